@@ -8,6 +8,7 @@
 #pragma once
 
 #include <memory>
+#include <stddef.h>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -16,6 +17,43 @@ namespace libcamera {
 
 class Object;
 
+namespace details {
+
+void *poolAllocate(size_t size);
+void poolFree(void *ptr, size_t size) noexcept;
+
+template<typename T>
+class PoolAllocator
+{
+public:
+	using value_type = T;
+
+	static_assert(alignof(T) <= alignof(max_align_t),
+		      "Over-aligned types can't be pool-allocated");
+
+	PoolAllocator() = default;
+
+	template<typename U>
+	PoolAllocator([[maybe_unused]] const PoolAllocator<U> &other) {}
+
+	T *allocate(size_t n)
+	{
+		return static_cast<T *>(poolAllocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, size_t n) noexcept
+	{
+		poolFree(ptr, n * sizeof(T));
+	}
+
+	template<typename U>
+	bool operator==([[maybe_unused]] const PoolAllocator<U> &other) const { return true; }
+	template<typename U>
+	bool operator!=([[maybe_unused]] const PoolAllocator<U> &other) const { return false; }
+};
+
+} /* namespace details */
+
 enum ConnectionType {
 	ConnectionTypeAuto,
 	ConnectionTypeDirect,
@@ -33,8 +71,9 @@ template<typename R, typename... Args>
 class BoundMethodPack : public BoundMethodPackBase
 {
 public:
-	BoundMethodPack(const Args &... args)
-		: args_(args...)
+	template<typename... Ts>
+	BoundMethodPack(Ts &&...args)
+		: args_(std::forward<Ts>(args)...)
 	{
 	}
 
@@ -51,8 +90,9 @@ template<typename... Args>
 class BoundMethodPack<void, Args...> : public BoundMethodPackBase
 {
 public:
-	BoundMethodPack(const Args &... args)
-		: args_(args...)
+	template<typename... Ts>
+	BoundMethodPack(Ts &&...args)
+		: args_(std::forward<Ts>(args)...)
 	{
 	}
 
@@ -72,6 +112,9 @@ public:
 	}
 	virtual ~BoundMethodBase() = default;
 
+	static void *operator new(size_t size) { return details::poolAllocate(size); }
+	static void operator delete(void *ptr, size_t size) { details::poolFree(ptr, size); }
+
 	template<typename T, std::enable_if_t<!std::is_same<Object, T>::value> * = nullptr>
 	bool match(T *obj) { return obj == obj_; }
 	bool match(Object *object) { return object == object_; }
@@ -103,7 +146,7 @@ private:
 	invokePack(BoundMethodPackBase *pack, std::index_sequence<I...>)
 	{
 		PackType *args = static_cast<PackType *>(pack);
-		args->ret_ = invoke(std::get<I>(args->args_)...);
+		args->ret_ = invoke(std::forward<Args>(std::get<I>(args->args_))...);
 	}
 
 	template<std::size_t... I, typename T = R>
@@ -112,7 +155,7 @@ private:
 	{
 		/* args is effectively unused when the sequence I is empty. */
 		PackType *args [[gnu::unused]] = static_cast<PackType *>(pack);
-		invoke(std::get<I>(args->args_)...);
+		invoke(std::forward<Args>(std::get<I>(args->args_))...);
 	}
 
 public:
@@ -143,16 +186,17 @@ public:
 	R activate(Args... args, bool deleteMethod = false) override
 	{
 		if (!this->object_)
-			return func_(args...);
+			return func_(std::forward<Args>(args)...);
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(details::PoolAllocator<PackType>(),
+							   std::forward<Args>(args)...);
 		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
 		return sync ? pack->returnValue() : R();
 	}
 
 	R invoke(Args... args) override
 	{
-		return func_(args...);
+		return func_(std::forward<Args>(args)...);
 	}
 
 private:
@@ -177,10 +221,11 @@ public:
 	{
 		if (!this->object_) {
 			T *obj = static_cast<T *>(this->obj_);
-			return (obj->*func_)(args...);
+			return (obj->*func_)(std::forward<Args>(args)...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(details::PoolAllocator<PackType>(),
+							   std::forward<Args>(args)...);
 		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
 		return sync ? pack->returnValue() : R();
 	}
@@ -188,7 +233,7 @@ public:
 	R invoke(Args... args) override
 	{
 		T *obj = static_cast<T *>(this->obj_);
-		return (obj->*func_)(args...);
+		return (obj->*func_)(std::forward<Args>(args)...);
 	}
 
 private:
@@ -209,7 +254,7 @@ public:
 
 	R activate(Args... args, [[maybe_unused]] bool deleteMethod = false) override
 	{
-		return (*func_)(args...);
+		return (*func_)(std::forward<Args>(args)...);
 	}
 
 	R invoke(Args...) override
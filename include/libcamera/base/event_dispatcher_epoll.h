@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Epoll-based event dispatcher
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/timer_queue.h>
+#include <libcamera/base/unique_fd.h>
+
+struct epoll_event;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		EventNotifier *notifiers[3];
+	};
+
+	void updateEvents(int fd, uint32_t oldEvents, uint32_t newEvents);
+	int wait(std::vector<struct epoll_event> *events);
+	void processInterrupt(const struct epoll_event &event);
+	void processNotifiers(unsigned int count);
+
+	std::unordered_map<int, EventNotifierSetEpoll> notifiers_;
+	TimerQueue timers_;
+	std::vector<struct epoll_event> events_;
+	UniqueFD epollfd_;
+	UniqueFD eventfd_;
+
+	bool processingEvents_;
+	bool pendingErase_;
+};
+
+} /* namespace libcamera */
@@ -7,13 +7,13 @@
 
 #pragma once
 
-#include <list>
 #include <map>
 #include <vector>
 
 #include <libcamera/base/private.h>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/timer_queue.h>
 #include <libcamera/base/unique_fd.h>
 
 struct pollfd;
@@ -47,10 +47,10 @@ private:
 	int poll(std::vector<struct pollfd> *pollfds);
 	void processInterrupt(const struct pollfd &pfd);
 	void processNotifiers(const std::vector<struct pollfd> &pollfds);
-	void processTimers();
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	TimerQueue timers_;
+	std::vector<struct pollfd> pollfds_;
 	UniqueFD eventfd_;
 
 	bool processingEvents_;
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Sorted associative container with inline storage
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <initializer_list>
+#include <stddef.h>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace libcamera {
+
+template<typename Key, typename T, std::size_t N = 4,
+	 typename Compare = std::less<Key>>
+class FlatMap
+{
+public:
+	static_assert(N > 0, "FlatMap<> inline capacity must not be zero");
+
+	using key_type = Key;
+	using mapped_type = T;
+	using value_type = std::pair<Key, T>;
+	using size_type = std::size_t;
+	using iterator = value_type *;
+	using const_iterator = const value_type *;
+
+	FlatMap()
+		: size_(0)
+	{
+	}
+
+	FlatMap(std::initializer_list<value_type> init)
+		: size_(0)
+	{
+		for (const value_type &value : init)
+			insert(value);
+	}
+
+	iterator begin() { return data(); }
+	const_iterator begin() const { return data(); }
+	const_iterator cbegin() const { return data(); }
+	iterator end() { return data() + size_; }
+	const_iterator end() const { return data() + size_; }
+	const_iterator cend() const { return data() + size_; }
+
+	bool empty() const { return size_ == 0; }
+	size_type size() const { return size_; }
+
+	void clear()
+	{
+		size_ = 0;
+		heap_.clear();
+	}
+
+	iterator find(const Key &key)
+	{
+		iterator it = lowerBound(key);
+		return it != end() && !comp_(key, it->first) ? it : end();
+	}
+
+	const_iterator find(const Key &key) const
+	{
+		return const_cast<FlatMap *>(this)->find(key);
+	}
+
+	size_type count(const Key &key) const
+	{
+		return find(key) != end() ? 1 : 0;
+	}
+
+	T &at(const Key &key)
+	{
+		iterator it = find(key);
+		if (it == end())
+			throw std::out_of_range("FlatMap::at");
+		return it->second;
+	}
+
+	const T &at(const Key &key) const
+	{
+		return const_cast<FlatMap *>(this)->at(key);
+	}
+
+	T &operator[](const Key &key)
+	{
+		return insert(value_type(key, T{})).first->second;
+	}
+
+	std::pair<iterator, bool> insert(const value_type &value)
+	{
+		iterator it = lowerBound(value.first);
+		if (it != end() && !comp_(value.first, it->first))
+			return { it, false };
+
+		return { insertAt(it - begin(), value), true };
+	}
+
+	template<typename... Args>
+	std::pair<iterator, bool> emplace(Args &&...args)
+	{
+		return insert(value_type(std::forward<Args>(args)...));
+	}
+
+	iterator erase(const_iterator pos)
+	{
+		size_type index = pos - begin();
+
+		if (!heap_.empty()) {
+			heap_.erase(heap_.begin() + index);
+		} else {
+			std::move(inline_.begin() + index + 1,
+				  inline_.begin() + size_,
+				  inline_.begin() + index);
+		}
+
+		size_--;
+		return begin() + index;
+	}
+
+	size_type erase(const Key &key)
+	{
+		const_iterator it = find(key);
+		if (it == end())
+			return 0;
+
+		erase(it);
+		return 1;
+	}
+
+private:
+	value_type *data()
+	{
+		return heap_.empty() ? inline_.data() : heap_.data();
+	}
+
+	const value_type *data() const
+	{
+		return heap_.empty() ? inline_.data() : heap_.data();
+	}
+
+	iterator lowerBound(const Key &key)
+	{
+		return std::lower_bound(begin(), end(), key,
+					[this](const value_type &value, const Key &k) {
+						return comp_(value.first, k);
+					});
+	}
+
+	iterator insertAt(size_type index, const value_type &value)
+	{
+		if (heap_.empty() && size_ == N)
+			heap_.assign(inline_.begin(), inline_.end());
+
+		if (!heap_.empty()) {
+			heap_.insert(heap_.begin() + index, value);
+		} else {
+			std::move_backward(inline_.begin() + index,
+					   inline_.begin() + size_,
+					   inline_.begin() + size_ + 1);
+			inline_[index] = value;
+		}
+
+		size_++;
+		return begin() + index;
+	}
+
+	std::array<value_type, N> inline_;
+	std::vector<value_type> heap_;
+	size_type size_;
+	Compare comp_;
+};
+
+} /* namespace libcamera */
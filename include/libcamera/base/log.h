@@ -34,6 +34,7 @@ public:
 	const std::string &name() const { return name_; }
 	LogSeverity severity() const { return severity_; }
 	void setSeverity(LogSeverity severity);
+	bool isEnabled(LogSeverity severity) const { return severity >= severity_; }
 
 	static const LogCategory &defaultCategory();
 
@@ -104,13 +105,96 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
 		const char *fileName = __builtin_FILE(),
 		unsigned int line = __builtin_LINE());
 
+class LogRateLimiter
+{
+public:
+	LogRateLimiter(unsigned int burst = 10,
+		       std::chrono::milliseconds interval = std::chrono::seconds(5));
+
+	int allow();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(LogRateLimiter)
+
+	const double burst_;
+	const std::chrono::duration<double> interval_;
+
+	double tokens_;
+	utils::time_point last_;
+	unsigned int suppressed_;
+};
+
 #ifndef __DOXYGEN__
+#ifndef LIBCAMERA_LOG_MIN_SEVERITY
+#define LIBCAMERA_LOG_MIN_SEVERITY 0
+#endif
+
+constexpr bool _logCompiled(LogSeverity severity)
+{
+	return severity == LogFatal || severity >= LIBCAMERA_LOG_MIN_SEVERITY;
+}
+
+class LogVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
 #define _LOG_CATEGORY(name) logCategory##name
 
-#define _LOG1(severity) \
-	_log(nullptr, Log##severity).stream()
-#define _LOG2(category, severity) \
-	_log(&_LOG_CATEGORY(category)(), Log##severity).stream()
+/*
+ * Append the number of messages suppressed by a LogRateLimiter to a message.
+ * The instance is created after the LogMessage it wraps, and is thus destroyed
+ * before the message is written.
+ */
+class LogSuppressedCount
+{
+public:
+	LogSuppressedCount(LogMessage &&msg, int suppressed)
+		: msg_(msg), suppressed_(suppressed)
+	{
+	}
+
+	~LogSuppressedCount()
+	{
+		if (suppressed_)
+			msg_.stream() << " (" << suppressed_
+				      << " similar messages suppressed)";
+	}
+
+	std::ostream &stream() { return msg_.stream(); }
+
+private:
+	LogMessage &msg_;
+	int suppressed_;
+};
+
+/*
+ * Check the severity before creating the LogMessage, to skip formatting of
+ * disabled messages. Severities below the compiled-in minimum are constant
+ * false and get optimized out. Fatal messages are never skipped, as they abort
+ * the process.
+ *
+ * This is a function and not a macro to allow qualifying the LOG() macro with
+ * the libcamera namespace.
+ */
+inline bool _logDisabled(const LogCategory &category, LogSeverity severity)
+{
+	if (!_logCompiled(severity))
+		return true;
+
+	return severity != LogFatal && !category.isEnabled(severity);
+}
+
+#define _LOG1(severity)							\
+	_logDisabled(LogCategory::defaultCategory(), Log##severity)	\
+		? (void)0						\
+		: LogVoidify() & _log(nullptr, Log##severity).stream()
+#define _LOG2(category, severity)					\
+	_logDisabled(_LOG_CATEGORY(category)(), Log##severity)		\
+		? (void)0						\
+		: LogVoidify() &					\
+		  _log(&_LOG_CATEGORY(category)(), Log##severity).stream()
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
@@ -118,8 +202,36 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  */
 #define _LOG_MACRO(_1, _2, NAME, ...) NAME
 #define LOG(...) _LOG_MACRO(__VA_ARGS__, _LOG2, _LOG1)(__VA_ARGS__)
+
+/*
+ * The lambda gives each call site its own rate limiter instance. The rate
+ * limiter is only consulted when the message is enabled, to avoid consuming
+ * tokens for messages that are not printed. The loop body runs at most once,
+ * a for statement is used instead of an if statement to avoid dangling else
+ * issues.
+ */
+#define _LOG_LIMITED(category, severity, ...)				\
+	for (int _logSuppressed =					\
+		_logDisabled(_LOG_CATEGORY(category)(), Log##severity)	\
+			? -1						\
+			: []() -> LogRateLimiter & {			\
+				static LogRateLimiter limiter{ __VA_ARGS__ }; \
+				return limiter;				\
+			}().allow();					\
+	     _logSuppressed >= 0; _logSuppressed = -1)			\
+		LogVoidify() &						\
+		LogSuppressedCount(_log(&_LOG_CATEGORY(category)(),	\
+					Log##severity),			\
+				   _logSuppressed).stream()
+
+#define LOG_RATELIMITED(category, severity)				\
+	_LOG_LIMITED(category, severity)
+#define LOG_ONCE(category, severity)					\
+	_LOG_LIMITED(category, severity, 1, std::chrono::milliseconds(0))
 #else /* __DOXYGEN___ */
 #define LOG(category, severity)
+#define LOG_RATELIMITED(category, severity)
+#define LOG_ONCE(category, severity)
 #endif /* __DOXYGEN__ */
 
 #ifndef NDEBUG
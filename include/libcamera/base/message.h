@@ -8,14 +8,17 @@
 #pragma once
 
 #include <atomic>
+#include <stddef.h>
 
 #include <libcamera/base/private.h>
 
 #include <libcamera/base/bound_method.h>
+#include <libcamera/base/utils.h>
 
 namespace libcamera {
 
 class BoundMethodBase;
+class MessageQueue;
 class Object;
 class Semaphore;
 class Thread;
@@ -34,16 +37,23 @@ public:
 	Message(Type type);
 	virtual ~Message();
 
+	static void *operator new(size_t size) { return details::poolAllocate(size); }
+	static void operator delete(void *ptr, size_t size) { details::poolFree(ptr, size); }
+
 	Type type() const { return type_; }
 	Object *receiver() const { return receiver_; }
+	utils::time_point postTime() const { return postTime_; }
 
 	static Type registerMessageType();
 
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
+	utils::time_point postTime_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
@@ -38,7 +39,7 @@ public:
 	{
 		T *obj = static_cast<T *>(this);
 		auto *method = new BoundMethodMember<T, R, FuncArgs...>(obj, this, func, type);
-		return method->activate(args..., true);
+		return method->activate(std::forward<Args>(args)..., true);
 	}
 
 	Thread *thread() const { return thread_; }
@@ -65,7 +66,7 @@ private:
 
 	Thread *thread_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
 };
 
 } /* namespace libcamera */
@@ -7,8 +7,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
-#include <list>
+#include <memory>
 #include <type_traits>
 #include <vector>
 
@@ -18,21 +19,45 @@ namespace libcamera {
 
 class Object;
 
+namespace details {
+
+struct SignalSlot {
+	SignalSlot(BoundMethodBase *m)
+		: method(m), connected(true)
+	{
+	}
+
+	std::unique_ptr<BoundMethodBase> method;
+	std::atomic<bool> connected;
+};
+
+struct SignalSlotArray {
+	std::atomic<unsigned int> refs;
+	std::vector<std::shared_ptr<SignalSlot>> slots;
+};
+
+} /* namespace details */
+
 class SignalBase
 {
 public:
 	void disconnect(Object *object);
 
 protected:
-	using SlotList = std::list<BoundMethodBase *>;
+	SignalBase();
+	~SignalBase();
 
 	void connect(BoundMethodBase *slot);
-	void disconnect(std::function<bool(SlotList::iterator &)> match);
+	void disconnect(std::function<bool(BoundMethodBase *)> match);
 
-	SlotList slots();
+	details::SignalSlotArray *acquireSlots();
+	static void releaseSlots(details::SignalSlotArray *slots);
 
 private:
-	SlotList slots_;
+	void replaceSlots(details::SignalSlotArray *slots);
+
+	std::atomic<details::SignalSlotArray *> slots_;
+	std::atomic<unsigned int> acquiring_;
 };
 
 template<typename... Args>
@@ -97,7 +122,7 @@ public:
 
 	void disconnect()
 	{
-		SignalBase::disconnect([]([[maybe_unused]] SlotList::iterator &iter) {
+		SignalBase::disconnect([]([[maybe_unused]] BoundMethodBase *slot) {
 			return true;
 		});
 	}
@@ -105,17 +130,17 @@ public:
 	template<typename T>
 	void disconnect(T *obj)
 	{
-		SignalBase::disconnect([obj](SlotList::iterator &iter) {
-			return (*iter)->match(obj);
+		SignalBase::disconnect([obj](BoundMethodBase *slot) {
+			return slot->match(obj);
 		});
 	}
 
 	template<typename T, typename R>
 	void disconnect(T *obj, R (T::*func)(Args...))
 	{
-		SignalBase::disconnect([obj, func](SlotList::iterator &iter) {
+		SignalBase::disconnect([obj, func](BoundMethodBase *base) {
 			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
+				static_cast<BoundMethodArgs<R, Args...> *>(base);
 
 			if (!slot->match(obj))
 				return false;
@@ -133,9 +158,9 @@ public:
 	template<typename R>
 	void disconnect(R (*func)(Args...))
 	{
-		SignalBase::disconnect([func](SlotList::iterator &iter) {
+		SignalBase::disconnect([func](BoundMethodBase *base) {
 			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
+				static_cast<BoundMethodArgs<R, Args...> *>(base);
 
 			if (!slot->match(nullptr))
 				return false;
@@ -147,11 +172,23 @@ public:
 	void emit(Args... args)
 	{
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * Hold a reference to the current slots array, as slots could
+		 * connect or disconnect slots, or even delete the signal.
+		 * Slots disconnected during emission are skipped.
 		 */
-		for (BoundMethodBase *slot : slots())
-			static_cast<BoundMethodArgs<void, Args...> *>(slot)->activate(args...);
+		details::SignalSlotArray *slots = acquireSlots();
+		if (!slots)
+			return;
+
+		for (const auto &slot : slots->slots) {
+			if (!slot->connected.load(std::memory_order_acquire))
+				continue;
+
+			static_cast<BoundMethodArgs<void, Args...> *>(slot->method.get())
+				->activate(args...);
+		}
+
+		releaseSlots(slots);
 	}
 };
 
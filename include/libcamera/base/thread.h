@@ -8,13 +8,17 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 #include <libcamera/base/private.h>
 
 #include <libcamera/base/message.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/thread_statistics.h>
 #include <libcamera/base/utils.h>
 
 namespace libcamera {
@@ -28,15 +32,36 @@ class ThreadMain;
 class Thread
 {
 public:
-	Thread();
+	enum class SchedulingPolicy {
+		Other,
+		Fifo,
+		RoundRobin,
+	};
+
+	Thread(const std::string &name = {});
 	virtual ~Thread();
 
+	const std::string &name() const { return name_; }
+
 	void start();
 	void exit(int code = 0);
 	bool wait(utils::duration duration = utils::duration::max());
 
 	bool isRunning();
 
+	int setAffinity(Span<const unsigned int> cpus);
+	int setPriority(SchedulingPolicy policy, int priority = 0);
+
+	static void setDefaultAffinity(const std::string &name,
+				       Span<const unsigned int> cpus);
+	static void setDefaultPriority(const std::string &name,
+				       SchedulingPolicy policy, int priority = 0);
+	static void configureCurrent(const std::string &name);
+
+	void setStatisticsEnabled(bool enable);
+	ThreadStatistics statistics() const;
+	void resetStatistics();
+
 	Signal<> finished;
 
 	static Thread *current();
@@ -63,8 +88,9 @@ private:
 
 	void moveObject(Object *object);
 	void moveObject(Object *object, ThreadData *currentData,
-			ThreadData *targetData);
+			std::vector<std::unique_ptr<Message>> *messages);
 
+	const std::string name_;
 	std::thread thread_;
 	ThreadData *data_;
 };
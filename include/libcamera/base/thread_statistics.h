@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Thread event loop instrumentation
+ */
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <typeinfo>
+#include <typeindex>
+#include <vector>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/utils.h>
+
+namespace libcamera {
+
+class Message;
+class Object;
+class Thread;
+
+struct ThreadStatistics {
+	static constexpr unsigned int kHistogramBins = 20;
+	using Histogram = std::array<uint64_t, kHistogramBins>;
+
+	struct Handler {
+		std::string name;
+		uint64_t count;
+		utils::Duration totalTime;
+		utils::Duration maxTime;
+	};
+
+	static unsigned int histogramBin(utils::Duration duration);
+
+	utils::Duration elapsed;
+	utils::Duration idleTime;
+
+	uint64_t messages;
+	unsigned int maxQueueDepth;
+	utils::Duration maxLatency;
+	Histogram latency;
+
+	uint64_t events;
+	Histogram runTime;
+
+	std::vector<Handler> handlers;
+};
+
+struct ThreadTraceEvent {
+	enum class Type {
+		Message,
+		EventNotifier,
+		Timer,
+	};
+
+	const Thread *thread;
+	Type type;
+	const char *handler;
+	int fd;
+	unsigned int queueDepth;
+	utils::Duration latency;
+	utils::Duration runTime;
+};
+
+using ThreadTraceHook = void (*)(const ThreadTraceEvent &event);
+
+class ThreadStatisticsRecorder
+{
+public:
+	ThreadStatisticsRecorder(const Thread *thread);
+
+	static ThreadStatisticsRecorder *current();
+	static void setTraceHook(ThreadTraceHook hook);
+
+	static const std::type_info &handlerType(const Object *object);
+
+	void recordQueueDepth(unsigned int depth);
+	void recordMessage(const Message *message, const std::type_info &handler,
+			   utils::time_point start, utils::time_point end);
+	void recordNotifier(int fd, const std::type_info &handler,
+			    utils::time_point start, utils::time_point end);
+	void recordTimer(const std::type_info &handler, utils::time_point start,
+			 utils::time_point end);
+	void recordIdle(utils::Duration duration);
+
+	ThreadStatistics statistics() const;
+	void reset();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(ThreadStatisticsRecorder)
+
+	struct HandlerData {
+		uint64_t count = 0;
+		utils::Duration totalTime{};
+		utils::Duration maxTime{};
+	};
+
+	void record(ThreadTraceEvent::Type type, const std::type_info &handler,
+		    int fd, utils::Duration latency, utils::Duration runTime)
+		LIBCAMERA_TSA_REQUIRES(mutex_);
+
+	const Thread *thread_;
+
+	mutable Mutex mutex_;
+	utils::time_point start_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	unsigned int queueDepth_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	ThreadStatistics stats_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::map<std::type_index, HandlerData> handlers_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+} /* namespace libcamera */
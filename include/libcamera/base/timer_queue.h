@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Timer scheduling queue for event dispatchers
+ */
+
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/unique_fd.h>
+
+namespace libcamera {
+
+class Timer;
+
+class TimerQueue
+{
+public:
+	TimerQueue(bool useTimerfd = false);
+	~TimerQueue();
+
+	bool empty() const { return heap_.empty(); }
+	int fd() const { return timerfd_.get(); }
+
+	void insert(Timer *timer);
+	void remove(Timer *timer);
+
+	Timer *next() const;
+
+	void acknowledge();
+	void expire(std::chrono::steady_clock::time_point now);
+
+private:
+	struct Entry {
+		std::chrono::steady_clock::time_point deadline;
+		Timer *timer;
+	};
+
+	void swap(size_t a, size_t b);
+	void siftUp(size_t index);
+	void siftDown(size_t index);
+	void removeAt(size_t index);
+	void arm();
+
+	std::vector<Entry> heap_;
+	std::unordered_map<Timer *, size_t> index_;
+
+	UniqueFD timerfd_;
+	std::chrono::steady_clock::time_point armed_;
+};
+
+} /* namespace libcamera */
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <initializer_list>
+#include <map>
 #include <memory>
 #include <optional>
 #include <set>
@@ -65,6 +66,12 @@ public:
 		Invalid,
 	};
 
+	enum class BufferHint {
+		Balanced,
+		MinimalMemory,
+		MaxThroughput,
+	};
+
 	using iterator = std::vector<StreamConfiguration>::iterator;
 	using const_iterator = std::vector<StreamConfiguration>::const_iterator;
 
@@ -94,6 +101,7 @@ public:
 
 	std::optional<SensorConfiguration> sensorConfig;
 	Orientation orientation;
+	BufferHint bufferHint;
 
 protected:
 	CameraConfiguration();
@@ -106,6 +114,7 @@ protected:
 	using ColorSpaceFlags = Flags<ColorSpaceFlag>;
 
 	Status validateColorSpaces(ColorSpaceFlags flags = ColorSpaceFlag::None);
+	unsigned int bufferCount(unsigned int minimum, unsigned int preferred) const;
 
 	std::vector<StreamConfiguration> config_;
 };
@@ -148,8 +157,12 @@ public:
 	std::unique_ptr<Request> createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
 
+	int prepare();
 	int start(const ControlList *controls = nullptr);
 	int stop();
+	int flush();
+
+	std::map<std::string, uint64_t> counters() const;
 
 private:
 	LIBCAMERA_DISABLE_COPY(Camera)
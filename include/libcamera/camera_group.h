@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Synchronized capture from a group of cameras
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class ControlList;
+class Request;
+
+class CameraGroup : public Extensible
+{
+	LIBCAMERA_DECLARE_PRIVATE()
+
+public:
+	~CameraGroup();
+
+	const std::vector<std::shared_ptr<Camera>> &cameras() const;
+
+	void setMaxSkew(int64_t maxSkew);
+	int64_t maxSkew() const;
+
+	int start(const ControlList *controls = nullptr);
+	int stop();
+
+	int queueRequests(const std::vector<Request *> &requests,
+			  const ControlList *controls = nullptr);
+
+	Signal<const std::vector<Request *> &, int64_t> requestsCompleted;
+	Signal<Request *> requestUnmatched;
+
+private:
+	LIBCAMERA_DISABLE_COPY(CameraGroup)
+
+	friend class CameraManager;
+
+	CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras);
+};
+
+} /* namespace libcamera */
@@ -19,6 +19,7 @@
 namespace libcamera {
 
 class Camera;
+class CameraGroup;
 
 class CameraManager : public Object, public Extensible
 {
@@ -33,6 +34,9 @@ public:
 	std::vector<std::shared_ptr<Camera>> cameras() const;
 	std::shared_ptr<Camera> get(const std::string &id);
 
+	std::unique_ptr<CameraGroup>
+	createGroup(const std::vector<std::shared_ptr<Camera>> &cameras);
+
 	static const std::string &version() { return version_; }
 
 	Signal<std::shared_ptr<Camera>> cameraAdded;
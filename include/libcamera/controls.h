@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
 #include <optional>
 #include <set>
@@ -126,7 +127,9 @@ public:
 	~ControlValue();
 
 	ControlValue(const ControlValue &other);
+	ControlValue(ControlValue &&other) noexcept;
 	ControlValue &operator=(const ControlValue &other);
+	ControlValue &operator=(ControlValue &&other) noexcept;
 
 	ControlType type() const { return type_; }
 	bool isNone() const { return type_ == ControlTypeNone; }
@@ -200,8 +203,13 @@ private:
 	ControlType type_ : 8;
 	bool isArray_;
 	std::size_t numElements_ : 32;
+
+	/*
+	 * Values of up to 40 bytes, which includes 3x3 float matrices, are
+	 * stored inline to avoid allocating memory for common array values.
+	 */
 	union {
-		uint64_t value_;
+		uint64_t value_[5];
 		void *storage_;
 	};
 
@@ -349,7 +357,7 @@ private:
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<unsigned int, ControlValue>;
+	using ControlListMap = std::vector<std::pair<unsigned int, ControlValue>>;
 
 public:
 	enum class MergePolicy {
@@ -361,6 +369,11 @@ public:
 	ControlList(const ControlIdMap &idmap, const ControlValidator *validator = nullptr);
 	ControlList(const ControlInfoMap &infoMap, const ControlValidator *validator = nullptr);
 
+	ControlList(const ControlList &other);
+	ControlList(ControlList &&other) = default;
+	ControlList &operator=(const ControlList &other);
+	ControlList &operator=(ControlList &&other) = default;
+
 	using iterator = ControlListMap::iterator;
 	using const_iterator = ControlListMap::const_iterator;
 
@@ -372,7 +385,8 @@ public:
 	bool empty() const { return controls_.empty(); }
 	std::size_t size() const { return controls_.size(); }
 
-	void clear() { controls_.clear(); }
+	void reserve(std::size_t size);
+	void clear();
 	void merge(const ControlList &source, MergePolicy policy = MergePolicy::KeepExisting);
 
 	bool contains(unsigned int id) const;
@@ -380,7 +394,7 @@ public:
 	template<typename T>
 	std::optional<T> get(const Control<T> &ctrl) const
 	{
-		const auto entry = controls_.find(ctrl.id());
+		const auto entry = lookup(ctrl.id());
 		if (entry == controls_.end())
 			return std::nullopt;
 
@@ -415,14 +429,30 @@ public:
 	const ControlIdMap *idMap() const { return idmap_; }
 
 private:
+	ControlListMap::const_iterator lookup(unsigned int id) const
+	{
+		auto iter = std::lower_bound(controls_.begin(), controls_.end(), id,
+					     [](const auto &entry, unsigned int key) {
+						     return entry.first < key;
+					     });
+		if (iter == controls_.end() || iter->first != id)
+			return controls_.end();
+
+		return iter;
+	}
+
 	const ControlValue *find(unsigned int id) const;
 	ControlValue *find(unsigned int id);
+	bool validate(unsigned int id) const;
+	bool validated() const;
 
 	const ControlValidator *validator_;
+	unsigned int generation_;
 	const ControlIdMap *idmap_;
 	const ControlInfoMap *infoMap_;
 
 	ControlListMap controls_;
+	ControlListMap spares_;
 };
 
 } /* namespace libcamera */
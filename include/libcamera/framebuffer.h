@@ -70,6 +70,7 @@ public:
 	void setCookie(uint64_t cookie);
 
 	std::unique_ptr<Fence> releaseFence();
+	std::unique_ptr<Fence> exportFence() const;
 
 private:
 	LIBCAMERA_DISABLE_COPY_AND_MOVE(FrameBuffer)
@@ -9,17 +9,23 @@
 
 #include <atomic>
 #include <list>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/thread_annotations.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
 
 namespace libcamera {
 
 class CameraControlValidator;
+class FrameBuffer;
 class PipelineHandler;
 class Stream;
 
@@ -34,11 +40,45 @@ public:
 	PipelineHandler *pipe() { return pipe_.get(); }
 
 	std::list<Request *> queuedRequests_;
+
+	Mutex pendingRequestsMutex_;
+	std::vector<Request *> pendingRequests_ LIBCAMERA_TSA_GUARDED_BY(pendingRequestsMutex_);
+	std::vector<Request *> submittingRequests_;
+	unsigned int deliveryDepth_;
+
 	ControlInfoMap controlInfo_;
 	ControlList properties_;
 
 	uint32_t requestSequence_;
 
+	struct Counters {
+		uint64_t requestsQueued;
+		uint64_t requestsCompleted;
+		uint64_t requestsCancelled;
+		uint64_t framesDropped;
+		unsigned int maxQueueDepth;
+	};
+
+	Counters counters_;
+	std::map<const Stream *, uint32_t> lastSequence_;
+
+	struct BufferUsage {
+		unsigned int index;
+		utils::time_point lastDelivery;
+		uint64_t intervalSum;
+		uint64_t intervals;
+		uint64_t latencySum;
+		uint64_t latencies;
+		uint64_t holdTimeSum;
+		uint64_t holdTimes;
+	};
+
+	std::map<const Stream *, BufferUsage> bufferUsage_;
+	std::map<const FrameBuffer *, utils::time_point> deliveredBuffers_;
+
+	void bufferQueued(const Stream *stream, const FrameBuffer *buffer);
+	void bufferDelivered(const Stream *stream, const FrameBuffer *buffer);
+
 	const CameraControlValidator *validator() const { return validator_.get(); }
 
 private:
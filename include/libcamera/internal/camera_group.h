@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Camera group private data
+ */
+
+#pragma once
+
+#include <libcamera/camera_group.h>
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/thread_annotations.h>
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+class CameraGroup::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(CameraGroup)
+
+public:
+	Private(const std::vector<std::shared_ptr<Camera>> &cameras);
+
+	void requestComplete(unsigned int index, Request *request)
+		LIBCAMERA_TSA_EXCLUDES(mutex_);
+	void flush() LIBCAMERA_TSA_EXCLUDES(mutex_);
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	int64_t maxSkew_;
+
+private:
+	struct RequestSet {
+		std::vector<Request *> requests;
+		int64_t skew;
+	};
+
+	static int64_t timestamp(Request *request);
+	static int64_t frameDuration(Request *request);
+
+	void match(std::vector<RequestSet> *sets, std::vector<Request *> *unmatched)
+		LIBCAMERA_TSA_REQUIRES(mutex_);
+
+	Mutex mutex_;
+	std::vector<std::deque<Request *>> completed_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+} /* namespace libcamera */
@@ -11,6 +11,8 @@
 
 #include <map>
 #include <memory>
+#include <set>
+#include <string>
 #include <sys/types.h>
 #include <vector>
 
@@ -26,6 +28,7 @@ namespace libcamera {
 
 class Camera;
 class DeviceEnumerator;
+class MediaDevice;
 
 class CameraManager::Private : public Extensible::Private, public Thread
 {
@@ -43,8 +46,10 @@ protected:
 
 private:
 	int init();
-	void createPipelineHandlers();
-	void pipelineFactoryMatch(const PipelineHandlerFactoryBase *factory);
+	void loadThreadConfiguration();
+	void createPipelineHandlers(MediaDevice *added = nullptr);
+	void pipelineFactoryMatch(const PipelineHandlerFactoryBase *factory,
+				  MediaDevice *added);
 	void cleanup() LIBCAMERA_TSA_EXCLUDES(mutex_);
 
 	/*
@@ -61,6 +66,10 @@ private:
 	int status_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
 
 	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::map<const PipelineHandlerFactoryBase *, std::set<std::string>> unmatchedDrivers_;
+
+	bool pipelineThreads_;
+	std::vector<std::unique_ptr<Thread>> threads_;
 
 	IPAManager ipaManager_;
 	ProcessManager processManager_;
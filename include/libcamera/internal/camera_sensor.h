@@ -7,12 +7,16 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/thread_annotations.h>
 
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
@@ -87,6 +91,18 @@ protected:
 private:
 	LIBCAMERA_DISABLE_COPY(CameraSensor)
 
+	/* A sensor output size, with the format selection criteria */
+	struct Mode {
+		Size size;
+		float ratio;
+		unsigned int area;
+	};
+
+	/* Maximum number of memoized getFormat() results */
+	static constexpr std::size_t kFormatCacheSize = 256;
+
+	V4L2SubdeviceFormat selectFormat(const std::vector<unsigned int> &mbusCodes,
+					 const Size &size) const;
 	int generateId();
 	int validateSensorDriver();
 	void initVimcDefaultProperties();
@@ -108,6 +124,8 @@ private:
 	V4L2Subdevice::Formats formats_;
 	std::vector<unsigned int> mbusCodes_;
 	std::vector<Size> sizes_;
+	/* Output sizes by media bus code, sorted by increasing area */
+	std::map<unsigned int, std::vector<Mode>> modes_;
 	std::vector<controls::draft::TestPatternModeEnum> testPatternModes_;
 	controls::draft::TestPatternModeEnum testPatternMode_;
 
@@ -121,6 +139,10 @@ private:
 	ControlList properties_;
 
 	std::unique_ptr<CameraLens> focusLens_;
+
+	mutable Mutex formatCacheMutex_;
+	mutable std::map<std::pair<std::vector<unsigned int>, Size>, V4L2SubdeviceFormat>
+		formatCache_ LIBCAMERA_TSA_GUARDED_BY(formatCacheMutex_);
 };
 
 } /* namespace libcamera */
@@ -29,7 +29,7 @@ public:
 
 	void reset();
 
-	static size_t binarySize(const ControlInfoMap &infoMap);
+	size_t binarySize(const ControlInfoMap &infoMap) const;
 	static size_t binarySize(const ControlList &list);
 
 	int serialize(const ControlInfoMap &infoMap, ByteStreamBuffer &buffer);
@@ -38,7 +38,7 @@ public:
 	template<typename T>
 	T deserialize(ByteStreamBuffer &buffer);
 
-	bool isCached(const ControlInfoMap &infoMap);
+	bool isCached(const ControlInfoMap &infoMap) const;
 
 private:
 	static size_t binarySize(const ControlValue &value);
@@ -47,8 +47,7 @@ private:
 	static void store(const ControlValue &value, ByteStreamBuffer &buffer);
 	static void store(const ControlInfo &info, ByteStreamBuffer &buffer);
 
-	ControlValue loadControlValue(ByteStreamBuffer &buffer,
-				      bool isArray = false, unsigned int count = 1);
+	ControlValue loadControlValue(ByteStreamBuffer &buffer);
 	ControlInfo loadControlInfo(ByteStreamBuffer &buffer);
 
 	unsigned int serial_;
@@ -57,6 +56,7 @@ private:
 	std::vector<std::unique_ptr<ControlIdMap>> controlIdMaps_;
 	std::map<unsigned int, ControlInfoMap> infoMaps_;
 	std::map<const ControlInfoMap *, unsigned int> infoMapHandles_;
+	std::map<unsigned int, const ControlInfoMap *> handleInfoMaps_;
 };
 
 } /* namespace libcamera */
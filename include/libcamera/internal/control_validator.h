@@ -16,10 +16,21 @@ class ControlId;
 class ControlValidator
 {
 public:
+	ControlValidator()
+		: generation_(0)
+	{
+	}
+
 	virtual ~ControlValidator() = default;
 
 	virtual const std::string &name() const = 0;
 	virtual bool validate(unsigned int id) const = 0;
+
+	unsigned int generation() const { return generation_; }
+	void invalidate() { generation_++; }
+
+private:
+	unsigned int generation_;
 };
 
 } /* namespace libcamera */
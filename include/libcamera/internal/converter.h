@@ -10,13 +10,13 @@
 
 #include <functional>
 #include <initializer_list>
-#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/flat_map.h>
 #include <libcamera/base/signal.h>
 
 #include <libcamera/geometry.h>
@@ -31,6 +31,8 @@ struct StreamConfiguration;
 class Converter
 {
 public:
+	using OutputBuffers = FlatMap<unsigned int, FrameBuffer *>;
+
 	Converter(MediaDevice *media);
 	virtual ~Converter();
 
@@ -53,7 +55,7 @@ public:
 	virtual void stop() = 0;
 
 	virtual int queueBuffers(FrameBuffer *input,
-				 const std::map<unsigned int, FrameBuffer *> &outputs) = 0;
+				 const OutputBuffers &outputs) = 0;
 
 	Signal<FrameBuffer *> inputBufferReady;
 	Signal<FrameBuffer *> outputBufferReady;
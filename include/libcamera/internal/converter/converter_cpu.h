@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * CPU based format converter
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/semaphore.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_annotations.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/converter.h"
+#include "libcamera/internal/dma_buf_allocator.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+struct StreamConfiguration;
+
+class CpuConverter : public Converter, public Object
+{
+public:
+	static constexpr unsigned int kMaxOutputs = 2;
+
+	CpuConverter();
+	~CpuConverter();
+
+	int loadConfiguration([[maybe_unused]] const std::string &filename) { return 0; }
+	bool isValid() const { return dmaBufAllocator_.isValid(); }
+
+	std::vector<PixelFormat> formats(PixelFormat input);
+	SizeRange sizes(const Size &input);
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size);
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs);
+	int exportBuffers(unsigned int output, unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
+	int start();
+	void stop();
+
+	int queueBuffers(FrameBuffer *input,
+			 const OutputBuffers &outputs);
+
+private:
+	class Processor;
+	class StripeWorker;
+
+	struct Kernels;
+	struct YuvFormat;
+	struct RgbFormat;
+
+	/* Bilinear interpolation step: source index and weight of the next pixel */
+	struct ScaleStep {
+		unsigned int index;
+		unsigned int weight;
+	};
+
+	/* A line of YUV 4:2:2 planar data */
+	struct Line {
+		const uint8_t *y;
+		const uint8_t *u;
+		const uint8_t *v;
+	};
+
+	/* An unpacked input line cached by a stripe */
+	struct LineBuffer {
+		int index;
+		Line line;
+		std::vector<uint8_t> y;
+		std::vector<uint8_t> u;
+		std::vector<uint8_t> v;
+		std::vector<uint8_t> packed;
+	};
+
+	/* A range of output lines processed by a single thread */
+	struct Stripe {
+		unsigned int begin;
+		unsigned int end;
+
+		LineBuffer lines[2];
+		std::vector<uint8_t> blended[3];
+		std::vector<uint8_t> scaled[3];
+		std::vector<uint8_t> scratch[3];
+	};
+
+	struct Output {
+		PixelFormat pixelFormat;
+		Size size;
+		unsigned int stride;
+		unsigned int frameSize;
+		std::vector<unsigned int> planeSizes;
+
+		const YuvFormat *yuv;
+		const RgbFormat *rgb;
+
+		std::vector<ScaleStep> lineSteps;
+		std::vector<ScaleStep> lumaSteps;
+		std::vector<ScaleStep> chromaSteps;
+
+		std::vector<Stripe> stripes;
+	};
+
+	/* The planes of the frame buffers being processed */
+	struct Frame {
+		const uint8_t *input[2];
+		uint8_t *output[2];
+	};
+
+	static const Kernels *selectKernels();
+	static Span<const YuvFormat> yuvFormats();
+	static Span<const RgbFormat> rgbFormats();
+	static const YuvFormat *yuvFormat(const PixelFormat &format);
+	static const RgbFormat *rgbFormat(const PixelFormat &format);
+	static std::vector<ScaleStep> scaleSteps(unsigned int input, unsigned int output);
+
+	int configureOutput(Output *output, const StreamConfiguration &cfg);
+
+	void processFrame(FrameBuffer *input, const OutputBuffers &outputs);
+	void processStripe(const Output &output, Stripe &stripe, const Frame &frame);
+
+	const Line &unpackLine(Stripe &stripe, const Frame &frame, int index, int keep);
+	Line blendLines(Stripe &stripe, const Line &line0, const Line &line1,
+			unsigned int weight, bool chroma);
+	Line scaleLine(const Output &output, Stripe &stripe, const Line &line,
+		       bool chroma);
+	void packLine(const Output &output, Stripe &stripe, const Frame &frame,
+		      unsigned int y, const Line &line);
+
+	void frameDone();
+
+	const Kernels *kernels_;
+	DmaBufAllocator dmaBufAllocator_;
+
+	const YuvFormat *inputFormat_;
+	Size inputSize_;
+	unsigned int inputStride_;
+	unsigned int inputFrameSize_;
+	/* Fixed-point YCbCr to RGB conversion coefficients */
+	std::array<int16_t, 6> rgbCoefficients_;
+
+	std::vector<Output> outputs_;
+
+	Thread thread_;
+	std::unique_ptr<Processor> processor_;
+	std::vector<std::unique_ptr<Thread>> workerThreads_;
+	std::vector<std::unique_ptr<StripeWorker>> workers_;
+	Semaphore stripesDone_;
+	std::atomic<bool> stopping_;
+
+	Mutex mutex_;
+	std::vector<std::pair<FrameBuffer *, OutputBuffers>> completed_
+		LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+} /* namespace libcamera */
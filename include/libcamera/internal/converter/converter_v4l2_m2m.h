@@ -54,7 +54,7 @@ public:
 	void stop();
 
 	int queueBuffers(FrameBuffer *input,
-			 const std::map<unsigned int, FrameBuffer *> &outputs);
+			 const OutputBuffers &outputs);
 
 private:
 	class Stream : protected Loggable
@@ -72,7 +72,8 @@ private:
 		int start();
 		void stop();
 
-		int queueBuffers(FrameBuffer *input, FrameBuffer *output);
+		int queueInput(FrameBuffer *input);
+		int queueOutput(FrameBuffer *output);
 
 	protected:
 		std::string logPrefix() const override;
@@ -24,9 +24,18 @@ public:
 		bool priorityWrite;
 	};
 
+	struct Statistics {
+		uint64_t frames;
+		uint64_t underruns;
+		uint64_t late;
+		uint64_t maxLateness;
+		uint64_t totalLateness;
+	};
+
 	DelayedControls(V4L2Device *device,
 			const std::unordered_map<uint32_t, ControlParams> &controlParams);
 
+	void setDelays(const std::unordered_map<uint32_t, ControlParams> &controlParams);
 	void reset();
 
 	bool push(const ControlList &controls);
@@ -34,6 +43,8 @@ public:
 
 	void applyControls(uint32_t sequence);
 
+	const Statistics &statistics() const { return statistics_; }
+
 private:
 	class Info : public ControlValue
 	{
@@ -74,8 +85,11 @@ private:
 
 	uint32_t queueCount_;
 	uint32_t writeCount_;
+	unsigned int lateness_;
 	/* \todo Evaluate if we should index on ControlId * or unsigned int */
 	std::unordered_map<const ControlId *, ControlRingBuffer> values_;
+
+	Statistics statistics_;
 };
 
 } /* namespace libcamera */
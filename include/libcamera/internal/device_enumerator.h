@@ -8,6 +8,7 @@
 #pragma once
 
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,8 @@ public:
 
 	bool match(const MediaDevice *device) const;
 
+	const std::string &driver() const { return driver_; }
+
 private:
 	std::string driver_;
 	std::vector<std::string> entities_;
@@ -42,8 +45,9 @@ public:
 	virtual int enumerate() = 0;
 
 	std::shared_ptr<MediaDevice> search(const DeviceMatch &dm);
+	void recordSearches(std::set<std::string> *drivers);
 
-	Signal<> devicesAdded;
+	Signal<MediaDevice *> devicesAdded;
 
 protected:
 	std::unique_ptr<MediaDevice> createDevice(const std::string &deviceNode);
@@ -52,6 +56,7 @@ protected:
 
 private:
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	std::set<std::string> *searchedDrivers_ = nullptr;
 };
 
 } /* namespace libcamera */
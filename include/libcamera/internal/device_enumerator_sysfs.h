@@ -23,6 +23,7 @@ public:
 	int enumerate();
 
 private:
+	std::unique_ptr<MediaDevice> createMediaDevice(const std::string &devnode);
 	int populateMediaDevice(MediaDevice *media);
 	std::string lookupDeviceNode(int major, int minor);
 };
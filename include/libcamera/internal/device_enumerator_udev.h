@@ -13,11 +13,18 @@
 #include <set>
 #include <string>
 #include <sys/types.h>
+#include <utility>
+
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_annotations.h>
 
 #include "libcamera/internal/device_enumerator.h"
 
 struct udev;
 struct udev_device;
+struct udev_list_entry;
 struct udev_monitor;
 
 namespace libcamera {
@@ -26,7 +33,7 @@ class EventNotifier;
 class MediaDevice;
 class MediaEntity;
 
-class DeviceEnumeratorUdev final : public DeviceEnumerator
+class DeviceEnumeratorUdev final : public DeviceEnumerator, public Object
 {
 public:
 	DeviceEnumeratorUdev();
@@ -36,6 +43,8 @@ public:
 	int enumerate();
 
 private:
+	class HotplugWorker;
+
 	using DependencyMap = std::map<dev_t, std::list<MediaEntity *>>;
 
 	struct MediaDeviceDeps {
@@ -54,12 +63,17 @@ private:
 		DependencyMap deps_;
 	};
 
-	int addUdevDevice(struct udev_device *dev);
+	std::map<std::string, std::unique_ptr<MediaDevice>>
+	createMediaDevices(struct udev_list_entry *ents);
+	int addUdevDevice(struct udev_device *dev,
+			  std::unique_ptr<MediaDevice> media = nullptr);
+	int addMediaDevice(std::unique_ptr<MediaDevice> media);
 	int populateMediaDevice(MediaDevice *media, DependencyMap *deps);
 	std::string lookupDeviceNode(dev_t devnum);
 
 	int addV4L2Device(dev_t devnum);
 	void udevNotify();
+	void mediaDeviceCreated();
 
 	struct udev *udev_;
 	struct udev_monitor *monitor_;
@@ -68,6 +82,14 @@ private:
 	std::set<dev_t> orphans_;
 	std::list<MediaDeviceDeps> pending_;
 	std::map<dev_t, MediaDeviceDeps *> devMap_;
+
+	Thread hotplugThread_;
+	std::unique_ptr<HotplugWorker> hotplugWorker_;
+	std::multiset<std::string> creating_;
+
+	Mutex mutex_;
+	std::list<std::pair<std::string, std::unique_ptr<MediaDevice>>> created_
+		LIBCAMERA_TSA_GUARDED_BY(mutex_);
 };
 
 } /* namespace libcamera */
@@ -7,13 +7,22 @@
 
 #pragma once
 
+#include <initializer_list>
+#include <memory>
 #include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
+#include <libcamera/base/class.h>
 #include <libcamera/base/flags.h>
+#include <libcamera/base/shared_fd.h>
 #include <libcamera/base/unique_fd.h>
 
 namespace libcamera {
 
+class FrameBuffer;
+
 class DmaBufAllocator
 {
 public:
@@ -21,6 +30,7 @@ public:
 		CmaHeap = 1 << 0,
 		SystemHeap = 1 << 1,
 		UDmaBuf = 1 << 2,
+		UDmaBufHugePages = 1 << 3,
 	};
 
 	using DmaBufAllocatorFlags = Flags<DmaBufAllocatorFlag>;
@@ -30,13 +40,68 @@ public:
 	bool isValid() const { return providerHandle_.isValid(); }
 	UniqueFD alloc(const char *name, std::size_t size);
 
+	int exportBuffers(unsigned int count,
+			  const std::vector<unsigned int> &planeSizes,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
+	void setPoolCapacity(std::size_t capacity);
+	std::size_t poolCapacity() const;
+	std::size_t pooledSize() const;
+	int preallocate(std::size_t size, unsigned int count);
+	void releasePool();
+
+	void useSharedPool();
+	void setMemoryLimit(std::size_t limit);
+	std::size_t memoryLimit() const;
+	std::size_t allocatedSize() const;
+
 private:
+	class Pool;
+	class PooledFrameBufferData;
+
 	UniqueFD allocFromHeap(const char *name, std::size_t size);
 	UniqueFD allocFromUDmaBuf(const char *name, std::size_t size);
+	UniqueFD createUDmaBuf(const char *name, std::size_t size,
+			       unsigned int memfdFlags);
+	bool probeHugePages();
+	UniqueFD allocFromProvider(const char *name, std::size_t size);
+	std::unique_ptr<FrameBuffer> createBuffer(const std::string &name,
+						  const std::vector<unsigned int> &planeSizes);
+
 	UniqueFD providerHandle_;
 	DmaBufAllocatorFlag type_;
+	std::size_t hugePageSize_;
+
+	std::shared_ptr<Pool> pool_;
 };
 
 LIBCAMERA_FLAGS_ENABLE_OPERATORS(DmaBufAllocator::DmaBufAllocatorFlag)
 
+class DmaSyncer final
+{
+public:
+	enum class SyncType {
+		Read = 0,
+		Write,
+		ReadWrite,
+	};
+
+	explicit DmaSyncer(const SharedFD &fd, SyncType type = SyncType::ReadWrite);
+	DmaSyncer(const FrameBuffer *buffer, SyncType type = SyncType::ReadWrite,
+		  std::initializer_list<unsigned int> planes = {});
+	~DmaSyncer();
+
+	DmaSyncer(DmaSyncer &&other);
+	DmaSyncer &operator=(DmaSyncer &&other);
+
+private:
+	LIBCAMERA_DISABLE_COPY(DmaSyncer)
+
+	void addFd(const SharedFD &fd);
+	void sync(uint64_t step);
+
+	std::vector<SharedFD> fds_;
+	uint64_t flags_;
+};
+
 } /* namespace libcamera */
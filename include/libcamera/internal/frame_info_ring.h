@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Fixed-size storage of per-frame information for pipeline handlers
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+namespace libcamera {
+
+template<typename Info>
+class FrameInfoRing
+{
+public:
+	FrameInfoRing() = default;
+
+	void resize(unsigned int size)
+	{
+		infos_ = std::vector<Info>(size);
+		slots_ = std::vector<Slot>(size);
+	}
+
+	void clear()
+	{
+		for (Slot &slot : slots_)
+			slot.used = false;
+	}
+
+	unsigned int size() const { return infos_.size(); }
+
+	Info &operator[](unsigned int index) { return infos_[index]; }
+	const Info &operator[](unsigned int index) const { return infos_[index]; }
+
+	Info *alloc(unsigned int frame)
+	{
+		for (unsigned int i = 0; i < infos_.size(); i++) {
+			unsigned int index = (frame + i) % infos_.size();
+			Slot &slot = slots_[index];
+
+			if (slot.used)
+				continue;
+
+			slot.used = true;
+			slot.frame = frame;
+			return &infos_[index];
+		}
+
+		return nullptr;
+	}
+
+	void release(Info *info)
+	{
+		slots_[info - infos_.data()].used = false;
+	}
+
+	Info *find(unsigned int frame)
+	{
+		for (unsigned int i = 0; i < infos_.size(); i++) {
+			unsigned int index = (frame + i) % infos_.size();
+			const Slot &slot = slots_[index];
+
+			if (slot.used && slot.frame == frame)
+				return &infos_[index];
+		}
+
+		return nullptr;
+	}
+
+	template<typename Predicate>
+	Info *findIf(Predicate pred)
+	{
+		for (unsigned int index = 0; index < infos_.size(); index++) {
+			if (slots_[index].used && pred(infos_[index]))
+				return &infos_[index];
+		}
+
+		return nullptr;
+	}
+
+private:
+	LIBCAMERA_DISABLE_COPY(FrameInfoRing)
+
+	struct Slot {
+		unsigned int frame = 0;
+		bool used = false;
+	};
+
+	std::vector<Info> infos_;
+	std::vector<Slot> slots_;
+};
+
+} /* namespace libcamera */
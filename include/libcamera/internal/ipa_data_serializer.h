@@ -16,6 +16,7 @@
 
 #include <libcamera/base/flags.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/control_ids.h>
 #include <libcamera/framebuffer.h>
@@ -63,6 +64,12 @@ T readPOD(std::vector<uint8_t> &vec, size_t pos)
 
 } /* namespace */
 
+template<typename T>
+struct IPADataSerializerTrivial
+	: std::integral_constant<bool, (std::is_arithmetic_v<T> || std::is_enum_v<T>) &&
+				       !std::is_same_v<T, bool>> {
+};
+
 template<typename T>
 class IPADataSerializer
 {
@@ -93,7 +100,11 @@ public:
  *
  * 4 bytes - uint32_t Length of vector, in number of elements
  *
- * For every element in the vector:
+ * If V is trivial, as reported by IPADataSerializerTrivial:
+ *
+ * X bytes - Elements, copied in bulk
+ *
+ * Otherwise, for every element in the vector:
  *
  * 4 bytes - uint32_t Size of element, in bytes
  * 4 bytes - uint32_t Number of fds for the element
@@ -115,6 +126,15 @@ public:
 		uint32_t vecLen = data.size();
 		appendPOD<uint32_t>(dataVec, vecLen);
 
+		if constexpr (IPADataSerializerTrivial<V>::value) {
+			const size_t size = vecLen * sizeof(V);
+			dataVec.resize(sizeof(vecLen) + size);
+			if (size)
+				memcpy(dataVec.data() + sizeof(vecLen), data.data(), size);
+
+			return { dataVec, {} };
+		}
+
 		/* Serialize the members. */
 		for (auto const &it : data) {
 			std::vector<uint8_t> dvec;
@@ -158,6 +178,19 @@ public:
 					  [[maybe_unused]] std::vector<SharedFD>::const_iterator fdsEnd,
 					  ControlSerializer *cs = nullptr)
 	{
+		if constexpr (IPADataSerializerTrivial<V>::value) {
+			uint32_t vecLen;
+			const uint8_t *elements = locate(dataBegin, dataEnd, &vecLen);
+			if (!elements)
+				return {};
+
+			std::vector<V> ret(vecLen);
+			if (vecLen)
+				memcpy(ret.data(), elements, vecLen * sizeof(V));
+
+			return ret;
+		}
+
 		uint32_t vecLen = readPOD<uint32_t>(dataBegin, 0, dataEnd);
 		std::vector<V> ret(vecLen);
 
@@ -180,6 +213,47 @@ public:
 
 		return ret;
 	}
+
+	/*
+	 * Access the elements of a serialized vector of trivial elements in
+	 * place, without copying them. The returned span points to the data
+	 * buffer and is valid as long as the buffer is. As the serialized
+	 * vector can be stored at any offset in the buffer, this is only
+	 * available for single-byte elements, other types require a copy to
+	 * be correctly aligned.
+	 */
+	template<typename T = V,
+		 std::enable_if_t<IPADataSerializerTrivial<T>::value &&
+				  alignof(T) == 1> * = nullptr>
+	static Span<const V> view(std::vector<uint8_t>::const_iterator dataBegin,
+				  std::vector<uint8_t>::const_iterator dataEnd)
+	{
+		uint32_t vecLen;
+		const uint8_t *elements = locate(dataBegin, dataEnd, &vecLen);
+		if (!elements)
+			return {};
+
+		return { reinterpret_cast<const V *>(elements), vecLen };
+	}
+
+private:
+	static const uint8_t *locate(std::vector<uint8_t>::const_iterator dataBegin,
+				     std::vector<uint8_t>::const_iterator dataEnd,
+				     uint32_t *vecLen)
+	{
+		*vecLen = readPOD<uint32_t>(dataBegin, 0, dataEnd);
+		size_t available = std::distance(dataBegin, dataEnd) - sizeof(*vecLen);
+
+		if (*vecLen > available / sizeof(V)) {
+			LOG(IPADataSerializer, Error)
+				<< "Failed to deserialize vector: expected "
+				<< *vecLen << " elements, got "
+				<< available / sizeof(V);
+			return nullptr;
+		}
+
+		return &*dataBegin + sizeof(*vecLen);
+	}
 };
 
 /*
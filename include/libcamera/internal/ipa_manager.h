@@ -7,7 +7,13 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/log.h>
@@ -23,6 +29,8 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPAManager)
 
+class IPCPipeUnixSocket;
+
 class IPAManager
 {
 public:
@@ -47,6 +55,9 @@ public:
 		return proxy;
 	}
 
+	static std::unique_ptr<IPCPipeUnixSocket>
+	createPipe(const IPAModule *ipam, const std::string &workerPath);
+
 #if HAVE_IPA_PUBKEY
 	static const PubKey &pubKey()
 	{
@@ -68,7 +79,21 @@ private:
 
 	std::vector<IPAModule *> modules_;
 
+	bool prespawn_;
+	std::map<std::pair<std::string, std::string>,
+		 std::unique_ptr<IPCPipeUnixSocket>> spares_;
+
 #if HAVE_IPA_PUBKEY
+	struct SignatureCacheEntry {
+		bool verified = false;
+		struct timespec mtime = {};
+		off_t size = 0;
+		std::vector<uint8_t> signature;
+		bool valid = false;
+	};
+
+	mutable std::map<std::string, SignatureCacheEntry> signatureCache_;
+
 	static const uint8_t publicKeyData_[];
 	static const PubKey pubKey_;
 #endif
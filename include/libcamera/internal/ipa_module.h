@@ -44,9 +44,11 @@ protected:
 
 private:
 	int loadIPAModuleInfo();
+	void loadSignature() const;
 
 	struct IPAModuleInfo info_;
-	std::vector<uint8_t> signature_;
+	mutable std::vector<uint8_t> signature_;
+	mutable bool signatureLoaded_;
 
 	std::string libPath_;
 	bool valid_;
@@ -33,11 +33,14 @@ public:
 
 	std::string configurationFile(const std::string &file) const;
 
+	void setDirectCalls(bool enable);
+
 protected:
 	std::string resolvePath(const std::string &file) const;
 
 	bool valid_;
 	ProxyState state_;
+	bool directCalls_;
 
 private:
 	IPAModule *ipam_;
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <vector>
 
 #include <libcamera/base/shared_fd.h>
@@ -29,7 +30,16 @@ public:
 	IPCMessage(const Header &header);
 	IPCMessage(IPCUnixSocket::Payload &payload);
 
+	static constexpr uint32_t kBatchCmd = UINT32_MAX;
+
 	IPCUnixSocket::Payload payload() const;
+	void payload(IPCUnixSocket::Payload *payload) const;
+
+	void clear();
+
+	bool isBatch() const { return header_.cmd == kBatchCmd; }
+	void append(const IPCMessage &message);
+	std::vector<IPCMessage> unbatch() const;
 
 	Header &header() { return header_; }
 	std::vector<uint8_t> &data() { return data_; }
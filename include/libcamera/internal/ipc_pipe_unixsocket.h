@@ -11,6 +11,8 @@
 #include <memory>
 #include <vector>
 
+#include <libcamera/base/object.h>
+
 #include "libcamera/internal/ipc_pipe.h"
 #include "libcamera/internal/ipc_unixsocket.h"
 
@@ -18,7 +20,7 @@ namespace libcamera {
 
 class Process;
 
-class IPCPipeUnixSocket : public IPCPipe
+class IPCPipeUnixSocket : public IPCPipe, public Object
 {
 public:
 	IPCPipeUnixSocket(const char *ipaModulePath, const char *ipaProxyWorkerPath);
@@ -35,6 +37,7 @@ private:
 		bool done;
 	};
 
+	void flush();
 	void readyRead();
 	int call(const IPCUnixSocket::Payload &message,
 		 IPCUnixSocket::Payload *response, uint32_t seq);
@@ -42,6 +45,19 @@ private:
 	std::unique_ptr<Process> proc_;
 	std::unique_ptr<IPCUnixSocket> socket_;
 	std::map<uint32_t, CallData> callData_;
+
+	/*
+	 * Asynchronous messages pending transmission. The vector is never
+	 * shrunk, its first pendingCount_ entries are pending, and the other
+	 * entries are kept to reuse their storage.
+	 */
+	std::vector<IPCMessage> pending_;
+	size_t pendingCount_;
+	bool flushQueued_;
+
+	IPCMessage batch_;
+	IPCUnixSocket::Payload txPayload_;
+	IPCUnixSocket::Payload rxPayload_;
 };
 
 } /* namespace libcamera */
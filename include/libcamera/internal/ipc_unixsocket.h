@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <memory>
 #include <stdint.h>
 #include <sys/types.h>
 #include <vector>
@@ -29,7 +30,7 @@ public:
 	IPCUnixSocket();
 	~IPCUnixSocket();
 
-	UniqueFD create();
+	UniqueFD create(bool sharedMemory = false);
 	int bind(UniqueFD fd);
 	void close();
 	bool isBound() const;
@@ -40,20 +41,31 @@ public:
 	Signal<> readyRead;
 
 private:
+	struct SharedMemoryChannel;
+
 	struct Header {
 		uint32_t data;
 		uint8_t fds;
+		uint8_t flags;
 	};
 
+	int sendMessage(const Payload &payload, uint8_t flags = 0);
 	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
 	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
 
+	int sendShared(const Payload &payload);
+	int receiveShared(Payload *payload);
+	int bindSharedMemory();
+
 	void dataNotifier();
+	void sharedMemoryNotifier();
 
 	UniqueFD fd_;
 	bool headerReceived_;
 	struct Header header_;
 	EventNotifier *notifier_;
+
+	std::unique_ptr<SharedMemoryChannel> shm_;
 };
 
 } /* namespace libcamera */
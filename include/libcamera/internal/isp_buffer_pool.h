@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Parameters and statistics buffers pool for ISP pipeline handlers
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+class V4L2VideoDevice;
+
+class IspBufferPool
+{
+public:
+	struct Statistics {
+		unsigned int occupancy;
+		unsigned int peakOccupancy;
+		unsigned int underruns;
+		uint64_t cycles;
+	};
+
+	IspBufferPool(const std::string &name);
+	~IspBufferPool();
+
+	int allocate(V4L2VideoDevice *params, V4L2VideoDevice *stats,
+		     unsigned int count, unsigned int firstCookie = 1);
+	void free();
+
+	unsigned int size() const { return entries_.size(); }
+
+	const std::vector<IPABuffer> &ipaBuffers() const { return ipaBuffers_; }
+	std::vector<unsigned int> ipaBufferIds() const;
+
+	int acquire();
+	void release(unsigned int index);
+	void reset();
+
+	FrameBuffer *params(unsigned int index) const { return entries_[index].params.get(); }
+	FrameBuffer *stats(unsigned int index) const { return entries_[index].stats.get(); }
+
+	const Statistics &statistics() const { return statistics_; }
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(IspBufferPool)
+
+	struct Entry {
+		std::unique_ptr<FrameBuffer> params;
+		std::unique_ptr<FrameBuffer> stats;
+	};
+
+	std::string name_;
+
+	std::vector<Entry> entries_;
+	std::vector<unsigned int> free_;
+	std::vector<IPABuffer> ipaBuffers_;
+
+	Statistics statistics_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * ISP parameters, statistics and metadata recorder
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/file.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/thread_annotations.h>
+
+namespace libcamera {
+
+class ControlList;
+class FrameBuffer;
+class MappedFrameBuffer;
+
+namespace isp_recording {
+
+static constexpr uint32_t kMagic = 0x4c435252; /* "RRCL" */
+static constexpr uint32_t kVersion = 1;
+
+enum class RecordType : uint32_t {
+	Parameters = 1,
+	Statistics = 2,
+	Metadata = 3,
+};
+
+struct FileHeader {
+	uint32_t magic;
+	uint32_t version;
+	char name[32];
+};
+
+struct RecordHeader {
+	uint32_t type;
+	uint32_t frame;
+	uint64_t timestamp;
+	uint32_t size;
+	uint32_t reserved;
+};
+
+} /* namespace isp_recording */
+
+class IspRecorder
+{
+public:
+	using RecordType = isp_recording::RecordType;
+
+	IspRecorder(const std::string &name);
+	~IspRecorder();
+
+	bool isEnabled() const { return !directory_.empty(); }
+	bool isRecording() const { return file_.isOpen(); }
+
+	int start();
+	void stop();
+
+	void record(RecordType type, uint32_t frame, const FrameBuffer *buffer);
+	void record(RecordType type, uint32_t frame, Span<const uint8_t> data);
+	void record(uint32_t frame, const ControlList &metadata);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(IspRecorder)
+
+	static constexpr size_t kMaxPendingBytes = 16 * 1024 * 1024;
+
+	static std::atomic<unsigned int> sessions_;
+
+	bool accept(uint32_t frame);
+	std::vector<uint8_t> prepare(RecordType type, uint32_t frame, size_t size);
+	void queue(std::vector<uint8_t> &&record);
+	void run();
+
+	std::string name_;
+	std::string directory_;
+	unsigned int maxFrames_;
+
+	std::map<const FrameBuffer *, std::unique_ptr<MappedFrameBuffer>> maps_;
+	bool windowStarted_;
+	uint32_t firstFrame_;
+
+	File file_;
+	std::thread thread_;
+
+	Mutex mutex_;
+	ConditionVariable cv_;
+	std::deque<std::vector<uint8_t>> pending_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::vector<std::vector<uint8_t>> spare_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	size_t pendingBytes_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	unsigned int records_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	unsigned int dropped_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	bool stop_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+class IspRecordingReader
+{
+public:
+	using RecordType = isp_recording::RecordType;
+
+	struct Record {
+		RecordType type;
+		uint32_t frame;
+		uint64_t timestamp;
+		std::vector<uint8_t> data;
+	};
+
+	int open(const std::string &path);
+
+	const std::string &name() const { return name_; }
+
+	int read(Record *record);
+
+private:
+	File file_;
+	std::string name_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Fixed-size hash index for constant tables
+ */
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <stdint.h>
+
+#include <libcamera/base/log.h>
+
+namespace libcamera {
+
+template<typename Key, typename Entry, unsigned int Size,
+	 typename Hash = std::hash<Key>>
+class LookupTable
+{
+public:
+	static_assert(Size >= 2 && !(Size & (Size - 1)),
+		      "LookupTable size must be a power of two");
+
+	template<typename Container, typename KeyFunc>
+	LookupTable(const Container &entries, KeyFunc keyFunc)
+		: buckets_{}
+	{
+		for (const auto &entry : entries)
+			insert(keyFunc(entry), &entry);
+	}
+
+	const Entry *find(const Key &key) const
+	{
+		unsigned int index = bucket(key);
+
+		for (unsigned int i = 0; i < Size; i++) {
+			const Bucket &b = buckets_[index];
+			if (!b.entry)
+				return nullptr;
+			if (b.key == key)
+				return b.entry;
+
+			index = (index + 1) & (Size - 1);
+		}
+
+		return nullptr;
+	}
+
+private:
+	struct Bucket {
+		Key key;
+		const Entry *entry;
+	};
+
+	static constexpr unsigned int order()
+	{
+		unsigned int n = 0;
+		while ((1U << n) < Size)
+			n++;
+		return n;
+	}
+
+	static unsigned int bucket(const Key &key)
+	{
+		/* Fibonacci hashing, to spread keys with a poor hash. */
+		uint64_t hash = static_cast<uint64_t>(Hash{}(key));
+		return (hash * 0x9e3779b97f4a7c15ULL) >> (64 - order());
+	}
+
+	void insert(const Key &key, const Entry *entry)
+	{
+		unsigned int index = bucket(key);
+
+		for (unsigned int i = 0; i < Size; i++) {
+			Bucket &b = buckets_[index];
+			if (!b.entry) {
+				b = { key, entry };
+				return;
+			}
+
+			/* Keep the first entry for duplicated keys. */
+			if (b.key == key)
+				return;
+
+			index = (index + 1) & (Size - 1);
+		}
+
+		ASSERT(false);
+	}
+
+	std::array<Bucket, Size> buckets_;
+};
+
+} /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <optional>
 #include <stdint.h>
 #include <vector>
 
@@ -16,6 +17,8 @@
 
 #include <libcamera/framebuffer.h>
 
+#include "libcamera/internal/dma_buf_allocator.h"
+
 namespace libcamera {
 
 class MappedBuffer
@@ -50,11 +53,20 @@ public:
 		Read = 1 << 0,
 		Write = 1 << 1,
 		ReadWrite = Read | Write,
+		Persistent = 1 << 2,
+		Sync = 1 << 3,
 	};
 
 	using MapFlags = Flags<MapFlag>;
 
 	MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags);
+	~MappedFrameBuffer();
+
+	MappedFrameBuffer(MappedFrameBuffer &&other);
+	MappedFrameBuffer &operator=(MappedFrameBuffer &&other);
+
+private:
+	std::optional<DmaSyncer> syncer_;
 };
 
 LIBCAMERA_FLAGS_ENABLE_OPERATORS(MappedFrameBuffer::MapFlag)
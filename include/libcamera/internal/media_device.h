@@ -8,8 +8,10 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
@@ -18,13 +20,18 @@
 #include <libcamera/base/signal.h>
 #include <libcamera/base/unique_fd.h>
 
+#include <libcamera/geometry.h>
+
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
 
 namespace libcamera {
 
 class MediaDevice : protected Loggable
 {
 public:
+	using CachedFormats = std::map<unsigned int, std::vector<SizeRange>>;
+
 	MediaDevice(const std::string &deviceNode);
 	~MediaDevice();
 
@@ -54,6 +61,12 @@ public:
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
 
+	int allocateRequests(unsigned int count,
+			     std::vector<std::unique_ptr<MediaRequest>> *requests);
+
+	const CachedFormats *cachedFormats(const std::string &key) const;
+	void cacheFormats(const std::string &key, CachedFormats formats) const;
+
 	Signal<> disconnected;
 
 protected:
@@ -67,8 +80,6 @@ private:
 	bool addObject(MediaObject *object);
 	void clear();
 
-	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
-						 unsigned int entityId);
 	bool populateEntities(const struct media_v2_topology &topology);
 	bool populatePads(const struct media_v2_topology &topology);
 	bool populateLinks(const struct media_v2_topology &topology);
@@ -82,13 +93,17 @@ private:
 	std::string model_;
 	unsigned int version_;
 	unsigned int hwRevision_;
+	__u64 topologyVersion_;
 
 	UniqueFD fd_;
 	bool valid_;
 	bool acquired_;
 
-	std::map<unsigned int, MediaObject *> objects_;
+	std::unordered_map<unsigned int, MediaObject *> objects_;
 	std::vector<MediaEntity *> entities_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
+
+	mutable std::map<std::string, CachedFormats> formatsCache_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Media controller request
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/unique_fd.h>
+
+namespace libcamera {
+
+class EventNotifier;
+
+class MediaRequest
+{
+public:
+	enum class Status {
+		Idle,
+		Queued,
+		Complete,
+	};
+
+	MediaRequest(UniqueFD fd);
+	~MediaRequest();
+
+	int fd() const { return fd_.get(); }
+	Status status() const { return status_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MediaRequest)
+
+	void notify();
+
+	UniqueFD fd_;
+	Status status_;
+	std::unique_ptr<EventNotifier> notifier_;
+};
+
+} /* namespace libcamera */
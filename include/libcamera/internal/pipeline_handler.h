@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <queue>
 #include <set>
@@ -33,6 +35,7 @@ class FrameBuffer;
 class MediaDevice;
 class PipelineHandler;
 class Request;
+class Thread;
 
 class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>,
 			public Object
@@ -55,16 +58,22 @@ public:
 	virtual int exportFrameBuffers(Camera *camera, Stream *stream,
 				       std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
 
+	virtual int prepare(Camera *camera);
 	virtual int start(Camera *camera, const ControlList *controls) = 0;
 	void stop(Camera *camera);
+	void flush(Camera *camera);
 	bool hasPendingRequests(const Camera *camera) const;
 
 	void registerRequest(Request *request);
 	void queueRequest(Request *request);
+	void submitRequests(Camera *camera);
 
 	bool completeBuffer(Request *request, FrameBuffer *buffer);
 	void completeRequest(Request *request);
 
+	void counters(const Camera *camera,
+		      std::map<std::string, uint64_t> *counters);
+
 	std::string configurationFile(const std::string &subdir,
 				      const std::string &name) const;
 
@@ -74,14 +83,23 @@ protected:
 	void registerCamera(std::shared_ptr<Camera> camera);
 	void hotplugMediaDevice(MediaDevice *media);
 
+	virtual bool handlesFences(const Camera *camera) const;
 	virtual int queueRequestDevice(Camera *camera, Request *request) = 0;
 	virtual void stopDevice(Camera *camera) = 0;
+	virtual void flushDevice(Camera *camera);
 
 	virtual void releaseDevice(Camera *camera);
 
+	virtual void countersDevice(const Camera *camera,
+				    std::map<std::string, uint64_t> *counters);
+
+	int runInWorker(const std::function<int()> &func);
+
 	CameraManager *manager_;
 
 private:
+	class Worker;
+
 	void unlockMediaDevices();
 
 	void mediaDeviceDisconnected(MediaDevice *media);
@@ -97,6 +115,9 @@ private:
 
 	const char *name_;
 
+	std::unique_ptr<Thread> workerThread_;
+	std::unique_ptr<Worker> worker_;
+
 	Mutex lock_;
 	unsigned int useCount_ LIBCAMERA_TSA_GUARDED_BY(lock_);
 
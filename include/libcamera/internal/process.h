@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <list>
 #include <signal.h>
 #include <string>
 #include <vector>
@@ -42,8 +43,6 @@ public:
 	Signal<enum ExitStatus, int> finished;
 
 private:
-	void closeAllFdsExcept(const std::vector<int> &fds);
-	int isolate();
 	void died(int wstatus);
 
 	pid_t pid_;
@@ -61,6 +60,7 @@ public:
 	~ProcessManager();
 
 	void registerProcess(Process *proc);
+	void unregisterProcess(Process *proc);
 
 	static ProcessManager *instance();
 
@@ -27,6 +27,7 @@ public:
 	SharedMem();
 
 	SharedMem(const std::string &name, std::size_t size);
+	SharedMem(const SharedFD &fd, std::size_t size);
 	SharedMem(SharedMem &&rhs);
 
 	virtual ~SharedMem();
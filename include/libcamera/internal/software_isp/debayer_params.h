@@ -17,12 +17,31 @@ namespace libcamera {
 
 struct DebayerParams {
 	static constexpr unsigned int kRGBLookupSize = 256;
+	static constexpr unsigned int kGammaLookupSize = 1024;
+	static constexpr unsigned int kBufferCount = 4;
 
 	using ColorLookupTable = std::array<uint8_t, kRGBLookupSize>;
 
+	struct CcmColumn {
+		int16_t r;
+		int16_t g;
+		int16_t b;
+	};
+
+	using CcmLookupTable = std::array<CcmColumn, kRGBLookupSize>;
+	using GammaLookupTable = std::array<uint8_t, kGammaLookupSize>;
+
+	uint32_t generation;
+
 	ColorLookupTable red;
 	ColorLookupTable green;
 	ColorLookupTable blue;
+
+	bool ccmEnabled;
+	CcmLookupTable redCcm;
+	CcmLookupTable greenCcm;
+	CcmLookupTable blueCcm;
+	GammaLookupTable gammaLut;
 };
 
 } /* namespace libcamera */
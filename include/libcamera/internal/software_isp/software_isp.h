@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <deque>
 #include <functional>
 #include <initializer_list>
 #include <map>
@@ -16,9 +17,12 @@
 #include <vector>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/flat_map.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/mutex.h>
 #include <libcamera/base/signal.h>
 #include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
@@ -28,15 +32,17 @@
 
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/dma_buf_allocator.h"
+#include "libcamera/internal/isp_recorder.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/shared_mem_object.h"
 #include "libcamera/internal/software_isp/debayer_params.h"
 
 namespace libcamera {
 
-class DebayerCpu;
+class Debayer;
 class FrameBuffer;
 class PixelFormat;
+class SwStatsCpu;
 struct StreamConfiguration;
 
 LOG_DECLARE_CATEGORY(SoftwareIsp)
@@ -44,10 +50,26 @@ LOG_DECLARE_CATEGORY(SoftwareIsp)
 class SoftwareIsp
 {
 public:
+	struct FrameTimes {
+		utils::Duration processing;
+		utils::Duration stats;
+		utils::Duration queue;
+	};
+
+	struct Counters {
+		uint64_t frames;
+		uint64_t dropped;
+		FrameTimes last;
+		FrameTimes total;
+		FrameTimes max;
+	};
+
+	static constexpr unsigned int kMaxOutputs = 2;
+
 	SoftwareIsp(PipelineHandler *pipe, const CameraSensor *sensor);
 	~SoftwareIsp();
 
-	int loadConfiguration([[maybe_unused]] const std::string &filename) { return 0; }
+	int loadConfiguration(const std::string &filename);
 
 	bool isValid() const;
 
@@ -55,6 +77,9 @@ public:
 
 	SizeRange sizes(PixelFormat inputFormat, const Size &inputSize);
 
+	unsigned int maxOutputs() const;
+	Size outputSize(const Size &firstSize, const Size &size);
+
 	std::tuple<unsigned int, unsigned int>
 	strideAndFrameSize(const PixelFormat &outputFormat, const Size &size);
 
@@ -65,35 +90,74 @@ public:
 	int exportBuffers(unsigned int output, unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 
-	void processStats(const ControlList &sensorControls);
+	void processStats(const uint32_t frame, const uint32_t bufferId,
+			  const ControlList &sensorControls);
 
 	int start();
 	void stop();
 
 	int queueBuffers(FrameBuffer *input,
-			 const std::map<unsigned int, FrameBuffer *> &outputs);
+			 const FlatMap<unsigned int, FrameBuffer *> &outputs);
+
+	void process(FrameBuffer *input,
+		     const FlatMap<unsigned int, FrameBuffer *> &outputs);
 
-	void process(FrameBuffer *input, FrameBuffer *output);
+	Counters counters() const;
 
 	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *, const FrameTimes &> frameTimesReady;
 	Signal<FrameBuffer *> outputBufferReady;
-	Signal<> ispStatsReady;
+	Signal<uint32_t, uint32_t> ispStatsReady;
 	Signal<const ControlList &> setSensorControls;
 
 private:
-	void saveIspParams();
+	/* Maximum amount of memory kept for output buffer reuse */
+	static constexpr std::size_t kBufferPoolCapacity = 64 * 1024 * 1024;
+
+	/* Default number of frames queued for processing before dropping */
+	static constexpr unsigned int kDefaultMaxQueuedFrames = 2;
+	/* Maximum statistics decimation level when dropping frames */
+	static constexpr unsigned int kMaxStatsDecimation = 2;
+	/* Frames processed without drops before lowering the decimation */
+	static constexpr unsigned int kStatsRecoveryFrames = 60;
+
+	std::unique_ptr<SwStatsCpu> createStats();
+	std::unique_ptr<Debayer> createDebayer();
+	void saveIspParams(uint32_t frame, uint32_t bufferId);
 	void setSensorCtrls(const ControlList &sensorControls);
-	void statsReady();
+	void statsReady(uint32_t frame, uint32_t bufferId);
+	void updateBackpressure(bool dropped);
+	FrameTimes frameTimes() LIBCAMERA_TSA_REQUIRES(countersMutex_);
 	void inputReady(FrameBuffer *input);
 	void outputReady(FrameBuffer *output);
 
-	std::unique_ptr<DebayerCpu> debayer_;
+	std::unique_ptr<Debayer> debayer_;
 	Thread ispWorkerThread_;
-	SharedMemObject<DebayerParams> sharedParams_;
-	DebayerParams debayerParams_;
+	SharedMemObject<std::array<DebayerParams, DebayerParams::kBufferCount>> sharedParams_;
+	/* Pairs of first frame and parameters buffer index, in frame order */
+	std::deque<std::pair<uint32_t, uint32_t>> pendingParams_;
+	uint32_t paramsBufferId_;
+	unsigned int numOutputs_;
+
+	/* Frame dropping and statistics decimation when processing lags */
+	unsigned int maxQueuedFrames_;
+	unsigned int statsFrameInterval_;
+	unsigned int statsXSubsampling_;
+	unsigned int statsDecimation_;
+	unsigned int framesSinceDrop_;
 	DmaBufAllocator dmaHeap_;
 
+	mutable Mutex countersMutex_;
+	/* Times at which the frames have been queued, by input buffer */
+	std::map<FrameBuffer *, utils::time_point> queueTimes_
+		LIBCAMERA_TSA_GUARDED_BY(countersMutex_);
+	Counters counters_ LIBCAMERA_TSA_GUARDED_BY(countersMutex_);
+
 	std::unique_ptr<ipa::soft::IPAProxySoft> ipa_;
+
+	IspRecorder recorder_;
+	/* Statistics mapping for the recorder, only set when it is enabled */
+	SharedMem recordedStats_;
 };
 
 } /* namespace libcamera */
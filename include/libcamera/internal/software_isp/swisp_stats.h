@@ -44,6 +44,10 @@ struct SwIspStats {
 	 * \brief A histogram of luminance values
 	 */
 	Histogram yHistogram;
+	/**
+	 * \brief Number of statistics buffers shared between the ISP and the IPA
+	 */
+	static constexpr unsigned int kBufferCount = 4;
 };
 
 } /* namespace libcamera */
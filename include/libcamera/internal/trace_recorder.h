@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Built-in in-memory trace recorder
+ */
+
+#pragma once
+
+#include <atomic>
+#include <initializer_list>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/thread_annotations.h>
+
+#include <libcamera/request.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class TraceArg
+{
+public:
+	enum class Type : uint8_t {
+		Integer,
+		Hex,
+		String,
+	};
+
+	TraceArg() = default;
+	TraceArg(const char *name, int64_t value);
+	TraceArg(const char *name, const char *value);
+
+	static TraceArg hex(const char *name, uint64_t value);
+
+	const char *name() const { return name_; }
+	Type type() const { return type_; }
+	int64_t integer() const { return integer_; }
+	const char *string() const { return string_; }
+
+private:
+	static constexpr unsigned int kMaxStringLength = 31;
+
+	const char *name_;
+	Type type_;
+	union {
+		int64_t integer_;
+		char string_[kMaxStringLength + 1];
+	};
+};
+
+class TraceRecorder
+{
+public:
+	enum class Phase : char {
+		Begin = 'B',
+		End = 'E',
+		Instant = 'i',
+		Complete = 'X',
+		AsyncBegin = 'b',
+		AsyncEnd = 'e',
+	};
+
+	static TraceRecorder *instance();
+
+	bool isEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	void enable(unsigned int size);
+	void record(const char *name, Phase phase,
+		    std::initializer_list<TraceArg> args);
+	void recordAsync(const char *name, Phase phase, uint64_t id,
+			 std::initializer_list<TraceArg> args);
+	void recordComplete(const char *name, int64_t duration,
+			    std::initializer_list<TraceArg> args);
+
+	int exportTrace(std::ostream &stream);
+	int exportTrace(const std::string &path);
+	int exportTrace();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(TraceRecorder)
+
+	static constexpr unsigned int kMaxArgs = 5;
+
+	struct Event {
+		int64_t timestamp;
+		int64_t duration;
+		uint64_t id;
+		const char *name;
+		pid_t tid;
+		Phase phase;
+		uint8_t numArgs;
+		TraceArg args[kMaxArgs];
+	};
+
+	TraceRecorder();
+
+	void append(const char *name, Phase phase, int64_t timestamp,
+		    int64_t duration, uint64_t id,
+		    std::initializer_list<TraceArg> args);
+
+	std::string path_;
+	std::atomic<bool> enabled_;
+
+	Mutex mutex_;
+	std::vector<Event> events_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	uint64_t head_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::map<pid_t, std::string> threads_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+namespace trace {
+
+/*
+ * Handlers for the tracepoints of include/libcamera/internal/tracepoints/,
+ * named after the events to be called from the LIBCAMERA_TRACEPOINT() macro.
+ * They record the same fields as the lttng events.
+ */
+void ipa_call_begin(const char *pipe, const char *func);
+void ipa_call_end(const char *pipe, const char *func);
+void ipa_call_async(const char *pipe, const char *func);
+void ipa_signal(const char *pipe, const char *func);
+
+void request_construct(Request *req);
+void request_destroy(Request *req);
+void request_reuse(Request *req);
+void request_queue(Request *req);
+void request_device_queue(Request *req);
+void request_complete(Request::Private *req);
+void request_cancel(Request::Private *req);
+void request_complete_buffer(Request::Private *req, FrameBuffer *buf);
+
+void v4l2_buffer_queue(const char *dev, unsigned int idx, FrameBuffer *buf);
+void v4l2_buffer_dequeue(const char *dev, FrameBuffer *buf);
+void frame_stage(const char *pipe, const char *stage, Request *req,
+		 uint32_t seq);
+void frame_process_begin(const char *pipe, const char *stage, uint32_t seq);
+void frame_process_end(const char *pipe, const char *stage, uint32_t seq);
+
+void thread_dispatch(const char *thread, int type, const char *handler, int fd,
+		     unsigned int queue_depth, int64_t latency, int64_t run_time);
+
+} /* namespace trace */
+
+} /* namespace libcamera */
@@ -27,6 +27,7 @@
 namespace libcamera {
 
 class EventNotifier;
+class MediaRequest;
 
 class V4L2Device : protected Loggable
 {
@@ -36,8 +37,9 @@ public:
 
 	const ControlInfoMap &controls() const { return controls_; }
 
-	ControlList getControls(const std::vector<uint32_t> &ids);
-	int setControls(ControlList *ctrls);
+	ControlList getControls(const std::vector<uint32_t> &ids,
+				const MediaRequest *request = nullptr);
+	int setControls(ControlList *ctrls, const MediaRequest *request = nullptr);
 
 	const struct v4l2_query_ext_ctrl *controlInfo(uint32_t id) const;
 
@@ -12,8 +12,11 @@
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <queue>
 #include <stdint.h>
 #include <string>
+#include <sys/types.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -124,6 +127,14 @@ struct V4L2Capability final : v4l2_capability {
 class V4L2BufferCache
 {
 public:
+	struct Statistics {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+
+		Statistics &operator+=(const Statistics &other);
+	};
+
 	V4L2BufferCache(unsigned int numEntries);
 	V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
 	~V4L2BufferCache();
@@ -132,36 +143,45 @@ public:
 	int get(const FrameBuffer &buffer);
 	void put(unsigned int index);
 
+	const Statistics &statistics() const { return stats_; }
+
 private:
+	struct Key {
+		struct Plane {
+			ino_t inode;
+			unsigned int offset;
+			unsigned int length;
+		};
+
+		Key();
+		Key(const FrameBuffer &buffer);
+
+		bool operator==(const Key &other) const;
+
+		bool valid;
+		unsigned int numPlanes;
+		std::array<Plane, VIDEO_MAX_PLANES> planes;
+	};
+
+	struct KeyHash {
+		std::size_t operator()(const Key &key) const;
+	};
+
 	class Entry
 	{
 	public:
 		Entry();
-		Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer);
-
-		bool operator==(const FrameBuffer &buffer) const;
+		Entry(bool free, uint64_t lastUsed, const Key &key);
 
 		bool free_;
 		uint64_t lastUsed_;
-
-	private:
-		struct Plane {
-			Plane(const FrameBuffer::Plane &plane)
-				: fd(plane.fd.get()), length(plane.length)
-			{
-			}
-
-			int fd;
-			unsigned int length;
-		};
-
-		std::vector<Plane> planes_;
+		Key key_;
 	};
 
 	std::atomic<uint64_t> lastUsedCounter_;
 	std::vector<Entry> cache_;
-	/* \todo Expose the miss counter through an instrumentation API. */
-	unsigned int missCounter_;
+	std::unordered_map<Key, unsigned int, KeyHash> index_;
+	Statistics stats_;
 };
 
 class V4L2DeviceFormat
@@ -202,6 +222,7 @@ public:
 	const char *busName() const { return caps_.bus_info(); }
 
 	const V4L2Capability &caps() const { return caps_; }
+	bool supportsRequests();
 
 	int getFormat(V4L2DeviceFormat *format);
 	int tryFormat(V4L2DeviceFormat *format);
@@ -217,9 +238,11 @@ public:
 	int importBuffers(unsigned int count);
 	int releaseBuffers();
 
-	int queueBuffer(FrameBuffer *buffer);
+	int queueBuffer(FrameBuffer *buffer, const MediaRequest *request = nullptr);
 	Signal<FrameBuffer *> bufferReady;
 
+	V4L2BufferCache::Statistics bufferCacheStatistics() const;
+
 	int streamOn();
 	int streamOff();
 
@@ -263,14 +286,21 @@ private:
 	std::unique_ptr<FrameBuffer> createBuffer(unsigned int index);
 	UniqueFD exportDmabufFd(unsigned int index, unsigned int plane);
 
+	int queueBufferDevice(FrameBuffer *buffer, const MediaRequest *request);
+	void processFencedBuffers();
+	void fenceSignalled();
+	void fenceExpired();
+
 	void bufferAvailable();
-	FrameBuffer *dequeueBuffer();
+	FrameBuffer *dequeueBuffer(bool drain = false);
 
 	void watchdogExpired();
 
 	template<typename T>
 	static std::optional<ColorSpace> toColorSpace(const T &v4l2Format);
 
+	const MediaEntity *entity_;
+
 	V4L2Capability caps_;
 	V4L2DeviceFormat format_;
 	const PixelFormatInfo *formatInfo_;
@@ -280,9 +310,15 @@ private:
 	enum v4l2_memory memoryType_;
 
 	V4L2BufferCache *cache_;
+	V4L2BufferCache::Statistics cacheStats_;
 	std::map<unsigned int, FrameBuffer *> queuedBuffers_;
 
+	std::queue<FrameBuffer *> fencedBuffers_;
+	std::unique_ptr<EventNotifier> fenceNotifier_;
+	Timer fenceTimer_;
+
 	EventNotifier *fdBufferNotifier_;
+	bool nonBlocking_;
 
 	State state_;
 	std::optional<unsigned int> firstFrame_;
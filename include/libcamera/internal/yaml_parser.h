@@ -14,12 +14,14 @@
 #include <vector>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/geometry.h>
 
 namespace libcamera {
 
 class File;
+class YamlParserCache;
 class YamlParserContext;
 
 class YamlObject
@@ -191,6 +193,14 @@ public:
 #endif
 	std::optional<std::vector<T>> getList() const;
 
+#ifndef __DOXYGEN__
+	template<typename T,
+		 std::enable_if_t<std::is_same_v<double, T>> * = nullptr>
+#else
+	template<typename T>
+#endif
+	std::optional<Span<const T>> getSpan() const;
+
 	DictAdapter asDict() const { return DictAdapter{ list_ }; }
 	ListAdapter asList() const { return ListAdapter{ list_ }; }
 
@@ -204,6 +214,7 @@ private:
 
 	template<typename T>
 	friend struct Getter;
+	friend class YamlParserCache;
 	friend class YamlParserContext;
 
 	enum class Type {
@@ -212,16 +223,29 @@ private:
 		Value,
 	};
 
+	enum NumberFlag {
+		NumberReal = 1 << 0,
+		NumberInteger = 1 << 1,
+		NumberUnsigned = 1 << 2,
+	};
+
 	template<typename T>
 	struct Getter {
 		std::optional<T> get(const YamlObject &obj) const;
 	};
 
+	void parseNumbers();
+
 	Type type_;
 
 	std::string value_;
 	Container list_;
 	std::map<std::string, YamlObject *> dictionary_;
+
+	unsigned int numberFlags_;
+	double real_;
+	int64_t integer_;
+	std::vector<double> reals_;
 };
 
 class YamlParser final
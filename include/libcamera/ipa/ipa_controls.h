@@ -15,7 +15,9 @@ namespace libcamera {
 extern "C" {
 #endif
 
-#define IPA_CONTROLS_FORMAT_VERSION	1
+#define IPA_CONTROLS_FORMAT_VERSION	2
+
+#define IPA_CONTROLS_FLAG_CACHED	(1 << 0)
 
 enum ipa_controls_id_map_type {
 	IPA_CONTROL_ID_MAP_CONTROLS,
@@ -30,7 +32,8 @@ struct ipa_controls_header {
 	uint32_t size;
 	uint32_t data_offset;
 	enum ipa_controls_id_map_type id_map_type;
-	uint32_t reserved[2];
+	uint32_t flags;
+	uint32_t reserved[1];
 };
 
 struct ipa_control_value_entry {
@@ -38,8 +41,6 @@ struct ipa_control_value_entry {
 	uint8_t type;
 	uint8_t is_array;
 	uint16_t count;
-	uint32_t offset;
-	uint32_t padding[1];
 };
 
 struct ipa_control_info_entry {
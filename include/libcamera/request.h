@@ -7,7 +7,6 @@
 
 #pragma once
 
-#include <map>
 #include <memory>
 #include <ostream>
 #include <stdint.h>
@@ -15,6 +14,7 @@
 #include <unordered_set>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/flat_map.h>
 #include <libcamera/base/signal.h>
 
 #include <libcamera/controls.h>
@@ -43,7 +43,7 @@ public:
 		ReuseBuffers = (1 << 0),
 	};
 
-	using BufferMap = std::map<const Stream *, FrameBuffer *>;
+	using BufferMap = FlatMap<const Stream *, FrameBuffer *>;
 
 	Request(Camera *camera, uint64_t cookie = 0);
 	~Request();
@@ -10,12 +10,17 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <fstream>
 #include <map>
+#include <sstream>
+#include <stdio.h>
 #include <type_traits>
+#include <unistd.h>
 
 #include <hardware/camera3.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
@@ -48,6 +53,18 @@ const std::vector<Size> camera3Resolutions = {
 	{ 1920, 1080 }
 };
 
+/*
+ * \var kHighSpeedFps
+ * \brief The frame rates advertised for constrained high speed video
+ */
+constexpr std::array<int32_t, 2> kHighSpeedFps = { 120, 240 };
+
+/*
+ * \var kHighSpeedMinResolution
+ * \brief The smallest resolution advertised for constrained high speed video
+ */
+const Size kHighSpeedMinResolution = { 640, 480 };
+
 /*
  * \struct Camera3Format
  * \brief Data associated with an Android format identifier
@@ -338,6 +355,29 @@ bool CameraCapabilities::validateBurstCaptureCapability()
 	return false;
 }
 
+bool CameraCapabilities::validateConstrainedHighSpeedCapability()
+{
+	const char *noMode = "Constrained high speed capability unavailable: ";
+
+	/*
+	 * https://developer.android.com/reference/android/hardware/camera2/CameraMetadata#REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO
+	 *
+	 * At least one 720p or larger size must be supported at 120 FPS or
+	 * more.
+	 */
+	auto it = std::find_if(highSpeedConfigurations_.begin(),
+			       highSpeedConfigurations_.end(),
+			       [](const HighSpeedConfiguration &config) {
+				       return config.resolution >= Size(1280, 720);
+			       });
+	if (it == highSpeedConfigurations_.end()) {
+		LOG(HAL, Info) << noMode << "no 720p high speed configuration";
+		return false;
+	}
+
+	return true;
+}
+
 std::set<camera_metadata_enum_android_request_available_capabilities>
 CameraCapabilities::computeCapabilities()
 {
@@ -361,6 +401,9 @@ CameraCapabilities::computeCapabilities()
 	if (rawStreamAvailable_)
 		capabilities.insert(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_RAW);
 
+	if (validateConstrainedHighSpeedCapability())
+		capabilities.insert(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO);
+
 	return capabilities;
 }
 
@@ -398,14 +441,38 @@ void CameraCapabilities::computeHwLevel(
 	hwLevel_ = hwLevel;
 }
 
+CameraCapabilities::~CameraCapabilities()
+{
+	finishRevalidation();
+}
+
+/*
+ * Initialize the static capabilities of \a camera.
+ *
+ * Enumerating the stream configurations requires validating and configuring
+ * the camera for every supported format and resolution, which slows down the
+ * camera service startup. When a \a cacheKey is given, the stream
+ * configurations are cached on disk, keyed by \a cacheKey which must identify
+ * everything they depend on, and loaded from the cache at the next startup.
+ * They are then revalidated in a background thread, and the cache is updated
+ * for the next startup if they have changed.
+ */
 int CameraCapabilities::initialize(std::shared_ptr<Camera> camera,
-				   int orientation, int facing)
+				   int orientation, int facing,
+				   const std::string &cacheKey)
 {
+	finishRevalidation();
+
 	camera_ = camera;
 	orientation_ = orientation;
 	facing_ = facing;
+	cacheKey_ = cacheKey;
 	rawStreamAvailable_ = false;
 	maxFrameDuration_ = 0;
+	maxJpegBufferSize_ = 0;
+	highSpeedConfigurations_.clear();
+	streamConfigurations_.clear();
+	formatsMap_.clear();
 
 	/* Acquire the camera and initialize available stream configurations. */
 	int ret = camera_->acquire();
@@ -414,17 +481,226 @@ int CameraCapabilities::initialize(std::shared_ptr<Camera> camera,
 		return ret;
 	}
 
-	ret = initializeStreamConfigurations();
-	if (ret) {
-		camera_->release();
-		return ret;
+	bool cached = loadStreamConfigurations();
+	if (!cached) {
+		ret = initializeStreamConfigurations();
+		if (ret) {
+			camera_->release();
+			return ret;
+		}
+
+		storeStreamConfigurations();
 	}
 
 	ret = initializeStaticMetadata();
 	camera_->release();
+
+	if (!ret && cached) {
+		cancelRevalidation_ = false;
+		revalidationThread_ = std::thread(&CameraCapabilities::revalidateStreamConfigurations,
+						  this);
+	}
+
 	return ret;
 }
 
+/*
+ * Wait for the background revalidation of cached stream configurations to
+ * complete, interrupting it. This must be called before acquiring the camera.
+ */
+void CameraCapabilities::finishRevalidation()
+{
+	if (!revalidationThread_.joinable())
+		return;
+
+	cancelRevalidation_ = true;
+	revalidationThread_.join();
+}
+
+std::string CameraCapabilities::cachePath() const
+{
+	if (cacheKey_.empty())
+		return {};
+
+	std::string dir;
+	const char *env = utils::secure_getenv("LIBCAMERA_HAL_CACHE_DIR");
+	if (env)
+		dir = env;
+#if defined(__ANDROID__)
+	else
+		dir = "/data/vendor/camera/libcamera";
+#endif
+
+	if (dir.empty())
+		return {};
+
+	/* Camera IDs contain characters that are not suitable for file names. */
+	std::string name = camera_->id();
+	std::replace_if(name.begin(), name.end(),
+			[](char c) { return !isalnum(c); }, '_');
+
+	return dir + "/" + name + ".capabilities";
+}
+
+/*
+ * Serialize the stream configurations, with one entry per line. The first line
+ * holds the cache key.
+ */
+std::string CameraCapabilities::serializeStreamConfigurations() const
+{
+	std::ostringstream out;
+
+	out << cacheKey_ << "\n";
+	out << "raw " << rawStreamAvailable_ << "\n";
+	out << "maxFrameDuration " << maxFrameDuration_ << "\n";
+	out << "maxJpegBufferSize " << maxJpegBufferSize_ << "\n";
+
+	for (const auto &[androidFormat, pixelFormat] : formatsMap_)
+		out << "format " << androidFormat << " " << pixelFormat.fourcc()
+		    << " " << pixelFormat.modifier() << "\n";
+
+	for (const Camera3StreamConfiguration &entry : streamConfigurations_)
+		out << "stream " << entry.resolution.width << " "
+		    << entry.resolution.height << " " << entry.androidFormat << " "
+		    << entry.minFrameDurationNsec << " "
+		    << entry.maxFrameDurationNsec << "\n";
+
+	for (const HighSpeedConfiguration &entry : highSpeedConfigurations_)
+		out << "highSpeed " << entry.resolution.width << " "
+		    << entry.resolution.height << " " << entry.fps << "\n";
+
+	return out.str();
+}
+
+bool CameraCapabilities::loadStreamConfigurations()
+{
+	const std::string path = cachePath();
+	if (path.empty())
+		return false;
+
+	std::ifstream file(path);
+	if (!file.is_open())
+		return false;
+
+	std::string line;
+	if (!std::getline(file, line) || line != cacheKey_) {
+		LOG(HAL, Debug) << "Stale capabilities cache " << path;
+		return false;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream in(line);
+		std::string type;
+
+		in >> type;
+
+		if (type == "raw") {
+			in >> rawStreamAvailable_;
+		} else if (type == "maxFrameDuration") {
+			in >> maxFrameDuration_;
+		} else if (type == "maxJpegBufferSize") {
+			in >> maxJpegBufferSize_;
+		} else if (type == "format") {
+			int androidFormat;
+			uint32_t fourcc;
+			uint64_t modifier;
+
+			in >> androidFormat >> fourcc >> modifier;
+			formatsMap_[androidFormat] = PixelFormat(fourcc, modifier);
+		} else if (type == "stream") {
+			Camera3StreamConfiguration entry;
+
+			in >> entry.resolution.width >> entry.resolution.height
+			   >> entry.androidFormat >> entry.minFrameDurationNsec
+			   >> entry.maxFrameDurationNsec;
+			streamConfigurations_.push_back(entry);
+		} else if (type == "highSpeed") {
+			HighSpeedConfiguration entry;
+
+			in >> entry.resolution.width >> entry.resolution.height
+			   >> entry.fps;
+			highSpeedConfigurations_.push_back(entry);
+		} else {
+			in.setstate(std::ios::failbit);
+		}
+
+		if (in.fail()) {
+			LOG(HAL, Warning) << "Invalid capabilities cache " << path;
+			formatsMap_.clear();
+			streamConfigurations_.clear();
+			highSpeedConfigurations_.clear();
+			return false;
+		}
+	}
+
+	LOG(HAL, Debug) << "Loaded stream configurations from " << path;
+
+	return true;
+}
+
+void CameraCapabilities::storeStreamConfigurations() const
+{
+	const std::string path = cachePath();
+	if (path.empty())
+		return;
+
+	/* Write to a temporary file and rename it to update the cache atomically. */
+	const std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+
+	{
+		std::ofstream file(tmpPath);
+		file << serializeStreamConfigurations();
+		file.close();
+
+		if (file.fail()) {
+			LOG(HAL, Debug) << "Failed to write " << tmpPath;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) < 0) {
+		LOG(HAL, Debug) << "Failed to update " << path;
+		unlink(tmpPath.c_str());
+	}
+}
+
+/*
+ * Enumerate the stream configurations again, and update the cache if they
+ * differ from the cached ones. The static metadata can't change once reported
+ * to the camera service, the new stream configurations are used from the next
+ * startup.
+ */
+void CameraCapabilities::revalidateStreamConfigurations()
+{
+	CameraCapabilities fresh;
+	fresh.camera_ = camera_;
+	fresh.cacheKey_ = cacheKey_;
+	fresh.cancel_ = &cancelRevalidation_;
+	fresh.rawStreamAvailable_ = false;
+	fresh.maxFrameDuration_ = 0;
+	fresh.maxJpegBufferSize_ = 0;
+
+	/* The camera is in use, try again at the next startup. */
+	if (camera_->acquire())
+		return;
+
+	int ret = fresh.initializeStreamConfigurations();
+	camera_->release();
+
+	if (ret)
+		return;
+
+	if (fresh.serializeStreamConfigurations() == serializeStreamConfigurations())
+		return;
+
+	LOG(HAL, Warning)
+		<< "Stream configurations of camera " << camera_->id()
+		<< " have changed, they will be updated at the next startup";
+
+	fresh.storeStreamConfigurations();
+}
+
 std::vector<Size>
 CameraCapabilities::initializeYUVResolutions(const PixelFormat &pixelFormat,
 					     const std::vector<Size> &resolutions)
@@ -643,6 +919,9 @@ int CameraCapabilities::initializeStreamConfigurations()
 		}
 
 		for (const Size &res : resolutions) {
+			if (cancel_ && *cancel_)
+				return -ECANCELED;
+
 			/*
 			 * Configure the Camera with the collected format and
 			 * resolution to get an updated list of controls.
@@ -667,6 +946,22 @@ int CameraCapabilities::initializeStreamConfigurations()
 			int64_t minFrameDuration = frameDurations->second.min().get<int64_t>() * 1000;
 			int64_t maxFrameDuration = frameDurations->second.max().get<int64_t>() * 1000;
 
+			/*
+			 * Record the high speed video configurations before
+			 * capping the frame durations. High speed streams use
+			 * the implementation defined format, for the preview
+			 * and video encoder surfaces.
+			 */
+			if (androidFormat == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED &&
+			    res >= kHighSpeedMinResolution) {
+				unsigned int maxFps = floor(1e9 / minFrameDuration + 0.05f);
+
+				for (int32_t fps : kHighSpeedFps) {
+					if (maxFps >= static_cast<unsigned int>(fps))
+						highSpeedConfigurations_.push_back({ res, fps });
+				}
+			}
+
 			/*
 			 * Cap min frame duration to 30 FPS with 1% tolerance.
 			 *
@@ -1363,6 +1658,35 @@ int CameraCapabilities::initializeStaticMetadata()
 	staticMetadata_->addEntry(ANDROID_CONTROL_AE_AVAILABLE_TARGET_FPS_RANGES,
 				  availableAeFpsTarget);
 
+	/*
+	 * Register the high speed video configurations as { width, height,
+	 * fps_min, fps_max, batch_size_max }. Each frame rate is reported with
+	 * a { 30, fps } range for preview and a { fps, fps } range for
+	 * recording, and the framework submits requests in batches of fps / 30.
+	 */
+	if (!highSpeedConfigurations_.empty()) {
+		std::vector<int32_t> highSpeedConfigurations;
+		highSpeedConfigurations.reserve(highSpeedConfigurations_.size() * 10);
+
+		for (const HighSpeedConfiguration &config : highSpeedConfigurations_) {
+			for (int32_t minFpsRange : { 30, config.fps }) {
+				highSpeedConfigurations.push_back(config.resolution.width);
+				highSpeedConfigurations.push_back(config.resolution.height);
+				highSpeedConfigurations.push_back(minFpsRange);
+				highSpeedConfigurations.push_back(config.fps);
+				highSpeedConfigurations.push_back(config.fps / 30);
+			}
+
+			LOG(HAL, Debug)
+				<< "High speed video configuration: "
+				<< config.resolution << "@" << config.fps;
+		}
+
+		staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS,
+					  highSpeedConfigurations);
+		availableCharacteristicsKeys_.insert(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS);
+	}
+
 	std::vector<int64_t> availableStallDurations;
 	for (const auto &entry : streamConfigurations_) {
 		if (entry.androidFormat != HAL_PIXEL_FORMAT_BLOB)
@@ -1380,9 +1704,8 @@ int CameraCapabilities::initializeStaticMetadata()
 	staticMetadata_->addEntry(ANDROID_SCALER_CROPPING_TYPE, croppingType);
 
 	/* Request static metadata. */
-	int32_t partialResultCount = 1;
 	staticMetadata_->addEntry(ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
-				  partialResultCount);
+				  kPartialResultCount);
 
 	{
 		/* Default the value to 2 if not reported by the camera. */
@@ -7,9 +7,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <libcamera/base/class.h>
@@ -23,14 +26,33 @@
 class CameraCapabilities
 {
 public:
+	struct HighSpeedConfiguration {
+		libcamera::Size resolution;
+		int32_t fps;
+	};
+
+	/*
+	 * Capture results are delivered in two parts, the sensor timestamp is
+	 * sent as soon as the first buffer of a request completes, and the rest
+	 * of the result metadata when the request completes.
+	 */
+	static constexpr int32_t kPartialResultCount = 2;
+
 	CameraCapabilities() = default;
+	~CameraCapabilities();
 
 	int initialize(std::shared_ptr<libcamera::Camera> camera,
-		       int orientation, int facing);
+		       int orientation, int facing,
+		       const std::string &cacheKey = {});
+	void finishRevalidation();
 
 	CameraMetadata *staticMetadata() const { return staticMetadata_.get(); }
 	libcamera::PixelFormat toPixelFormat(int format) const;
 	unsigned int maxJpegBufferSize() const { return maxJpegBufferSize_; }
+	const std::vector<HighSpeedConfiguration> &highSpeedConfigurations() const
+	{
+		return highSpeedConfigurations_;
+	}
 
 	std::unique_ptr<CameraMetadata> requestTemplateManual() const;
 	std::unique_ptr<CameraMetadata> requestTemplatePreview() const;
@@ -50,6 +72,7 @@ private:
 	bool validateManualSensorCapability();
 	bool validateManualPostProcessingCapability();
 	bool validateBurstCaptureCapability();
+	bool validateConstrainedHighSpeedCapability();
 
 	std::set<camera_metadata_enum_android_request_available_capabilities>
 		computeCapabilities();
@@ -64,6 +87,12 @@ private:
 	initializeRawResolutions(const libcamera::PixelFormat &pixelFormat);
 	int initializeStreamConfigurations();
 
+	std::string cachePath() const;
+	std::string serializeStreamConfigurations() const;
+	bool loadStreamConfigurations();
+	void storeStreamConfigurations() const;
+	void revalidateStreamConfigurations();
+
 	int initializeStaticMetadata();
 
 	std::shared_ptr<libcamera::Camera> camera_;
@@ -76,6 +105,7 @@ private:
 	std::set<camera_metadata_enum_android_request_available_capabilities> capabilities_;
 
 	std::vector<Camera3StreamConfiguration> streamConfigurations_;
+	std::vector<HighSpeedConfiguration> highSpeedConfigurations_;
 	std::map<int, libcamera::PixelFormat> formatsMap_;
 	std::unique_ptr<CameraMetadata> staticMetadata_;
 	unsigned int maxJpegBufferSize_;
@@ -83,4 +113,10 @@ private:
 	std::set<int32_t> availableCharacteristicsKeys_;
 	std::set<int32_t> availableRequestKeys_;
 	std::set<int32_t> availableResultKeys_;
+
+	/* Stream configurations cache, see initialize() */
+	std::string cacheKey_;
+	std::thread revalidationThread_;
+	std::atomic<bool> cancelRevalidation_{ false };
+	const std::atomic<bool> *cancel_ = nullptr;
 };
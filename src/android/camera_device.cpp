@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <fstream>
 #include <set>
+#include <sstream>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <vector>
@@ -18,6 +19,7 @@
 #include <libcamera/base/unique_fd.h>
 #include <libcamera/base/utils.h>
 
+#include <libcamera/camera_manager.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/fence.h>
@@ -38,6 +40,12 @@ LOG_DECLARE_CATEGORY(HAL)
 
 namespace {
 
+/*
+ * Maximum number of result metadata packs kept for reuse. This covers the
+ * requests in flight in the pipeline handlers.
+ */
+constexpr size_t kMaxResultMetadataPoolSize = 16;
+
 /*
  * \struct Camera3StreamConfig
  * \brief Data to store StreamConfiguration associated with camera3_stream(s)
@@ -248,8 +256,12 @@ bool validateCropRotate(const camera3_stream_configuration_t &streamList)
 
 CameraDevice::CameraDevice(unsigned int id, std::shared_ptr<Camera> camera)
 	: id_(id), state_(State::Stopped), camera_(std::move(camera)),
-	  facing_(CAMERA_FACING_FRONT), orientation_(0)
+	  sendingResults_(false), resultsStats_{}, resultEntryHighWater_(0), resultDataHighWater_(0),
+	  facing_(CAMERA_FACING_FRONT), orientation_(0),
+	  postProcessingWorkers_(1), highSpeedMode_(false), batchSize_(1),
+	  batchRemaining_(0)
 {
+	camera_->bufferCompleted.connect(this, &CameraDevice::bufferComplete);
 	camera_->requestCompleted.connect(this, &CameraDevice::requestComplete);
 
 	maker_ = "libcamera";
@@ -376,7 +388,21 @@ int CameraDevice::initialize(const CameraConfigData *cameraConfigData)
 		orientation_ = 0;
 	}
 
-	return capabilities_.initialize(camera_, orientation_, facing_);
+	if (cameraConfigData)
+		postProcessingWorkers_ = cameraConfigData->postProcessingWorkers;
+
+	/*
+	 * Key the cached capabilities by the libcamera version, the sensor
+	 * model and the camera configuration, they are re-enumerated when any
+	 * of them changes.
+	 */
+	std::ostringstream cacheKey;
+	cacheKey << camera_->id() << ";" << CameraManager::version() << ";"
+		 << properties.get(properties::Model).value_or("") << ";"
+		 << facing_ << ";" << orientation_ << ";" << postProcessingWorkers_;
+
+	return capabilities_.initialize(camera_, orientation_, facing_,
+					cacheKey.str());
 }
 
 /*
@@ -385,6 +411,9 @@ int CameraDevice::initialize(const CameraConfigData *cameraConfigData)
  */
 int CameraDevice::open(const hw_module_t *hardwareModule)
 {
+	/* Make sure the capabilities are not being revalidated. */
+	capabilities_.finishRevalidation();
+
 	int ret = camera_->acquire();
 	if (ret) {
 		LOG(HAL, Error) << "Failed to acquire the camera";
@@ -424,10 +453,29 @@ void CameraDevice::flush()
 		state_ = State::Flushing;
 	}
 
-	camera_->stop();
+	/*
+	 * Cancel the requests that haven't started processing and wait for the
+	 * in-flight requests to complete, without stopping the camera. Fall
+	 * back to stopping the camera if the requests don't complete in time,
+	 * as flush() must return within one second.
+	 */
+	bool flushed = false;
+	if (!camera_->flush()) {
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		flushed = descriptorsDrained_.wait_for(descriptorsLock, kFlushTimeout,
+						       [&]() LIBCAMERA_TSA_REQUIRES(descriptorsMutex_) {
+							       return descriptors_.empty() &&
+								      !sendingResults_;
+						       });
+	}
+
+	if (!flushed) {
+		LOG(HAL, Warning) << "Failed to flush requests, stopping camera";
+		camera_->stop();
+	}
 
 	MutexLocker stateLock(stateMutex_);
-	state_ = State::Stopped;
+	state_ = flushed ? State::Running : State::Stopped;
 }
 
 void CameraDevice::stop()
@@ -439,9 +487,16 @@ void CameraDevice::stop()
 	{
 		MutexLocker descriptorsLock(descriptorsMutex_);
 		descriptors_ = {};
+
+		LOG(HAL, Debug)
+			<< "Sent " << resultsStats_.sent << " capture results, "
+			<< resultsStats_.contended << " contended completions, "
+			<< resultsStats_.delegated << " delegated to another thread";
+		resultsStats_ = {};
 	}
 
 	streams_.clear();
+	batchRemaining_ = 0;
 
 	state_ = State::Stopped;
 }
@@ -536,6 +591,14 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		return -EINVAL;
 #endif
 
+	highSpeedMode_ = stream_list->operation_mode ==
+			 CAMERA3_STREAM_CONFIGURATION_CONSTRAINED_HIGH_SPEED_MODE;
+	batchSize_ = 1;
+	batchRemaining_ = 0;
+
+	if (highSpeedMode_ && !validateHighSpeedConfiguration(*stream_list))
+		return -EINVAL;
+
 	/*
 	 * Generate an empty configuration, and construct a StreamConfiguration
 	 * for each camera3_stream to add to it.
@@ -554,6 +617,9 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 	streams_.clear();
 	streams_.reserve(stream_list->num_streams);
 
+	/* The result metadata usage depends on the stream configuration. */
+	resetResultMetadataPool();
+
 	std::vector<Camera3StreamConfig> streamConfigs;
 	streamConfigs.reserve(stream_list->num_streams);
 
@@ -744,32 +810,6 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 	return 0;
 }
 
-std::unique_ptr<HALFrameBuffer>
-CameraDevice::createFrameBuffer(const buffer_handle_t camera3buffer,
-				PixelFormat pixelFormat, const Size &size)
-{
-	CameraBuffer buf(camera3buffer, pixelFormat, size, PROT_READ);
-	if (!buf.isValid()) {
-		LOG(HAL, Fatal) << "Failed to create CameraBuffer";
-		return nullptr;
-	}
-
-	std::vector<FrameBuffer::Plane> planes(buf.numPlanes());
-	for (size_t i = 0; i < buf.numPlanes(); ++i) {
-		SharedFD fd{ camera3buffer->data[i] };
-		if (!fd.isValid()) {
-			LOG(HAL, Fatal) << "No valid fd";
-			return nullptr;
-		}
-
-		planes[i].fd = fd;
-		planes[i].offset = buf.offset(i);
-		planes[i].length = buf.size(i);
-	}
-
-	return std::make_unique<HALFrameBuffer>(planes, camera3buffer);
-}
-
 int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
 {
 	const CameraMetadata &settings = descriptor->settings_;
@@ -825,9 +865,69 @@ int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
 		controls.set(controls::draft::TestPatternMode, testPatternMode);
 	}
 
+	/*
+	 * In constrained high speed mode the frame rate is fixed by the AE
+	 * target FPS range, which also sets the size of the request batches.
+	 */
+	if (highSpeedMode_ &&
+	    settings.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry) &&
+	    entry.data.i32[0] > 0 && entry.data.i32[1] >= entry.data.i32[0]) {
+		const int32_t *data = entry.data.i32;
+		int64_t minFrameDuration = 1000000 / data[1];
+		int64_t maxFrameDuration = 1000000 / data[0];
+
+		controls.set(controls::FrameDurationLimits,
+			     { minFrameDuration, maxFrameDuration });
+
+		batchSize_ = std::max(data[1] / 30, 1);
+	}
+
 	return 0;
 }
 
+bool CameraDevice::validateHighSpeedConfiguration(const camera3_stream_configuration_t &streamList) const
+{
+	const std::vector<CameraCapabilities::HighSpeedConfiguration> &configs =
+		capabilities_.highSpeedConfigurations();
+	if (configs.empty()) {
+		LOG(HAL, Error) << "Constrained high speed mode not supported";
+		return false;
+	}
+
+	/* At most a preview and a video encoder stream are allowed. */
+	if (streamList.num_streams > 2) {
+		LOG(HAL, Error)
+			<< "Too many streams in constrained high speed mode: "
+			<< streamList.num_streams;
+		return false;
+	}
+
+	for (unsigned int i = 0; i < streamList.num_streams; ++i) {
+		const camera3_stream_t *stream = streamList.streams[i];
+		Size size(stream->width, stream->height);
+
+		if (stream->format != HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
+			LOG(HAL, Error)
+				<< "Unsupported format " << utils::hex(stream->format)
+				<< " in constrained high speed mode";
+			return false;
+		}
+
+		auto it = std::find_if(configs.begin(), configs.end(),
+				       [&](const CameraCapabilities::HighSpeedConfiguration &config) {
+					       return config.resolution == size;
+				       });
+		if (it == configs.end()) {
+			LOG(HAL, Error)
+				<< "Unsupported size " << size
+				<< " in constrained high speed mode";
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void CameraDevice::abortRequest(Camera3RequestDescriptor *descriptor) const
 {
 	notifyError(descriptor->frameNumber_, nullptr, CAMERA3_MSG_ERROR_REQUEST);
@@ -965,15 +1065,13 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 
 		case CameraStream::Type::Direct:
 			/*
-			 * Create a libcamera buffer using the dmabuf
-			 * descriptors of the camera3Buffer for each stream and
-			 * associate it with the Camera3RequestDescriptor for
-			 * lifetime management only.
+			 * Retrieve the libcamera buffer wrapping the dmabuf
+			 * descriptors of the camera3Buffer from the stream
+			 * buffer cache, and associate it with the
+			 * Camera3RequestDescriptor for lifetime management.
 			 */
 			buffer.frameBuffer =
-				createFrameBuffer(*buffer.camera3Buffer,
-						  cameraStream->configuration().pixelFormat,
-						  cameraStream->configuration().size);
+				cameraStream->frameBuffer(*buffer.camera3Buffer);
 			frameBuffer = buffer.frameBuffer.get();
 			acquireFence = std::move(buffer.fence);
 			LOG(HAL, Debug) << ss.str() << " (direct)";
@@ -1054,11 +1152,23 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 
 	/*
 	 * Translate controls from Android to libcamera and queue the request
-	 * to the camera.
+	 * to the camera. The requests of a high speed batch share the settings
+	 * of the first request of the batch, reuse its controls.
 	 */
-	int ret = processControls(descriptor.get());
-	if (ret)
-		return ret;
+	int ret;
+	if (highSpeedMode_ && batchRemaining_) {
+		descriptor->request_->controls().merge(batchControls_);
+		batchRemaining_--;
+	} else {
+		ret = processControls(descriptor.get());
+		if (ret)
+			return ret;
+
+		if (highSpeedMode_) {
+			batchControls_ = descriptor->request_->controls();
+			batchRemaining_ = batchSize_ - 1;
+		}
+	}
 
 	/*
 	 * If flush is in progress set the request status to error and place it
@@ -1103,6 +1213,36 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	return 0;
 }
 
+/**
+ * \brief Handle the completion of a buffer in a capture request
+ * \param[in] request The request the buffer belongs to
+ * \param[in] buffer The completed buffer
+ *
+ * The first successfully completed buffer of a request marks the start of the
+ * exposure being available. Notify the shutter event and send the sensor
+ * timestamp as a partial result right away instead of waiting for all the
+ * buffers and the metadata of the request to complete, which lets the camera
+ * framework start processing the frame earlier.
+ *
+ * The buffer timestamp is the start of exposure timestamp reported by the
+ * pipeline handler, and is identical to the controls::SensorTimestamp reported
+ * in the request metadata at completion time.
+ */
+void CameraDevice::bufferComplete(Request *request, FrameBuffer *buffer)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	if (descriptor->shutterNotified_)
+		return;
+
+	const FrameMetadata &metadata = buffer->metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess || !metadata.timestamp)
+		return;
+
+	notifyShutter(descriptor, metadata.timestamp);
+}
+
 void CameraDevice::requestComplete(Request *request)
 {
 	Camera3RequestDescriptor *descriptor =
@@ -1137,28 +1277,40 @@ void CameraDevice::requestComplete(Request *request)
 	/*
 	 * If the Request has failed, abort the request by notifying the error
 	 * and complete the request with all buffers in error state.
+	 *
+	 * A request can't be reported as failed once its shutter has been
+	 * notified. Report the result metadata and all the buffers as failed
+	 * instead in that case.
 	 */
 	if (request->status() != Request::RequestComplete) {
 		LOG(HAL, Error) << "Request " << request->cookie()
 				<< " not successfully completed: "
 				<< request->status();
 
-		abortRequest(descriptor);
+		if (descriptor->shutterNotified_) {
+			notifyError(descriptor->frameNumber_, nullptr,
+				    CAMERA3_MSG_ERROR_RESULT);
+			for (auto &buffer : descriptor->buffers_)
+				setBufferStatus(buffer, Camera3RequestDescriptor::Status::Error);
+		} else {
+			abortRequest(descriptor);
+		}
+
 		completeDescriptor(descriptor);
 
 		return;
 	}
 
 	/*
-	 * Notify shutter as soon as we have verified we have a valid request.
-	 *
-	 * \todo The shutter event notification should be sent to the framework
-	 * as soon as possible, earlier than request completion time.
+	 * Notify shutter now if it hasn't been notified when the first buffer
+	 * completed.
 	 */
-	uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
-								 .get(controls::SensorTimestamp)
-								 .value_or(0));
-	notifyShutter(descriptor->frameNumber_, sensorTimestamp);
+	if (!descriptor->shutterNotified_) {
+		uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
+									 .get(controls::SensorTimestamp)
+									 .value_or(0));
+		notifyShutter(descriptor, sensorTimestamp);
+	}
 
 	LOG(HAL, Debug) << "Request " << request->cookie() << " completed with "
 			<< descriptor->request_->buffers().size() << " streams";
@@ -1236,35 +1388,67 @@ void CameraDevice::requestComplete(Request *request)
  * capture (or have been generated via post-processing) and the request is ready
  * to be sent back to the framework.
  *
+ * Capture results are sent by a single thread at a time, without holding the
+ * descriptors lock while calling back to the framework. If another thread is
+ * already sending results, the descriptor is left for that thread to send.
+ *
  * \context This function is \threadsafe.
  */
 void CameraDevice::completeDescriptor(Camera3RequestDescriptor *descriptor)
 {
-	MutexLocker lock(descriptorsMutex_);
+	MutexLocker lock(descriptorsMutex_, std::defer_lock);
+	if (!lock.try_lock()) {
+		lock.lock();
+		resultsStats_.contended++;
+	}
+
 	descriptor->complete_ = true;
 
-	sendCaptureResults();
+	if (sendingResults_) {
+		resultsStats_.delegated++;
+		return;
+	}
+
+	sendingResults_ = true;
+
+	while (true) {
+		std::vector<std::unique_ptr<Camera3RequestDescriptor>> completed;
+
+		while (!descriptors_.empty() && !descriptors_.front()->isPending()) {
+			completed.push_back(std::move(descriptors_.front()));
+			descriptors_.pop();
+		}
+
+		if (completed.empty())
+			break;
+
+		resultsStats_.sent += completed.size();
+
+		lock.unlock();
+		sendCaptureResults(completed);
+		lock.lock();
+	}
+
+	sendingResults_ = false;
+
+	if (descriptors_.empty())
+		descriptorsDrained_.notify_all();
 }
 
 /**
  * \brief Sequentially send capture results to the framework
+ * \param[in] descriptors The completed descriptors, in queue order
  *
- * Iterate over the descriptors queue to send completed descriptors back to the
- * framework, in the same order as they have been queued. For each complete
- * descriptor, populate a locally-scoped camera3_capture_result_t from the
- * descriptor, send the capture result back by calling the
- * process_capture_result() callback, and remove the descriptor from the queue.
- * Stop iterating if the descriptor at the front of the queue is not complete.
+ * For each complete descriptor, populate a locally-scoped
+ * camera3_capture_result_t from the descriptor and send the capture result
+ * back by calling the process_capture_result() callback.
  *
  * This function should never be called directly in the codebase. Use
  * completeDescriptor() instead.
  */
-void CameraDevice::sendCaptureResults()
+void CameraDevice::sendCaptureResults(std::vector<std::unique_ptr<Camera3RequestDescriptor>> &descriptors)
 {
-	while (!descriptors_.empty() && !descriptors_.front()->isPending()) {
-		auto descriptor = std::move(descriptors_.front());
-		descriptors_.pop();
-
+	for (std::unique_ptr<Camera3RequestDescriptor> &descriptor : descriptors) {
 		camera3_capture_result_t captureResult = {};
 
 		captureResult.frame_number = descriptor->frameNumber_;
@@ -1297,9 +1481,16 @@ void CameraDevice::sendCaptureResults()
 		captureResult.output_buffers = resultBuffers.data();
 
 		if (descriptor->status_ == Camera3RequestDescriptor::Status::Success)
-			captureResult.partial_result = 1;
+			captureResult.partial_result = CameraCapabilities::kPartialResultCount;
 
 		callbacks_->process_capture_result(callbacks_, &captureResult);
+
+		/*
+		 * The framework copies the result metadata, the pack can be
+		 * reused for the next requests.
+		 */
+		if (descriptor->resultMetadata_)
+			recycleResultMetadata(std::move(descriptor->resultMetadata_));
 	}
 }
 
@@ -1361,15 +1552,34 @@ std::string CameraDevice::logPrefix() const
 	return "'" + camera_->id() + "'";
 }
 
-void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
+/*
+ * Notify the shutter event and send the sensor timestamp as the first partial
+ * capture result. The final capture result, sent by sendCaptureResults(),
+ * carries the rest of the result metadata.
+ */
+void CameraDevice::notifyShutter(Camera3RequestDescriptor *descriptor,
+				 uint64_t timestamp)
 {
 	camera3_notify_msg_t notify = {};
 
 	notify.type = CAMERA3_MSG_SHUTTER;
-	notify.message.shutter.frame_number = frameNumber;
+	notify.message.shutter.frame_number = descriptor->frameNumber_;
 	notify.message.shutter.timestamp = timestamp;
 
 	callbacks_->notify(callbacks_, &notify);
+
+	descriptor->shutterNotified_ = true;
+
+	CameraMetadata partialMetadata(1, sizeof(int64_t));
+	partialMetadata.addEntry(ANDROID_SENSOR_TIMESTAMP,
+				 static_cast<int64_t>(timestamp));
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber_;
+	captureResult.result = partialMetadata.getMetadata();
+	captureResult.partial_result = 1;
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
 }
 
 void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
@@ -1388,8 +1598,70 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
 /*
  * Produce a set of fixed result metadata.
  */
+/*
+ * Retrieve an empty result metadata pack from the pool, or allocate a new one.
+ * The capacity of the pack is at least the requested capacity, or the
+ * high-water mark of the result metadata usage if larger, to avoid resizing
+ * it when adding entries.
+ */
 std::unique_ptr<CameraMetadata>
-CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) const
+CameraDevice::allocateResultMetadata(size_t entryCapacity, size_t dataCapacity)
+{
+	MutexLocker locker(resultMetadataMutex_);
+
+	entryCapacity = std::max(entryCapacity, resultEntryHighWater_);
+	dataCapacity = std::max(dataCapacity, resultDataHighWater_);
+
+	while (!resultMetadataPool_.empty()) {
+		std::unique_ptr<CameraMetadata> metadata =
+			std::move(resultMetadataPool_.back());
+		resultMetadataPool_.pop_back();
+
+		/* Drop the packs that are too small for the current usage. */
+		auto [entries, data] = metadata->capacity();
+		if (entries < entryCapacity || data < dataCapacity)
+			continue;
+
+		metadata->clear();
+		return metadata;
+	}
+
+	locker.unlock();
+
+	return std::make_unique<CameraMetadata>(entryCapacity, dataCapacity);
+}
+
+/*
+ * Return a result metadata pack to the pool once the capture result has been
+ * sent to the framework, and update the high-water marks with its usage.
+ */
+void CameraDevice::recycleResultMetadata(std::unique_ptr<CameraMetadata> metadata)
+{
+	if (!metadata->isValid())
+		return;
+
+	auto [entries, data] = metadata->usage();
+
+	MutexLocker locker(resultMetadataMutex_);
+
+	resultEntryHighWater_ = std::max(resultEntryHighWater_, entries);
+	resultDataHighWater_ = std::max(resultDataHighWater_, data);
+
+	if (resultMetadataPool_.size() < kMaxResultMetadataPoolSize)
+		resultMetadataPool_.push_back(std::move(metadata));
+}
+
+void CameraDevice::resetResultMetadataPool()
+{
+	MutexLocker locker(resultMetadataMutex_);
+
+	resultMetadataPool_.clear();
+	resultEntryHighWater_ = 0;
+	resultDataHighWater_ = 0;
+}
+
+std::unique_ptr<CameraMetadata>
+CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor)
 {
 	const ControlList &metadata = descriptor.request_->metadata();
 	const CameraMetadata &settings = descriptor.settings_;
@@ -1413,7 +1685,7 @@ CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) cons
 	 * Total bytes for JPEG metadata: 82
 	 */
 	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(88, 166);
+		allocateResultMetadata(88, 166);
 	if (!resultMetadata->isValid()) {
 		LOG(HAL, Error) << "Failed to allocate result metadata";
 		return nullptr;
@@ -1535,10 +1807,10 @@ CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) cons
 	resultMetadata->addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
 				 rolling_shutter_skew);
 
-	/* Add metadata tags reported by libcamera. */
-	const int64_t timestamp = metadata.get(controls::SensorTimestamp).value_or(0);
-	resultMetadata->addEntry(ANDROID_SENSOR_TIMESTAMP, timestamp);
-
+	/*
+	 * Add metadata tags reported by libcamera. The sensor timestamp has
+	 * been sent in the first partial result when notifying the shutter.
+	 */
 	const auto &pipelineDepth = metadata.get(controls::draft::PipelineDepth);
 	if (pipelineDepth)
 		resultMetadata->addEntry(ANDROID_REQUEST_PIPELINE_DEPTH,
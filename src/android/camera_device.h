@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <queue>
@@ -57,6 +58,7 @@ public:
 	const std::string &model() const { return model_; }
 	int facing() const { return facing_; }
 	int orientation() const { return orientation_; }
+	unsigned int postProcessingWorkers() const { return postProcessingWorkers_; }
 	unsigned int maxJpegBufferSize() const;
 
 	void setCallbacks(const camera3_callback_ops_t *callbacks);
@@ -64,6 +66,8 @@ public:
 	const camera_metadata_t *constructDefaultRequestSettings(int type);
 	int configureStreams(camera3_stream_configuration_t *stream_list);
 	int processCaptureRequest(camera3_capture_request_t *request);
+	void bufferComplete(libcamera::Request *request,
+			    libcamera::FrameBuffer *buffer);
 	void requestComplete(libcamera::Request *request);
 	void streamProcessingComplete(Camera3RequestDescriptor::StreamBuffer *bufferStream,
 				      Camera3RequestDescriptor::Status status);
@@ -76,6 +80,8 @@ private:
 
 	CameraDevice(unsigned int id, std::shared_ptr<libcamera::Camera> camera);
 
+	static constexpr std::chrono::milliseconds kFlushTimeout{ 900 };
+
 	enum class State {
 		Stopped,
 		Flushing,
@@ -84,23 +90,27 @@ private:
 
 	void stop() LIBCAMERA_TSA_EXCLUDES(stateMutex_);
 
-	std::unique_ptr<HALFrameBuffer>
-	createFrameBuffer(const buffer_handle_t camera3buffer,
-			  libcamera::PixelFormat pixelFormat,
-			  const libcamera::Size &size);
 	void abortRequest(Camera3RequestDescriptor *descriptor) const;
 	bool isValidRequest(camera3_capture_request_t *request) const;
-	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
+	void notifyShutter(Camera3RequestDescriptor *descriptor, uint64_t timestamp);
 	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
 			 camera3_error_msg_code code) const;
 	int processControls(Camera3RequestDescriptor *descriptor);
+	bool validateHighSpeedConfiguration(const camera3_stream_configuration_t &streamList) const;
 	void completeDescriptor(Camera3RequestDescriptor *descriptor)
 		LIBCAMERA_TSA_EXCLUDES(descriptorsMutex_);
-	void sendCaptureResults() LIBCAMERA_TSA_REQUIRES(descriptorsMutex_);
+	void sendCaptureResults(std::vector<std::unique_ptr<Camera3RequestDescriptor>> &descriptors)
+		LIBCAMERA_TSA_EXCLUDES(descriptorsMutex_);
 	void setBufferStatus(Camera3RequestDescriptor::StreamBuffer &buffer,
 			     Camera3RequestDescriptor::Status status);
 	std::unique_ptr<CameraMetadata> getResultMetadata(
-		const Camera3RequestDescriptor &descriptor) const;
+		const Camera3RequestDescriptor &descriptor);
+	std::unique_ptr<CameraMetadata> allocateResultMetadata(size_t entryCapacity,
+							       size_t dataCapacity)
+		LIBCAMERA_TSA_EXCLUDES(resultMetadataMutex_);
+	void recycleResultMetadata(std::unique_ptr<CameraMetadata> metadata)
+		LIBCAMERA_TSA_EXCLUDES(resultMetadataMutex_);
+	void resetResultMetadataPool() LIBCAMERA_TSA_EXCLUDES(resultMetadataMutex_);
 
 	unsigned int id_;
 	camera3_device_t camera3Device_;
@@ -120,12 +130,45 @@ private:
 	libcamera::Mutex descriptorsMutex_ LIBCAMERA_TSA_ACQUIRED_AFTER(stateMutex_);
 	std::queue<std::unique_ptr<Camera3RequestDescriptor>> descriptors_
 		LIBCAMERA_TSA_GUARDED_BY(descriptorsMutex_);
+	bool sendingResults_ LIBCAMERA_TSA_GUARDED_BY(descriptorsMutex_);
+	/* Signalled when all descriptors have been sent to the framework. */
+	libcamera::ConditionVariable descriptorsDrained_;
+
+	/* Capture results delivery statistics, reported when stopping. */
+	struct {
+		uint64_t sent;
+		uint64_t contended;
+		uint64_t delegated;
+	} resultsStats_ LIBCAMERA_TSA_GUARDED_BY(descriptorsMutex_);
+
+	/*
+	 * Result metadata packs are recycled once the capture results have been
+	 * sent to the framework. The high-water marks record the largest
+	 * result metadata usage for the current stream configuration.
+	 */
+	libcamera::Mutex resultMetadataMutex_ LIBCAMERA_TSA_ACQUIRED_AFTER(descriptorsMutex_);
+	std::vector<std::unique_ptr<CameraMetadata>> resultMetadataPool_
+		LIBCAMERA_TSA_GUARDED_BY(resultMetadataMutex_);
+	size_t resultEntryHighWater_ LIBCAMERA_TSA_GUARDED_BY(resultMetadataMutex_);
+	size_t resultDataHighWater_ LIBCAMERA_TSA_GUARDED_BY(resultMetadataMutex_);
 
 	std::string maker_;
 	std::string model_;
 
 	int facing_;
 	int orientation_;
+	unsigned int postProcessingWorkers_;
 
 	CameraMetadata lastSettings_;
+
+	/*
+	 * In constrained high speed mode the framework submits requests in
+	 * batches of batchSize_ requests that share the same settings. The
+	 * controls of the first request of a batch are applied to the other
+	 * batchRemaining_ requests without translating the settings again.
+	 */
+	bool highSpeedMode_;
+	unsigned int batchSize_;
+	unsigned int batchRemaining_;
+	libcamera::ControlList batchControls_;
 };
@@ -20,6 +20,12 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(HALConfig)
 
+namespace {
+
+constexpr int32_t kMaxPostProcessingWorkers = 8;
+
+} /* namespace */
+
 class CameraHalConfig::Private : public Extensible::Private
 {
 	LIBCAMERA_DECLARE_PUBLIC(CameraHalConfig)
@@ -33,6 +39,8 @@ private:
 	int parseCameraConfigData(const std::string &cameraId, const YamlObject &);
 	int parseLocation(const YamlObject &, CameraConfigData &cameraConfigData);
 	int parseRotation(const YamlObject &, CameraConfigData &cameraConfigData);
+	int parsePostProcessingWorkers(const YamlObject &,
+				       CameraConfigData &cameraConfigData);
 
 	std::map<std::string, CameraConfigData> *cameras_;
 };
@@ -55,6 +63,7 @@ int CameraHalConfig::Private::parseConfigFile(File &file,
 	 *   "camera0 id":
 	 *     location: value
 	 *     rotation: value
+	 *     post_processing_workers: value (optional)
 	 *     ...
 	 *
 	 *   "camera1 id":
@@ -106,6 +115,10 @@ int CameraHalConfig::Private::parseCameraConfigData(const std::string &cameraId,
 	if (parseRotation(cameraObject, cameraConfigData))
 		return -EINVAL;
 
+	/* Parse property "post_processing_workers" */
+	if (parsePostProcessingWorkers(cameraObject, cameraConfigData))
+		return -EINVAL;
+
 	return 0;
 }
 
@@ -145,6 +158,25 @@ int CameraHalConfig::Private::parseRotation(const YamlObject &cameraObject,
 	return 0;
 }
 
+int CameraHalConfig::Private::parsePostProcessingWorkers(const YamlObject &cameraObject,
+							 CameraConfigData &cameraConfigData)
+{
+	/* The number of post-processing workers is optional. */
+	if (!cameraObject.contains("post_processing_workers"))
+		return 0;
+
+	int32_t workers = cameraObject["post_processing_workers"].get<int32_t>(-1);
+
+	if (workers < 1 || workers > kMaxPostProcessingWorkers) {
+		LOG(HALConfig, Error)
+			<< "Invalid number of post-processing workers: " << workers;
+		return -EINVAL;
+	}
+
+	cameraConfigData.postProcessingWorkers = workers;
+	return 0;
+}
+
 CameraHalConfig::CameraHalConfig()
 	: Extensible(std::make_unique<Private>()), exists_(false), valid_(false)
 {
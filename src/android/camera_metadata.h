@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <tuple>
 #include <vector>
 
 #include <system/camera_metadata.h>
@@ -24,6 +25,8 @@ public:
 	CameraMetadata &operator=(const CameraMetadata &other);
 
 	std::tuple<size_t, size_t> usage() const;
+	std::tuple<size_t, size_t> capacity() const;
+	void clear();
 	bool resized() const { return resized_; }
 
 	bool isValid() const { return valid_; }
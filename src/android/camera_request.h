@@ -45,12 +45,12 @@ public:
 
 		CameraStream *stream;
 		buffer_handle_t *camera3Buffer;
-		std::unique_ptr<HALFrameBuffer> frameBuffer;
+		std::shared_ptr<HALFrameBuffer> frameBuffer;
 		libcamera::UniqueFD fence;
 		Status status = Status::Success;
 		libcamera::FrameBuffer *internalBuffer = nullptr;
 		const libcamera::FrameBuffer *srcBuffer = nullptr;
-		std::unique_ptr<CameraBuffer> dstBuffer;
+		std::shared_ptr<CameraBuffer> dstBuffer;
 		Camera3RequestDescriptor *request;
 
 	private:
@@ -76,6 +76,13 @@ public:
 	std::unique_ptr<libcamera::Request> request_;
 	std::unique_ptr<CameraMetadata> resultMetadata_;
 
+	/*
+	 * Set when the shutter notification and the sensor timestamp partial
+	 * result have been sent. Only accessed from the thread that emits the
+	 * libcamera::Camera completion signals.
+	 */
+	bool shutterNotified_ = false;
+
 	bool complete_ = false;
 	Status status_ = Status::Success;
 
@@ -7,10 +7,13 @@
 
 #include "camera_stream.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <map>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <libcamera/formats.h>
@@ -23,12 +26,150 @@
 #include "camera_device.h"
 #include "camera_metadata.h"
 #include "frame_buffer_allocator.h"
+#include "hal_framebuffer.h"
 #include "post_processor.h"
 
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(HAL)
 
+/*
+ * Cache the FrameBuffer wrappers and the CPU mappings of the gralloc buffers
+ * of a stream, keyed by buffer handle. The framework cycles through a small set
+ * of buffers for every stream, caching them avoids importing and mapping the
+ * buffers for every request. The cache lives as long as the CameraStream, and
+ * is thus invalidated when the streams are reconfigured.
+ *
+ * Buffer handles may be reused by the framework for newly allocated buffers.
+ * Entries are validated against the inode of the first dmabuf of the handle,
+ * and the least recently used entry is evicted when the cache is full.
+ */
+class CameraStream::BufferCache
+{
+public:
+	BufferCache()
+		: useCount_(0)
+	{
+	}
+
+	std::shared_ptr<HALFrameBuffer> frameBuffer(buffer_handle_t camera3Buffer,
+						    const StreamConfiguration &config);
+	std::shared_ptr<CameraBuffer> cameraBuffer(buffer_handle_t camera3Buffer,
+						   const StreamConfiguration &config);
+
+private:
+	static constexpr unsigned int kMaxEntries = 32;
+
+	struct Entry {
+		dev_t device;
+		ino_t inode;
+		uint64_t lastUse;
+		std::shared_ptr<HALFrameBuffer> frameBuffer;
+		std::shared_ptr<CameraBuffer> cameraBuffer;
+	};
+
+	Entry &entry(buffer_handle_t camera3Buffer) LIBCAMERA_TSA_REQUIRES(mutex_);
+
+	Mutex mutex_;
+	std::map<buffer_handle_t, Entry> entries_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	uint64_t useCount_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+CameraStream::BufferCache::Entry &
+CameraStream::BufferCache::entry(buffer_handle_t camera3Buffer)
+{
+	struct stat st = {};
+	if (camera3Buffer->numFds > 0)
+		fstat(camera3Buffer->data[0], &st);
+
+	auto it = entries_.find(camera3Buffer);
+	if (it != entries_.end() &&
+	    (it->second.device != st.st_dev || it->second.inode != st.st_ino)) {
+		LOG(HAL, Debug) << "Buffer handle reused, invalidating cache entry";
+		entries_.erase(it);
+		it = entries_.end();
+	}
+
+	if (it == entries_.end()) {
+		if (entries_.size() >= kMaxEntries) {
+			auto lru = std::min_element(entries_.begin(), entries_.end(),
+						    [](const auto &a, const auto &b) {
+							    return a.second.lastUse < b.second.lastUse;
+						    });
+			entries_.erase(lru);
+		}
+
+		it = entries_.emplace(camera3Buffer, Entry{}).first;
+		it->second.device = st.st_dev;
+		it->second.inode = st.st_ino;
+	}
+
+	it->second.lastUse = ++useCount_;
+	return it->second;
+}
+
+std::shared_ptr<HALFrameBuffer>
+CameraStream::BufferCache::frameBuffer(buffer_handle_t camera3Buffer,
+				       const StreamConfiguration &config)
+{
+	MutexLocker locker(mutex_);
+
+	Entry &cached = entry(camera3Buffer);
+	if (cached.frameBuffer)
+		return cached.frameBuffer;
+
+	CameraBuffer buf(camera3Buffer, config.pixelFormat, config.size, PROT_READ);
+	if (!buf.isValid()) {
+		LOG(HAL, Fatal) << "Failed to create CameraBuffer";
+		return nullptr;
+	}
+
+	std::vector<FrameBuffer::Plane> planes(buf.numPlanes());
+	for (size_t i = 0; i < buf.numPlanes(); ++i) {
+		/* Don't duplicate the fd of planes stored in the same buffer. */
+		if (i > 0 && camera3Buffer->data[i] == camera3Buffer->data[i - 1]) {
+			planes[i].fd = planes[i - 1].fd;
+			planes[i].offset = buf.offset(i);
+			planes[i].length = buf.size(i);
+			continue;
+		}
+
+		SharedFD fd{ camera3Buffer->data[i] };
+		if (!fd.isValid()) {
+			LOG(HAL, Fatal) << "No valid fd";
+			return nullptr;
+		}
+
+		planes[i].fd = fd;
+		planes[i].offset = buf.offset(i);
+		planes[i].length = buf.size(i);
+	}
+
+	cached.frameBuffer = std::make_shared<HALFrameBuffer>(planes, camera3Buffer);
+	return cached.frameBuffer;
+}
+
+std::shared_ptr<CameraBuffer>
+CameraStream::BufferCache::cameraBuffer(buffer_handle_t camera3Buffer,
+					const StreamConfiguration &config)
+{
+	MutexLocker locker(mutex_);
+
+	Entry &cached = entry(camera3Buffer);
+	if (cached.cameraBuffer)
+		return cached.cameraBuffer;
+
+	auto buffer = std::make_shared<CameraBuffer>(camera3Buffer,
+						     config.pixelFormat,
+						     config.size,
+						     PROT_READ | PROT_WRITE);
+	if (!buffer->isValid())
+		return nullptr;
+
+	cached.cameraBuffer = std::move(buffer);
+	return cached.cameraBuffer;
+}
+
 /*
  * \class CameraStream
  * \brief Map a camera3_stream_t to a StreamConfiguration
@@ -56,7 +197,7 @@ CameraStream::CameraStream(CameraDevice *const cameraDevice,
 			   CameraStream *const sourceStream, unsigned int index)
 	: cameraDevice_(cameraDevice), config_(config), type_(type),
 	  camera3Stream_(camera3Stream), sourceStream_(sourceStream),
-	  index_(index)
+	  index_(index), bufferCache_(std::make_unique<BufferCache>())
 {
 }
 
@@ -92,39 +233,53 @@ int CameraStream::configure()
 		output.size.width = camera3Stream_->width;
 		output.size.height = camera3Stream_->height;
 
-		switch (outFormat) {
-		case formats::NV12:
-			postProcessor_ = std::make_unique<PostProcessorYuv>();
-			break;
+		/*
+		 * Post-processors are not thread-safe, create one instance for
+		 * each worker thread.
+		 */
+		unsigned int numWorkers = cameraDevice_->postProcessingWorkers();
+		std::vector<PostProcessor *> postProcessors;
 
-		case formats::MJPEG:
-			postProcessor_ = std::make_unique<PostProcessorJpeg>(cameraDevice_);
-			break;
+		for (unsigned int i = 0; i < numWorkers; i++) {
+			std::unique_ptr<PostProcessor> postProcessor;
 
-		default:
-			LOG(HAL, Error) << "Unsupported format: " << outFormat;
-			return -EINVAL;
-		}
+			switch (outFormat) {
+			case formats::NV12:
+				postProcessor = std::make_unique<PostProcessorYuv>();
+				break;
 
-		int ret = postProcessor_->configure(configuration(), output);
-		if (ret)
-			return ret;
+			case formats::MJPEG:
+				postProcessor = std::make_unique<PostProcessorJpeg>(cameraDevice_);
+				break;
 
-		worker_ = std::make_unique<PostProcessorWorker>(postProcessor_.get());
-		postProcessor_->processComplete.connect(
-			this, [&](Camera3RequestDescriptor::StreamBuffer *streamBuffer,
-				  PostProcessor::Status status) {
-				Camera3RequestDescriptor::Status bufferStatus;
+			default:
+				LOG(HAL, Error) << "Unsupported format: " << outFormat;
+				return -EINVAL;
+			}
+
+			int ret = postProcessor->configure(configuration(), output);
+			if (ret)
+				return ret;
+
+			postProcessor->processComplete.connect(
+				this, [&](Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+					  PostProcessor::Status status) {
+					Camera3RequestDescriptor::Status bufferStatus;
+
+					if (status == PostProcessor::Status::Success)
+						bufferStatus = Camera3RequestDescriptor::Status::Success;
+					else
+						bufferStatus = Camera3RequestDescriptor::Status::Error;
 
-				if (status == PostProcessor::Status::Success)
-					bufferStatus = Camera3RequestDescriptor::Status::Success;
-				else
-					bufferStatus = Camera3RequestDescriptor::Status::Error;
+					cameraDevice_->streamProcessingComplete(streamBuffer,
+										bufferStatus);
+				});
 
-				cameraDevice_->streamProcessingComplete(streamBuffer,
-									bufferStatus);
-			});
+			postProcessors.push_back(postProcessor.get());
+			postProcessors_.push_back(std::move(postProcessor));
+		}
 
+		worker_ = std::make_unique<PostProcessorWorker>(postProcessors);
 		worker_->start();
 	}
 
@@ -185,11 +340,10 @@ int CameraStream::process(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
 		streamBuffer->fence.reset();
 	}
 
-	const StreamConfiguration &output = configuration();
-	streamBuffer->dstBuffer = std::make_unique<CameraBuffer>(
-		*streamBuffer->camera3Buffer, output.pixelFormat, output.size,
-		PROT_READ | PROT_WRITE);
-	if (!streamBuffer->dstBuffer->isValid()) {
+	streamBuffer->dstBuffer =
+		bufferCache_->cameraBuffer(*streamBuffer->camera3Buffer,
+					   configuration());
+	if (!streamBuffer->dstBuffer) {
 		LOG(HAL, Error) << "Failed to create destination buffer";
 		return -EINVAL;
 	}
@@ -199,9 +353,19 @@ int CameraStream::process(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
 	return 0;
 }
 
+/*
+ * Retrieve the FrameBuffer wrapping a gralloc buffer of a direct stream. The
+ * FrameBuffer is created the first time the buffer is used, and reused for the
+ * next requests.
+ */
+std::shared_ptr<HALFrameBuffer> CameraStream::frameBuffer(buffer_handle_t camera3Buffer)
+{
+	return bufferCache_->frameBuffer(camera3Buffer, configuration());
+}
+
 void CameraStream::flush()
 {
-	if (!postProcessor_)
+	if (!worker_)
 		return;
 
 	worker_->flush();
@@ -249,7 +413,7 @@ void CameraStream::putBuffer(FrameBuffer *buffer)
 
 /**
  * \class CameraStream::PostProcessorWorker
- * \brief Post-process a CameraStream in an internal thread
+ * \brief Post-process a CameraStream in internal threads
  *
  * If the association between CameraStream and camera3_stream_t dictated by
  * CameraStream::Type is internal or mapped, the stream is generated by post
@@ -258,10 +422,15 @@ void CameraStream::putBuffer(FrameBuffer *buffer)
  * requests is maintained by the PostProcessorWorker and it will run the
  * post-processing on an internal thread as soon as any request is available on
  * its queue.
+ *
+ * The worker runs one thread per post-processor, to process multiple requests
+ * concurrently during burst captures. Requests may thus complete out of order,
+ * the CameraDevice delivers the capture results to the framework in order.
  */
-CameraStream::PostProcessorWorker::PostProcessorWorker(PostProcessor *postProcessor)
-	: postProcessor_(postProcessor)
+CameraStream::PostProcessorWorker::PostProcessorWorker(const std::vector<PostProcessor *> &postProcessors)
 {
+	for (PostProcessor *postProcessor : postProcessors)
+		threads_.push_back(std::make_unique<WorkerThread>(this, postProcessor));
 }
 
 CameraStream::PostProcessorWorker::~PostProcessorWorker()
@@ -271,8 +440,10 @@ CameraStream::PostProcessorWorker::~PostProcessorWorker()
 		state_ = State::Stopped;
 	}
 
-	cv_.notify_one();
-	wait();
+	cv_.notify_all();
+
+	for (std::unique_ptr<WorkerThread> &thread : threads_)
+		thread->wait();
 }
 
 void CameraStream::PostProcessorWorker::start()
@@ -283,7 +454,8 @@ void CameraStream::PostProcessorWorker::start()
 		state_ = State::Running;
 	}
 
-	Thread::start();
+	for (std::unique_ptr<WorkerThread> &thread : threads_)
+		thread->start();
 }
 
 void CameraStream::PostProcessorWorker::queueRequest(Camera3RequestDescriptor::StreamBuffer *dest)
@@ -297,7 +469,7 @@ void CameraStream::PostProcessorWorker::queueRequest(Camera3RequestDescriptor::S
 	cv_.notify_one();
 }
 
-void CameraStream::PostProcessorWorker::run()
+void CameraStream::PostProcessorWorker::run(PostProcessor *postProcessor)
 {
 	MutexLocker locker(mutex_);
 
@@ -313,18 +485,23 @@ void CameraStream::PostProcessorWorker::run()
 		requests_.pop();
 		locker.unlock();
 
-		postProcessor_->process(streamBuffer);
+		postProcessor->process(streamBuffer);
 
 		locker.lock();
 	}
 
+	/*
+	 * The first thread to notice the flush completes all pending requests
+	 * with an error. The other threads stop after completing the request
+	 * they are processing, if any.
+	 */
 	if (state_ == State::Flushing) {
 		std::queue<Camera3RequestDescriptor::StreamBuffer *> requests =
 			std::move(requests_);
 		locker.unlock();
 
 		while (!requests.empty()) {
-			postProcessor_->processComplete.emit(
+			postProcessor->processComplete.emit(
 				requests.front(), PostProcessor::Status::Error);
 			requests.pop();
 		}
@@ -340,5 +517,5 @@ void CameraStream::PostProcessorWorker::flush()
 	state_ = State::Flushing;
 	lock.unlock();
 
-	cv_.notify_one();
+	cv_.notify_all();
 }
@@ -130,10 +130,13 @@ public:
 	int process(Camera3RequestDescriptor::StreamBuffer *streamBuffer);
 	libcamera::FrameBuffer *getBuffer();
 	void putBuffer(libcamera::FrameBuffer *buffer);
+	std::shared_ptr<HALFrameBuffer> frameBuffer(buffer_handle_t camera3Buffer);
 	void flush();
 
 private:
-	class PostProcessorWorker : public libcamera::Thread
+	class BufferCache;
+
+	class PostProcessorWorker
 	{
 	public:
 		enum class State {
@@ -142,18 +145,34 @@ private:
 			Flushing,
 		};
 
-		PostProcessorWorker(PostProcessor *postProcessor);
+		PostProcessorWorker(const std::vector<PostProcessor *> &postProcessors);
 		~PostProcessorWorker();
 
 		void start();
 		void queueRequest(Camera3RequestDescriptor::StreamBuffer *request);
 		void flush();
 
-	protected:
-		void run() override;
-
 	private:
-		PostProcessor *postProcessor_;
+		class WorkerThread : public libcamera::Thread
+		{
+		public:
+			WorkerThread(PostProcessorWorker *worker,
+				     PostProcessor *postProcessor)
+				: worker_(worker), postProcessor_(postProcessor)
+			{
+			}
+
+		protected:
+			void run() override { worker_->run(postProcessor_); }
+
+		private:
+			PostProcessorWorker *worker_;
+			PostProcessor *postProcessor_;
+		};
+
+		void run(PostProcessor *postProcessor);
+
+		std::vector<std::unique_ptr<WorkerThread>> threads_;
 
 		libcamera::Mutex mutex_;
 		libcamera::ConditionVariable cv_;
@@ -181,7 +200,9 @@ private:
 	 * an std::vector in CameraDevice.
 	 */
 	std::unique_ptr<libcamera::Mutex> mutex_;
-	std::unique_ptr<PostProcessor> postProcessor_;
+	std::vector<std::unique_ptr<PostProcessor>> postProcessors_;
 
 	std::unique_ptr<PostProcessorWorker> worker_;
+
+	std::unique_ptr<BufferCache> bufferCache_;
 };
@@ -7,6 +7,7 @@
 
 #include "encoder_libjpeg.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
@@ -102,9 +103,45 @@ int EncoderLibJpeg::configure(const StreamConfiguration &cfg)
 	nv_ = pixelFormatInfo_->numPlanes() == 2;
 	nvSwap_ = info.nvSwap;
 
+	/*
+	 * Feed the formats with horizontally subsampled chroma (4:2:0 and
+	 * 4:2:2) to libjpeg as raw downsampled data. This avoids upsampling the
+	 * chroma to 4:4:4 only for libjpeg to downsample it again, and allows
+	 * passing the luma lines to libjpeg without any copy.
+	 */
+	raw_ = false;
+
+	if (nv_) {
+		unsigned int c_stride = pixelFormatInfo_->stride(cfg.size.width, 1);
+		unsigned int horzSubSample = 2 * cfg.size.width / c_stride;
+		unsigned int vertSubSample = pixelFormatInfo_->planes[1].verticalSubSampling;
+
+		if (horzSubSample == 2 && vertSubSample <= 2) {
+			compress_.raw_data_in = TRUE;
+			compress_.comp_info[0].h_samp_factor = 2;
+			compress_.comp_info[0].v_samp_factor = vertSubSample;
+
+			for (unsigned int i = 1; i < 3; i++) {
+				compress_.comp_info[i].h_samp_factor = 1;
+				compress_.comp_info[i].v_samp_factor = 1;
+			}
+
+			raw_ = true;
+		}
+	}
+
 	return 0;
 }
 
+/*
+ * Insert a restart marker every \a rows MCU rows. This must be called after
+ * configure(), which resets the restart interval.
+ */
+void EncoderLibJpeg::setRestartInterval(unsigned int rows)
+{
+	compress_.restart_in_rows = rows;
+}
+
 void EncoderLibJpeg::compressRGB(const std::vector<Span<uint8_t>> &planes)
 {
 	unsigned char *src = const_cast<unsigned char *>(planes[0].data());
@@ -122,19 +159,12 @@ void EncoderLibJpeg::compressRGB(const std::vector<Span<uint8_t>> &planes)
 /*
  * Compress the incoming buffer from a supported NV format.
  * This naively unpacks the semi-planar NV12 to a YUV888 format for libjpeg.
+ * It is only used for NV24 and NV42, other NV formats use compressNVRaw().
  */
 void EncoderLibJpeg::compressNV(const std::vector<Span<uint8_t>> &planes)
 {
 	uint8_t tmprowbuf[compress_.image_width * 3];
 
-	/*
-	 * \todo Use the raw api, and only unpack the cb/cr samples to new line
-	 * buffers. If possible, see if we can set appropriate pixel strides
-	 * too to save even that copy.
-	 *
-	 * Possible hints at:
-	 * https://sourceforge.net/p/libjpeg/mailman/message/30815123/
-	 */
 	unsigned int y_stride = pixelFormatInfo_->stride(compress_.image_width, 0);
 	unsigned int c_stride = pixelFormatInfo_->stride(compress_.image_width, 1);
 
@@ -180,12 +210,98 @@ void EncoderLibJpeg::compressNV(const std::vector<Span<uint8_t>> &planes)
 	}
 }
 
+/*
+ * Compress the incoming buffer from a 4:2:0 or 4:2:2 NV format with the raw
+ * data API. libjpeg consumes one MCU row at a time, made of 8 lines of each
+ * chroma component and 8 or 16 lines of luma. The luma lines are passed
+ * directly from the source buffer, and the chroma samples are de-interleaved
+ * into line buffers.
+ *
+ * The lines must cover whole DCT blocks. When the image size isn't a multiple
+ * of the block size, the last column is replicated to pad the lines, and the
+ * last line is replicated to pad the last MCU row.
+ */
+void EncoderLibJpeg::compressNVRaw(const std::vector<Span<uint8_t>> &planes)
+{
+	unsigned int width = compress_.image_width;
+	unsigned int height = compress_.image_height;
+
+	unsigned int y_stride = pixelFormatInfo_->stride(width, 0);
+	unsigned int c_stride = pixelFormatInfo_->stride(width, 1);
+	unsigned int vertSubSample = compress_.comp_info[0].v_samp_factor;
+
+	unsigned int cb_pos = nvSwap_ ? 1 : 0;
+	unsigned int cr_pos = nvSwap_ ? 0 : 1;
+
+	unsigned int y_width = compress_.comp_info[0].width_in_blocks * DCTSIZE;
+	unsigned int c_width = compress_.comp_info[1].width_in_blocks * DCTSIZE;
+	unsigned int c_samples = (width + 1) / 2;
+	unsigned int c_height = (height + vertSubSample - 1) / vertSubSample;
+
+	unsigned int y_lines = vertSubSample * DCTSIZE;
+	unsigned int c_lines = DCTSIZE;
+
+	/* Luma lines need to be copied only if they must be padded. */
+	bool copyLuma = y_width != width;
+
+	std::vector<JSAMPLE> y_buffer(copyLuma ? y_lines * y_width : 0);
+	std::vector<JSAMPLE> cb_buffer(c_lines * c_width);
+	std::vector<JSAMPLE> cr_buffer(c_lines * c_width);
+
+	JSAMPROW y_rows[2 * DCTSIZE];
+	JSAMPROW cb_rows[DCTSIZE];
+	JSAMPROW cr_rows[DCTSIZE];
+	JSAMPARRAY data[3] = { y_rows, cb_rows, cr_rows };
+
+	const unsigned char *src = planes[0].data();
+	const unsigned char *src_c = planes[1].data();
+
+	for (unsigned int y = 0; y < height; y += y_lines) {
+		for (unsigned int i = 0; i < y_lines; i++) {
+			unsigned int line = std::min(y + i, height - 1);
+			const unsigned char *src_y = src + line * y_stride;
+
+			if (!copyLuma) {
+				y_rows[i] = const_cast<JSAMPROW>(src_y);
+				continue;
+			}
+
+			JSAMPROW dst = &y_buffer[i * y_width];
+			memcpy(dst, src_y, width);
+			memset(dst + width, src_y[width - 1], y_width - width);
+			y_rows[i] = dst;
+		}
+
+		for (unsigned int i = 0; i < c_lines; i++) {
+			unsigned int line = std::min(y / vertSubSample + i, c_height - 1);
+			const unsigned char *src_cbcr = src_c + line * c_stride;
+			JSAMPROW dst_cb = &cb_buffer[i * c_width];
+			JSAMPROW dst_cr = &cr_buffer[i * c_width];
+
+			for (unsigned int x = 0; x < c_samples; x++) {
+				dst_cb[x] = src_cbcr[2 * x + cb_pos];
+				dst_cr[x] = src_cbcr[2 * x + cr_pos];
+			}
+
+			memset(dst_cb + c_samples, dst_cb[c_samples - 1], c_width - c_samples);
+			memset(dst_cr + c_samples, dst_cr[c_samples - 1], c_width - c_samples);
+
+			cb_rows[i] = dst_cb;
+			cr_rows[i] = dst_cr;
+		}
+
+		jpeg_write_raw_data(&compress_, data, y_lines);
+	}
+}
+
 int EncoderLibJpeg::encode(Camera3RequestDescriptor::StreamBuffer *buffer,
 			   libcamera::Span<const uint8_t> exifData,
 			   unsigned int quality)
 {
 	MappedFrameBuffer frame(buffer->srcBuffer,
-				MappedFrameBuffer::MapFlag::Read);
+				MappedFrameBuffer::MapFlag::Read |
+				MappedFrameBuffer::MapFlag::Persistent |
+				MappedFrameBuffer::MapFlag::Sync);
 	if (!frame.isValid()) {
 		LOG(JPEG, Error) << "Failed to map FrameBuffer : "
 				 << strerror(frame.error());
@@ -228,7 +344,9 @@ int EncoderLibJpeg::encode(const std::vector<Span<uint8_t>> &src,
 
 	ASSERT(src.size() == pixelFormatInfo_->numPlanes());
 
-	if (nv_)
+	if (raw_)
+		compressNVRaw(src);
+	else if (nv_)
 		compressNV(src);
 	else
 		compressRGB(src);
@@ -30,9 +30,12 @@ public:
 		   libcamera::Span<const uint8_t> exifData,
 		   unsigned int quality);
 
+	void setRestartInterval(unsigned int rows);
+
 private:
 	void compressRGB(const std::vector<libcamera::Span<uint8_t>> &planes);
 	void compressNV(const std::vector<libcamera::Span<uint8_t>> &planes);
+	void compressNVRaw(const std::vector<libcamera::Span<uint8_t>> &planes);
 
 	struct jpeg_compress_struct compress_;
 	struct jpeg_error_mgr jerr_;
@@ -41,4 +44,5 @@ private:
 
 	bool nv_;
 	bool nvSwap_;
+	bool raw_;
 };
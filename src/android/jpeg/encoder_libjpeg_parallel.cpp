@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Parallel JPEG encoding using libjpeg
+ */
+
+#include "encoder_libjpeg_parallel.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <libcamera/base/log.h>
+
+#include "libcamera/internal/mapped_framebuffer.h"
+
+#include "../camera_buffer.h"
+
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/*
+ * Bands are aligned to the largest MCU height, for 4:2:0 subsampling. Restart
+ * markers are inserted at the end of every MCU row, so that every band starts
+ * at a restart boundary.
+ */
+constexpr unsigned int kMcuHeight = 16;
+
+/* Margin for the JPEG headers and the Exif data in the band buffers. */
+constexpr unsigned int kHeaderMargin = 64 * 1024;
+
+constexpr uint8_t kMarkerSOF0 = 0xc0;
+constexpr uint8_t kMarkerSOF2 = 0xc2;
+constexpr uint8_t kMarkerRST0 = 0xd0;
+constexpr uint8_t kMarkerRST7 = 0xd7;
+constexpr uint8_t kMarkerSOI = 0xd8;
+constexpr uint8_t kMarkerEOI = 0xd9;
+constexpr uint8_t kMarkerSOS = 0xda;
+
+struct JpegLayout {
+	/* Offset of the SOF marker */
+	size_t sof;
+	/* Offset of the entropy-coded data, after the SOS header */
+	size_t data;
+	/* Offset of the EOI marker */
+	size_t end;
+};
+
+/*
+ * Locate the frame header and the entropy-coded data in a JPEG stream
+ * produced by libjpeg, which contains a single scan.
+ */
+int parseJpeg(Span<const uint8_t> jpeg, JpegLayout *layout)
+{
+	*layout = {};
+
+	if (jpeg.size() < 4 || jpeg[0] != 0xff || jpeg[1] != kMarkerSOI)
+		return -EINVAL;
+
+	size_t pos = 2;
+	while (pos + 4 <= jpeg.size()) {
+		if (jpeg[pos] != 0xff)
+			return -EINVAL;
+
+		uint8_t marker = jpeg[pos + 1];
+		size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+		if (marker >= kMarkerSOF0 && marker <= kMarkerSOF2)
+			layout->sof = pos;
+
+		pos += 2 + length;
+
+		if (marker == kMarkerSOS) {
+			layout->data = pos;
+			break;
+		}
+	}
+
+	if (!layout->sof || !layout->data || jpeg.size() < layout->data + 2)
+		return -EINVAL;
+
+	if (jpeg[jpeg.size() - 2] != 0xff || jpeg[jpeg.size() - 1] != kMarkerEOI)
+		return -EINVAL;
+
+	layout->end = jpeg.size() - 2;
+
+	return 0;
+}
+
+/*
+ * Number the restart markers in entropy-coded \a data sequentially, starting
+ * at \a restart. Byte stuffing guarantees that 0xff is only followed by a
+ * marker code in entropy-coded data when it starts a marker.
+ */
+void renumberRestartMarkers(Span<uint8_t> data, unsigned int *restart)
+{
+	if (data.size() < 2)
+		return;
+
+	uint8_t *pos = data.data();
+	uint8_t *end = data.data() + data.size();
+
+	while (pos < end - 1) {
+		pos = static_cast<uint8_t *>(memchr(pos, 0xff, end - pos - 1));
+		if (!pos)
+			break;
+
+		if (pos[1] >= kMarkerRST0 && pos[1] <= kMarkerRST7)
+			pos[1] = kMarkerRST0 + ((*restart)++ & 7);
+
+		pos += 2;
+	}
+}
+
+} /* namespace */
+
+/*
+ * Encode large images by splitting them in horizontal bands, encoded in
+ * parallel by a pool of workers, each with its own libjpeg instance. Every
+ * MCU row ends with a restart marker, which resets the DC predictors, so the
+ * entropy-coded data of the bands can be concatenated into a single scan. The
+ * restart markers are renumbered, and a restart marker is inserted between
+ * the bands.
+ */
+EncoderLibJpegParallel::EncoderLibJpegParallel(unsigned int workers)
+	: numWorkers_(std::max(workers, 1U)), pixelFormatInfo_(nullptr),
+	  width_(0), height_(0), generation_(0), pending_(0), exit_(false),
+	  planes_(nullptr), quality_(0)
+{
+	for (unsigned int i = 0; i < numWorkers_; i++)
+		workers_.emplace_back(&EncoderLibJpegParallel::run, this, i);
+}
+
+EncoderLibJpegParallel::~EncoderLibJpegParallel()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+	start_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+int EncoderLibJpegParallel::configure(const StreamConfiguration &cfg)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	if (!info.isValid())
+		return -ENOTSUP;
+
+	pixelFormatInfo_ = &info;
+	width_ = cfg.size.width;
+	height_ = cfg.size.height;
+
+	unsigned int mcuRows = (height_ + kMcuHeight - 1) / kMcuHeight;
+	unsigned int numBands = std::clamp(mcuRows, 1U, numWorkers_);
+	unsigned int bandHeight = (mcuRows + numBands - 1) / numBands * kMcuHeight;
+
+	bands_.clear();
+
+	for (unsigned int y = 0; y < height_; y += bandHeight) {
+		std::unique_ptr<Band> band = std::make_unique<Band>();
+		band->y = y;
+		band->height = std::min(bandHeight, height_ - y);
+		band->size = 0;
+
+		StreamConfiguration bandCfg = cfg;
+		bandCfg.size.height = band->height;
+
+		int ret = band->encoder.configure(bandCfg);
+		if (ret)
+			return ret;
+
+		band->encoder.setRestartInterval(1);
+		band->output.resize(info.frameSize(bandCfg.size) + kHeaderMargin);
+
+		bands_.push_back(std::move(band));
+	}
+
+	LOG(JPEG, Debug)
+		<< "Encoding " << cfg.size << " in " << bands_.size()
+		<< " bands of " << bandHeight << " lines";
+
+	return 0;
+}
+
+int EncoderLibJpegParallel::encode(Camera3RequestDescriptor::StreamBuffer *buffer,
+				   Span<const uint8_t> exifData,
+				   unsigned int quality)
+{
+	MappedFrameBuffer frame(buffer->srcBuffer,
+				MappedFrameBuffer::MapFlag::Read |
+				MappedFrameBuffer::MapFlag::Persistent |
+				MappedFrameBuffer::MapFlag::Sync);
+	if (!frame.isValid()) {
+		LOG(JPEG, Error) << "Failed to map FrameBuffer : "
+				 << strerror(frame.error());
+		return frame.error();
+	}
+
+	return encode(frame.planes(), buffer->dstBuffer->plane(0),
+		      exifData, quality);
+}
+
+int EncoderLibJpegParallel::encode(const std::vector<Span<uint8_t>> &planes,
+				   Span<uint8_t> destination,
+				   Span<const uint8_t> exifData,
+				   unsigned int quality)
+{
+	ASSERT(planes.size() == pixelFormatInfo_->numPlanes());
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		planes_ = &planes;
+		exifData_ = exifData;
+		quality_ = quality;
+		pending_ = bands_.size();
+		generation_++;
+
+		start_.notify_all();
+		done_.wait(lock, [&] { return pending_ == 0; });
+
+		planes_ = nullptr;
+	}
+
+	return assemble(destination);
+}
+
+void EncoderLibJpegParallel::run(unsigned int index)
+{
+	unsigned int generation = 0;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (true) {
+		start_.wait(lock, [&] { return exit_ || generation_ != generation; });
+		if (exit_)
+			return;
+
+		generation = generation_;
+
+		if (index >= bands_.size())
+			continue;
+
+		lock.unlock();
+		encodeBand(index);
+		lock.lock();
+
+		if (--pending_ == 0)
+			done_.notify_one();
+	}
+}
+
+void EncoderLibJpegParallel::encodeBand(unsigned int index)
+{
+	Band &band = *bands_[index];
+
+	/* Point to the first line of the band in each plane. */
+	std::vector<Span<uint8_t>> planes;
+	for (unsigned int i = 0; i < planes_->size(); i++) {
+		unsigned int stride = pixelFormatInfo_->stride(width_, i);
+		unsigned int vertSubSample = pixelFormatInfo_->planes[i].verticalSubSampling;
+
+		planes.push_back((*planes_)[i].subspan(band.y / vertSubSample * stride));
+	}
+
+	/* The Exif data is only stored in the headers of the first band. */
+	Span<const uint8_t> exifData = index == 0 ? exifData_ : Span<const uint8_t>{};
+
+	band.size = band.encoder.encode(planes, band.output, exifData, quality_);
+}
+
+int EncoderLibJpegParallel::assemble(Span<uint8_t> destination)
+{
+	std::vector<JpegLayout> layouts(bands_.size());
+
+	for (unsigned int i = 0; i < bands_.size(); i++) {
+		const Band &band = *bands_[i];
+
+		if (band.size < 0 ||
+		    static_cast<size_t>(band.size) > band.output.size()) {
+			LOG(JPEG, Error) << "Failed to encode band " << i;
+			return -EINVAL;
+		}
+
+		int ret = parseJpeg({ band.output.data(), static_cast<size_t>(band.size) },
+				    &layouts[i]);
+		if (ret) {
+			LOG(JPEG, Error) << "Invalid JPEG stream for band " << i;
+			return ret;
+		}
+	}
+
+	size_t size = layouts[0].data + 2;
+	for (unsigned int i = 0; i < bands_.size(); i++)
+		size += layouts[i].end - layouts[i].data + (i ? 2 : 0);
+
+	if (size > destination.size()) {
+		LOG(JPEG, Error)
+			<< "Destination buffer too small: " << size << " > "
+			<< destination.size();
+		return -ENOSPC;
+	}
+
+	/*
+	 * Copy the headers of the first band, and patch the frame height in
+	 * the SOF segment.
+	 */
+	uint8_t *dst = destination.data();
+	memcpy(dst, bands_[0]->output.data(), layouts[0].data);
+	dst[layouts[0].sof + 5] = height_ >> 8;
+	dst[layouts[0].sof + 6] = height_ & 0xff;
+	dst += layouts[0].data;
+
+	unsigned int restart = 0;
+
+	for (unsigned int i = 0; i < bands_.size(); i++) {
+		const JpegLayout &layout = layouts[i];
+		size_t length = layout.end - layout.data;
+
+		if (i) {
+			dst[0] = 0xff;
+			dst[1] = kMarkerRST0 + (restart++ & 7);
+			dst += 2;
+		}
+
+		memcpy(dst, bands_[i]->output.data() + layout.data, length);
+		renumberRestartMarkers({ dst, length }, &restart);
+		dst += length;
+	}
+
+	dst[0] = 0xff;
+	dst[1] = kMarkerEOI;
+
+	return size;
+}
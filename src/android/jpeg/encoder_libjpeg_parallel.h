@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Parallel JPEG encoding using libjpeg
+ */
+
+#pragma once
+
+#include "encoder.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libcamera/internal/formats.h"
+
+#include "encoder_libjpeg.h"
+
+class EncoderLibJpegParallel : public Encoder
+{
+public:
+	EncoderLibJpegParallel(unsigned int workers);
+	~EncoderLibJpegParallel();
+
+	int configure(const libcamera::StreamConfiguration &cfg) override;
+	int encode(Camera3RequestDescriptor::StreamBuffer *buffer,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality) override;
+	int encode(const std::vector<libcamera::Span<uint8_t>> &planes,
+		   libcamera::Span<uint8_t> destination,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality);
+
+private:
+	struct Band {
+		EncoderLibJpeg encoder;
+		unsigned int y;
+		unsigned int height;
+		std::vector<uint8_t> output;
+		int size;
+	};
+
+	void run(unsigned int index);
+	void encodeBand(unsigned int index);
+	int assemble(libcamera::Span<uint8_t> destination);
+
+	unsigned int numWorkers_;
+	std::vector<std::unique_ptr<Band>> bands_;
+	const libcamera::PixelFormatInfo *pixelFormatInfo_;
+	unsigned int width_;
+	unsigned int height_;
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	unsigned int generation_;
+	unsigned int pending_;
+	bool exit_;
+
+	/* Parameters of the current encode() call, protected by mutex_. */
+	const std::vector<libcamera::Span<uint8_t>> *planes_;
+	libcamera::Span<const uint8_t> exifData_;
+	unsigned int quality_;
+};
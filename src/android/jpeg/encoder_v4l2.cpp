@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+
+#include "encoder_v4l2.h"
+
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <optional>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <hardware/camera3.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/shared_fd.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/unique_fd.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/dma_buf_allocator.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#include "../camera_buffer.h"
+
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/* Maximum time to wait for the encoder to produce an image. */
+constexpr std::chrono::milliseconds kEncodeTimeout = 1000ms;
+
+/*
+ * List the V4L2 memory-to-memory devices that produce JPEG images. The device
+ * nodes are scanned once, the first time an encoder is configured.
+ */
+std::vector<std::string> jpegEncoderNodes()
+{
+	static Mutex mutex;
+	static std::optional<std::vector<std::string>> nodes;
+
+	MutexLocker locker(mutex);
+
+	if (nodes)
+		return *nodes;
+
+	nodes.emplace();
+
+	DIR *dir = opendir("/dev");
+	if (!dir)
+		return *nodes;
+
+	std::vector<std::string> candidates;
+	while (struct dirent *ent = readdir(dir)) {
+		if (strncmp(ent->d_name, "video", 5))
+			continue;
+
+		std::string node = std::string("/dev/") + ent->d_name;
+
+		/*
+		 * Check the capabilities directly to avoid logging errors for
+		 * all the video devices that are not memory-to-memory devices.
+		 */
+		UniqueFD fd(open(node.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC));
+		if (!fd.isValid())
+			continue;
+
+		V4L2Capability caps;
+		if (ioctl(fd.get(), VIDIOC_QUERYCAP, &caps) < 0)
+			continue;
+
+		if (caps.isM2M() && caps.hasStreaming())
+			candidates.push_back(std::move(node));
+	}
+
+	closedir(dir);
+
+	for (const std::string &node : candidates) {
+		V4L2M2MDevice m2m(node);
+		if (m2m.open())
+			continue;
+
+		V4L2VideoDevice::Formats formats = m2m.capture()->formats();
+		if (formats.count(V4L2PixelFormat(V4L2_PIX_FMT_JPEG))) {
+			LOG(JPEG, Debug) << "Found V4L2 JPEG encoder " << node;
+			nodes->push_back(node);
+		}
+	}
+
+	return *nodes;
+}
+
+} /* namespace */
+
+EncoderV4L2::EncoderV4L2()
+	: stride_(0)
+{
+}
+
+EncoderV4L2::~EncoderV4L2() = default;
+
+/*
+ * Select a JPEG encoder that accepts the stream configuration, without
+ * padding or copying the source frames. Return -ENODEV if no compatible
+ * encoder is found, in which case the caller shall use a software encoder.
+ */
+int EncoderV4L2::configure(const StreamConfiguration &cfg)
+{
+	pixelFormat_ = cfg.pixelFormat;
+	size_ = cfg.size;
+	stride_ = cfg.stride;
+	deviceNode_.clear();
+
+	for (const std::string &node : jpegEncoderNodes()) {
+		V4L2M2MDevice m2m(node);
+		if (m2m.open())
+			continue;
+
+		V4L2DeviceFormat format;
+		format.fourcc = m2m.output()->toV4L2PixelFormat(pixelFormat_);
+		format.size = size_;
+
+		if (!format.fourcc.isValid())
+			continue;
+
+		if (m2m.output()->tryFormat(&format))
+			continue;
+
+		if (format.fourcc != m2m.output()->toV4L2PixelFormat(pixelFormat_) ||
+		    format.size != size_ || format.planes[0].bpl != stride_)
+			continue;
+
+		deviceNode_ = node;
+		break;
+	}
+
+	if (deviceNode_.empty())
+		return -ENODEV;
+
+	LOG(JPEG, Info) << "Using V4L2 JPEG encoder " << deviceNode_
+			<< " for " << size_ << "-" << pixelFormat_;
+
+	return 0;
+}
+
+/*
+ * The encoder is set up for every image, as the V4L2 devices must be used from
+ * the thread that processes their events, which is the post-processing worker
+ * thread calling this function. Still captures are rare enough for the setup
+ * cost to be negligible compared to the encoding time saved.
+ */
+int EncoderV4L2::encode(Camera3RequestDescriptor::StreamBuffer *buffer,
+			Span<const uint8_t> exifData, unsigned int quality)
+{
+	if (deviceNode_.empty())
+		return -ENODEV;
+
+	Span<uint8_t> destination = buffer->dstBuffer->plane(0);
+	if (destination.size() <= sizeof(struct camera3_jpeg_blob))
+		return -ENOSPC;
+
+	/*
+	 * Import the source buffer and the JPEG blob buffer, without the
+	 * space reserved for the blob header at the end.
+	 */
+	FrameBuffer source(buffer->srcBuffer->planes());
+	for (auto [i, srcPlane] : utils::enumerate(source.planes()))
+		source._d()->metadata().planes()[i].bytesused = srcPlane.length;
+
+	FrameBuffer::Plane plane;
+	plane.fd = SharedFD((*buffer->camera3Buffer)->data[0]);
+	plane.offset = 0;
+	plane.length = destination.size() - sizeof(struct camera3_jpeg_blob);
+	FrameBuffer jpeg({ plane });
+
+	V4L2M2MDevice m2m(deviceNode_);
+	int ret = m2m.open();
+	if (ret)
+		return ret;
+
+	V4L2DeviceFormat format;
+	format.fourcc = m2m.output()->toV4L2PixelFormat(pixelFormat_);
+	format.size = size_;
+	ret = m2m.output()->setFormat(&format);
+	if (ret)
+		return ret;
+
+	format = {};
+	format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_JPEG);
+	format.size = size_;
+	ret = m2m.capture()->setFormat(&format);
+	if (ret)
+		return ret;
+
+	if (format.planes[0].size > plane.length) {
+		LOG(JPEG, Error) << "JPEG buffer too small for V4L2 encoder";
+		return -ENOSPC;
+	}
+
+	const ControlInfoMap &controls = m2m.capture()->controls();
+	if (controls.find(V4L2_CID_JPEG_COMPRESSION_QUALITY) != controls.end()) {
+		ControlList ctrls(controls);
+		ctrls.set(V4L2_CID_JPEG_COMPRESSION_QUALITY,
+			  static_cast<int32_t>(quality));
+		m2m.capture()->setControls(&ctrls);
+	}
+
+	bool sourceDone = false;
+	bool jpegDone = false;
+	m2m.output()->bufferReady.connect(this, [&](FrameBuffer *) {
+		sourceDone = true;
+	});
+	m2m.capture()->bufferReady.connect(this, [&](FrameBuffer *) {
+		jpegDone = true;
+	});
+
+	ret = m2m.output()->importBuffers(1);
+	if (ret)
+		return ret;
+
+	ret = m2m.capture()->importBuffers(1);
+	if (ret)
+		return ret;
+
+	ret = m2m.output()->streamOn();
+	if (ret)
+		return ret;
+
+	ret = m2m.capture()->streamOn();
+	if (ret) {
+		m2m.output()->streamOff();
+		return ret;
+	}
+
+	ret = m2m.capture()->queueBuffer(&jpeg);
+	if (!ret)
+		ret = m2m.output()->queueBuffer(&source);
+
+	/* Process the device events in this thread until encoding completes. */
+	EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+	Timer timeout;
+	timeout.start(kEncodeTimeout);
+
+	while (!ret && !(sourceDone && jpegDone) && timeout.isRunning())
+		dispatcher->processEvents();
+
+	bool completed = sourceDone && jpegDone;
+
+	m2m.capture()->streamOff();
+	m2m.output()->streamOff();
+
+	if (ret)
+		return ret;
+
+	if (!completed) {
+		LOG(JPEG, Error) << "V4L2 JPEG encoder timeout";
+		return -ETIMEDOUT;
+	}
+
+	const FrameMetadata &metadata = jpeg.metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess)
+		return -EIO;
+
+	/*
+	 * The image has been written by the device, synchronize the CPU
+	 * access to the buffer to insert the EXIF data.
+	 */
+	DmaSyncer syncer(jpeg.planes()[0].fd);
+
+	return insertExif(destination, metadata.planes()[0].bytesused, exifData);
+}
+
+/*
+ * Hardware encoders don't store the EXIF data, insert an APP1 segment after
+ * the SOI marker and the APP0 JFIF segment, if any, as libjpeg does. Return
+ * the size of the resulting image.
+ */
+int EncoderV4L2::insertExif(Span<uint8_t> jpeg, size_t size,
+			    Span<const uint8_t> exifData)
+{
+	if (exifData.empty())
+		return size;
+
+	/* The segment length covers the length field itself. */
+	const size_t segmentSize = exifData.size() + 4;
+	if (exifData.size() + 2 > 0xffff ||
+	    size + segmentSize > jpeg.size() - sizeof(struct camera3_jpeg_blob)) {
+		LOG(JPEG, Warning) << "No space for EXIF data in JPEG image";
+		return size;
+	}
+
+	uint8_t *data = jpeg.data();
+
+	if (size < 4 || data[0] != 0xff || data[1] != 0xd8) {
+		LOG(JPEG, Error) << "Invalid JPEG image from V4L2 encoder";
+		return -EINVAL;
+	}
+
+	size_t offset = 2;
+	if (data[2] == 0xff && data[3] == 0xe0 && size >= 6)
+		offset += 2 + ((data[4] << 8) | data[5]);
+
+	if (offset > size)
+		return -EINVAL;
+
+	memmove(data + offset + segmentSize, data + offset, size - offset);
+
+	data[offset] = 0xff;
+	data[offset + 1] = 0xe1;
+	data[offset + 2] = (exifData.size() + 2) >> 8;
+	data[offset + 3] = (exifData.size() + 2) & 0xff;
+	memcpy(data + offset + 4, exifData.data(), exifData.size());
+
+	return size + segmentSize;
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+
+#pragma once
+
+#include <string>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "encoder.h"
+
+class EncoderV4L2 : public Encoder
+{
+public:
+	EncoderV4L2();
+	~EncoderV4L2();
+
+	int configure(const libcamera::StreamConfiguration &cfg) override;
+	int encode(Camera3RequestDescriptor::StreamBuffer *buffer,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality) override;
+
+private:
+	int insertExif(libcamera::Span<uint8_t> jpeg, size_t size,
+		       libcamera::Span<const uint8_t> exifData);
+
+	std::string deviceNode_;
+	libcamera::PixelFormat pixelFormat_;
+	libcamera::Size size_;
+	unsigned int stride_;
+};
@@ -41,10 +41,16 @@ enum class _ExifTag {
  * Calls to generate() must check the return code to determine if any error
  * occurred during the construction of the Exif data, and if successful the
  * data can be obtained using the data() function.
+ *
+ * An Exif instance can be reused to generate the Exif data of multiple
+ * images, setting the constant properties once. As long as no entry is added,
+ * removed or resized, generate() patches the values of the entries in the
+ * previously generated data instead of serializing all entries again.
  */
 Exif::Exif()
 	: valid_(false), data_(nullptr), order_(EXIF_BYTE_ORDER_INTEL),
-	  exifData_(0), size_(0)
+	  exifData_(0), size_(0), layoutValid_(false), thumbnailOffset_(0),
+	  thumbnailLengthOffset_(0)
 {
 	/* Create an ExifMem allocator to construct entries. */
 	mem_ = exif_mem_new_default();
@@ -107,6 +113,8 @@ ExifEntry *Exif::createEntry(ExifIfd ifd, ExifTag tag)
 		return entry;
 	}
 
+	layoutValid_ = false;
+
 	entry = exif_entry_new_mem(mem_);
 	if (!entry) {
 		LOG(EXIF, Error) << "Failed to allocated new entry";
@@ -125,9 +133,21 @@ ExifEntry *Exif::createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 {
 	ExifContent *content = data_->ifd[ifd];
 
-	/* Replace any existing entry with the same tag. */
+	/*
+	 * Reuse any existing entry with the same tag and layout, or replace
+	 * it.
+	 */
 	ExifEntry *existing = exif_content_get_entry(content, tag);
-	exif_content_remove_entry(content, existing);
+	if (existing && existing->format == format &&
+	    existing->components == components && existing->size == size) {
+		exif_entry_ref(existing);
+		return existing;
+	}
+
+	if (existing)
+		exif_content_remove_entry(content, existing);
+
+	layoutValid_ = false;
 
 	ExifEntry *entry = exif_entry_new_mem(mem_);
 	if (!entry) {
@@ -155,6 +175,17 @@ ExifEntry *Exif::createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 	return entry;
 }
 
+void Exif::removeEntry(ExifIfd ifd, ExifTag tag)
+{
+	ExifContent *content = data_->ifd[ifd];
+	ExifEntry *entry = exif_content_get_entry(content, tag);
+	if (!entry)
+		return;
+
+	exif_content_remove_entry(content, entry);
+	layoutValid_ = false;
+}
+
 void Exif::setByte(ExifIfd ifd, ExifTag tag, uint8_t item)
 {
 	ExifEntry *entry = createEntry(ifd, tag, EXIF_FORMAT_BYTE, 1, 1);
@@ -408,6 +439,27 @@ void Exif::setGPSMethod(const std::string &method)
 		  EXIF_FORMAT_UNDEFINED, method, NoEncoding);
 }
 
+void Exif::clearGPSDateTimestamp()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_DATE_STAMP));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_TIME_STAMP));
+}
+
+void Exif::clearGPSLocation()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LATITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LATITUDE));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LONGITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LONGITUDE));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_ALTITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_ALTITUDE));
+}
+
+void Exif::clearGPSMethod()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_PROCESSING_METHOD));
+}
+
 void Exif::setOrientation(int orientation)
 {
 	int value;
@@ -441,6 +493,19 @@ void Exif::setThumbnail(std::vector<unsigned char> &&thumbnail,
 	setShort(EXIF_IFD_0, EXIF_TAG_COMPRESSION, compression);
 }
 
+void Exif::clearThumbnail()
+{
+	if (!data_->data)
+		return;
+
+	data_->data = nullptr;
+	data_->size = 0;
+	thumbnailData_.clear();
+
+	removeEntry(EXIF_IFD_0, EXIF_TAG_COMPRESSION);
+	layoutValid_ = false;
+}
+
 void Exif::setFocalLength(float length)
 {
 	ExifRational rational = { static_cast<ExifLong>(length * 1000), 1000 };
@@ -459,6 +524,11 @@ void Exif::setAperture(float size)
 	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, rational);
 }
 
+void Exif::clearAperture()
+{
+	removeEntry(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER);
+}
+
 void Exif::setISO(uint16_t iso)
 {
 	setShort(EXIF_IFD_EXIF, EXIF_TAG_ISO_SPEED_RATINGS, iso);
@@ -502,20 +572,174 @@ std::u16string Exif::utf8ToUtf16(const std::string &str)
 	return ret;
 }
 
-[[nodiscard]] int Exif::generate()
+/*
+ * \brief Locate the values of the entries in the generated data
+ *
+ * Walk the IFDs of the TIFF structure generated by libexif, and record the
+ * offset of the value of every entry, as well as the location of the
+ * thumbnail.
+ *
+ * \return True if all entries have been located, false otherwise
+ */
+bool Exif::parseLayout()
 {
-	if (exifData_) {
-		free(exifData_);
-		exifData_ = nullptr;
+	/* The TIFF structure follows the "Exif\0\0" header. */
+	constexpr size_t kTiffOffset = 6;
+	constexpr size_t kEntrySize = 12;
+
+	layout_.clear();
+	thumbnailOffset_ = 0;
+	thumbnailLengthOffset_ = 0;
+
+	if (size_ < kTiffOffset + 8)
+		return false;
+
+	const unsigned char *tiff = exifData_ + kTiffOffset;
+	const size_t tiffSize = size_ - kTiffOffset;
+
+	std::vector<std::pair<ExifIfd, size_t>> ifds = {
+		{ EXIF_IFD_0, exif_get_long(tiff + 4, order_) },
+	};
+
+	for (unsigned int i = 0; i < ifds.size(); i++) {
+		const auto [ifd, offset] = ifds[i];
+
+		if (offset + 2 > tiffSize)
+			return false;
+
+		unsigned int count = exif_get_short(tiff + offset, order_);
+		if (offset + 2 + count * kEntrySize + 4 > tiffSize)
+			return false;
+
+		for (unsigned int j = 0; j < count; j++) {
+			size_t entryOffset = offset + 2 + j * kEntrySize;
+			const unsigned char *entry = tiff + entryOffset;
+
+			ExifTag tag = static_cast<ExifTag>(exif_get_short(entry, order_));
+			ExifFormat format = static_cast<ExifFormat>(exif_get_short(entry + 2, order_));
+			size_t size = exif_format_get_size(format) *
+				      exif_get_long(entry + 4, order_);
+			size_t value = exif_get_long(entry + 8, order_);
+			size_t valueOffset = size <= 4 ? entryOffset + 8 : value;
+
+			if (valueOffset + size > tiffSize)
+				return false;
+
+			/* Pointers to the sub-IFDs are generated by libexif. */
+			if (tag == EXIF_TAG_EXIF_IFD_POINTER) {
+				ifds.push_back({ EXIF_IFD_EXIF, value });
+				continue;
+			}
+
+			if (tag == EXIF_TAG_GPS_INFO_IFD_POINTER) {
+				ifds.push_back({ EXIF_IFD_GPS, value });
+				continue;
+			}
+
+			if (tag == EXIF_TAG_INTEROPERABILITY_IFD_POINTER) {
+				ifds.push_back({ EXIF_IFD_INTEROPERABILITY, value });
+				continue;
+			}
+
+			/* So are the thumbnail location entries. */
+			if (ifd == EXIF_IFD_1 && tag == EXIF_TAG_JPEG_INTERCHANGE_FORMAT) {
+				thumbnailOffset_ = kTiffOffset + value;
+				continue;
+			}
+
+			if (ifd == EXIF_IFD_1 &&
+			    tag == EXIF_TAG_JPEG_INTERCHANGE_FORMAT_LENGTH) {
+				thumbnailLengthOffset_ = kTiffOffset + valueOffset;
+				continue;
+			}
+
+			ExifEntry *exifEntry = exif_content_get_entry(data_->ifd[ifd], tag);
+			if (!exifEntry || exifEntry->size != size)
+				return false;
+
+			layout_.push_back({ exifEntry, kTiffOffset + valueOffset });
+		}
+
+		if (ifd == EXIF_IFD_0) {
+			size_t next = exif_get_long(tiff + offset + 2 + count * kEntrySize,
+						    order_);
+			if (next)
+				ifds.push_back({ EXIF_IFD_1, next });
+		}
+	}
+
+	unsigned int entries = 0;
+	for (unsigned int i = 0; i < EXIF_IFD_COUNT; i++)
+		entries += data_->ifd[i]->count;
+
+	if (entries != layout_.size())
+		return false;
+
+	/* The thumbnail must be stored last to be resized in place. */
+	if (data_->data) {
+		if (!thumbnailOffset_ || !thumbnailLengthOffset_ ||
+		    thumbnailOffset_ + data_->size != size_)
+			return false;
+	} else if (thumbnailOffset_) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * \brief Update the previously generated data with the current entries values
+ * \return True on success, false otherwise
+ */
+bool Exif::patchLayout()
+{
+	if (!data_->data != !thumbnailOffset_)
+		return false;
+
+	if (data_->data) {
+		size_t size = thumbnailOffset_ + data_->size;
+		if (size != size_) {
+			void *exifData = realloc(exifData_, size);
+			if (!exifData)
+				return false;
+
+			exifData_ = static_cast<unsigned char *>(exifData);
+			size_ = size;
+		}
+
+		memcpy(exifData_ + thumbnailOffset_, data_->data, data_->size);
+		exif_set_long(exifData_ + thumbnailLengthOffset_, order_,
+			      data_->size);
 	}
 
+	for (const EntryLocation &location : layout_)
+		memcpy(exifData_ + location.offset, location.entry->data,
+		       location.entry->size);
+
+	return true;
+}
+
+[[nodiscard]] int Exif::generate()
+{
 	if (!valid_) {
 		LOG(EXIF, Error) << "Generated EXIF data is invalid";
 		return -1;
 	}
 
+	if (layoutValid_ && patchLayout()) {
+		LOG(EXIF, Debug) << "Updated EXIF instance (" << size_ << " bytes)";
+		return 0;
+	}
+
+	if (exifData_) {
+		free(exifData_);
+		exifData_ = nullptr;
+	}
+
 	exif_data_save_data(data_, &exifData_, &size_);
 
+	layoutValid_ = parseLayout();
+
 	LOG(EXIF, Debug) << "Created EXIF instance (" << size_ << " bytes)";
 
 	return 0;
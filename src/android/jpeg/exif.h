@@ -63,15 +63,20 @@ public:
 	void setSize(const libcamera::Size &size);
 	void setThumbnail(std::vector<unsigned char> &&thumbnail,
 			  Compression compression);
+	void clearThumbnail();
 	void setTimestamp(time_t timestamp, std::chrono::milliseconds msec);
 
 	void setGPSDateTimestamp(time_t timestamp);
 	void setGPSLocation(const double *coords);
 	void setGPSMethod(const std::string &method);
+	void clearGPSDateTimestamp();
+	void clearGPSLocation();
+	void clearGPSMethod();
 
 	void setFocalLength(float length);
 	void setExposureTime(uint64_t nsec);
 	void setAperture(float size);
+	void clearAperture();
 	void setISO(uint16_t iso);
 	void setFlash(Flash flash);
 	void setWhiteBalance(WhiteBalance wb);
@@ -80,10 +85,20 @@ public:
 	[[nodiscard]] int generate();
 
 private:
+	struct EntryLocation {
+		ExifEntry *entry;
+		size_t offset;
+	};
+
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag);
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 			       unsigned long components, unsigned int size);
 
+	void removeEntry(ExifIfd ifd, ExifTag tag);
+
+	bool parseLayout();
+	bool patchLayout();
+
 	void setByte(ExifIfd ifd, ExifTag tag, uint8_t item);
 	void setShort(ExifIfd ifd, ExifTag tag, uint16_t item);
 	void setLong(ExifIfd ifd, ExifTag tag, uint32_t item);
@@ -108,5 +123,14 @@ private:
 	unsigned char *exifData_;
 	unsigned int size_;
 
+	/*
+	 * Location of the entries values in the generated data, valid until
+	 * an entry is added, removed or resized.
+	 */
+	std::vector<EntryLocation> layout_;
+	bool layoutValid_;
+	size_t thumbnailOffset_;
+	size_t thumbnailLengthOffset_;
+
 	std::vector<unsigned char> thumbnailData_;
 };
@@ -7,7 +7,9 @@
 
 #include "post_processor_jpeg.h"
 
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 #include "../camera_device.h"
 #include "../camera_metadata.h"
@@ -16,6 +18,8 @@
 #include "encoder_jea.h"
 #else /* !defined(OS_CHROMEOS) */
 #include "encoder_libjpeg.h"
+#include "encoder_libjpeg_parallel.h"
+#include "encoder_v4l2.h"
 #endif
 #include "exif.h"
 
@@ -28,6 +32,18 @@ using namespace std::chrono_literals;
 
 LOG_DEFINE_CATEGORY(JPEG)
 
+#if !defined(OS_CHROMEOS)
+namespace {
+
+/* Minimum image size, in pixels, to encode images in parallel. */
+constexpr unsigned int kParallelEncodeMinPixels = 8000000;
+
+/* Maximum number of threads to encode images in parallel. */
+constexpr unsigned int kParallelEncodeMaxWorkers = 4;
+
+} /* namespace */
+#endif
+
 PostProcessorJpeg::PostProcessorJpeg(CameraDevice *const device)
 	: cameraDevice_(device)
 {
@@ -48,12 +64,36 @@ int PostProcessorJpeg::configure(const StreamConfiguration &inCfg,
 
 	streamSize_ = outCfg.size;
 
+	/* Set the EXIF tags that are constant for all images. */
+	exif_.setMake(cameraDevice_->maker());
+	exif_.setModel(cameraDevice_->model());
+	exif_.setSize(streamSize_);
+	exif_.setFlash(Exif::Flash::FlashNotPresent);
+	exif_.setWhiteBalance(Exif::WhiteBalance::Auto);
+	exif_.setFocalLength(1.0);
+
 	thumbnailer_.configure(inCfg.size, inCfg.pixelFormat);
 
 #if defined(OS_CHROMEOS)
 	encoder_ = std::make_unique<EncoderJea>();
 #else /* !defined(OS_CHROMEOS) */
-	encoder_ = std::make_unique<EncoderLibJpeg>();
+	/* Use a hardware encoder when a compatible one is available. */
+	encoder_ = std::make_unique<EncoderV4L2>();
+	if (!encoder_->configure(inCfg))
+		return 0;
+
+	/*
+	 * Large stills are split in bands encoded in parallel, as the encoding
+	 * time of a single libjpeg instance dominates the capture latency.
+	 */
+	unsigned int workers = std::min(std::thread::hardware_concurrency(),
+					kParallelEncodeMaxWorkers);
+
+	if (inCfg.size.width * inCfg.size.height >= kParallelEncodeMinPixels &&
+	    workers > 1)
+		encoder_ = std::make_unique<EncoderLibJpegParallel>(workers);
+	else
+		encoder_ = std::make_unique<EncoderLibJpeg>();
 #endif
 
 	return encoder_->configure(inCfg);
@@ -120,44 +160,41 @@ void PostProcessorJpeg::process(Camera3RequestDescriptor::StreamBuffer *streamBu
 	camera_metadata_ro_entry_t entry;
 	int ret;
 
-	/* Set EXIF metadata for various tags. */
-	Exif exif;
-	exif.setMake(cameraDevice_->maker());
-	exif.setModel(cameraDevice_->model());
-
+	/*
+	 * Set EXIF metadata for the per-image tags, and clear the optional
+	 * tags set for the previous image.
+	 */
 	ret = requestMetadata.getEntry(ANDROID_JPEG_ORIENTATION, &entry);
 
 	const uint32_t jpegOrientation = ret ? *entry.data.i32 : 0;
 	resultMetadata->addEntry(ANDROID_JPEG_ORIENTATION, jpegOrientation);
-	exif.setOrientation(jpegOrientation);
+	exif_.setOrientation(jpegOrientation);
 
-	exif.setSize(streamSize_);
 	/*
 	 * We set the frame's EXIF timestamp as the time of encode.
 	 * Since the precision we need for EXIF timestamp is only one
 	 * second, it is good enough.
 	 */
-	exif.setTimestamp(std::time(nullptr), 0ms);
+	exif_.setTimestamp(std::time(nullptr), 0ms);
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
-	exif.setExposureTime(ret ? *entry.data.i64 : 0);
+	exif_.setExposureTime(ret ? *entry.data.i64 : 0);
 	ret = requestMetadata.getEntry(ANDROID_LENS_APERTURE, &entry);
 	if (ret)
-		exif.setAperture(*entry.data.f);
+		exif_.setAperture(*entry.data.f);
+	else
+		exif_.clearAperture();
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_SENSITIVITY, &entry);
-	exif.setISO(ret ? *entry.data.i32 : 100);
-
-	exif.setFlash(Exif::Flash::FlashNotPresent);
-	exif.setWhiteBalance(Exif::WhiteBalance::Auto);
-
-	exif.setFocalLength(1.0);
+	exif_.setISO(ret ? *entry.data.i32 : 100);
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_TIMESTAMP, &entry);
 	if (ret) {
-		exif.setGPSDateTimestamp(*entry.data.i64);
+		exif_.setGPSDateTimestamp(*entry.data.i64);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_TIMESTAMP,
 					 *entry.data.i64);
+	} else {
+		exif_.clearGPSDateTimestamp();
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
@@ -170,39 +207,47 @@ void PostProcessorJpeg::process(Camera3RequestDescriptor::StreamBuffer *streamBu
 		uint8_t quality = ret ? *entry.data.u8 : 95;
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_QUALITY, quality);
 
-		if (thumbnailSize != Size(0, 0)) {
-			std::vector<unsigned char> thumbnail;
+		std::vector<unsigned char> thumbnail;
+		if (thumbnailSize != Size(0, 0))
 			generateThumbnail(source, thumbnailSize, quality, &thumbnail);
-			if (!thumbnail.empty())
-				exif.setThumbnail(std::move(thumbnail), Exif::Compression::JPEG);
-		}
+
+		if (!thumbnail.empty())
+			exif_.setThumbnail(std::move(thumbnail), Exif::Compression::JPEG);
+		else
+			exif_.clearThumbnail();
 
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_SIZE, data, 2);
+	} else {
+		exif_.clearThumbnail();
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_COORDINATES, &entry);
 	if (ret) {
-		exif.setGPSLocation(entry.data.d);
+		exif_.setGPSLocation(entry.data.d);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_COORDINATES,
 					 entry.data.d, 3);
+	} else {
+		exif_.clearGPSLocation();
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD, &entry);
 	if (ret) {
 		std::string method(entry.data.u8, entry.data.u8 + entry.count);
-		exif.setGPSMethod(method);
+		exif_.setGPSMethod(method);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD,
 					 entry.data.u8, entry.count);
+	} else {
+		exif_.clearGPSMethod();
 	}
 
-	if (exif.generate() != 0)
+	if (exif_.generate() != 0)
 		LOG(JPEG, Error) << "Failed to generate valid EXIF data";
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_QUALITY, &entry);
 	const uint8_t quality = ret ? *entry.data.u8 : 95;
 	resultMetadata->addEntry(ANDROID_JPEG_QUALITY, quality);
 
-	int jpeg_size = encoder_->encode(streamBuffer, exif.data(), quality);
+	int jpeg_size = encoder_->encode(streamBuffer, exif_.data(), quality);
 	if (jpeg_size < 0) {
 		LOG(JPEG, Error) << "Failed to encode stream image";
 		processComplete.emit(streamBuffer, PostProcessor::Status::Error);
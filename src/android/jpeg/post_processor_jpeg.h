@@ -9,6 +9,7 @@
 
 #include "../post_processor.h"
 #include "encoder_libjpeg.h"
+#include "exif.h"
 #include "thumbnailer.h"
 
 #include <libcamera/geometry.h>
@@ -35,4 +36,10 @@ private:
 	libcamera::Size streamSize_;
 	EncoderLibJpeg thumbnailEncoder_;
 	Thumbnailer thumbnailer_;
+
+	/*
+	 * The Exif data is reused for all images, with the constant tags set
+	 * at configuration time.
+	 */
+	Exif exif_;
 };
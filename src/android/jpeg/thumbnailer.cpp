@@ -7,6 +7,8 @@
 
 #include "thumbnailer.h"
 
+#include <libyuv/scale.h>
+
 #include <libcamera/base/log.h>
 
 #include <libcamera/formats.h>
@@ -41,7 +43,9 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 				  const Size &targetSize,
 				  std::vector<unsigned char> *destination)
 {
-	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read);
+	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read |
+					 MappedFrameBuffer::MapFlag::Persistent |
+					 MappedFrameBuffer::MapFlag::Sync);
 	if (!frame.isValid()) {
 		LOG(Thumbnailer, Error)
 			<< "Failed to map FrameBuffer : "
@@ -62,35 +66,22 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 	ASSERT(frame.planes().size() == 2);
 	ASSERT(tw % 2 == 0 && th % 2 == 0);
 
-	/* Image scaling block implementing nearest-neighbour algorithm. */
-	unsigned char *src = frame.planes()[0].data();
-	unsigned char *srcC = frame.planes()[1].data();
-	unsigned char *srcCb, *srcCr;
-	unsigned char *dstY, *srcY;
-
 	size_t dstSize = (th * tw) + ((th / 2) * tw);
 	destination->resize(dstSize);
 	unsigned char *dst = destination->data();
 	unsigned char *dstC = dst + th * tw;
 
-	for (unsigned int y = 0; y < th; y += 2) {
-		unsigned int sourceY = (sh * y + th / 2) / th;
-
-		dstY = dst + y * tw;
-		srcY = src + sw * sourceY;
-		srcCb = srcC + (sourceY / 2) * sw + 0;
-		srcCr = srcC + (sourceY / 2) * sw + 1;
-
-		for (unsigned int x = 0; x < tw; x += 2) {
-			unsigned int sourceX = (sw * x + tw / 2) / tw;
-
-			dstY[x] = srcY[sourceX];
-			dstY[tw + x] = srcY[sw + sourceX];
-			dstY[x + 1] = srcY[sourceX + 1];
-			dstY[tw + x + 1] = srcY[sw + sourceX + 1];
-
-			dstC[(y / 2) * tw + x + 0] = srcCb[(sourceX / 2) * 2];
-			dstC[(y / 2) * tw + x + 1] = srcCr[(sourceX / 2) * 2];
-		}
+	/*
+	 * Downscale with bilinear filtering, which only reads the two source
+	 * lines around each destination line, and uses the SIMD
+	 * implementations of libyuv where available.
+	 */
+	int ret = libyuv::NV12Scale(frame.planes()[0].data(), sw,
+				    frame.planes()[1].data(), sw,
+				    sw, sh, dst, tw, dstC, tw, tw, th,
+				    libyuv::FilterMode::kFilterBilinear);
+	if (ret) {
+		LOG(Thumbnailer, Error) << "Failed NV12 scaling: " << ret;
+		destination->clear();
 	}
 }
@@ -7,21 +7,203 @@
 
 #include "post_processor_yuv.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
+
 #include <libyuv/scale.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/object.h>
 
 #include <libcamera/formats.h>
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
 
+#include "libcamera/internal/converter.h"
+#include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/media_device.h"
+
+#include "../camera_stream.h"
+#include "../hal_framebuffer.h"
 
 using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(YUV)
 
+/*
+ * Scale frames with a memory-to-memory converter, importing the dmabufs of the
+ * source and destination buffers, without mapping them. The converter devices
+ * are bound to the thread that opens them, all the scaler functions are thus
+ * invoked in the post-processor scaler thread.
+ *
+ * Frames are processed asynchronously, the post-processor completes the
+ * stream buffer when the converter signals that the destination buffer is
+ * ready.
+ */
+class PostProcessorYuv::HardwareScaler : public Object
+{
+public:
+	HardwareScaler(PostProcessorYuv *postProcessor)
+		: postProcessor_(postProcessor), stride_(0)
+	{
+	}
+
+	int configure(const StreamConfiguration &inCfg,
+		      const StreamConfiguration &outCfg);
+	void stop();
+
+	void queue(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+		   std::shared_ptr<HALFrameBuffer> destination);
+
+	unsigned int stride() const { return stride_; }
+
+private:
+	struct Pending {
+		Camera3RequestDescriptor::StreamBuffer *streamBuffer;
+		std::shared_ptr<HALFrameBuffer> destination;
+	};
+
+	std::unique_ptr<Converter> createConverter();
+	void outputBufferReady(FrameBuffer *buffer);
+
+	PostProcessorYuv *postProcessor_;
+	std::unique_ptr<Converter> converter_;
+	unsigned int stride_;
+
+	std::map<const FrameBuffer *, Pending> pending_;
+};
+
+std::unique_ptr<Converter> PostProcessorYuv::HardwareScaler::createConverter()
+{
+	std::unique_ptr<DeviceEnumerator> enumerator = DeviceEnumerator::create();
+	if (!enumerator || enumerator->enumerate())
+		return nullptr;
+
+	for (const ConverterFactoryBase *factory : ConverterFactoryBase::factories()) {
+		for (const std::string &compatible : factory->compatibles()) {
+			std::shared_ptr<MediaDevice> media =
+				enumerator->search(DeviceMatch(compatible));
+			if (!media)
+				continue;
+
+			std::unique_ptr<Converter> converter =
+				ConverterFactoryBase::create(media.get());
+			if (converter)
+				return converter;
+		}
+	}
+
+	return nullptr;
+}
+
+int PostProcessorYuv::HardwareScaler::configure(const StreamConfiguration &inCfg,
+						const StreamConfiguration &outCfg)
+{
+	converter_ = createConverter();
+	if (!converter_)
+		return -ENODEV;
+
+	std::vector<PixelFormat> formats = converter_->formats(inCfg.pixelFormat);
+	if (std::find(formats.begin(), formats.end(), outCfg.pixelFormat) == formats.end() ||
+	    !converter_->sizes(inCfg.size).contains(outCfg.size)) {
+		converter_.reset();
+		return -EINVAL;
+	}
+
+	StreamConfiguration output = outCfg;
+	output.stride = 0;
+
+	int ret = converter_->configure(inCfg, { std::ref(output) });
+	if (ret < 0) {
+		converter_.reset();
+		return ret;
+	}
+
+	ret = converter_->start();
+	if (ret < 0) {
+		converter_.reset();
+		return ret;
+	}
+
+	converter_->outputBufferReady.connect(this, &HardwareScaler::outputBufferReady);
+	stride_ = output.stride;
+
+	LOG(YUV, Info)
+		<< "Scaling " << inCfg.size << " to " << outCfg.size
+		<< " with converter " << converter_->deviceNode();
+
+	return 0;
+}
+
+void PostProcessorYuv::HardwareScaler::stop()
+{
+	if (!converter_)
+		return;
+
+	/*
+	 * The stream buffers of the pending frames are owned by requests that
+	 * are being destroyed, don't complete them.
+	 */
+	converter_->outputBufferReady.disconnect(this);
+	converter_->stop();
+	converter_.reset();
+	pending_.clear();
+}
+
+void PostProcessorYuv::HardwareScaler::queue(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+					     std::shared_ptr<HALFrameBuffer> destination)
+{
+	/* The converter API doesn't support const source buffers. */
+	FrameBuffer *source = const_cast<FrameBuffer *>(streamBuffer->srcBuffer);
+	FrameBuffer *output = destination.get();
+
+	pending_[output] = { streamBuffer, std::move(destination) };
+
+	int ret = converter_->queueBuffers(source, { { 0, output } });
+	if (ret < 0) {
+		LOG(YUV, Error) << "Failed to queue buffers to the converter: "
+				<< strerror(-ret);
+		pending_.erase(output);
+		postProcessor_->processComplete.emit(streamBuffer,
+						     PostProcessor::Status::Error);
+	}
+}
+
+void PostProcessorYuv::HardwareScaler::outputBufferReady(FrameBuffer *buffer)
+{
+	auto it = pending_.find(buffer);
+	if (it == pending_.end())
+		return;
+
+	Camera3RequestDescriptor::StreamBuffer *streamBuffer = it->second.streamBuffer;
+	pending_.erase(it);
+
+	PostProcessor::Status status =
+		buffer->metadata().status == FrameMetadata::FrameSuccess
+			? PostProcessor::Status::Success
+			: PostProcessor::Status::Error;
+
+	postProcessor_->processComplete.emit(streamBuffer, status);
+}
+
+PostProcessorYuv::PostProcessorYuv()
+	: scalerThread_("yuv-scaler")
+{
+}
+
+PostProcessorYuv::~PostProcessorYuv()
+{
+	if (!scaler_)
+		return;
+
+	scaler_->invokeMethod(&HardwareScaler::stop, ConnectionTypeBlocking);
+	scalerThread_.exit();
+	scalerThread_.wait();
+}
+
 int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 				const StreamConfiguration &outCfg)
 {
@@ -46,6 +228,29 @@ int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 	}
 
 	calculateLengths(inCfg, outCfg);
+
+	/*
+	 * Scale with a hardware converter when available, and fall back to
+	 * libyuv otherwise.
+	 */
+	if (!scaler_) {
+		scaler_ = std::make_unique<HardwareScaler>(this);
+		scaler_->moveToThread(&scalerThread_);
+		scalerThread_.start();
+	} else {
+		scaler_->invokeMethod(&HardwareScaler::stop, ConnectionTypeBlocking);
+	}
+
+	int ret = scaler_->invokeMethod(&HardwareScaler::configure,
+					ConnectionTypeBlocking, inCfg, outCfg);
+	if (ret < 0) {
+		LOG(YUV, Debug) << "No hardware scaler available, using libyuv";
+
+		scalerThread_.exit();
+		scalerThread_.wait();
+		scaler_.reset();
+	}
+
 	return 0;
 }
 
@@ -59,7 +264,33 @@ void PostProcessorYuv::process(Camera3RequestDescriptor::StreamBuffer *streamBuf
 		return;
 	}
 
-	const MappedFrameBuffer sourceMapped(&source, MappedFrameBuffer::MapFlag::Read);
+	/*
+	 * The hardware scaler writes the destination with the stride it has
+	 * been configured with, fall back to libyuv for buffers allocated
+	 * with a different stride.
+	 */
+	if (scaler_ && destination->stride(0) == scaler_->stride()) {
+		std::shared_ptr<HALFrameBuffer> frameBuffer =
+			streamBuffer->stream->frameBuffer(*streamBuffer->camera3Buffer);
+		if (frameBuffer) {
+			scaler_->invokeMethod(&HardwareScaler::queue,
+					      ConnectionTypeQueued, streamBuffer,
+					      std::move(frameBuffer));
+			return;
+		}
+	}
+
+	scale(streamBuffer);
+}
+
+void PostProcessorYuv::scale(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
+{
+	const FrameBuffer &source = *streamBuffer->srcBuffer;
+	CameraBuffer *destination = streamBuffer->dstBuffer.get();
+
+	const MappedFrameBuffer sourceMapped(&source, MappedFrameBuffer::MapFlag::Read |
+						      MappedFrameBuffer::MapFlag::Persistent |
+						      MappedFrameBuffer::MapFlag::Sync);
 	if (!sourceMapped.isValid()) {
 		LOG(YUV, Error) << "Failed to mmap camera frame buffer";
 		processComplete.emit(streamBuffer, PostProcessor::Status::Error);
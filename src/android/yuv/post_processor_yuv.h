@@ -9,18 +9,26 @@
 
 #include "../post_processor.h"
 
+#include <memory>
+
+#include <libcamera/base/thread.h>
+
 #include <libcamera/geometry.h>
 
 class PostProcessorYuv : public PostProcessor
 {
 public:
-	PostProcessorYuv() = default;
+	PostProcessorYuv();
+	~PostProcessorYuv();
 
 	int configure(const libcamera::StreamConfiguration &incfg,
 		      const libcamera::StreamConfiguration &outcfg) override;
 	void process(Camera3RequestDescriptor::StreamBuffer *streamBuffer) override;
 
 private:
+	class HardwareScaler;
+
+	void scale(Camera3RequestDescriptor::StreamBuffer *streamBuffer);
 	bool isValidBuffers(const libcamera::FrameBuffer &source,
 			    const CameraBuffer &destination) const;
 	void calculateLengths(const libcamera::StreamConfiguration &inCfg,
@@ -32,4 +40,7 @@ private:
 	unsigned int destinationLength_[2] = {};
 	unsigned int sourceStride_[2] = {};
 	unsigned int destinationStride_[2] = {};
+
+	libcamera::Thread scalerThread_;
+	std::unique_ptr<HardwareScaler> scaler_;
 };
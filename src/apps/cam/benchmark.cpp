@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Capture latency benchmark
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
+#include <utility>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+using namespace libcamera;
+
+namespace {
+
+const double kPercentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+/*
+ * Frame timestamps are expressed in nanoseconds in the CLOCK_MONOTONIC time
+ * base.
+ */
+uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+Histogram::Histogram()
+	: buckets_{}, count_(0), sum_(0), min_(UINT64_MAX), max_(0)
+{
+}
+
+unsigned int Histogram::bucket(uint64_t value)
+{
+	if (value < 2 * kSubBuckets)
+		return value;
+
+	unsigned int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+	return (shift + 1) * kSubBuckets + (value >> shift) - kSubBuckets;
+}
+
+uint64_t Histogram::bucketValue(unsigned int index)
+{
+	if (index < 2 * kSubBuckets)
+		return index;
+
+	unsigned int shift = index / kSubBuckets - 1;
+	return static_cast<uint64_t>(index % kSubBuckets + kSubBuckets) << shift;
+}
+
+void Histogram::record(uint64_t value)
+{
+	buckets_[bucket(value)]++;
+	count_++;
+	sum_ += value;
+	min_ = std::min(min_, value);
+	max_ = std::max(max_, value);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+	for (unsigned int i = 0; i < kNumBuckets; i++)
+		buckets_[i] += other.buckets_[i];
+
+	count_ += other.count_;
+	sum_ += other.sum_;
+	min_ = std::min(min_, other.min_);
+	max_ = std::max(max_, other.max_);
+}
+
+/*
+ * Return an estimate of the value below which \a percent of the values fall,
+ * as the middle of the bucket containing it.
+ */
+uint64_t Histogram::percentile(double percent) const
+{
+	if (!count_)
+		return 0;
+
+	uint64_t rank = std::max<uint64_t>(std::ceil(count_ * percent / 100.0), 1);
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < kNumBuckets; i++) {
+		total += buckets_[i];
+		if (total < rank)
+			continue;
+
+		/* The last bucket contains the maximum. */
+		if (total == count_)
+			return max_;
+
+		uint64_t value = (bucketValue(i) + bucketValue(i + 1)) / 2;
+		return std::clamp(value, min_, max_);
+	}
+
+	return max_;
+}
+
+/*
+ * The benchmark measures, in microseconds:
+ *
+ * - the latency between queuing a request and its completion
+ * - the latency between the start of exposure reported by the SensorTimestamp
+ *   metadata, or the buffer timestamp if not available, and the completion of
+ *   the request
+ * - the interval between consecutive frames
+ *
+ * Measurements are recorded from the camera manager thread in the request
+ * completion handler, to avoid any delay introduced by the event loop.
+ * Requests are identified by their cookie, which must be an index smaller
+ * than \a numRequests.
+ */
+Benchmark::Benchmark(unsigned int numRequests)
+	: queueTimes_(numRequests), lastTimestamp_(0), lastSequence_(0),
+	  droppedFrames_(0)
+{
+}
+
+void Benchmark::requestQueued(Request *request)
+{
+	queueTimes_.at(request->cookie()) = now();
+}
+
+void Benchmark::requestCompleted(Request *request)
+{
+	uint64_t completed = now();
+
+	queueLatency_.record((completed - queueTimes_.at(request->cookie())) / 1000);
+
+	/* All buffers of a request share the same timestamp and sequence. */
+	const FrameMetadata &metadata = request->buffers().begin()->second->metadata();
+	const auto &sensorTimestamp = request->metadata().get(controls::SensorTimestamp);
+	uint64_t timestamp = sensorTimestamp ? *sensorTimestamp : metadata.timestamp;
+
+	if (completed > timestamp)
+		sensorLatency_.record((completed - timestamp) / 1000);
+
+	if (lastTimestamp_) {
+		if (metadata.timestamp > lastTimestamp_)
+			frameInterval_.record((metadata.timestamp - lastTimestamp_) / 1000);
+		if (metadata.sequence > lastSequence_ + 1)
+			droppedFrames_ += metadata.sequence - lastSequence_ - 1;
+	}
+
+	lastTimestamp_ = metadata.timestamp;
+	lastSequence_ = metadata.sequence;
+}
+
+void Benchmark::report(std::ostream &out, const std::string &name) const
+{
+	const std::pair<const char *, const Histogram *> histograms[] = {
+		{ "queue-to-complete", &queueLatency_ },
+		{ "sensor-to-complete", &sensorLatency_ },
+		{ "frame-interval", &frameInterval_ },
+	};
+
+	out << name << ": Benchmark summary, " << queueLatency_.count()
+	    << " frames, " << droppedFrames_ << " dropped" << std::endl;
+
+	out << "  " << std::left << std::setw(24) << "latency (us)" << std::right;
+	out << std::setw(10) << "min";
+	for (double percent : kPercentiles) {
+		std::ostringstream label;
+		label << "p" << percent;
+		out << std::setw(10) << label.str();
+	}
+	out << std::setw(10) << "max" << std::setw(10) << "mean" << std::endl;
+
+	for (const auto &[label, histogram] : histograms) {
+		out << "  " << std::left << std::setw(24) << label << std::right
+		    << std::setw(10) << histogram->min();
+		for (double percent : kPercentiles)
+			out << std::setw(10) << histogram->percentile(percent);
+		out << std::setw(10) << histogram->max()
+		    << std::setw(10) << std::fixed << std::setprecision(1)
+		    << histogram->mean() << std::defaultfloat << std::endl;
+	}
+}
+
+void Benchmark::reportJson(std::ostream &out, const std::string &name) const
+{
+	const std::pair<const char *, const Histogram *> histograms[] = {
+		{ "queue_to_complete_us", &queueLatency_ },
+		{ "sensor_to_complete_us", &sensorLatency_ },
+		{ "frame_interval_us", &frameInterval_ },
+	};
+
+	out << "{" << std::endl
+	    << "  \"camera\": \"" << name << "\"," << std::endl
+	    << "  \"frames\": " << queueLatency_.count() << "," << std::endl
+	    << "  \"dropped_frames\": " << droppedFrames_;
+
+	for (const auto &[label, histogram] : histograms) {
+		out << "," << std::endl
+		    << "  \"" << label << "\": { \"min\": " << histogram->min();
+		for (double percent : kPercentiles)
+			out << ", \"p" << percent << "\": " << histogram->percentile(percent);
+		out << ", \"max\": " << histogram->max()
+		    << ", \"mean\": " << histogram->mean() << " }";
+	}
+
+	out << std::endl << "}" << std::endl;
+}
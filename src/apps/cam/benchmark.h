@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Capture latency benchmark
+ */
+
+#pragma once
+
+#include <array>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace libcamera {
+class Request;
+} /* namespace libcamera */
+
+class Histogram
+{
+public:
+	Histogram();
+
+	void record(uint64_t value);
+	void merge(const Histogram &other);
+
+	uint64_t count() const { return count_; }
+	uint64_t min() const { return count_ ? min_ : 0; }
+	uint64_t max() const { return max_; }
+	double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+	uint64_t percentile(double percent) const;
+
+private:
+	/*
+	 * Values are stored in buckets of logarithmically increasing size, with
+	 * 2^kSubBucketBits buckets for every power of two. This keeps the
+	 * relative error below 3% for any value.
+	 */
+	static constexpr unsigned int kSubBucketBits = 5;
+	static constexpr unsigned int kSubBuckets = 1 << kSubBucketBits;
+	static constexpr unsigned int kNumBuckets = 64 * kSubBuckets;
+
+	static unsigned int bucket(uint64_t value);
+	static uint64_t bucketValue(unsigned int index);
+
+	std::array<uint32_t, kNumBuckets> buckets_;
+	uint64_t count_;
+	uint64_t sum_;
+	uint64_t min_;
+	uint64_t max_;
+};
+
+class Benchmark
+{
+public:
+	Benchmark(unsigned int numRequests);
+
+	void requestQueued(libcamera::Request *request);
+	void requestCompleted(libcamera::Request *request);
+
+	void report(std::ostream &out, const std::string &name) const;
+	void reportJson(std::ostream &out, const std::string &name) const;
+
+private:
+	std::vector<uint64_t> queueTimes_;
+	uint64_t lastTimestamp_;
+	uint32_t lastSequence_;
+	unsigned int droppedFrames_;
+
+	Histogram queueLatency_;
+	Histogram sensorLatency_;
+	Histogram frameInterval_;
+};
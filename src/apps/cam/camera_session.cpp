@@ -5,6 +5,7 @@
  * Camera capture session
  */
 
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits.h>
@@ -16,6 +17,7 @@
 #include "../common/event_loop.h"
 #include "../common/stream_options.h"
 
+#include "benchmark.h"
 #include "camera_session.h"
 #include "capture_script.h"
 #include "file_sink.h"
@@ -29,11 +31,25 @@
 
 using namespace libcamera;
 
+namespace {
+
+/* Replace the first '#' in a report file name with the camera index. */
+std::string reportFileName(std::string filename, unsigned int index)
+{
+	size_t pos = filename.find_first_of('#');
+	if (pos != std::string::npos)
+		filename.replace(pos, 1, std::to_string(index));
+
+	return filename;
+}
+
+} /* namespace */
+
 CameraSession::CameraSession(CameraManager *cm,
 			     const std::string &cameraId,
 			     unsigned int cameraIndex,
 			     const OptionsParser::Options &options)
-	: options_(options), cameraIndex_(cameraIndex), last_(0),
+	: options_(options), cameraIndex_(cameraIndex), loop_(nullptr), last_(0),
 	  queueCount_(0), captureCount_(0), captureLimit_(0),
 	  printMetadata_(false)
 {
@@ -203,6 +219,13 @@ int CameraSession::start()
 	captureCount_ = 0;
 	captureLimit_ = options_[OptCapture].toInteger();
 	printMetadata_ = options_.isSet(OptMetadata);
+	processLatency_ = Histogram();
+
+	/*
+	 * Completed requests are processed by the event loop of the thread
+	 * that starts the session.
+	 */
+	loop_ = EventLoop::instance();
 
 	ret = camera_->configure(config_.get());
 	if (ret < 0) {
@@ -219,6 +242,12 @@ int CameraSession::start()
 
 	camera_->requestCompleted.connect(this, &CameraSession::requestComplete);
 
+	/* Frames are discarded in benchmark mode, to avoid perturbing timings. */
+	if (options_.isSet(OptBenchmark)) {
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+		return startCapture();
+	}
+
 #ifdef HAVE_KMS
 	if (options_.isSet(OptDisplay))
 		sink_ = std::make_unique<KMSSink>(options_[OptDisplay].toString());
@@ -229,13 +258,11 @@ int CameraSession::start()
 		sink_ = std::make_unique<SDLSink>();
 #endif
 
-	if (options_.isSet(OptFile)) {
-		if (!options_[OptFile].toString().empty())
-			sink_ = std::make_unique<FileSink>(camera_.get(), streamNames_,
-							   options_[OptFile]);
-		else
-			sink_ = std::make_unique<FileSink>(camera_.get(), streamNames_);
-	}
+	if (options_.isSet(OptFile))
+		sink_ = std::make_unique<FileSink>(camera_.get(), streamNames_,
+						   options_[OptFile].toString(),
+						   options_.isSet(OptDirectIO),
+						   options_.isSet(OptDNGCompression));
 
 	if (sink_) {
 		ret = sink_->configure(*config_);
@@ -253,7 +280,7 @@ int CameraSession::start()
 	return startCapture();
 }
 
-void CameraSession::stop()
+int CameraSession::stop()
 {
 	int ret = camera_->stop();
 	if (ret)
@@ -267,9 +294,57 @@ void CameraSession::stop()
 
 	sink_.reset();
 
+	std::string name = "cam" + std::to_string(cameraIndex_);
+
+	if (benchmark_) {
+		benchmark_->report(std::cout, name);
+
+		std::string filename = options_[OptBenchmark].toString();
+		if (!filename.empty()) {
+			filename = reportFileName(filename, cameraIndex_);
+
+			std::ofstream file(filename);
+			if (file)
+				benchmark_->reportJson(file, name);
+			else
+				std::cerr << "Failed to open benchmark file " << filename
+					  << std::endl;
+		}
+
+		benchmark_.reset();
+	}
+
 	requests_.clear();
 
 	allocator_.reset();
+
+	/* Report the capture script measurements, and whether they passed. */
+	if (!script_)
+		return 0;
+
+	bool passed = script_->report(std::cout, name);
+
+	if (!script_->reportFile().empty()) {
+		std::string filename = reportFileName(script_->reportFile(), cameraIndex_);
+
+		std::ofstream file(filename);
+		if (file)
+			script_->reportJson(file, name);
+		else
+			std::cerr << "Failed to open measurements report file "
+				  << filename << std::endl;
+	}
+
+	return passed ? 0 : -EINVAL;
+}
+
+/*
+ * Return the time elapsed between the start of the capture and the processing
+ * of the last completed request.
+ */
+std::chrono::steady_clock::duration CameraSession::captureTime() const
+{
+	return lastTime_ - startTime_;
 }
 
 int CameraSession::startCapture()
@@ -295,7 +370,7 @@ int CameraSession::startCapture()
 	 */
 
 	for (unsigned int i = 0; i < nbuffers; i++) {
-		std::unique_ptr<Request> request = camera_->createRequest();
+		std::unique_ptr<Request> request = camera_->createRequest(i);
 		if (!request) {
 			std::cerr << "Can't create request" << std::endl;
 			return -ENOMEM;
@@ -321,6 +396,8 @@ int CameraSession::startCapture()
 		requests_.push_back(std::move(request));
 	}
 
+	completeTimes_.assign(nbuffers, {});
+
 	if (sink_) {
 		ret = sink_->start();
 		if (ret) {
@@ -329,6 +406,9 @@ int CameraSession::startCapture()
 		}
 	}
 
+	if (options_.isSet(OptBenchmark))
+		benchmark_ = std::make_unique<Benchmark>(nbuffers);
+
 	ret = camera_->start();
 	if (ret) {
 		std::cout << "Failed to start capture" << std::endl;
@@ -348,6 +428,9 @@ int CameraSession::startCapture()
 		}
 	}
 
+	startTime_ = std::chrono::steady_clock::now();
+	lastTime_ = startTime_;
+
 	if (captureLimit_)
 		std::cout << "cam" << cameraIndex_
 			  << ": Capture " << captureLimit_ << " frames"
@@ -370,6 +453,9 @@ int CameraSession::queueRequest(Request *request)
 
 	queueCount_++;
 
+	if (benchmark_)
+		benchmark_->requestQueued(request);
+
 	return camera_->queueRequest(request);
 }
 
@@ -378,11 +464,16 @@ void CameraSession::requestComplete(Request *request)
 	if (request->status() == Request::RequestCancelled)
 		return;
 
+	if (benchmark_)
+		benchmark_->requestCompleted(request);
+
+	completeTimes_.at(request->cookie()) = std::chrono::steady_clock::now();
+
 	/*
 	 * Defer processing of the completed request to the event loop, to avoid
 	 * blocking the camera manager thread.
 	 */
-	EventLoop::instance()->callLater([this, request]() { processRequest(request); });
+	loop_->callLater([this, request]() { processRequest(request); });
 }
 
 void CameraSession::processRequest(Request *request)
@@ -397,6 +488,30 @@ void CameraSession::processRequest(Request *request)
 	if (captureLimit_ && captureCount_ >= captureLimit_)
 		return;
 
+	/*
+	 * Measure the time the completed request waited for the event loop,
+	 * which increases when the event loop is shared with other cameras.
+	 */
+	auto now = std::chrono::steady_clock::now();
+	auto latency = now - completeTimes_.at(request->cookie());
+	processLatency_.record(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+	lastTime_ = now;
+
+	if (script_)
+		script_->frameCompleted(captureCount_, request->metadata());
+
+	if (benchmark_) {
+		captureCount_++;
+		if (captureLimit_ && captureCount_ >= captureLimit_) {
+			captureDone.emit();
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		queueRequest(request);
+		return;
+	}
+
 	const Request::BufferMap &buffers = request->buffers();
 
 	/*
@@ -463,12 +578,26 @@ void CameraSession::processRequest(Request *request)
 	if (!requeue)
 		return;
 
+	if (sink_) {
+		sinkRelease(request);
+		return;
+	}
+
 	request->reuse(Request::ReuseBuffers);
 	queueRequest(request);
 }
 
 void CameraSession::sinkRelease(Request *request)
 {
-	request->reuse(Request::ReuseBuffers);
+	/*
+	 * The sink may release the request while its buffers are still in use,
+	 * in which case the buffers are added back with the release fences.
+	 */
+	Request::BufferMap buffers = request->buffers();
+	request->reuse();
+
+	for (const auto &[stream, buffer] : buffers)
+		request->addBuffer(stream, buffer, sink_->releaseFence(buffer));
+
 	queueRequest(request);
 }
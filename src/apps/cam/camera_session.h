@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <stdint.h>
 #include <string>
@@ -23,7 +24,10 @@
 
 #include "../common/options.h"
 
+#include "benchmark.h"
+
 class CaptureScript;
+class EventLoop;
 class FrameSink;
 
 class CameraSession
@@ -45,7 +49,11 @@ public:
 	void infoConfiguration() const;
 
 	int start();
-	void stop();
+	int stop();
+
+	unsigned int captureCount() const { return captureCount_; }
+	std::chrono::steady_clock::duration captureTime() const;
+	const Histogram &processLatency() const { return processLatency_; }
 
 	libcamera::Signal<> captureDone;
 
@@ -62,10 +70,12 @@ private:
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
 
 	std::unique_ptr<CaptureScript> script_;
+	std::unique_ptr<Benchmark> benchmark_;
 
 	std::map<const libcamera::Stream *, std::string> streamNames_;
 	std::unique_ptr<FrameSink> sink_;
 	unsigned int cameraIndex_;
+	EventLoop *loop_;
 
 	uint64_t last_;
 
@@ -74,6 +84,11 @@ private:
 	unsigned int captureLimit_;
 	bool printMetadata_;
 
+	std::chrono::steady_clock::time_point startTime_;
+	std::chrono::steady_clock::time_point lastTime_;
+	std::vector<std::chrono::steady_clock::time_point> completeTimes_;
+	Histogram processLatency_;
+
 	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
 	std::vector<std::unique_ptr<libcamera::Request>> requests_;
 };
@@ -7,12 +7,41 @@
 
 #include "capture_script.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <stdio.h>
 #include <stdlib.h>
 
 using namespace libcamera;
 
+namespace {
+
+std::optional<double> numericValue(const ControlValue &value)
+{
+	if (value.isArray())
+		return std::nullopt;
+
+	switch (value.type()) {
+	case ControlTypeBool:
+		return value.get<bool>() ? 1.0 : 0.0;
+	case ControlTypeByte:
+		return value.get<uint8_t>();
+	case ControlTypeInteger32:
+		return value.get<int32_t>();
+	case ControlTypeInteger64:
+		return value.get<int64_t>();
+	case ControlTypeFloat:
+		return value.get<float>();
+	default:
+		return std::nullopt;
+	}
+}
+
+} /* namespace */
+
 CaptureScript::CaptureScript(std::shared_ptr<Camera> camera,
 			     const std::string &fileName)
 	: camera_(camera), loop_(0), valid_(false)
@@ -57,6 +86,233 @@ const ControlList &CaptureScript::frameControls(unsigned int frame)
 	return it->second;
 }
 
+/*
+ * Measurements are evaluated on the metadata of completed requests, identified
+ * by their frame number. Requests complete in the order they are queued, the
+ * frame number thus matches the one passed to frameControls() when the
+ * request was queued.
+ */
+void CaptureScript::frameCompleted(unsigned int frame, const ControlList &metadata)
+{
+	for (Measurement &measurement : measurements_) {
+		switch (measurement.type) {
+		case Measurement::Type::Latency:
+			measureLatency(measurement, frame, metadata);
+			break;
+		case Measurement::Type::Convergence:
+			measureConvergence(measurement, frame, metadata);
+			break;
+		}
+	}
+}
+
+/*
+ * Measure the number of frames between the request that sets a control and
+ * the first request whose metadata reports the value. This covers the delays
+ * applied by the pipeline handler to the sensor controls as well as the depth
+ * of the pipeline. A value that hasn't been reported by the time the control
+ * is set again is counted as missed.
+ */
+void CaptureScript::measureLatency(Measurement &measurement, unsigned int frame,
+				   const ControlList &metadata)
+{
+	unsigned int id = measurement.control->id();
+	const ControlList &controls = frameControls(frame);
+
+	if (controls.contains(id)) {
+		if (measurement.start)
+			measurement.missed++;
+
+		measurement.start = frame;
+		measurement.expected = controls.get(id);
+	}
+
+	if (!measurement.start || !metadata.contains(id))
+		return;
+
+	if (!withinTolerance(measurement, measurement.expected, metadata.get(id)))
+		return;
+
+	measurement.results.push_back(frame - *measurement.start);
+	measurement.start.reset();
+}
+
+/*
+ * Measure the number of frames it takes for a metadata value to settle,
+ * starting from the frame given in the script, and repeated every loop if the
+ * script loops. The value is considered as converged when it stays within the
+ * tolerance of the previous frame for the given number of consecutive frames,
+ * the convergence point being the first of those frames. Not converging before
+ * the next start frame is counted as missed.
+ */
+void CaptureScript::measureConvergence(Measurement &measurement, unsigned int frame,
+				       const ControlList &metadata)
+{
+	unsigned int id = measurement.control->id();
+	unsigned int idx = loop_ ? frame % loop_ : frame;
+
+	if (idx == measurement.frame) {
+		if (measurement.start)
+			measurement.missed++;
+
+		measurement.start = frame;
+		measurement.previous.reset();
+		measurement.stable = 0;
+	}
+
+	if (!measurement.start || !metadata.contains(id))
+		return;
+
+	std::optional<double> value = numericValue(metadata.get(id));
+	if (!value)
+		return;
+
+	if (measurement.previous &&
+	    withinTolerance(measurement, *measurement.previous, *value))
+		measurement.stable++;
+	else
+		measurement.stable = 0;
+
+	measurement.previous = value;
+
+	if (measurement.stable < measurement.stableFrames)
+		return;
+
+	measurement.results.push_back(frame - measurement.stableFrames - *measurement.start);
+	measurement.start.reset();
+}
+
+bool CaptureScript::withinTolerance(const Measurement &measurement,
+				    const ControlValue &expected,
+				    const ControlValue &value)
+{
+	std::optional<double> expectedValue = numericValue(expected);
+	std::optional<double> actualValue = numericValue(value);
+
+	if (!expectedValue || !actualValue)
+		return expected == value;
+
+	return withinTolerance(measurement, *expectedValue, *actualValue);
+}
+
+bool CaptureScript::withinTolerance(const Measurement &measurement,
+				    double expected, double value)
+{
+	double limit = measurement.relative
+		     ? measurement.tolerance * std::abs(expected)
+		     : measurement.tolerance;
+
+	return std::abs(value - expected) <= limit;
+}
+
+const char *CaptureScript::Measurement::typeName() const
+{
+	return type == Type::Latency ? "latency" : "convergence";
+}
+
+/*
+ * A measurement passes if it has no maximum, or if it has been measured at
+ * least once, never missed and never exceeded the maximum.
+ */
+bool CaptureScript::Measurement::passed() const
+{
+	if (!maxFrames)
+		return true;
+
+	if (missed || results.empty())
+		return false;
+
+	return *std::max_element(results.begin(), results.end()) <= *maxFrames;
+}
+
+/* Print the measurements summary, return false if any assertion failed. */
+bool CaptureScript::report(std::ostream &out, const std::string &name) const
+{
+	if (measurements_.empty())
+		return true;
+
+	bool passed = true;
+
+	out << name << ": Capture script measurements" << std::endl;
+
+	out << "  " << std::left << std::setw(24) << "measurement (frames)"
+	    << std::setw(12) << "type" << std::right
+	    << std::setw(8) << "count" << std::setw(8) << "min"
+	    << std::setw(8) << "max" << std::setw(8) << "mean"
+	    << std::setw(8) << "missed" << std::setw(8) << "result"
+	    << std::endl;
+
+	for (const Measurement &measurement : measurements_) {
+		const std::vector<unsigned int> &results = measurement.results;
+
+		out << "  " << std::left << std::setw(24) << measurement.name
+		    << std::setw(12) << measurement.typeName() << std::right
+		    << std::setw(8) << results.size();
+
+		if (results.empty()) {
+			out << std::setw(8) << "-" << std::setw(8) << "-"
+			    << std::setw(8) << "-";
+		} else {
+			double mean = std::accumulate(results.begin(), results.end(), 0.0)
+				    / results.size();
+
+			out << std::setw(8) << *std::min_element(results.begin(), results.end())
+			    << std::setw(8) << *std::max_element(results.begin(), results.end())
+			    << std::setw(8) << std::fixed << std::setprecision(1)
+			    << mean << std::defaultfloat;
+		}
+
+		out << std::setw(8) << measurement.missed;
+
+		if (!measurement.maxFrames)
+			out << std::setw(8) << "-";
+		else if (measurement.passed())
+			out << std::setw(8) << "pass";
+		else
+			out << std::setw(8) << "FAIL";
+
+		out << std::endl;
+
+		passed &= measurement.passed();
+	}
+
+	return passed;
+}
+
+void CaptureScript::reportJson(std::ostream &out, const std::string &name) const
+{
+	out << "{" << std::endl
+	    << "  \"camera\": \"" << name << "\"," << std::endl
+	    << "  \"measurements\": [";
+
+	for (auto it = measurements_.begin(); it != measurements_.end(); ++it) {
+		const Measurement &measurement = *it;
+
+		out << (it == measurements_.begin() ? "" : ",") << std::endl
+		    << "    { \"name\": \"" << measurement.name << "\""
+		    << ", \"type\": \"" << measurement.typeName() << "\""
+		    << ", \"control\": \"" << measurement.control->name() << "\""
+		    << ", \"missed\": " << measurement.missed
+		    << ", \"frames\": [";
+
+		for (auto result = measurement.results.begin();
+		     result != measurement.results.end(); ++result)
+			out << (result == measurement.results.begin() ? "" : ", ")
+			    << *result;
+
+		out << "]";
+
+		if (measurement.maxFrames)
+			out << ", \"max_frames\": " << *measurement.maxFrames
+			    << ", \"passed\": "
+			    << (measurement.passed() ? "true" : "false");
+
+		out << " }";
+	}
+
+	out << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
 CaptureScript::EventPtr CaptureScript::nextEvent(yaml_event_type_t expectedType)
 {
 	EventPtr event(new yaml_event_t);
@@ -162,6 +418,10 @@ int CaptureScript::parseScript(FILE *script)
 			ret = parseFrames();
 			if (ret)
 				return ret;
+		} else if (section == "measurements") {
+			ret = parseMeasurements();
+			if (ret)
+				return ret;
 		} else {
 			std::cerr << "Unsupported section '" << section << "'"
 				  << std::endl;
@@ -195,6 +455,10 @@ int CaptureScript::parseProperty()
 				  << std::endl;
 			return -EINVAL;
 		}
+	} else if (prop == "report") {
+		reportFile_ = parseScalar();
+		if (reportFile_.empty())
+			return -EINVAL;
 	} else {
 		std::cerr << "Unsupported property '" << prop << "'" << std::endl;
 		return -EINVAL;
@@ -294,6 +558,141 @@ int CaptureScript::parseFrame(EventPtr event)
 	return 0;
 }
 
+int CaptureScript::parseMeasurements()
+{
+	EventPtr event = nextEvent(YAML_SEQUENCE_START_EVENT);
+	if (!event)
+		return -EINVAL;
+
+	while (1) {
+		event = nextEvent();
+		if (!event)
+			return -EINVAL;
+
+		if (event->type == YAML_SEQUENCE_END_EVENT)
+			return 0;
+
+		int ret = parseMeasurement(std::move(event));
+		if (ret)
+			return ret;
+	}
+}
+
+int CaptureScript::parseMeasurement(EventPtr event)
+{
+	if (!checkEvent(event, YAML_MAPPING_START_EVENT))
+		return -EINVAL;
+
+	Measurement measurement{};
+	measurement.stableFrames = 3;
+
+	std::string type;
+
+	while (1) {
+		event = nextEvent();
+		if (!event)
+			return -EINVAL;
+
+		if (event->type == YAML_MAPPING_END_EVENT)
+			break;
+
+		if (!checkEvent(event, YAML_SCALAR_EVENT))
+			return -EINVAL;
+
+		std::string key = eventScalarValue(event);
+		std::string value = parseScalar();
+		if (value.empty())
+			return -EINVAL;
+
+		if (key == "name") {
+			measurement.name = value;
+		} else if (key == "type") {
+			type = value;
+		} else if (key == "control") {
+			auto it = controls_.find(value);
+			if (it == controls_.end()) {
+				std::cerr << "Unsupported control '" << value
+					  << "'" << std::endl;
+				return -EINVAL;
+			}
+
+			measurement.control = it->second;
+		} else if (key == "frame") {
+			measurement.frame = atoi(value.c_str());
+		} else if (key == "tolerance") {
+			int ret = parseTolerance(value, measurement);
+			if (ret)
+				return ret;
+		} else if (key == "stable-frames") {
+			measurement.stableFrames = atoi(value.c_str());
+		} else if (key == "max-frames") {
+			measurement.maxFrames = atoi(value.c_str());
+		} else {
+			std::cerr << "Unsupported measurement key '" << key
+				  << "'" << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	if (type == "latency") {
+		measurement.type = Measurement::Type::Latency;
+	} else if (type == "convergence") {
+		measurement.type = Measurement::Type::Convergence;
+	} else {
+		std::cerr << "Invalid measurement type '" << type << "'"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (!measurement.control) {
+		std::cerr << "Measurement requires a control" << std::endl;
+		return -EINVAL;
+	}
+
+	if (measurement.type == Measurement::Type::Convergence) {
+		if (!measurement.stableFrames) {
+			std::cerr << "Invalid number of stable frames" << std::endl;
+			return -EINVAL;
+		}
+
+		if (loop_ && measurement.frame >= loop_) {
+			std::cerr << "Measurement frame (" << measurement.frame
+				  << ") shall be smaller than loop limit ("
+				  << loop_ << ")" << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	if (measurement.name.empty())
+		measurement.name = measurement.control->name() + "-" + type;
+
+	measurements_.push_back(std::move(measurement));
+
+	return 0;
+}
+
+/* Parse an absolute tolerance, or a relative one if suffixed with '%'. */
+int CaptureScript::parseTolerance(const std::string &repr, Measurement &measurement)
+{
+	char *end;
+	double tolerance = strtod(repr.c_str(), &end);
+
+	measurement.relative = *end == '%';
+	if (measurement.relative) {
+		tolerance /= 100.0;
+		end++;
+	}
+
+	if (end == repr.c_str() || *end != '\0' || tolerance < 0.0) {
+		std::cerr << "Invalid tolerance '" << repr << "'" << std::endl;
+		return -EINVAL;
+	}
+
+	measurement.tolerance = tolerance;
+
+	return 0;
+}
+
 int CaptureScript::parseControl(EventPtr event, ControlList &controls)
 {
 	/* We expect a value after a key. */
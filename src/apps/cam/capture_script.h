@@ -9,7 +9,10 @@
 
 #include <map>
 #include <memory>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <vector>
 
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
@@ -26,7 +29,41 @@ public:
 
 	const libcamera::ControlList &frameControls(unsigned int frame);
 
+	void frameCompleted(unsigned int frame, const libcamera::ControlList &metadata);
+	bool report(std::ostream &out, const std::string &name) const;
+	void reportJson(std::ostream &out, const std::string &name) const;
+	const std::string &reportFile() const { return reportFile_; }
+
 private:
+	struct Measurement {
+		enum class Type {
+			Latency,
+			Convergence,
+		};
+
+		std::string name;
+		Type type;
+		const libcamera::ControlId *control;
+		unsigned int frame;
+		double tolerance;
+		bool relative;
+		unsigned int stableFrames;
+		std::optional<unsigned int> maxFrames;
+
+		/* Measurement state */
+		std::optional<unsigned int> start;
+		libcamera::ControlValue expected;
+		std::optional<double> previous;
+		unsigned int stable;
+
+		/* Results, in frames */
+		std::vector<unsigned int> results;
+		unsigned int missed;
+
+		const char *typeName() const;
+		bool passed() const;
+	};
+
 	struct EventDeleter {
 		void operator()(yaml_event_t *event) const
 		{
@@ -38,6 +75,8 @@ private:
 
 	std::map<std::string, const libcamera::ControlId *> controls_;
 	std::map<unsigned int, libcamera::ControlList> frameControls_;
+	std::vector<Measurement> measurements_;
+	std::string reportFile_;
 	std::shared_ptr<libcamera::Camera> camera_;
 	yaml_parser_t parser_;
 	unsigned int loop_;
@@ -55,6 +94,19 @@ private:
 	int parseFrames();
 	int parseFrame(EventPtr event);
 	int parseControl(EventPtr event, libcamera::ControlList &controls);
+	int parseMeasurements();
+	int parseMeasurement(EventPtr event);
+	int parseTolerance(const std::string &repr, Measurement &measurement);
+
+	void measureLatency(Measurement &measurement, unsigned int frame,
+			    const libcamera::ControlList &metadata);
+	void measureConvergence(Measurement &measurement, unsigned int frame,
+				const libcamera::ControlList &metadata);
+	static bool withinTolerance(const Measurement &measurement,
+				    const libcamera::ControlValue &expected,
+				    const libcamera::ControlValue &value);
+	static bool withinTolerance(const Measurement &measurement,
+				    double expected, double value);
 
 	libcamera::ControlValue parseScalarControl(const libcamera::ControlId *id,
 						   const std::string repr);
@@ -5,17 +5,21 @@
  * File Sink
  */
 
+#include <algorithm>
 #include <assert.h>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/camera.h>
 
 #include "../common/dng_writer.h"
+#include "../common/event_loop.h"
 #include "../common/image.h"
 #include "../common/ppm_writer.h"
 
@@ -23,19 +27,60 @@
 
 using namespace libcamera;
 
+namespace {
+
+/*
+ * Direct I/O requires the memory buffer, file offset and length to be aligned
+ * to the logical block size of the storage, 4kiB covers all common devices.
+ */
+constexpr size_t kDirectIOAlignment = 4096;
+
+/*
+ * Frame buffers are usually mapped from dma-bufs, which the kernel can't use
+ * as a source for direct I/O. Data is copied to an aligned bounce buffer
+ * instead, in chunks of this size.
+ */
+constexpr size_t kBounceSize = 4 * 1024 * 1024;
+
+/* Number of frames to preallocate ahead when streaming to a single file. */
+constexpr unsigned int kPreallocFrames = 64;
+
+constexpr mode_t kFileMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+size_t alignUp(size_t value)
+{
+	return (value + kDirectIOAlignment - 1) / kDirectIOAlignment * kDirectIOAlignment;
+}
+
+} /* namespace */
+
 FileSink::FileSink([[maybe_unused]] const libcamera::Camera *camera,
 		   const std::map<const libcamera::Stream *, std::string> &streamNames,
-		   const std::string &pattern)
+		   const std::string &pattern, bool directIO,
+		   [[maybe_unused]] bool compressDNG)
 	:
 #ifdef HAVE_TIFF
-	  camera_(camera),
+	  camera_(camera), compressDNG_(compressDNG),
 #endif
-	  streamNames_(streamNames), pattern_(pattern)
+	  streamNames_(streamNames), pattern_(pattern), directIO_(directIO),
+	  bounce_(nullptr, &free), loop_(nullptr), stopping_(false),
+	  token_(std::make_shared<bool>(true))
 {
+	if (directIO_) {
+		void *bounce;
+		if (posix_memalign(&bounce, kDirectIOAlignment, kBounceSize)) {
+			std::cerr << "failed to allocate direct I/O buffer, "
+				  << "falling back to buffered I/O" << std::endl;
+			directIO_ = false;
+		} else {
+			bounce_.reset(static_cast<uint8_t *>(bounce));
+		}
+	}
 }
 
 FileSink::~FileSink()
 {
+	stop();
 }
 
 int FileSink::configure(const libcamera::CameraConfiguration &config)
@@ -56,12 +101,87 @@ void FileSink::mapBuffer(FrameBuffer *buffer)
 	mappedBuffers_[buffer] = std::move(image);
 }
 
+/*
+ * Files are written by a dedicated thread, to avoid blocking the event loop
+ * when the storage can't keep up momentarily. Requests are held until their
+ * buffers have been written, the queue is thus bounded by the number of
+ * requests allocated by the camera session. They are released from the event
+ * loop of the thread that starts the sink.
+ */
+int FileSink::start()
+{
+	loop_ = EventLoop::instance();
+	stopping_ = false;
+	thread_ = std::thread(&FileSink::run, this);
+
+	return 0;
+}
+
+int FileSink::stop()
+{
+	if (!thread_.joinable())
+		return 0;
+
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+	cv_.notify_one();
+
+	thread_.join();
+
+	closeContainers();
+
+	return 0;
+}
+
 bool FileSink::processRequest(Request *request)
+{
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		queue_.push(request);
+	}
+	cv_.notify_one();
+
+	return false;
+}
+
+void FileSink::run()
+{
+	while (true) {
+		Request *request;
+
+		{
+			std::unique_lock<std::mutex> locker(mutex_);
+			cv_.wait(locker, [&] { return stopping_ || !queue_.empty(); });
+
+			/* Write all queued requests before stopping. */
+			if (queue_.empty())
+				return;
+
+			request = queue_.front();
+			queue_.pop();
+		}
+
+		writeRequest(request);
+
+		/*
+		 * Release the request from the event loop. The sink may have
+		 * been destroyed by the time the call is dispatched, in which
+		 * case the request isn't released.
+		 */
+		std::weak_ptr<bool> token = token_;
+		loop_->callLater([this, token, request]() {
+			if (!token.expired())
+				requestProcessed.emit(request);
+		});
+	}
+}
+
+void FileSink::writeRequest(Request *request)
 {
 	for (auto [stream, buffer] : request->buffers())
 		writeBuffer(stream, buffer, request->metadata());
-
-	return true;
 }
 
 void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer,
@@ -69,7 +189,7 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer,
 {
 	std::string filename;
 	size_t pos;
-	int fd, ret = 0;
+	int ret = 0;
 
 	if (!pattern_.empty())
 		filename = pattern_;
@@ -85,18 +205,20 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer,
 	pos = filename.find_first_of('#');
 	if (pos != std::string::npos) {
 		std::stringstream ss;
-		ss << streamNames_[stream] << "-" << std::setw(6)
+		ss << streamNames_.at(stream) << "-" << std::setw(6)
 		   << std::setfill('0') << buffer->metadata().sequence;
 		filename.replace(pos, 1, ss.str());
 	}
 
-	Image *image = mappedBuffers_[buffer].get();
+	Image *image = mappedBuffers_.at(buffer).get();
 
 #ifdef HAVE_TIFF
 	if (dng) {
 		ret = DNGWriter::write(filename.c_str(), camera_,
 				       stream->configuration(), metadata,
-				       buffer, image->data(0).data());
+				       buffer, image->data(0).data(),
+				       compressDNG_ ? DNGWriter::Compression::LosslessJPEG
+						    : DNGWriter::Compression::None);
 		if (ret < 0)
 			std::cerr << "failed to write DNG file `" << filename
 				  << "'" << std::endl;
@@ -114,16 +236,35 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer,
 		return;
 	}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1) {
-		ret = -errno;
-		std::cerr << "failed to open file " << filename << ": "
-			  << strerror(-ret) << std::endl;
-		return;
+	/*
+	 * Without a '#' in the file name, all frames are appended to a single
+	 * file, which is kept open for the whole capture session.
+	 */
+	OutputFile frameFile = { -1, 0, 0 };
+	OutputFile *file;
+
+	if (pos == std::string::npos) {
+		file = openContainer(filename);
+		if (!file)
+			return;
+	} else {
+		frameFile.fd = open(filename.c_str(),
+				    O_CREAT | O_WRONLY | O_TRUNC |
+				    (directIO_ ? O_DIRECT : 0),
+				    kFileMode);
+		if (frameFile.fd == -1) {
+			ret = -errno;
+			std::cerr << "failed to open file " << filename << ": "
+				  << strerror(-ret) << std::endl;
+			return;
+		}
+
+		file = &frameFile;
 	}
 
+	std::vector<Span<const uint8_t>> planes;
+	size_t size = 0;
+
 	for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
 		/*
 		 * This was formerly a local "const FrameMetadata::Plane &"
@@ -140,19 +281,150 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer,
 				  << " larger than plane size " << data.size()
 				  << std::endl;
 
-		ret = ::write(fd, data.data(), length);
+		planes.push_back(data.first(length));
+		size += length;
+	}
+
+	/*
+	 * Reserve space ahead when streaming to a single file, to reduce
+	 * fragmentation and metadata updates. Not all file systems support
+	 * preallocation, errors are ignored.
+	 */
+	if (file != &frameFile && file->offset + static_cast<off_t>(size) > file->allocated) {
+		off_t length = alignUp(size) * kPreallocFrames;
+		if (!fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->offset, length))
+			file->allocated = file->offset + length;
+	}
+
+	size_t filled = 0;
+
+	for (Span<const uint8_t> data : planes) {
+		ret = directIO_ ? writeDirect(file, data, &filled)
+				: writeData(file, data);
+		if (ret < 0)
+			break;
+	}
+
+	if (ret >= 0 && directIO_) {
+		ret = flushDirect(file, filled);
+
+		/*
+		 * The last block has been padded, truncate the file to the
+		 * frame size. Frames appended to a single file are kept
+		 * padded, to keep the next frames aligned.
+		 */
+		if (ret >= 0 && file == &frameFile && ftruncate(file->fd, size) < 0) {
+			ret = -errno;
+			std::cerr << "failed to truncate file " << filename
+				  << ": " << strerror(-ret) << std::endl;
+		}
+	}
+
+	if (frameFile.fd != -1)
+		close(frameFile.fd);
+}
+
+FileSink::OutputFile *FileSink::openContainer(const std::string &filename)
+{
+	auto it = containers_.find(filename);
+	if (it != containers_.end())
+		return &it->second;
+
+	int fd = open(filename.c_str(), O_CREAT | O_WRONLY |
+		      (directIO_ ? O_DIRECT : 0), kFileMode);
+	if (fd == -1) {
+		int ret = -errno;
+		std::cerr << "failed to open file " << filename << ": "
+			  << strerror(-ret) << std::endl;
+		return nullptr;
+	}
+
+	/* Append to the existing content, aligned for direct I/O. */
+	off_t offset = lseek(fd, 0, SEEK_END);
+	if (offset < 0)
+		offset = 0;
+	if (directIO_)
+		offset = alignUp(offset);
+
+	OutputFile &file = containers_[filename];
+	file = { fd, offset, offset };
+
+	return &file;
+}
+
+void FileSink::closeContainers()
+{
+	for (const auto &[filename, file] : containers_) {
+		/* Release the space preallocated beyond the last frame. */
+		if (file.allocated > file.offset)
+			fallocate(file.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				  file.offset, file.allocated - file.offset);
+
+		close(file.fd);
+	}
+
+	containers_.clear();
+}
+
+int FileSink::writeData(OutputFile *file, Span<const uint8_t> data)
+{
+	while (!data.empty()) {
+		ssize_t ret = pwrite(file->fd, data.data(), data.size(),
+				     file->offset);
 		if (ret < 0) {
 			ret = -errno;
 			std::cerr << "write error: " << strerror(-ret)
 				  << std::endl;
-			break;
-		} else if (ret != (int)length) {
-			std::cerr << "write error: only " << ret
-				  << " bytes written instead of "
-				  << length << std::endl;
-			break;
+			return ret;
+		} else if (ret == 0) {
+			std::cerr << "write error: no data written" << std::endl;
+			return -EIO;
 		}
+
+		file->offset += ret;
+		data = data.subspan(ret);
 	}
 
-	close(fd);
+	return 0;
+}
+
+/*
+ * Copy data to the bounce buffer, and write it every time it fills up. The
+ * \a filled argument tracks the amount of data in the bounce buffer across the
+ * planes of a frame.
+ */
+int FileSink::writeDirect(OutputFile *file, Span<const uint8_t> data,
+			  size_t *filled)
+{
+	uint8_t *bounce = bounce_.get();
+
+	while (!data.empty()) {
+		size_t length = std::min(data.size(), kBounceSize - *filled);
+
+		memcpy(bounce + *filled, data.data(), length);
+		*filled += length;
+		data = data.subspan(length);
+
+		if (*filled < kBounceSize)
+			break;
+
+		int ret = writeData(file, { bounce, kBounceSize });
+		if (ret < 0)
+			return ret;
+
+		*filled = 0;
+	}
+
+	return 0;
+}
+
+int FileSink::flushDirect(OutputFile *file, size_t filled)
+{
+	if (!filled)
+		return 0;
+
+	size_t length = alignUp(filled);
+	memset(bounce_.get() + filled, 0, length - filled);
+
+	return writeData(file, { bounce_.get(), length });
 }
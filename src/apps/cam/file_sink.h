@@ -7,14 +7,23 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <stdlib.h>
 #include <string>
+#include <sys/types.h>
+#include <thread>
+
+#include <libcamera/base/span.h>
 
 #include <libcamera/stream.h>
 
 #include "frame_sink.h"
 
+class EventLoop;
 class Image;
 
 class FileSink : public FrameSink
@@ -22,24 +31,56 @@ class FileSink : public FrameSink
 public:
 	FileSink(const libcamera::Camera *camera,
 		 const std::map<const libcamera::Stream *, std::string> &streamNames,
-		 const std::string &pattern = "");
+		 const std::string &pattern = "", bool directIO = false,
+		 bool compressDNG = false);
 	~FileSink();
 
 	int configure(const libcamera::CameraConfiguration &config) override;
 
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
+	int start() override;
+	int stop() override;
+
 	bool processRequest(libcamera::Request *request) override;
 
 private:
+	struct OutputFile {
+		int fd;
+		off_t offset;
+		off_t allocated;
+	};
+
+	void run();
+	void writeRequest(libcamera::Request *request);
 	void writeBuffer(const libcamera::Stream *stream,
 			 libcamera::FrameBuffer *buffer,
 			 const libcamera::ControlList &metadata);
+	OutputFile *openContainer(const std::string &filename);
+	void closeContainers();
+	int writeData(OutputFile *file, libcamera::Span<const uint8_t> data);
+	int writeDirect(OutputFile *file, libcamera::Span<const uint8_t> data,
+			size_t *filled);
+	int flushDirect(OutputFile *file, size_t filled);
 
 #ifdef HAVE_TIFF
 	const libcamera::Camera *camera_;
+	bool compressDNG_;
 #endif
 	std::map<const libcamera::Stream *, std::string> streamNames_;
 	std::string pattern_;
 	std::map<libcamera::FrameBuffer *, std::unique_ptr<Image>> mappedBuffers_;
+
+	bool directIO_;
+	std::unique_ptr<uint8_t, decltype(&free)> bounce_;
+	std::map<std::string, OutputFile> containers_;
+
+	EventLoop *loop_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::queue<libcamera::Request *> queue_;
+	bool stopping_;
+
+	std::shared_ptr<bool> token_;
 };
@@ -7,6 +7,8 @@
 
 #include "frame_sink.h"
 
+#include <libcamera/fence.h>
+
 /**
  * \class FrameSink
  * \brief Abstract class to model a consumer of frames
@@ -65,3 +67,23 @@ int FrameSink::stop()
  * \return True if the request has been processed synchronously, false if
  * processing has been queued
  */
+
+/**
+ * \fn FrameSink::releaseFence()
+ * \param[in] buffer The frame buffer
+ *
+ * A frame sink may release a request before it is done with its buffers, for
+ * instance when a display device provides a fence that signals when a buffer
+ * stops being scanned out, or when a GPU still reads the buffer. This function
+ * is called for every buffer of a request released by the sink, either
+ * synchronously from processRequest() or through the requestProcessed signal,
+ * to retrieve the fence the camera shall wait on before writing to the buffer.
+ *
+ * \return The release fence for the \a buffer, or nullptr if the buffer can be
+ * reused immediately
+ */
+std::unique_ptr<libcamera::Fence>
+FrameSink::releaseFence([[maybe_unused]] libcamera::FrameBuffer *buffer)
+{
+	return nullptr;
+}
@@ -7,10 +7,13 @@
 
 #pragma once
 
+#include <memory>
+
 #include <libcamera/base/signal.h>
 
 namespace libcamera {
 class CameraConfiguration;
+class Fence;
 class FrameBuffer;
 class Request;
 } /* namespace libcamera */
@@ -29,4 +32,6 @@ public:
 
 	virtual bool processRequest(libcamera::Request *request) = 0;
 	libcamera::Signal<libcamera::Request *> requestProcessed;
+
+	virtual std::unique_ptr<libcamera::Fence> releaseFence(libcamera::FrameBuffer *buffer);
 };
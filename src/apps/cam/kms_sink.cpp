@@ -15,6 +15,8 @@
 #include <memory>
 #include <stdint.h>
 #include <string.h>
+#include <tuple>
+#include <unistd.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/formats.h>
@@ -23,8 +25,54 @@
 
 #include "drm.h"
 
+namespace {
+
+/*
+ * Return the variant of a format with an alpha channel that ignores the alpha
+ * channel, or an invalid format if there's no such variant.
+ */
+libcamera::PixelFormat opaqueFormat(const libcamera::PixelFormat &format)
+{
+	switch (format) {
+	case libcamera::formats::ABGR8888:
+		return libcamera::formats::XBGR8888;
+	case libcamera::formats::ARGB8888:
+		return libcamera::formats::XRGB8888;
+	case libcamera::formats::BGRA8888:
+		return libcamera::formats::BGRX8888;
+	case libcamera::formats::RGBA8888:
+		return libcamera::formats::RGBX8888;
+	default:
+		return {};
+	}
+}
+
+/*
+ * Check if \a plane can display \a format, or its opaque variant, and return
+ * the format to use in \a selected.
+ */
+bool planeSupportsFormat(const DRM::Plane *plane,
+			 const libcamera::PixelFormat &format,
+			 libcamera::PixelFormat *selected)
+{
+	if (plane->supportsFormat(format)) {
+		*selected = format;
+		return true;
+	}
+
+	libcamera::PixelFormat xFormat = opaqueFormat(format);
+	if (xFormat.isValid() && plane->supportsFormat(xFormat)) {
+		*selected = xFormat;
+		return true;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
 KMSSink::KMSSink(const std::string &connectorName)
-	: connector_(nullptr), crtc_(nullptr), plane_(nullptr), mode_(nullptr)
+	: connector_(nullptr), crtc_(nullptr), mode_(nullptr), outFences_(false)
 {
 	int ret = dev_.init();
 	if (ret < 0)
@@ -66,50 +114,14 @@ KMSSink::KMSSink(const std::string &connectorName)
 	dev_.requestComplete.connect(this, &KMSSink::requestComplete);
 }
 
-void KMSSink::mapBuffer(libcamera::FrameBuffer *buffer)
-{
-	std::array<uint32_t, 4> strides = {};
-
-	/* \todo Should libcamera report per-plane strides ? */
-	unsigned int uvStrideMultiplier;
-
-	switch (format_) {
-	case libcamera::formats::NV24:
-	case libcamera::formats::NV42:
-		uvStrideMultiplier = 4;
-		break;
-	case libcamera::formats::YUV420:
-	case libcamera::formats::YVU420:
-	case libcamera::formats::YUV422:
-		uvStrideMultiplier = 1;
-		break;
-	default:
-		uvStrideMultiplier = 2;
-		break;
-	}
-
-	strides[0] = stride_;
-	for (unsigned int i = 1; i < buffer->planes().size(); ++i)
-		strides[i] = stride_ * uvStrideMultiplier / 2;
-
-	std::unique_ptr<DRM::FrameBuffer> drmBuffer =
-		dev_.createFrameBuffer(*buffer, format_, size_, strides);
-	if (!drmBuffer)
-		return;
-
-	buffers_.emplace(std::piecewise_construct,
-			 std::forward_as_tuple(buffer),
-			 std::forward_as_tuple(std::move(drmBuffer)));
-}
-
 int KMSSink::configure(const libcamera::CameraConfiguration &config)
 {
 	if (!connector_)
 		return -EINVAL;
 
 	crtc_ = nullptr;
-	plane_ = nullptr;
 	mode_ = nullptr;
+	outputs_.clear();
 
 	const libcamera::StreamConfiguration &cfg = config.at(0);
 
@@ -142,19 +154,60 @@ int KMSSink::configure(const libcamera::CameraConfiguration &config)
 		return -EINVAL;
 	}
 
-	int ret = configurePipeline(cfg.pixelFormat);
-	if (ret < 0)
-		return ret;
+	/*
+	 * Display the first stream on the primary plane, and the other streams
+	 * on overlay planes of the same CRTC, if available.
+	 */
+	for (unsigned int i = 0; i < config.size(); ++i) {
+		const libcamera::StreamConfiguration &streamCfg = config.at(i);
+		Output output{};
+
+		if (i == 0) {
+			int ret = configurePipeline(streamCfg.pixelFormat, &output);
+			if (ret < 0)
+				return ret;
+		} else {
+			output.plane = selectOverlay(streamCfg.pixelFormat,
+						     &output.format);
+			if (!output.plane) {
+				std::cerr
+					<< "No overlay plane for stream " << i
+					<< ", the stream will not be displayed"
+					<< std::endl;
+				continue;
+			}
+
+			std::cout
+				<< "Using KMS plane " << output.plane->id()
+				<< " for stream " << i << std::endl;
+		}
+
+		output.stream = streamCfg.stream();
+		output.size = streamCfg.size;
+		output.stride = streamCfg.stride;
+		configureColorSpace(&output, streamCfg);
+
+		outputs_.push_back(output);
+	}
+
+	/*
+	 * With out fences, the frames replaced on screen can be released as
+	 * soon as the next frame is committed, along with a fence that signals
+	 * when they stop being scanned out.
+	 */
+	outFences_ = crtc_->property("OUT_FENCE_PTR") != nullptr;
 
-	size_ = cfg.size;
-	stride_ = cfg.stride;
+	return 0;
+}
 
-	/* Configure color space. */
-	colorEncoding_ = std::nullopt;
-	colorRange_ = std::nullopt;
+void KMSSink::configureColorSpace(Output *output,
+				  const libcamera::StreamConfiguration &cfg)
+{
+	output->colorEncoding = std::nullopt;
+	output->colorRange = std::nullopt;
 
 	if (cfg.colorSpace->ycbcrEncoding == libcamera::ColorSpace::YcbcrEncoding::None)
-		return 0;
+		return;
 
 	/*
 	 * The encoding and range enums are defined in the kernel but not
@@ -171,8 +224,8 @@ int KMSSink::configure(const libcamera::CameraConfiguration &config)
 		DRM_COLOR_YCBCR_FULL_RANGE,
 	};
 
-	const DRM::Property *colorEncoding = plane_->property("COLOR_ENCODING");
-	const DRM::Property *colorRange = plane_->property("COLOR_RANGE");
+	const DRM::Property *colorEncoding = output->plane->property("COLOR_ENCODING");
+	const DRM::Property *colorRange = output->plane->property("COLOR_RANGE");
 
 	if (colorEncoding) {
 		drm_color_encoding encoding;
@@ -192,7 +245,7 @@ int KMSSink::configure(const libcamera::CameraConfiguration &config)
 
 		for (const auto &[id, name] : colorEncoding->enums()) {
 			if (id == encoding) {
-				colorEncoding_ = encoding;
+				output->colorEncoding = encoding;
 				break;
 			}
 		}
@@ -213,47 +266,25 @@ int KMSSink::configure(const libcamera::CameraConfiguration &config)
 
 		for (const auto &[id, name] : colorRange->enums()) {
 			if (id == range) {
-				colorRange_ = range;
+				output->colorRange = range;
 				break;
 			}
 		}
 	}
 
-	if (!colorEncoding_ || !colorRange_)
+	if (!output->colorEncoding || !output->colorRange)
 		std::cerr << "Color space " << cfg.colorSpace->toString()
 			  << " not supported by the display device."
 			  << " Colors may be wrong." << std::endl;
-
-	return 0;
 }
 
-int KMSSink::selectPipeline(const libcamera::PixelFormat &format)
+int KMSSink::selectPipeline(const libcamera::PixelFormat &format, Output *output)
 {
-	/*
-	 * If the requested format has an alpha channel, also consider the X
-	 * variant.
-	 */
-	libcamera::PixelFormat xFormat;
-
-	switch (format) {
-	case libcamera::formats::ABGR8888:
-		xFormat = libcamera::formats::XBGR8888;
-		break;
-	case libcamera::formats::ARGB8888:
-		xFormat = libcamera::formats::XRGB8888;
-		break;
-	case libcamera::formats::BGRA8888:
-		xFormat = libcamera::formats::BGRX8888;
-		break;
-	case libcamera::formats::RGBA8888:
-		xFormat = libcamera::formats::RGBX8888;
-		break;
-	}
-
 	/*
 	 * Find a CRTC and plane suitable for the request format and the
 	 * connector at the end of the pipeline. Restrict the search to primary
-	 * planes for now.
+	 * planes, other streams are displayed on overlay planes of the selected
+	 * CRTC.
 	 */
 	for (const DRM::Encoder *encoder : connector_->encoders()) {
 		for (const DRM::Crtc *crtc : encoder->possibleCrtcs()) {
@@ -261,17 +292,9 @@ int KMSSink::selectPipeline(const libcamera::PixelFormat &format)
 				if (plane->type() != DRM::Plane::TypePrimary)
 					continue;
 
-				if (plane->supportsFormat(format)) {
-					crtc_ = crtc;
-					plane_ = plane;
-					format_ = format;
-					return 0;
-				}
-
-				if (plane->supportsFormat(xFormat)) {
+				if (planeSupportsFormat(plane, format, &output->format)) {
 					crtc_ = crtc;
-					plane_ = plane;
-					format_ = xFormat;
+					output->plane = plane;
 					return 0;
 				}
 			}
@@ -281,9 +304,9 @@ int KMSSink::selectPipeline(const libcamera::PixelFormat &format)
 	return -EPIPE;
 }
 
-int KMSSink::configurePipeline(const libcamera::PixelFormat &format)
+int KMSSink::configurePipeline(const libcamera::PixelFormat &format, Output *output)
 {
-	const int ret = selectPipeline(format);
+	const int ret = selectPipeline(format, output);
 	if (ret) {
 		std::cerr
 			<< "Unable to find display pipeline for format "
@@ -293,7 +316,7 @@ int KMSSink::configurePipeline(const libcamera::PixelFormat &format)
 	}
 
 	std::cout
-		<< "Using KMS plane " << plane_->id() << ", CRTC " << crtc_->id()
+		<< "Using KMS plane " << output->plane->id() << ", CRTC " << crtc_->id()
 		<< ", connector " << connector_->name()
 		<< " (" << connector_->id() << "), mode " << mode_->hdisplay
 		<< "x" << mode_->vdisplay << "@" << mode_->vrefresh << std::endl;
@@ -301,6 +324,27 @@ int KMSSink::configurePipeline(const libcamera::PixelFormat &format)
 	return 0;
 }
 
+const DRM::Plane *KMSSink::selectOverlay(const libcamera::PixelFormat &format,
+					 libcamera::PixelFormat *selected)
+{
+	for (const DRM::Plane *plane : crtc_->planes()) {
+		if (plane->type() != DRM::Plane::TypeOverlay)
+			continue;
+
+		auto used = std::find_if(outputs_.begin(), outputs_.end(),
+					 [plane](const Output &output) {
+						 return output.plane == plane;
+					 });
+		if (used != outputs_.end())
+			continue;
+
+		if (planeSupportsFormat(plane, format, selected))
+			return plane;
+	}
+
+	return nullptr;
+}
+
 int KMSSink::start()
 {
 	int ret = FrameSink::start();
@@ -337,8 +381,11 @@ int KMSSink::stop()
 	request.addProperty(connector_, "CRTC_ID", 0);
 	request.addProperty(crtc_, "ACTIVE", 0);
 	request.addProperty(crtc_, "MODE_ID", 0);
-	request.addProperty(plane_, "CRTC_ID", 0);
-	request.addProperty(plane_, "FB_ID", 0);
+
+	for (const Output &output : outputs_) {
+		request.addProperty(output.plane, "CRTC_ID", 0);
+		request.addProperty(output.plane, "FB_ID", 0);
+	}
 
 	int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset);
 	if (ret < 0) {
@@ -352,14 +399,97 @@ int KMSSink::stop()
 	pending_.reset();
 	queued_.reset();
 	active_.reset();
+	releaseFences_.clear();
 	buffers_.clear();
 
 	return FrameSink::stop();
 }
 
-bool KMSSink::testModeSet(DRM::FrameBuffer *drmBuffer,
-			  const libcamera::Rectangle &src,
-			  const libcamera::Rectangle &dst)
+DRM::FrameBuffer *KMSSink::drmBuffer(const Output &output,
+				     libcamera::FrameBuffer *buffer)
+{
+	auto iter = buffers_.find(buffer);
+	if (iter != buffers_.end())
+		return iter->second.get();
+
+	/*
+	 * Create the DRM frame buffer the first time the camera buffer is
+	 * displayed, as the stream, and thus the format, of the buffer isn't
+	 * known when it is mapped.
+	 */
+	std::array<uint32_t, 4> strides = {};
+
+	/* \todo Should libcamera report per-plane strides ? */
+	unsigned int uvStrideMultiplier;
+
+	switch (output.format) {
+	case libcamera::formats::NV24:
+	case libcamera::formats::NV42:
+		uvStrideMultiplier = 4;
+		break;
+	case libcamera::formats::YUV420:
+	case libcamera::formats::YVU420:
+	case libcamera::formats::YUV422:
+		uvStrideMultiplier = 1;
+		break;
+	default:
+		uvStrideMultiplier = 2;
+		break;
+	}
+
+	strides[0] = output.stride;
+	for (unsigned int i = 1; i < buffer->planes().size(); ++i)
+		strides[i] = output.stride * uvStrideMultiplier / 2;
+
+	std::unique_ptr<DRM::FrameBuffer> drmBuffer =
+		dev_.createFrameBuffer(*buffer, output.format, output.size, strides);
+	if (!drmBuffer)
+		return nullptr;
+
+	DRM::FrameBuffer *fb = drmBuffer.get();
+	buffers_.emplace(buffer, std::move(drmBuffer));
+
+	return fb;
+}
+
+/*
+ * Return the DRM frame buffers to display for a camera request, in the order of
+ * the outputs. Outputs whose stream has no buffer in the request are set to
+ * nullptr.
+ */
+std::vector<DRM::FrameBuffer *> KMSSink::drmBuffers(libcamera::Request *camRequest)
+{
+	std::vector<DRM::FrameBuffer *> drmBuffers;
+
+	for (const Output &output : outputs_) {
+		libcamera::FrameBuffer *buffer = camRequest->findBuffer(output.stream);
+		drmBuffers.push_back(buffer ? drmBuffer(output, buffer) : nullptr);
+	}
+
+	return drmBuffers;
+}
+
+void KMSSink::addPlaneProperties(DRM::AtomicRequest *request, const Output &output,
+				 DRM::FrameBuffer *drmBuffer)
+{
+	request->addProperty(output.plane, "CRTC_ID", crtc_->id());
+	request->addProperty(output.plane, "FB_ID", drmBuffer->id());
+	request->addProperty(output.plane, "SRC_X", output.src.x << 16);
+	request->addProperty(output.plane, "SRC_Y", output.src.y << 16);
+	request->addProperty(output.plane, "SRC_W", output.src.width << 16);
+	request->addProperty(output.plane, "SRC_H", output.src.height << 16);
+	request->addProperty(output.plane, "CRTC_X", output.dst.x);
+	request->addProperty(output.plane, "CRTC_Y", output.dst.y);
+	request->addProperty(output.plane, "CRTC_W", output.dst.width);
+	request->addProperty(output.plane, "CRTC_H", output.dst.height);
+
+	if (output.colorEncoding)
+		request->addProperty(output.plane, "COLOR_ENCODING", *output.colorEncoding);
+	if (output.colorRange)
+		request->addProperty(output.plane, "COLOR_RANGE", *output.colorRange);
+}
+
+bool KMSSink::testModeSet(const std::vector<std::pair<const Output *, DRM::FrameBuffer *>> &planes)
 {
 	DRM::AtomicRequest drmRequest{ &dev_ };
 
@@ -368,169 +498,296 @@ bool KMSSink::testModeSet(DRM::FrameBuffer *drmBuffer,
 	drmRequest.addProperty(crtc_, "ACTIVE", 1);
 	drmRequest.addProperty(crtc_, "MODE_ID", mode_->toBlob(&dev_));
 
-	drmRequest.addProperty(plane_, "CRTC_ID", crtc_->id());
-	drmRequest.addProperty(plane_, "FB_ID", drmBuffer->id());
-	drmRequest.addProperty(plane_, "SRC_X", src.x << 16);
-	drmRequest.addProperty(plane_, "SRC_Y", src.y << 16);
-	drmRequest.addProperty(plane_, "SRC_W", src.width << 16);
-	drmRequest.addProperty(plane_, "SRC_H", src.height << 16);
-	drmRequest.addProperty(plane_, "CRTC_X", dst.x);
-	drmRequest.addProperty(plane_, "CRTC_Y", dst.y);
-	drmRequest.addProperty(plane_, "CRTC_W", dst.width);
-	drmRequest.addProperty(plane_, "CRTC_H", dst.height);
+	for (const auto &[output, drmBuffer] : planes)
+		addPlaneProperties(&drmRequest, *output, drmBuffer);
 
 	return !drmRequest.commit(DRM::AtomicRequest::FlagAllowModeset |
 				  DRM::AtomicRequest::FlagTestOnly);
 }
 
-bool KMSSink::setupComposition(DRM::FrameBuffer *drmBuffer)
+bool KMSSink::setupComposition(const std::vector<DRM::FrameBuffer *> &drmBuffers)
 {
+	if (!drmBuffers[0])
+		return false;
+
 	/*
-	 * Test composition options, from most to least desirable, to select the
-	 * best one.
+	 * Test composition options for the primary plane, from most to least
+	 * desirable, to select the best one.
 	 */
-	const libcamera::Rectangle framebuffer{ size_ };
+	Output &primary = outputs_[0];
+	const libcamera::Rectangle framebuffer{ primary.size };
 	const libcamera::Rectangle display{ 0, 0, mode_->hdisplay, mode_->vdisplay };
 
-	/* 1. Scale the frame buffer to full screen, preserving aspect ratio. */
-	libcamera::Rectangle src = framebuffer;
-	libcamera::Rectangle dst = display.size().boundedToAspectRatio(framebuffer.size())
-						 .centeredTo(display.center());
+	const std::array<std::tuple<const char *, libcamera::Rectangle, libcamera::Rectangle>, 4> options{ {
+		/* 1. Scale the frame buffer to full screen, preserving aspect ratio. */
+		{
+			"full-screen scaled output, square pixels",
+			framebuffer,
+			display.size().boundedToAspectRatio(framebuffer.size())
+				      .centeredTo(display.center()),
+		},
+		/*
+		 * 2. Scale the frame buffer to full screen, without preserving
+		 *    aspect ratio.
+		 */
+		{
+			"full-screen scaled output, non-square pixels",
+			framebuffer,
+			display,
+		},
+		/* 3. Center the frame buffer on the display. */
+		{
+			"centered output",
+			display.size().centeredTo(framebuffer.center()).boundedTo(framebuffer),
+			framebuffer.size().centeredTo(display.center()).boundedTo(display),
+		},
+		/* 4. Align the frame buffer on the top-left of the display. */
+		{
+			"top-left aligned output",
+			framebuffer.boundedTo(display),
+			display.boundedTo(framebuffer),
+		},
+	} };
+
+	std::vector<std::pair<const Output *, DRM::FrameBuffer *>> planes{
+		{ &primary, drmBuffers[0] }
+	};
+	bool found = false;
 
-	if (testModeSet(drmBuffer, src, dst)) {
-		std::cout << "KMS: full-screen scaled output, square pixels"
-			  << std::endl;
-		src_ = src;
-		dst_ = dst;
-		return true;
+	for (const auto &[name, src, dst] : options) {
+		primary.src = src;
+		primary.dst = dst;
+
+		if (testModeSet(planes)) {
+			std::cout << "KMS: " << name << std::endl;
+			found = true;
+			break;
+		}
 	}
 
+	if (!found)
+		return false;
+
 	/*
-	 * 2. Scale the frame buffer to full screen, without preserving aspect
-	 *    ratio.
+	 * Display the other streams in picture-in-picture windows along the
+	 * bottom edge of the display, from right to left, scaled to a quarter
+	 * of the display size. Fall back to unscaled windows if the plane can't
+	 * scale, and stop displaying the stream if neither option works.
 	 */
-	src = framebuffer;
-	dst = display;
-
-	if (testModeSet(drmBuffer, src, dst)) {
-		std::cout << "KMS: full-screen scaled output, non-square pixels"
-			  << std::endl;
-		src_ = src;
-		dst_ = dst;
-		return true;
+	const libcamera::Size tile = display.size() / 4;
+	std::vector<Output> outputs{ primary };
+	int x = display.width;
+
+	for (unsigned int i = 1; i < outputs_.size(); ++i) {
+		Output &output = outputs_[i];
+		const libcamera::Rectangle overlay{ output.size };
+		const libcamera::Size window = tile.boundedToAspectRatio(output.size);
+		bool placed = false;
+
+		if (drmBuffers[i] && x >= static_cast<int>(window.width)) {
+			const libcamera::Rectangle scaled{
+				x - static_cast<int>(window.width),
+				static_cast<int>(display.height - window.height),
+				window
+			};
+			const libcamera::Rectangle cropped =
+				window.centeredTo(overlay.center()).boundedTo(overlay);
+
+			output.src = overlay;
+			output.dst = scaled;
+			planes.emplace_back(&output, drmBuffers[i]);
+			placed = testModeSet(planes);
+
+			if (!placed) {
+				output.src = cropped;
+				output.dst = { scaled.x, scaled.y, cropped.size() };
+				placed = testModeSet(planes);
+			}
+
+			if (placed) {
+				x -= window.width;
+			} else {
+				planes.pop_back();
+			}
+		}
+
+		if (!placed) {
+			std::cerr
+				<< "KMS: unable to display stream on plane "
+				<< output.plane->id() << std::endl;
+			continue;
+		}
+
+		std::cout
+			<< "KMS: plane " << output.plane->id() << " at "
+			<< output.dst << std::endl;
+		outputs.push_back(output);
 	}
 
-	/* 3. Center the frame buffer on the display. */
-	src = display.size().centeredTo(framebuffer.center()).boundedTo(framebuffer);
-	dst = framebuffer.size().centeredTo(display.center()).boundedTo(display);
+	outputs_ = std::move(outputs);
 
-	if (testModeSet(drmBuffer, src, dst)) {
-		std::cout << "KMS: centered output" << std::endl;
-		src_ = src;
-		dst_ = dst;
-		return true;
+	return true;
+}
+
+/*
+ * Commit the atomic request of \a request, which becomes the queued request.
+ *
+ * When the CRTC supports out fences, the request being displayed is released
+ * right away, with a fence that signals when the new frame replaces it on the
+ * screen. This gives the camera its buffers back one frame earlier than
+ * waiting for the page flip. Released requests are added to \a released, for
+ * the caller to emit the requestProcessed signal without holding the lock.
+ */
+void KMSSink::commit(std::unique_ptr<Request> request, unsigned int flags,
+		     std::vector<libcamera::Request *> *released)
+{
+	int32_t outFence = -1;
+
+	if (outFences_ && active_)
+		request->drmRequest_->addProperty(crtc_, "OUT_FENCE_PTR",
+						  reinterpret_cast<uintptr_t>(&outFence));
+
+	int ret = request->drmRequest_->commit(flags);
+	if (ret < 0) {
+		std::cerr
+			<< "Failed to commit atomic request: "
+			<< strerror(-ret) << std::endl;
+		released->push_back(request->camRequest_);
+		return;
 	}
 
-	/* 4. Align the frame buffer on the top-left of the display. */
-	src = framebuffer.boundedTo(display);
-	dst = display.boundedTo(framebuffer);
+	queued_ = std::move(request);
 
-	if (testModeSet(drmBuffer, src, dst)) {
-		std::cout << "KMS: top-left aligned output" << std::endl;
-		src_ = src;
-		dst_ = dst;
-		return true;
+	if (outFence < 0)
+		return;
+
+	libcamera::UniqueFD fence(outFence);
+
+	for (const Output &output : outputs_) {
+		libcamera::FrameBuffer *buffer =
+			active_->camRequest_->findBuffer(output.stream);
+		if (buffer)
+			releaseFences_[buffer] = libcamera::UniqueFD(dup(fence.get()));
 	}
 
-	return false;
+	released->push_back(active_->camRequest_);
+	active_.reset();
 }
 
 bool KMSSink::processRequest(libcamera::Request *camRequest)
 {
-	/*
-	 * Perform a very crude rate adaptation by simply dropping the request
-	 * if the display queue is full.
-	 */
-	if (pending_)
-		return true;
-
-	libcamera::FrameBuffer *buffer = camRequest->buffers().begin()->second;
-	auto iter = buffers_.find(buffer);
-	if (iter == buffers_.end())
-		return true;
-
-	DRM::FrameBuffer *drmBuffer = iter->second.get();
+	std::vector<libcamera::Request *> released;
 
-	unsigned int flags = DRM::AtomicRequest::FlagAsync;
-	std::unique_ptr<DRM::AtomicRequest> drmRequest =
-		std::make_unique<DRM::AtomicRequest>(&dev_);
-	drmRequest->addProperty(plane_, "FB_ID", drmBuffer->id());
+	{
+		std::lock_guard<std::mutex> lock(lock_);
 
-	if (!active_ && !queued_) {
 		/* Enable the display pipeline on the first frame. */
-		if (!setupComposition(drmBuffer)) {
+		bool modeset = !active_ && !queued_;
+		if (modeset && !setupComposition(drmBuffers(camRequest))) {
 			std::cerr << "Failed to setup composition" << std::endl;
 			return true;
 		}
 
-		drmRequest->addProperty(connector_, "CRTC_ID", crtc_->id());
-
-		drmRequest->addProperty(crtc_, "ACTIVE", 1);
-		drmRequest->addProperty(crtc_, "MODE_ID", mode_->toBlob(&dev_));
+		std::vector<DRM::FrameBuffer *> buffers = drmBuffers(camRequest);
+		if (std::none_of(buffers.begin(), buffers.end(),
+				 [](DRM::FrameBuffer *fb) { return fb; }))
+			return true;
 
-		drmRequest->addProperty(plane_, "CRTC_ID", crtc_->id());
-		drmRequest->addProperty(plane_, "SRC_X", src_.x << 16);
-		drmRequest->addProperty(plane_, "SRC_Y", src_.y << 16);
-		drmRequest->addProperty(plane_, "SRC_W", src_.width << 16);
-		drmRequest->addProperty(plane_, "SRC_H", src_.height << 16);
-		drmRequest->addProperty(plane_, "CRTC_X", dst_.x);
-		drmRequest->addProperty(plane_, "CRTC_Y", dst_.y);
-		drmRequest->addProperty(plane_, "CRTC_W", dst_.width);
-		drmRequest->addProperty(plane_, "CRTC_H", dst_.height);
+		unsigned int flags = DRM::AtomicRequest::FlagAsync;
+		std::unique_ptr<DRM::AtomicRequest> drmRequest =
+			std::make_unique<DRM::AtomicRequest>(&dev_);
 
-		if (colorEncoding_)
-			drmRequest->addProperty(plane_, "COLOR_ENCODING", *colorEncoding_);
-		if (colorRange_)
-			drmRequest->addProperty(plane_, "COLOR_RANGE", *colorRange_);
+		if (modeset) {
+			drmRequest->addProperty(connector_, "CRTC_ID", crtc_->id());
 
-		flags |= DRM::AtomicRequest::FlagAllowModeset;
-	}
+			drmRequest->addProperty(crtc_, "ACTIVE", 1);
+			drmRequest->addProperty(crtc_, "MODE_ID", mode_->toBlob(&dev_));
 
-	pending_ = std::make_unique<Request>(std::move(drmRequest), camRequest);
+			flags |= DRM::AtomicRequest::FlagAllowModeset;
+		}
 
-	std::lock_guard<std::mutex> lock(lock_);
+		for (unsigned int i = 0; i < outputs_.size(); ++i) {
+			if (!buffers[i])
+				continue;
 
-	if (!queued_) {
-		int ret = pending_->drmRequest_->commit(flags);
-		if (ret < 0) {
-			std::cerr
-				<< "Failed to commit atomic request: "
-				<< strerror(-ret) << std::endl;
-			/* \todo Implement error handling */
+			if (modeset)
+				addPlaneProperties(drmRequest.get(), outputs_[i], buffers[i]);
+			else
+				drmRequest->addProperty(outputs_[i].plane, "FB_ID",
+							buffers[i]->id());
 		}
 
-		queued_ = std::move(pending_);
+		std::unique_ptr<Request> request =
+			std::make_unique<Request>(std::move(drmRequest), camRequest);
+
+		if (!queued_) {
+			commit(std::move(request), flags, &released);
+		} else {
+			/*
+			 * Keep the most recent frame ready to be committed as
+			 * soon as the queued frame is displayed, so that the
+			 * next vblank isn't missed. A frame waiting for the
+			 * display is replaced by the newer one and released.
+			 */
+			if (pending_)
+				released.push_back(pending_->camRequest_);
+
+			pending_ = std::move(request);
+		}
 	}
 
+	/*
+	 * Release requests without holding the lock, as the camera session
+	 * retrieves the release fences when requeuing them.
+	 */
+	for (libcamera::Request *request : released)
+		requestProcessed.emit(request);
+
 	return false;
 }
 
-void KMSSink::requestComplete([[maybe_unused]] DRM::AtomicRequest *request)
+std::unique_ptr<libcamera::Fence> KMSSink::releaseFence(libcamera::FrameBuffer *buffer)
 {
 	std::lock_guard<std::mutex> lock(lock_);
 
-	assert(queued_ && queued_->drmRequest_.get() == request);
+	auto iter = releaseFences_.find(buffer);
+	if (iter == releaseFences_.end())
+		return nullptr;
 
-	/* Complete the active request, if any. */
-	if (active_)
-		requestProcessed.emit(active_->camRequest_);
+	libcamera::UniqueFD fence = std::move(iter->second);
+	releaseFences_.erase(iter);
 
-	/* The queued request becomes active. */
-	active_ = std::move(queued_);
+	if (!fence.isValid())
+		return nullptr;
 
-	/* Queue the pending request, if any. */
-	if (pending_) {
-		pending_->drmRequest_->commit(DRM::AtomicRequest::FlagAsync);
-		queued_ = std::move(pending_);
+	return std::make_unique<libcamera::Fence>(std::move(fence));
+}
+
+void KMSSink::requestComplete([[maybe_unused]] DRM::AtomicRequest *request)
+{
+	std::vector<libcamera::Request *> released;
+
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+
+		assert(queued_ && queued_->drmRequest_.get() == request);
+
+		/*
+		 * Complete the active request, if any. With out fences, it has
+		 * been released already when the queued request was committed.
+		 */
+		if (active_)
+			released.push_back(active_->camRequest_);
+
+		/* The queued request becomes active. */
+		active_ = std::move(queued_);
+
+		/* Queue the pending request, if any. */
+		if (pending_)
+			commit(std::move(pending_), DRM::AtomicRequest::FlagAsync,
+			       &released);
 	}
+
+	for (libcamera::Request *camRequest : released)
+		requestProcessed.emit(camRequest);
 }
@@ -8,16 +8,21 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/unique_fd.h>
 
+#include <libcamera/fence.h>
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
 
 #include "drm.h"
 #include "frame_sink.h"
@@ -27,13 +32,12 @@ class KMSSink : public FrameSink
 public:
 	KMSSink(const std::string &connectorName);
 
-	void mapBuffer(libcamera::FrameBuffer *buffer) override;
-
 	int configure(const libcamera::CameraConfiguration &config) override;
 	int start() override;
 	int stop() override;
 
 	bool processRequest(libcamera::Request *request) override;
+	std::unique_ptr<libcamera::Fence> releaseFence(libcamera::FrameBuffer *buffer) override;
 
 private:
 	class Request
@@ -49,32 +53,51 @@ private:
 		libcamera::Request *camRequest_;
 	};
 
-	int selectPipeline(const libcamera::PixelFormat &format);
-	int configurePipeline(const libcamera::PixelFormat &format);
-	bool testModeSet(DRM::FrameBuffer *drmBuffer,
-			 const libcamera::Rectangle &src,
-			 const libcamera::Rectangle &dst);
-	bool setupComposition(DRM::FrameBuffer *drmBuffer);
+	/* A camera stream displayed on a KMS plane */
+	struct Output {
+		const libcamera::Stream *stream;
+		const DRM::Plane *plane;
+
+		libcamera::PixelFormat format;
+		libcamera::Size size;
+		unsigned int stride;
+		std::optional<unsigned int> colorEncoding;
+		std::optional<unsigned int> colorRange;
 
+		libcamera::Rectangle src;
+		libcamera::Rectangle dst;
+	};
+
+	int selectPipeline(const libcamera::PixelFormat &format, Output *output);
+	int configurePipeline(const libcamera::PixelFormat &format, Output *output);
+	const DRM::Plane *selectOverlay(const libcamera::PixelFormat &format,
+					libcamera::PixelFormat *selected);
+	void configureColorSpace(Output *output,
+				 const libcamera::StreamConfiguration &cfg);
+
+	DRM::FrameBuffer *drmBuffer(const Output &output,
+				    libcamera::FrameBuffer *buffer);
+	std::vector<DRM::FrameBuffer *> drmBuffers(libcamera::Request *camRequest);
+	void addPlaneProperties(DRM::AtomicRequest *request, const Output &output,
+				DRM::FrameBuffer *drmBuffer);
+	bool testModeSet(const std::vector<std::pair<const Output *, DRM::FrameBuffer *>> &planes);
+	bool setupComposition(const std::vector<DRM::FrameBuffer *> &drmBuffers);
+
+	void commit(std::unique_ptr<Request> request, unsigned int flags,
+		    std::vector<libcamera::Request *> *released);
 	void requestComplete(DRM::AtomicRequest *request);
 
 	DRM::Device dev_;
 
 	const DRM::Connector *connector_;
 	const DRM::Crtc *crtc_;
-	const DRM::Plane *plane_;
 	const DRM::Mode *mode_;
 
-	libcamera::PixelFormat format_;
-	libcamera::Size size_;
-	unsigned int stride_;
-	std::optional<unsigned int> colorEncoding_;
-	std::optional<unsigned int> colorRange_;
-
-	libcamera::Rectangle src_;
-	libcamera::Rectangle dst_;
+	std::vector<Output> outputs_;
+	bool outFences_;
 
 	std::map<libcamera::FrameBuffer *, std::unique_ptr<DRM::FrameBuffer>> buffers_;
+	std::map<libcamera::FrameBuffer *, libcamera::UniqueFD> releaseFences_;
 
 	std::mutex lock_;
 	std::unique_ptr<Request> pending_;
@@ -6,10 +6,15 @@
  */
 
 #include <atomic>
+#include <chrono>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <signal.h>
 #include <string.h>
+#include <thread>
 
 #include <libcamera/libcamera.h>
 #include <libcamera/property_ids.h>
@@ -37,12 +42,30 @@ public:
 	void quit();
 
 private:
+	/*
+	 * A worker thread running a camera session with its own event loop.
+	 * The loop pointer is protected by the mutex, and is reset before the
+	 * loop is destroyed.
+	 */
+	struct SessionWorker {
+		std::thread thread;
+		std::mutex mutex;
+		EventLoop *loop = nullptr;
+		int result = 0;
+	};
+
 	void cameraAdded(std::shared_ptr<Camera> cam);
 	void cameraRemoved(std::shared_ptr<Camera> cam);
 	void captureDone();
 	int parseOptions(int argc, char *argv[]);
 	int run();
 
+	int startWorker(CameraSession *session);
+	int stopWorkers();
+	void runWorker(CameraSession *session, SessionWorker *worker,
+		       std::promise<int> started);
+	void reportSessions(const std::vector<std::unique_ptr<CameraSession>> &sessions);
+
 	static std::string cameraName(const Camera *camera);
 
 	static CamApp *app_;
@@ -52,6 +75,8 @@ private:
 
 	std::atomic_uint loopUsers_;
 	EventLoop loop_;
+
+	std::list<SessionWorker> workers_;
 };
 
 CamApp *CamApp::app_ = nullptr;
@@ -127,6 +152,12 @@ int CamApp::parseOptions(int argc, char *argv[])
 	parser.addOption(OptMonitor, OptionNone,
 			 "Monitor for hotplug and unplug camera events",
 			 "monitor");
+	parser.addOption(OptThreads, OptionNone,
+			 "Run the capture session of each camera in a dedicated thread, to\n"
+			 "process the completed requests of all cameras concurrently, and\n"
+			 "print a summary of the throughput and latency of all cameras when\n"
+			 "the capture stops",
+			 "threads");
 
 	/* Sub-options of OptCamera: */
 	parser.addOption(OptCapture, OptionInteger,
@@ -159,6 +190,16 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename", false,
 			 OptCamera);
+	parser.addOption(OptDirectIO, OptionNone,
+			 "Write raw frames to disk with direct I/O, bypassing the page cache\n"
+			 "When all frames are written to a single file, each frame is padded\n"
+			 "to a multiple of 4096 bytes.",
+			 "direct-io", ArgumentNone, nullptr, false, OptCamera);
+#ifdef HAVE_TIFF
+	parser.addOption(OptDNGCompression, OptionNone,
+			 "Compress the raw data of DNG files with lossless JPEG",
+			 "dng-compress", ArgumentNone, nullptr, false, OptCamera);
+#endif
 #ifdef HAVE_SDL
 	parser.addOption(OptSDL, OptionNone, "Display viewfinder through SDL",
 			 "sdl", ArgumentNone, "", false, OptCamera);
@@ -174,6 +215,14 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "Print the metadata for completed requests",
 			 "metadata", ArgumentNone, nullptr, false,
 			 OptCamera);
+	parser.addOption(OptBenchmark, OptionString,
+			 "Measure the capture latencies and print a summary when the capture\n"
+			 "stops. Frames are not passed to any sink, and no per-frame\n"
+			 "information is printed. If a file name is given, the summary is\n"
+			 "also written to the file in JSON format. The first '#' character\n"
+			 "in the file name is expanded to the camera index.",
+			 "benchmark", ArgumentOptional, "filename", false,
+			 OptCamera);
 	parser.addOption(OptCaptureScript, OptionString,
 			 "Load a capture session configuration script from a file",
 			 "script", ArgumentRequired, "script", false,
@@ -242,7 +291,19 @@ int CamApp::run()
 			std::cout << "Using camera " << session->camera()->id()
 				  << " as cam" << index << std::endl;
 
-			session->captureDone.connect(this, &CamApp::captureDone);
+#ifdef HAVE_SDL
+			/* SDL must be used from the main thread only. */
+			if (options_.isSet(OptThreads) &&
+			    session->options().isSet(OptSDL)) {
+				std::cout << "--sdl and --threads options are mutually exclusive"
+					  << std::endl;
+				return -EINVAL;
+			}
+#endif
+
+			/* Worker threads handle the capture completion themselves. */
+			if (!options_.isSet(OptThreads))
+				session->captureDone.connect(this, &CamApp::captureDone);
 
 			sessions.push_back(std::move(session));
 			index++;
@@ -268,9 +329,13 @@ int CamApp::run()
 		if (!session->options().isSet(OptCapture))
 			continue;
 
-		ret = session->start();
+		if (options_.isSet(OptThreads))
+			ret = startWorker(session.get());
+		else
+			ret = session->start();
 		if (ret) {
 			std::cout << "Failed to start camera session" << std::endl;
+			stopWorkers();
 			return ret;
 		}
 
@@ -291,15 +356,161 @@ int CamApp::run()
 	if (loopUsers_)
 		loop_.exec();
 
-	/* 6. Stop capture. */
+	/*
+	 * 6. Stop capture. Report a failure if any capture script assertion
+	 * failed.
+	 */
+	if (options_.isSet(OptThreads)) {
+		ret = stopWorkers();
+		reportSessions(sessions);
+		return ret;
+	}
+
+	ret = 0;
+
 	for (const auto &session : sessions) {
 		if (!session->options().isSet(OptCapture))
 			continue;
 
-		session->stop();
+		if (session->stop())
+			ret = -EINVAL;
 	}
 
-	return 0;
+	return ret;
+}
+
+/*
+ * Start a camera session in a worker thread and wait for the session to start.
+ * The completed requests of the session are then processed by the event loop
+ * of the worker thread, and only the request requeuing goes through the
+ * camera manager.
+ */
+int CamApp::startWorker(CameraSession *session)
+{
+	SessionWorker &worker = workers_.emplace_back();
+
+	std::promise<int> started;
+	std::future<int> result = started.get_future();
+
+	worker.thread = std::thread(&CamApp::runWorker, this, session, &worker,
+				    std::move(started));
+
+	return result.get();
+}
+
+/*
+ * Stop all worker threads, and return an error if any capture script assertion
+ * failed.
+ */
+int CamApp::stopWorkers()
+{
+	int ret = 0;
+
+	for (SessionWorker &worker : workers_) {
+		{
+			std::unique_lock<std::mutex> locker(worker.mutex);
+
+			/*
+			 * Exit the loop with a deferred call, as exiting an event
+			 * loop that isn't running yet has no effect.
+			 */
+			EventLoop *loop = worker.loop;
+			if (loop)
+				loop->callLater([loop]() { loop->exit(0); });
+		}
+
+		worker.thread.join();
+
+		if (worker.result)
+			ret = -EINVAL;
+	}
+
+	workers_.clear();
+
+	return ret;
+}
+
+void CamApp::runWorker(CameraSession *session, SessionWorker *worker,
+		       std::promise<int> started)
+{
+	EventLoop loop;
+
+	{
+		std::unique_lock<std::mutex> locker(worker->mutex);
+		worker->loop = &loop;
+	}
+
+	session->captureDone.connect(&loop, [&loop]() { loop.exit(0); });
+
+	int ret = session->start();
+	started.set_value(ret);
+
+	if (!ret) {
+		loop.exec();
+		worker->result = session->stop();
+	}
+
+	session->captureDone.disconnect(&loop);
+
+	{
+		std::unique_lock<std::mutex> locker(worker->mutex);
+		worker->loop = nullptr;
+	}
+
+	if (!ret)
+		loop_.callLater([this]() { captureDone(); });
+}
+
+void CamApp::reportSessions(const std::vector<std::unique_ptr<CameraSession>> &sessions)
+{
+	const double kPercentiles[] = { 50.0, 99.0 };
+
+	Histogram totalLatency;
+	unsigned int totalFrames = 0;
+	double totalFps = 0.0;
+
+	std::cout << "Capture summary, latency from request completion to processing in us"
+		  << std::endl;
+
+	std::cout << "  " << std::left << std::setw(8) << "camera" << std::right
+		  << std::setw(10) << "frames" << std::setw(10) << "time (s)"
+		  << std::setw(10) << "fps";
+	for (double percent : kPercentiles)
+		std::cout << std::setw(10) << "p" + std::to_string(static_cast<int>(percent));
+	std::cout << std::setw(10) << "max" << std::endl;
+
+	auto printRow = [&](const std::string &name, unsigned int frames,
+			    double seconds, double fps, const Histogram &latency) {
+		std::cout << "  " << std::left << std::setw(8) << name << std::right
+			  << std::setw(10) << frames
+			  << std::fixed << std::setprecision(2)
+			  << std::setw(10) << seconds << std::setw(10) << fps
+			  << std::defaultfloat;
+		for (double percent : kPercentiles)
+			std::cout << std::setw(10) << latency.percentile(percent);
+		std::cout << std::setw(10) << latency.max() << std::endl;
+	};
+
+	double totalTime = 0.0;
+
+	for (unsigned int index = 0; index < sessions.size(); ++index) {
+		CameraSession *session = sessions[index].get();
+		if (!session->options().isSet(OptCapture))
+			continue;
+
+		double seconds = std::chrono::duration<double>(session->captureTime()).count();
+		double fps = seconds > 0.0 ? session->captureCount() / seconds : 0.0;
+
+		printRow("cam" + std::to_string(index), session->captureCount(),
+			 seconds, fps, session->processLatency());
+
+		totalLatency.merge(session->processLatency());
+		totalFrames += session->captureCount();
+		totalFps += fps;
+		totalTime = std::max(totalTime, seconds);
+	}
+
+	printRow("total", totalFrames, totalTime, totalFps, totalLatency);
 }
 
 std::string CamApp::cameraName(const Camera *camera)
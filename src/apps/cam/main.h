@@ -24,4 +24,8 @@ enum {
 	OptStrictFormats = 257,
 	OptMetadata = 258,
 	OptCaptureScript = 259,
+	OptDirectIO = 260,
+	OptDNGCompression = 261,
+	OptBenchmark = 262,
+	OptThreads = 263,
 };
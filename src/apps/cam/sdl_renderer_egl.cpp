@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * SDL EGL Renderer
+ */
+
+#include "sdl_renderer_egl.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+const char *kVertexShader = R"(
+attribute vec2 position;
+varying vec2 texCoord;
+
+void main()
+{
+	texCoord = vec2(position.x + 1.0, 1.0 - position.y) * 0.5;
+	gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+/*
+ * External textures are sampled as RGB, the conversion from YUV is performed
+ * by the GPU according to the color space hints of the EGL image.
+ */
+const char *kFragmentShader = R"(
+#extension GL_OES_EGL_image_external : require
+precision mediump float;
+
+uniform samplerExternalOES tex;
+varying vec2 texCoord;
+
+void main()
+{
+	gl_FragColor = texture2D(tex, texCoord);
+}
+)";
+
+const GLfloat kVertices[] = {
+	-1.0f, -1.0f,
+	1.0f, -1.0f,
+	-1.0f, 1.0f,
+	1.0f, 1.0f,
+};
+
+bool hasExtension(const char *extensions, const char *name)
+{
+	if (!extensions)
+		return false;
+
+	std::istringstream stream(extensions);
+	std::string extension;
+	while (stream >> extension) {
+		if (extension == name)
+			return true;
+	}
+
+	return false;
+}
+
+GLuint compileShader(GLenum type, const char *source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		std::cerr << "Failed to compile shader: " << log << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+} /* namespace */
+
+/*
+ * Render frames by importing the camera dmabufs as EGL images and sampling
+ * them directly in a GL ES 2.0 context created on the SDL window. This avoids
+ * mapping the frames and uploading them to the GPU, which at high resolutions
+ * costs more than the frame interval.
+ */
+SDLRendererEGL::SDLRendererEGL(const StreamConfiguration &cfg)
+	: format_(cfg.pixelFormat), size_(cfg.size), stride_(cfg.stride),
+	  colorSpace_(cfg.colorSpace), window_(nullptr), context_(nullptr),
+	  display_(EGL_NO_DISPLAY), nativeFences_(false),
+	  eglCreateImageKHR_(nullptr), eglDestroyImageKHR_(nullptr),
+	  glEGLImageTargetTexture2DOES_(nullptr), eglCreateSyncKHR_(nullptr),
+	  eglDestroySyncKHR_(nullptr), eglDupNativeFenceFDANDROID_(nullptr),
+	  program_(0), positionAttrib_(-1)
+{
+}
+
+SDLRendererEGL::~SDLRendererEGL()
+{
+	if (!context_)
+		return;
+
+	SDL_GL_MakeCurrent(window_, context_);
+
+	for (const auto &[buffer, texture] : textures_) {
+		glDeleteTextures(1, &texture.id);
+		eglDestroyImageKHR_(display_, texture.image);
+	}
+
+	if (program_)
+		glDeleteProgram(program_);
+
+	SDL_GL_DeleteContext(context_);
+}
+
+/*
+ * The formats supported by the SDL textures, for which the chroma stride can
+ * be derived from the luma stride.
+ */
+bool SDLRendererEGL::supportsFormat(const PixelFormat &format)
+{
+	return format == formats::NV12 || format == formats::YUYV;
+}
+
+/*
+ * Request an OpenGL ES 2.0 context, and force the X11 video driver to use EGL
+ * instead of GLX. This must be called before creating the window.
+ */
+void SDLRendererEGL::setAttributes()
+{
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+
+#ifdef SDL_HINT_VIDEO_X11_FORCE_EGL
+	SDL_SetHint(SDL_HINT_VIDEO_X11_FORCE_EGL, "1");
+#endif
+}
+
+int SDLRendererEGL::init(SDL_Window *window)
+{
+	window_ = window;
+
+	context_ = SDL_GL_CreateContext(window_);
+	if (!context_) {
+		std::cerr << "Failed to create GL context: " << SDL_GetError()
+			  << std::endl;
+		return -ENOTSUP;
+	}
+
+	/* The dmabuf import requires SDL to use EGL. */
+	display_ = eglGetCurrentDisplay();
+	if (display_ == EGL_NO_DISPLAY)
+		return -ENOTSUP;
+
+	const char *extensions = eglQueryString(display_, EGL_EXTENSIONS);
+	const char *glExtensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+
+	if (!hasExtension(extensions, "EGL_EXT_image_dma_buf_import") ||
+	    !hasExtension(glExtensions, "GL_OES_EGL_image_external"))
+		return -ENOTSUP;
+
+	eglCreateImageKHR_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+		eglGetProcAddress("eglCreateImageKHR"));
+	eglDestroyImageKHR_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+		eglGetProcAddress("eglDestroyImageKHR"));
+	glEGLImageTargetTexture2DOES_ = reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+		eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+	if (!eglCreateImageKHR_ || !eglDestroyImageKHR_ ||
+	    !glEGLImageTargetTexture2DOES_)
+		return -ENOTSUP;
+
+	/*
+	 * Native fences let the camera wait for the GPU to finish reading the
+	 * frame. Without them, rendering is synchronous.
+	 */
+	if (hasExtension(extensions, "EGL_ANDROID_native_fence_sync")) {
+		eglCreateSyncKHR_ = reinterpret_cast<PFNEGLCREATESYNCKHRPROC>(
+			eglGetProcAddress("eglCreateSyncKHR"));
+		eglDestroySyncKHR_ = reinterpret_cast<PFNEGLDESTROYSYNCKHRPROC>(
+			eglGetProcAddress("eglDestroySyncKHR"));
+		eglDupNativeFenceFDANDROID_ = reinterpret_cast<PFNEGLDUPNATIVEFENCEFDANDROIDPROC>(
+			eglGetProcAddress("eglDupNativeFenceFDANDROID"));
+		nativeFences_ = eglCreateSyncKHR_ && eglDestroySyncKHR_ &&
+				eglDupNativeFenceFDANDROID_;
+	}
+
+	int ret = createProgram();
+	if (ret < 0)
+		return ret;
+
+	/* Don't wait for vblank, the camera paces the frames. */
+	SDL_GL_SetSwapInterval(0);
+
+	std::cout << "SDL: rendering with EGL dmabuf import"
+		  << (nativeFences_ ? ", native fences" : "") << std::endl;
+
+	return 0;
+}
+
+int SDLRendererEGL::createProgram()
+{
+	GLuint vertexShader = compileShader(GL_VERTEX_SHADER, kVertexShader);
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, kFragmentShader);
+	if (!vertexShader || !fragmentShader) {
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+		return -EINVAL;
+	}
+
+	program_ = glCreateProgram();
+	glAttachShader(program_, vertexShader);
+	glAttachShader(program_, fragmentShader);
+	glLinkProgram(program_);
+
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	GLint status;
+	glGetProgramiv(program_, GL_LINK_STATUS, &status);
+	if (!status) {
+		std::cerr << "Failed to link shader program" << std::endl;
+		return -EINVAL;
+	}
+
+	glUseProgram(program_);
+	glUniform1i(glGetUniformLocation(program_, "tex"), 0);
+
+	positionAttrib_ = glGetAttribLocation(program_, "position");
+	glVertexAttribPointer(positionAttrib_, 2, GL_FLOAT, GL_FALSE, 0, kVertices);
+	glEnableVertexAttribArray(positionAttrib_);
+
+	return 0;
+}
+
+EGLImageKHR SDLRendererEGL::importBuffer(const FrameBuffer *buffer)
+{
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+
+	std::vector<EGLint> attribs = {
+		EGL_WIDTH, static_cast<EGLint>(size_.width),
+		EGL_HEIGHT, static_cast<EGLint>(size_.height),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(format_.fourcc()),
+		EGL_DMA_BUF_PLANE0_FD_EXT, planes[0].fd.get(),
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(planes[0].offset),
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(stride_),
+	};
+
+	/*
+	 * The chroma plane of NV12 has the same stride as the luma plane, and
+	 * directly follows it when the buffer has a single plane.
+	 */
+	if (format_ == formats::NV12) {
+		const FrameBuffer::Plane &plane = planes.size() > 1 ? planes[1] : planes[0];
+		unsigned int offset = planes.size() > 1 ? plane.offset
+				    : plane.offset + stride_ * size_.height;
+
+		attribs.insert(attribs.end(), {
+			EGL_DMA_BUF_PLANE1_FD_EXT, plane.fd.get(),
+			EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(offset),
+			EGL_DMA_BUF_PLANE1_PITCH_EXT, static_cast<EGLint>(stride_),
+		});
+	}
+
+	if (colorSpace_) {
+		EGLint encoding;
+		switch (colorSpace_->ycbcrEncoding) {
+		case ColorSpace::YcbcrEncoding::Rec601:
+		default:
+			encoding = EGL_ITU_REC601_EXT;
+			break;
+		case ColorSpace::YcbcrEncoding::Rec709:
+			encoding = EGL_ITU_REC709_EXT;
+			break;
+		case ColorSpace::YcbcrEncoding::Rec2020:
+			encoding = EGL_ITU_REC2020_EXT;
+			break;
+		}
+
+		EGLint range = colorSpace_->range == ColorSpace::Range::Full
+			     ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
+
+		attribs.insert(attribs.end(), {
+			EGL_YUV_COLOR_SPACE_HINT_EXT, encoding,
+			EGL_SAMPLE_RANGE_HINT_EXT, range,
+		});
+	}
+
+	attribs.push_back(EGL_NONE);
+
+	return eglCreateImageKHR_(display_, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+				  nullptr, attribs.data());
+}
+
+/*
+ * Return the texture bound to the EGL image of a frame buffer, importing it the
+ * first time the buffer is rendered. The camera reuses a small set of buffers,
+ * the textures are kept until the renderer is destroyed.
+ */
+const SDLRendererEGL::Texture *SDLRendererEGL::texture(const FrameBuffer *buffer)
+{
+	auto iter = textures_.find(buffer);
+	if (iter != textures_.end())
+		return &iter->second;
+
+	EGLImageKHR image = importBuffer(buffer);
+	if (image == EGL_NO_IMAGE_KHR) {
+		std::cerr << "Failed to import dmabuf: " << eglGetError()
+			  << std::endl;
+		return nullptr;
+	}
+
+	GLuint id;
+	glGenTextures(1, &id);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, id);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glEGLImageTargetTexture2DOES_(GL_TEXTURE_EXTERNAL_OES, image);
+
+	if (glGetError() != GL_NO_ERROR) {
+		glDeleteTextures(1, &id);
+		eglDestroyImageKHR_(display_, image);
+		return nullptr;
+	}
+
+	return &textures_.emplace(buffer, Texture{ image, id }).first->second;
+}
+
+UniqueFD SDLRendererEGL::createFence()
+{
+	const EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+		EGL_NONE
+	};
+
+	EGLSyncKHR sync = eglCreateSyncKHR_(display_, EGL_SYNC_NATIVE_FENCE_ANDROID,
+					    attribs);
+	if (sync == EGL_NO_SYNC_KHR)
+		return {};
+
+	/* The native fence is created when the commands are flushed. */
+	glFlush();
+
+	UniqueFD fence(eglDupNativeFenceFDANDROID_(display_, sync));
+	eglDestroySyncKHR_(display_, sync);
+
+	return fence;
+}
+
+/*
+ * Render \a buffer to the window. The GPU reads the buffer asynchronously, the
+ * \a fence signals when the buffer can be reused. If no fence can be created,
+ * wait for rendering to complete and leave \a fence invalid.
+ */
+int SDLRendererEGL::render(FrameBuffer *buffer, UniqueFD *fence)
+{
+	if (SDL_GL_MakeCurrent(window_, context_))
+		return -EIO;
+
+	const Texture *tex = texture(buffer);
+	if (!tex)
+		return -EINVAL;
+
+	/* Letterbox the frame to preserve the aspect ratio. */
+	int width, height;
+	SDL_GL_GetDrawableSize(window_, &width, &height);
+
+	const Rectangle drawable{ 0, 0, static_cast<unsigned int>(width),
+				  static_cast<unsigned int>(height) };
+	const Rectangle viewport = drawable.size().boundedToAspectRatio(size_)
+					   .centeredTo(drawable.center());
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glViewport(viewport.x, viewport.y, viewport.width, viewport.height);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, tex->id);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	if (nativeFences_)
+		*fence = createFence();
+
+	if (!fence->isValid())
+		glFinish();
+
+	SDL_GL_SwapWindow(window_);
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * SDL EGL Renderer
+ */
+
+#pragma once
+
+#include <map>
+#include <optional>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <SDL2/SDL.h>
+
+#include <libcamera/base/unique_fd.h>
+
+#include <libcamera/color_space.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+class SDLRendererEGL
+{
+public:
+	SDLRendererEGL(const libcamera::StreamConfiguration &cfg);
+	~SDLRendererEGL();
+
+	static bool supportsFormat(const libcamera::PixelFormat &format);
+	static void setAttributes();
+
+	int init(SDL_Window *window);
+	int render(libcamera::FrameBuffer *buffer, libcamera::UniqueFD *fence);
+
+private:
+	struct Texture {
+		EGLImageKHR image;
+		GLuint id;
+	};
+
+	int createProgram();
+	EGLImageKHR importBuffer(const libcamera::FrameBuffer *buffer);
+	const Texture *texture(const libcamera::FrameBuffer *buffer);
+	libcamera::UniqueFD createFence();
+
+	const libcamera::PixelFormat format_;
+	const libcamera::Size size_;
+	const unsigned int stride_;
+	const std::optional<libcamera::ColorSpace> colorSpace_;
+
+	SDL_Window *window_;
+	SDL_GLContext context_;
+	EGLDisplay display_;
+	bool nativeFences_;
+
+	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_;
+	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES_;
+	PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR_;
+	PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR_;
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID_;
+
+	GLuint program_;
+	GLint positionAttrib_;
+
+	std::map<const libcamera::FrameBuffer *, Texture> textures_;
+};
@@ -17,11 +17,15 @@
 #include <unistd.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/fence.h>
 #include <libcamera/formats.h>
 
 #include "../common/event_loop.h"
 #include "../common/image.h"
 
+#ifdef HAVE_SDL_EGL
+#include "sdl_renderer_egl.h"
+#endif
 #ifdef HAVE_LIBJPEG
 #include "sdl_texture_mjpg.h"
 #endif
@@ -32,8 +36,9 @@ using namespace libcamera;
 using namespace std::chrono_literals;
 
 SDLSink::SDLSink()
-	: window_(nullptr), renderer_(nullptr), rect_({}),
-	  init_(false)
+	: busy_(false), stopping_(false), token_(std::make_shared<bool>(true)),
+	  pending_(nullptr), window_(nullptr),
+	  renderer_(nullptr), rect_({}), init_(false)
 {
 }
 
@@ -82,6 +87,11 @@ int SDLSink::configure(const libcamera::CameraConfiguration &config)
 		return -EINVAL;
 	};
 
+#ifdef HAVE_SDL_EGL
+	if (SDLRendererEGL::supportsFormat(cfg.pixelFormat))
+		egl_ = std::make_unique<SDLRendererEGL>(cfg);
+#endif
+
 	return 0;
 }
 
@@ -95,35 +105,57 @@ int SDLSink::start()
 	}
 
 	init_ = true;
+
+	Uint32 flags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE;
+#ifdef HAVE_SDL_EGL
+	if (egl_) {
+		SDLRendererEGL::setAttributes();
+		flags |= SDL_WINDOW_OPENGL;
+	}
+#endif
+
 	window_ = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED,
 				   SDL_WINDOWPOS_UNDEFINED, rect_.w,
-				   rect_.h,
-				   SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+				   rect_.h, flags);
 	if (!window_) {
 		std::cerr << "Failed to create SDL window: " << SDL_GetError()
 			  << std::endl;
 		return -EINVAL;
 	}
 
-	renderer_ = SDL_CreateRenderer(window_, -1, 0);
-	if (!renderer_) {
-		std::cerr << "Failed to create SDL renderer: " << SDL_GetError()
-			  << std::endl;
-		return -EINVAL;
+	/*
+	 * Render frames with EGL when possible, and fall back to uploading
+	 * them to an SDL texture otherwise.
+	 */
+	bool upload = true;
+
+#ifdef HAVE_SDL_EGL
+	if (egl_) {
+		ret = egl_->init(window_);
+		if (ret < 0) {
+			std::cerr << "EGL dmabuf import not available, "
+				  << "uploading frames instead" << std::endl;
+			egl_.reset();
+		} else {
+			upload = false;
+		}
+	}
+#endif
+
+	if (upload) {
+		ret = createRenderer();
+		if (ret)
+			return ret;
 	}
 
 	/*
-	 * Set for scaling purposes, not critical, don't return in case of
-	 * error.
+	 * Prepare frames in a worker thread, to avoid blocking the event loop
+	 * while decoding.
 	 */
-	ret = SDL_RenderSetLogicalSize(renderer_, rect_.w, rect_.h);
-	if (ret)
-		std::cerr << "Failed to set SDL render logical size: "
-			  << SDL_GetError() << std::endl;
-
-	ret = texture_->create(renderer_);
-	if (ret) {
-		return ret;
+	if (texture_->needsPrepare()) {
+		stopping_ = false;
+		busy_ = false;
+		thread_ = std::thread(&SDLSink::run, this);
 	}
 
 	/* \todo Make the event cancellable to support stop/start cycles. */
@@ -135,6 +167,24 @@ int SDLSink::start()
 
 int SDLSink::stop()
 {
+	if (thread_.joinable()) {
+		{
+			std::unique_lock<std::mutex> locker(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_one();
+
+		thread_.join();
+	}
+
+	/* Drop the frames prepared by the worker and not displayed yet. */
+	token_ = std::make_shared<bool>(true);
+	pending_ = nullptr;
+
+#ifdef HAVE_SDL_EGL
+	egl_.reset();
+	releaseFences_.clear();
+#endif
 	texture_.reset();
 
 	if (renderer_) {
@@ -164,14 +214,135 @@ void SDLSink::mapBuffer(FrameBuffer *buffer)
 	mappedBuffers_[buffer] = std::move(image);
 }
 
+int SDLSink::createRenderer()
+{
+	renderer_ = SDL_CreateRenderer(window_, -1, 0);
+	if (!renderer_) {
+		std::cerr << "Failed to create SDL renderer: " << SDL_GetError()
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	/*
+	 * Set for scaling purposes, not critical, don't return in case of
+	 * error.
+	 */
+	int ret = SDL_RenderSetLogicalSize(renderer_, rect_.w, rect_.h);
+	if (ret)
+		std::cerr << "Failed to set SDL render logical size: "
+			  << SDL_GetError() << std::endl;
+
+	return texture_->create(renderer_);
+}
+
 bool SDLSink::processRequest(Request *request)
 {
-	for (auto [stream, buffer] : request->buffers()) {
-		renderBuffer(buffer);
-		break; /* to be expanded to launch SDL window per buffer */
+	/*
+	 * Only render the latest frame. Frames completed while the previous
+	 * one is waiting to be rendered or prepared supersede it, and the
+	 * superseded request is released immediately to the camera, keeping
+	 * the preview latency bounded when rendering can't keep up.
+	 */
+	Request *superseded;
+	bool schedule;
+
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		superseded = pending_;
+		pending_ = request;
+		schedule = !superseded && !thread_.joinable();
+	}
+
+	if (thread_.joinable())
+		cv_.notify_one();
+
+	/* \todo Launch an SDL window per buffer */
+	if (schedule) {
+		std::weak_ptr<bool> token = token_;
+		EventLoop::instance()->callLater([this, token]() {
+			if (token.expired())
+				return;
+
+			Request *req;
+			{
+				std::unique_lock<std::mutex> locker(mutex_);
+				req = pending_;
+				pending_ = nullptr;
+			}
+
+			renderBuffer(req->buffers().begin()->second);
+			requestProcessed.emit(req);
+		});
 	}
 
-	return true;
+	if (superseded)
+		requestProcessed.emit(superseded);
+
+	return false;
+}
+
+std::unique_ptr<Fence> SDLSink::releaseFence([[maybe_unused]] FrameBuffer *buffer)
+{
+#ifdef HAVE_SDL_EGL
+	auto iter = releaseFences_.find(buffer);
+	if (iter == releaseFences_.end())
+		return nullptr;
+
+	UniqueFD fence = std::move(iter->second);
+	releaseFences_.erase(iter);
+
+	return std::make_unique<Fence>(std::move(fence));
+#else
+	return nullptr;
+#endif
+}
+
+void SDLSink::run()
+{
+	while (true) {
+		Request *request;
+
+		{
+			std::unique_lock<std::mutex> locker(mutex_);
+			cv_.wait(locker, [&] {
+				return stopping_ || (pending_ && !busy_);
+			});
+			if (stopping_)
+				return;
+
+			request = pending_;
+			pending_ = nullptr;
+			busy_ = true;
+		}
+
+		FrameBuffer *buffer = request->buffers().begin()->second;
+		texture_->prepare(planes(buffer));
+
+		/*
+		 * Upload and display the frame from the event loop, as SDL
+		 * rendering isn't thread-safe. The frame is dropped if the sink
+		 * has been stopped in the meantime. The next frame is prepared
+		 * once this one has been displayed, as the texture holds a
+		 * single prepared frame.
+		 */
+		std::weak_ptr<bool> token = token_;
+		EventLoop::instance()->callLater([this, token, request]() {
+			if (token.expired())
+				return;
+
+			FrameBuffer *fb = request->buffers().begin()->second;
+			texture_->update(planes(fb));
+			present();
+
+			{
+				std::unique_lock<std::mutex> locker(mutex_);
+				busy_ = false;
+			}
+			cv_.notify_one();
+
+			requestProcessed.emit(request);
+		});
+	}
 }
 
 /*
@@ -187,9 +358,9 @@ void SDLSink::processSDLEvents()
 	}
 }
 
-void SDLSink::renderBuffer(FrameBuffer *buffer)
+std::vector<Span<const uint8_t>> SDLSink::planes(FrameBuffer *buffer)
 {
-	Image *image = mappedBuffers_[buffer].get();
+	Image *image = mappedBuffers_.at(buffer).get();
 
 	std::vector<Span<const uint8_t>> planes;
 	unsigned int i = 0;
@@ -207,8 +378,39 @@ void SDLSink::renderBuffer(FrameBuffer *buffer)
 		i++;
 	}
 
-	texture_->update(planes);
+	return planes;
+}
+
+void SDLSink::renderBuffer(FrameBuffer *buffer)
+{
+#ifdef HAVE_SDL_EGL
+	if (egl_) {
+		UniqueFD fence;
+		int ret = egl_->render(buffer, &fence);
+		if (!ret) {
+			if (fence.isValid())
+				releaseFences_[buffer] = std::move(fence);
+			return;
+		}
+
+		std::cerr << "Failed to render frame with EGL, "
+			  << "uploading frames instead" << std::endl;
+		egl_.reset();
+
+		if (createRenderer() < 0)
+			return;
+	}
+#endif
+
+	if (!renderer_)
+		return;
 
+	texture_->update(planes(buffer));
+	present();
+}
+
+void SDLSink::present()
+{
 	SDL_RenderClear(renderer_);
 	SDL_RenderCopy(renderer_, texture_->get(), nullptr, nullptr);
 	SDL_RenderPresent(renderer_);
@@ -7,8 +7,15 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/span.h>
+#include <libcamera/base/unique_fd.h>
 
 #include <libcamera/stream.h>
 
@@ -17,6 +24,7 @@
 #include "frame_sink.h"
 
 class Image;
+class SDLRendererEGL;
 class SDLTexture;
 
 class SDLSink : public FrameSink
@@ -31,15 +39,35 @@ public:
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
 	bool processRequest(libcamera::Request *request) override;
+	std::unique_ptr<libcamera::Fence> releaseFence(libcamera::FrameBuffer *buffer) override;
 
 private:
+	int createRenderer();
+	std::vector<libcamera::Span<const uint8_t>> planes(libcamera::FrameBuffer *buffer);
 	void renderBuffer(libcamera::FrameBuffer *buffer);
+	void present();
 	void processSDLEvents();
+	void run();
 
 	std::map<libcamera::FrameBuffer *, std::unique_ptr<Image>>
 		mappedBuffers_;
 
 	std::unique_ptr<SDLTexture> texture_;
+#ifdef HAVE_SDL_EGL
+	std::unique_ptr<SDLRendererEGL> egl_;
+	std::map<libcamera::FrameBuffer *, libcamera::UniqueFD> releaseFences_;
+#endif
+
+	/* Worker thread preparing frames, for textures that need it */
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool busy_;
+	bool stopping_;
+	std::shared_ptr<bool> token_;
+
+	/* Latest completed request, waiting to be prepared or rendered */
+	libcamera::Request *pending_;
 
 	SDL_Window *window_;
 	SDL_Renderer *renderer_;
@@ -34,3 +34,14 @@ int SDLTexture::create(SDL_Renderer *renderer)
 
 	return 0;
 }
+
+/*
+ * Textures that need to process frames on the CPU before uploading them, such
+ * as decoding compressed frames, do so in prepare(). The function is called
+ * from a worker thread when needsPrepare() returns true, and must not use the
+ * SDL renderer. The following update() call uploads the prepared frame.
+ */
+int SDLTexture::prepare([[maybe_unused]] const std::vector<libcamera::Span<const uint8_t>> &data)
+{
+	return 0;
+}
@@ -19,6 +19,8 @@ public:
 	SDLTexture(const SDL_Rect &rect, uint32_t pixelFormat, const int stride);
 	virtual ~SDLTexture();
 	int create(SDL_Renderer *renderer);
+	virtual bool needsPrepare() const { return false; }
+	virtual int prepare(const std::vector<libcamera::Span<const uint8_t>> &data);
 	virtual void update(const std::vector<libcamera::Span<const uint8_t>> &data) = 0;
 	SDL_Texture *get() const { return ptr_; }
 
@@ -76,8 +76,12 @@ int SDLTextureMJPG::decompress(Span<const uint8_t> data)
 	return 0;
 }
 
-void SDLTextureMJPG::update(const std::vector<libcamera::Span<const uint8_t>> &data)
+int SDLTextureMJPG::prepare(const std::vector<libcamera::Span<const uint8_t>> &data)
+{
+	return decompress(data[0]);
+}
+
+void SDLTextureMJPG::update([[maybe_unused]] const std::vector<libcamera::Span<const uint8_t>> &data)
 {
-	decompress(data[0]);
 	SDL_UpdateTexture(ptr_, nullptr, rgb_.get(), stride_);
 }
@@ -14,6 +14,8 @@ class SDLTextureMJPG : public SDLTexture
 public:
 	SDLTextureMJPG(const SDL_Rect &rect);
 
+	bool needsPrepare() const override { return true; }
+	int prepare(const std::vector<libcamera::Span<const uint8_t>> &data) override;
 	void update(const std::vector<libcamera::Span<const uint8_t>> &data) override;
 
 private:
@@ -8,8 +8,15 @@
 #include "dng_writer.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
 
 #include <tiffio.h>
 
@@ -282,6 +289,357 @@ void thumbScanlineIPU3([[maybe_unused]] const FormatInfo &info, void *output,
 	}
 }
 
+/*
+ * Lossless JPEG (ITU-T T.81 process 14, also known as LJ92) encoding of raw
+ * tiles, as used by most DNG writers.
+ */
+namespace {
+
+/*
+ * Compressed raw images are stored in tiles, which are encoded independently
+ * and can thus be compressed in parallel. The TIFF specification requires the
+ * tile dimensions to be multiples of 16.
+ */
+constexpr unsigned int kTileSize = 256;
+
+/* Number of rows packed by every worker task. */
+constexpr unsigned int kPackBandHeight = 64;
+
+constexpr unsigned int kMaxWorkers = 8;
+
+constexpr uint8_t kMarkerSOF3 = 0xc3;
+constexpr uint8_t kMarkerDHT = 0xc4;
+constexpr uint8_t kMarkerSOI = 0xd8;
+constexpr uint8_t kMarkerEOI = 0xd9;
+constexpr uint8_t kMarkerSOS = 0xda;
+
+/* Difference categories range from 0 to 16. */
+constexpr unsigned int kNumCategories = 17;
+
+/* Run \a func for all indices in [0, count[ on a pool of threads. */
+void parallelFor(unsigned int count, const std::function<void(unsigned int)> &func)
+{
+	unsigned int numWorkers = std::clamp(std::thread::hardware_concurrency(),
+					     1U, kMaxWorkers);
+	numWorkers = std::min(numWorkers, count);
+
+	std::atomic<unsigned int> next = 0;
+	auto worker = [&]() {
+		for (unsigned int i = next++; i < count; i = next++)
+			func(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numWorkers; i++)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+/*
+ * Extract the samples of a scanline packed by a FormatInfo::packScanline
+ * function. Samples smaller than 16 bits are packed MSB first without padding,
+ * 16-bit samples are stored in native byte order.
+ */
+void unpackScanline(const FormatInfo &info, uint16_t *output,
+		    const uint8_t *input, unsigned int width)
+{
+	if (info.bitsPerSample == 16) {
+		memcpy(output, input, width * sizeof(*output));
+		return;
+	}
+
+	const unsigned int bits = info.bitsPerSample;
+	const uint32_t mask = (1U << bits) - 1;
+	uint32_t value = 0;
+	unsigned int available = 0;
+
+	for (unsigned int x = 0; x < width; x++) {
+		while (available < bits) {
+			value = value << 8 | *input++;
+			available += 8;
+		}
+
+		available -= bits;
+		output[x] = (value >> available) & mask;
+	}
+}
+
+struct HuffmanTable {
+	/* Number of codes of each length, from 1 to 16 bits */
+	std::array<uint8_t, 16> bits;
+	/* Symbols, sorted by code length */
+	std::vector<uint8_t> values;
+
+	std::array<uint16_t, kNumCategories> codes;
+	std::array<uint8_t, kNumCategories> sizes;
+};
+
+/*
+ * Build an optimal Huffman table for the difference category frequencies
+ * \a counts, limited to code lengths of 16 bits, following the procedure of
+ * T.81 annex K.2. An extra symbol with the lowest frequency reserves the code
+ * made of all 1 bits, which is not allowed.
+ */
+HuffmanTable buildHuffmanTable(const std::array<uint32_t, kNumCategories> &counts)
+{
+	constexpr unsigned int kNumSymbols = kNumCategories + 1;
+
+	std::array<uint64_t, kNumSymbols> freq{};
+	std::array<unsigned int, kNumSymbols> codeSize{};
+	std::array<int, kNumSymbols> others;
+
+	std::copy(counts.begin(), counts.end(), freq.begin());
+	freq[kNumCategories] = 1;
+	others.fill(-1);
+
+	while (true) {
+		/* Find the two least frequent symbols, favouring the last one. */
+		int c1 = -1;
+		int c2 = -1;
+
+		for (unsigned int i = 0; i < kNumSymbols; i++) {
+			if (freq[i] && (c1 < 0 || freq[i] <= freq[c1]))
+				c1 = i;
+		}
+
+		for (unsigned int i = 0; i < kNumSymbols; i++) {
+			if (freq[i] && static_cast<int>(i) != c1 &&
+			    (c2 < 0 || freq[i] <= freq[c2]))
+				c2 = i;
+		}
+
+		if (c2 < 0)
+			break;
+
+		freq[c1] += freq[c2];
+		freq[c2] = 0;
+
+		codeSize[c1]++;
+		while (others[c1] >= 0) {
+			c1 = others[c1];
+			codeSize[c1]++;
+		}
+
+		others[c1] = c2;
+
+		codeSize[c2]++;
+		while (others[c2] >= 0) {
+			c2 = others[c2];
+			codeSize[c2]++;
+		}
+	}
+
+	/* Count the codes of each length, and limit them to 16 bits. */
+	std::array<unsigned int, kNumSymbols + 1> bits{};
+	for (unsigned int size : codeSize) {
+		if (size)
+			bits[size]++;
+	}
+
+	for (unsigned int i = kNumSymbols; i > 16; i--) {
+		while (bits[i]) {
+			unsigned int j = i - 2;
+			while (!bits[j])
+				j--;
+
+			bits[i] -= 2;
+			bits[i - 1]++;
+			bits[j + 1] += 2;
+			bits[j]--;
+		}
+	}
+
+	/* Drop the reserved symbol, which has the longest code. */
+	unsigned int longest = 16;
+	while (!bits[longest])
+		longest--;
+	bits[longest]--;
+
+	HuffmanTable table{};
+
+	for (unsigned int size = 1; size <= kNumSymbols; size++) {
+		for (unsigned int symbol = 0; symbol < kNumCategories; symbol++) {
+			if (codeSize[symbol] == size)
+				table.values.push_back(symbol);
+		}
+	}
+
+	/* Assign the codes in order of increasing length, see T.81 annex C. */
+	unsigned int code = 0;
+	unsigned int k = 0;
+
+	for (unsigned int size = 1; size <= 16; size++) {
+		table.bits[size - 1] = bits[size];
+
+		for (unsigned int i = 0; i < bits[size]; i++, k++) {
+			table.codes[table.values[k]] = code++;
+			table.sizes[table.values[k]] = size;
+		}
+
+		code <<= 1;
+	}
+
+	return table;
+}
+
+class BitWriter
+{
+public:
+	BitWriter(std::vector<uint8_t> *output)
+		: output_(output), value_(0), count_(0)
+	{
+	}
+
+	/* Write the \a count least significant bits of \a bits, up to 16. */
+	void write(uint32_t bits, unsigned int count)
+	{
+		value_ = (value_ << count) | (bits & ((1U << count) - 1));
+		count_ += count;
+
+		while (count_ >= 8) {
+			count_ -= 8;
+
+			uint8_t byte = value_ >> count_;
+			output_->push_back(byte);
+
+			/* Stuff a zero byte after 0xff in the entropy-coded data. */
+			if (byte == 0xff)
+				output_->push_back(0);
+		}
+
+		value_ &= (1U << count_) - 1;
+	}
+
+	/* Pad the last byte with 1 bits. */
+	void flush()
+	{
+		if (count_)
+			write(0xff, 8 - count_);
+	}
+
+private:
+	std::vector<uint8_t> *output_;
+	uint32_t value_;
+	unsigned int count_;
+};
+
+void writeMarker(std::vector<uint8_t> *output, uint8_t marker)
+{
+	output->push_back(0xff);
+	output->push_back(marker);
+}
+
+void writeWord(std::vector<uint8_t> *output, uint16_t value)
+{
+	output->push_back(value >> 8);
+	output->push_back(value & 0xff);
+}
+
+/*
+ * Encode a \a width x \a height tile of \a precision bits samples with
+ * predictor 1. As customary for DNG files, the CFA data is encoded as an
+ * image of half the width with two interleaved components, so that samples
+ * are predicted from the previous sample of the same colour.
+ */
+std::vector<uint8_t> encodeLosslessJpeg(const uint16_t *samples, unsigned int width,
+					unsigned int height, unsigned int precision)
+{
+	auto forEachDifference = [&](auto func) {
+		for (unsigned int y = 0; y < height; y++) {
+			const uint16_t *line = samples + y * width;
+
+			for (unsigned int x = 0; x < width; x++) {
+				int prediction;
+
+				/*
+				 * The first sample of each component is predicted
+				 * from the sample above it, or from the middle of
+				 * the range on the first line.
+				 */
+				if (x >= 2)
+					prediction = line[x - 2];
+				else if (y > 0)
+					prediction = samples[(y - 1) * width + x];
+				else
+					prediction = 1 << (precision - 1);
+
+				/* Differences are computed modulo 2^16. */
+				int diff = static_cast<int16_t>(line[x] - prediction);
+				unsigned int category = diff ? 32 - __builtin_clz(std::abs(diff)) : 0;
+
+				func(diff, category);
+			}
+		}
+	};
+
+	std::array<uint32_t, kNumCategories> counts{};
+	forEachDifference([&](int, unsigned int category) {
+		counts[category]++;
+	});
+
+	const HuffmanTable table = buildHuffmanTable(counts);
+
+	std::vector<uint8_t> output;
+	output.reserve(width * height * precision / 8 / 2);
+
+	writeMarker(&output, kMarkerSOI);
+
+	/* Frame header, two components without subsampling. */
+	writeMarker(&output, kMarkerSOF3);
+	writeWord(&output, 8 + 3 * 2);
+	output.push_back(precision);
+	writeWord(&output, height);
+	writeWord(&output, width / 2);
+	output.push_back(2);
+	for (uint8_t component = 1; component <= 2; component++) {
+		output.push_back(component);
+		output.push_back(0x11);
+		output.push_back(0);
+	}
+
+	/* Huffman table, shared by both components. */
+	writeMarker(&output, kMarkerDHT);
+	writeWord(&output, 2 + 1 + 16 + table.values.size());
+	output.push_back(0);
+	output.insert(output.end(), table.bits.begin(), table.bits.end());
+	output.insert(output.end(), table.values.begin(), table.values.end());
+
+	/* Scan header, with predictor 1 and no point transform. */
+	writeMarker(&output, kMarkerSOS);
+	writeWord(&output, 6 + 2 * 2);
+	output.push_back(2);
+	for (uint8_t component = 1; component <= 2; component++) {
+		output.push_back(component);
+		output.push_back(0);
+	}
+	output.push_back(1);
+	output.push_back(0);
+	output.push_back(0);
+
+	BitWriter writer(&output);
+	forEachDifference([&](int diff, unsigned int category) {
+		writer.write(table.codes[category], table.sizes[category]);
+
+		/*
+		 * Negative differences are stored as the one's complement of
+		 * their magnitude. Category 16 has no additional bits.
+		 */
+		if (category && category < 16)
+			writer.write(diff < 0 ? diff - 1 : diff, category);
+	});
+	writer.flush();
+
+	writeMarker(&output, kMarkerEOI);
+
+	return output;
+}
+
+} /* namespace */
+
 static const std::map<PixelFormat, FormatInfo> formatInfo = {
 	{ formats::SBGGR8, {
 		.bitsPerSample = 8,
@@ -385,7 +743,7 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 		     const StreamConfiguration &config,
 		     const ControlList &metadata,
 		     [[maybe_unused]] const FrameBuffer *buffer,
-		     const void *data)
+		     const void *data, Compression compression)
 {
 	const ControlList &cameraProperties = camera->properties();
 
@@ -396,18 +754,20 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	}
 	const FormatInfo *info = &it->second;
 
+	/* Lossless JPEG encodes the CFA as two interleaved components. */
+	if (compression == Compression::LosslessJPEG && config.size.width % 2) {
+		std::cerr << "Lossless JPEG requires an even width" << std::endl;
+		return -EINVAL;
+	}
+
 	TIFF *tif = TIFFOpen(filename, "w");
 	if (!tif) {
 		std::cerr << "Failed to open tiff file" << std::endl;
 		return -EINVAL;
 	}
 
-	/*
-	 * Scanline buffer, has to be large enough to store both a RAW scanline
-	 * or a thumbnail scanline. The latter will always be much smaller than
-	 * the former as we downscale by 16 in both directions.
-	 */
-	uint8_t scanline[(config.size.width * info->bitsPerSample + 7) / 8];
+	/* Thumbnail scanline buffer, downscaled by 16 in both directions. */
+	uint8_t scanline[config.size.width / 16 * 3];
 
 	toff_t rawIFDOffset = 0;
 	toff_t exifIFDOffset = 0;
@@ -590,19 +950,85 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	TIFFSetField(tif, TIFFTAG_BLACKLEVEL, 4, &blackLevel);
 	TIFFSetField(tif, TIFFTAG_WHITELEVEL, 1, &whiteLevel);
 
-	/* Write RAW content. */
-	row = static_cast<const uint8_t *>(data);
-	for (unsigned int y = 0; y < config.size.height; y++) {
-		info->packScanline(&scanline, row, config.size.width);
+	if (compression == Compression::LosslessJPEG) {
+		TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
+		TIFFSetField(tif, TIFFTAG_TILEWIDTH, kTileSize);
+		TIFFSetField(tif, TIFFTAG_TILELENGTH, kTileSize);
+	} else {
+		TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, config.size.height);
+	}
 
-		if (TIFFWriteScanline(tif, &scanline, y, 0) != 1) {
-			std::cerr << "Failed to write RAW scanline"
-				  << std::endl;
+	/*
+	 * Pack the RAW content in memory first, spreading the work across all
+	 * CPUs, and write it with a single call for uncompressed images.
+	 */
+	const unsigned int rawStride = (config.size.width * info->bitsPerSample + 7) / 8;
+	std::vector<uint8_t> raw(rawStride * config.size.height);
+	const unsigned int numBands = (config.size.height + kPackBandHeight - 1)
+				    / kPackBandHeight;
+
+	parallelFor(numBands, [&](unsigned int band) {
+		unsigned int start = band * kPackBandHeight;
+		unsigned int end = std::min(start + kPackBandHeight, config.size.height);
+
+		for (unsigned int y = start; y < end; y++)
+			info->packScanline(&raw[y * rawStride],
+					   static_cast<const uint8_t *>(data) + y * config.stride,
+					   config.size.width);
+	});
+
+	if (compression == Compression::LosslessJPEG) {
+		const unsigned int tilesAcross = (config.size.width + kTileSize - 1) / kTileSize;
+		const unsigned int tilesDown = (config.size.height + kTileSize - 1) / kTileSize;
+		std::vector<std::vector<uint8_t>> tiles(tilesAcross * tilesDown);
+
+		parallelFor(tiles.size(), [&](unsigned int index) {
+			unsigned int x0 = index % tilesAcross * kTileSize;
+			unsigned int y0 = index / tilesAcross * kTileSize;
+			unsigned int width = std::min(kTileSize, config.size.width - x0);
+			unsigned int height = std::min(kTileSize, config.size.height - y0);
+
+			/*
+			 * Tiles extending past the image are padded by repeating
+			 * the last CFA columns and rows, which compresses best.
+			 * The tile size is a multiple of 8 pixels, tiles thus
+			 * start on a byte boundary in the packed data.
+			 */
+			const unsigned int offset = x0 * info->bitsPerSample / 8;
+			std::vector<uint16_t> samples(kTileSize * kTileSize);
+
+			for (unsigned int y = 0; y < kTileSize; y++) {
+				uint16_t *dst = &samples[y * kTileSize];
+
+				if (y >= height) {
+					std::copy_n(dst - 2 * kTileSize, kTileSize, dst);
+					continue;
+				}
+
+				unpackScanline(*info, dst, &raw[(y0 + y) * rawStride + offset],
+					       width);
+
+				for (unsigned int x = width; x < kTileSize; x++)
+					dst[x] = dst[x - 2];
+			}
+
+			tiles[index] = encodeLosslessJpeg(samples.data(), kTileSize,
+							  kTileSize, info->bitsPerSample);
+		});
+
+		for (unsigned int i = 0; i < tiles.size(); i++) {
+			if (TIFFWriteRawTile(tif, i, tiles[i].data(), tiles[i].size()) < 0) {
+				std::cerr << "Failed to write RAW tile" << std::endl;
+				TIFFClose(tif);
+				return -EINVAL;
+			}
+		}
+	} else {
+		if (TIFFWriteRawStrip(tif, 0, raw.data(), raw.size()) < 0) {
+			std::cerr << "Failed to write RAW data" << std::endl;
 			TIFFClose(tif);
 			return -EINVAL;
 		}
-
-		row += config.stride;
 	}
 
 	/* Checkpoint the IFD to retrieve its offset, and write it out. */
@@ -18,10 +18,16 @@
 class DNGWriter
 {
 public:
+	enum class Compression {
+		None,
+		LosslessJPEG,
+	};
+
 	static int write(const char *filename, const libcamera::Camera *camera,
 			 const libcamera::StreamConfiguration &config,
 			 const libcamera::ControlList &metadata,
-			 const libcamera::FrameBuffer *buffer, const void *data);
+			 const libcamera::FrameBuffer *buffer, const void *data,
+			 Compression compression = Compression::None);
 };
 
 #endif /* HAVE_TIFF */
@@ -12,29 +12,44 @@
 #include <event2/thread.h>
 #include <iostream>
 
+/*
+ * Each thread can run its own event loop. The first event loop, created by the
+ * main thread before any other, is the main loop. It is returned by instance()
+ * in threads that don't run an event loop.
+ */
 EventLoop *EventLoop::instance_ = nullptr;
+thread_local EventLoop *EventLoop::current_ = nullptr;
+std::atomic_uint EventLoop::count_ = 0;
 
 EventLoop::EventLoop()
 {
-	assert(!instance_);
+	assert(!current_);
+
+	if (count_++ == 0)
+		evthread_use_pthreads();
 
-	evthread_use_pthreads();
 	base_ = event_base_new();
-	instance_ = this;
+	current_ = this;
+	if (!instance_)
+		instance_ = this;
 }
 
 EventLoop::~EventLoop()
 {
-	instance_ = nullptr;
+	if (instance_ == this)
+		instance_ = nullptr;
+	current_ = nullptr;
 
 	events_.clear();
 	event_base_free(base_);
-	libevent_global_shutdown();
+
+	if (--count_ == 0)
+		libevent_global_shutdown();
 }
 
 EventLoop *EventLoop::instance()
 {
-	return instance_;
+	return current_ ? current_ : instance_;
 }
 
 int EventLoop::exec()
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <list>
@@ -54,6 +55,8 @@ private:
 	};
 
 	static EventLoop *instance_;
+	static thread_local EventLoop *current_;
+	static std::atomic_uint count_;
 
 	struct event_base *base_;
 	int exitCode_;
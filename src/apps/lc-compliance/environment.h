@@ -9,19 +9,48 @@
 
 #include <libcamera/libcamera.h>
 
+/*
+ * Limits for the performance tests, which can be tuned for each platform
+ * from the command line.
+ */
+struct PerformanceThresholds {
+	/* Number of frames captured by each test */
+	unsigned int frames = 120;
+	/* Maximum deviation from the requested frame rate, in percent */
+	unsigned int frameRateTolerance = 5;
+	/* Maximum standard deviation of the frame interval, in microseconds */
+	unsigned int jitter = 1000;
+	/* Maximum duration of Camera::start() and Camera::stop(), in milliseconds */
+	unsigned int startLatency = 1000;
+	unsigned int stopLatency = 1000;
+	/* Maximum 99th percentile of the request latency, in milliseconds */
+	unsigned int requestLatency = 1000;
+	/* Maximum number of frames dropped during a test */
+	unsigned int droppedFrames = 0;
+	/* Duration of the stress tests, in seconds */
+	unsigned int stressDuration = 60;
+	/* Maximum CPU usage of the stress tests in percent of one CPU, 0 to disable */
+	unsigned int cpuUsage = 0;
+	/* Maximum growth of the resident memory in the stress tests, in kilobytes */
+	unsigned int memoryGrowth = 4096;
+};
+
 class Environment
 {
 public:
 	static Environment *get();
 
 	void setup(libcamera::CameraManager *cm, std::string cameraId);
+	void setPerformanceThresholds(const PerformanceThresholds &thresholds);
 
 	const std::string &cameraId() const { return cameraId_; }
 	libcamera::CameraManager *cm() const { return cm_; }
+	const PerformanceThresholds &performanceThresholds() const { return thresholds_; }
 
 private:
 	Environment() = default;
 
 	std::string cameraId_;
 	libcamera::CameraManager *cm_;
+	PerformanceThresholds thresholds_;
 };
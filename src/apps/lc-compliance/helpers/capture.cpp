@@ -7,12 +7,15 @@
 
 #include "capture.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include <gtest/gtest.h>
 
 using namespace libcamera;
 
 Capture::Capture(std::shared_ptr<Camera> camera)
-	: loop_(nullptr), camera_(camera),
+	: loop_(nullptr), startLatency_{}, stopLatency_{}, camera_(camera),
 	  allocator_(std::make_unique<FrameBufferAllocator>(camera))
 {
 }
@@ -42,17 +45,41 @@ void Capture::configure(StreamRole role)
 	}
 }
 
+/*
+ * Configure the camera with multiple streams. Unlike the single stream
+ * version, the configuration may be adjusted, and the test is skipped if the
+ * combination of roles isn't supported.
+ */
+void Capture::configure(Span<const StreamRole> roles)
+{
+	config_ = camera_->generateConfiguration(roles);
+
+	if (!config_ || config_->validate() == CameraConfiguration::Invalid) {
+		config_.reset();
+		std::cout << "Roles combination not supported by camera" << std::endl;
+		GTEST_SKIP();
+	}
+
+	if (camera_->configure(config_.get())) {
+		config_.reset();
+		FAIL() << "Failed to configure camera";
+	}
+}
+
 void Capture::start()
 {
-	Stream *stream = config_->at(0).stream();
-	int count = allocator_->allocate(stream);
+	for (const StreamConfiguration &cfg : *config_) {
+		int count = allocator_->allocate(cfg.stream());
 
-	ASSERT_GE(count, 0) << "Failed to allocate buffers";
-	EXPECT_EQ(count, config_->at(0).bufferCount) << "Allocated less buffers than expected";
+		ASSERT_GE(count, 0) << "Failed to allocate buffers";
+		EXPECT_EQ(count, cfg.bufferCount) << "Allocated less buffers than expected";
+	}
 
 	camera_->requestCompleted.connect(this, &Capture::requestComplete);
 
+	auto begin = std::chrono::steady_clock::now();
 	ASSERT_EQ(camera_->start(), 0) << "Failed to start camera";
+	startLatency_ = std::chrono::steady_clock::now() - begin;
 }
 
 void Capture::stop()
@@ -60,13 +87,15 @@ void Capture::stop()
 	if (!config_ || !allocator_->allocated())
 		return;
 
+	auto begin = std::chrono::steady_clock::now();
 	camera_->stop();
+	stopLatency_ = std::chrono::steady_clock::now() - begin;
 
 	camera_->requestCompleted.disconnect(this);
 
-	Stream *stream = config_->at(0).stream();
 	requests_.clear();
-	allocator_->free(stream);
+	for (const StreamConfiguration &cfg : *config_)
+		allocator_->free(cfg.stream());
 }
 
 /* CaptureBalanced */
@@ -194,3 +223,244 @@ void CaptureUnbalanced::requestComplete(Request *request)
 	if (camera_->queueRequest(request))
 		loop_->exit(-EINVAL);
 }
+
+/* CapturePerformance */
+
+namespace {
+
+/*
+ * Frames captured right after start are not representative of the steady
+ * state, as the sensor and algorithms may still be converging. They are
+ * excluded from the frame rate and frame interval measurements.
+ */
+constexpr unsigned int kWarmupFrames = 5;
+
+} /* namespace */
+
+std::chrono::microseconds
+CapturePerformance::Results::requestLatency(unsigned int percentile) const
+{
+	if (requestLatencies.empty())
+		return {};
+
+	size_t index = std::min(requestLatencies.size() * percentile / 100,
+				requestLatencies.size() - 1);
+	return requestLatencies[index];
+}
+
+CapturePerformance::CapturePerformance(std::shared_ptr<Camera> camera)
+	: Capture(camera), captureCount_(0), captureLimit_(0), results_{}
+{
+}
+
+/*
+ * Capture \a numFrames frames at the highest frame rate supported by the
+ * camera, and measure the camera timings. Requests are requeued as soon as
+ * they complete, and the camera is stopped with requests still queued.
+ */
+void CapturePerformance::capture(unsigned int numFrames)
+{
+	ASSERT_GT(numFrames, kWarmupFrames + 1) << "Not enough frames to measure";
+
+	results_ = {};
+
+	const ControlInfoMap &infoMap = camera_->controls();
+	auto info = infoMap.find(&controls::FrameDurationLimits);
+	if (info != infoMap.end())
+		results_.frameDuration = info->second.min().get<int64_t>();
+
+	start();
+	results_.startLatency =
+		std::chrono::duration_cast<std::chrono::microseconds>(startLatency_);
+
+	Stream *stream = config_->at(0).stream();
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers = allocator_->buffers(stream);
+
+	captureCount_ = 0;
+	captureLimit_ = numFrames;
+
+	queueTimes_.resize(buffers.size());
+	timestamps_.clear();
+	timestamps_.reserve(numFrames);
+	sequences_.clear();
+	sequences_.reserve(numFrames);
+	results_.requestLatencies.reserve(numFrames);
+
+	/*
+	 * Use the request cookie to index the queue times, completion
+	 * handlers run in a different thread.
+	 */
+	for (unsigned int i = 0; i < buffers.size(); i++) {
+		std::unique_ptr<Request> request = camera_->createRequest(i);
+		ASSERT_TRUE(request) << "Can't create request";
+
+		ASSERT_EQ(request->addBuffer(stream, buffers[i].get()), 0) << "Can't set buffer for request";
+
+		if (results_.frameDuration)
+			request->controls().set(controls::FrameDurationLimits,
+						{ results_.frameDuration, results_.frameDuration });
+
+		requests_.push_back(std::move(request));
+	}
+
+	for (const std::unique_ptr<Request> &request : requests_)
+		ASSERT_EQ(queueRequest(request.get()), 0) << "Failed to queue request";
+
+	/* Run capture session. */
+	loop_ = new EventLoop();
+	int status = loop_->exec();
+	stop();
+	delete loop_;
+
+	ASSERT_EQ(status, 0);
+	ASSERT_EQ(captureCount_, captureLimit_);
+
+	results_.stopLatency =
+		std::chrono::duration_cast<std::chrono::microseconds>(stopLatency_);
+
+	computeResults();
+}
+
+int CapturePerformance::queueRequest(Request *request)
+{
+	queueTimes_[request->cookie()] = Clock::now();
+
+	return camera_->queueRequest(request);
+}
+
+void CapturePerformance::requestComplete(Request *request)
+{
+	/* Ignore the requests cancelled when stopping the camera. */
+	if (captureCount_ >= captureLimit_)
+		return;
+
+	Clock::time_point now = Clock::now();
+
+	EXPECT_EQ(request->status(), Request::Status::RequestComplete)
+		<< "Request didn't complete successfully";
+
+	results_.requestLatencies.push_back(
+		std::chrono::duration_cast<std::chrono::microseconds>(now - queueTimes_[request->cookie()]));
+
+	const FrameMetadata &metadata = request->buffers().begin()->second->metadata();
+	timestamps_.push_back(metadata.timestamp);
+	sequences_.push_back(metadata.sequence);
+
+	captureCount_++;
+	if (captureCount_ >= captureLimit_) {
+		loop_->exit(0);
+		return;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+	if (queueRequest(request))
+		loop_->exit(-EINVAL);
+}
+
+void CapturePerformance::computeResults()
+{
+	std::sort(results_.requestLatencies.begin(), results_.requestLatencies.end());
+
+	for (unsigned int i = 1; i < sequences_.size(); i++) {
+		if (sequences_[i] > sequences_[i - 1] + 1)
+			results_.droppedFrames += sequences_[i] - sequences_[i - 1] - 1;
+	}
+
+	/* Frame intervals in microseconds, in the steady state. */
+	std::vector<double> intervals;
+	for (unsigned int i = kWarmupFrames + 1; i < timestamps_.size(); i++)
+		intervals.push_back((timestamps_[i] - timestamps_[i - 1]) / 1000.0);
+
+	if (intervals.empty())
+		return;
+
+	double sum = 0.0;
+	for (double interval : intervals) {
+		sum += interval;
+		results_.maxInterval = std::max(results_.maxInterval, interval);
+	}
+
+	double mean = sum / intervals.size();
+	double variance = 0.0;
+	for (double interval : intervals)
+		variance += (interval - mean) * (interval - mean);
+
+	results_.frameRate = mean > 0.0 ? 1e6 / mean : 0.0;
+	results_.jitter = std::sqrt(variance / intervals.size());
+}
+
+/* CaptureStress */
+
+CaptureStress::CaptureStress(std::shared_ptr<Camera> camera)
+	: Capture(camera), running_(false), results_{}
+{
+}
+
+/*
+ * Start capturing on all configured streams. Requests are requeued as soon as
+ * they complete, until the capture is stopped. The caller runs the event loop.
+ */
+void CaptureStress::start()
+{
+	Capture::start();
+
+	results_ = {};
+	sequences_.clear();
+
+	/* Every request carries a buffer for each stream. */
+	size_t numRequests = SIZE_MAX;
+	for (const StreamConfiguration &cfg : *config_)
+		numRequests = std::min(numRequests, allocator_->buffers(cfg.stream()).size());
+
+	for (size_t i = 0; i < numRequests; i++) {
+		std::unique_ptr<Request> request = camera_->createRequest();
+		ASSERT_TRUE(request) << "Can't create request";
+
+		for (const StreamConfiguration &cfg : *config_) {
+			Stream *stream = cfg.stream();
+			FrameBuffer *buffer = allocator_->buffers(stream)[i].get();
+
+			ASSERT_EQ(request->addBuffer(stream, buffer), 0) << "Can't set buffer for request";
+		}
+
+		requests_.push_back(std::move(request));
+	}
+
+	running_ = true;
+
+	for (const std::unique_ptr<Request> &request : requests_)
+		ASSERT_EQ(camera_->queueRequest(request.get()), 0) << "Failed to queue request";
+}
+
+void CaptureStress::stop()
+{
+	running_ = false;
+
+	Capture::stop();
+}
+
+void CaptureStress::requestComplete(Request *request)
+{
+	/* Ignore the requests cancelled when stopping the camera. */
+	if (!running_)
+		return;
+
+	if (request->status() != Request::Status::RequestComplete)
+		results_.failedRequests++;
+	else
+		results_.completedRequests++;
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		uint32_t sequence = buffer->metadata().sequence;
+
+		auto it = sequences_.find(stream);
+		if (it != sequences_.end() && sequence > it->second + 1)
+			results_.droppedFrames += sequence - it->second - 1;
+
+		sequences_[stream] = sequence;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+	if (camera_->queueRequest(request))
+		results_.failedRequests++;
+}
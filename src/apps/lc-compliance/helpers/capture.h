@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include <libcamera/libcamera.h>
 
@@ -17,6 +21,7 @@ class Capture
 {
 public:
 	void configure(libcamera::StreamRole role);
+	void configure(libcamera::Span<const libcamera::StreamRole> roles);
 
 protected:
 	Capture(std::shared_ptr<libcamera::Camera> camera);
@@ -29,6 +34,9 @@ protected:
 
 	EventLoop *loop_;
 
+	std::chrono::steady_clock::duration startLatency_;
+	std::chrono::steady_clock::duration stopLatency_;
+
 	std::shared_ptr<libcamera::Camera> camera_;
 	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
@@ -64,3 +72,72 @@ private:
 	unsigned int captureCount_;
 	unsigned int captureLimit_;
 };
+
+class CapturePerformance : public Capture
+{
+public:
+	struct Results {
+		/* Requested frame duration in microseconds, 0 if not supported */
+		int64_t frameDuration;
+		/* Achieved frame rate in frames per second */
+		double frameRate;
+		/* Standard deviation of the frame interval in microseconds */
+		double jitter;
+		/* Largest frame interval in microseconds */
+		double maxInterval;
+		std::chrono::microseconds startLatency;
+		std::chrono::microseconds stopLatency;
+		/* Request to completion latencies, sorted */
+		std::vector<std::chrono::microseconds> requestLatencies;
+		unsigned int droppedFrames;
+
+		std::chrono::microseconds requestLatency(unsigned int percentile) const;
+	};
+
+	CapturePerformance(std::shared_ptr<libcamera::Camera> camera);
+
+	void capture(unsigned int numFrames);
+
+	const Results &results() const { return results_; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	int queueRequest(libcamera::Request *request);
+	void requestComplete(libcamera::Request *request) override;
+	void computeResults();
+
+	unsigned int captureCount_;
+	unsigned int captureLimit_;
+
+	std::vector<Clock::time_point> queueTimes_;
+	std::vector<uint64_t> timestamps_;
+	std::vector<uint32_t> sequences_;
+
+	Results results_;
+};
+
+class CaptureStress : public Capture
+{
+public:
+	struct Results {
+		unsigned int completedRequests;
+		unsigned int failedRequests;
+		unsigned int droppedFrames;
+	};
+
+	CaptureStress(std::shared_ptr<libcamera::Camera> camera);
+
+	void start();
+	void stop();
+
+	const Results &results() const { return results_; }
+
+private:
+	void requestComplete(libcamera::Request *request) override;
+
+	std::atomic<bool> running_;
+	std::map<const libcamera::Stream *, uint32_t> sequences_;
+
+	Results results_;
+};
@@ -8,6 +8,7 @@
 
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <string.h>
 
 #include <gtest/gtest.h>
@@ -25,6 +26,7 @@ enum {
 	OptList = 'l',
 	OptFilter = 'f',
 	OptHelp = 'h',
+	OptThresholds = 't',
 };
 
 /*
@@ -136,8 +138,62 @@ static int initGtest(char *arg0, OptionsParser::Options options)
 	return 0;
 }
 
+static void initThresholds(const OptionsParser::Options &options)
+{
+	PerformanceThresholds thresholds;
+
+	if (options.isSet(OptThresholds)) {
+		const KeyValueParser::Options &values = options[OptThresholds].toKeyValues();
+		const std::map<std::string, unsigned int *> keys = {
+			{ "frames", &thresholds.frames },
+			{ "fps-tolerance", &thresholds.frameRateTolerance },
+			{ "jitter", &thresholds.jitter },
+			{ "start-latency", &thresholds.startLatency },
+			{ "stop-latency", &thresholds.stopLatency },
+			{ "request-latency", &thresholds.requestLatency },
+			{ "dropped-frames", &thresholds.droppedFrames },
+			{ "stress-duration", &thresholds.stressDuration },
+			{ "cpu-usage", &thresholds.cpuUsage },
+			{ "memory-growth", &thresholds.memoryGrowth },
+		};
+
+		for (const auto &[key, value] : keys) {
+			if (values.isSet(key))
+				*value = values[key].toInteger();
+		}
+	}
+
+	Environment::get()->setPerformanceThresholds(thresholds);
+}
+
 static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 {
+	KeyValueParser thresholdsParser;
+	thresholdsParser.addOption("frames", OptionInteger,
+				   "Number of frames to capture", ArgumentRequired);
+	thresholdsParser.addOption("fps-tolerance", OptionInteger,
+				   "Frame rate tolerance, in percent", ArgumentRequired);
+	thresholdsParser.addOption("jitter", OptionInteger,
+				   "Frame interval standard deviation, in microseconds",
+				   ArgumentRequired);
+	thresholdsParser.addOption("start-latency", OptionInteger,
+				   "Camera start latency, in milliseconds", ArgumentRequired);
+	thresholdsParser.addOption("stop-latency", OptionInteger,
+				   "Camera stop latency, in milliseconds", ArgumentRequired);
+	thresholdsParser.addOption("request-latency", OptionInteger,
+				   "99th percentile of the request latency, in milliseconds",
+				   ArgumentRequired);
+	thresholdsParser.addOption("dropped-frames", OptionInteger,
+				   "Number of dropped frames", ArgumentRequired);
+	thresholdsParser.addOption("stress-duration", OptionInteger,
+				   "Duration of the stress tests, in seconds", ArgumentRequired);
+	thresholdsParser.addOption("cpu-usage", OptionInteger,
+				   "CPU usage of the stress tests, in percent of one CPU",
+				   ArgumentRequired);
+	thresholdsParser.addOption("memory-growth", OptionInteger,
+				   "Memory growth of the stress tests, in kilobytes",
+				   ArgumentRequired);
+
 	OptionsParser parser;
 	parser.addOption(OptCamera, OptionString,
 			 "Specify which camera to operate on, by id", "camera",
@@ -148,6 +204,8 @@ static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 			 ArgumentRequired, "filter");
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
 			 "help");
+	parser.addOption(OptThresholds, &thresholdsParser,
+			 "Set the limits of the performance tests", "thresholds");
 
 	*options = parser.parse(argc, argv);
 	if (!options->valid())
@@ -181,6 +239,8 @@ int main(int argc, char **argv)
 			return ret;
 	}
 
+	initThresholds(options);
+
 	ret = initGtest(argv[0], options);
 	if (ret)
 		return ret;
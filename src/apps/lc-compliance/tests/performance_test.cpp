@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Test camera capture performance
+ */
+
+#include "capture.h"
+
+#include <cmath>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+
+using namespace libcamera;
+
+namespace {
+
+const std::vector<StreamRole> ROLES = {
+	StreamRole::Raw,
+	StreamRole::StillCapture,
+	StreamRole::VideoRecording,
+	StreamRole::Viewfinder
+};
+
+} /* namespace */
+
+class Performance : public testing::TestWithParam<StreamRole>
+{
+public:
+	static std::string nameParameters(const testing::TestParamInfo<Performance::ParamType> &info);
+
+protected:
+	void SetUp() override;
+	void TearDown() override;
+
+	std::shared_ptr<Camera> camera_;
+};
+
+void Performance::SetUp()
+{
+	Environment *env = Environment::get();
+
+	camera_ = env->cm()->get(env->cameraId());
+
+	ASSERT_EQ(camera_->acquire(), 0);
+}
+
+void Performance::TearDown()
+{
+	if (!camera_)
+		return;
+
+	camera_->release();
+	camera_.reset();
+}
+
+std::string Performance::nameParameters(const testing::TestParamInfo<Performance::ParamType> &info)
+{
+	std::map<StreamRole, std::string> rolesMap = {
+		{ StreamRole::Raw, "Raw" },
+		{ StreamRole::StillCapture, "StillCapture" },
+		{ StreamRole::VideoRecording, "VideoRecording" },
+		{ StreamRole::Viewfinder, "Viewfinder" }
+	};
+
+	return rolesMap[info.param];
+}
+
+/*
+ * Test capture timings
+ *
+ * Captures frames at the highest frame rate supported by the camera, and
+ * checks the achieved frame rate, the frame interval jitter, the start and
+ * stop latencies, the request completion latency and the number of dropped
+ * frames against the platform thresholds. The measurements are recorded as
+ * test properties, to be collected from the gtest XML or JSON output.
+ */
+TEST_P(Performance, Timings)
+{
+	const PerformanceThresholds &thresholds = Environment::get()->performanceThresholds();
+
+	CapturePerformance capture(camera_);
+
+	capture.configure(GetParam());
+
+	capture.capture(thresholds.frames);
+
+	const CapturePerformance::Results &results = capture.results();
+
+	std::cout << "Frame rate: " << results.frameRate << " fps";
+	if (results.frameDuration)
+		std::cout << " (requested " << 1e6 / results.frameDuration << " fps)";
+	std::cout << std::endl
+		  << "Frame interval jitter: " << results.jitter
+		  << " us (max interval " << results.maxInterval << " us)" << std::endl
+		  << "Start latency: " << results.startLatency.count() << " us" << std::endl
+		  << "Stop latency: " << results.stopLatency.count() << " us" << std::endl
+		  << "Request latency: p50 " << results.requestLatency(50).count()
+		  << " us, p90 " << results.requestLatency(90).count()
+		  << " us, p99 " << results.requestLatency(99).count() << " us" << std::endl
+		  << "Dropped frames: " << results.droppedFrames << std::endl;
+
+	RecordProperty("frame_rate", std::to_string(results.frameRate));
+	RecordProperty("jitter_us", std::to_string(results.jitter));
+	RecordProperty("start_latency_us", std::to_string(results.startLatency.count()));
+	RecordProperty("stop_latency_us", std::to_string(results.stopLatency.count()));
+	RecordProperty("request_latency_p50_us", std::to_string(results.requestLatency(50).count()));
+	RecordProperty("request_latency_p90_us", std::to_string(results.requestLatency(90).count()));
+	RecordProperty("request_latency_p99_us", std::to_string(results.requestLatency(99).count()));
+	RecordProperty("dropped_frames", std::to_string(results.droppedFrames));
+
+	if (results.frameDuration) {
+		double requested = 1e6 / results.frameDuration;
+		EXPECT_LE(std::abs(results.frameRate - requested),
+			  requested * thresholds.frameRateTolerance / 100)
+			<< "Frame rate doesn't match the requested frame duration";
+	} else {
+		std::cout << "FrameDurationLimits not supported, frame rate not checked"
+			  << std::endl;
+	}
+
+	EXPECT_LE(results.jitter, thresholds.jitter)
+		<< "Frame interval jitter too high";
+	EXPECT_LE(results.startLatency.count(), thresholds.startLatency * 1000)
+		<< "Camera start too slow";
+	EXPECT_LE(results.stopLatency.count(), thresholds.stopLatency * 1000)
+		<< "Camera stop too slow";
+	EXPECT_LE(results.requestLatency(99).count(), thresholds.requestLatency * 1000)
+		<< "Request latency too high";
+	EXPECT_LE(results.droppedFrames, thresholds.droppedFrames)
+		<< "Too many dropped frames";
+}
+
+INSTANTIATE_TEST_SUITE_P(PerformanceTests,
+			 Performance,
+			 testing::ValuesIn(ROLES),
+			 Performance::nameParameters);
@@ -0,0 +1,218 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Stress test multi-stream and multi-camera capture
+ */
+
+#include "capture.h"
+
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+
+using namespace std::chrono_literals;
+using namespace libcamera;
+
+namespace {
+
+struct ResourceUsage {
+	std::chrono::microseconds cpuTime;
+	/* Resident memory size, in bytes */
+	size_t residentSize;
+};
+
+ResourceUsage resourceUsage()
+{
+	ResourceUsage usage{};
+
+	struct rusage rusage;
+	if (!getrusage(RUSAGE_SELF, &rusage))
+		usage.cpuTime = std::chrono::seconds(rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec)
+			      + std::chrono::microseconds(rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec);
+
+	std::ifstream statm("/proc/self/statm");
+	size_t size;
+	size_t resident;
+	if (statm >> size >> resident)
+		usage.residentSize = resident * sysconf(_SC_PAGESIZE);
+
+	return usage;
+}
+
+} /* namespace */
+
+class Stress : public testing::Test
+{
+protected:
+	void TearDown() override;
+
+	std::shared_ptr<Camera> acquire(const std::string &id);
+	void run(const std::vector<CaptureStress *> &captures);
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+};
+
+void Stress::TearDown()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->release();
+
+	cameras_.clear();
+}
+
+std::shared_ptr<Camera> Stress::acquire(const std::string &id)
+{
+	std::shared_ptr<Camera> camera = Environment::get()->cm()->get(id);
+	if (!camera || camera->acquire())
+		return nullptr;
+
+	cameras_.push_back(camera);
+
+	return camera;
+}
+
+/*
+ * Run the captures for the stress test duration, and check the frame drops, the
+ * CPU usage and the memory growth. The CPU and memory usage is measured for the
+ * whole process, including the libcamera threads. The memory baseline is taken
+ * after a warm-up period, once all buffers have been allocated and mapped.
+ */
+void Stress::run(const std::vector<CaptureStress *> &captures)
+{
+	const PerformanceThresholds &thresholds = Environment::get()->performanceThresholds();
+	const std::chrono::seconds duration(thresholds.stressDuration);
+	const std::chrono::seconds warmup = duration / 10;
+
+	EventLoop loop;
+
+	for (CaptureStress *capture : captures)
+		capture->start();
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	const ResourceUsage initial = resourceUsage();
+	std::optional<size_t> baseline;
+	size_t peak = initial.residentSize;
+
+	loop.addTimerEvent(1s, [&]() {
+		std::chrono::steady_clock::duration elapsed =
+			std::chrono::steady_clock::now() - begin;
+		ResourceUsage usage = resourceUsage();
+
+		peak = std::max(peak, usage.residentSize);
+		if (!baseline && elapsed >= warmup)
+			baseline = usage.residentSize;
+
+		if (elapsed >= duration)
+			loop.exit(0);
+	});
+
+	loop.exec();
+
+	const ResourceUsage last = resourceUsage();
+	const std::chrono::steady_clock::duration elapsed =
+		std::chrono::steady_clock::now() - begin;
+
+	for (CaptureStress *capture : captures)
+		capture->stop();
+
+	double cpuUsage = 100.0 * (last.cpuTime - initial.cpuTime) / elapsed;
+	ssize_t memoryGrowth = (static_cast<ssize_t>(last.residentSize) -
+				static_cast<ssize_t>(baseline.value_or(initial.residentSize))) / 1024;
+	unsigned int droppedFrames = 0;
+
+	for (unsigned int i = 0; i < captures.size(); i++) {
+		const CaptureStress::Results &results = captures[i]->results();
+
+		std::cout << "Capture " << i << ": " << results.completedRequests
+			  << " requests completed, " << results.failedRequests
+			  << " failed, " << results.droppedFrames << " frames dropped"
+			  << std::endl;
+
+		EXPECT_GT(results.completedRequests, 0U) << "No request completed";
+		EXPECT_EQ(results.failedRequests, 0U) << "Requests failed";
+
+		droppedFrames += results.droppedFrames;
+	}
+
+	std::cout << "CPU usage: " << cpuUsage << "%" << std::endl
+		  << "Resident memory: peak " << peak / 1024 << " kB, growth "
+		  << memoryGrowth << " kB" << std::endl;
+
+	RecordProperty("cpu_usage", std::to_string(cpuUsage));
+	RecordProperty("memory_peak_kb", std::to_string(peak / 1024));
+	RecordProperty("memory_growth_kb", std::to_string(memoryGrowth));
+	RecordProperty("dropped_frames", std::to_string(droppedFrames));
+
+	EXPECT_LE(droppedFrames, thresholds.droppedFrames) << "Too many dropped frames";
+	EXPECT_LE(memoryGrowth, static_cast<ssize_t>(thresholds.memoryGrowth))
+		<< "Memory usage grew during capture";
+	if (thresholds.cpuUsage) {
+		EXPECT_LE(cpuUsage, thresholds.cpuUsage) << "CPU usage too high";
+	}
+}
+
+/*
+ * Test sustained multi-stream capture
+ *
+ * Captures from the viewfinder, video recording and still capture streams
+ * simultaneously, with every request carrying a buffer for each stream.
+ * Example failure is a pipeline handler running out of resources or leaking
+ * memory when all its outputs are in use.
+ */
+TEST_F(Stress, MultiStream)
+{
+	std::shared_ptr<Camera> camera = acquire(Environment::get()->cameraId());
+	ASSERT_TRUE(camera) << "Failed to acquire camera";
+
+	const std::vector<StreamRole> roles = {
+		StreamRole::Viewfinder,
+		StreamRole::VideoRecording,
+		StreamRole::StillCapture,
+	};
+
+	CaptureStress capture(camera);
+
+	capture.configure(roles);
+
+	run({ &capture });
+}
+
+/*
+ * Test sustained capture on all cameras
+ *
+ * Captures from the viewfinder stream of all the cameras reported by the
+ * camera manager simultaneously. Cameras that can't be acquired, for instance
+ * because they share hardware with another camera, are skipped.
+ */
+TEST_F(Stress, MultiCamera)
+{
+	const std::vector<StreamRole> roles = { StreamRole::Viewfinder };
+	std::vector<std::unique_ptr<CaptureStress>> captures;
+
+	for (const std::shared_ptr<Camera> &cam : Environment::get()->cm()->cameras()) {
+		std::shared_ptr<Camera> camera = acquire(cam->id());
+		if (!camera) {
+			std::cout << "Skipping camera " << cam->id()
+				  << ", can't acquire it" << std::endl;
+			continue;
+		}
+
+		captures.push_back(std::make_unique<CaptureStress>(camera));
+		captures.back()->configure(roles);
+	}
+
+	ASSERT_FALSE(captures.empty()) << "No camera available";
+
+	std::vector<CaptureStress *> list;
+	for (const std::unique_ptr<CaptureStress> &capture : captures)
+		list.push_back(capture.get());
+
+	run(list);
+}
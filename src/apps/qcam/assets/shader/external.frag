@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * external.frag - Fragment shader code for dmabufs imported as EGL images
+ */
+
+#extension GL_OES_EGL_image_external : require
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+uniform samplerExternalOES tex_y;
+
+/*
+ * External textures are sampled as RGB, the conversion from YUV is performed
+ * by the GPU according to the color space hints of the EGL image.
+ */
+void main(void)
+{
+	gl_FragColor = vec4(texture2D(tex_y, textureOut).rgb, 1.0);
+}
@@ -7,29 +7,172 @@
 
 #include "format_converter.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <utility>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <QImage>
 
 #include <libcamera/formats.h>
 
 #include "../common/image.h"
 
-#define RGBSHIFT		8
-#ifndef MAX
-#define MAX(a,b)		((a)>(b)?(a):(b))
-#endif
-#ifndef MIN
-#define MIN(a,b)		((a)<(b)?(a):(b))
-#endif
-#ifndef CLAMP
-#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
+namespace {
+
+/* Conversions are split in bands of at least this number of lines. */
+constexpr unsigned int kMinBandHeight = 16;
+
+constexpr unsigned int kMaxWorkers = 8;
+
+#if defined(__SSE2__)
+
+/* Convert 8 pixels, see yuvLineToRgb() */
+inline void yuvToRgbSse2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			 uint8_t *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(y)), zero),
+					_mm_set1_epi16(16));
+	const __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(u)), zero),
+					_mm_set1_epi16(128));
+	const __m128i e = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(v)), zero),
+					_mm_set1_epi16(128));
+
+	/* Compute the sums of products in 32 bits, with pairs of samples. */
+	const __m128i cd[2] = { _mm_unpacklo_epi16(c, d), _mm_unpackhi_epi16(c, d) };
+	const __m128i ce[2] = { _mm_unpacklo_epi16(c, e), _mm_unpackhi_epi16(c, e) };
+	const __m128i ez[2] = { _mm_unpacklo_epi16(e, zero), _mm_unpackhi_epi16(e, zero) };
+
+	const __m128i kB = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+	const __m128i kG = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+	const __m128i kGe = _mm_setr_epi16(-208, 0, -208, 0, -208, 0, -208, 0);
+	const __m128i kR = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+	const __m128i round = _mm_set1_epi32(128);
+
+	__m128i b[2], g[2], r[2];
+	for (unsigned int i = 0; i < 2; i++) {
+		b[i] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd[i], kB), round), 8);
+		g[i] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(cd[i], kG),
+								  _mm_madd_epi16(ez[i], kGe)),
+						    round), 8);
+		r[i] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce[i], kR), round), 8);
+	}
+
+	/* Saturate to 8 bits and interleave to BGRA. */
+	const __m128i b8 = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), zero);
+	const __m128i g8 = _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), zero);
+	const __m128i r8 = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]), zero);
+
+	const __m128i bg = _mm_unpacklo_epi8(b8, g8);
+	const __m128i ra = _mm_unpacklo_epi8(r8, _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+#elif defined(__ARM_NEON)
+
+/* Convert 8 pixels, see yuvLineToRgb() */
+inline void yuvToRgbNeon(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			 uint8_t *dst)
+{
+	const int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y))),
+				      vdupq_n_s16(16));
+	const int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u))),
+				      vdupq_n_s16(128));
+	const int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v))),
+				      vdupq_n_s16(128));
+
+	const int32x4_t cLo = vmull_n_s16(vget_low_s16(c), 298);
+	const int32x4_t cHi = vmull_n_s16(vget_high_s16(c), 298);
+
+	const int32x4_t bLo = vmlal_n_s16(cLo, vget_low_s16(d), 516);
+	const int32x4_t bHi = vmlal_n_s16(cHi, vget_high_s16(d), 516);
+	const int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(cLo, vget_low_s16(d), -100),
+					  vget_low_s16(e), -208);
+	const int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(cHi, vget_high_s16(d), -100),
+					  vget_high_s16(e), -208);
+	const int32x4_t rLo = vmlal_n_s16(cLo, vget_low_s16(e), 409);
+	const int32x4_t rHi = vmlal_n_s16(cHi, vget_high_s16(e), 409);
+
+	/* Round, saturate to 8 bits and interleave to BGRA. */
+	uint8x8x4_t bgra;
+	bgra.val[0] = vqmovun_s16(vcombine_s16(vrshrn_n_s32(bLo, 8), vrshrn_n_s32(bHi, 8)));
+	bgra.val[1] = vqmovun_s16(vcombine_s16(vrshrn_n_s32(gLo, 8), vrshrn_n_s32(gHi, 8)));
+	bgra.val[2] = vqmovun_s16(vcombine_s16(vrshrn_n_s32(rLo, 8), vrshrn_n_s32(rHi, 8)));
+	bgra.val[3] = vdup_n_u8(0xff);
+
+	vst4_u8(dst, bgra);
+}
+
 #endif
-#ifndef CLIP
-#define CLIP(x)			CLAMP(x,0,255)
+
+/*
+ * Convert a line of YUV 4:4:4 samples to XRGB8888, with the BT.601 limited
+ * range coefficients in 8-bit fixed point. Blocks of 8 pixels are converted
+ * with SIMD instructions when available, with identical results.
+ */
+void yuvLineToRgb(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+		  uint8_t *dst, unsigned int width)
+{
+	unsigned int x = 0;
+
+#if defined(__SSE2__)
+	for (; x + 8 <= width; x += 8)
+		yuvToRgbSse2(y + x, u + x, v + x, dst + 4 * x);
+#elif defined(__ARM_NEON)
+	for (; x + 8 <= width; x += 8)
+		yuvToRgbNeon(y + x, u + x, v + x, dst + 4 * x);
 #endif
 
+	for (; x < width; x++) {
+		int c = 298 * (y[x] - 16) + 128;
+		int d = u[x] - 128;
+		int e = v[x] - 128;
+
+		dst[4 * x + 0] = std::clamp((c + 516 * d) >> 8, 0, 255);
+		dst[4 * x + 1] = std::clamp((c - 100 * d - 208 * e) >> 8, 0, 255);
+		dst[4 * x + 2] = std::clamp((c + 409 * e) >> 8, 0, 255);
+		dst[4 * x + 3] = 0xff;
+	}
+}
+
+} /* namespace */
+
+/*
+ * Conversion of large images is split in bands of lines, converted in parallel
+ * by a pool of workers. Each band is converted a line at a time: the luma and
+ * chroma samples are first gathered in full-resolution lines, which are then
+ * converted to RGB by a SIMD kernel.
+ */
+FormatConverter::FormatConverter()
+	: numWorkers_(std::clamp(std::thread::hardware_concurrency(), 1U, kMaxWorkers)),
+	  generation_(0), pending_(0), exit_(false), src_(nullptr), dst_(nullptr)
+{
+	lines_.resize(numWorkers_);
+
+	for (unsigned int i = 0; i < numWorkers_; i++)
+		workers_.emplace_back(&FormatConverter::run, this, i);
+}
+
+FormatConverter::~FormatConverter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+	start_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
 int FormatConverter::configure(const libcamera::PixelFormat &format,
 			       const QSize &size, unsigned int stride)
 {
@@ -178,182 +321,174 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 	height_ = size.height();
 	stride_ = stride;
 
+	/* Scratch lines for the Y, Cb and Cr samples of each worker. */
+	for (std::vector<uint8_t> &line : lines_)
+		line.resize(width_ * 3);
+
 	return 0;
 }
 
 void FormatConverter::convert(const Image *src, size_t size, QImage *dst)
 {
+	if (formatFamily_ == MJPEG) {
+		dst->loadFromData(src->data(0).data(), size, "JPEG");
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	src_ = src;
+	dst_ = dst->bits();
+	pending_ = numWorkers_;
+	generation_++;
+
+	start_.notify_all();
+	done_.wait(lock, [&] { return pending_ == 0; });
+
+	src_ = nullptr;
+	dst_ = nullptr;
+}
+
+void FormatConverter::run(unsigned int index)
+{
+	unsigned int generation = 0;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (true) {
+		start_.wait(lock, [&] { return exit_ || generation_ != generation; });
+		if (exit_)
+			return;
+
+		generation = generation_;
+
+		lock.unlock();
+		convertBand(index);
+		lock.lock();
+
+		if (--pending_ == 0)
+			done_.notify_one();
+	}
+}
+
+void FormatConverter::convertBand(unsigned int index)
+{
+	unsigned int bandHeight = std::max((height_ + numWorkers_ - 1) / numWorkers_,
+					   kMinBandHeight);
+	unsigned int start = std::min(index * bandHeight, height_);
+	unsigned int end = std::min(start + bandHeight, height_);
+
+	if (start == end)
+		return;
+
 	switch (formatFamily_) {
 	case MJPEG:
-		dst->loadFromData(src->data(0).data(), size, "JPEG");
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		convertRGB(start, end);
 		break;
 	case YUVPacked:
-		convertYUVPacked(src, dst->bits());
+		convertYUVPacked(start, end, lines_[index]);
 		break;
 	case YUVSemiPlanar:
-		convertYUVSemiPlanar(src, dst->bits());
+		convertYUVSemiPlanar(start, end, lines_[index]);
 		break;
 	case YUVPlanar:
-		convertYUVPlanar(src, dst->bits());
+		convertYUVPlanar(start, end, lines_[index]);
 		break;
 	};
 }
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
-{
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
-}
-
-void FormatConverter::convertRGB(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertRGB(unsigned int start, unsigned int end)
 {
-	const unsigned char *src = srcImage->data(0).data();
-	unsigned int x, y;
-	int r, g, b;
-
-	for (y = 0; y < height_; y++) {
-		for (x = 0; x < width_; x++) {
-			r = src[bpp_ * x + r_pos_];
-			g = src[bpp_ * x + g_pos_];
-			b = src[bpp_ * x + b_pos_];
-
-			dst[4 * x + 0] = b;
-			dst[4 * x + 1] = g;
-			dst[4 * x + 2] = r;
+	for (unsigned int y = start; y < end; y++) {
+		const unsigned char *src = src_->data(0).data() + y * stride_;
+		unsigned char *dst = dst_ + y * width_ * 4;
+
+		for (unsigned int x = 0; x < width_; x++) {
+			dst[4 * x + 0] = src[bpp_ * x + b_pos_];
+			dst[4 * x + 1] = src[bpp_ * x + g_pos_];
+			dst[4 * x + 2] = src[bpp_ * x + r_pos_];
 			dst[4 * x + 3] = 0xff;
 		}
-
-		src += stride_;
-		dst += width_ * 4;
 	}
 }
 
-void FormatConverter::convertYUVPacked(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVPacked(unsigned int start, unsigned int end,
+				       std::vector<uint8_t> &line)
 {
-	const unsigned char *src = srcImage->data(0).data();
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = stride_;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
+	unsigned int cr_pos = (cb_pos_ + 2) % 4;
+	uint8_t *line_y = line.data();
+	uint8_t *line_cb = line_y + width_;
+	uint8_t *line_cr = line_cb + width_;
+
+	for (unsigned int y = start; y < end; y++) {
+		const unsigned char *src = src_->data(0).data() + y * stride_;
+
+		for (unsigned int x = 0; x < width_; x++) {
+			line_y[x] = src[x * 2 + y_pos_];
+			line_cb[x] = src[(x >> 1) * 4 + cb_pos_];
+			line_cr[x] = src[(x >> 1) * 4 + cr_pos];
 		}
+
+		yuvLineToRgb(line_y, line_cb, line_cr, dst_ + y * width_ * 4,
+			     width_);
 	}
 }
 
-void FormatConverter::convertYUVPlanar(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVPlanar(unsigned int start, unsigned int end,
+				       std::vector<uint8_t> &line)
 {
 	unsigned int c_stride = stride_ / horzSubSample_;
-	unsigned int c_inc = horzSubSample_ == 1 ? 1 : 0;
-	const unsigned char *src_y = srcImage->data(0).data();
-	const unsigned char *src_cb = srcImage->data(1).data();
-	const unsigned char *src_cr = srcImage->data(2).data();
-	int r, g, b;
+	unsigned int c_shift = horzSubSample_ == 2 ? 1 : 0;
+	const unsigned char *src_y = src_->data(0).data();
+	const unsigned char *src_cb = src_->data(1).data();
+	const unsigned char *src_cr = src_->data(2).data();
+	uint8_t *line_cb = line.data() + width_;
+	uint8_t *line_cr = line_cb + width_;
 
 	if (nvSwap_)
 		std::swap(src_cb, src_cr);
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *line_y = src_y + y * stride_;
-		const unsigned char *line_cb = src_cb + (y / vertSubSample_) *
-					       c_stride;
-		const unsigned char *line_cr = src_cr + (y / vertSubSample_) *
-					       c_stride;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*line_y, *line_cb, *line_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			line_y++;
-			line_cb += c_inc;
-			line_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*line_y, *line_cb, *line_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			line_y++;
-			line_cb += 1;
-			line_cr += 1;
-			dst += 4;
+	for (unsigned int y = start; y < end; y++) {
+		const unsigned char *cb = src_cb + (y / vertSubSample_) * c_stride;
+		const unsigned char *cr = src_cr + (y / vertSubSample_) * c_stride;
+
+		/* Upsample the chroma line horizontally. */
+		for (unsigned int x = 0; x < width_; x++) {
+			line_cb[x] = cb[x >> c_shift];
+			line_cr[x] = cr[x >> c_shift];
 		}
+
+		yuvLineToRgb(src_y + y * stride_, line_cb, line_cr,
+			     dst_ + y * width_ * 4, width_);
 	}
 }
 
-void FormatConverter::convertYUVSemiPlanar(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVSemiPlanar(unsigned int start, unsigned int end,
+					   std::vector<uint8_t> &line)
 {
 	unsigned int c_stride = stride_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
+	unsigned int c_shift = horzSubSample_ == 2 ? 1 : 0;
 	unsigned int cb_pos = nvSwap_ ? 1 : 0;
 	unsigned int cr_pos = nvSwap_ ? 0 : 1;
-	const unsigned char *src = srcImage->data(0).data();
-	const unsigned char *src_c = srcImage->data(1).data();
-	int r, g, b;
-
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * stride_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
+	const unsigned char *src = src_->data(0).data();
+	const unsigned char *src_c = src_->data(1).data();
+	uint8_t *line_cb = line.data() + width_;
+	uint8_t *line_cr = line_cb + width_;
+
+	for (unsigned int y = start; y < end; y++) {
+		const unsigned char *c = src_c + (y / vertSubSample_) * c_stride;
+
+		/* Deinterleave and upsample the chroma line. */
+		for (unsigned int x = 0; x < width_; x++) {
+			unsigned int offset = (x >> c_shift) * 2;
+
+			line_cb[x] = c[offset + cb_pos];
+			line_cr[x] = c[offset + cr_pos];
 		}
+
+		yuvLineToRgb(src + y * stride_, line_cb, line_cr,
+			     dst_ + y * width_ * 4, width_);
 	}
 }
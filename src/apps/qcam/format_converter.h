@@ -7,7 +7,12 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
 #include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
 
 #include <QSize>
 
@@ -19,6 +24,9 @@ class QImage;
 class FormatConverter
 {
 public:
+	FormatConverter();
+	~FormatConverter();
+
 	int configure(const libcamera::PixelFormat &format, const QSize &size,
 		      unsigned int stride);
 
@@ -33,10 +41,16 @@ private:
 		YUVSemiPlanar,
 	};
 
-	void convertRGB(const Image *src, unsigned char *dst);
-	void convertYUVPacked(const Image *src, unsigned char *dst);
-	void convertYUVPlanar(const Image *src, unsigned char *dst);
-	void convertYUVSemiPlanar(const Image *src, unsigned char *dst);
+	void run(unsigned int index);
+	void convertBand(unsigned int index);
+
+	void convertRGB(unsigned int start, unsigned int end);
+	void convertYUVPacked(unsigned int start, unsigned int end,
+			      std::vector<uint8_t> &line);
+	void convertYUVPlanar(unsigned int start, unsigned int end,
+			      std::vector<uint8_t> &line);
+	void convertYUVSemiPlanar(unsigned int start, unsigned int end,
+				  std::vector<uint8_t> &line);
 
 	libcamera::PixelFormat format_;
 	unsigned int width_;
@@ -59,4 +73,19 @@ private:
 	/* YUV parameters */
 	unsigned int y_pos_;
 	unsigned int cb_pos_;
+
+	/* Worker pool, converting the image in bands of lines */
+	unsigned int numWorkers_;
+	std::vector<std::thread> workers_;
+	std::vector<std::vector<uint8_t>> lines_;
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	unsigned int generation_;
+	unsigned int pending_;
+	bool exit_;
+
+	/* Parameters of the current convert() call, protected by mutex_. */
+	const Image *src_;
+	unsigned char *dst_;
 };
@@ -700,29 +700,53 @@ void MainWindow::requestComplete(Request *request)
 void MainWindow::processCapture()
 {
 	/*
-	 * Retrieve the next buffer from the done queue. The queue may be empty
-	 * if stopCapture() has been called while a CaptureEvent was posted but
-	 * not processed yet. Return immediately in that case.
+	 * Retrieve all the requests from the done queue. The queue may be
+	 * empty if stopCapture() has been called while a CaptureEvent was
+	 * posted but not processed yet, or if a previous CaptureEvent has
+	 * already processed the request. Return immediately in that case.
 	 */
-	Request *request;
+	QQueue<Request *> requests;
 	{
 		QMutexLocker locker(&mutex_);
 		if (doneQueue_.isEmpty())
 			return;
 
-		request = doneQueue_.dequeue();
+		requests.swap(doneQueue_);
 	}
 
+	/*
+	 * Only render the latest request when rendering lags behind the
+	 * camera. The viewfinder buffers of the superseded requests are
+	 * queued back to the camera immediately, to bound the preview latency.
+	 */
+	while (!requests.isEmpty()) {
+		Request *request = requests.dequeue();
+		processRequest(request, requests.isEmpty());
+	}
+}
+
+void MainWindow::processRequest(Request *request, bool render)
+{
+	FrameBuffer *vfBuffer = nullptr;
+
 	/* Process buffers. */
-	if (request->buffers().count(vfStream_))
-		processViewfinder(request->buffers().at(vfStream_));
+	if (request->buffers().count(vfStream_)) {
+		vfBuffer = request->buffers().at(vfStream_);
+		if (render)
+			processViewfinder(vfBuffer);
+	}
 
 	if (request->buffers().count(rawStream_))
 		processRaw(request->buffers().at(rawStream_), request->metadata());
 
 	request->reuse();
-	QMutexLocker locker(&mutex_);
-	freeQueue_.enqueue(request);
+	{
+		QMutexLocker locker(&mutex_);
+		freeQueue_.enqueue(request);
+	}
+
+	if (vfBuffer && !render)
+		renderComplete(vfBuffer);
 }
 
 void MainWindow::processViewfinder(FrameBuffer *buffer)
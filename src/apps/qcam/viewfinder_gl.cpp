@@ -7,11 +7,14 @@
 
 #include "viewfinder_gl.h"
 
+#include <algorithm>
 #include <array>
+#include <vector>
 
 #include <QByteArray>
 #include <QFile>
 #include <QImage>
+#include <QOpenGLContext>
 #include <QStringList>
 
 #include <libcamera/formats.h>
@@ -58,15 +61,66 @@ static const QList<libcamera::PixelFormat> supportedFormats{
 	libcamera::formats::SRGGB12_CSI2P,
 };
 
+/*
+ * Formats that can be imported as external textures, the GPU converts them to
+ * RGB when sampling. Raw Bayer formats are always uploaded and demosaiced by
+ * the shaders.
+ */
+static const QList<libcamera::PixelFormat> dmaBufFormats{
+	libcamera::formats::UYVY,
+	libcamera::formats::VYUY,
+	libcamera::formats::YUYV,
+	libcamera::formats::YVYU,
+	libcamera::formats::NV12,
+	libcamera::formats::NV21,
+	libcamera::formats::NV16,
+	libcamera::formats::NV61,
+	libcamera::formats::NV24,
+	libcamera::formats::NV42,
+	libcamera::formats::YUV420,
+	libcamera::formats::YVU420,
+	libcamera::formats::ABGR8888,
+	libcamera::formats::ARGB8888,
+	libcamera::formats::BGRA8888,
+	libcamera::formats::RGBA8888,
+	libcamera::formats::BGR888,
+	libcamera::formats::RGB888,
+};
+
+#ifndef GL_TEXTURE_EXTERNAL_OES
+#define GL_TEXTURE_EXTERNAL_OES 0x8D65
+#endif
+
+#ifdef HAVE_EGL
+/* DRM_FORMAT_MOD_LINEAR, frame buffers allocated by V4L2 are never tiled. */
+static constexpr EGLuint64KHR kModifierLinear = 0;
+
+static bool hasExtension(const char *extensions, const char *name)
+{
+	if (!extensions)
+		return false;
+
+	return QByteArray(extensions).split(' ').contains(name);
+}
+#endif
+
 ViewFinderGL::ViewFinderGL(QWidget *parent)
 	: QOpenGLWidget(parent), buffer_(nullptr),
 	  colorSpace_(libcamera::ColorSpace::Raw), image_(nullptr),
-	  vertexBuffer_(QOpenGLBuffer::VertexBuffer)
+	  vertexBuffer_(QOpenGLBuffer::VertexBuffer), dmaBufImport_(false),
+	  dmaBufFallback_(false)
+#ifdef HAVE_EGL
+	  , eglDisplay_(EGL_NO_DISPLAY), dmaBufModifiers_(false),
+	  eglCreateImageKHR_(nullptr), eglDestroyImageKHR_(nullptr),
+	  eglQueryDmaBufModifiersEXT_(nullptr),
+	  glEGLImageTargetTexture2DOES_(nullptr)
+#endif
 {
 }
 
 ViewFinderGL::~ViewFinderGL()
 {
+	clearDmaBufTextures();
 	removeShader();
 }
 
@@ -84,11 +138,7 @@ int ViewFinderGL::setFormat(const libcamera::PixelFormat &format, const QSize &s
 		 * If the fragment already exists, remove it and create a new
 		 * one for the new format.
 		 */
-		if (shaderProgram_.isLinked()) {
-			shaderProgram_.release();
-			shaderProgram_.removeShader(fragmentShader_.get());
-			fragmentShader_.reset();
-		}
+		removeFragmentShader();
 
 		if (!selectFormat(format))
 			return -1;
@@ -97,8 +147,12 @@ int ViewFinderGL::setFormat(const libcamera::PixelFormat &format, const QSize &s
 
 		format_ = format;
 		colorSpace_ = colorSpace;
+		dmaBufFallback_ = false;
 	}
 
+	/* The EGL images depend on the frame size and stride. */
+	clearDmaBufTextures();
+
 	size_ = size;
 	stride_ = stride;
 
@@ -113,6 +167,12 @@ void ViewFinderGL::stop()
 		buffer_ = nullptr;
 		image_ = nullptr;
 	}
+
+	/*
+	 * The frame buffers are freed when the camera stops, release the EGL
+	 * images and textures that reference them.
+	 */
+	clearDmaBufTextures();
 }
 
 QImage ViewFinderGL::getCurrentImage()
@@ -420,9 +480,12 @@ bool ViewFinderGL::createFragmentShader()
 	 */
 	fragmentShader_ = std::make_unique<QOpenGLShader>(QOpenGLShader::Fragment, this);
 
-	QFile file(fragmentShaderFile_);
+	QString fragmentShaderFile = dmaBufActive() ? QStringLiteral(":external.frag")
+						    : fragmentShaderFile_;
+
+	QFile file(fragmentShaderFile);
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-		qWarning() << "Shader" << fragmentShaderFile_ << "not found";
+		qWarning() << "Shader" << fragmentShaderFile << "not found";
 		return false;
 	}
 
@@ -497,6 +560,15 @@ void ViewFinderGL::configureTexture(QOpenGLTexture &texture)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
+void ViewFinderGL::removeFragmentShader()
+{
+	if (shaderProgram_.isLinked()) {
+		shaderProgram_.release();
+		shaderProgram_.removeShader(fragmentShader_.get());
+		fragmentShader_.reset();
+	}
+}
+
 void ViewFinderGL::removeShader()
 {
 	if (shaderProgram_.isLinked()) {
@@ -536,9 +608,249 @@ void ViewFinderGL::initializeGL()
 	if (!createVertexShader())
 		qWarning() << "[ViewFinderGL]: create vertex shader failed.";
 
+	initDmaBuf();
+
 	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 }
 
+bool ViewFinderGL::dmaBufActive() const
+{
+	return dmaBufImport_ && !dmaBufFallback_ && dmaBufFormats.contains(format_);
+}
+
+/*
+ * Frame buffers can be sampled by the GPU directly when Qt uses EGL and the
+ * driver supports dmabuf import. This avoids copying every frame through the
+ * CPU with glTexImage2D(), which dominates the cost of rendering on embedded
+ * platforms.
+ */
+void ViewFinderGL::initDmaBuf()
+{
+#ifdef HAVE_EGL
+	/* The dmabuf import isn't available when Qt uses GLX. */
+	eglDisplay_ = eglGetCurrentDisplay();
+	if (eglDisplay_ == EGL_NO_DISPLAY)
+		return;
+
+	const char *extensions = eglQueryString(eglDisplay_, EGL_EXTENSIONS);
+	if (!hasExtension(extensions, "EGL_EXT_image_dma_buf_import") ||
+	    !context()->hasExtension("GL_OES_EGL_image_external"))
+		return;
+
+	eglCreateImageKHR_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+		eglGetProcAddress("eglCreateImageKHR"));
+	eglDestroyImageKHR_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+		eglGetProcAddress("eglDestroyImageKHR"));
+	glEGLImageTargetTexture2DOES_ = reinterpret_cast<void (*)(GLenum, void *)>(
+		eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+	if (!eglCreateImageKHR_ || !eglDestroyImageKHR_ ||
+	    !glEGLImageTargetTexture2DOES_)
+		return;
+
+	if (hasExtension(extensions, "EGL_EXT_image_dma_buf_import_modifiers")) {
+		eglQueryDmaBufModifiersEXT_ = reinterpret_cast<PFNEGLQUERYDMABUFMODIFIERSEXTPROC>(
+			eglGetProcAddress("eglQueryDmaBufModifiersEXT"));
+		dmaBufModifiers_ = eglQueryDmaBufModifiersEXT_ != nullptr;
+	}
+
+	dmaBufImport_ = true;
+#endif
+}
+
+#ifdef HAVE_EGL
+EGLImageKHR ViewFinderGL::importDmaBuf(const libcamera::FrameBuffer *buffer)
+{
+	static const EGLint planeAttribs[3][5] = {
+		{
+			EGL_DMA_BUF_PLANE0_FD_EXT,
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE0_PITCH_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE1_FD_EXT,
+			EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE1_PITCH_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE2_FD_EXT,
+			EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE2_PITCH_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+		},
+	};
+
+	/*
+	 * The chroma strides are derived from the luma stride, the same way
+	 * as for texture uploads.
+	 */
+	std::array<unsigned int, 3> pitches{ stride_ };
+	unsigned int numPlanes;
+
+	switch (format_) {
+	case libcamera::formats::NV12:
+	case libcamera::formats::NV21:
+	case libcamera::formats::NV16:
+	case libcamera::formats::NV61:
+	case libcamera::formats::NV24:
+	case libcamera::formats::NV42:
+		pitches[1] = stride_ * 2 / horzSubSample_;
+		numPlanes = 2;
+		break;
+	case libcamera::formats::YUV420:
+	case libcamera::formats::YVU420:
+		pitches[1] = stride_ / horzSubSample_;
+		pitches[2] = stride_ / horzSubSample_;
+		numPlanes = 3;
+		break;
+	default:
+		numPlanes = 1;
+		break;
+	}
+
+	const std::vector<libcamera::FrameBuffer::Plane> &planes = buffer->planes();
+	if (planes.size() != numPlanes)
+		return EGL_NO_IMAGE_KHR;
+
+	/*
+	 * Pass the linear modifier explicitly if the driver reports it for the
+	 * format, to avoid relying on the implicit modifier of the dmabuf.
+	 * Otherwise, leave it to the driver.
+	 */
+	bool linear = false;
+
+	if (dmaBufModifiers_) {
+		EGLint count = 0;
+
+		eglQueryDmaBufModifiersEXT_(eglDisplay_, format_.fourcc(), 0,
+					    nullptr, nullptr, &count);
+
+		std::vector<EGLuint64KHR> modifiers(count);
+		if (count &&
+		    eglQueryDmaBufModifiersEXT_(eglDisplay_, format_.fourcc(),
+						count, modifiers.data(), nullptr,
+						&count)) {
+			linear = std::find(modifiers.begin(), modifiers.end(),
+					   kModifierLinear) != modifiers.end();
+		}
+	}
+
+	std::vector<EGLint> attribs = {
+		EGL_WIDTH, size_.width(),
+		EGL_HEIGHT, size_.height(),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(format_.fourcc()),
+	};
+
+	for (unsigned int i = 0; i < numPlanes; ++i) {
+		attribs.insert(attribs.end(), {
+			planeAttribs[i][0], planes[i].fd.get(),
+			planeAttribs[i][1], static_cast<EGLint>(planes[i].offset),
+			planeAttribs[i][2], static_cast<EGLint>(pitches[i]),
+		});
+
+		if (linear) {
+			attribs.insert(attribs.end(), {
+				planeAttribs[i][3], static_cast<EGLint>(kModifierLinear & 0xffffffff),
+				planeAttribs[i][4], static_cast<EGLint>(kModifierLinear >> 32),
+			});
+		}
+	}
+
+	/* Color space hints only apply to YUV formats. */
+	if (colorSpace_.ycbcrEncoding != libcamera::ColorSpace::YcbcrEncoding::None) {
+		EGLint encoding;
+
+		switch (colorSpace_.ycbcrEncoding) {
+		case libcamera::ColorSpace::YcbcrEncoding::Rec601:
+		default:
+			encoding = EGL_ITU_REC601_EXT;
+			break;
+		case libcamera::ColorSpace::YcbcrEncoding::Rec709:
+			encoding = EGL_ITU_REC709_EXT;
+			break;
+		case libcamera::ColorSpace::YcbcrEncoding::Rec2020:
+			encoding = EGL_ITU_REC2020_EXT;
+			break;
+		}
+
+		EGLint range = colorSpace_.range == libcamera::ColorSpace::Range::Full
+			     ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
+
+		attribs.insert(attribs.end(), {
+			EGL_YUV_COLOR_SPACE_HINT_EXT, encoding,
+			EGL_SAMPLE_RANGE_HINT_EXT, range,
+		});
+	}
+
+	attribs.push_back(EGL_NONE);
+
+	return eglCreateImageKHR_(eglDisplay_, EGL_NO_CONTEXT,
+				  EGL_LINUX_DMA_BUF_EXT, nullptr,
+				  attribs.data());
+}
+#endif
+
+/*
+ * Return the external texture bound to the EGL image of \a buffer, importing
+ * it the first time the buffer is rendered, or 0 if the buffer can't be
+ * imported. The camera cycles through a small set of buffers, the textures
+ * are kept until the camera stops.
+ */
+GLuint ViewFinderGL::dmaBufTexture([[maybe_unused]] const libcamera::FrameBuffer *buffer)
+{
+#ifdef HAVE_EGL
+	auto iter = dmaBufTextures_.find(buffer);
+	if (iter != dmaBufTextures_.end())
+		return iter->second.id;
+
+	EGLImageKHR image = importDmaBuf(buffer);
+	if (image == EGL_NO_IMAGE_KHR)
+		return 0;
+
+	GLuint id;
+	glGenTextures(1, &id);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, id);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glEGLImageTargetTexture2DOES_(GL_TEXTURE_EXTERNAL_OES, image);
+
+	if (glGetError() != GL_NO_ERROR) {
+		glDeleteTextures(1, &id);
+		eglDestroyImageKHR_(eglDisplay_, image);
+		return 0;
+	}
+
+	dmaBufTextures_[buffer] = { image, id };
+
+	return id;
+#else
+	return 0;
+#endif
+}
+
+void ViewFinderGL::clearDmaBufTextures()
+{
+#ifdef HAVE_EGL
+	if (dmaBufTextures_.empty())
+		return;
+
+	makeCurrent();
+
+	for (const auto &[buffer, texture] : dmaBufTextures_) {
+		glDeleteTextures(1, &texture.id);
+		eglDestroyImageKHR_(eglDisplay_, texture.image);
+	}
+
+	doneCurrent();
+
+	dmaBufTextures_.clear();
+#endif
+}
+
 void ViewFinderGL::doRender()
 {
 	/* Stride of the first plane, in pixels. */
@@ -807,8 +1119,34 @@ void ViewFinderGL::doRender()
 				       (stridePixels - 1));
 }
 
+void ViewFinderGL::doRenderDmaBuf(GLuint texture)
+{
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+	shaderProgram_.setUniformValue(textureUniformY_, 0);
+
+	/* The EGL image only covers the active portion of the lines. */
+	shaderProgram_.setUniformValue(textureUniformStrideFactor_, 1.0f);
+}
+
 void ViewFinderGL::paintGL()
 {
+	GLuint dmaBuf = 0;
+
+	/*
+	 * Import the frame buffer when possible. If the import fails, fall
+	 * back to uploading the mapped image until the format changes.
+	 */
+	if (image_ && dmaBufActive()) {
+		dmaBuf = dmaBufTexture(buffer_);
+		if (!dmaBuf) {
+			qWarning() << "[ViewFinderGL]:"
+				   << "dmabuf import failed, uploading frames.";
+			dmaBufFallback_ = true;
+			removeFragmentShader();
+		}
+	}
+
 	if (!fragmentShader_)
 		if (!createFragmentShader()) {
 			qWarning() << "[ViewFinderGL]:"
@@ -819,7 +1157,10 @@ void ViewFinderGL::paintGL()
 		glClearColor(0.0, 0.0, 0.0, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		doRender();
+		if (dmaBuf)
+			doRenderDmaBuf(dmaBuf);
+		else
+			doRender();
 		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	}
 }
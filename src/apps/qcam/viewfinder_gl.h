@@ -8,8 +8,14 @@
 #pragma once
 
 #include <array>
+#include <map>
 #include <memory>
 
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include <QImage>
 #include <QMutex>
 #include <QOpenGLBuffer>
@@ -61,9 +67,16 @@ private:
 	void configureTexture(QOpenGLTexture &texture);
 	bool createFragmentShader();
 	bool createVertexShader();
+	void removeFragmentShader();
 	void removeShader();
 	void doRender();
 
+	bool dmaBufActive() const;
+	void initDmaBuf();
+	GLuint dmaBufTexture(const libcamera::FrameBuffer *buffer);
+	void clearDmaBufTextures();
+	void doRenderDmaBuf(GLuint texture);
+
 	/* Captured image size, format and buffer */
 	libcamera::FrameBuffer *buffer_;
 	libcamera::PixelFormat format_;
@@ -103,5 +116,26 @@ private:
 	GLuint textureUniformBayerFirstRed_;
 	QPointF firstRed_;
 
+	/* dmabuf import */
+	bool dmaBufImport_;
+	bool dmaBufFallback_;
+#ifdef HAVE_EGL
+	struct DmaBufTexture {
+		EGLImageKHR image;
+		GLuint id;
+	};
+
+	EGLImageKHR importDmaBuf(const libcamera::FrameBuffer *buffer);
+
+	EGLDisplay eglDisplay_;
+	bool dmaBufModifiers_;
+	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_;
+	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_;
+	PFNEGLQUERYDMABUFMODIFIERSEXTPROC eglQueryDmaBufModifiersEXT_;
+	void (*glEGLImageTargetTexture2DOES_)(GLenum target, void *image);
+
+	std::map<const libcamera::FrameBuffer *, DmaBufTexture> dmaBufTextures_;
+#endif
+
 	QMutex mutex_; /* Prevent concurrent access to image_ */
 };
@@ -39,14 +39,32 @@ static const QMap<libcamera::PixelFormat, QImage::Format> nativeFormats
 	{ libcamera::formats::RGB565, QImage::Format_RGB16 },
 };
 
+/*
+ * Formats that are not natively supported are converted in a dedicated thread,
+ * to avoid blocking the event loop. The converted image is displayed from the
+ * event loop, and the frame buffer is released at that point.
+ */
 ViewFinderQt::ViewFinderQt(QWidget *parent)
-	: QWidget(parent), buffer_(nullptr)
+	: QWidget(parent), buffer_(nullptr), pending_({}), converting_(nullptr),
+	  converted_(nullptr), exit_(false)
 {
 	icon_ = QIcon(":camera-off.svg");
+
+	connect(this, &ViewFinderQt::frameConverted,
+		this, &ViewFinderQt::displayConverted, Qt::QueuedConnection);
+
+	thread_ = std::thread(&ViewFinderQt::convertThread, this);
 }
 
 ViewFinderQt::~ViewFinderQt()
 {
+	{
+		QMutexLocker locker(&convertMutex_);
+		exit_ = true;
+	}
+	convertCond_.wakeAll();
+
+	thread_.join();
 }
 
 const QList<libcamera::PixelFormat> &ViewFinderQt::nativeFormats() const
@@ -71,6 +89,7 @@ int ViewFinderQt::setFormat(const libcamera::PixelFormat &format, const QSize &s
 			return ret;
 
 		image_ = QImage(size, QImage::Format_RGB32);
+		convertedImage_ = QImage(size, QImage::Format_RGB32);
 
 		qInfo() << "Using software format conversion from"
 			<< format.toString().c_str();
@@ -89,32 +108,44 @@ void ViewFinderQt::render(libcamera::FrameBuffer *buffer, Image *image)
 {
 	size_t size = buffer->metadata().planes()[0].bytesused;
 
+	if (!::nativeFormats.contains(format_)) {
+		/*
+		 * Queue the frame for conversion. If the previous frame is
+		 * still waiting, replace it with the newest one and release
+		 * it.
+		 */
+		libcamera::FrameBuffer *dropped;
+
+		{
+			QMutexLocker locker(&convertMutex_);
+			dropped = pending_.buffer;
+			pending_ = { buffer, image, size };
+		}
+		convertCond_.wakeAll();
+
+		if (dropped)
+			renderComplete(dropped);
+
+		return;
+	}
+
 	{
 		QMutexLocker locker(&mutex_);
 
-		if (::nativeFormats.contains(format_)) {
-			/*
-			 * If the frame format is identical to the display
-			 * format, create a QImage that references the frame
-			 * and store a reference to the frame buffer. The
-			 * previously stored frame buffer, if any, will be
-			 * released.
-			 *
-			 * \todo Get the stride from the buffer instead of
-			 * computing it naively
-			 */
-			assert(buffer->planes().size() == 1);
-			image_ = QImage(image->data(0).data(), size_.width(),
-					size_.height(), size / size_.height(),
-					::nativeFormats[format_]);
-			std::swap(buffer, buffer_);
-		} else {
-			/*
-			 * Otherwise, convert the format and release the frame
-			 * buffer immediately.
-			 */
-			converter_.convert(image, size, &image_);
-		}
+		/*
+		 * If the frame format is identical to the display format,
+		 * create a QImage that references the frame and store a
+		 * reference to the frame buffer. The previously stored frame
+		 * buffer, if any, will be released.
+		 *
+		 * \todo Get the stride from the buffer instead of computing it
+		 * naively
+		 */
+		assert(buffer->planes().size() == 1);
+		image_ = QImage(image->data(0).data(), size_.width(),
+				size_.height(), size / size_.height(),
+				::nativeFormats[format_]);
+		std::swap(buffer, buffer_);
 	}
 
 	update();
@@ -123,15 +154,90 @@ void ViewFinderQt::render(libcamera::FrameBuffer *buffer, Image *image)
 		renderComplete(buffer);
 }
 
+void ViewFinderQt::convertThread()
+{
+	QMutexLocker locker(&convertMutex_);
+
+	while (true) {
+		/* Wait for a frame, and for the converted image to be free. */
+		while (!exit_ && (!pending_.buffer || converted_))
+			convertCond_.wait(&convertMutex_);
+
+		if (exit_)
+			return;
+
+		Frame frame = pending_;
+		pending_ = {};
+		converting_ = frame.buffer;
+
+		locker.unlock();
+		converter_.convert(frame.image, frame.size, &convertedImage_);
+		locker.relock();
+
+		converting_ = nullptr;
+		converted_ = frame.buffer;
+		convertCond_.wakeAll();
+
+		Q_EMIT frameConverted();
+	}
+}
+
+void ViewFinderQt::displayConverted()
+{
+	libcamera::FrameBuffer *buffer;
+
+	{
+		QMutexLocker locker(&convertMutex_);
+
+		/* The frame has been released by stop(). */
+		buffer = converted_;
+		if (!buffer)
+			return;
+
+		{
+			QMutexLocker imageLocker(&mutex_);
+			std::swap(image_, convertedImage_);
+		}
+
+		converted_ = nullptr;
+	}
+	convertCond_.wakeAll();
+
+	update();
+
+	renderComplete(buffer);
+}
+
 void ViewFinderQt::stop()
 {
+	QList<libcamera::FrameBuffer *> buffers;
+
+	/* Release the frames waiting for or being converted. */
+	{
+		QMutexLocker locker(&convertMutex_);
+
+		while (converting_)
+			convertCond_.wait(&convertMutex_);
+
+		if (pending_.buffer)
+			buffers.append(pending_.buffer);
+		if (converted_)
+			buffers.append(converted_);
+
+		pending_ = {};
+		converted_ = nullptr;
+	}
+
 	image_ = QImage();
 
 	if (buffer_) {
-		renderComplete(buffer_);
+		buffers.append(buffer_);
 		buffer_ = nullptr;
 	}
 
+	for (libcamera::FrameBuffer *buffer : buffers)
+		renderComplete(buffer);
+
 	update();
 }
 
@@ -7,11 +7,15 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <thread>
+
 #include <QIcon>
 #include <QImage>
 #include <QList>
 #include <QMutex>
 #include <QSize>
+#include <QWaitCondition>
 #include <QWidget>
 
 #include <libcamera/formats.h>
@@ -41,12 +45,24 @@ public:
 
 Q_SIGNALS:
 	void renderComplete(libcamera::FrameBuffer *buffer);
+	void frameConverted();
 
 protected:
 	void paintEvent(QPaintEvent *) override;
 	QSize sizeHint() const override;
 
+private Q_SLOTS:
+	void displayConverted();
+
 private:
+	struct Frame {
+		libcamera::FrameBuffer *buffer;
+		Image *image;
+		size_t size;
+	};
+
+	void convertThread();
+
 	FormatConverter converter_;
 
 	libcamera::PixelFormat format_;
@@ -61,4 +77,14 @@ private:
 	libcamera::FrameBuffer *buffer_;
 	QImage image_;
 	QMutex mutex_; /* Prevent concurrent access to image_ */
+
+	/* Format conversion thread, and conversion state protected by convertMutex_ */
+	std::thread thread_;
+	QMutex convertMutex_;
+	QWaitCondition convertCond_;
+	Frame pending_;
+	libcamera::FrameBuffer *converting_;
+	libcamera::FrameBuffer *converted_;
+	QImage convertedImage_;
+	bool exit_;
 };
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * softisp-bench - Synthetic Bayer pattern generator
+ */
+
+#include "bayer_pattern.h"
+
+#include <algorithm>
+#include <array>
+#include <string.h>
+#include <vector>
+
+using namespace libcamera;
+
+/*
+ * Generate a scene made of vertical colour bars over a horizontal brightness
+ * gradient, with some noise. The content doesn't matter much for the
+ * throughput of the debayering itself, but a realistic scene avoids the
+ * statistics and lookup tables hitting the same entries for all pixels.
+ */
+BayerPattern::BayerPattern(const BayerFormat &format, const Size &size,
+			   unsigned int stride)
+	: format_(format), size_(size), stride_(stride)
+{
+}
+
+uint16_t BayerPattern::pixel(unsigned int x, unsigned int y, uint32_t &seed) const
+{
+	/* R, G, B of 8 colour bars, from white to black. */
+	static constexpr std::array<std::array<unsigned int, 3>, 8> bars = { {
+		{ 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+		{ 255, 0, 255 }, { 255, 0, 0 }, { 0, 0, 255 }, { 0, 0, 0 },
+	} };
+
+	/* Colour channel of the pixel, 0 = R, 1 = G, 2 = B. */
+	static constexpr std::array<std::array<unsigned int, 4>, 4> channels = { {
+		{ 2, 1, 1, 0 },	/* BGGR */
+		{ 1, 2, 0, 1 },	/* GBRG */
+		{ 1, 0, 2, 1 },	/* GRBG */
+		{ 0, 1, 1, 2 },	/* RGGB */
+	} };
+
+	unsigned int order = std::min<unsigned int>(format_.order, BayerFormat::RGGB);
+	unsigned int channel = channels[order][(y & 1) * 2 + (x & 1)];
+	unsigned int bar = x * bars.size() / size_.width;
+
+	/* Brightness from 1/8 at the top to full at the bottom. */
+	unsigned int value = bars[bar][channel] * (size_.height + 7 * y) /
+			     (8 * size_.height);
+	value = std::max(value, 16U);
+
+	/* Add a few LSBs of noise with a linear congruential generator. */
+	seed = seed * 1664525 + 1013904223;
+	unsigned int maxValue = (1U << format_.bitDepth) - 1;
+	value = (value << (format_.bitDepth - 8)) + (seed >> 28);
+
+	return std::min(value, maxValue);
+}
+
+void BayerPattern::packLine(uint8_t *dst, const uint16_t *src) const
+{
+	unsigned int width = size_.width;
+
+	if (format_.packing == BayerFormat::Packing::CSI2) {
+		/* 4 pixels in 5 bytes, the 2 LSBs of each pixel in the last one. */
+		for (unsigned int x = 0; x < width; x += 4) {
+			uint8_t lsbs = 0;
+
+			for (unsigned int i = 0; i < 4; i++) {
+				*dst++ = src[x + i] >> 2;
+				lsbs |= (src[x + i] & 3) << (i * 2);
+			}
+
+			*dst++ = lsbs;
+		}
+	} else if (format_.bitDepth > 8) {
+		memcpy(dst, src, width * sizeof(*src));
+	} else {
+		for (unsigned int x = 0; x < width; x++)
+			dst[x] = src[x];
+	}
+}
+
+void BayerPattern::generate(Span<uint8_t> data) const
+{
+	std::vector<uint16_t> line(size_.width);
+	uint32_t seed = 1;
+
+	for (unsigned int y = 0; y < size_.height; y++) {
+		for (unsigned int x = 0; x < size_.width; x++)
+			line[x] = pixel(x, y, seed);
+
+		packLine(data.data() + y * stride_, line.data());
+	}
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * softisp-bench - Synthetic Bayer pattern generator
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+
+#include "libcamera/internal/bayer_format.h"
+
+class BayerPattern
+{
+public:
+	BayerPattern(const libcamera::BayerFormat &format,
+		     const libcamera::Size &size, unsigned int stride);
+
+	void generate(libcamera::Span<uint8_t> data) const;
+
+private:
+	uint16_t pixel(unsigned int x, unsigned int y, uint32_t &seed) const;
+
+	void packLine(uint8_t *dst, const uint16_t *src) const;
+
+	libcamera::BayerFormat format_;
+	libcamera::Size size_;
+	unsigned int stride_;
+};
@@ -0,0 +1,531 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * softisp-bench - Benchmark the Software ISP debayering
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/flat_map.h>
+#include <libcamera/base/span.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/shared_mem_object.h"
+#include "libcamera/internal/software_isp/debayer_params.h"
+
+#include "../common/options.h"
+
+#include "bayer_pattern.h"
+#include "debayer_cpu.h"
+#include "swstats_cpu.h"
+
+using namespace libcamera;
+
+namespace {
+
+enum {
+	OptCcm = 'c',
+	OptFile = 'f',
+	OptHelp = 'h',
+	OptInputFormat = 'i',
+	OptFrames = 'n',
+	OptOutputFormat = 'o',
+	OptReference = 'r',
+	OptSize = 's',
+	OptStripes = 'S',
+	OptWarmup = 'w',
+	OptWrite = 'W',
+};
+
+/* A frame buffer backed by anonymous shared memory */
+struct Buffer {
+	Buffer(const std::vector<unsigned int> &planeSizes)
+	{
+		unsigned int size = 0;
+		for (unsigned int planeSize : planeSizes)
+			size += planeSize;
+
+		mem = SharedMem("softisp-bench", size);
+
+		std::vector<FrameBuffer::Plane> planes;
+		unsigned int offset = 0;
+		for (unsigned int planeSize : planeSizes) {
+			planes.push_back({ mem.fd(), offset, planeSize });
+			offset += planeSize;
+		}
+
+		buffer = std::make_unique<FrameBuffer>(planes);
+	}
+
+	SharedMem mem;
+	std::unique_ptr<FrameBuffer> buffer;
+};
+
+struct TestCase {
+	PixelFormat inputFormat;
+	Size size;
+	PixelFormat outputFormat;
+
+	std::string name() const
+	{
+		std::stringstream ss;
+		ss << inputFormat << "-" << size << "-" << outputFormat;
+		return ss.str();
+	}
+};
+
+struct Result {
+	unsigned int frames;
+	int64_t wallTime;
+	int64_t processingTime;
+	int64_t statsTime;
+	unsigned int inputSize;
+	unsigned int outputSize;
+};
+
+class Benchmark
+{
+public:
+	int parseOptions(int argc, char *argv[]);
+	int run();
+
+private:
+	int runCase(const TestCase &test);
+	int loadInput(const TestCase &test, Span<uint8_t> data, unsigned int stride);
+	int checkOutput(const TestCase &test, Span<const uint8_t> data);
+	void fillParams();
+	void report(const TestCase &test, const Result &result);
+
+	static std::string expandPath(const std::string &pattern,
+				      const TestCase &test);
+
+	OptionsParser::Options options_;
+
+	std::vector<PixelFormat> inputFormats_;
+	std::vector<Size> sizes_;
+	std::vector<PixelFormat> outputFormats_;
+	unsigned int frames_;
+	unsigned int warmup_;
+	unsigned int stripes_;
+
+	DebayerParams params_;
+};
+
+int Benchmark::parseOptions(int argc, char *argv[])
+{
+	OptionsParser parser;
+	parser.addOption(OptCcm, OptionNone,
+			 "Enable the colour correction matrix", "ccm");
+	parser.addOption(OptFile, OptionString,
+			 "Read the Bayer input from a raw file instead of generating a synthetic pattern",
+			 "file", ArgumentRequired, "file");
+	parser.addOption(OptHelp, OptionNone, "Display this help message",
+			 "help");
+	parser.addOption(OptInputFormat, OptionString,
+			 "Bayer input format (default: SRGGB8, SRGGB10, SRGGB12 and SRGGB10_CSI2P)",
+			 "input-format", ArgumentRequired, "format", true);
+	parser.addOption(OptFrames, OptionInteger,
+			 "Number of measured frames per test case (default: 100)",
+			 "frames", ArgumentRequired, "count");
+	parser.addOption(OptOutputFormat, OptionString,
+			 "Output format (default: all formats supported for the input format)",
+			 "output-format", ArgumentRequired, "format", true);
+	parser.addOption(OptReference, OptionString,
+			 "Compare the output with a reference image, '#' is replaced with the test case name",
+			 "reference", ArgumentRequired, "file");
+	parser.addOption(OptSize, OptionString,
+			 "Input frame size (default: 1920x1080)",
+			 "size", ArgumentRequired, "WxH", true);
+	parser.addOption(OptStripes, OptionInteger,
+			 "Number of stripes debayered concurrently (default: 1)",
+			 "stripes", ArgumentRequired, "count");
+	parser.addOption(OptWarmup, OptionInteger,
+			 "Number of frames processed before measuring (default: 10)",
+			 "warmup", ArgumentRequired, "count");
+	parser.addOption(OptWrite, OptionString,
+			 "Write the output of the last frame to a file, '#' is replaced with the test case name",
+			 "write", ArgumentRequired, "file");
+
+	options_ = parser.parse(argc, argv);
+	if (!options_.valid())
+		return -EINVAL;
+
+	if (options_.isSet(OptHelp)) {
+		parser.usage();
+		return -EINTR;
+	}
+
+	if (options_.isSet(OptInputFormat)) {
+		for (const OptionValue &value : options_[OptInputFormat].toArray()) {
+			PixelFormat format = PixelFormat::fromString(value.toString());
+			if (!BayerFormat::fromPixelFormat(format).isValid()) {
+				std::cerr << "Invalid Bayer format " << value.toString()
+					  << std::endl;
+				return -EINVAL;
+			}
+
+			inputFormats_.push_back(format);
+		}
+	} else {
+		inputFormats_ = { formats::SRGGB8, formats::SRGGB10,
+				  formats::SRGGB12, formats::SRGGB10_CSI2P };
+	}
+
+	if (options_.isSet(OptSize)) {
+		for (const OptionValue &value : options_[OptSize].toArray()) {
+			unsigned int width, height;
+			char x;
+
+			std::istringstream ss(value.toString());
+			if (!(ss >> width >> x >> height) || x != 'x' ||
+			    !width || !height) {
+				std::cerr << "Invalid size " << value.toString()
+					  << std::endl;
+				return -EINVAL;
+			}
+
+			sizes_.emplace_back(width, height);
+		}
+	} else {
+		sizes_ = { Size(1920, 1080) };
+	}
+
+	if (options_.isSet(OptOutputFormat)) {
+		for (const OptionValue &value : options_[OptOutputFormat].toArray())
+			outputFormats_.push_back(PixelFormat::fromString(value.toString()));
+	}
+
+	if (options_.isSet(OptFile) &&
+	    (inputFormats_.size() != 1 || sizes_.size() != 1)) {
+		std::cerr << "A single input format and size must be given with a raw input file"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	frames_ = options_.isSet(OptFrames) ? options_[OptFrames].toInteger() : 100;
+	warmup_ = options_.isSet(OptWarmup) ? options_[OptWarmup].toInteger() : 10;
+	stripes_ = options_.isSet(OptStripes) ? options_[OptStripes].toInteger() : 1;
+
+	if (!frames_ || !stripes_) {
+		std::cerr << "The number of frames and stripes must be positive"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void Benchmark::fillParams()
+{
+	/* Unity gains, an identity (or saturation boosting) CCM and no gamma. */
+	params_.generation = 0;
+
+	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+		params_.red[i] = i;
+		params_.green[i] = i;
+		params_.blue[i] = i;
+	}
+
+	params_.ccmEnabled = options_.isSet(OptCcm);
+
+	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+		int16_t v = i * 4;
+
+		if (params_.ccmEnabled) {
+			/* A typical CCM with a 1.5 gain on the diagonal. */
+			params_.redCcm[i] = { static_cast<int16_t>(v * 3 / 2),
+					      static_cast<int16_t>(-v / 4),
+					      static_cast<int16_t>(-v / 4) };
+			params_.greenCcm[i] = { static_cast<int16_t>(-v / 4),
+						static_cast<int16_t>(v * 3 / 2),
+						static_cast<int16_t>(-v / 4) };
+			params_.blueCcm[i] = { static_cast<int16_t>(-v / 4),
+					       static_cast<int16_t>(-v / 4),
+					       static_cast<int16_t>(v * 3 / 2) };
+		} else {
+			params_.redCcm[i] = { v, 0, 0 };
+			params_.greenCcm[i] = { 0, v, 0 };
+			params_.blueCcm[i] = { 0, 0, v };
+		}
+	}
+
+	for (unsigned int i = 0; i < DebayerParams::kGammaLookupSize; i++)
+		params_.gammaLut[i] = i / 4;
+}
+
+std::string Benchmark::expandPath(const std::string &pattern, const TestCase &test)
+{
+	std::string path = pattern;
+	size_t pos = path.find('#');
+	if (pos != std::string::npos)
+		path.replace(pos, 1, test.name());
+
+	return path;
+}
+
+int Benchmark::loadInput(const TestCase &test, Span<uint8_t> data,
+			 unsigned int stride)
+{
+	if (!options_.isSet(OptFile)) {
+		BayerFormat bayer = BayerFormat::fromPixelFormat(test.inputFormat);
+		BayerPattern(bayer, test.size, stride).generate(data);
+		return 0;
+	}
+
+	const std::string &path = options_[OptFile];
+	File file(path);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		std::cerr << "Failed to open " << path << ": "
+			  << strerror(-file.error()) << std::endl;
+		return file.error();
+	}
+
+	ssize_t ret = file.read(data);
+	if (ret != static_cast<ssize_t>(data.size())) {
+		std::cerr << "Raw file " << path << " is too small, expected "
+			  << data.size() << " bytes" << std::endl;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int Benchmark::checkOutput(const TestCase &test, Span<const uint8_t> data)
+{
+	if (options_.isSet(OptWrite)) {
+		std::string path = expandPath(options_[OptWrite], test);
+		File file(path);
+		if (!file.open(File::OpenModeFlag::WriteOnly) ||
+		    file.write(data) != static_cast<ssize_t>(data.size())) {
+			std::cerr << "Failed to write " << path << std::endl;
+			return -EIO;
+		}
+	}
+
+	if (!options_.isSet(OptReference))
+		return 0;
+
+	std::string path = expandPath(options_[OptReference], test);
+	File file(path);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		std::cerr << "Failed to open reference " << path << std::endl;
+		return -ENOENT;
+	}
+
+	std::vector<uint8_t> reference(data.size());
+	if (file.read(reference) != static_cast<ssize_t>(reference.size()) ||
+	    file.size() != static_cast<ssize_t>(reference.size())) {
+		std::cerr << "Reference " << path << " size mismatch" << std::endl;
+		return -EINVAL;
+	}
+
+	unsigned int maxDiff = 0;
+	double sumSquares = 0.0;
+
+	for (size_t i = 0; i < data.size(); i++) {
+		unsigned int diff = std::abs(data[i] - reference[i]);
+		maxDiff = std::max(maxDiff, diff);
+		sumSquares += diff * diff;
+	}
+
+	std::cout << "  reference: max diff " << maxDiff << ", PSNR ";
+	if (sumSquares == 0.0) {
+		std::cout << "inf" << std::endl;
+	} else {
+		double mse = sumSquares / data.size();
+		std::cout << std::fixed << std::setprecision(2)
+			  << 10.0 * std::log10(255.0 * 255.0 / mse) << " dB"
+			  << std::endl;
+	}
+
+	return 0;
+}
+
+void Benchmark::report(const TestCase &test, const Result &result)
+{
+	double frameTime = static_cast<double>(result.wallTime) / result.frames;
+	double processingTime = static_cast<double>(result.processingTime) / result.frames;
+	double statsTime = static_cast<double>(result.statsTime) / result.frames;
+	double pixels = test.size.width * test.size.height;
+	double bytes = result.inputSize + result.outputSize;
+
+	/* Times are in ns, throughputs are computed per second. */
+	std::cout << std::left << std::setw(40) << test.name() << std::right
+		  << std::fixed << std::setprecision(3)
+		  << std::setw(10) << frameTime / 1e6 << " ms/frame"
+		  << std::setw(10) << pixels / frameTime * 1e3 << " Mpixel/s"
+		  << std::setw(8) << bytes / frameTime << " GB/s"
+		  << "  (stats " << statsTime / 1e6 << " ms, debayer "
+		  << std::max(processingTime - statsTime, 0.0) / 1e6 << " ms)"
+		  << std::endl;
+}
+
+int Benchmark::runCase(const TestCase &test)
+{
+	auto stats = std::make_unique<SwStatsCpu>();
+	if (!stats->isValid()) {
+		std::cerr << "Failed to create statistics" << std::endl;
+		return -ENOMEM;
+	}
+
+	DebayerCpu debayer(std::move(stats));
+	debayer.setStripes(stripes_);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(test.inputFormat);
+
+	StreamConfiguration inputCfg;
+	inputCfg.pixelFormat = test.inputFormat;
+	inputCfg.size = test.size;
+	inputCfg.stride = info.stride(test.size.width, 0, 1);
+
+	SizeRange outputSizes = debayer.sizes(test.inputFormat, test.size);
+	if (outputSizes.max.isNull()) {
+		std::cerr << test.name() << ": unsupported input size" << std::endl;
+		return -EINVAL;
+	}
+
+	StreamConfiguration outputCfg;
+	outputCfg.pixelFormat = test.outputFormat;
+	outputCfg.size = outputSizes.max;
+	std::tie(outputCfg.stride, outputCfg.frameSize) =
+		debayer.strideAndFrameSize(test.outputFormat, outputCfg.size);
+
+	if (debayer.configure(inputCfg, { outputCfg }) < 0) {
+		std::cerr << test.name() << ": failed to configure debayer"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	unsigned int inputSize = inputCfg.stride * test.size.height;
+	Buffer input({ inputSize });
+	Buffer output(debayer.planeSizes(0));
+	if (!input.mem || !output.mem) {
+		std::cerr << "Failed to allocate buffers" << std::endl;
+		return -ENOMEM;
+	}
+
+	int ret = loadInput(test, input.mem.mem(), inputCfg.stride);
+	if (ret)
+		return ret;
+
+	FlatMap<unsigned int, FrameBuffer *> outputs;
+	outputs[0] = output.buffer.get();
+
+	Result result = {};
+	result.inputSize = inputSize;
+	result.outputSize = debayer.frameSize(0);
+
+	for (unsigned int i = 0; i < warmup_ + frames_; i++) {
+		FrameMetadata &metadata = input.buffer->_d()->metadata();
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = i;
+
+		timespec start = {};
+		timespec end = {};
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+		debayer.process(input.buffer.get(), outputs, &params_);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+		if (output.buffer->metadata().status != FrameMetadata::FrameSuccess) {
+			std::cerr << test.name() << ": processing failed"
+				  << std::endl;
+			return -EIO;
+		}
+
+		if (i < warmup_)
+			continue;
+
+		result.frames++;
+		result.wallTime += (end.tv_sec - start.tv_sec) * 1000000000LL +
+				   end.tv_nsec - start.tv_nsec;
+		result.processingTime += debayer.processingTime().get<std::nano>();
+		result.statsTime += debayer.statsTime().get<std::nano>();
+	}
+
+	report(test, result);
+
+	return checkOutput(test, output.mem.mem().first(result.outputSize));
+}
+
+int Benchmark::run()
+{
+	fillParams();
+
+	std::cout << "Processing " << frames_ << " frames after " << warmup_
+		  << " warm-up frames, " << stripes_ << " stripe(s)"
+		  << (params_.ccmEnabled ? ", CCM enabled" : "") << std::endl;
+
+	int status = 0;
+
+	for (const PixelFormat &inputFormat : inputFormats_) {
+		/*
+		 * Instantiate a debayer only to list the output formats, they
+		 * don't depend on the configuration.
+		 */
+		std::vector<PixelFormat> supported =
+			DebayerCpu(std::make_unique<SwStatsCpu>()).formats(inputFormat);
+		if (supported.empty()) {
+			std::cerr << "Unsupported input format " << inputFormat
+				  << std::endl;
+			status = -EINVAL;
+			continue;
+		}
+
+		std::vector<PixelFormat> outputFormats = outputFormats_;
+		if (outputFormats.empty())
+			outputFormats = supported;
+
+		for (const Size &size : sizes_) {
+			for (const PixelFormat &outputFormat : outputFormats) {
+				if (std::find(supported.begin(), supported.end(),
+					      outputFormat) == supported.end()) {
+					std::cerr << "Skipping unsupported conversion "
+						  << inputFormat << " to "
+						  << outputFormat << std::endl;
+					continue;
+				}
+
+				int ret = runCase({ inputFormat, size, outputFormat });
+				if (ret)
+					status = ret;
+			}
+		}
+	}
+
+	return status;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	Benchmark benchmark;
+
+	int ret = benchmark.parseOptions(argc, argv);
+	if (ret < 0)
+		return ret == -EINTR ? 0 : EXIT_FAILURE;
+
+	return benchmark.run() ? EXIT_FAILURE : 0;
+}
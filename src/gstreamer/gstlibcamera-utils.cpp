@@ -399,6 +399,45 @@ gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg
 	return caps;
 }
 
+bool
+gst_libcamera_stream_configuration_to_video_info(const StreamConfiguration &stream_cfg,
+						 GstCaps *caps, GstVideoInfo *info)
+{
+	if (!gst_video_info_from_caps(info, caps))
+		return false;
+
+	gint default_stride = GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+	if (!stream_cfg.stride || !default_stride ||
+	    static_cast<gint>(stream_cfg.stride) == default_stride)
+		return true;
+
+	/*
+	 * Scale the default stride of each plane to the stride of the stream,
+	 * and compute the plane offsets from the number of lines of the planes
+	 * in the default layout.
+	 */
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	gsize offset = 0;
+
+	for (guint i = 0; i < n_planes; i++) {
+		gint plane_stride = GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+		gsize plane_end = i + 1 < n_planes
+				? GST_VIDEO_INFO_PLANE_OFFSET(info, i + 1)
+				: GST_VIDEO_INFO_SIZE(info);
+		gsize lines = (plane_end - GST_VIDEO_INFO_PLANE_OFFSET(info, i)) / plane_stride;
+		gint stride = gst_util_uint64_scale_int(plane_stride, stream_cfg.stride,
+							default_stride);
+
+		GST_VIDEO_INFO_PLANE_OFFSET(info, i) = offset;
+		GST_VIDEO_INFO_PLANE_STRIDE(info, i) = stride;
+		offset += stride * lines;
+	}
+
+	GST_VIDEO_INFO_SIZE(info) = offset;
+
+	return true;
+}
+
 void
 gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
 					 GstCaps *caps)
@@ -0,0 +1,301 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Collabora Ltd.
+ *
+ * GStreamer Request Metadata
+ */
+
+#include "gstlibcamerameta.h"
+
+#include <libcamera/control_ids.h>
+#include <libcamera/geometry.h>
+
+using namespace libcamera;
+
+GST_DEBUG_CATEGORY_STATIC(meta_debug);
+#define GST_CAT_DEFAULT meta_debug
+
+static gboolean
+gst_libcamera_meta_init(GstMeta *meta, [[maybe_unused]] gpointer params,
+			[[maybe_unused]] GstBuffer *buffer)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+	self->metadata = nullptr;
+	return TRUE;
+}
+
+static void
+gst_libcamera_meta_free(GstMeta *meta, [[maybe_unused]] GstBuffer *buffer)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+	g_clear_pointer(&self->metadata, gst_structure_free);
+}
+
+static gboolean
+gst_libcamera_meta_transform(GstBuffer *dest, GstMeta *meta,
+			     [[maybe_unused]] GstBuffer *buffer, GQuark type,
+			     [[maybe_unused]] gpointer data)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	if (!GST_META_TRANSFORM_IS_COPY(type))
+		return FALSE;
+
+	gst_buffer_add_libcamera_meta(dest, gst_structure_copy(self->metadata));
+	return TRUE;
+}
+
+GType
+gst_libcamera_meta_api_get_type()
+{
+	static gsize type = 0;
+	static const gchar *tags[] = { nullptr };
+
+	if (g_once_init_enter(&type)) {
+		GType api = gst_meta_api_type_register("GstLibcameraMetaAPI", tags);
+		g_once_init_leave(&type, api);
+	}
+
+	return type;
+}
+
+const GstMetaInfo *
+gst_libcamera_meta_get_info()
+{
+	static gsize info = 0;
+
+	if (g_once_init_enter(&info)) {
+		const GstMetaInfo *meta =
+			gst_meta_register(GST_LIBCAMERA_META_API_TYPE, "GstLibcameraMeta",
+					  sizeof(GstLibcameraMeta),
+					  gst_libcamera_meta_init,
+					  gst_libcamera_meta_free,
+					  gst_libcamera_meta_transform);
+		g_once_init_leave(&info, reinterpret_cast<gsize>(meta));
+	}
+
+	return reinterpret_cast<const GstMetaInfo *>(info);
+}
+
+/**
+ * \brief Attach request metadata to a buffer
+ * \param[in] buffer The buffer
+ * \param[in] metadata The metadata structure, ownership is transferred
+ */
+GstLibcameraMeta *
+gst_buffer_add_libcamera_meta(GstBuffer *buffer, GstStructure *metadata)
+{
+	auto *meta = reinterpret_cast<GstLibcameraMeta *>(
+		gst_buffer_add_meta(buffer, GST_LIBCAMERA_META_INFO, nullptr));
+	meta->metadata = metadata;
+	return meta;
+}
+
+/**
+ * \brief Parse a comma-separated list of control names
+ * \param[in] names The control names
+ *
+ * The names are resolved, and the quarks of the structure fields computed,
+ * once when streaming starts, to avoid string operations for every frame.
+ * Unknown names are ignored with a warning.
+ *
+ * \return The exported controls
+ */
+GstLibcameraMetaControls
+gst_libcamera_meta_parse_controls(const gchar *names)
+{
+	GstLibcameraMetaControls controls;
+
+	if (!names)
+		return controls;
+
+	static gsize debug = 0;
+	if (g_once_init_enter(&debug)) {
+		GST_DEBUG_CATEGORY_INIT(meta_debug, "libcamerameta", 0,
+					"libcamera Request Metadata");
+		g_once_init_leave(&debug, 1);
+	}
+
+	gchar **tokens = g_strsplit(names, ",", -1);
+	for (gchar **token = tokens; *token; token++) {
+		g_strstrip(*token);
+		if (!**token)
+			continue;
+
+		const ControlId *id = nullptr;
+		for (const auto &[key, control] : controls::controls) {
+			if (control->name() == *token) {
+				id = control;
+				break;
+			}
+		}
+
+		if (!id) {
+			GST_WARNING("Unknown control '%s'", *token);
+			continue;
+		}
+
+		controls.emplace_back(id, g_quark_from_string(id->name().c_str()));
+	}
+
+	g_strfreev(tokens);
+
+	return controls;
+}
+
+template<typename T>
+static void
+gst_libcamera_value_set(GValue *value, const T &v);
+
+template<>
+void gst_libcamera_value_set(GValue *value, const bool &v)
+{
+	g_value_init(value, G_TYPE_BOOLEAN);
+	g_value_set_boolean(value, v);
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const uint8_t &v)
+{
+	g_value_init(value, G_TYPE_UINT);
+	g_value_set_uint(value, v);
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const int32_t &v)
+{
+	g_value_init(value, G_TYPE_INT);
+	g_value_set_int(value, v);
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const int64_t &v)
+{
+	g_value_init(value, G_TYPE_INT64);
+	g_value_set_int64(value, v);
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const float &v)
+{
+	g_value_init(value, G_TYPE_FLOAT);
+	g_value_set_float(value, v);
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const Rectangle &v)
+{
+	g_value_init(value, GST_TYPE_ARRAY);
+
+	for (int32_t coord : { v.x, v.y, static_cast<int32_t>(v.width),
+			       static_cast<int32_t>(v.height) }) {
+		GValue element = G_VALUE_INIT;
+		gst_libcamera_value_set(&element, coord);
+		gst_value_array_append_value(value, &element);
+		g_value_unset(&element);
+	}
+}
+
+template<>
+void gst_libcamera_value_set(GValue *value, const Size &v)
+{
+	g_value_init(value, GST_TYPE_ARRAY);
+
+	for (int32_t dim : { static_cast<int32_t>(v.width),
+			     static_cast<int32_t>(v.height) }) {
+		GValue element = G_VALUE_INIT;
+		gst_libcamera_value_set(&element, dim);
+		gst_value_array_append_value(value, &element);
+		g_value_unset(&element);
+	}
+}
+
+template<typename T>
+static void
+gst_libcamera_control_value_set(GValue *value, const ControlValue &control)
+{
+	if (!control.isArray()) {
+		gst_libcamera_value_set(value, control.get<T>());
+		return;
+	}
+
+	Span<const T> data = control.get<Span<const T>>();
+	g_value_init(value, GST_TYPE_ARRAY);
+
+	for (const T &v : data) {
+		GValue element = G_VALUE_INIT;
+		gst_libcamera_value_set(&element, v);
+		gst_value_array_append_value(value, &element);
+		g_value_unset(&element);
+	}
+}
+
+static bool
+gst_libcamera_control_value_to_gvalue(const ControlValue &control, GValue *value)
+{
+	switch (control.type()) {
+	case ControlTypeBool:
+		gst_libcamera_control_value_set<bool>(value, control);
+		return true;
+	case ControlTypeByte:
+		gst_libcamera_control_value_set<uint8_t>(value, control);
+		return true;
+	case ControlTypeInteger32:
+		gst_libcamera_control_value_set<int32_t>(value, control);
+		return true;
+	case ControlTypeInteger64:
+		gst_libcamera_control_value_set<int64_t>(value, control);
+		return true;
+	case ControlTypeFloat:
+		gst_libcamera_control_value_set<float>(value, control);
+		return true;
+	case ControlTypeString:
+		g_value_init(value, G_TYPE_STRING);
+		g_value_set_string(value, control.get<std::string>().c_str());
+		return true;
+	case ControlTypeRectangle:
+		gst_libcamera_control_value_set<Rectangle>(value, control);
+		return true;
+	case ControlTypeSize:
+		gst_libcamera_control_value_set<Size>(value, control);
+		return true;
+	case ControlTypeNone:
+		break;
+	}
+
+	return false;
+}
+
+/**
+ * \brief Create a structure from the exported controls of the request metadata
+ * \param[in] metadata The request metadata
+ * \param[in] controls The exported controls
+ * \return The metadata structure, or nullptr if none of the exported controls
+ * is present in the request metadata
+ */
+GstStructure *
+gst_libcamera_meta_structure_new(const ControlList &metadata,
+				 const GstLibcameraMetaControls &controls)
+{
+	static gsize name = 0;
+	if (g_once_init_enter(&name))
+		g_once_init_leave(&name, g_quark_from_static_string("libcamera-metadata"));
+
+	GstStructure *structure = nullptr;
+
+	for (const auto &[id, quark] : controls) {
+		if (!metadata.contains(id->id()))
+			continue;
+
+		GValue value = G_VALUE_INIT;
+		if (!gst_libcamera_control_value_to_gvalue(metadata.get(id->id()), &value))
+			continue;
+
+		if (!structure)
+			structure = gst_structure_new_id_empty(static_cast<GQuark>(name));
+
+		gst_structure_id_take_value(structure, quark, &value);
+	}
+
+	return structure;
+}
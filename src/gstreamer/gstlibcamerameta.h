@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Collabora Ltd.
+ *
+ * GStreamer Request Metadata
+ */
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <libcamera/controls.h>
+
+#include <gst/gst.h>
+
+/**
+ * \struct GstLibcameraMeta
+ * \brief Request metadata attached to the buffers produced by libcamerasrc
+ *
+ * The metadata is stored in a GstStructure named "libcamera-metadata", with
+ * one field per exported control, named after the control.
+ */
+struct GstLibcameraMeta {
+	GstMeta meta;
+	GstStructure *metadata;
+};
+
+#define GST_LIBCAMERA_META_API_TYPE (gst_libcamera_meta_api_get_type())
+#define GST_LIBCAMERA_META_INFO (gst_libcamera_meta_get_info())
+
+#define gst_buffer_get_libcamera_meta(b) \
+	((GstLibcameraMeta *)gst_buffer_get_meta((b), GST_LIBCAMERA_META_API_TYPE))
+
+GType gst_libcamera_meta_api_get_type();
+const GstMetaInfo *gst_libcamera_meta_get_info();
+
+GstLibcameraMeta *gst_buffer_add_libcamera_meta(GstBuffer *buffer,
+						GstStructure *metadata);
+
+/* The exported controls, with the quarks of the structure field names. */
+using GstLibcameraMetaControls = std::vector<std::pair<const libcamera::ControlId *, GQuark>>;
+
+GstLibcameraMetaControls gst_libcamera_meta_parse_controls(const gchar *names);
+
+GstStructure *gst_libcamera_meta_structure_new(const libcamera::ControlList &metadata,
+					       const GstLibcameraMetaControls &controls);
@@ -8,6 +8,9 @@
 
 #include "gstlibcamerapad.h"
 
+#include <algorithm>
+#include <utility>
+
 #include <libcamera/stream.h>
 
 #include "gstlibcamera-utils.h"
@@ -17,13 +20,34 @@ using namespace libcamera;
 struct _GstLibcameraPad {
 	GstPad parent;
 	StreamRole role;
+	guint buffer_count;
 	GstLibcameraPool *pool;
 	GstClockTime latency;
+	GstClockTime max_latency;
+
+	GstLibcameraPadLeaky leaky;
+	guint max_pending_buffers;
+
+	/* Streaming thread pushing the pending buffers and events downstream. */
+	GRecMutex stream_lock;
+	GstTask *task;
+	GstTask *src_task;
+
+	/* Protects the members below, and leaky and max_pending_buffers. */
+	GMutex lock;
+	GQueue pending;
+	guint pending_buffers;
+	guint64 dropped_buffers;
+	GstFlowReturn flow_ret;
 };
 
 enum {
 	PROP_0,
-	PROP_STREAM_ROLE
+	PROP_STREAM_ROLE,
+	PROP_BUFFER_COUNT,
+	PROP_LEAKY,
+	PROP_MAX_PENDING_BUFFERS,
+	PROP_DROPPED_BUFFERS,
 };
 
 G_DEFINE_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_TYPE_PAD)
@@ -39,6 +63,19 @@ gst_libcamera_pad_set_property(GObject *object, guint prop_id,
 	case PROP_STREAM_ROLE:
 		self->role = (StreamRole)g_value_get_enum(value);
 		break;
+	case PROP_BUFFER_COUNT:
+		self->buffer_count = g_value_get_uint(value);
+		break;
+	case PROP_LEAKY: {
+		GLibLocker locker(&self->lock);
+		self->leaky = static_cast<GstLibcameraPadLeaky>(g_value_get_enum(value));
+		break;
+	}
+	case PROP_MAX_PENDING_BUFFERS: {
+		GLibLocker locker(&self->lock);
+		self->max_pending_buffers = g_value_get_uint(value);
+		break;
+	}
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -56,6 +93,24 @@ gst_libcamera_pad_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_STREAM_ROLE:
 		g_value_set_enum(value, static_cast<gint>(self->role));
 		break;
+	case PROP_BUFFER_COUNT:
+		g_value_set_uint(value, self->buffer_count);
+		break;
+	case PROP_LEAKY: {
+		GLibLocker locker(&self->lock);
+		g_value_set_enum(value, self->leaky);
+		break;
+	}
+	case PROP_MAX_PENDING_BUFFERS: {
+		GLibLocker locker(&self->lock);
+		g_value_set_uint(value, self->max_pending_buffers);
+		break;
+	}
+	case PROP_DROPPED_BUFFERS: {
+		GLibLocker locker(&self->lock);
+		g_value_set_uint64(value, self->dropped_buffers);
+		break;
+	}
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -70,16 +125,94 @@ gst_libcamera_pad_query(GstPad *pad, GstObject *parent, GstQuery *query)
 	if (query->type != GST_QUERY_LATENCY)
 		return gst_pad_query_default(pad, parent, query);
 
-	/* TRUE here means live, we assumes that max latency is the same as min
-	 * as we have no idea that duration of frames. */
-	gst_query_set_latency(query, TRUE, self->latency, self->latency);
+	/*
+	 * TRUE here means live. The max latency accounts for the frames that
+	 * can be buffered in the pool before the camera runs out of buffers.
+	 */
+	GLibLocker lock(GST_OBJECT(self));
+	gst_query_set_latency(query, TRUE, self->latency, self->max_latency);
 	return TRUE;
 }
 
+/*
+ * Push the pending buffers and events downstream, one per iteration. The task
+ * pauses itself first and is resumed when new items are queued, following the
+ * same race-free pattern as the libcamerasrc task.
+ */
+static void
+gst_libcamera_pad_task_run(gpointer user_data)
+{
+	auto *self = GST_LIBCAMERA_PAD(user_data);
+	GstMiniObject *item;
+
+	gst_task_pause(self->task);
+
+	{
+		GLibLocker locker(&self->lock);
+		item = static_cast<GstMiniObject *>(g_queue_pop_head(&self->pending));
+		if (item && GST_IS_BUFFER(item))
+			self->pending_buffers--;
+	}
+
+	if (!item)
+		return;
+
+	bool isEvent = GST_IS_EVENT(item);
+	GstFlowReturn ret = GST_FLOW_OK;
+
+	if (isEvent)
+		gst_pad_push_event(GST_PAD(self), GST_EVENT(item));
+	else
+		ret = gst_pad_push(GST_PAD(self), GST_BUFFER(item));
+
+	bool more;
+	{
+		GLibLocker locker(&self->lock);
+		if (!isEvent)
+			self->flow_ret = ret;
+		more = !g_queue_is_empty(&self->pending);
+	}
+
+	/*
+	 * Stop pushing on fatal flow returns, and let the libcamerasrc task
+	 * handle the error. The pad is flushed when the error is resolved.
+	 */
+	if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED) {
+		gst_task_resume(self->src_task);
+		return;
+	}
+
+	if (more)
+		gst_task_resume(self->task);
+}
+
 static void
 gst_libcamera_pad_init(GstLibcameraPad *self)
 {
 	GST_PAD_QUERYFUNC(self) = gst_libcamera_pad_query;
+
+	g_rec_mutex_init(&self->stream_lock);
+	self->task = gst_task_new(gst_libcamera_pad_task_run, self, nullptr);
+	gst_task_set_lock(self->task, &self->stream_lock);
+
+	g_mutex_init(&self->lock);
+	g_queue_init(&self->pending);
+	self->flow_ret = GST_FLOW_OK;
+}
+
+static void
+gst_libcamera_pad_finalize(GObject *object)
+{
+	GObjectClass *klass = G_OBJECT_CLASS(gst_libcamera_pad_parent_class);
+	auto *self = GST_LIBCAMERA_PAD(object);
+
+	g_queue_clear_full(&self->pending,
+			   reinterpret_cast<GDestroyNotify>(gst_mini_object_unref));
+	g_mutex_clear(&self->lock);
+	g_clear_object(&self->task);
+	g_rec_mutex_clear(&self->stream_lock);
+
+	return klass->finalize(object);
 }
 
 static GType
@@ -109,6 +242,33 @@ gst_libcamera_stream_role_get_type()
 	return type;
 }
 
+static GType
+gst_libcamera_pad_leaky_get_type()
+{
+	static GType type = 0;
+	static const GEnumValue values[] = {
+		{
+			GST_LIBCAMERA_PAD_LEAKY_NO,
+			"Not leaky",
+			"no",
+		}, {
+			GST_LIBCAMERA_PAD_LEAKY_UPSTREAM,
+			"Leaky on upstream (new buffers)",
+			"upstream",
+		}, {
+			GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM,
+			"Leaky on downstream (old buffers)",
+			"downstream",
+		},
+		{ 0, NULL, NULL }
+	};
+
+	if (!type)
+		type = g_enum_register_static("GstLibcameraPadLeaky", values);
+
+	return type;
+}
+
 static void
 gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 {
@@ -116,6 +276,7 @@ gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 
 	object_class->set_property = gst_libcamera_pad_set_property;
 	object_class->get_property = gst_libcamera_pad_get_property;
+	object_class->finalize = gst_libcamera_pad_finalize;
 
 	auto *spec = g_param_spec_enum("stream-role", "Stream Role",
 				       "The selected stream role",
@@ -126,6 +287,42 @@ gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 						     | G_PARAM_READWRITE
 						     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_STREAM_ROLE, spec);
+
+	spec = g_param_spec_uint("buffer-count", "Buffer Count",
+				 "The number of buffers allocated for the stream, "
+				 "0 to use the camera default",
+				 0, G_MAXUINT, 0,
+				 (GParamFlags)(GST_PARAM_MUTABLE_READY
+					       | G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_BUFFER_COUNT, spec);
+
+	spec = g_param_spec_enum("leaky", "Leaky",
+				 "Where to drop buffers when max-pending-buffers "
+				 "buffers are waiting to be pushed downstream",
+				 gst_libcamera_pad_leaky_get_type(),
+				 GST_LIBCAMERA_PAD_LEAKY_NO,
+				 (GParamFlags)(G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_LEAKY, spec);
+
+	spec = g_param_spec_uint("max-pending-buffers", "Maximum Pending Buffers",
+				 "The maximum number of buffers waiting to be pushed "
+				 "downstream before dropping buffers, when leaky",
+				 1, G_MAXUINT, 1,
+				 (GParamFlags)(G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_MAX_PENDING_BUFFERS, spec);
+
+	spec = g_param_spec_uint64("dropped-buffers", "Dropped Buffers",
+				   "The number of buffers dropped by the leaky pad",
+				   0, G_MAXUINT64, 0,
+				   (GParamFlags)(G_PARAM_READABLE
+						 | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_DROPPED_BUFFERS, spec);
 }
 
 StreamRole
@@ -136,6 +333,14 @@ gst_libcamera_pad_get_role(GstPad *pad)
 	return self->role;
 }
 
+guint
+gst_libcamera_pad_get_buffer_count(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+	return self->buffer_count;
+}
+
 GstLibcameraPool *
 gst_libcamera_pad_get_pool(GstPad *pad)
 {
@@ -165,9 +370,142 @@ gst_libcamera_pad_get_stream(GstPad *pad)
 }
 
 void
-gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency)
+gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency,
+			      GstClockTime max_latency)
 {
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
 	self->latency = latency;
+	self->max_latency = std::max(latency, max_latency);
+}
+
+void
+gst_libcamera_pad_start_task(GstPad *pad, GstTask *src_task)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	gst_object_replace(reinterpret_cast<GstObject **>(&self->src_task),
+			   GST_OBJECT(src_task));
+
+	{
+		GLibLocker locker(&self->lock);
+		self->flow_ret = GST_FLOW_OK;
+	}
+
+	gst_task_start(self->task);
+}
+
+void
+gst_libcamera_pad_stop_task(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	gst_task_stop(self->task);
+	gst_task_join(self->task);
+	gst_libcamera_pad_flush(pad);
+
+	gst_object_replace(reinterpret_cast<GstObject **>(&self->src_task),
+			   nullptr);
+}
+
+void
+gst_libcamera_pad_flush(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GQueue pending = G_QUEUE_INIT;
+
+	/* Wait for the item being pushed, if any. */
+	GLibRecLocker streamLocker(&self->stream_lock);
+
+	{
+		GLibLocker locker(&self->lock);
+		std::swap(pending, self->pending);
+		self->pending_buffers = 0;
+		self->flow_ret = GST_FLOW_OK;
+	}
+
+	g_queue_clear_full(&pending,
+			   reinterpret_cast<GDestroyNotify>(gst_mini_object_unref));
+}
+
+/*
+ * Queue a buffer to be pushed downstream by the streaming thread of the pad.
+ * When the pad is leaky and max-pending-buffers buffers are already waiting,
+ * either the new buffer or the oldest pending buffer is dropped, returning it
+ * to its pool.
+ *
+ * Return the flow return of the last buffer pushed downstream. Buffers are
+ * dropped without being queued after a fatal flow return, until the pad is
+ * flushed.
+ */
+GstFlowReturn
+gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GstBuffer *dropped = nullptr;
+	GstFlowReturn ret;
+
+	{
+		GLibLocker locker(&self->lock);
+		ret = self->flow_ret;
+
+		if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED) {
+			dropped = buffer;
+		} else if (self->leaky == GST_LIBCAMERA_PAD_LEAKY_UPSTREAM &&
+			   self->pending_buffers >= self->max_pending_buffers) {
+			dropped = buffer;
+			self->dropped_buffers++;
+		} else {
+			if (self->leaky == GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM &&
+			    self->pending_buffers >= self->max_pending_buffers) {
+				/* Drop the oldest buffer, events are never dropped. */
+				for (GList *l = self->pending.head; l; l = l->next) {
+					if (!GST_IS_BUFFER(l->data))
+						continue;
+
+					dropped = GST_BUFFER(l->data);
+					g_queue_delete_link(&self->pending, l);
+					self->pending_buffers--;
+					self->dropped_buffers++;
+					break;
+				}
+			}
+
+			g_queue_push_tail(&self->pending, buffer);
+			self->pending_buffers++;
+		}
+	}
+
+	if (dropped)
+		gst_buffer_unref(dropped);
+
+	if (dropped != buffer)
+		gst_task_resume(self->task);
+
+	return ret;
+}
+
+/*
+ * Queue a serialized event to be pushed downstream by the streaming thread of
+ * the pad, after the pending buffers.
+ */
+void
+gst_libcamera_pad_queue_event(GstPad *pad, GstEvent *event)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	{
+		GLibLocker locker(&self->lock);
+		g_queue_push_tail(&self->pending, event);
+	}
+
+	gst_task_resume(self->task);
+}
+
+GstFlowReturn
+gst_libcamera_pad_get_flow_return(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker locker(&self->lock);
+	return self->flow_ret;
 }
@@ -14,15 +14,36 @@
 
 #include <libcamera/stream.h>
 
+typedef enum {
+	GST_LIBCAMERA_PAD_LEAKY_NO,
+	GST_LIBCAMERA_PAD_LEAKY_UPSTREAM,
+	GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM,
+} GstLibcameraPadLeaky;
+
 #define GST_TYPE_LIBCAMERA_PAD gst_libcamera_pad_get_type()
 G_DECLARE_FINAL_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_LIBCAMERA, PAD, GstPad)
 
 libcamera::StreamRole gst_libcamera_pad_get_role(GstPad *pad);
 
+guint gst_libcamera_pad_get_buffer_count(GstPad *pad);
+
 GstLibcameraPool *gst_libcamera_pad_get_pool(GstPad *pad);
 
 void gst_libcamera_pad_set_pool(GstPad *pad, GstLibcameraPool *pool);
 
 libcamera::Stream *gst_libcamera_pad_get_stream(GstPad *pad);
 
-void gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency);
+void gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency,
+				   GstClockTime max_latency);
+
+void gst_libcamera_pad_start_task(GstPad *pad, GstTask *src_task);
+
+void gst_libcamera_pad_stop_task(GstPad *pad);
+
+void gst_libcamera_pad_flush(GstPad *pad);
+
+GstFlowReturn gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer);
+
+void gst_libcamera_pad_queue_event(GstPad *pad, GstEvent *event);
+
+GstFlowReturn gst_libcamera_pad_get_flow_return(GstPad *pad);
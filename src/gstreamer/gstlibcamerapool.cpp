@@ -8,6 +8,7 @@
 
 #include "gstlibcamerapool.h"
 
+#include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
 #include "gstlibcamera-utils.h"
@@ -27,10 +28,163 @@ struct _GstLibcameraPool {
 	GstAtomicQueue *queue;
 	GstLibcameraAllocator *allocator;
 	Stream *stream;
+	gsize size;
+
+	/* Downstream pool the buffers are imported from, if any. */
+	GstBufferPool *downstream;
+	GstVideoInfo info;
+	bool video_meta;
 };
 
 G_DEFINE_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_TYPE_BUFFER_POOL)
 
+static GQuark
+gst_libcamera_pool_import_quark()
+{
+	static gsize import_quark = 0;
+
+	if (g_once_init_enter(&import_quark)) {
+		GQuark quark = g_quark_from_string("GstLibcameraImportedFrameBuffer");
+		g_once_init_leave(&import_quark, quark);
+	}
+
+	return import_quark;
+}
+
+static void
+gst_libcamera_pool_free_frame_buffer(gpointer data)
+{
+	delete reinterpret_cast<FrameBuffer *>(data);
+}
+
+/*
+ * Wrap the dmabuf memories of a downstream buffer in a FrameBuffer. The
+ * FrameBuffer is attached to the first memory of the buffer, and reused as
+ * long as the downstream pool recycles the memory.
+ */
+static FrameBuffer *
+gst_libcamera_pool_import_frame_buffer(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	GstMemory *first = gst_buffer_peek_memory(buffer, 0);
+	auto *fb = reinterpret_cast<FrameBuffer *>(gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(first),
+									     gst_libcamera_pool_import_quark()));
+	if (fb)
+		return fb;
+
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(&self->info);
+	std::vector<FrameBuffer::Plane> planes;
+	GstMemory *prevMem = nullptr;
+
+	for (guint i = 0; i < n_planes; i++) {
+		gsize offset = meta ? meta->offset[i] : GST_VIDEO_INFO_PLANE_OFFSET(&self->info, i);
+		guint idx, length;
+		gsize skip;
+
+		if (!gst_buffer_find_memory(buffer, offset, 1, &idx, &length, &skip))
+			return nullptr;
+
+		GstMemory *mem = gst_buffer_peek_memory(buffer, idx);
+		if (!gst_is_dmabuf_memory(mem))
+			return nullptr;
+
+		/* Planes extend to the next plane in the same memory. */
+		gsize end = mem->size;
+		if (i + 1 < n_planes) {
+			gsize next = meta ? meta->offset[i + 1] : GST_VIDEO_INFO_PLANE_OFFSET(&self->info, i + 1);
+			if (next > offset && next - offset < end - skip)
+				end = skip + next - offset;
+		}
+
+		FrameBuffer::Plane plane;
+		/* Don't duplicate the fd of planes stored in the same memory. */
+		if (mem == prevMem)
+			plane.fd = planes.back().fd;
+		else
+			plane.fd = SharedFD(gst_dmabuf_memory_get_fd(mem));
+		prevMem = mem;
+		plane.offset = mem->offset + skip;
+		plane.length = end - skip;
+		planes.push_back(std::move(plane));
+	}
+
+	fb = new FrameBuffer(planes);
+	gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(first),
+				  gst_libcamera_pool_import_quark(), fb,
+				  gst_libcamera_pool_free_frame_buffer);
+
+	return fb;
+}
+
+/*
+ * Fill a pool buffer with the memories of a buffer acquired from the downstream
+ * pool. The downstream buffer is kept alive by a parent buffer meta, and
+ * returns to the downstream pool when the pool buffer is reset.
+ */
+static bool
+gst_libcamera_pool_import_buffer(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	GstBufferPoolAcquireParams params = {};
+	params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+	GstBuffer *downstream;
+	if (gst_buffer_pool_acquire_buffer(self->downstream, &downstream,
+					   &params) != GST_FLOW_OK)
+		return false;
+
+	if (!gst_libcamera_pool_import_frame_buffer(self, downstream)) {
+		GST_WARNING_OBJECT(self, "Failed to import downstream buffer");
+		gst_buffer_unref(downstream);
+		return false;
+	}
+
+	gst_buffer_copy_into(buffer, downstream,
+			     static_cast<GstBufferCopyFlags>(GST_BUFFER_COPY_MEMORY |
+							     GST_BUFFER_COPY_META),
+			     0, -1);
+	gst_buffer_add_parent_buffer_meta(buffer, downstream);
+	gst_buffer_unref(downstream);
+
+	return true;
+}
+
+/*
+ * Attach a GstVideoMeta describing the layout of the libcamera buffer. The
+ * allocator creates one memory per FrameBuffer plane, the plane offsets are
+ * computed from the memory sizes, and from the video info for the planes that
+ * are stored in the same memory.
+ */
+static void
+gst_libcamera_pool_add_video_meta(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	GstVideoInfo *info = &self->info;
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	guint n_mem = gst_buffer_n_memory(buffer);
+	gsize offsets[GST_VIDEO_MAX_PLANES] = {};
+	gint strides[GST_VIDEO_MAX_PLANES] = {};
+
+	for (guint i = 0; i < n_planes; i++) {
+		strides[i] = GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+
+		if (i == 0)
+			continue;
+
+		if (i < n_mem)
+			offsets[i] = offsets[i - 1] +
+				     gst_buffer_peek_memory(buffer, i - 1)->size;
+		else
+			offsets[i] = offsets[i - 1] +
+				     GST_VIDEO_INFO_PLANE_OFFSET(info, i) -
+				     GST_VIDEO_INFO_PLANE_OFFSET(info, i - 1);
+	}
+
+	gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+				       GST_VIDEO_INFO_FORMAT(info),
+				       GST_VIDEO_INFO_WIDTH(info),
+				       GST_VIDEO_INFO_HEIGHT(info),
+				       n_planes, offsets, strides);
+}
+
 static GstFlowReturn
 gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 				  [[maybe_unused]] GstBufferPoolAcquireParams *params)
@@ -40,11 +194,17 @@ gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 	if (!buf)
 		return GST_FLOW_ERROR;
 
-	if (!gst_libcamera_allocator_prepare_buffer(self->allocator, self->stream, buf)) {
+	bool prepared = self->downstream
+		      ? gst_libcamera_pool_import_buffer(self, buf)
+		      : gst_libcamera_allocator_prepare_buffer(self->allocator, self->stream, buf);
+	if (!prepared) {
 		gst_atomic_queue_push(self->queue, buf);
 		return GST_FLOW_ERROR;
 	}
 
+	if (self->video_meta)
+		gst_libcamera_pool_add_video_meta(self, buf);
+
 	*buffer = buf;
 	return GST_FLOW_OK;
 }
@@ -88,7 +248,12 @@ gst_libcamera_pool_finalize(GObject *object)
 		gst_buffer_unref(buf);
 
 	gst_atomic_queue_unref(self->queue);
-	g_object_unref(self->allocator);
+	g_clear_object(&self->allocator);
+
+	if (self->downstream) {
+		gst_buffer_pool_set_active(self->downstream, FALSE);
+		gst_object_unref(self->downstream);
+	}
 
 	G_OBJECT_CLASS(gst_libcamera_pool_parent_class)->finalize(object);
 }
@@ -112,14 +277,21 @@ gst_libcamera_pool_class_init(GstLibcameraPoolClass *klass)
 }
 
 GstLibcameraPool *
-gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream)
+gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream,
+		       const GstVideoInfo *info)
 {
 	auto *pool = GST_LIBCAMERA_POOL(g_object_new(GST_TYPE_LIBCAMERA_POOL, nullptr));
 
 	pool->allocator = GST_LIBCAMERA_ALLOCATOR(g_object_ref(allocator));
 	pool->stream = stream;
 
+	if (info) {
+		pool->info = *info;
+		pool->video_meta = true;
+	}
+
 	gsize pool_size = gst_libcamera_allocator_get_pool_size(allocator, stream);
+	pool->size = pool_size;
 	for (gsize i = 0; i < pool_size; i++) {
 		GstBuffer *buffer = gst_buffer_new();
 		gst_atomic_queue_push(pool->queue, buffer);
@@ -128,6 +300,31 @@ gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream)
 	return pool;
 }
 
+GstLibcameraPool *
+gst_libcamera_pool_new_import(GstBufferPool *downstream, Stream *stream,
+			      const GstVideoInfo *info, gsize pool_size)
+{
+	auto *pool = GST_LIBCAMERA_POOL(g_object_new(GST_TYPE_LIBCAMERA_POOL, nullptr));
+
+	pool->downstream = GST_BUFFER_POOL(gst_object_ref(downstream));
+	pool->stream = stream;
+	pool->info = *info;
+	pool->size = pool_size;
+
+	for (gsize i = 0; i < pool_size; i++) {
+		GstBuffer *buffer = gst_buffer_new();
+		gst_atomic_queue_push(pool->queue, buffer);
+	}
+
+	return pool;
+}
+
+gsize
+gst_libcamera_pool_get_size(GstLibcameraPool *self)
+{
+	return self->size;
+}
+
 Stream *
 gst_libcamera_pool_get_stream(GstLibcameraPool *self)
 {
@@ -138,5 +335,11 @@ FrameBuffer *
 gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer)
 {
 	GstMemory *mem = gst_buffer_peek_memory(buffer, 0);
+
+	auto *fb = reinterpret_cast<FrameBuffer *>(gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(mem),
+									     gst_libcamera_pool_import_quark()));
+	if (fb)
+		return fb;
+
 	return gst_libcamera_memory_get_frame_buffer(mem);
 }
@@ -7,6 +7,9 @@
  *
  * This is a partial implementation of GstBufferPool intended for internal use
  * only. This pool cannot be configured or activated.
+ *
+ * The pool either provides buffers allocated by libcamera, or buffers imported
+ * from a dmabuf pool proposed by downstream elements.
  */
 
 #pragma once
@@ -14,6 +17,7 @@
 #include "gstlibcameraallocator.h"
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <libcamera/stream.h>
 
@@ -21,7 +25,15 @@
 G_DECLARE_FINAL_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_LIBCAMERA, POOL, GstBufferPool)
 
 GstLibcameraPool *gst_libcamera_pool_new(GstLibcameraAllocator *allocator,
-					 libcamera::Stream *stream);
+					 libcamera::Stream *stream,
+					 const GstVideoInfo *info);
+
+GstLibcameraPool *gst_libcamera_pool_new_import(GstBufferPool *downstream,
+						libcamera::Stream *stream,
+						const GstVideoInfo *info,
+						gsize pool_size);
+
+gsize gst_libcamera_pool_get_size(GstLibcameraPool *self);
 
 libcamera::Stream *gst_libcamera_pool_get_stream(GstLibcameraPool *self);
 
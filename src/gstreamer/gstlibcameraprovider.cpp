@@ -6,7 +6,11 @@
  * GStreamer Device Provider
  */
 
+#include <algorithm>
 #include <array>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "gstlibcameraprovider.h"
 
@@ -140,25 +144,83 @@ gst_libcamera_device_class_init(GstLibcameraDeviceClass *klass)
 	g_object_class_install_property(object_class, PROP_AUTO_FOCUS_MODE, pspec);
 }
 
-static GstDevice *
-gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
+/*
+ * Generating the caps of a camera requires generating a configuration, which
+ * is costly for some pipeline handlers. The caps of a camera don't change, so
+ * cache them per camera for all probes in the process.
+ */
+G_LOCK_DEFINE_STATIC(device_caps_lock);
+static std::map<std::string, GstCaps *> device_caps;
+
+static GstCaps *
+gst_libcamera_device_get_caps(const std::shared_ptr<Camera> &camera)
 {
 	static const std::array roles{ StreamRole::VideoRecording };
-	g_autoptr(GstCaps) caps = gst_caps_new_empty();
-	const gchar *name = camera->id().c_str();
+	const std::string &name = camera->id();
+
+	G_LOCK(device_caps_lock);
+	auto it = device_caps.find(name);
+	GstCaps *cached = it != device_caps.end() ? gst_caps_ref(it->second) : nullptr;
+	G_UNLOCK(device_caps_lock);
+
+	if (cached)
+		return cached;
 
 	std::unique_ptr<CameraConfiguration> config = camera->generateConfiguration(roles);
 	if (!config || config->size() != roles.size()) {
-		GST_ERROR("Failed to generate a default configuration for %s", name);
+		GST_ERROR("Failed to generate a default configuration for %s", name.c_str());
 		return nullptr;
 	}
 
+	GstCaps *caps = gst_caps_new_empty();
 	for (const StreamConfiguration &stream_cfg : *config) {
 		GstCaps *sub_caps = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
 		if (sub_caps)
 			gst_caps_append(caps, sub_caps);
 	}
 
+	G_LOCK(device_caps_lock);
+	auto [entry, inserted] = device_caps.try_emplace(name, caps);
+	if (!inserted)
+		gst_caps_replace(&entry->second, caps);
+	else
+		gst_caps_ref(caps);
+	G_UNLOCK(device_caps_lock);
+
+	return caps;
+}
+
+/* Drop the cached caps of the cameras that have been unplugged. */
+static void
+gst_libcamera_device_prune_caps(const std::vector<std::shared_ptr<Camera>> &cameras)
+{
+	G_LOCK(device_caps_lock);
+
+	for (auto it = device_caps.begin(); it != device_caps.end();) {
+		bool present = std::any_of(cameras.begin(), cameras.end(),
+					   [&](const std::shared_ptr<Camera> &camera) {
+						   return camera->id() == it->first;
+					   });
+		if (present) {
+			++it;
+		} else {
+			gst_caps_unref(it->second);
+			it = device_caps.erase(it);
+		}
+	}
+
+	G_UNLOCK(device_caps_lock);
+}
+
+static GstDevice *
+gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
+{
+	const gchar *name = camera->id().c_str();
+
+	g_autoptr(GstCaps) caps = gst_libcamera_device_get_caps(camera);
+	if (!caps)
+		return nullptr;
+
 	return GST_DEVICE(g_object_new(GST_TYPE_LIBCAMERA_DEVICE,
 				       /* \todo Use a unique identifier instead of camera name. */
 				       "name", name,
@@ -178,6 +240,13 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 
 struct _GstLibcameraProvider {
 	GstDeviceProvider parent;
+
+	/*
+	 * Keep the camera manager running between probes. It is shared with
+	 * the libcamerasrc elements of the process, which then don't need to
+	 * enumerate the cameras again.
+	 */
+	std::shared_ptr<CameraManager> *cm;
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraProvider, gst_libcamera_provider,
@@ -189,25 +258,30 @@ static GList *
 gst_libcamera_provider_probe(GstDeviceProvider *provider)
 {
 	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
-	std::shared_ptr<CameraManager> cm;
 	GList *devices = nullptr;
-	gint ret;
 
 	GST_INFO_OBJECT(self, "Probing cameras using libcamera");
 
-	/* \todo Move the CameraMananger start()/stop() calls into
-	 * GstDeviceProvider start()/stop() virtual function when CameraMananger
-	 * gains monitoring support. Meanwhile we need to cycle start()/stop()
-	 * to ensure every probe() calls return the latest list.
+	/*
+	 * The camera manager handles hotplug, the list of cameras is kept up
+	 * to date without restarting it for every probe.
 	 */
-	cm = gst_libcamera_get_camera_manager(ret);
-	if (ret) {
-		GST_ERROR_OBJECT(self, "Failed to retrieve device list: %s",
-				 g_strerror(-ret));
-		return nullptr;
+	if (!*self->cm) {
+		gint ret;
+
+		*self->cm = gst_libcamera_get_camera_manager(ret);
+		if (ret) {
+			GST_ERROR_OBJECT(self, "Failed to retrieve device list: %s",
+					 g_strerror(-ret));
+			self->cm->reset();
+			return nullptr;
+		}
 	}
 
-	for (const std::shared_ptr<Camera> &camera : cm->cameras()) {
+	std::vector<std::shared_ptr<Camera>> cameras = (*self->cm)->cameras();
+	gst_libcamera_device_prune_caps(cameras);
+
+	for (const std::shared_ptr<Camera> &camera : cameras) {
 		GST_INFO_OBJECT(self, "Found camera '%s'", camera->id().c_str());
 
 		GstDevice *dev = gst_libcamera_device_new(camera);
@@ -229,17 +303,33 @@ gst_libcamera_provider_init(GstLibcameraProvider *self)
 {
 	GstDeviceProvider *provider = GST_DEVICE_PROVIDER(self);
 
+	self->cm = new std::shared_ptr<CameraManager>();
+
 	/* Avoid devices being duplicated. */
 	gst_device_provider_hide_provider(provider, "v4l2deviceprovider");
 }
 
+static void
+gst_libcamera_provider_finalize(GObject *object)
+{
+	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(object);
+	gpointer klass = gst_libcamera_provider_parent_class;
+
+	delete self->cm;
+
+	G_OBJECT_CLASS(klass)->finalize(object);
+}
+
 static void
 gst_libcamera_provider_class_init(GstLibcameraProviderClass *klass)
 {
 	GstDeviceProviderClass *provider_class = GST_DEVICE_PROVIDER_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
 	provider_class->probe = gst_libcamera_provider_probe;
 
+	object_class->finalize = gst_libcamera_provider_finalize;
+
 	gst_device_provider_class_set_metadata(provider_class,
 					       "libcamera Device Provider",
 					       "Source/Video",
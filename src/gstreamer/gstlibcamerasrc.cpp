@@ -12,21 +12,19 @@
  *    + Allowing application to use FLUSH/FLUSH_STOP
  *    + Prevent the main thread from accessing streaming thread
  *  - Implement GstElement::request-new-pad (multi stream)
- *    + Evaluate if a single streaming thread is fine
  *  - Add application driven request (snapshot)
  *  - Add framerate control
- *  - Add buffer importation support
  *
  *  Requires new libcamera API:
  *  - Add framerate negotiation support
  *  - Add colorimetry support
  *  - Add timestamp support
  *  - Use unique names to select the camera devices
- *  - Add GstVideoMeta support (strides and offsets)
  */
 
 #include "gstlibcamerasrc.h"
 
+#include <algorithm>
 #include <atomic>
 #include <queue>
 #include <vector>
@@ -38,6 +36,7 @@
 #include <gst/base/base.h>
 
 #include "gstlibcameraallocator.h"
+#include "gstlibcamerameta.h"
 #include "gstlibcamerapad.h"
 #include "gstlibcamerapool.h"
 #include "gstlibcamera-utils.h"
@@ -59,10 +58,12 @@ struct RequestWrap {
 
 	GstClockTime latency_;
 	GstClockTime pts_;
+	GstClockTime frameDuration_;
 };
 
 RequestWrap::RequestWrap(std::unique_ptr<Request> request)
-	: request_(std::move(request)), latency_(0), pts_(GST_CLOCK_TIME_NONE)
+	: request_(std::move(request)), latency_(0), pts_(GST_CLOCK_TIME_NONE),
+	  frameDuration_(0)
 {
 }
 
@@ -128,10 +129,13 @@ struct GstLibcameraSrcState {
 
 	ControlList initControls_;
 	guint group_id_;
+	guint maxRequests_; /* Protected by stream_lock */
+	GstLibcameraMetaControls metadataControls_; /* Protected by stream_lock */
 
 	int queueRequest();
 	void requestCompleted(Request *request);
 	int processRequest();
+	int checkFlow();
 	void clearRequests();
 };
 
@@ -143,6 +147,8 @@ struct _GstLibcameraSrc {
 
 	gchar *camera_name;
 	controls::AfModeEnum auto_focus_mode = controls::AfModeManual;
+	guint max_requests;
+	gchar *export_metadata;
 
 	std::atomic<GstEvent *> pending_eos;
 
@@ -155,6 +161,8 @@ enum {
 	PROP_0,
 	PROP_CAMERA_NAME,
 	PROP_AUTO_FOCUS_MODE,
+	PROP_MAX_REQUESTS,
+	PROP_EXPORT_METADATA,
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
@@ -176,6 +184,12 @@ GstStaticPadTemplate request_src_template = {
 /* Must be called with stream_lock held. */
 int GstLibcameraSrcState::queueRequest()
 {
+	if (maxRequests_) {
+		GLibLocker locker(&lock_);
+		if (queuedRequests_.size() >= maxRequests_)
+			return -ENOBUFS;
+	}
+
 	std::unique_ptr<Request> request = cam_->createRequest();
 	if (!request)
 		return -ENOMEM;
@@ -248,6 +262,10 @@ GstLibcameraSrcState::requestCompleted(Request *request)
 		wrap->latency_ = sys_now - timestamp;
 	}
 
+	const auto frameDuration = request->metadata().get(controls::FrameDuration);
+	if (frameDuration)
+		wrap->frameDuration_ = *frameDuration * GST_USECOND;
+
 	{
 		GLibLocker locker(&lock_);
 		completedRequests_.push(std::move(wrap));
@@ -277,18 +295,37 @@ int GstLibcameraSrcState::processRequest()
 	if (!wrap)
 		return -ENOBUFS;
 
-	GstFlowReturn ret = GST_FLOW_OK;
-	gst_flow_combiner_reset(src_->flow_combiner);
+	GstStructure *metadata = nullptr;
+	if (!metadataControls_.empty())
+		metadata = gst_libcamera_meta_structure_new(wrap->request_->metadata(),
+							    metadataControls_);
 
-	for (GstPad *srcpad : srcpads_) {
+	for (gsize i = 0; i < srcpads_.size(); i++) {
+		GstPad *srcpad = srcpads_[i];
 		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
 		GstBuffer *buffer = wrap->detachBuffer(stream);
 
+		/* The last buffer takes ownership of the metadata structure. */
+		if (metadata)
+			gst_buffer_add_libcamera_meta(buffer, i + 1 == srcpads_.size()
+							      ? metadata
+							      : gst_structure_copy(metadata));
+
 		FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
 
 		if (GST_CLOCK_TIME_IS_VALID(wrap->pts_)) {
+			/*
+			 * Frames can be buffered downstream for as long as the
+			 * pool has buffers left to queue to the camera.
+			 */
+			gsize buffers = gst_libcamera_pool_get_size(gst_libcamera_pad_get_pool(srcpad));
+			if (maxRequests_)
+				buffers = std::min<gsize>(buffers, maxRequests_);
+			GstClockTime max_latency = wrap->latency_ +
+						   wrap->frameDuration_ * (buffers ? buffers - 1 : 0);
+
 			GST_BUFFER_PTS(buffer) = wrap->pts_;
-			gst_libcamera_pad_set_latency(srcpad, wrap->latency_);
+			gst_libcamera_pad_set_latency(srcpad, wrap->latency_, max_latency);
 		} else {
 			GST_BUFFER_PTS(buffer) = 0;
 		}
@@ -296,11 +333,34 @@ int GstLibcameraSrcState::processRequest()
 		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
 		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
 
-		ret = gst_pad_push(srcpad, buffer);
-		ret = gst_flow_combiner_update_pad_flow(src_->flow_combiner,
-							srcpad, ret);
+		/*
+		 * Hand the buffer to the streaming thread of the pad, for a
+		 * slow downstream on one pad not to delay the other pads.
+		 */
+		gst_libcamera_pad_queue_buffer(srcpad, buffer);
 	}
 
+	return err;
+}
+
+/*
+ * Combine the flow returns of the buffers pushed by the streaming threads of
+ * the pads, and handle errors. Return -EAGAIN if a renegotiation is pending
+ * and -EPIPE if streaming must stop.
+ *
+ * Must be called with stream_lock held.
+ */
+int GstLibcameraSrcState::checkFlow()
+{
+	GstFlowReturn ret = GST_FLOW_OK;
+	int err = 0;
+
+	gst_flow_combiner_reset(src_->flow_combiner);
+
+	for (GstPad *srcpad : srcpads_)
+		ret = gst_flow_combiner_update_pad_flow(src_->flow_combiner, srcpad,
+							gst_libcamera_pad_get_flow_return(srcpad));
+
 	switch (ret) {
 	case GST_FLOW_OK:
 		break;
@@ -315,13 +375,13 @@ int GstLibcameraSrcState::processRequest()
 		}
 
 		/* If no pads need a reconfiguration something went wrong. */
-		if (!reconfigure)
-			err = -EPIPE;
+		err = reconfigure ? -EAGAIN : -EPIPE;
 
 		break;
 	}
 
 	case GST_FLOW_EOS: {
+		/* All pads have stopped pushing, push EOS directly. */
 		g_autoptr(GstEvent) eos = gst_event_new_eos();
 		guint32 seqnum = gst_util_seqnum_next();
 		gst_event_set_seqnum(eos, seqnum);
@@ -414,6 +474,119 @@ gst_libcamera_src_open(GstLibcameraSrc *self)
 	return true;
 }
 
+/*
+ * Use the dmabuf pool proposed by downstream in the allocation \a query to
+ * import the buffers of a stream, to avoid copying frames from libcamera
+ * buffers when downstream elements require their own buffers. Only pools
+ * producing dmabuf memories with the same stride as the stream are used.
+ *
+ * Must be called with stream_lock held.
+ */
+static GstLibcameraPool *
+gst_libcamera_src_import_pool(GstLibcameraSrc *self, GstQuery *query,
+			      GstCaps *caps, const GstVideoInfo &info,
+			      const StreamConfiguration &stream_cfg)
+{
+	if (gst_query_get_n_allocation_pools(query) == 0)
+		return nullptr;
+
+	GstBufferPool *downstream = nullptr;
+	guint size, min, max;
+	gst_query_parse_nth_allocation_pool(query, 0, &downstream, &size, &min, &max);
+	if (!downstream)
+		return nullptr;
+
+	g_autoptr(GstBufferPool) pool = downstream;
+
+	/* Keep enough buffers to fill the pipeline of the camera. */
+	guint count = std::max<guint>(min, stream_cfg.bufferCount);
+	if (max && max < count) {
+		GST_DEBUG_OBJECT(self, "Downstream pool is too small to import buffers");
+		return nullptr;
+	}
+
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_set_params(config, caps, std::max<guint>(size, info.size),
+					  count, max);
+	gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+	if (!gst_buffer_pool_set_config(pool, config) ||
+	    !gst_buffer_pool_set_active(pool, TRUE))
+		return nullptr;
+
+	/* Check that the downstream buffers can be imported in libcamera. */
+	GstBuffer *buffer;
+	if (gst_buffer_pool_acquire_buffer(pool, &buffer, nullptr) != GST_FLOW_OK) {
+		gst_buffer_pool_set_active(pool, FALSE);
+		return nullptr;
+	}
+
+	/* Buffers without video meta use the default layout for the caps. */
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+	GstVideoInfo default_info;
+	gst_video_info_from_caps(&default_info, caps);
+	guint stride = meta ? meta->stride[0] : GST_VIDEO_INFO_PLANE_STRIDE(&default_info, 0);
+	bool importable = gst_is_dmabuf_memory(gst_buffer_peek_memory(buffer, 0)) &&
+			  stride == stream_cfg.stride;
+	gst_buffer_unref(buffer);
+
+	if (!importable) {
+		GST_DEBUG_OBJECT(self, "Downstream pool buffers can't be imported");
+		gst_buffer_pool_set_active(pool, FALSE);
+		return nullptr;
+	}
+
+	GST_INFO_OBJECT(self, "Importing %u buffers from downstream pool %" GST_PTR_FORMAT,
+			count, pool);
+
+	return gst_libcamera_pool_new_import(pool, stream_cfg.stream(), &info, count);
+}
+
+/*
+ * Create the pool of a stream. Buffers are imported from downstream if
+ * possible, and allocated by libcamera otherwise. GstVideoMeta are attached to
+ * the buffers allocated by libcamera when downstream supports them, to convey
+ * the strides and offsets of the planes.
+ *
+ * Must be called with stream_lock held.
+ */
+static GstLibcameraPool *
+gst_libcamera_src_create_pool(GstLibcameraSrc *self, GstPad *srcpad,
+			      const StreamConfiguration &stream_cfg)
+{
+	g_autoptr(GstCaps) caps = gst_pad_get_current_caps(srcpad);
+	GstVideoInfo info;
+
+	if (!caps || !gst_libcamera_stream_configuration_to_video_info(stream_cfg, caps, &info))
+		return gst_libcamera_pool_new(self->allocator, stream_cfg.stream(), nullptr);
+
+	g_autoptr(GstQuery) query = gst_query_new_allocation(caps, TRUE);
+	if (!gst_pad_peer_query(srcpad, query))
+		GST_DEBUG_OBJECT(self, "Allocation query failed on %" GST_PTR_FORMAT, srcpad);
+
+	GstLibcameraPool *pool = gst_libcamera_src_import_pool(self, query, caps,
+							       info, stream_cfg);
+	if (pool)
+		return pool;
+
+	bool video_meta = gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE,
+							 nullptr);
+	if (!video_meta) {
+		GstVideoInfo default_info;
+		gst_video_info_from_caps(&default_info, caps);
+
+		if (GST_VIDEO_INFO_PLANE_STRIDE(&default_info, 0) !=
+		    GST_VIDEO_INFO_PLANE_STRIDE(&info, 0))
+			GST_WARNING_OBJECT(self,
+					   "Downstream doesn't support video meta, "
+					   "stride %u differs from the default %d",
+					   stream_cfg.stride,
+					   GST_VIDEO_INFO_PLANE_STRIDE(&default_info, 0));
+	}
+
+	return gst_libcamera_pool_new(self->allocator, stream_cfg.stream(),
+				      video_meta ? &info : nullptr);
+}
+
 /* Must be called with stream_lock held. */
 static bool
 gst_libcamera_src_negotiate(GstLibcameraSrc *self)
@@ -436,6 +609,10 @@ gst_libcamera_src_negotiate(GstLibcameraSrc *self)
 		caps = gst_caps_make_writable(caps);
 		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
 		gst_libcamera_get_framerate_from_caps(caps, element_caps);
+
+		guint buffer_count = gst_libcamera_pad_get_buffer_count(srcpad);
+		if (buffer_count)
+			stream_cfg.bufferCount = buffer_count;
 	}
 
 	/* Validate the configuration. */
@@ -484,8 +661,8 @@ gst_libcamera_src_negotiate(GstLibcameraSrc *self)
 		GstPad *srcpad = state->srcpads_[i];
 		const StreamConfiguration &stream_cfg = state->config_->at(i);
 
-		GstLibcameraPool *pool = gst_libcamera_pool_new(self->allocator,
-								stream_cfg.stream());
+		GstLibcameraPool *pool = gst_libcamera_src_create_pool(self, srcpad,
+								       stream_cfg);
 		g_signal_connect_swapped(pool, "buffer-notify",
 					 G_CALLBACK(gst_task_resume), self->task);
 
@@ -520,8 +697,9 @@ gst_libcamera_src_task_run(gpointer user_data)
 
 	g_autoptr(GstEvent) event = self->pending_eos.exchange(nullptr);
 	if (event) {
+		/* Send EOS after the buffers pending on the pads. */
 		for (GstPad *srcpad : state->srcpads_)
-			gst_pad_push_event(srcpad, gst_event_ref(event));
+			gst_libcamera_pad_queue_event(srcpad, gst_event_ref(event));
 
 		return;
 	}
@@ -543,6 +721,10 @@ gst_libcamera_src_task_run(gpointer user_data)
 		state->cam_->stop();
 		state->clearRequests();
 
+		/* Drop the buffers with the old format. */
+		for (GstPad *srcpad : state->srcpads_)
+			gst_libcamera_pad_flush(srcpad);
+
 		if (!gst_libcamera_src_negotiate(self)) {
 			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
 			gst_task_stop(self->task);
@@ -591,11 +773,22 @@ gst_libcamera_src_task_run(gpointer user_data)
 		doResume = true;
 		break;
 
+	case -ENOBUFS:
+	default:
+		break;
+	}
+
+	ret = state->checkFlow();
+	switch (ret) {
+	case -EAGAIN:
+		/* Renegotiate in the next iteration. */
+		doResume = true;
+		break;
+
 	case -EPIPE:
 		gst_task_stop(self->task);
 		return;
 
-	case -ENOBUFS:
 	default:
 		break;
 	}
@@ -616,6 +809,13 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 
 	GST_DEBUG_OBJECT(self, "Streaming thread has started");
 
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		state->maxRequests_ = self->max_requests;
+		state->metadataControls_ =
+			gst_libcamera_meta_parse_controls(self->export_metadata);
+	}
+
 	gint stream_id_num = 0;
 	std::vector<StreamRole> roles;
 	for (GstPad *srcpad : state->srcpads_) {
@@ -656,6 +856,9 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		GstSegment segment;
 		gst_segment_init(&segment, GST_FORMAT_TIME);
 		gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
+
+		/* Buffers are pushed by a streaming thread per pad. */
+		gst_libcamera_pad_start_task(srcpad, task);
 	}
 
 	if (self->auto_focus_mode != controls::AfModeManual) {
@@ -695,8 +898,11 @@ gst_libcamera_src_task_leave([[maybe_unused]] GstTask *task,
 
 	{
 		GLibRecLocker locker(&self->stream_lock);
-		for (GstPad *srcpad : state->srcpads_)
+		for (GstPad *srcpad : state->srcpads_) {
+			/* Return the pending buffers to the pool first. */
+			gst_libcamera_pad_stop_task(srcpad);
 			gst_libcamera_pad_set_pool(srcpad, nullptr);
+		}
 	}
 
 	g_clear_object(&self->allocator);
@@ -740,6 +946,13 @@ gst_libcamera_src_set_property(GObject *object, guint prop_id,
 	case PROP_AUTO_FOCUS_MODE:
 		self->auto_focus_mode = static_cast<controls::AfModeEnum>(g_value_get_enum(value));
 		break;
+	case PROP_MAX_REQUESTS:
+		self->max_requests = g_value_get_uint(value);
+		break;
+	case PROP_EXPORT_METADATA:
+		g_free(self->export_metadata);
+		self->export_metadata = g_value_dup_string(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -760,6 +973,12 @@ gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_AUTO_FOCUS_MODE:
 		g_value_set_enum(value, static_cast<gint>(self->auto_focus_mode));
 		break;
+	case PROP_MAX_REQUESTS:
+		g_value_set_uint(value, self->max_requests);
+		break;
+	case PROP_EXPORT_METADATA:
+		g_value_set_string(value, self->export_metadata);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -846,6 +1065,7 @@ gst_libcamera_src_finalize(GObject *object)
 	g_clear_object(&self->task);
 	g_mutex_clear(&self->state->lock_);
 	g_free(self->camera_name);
+	g_free(self->export_metadata);
 	delete self->state;
 
 	return klass->finalize(object);
@@ -964,4 +1184,24 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 				 static_cast<gint>(controls::AfModeManual),
 				 G_PARAM_WRITABLE);
 	g_object_class_install_property(object_class, PROP_AUTO_FOCUS_MODE, spec);
+
+	spec = g_param_spec_uint("max-requests", "Maximum Requests",
+				 "The maximum number of requests queued to the camera, "
+				 "0 to queue as many requests as buffers are available",
+				 0, G_MAXUINT, 0,
+				 (GParamFlags)(GST_PARAM_MUTABLE_READY
+					       | G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_MAX_REQUESTS, spec);
+
+	spec = g_param_spec_string("export-metadata", "Export Metadata",
+				   "Comma-separated list of the request metadata controls "
+				   "attached to the buffers as GstLibcameraMeta",
+				   nullptr,
+				   (GParamFlags)(GST_PARAM_MUTABLE_READY
+						 | G_PARAM_CONSTRUCT
+						 | G_PARAM_READWRITE
+						 | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_EXPORT_METADATA, spec);
 }
@@ -23,6 +23,8 @@
 
 #include <libcamera/ipa/core_ipa_interface.h>
 
+#include "libcamera/internal/yaml_parser.h"
+
 #include "libipa/histogram.h"
 
 /**
@@ -81,6 +83,15 @@ static constexpr uint32_t kIgnoreFrame = 10;
 /* Fine scan range 0 < kFineRange < 1 */
 static constexpr double kFineRange = 0.05;
 
+/* Coarse scan step of the fast search */
+static constexpr uint32_t kFastCoarseSearchStep = 64;
+
+/* Range of the fast search golden-section bracket at convergence */
+static constexpr double kFastFineRange = 4.0;
+
+/* Inverse of the golden ratio */
+static constexpr double kGoldenRatio = 0.6180339887498949;
+
 /* Settings for IPU3 AF filter */
 static struct ipu3_uapi_af_filter_config afFilterConfigDefault = {
 	.y1_coeff_0 = { 0, 1, 3, 7 },
@@ -106,13 +117,39 @@ static struct ipu3_uapi_af_filter_config afFilterConfigDefault = {
  * blurred one. Therefore, if an image with the highest contrast can be
  * found through the scan, the position of the len indicates to a clearest
  * image.
+ *
+ * By default, the algorithm scans the whole lens range with a coarse step,
+ * then scans around the best coarse position one step at a time. When the
+ * 'fast-search' tuning parameter is set, the coarse scan uses a larger step,
+ * and the fine scan is replaced by a golden-section search in the bracket
+ * around the best coarse position, which converges in a few frames.
+ *
+ * When the 'reuse-focus' tuning parameter is set, a new streaming session
+ * starts from the focus position found in the previous session. The scan is
+ * only restarted if the contrast shows that the scene has changed.
  */
 Af::Af()
 	: focus_(0), bestFocus_(0), currentVariance_(0.0), previousVariance_(0.0),
-	  coarseCompleted_(false), fineCompleted_(false)
+	  coarseCompleted_(false), fineCompleted_(false), fastSearch_(false),
+	  reuseFocus_(false), search_{}, lastFocus_{}
 {
 }
 
+/**
+ * \brief Initialise the Af algorithm from tuning files
+ * \param[in] context The shared IPA context
+ * \param[in] tuningData The YamlObject containing Af tuning data
+ * \return 0
+ */
+int Af::init([[maybe_unused]] IPAContext &context,
+	     const YamlObject &tuningData)
+{
+	fastSearch_ = tuningData["fast-search"].get<bool>(false);
+	reuseFocus_ = tuningData["reuse-focus"].get<bool>(false);
+
+	return 0;
+}
+
 /**
  * \brief Configure the Af given a configInfo
  * \param[in] context The shared IPA context
@@ -171,6 +208,34 @@ int Af::configure(IPAContext &context, const IPAConfigInfo &configInfo)
 	/* Initial frame ignore counter */
 	afIgnoreFrameReset();
 
+	previousVariance_ = 0.0;
+	search_ = {};
+
+	/*
+	 * Start from the last stable focus position if requested. The
+	 * out-of-focus detection restarts the scan if the scene has changed.
+	 */
+	if (reuseFocus_ && lastFocus_.valid) {
+		LOG(IPU3Af, Debug)
+			<< "Reusing focus position " << lastFocus_.focus;
+
+		focus_ = lastFocus_.focus;
+		bestFocus_ = lastFocus_.focus;
+		coarseCompleted_ = true;
+		fineCompleted_ = true;
+
+		context.activeState.af.focus = lastFocus_.focus;
+		context.activeState.af.maxVariance = lastFocus_.variance;
+		context.activeState.af.stable = true;
+
+		return 0;
+	}
+
+	focus_ = 0;
+	bestFocus_ = 0;
+	coarseCompleted_ = false;
+	fineCompleted_ = false;
+
 	/* Initial focus value */
 	context.activeState.af.focus = 0;
 	/* Maximum variance of the AF statistics */
@@ -244,6 +309,114 @@ void Af::afFineScan(IPAContext &context)
 	}
 }
 
+/**
+ * \brief Start the golden-section search of the fast search
+ * \param[in] context The shared IPA context
+ *
+ * The contrast is assumed to be unimodal in the bracket that spans one coarse
+ * step on each side of the best coarse position. Evaluate the first interior
+ * point of the bracket.
+ */
+void Af::afGoldenSectionStart(IPAContext &context)
+{
+	double step = kFastCoarseSearchStep;
+
+	search_.lo = std::max(bestFocus_ - step, 0.0);
+	search_.hi = std::min(bestFocus_ + step,
+			      static_cast<double>(kMaxFocusSteps));
+	search_.x1 = search_.hi - kGoldenRatio * (search_.hi - search_.lo);
+	search_.x2 = search_.lo + kGoldenRatio * (search_.hi - search_.lo);
+	search_.evaluations = 0;
+	search_.evaluatingX1 = true;
+
+	focus_ = std::lround(search_.x1);
+	context.activeState.af.focus = focus_;
+}
+
+/**
+ * \brief Run one step of the golden-section search
+ * \param[in] context The shared IPA context
+ *
+ * Record the variance of the point evaluated in the previous frame, shrink the
+ * bracket and move the lens to the next point to evaluate. Each step reduces
+ * the bracket by the golden ratio, reusing one of the interior points.
+ *
+ * \return True if the search has converged, false otherwise
+ */
+bool Af::afGoldenSectionStep(IPAContext &context)
+{
+	if (search_.evaluatingX1)
+		search_.f1 = currentVariance_;
+	else
+		search_.f2 = currentVariance_;
+
+	/* Evaluate the second interior point before shrinking the bracket. */
+	if (++search_.evaluations == 1) {
+		search_.evaluatingX1 = false;
+		focus_ = std::lround(search_.x2);
+		context.activeState.af.focus = focus_;
+		return false;
+	}
+
+	if (search_.f1 >= search_.f2) {
+		search_.hi = search_.x2;
+		search_.x2 = search_.x1;
+		search_.f2 = search_.f1;
+		search_.x1 = search_.hi - kGoldenRatio * (search_.hi - search_.lo);
+		search_.evaluatingX1 = true;
+	} else {
+		search_.lo = search_.x1;
+		search_.x1 = search_.x2;
+		search_.f1 = search_.f2;
+		search_.x2 = search_.lo + kGoldenRatio * (search_.hi - search_.lo);
+		search_.evaluatingX1 = false;
+	}
+
+	if (search_.hi - search_.lo <= kFastFineRange) {
+		bool first = search_.f1 >= search_.f2;
+
+		bestFocus_ = std::lround(first ? search_.x1 : search_.x2);
+		focus_ = bestFocus_;
+		context.activeState.af.focus = bestFocus_;
+		context.activeState.af.maxVariance = first ? search_.f1 : search_.f2;
+
+		LOG(IPU3Af, Debug)
+			<< "Golden-section search converged to " << bestFocus_
+			<< " after " << search_.evaluations << " evaluations";
+		return true;
+	}
+
+	focus_ = std::lround(search_.evaluatingX1 ? search_.x1 : search_.x2);
+	context.activeState.af.focus = focus_;
+	return false;
+}
+
+/**
+ * \brief AF fast scan
+ * \param[in] context The shared IPA context
+ *
+ * Find a near focused image using a large coarse step, and refine the lens
+ * position with a golden-section search around it.
+ */
+void Af::afFastScan(IPAContext &context)
+{
+	if (afNeedIgnoreFrame())
+		return;
+
+	if (!coarseCompleted_) {
+		if (afScan(context, kFastCoarseSearchStep)) {
+			coarseCompleted_ = true;
+			afGoldenSectionStart(context);
+		}
+		return;
+	}
+
+	if (afGoldenSectionStep(context)) {
+		context.activeState.af.stable = true;
+		fineCompleted_ = true;
+	}
+}
+
 /**
  * \brief AF reset
  * \param[in] context The shared IPA context
@@ -264,6 +437,7 @@ void Af::afReset(IPAContext &context)
 	coarseCompleted_ = false;
 	fineCompleted_ = false;
 	maxStep_ = kMaxFocusSteps;
+	search_ = {};
 }
 
 /**
@@ -444,8 +618,16 @@ void Af::process(IPAContext &context, [[maybe_unused]] const uint32_t frame,
 	currentVariance_ = afEstimateVariance(y_items, !coarseCompleted_);
 
 	if (!context.activeState.af.stable) {
-		afCoarseScan(context);
-		afFineScan(context);
+		if (fastSearch_) {
+			afFastScan(context);
+		} else {
+			afCoarseScan(context);
+			afFineScan(context);
+		}
+
+		if (context.activeState.af.stable)
+			lastFocus_ = { true, context.activeState.af.focus,
+				       context.activeState.af.maxVariance };
 	} else {
 		if (afIsOutOfFocus(context))
 			afReset(context);
@@ -30,6 +30,7 @@ public:
 	Af();
 	~Af() = default;
 
+	int init(IPAContext &context, const YamlObject &tuningData) override;
 	int configure(IPAContext &context, const IPAConfigInfo &configInfo) override;
 	void prepare(IPAContext &context, const uint32_t frame,
 		     IPAFrameContext &frameContext,
@@ -43,6 +44,9 @@ private:
 	void afCoarseScan(IPAContext &context);
 	void afFineScan(IPAContext &context);
 	bool afScan(IPAContext &context, int min_step);
+	void afFastScan(IPAContext &context);
+	void afGoldenSectionStart(IPAContext &context);
+	bool afGoldenSectionStep(IPAContext &context);
 	void afReset(IPAContext &context);
 	bool afNeedIgnoreFrame();
 	void afIgnoreFrameReset();
@@ -66,6 +70,30 @@ private:
 	bool coarseCompleted_;
 	/* If the fine scan completes, it is set to true. */
 	bool fineCompleted_;
+
+	/* Use a coarse scan followed by a golden-section search. */
+	bool fastSearch_;
+	/* Start from the last focus position of the previous session. */
+	bool reuseFocus_;
+
+	/* The golden-section search state of the fast search. */
+	struct {
+		double lo;
+		double hi;
+		double x1;
+		double x2;
+		double f1;
+		double f2;
+		unsigned int evaluations;
+		bool evaluatingX1;
+	} search_;
+
+	/* The last stable focus position, for the next session. */
+	struct {
+		bool valid;
+		uint32_t focus;
+		double variance;
+	} lastFocus_;
 };
 
 } /* namespace ipa::ipu3::algorithms */
@@ -7,8 +7,8 @@
 
 #include "tone_mapping.h"
 
-#include <cmath>
 #include <string.h>
+#include <vector>
 
 /**
  * \file tone_mapping.h
@@ -18,6 +18,21 @@ namespace libcamera {
 
 namespace ipa::ipu3::algorithms {
 
+namespace {
+
+/* The gamma correction table entries are evenly spaced. */
+std::vector<double> gammaSamples()
+{
+	std::vector<double> samples(IPU3_UAPI_GAMMA_CORR_LUT_ENTRIES);
+
+	for (unsigned int i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<double>(i) / (samples.size() - 1);
+
+	return samples;
+}
+
+} /* namespace */
+
 /**
  * \class ToneMapping
  * \brief A class to handle tone mapping based on gamma
@@ -26,8 +41,9 @@ namespace ipa::ipu3::algorithms {
  * generated based on a gamma parameter.
  */
 
+/* The output values are expressed on 13 bits. */
 ToneMapping::ToneMapping()
-	: gamma_(1.0)
+	: gamma_(1.0), gammaLut_(gammaSamples(), 8191)
 {
 }
 
@@ -55,7 +71,8 @@ int ToneMapping::configure(IPAContext &context,
  * \param[out] params The IPU3 parameters
  *
  * Populate the IPU3 parameter structure with our tone mapping look up table and
- * enable the gamma control module in the processing blocks.
+ * enable the gamma control module in the processing blocks. The update of the
+ * block is skipped by the IPA module when the table hasn't changed.
  */
 void ToneMapping::prepare([[maybe_unused]] IPAContext &context,
 			  [[maybe_unused]] const uint32_t frame,
@@ -82,7 +99,7 @@ void ToneMapping::prepare([[maybe_unused]] IPAContext &context,
  * \param[out] metadata Metadata for the frame, to be filled by the algorithm
  *
  * The tone mapping look up table is generated as an inverse power curve from
- * our gamma setting.
+ * our gamma setting. The tables are cached per gamma value.
  */
 void ToneMapping::process(IPAContext &context, [[maybe_unused]] const uint32_t frame,
 			  [[maybe_unused]] IPAFrameContext &frameContext,
@@ -101,14 +118,9 @@ void ToneMapping::process(IPAContext &context, [[maybe_unused]] const uint32_t f
 
 	struct ipu3_uapi_gamma_corr_lut &lut =
 		context.activeState.toneMapping.gammaCorrection;
+	Span<const uint16_t> values = gammaLut_.get(gamma_);
 
-	for (uint32_t i = 0; i < std::size(lut.lut); i++) {
-		double j = static_cast<double>(i) / (std::size(lut.lut) - 1);
-		double gamma = std::pow(j, 1.0 / gamma_);
-
-		/* The output value is expressed on 13 bits. */
-		lut.lut[i] = gamma * 8191;
-	}
+	memcpy(lut.lut, values.data(), values.size_bytes());
 
 	context.activeState.toneMapping.gamma = gamma_;
 }
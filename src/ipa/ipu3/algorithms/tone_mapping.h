@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "libipa/gamma_lut.h"
+
 #include "algorithm.h"
 
 namespace libcamera {
@@ -28,6 +30,7 @@ public:
 
 private:
 	double gamma_;
+	GammaLut gammaLut_;
 };
 
 } /* namespace ipa::ipu3::algorithms */
@@ -11,6 +11,7 @@
 #include <limits>
 #include <map>
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
 #include <utility>
 #include <vector>
@@ -18,7 +19,6 @@
 #include <linux/intel-ipu3.h>
 #include <linux/v4l2-controls.h>
 
-#include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
@@ -39,6 +39,9 @@
 #include "algorithms/blc.h"
 #include "algorithms/tone_mapping.h"
 #include "libipa/camera_sensor_helper.h"
+#include "libipa/params_tracker.h"
+#include "libipa/persistent_state.h"
+#include "libipa/tuning_data.h"
 
 #include "ipa_context.h"
 
@@ -172,6 +175,9 @@ private:
 	void updateSessionConfiguration(const ControlInfoMap &sensorControls);
 
 	void setControls(unsigned int frame);
+	void loadState();
+	void storeState();
+	void skipUnchangedParams(const uint32_t frame, ipu3_uapi_params *params);
 	void calculateBdsGrid(const Size &bdsOutputSize);
 
 	std::map<unsigned int, MappedFrameBuffer> buffers_;
@@ -186,6 +192,15 @@ private:
 
 	/* Local parameter storage */
 	struct IPAContext context_;
+
+	/* Contents of the parameter blocks programmed to the ImgU */
+	ParamsTracker paramsTracker_;
+
+	/* AGC and AWB results persisted across camera sessions */
+	PersistentState state_;
+
+	/* Tuning data, shared with the other cameras using the same file */
+	std::shared_ptr<const YamlObject> tuningData_;
 };
 
 IPAIPU3::IPAIPU3()
@@ -317,18 +332,11 @@ int IPAIPU3::init(const IPASettings &settings,
 						   * 1.0s / sensorInfo.pixelRate;
 
 	/* Load the tuning data file. */
-	File file(settings.configurationFile);
-	if (!file.open(File::OpenModeFlag::ReadOnly)) {
-		int ret = file.error();
-		LOG(IPAIPU3, Error)
-			<< "Failed to open configuration file "
-			<< settings.configurationFile << ": " << strerror(-ret);
+	int ret = TuningData::load(settings.configurationFile, &tuningData_);
+	if (ret)
 		return ret;
-	}
 
-	std::unique_ptr<libcamera::YamlObject> data = YamlParser::parse(file);
-	if (!data)
-		return -EINVAL;
+	const YamlObject *data = tuningData_.get();
 
 	unsigned int version = (*data)["version"].get<uint32_t>(0);
 	if (version != 1) {
@@ -343,13 +351,15 @@ int IPAIPU3::init(const IPASettings &settings,
 		return -EINVAL;
 	}
 
-	int ret = createAlgorithms(context_, (*data)["algorithms"]);
+	ret = createAlgorithms(context_, (*data)["algorithms"]);
 	if (ret)
 		return ret;
 
 	/* Initialize controls. */
 	updateControls(sensorInfo, sensorControls, ipaControls);
 
+	state_.init("ipu3-" + settings.sensorModel);
+
 	return 0;
 }
 
@@ -358,6 +368,9 @@ int IPAIPU3::init(const IPASettings &settings,
  */
 int IPAIPU3::start()
 {
+	/* The ImgU configuration isn't retained across streaming sessions. */
+	paramsTracker_.reset();
+
 	/*
 	 * Set the sensors V4L2 controls before the first frame to ensure that
 	 * we have an expected and known configuration from the start.
@@ -373,6 +386,17 @@ int IPAIPU3::start()
 void IPAIPU3::stop()
 {
 	context_.frameContexts.clear();
+
+	storeState();
+
+	const ParamsTracker::Statistics &stats = paramsTracker_.statistics();
+	if (stats.frames)
+		LOG(IPAIPU3, Debug)
+			<< "Updated " << stats.updated << " and skipped "
+			<< stats.skipped << " parameter blocks over "
+			<< stats.frames << " frames, "
+			<< static_cast<double>(stats.updated) / stats.frames
+			<< " updates per frame";
 }
 
 /**
@@ -501,6 +525,8 @@ int IPAIPU3::configure(const IPAConfigInfo &configInfo,
 			return ret;
 	}
 
+	loadState();
+
 	return 0;
 }
 
@@ -568,9 +594,50 @@ void IPAIPU3::fillParamsBuffer(const uint32_t frame, const uint32_t bufferId)
 	for (auto const &algo : algorithms())
 		algo->prepare(context_, frame, frameContext, params);
 
+	skipUnchangedParams(frame, params);
+
 	paramsBufferReady.emit(frame);
 }
 
+/**
+ * \brief Skip the update of parameter blocks that haven't changed
+ * \param[in] frame The frame number
+ * \param[in] params The IPU3 parameters
+ *
+ * Algorithms fill their parameter blocks for every frame, even when the values
+ * haven't changed. The kernel keeps the previous configuration of the blocks
+ * whose use flag is not set, clear the use flag of the blocks whose contents
+ * are identical to the ones last programmed to the ImgU, to avoid
+ * reprogramming the hardware needlessly.
+ */
+void IPAIPU3::skipUnchangedParams(const uint32_t frame,
+				  ipu3_uapi_params *params)
+{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(params);
+
+	paramsTracker_.startFrame();
+
+#define SKIP_UNCHANGED(flag, member)					\
+	if (params->use.flag &&						\
+	    !paramsTracker_.update(offsetof(ipu3_uapi_params, member),	\
+				   { data + offsetof(ipu3_uapi_params, member), \
+				     sizeof(ipu3_uapi_params::member) }))	\
+		params->use.flag = 0;
+
+	SKIP_UNCHANGED(acc_bnr, acc_param.bnr)
+	SKIP_UNCHANGED(acc_ccm, acc_param.ccm)
+	SKIP_UNCHANGED(acc_gamma, acc_param.gamma)
+	SKIP_UNCHANGED(acc_af, acc_param.af)
+	SKIP_UNCHANGED(acc_awb, acc_param.awb)
+	SKIP_UNCHANGED(obgrid_param, obgrid_param)
+
+#undef SKIP_UNCHANGED
+
+	LOG(IPAIPU3, Debug)
+		<< "Frame " << frame << ": updating "
+		<< paramsTracker_.frameUpdates() << " parameter blocks";
+}
+
 /**
  * \brief Process the statistics generated by the ImgU
  * \param[in] frame The frame number
@@ -658,6 +725,71 @@ void IPAIPU3::setControls(unsigned int frame)
 	setSensorControls.emit(frame, ctrls, lensCtrls);
 }
 
+/**
+ * \brief Seed the algorithms with the state of the previous session
+ *
+ * Restore the AGC and AWB results stored when the camera was last stopped, to
+ * shorten convergence when the camera is started. The values are clamped to
+ * the limits of the current configuration.
+ */
+void IPAIPU3::loadState()
+{
+	if (state_.load())
+		return;
+
+	const auto &configuration = context_.configuration;
+	auto &agc = context_.activeState.agc;
+	auto &awb = context_.activeState.awb;
+
+	auto exposureTime = state_.get("agc.exposure_time");
+	auto gain = state_.get("agc.analogue_gain");
+	if (exposureTime && gain && configuration.sensor.lineDuration > 0s) {
+		utils::Duration exposure = std::clamp<utils::Duration>(*exposureTime * 1.0us,
+								       configuration.agc.minShutterSpeed,
+								       configuration.agc.maxShutterSpeed);
+		agc.exposure = exposure / configuration.sensor.lineDuration;
+		agc.gain = std::clamp(*gain, configuration.agc.minAnalogueGain,
+				      configuration.agc.maxAnalogueGain);
+	}
+
+	auto red = state_.get("awb.red_gain");
+	auto green = state_.get("awb.green_gain");
+	auto blue = state_.get("awb.blue_gain");
+	auto temperature = state_.get("awb.colour_temperature");
+	if (red && green && blue && temperature &&
+	    *red > 0 && *green > 0 && *blue > 0 && *temperature > 0) {
+		awb.gains.red = *red;
+		awb.gains.green = *green;
+		awb.gains.blue = *blue;
+		awb.temperatureK = *temperature;
+	}
+
+	LOG(IPAIPU3, Debug) << "Restored algorithms state";
+}
+
+/**
+ * \brief Store the state of the algorithms for the next session
+ */
+void IPAIPU3::storeState()
+{
+	if (!state_.isEnabled())
+		return;
+
+	const auto &agc = context_.activeState.agc;
+	const auto &awb = context_.activeState.awb;
+
+	state_.set("agc.exposure_time",
+		   (agc.exposure * context_.configuration.sensor.lineDuration)
+			   .get<std::micro>());
+	state_.set("agc.analogue_gain", agc.gain);
+	state_.set("awb.red_gain", awb.gains.red);
+	state_.set("awb.green_gain", awb.gains.green);
+	state_.set("awb.blue_gain", awb.gains.blue);
+	state_.set("awb.colour_temperature", awb.temperatureK);
+
+	state_.store();
+}
+
 } /* namespace ipa::ipu3 */
 
 /**
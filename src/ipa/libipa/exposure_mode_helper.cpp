@@ -57,6 +57,11 @@ namespace ipa {
  * constraints. Any gain that is needed will be applied as analogue gain first
  * until the hardware's limit is reached, following which digital gain will be
  * used.
+ *
+ * The stages, clamped to the limits, are converted to a table of exposure
+ * segments when the limits are set. Splitting an exposure then only requires
+ * a binary search in the table, keeping the per-frame cost of AEGC algorithms
+ * independent of the number of stages.
  */
 
 /**
@@ -80,6 +85,8 @@ ExposureModeHelper::ExposureModeHelper(const Span<std::pair<utils::Duration, dou
 		shutters_.push_back(s);
 		gains_.push_back(g);
 	}
+
+	updateSegments();
 }
 
 /**
@@ -102,10 +109,52 @@ void ExposureModeHelper::setLimits(utils::Duration minShutter,
 				   utils::Duration maxShutter,
 				   double minGain, double maxGain)
 {
+	if (minShutter == minShutter_ && maxShutter == maxShutter_ &&
+	    minGain == minGain_ && maxGain == maxGain_)
+		return;
+
 	minShutter_ = minShutter;
 	maxShutter_ = maxShutter;
 	minGain_ = minGain;
 	maxGain_ = maxGain;
+
+	updateSegments();
+}
+
+/*
+ * Precompute the exposure segments from the stages clamped to the limits.
+ * Within a segment, the exposure is divided by the segment gain to obtain the
+ * shutter time, and the gain is then adjusted to compensate for the shutter
+ * time clamping. Each stage produces two segments, the first one ramping up
+ * the shutter time with the gain of the previous stage, and the second one
+ * ramping up the gain to the gain of the stage. A final segment covers all
+ * exposures above the last stage.
+ *
+ * The segment used for an exposure is the first one whose upper exposure bound
+ * is large enough. Storing the running maximum of the bounds makes the table
+ * monotonic, allowing a binary search, without changing the segment selected
+ * for any exposure.
+ */
+void ExposureModeHelper::updateSegments()
+{
+	segments_.clear();
+
+	utils::Duration bound = 0s;
+	double stageGain = 1.0;
+
+	for (unsigned int stage = 0; stage < gains_.size(); stage++) {
+		double lastStageGain = stage == 0 ? 1.0 : clampGain(gains_[stage - 1]);
+		utils::Duration stageShutter = clampShutter(shutters_[stage]);
+		stageGain = clampGain(gains_[stage]);
+
+		bound = std::max<utils::Duration>(bound, stageShutter * lastStageGain);
+		segments_.push_back({ bound, clampGain(lastStageGain) });
+
+		bound = std::max<utils::Duration>(bound, stageShutter * stageGain);
+		segments_.push_back({ bound, stageGain });
+	}
+
+	segments_.push_back({ utils::Duration::max(), stageGain });
 }
 
 utils::Duration ExposureModeHelper::clampShutter(utils::Duration shutter) const
@@ -165,50 +214,21 @@ ExposureModeHelper::splitExposure(utils::Duration exposure) const
 	if (shutterFixed && gainFixed)
 		return { minShutter_, minGain_, exposure / (minShutter_ * minGain_) };
 
-	utils::Duration shutter;
-	double stageGain;
-	double gain;
-
-	for (unsigned int stage = 0; stage < gains_.size(); stage++) {
-		double lastStageGain = stage == 0 ? 1.0 : clampGain(gains_[stage - 1]);
-		utils::Duration stageShutter = clampShutter(shutters_[stage]);
-		stageGain = clampGain(gains_[stage]);
-
-		/*
-		 * We perform the clamping on both shutter and gain in case the
-		 * helper has had limits set that prevent those values being
-		 * lowered beyond a certain minimum...this can happen at runtime
-		 * for various reasons and so would not be known when the stage
-		 * limits are initialised.
-		 */
-
-		if (stageShutter * lastStageGain >= exposure) {
-			shutter = clampShutter(exposure / clampGain(lastStageGain));
-			gain = clampGain(exposure.count() / shutter.count());
-
-			return { shutter, gain, exposure / (shutter * gain) };
-		}
-
-		if (stageShutter * stageGain >= exposure) {
-			shutter = clampShutter(exposure / clampGain(stageGain));
-			gain = clampGain(exposure.count() / shutter.count());
-
-			return { shutter, gain, exposure / (shutter * gain) };
-		}
-	}
-
 	/*
-	 * From here on all we can do is max out the shutter time, followed by
-	 * the analogue gain. If we still haven't achieved the target we send
-	 * the rest of the exposure time to digital gain. If we were given no
-	 * stages to use then set stageGain to 1.0 so that shutter time is maxed
-	 * before gain touched at all.
+	 * The segments are computed from the stages clamped to the limits, as
+	 * the limits can change at runtime for various reasons and so would
+	 * not be known when the stage limits are initialised. Find the first
+	 * segment that can meet the required exposure. If none of the stages
+	 * can, the last segment maxes out the shutter time, followed by the
+	 * analogue gain, and sends the rest of the exposure to digital gain.
 	 */
-	if (gains_.empty())
-		stageGain = 1.0;
+	auto segment = std::lower_bound(segments_.begin(), segments_.end(), exposure,
+					[](const Segment &s, utils::Duration e) {
+						return s.exposure < e;
+					});
 
-	shutter = clampShutter(exposure / clampGain(stageGain));
-	gain = clampGain(exposure.count() / shutter.count());
+	utils::Duration shutter = clampShutter(exposure / clampGain(segment->gain));
+	double gain = clampGain(exposure.count() / shutter.count());
 
 	return { shutter, gain, exposure / (shutter * gain) };
 }
@@ -36,11 +36,19 @@ public:
 	double maxGain() const { return maxGain_; }
 
 private:
+	struct Segment {
+		utils::Duration exposure;
+		double gain;
+	};
+
+	void updateSegments();
+
 	utils::Duration clampShutter(utils::Duration shutter) const;
 	double clampGain(double gain) const;
 
 	std::vector<utils::Duration> shutters_;
 	std::vector<double> gains_;
+	std::vector<Segment> segments_;
 
 	utils::Duration minShutter_;
 	utils::Duration maxShutter_;
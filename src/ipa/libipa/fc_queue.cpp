@@ -84,6 +84,21 @@ namespace ipa {
  * queuing more in-flight requests to the IPA module than the queue size. If an
  * overflow condition is detected, the queue will log a fatal error.
  *
+ * IPA modules that process frames in multiple stages running in different
+ * threads, such as a statistics parsing stage feeding an algorithm stage, can
+ * hand frame contexts over between the stages without locking. A stage obtains
+ * exclusive access to a context with acquire(), and returns it with release()
+ * once done. The release synchronizes with the next acquire() of the same
+ * frame, making all the context fields written by the releasing stage visible
+ * to the acquiring stage. Contexts that are acquired can't be reallocated, an
+ * attempt to do so indicates that the pipeline runs further ahead of the
+ * slowest stage than the queue size, and is reported as a fatal error. The
+ * isAvailable() function allows detecting this condition beforehand.
+ *
+ * The alloc(), get() and clear() functions are not thread-safe, and shall be
+ * called from a single thread. Only acquire(), release() and isAvailable() may
+ * be called concurrently.
+ *
  * IPA module-specific frame context implementations shall inherit from the
  * FrameContext base class to support the minimum required features for a
  * FrameContext.
@@ -135,6 +150,45 @@ namespace ipa {
  * \return A reference to the FrameContext for sequence \a frame
  */
 
+/**
+ * \fn FCQueue::isAvailable(uint32_t frame) const
+ * \brief Check if the queue slot for \a frame can be allocated
+ * \param[in] frame The frame context sequence number
+ *
+ * The slot used by \a frame is available unless it is currently acquired by a
+ * processing stage, in which case allocating \a frame would overrun the queue.
+ *
+ * \return True if the slot for \a frame can be allocated, false otherwise
+ */
+
+/**
+ * \fn FCQueue::acquire(uint32_t frame)
+ * \brief Obtain exclusive access to the FrameContext for the \a frame
+ * \param[in] frame The frame context sequence number
+ *
+ * Acquire the FrameContext for \a frame for a processing stage. The context
+ * shall have been allocated with alloc() or get(), and shall be returned with
+ * release() when the stage completes. This function is thread-safe and does not
+ * block.
+ *
+ * If the context is held by another stage, hasn't been allocated yet or has
+ * been overwritten by a newer frame, this function returns nullptr. The last
+ * condition indicates a queue overflow and is logged as an error.
+ *
+ * \return A pointer to the FrameContext for sequence \a frame, or nullptr if
+ * the context can't be acquired
+ */
+
+/**
+ * \fn FCQueue::release(uint32_t frame)
+ * \brief Release the FrameContext for the \a frame
+ * \param[in] frame The frame context sequence number
+ *
+ * Return the FrameContext acquired with acquire() to the queue. All writes to
+ * the context performed before this call are visible to the next stage that
+ * acquires the context.
+ */
+
 } /* namespace ipa */
 
 } /* namespace libcamera */
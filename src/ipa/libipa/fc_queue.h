@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
@@ -32,7 +33,7 @@ class FCQueue
 {
 public:
 	FCQueue(unsigned int size)
-		: contexts_(size)
+		: contexts_(size), tags_(size)
 	{
 	}
 
@@ -40,11 +41,34 @@ public:
 	{
 		for (FrameContext &ctx : contexts_)
 			ctx.frame = 0;
+
+		for (std::atomic<uint64_t> &tag : tags_)
+			tag.store(0, std::memory_order_release);
+	}
+
+	bool isAvailable(uint32_t frame) const
+	{
+		uint64_t current = tags_[frame % tags_.size()].load(std::memory_order_acquire);
+		return !tagAcquired(current);
 	}
 
 	FrameContext &alloc(const uint32_t frame)
 	{
-		FrameContext &frameContext = contexts_[frame % contexts_.size()];
+		unsigned int index = frame % contexts_.size();
+		FrameContext &frameContext = contexts_[index];
+
+		/*
+		 * A slot still acquired by a processing stage means that the
+		 * pipeline runs further ahead of the slowest stage than the
+		 * queue size. Reusing the slot would corrupt the context being
+		 * processed.
+		 */
+		uint64_t current = tags_[index].load(std::memory_order_acquire);
+		if (tagAcquired(current))
+			LOG(FCQueue, Fatal)
+				<< "Frame context queue overrun: frame " << frame
+				<< " allocated while frame " << tagFrame(current)
+				<< " is being processed";
 
 		/*
 		 * Do not re-initialise if a get() call has already fetched this
@@ -63,12 +87,21 @@ public:
 		else
 			init(frameContext, frame);
 
+		tags_[index].store(tag(frame, false), std::memory_order_release);
+
 		return frameContext;
 	}
 
 	FrameContext &get(uint32_t frame)
 	{
-		FrameContext &frameContext = contexts_[frame % contexts_.size()];
+		unsigned int index = frame % contexts_.size();
+		FrameContext &frameContext = contexts_[index];
+
+		uint64_t current = tags_[index].load(std::memory_order_acquire);
+		if (tagAcquired(current))
+			LOG(FCQueue, Fatal)
+				<< "Frame context for " << tagFrame(current)
+				<< " is being processed, can't get frame " << frame;
 
 		/*
 		 * If the IPA algorithms try to access a frame context slot which
@@ -100,9 +133,38 @@ public:
 
 		init(frameContext, frame);
 
+		tags_[index].store(tag(frame, false), std::memory_order_release);
+
 		return frameContext;
 	}
 
+	FrameContext *acquire(uint32_t frame)
+	{
+		unsigned int index = frame % contexts_.size();
+		uint64_t expected = tag(frame, false);
+
+		if (tags_[index].compare_exchange_strong(expected, tag(frame, true),
+							 std::memory_order_acquire,
+							 std::memory_order_relaxed))
+			return &contexts_[index];
+
+		if (tagFrame(expected) > frame)
+			LOG(FCQueue, Error)
+				<< "Frame context for " << frame
+				<< " has been overwritten by " << tagFrame(expected);
+
+		return nullptr;
+	}
+
+	void release(uint32_t frame)
+	{
+		unsigned int index = frame % contexts_.size();
+
+		ASSERT(tags_[index].load(std::memory_order_relaxed) == tag(frame, true));
+
+		tags_[index].store(tag(frame, false), std::memory_order_release);
+	}
+
 private:
 	void init(FrameContext &frameContext, const uint32_t frame)
 	{
@@ -110,7 +172,27 @@ private:
 		frameContext.frame = frame;
 	}
 
+	/*
+	 * The tag stores the frame number of the slot in the upper 32 bits,
+	 * and whether the slot is acquired by a processing stage in bit 0.
+	 */
+	static constexpr uint64_t tag(uint32_t frame, bool acquired)
+	{
+		return (static_cast<uint64_t>(frame) << 32) | acquired;
+	}
+
+	static constexpr uint32_t tagFrame(uint64_t tag)
+	{
+		return tag >> 32;
+	}
+
+	static constexpr bool tagAcquired(uint64_t tag)
+	{
+		return tag & 1;
+	}
+
 	std::vector<FrameContext> contexts_;
+	std::vector<std::atomic<uint64_t>> tags_;
 };
 
 } /* namespace ipa */
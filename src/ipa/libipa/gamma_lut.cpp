@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Gamma lookup table generation
+ */
+
+#include "gamma_lut.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+/**
+ * \file gamma_lut.h
+ * \brief Gamma lookup table generation
+ */
+
+namespace libcamera {
+
+namespace ipa {
+
+/**
+ * \class GammaLut
+ * \brief Generate and cache gamma lookup tables
+ *
+ * ISPs implement gamma correction with a lookup table sampling the gamma curve
+ * at fixed input positions. Generating the table takes one std::pow() call per
+ * entry, which is expensive for large tables, while the gamma value seldom
+ * changes.
+ *
+ * The GammaLut class generates tables for the input positions and output
+ * scale of an ISP, and caches the tables of the last few gamma values. A table
+ * entry is computed as \f$ scale \times sample^{1/gamma} \f$, truncated to an
+ * integer.
+ */
+
+/**
+ * \brief Construct a GammaLut
+ * \param[in] samples The input positions of the table entries, in the [0, 1]
+ * interval
+ * \param[in] scale The output value corresponding to a full-scale input
+ */
+GammaLut::GammaLut(std::vector<double> samples, double scale)
+	: samples_(std::move(samples)), scale_(scale), useCount_(0)
+{
+	cache_.reserve(kCacheSize);
+}
+
+/**
+ * \brief Retrieve the lookup table for a gamma value
+ * \param[in] gamma The gamma value
+ *
+ * The table is generated if it isn't cached already, replacing the least
+ * recently used table if the cache is full.
+ *
+ * \return The lookup table, valid until the next call to this function
+ */
+Span<const uint16_t> GammaLut::get(double gamma)
+{
+	useCount_++;
+
+	auto it = std::find_if(cache_.begin(), cache_.end(),
+			       [gamma](const Entry &entry) {
+				       return entry.gamma == gamma;
+			       });
+	if (it != cache_.end()) {
+		it->lastUse = useCount_;
+		return it->lut;
+	}
+
+	if (cache_.size() < kCacheSize) {
+		it = cache_.emplace(cache_.end());
+		it->lut.resize(samples_.size());
+	} else {
+		it = std::min_element(cache_.begin(), cache_.end(),
+				      [](const Entry &a, const Entry &b) {
+					      return a.lastUse < b.lastUse;
+				      });
+	}
+
+	it->gamma = gamma;
+	it->lastUse = useCount_;
+
+	for (unsigned int i = 0; i < samples_.size(); i++)
+		it->lut[i] = std::pow(samples_[i], 1.0 / gamma) * scale_;
+
+	return it->lut;
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
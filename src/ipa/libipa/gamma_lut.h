@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Gamma lookup table generation
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+namespace libcamera {
+
+namespace ipa {
+
+class GammaLut
+{
+public:
+	GammaLut(std::vector<double> samples, double scale);
+
+	Span<const uint16_t> get(double gamma);
+
+private:
+	static constexpr unsigned int kCacheSize = 4;
+
+	struct Entry {
+		double gamma;
+		unsigned int lastUse;
+		std::vector<uint16_t> lut;
+	};
+
+	std::vector<double> samples_;
+	double scale_;
+
+	std::vector<Entry> cache_;
+	unsigned int useCount_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
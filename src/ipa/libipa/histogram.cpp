@@ -6,6 +6,7 @@
  */
 #include "histogram.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include <libcamera/base/log.h>
@@ -26,6 +27,16 @@ namespace ipa {
  * This class stores a cumulative frequency histogram, which is a mapping that
  * counts the cumulative number of observations in all of the bins up to the
  * specified bin. It can be used to find quantiles and averages between quantiles.
+ *
+ * Algorithms usually compute a histogram for every frame. To avoid allocating
+ * memory each time, a Histogram can be kept across frames and its data
+ * replaced with setData(), which reuses the storage of the cumulative array.
+ *
+ * The results of the last few quantile() and interQuantileMean() queries are
+ * cached until the data is replaced, as algorithms often evaluate the same
+ * quantiles multiple times per frame, for instance for the constraints of
+ * different modes. As the cache is updated by the const query functions, a
+ * Histogram shall not be queried concurrently from multiple threads.
  */
 
 /**
@@ -43,10 +54,7 @@ namespace ipa {
  */
 Histogram::Histogram(Span<const uint32_t> data)
 {
-	cumulative_.resize(data.size() + 1);
-	cumulative_[0] = 0;
-	for (const auto &[i, value] : utils::enumerate(data))
-		cumulative_[i + 1] = cumulative_[i] + value;
+	setData(data);
 }
 
 /**
@@ -56,6 +64,56 @@ Histogram::Histogram(Span<const uint32_t> data)
  * \param[in] transform The transformation function to apply to every bin
  */
 
+/**
+ * \brief Replace the histogram data
+ * \param[in] data A (non-cumulative) histogram
+ *
+ * The cumulative array is computed in place, reusing the memory of the
+ * previous data when the number of bins doesn't increase.
+ */
+void Histogram::setData(Span<const uint32_t> data)
+{
+	setData(data, 0);
+}
+
+/**
+ * \brief Replace the histogram data with bins in fixed-point format
+ * \param[in] data A (non-cumulative) histogram
+ * \param[in] shift The number of fractional bits of the bins to discard
+ *
+ * Some ISPs report histogram bins in fixed-point format. This function
+ * discards the \a shift fractional bits of every bin while computing the
+ * cumulative array. It is equivalent to, but faster than, calling
+ * setData(Span<const uint32_t> data, Transform transform) with a shift
+ * transform function.
+ */
+void Histogram::setData(Span<const uint32_t> data, unsigned int shift)
+{
+	cumulative_.resize(data.size() + 1);
+
+	/*
+	 * Keep the loop simple, with the running sum in a local variable, to
+	 * let the compiler vectorise the unpacking.
+	 */
+	uint64_t *cumulative = cumulative_.data();
+	uint64_t sum = 0;
+
+	cumulative[0] = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		sum += data[i] >> shift;
+		cumulative[i + 1] = sum;
+	}
+
+	invalidateCache();
+}
+
+/**
+ * \fn Histogram::setData(Span<const uint32_t> data, Transform transform)
+ * \brief Replace the histogram data
+ * \param[in] data A (non-cumulative) histogram
+ * \param[in] transform The transformation function to apply to every bin
+ */
+
 /**
  * \fn Histogram::bins()
  * \brief Retrieve the number of bins currently used by the Histogram
@@ -103,6 +161,23 @@ uint64_t Histogram::cumulativeFrequency(double bin) const
  * \return The fractional bin of the point
  */
 double Histogram::quantile(double q, uint32_t first, uint32_t last) const
+{
+	for (unsigned int i = 0; i < quantileCacheSize_; i++) {
+		const QuantileQuery &query = quantileCache_[i];
+		if (query.q == q && query.first == first && query.last == last)
+			return query.result;
+	}
+
+	double result = computeQuantile(q, first, last);
+
+	quantileCache_[quantileCacheNext_] = { q, first, last, result };
+	quantileCacheNext_ = (quantileCacheNext_ + 1) % kCacheSize;
+	quantileCacheSize_ = std::min(quantileCacheSize_ + 1, kCacheSize);
+
+	return result;
+}
+
+double Histogram::computeQuantile(double q, uint32_t first, uint32_t last) const
 {
 	if (last == UINT_MAX)
 		last = cumulative_.size() - 2;
@@ -140,6 +215,25 @@ double Histogram::quantile(double q, uint32_t first, uint32_t last) const
  * \return The mean histogram bin value between the two quantiles
  */
 double Histogram::interQuantileMean(double lowQuantile, double highQuantile) const
+{
+	for (unsigned int i = 0; i < meanCacheSize_; i++) {
+		const MeanQuery &query = meanCache_[i];
+		if (query.lowQuantile == lowQuantile &&
+		    query.highQuantile == highQuantile)
+			return query.result;
+	}
+
+	double result = computeInterQuantileMean(lowQuantile, highQuantile);
+
+	meanCache_[meanCacheNext_] = { lowQuantile, highQuantile, result };
+	meanCacheNext_ = (meanCacheNext_ + 1) % kCacheSize;
+	meanCacheSize_ = std::min(meanCacheSize_ + 1, kCacheSize);
+
+	return result;
+}
+
+double Histogram::computeInterQuantileMean(double lowQuantile,
+					   double highQuantile) const
 {
 	ASSERT(highQuantile > lowQuantile);
 	/* Proportion of pixels which lies below lowQuantile */
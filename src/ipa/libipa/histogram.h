@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <array>
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
@@ -29,11 +30,22 @@ public:
 	template<typename Transform,
 		 std::enable_if_t<std::is_invocable_v<Transform, uint32_t>> * = nullptr>
 	Histogram(Span<const uint32_t> data, Transform transform)
+	{
+		setData(data, transform);
+	}
+
+	void setData(Span<const uint32_t> data);
+	void setData(Span<const uint32_t> data, unsigned int shift);
+
+	template<typename Transform,
+		 std::enable_if_t<std::is_invocable_v<Transform, uint32_t>> * = nullptr>
+	void setData(Span<const uint32_t> data, Transform transform)
 	{
 		cumulative_.resize(data.size() + 1);
 		cumulative_[0] = 0;
 		for (const auto &[i, value] : utils::enumerate(data))
 			cumulative_[i + 1] = cumulative_[i] + transform(value);
+		invalidateCache();
 	}
 
 	size_t bins() const { return cumulative_.size() - 1; }
@@ -43,7 +55,38 @@ public:
 	double interQuantileMean(double lowQuantile, double hiQuantile) const;
 
 private:
+	static constexpr unsigned int kCacheSize = 4;
+
+	struct QuantileQuery {
+		double q;
+		uint32_t first;
+		uint32_t last;
+		double result;
+	};
+
+	struct MeanQuery {
+		double lowQuantile;
+		double highQuantile;
+		double result;
+	};
+
+	void invalidateCache()
+	{
+		quantileCacheSize_ = 0;
+		meanCacheSize_ = 0;
+	}
+
+	double computeQuantile(double q, uint32_t first, uint32_t last) const;
+	double computeInterQuantileMean(double lowQuantile, double hiQuantile) const;
+
 	std::vector<uint64_t> cumulative_;
+
+	mutable std::array<QuantileQuery, kCacheSize> quantileCache_;
+	mutable unsigned int quantileCacheSize_ = 0;
+	mutable unsigned int quantileCacheNext_ = 0;
+	mutable std::array<MeanQuery, kCacheSize> meanCache_;
+	mutable unsigned int meanCacheSize_ = 0;
+	mutable unsigned int meanCacheNext_ = 0;
 };
 
 } /* namespace ipa */
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Track changes to ISP parameter blocks
+ */
+
+#include "params_tracker.h"
+
+#include <string.h>
+
+/**
+ * \file params_tracker.h
+ * \brief Track changes to ISP parameter blocks
+ */
+
+namespace libcamera {
+
+namespace ipa {
+
+/**
+ * \class ParamsTracker
+ * \brief Track the ISP parameter blocks programmed to the hardware
+ *
+ * ISP parameter buffers are split in blocks, each configuring one processing
+ * block of the ISP, and flagged individually for update. Many algorithms fill
+ * their block for every frame, even when the values haven't changed, which
+ * makes the kernel driver reprogram the hardware needlessly.
+ *
+ * The ParamsTracker keeps a copy of the last contents of each block flagged
+ * for update. After the algorithms have prepared the parameters for a frame,
+ * the IPA module calls update() for every block flagged for update, and
+ * clears the update flag of the blocks whose contents haven't changed since
+ * they have last been programmed.
+ *
+ * Blocks are identified by an IPA-specific numerical ID, which is usually the
+ * block offset in the parameters buffer. As the tracker assumes that the
+ * hardware keeps the configuration of blocks that are not flagged for update,
+ * the IPA module shall reset() the tracker when the hardware configuration is
+ * lost, for instance when starting streaming.
+ *
+ * The tracker also collects statistics on the number of blocks updated and
+ * skipped, to evaluate how effective the tracking is.
+ */
+
+/**
+ * \struct ParamsTracker::Statistics
+ * \brief Counters of updated and skipped parameter blocks
+ *
+ * \var ParamsTracker::Statistics::frames
+ * \brief The number of frames
+ *
+ * \var ParamsTracker::Statistics::updated
+ * \brief The number of blocks that have been updated
+ *
+ * \var ParamsTracker::Statistics::skipped
+ * \brief The number of blocks flagged for update whose contents hadn't changed
+ */
+
+ParamsTracker::ParamsTracker()
+	: frameUpdates_(0), statistics_{}
+{
+}
+
+/**
+ * \brief Forget the contents of all blocks
+ *
+ * After a reset, the next update() call for each block reports the block as
+ * changed. The statistics are not reset.
+ */
+void ParamsTracker::reset()
+{
+	blocks_.clear();
+}
+
+/**
+ * \brief Start tracking the parameter blocks of a new frame
+ */
+void ParamsTracker::startFrame()
+{
+	frameUpdates_ = 0;
+	statistics_.frames++;
+}
+
+/**
+ * \brief Record the contents of a block flagged for update
+ * \param[in] id The block ID
+ * \param[in] data The block contents
+ *
+ * Blocks are expected to have a constant size. A block whose size differs
+ * from the recorded contents is reported as changed.
+ *
+ * \return True if the block contents have changed since the last update, or
+ * false if the block update can be skipped
+ */
+bool ParamsTracker::update(unsigned int id, Span<const uint8_t> data)
+{
+	std::vector<uint8_t> &block = blocks_[id];
+
+	if (block.size() == data.size() &&
+	    !memcmp(block.data(), data.data(), data.size())) {
+		statistics_.skipped++;
+		return false;
+	}
+
+	block.assign(data.begin(), data.end());
+
+	frameUpdates_++;
+	statistics_.updated++;
+	return true;
+}
+
+/**
+ * \fn ParamsTracker::update(unsigned int id, const T &block)
+ * \copybrief ParamsTracker::update(unsigned int id, Span<const uint8_t> data)
+ * \tparam T The block type
+ * \param[in] id The block ID
+ * \param[in] block The block
+ * \return True if the block contents have changed since the last update, or
+ * false if the block update can be skipped
+ */
+
+/**
+ * \fn ParamsTracker::frameUpdates()
+ * \brief Retrieve the number of blocks updated for the current frame
+ * \return The number of blocks updated since the last call to startFrame()
+ */
+
+/**
+ * \fn ParamsTracker::statistics()
+ * \brief Retrieve the tracking statistics
+ * \return The statistics accumulated since the tracker was constructed
+ */
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
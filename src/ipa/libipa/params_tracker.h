@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Track changes to ISP parameter blocks
+ */
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+namespace libcamera {
+
+namespace ipa {
+
+class ParamsTracker
+{
+public:
+	struct Statistics {
+		uint64_t frames;
+		uint64_t updated;
+		uint64_t skipped;
+	};
+
+	ParamsTracker();
+
+	void reset();
+
+	void startFrame();
+	bool update(unsigned int id, Span<const uint8_t> data);
+
+	template<typename T>
+	bool update(unsigned int id, const T &block)
+	{
+		return update(id, { reinterpret_cast<const uint8_t *>(&block),
+				    sizeof(block) });
+	}
+
+	unsigned int frameUpdates() const { return frameUpdates_; }
+	const Statistics &statistics() const { return statistics_; }
+
+private:
+	std::map<unsigned int, std::vector<uint8_t>> blocks_;
+	unsigned int frameUpdates_;
+	Statistics statistics_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Algorithm state persisted across camera sessions
+ */
+
+#include "persistent_state.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file persistent_state.h
+ * \brief Algorithm state persisted across camera sessions
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(PersistentState)
+
+namespace ipa {
+
+/**
+ * \class PersistentState
+ * \brief Store the state of algorithms across camera sessions
+ *
+ * Control algorithms such as AGC and AWB start from default values every time
+ * a camera is started, and take many frames to converge. When the scene
+ * doesn't change much between sessions, as for fixed cameras, starting from
+ * the results of the previous session avoids wasting those frames.
+ *
+ * The PersistentState stores a set of numerical values, identified by a
+ * string key, in a small text file. IPA modules store the state of their
+ * algorithms with set() and store() when the camera is stopped, and load() it
+ * and retrieve the values with get() to seed the algorithms when the camera is
+ * configured.
+ *
+ * Persistence is enabled by setting the LIBCAMERA_IPA_STATE_DIR environment
+ * variable to the directory where state files are stored. The file name is
+ * set by the IPA module, and should identify the camera, for instance by
+ * including the camera sensor model. When the variable isn't set, the state
+ * is not persisted and load() and store() do nothing.
+ *
+ * The stored values are a hint only. IPA modules shall validate them against
+ * the current camera configuration before use, as the state file may have
+ * been created with a different configuration or be corrupted.
+ */
+
+/**
+ * \brief Initialize the persistent state
+ * \param[in] name The name of the state file
+ *
+ * Characters of \a name that are not alphanumeric, dashes or dots are replaced
+ * with underscores to form the file name.
+ *
+ * \return 0 on success, or -ENOENT if persistence is disabled
+ */
+int PersistentState::init(const std::string &name)
+{
+	directory_.clear();
+	path_.clear();
+	values_.clear();
+
+	const char *dir = utils::secure_getenv("LIBCAMERA_IPA_STATE_DIR");
+	if (!dir || *dir == '\0')
+		return -ENOENT;
+
+	std::string fileName = name;
+	for (char &c : fileName) {
+		if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.')
+			c = '_';
+	}
+
+	directory_ = dir;
+	path_ = directory_ + "/" + fileName + ".state";
+
+	return 0;
+}
+
+/**
+ * \fn PersistentState::isEnabled()
+ * \brief Check if persistence is enabled
+ * \return True if the state is persisted, false otherwise
+ */
+
+/**
+ * \brief Load the state from the state file
+ *
+ * Values previously set with set() are discarded. Malformed lines in the state
+ * file are ignored.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PersistentState::load()
+{
+	values_.clear();
+
+	if (path_.empty())
+		return -ENOENT;
+
+	File file(path_);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return file.error();
+
+	Span<const uint8_t> data = file.map();
+	if (data.empty() && file.size())
+		return file.error();
+
+	std::istringstream stream(std::string(data.begin(), data.end()));
+	std::string line;
+
+	while (std::getline(stream, line)) {
+		size_t pos = line.find(' ');
+		if (pos == 0 || pos == std::string::npos)
+			continue;
+
+		const char *value = line.c_str() + pos + 1;
+		char *end;
+
+		errno = 0;
+		double number = utils::strtod(value, &end);
+		if (end == value || *end != '\0' || errno == ERANGE)
+			continue;
+
+		values_[line.substr(0, pos)] = number;
+	}
+
+	LOG(PersistentState, Debug)
+		<< "Loaded " << values_.size() << " values from " << path_;
+
+	return 0;
+}
+
+/**
+ * \brief Store the state to the state file
+ *
+ * The state file is written to a temporary file that is then atomically
+ * renamed, to avoid corrupting it when multiple processes store the state
+ * concurrently.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PersistentState::store() const
+{
+	if (path_.empty())
+		return -ENOENT;
+
+	if (mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+		int ret = -errno;
+		LOG(PersistentState, Warning)
+			<< "Failed to create " << directory_ << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	std::ostringstream stream;
+	stream.imbue(std::locale::classic());
+	stream << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+	for (const auto &[key, value] : values_)
+		stream << key << " " << value << "\n";
+
+	const std::string contents = stream.str();
+	const std::string tmpPath = path_ + "." + std::to_string(getpid()) + ".tmp";
+
+	File file(tmpPath);
+	if (!file.open(File::OpenModeFlag::WriteOnly)) {
+		LOG(PersistentState, Warning)
+			<< "Failed to create " << tmpPath << ": "
+			<< strerror(-file.error());
+		return file.error();
+	}
+
+	Span<const uint8_t> data{ reinterpret_cast<const uint8_t *>(contents.data()),
+				  contents.size() };
+	ssize_t ret = file.write(data);
+	file.close();
+
+	if (ret != static_cast<ssize_t>(data.size())) {
+		unlink(tmpPath.c_str());
+		return ret < 0 ? ret : -EIO;
+	}
+
+	if (rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		ret = -errno;
+		unlink(tmpPath.c_str());
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve a value from the state
+ * \param[in] key The value key
+ * \return The value, or std::nullopt if the state doesn't contain \a key
+ */
+std::optional<double> PersistentState::get(const std::string &key) const
+{
+	auto it = values_.find(key);
+	if (it == values_.end())
+		return std::nullopt;
+
+	return it->second;
+}
+
+/**
+ * \brief Set a value in the state
+ * \param[in] key The value key, shall not contain spaces or newlines
+ * \param[in] value The value
+ */
+void PersistentState::set(const std::string &key, double value)
+{
+	values_[key] = value;
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Algorithm state persisted across camera sessions
+ */
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string>
+
+namespace libcamera {
+
+namespace ipa {
+
+class PersistentState
+{
+public:
+	PersistentState() = default;
+
+	int init(const std::string &name);
+	bool isEnabled() const { return !path_.empty(); }
+
+	int load();
+	int store() const;
+
+	std::optional<double> get(const std::string &key) const;
+	void set(const std::string &key, double value);
+
+private:
+	std::string directory_;
+	std::string path_;
+	std::map<std::string, double> values_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -95,6 +95,67 @@ namespace ipa {
  * \brief End of the interval
  */
 
+/**
+ * \class Pwl::Lut
+ * \brief A piecewise linear function baked into a uniformly sampled table
+ *
+ * Evaluating a Pwl requires searching for the span that contains the x value,
+ * which dominates the cost of algorithms that evaluate the same function
+ * many times per frame. A Lut, created with Pwl::bake(), samples the function
+ * at regular intervals over its domain. Evaluating it computes the position
+ * of x in the table in fixed-point, and interpolates linearly between the two
+ * nearest entries, without any search or division.
+ *
+ * The Lut is an approximation of the Pwl: knots of the function that don't
+ * fall on a sample are smoothed out, with an error that decreases as the size
+ * of the table increases. The Lut evaluates to the values at the ends of the
+ * domain of the function for x values outside of the domain.
+ */
+
+/**
+ * \brief Construct an empty Lut
+ *
+ * The Lut shall not be evaluated, use Pwl::bake() to create a usable Lut.
+ */
+Pwl::Lut::Lut()
+	: start_(0.0), scale_(0.0), maxPosition_(0.0)
+{
+}
+
+/**
+ * \fn Pwl::Lut::empty()
+ * \brief Check if the Lut is empty
+ * \return True if the Lut has no entries, false otherwise
+ */
+
+/**
+ * \fn Pwl::Lut::size()
+ * \brief Retrieve the number of entries in the Lut
+ * \return The number of entries in the Lut
+ */
+
+/**
+ * \fn Pwl::Lut::eval(double x) const
+ * \brief Evaluate the baked piecewise linear function
+ * \param[in] x The x value to input into the function
+ * \return The approximate value of the function at position \a x
+ */
+
+/**
+ * \brief Evaluate the baked piecewise linear function for a list of values
+ * \param[in] x The x values to input into the function
+ * \param[out] y The approximate values of the function at positions \a x
+ *
+ * The \a y span shall be at least as large as the \a x span.
+ */
+void Pwl::Lut::eval(Span<const double> x, Span<double> y) const
+{
+	assert(y.size() >= x.size());
+
+	for (size_t i = 0; i < x.size(); i++)
+		y[i] = eval(x[i]);
+}
+
 /**
  * \brief Construct an empty piecewise linear function
  */
@@ -213,6 +274,70 @@ double Pwl::eval(double x, int *span, bool updateSpan) const
 		       (points_[index + 1].x() - points_[index].x());
 }
 
+/**
+ * \brief Evaluate the piecewise linear function for a list of values
+ * \param[in] x The x values to input into the function
+ * \param[out] y The results of evaluating the function at positions \a x
+ *
+ * This function is equivalent to calling eval() for each value of \a x, but
+ * starts each span search from the span found for the previous value. When
+ * the \a x values are sorted, the whole list is evaluated with a single pass
+ * over the knots of the function.
+ *
+ * The \a y span shall be at least as large as the \a x span.
+ */
+void Pwl::eval(Span<const double> x, Span<double> y) const
+{
+	assert(y.size() >= x.size());
+
+	int span = 0;
+	for (size_t i = 0; i < x.size(); i++)
+		y[i] = eval(x[i], &span);
+}
+
+/**
+ * \brief Bake the piecewise linear function into a lookup table
+ * \param[in] size The number of entries in the table, between 2 and 65536
+ *
+ * Sample the function at \a size regularly spaced positions over its domain,
+ * to evaluate it quickly through the returned Lut. The size of the table
+ * trades the accuracy of the approximation against the cost of baking the
+ * table and its memory footprint.
+ *
+ * \return The baked function, or an empty Lut if the function is empty
+ */
+Pwl::Lut Pwl::bake(unsigned int size) const
+{
+	Lut lut;
+
+	if (empty())
+		return lut;
+
+	size = std::clamp(size, 2U, 1U << Lut::kFractionBits);
+
+	Interval dom = domain();
+	double maxPosition = static_cast<double>(size - 1) * (1 << Lut::kFractionBits);
+
+	lut.start_ = dom.start;
+	lut.scale_ = dom.length() > 0 ? maxPosition / dom.length() : 0.0;
+	lut.maxPosition_ = maxPosition;
+	lut.entries_.resize(size);
+
+	int span = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		double x = dom.start + dom.length() * i / (size - 1);
+		lut.entries_[i].y = points_.size() > 1 ? eval(x, &span)
+						       : points_[0].y();
+	}
+
+	for (unsigned int i = 0; i < size - 1; i++)
+		lut.entries_[i].slope = (lut.entries_[i + 1].y - lut.entries_[i].y) /
+					(1 << Lut::kFractionBits);
+	lut.entries_[size - 1].slope = 0.0;
+
+	return lut;
+}
+
 int Pwl::findSpan(double x, int span) const
 {
 	/*
@@ -9,10 +9,13 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <stdint.h>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <libcamera/base/span.h>
+
 #include "libcamera/internal/yaml_parser.h"
 
 #include "vector.h"
@@ -45,6 +48,47 @@ public:
 		double start, end;
 	};
 
+	class Lut
+	{
+	public:
+		Lut();
+
+		bool empty() const { return entries_.empty(); }
+		size_t size() const { return entries_.size(); }
+
+		double eval(double x) const
+		{
+			uint32_t pos = position(x);
+			const Entry &entry = entries_[pos >> kFractionBits];
+			return entry.y + entry.slope * (pos & kFractionMask);
+		}
+
+		void eval(Span<const double> x, Span<double> y) const;
+
+	private:
+		friend class Pwl;
+
+		static constexpr unsigned int kFractionBits = 16;
+		static constexpr uint32_t kFractionMask = (1 << kFractionBits) - 1;
+
+		struct Entry {
+			double y;
+			/* Increment of y for each fractional step of x. */
+			double slope;
+		};
+
+		uint32_t position(double x) const
+		{
+			double pos = std::clamp((x - start_) * scale_, 0.0, maxPosition_);
+			return static_cast<uint32_t>(pos);
+		}
+
+		double start_;
+		double scale_;
+		double maxPosition_;
+		std::vector<Entry> entries_;
+	};
+
 	Pwl();
 	Pwl(const std::vector<Point> &points);
 	Pwl(std::vector<Point> &&points);
@@ -59,6 +103,9 @@ public:
 
 	double eval(double x, int *span = nullptr,
 		    bool updateSpan = true) const;
+	void eval(Span<const double> x, Span<double> y) const;
+
+	Lut bake(unsigned int size) const;
 
 	std::pair<Pwl, bool> inverse(double eps = 1e-6) const;
 	Pwl compose(const Pwl &other, double eps = 1e-6) const;
@@ -0,0 +1,334 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Shared worker pool for asynchronous IPA algorithms
+ */
+
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+
+/**
+ * \file task_scheduler.h
+ * \brief Shared worker pool for asynchronous IPA algorithms
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(TaskScheduler)
+
+namespace ipa {
+
+/**
+ * \class TaskScheduler
+ * \brief Run the jobs of asynchronous IPA algorithms on a shared worker pool
+ *
+ * Some IPA algorithms are too expensive to run synchronously for every frame,
+ * and instead run a job in the background every few frames, picking up the
+ * results when they are available. Instead of creating one thread per
+ * algorithm and per camera, algorithms create a Task and submit() it to the
+ * process-wide TaskScheduler, which runs the jobs on a bounded pool of worker
+ * threads.
+ *
+ * The workers are created on demand, up to maxWorkers(). The maximum defaults
+ * to the number of CPUs minus one, between one and four, and can be
+ * overridden with the LIBCAMERA_IPA_WORKERS environment variable.
+ *
+ * When more jobs are queued than workers are available, the jobs of the tasks
+ * with the highest priority run first, and jobs of the same priority run in
+ * order of their deadline. Deadlines are expressed relative to the submission
+ * time, and are usually computed from the frame duration and the number of
+ * frames after which the algorithm expects the results. A job that completes
+ * after its deadline is counted as a missed deadline in the task and
+ * scheduler statistics.
+ */
+
+/**
+ * \typedef TaskScheduler::Clock
+ * \brief The clock used to measure deadlines
+ */
+
+/**
+ * \struct TaskScheduler::Statistics
+ * \brief Counters of submitted and completed jobs
+ *
+ * \var TaskScheduler::Statistics::submitted
+ * \brief The number of jobs submitted
+ *
+ * \var TaskScheduler::Statistics::completed
+ * \brief The number of jobs that have completed
+ *
+ * \var TaskScheduler::Statistics::missedDeadlines
+ * \brief The number of jobs that completed after their deadline
+ */
+
+/**
+ * \class TaskScheduler::Task
+ * \brief A job that an IPA algorithm runs asynchronously
+ *
+ * A Task wraps a function that is run on a TaskScheduler worker every time the
+ * task is submitted. A task can only be queued or running once at a time. The
+ * task owner checks whether the job has completed with done(), and waits for
+ * it with wait().
+ *
+ * Destroying a task cancels the job if it is queued, and waits for it to
+ * complete if it is running. As the job usually accesses data members of the
+ * task owner, owners should call cancel() and wait() in their destructor, to
+ * ensure the job doesn't run once the data it accesses has been destroyed.
+ */
+
+/**
+ * \brief Construct a Task
+ * \param[in] name The task name, used in log messages
+ * \param[in] func The function to run asynchronously
+ * \param[in] priority The task priority, higher values run first
+ */
+TaskScheduler::Task::Task(const std::string &name, std::function<void()> func,
+			  int priority)
+	: scheduler_(TaskScheduler::instance()), name_(name),
+	  func_(std::move(func)), priority_(priority), state_(State::Idle),
+	  statistics_{}
+{
+}
+
+TaskScheduler::Task::~Task()
+{
+	scheduler_->cancel(this);
+	scheduler_->wait(this);
+
+	LOG(TaskScheduler, Debug)
+		<< name_ << ": " << statistics_.completed << " jobs, "
+		<< statistics_.missedDeadlines << " missed deadlines";
+}
+
+/**
+ * \brief Queue the job to run on a worker
+ * \param[in] deadline The time within which the job should complete
+ * \return True if the job has been queued, or false if the previous job hasn't
+ * completed yet
+ */
+bool TaskScheduler::Task::submit(utils::Duration deadline)
+{
+	return scheduler_->submit(this, deadline);
+}
+
+/**
+ * \brief Check if the last submitted job has completed
+ *
+ * This function returns true as well if the task has never been submitted.
+ *
+ * \return True if the task is neither queued nor running, false otherwise
+ */
+bool TaskScheduler::Task::done() const
+{
+	std::scoped_lock lock(scheduler_->mutex_);
+	return state_ == State::Idle;
+}
+
+/**
+ * \brief Cancel the job if it is queued
+ *
+ * A job that is already running isn't interrupted, use wait() to wait for it
+ * to complete.
+ */
+void TaskScheduler::Task::cancel()
+{
+	scheduler_->cancel(this);
+}
+
+/**
+ * \brief Wait for the last submitted job to complete
+ */
+void TaskScheduler::Task::wait()
+{
+	scheduler_->wait(this);
+}
+
+/**
+ * \fn TaskScheduler::Task::name()
+ * \brief Retrieve the task name
+ * \return The task name
+ */
+
+/**
+ * \brief Retrieve the task priority
+ * \return The task priority
+ */
+int TaskScheduler::Task::priority() const
+{
+	std::scoped_lock lock(scheduler_->mutex_);
+	return priority_;
+}
+
+/**
+ * \brief Set the task priority
+ * \param[in] priority The task priority, higher values run first
+ *
+ * The new priority applies to the jobs queued from now on, and to the job
+ * currently queued if any.
+ */
+void TaskScheduler::Task::setPriority(int priority)
+{
+	std::scoped_lock lock(scheduler_->mutex_);
+	priority_ = priority;
+}
+
+/**
+ * \brief Retrieve the task statistics
+ * \return The statistics of the jobs of this task
+ */
+TaskScheduler::Statistics TaskScheduler::Task::statistics() const
+{
+	std::scoped_lock lock(scheduler_->mutex_);
+	return statistics_;
+}
+
+TaskScheduler::TaskScheduler()
+	: idleWorkers_(0), statistics_{}, exit_(false)
+{
+	const char *workers = utils::secure_getenv("LIBCAMERA_IPA_WORKERS");
+	if (workers && atoi(workers) > 0) {
+		maxWorkers_ = atoi(workers);
+	} else {
+		unsigned int cpus = std::thread::hardware_concurrency();
+		maxWorkers_ = std::clamp(cpus, 2U, 5U) - 1;
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::scoped_lock lock(mutex_);
+		exit_ = true;
+	}
+	queued_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+/**
+ * \brief Retrieve the scheduler instance
+ * \return The process-wide TaskScheduler
+ */
+TaskScheduler *TaskScheduler::instance()
+{
+	static TaskScheduler scheduler;
+	return &scheduler;
+}
+
+/**
+ * \fn TaskScheduler::maxWorkers()
+ * \brief Retrieve the maximum number of worker threads
+ * \return The maximum number of worker threads
+ */
+
+/**
+ * \brief Retrieve the scheduler statistics
+ * \return The statistics of the jobs of all tasks
+ */
+TaskScheduler::Statistics TaskScheduler::statistics() const
+{
+	std::scoped_lock lock(mutex_);
+	return statistics_;
+}
+
+bool TaskScheduler::submit(Task *task, utils::Duration deadline)
+{
+	std::scoped_lock lock(mutex_);
+
+	if (task->state_ != Task::State::Idle)
+		return false;
+
+	task->state_ = Task::State::Queued;
+	task->deadline_ = Clock::now() +
+			  std::chrono::duration_cast<Clock::duration>(deadline);
+	task->statistics_.submitted++;
+	statistics_.submitted++;
+
+	queue_.push_back(task);
+
+	if (queue_.size() > idleWorkers_ && workers_.size() < maxWorkers_) {
+		workers_.emplace_back(&TaskScheduler::run, this);
+		LOG(TaskScheduler, Debug)
+			<< "Started worker " << workers_.size() << "/" << maxWorkers_;
+	} else {
+		queued_.notify_one();
+	}
+
+	return true;
+}
+
+void TaskScheduler::cancel(Task *task)
+{
+	std::scoped_lock lock(mutex_);
+
+	if (task->state_ != Task::State::Queued)
+		return;
+
+	queue_.erase(std::find(queue_.begin(), queue_.end(), task));
+	task->state_ = Task::State::Idle;
+}
+
+void TaskScheduler::wait(Task *task)
+{
+	std::unique_lock lock(mutex_);
+	completed_.wait(lock, [&] { return task->state_ == Task::State::Idle; });
+}
+
+void TaskScheduler::run()
+{
+	Thread::configureCurrent("ipa-worker");
+
+	std::unique_lock lock(mutex_);
+
+	while (true) {
+		idleWorkers_++;
+		queued_.wait(lock, [&] { return exit_ || !queue_.empty(); });
+		idleWorkers_--;
+
+		if (exit_)
+			break;
+
+		/* Pick the highest priority task, and the earliest deadline. */
+		auto it = std::min_element(queue_.begin(), queue_.end(),
+					   [](const Task *a, const Task *b) {
+						   if (a->priority_ != b->priority_)
+							   return a->priority_ > b->priority_;
+						   return a->deadline_ < b->deadline_;
+					   });
+		Task *task = *it;
+		queue_.erase(it);
+		task->state_ = Task::State::Running;
+
+		lock.unlock();
+		task->func_();
+		lock.lock();
+
+		task->state_ = Task::State::Idle;
+		task->statistics_.completed++;
+		statistics_.completed++;
+
+		Clock::time_point now = Clock::now();
+		if (now > task->deadline_) {
+			task->statistics_.missedDeadlines++;
+			statistics_.missedDeadlines++;
+
+			LOG(TaskScheduler, Debug)
+				<< task->name_ << ": Missed deadline by "
+				<< utils::Duration(now - task->deadline_).get<std::micro>()
+				<< "us";
+		}
+
+		completed_.notify_all();
+	}
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Shared worker pool for asynchronous IPA algorithms
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/utils.h>
+
+namespace libcamera {
+
+namespace ipa {
+
+class TaskScheduler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Statistics {
+		uint64_t submitted;
+		uint64_t completed;
+		uint64_t missedDeadlines;
+	};
+
+	class Task
+	{
+	public:
+		Task(const std::string &name, std::function<void()> func,
+		     int priority = 0);
+		~Task();
+
+		bool submit(utils::Duration deadline);
+		bool done() const;
+		void cancel();
+		void wait();
+
+		const std::string &name() const { return name_; }
+		int priority() const;
+		void setPriority(int priority);
+
+		Statistics statistics() const;
+
+	private:
+		LIBCAMERA_DISABLE_COPY_AND_MOVE(Task)
+
+		friend class TaskScheduler;
+
+		enum class State {
+			Idle,
+			Queued,
+			Running,
+		};
+
+		TaskScheduler *scheduler_;
+		std::string name_;
+		std::function<void()> func_;
+
+		/* Protected by the scheduler mutex. */
+		int priority_;
+		State state_;
+		Clock::time_point deadline_;
+		Statistics statistics_;
+	};
+
+	static TaskScheduler *instance();
+
+	unsigned int maxWorkers() const { return maxWorkers_; }
+	Statistics statistics() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(TaskScheduler)
+
+	TaskScheduler();
+	~TaskScheduler();
+
+	bool submit(Task *task, utils::Duration deadline);
+	void cancel(Task *task);
+	void wait(Task *task);
+	void run();
+
+	unsigned int maxWorkers_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable queued_;
+	std::condition_variable completed_;
+	std::vector<std::thread> workers_;
+	unsigned int idleWorkers_;
+	std::vector<Task *> queue_;
+	Statistics statistics_;
+	bool exit_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
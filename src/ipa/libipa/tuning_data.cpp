@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Tuning data shared between IPA instances
+ */
+
+#include "tuning_data.h"
+
+#include <errno.h>
+#include <map>
+#include <mutex>
+#include <string.h>
+#include <sys/stat.h>
+#include <utility>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+
+/**
+ * \file tuning_data.h
+ * \brief Tuning data shared between IPA instances
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(TuningData)
+
+namespace ipa {
+
+namespace {
+
+/* A parsed tuning file, identified by the file it has been read from */
+struct TuningFile {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	std::weak_ptr<const YamlObject> root;
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::map<std::string, TuningFile> files;
+	std::map<std::pair<const YamlObject *, std::type_index>,
+		 std::weak_ptr<const void>> values;
+};
+
+Registry &registry()
+{
+	static Registry registry;
+	return registry;
+}
+
+bool contains(const YamlObject &object, const YamlObject *node)
+{
+	if (&object == node)
+		return true;
+
+	if (object.isList()) {
+		for (const YamlObject &child : object.asList()) {
+			if (contains(child, node))
+				return true;
+		}
+	} else if (object.isDictionary()) {
+		for (const auto &[key, child] : object.asDict()) {
+			if (contains(child, node))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+/**
+ * \class TuningData
+ * \brief Share read-only tuning data between IPA instances of a process
+ *
+ * Systems with multiple identical cameras run one IPA instance per camera,
+ * all using the same tuning file. Without sharing, each instance parses the
+ * file and holds its own copy of the tables that its algorithms derive from
+ * it, such as lens shading or colour calibration tables.
+ *
+ * The TuningData class lets IPA modules load the tuning file with load(),
+ * which returns the tree already parsed by another instance when the file
+ * hasn't changed in the meantime. Algorithms then create the immutable data
+ * they derive from a node of the tree with share(), which returns the data
+ * already created for the same node by another instance.
+ *
+ * All shared data is reference-counted and const, and is freed when the last
+ * IPA instance using it is destroyed. IPA modules should keep a reference to
+ * the tree returned by load() for as long as they run, for other instances to
+ * find it.
+ */
+
+/**
+ * \brief Load and parse a tuning file
+ * \param[in] path The path to the tuning file
+ * \param[out] data The parsed tuning file
+ *
+ * If the file has already been loaded, and is still referenced by another IPA
+ * instance, the existing tree is returned without parsing the file again. The
+ * file is parsed again if its modification time or size has changed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int TuningData::load(const std::string &path,
+		     std::shared_ptr<const YamlObject> *data)
+{
+	Registry &reg = registry();
+	struct stat st;
+
+	if (stat(path.c_str(), &st) < 0) {
+		int ret = -errno;
+		LOG(TuningData, Error)
+			<< "Failed to access tuning file " << path << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	std::scoped_lock lock(reg.mutex);
+
+	auto it = reg.files.find(path);
+	if (it != reg.files.end()) {
+		const TuningFile &tuning = it->second;
+		std::shared_ptr<const YamlObject> root = tuning.root.lock();
+
+		if (root && tuning.dev == st.st_dev && tuning.ino == st.st_ino &&
+		    tuning.size == st.st_size &&
+		    tuning.mtime.tv_sec == st.st_mtim.tv_sec &&
+		    tuning.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			LOG(TuningData, Debug) << "Sharing tuning file " << path;
+			*data = std::move(root);
+			return 0;
+		}
+	}
+
+	File file(path);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		int ret = file.error();
+		LOG(TuningData, Error)
+			<< "Failed to open tuning file " << path << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	std::shared_ptr<const YamlObject> root = YamlParser::parse(file);
+	if (!root)
+		return -EINVAL;
+
+	reg.files[path] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim, root };
+	*data = std::move(root);
+
+	return 0;
+}
+
+/**
+ * \fn TuningData::share()
+ * \brief Retrieve immutable data derived from a node of a tuning file
+ * \tparam T The type of the data
+ * \param[in] node The tuning file node the data is created from
+ * \param[in] create Function that creates the data
+ *
+ * If data of type \a T has already been created from \a node, and is still in
+ * use, this function returns it. Otherwise it calls \a create, which shall
+ * return a std::shared_ptr<T>, or nullptr on error, and shares the result
+ * with the IPA instances that later call this function with the same node.
+ *
+ * Data is only shared when \a node is part of a tree returned by load(). The
+ * shared data keeps the tree alive, guaranteeing that the node isn't destroyed
+ * and its address reused while the data exists.
+ *
+ * \return The data derived from \a node, or nullptr if \a create failed
+ */
+
+std::shared_ptr<const void> TuningData::find(const YamlObject &node,
+					     std::type_index type)
+{
+	Registry &reg = registry();
+	std::scoped_lock lock(reg.mutex);
+
+	auto it = reg.values.find({ &node, type });
+	if (it == reg.values.end())
+		return nullptr;
+
+	return it->second.lock();
+}
+
+std::shared_ptr<const void> TuningData::insert(const YamlObject &node,
+					       std::type_index type,
+					       std::shared_ptr<const void> value)
+{
+	Registry &reg = registry();
+	std::scoped_lock lock(reg.mutex);
+
+	/* Another instance may have created the same data concurrently. */
+	auto it = reg.values.find({ &node, type });
+	if (it != reg.values.end()) {
+		std::shared_ptr<const void> existing = it->second.lock();
+		if (existing)
+			return existing;
+	}
+
+	std::shared_ptr<const YamlObject> root;
+	for (const auto &[path, tuning] : reg.files) {
+		std::shared_ptr<const YamlObject> candidate = tuning.root.lock();
+		if (candidate && contains(*candidate, &node)) {
+			root = std::move(candidate);
+			break;
+		}
+	}
+
+	if (!root)
+		return value;
+
+	/* Keep the tree alive for as long as the data is used. */
+	auto owner = std::make_shared<std::pair<std::shared_ptr<const void>,
+						std::shared_ptr<const YamlObject>>>(
+		value, std::move(root));
+	std::shared_ptr<const void> shared(owner, value.get());
+
+	/* Drop the entries of data that isn't used anymore. */
+	for (auto entry = reg.values.begin(); entry != reg.values.end();) {
+		if (entry->second.expired())
+			entry = reg.values.erase(entry);
+		else
+			++entry;
+	}
+
+	reg.values[{ &node, type }] = shared;
+
+	return shared;
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
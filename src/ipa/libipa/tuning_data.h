@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Tuning data shared between IPA instances
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+
+#include "libcamera/internal/yaml_parser.h"
+
+namespace libcamera {
+
+namespace ipa {
+
+class TuningData
+{
+public:
+	static int load(const std::string &path,
+			std::shared_ptr<const YamlObject> *data);
+
+	template<typename T, typename Func>
+	static std::shared_ptr<const T> share(const YamlObject &node, Func &&create)
+	{
+		std::shared_ptr<const void> value = find(node, typeid(T));
+		if (value)
+			return std::static_pointer_cast<const T>(value);
+
+		std::shared_ptr<const T> created = create();
+		if (!created)
+			return nullptr;
+
+		value = insert(node, typeid(T), std::move(created));
+		return std::static_pointer_cast<const T>(value);
+	}
+
+private:
+	static std::shared_ptr<const void> find(const YamlObject &node,
+						std::type_index type);
+	static std::shared_ptr<const void> insert(const YamlObject &node,
+						  std::type_index type,
+						  std::shared_ptr<const void> value);
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -134,6 +134,45 @@ namespace ipa {
  * \return Product of matrix \a m and vector \a v
  */
 
+/**
+ * \fn void transform(const Matrix<T, Rows, Cols> &m, Span<const Vector<T, Cols>> in, Span<Vector<T, Rows>> out)
+ * \brief Multiply a matrix by a list of vectors
+ * \tparam T Numerical type of the contents of the matrix and vectors
+ * \tparam Rows The number of rows in the matrix
+ * \tparam Cols The number of columns in the matrix (= rows in the vectors)
+ * \param[in] m The matrix
+ * \param[in] in The vectors to multiply
+ * \param[out] out The results of the multiplications
+ *
+ * This function computes out[n] = m * in[n] for all vectors in \a in, for
+ * instance to apply a colour correction matrix to the RGB values of all the
+ * zones of the statistics. It's faster than multiplying the vectors one by one
+ * as the matrix coefficients stay in registers, and the fixed-size inner
+ * loops let the compiler vectorise the computation. \a in and \a out may
+ * refer to the same vectors.
+ *
+ * The \a out span shall be at least as large as the \a in span.
+ */
+
+/**
+ * \fn void transformFixedPoint(const Matrix<T, Rows, Cols> &m, Span<const Vector<U, Cols>> in, Span<Vector<U, Rows>> out)
+ * \brief Multiply a fixed-point matrix by a list of integer vectors
+ * \tparam FracBits The number of fractional bits of the matrix coefficients
+ * \tparam T Integer type of the matrix coefficients
+ * \tparam U Integer type of the contents of the vectors
+ * \tparam Rows The number of rows in the matrix
+ * \tparam Cols The number of columns in the matrix (= rows in the vectors)
+ * \param[in] m The matrix, with coefficients scaled by 2^FracBits
+ * \param[in] in The vectors to multiply
+ * \param[out] out The results of the multiplications
+ *
+ * This function is the fixed-point equivalent of transform(), for integer
+ * data such as raw statistics. The products are accumulated in 64-bit
+ * integers, rounded to the nearest integer and clamped to the range of \a U.
+ *
+ * The \a out span shall be at least as large as the \a in span.
+ */
+
 /**
  * \fn bool operator==(const Vector<T, Rows> &lhs, const Vector<T, Rows> &rhs)
  * \brief Compare vectors for equality
@@ -9,7 +9,10 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <limits>
 #include <sstream>
+#include <stdint.h>
+#include <type_traits>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/span.h>
@@ -157,6 +160,77 @@ Vector<T, Rows> operator*(const Matrix<T, Rows, Cols> &m, const Vector<T, Cols>
 	return result;
 }
 
+template<typename T, unsigned int Rows, unsigned int Cols>
+void transform(const Matrix<T, Rows, Cols> &m, Span<const Vector<T, Cols>> in,
+	       Span<Vector<T, Rows>> out)
+{
+	ASSERT(out.size() >= in.size());
+
+	/*
+	 * Copy the coefficients to a local array, to keep them in registers
+	 * as the compiler can't otherwise assume they don't alias the output.
+	 */
+	std::array<T, Rows * Cols> coeffs;
+	for (unsigned int i = 0; i < Rows; i++) {
+		for (unsigned int j = 0; j < Cols; j++)
+			coeffs[i * Cols + j] = m[i][j];
+	}
+
+	for (size_t n = 0; n < in.size(); n++) {
+		const Vector<T, Cols> &v = in[n];
+		Vector<T, Rows> result;
+
+		for (unsigned int i = 0; i < Rows; i++) {
+			T sum = 0;
+			for (unsigned int j = 0; j < Cols; j++)
+				sum += coeffs[i * Cols + j] * v[j];
+			result[i] = sum;
+		}
+
+		out[n] = result;
+	}
+}
+
+#ifndef __DOXYGEN__
+template<unsigned int FracBits, typename T, typename U,
+	 unsigned int Rows, unsigned int Cols,
+	 std::enable_if_t<std::is_integral_v<T> && std::is_integral_v<U>> * = nullptr>
+#else
+template<unsigned int FracBits, typename T, typename U, unsigned int Rows, unsigned int Cols>
+#endif /* __DOXYGEN__ */
+void transformFixedPoint(const Matrix<T, Rows, Cols> &m,
+			 Span<const Vector<U, Cols>> in,
+			 Span<Vector<U, Rows>> out)
+{
+	static_assert(FracBits > 0 && FracBits < 32);
+
+	ASSERT(out.size() >= in.size());
+
+	std::array<int64_t, Rows * Cols> coeffs;
+	for (unsigned int i = 0; i < Rows; i++) {
+		for (unsigned int j = 0; j < Cols; j++)
+			coeffs[i * Cols + j] = m[i][j];
+	}
+
+	constexpr int64_t round = int64_t(1) << (FracBits - 1);
+	constexpr int64_t min = std::numeric_limits<U>::min();
+	constexpr int64_t max = std::numeric_limits<U>::max();
+
+	for (size_t n = 0; n < in.size(); n++) {
+		const Vector<U, Cols> &v = in[n];
+		Vector<U, Rows> result;
+
+		for (unsigned int i = 0; i < Rows; i++) {
+			int64_t sum = round;
+			for (unsigned int j = 0; j < Cols; j++)
+				sum += coeffs[i * Cols + j] * v[j];
+			result[i] = std::clamp(sum >> FracBits, min, max);
+		}
+
+		out[n] = result;
+	}
+}
+
 template<typename T, unsigned int Rows>
 bool operator==(const Vector<T, Rows> &lhs, const Vector<T, Rows> &rhs)
 {
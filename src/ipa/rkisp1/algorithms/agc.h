@@ -53,6 +53,7 @@ private:
 	double estimateLuminance(double gain) const override;
 
 	Span<const uint8_t> expMeans_;
+	Histogram hist_;
 
 	std::map<int32_t, std::vector<uint8_t>> meteringModes_;
 };
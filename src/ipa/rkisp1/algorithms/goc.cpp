@@ -6,10 +6,11 @@
  */
 #include "goc.h"
 
-#include <cmath>
+#include <algorithm>
+#include <array>
+#include <vector>
 
 #include <libcamera/base/log.h>
-#include <libcamera/base/utils.h>
 
 #include <libcamera/control_ids.h>
 
@@ -45,6 +46,37 @@ LOG_DEFINE_CATEGORY(RkISP1Gamma)
 
 const float kDefaultGamma = 2.2f;
 
+namespace {
+
+/*
+ * The logarithmic segments as specified in the reference.
+ * Plus an additional 0 to make the loop easier
+ */
+constexpr std::array<unsigned int, RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V10> kSegments = {
+	64, 64, 64, 64, 128, 128, 128, 128, 256,
+	256, 256, 512, 512, 512, 512, 512, 0
+};
+
+std::vector<double> gammaSamples()
+{
+	std::vector<double> samples;
+	unsigned int x = 0;
+
+	for (unsigned int size : kSegments) {
+		samples.push_back(x / 4096.0);
+		x += size;
+	}
+
+	return samples;
+}
+
+} /* namespace */
+
+GammaOutCorrection::GammaOutCorrection()
+	: gammaLut_(gammaSamples(), 1023.0)
+{
+}
+
 /**
  * \copydoc libcamera::ipa::Algorithm::init
  */
@@ -84,7 +116,7 @@ void GammaOutCorrection::queueRequest(IPAContext &context, const uint32_t frame,
 		frameContext.goc.update = true;
 
 	const auto &gamma = controls.get(controls::Gamma);
-	if (gamma) {
+	if (gamma && *gamma != context.activeState.goc.gamma) {
 		context.activeState.goc.gamma = *gamma;
 		frameContext.goc.update = true;
 		LOG(RkISP1Gamma, Debug) << "Set gamma to " << *gamma;
@@ -105,23 +137,14 @@ void GammaOutCorrection::prepare(IPAContext &context,
 	       RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V10);
 
 	/*
-	 * The logarithmic segments as specified in the reference.
-	 * Plus an additional 0 to make the loop easier
+	 * The ISP retains the gamma curve, only program it for the first frame
+	 * and when the gamma value changes.
 	 */
-	static constexpr std::array<unsigned int, RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V10> segments = {
-		64, 64, 64, 64, 128, 128, 128, 128, 256,
-		256, 256, 512, 512, 512, 512, 512, 0
-	};
-	__u16 *gamma_y = params->others.goc_config.gamma_y;
-
 	if (!frameContext.goc.update)
 		return;
 
-	unsigned x = 0;
-	for (const auto [i, size] : utils::enumerate(segments)) {
-		gamma_y[i] = std::pow(x / 4096.0, 1.0 / frameContext.goc.gamma) * 1023.0;
-		x += size;
-	}
+	Span<const uint16_t> lut = gammaLut_.get(frameContext.goc.gamma);
+	std::copy(lut.begin(), lut.end(), params->others.goc_config.gamma_y);
 
 	params->others.goc_config.mode = RKISP1_CIF_ISP_GOC_MODE_LOGARITHMIC;
 	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_GOC;
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "libipa/gamma_lut.h"
+
 #include "algorithm.h"
 
 namespace libcamera {
@@ -16,7 +18,7 @@ namespace ipa::rkisp1::algorithms {
 class GammaOutCorrection : public Algorithm
 {
 public:
-	GammaOutCorrection() = default;
+	GammaOutCorrection();
 	~GammaOutCorrection() = default;
 
 	int init(IPAContext &context, const YamlObject &tuningData) override;
@@ -36,6 +38,7 @@ public:
 
 private:
 	float defaultGamma_;
+	GammaLut gammaLut_;
 };
 
 } /* namespace ipa::rkisp1::algorithms */
@@ -16,6 +16,8 @@
 
 #include "libcamera/internal/yaml_parser.h"
 
+#include "libipa/tuning_data.h"
+
 #include "linux/rkisp1-config.h"
 
 /**
@@ -36,6 +38,13 @@ namespace ipa::rkisp1::algorithms {
  * The Lens Shading Correction algorithm applies multipliers to all pixels
  * to compensate for the lens shading effect. The coefficients are
  * specified in a downscaled table in the YAML tuning file.
+ *
+ * Tables are provided for a set of color temperatures, and interpolated
+ * between the two closest sets for other color temperatures. To avoid
+ * recomputing and reprogramming the tables for every small variation of the
+ * color temperature estimated by the AWB, the color temperature is quantized
+ * in steps of 'ct-quantum' kelvins (defaulting to 100K), and the interpolated
+ * tables are cached per step.
  */
 
 LOG_DEFINE_CATEGORY(RkISP1Lsc)
@@ -90,42 +99,26 @@ static std::vector<uint16_t> parseTable(const YamlObject &tuningData,
 }
 
 LensShadingCorrection::LensShadingCorrection()
-	: lastCt_({ 0, 0 })
+	: ctQuantum_(kDefaultCtQuantum), lastSet_(nullptr)
 {
 }
 
-/**
- * \copydoc libcamera::ipa::Algorithm::init
- */
-int LensShadingCorrection::init([[maybe_unused]] IPAContext &context,
-				const YamlObject &tuningData)
+std::shared_ptr<std::map<uint32_t, LensShadingCorrection::Components>>
+LensShadingCorrection::parseSets(const YamlObject &yamlSets)
 {
-	xSize_ = parseSizes(tuningData, "x-size");
-	ySize_ = parseSizes(tuningData, "y-size");
-
-	if (xSize_.empty() || ySize_.empty())
-		return -EINVAL;
+	auto sets = std::make_shared<std::map<uint32_t, Components>>();
 
-	/* Get all defined sets to apply. */
-	const YamlObject &yamlSets = tuningData["sets"];
-	if (!yamlSets.isList()) {
-		LOG(RkISP1Lsc, Error)
-			<< "'sets' parameter not found in tuning file";
-		return -EINVAL;
-	}
-
-	const auto &sets = yamlSets.asList();
-	for (const auto &yamlSet : sets) {
+	for (const auto &yamlSet : yamlSets.asList()) {
 		uint32_t ct = yamlSet["ct"].get<uint32_t>(0);
 
-		if (sets_.count(ct)) {
+		if (sets->count(ct)) {
 			LOG(RkISP1Lsc, Error)
 				<< "Multiple sets found for color temperature "
 				<< ct;
-			return -EINVAL;
+			return nullptr;
 		}
 
-		Components &set = sets_[ct];
+		Components &set = (*sets)[ct];
 
 		set.ct = ct;
 		set.r = parseTable(yamlSet, "r");
@@ -138,15 +131,54 @@ int LensShadingCorrection::init([[maybe_unused]] IPAContext &context,
 			LOG(RkISP1Lsc, Error)
 				<< "Set for color temperature " << ct
 				<< " is missing tables";
-			return -EINVAL;
+			return nullptr;
 		}
 	}
 
-	if (sets_.empty()) {
+	if (sets->empty()) {
 		LOG(RkISP1Lsc, Error) << "Failed to load any sets";
+		return nullptr;
+	}
+
+	return sets;
+}
+
+/**
+ * \copydoc libcamera::ipa::Algorithm::init
+ */
+int LensShadingCorrection::init([[maybe_unused]] IPAContext &context,
+				const YamlObject &tuningData)
+{
+	xSize_ = parseSizes(tuningData, "x-size");
+	ySize_ = parseSizes(tuningData, "y-size");
+
+	if (xSize_.empty() || ySize_.empty())
+		return -EINVAL;
+
+	ctQuantum_ = tuningData["ct-quantum"].get<uint32_t>(kDefaultCtQuantum);
+	if (!ctQuantum_) {
+		LOG(RkISP1Lsc, Error)
+			<< "Invalid 'ct-quantum' value: must be at least 1";
+		return -EINVAL;
+	}
+
+	/* Get all defined sets to apply. */
+	const YamlObject &yamlSets = tuningData["sets"];
+	if (!yamlSets.isList()) {
+		LOG(RkISP1Lsc, Error)
+			<< "'sets' parameter not found in tuning file";
 		return -EINVAL;
 	}
 
+	/*
+	 * The tables are large, share them with the other cameras that use the
+	 * same tuning file.
+	 */
+	sets_ = TuningData::share<std::map<uint32_t, Components>>(
+		yamlSets, [&]() { return parseSets(yamlSets); });
+	if (!sets_)
+		return -EINVAL;
+
 	return 0;
 }
 
@@ -181,6 +213,9 @@ int LensShadingCorrection::configure(IPAContext &context,
 		yGrad_[i] = std::round(32768 / ySizes_[i]);
 	}
 
+	/* The new configuration needs the tables to be programmed again. */
+	lastSet_ = nullptr;
+
 	context.configuration.lsc.enabled = true;
 	return 0;
 }
@@ -211,7 +246,7 @@ void LensShadingCorrection::copyTable(rkisp1_cif_isp_lsc_config &config,
 /*
  * Interpolate LSC parameters based on color temperature value.
  */
-void LensShadingCorrection::interpolateTable(rkisp1_cif_isp_lsc_config &config,
+void LensShadingCorrection::interpolateTable(Components &set,
 					     const Components &set0,
 					     const Components &set1,
 					     const uint32_t ct)
@@ -219,27 +254,71 @@ void LensShadingCorrection::interpolateTable(rkisp1_cif_isp_lsc_config &config,
 	double coeff0 = (set1.ct - ct) / static_cast<double>(set1.ct - set0.ct);
 	double coeff1 = (ct - set0.ct) / static_cast<double>(set1.ct - set0.ct);
 
-	for (unsigned int i = 0; i < RKISP1_CIF_ISP_LSC_SAMPLES_MAX; ++i) {
-		for (unsigned int j = 0; j < RKISP1_CIF_ISP_LSC_SAMPLES_MAX; ++j) {
-			unsigned int sample = i * RKISP1_CIF_ISP_LSC_SAMPLES_MAX + j;
+	auto interpolate = [&](std::vector<uint16_t> &table,
+			       const std::vector<uint16_t> &table0,
+			       const std::vector<uint16_t> &table1) {
+		table.resize(table0.size());
 
-			config.r_data_tbl[i][j] =
-				set0.r[sample] * coeff0 +
-				set1.r[sample] * coeff1;
+		for (unsigned int i = 0; i < table.size(); ++i)
+			table[i] = table0[i] * coeff0 + table1[i] * coeff1;
+	};
 
-			config.gr_data_tbl[i][j] =
-				set0.gr[sample] * coeff0 +
-				set1.gr[sample] * coeff1;
+	set.ct = ct;
+	interpolate(set.r, set0.r, set1.r);
+	interpolate(set.gr, set0.gr, set1.gr);
+	interpolate(set.gb, set0.gb, set1.gb);
+	interpolate(set.b, set0.b, set1.b);
+}
 
-			config.gb_data_tbl[i][j] =
-				set0.gb[sample] * coeff0 +
-				set1.gb[sample] * coeff1;
+/*
+ * Find the LSC tables to apply for a quantized color temperature. The tables
+ * are either one of the sets from the tuning file, or interpolated between
+ * the two neighbouring sets. Interpolated tables are computed the first time
+ * they are needed and cached, the returned reference stays valid until the
+ * algorithm is destroyed.
+ */
+const LensShadingCorrection::Components &
+LensShadingCorrection::tablesForCt(uint32_t ct)
+{
+	/*
+	 * The color temperature matches exactly one of the available LSC tables.
+	 */
+	auto iter = sets_->find(ct);
+	if (iter != sets_->end())
+		return iter->second;
 
-			config.b_data_tbl[i][j] =
-				set0.b[sample] * coeff0 +
-				set1.b[sample] * coeff1;
-		}
+	/* No shortcuts left; we need to round or interpolate */
+	iter = sets_->upper_bound(ct);
+	const Components &set1 = iter->second;
+	const Components &set0 = (--iter)->second;
+	uint32_t ct0 = set0.ct;
+	uint32_t ct1 = set1.ct;
+	uint32_t diff0 = ct - ct0;
+	uint32_t diff1 = ct1 - ct;
+	static constexpr double kThreshold = 0.1;
+	float threshold = kThreshold * (ct1 - ct0);
+
+	if (diff0 < threshold || diff1 < threshold) {
+		const Components &set = diff0 < diff1 ? set0 : set1;
+		LOG(RkISP1Lsc, Debug) << "using LSC table for " << set.ct;
+		return set;
 	}
+
+	auto cached = interpolated_.find(ct);
+	if (cached != interpolated_.end())
+		return cached->second;
+
+	/*
+	 * ct is not within 10% of the difference between the neighbouring
+	 * color temperatures, so we need to interpolate.
+	 */
+	LOG(RkISP1Lsc, Debug)
+		<< "ct is " << ct << ", interpolating between "
+		<< ct0 << " and " << ct1;
+
+	Components &set = interpolated_[ct];
+	interpolateTable(set, set0, set1, ct);
+	return set;
 }
 
 /**
@@ -256,83 +335,41 @@ void LensShadingCorrection::prepare(IPAContext &context,
 	 * If there is only one set, the configuration has already been done
 	 * for first frame.
 	 */
-	if (sets_.size() == 1 && frame > 0)
+	if (sets_->size() == 1 && frame > 0)
 		return;
 
 	/*
-	 * If there is only one set, pick it. We can ignore lastCt_, as it will
+	 * If there is only one set, pick it. We can ignore lastSet_, as it will
 	 * never be relevant.
 	 */
-	if (sets_.size() == 1) {
+	if (sets_->size() == 1) {
 		setParameters(params);
-		copyTable(config, sets_.cbegin()->second);
+		copyTable(config, sets_->cbegin()->second);
 		return;
 	}
 
-	uint32_t ct = context.activeState.awb.temperatureK;
-	ct = std::clamp(ct, sets_.cbegin()->first, sets_.crbegin()->first);
-
 	/*
-	 * If the original is the same, then it means the same adjustment would
-	 * be made. If the adjusted is the same, then it means that it's the
-	 * same as what was actually applied. Thus in these cases we can skip
-	 * reprogramming the LSC.
-	 *
-	 * original == adjusted can only happen if an interpolation
-	 * happened, or if original has an exact entry in sets_. This means
-	 * that if original != adjusted, then original was adjusted to
-	 * the nearest available entry in sets_, resulting in adjusted.
-	 * Clearly, any ct value that is in between original and adjusted
-	 * will be adjusted to the same adjusted value, so we can skip
-	 * reprogramming the LSC table.
-	 *
-	 * We also skip updating the original value, as the last one had a
-	 * larger bound and thus a larger range of ct values that will be
-	 * adjusted to the same adjusted.
+	 * Quantize the color temperature to the closest bucket, to avoid
+	 * reprogramming the LSC for every small change of the AWB estimate,
+	 * and to bound the number of interpolated tables to cache.
 	 */
-	if ((lastCt_.original <= ct && ct <= lastCt_.adjusted) ||
-	    (lastCt_.adjusted <= ct && ct <= lastCt_.original))
-		return;
-
-	setParameters(params);
+	uint32_t ct = context.activeState.awb.temperatureK;
+	ct = (ct + ctQuantum_ / 2) / ctQuantum_ * ctQuantum_;
+	ct = std::clamp(ct, sets_->cbegin()->first, sets_->crbegin()->first);
 
 	/*
-	 * The color temperature matches exactly one of the available LSC tables.
+	 * Neighbouring buckets may resolve to the same tables, when they are
+	 * rounded to the nearest available entry in sets_. In that case, or
+	 * if the bucket hasn't changed, the LSC is already programmed with
+	 * the right tables and we can skip reprogramming it.
 	 */
-	if (sets_.count(ct)) {
-		copyTable(config, sets_[ct]);
-		lastCt_ = { ct, ct };
-		return;
-	}
-
-	/* No shortcuts left; we need to round or interpolate */
-	auto iter = sets_.upper_bound(ct);
-	const Components &set1 = iter->second;
-	const Components &set0 = (--iter)->second;
-	uint32_t ct0 = set0.ct;
-	uint32_t ct1 = set1.ct;
-	uint32_t diff0 = ct - ct0;
-	uint32_t diff1 = ct1 - ct;
-	static constexpr double kThreshold = 0.1;
-	float threshold = kThreshold * (ct1 - ct0);
-
-	if (diff0 < threshold || diff1 < threshold) {
-		const Components &set = diff0 < diff1 ? set0 : set1;
-		LOG(RkISP1Lsc, Debug) << "using LSC table for " << set.ct;
-		copyTable(config, set);
-		lastCt_ = { ct, set.ct };
+	const Components &set = tablesForCt(ct);
+	if (&set == lastSet_)
 		return;
-	}
 
-	/*
-	 * ct is not within 10% of the difference between the neighbouring
-	 * color temperatures, so we need to interpolate.
-	 */
-	LOG(RkISP1Lsc, Debug)
-		<< "ct is " << ct << ", interpolating between "
-		<< ct0 << " and " << ct1;
-	interpolateTable(config, set0, set1, ct);
-	lastCt_ = { ct, ct };
+	setParameters(params);
+	copyTable(config, set);
+	lastSet_ = &set;
 }
 
 REGISTER_IPA_ALGORITHM(LensShadingCorrection, "LensShadingCorrection")
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 
 #include "algorithm.h"
 
@@ -36,23 +37,28 @@ private:
 		std::vector<uint16_t> b;
 	};
 
+	static std::shared_ptr<std::map<uint32_t, Components>>
+	parseSets(const YamlObject &yamlSets);
+
 	void setParameters(rkisp1_params_cfg *params);
 	void copyTable(rkisp1_cif_isp_lsc_config &config, const Components &set0);
-	void interpolateTable(rkisp1_cif_isp_lsc_config &config,
+	void interpolateTable(Components &set,
 			      const Components &set0, const Components &set1,
 			      const uint32_t ct);
+	const Components &tablesForCt(uint32_t ct);
+
+	static constexpr uint32_t kDefaultCtQuantum = 100;
 
-	std::map<uint32_t, Components> sets_;
+	std::shared_ptr<const std::map<uint32_t, Components>> sets_;
+	std::map<uint32_t, Components> interpolated_;
+	uint32_t ctQuantum_;
 	std::vector<double> xSize_;
 	std::vector<double> ySize_;
 	uint16_t xGrad_[RKISP1_CIF_ISP_LSC_SECTORS_TBL_SIZE];
 	uint16_t yGrad_[RKISP1_CIF_ISP_LSC_SECTORS_TBL_SIZE];
 	uint16_t xSizes_[RKISP1_CIF_ISP_LSC_SECTORS_TBL_SIZE];
 	uint16_t ySizes_[RKISP1_CIF_ISP_LSC_SECTORS_TBL_SIZE];
-	struct {
-		uint32_t original;
-		uint32_t adjusted;
-	} lastCt_;
+	const Components *lastSet_;
 };
 
 } /* namespace ipa::rkisp1::algorithms */
@@ -8,13 +8,13 @@
 #include <algorithm>
 #include <math.h>
 #include <queue>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <linux/rkisp1-config.h>
 #include <linux/v4l2-controls.h>
 
-#include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
 
 #include <libcamera/control_ids.h>
@@ -30,6 +30,9 @@
 
 #include "algorithms/algorithm.h"
 #include "libipa/camera_sensor_helper.h"
+#include "libipa/params_tracker.h"
+#include "libipa/persistent_state.h"
+#include "libipa/tuning_data.h"
 
 #include "ipa_context.h"
 
@@ -53,7 +56,7 @@ public:
 		 const IPACameraSensorInfo &sensorInfo,
 		 const ControlInfoMap &sensorControls,
 		 ControlInfoMap *ipaControls) override;
-	int start() override;
+	int start(const ControlList &controls, ControlList *sensorControls) override;
 	void stop() override;
 
 	int configure(const IPAConfigInfo &ipaConfig,
@@ -74,7 +77,11 @@ private:
 	void updateControls(const IPACameraSensorInfo &sensorInfo,
 			    const ControlInfoMap &sensorControls,
 			    ControlInfoMap *ipaControls);
+	ControlList makeSensorControls(uint32_t exposure, double gain) const;
 	void setControls(unsigned int frame);
+	void loadState();
+	void storeState();
+	void skipUnchangedParams(const uint32_t frame, rkisp1_params_cfg *params);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
 	std::map<unsigned int, MappedFrameBuffer> mappedBuffers_;
@@ -86,6 +93,15 @@ private:
 
 	/* Local parameter storage */
 	struct IPAContext context_;
+
+	/* Contents of the parameter blocks programmed to the ISP */
+	ParamsTracker paramsTracker_;
+
+	/* AGC and AWB results persisted across camera sessions */
+	PersistentState state_;
+
+	/* Tuning data, shared with the other cameras using the same file */
+	std::shared_ptr<const YamlObject> tuningData_;
 };
 
 namespace {
@@ -112,6 +128,42 @@ const ControlInfoMap::Map rkisp1Controls{
 	{ &controls::draft::NoiseReductionMode, ControlInfo(controls::draft::NoiseReductionModeValues) },
 };
 
+/* Parameter blocks, with the module they configure */
+struct ParamsBlock {
+	uint32_t module;
+	size_t offset;
+	size_t size;
+};
+
+#define PARAMS_BLOCK(module, member)					\
+	{								\
+		RKISP1_CIF_ISP_MODULE_##module,				\
+		offsetof(rkisp1_params_cfg, member),			\
+		sizeof(rkisp1_params_cfg::member),			\
+	}
+
+const ParamsBlock paramsBlocks[] = {
+	PARAMS_BLOCK(DPCC, others.dpcc_config),
+	PARAMS_BLOCK(BLS, others.bls_config),
+	PARAMS_BLOCK(SDG, others.sdg_config),
+	PARAMS_BLOCK(HST, meas.hst_config),
+	PARAMS_BLOCK(LSC, others.lsc_config),
+	PARAMS_BLOCK(AWB_GAIN, others.awb_gain_config),
+	PARAMS_BLOCK(FLT, others.flt_config),
+	PARAMS_BLOCK(BDM, others.bdm_config),
+	PARAMS_BLOCK(CTK, others.ctk_config),
+	PARAMS_BLOCK(GOC, others.goc_config),
+	PARAMS_BLOCK(CPROC, others.cproc_config),
+	PARAMS_BLOCK(AFC, meas.afc_config),
+	PARAMS_BLOCK(AWB, meas.awb_meas_config),
+	PARAMS_BLOCK(IE, others.ie_config),
+	PARAMS_BLOCK(AEC, meas.aec_config),
+	PARAMS_BLOCK(DPF, others.dpf_config),
+	PARAMS_BLOCK(DPF_STRENGTH, others.dpf_strength_config),
+};
+
+#undef PARAMS_BLOCK
+
 } /* namespace */
 
 IPARkISP1::IPARkISP1()
@@ -159,18 +211,11 @@ int IPARkISP1::init(const IPASettings &settings, unsigned int hwRevision,
 						   * 1.0s / sensorInfo.pixelRate;
 
 	/* Load the tuning data file. */
-	File file(settings.configurationFile);
-	if (!file.open(File::OpenModeFlag::ReadOnly)) {
-		int ret = file.error();
-		LOG(IPARkISP1, Error)
-			<< "Failed to open configuration file "
-			<< settings.configurationFile << ": " << strerror(-ret);
+	int ret = TuningData::load(settings.configurationFile, &tuningData_);
+	if (ret)
 		return ret;
-	}
 
-	std::unique_ptr<libcamera::YamlObject> data = YamlParser::parse(file);
-	if (!data)
-		return -EINVAL;
+	const YamlObject *data = tuningData_.get();
 
 	unsigned int version = (*data)["version"].get<uint32_t>(0);
 	if (version != 1) {
@@ -185,19 +230,39 @@ int IPARkISP1::init(const IPASettings &settings, unsigned int hwRevision,
 		return -EINVAL;
 	}
 
-	int ret = createAlgorithms(context_, (*data)["algorithms"]);
+	ret = createAlgorithms(context_, (*data)["algorithms"]);
 	if (ret)
 		return ret;
 
 	/* Initialize controls. */
 	updateControls(sensorInfo, sensorControls, ipaControls);
 
+	state_.init("rkisp1-" + settings.sensorModel);
+
 	return 0;
 }
 
-int IPARkISP1::start()
+int IPARkISP1::start(const ControlList &controls, ControlList *sensorControls)
 {
-	setControls(0);
+	/* The ISP configuration isn't retained across streaming sessions. */
+	paramsTracker_.reset();
+
+	/*
+	 * Apply the controls passed to Camera::start(), and return the initial
+	 * exposure and gain to the pipeline handler to program them before
+	 * streaming starts. This ensures the first frames are captured with
+	 * the AGC initial values instead of whatever the sensor was last set
+	 * to, shortening the time to the first usable frame.
+	 */
+	queueRequest(0, controls);
+
+	const auto &agc = context_.activeState.agc;
+	if (agc.autoEnabled)
+		*sensorControls = makeSensorControls(agc.automatic.exposure,
+						     agc.automatic.gain);
+	else
+		*sensorControls = makeSensorControls(agc.manual.exposure,
+						     agc.manual.gain);
 
 	return 0;
 }
@@ -205,6 +270,17 @@ int IPARkISP1::start()
 void IPARkISP1::stop()
 {
 	context_.frameContexts.clear();
+
+	storeState();
+
+	const ParamsTracker::Statistics &stats = paramsTracker_.statistics();
+	if (stats.frames)
+		LOG(IPARkISP1, Debug)
+			<< "Updated " << stats.updated << " and skipped "
+			<< stats.skipped << " parameter blocks over "
+			<< stats.frames << " frames, "
+			<< static_cast<double>(stats.updated) / stats.frames
+			<< " updates per frame";
 }
 
 int IPARkISP1::configure(const IPAConfigInfo &ipaConfig,
@@ -273,6 +349,8 @@ int IPARkISP1::configure(const IPAConfigInfo &ipaConfig,
 			return ret;
 	}
 
+	loadState();
+
 	return 0;
 }
 
@@ -332,9 +410,38 @@ void IPARkISP1::fillParamsBuffer(const uint32_t frame, const uint32_t bufferId)
 	for (auto const &algo : algorithms())
 		algo->prepare(context_, frame, frameContext, params);
 
+	skipUnchangedParams(frame, params);
+
 	paramsBufferReady.emit(frame);
 }
 
+/*
+ * Many algorithms fill their parameter block for every frame, even when the
+ * values haven't changed. Clear the configuration update flag of the blocks
+ * whose contents are identical to the ones last programmed to the ISP, to
+ * avoid reprogramming the hardware needlessly.
+ */
+void IPARkISP1::skipUnchangedParams(const uint32_t frame,
+				    rkisp1_params_cfg *params)
+{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(params);
+
+	paramsTracker_.startFrame();
+
+	for (const ParamsBlock &block : paramsBlocks) {
+		if (!(params->module_cfg_update & block.module))
+			continue;
+
+		if (!paramsTracker_.update(block.module,
+					   { data + block.offset, block.size }))
+			params->module_cfg_update &= ~block.module;
+	}
+
+	LOG(IPARkISP1, Debug)
+		<< "Frame " << frame << ": updating "
+		<< paramsTracker_.frameUpdates() << " parameter blocks";
+}
+
 void IPARkISP1::processStatsBuffer(const uint32_t frame, const uint32_t bufferId,
 				   const ControlList &sensorControls)
 {
@@ -435,14 +542,76 @@ void IPARkISP1::setControls(unsigned int frame)
 	 */
 
 	IPAFrameContext &frameContext = context_.frameContexts.get(frame);
-	uint32_t exposure = frameContext.agc.exposure;
-	uint32_t gain = camHelper_->gainCode(frameContext.agc.gain);
 
+	setSensorControls.emit(frame,
+			       makeSensorControls(frameContext.agc.exposure,
+						  frameContext.agc.gain));
+}
+
+ControlList IPARkISP1::makeSensorControls(uint32_t exposure, double gain) const
+{
 	ControlList ctrls(sensorControls_);
 	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure));
-	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN,
+		  static_cast<int32_t>(camHelper_->gainCode(gain)));
+
+	return ctrls;
+}
+
+/*
+ * Seed the AGC and AWB with the results of the previous session, to shorten
+ * convergence when the camera is started. The values are clamped to the limits
+ * of the current configuration.
+ */
+void IPARkISP1::loadState()
+{
+	if (context_.configuration.raw || state_.load())
+		return;
+
+	const auto &sensor = context_.configuration.sensor;
+	auto &agc = context_.activeState.agc;
+	auto &awb = context_.activeState.awb;
+
+	auto exposureTime = state_.get("agc.exposure_time");
+	auto gain = state_.get("agc.analogue_gain");
+	if (exposureTime && gain && sensor.lineDuration > 0s) {
+		utils::Duration exposure = std::clamp<utils::Duration>(*exposureTime * 1.0us,
+								       sensor.minShutterSpeed,
+								       sensor.maxShutterSpeed);
+		agc.automatic.exposure = exposure / sensor.lineDuration;
+		agc.automatic.gain = std::clamp(*gain, sensor.minAnalogueGain,
+						sensor.maxAnalogueGain);
+	}
+
+	auto red = state_.get("awb.red_gain");
+	auto blue = state_.get("awb.blue_gain");
+	auto temperature = state_.get("awb.colour_temperature");
+	if (red && blue && temperature && *red > 0 && *blue > 0 && *temperature > 0) {
+		awb.gains.automatic.red = *red;
+		awb.gains.automatic.blue = *blue;
+		awb.temperatureK = *temperature;
+	}
+
+	LOG(IPARkISP1, Debug) << "Restored algorithms state";
+}
+
+void IPARkISP1::storeState()
+{
+	if (context_.configuration.raw || !state_.isEnabled())
+		return;
+
+	const auto &agc = context_.activeState.agc;
+	const auto &awb = context_.activeState.awb;
+
+	state_.set("agc.exposure_time",
+		   (agc.automatic.exposure * context_.configuration.sensor.lineDuration)
+			   .get<std::micro>());
+	state_.set("agc.analogue_gain", agc.automatic.gain);
+	state_.set("awb.red_gain", awb.gains.automatic.red);
+	state_.set("awb.blue_gain", awb.gains.automatic.blue);
+	state_.set("awb.colour_temperature", awb.temperatureK);
 
-	setSensorControls.emit(frame, ctrls);
+	state_.store();
 }
 
 } /* namespace ipa::rkisp1 */
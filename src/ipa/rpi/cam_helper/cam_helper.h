@@ -39,7 +39,9 @@ namespace RPiController {
  * A function to return the number of frames of delay between updating exposure,
  * analogue gain and vblanking, and for the changes to take effect. For many
  * sensors these take the values 2, 1 and 2 respectively, but sensors that are
- * different will need to over-ride the default function provided.
+ * different will need to over-ride the default function provided. The delays
+ * are queried again every time a camera mode is set, so sensors that apply
+ * controls faster in some modes may return delays based on mode_.
  *
  * A function to query if the sensor outputs embedded data that can be parsed.
  *
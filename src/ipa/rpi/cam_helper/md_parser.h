@@ -127,8 +127,17 @@ public:
 			       RegisterMap &registers) override;
 
 private:
-	/* Maps register address to offset in the buffer. */
-	using OffsetMap = std::map<uint32_t, std::optional<uint32_t>>;
+	/*
+	 * Offsets in the buffer of a register value, and of the tag that
+	 * precedes it, used to check that the layout hasn't changed.
+	 */
+	struct RegOffset {
+		uint32_t tag;
+		uint32_t value;
+	};
+
+	/* Maps register address to offsets in the buffer. */
+	using OffsetMap = std::map<uint32_t, std::optional<RegOffset>>;
 
 	/*
 	 * Note that error codes > 0 are regarded as non-fatal; codes < 0
@@ -147,6 +156,7 @@ private:
 		BadPadding   = -5
 	};
 
+	bool validateOffsets(libcamera::Span<const uint8_t> buffer) const;
 	ParseStatus findRegs(libcamera::Span<const uint8_t> buffer);
 
 	OffsetMap offsets_;
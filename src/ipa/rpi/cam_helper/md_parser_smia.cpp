@@ -5,6 +5,8 @@
  * SMIA specification based embedded data parser
  */
 
+#include <string.h>
+
 #include <libcamera/base/log.h>
 #include "md_parser.h"
 
@@ -36,6 +38,15 @@ MdParserSmia::MdParserSmia(std::initializer_list<uint32_t> registerList)
 MdParser::Status MdParserSmia::parse(libcamera::Span<const uint8_t> buffer,
 				     RegisterMap &registers)
 {
+	/*
+	 * The embedded data layout doesn't normally change between frames, so
+	 * the offsets found by the last full search are reused as long as the
+	 * tags in front of the values are still where we expect them. Only
+	 * fall back to searching the whole buffer again when they are not.
+	 */
+	if (!reset_ && !validateOffsets(buffer))
+		reset_ = true;
+
 	if (reset_) {
 		/*
 		 * Search again through the metadata for all the registers
@@ -66,12 +77,23 @@ MdParser::Status MdParserSmia::parse(libcamera::Span<const uint8_t> buffer,
 			reset_ = true;
 			return NOTFOUND;
 		}
-		registers[reg] = buffer[offset.value()];
+		registers[reg] = buffer[offset->value];
 	}
 
 	return OK;
 }
 
+bool MdParserSmia::validateOffsets(libcamera::Span<const uint8_t> buffer) const
+{
+	for (const auto &[reg, offset] : offsets_) {
+		if (!offset || offset->value >= buffer.size() ||
+		    buffer[offset->tag] != RegValue)
+			return false;
+	}
+
+	return true;
+}
+
 MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t> buffer)
 {
 	ASSERT(offsets_.size());
@@ -84,6 +106,7 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 	unsigned int regNum = 0, regsDone = 0;
 
 	while (1) {
+		unsigned int tagOffset = currentOffset;
 		int tag = buffer[currentOffset++];
 
 		/* Non-dummy bytes come in even-sized blocks: skip can only ever follow tag */
@@ -117,13 +140,20 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 				if (buffer[currentOffset] != LineStart)
 					return NoLineStart;
 			} else {
-				/* allow a zero line length to mean "hunt for the next line" */
-				while (currentOffset < buffer.size() &&
-				       buffer[currentOffset] != LineStart)
-					currentOffset++;
+				/*
+				 * Allow a zero line length to mean "hunt for the
+				 * next line". memchr() is vectorised by the C
+				 * library, which matters for long lines.
+				 */
+				if (currentOffset >= buffer.size())
+					return NoLineStart;
 
-				if (currentOffset == buffer.size())
+				const void *next = memchr(&buffer[currentOffset], LineStart,
+							  buffer.size() - currentOffset);
+				if (!next)
 					return NoLineStart;
+
+				currentOffset = static_cast<const uint8_t *>(next) - buffer.data();
 			}
 
 			/* inc currentOffset to after LineStart */
@@ -139,7 +169,7 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 				auto reg = offsets_.find(regNum);
 
 				if (reg != offsets_.end()) {
-					offsets_[regNum] = currentOffset - 1;
+					reg->second = RegOffset{ tagOffset, currentOffset - 1 };
 
 					if (++regsDone == offsets_.size())
 						return ParseOk;
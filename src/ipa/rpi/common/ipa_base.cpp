@@ -207,6 +207,16 @@ int32_t IpaBase::configure(const IPACameraSensorInfo &sensorInfo, const ConfigPa
 	/* The pipeline handler passes out the mode's sensitivity. */
 	result->modeSensitivity = mode_.sensitivity;
 
+	/* Pass out the control delays, they may depend on the sensor mode. */
+	int gainDelay, exposureDelay, vblankDelay, hblankDelay;
+	helper_->getDelays(exposureDelay, gainDelay, vblankDelay, hblankDelay);
+
+	result->sensorConfig.gainDelay = gainDelay;
+	result->sensorConfig.exposureDelay = exposureDelay;
+	result->sensorConfig.vblankDelay = vblankDelay;
+	result->sensorConfig.hblankDelay = hblankDelay;
+	result->sensorConfig.sensorMetadata = helper_->sensorEmbeddedDataPresent();
+
 	if (firstStart_) {
 		/* Supply initial values for frame durations. */
 		applyFrameDurations(defaultMinFrameDuration, defaultMaxFrameDuration);
@@ -6,8 +6,10 @@
  */
 
 #include "algorithm.h"
+#include "device_status.h"
 
 using namespace RPiController;
+using namespace std::literals::chrono_literals;
 
 int Algorithm::read([[maybe_unused]] const libcamera::YamlObject &params)
 {
@@ -32,6 +34,23 @@ void Algorithm::process([[maybe_unused]] StatisticsPtr &stats,
 {
 }
 
+std::optional<std::vector<std::string>> Algorithm::dependencies() const
+{
+	return std::nullopt;
+}
+
+libcamera::utils::Duration Algorithm::frameDuration(Metadata *imageMetadata)
+{
+	DeviceStatus deviceStatus;
+
+	/* Assume 30fps when the device status isn't available. */
+	if (imageMetadata->get("device.status", deviceStatus) != 0 ||
+	    !deviceStatus.frameLength)
+		return 1.0s / 30;
+
+	return deviceStatus.frameLength * deviceStatus.lineLength;
+}
+
 /* For registering algorithms with the system: */
 
 namespace {
@@ -14,6 +14,8 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <optional>
+#include <vector>
 
 #include "libcamera/internal/yaml_parser.h"
 
@@ -37,6 +39,15 @@ public:
 	virtual void switchMode(CameraMode const &cameraMode, Metadata *metadata);
 	virtual void prepare(Metadata *imageMetadata);
 	virtual void process(StatisticsPtr &stats, Metadata *imageMetadata);
+	/*
+	 * Algorithms that can run concurrently with others return the names of
+	 * the algorithms whose image metadata they read in prepare() and
+	 * process(). By doing so they also guarantee that no algorithm other
+	 * than those naming them as a dependency reads the metadata they
+	 * produce. Algorithms returning std::nullopt (the default) run in
+	 * sequence, in the order of the tuning file.
+	 */
+	virtual std::optional<std::vector<std::string>> dependencies() const;
 	Metadata &getGlobalMetadata() const
 	{
 		return controller_->getGlobalMetadata();
@@ -49,6 +60,12 @@ public:
 	{
 		return controller_->getHardwareConfig();
 	}
+	int getTaskPriority() const
+	{
+		return controller_->getTaskPriority();
+	}
+	/* Duration of the frame described by the image metadata. */
+	static libcamera::utils::Duration frameDuration(Metadata *imageMetadata);
 
 private:
 	Controller *controller_;
@@ -5,13 +5,15 @@
  * ISP controller
  */
 
+#include <algorithm>
 #include <assert.h>
 
-#include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
 
 #include "libcamera/internal/yaml_parser.h"
 
+#include "libipa/tuning_data.h"
+
 #include "algorithm.h"
 #include "controller.h"
 
@@ -75,8 +77,23 @@ static const std::map<std::string, Controller::HardwareConfig> HardwareConfigMap
 	},
 };
 
+/*
+ * The passed name must be the entire algorithm name, or must match the last
+ * part of it with a period (.) just before.
+ */
+static bool algorithmNameMatches(char const *algoName, std::string const &name)
+{
+	size_t nameLen = name.length();
+	size_t algoNameLen = strlen(algoName);
+	return algoNameLen >= nameLen &&
+	       strcasecmp(name.c_str(), algoName + algoNameLen - nameLen) == 0 &&
+	       (nameLen == algoNameLen ||
+		algoName[algoNameLen - nameLen - 1] == '.');
+}
+
 Controller::Controller()
-	: switchModeCalled_(false)
+	: switchModeCalled_(false), taskPriority_(0), parallel_(false),
+	  stats_(nullptr), imageMetadata_(nullptr)
 {
 }
 
@@ -84,19 +101,27 @@ Controller::~Controller() {}
 
 int Controller::read(char const *filename)
 {
-	File file(filename);
-	if (!file.open(File::OpenModeFlag::ReadOnly)) {
-		LOG(RPiController, Warning)
-			<< "Failed to open tuning file '" << filename << "'";
+	/*
+	 * Keep a reference to the tuning data, for other cameras using the
+	 * same tuning file to share it.
+	 */
+	if (ipa::TuningData::load(filename, &tuningData_))
 		return -EINVAL;
-	}
 
-	std::unique_ptr<YamlObject> root = YamlParser::parse(file);
-	if (!root)
-		return -EINVAL;
+	const YamlObject *root = tuningData_.get();
 
 	double version = (*root)["version"].get<double>(1.0);
 	target_ = (*root)["target"].get<std::string>("bcm2835");
+	/*
+	 * Priority of the asynchronous algorithm jobs of this camera, relative
+	 * to the other cameras sharing the IPA worker pool.
+	 */
+	taskPriority_ = (*root)["task_priority"].get<int>(0);
+	/*
+	 * Run the algorithms that declare their dependencies concurrently on
+	 * the IPA worker pool.
+	 */
+	parallel_ = (*root)["parallel_algorithms"].get<bool>(false);
 
 	if (version < 2.0) {
 		LOG(RPiController, Warning)
@@ -154,6 +179,8 @@ void Controller::initialise()
 {
 	for (auto &algo : algorithms_)
 		algo->initialise();
+
+	createJobs();
 }
 
 void Controller::switchMode(CameraMode const &cameraMode, Metadata *metadata)
@@ -166,15 +193,110 @@ void Controller::switchMode(CameraMode const &cameraMode, Metadata *metadata)
 void Controller::prepare(Metadata *imageMetadata)
 {
 	assert(switchModeCalled_);
-	for (auto &algo : algorithms_)
-		algo->prepare(imageMetadata);
+	runJobs(nullptr, imageMetadata);
 }
 
 void Controller::process(StatisticsPtr stats, Metadata *imageMetadata)
 {
 	assert(switchModeCalled_);
-	for (auto &algo : algorithms_)
-		algo->process(stats, imageMetadata);
+	runJobs(&stats, imageMetadata);
+}
+
+void Controller::createJobs()
+{
+	jobs_.clear();
+	jobs_.reserve(algorithms_.size());
+
+	for (unsigned int i = 0; i < algorithms_.size(); i++) {
+		Algorithm *algo = algorithms_[i].get();
+		Job &job = jobs_.emplace_back();
+		job.algorithm = algo;
+
+		if (!parallel_)
+			continue;
+
+		std::optional<std::vector<std::string>> dependencies = algo->dependencies();
+		if (!dependencies)
+			continue;
+
+		bool concurrent = true;
+		for (std::string const &name : *dependencies) {
+			auto it = std::find_if(algorithms_.begin(), algorithms_.end(),
+					       [&](const AlgorithmPtr &other) {
+						       return algorithmNameMatches(other->name(), name);
+					       });
+			if (it == algorithms_.end())
+				continue;
+
+			unsigned int index = it - algorithms_.begin();
+			if (index > i) {
+				/*
+				 * The dependency runs later in the sequence,
+				 * keep the tuning file order.
+				 */
+				LOG(RPiController, Warning)
+					<< algo->name() << " depends on " << (*it)->name()
+					<< " listed after it, running it sequentially";
+				concurrent = false;
+				break;
+			}
+
+			/*
+			 * Dependencies that run in the calling thread have
+			 * completed by the time this job is submitted.
+			 */
+			if (jobs_[index].task)
+				job.dependencies.push_back(index);
+		}
+
+		if (!concurrent) {
+			job.dependencies.clear();
+			continue;
+		}
+
+		job.task = std::make_unique<ipa::TaskScheduler::Task>(
+			algo->name(), [this, algo] { runAlgorithm(algo); },
+			getTaskPriority());
+
+		LOG(RPiController, Debug)
+			<< "Running " << algo->name() << " concurrently";
+	}
+}
+
+/*
+ * Run the algorithms in the tuning file order, waiting for the dependencies of
+ * each job before running it in the calling thread or submitting it to the
+ * worker pool. The call returns once all the jobs have completed.
+ */
+void Controller::runJobs(StatisticsPtr *stats, Metadata *imageMetadata)
+{
+	stats_ = stats;
+	imageMetadata_ = imageMetadata;
+
+	utils::Duration deadline = Algorithm::frameDuration(imageMetadata);
+
+	for (Job &job : jobs_) {
+		for (unsigned int index : job.dependencies)
+			jobs_[index].task->wait();
+
+		if (job.task)
+			job.task->submit(deadline);
+		else
+			runAlgorithm(job.algorithm);
+	}
+
+	for (Job &job : jobs_) {
+		if (job.task)
+			job.task->wait();
+	}
+}
+
+void Controller::runAlgorithm(Algorithm *algorithm)
+{
+	if (stats_)
+		algorithm->process(*stats_, imageMetadata_);
+	else
+		algorithm->prepare(imageMetadata_);
 }
 
 Metadata &Controller::getGlobalMetadata()
@@ -184,19 +306,8 @@ Metadata &Controller::getGlobalMetadata()
 
 Algorithm *Controller::getAlgorithm(std::string const &name) const
 {
-	/*
-	 * The passed name must be the entire algorithm name, or must match the
-	 * last part of it with a period (.) just before.
-	 */
-	size_t nameLen = name.length();
 	for (auto &algo : algorithms_) {
-		char const *algoName = algo->name();
-		size_t algoNameLen = strlen(algoName);
-		if (algoNameLen >= nameLen &&
-		    strcasecmp(name.c_str(),
-			       algoName + algoNameLen - nameLen) == 0 &&
-		    (nameLen == algoNameLen ||
-		     algoName[algoNameLen - nameLen - 1] == '.'))
+		if (algorithmNameMatches(algo->name(), name))
 			return algo.get();
 	}
 	return nullptr;
@@ -207,6 +318,11 @@ const std::string &Controller::getTarget() const
 	return target_;
 }
 
+int Controller::getTaskPriority() const
+{
+	return taskPriority_;
+}
+
 const Controller::HardwareConfig &Controller::getHardwareConfig() const
 {
 	auto cfg = HardwareConfigMap.find(getTarget());
@@ -12,12 +12,15 @@
  * convenient manner.
  */
 
+#include <memory>
 #include <vector>
 #include <string>
 
 #include <libcamera/base/utils.h>
 #include "libcamera/internal/yaml_parser.h"
 
+#include "libipa/task_scheduler.h"
+
 #include "camera_mode.h"
 #include "device_status.h"
 #include "metadata.h"
@@ -62,6 +65,7 @@ public:
 	Algorithm *getAlgorithm(std::string const &name) const;
 	const std::string &getTarget() const;
 	const HardwareConfig &getHardwareConfig() const;
+	int getTaskPriority() const;
 
 protected:
 	int createAlgorithm(const std::string &name, const libcamera::YamlObject &params);
@@ -71,7 +75,32 @@ protected:
 	bool switchModeCalled_;
 
 private:
+	/*
+	 * An algorithm run by prepare() and process(). Algorithms that declare
+	 * their dependencies are run as a task on the IPA worker pool when
+	 * parallel execution is enabled, all others run in the calling thread.
+	 */
+	struct Job {
+		Algorithm *algorithm;
+		/* Indices of the jobs that must complete before this one starts */
+		std::vector<unsigned int> dependencies;
+		std::unique_ptr<libcamera::ipa::TaskScheduler::Task> task;
+	};
+
+	void createJobs();
+	void runJobs(StatisticsPtr *stats, Metadata *imageMetadata);
+	void runAlgorithm(Algorithm *algorithm);
+
 	std::string target_;
+	int taskPriority_;
+	bool parallel_;
+
+	std::shared_ptr<const libcamera::YamlObject> tuningData_;
+
+	std::vector<Job> jobs_;
+	/* Arguments of the prepare() or process() call being run by the jobs */
+	StatisticsPtr *stats_;
+	Metadata *imageMetadata_;
 };
 
 } /* namespace RPiController */
@@ -9,14 +9,92 @@
 /* A simple class for carrying arbitrary metadata, for example about an image. */
 
 #include <any>
+#include <array>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <typeinfo>
+#include <utility>
 
 #include <libcamera/base/thread_annotations.h>
 
 namespace RPiController {
 
+/*
+ * Tags used by the controller algorithms and the IPA. Each of these is
+ * stored in a fixed slot of the Metadata, so that accessing it needs neither
+ * a map lookup nor a memory allocation. Any other tag still works, but is
+ * stored in a (slower) map.
+ */
+constexpr std::array<std::string_view, 25> kMetadataTags = {
+	"device.status",
+	"agc.status",
+	"agc.delayed_status",
+	"agc.prepare_status",
+	"awb.status",
+	"alsc.status",
+	"lux.status",
+	"noise.status",
+	"ccm.status",
+	"black_level.status",
+	"af.status",
+	"focus.status",
+	"pdaf.regions",
+	"tonemap.status",
+	"sharpen.status",
+	"geq.status",
+	"dpc.status",
+	"contrast.status",
+	"denoise.status",
+	"sdn.status",
+	"cdn.status",
+	"tdn.status",
+	"stitch.status",
+	"saturation.status",
+	"cac.status",
+};
+
+class MetadataTag
+{
+public:
+	static constexpr unsigned int kUnregistered = kMetadataTags.size();
+
+	constexpr MetadataTag(const char *name)
+		: MetadataTag(std::string_view(name))
+	{
+	}
+
+	constexpr MetadataTag(std::string_view name)
+		: name_(name), index_(lookup(name))
+	{
+	}
+
+	MetadataTag(std::string const &name)
+		: MetadataTag(std::string_view(name))
+	{
+	}
+
+	constexpr std::string_view name() const { return name_; }
+	constexpr unsigned int index() const { return index_; }
+	constexpr bool registered() const { return index_ != kUnregistered; }
+
+private:
+	static constexpr unsigned int lookup(std::string_view name)
+	{
+		for (unsigned int i = 0; i < kMetadataTags.size(); i++) {
+			if (kMetadataTags[i] == name)
+				return i;
+		}
+
+		return kUnregistered;
+	}
+
+	std::string_view name_;
+	unsigned int index_;
+};
+
 class LIBCAMERA_TSA_CAPABILITY("mutex") Metadata
 {
 public:
@@ -25,59 +103,74 @@ public:
 	Metadata(Metadata const &other)
 	{
 		std::scoped_lock otherLock(other.mutex_);
-		data_ = other.data_;
+		copyFrom(other);
 	}
 
 	Metadata(Metadata &&other)
 	{
 		std::scoped_lock otherLock(other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
+		moveFrom(other);
 	}
 
 	template<typename T>
-	void set(std::string const &tag, T const &value)
+	void set(MetadataTag tag, T const &value)
 	{
 		std::scoped_lock lock(mutex_);
-		data_[tag] = value;
+		setLocked(tag, value);
 	}
 
 	template<typename T>
-	int get(std::string const &tag, T &value) const
+	int get(MetadataTag tag, T &value) const
 	{
 		std::scoped_lock lock(mutex_);
-		auto it = data_.find(tag);
-		if (it == data_.end())
+		const Slot *slot = find(tag);
+		if (!slot)
 			return -1;
-		value = std::any_cast<T>(it->second);
+		if (slot->value->type() != typeid(T))
+			throw std::bad_any_cast();
+		value = static_cast<const Value<T> *>(slot->value.get())->value;
 		return 0;
 	}
 
 	void clear()
 	{
 		std::scoped_lock lock(mutex_);
-		data_.clear();
+		for (Slot &slot : slots_)
+			slot.reset();
+		extra_.clear();
 	}
 
 	Metadata &operator=(Metadata const &other)
 	{
+		if (this == &other)
+			return *this;
+
 		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = other.data_;
+		copyFrom(other);
 		return *this;
 	}
 
 	Metadata &operator=(Metadata &&other)
 	{
+		if (this == &other)
+			return *this;
+
 		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
+		moveFrom(other);
 		return *this;
 	}
 
 	void merge(Metadata &other)
 	{
 		std::scoped_lock lock(mutex_, other.mutex_);
-		data_.merge(other.data_);
+		/* Move the items whose key doesn't exist yet, like std::map::merge(). */
+		for (unsigned int i = 0; i < slots_.size(); i++) {
+			if (slots_[i].valid || !other.slots_[i].valid)
+				continue;
+			slots_[i] = std::move(other.slots_[i]);
+			other.slots_[i].reset();
+		}
+		extra_.merge(other.extra_);
 	}
 
 	void mergeCopy(const Metadata &other)
@@ -85,29 +178,50 @@ public:
 		std::scoped_lock lock(mutex_, other.mutex_);
 		/*
 		 * If the metadata key exists, ignore this item and copy only
-		 * unique key/value pairs.
+		 * unique key/value pairs. The values are shared until either
+		 * copy is modified.
 		 */
-		data_.insert(other.data_.begin(), other.data_.end());
+		for (unsigned int i = 0; i < slots_.size(); i++) {
+			if (!slots_[i].valid && other.slots_[i].valid)
+				slots_[i] = other.slots_[i];
+		}
+		extra_.insert(other.extra_.begin(), other.extra_.end());
 	}
 
 	template<typename T>
-	T *getLocked(std::string const &tag)
+	T *getLocked(MetadataTag tag)
 	{
 		/*
 		 * This allows in-place access to the Metadata contents,
 		 * for which you should be holding the lock.
 		 */
-		auto it = data_.find(tag);
-		if (it == data_.end())
+		Slot *slot = find(tag);
+		if (!slot || slot->value->type() != typeid(T))
 			return nullptr;
-		return std::any_cast<T>(&it->second);
+		/* The value may be modified, stop sharing it with other copies. */
+		if (slot->value.use_count() > 1)
+			slot->value = slot->value->clone();
+		return &static_cast<Value<T> *>(slot->value.get())->value;
 	}
 
 	template<typename T>
-	void setLocked(std::string const &tag, T const &value)
+	void setLocked(MetadataTag tag, T const &value)
 	{
 		/* Use this only if you're holding the lock yourself. */
-		data_[tag] = value;
+		Slot &slot = tag.registered() ? slots_[tag.index()] : extraSlot(tag);
+
+		/*
+		 * Reuse the storage of the previous value when it is of the
+		 * same type and not shared with another copy of the metadata,
+		 * to avoid allocating memory for every frame.
+		 */
+		if (slot.value && slot.value.use_count() == 1 &&
+		    slot.value->type() == typeid(T))
+			static_cast<Value<T> *>(slot.value.get())->value = value;
+		else
+			slot.value = std::make_shared<Value<T>>(value);
+
+		slot.valid = true;
 	}
 
 	/*
@@ -120,8 +234,95 @@ public:
 	void unlock() LIBCAMERA_TSA_RELEASE() { mutex_.unlock(); }
 
 private:
+	struct ValueBase {
+		virtual ~ValueBase() = default;
+		virtual const std::type_info &type() const = 0;
+		virtual std::shared_ptr<ValueBase> clone() const = 0;
+	};
+
+	template<typename T>
+	struct Value : public ValueBase {
+		Value(T const &v)
+			: value(v)
+		{
+		}
+
+		const std::type_info &type() const override { return typeid(T); }
+
+		std::shared_ptr<ValueBase> clone() const override
+		{
+			return std::make_shared<Value<T>>(value);
+		}
+
+		T value;
+	};
+
+	struct Slot {
+		/*
+		 * Values are reference-counted and shared between copies of
+		 * the metadata (copy-on-write). The value of an invalid slot is
+		 * kept for reuse as long as it isn't shared.
+		 */
+		std::shared_ptr<ValueBase> value;
+		bool valid = false;
+
+		void reset()
+		{
+			if (value.use_count() > 1)
+				value.reset();
+			valid = false;
+		}
+	};
+
+	Slot *find(MetadataTag tag)
+	{
+		return const_cast<Slot *>(std::as_const(*this).find(tag));
+	}
+
+	const Slot *find(MetadataTag tag) const
+	{
+		if (tag.registered()) {
+			const Slot &slot = slots_[tag.index()];
+			return slot.valid ? &slot : nullptr;
+		}
+
+		auto it = extra_.find(tag.name());
+		if (it == extra_.end())
+			return nullptr;
+		return &it->second;
+	}
+
+	Slot &extraSlot(MetadataTag tag)
+	{
+		auto it = extra_.find(tag.name());
+		if (it == extra_.end())
+			it = extra_.emplace(std::string(tag.name()), Slot{}).first;
+		return it->second;
+	}
+
+	void copyFrom(Metadata const &other)
+	{
+		for (unsigned int i = 0; i < slots_.size(); i++) {
+			if (other.slots_[i].valid)
+				slots_[i] = other.slots_[i];
+			else
+				slots_[i].reset();
+		}
+		extra_ = other.extra_;
+	}
+
+	void moveFrom(Metadata &other)
+	{
+		slots_ = std::move(other.slots_);
+		extra_ = std::move(other.extra_);
+		for (Slot &slot : other.slots_)
+			slot = {};
+		other.extra_.clear();
+	}
+
 	mutable std::mutex mutex_;
-	std::map<std::string, std::any> data_;
+	std::array<Slot, kMetadataTags.size()> slots_;
+	std::map<std::string, Slot, std::less<>> extra_;
 };
 
 } /* namespace RPiController */
@@ -7,6 +7,7 @@
 
 #include "af.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <math.h>
 #include <stdlib.h>
@@ -51,7 +52,9 @@ Af::SpeedDependentParams::SpeedDependentParams()
 	  maxSlew(2.0),
 	  pdafFrames(20),
 	  dropoutFrames(6),
-	  stepFrames(4)
+	  stepFrames(4),
+	  pdafJumpConf(0.0),
+	  fineFallback(false)
 {
 }
 
@@ -93,6 +96,12 @@ void Af::SpeedDependentParams::read(const libcamera::YamlObject &params)
 	readNumber<uint32_t>(pdafFrames, params, "pdaf_frames");
 	readNumber<uint32_t>(dropoutFrames, params, "dropout_frames");
 	readNumber<uint32_t>(stepFrames, params, "step_frames");
+
+	/* The PDAF fast path is optional, and disabled by default. */
+	if (params.contains("pdaf_jump_conf"))
+		readNumber<double>(pdafJumpConf, params, "pdaf_jump_conf");
+	if (params.contains("fine_fallback"))
+		readNumber<bool>(fineFallback, params, "fine_fallback");
 }
 
 int Af::CfgParams::read(const libcamera::YamlObject &params)
@@ -163,6 +172,7 @@ void Af::CfgParams::initialise()
 /* Af Algorithm class */
 
 static constexpr unsigned MaxWindows = 10;
+static constexpr unsigned MaxCachedWeights = 4;
 
 Af::Af(Controller *controller)
 	: AfAlgorithm(controller),
@@ -176,6 +186,7 @@ Af::Af(Controller *controller)
 	  useWindows_(false),
 	  phaseWeights_(),
 	  contrastWeights_(),
+	  weightsCache_(),
 	  scanState_(ScanState::Idle),
 	  initted_(false),
 	  ftarget_(-1.0),
@@ -184,6 +195,8 @@ Af::Af(Controller *controller)
 	  skipCount_(0),
 	  stepCount_(0),
 	  dropCount_(0),
+	  jump_(false),
+	  pdafFocus_(),
 	  scanMaxContrast_(0.0),
 	  scanMinContrast_(1.0e9),
 	  scanData_(),
@@ -223,6 +236,8 @@ void Af::switchMode(CameraMode const &cameraMode, [[maybe_unused]] Metadata *met
 {
 	(void)metadata;
 
+	cacheWeights();
+
 	/* Assume that PDAF and Focus stats grids cover the visible area */
 	statsRegion_.x = (int)cameraMode.cropX;
 	statsRegion_.y = (int)cameraMode.cropY;
@@ -233,7 +248,10 @@ void Af::switchMode(CameraMode const &cameraMode, [[maybe_unused]] Metadata *met
 			  << statsRegion_.y << ','
 			  << statsRegion_.width << ','
 			  << statsRegion_.height;
-	invalidateWeights();
+	if (!restoreWeights()) {
+		phaseWeights_.sum = 0;
+		contrastWeights_.sum = 0;
+	}
 
 	if (scanState_ >= ScanState::Coarse && scanState_ < ScanState::Settle) {
 		/*
@@ -307,6 +325,42 @@ void Af::invalidateWeights()
 {
 	phaseWeights_.sum = 0;
 	contrastWeights_.sum = 0;
+	weightsCache_.clear();
+}
+
+/*
+ * The weights only depend on the statistics region and on the AF windows.
+ * Keep those of the last few modes, so that switching back and forth between
+ * modes, e.g. for still captures, doesn't recompute them.
+ */
+void Af::cacheWeights()
+{
+	if (phaseWeights_.sum == 0 && contrastWeights_.sum == 0)
+		return;
+
+	auto it = std::find_if(weightsCache_.begin(), weightsCache_.end(),
+			       [&](const CachedWeights &c) {
+				       return c.statsRegion == statsRegion_;
+			       });
+	if (it != weightsCache_.end())
+		weightsCache_.erase(it);
+	else if (weightsCache_.size() >= MaxCachedWeights)
+		weightsCache_.erase(weightsCache_.begin());
+
+	weightsCache_.push_back({ statsRegion_, phaseWeights_, contrastWeights_ });
+}
+
+bool Af::restoreWeights()
+{
+	for (const CachedWeights &c : weightsCache_) {
+		if (c.statsRegion == statsRegion_) {
+			phaseWeights_ = c.phase;
+			contrastWeights_ = c.contrast;
+			return true;
+		}
+	}
+
+	return false;
 }
 
 bool Af::getPhase(PdafRegions const &regions, double &phase, double &conf)
@@ -369,6 +423,25 @@ void Af::doPDAF(double phase, double conf)
 	/* Apply loop gain */
 	phase *= cfg_.speeds[speed_].pdafGain;
 
+	/*
+	 * When confidence is high and the slew rate limit would take several
+	 * frames to reach the predicted position, move the lens there in one
+	 * step, and skip the frames captured while it is moving.
+	 */
+	if (cfg_.speeds[speed_].pdafJumpConf > 0.0 &&
+	    conf >= cfg_.speeds[speed_].pdafJumpConf &&
+	    std::abs(phase) > cfg_.speeds[speed_].maxSlew) {
+		ftarget_ = std::clamp(fsmooth_ + phase,
+				      cfg_.ranges[range_].focusMin,
+				      cfg_.ranges[range_].focusMax);
+		pdafFocus_ = ftarget_;
+		jump_ = true;
+		skipCount_ = cfg_.speeds[speed_].stepFrames;
+		reportState_ = AfState::Scanning;
+		LOG(RPiAf, Debug) << "PDAF jump to " << ftarget_;
+		return;
+	}
+
 	if (mode_ == AfModeContinuous) {
 		/*
 		 * PDAF in Continuous mode. Scale down lens movement when
@@ -405,6 +478,8 @@ void Af::doPDAF(double phase, double conf)
 		reportState_ = AfState::Focused;
 
 	ftarget_ = fsmooth_ + phase;
+	if (conf >= cfg_.confEpsilon)
+		pdafFocus_ = ftarget_;
 }
 
 bool Af::earlyTerminationByPhase(double phase)
@@ -516,8 +591,12 @@ void Af::doAF(double contrast, double phase, double conf)
 			else if (mode_ != AfModeContinuous)
 				scanState_ = ScanState::Idle;
 			dropCount_ = 0;
-		} else if (++dropCount_ == cfg_.speeds[speed_].dropoutFrames)
-			startProgrammedScan();
+		} else if (++dropCount_ == cfg_.speeds[speed_].dropoutFrames) {
+			if (cfg_.speeds[speed_].fineFallback && pdafFocus_)
+				startFineScan(*pdafFocus_);
+			else
+				startProgrammedScan();
+		}
 	} else if (scanState_ >= ScanState::Coarse && fsmooth_ == ftarget_) {
 		/*
 		 * Scanning sequence. This means PDAF has become unavailable.
@@ -557,7 +636,10 @@ void Af::updateLensPosition()
 				      cfg_.ranges[range_].focusMax);
 	}
 
-	if (initted_) {
+	if (initted_ && jump_) {
+		/* to a confident PDAF prediction: skip the slew rate limit */
+		fsmooth_ = ftarget_;
+	} else if (initted_) {
 		/* from a known lens position: apply slew rate limit */
 		fsmooth_ = std::clamp(ftarget_,
 				      fsmooth_ - cfg_.speeds[speed_].maxSlew,
@@ -568,6 +650,8 @@ void Af::updateLensPosition()
 		initted_ = true;
 		skipCount_ = cfg_.skipFrames;
 	}
+
+	jump_ = false;
 }
 
 void Af::startAF()
@@ -583,6 +667,7 @@ void Af::startAF()
 		scanState_ = ScanState::Pdaf;
 		scanData_.clear();
 		dropCount_ = 0;
+		pdafFocus_.reset();
 		reportState_ = AfState::Scanning;
 	} else
 		startProgrammedScan();
@@ -591,8 +676,23 @@ void Af::startAF()
 void Af::startProgrammedScan()
 {
 	ftarget_ = cfg_.ranges[range_].focusMin;
+	startScan(ScanState::Coarse);
+}
+
+void Af::startFineScan(double focus)
+{
+	/* Start just beyond the estimate, as at the end of a coarse scan. */
+	ftarget_ = std::min(focus + 2.0 * cfg_.speeds[speed_].stepFine,
+			    cfg_.ranges[range_].focusMax);
+	LOG(RPiAf, Debug) << "Fine scan around " << focus;
+	startScan(ScanState::Fine);
+}
+
+void Af::startScan(ScanState state)
+{
 	updateLensPosition();
-	scanState_ = ScanState::Coarse;
+	scanState_ = state;
+	pdafFocus_.reset();
 	scanMaxContrast_ = 0.0;
 	scanMinContrast_ = 1.0e9;
 	scanMaxIndex_ = 0;
@@ -606,6 +706,7 @@ void Af::goIdle()
 	scanState_ = ScanState::Idle;
 	reportState_ = AfState::Idle;
 	scanData_.clear();
+	pdafFocus_.reset();
 }
 
 /*
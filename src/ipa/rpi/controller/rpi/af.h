@@ -29,6 +29,11 @@
  * "nuisance" scans. During each interval where PDAF is not working, only
  * ONE scan will be performed; CAF cannot track objects using CDAF alone.
  *
+ * Optionally, when PDAF confidence is high and the lens is far from the
+ * predicted position, the lens jumps there directly instead of being slew
+ * rate limited, and the loop resumes once it has settled. When PDAF drops
+ * out after having produced a confident estimate, the fallback can be
+ * restricted to a fine scan around that estimate.
  */
 
 namespace RPiController {
@@ -89,6 +94,8 @@ private:
 		uint32_t pdafFrames;		/* number of iterations when triggered */
 		uint32_t dropoutFrames;		/* number of non-PDAF frames to switch to CDAF */
 		uint32_t stepFrames;		/* frames to skip in between steps of a scan */
+		double pdafJumpConf;		/* PDAF confidence to jump to target (0 = off) */
+		bool fineFallback;		/* fine scan only, around last PDAF estimate */
 
 		SpeedDependentParams();
 		void read(const libcamera::YamlObject &params);
@@ -125,8 +132,17 @@ private:
 			: rows(0), cols(0), sum(0), w() {}
 	};
 
+	/* Weights computed for the statistics region of a previous mode */
+	struct CachedWeights {
+		libcamera::Rectangle statsRegion;
+		RegionWeights phase;
+		RegionWeights contrast;
+	};
+
 	void computeWeights(RegionWeights *wgts, unsigned rows, unsigned cols);
 	void invalidateWeights();
+	void cacheWeights();
+	bool restoreWeights();
 	bool getPhase(PdafRegions const &regions, double &phase, double &conf);
 	double getContrast(const FocusRegions &focusStats);
 	void doPDAF(double phase, double conf);
@@ -137,6 +153,8 @@ private:
 	void updateLensPosition();
 	void startAF();
 	void startProgrammedScan();
+	void startFineScan(double focus);
+	void startScan(ScanState state);
 	void goIdle();
 
 	/* Configuration and settings */
@@ -150,6 +168,7 @@ private:
 	bool useWindows_;
 	RegionWeights phaseWeights_;
 	RegionWeights contrastWeights_;
+	std::vector<CachedWeights> weightsCache_;
 
 	/* Working state. */
 	ScanState scanState_;
@@ -158,6 +177,8 @@ private:
 	double prevContrast_;
 	unsigned skipCount_, stepCount_, dropCount_;
 	unsigned scanMaxIndex_;
+	bool jump_;
+	std::optional<double> pdafFocus_;
 	double scanMaxContrast_, scanMinContrast_;
 	std::vector<ScanRecord> scanData_;
 	AfState reportState_;
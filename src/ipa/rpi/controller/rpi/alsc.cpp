@@ -6,14 +6,16 @@
  */
 
 #include <algorithm>
-#include <functional>
 #include <math.h>
 #include <numeric>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/span.h>
 
+#include "libipa/tuning_data.h"
+
 #include "../awb_status.h"
+#include "../device_status.h"
 #include "alsc.h"
 
 /* Raspberry Pi ALSC (Auto Lens Shading Correction) algorithm. */
@@ -25,23 +27,16 @@ LOG_DEFINE_CATEGORY(RPiAlsc)
 
 #define NAME "rpi.alsc"
 
-static const double InsufficientData = -1.0;
-
 Alsc::Alsc(Controller *controller)
-	: Algorithm(controller)
+	: Algorithm(controller), asyncTask_("rpi-alsc", [this] { doAlsc(); })
 {
-	asyncAbort_ = asyncStart_ = asyncStarted_ = asyncFinished_ = false;
-	asyncThread_ = std::thread(std::bind(&Alsc::asyncFunc, this));
+	asyncStarted_ = false;
 }
 
 Alsc::~Alsc()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		asyncAbort_ = true;
-	}
-	asyncSignal_.notify_one();
-	asyncThread_.join();
+	asyncTask_.cancel();
+	asyncTask_.wait();
 }
 
 char const *Alsc::name() const
@@ -88,13 +83,11 @@ static int readLut(Array2D<double> &lut, const libcamera::YamlObject &params)
 		return -EINVAL;
 	}
 
-	int num = 0;
-	for (const auto &p : params.asList()) {
-		auto value = p.get<double>();
-		if (!value)
-			return -EINVAL;
-		lut[num++] = *value;
-	}
+	auto values = params.getSpan<double>();
+	if (!values)
+		return -EINVAL;
+
+	std::copy(values->begin(), values->end(), lut.begin());
 
 	return 0;
 }
@@ -126,14 +119,13 @@ static int readCalibrations(std::vector<AlscCalibration> &calibrations,
 				return -EINVAL;
 			}
 
-			int num = 0;
+			auto values = table.getSpan<double>();
+			if (!values)
+				return -EINVAL;
+
 			calibration.table.resize(size);
-			for (const auto &elem : table.asList()) {
-				value = elem.get<double>();
-				if (!value)
-					return -EINVAL;
-				calibration.table[num++] = *value;
-			}
+			std::copy(values->begin(), values->end(),
+				  calibration.table.begin());
 
 			calibrations.push_back(std::move(calibration));
 			LOG(RPiAlsc, Debug)
@@ -143,6 +135,25 @@ static int readCalibrations(std::vector<AlscCalibration> &calibrations,
 	return 0;
 }
 
+/*
+ * The calibration tables are the largest part of the tuning data, share them
+ * with the other cameras using the same tuning file.
+ */
+static std::shared_ptr<const std::vector<AlscCalibration>>
+shareCalibrations(const libcamera::YamlObject &params, std::string const &name,
+		  const Size &size)
+{
+	auto create = [&]() -> std::shared_ptr<std::vector<AlscCalibration>> {
+		auto calibrations = std::make_shared<std::vector<AlscCalibration>>();
+		if (readCalibrations(*calibrations, params, name, size))
+			return nullptr;
+		return calibrations;
+	};
+
+	return ipa::TuningData::share<std::vector<AlscCalibration>>(params[name],
+								    create);
+}
+
 int Alsc::read(const libcamera::YamlObject &params)
 {
 	config_.tableSize = getHardwareConfig().awbRegions;
@@ -172,19 +183,30 @@ int Alsc::read(const libcamera::YamlObject &params)
 	if (ret)
 		return ret;
 
-	ret = readCalibrations(config_.calibrationsCr, params, "calibrations_Cr",
-			       config_.tableSize);
-	if (ret)
-		return ret;
-	ret = readCalibrations(config_.calibrationsCb, params, "calibrations_Cb",
-			       config_.tableSize);
-	if (ret)
-		return ret;
+	config_.calibrationsCr = shareCalibrations(params, "calibrations_Cr",
+						   config_.tableSize);
+	if (!config_.calibrationsCr)
+		return -EINVAL;
+	config_.calibrationsCb = shareCalibrations(params, "calibrations_Cb",
+						   config_.tableSize);
+	if (!config_.calibrationsCb)
+		return -EINVAL;
 
 	config_.defaultCt = params["default_ct"].get<double>(4500.0);
 	config_.threshold = params["threshold"].get<double>(1e-3);
 	config_.lambdaBound = params["lambda_bound"].get<double>(0.05);
 
+	std::string solver = params["solver"].get<std::string>("double");
+	if (solver == "double") {
+		config_.solver = AlscSolver::Precision::Double;
+	} else if (solver == "float") {
+		config_.solver = AlscSolver::Precision::Float;
+	} else {
+		LOG(RPiAlsc, Error) << "Invalid solver '" << solver << "'";
+		return -EINVAL;
+	}
+	config_.coarseIterations = params["coarse_iterations"].get<uint32_t>(0);
+
 	return 0;
 }
 
@@ -207,8 +229,7 @@ void Alsc::initialise()
 	frameCount2_ = frameCount_ = framePhase_ = 0;
 	firstTime_ = true;
 	ct_ = config_.defaultCt;
-
-	const size_t XY = config_.tableSize.width * config_.tableSize.height;
+	asyncTask_.setPriority(getTaskPriority());
 
 	for (auto &r : syncResults_)
 		r.resize(config_.tableSize);
@@ -227,19 +248,14 @@ void Alsc::initialise()
 	/* Temporaries for the computations, but sensible to allocate this up-front! */
 	for (auto &c : tmpC_)
 		c.resize(config_.tableSize);
-	for (auto &m : tmpM_)
-		m.resize(XY);
+	solver_.configure(config_.tableSize);
 }
 
 void Alsc::waitForAysncThread()
 {
 	if (asyncStarted_) {
 		asyncStarted_ = false;
-		std::unique_lock<std::mutex> lock(mutex_);
-		syncSignal_.wait(lock, [&] {
-			return asyncFinished_;
-		});
-		asyncFinished_ = false;
+		asyncTask_.wait();
 	}
 }
 
@@ -302,9 +318,9 @@ void Alsc::switchMode(CameraMode const &cameraMode,
 		std::fill(lambdaR_.begin(), lambdaR_.end(), 1.0);
 		std::fill(lambdaB_.begin(), lambdaB_.end(), 1.0);
 		Array2D<double> &calTableR = tmpC_[0], &calTableB = tmpC_[1], &calTableTmp = tmpC_[2];
-		getCalTable(ct_, config_.calibrationsCr, calTableTmp);
+		getCalTable(ct_, *config_.calibrationsCr, calTableTmp);
 		resampleCalTable(calTableTmp, cameraMode_, calTableR);
-		getCalTable(ct_, config_.calibrationsCb, calTableTmp);
+		getCalTable(ct_, *config_.calibrationsCb, calTableTmp);
 		resampleCalTable(calTableTmp, cameraMode_, calTableB);
 		compensateLambdasForCal(calTableR, lambdaR_, asyncLambdaR_);
 		compensateLambdasForCal(calTableB, lambdaB_, asyncLambdaB_);
@@ -319,7 +335,6 @@ void Alsc::switchMode(CameraMode const &cameraMode,
 void Alsc::fetchAsyncResults()
 {
 	LOG(RPiAlsc, Debug) << "Fetch ALSC results";
-	asyncFinished_ = false;
 	asyncStarted_ = false;
 	syncResults_ = asyncResults_;
 }
@@ -373,11 +388,8 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *imageMetadata)
 	copyStats(statistics_, stats, prevSyncResults_);
 	framePhase_ = 0;
 	asyncStarted_ = true;
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		asyncStart_ = true;
-	}
-	asyncSignal_.notify_one();
+	/* Aim to have the results by the time the algorithm runs again. */
+	asyncTask_.submit(config_.framePeriod * frameDuration(imageMetadata));
 }
 
 void Alsc::prepare(Metadata *imageMetadata)
@@ -393,11 +405,8 @@ void Alsc::prepare(Metadata *imageMetadata)
 			       : config_.speed;
 	LOG(RPiAlsc, Debug)
 		<< "frame count " << frameCount_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (asyncStarted_ && asyncFinished_)
-			fetchAsyncResults();
-	}
+	if (asyncStarted_ && asyncTask_.done())
+		fetchAsyncResults();
 	/* Apply IIR filter to results and program into the pipeline. */
 	for (unsigned int j = 0; j < syncResults_.size(); j++) {
 		for (unsigned int i = 0; i < syncResults_[j].size(); i++)
@@ -434,27 +443,6 @@ void Alsc::process(StatisticsPtr &stats, Metadata *imageMetadata)
 	}
 }
 
-void Alsc::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			asyncSignal_.wait(lock, [&] {
-				return asyncStart_ || asyncAbort_;
-			});
-			asyncStart_ = false;
-			if (asyncAbort_)
-				break;
-		}
-		doAlsc();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			asyncFinished_ = true;
-		}
-		syncSignal_.notify_one();
-	}
-}
-
 void getCalTable(double ct, std::vector<AlscCalibration> const &calibrations,
 		 Array2D<double> &calTable)
 {
@@ -595,147 +583,6 @@ void compensateLambdasForCal(const Array2D<double> &calTable,
 	printf("]\n");
 }
 
-/*
- * Compute weight out of 1.0 which reflects how similar we wish to make the
- * colours of these two regions.
- */
-static double computeWeight(double Ci, double Cj, double sigma)
-{
-	if (Ci == InsufficientData || Cj == InsufficientData)
-		return 0;
-	double diff = (Ci - Cj) / sigma;
-	return exp(-diff * diff / 2);
-}
-
-/* Compute all weights. */
-static void computeW(const Array2D<double> &C, double sigma,
-		     SparseArray<double> &W)
-{
-	size_t XY = C.size();
-	size_t X = C.dimensions().width;
-
-	for (unsigned int i = 0; i < XY; i++) {
-		/* Start with neighbour above and go clockwise. */
-		W[i][0] = i >= X ? computeWeight(C[i], C[i - X], sigma) : 0;
-		W[i][1] = i % X < X - 1 ? computeWeight(C[i], C[i + 1], sigma) : 0;
-		W[i][2] = i < XY - X ? computeWeight(C[i], C[i + X], sigma) : 0;
-		W[i][3] = i % X ? computeWeight(C[i], C[i - 1], sigma) : 0;
-	}
-}
-
-/* Compute M, the large but sparse matrix such that M * lambdas = 0. */
-static void constructM(const Array2D<double> &C,
-		       const SparseArray<double> &W,
-		       SparseArray<double> &M)
-{
-	size_t XY = C.size();
-	size_t X = C.dimensions().width;
-
-	double epsilon = 0.001;
-	for (unsigned int i = 0; i < XY; i++) {
-		/*
-		 * Note how, if C[i] == INSUFFICIENT_DATA, the weights will all
-		 * be zero so the equation is still set up correctly.
-		 */
-		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
-			!!(i % X); /* total number of neighbours */
-		/* we'll divide the diagonal out straight away */
-		double diagonal = (epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) * C[i];
-		M[i][0] = i >= X ? (W[i][0] * C[i - X] + epsilon / m * C[i]) / diagonal : 0;
-		M[i][1] = i % X < X - 1 ? (W[i][1] * C[i + 1] + epsilon / m * C[i]) / diagonal : 0;
-		M[i][2] = i < XY - X ? (W[i][2] * C[i + X] + epsilon / m * C[i]) / diagonal : 0;
-		M[i][3] = i % X ? (W[i][3] * C[i - 1] + epsilon / m * C[i]) / diagonal : 0;
-	}
-}
-
-/*
- * In the compute_lambda_ functions, note that the matrix coefficients for the
- * left/right neighbours are zero down the left/right edges, so we don't need
- * need to test the i value to exclude them.
- */
-static double computeLambdaBottom(int i, const SparseArray<double> &M,
-				  Array2D<double> &lambda)
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + lambda.dimensions().width] +
-	       M[i][3] * lambda[i - 1];
-}
-static double computeLambdaBottomStart(int i, const SparseArray<double> &M,
-				       Array2D<double> &lambda)
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + lambda.dimensions().width];
-}
-static double computeLambdaInterior(int i, const SparseArray<double> &M,
-				    Array2D<double> &lambda)
-{
-	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][1] * lambda[i + 1] +
-	       M[i][2] * lambda[i + lambda.dimensions().width] + M[i][3] * lambda[i - 1];
-}
-static double computeLambdaTop(int i, const SparseArray<double> &M,
-			       Array2D<double> &lambda)
-{
-	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][1] * lambda[i + 1] +
-	       M[i][3] * lambda[i - 1];
-}
-static double computeLambdaTopEnd(int i, const SparseArray<double> &M,
-				  Array2D<double> &lambda)
-{
-	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][3] * lambda[i - 1];
-}
-
-/* Gauss-Seidel iteration with over-relaxation. */
-static double gaussSeidel2Sor(const SparseArray<double> &M, double omega,
-			      Array2D<double> &lambda, double lambdaBound)
-{
-	int XY = lambda.size();
-	int X = lambda.dimensions().width;
-	const double min = 1 - lambdaBound, max = 1 + lambdaBound;
-	Array2D<double> oldLambda = lambda;
-	int i;
-	lambda[0] = computeLambdaBottomStart(0, M, lambda);
-	lambda[0] = std::clamp(lambda[0], min, max);
-	for (i = 1; i < X; i++) {
-		lambda[i] = computeLambdaBottom(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	for (; i < XY - X; i++) {
-		lambda[i] = computeLambdaInterior(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	for (; i < XY - 1; i++) {
-		lambda[i] = computeLambdaTop(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	lambda[i] = computeLambdaTopEnd(i, M, lambda);
-	lambda[i] = std::clamp(lambda[i], min, max);
-	/*
-	 * Also solve the system from bottom to top, to help spread the updates
-	 * better.
-	 */
-	lambda[i] = computeLambdaTopEnd(i, M, lambda);
-	lambda[i] = std::clamp(lambda[i], min, max);
-	for (i = XY - 2; i >= XY - X; i--) {
-		lambda[i] = computeLambdaTop(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	for (; i >= X; i--) {
-		lambda[i] = computeLambdaInterior(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	for (; i >= 1; i--) {
-		lambda[i] = computeLambdaBottom(i, M, lambda);
-		lambda[i] = std::clamp(lambda[i], min, max);
-	}
-	lambda[0] = computeLambdaBottomStart(0, M, lambda);
-	lambda[0] = std::clamp(lambda[0], min, max);
-	double maxDiff = 0;
-	for (i = 0; i < XY; i++) {
-		lambda[i] = oldLambda[i] + (lambda[i] - oldLambda[i]) * omega;
-		if (fabs(lambda[i] - oldLambda[i]) > fabs(maxDiff))
-			maxDiff = lambda[i] - oldLambda[i];
-	}
-	return maxDiff;
-}
-
 /* Normalise the values so that the smallest value is 1. */
 static void normalise(Array2D<double> &results)
 {
@@ -744,44 +591,6 @@ static void normalise(Array2D<double> &results)
 		      [minval](double val) { return val / minval; });
 }
 
-/* Rescale the values so that the average value is 1. */
-static void reaverage(Array2D<double> &data)
-{
-	double sum = std::accumulate(data.begin(), data.end(), 0.0);
-	double ratio = 1 / (sum / data.size());
-	std::for_each(data.begin(), data.end(),
-		      [ratio](double val) { return val * ratio; });
-}
-
-static void runMatrixIterations(const Array2D<double> &C,
-				Array2D<double> &lambda,
-				const SparseArray<double> &W,
-				SparseArray<double> &M, double omega,
-				unsigned int nIter, double threshold, double lambdaBound)
-{
-	constructM(C, W, M);
-	double lastMaxDiff = std::numeric_limits<double>::max();
-	for (unsigned int i = 0; i < nIter; i++) {
-		double maxDiff = fabs(gaussSeidel2Sor(M, omega, lambda, lambdaBound));
-		if (maxDiff < threshold) {
-			LOG(RPiAlsc, Debug)
-				<< "Stop after " << i + 1 << " iterations";
-			break;
-		}
-		/*
-		 * this happens very occasionally (so make a note), though
-		 * doesn't seem to matter
-		 */
-		if (maxDiff > lastMaxDiff)
-			LOG(RPiAlsc, Debug)
-				<< "Iteration " << i << ": maxDiff gone up "
-				<< lastMaxDiff << " to " << maxDiff;
-		lastMaxDiff = maxDiff;
-	}
-	/* We're going to normalise the lambdas so the total average is 1. */
-	reaverage(lambda);
-}
-
 static void addLuminanceRb(Array2D<double> &result, const Array2D<double> &lambda,
 			   const Array2D<double> &luminanceLut,
 			   double luminanceStrength)
@@ -815,7 +624,6 @@ void Alsc::doAlsc()
 {
 	Array2D<double> &cr = tmpC_[0], &cb = tmpC_[1], &calTableR = tmpC_[2],
 			&calTableB = tmpC_[3], &calTableTmp = tmpC_[4];
-	SparseArray<double> &wr = tmpM_[0], &wb = tmpM_[1], &M = tmpM_[2];
 
 	/*
 	 * Calculate our R/B ("Cr"/"Cb") colour statistics, and assess which are
@@ -826,9 +634,9 @@ void Alsc::doAlsc()
 	 * Fetch the new calibrations (if any) for this CT. Resample them in
 	 * case the camera mode is not full-frame.
 	 */
-	getCalTable(ct_, config_.calibrationsCr, calTableTmp);
+	getCalTable(ct_, *config_.calibrationsCr, calTableTmp);
 	resampleCalTable(calTableTmp, cameraMode_, calTableR);
-	getCalTable(ct_, config_.calibrationsCb, calTableTmp);
+	getCalTable(ct_, *config_.calibrationsCb, calTableTmp);
 	resampleCalTable(calTableTmp, cameraMode_, calTableB);
 	/*
 	 * You could print out the cal tables for this image here, if you're
@@ -838,14 +646,16 @@ void Alsc::doAlsc()
 	 */
 	applyCalTable(calTableR, cr);
 	applyCalTable(calTableB, cb);
-	/* Compute weights between zones. */
-	computeW(cr, config_.sigmaCr, wr);
-	computeW(cb, config_.sigmaCb, wb);
-	/* Run Gauss-Seidel iterations over the resulting matrix, for R and B. */
-	runMatrixIterations(cr, lambdaR_, wr, M, config_.omega, config_.nIter,
-			    config_.threshold, config_.lambdaBound);
-	runMatrixIterations(cb, lambdaB_, wb, M, config_.omega, config_.nIter,
-			    config_.threshold, config_.lambdaBound);
+	/*
+	 * Compute weights between zones and run Gauss-Seidel iterations over
+	 * the resulting matrix, for R and B.
+	 */
+	const AlscSolver::Params params = {
+		config_.solver, config_.omega, config_.nIter, config_.threshold,
+		config_.lambdaBound, config_.coarseIterations,
+	};
+	solver_.solve(cr, config_.sigmaCr, lambdaR_, params);
+	solver_.solve(cb, config_.sigmaCb, lambdaB_, params);
 	/*
 	 * Fold the calibrated gains into our final lambda values. (Note that on
 	 * the next run, we re-start with the lambda values that don't have the
@@ -7,75 +7,22 @@
 #pragma once
 
 #include <array>
-#include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <memory>
 #include <vector>
 
 #include <libcamera/geometry.h>
 
+#include "libipa/task_scheduler.h"
+
 #include "../algorithm.h"
 #include "../alsc_status.h"
 #include "../statistics.h"
+#include "alsc_solver.h"
 
 namespace RPiController {
 
 /* Algorithm to generate automagic LSC (Lens Shading Correction) tables. */
 
-/*
- * The Array2D class is a very thin wrapper round std::vector so that it can
- * be used in exactly the same way in the code but carries its correct width
- * and height ("dimensions") with it.
- */
-
-template<typename T>
-class Array2D
-{
-public:
-	using Size = libcamera::Size;
-
-	const Size &dimensions() const { return dimensions_; }
-
-	size_t size() const { return data_.size(); }
-
-	const std::vector<T> &data() const { return data_; }
-
-	void resize(const Size &dims)
-	{
-		dimensions_ = dims;
-		data_.resize(dims.width * dims.height);
-	}
-
-	void resize(const Size &dims, const T &value)
-	{
-		resize(dims);
-		std::fill(data_.begin(), data_.end(), value);
-	}
-
-	T &operator[](int index) { return data_[index]; }
-
-	const T &operator[](int index) const { return data_[index]; }
-
-	T *ptr() { return data_.data(); }
-
-	const T *ptr() const { return data_.data(); }
-
-	auto begin() { return data_.begin(); }
-	auto end() { return data_.end(); }
-
-private:
-	Size dimensions_;
-	std::vector<T> data_;
-};
-
-/*
- * We'll use the term SparseArray for the large sparse matrices that are
- * XY tall but have only 4 non-zero elements on each row.
- */
-
-template<typename T>
-using SparseArray = std::vector<std::array<T, 4>>;
-
 struct AlscCalibration {
 	double ct;
 	Array2D<double> table;
@@ -96,11 +43,14 @@ struct AlscConfig {
 	uint32_t nIter;
 	Array2D<double> luminanceLut;
 	double luminanceStrength;
-	std::vector<AlscCalibration> calibrationsCr;
-	std::vector<AlscCalibration> calibrationsCb;
+	/* Calibration tables, shared between cameras using the same tuning */
+	std::shared_ptr<const std::vector<AlscCalibration>> calibrationsCr;
+	std::shared_ptr<const std::vector<AlscCalibration>> calibrationsCb;
 	double defaultCt; /* colour temperature if no metadata found */
 	double threshold; /* iteration termination threshold */
 	double lambdaBound; /* upper/lower bound for lambda from a value of 1 */
+	AlscSolver::Precision solver; /* precision of the Gauss-Seidel solver */
+	uint32_t coarseIterations; /* iterations at half resolution first */
 	libcamera::Size tableSize;
 };
 
@@ -122,19 +72,8 @@ private:
 	bool firstTime_;
 	CameraMode cameraMode_;
 	Array2D<double> luminanceTable_;
-	std::thread asyncThread_;
-	void asyncFunc(); /* asynchronous thread function */
-	std::mutex mutex_;
-	/* condvar for async thread to wait on */
-	std::condition_variable asyncSignal_;
-	/* condvar for synchronous thread to wait on */
-	std::condition_variable syncSignal_;
-	/* for sync thread to check  if async thread finished (requires mutex) */
-	bool asyncFinished_;
-	/* for async thread to check if it's been told to run (requires mutex) */
-	bool asyncStart_;
-	/* for async thread to check if it's been told to quit (requires mutex) */
-	bool asyncAbort_;
+	/* asynchronous job, run on the shared IPA worker pool */
+	libcamera::ipa::TaskScheduler::Task asyncTask_;
 
 	/*
 	 * The following are only for the synchronous thread to use:
@@ -168,7 +107,7 @@ private:
 
 	/* Temporaries for the computations */
 	std::array<Array2D<double>, 5> tmpC_;
-	std::array<SparseArray<double>, 3> tmpM_;
+	AlscSolver solver_;
 };
 
 } /* namespace RPiController */
@@ -0,0 +1,444 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2019, Raspberry Pi Ltd
+ *
+ * ALSC (auto lens shading correction) Gauss-Seidel solver
+ */
+
+#include "alsc_solver.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <numeric>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/base/log.h>
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(RPiAlsc)
+
+/*
+ * Compute weight out of 1.0 which reflects how similar we wish to make the
+ * colours of these two regions.
+ */
+static double computeWeight(double Ci, double Cj, double sigma)
+{
+	if (Ci == InsufficientData || Cj == InsufficientData)
+		return 0;
+	double diff = (Ci - Cj) / sigma;
+	return exp(-diff * diff / 2);
+}
+
+/* Compute all weights. */
+static void computeW(const Array2D<double> &C, double sigma,
+		     SparseArray<double> &W)
+{
+	size_t XY = C.size();
+	size_t X = C.dimensions().width;
+
+	for (unsigned int i = 0; i < XY; i++) {
+		/* Start with neighbour above and go clockwise. */
+		W[i][0] = i >= X ? computeWeight(C[i], C[i - X], sigma) : 0;
+		W[i][1] = i % X < X - 1 ? computeWeight(C[i], C[i + 1], sigma) : 0;
+		W[i][2] = i < XY - X ? computeWeight(C[i], C[i + X], sigma) : 0;
+		W[i][3] = i % X ? computeWeight(C[i], C[i - 1], sigma) : 0;
+	}
+}
+
+/* Compute M, the large but sparse matrix such that M * lambdas = 0. */
+static void constructM(const Array2D<double> &C,
+		       const SparseArray<double> &W,
+		       SparseArray<double> &M)
+{
+	size_t XY = C.size();
+	size_t X = C.dimensions().width;
+
+	double epsilon = 0.001;
+	for (unsigned int i = 0; i < XY; i++) {
+		/*
+		 * Note how, if C[i] == INSUFFICIENT_DATA, the weights will all
+		 * be zero so the equation is still set up correctly.
+		 */
+		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
+			!!(i % X); /* total number of neighbours */
+		/* we'll divide the diagonal out straight away */
+		double diagonal = (epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) * C[i];
+		M[i][0] = i >= X ? (W[i][0] * C[i - X] + epsilon / m * C[i]) / diagonal : 0;
+		M[i][1] = i % X < X - 1 ? (W[i][1] * C[i + 1] + epsilon / m * C[i]) / diagonal : 0;
+		M[i][2] = i < XY - X ? (W[i][2] * C[i + X] + epsilon / m * C[i]) / diagonal : 0;
+		M[i][3] = i % X ? (W[i][3] * C[i - 1] + epsilon / m * C[i]) / diagonal : 0;
+	}
+}
+
+/*
+ * In the compute_lambda_ functions, note that the matrix coefficients for the
+ * left/right neighbours are zero down the left/right edges, so we don't need
+ * need to test the i value to exclude them.
+ */
+static double computeLambdaBottom(int i, const SparseArray<double> &M,
+				  Array2D<double> &lambda)
+{
+	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + lambda.dimensions().width] +
+	       M[i][3] * lambda[i - 1];
+}
+static double computeLambdaBottomStart(int i, const SparseArray<double> &M,
+				       Array2D<double> &lambda)
+{
+	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + lambda.dimensions().width];
+}
+static double computeLambdaInterior(int i, const SparseArray<double> &M,
+				    Array2D<double> &lambda)
+{
+	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][1] * lambda[i + 1] +
+	       M[i][2] * lambda[i + lambda.dimensions().width] + M[i][3] * lambda[i - 1];
+}
+static double computeLambdaTop(int i, const SparseArray<double> &M,
+			       Array2D<double> &lambda)
+{
+	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][1] * lambda[i + 1] +
+	       M[i][3] * lambda[i - 1];
+}
+static double computeLambdaTopEnd(int i, const SparseArray<double> &M,
+				  Array2D<double> &lambda)
+{
+	return M[i][0] * lambda[i - lambda.dimensions().width] + M[i][3] * lambda[i - 1];
+}
+
+/* Gauss-Seidel iteration with over-relaxation. */
+static double gaussSeidel2Sor(const SparseArray<double> &M, double omega,
+			      Array2D<double> &lambda, double lambdaBound)
+{
+	int XY = lambda.size();
+	int X = lambda.dimensions().width;
+	const double min = 1 - lambdaBound, max = 1 + lambdaBound;
+	Array2D<double> oldLambda = lambda;
+	int i;
+	lambda[0] = computeLambdaBottomStart(0, M, lambda);
+	lambda[0] = std::clamp(lambda[0], min, max);
+	for (i = 1; i < X; i++) {
+		lambda[i] = computeLambdaBottom(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	for (; i < XY - X; i++) {
+		lambda[i] = computeLambdaInterior(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	for (; i < XY - 1; i++) {
+		lambda[i] = computeLambdaTop(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	lambda[i] = computeLambdaTopEnd(i, M, lambda);
+	lambda[i] = std::clamp(lambda[i], min, max);
+	/*
+	 * Also solve the system from bottom to top, to help spread the updates
+	 * better.
+	 */
+	lambda[i] = computeLambdaTopEnd(i, M, lambda);
+	lambda[i] = std::clamp(lambda[i], min, max);
+	for (i = XY - 2; i >= XY - X; i--) {
+		lambda[i] = computeLambdaTop(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	for (; i >= X; i--) {
+		lambda[i] = computeLambdaInterior(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	for (; i >= 1; i--) {
+		lambda[i] = computeLambdaBottom(i, M, lambda);
+		lambda[i] = std::clamp(lambda[i], min, max);
+	}
+	lambda[0] = computeLambdaBottomStart(0, M, lambda);
+	lambda[0] = std::clamp(lambda[0], min, max);
+	double maxDiff = 0;
+	for (i = 0; i < XY; i++) {
+		lambda[i] = oldLambda[i] + (lambda[i] - oldLambda[i]) * omega;
+		if (fabs(lambda[i] - oldLambda[i]) > fabs(maxDiff))
+			maxDiff = lambda[i] - oldLambda[i];
+	}
+	return maxDiff;
+}
+
+/*
+ * Over-relax the regions of one row selected by the mask, in single precision.
+ * The lambda pointers point to the first region of the current, previous and
+ * next rows, which are padded with zeros on all sides. Return the largest
+ * correction applied before over-relaxation.
+ */
+static float sorRow(const std::array<const float *, 4> &m, float *lambda,
+		    const float *prev, const float *next, const float *mask,
+		    unsigned int width, float omega, float min, float max)
+{
+	float residual = 0.0f;
+	unsigned int x = 0;
+
+#if defined(__ARM_NEON)
+	const float32x4_t vomega = vdupq_n_f32(omega);
+	const float32x4_t vmin = vdupq_n_f32(min);
+	const float32x4_t vmax = vdupq_n_f32(max);
+	float32x4_t vresidual = vdupq_n_f32(0.0f);
+
+	/*
+	 * Vectors of regions of the same row are updated in place. The
+	 * neighbours of the regions being updated are all of the other colour,
+	 * so they are never modified by the stores.
+	 */
+	for (; x + 4 <= width; x += 4) {
+		float32x4_t cur = vld1q_f32(lambda + x);
+		float32x4_t n = vmulq_f32(vld1q_f32(m[0] + x), vld1q_f32(prev + x));
+		n = vmlaq_f32(n, vld1q_f32(m[1] + x), vld1q_f32(lambda + x + 1));
+		n = vmlaq_f32(n, vld1q_f32(m[2] + x), vld1q_f32(next + x));
+		n = vmlaq_f32(n, vld1q_f32(m[3] + x), vld1q_f32(lambda + x - 1));
+		n = vminq_f32(vmaxq_f32(n, vmin), vmax);
+
+		float32x4_t d = vmulq_f32(vsubq_f32(n, cur), vld1q_f32(mask + x));
+		vresidual = vmaxq_f32(vresidual, vabsq_f32(d));
+		vst1q_f32(lambda + x, vmlaq_f32(cur, d, vomega));
+	}
+
+	float32x2_t r = vpmax_f32(vget_low_f32(vresidual), vget_high_f32(vresidual));
+	r = vpmax_f32(r, r);
+	residual = vget_lane_f32(r, 0);
+#endif
+
+	const float *left = lambda - 1;
+	const float *right = lambda + 1;
+
+	for (; x < width; x++) {
+		if (!mask[x])
+			continue;
+
+		float n = m[0][x] * prev[x] + m[1][x] * right[x] +
+			  m[2][x] * next[x] + m[3][x] * left[x];
+		n = std::clamp(n, min, max);
+
+		float d = n - lambda[x];
+		residual = std::max(residual, std::abs(d));
+		lambda[x] += omega * d;
+	}
+
+	return residual;
+}
+
+/* Rescale the values so that the average value is 1. */
+static void reaverage(Array2D<double> &data)
+{
+	double sum = std::accumulate(data.begin(), data.end(), 0.0);
+	double ratio = 1 / (sum / data.size());
+	std::for_each(data.begin(), data.end(),
+		      [ratio](double val) { return val * ratio; });
+}
+
+void AlscSolver::Level::configure(const Size &size)
+{
+	const size_t XY = size.width * size.height;
+	const size_t padded = (size.width + 2) * (size.height + 2);
+
+	W.resize(XY);
+	M.resize(XY);
+
+	for (std::vector<float> &plane : m)
+		plane.resize(XY);
+
+	lambda.assign(padded, 0.0f);
+
+	for (unsigned int i = 0; i < masks.size(); i++) {
+		masks[i].resize(size.width);
+		for (unsigned int x = 0; x < size.width; x++)
+			masks[i][x] = (x & 1) == i ? 1.0f : 0.0f;
+	}
+}
+
+/*
+ * Allocate the temporaries for the computations up-front, for tables of the
+ * given size.
+ */
+void AlscSolver::configure(const Size &tableSize)
+{
+	const Size coarseSize((tableSize.width + 1) / 2, (tableSize.height + 1) / 2);
+
+	fine_.configure(tableSize);
+	coarse_.configure(coarseSize);
+
+	coarseC_.resize(coarseSize);
+	coarseLambda_.resize(coarseSize);
+	coarseLambdaStart_.resize(coarseSize);
+}
+
+/*
+ * Solve for the lambdas of the colour statistics C, starting from the current
+ * lambda values. Return the number of iterations run at full resolution.
+ */
+unsigned int AlscSolver::solve(const Array2D<double> &C, double sigma,
+			       Array2D<double> &lambda, const Params &params)
+{
+	if (params.coarseIterations && C.dimensions().width >= 4 &&
+	    C.dimensions().height >= 4)
+		coarseSolve(C, sigma, lambda, params);
+
+	unsigned int iterations = iterate(C, sigma, lambda, params.nIter,
+					  params, fine_);
+
+	/* We're going to normalise the lambdas so the total average is 1. */
+	reaverage(lambda);
+
+	return iterations;
+}
+
+unsigned int AlscSolver::iterate(const Array2D<double> &C, double sigma,
+				 Array2D<double> &lambda, unsigned int nIter,
+				 const Params &params, Level &level)
+{
+	computeW(C, sigma, level.W);
+	constructM(C, level.W, level.M);
+
+	if (params.precision == Precision::Float)
+		return iterateFloat(lambda, nIter, params, level);
+	else
+		return iterateDouble(lambda, nIter, params, level);
+}
+
+unsigned int AlscSolver::iterateDouble(Array2D<double> &lambda, unsigned int nIter,
+				       const Params &params, Level &level)
+{
+	double lastMaxDiff = std::numeric_limits<double>::max();
+	unsigned int i;
+
+	for (i = 0; i < nIter; i++) {
+		double maxDiff = fabs(gaussSeidel2Sor(level.M, params.omega, lambda,
+						      params.lambdaBound));
+		if (maxDiff < params.threshold) {
+			LOG(RPiAlsc, Debug)
+				<< "Stop after " << i + 1 << " iterations";
+			return i + 1;
+		}
+		/*
+		 * this happens very occasionally (so make a note), though
+		 * doesn't seem to matter
+		 */
+		if (maxDiff > lastMaxDiff)
+			LOG(RPiAlsc, Debug)
+				<< "Iteration " << i << ": maxDiff gone up "
+				<< lastMaxDiff << " to " << maxDiff;
+		lastMaxDiff = maxDiff;
+	}
+
+	return i;
+}
+
+unsigned int AlscSolver::iterateFloat(Array2D<double> &lambda, unsigned int nIter,
+				      const Params &params, Level &level)
+{
+	const unsigned int X = lambda.dimensions().width;
+	const unsigned int Y = lambda.dimensions().height;
+	const unsigned int stride = X + 2;
+	const float omega = params.omega;
+	const float min = 1 - params.lambdaBound;
+	const float max = 1 + params.lambdaBound;
+	unsigned int i;
+
+	for (unsigned int k = 0; k < 4; k++) {
+		for (unsigned int j = 0; j < lambda.size(); j++)
+			level.m[k][j] = level.M[j][k];
+	}
+
+	for (unsigned int y = 0; y < Y; y++) {
+		for (unsigned int x = 0; x < X; x++)
+			level.lambda[(y + 1) * stride + x + 1] = lambda[y * X + x];
+	}
+
+	for (i = 0; i < nIter; i++) {
+		float residual = 0.0f;
+
+		/*
+		 * Run two red-black sweeps per iteration, to match the cost
+		 * of the two Gauss-Seidel sweeps of the double precision
+		 * implementation.
+		 */
+		for (unsigned int sweep = 0; sweep < 2; sweep++) {
+			residual = 0.0f;
+
+			for (unsigned int colour = 0; colour < 2; colour++) {
+				for (unsigned int y = 0; y < Y; y++) {
+					float *row = &level.lambda[(y + 1) * stride + 1];
+					std::array<const float *, 4> m = {
+						&level.m[0][y * X], &level.m[1][y * X],
+						&level.m[2][y * X], &level.m[3][y * X],
+					};
+					const float *mask = level.masks[(colour ^ y) & 1].data();
+
+					float r = sorRow(m, row, row - stride, row + stride,
+							 mask, X, omega, min, max);
+					residual = std::max(residual, r);
+				}
+			}
+		}
+
+		if (residual < params.threshold) {
+			i++;
+			LOG(RPiAlsc, Debug) << "Stop after " << i << " iterations";
+			break;
+		}
+	}
+
+	for (unsigned int y = 0; y < Y; y++) {
+		for (unsigned int x = 0; x < X; x++)
+			lambda[y * X + x] = level.lambda[(y + 1) * stride + x + 1];
+	}
+
+	return i;
+}
+
+/*
+ * Iterate on a table downsampled by two in each direction, and scale the
+ * lambdas of each block of regions by the correction computed for the block.
+ */
+void AlscSolver::coarseSolve(const Array2D<double> &C, double sigma,
+			     Array2D<double> &lambda, const Params &params)
+{
+	const unsigned int X = C.dimensions().width;
+	const unsigned int Y = C.dimensions().height;
+	const unsigned int coarseX = coarseC_.dimensions().width;
+	const double min = 1 - params.lambdaBound;
+	const double max = 1 + params.lambdaBound;
+
+	for (unsigned int j = 0; j < coarseC_.size(); j++) {
+		unsigned int x0 = j % coarseX * 2;
+		unsigned int y0 = j / coarseX * 2;
+		double sumC = 0.0, sumLambda = 0.0;
+		unsigned int validC = 0, count = 0;
+
+		for (unsigned int y = y0; y < std::min(y0 + 2, Y); y++) {
+			for (unsigned int x = x0; x < std::min(x0 + 2, X); x++) {
+				unsigned int i = y * X + x;
+
+				if (C[i] != InsufficientData) {
+					sumC += C[i];
+					validC++;
+				}
+
+				sumLambda += lambda[i];
+				count++;
+			}
+		}
+
+		coarseC_[j] = validC ? sumC / validC : InsufficientData;
+		coarseLambda_[j] = sumLambda / count;
+	}
+
+	coarseLambdaStart_ = coarseLambda_;
+
+	iterate(coarseC_, sigma, coarseLambda_, params.coarseIterations,
+		params, coarse_);
+
+	for (unsigned int i = 0; i < lambda.size(); i++) {
+		unsigned int j = (i / X / 2) * coarseX + i % X / 2;
+		double value = lambda[i] * coarseLambda_[j] / coarseLambdaStart_[j];
+		lambda[i] = std::clamp(value, min, max);
+	}
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2019, Raspberry Pi Ltd
+ *
+ * ALSC (auto lens shading correction) Gauss-Seidel solver
+ */
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace RPiController {
+
+/*
+ * The Array2D class is a very thin wrapper round std::vector so that it can
+ * be used in exactly the same way in the code but carries its correct width
+ * and height ("dimensions") with it.
+ */
+
+template<typename T>
+class Array2D
+{
+public:
+	using Size = libcamera::Size;
+
+	const Size &dimensions() const { return dimensions_; }
+
+	size_t size() const { return data_.size(); }
+
+	const std::vector<T> &data() const { return data_; }
+
+	void resize(const Size &dims)
+	{
+		dimensions_ = dims;
+		data_.resize(dims.width * dims.height);
+	}
+
+	void resize(const Size &dims, const T &value)
+	{
+		resize(dims);
+		std::fill(data_.begin(), data_.end(), value);
+	}
+
+	T &operator[](int index) { return data_[index]; }
+
+	const T &operator[](int index) const { return data_[index]; }
+
+	T *ptr() { return data_.data(); }
+
+	const T *ptr() const { return data_.data(); }
+
+	auto begin() { return data_.begin(); }
+	auto end() { return data_.end(); }
+
+private:
+	Size dimensions_;
+	std::vector<T> data_;
+};
+
+/*
+ * We'll use the term SparseArray for the large sparse matrices that are
+ * XY tall but have only 4 non-zero elements on each row.
+ */
+
+template<typename T>
+using SparseArray = std::vector<std::array<T, 4>>;
+
+/* Value of the colour statistics of regions without enough data. */
+static constexpr double InsufficientData = -1.0;
+
+/*
+ * Solve for the lambdas (the colour gains of each region) that make the
+ * colours of neighbouring regions as similar as possible, by Gauss-Seidel
+ * iteration with over-relaxation.
+ *
+ * Two implementations are available. The double precision one is the
+ * reference. The single precision one uses red-black ordering, where each
+ * half-sweep only updates the regions of one colour of a checkerboard, so
+ * that rows can be processed with SIMD instructions. It stops as soon as the
+ * largest correction applied to a region in an iteration drops below the
+ * threshold.
+ *
+ * Either of them can optionally start with a few iterations on a table
+ * downsampled by two in each direction, which spreads corrections across the
+ * table faster than iterating at full resolution.
+ */
+class AlscSolver
+{
+public:
+	enum class Precision {
+		Double,
+		Float,
+	};
+
+	struct Params {
+		Precision precision;
+		double omega;
+		unsigned int nIter;
+		double threshold;
+		double lambdaBound;
+		unsigned int coarseIterations;
+	};
+
+	void configure(const libcamera::Size &tableSize);
+	unsigned int solve(const Array2D<double> &C, double sigma,
+			   Array2D<double> &lambda, const Params &params);
+
+private:
+	struct Level {
+		void configure(const libcamera::Size &size);
+
+		SparseArray<double> W;
+		SparseArray<double> M;
+
+		/* Single precision coefficients, one plane per neighbour */
+		std::array<std::vector<float>, 4> m;
+		/* Single precision lambdas, padded with a border of zeros */
+		std::vector<float> lambda;
+		/* Red-black masks for rows starting with a red or black region */
+		std::array<std::vector<float>, 2> masks;
+	};
+
+	unsigned int iterate(const Array2D<double> &C, double sigma,
+			     Array2D<double> &lambda, unsigned int nIter,
+			     const Params &params, Level &level);
+	unsigned int iterateDouble(Array2D<double> &lambda, unsigned int nIter,
+				   const Params &params, Level &level);
+	unsigned int iterateFloat(Array2D<double> &lambda, unsigned int nIter,
+				  const Params &params, Level &level);
+	void coarseSolve(const Array2D<double> &C, double sigma,
+			 Array2D<double> &lambda, const Params &params);
+
+	Level fine_;
+	Level coarse_;
+	Array2D<double> coarseC_;
+	Array2D<double> coarseLambda_;
+	Array2D<double> coarseLambdaStart_;
+};
+
+} /* namespace RPiController */
@@ -6,7 +6,7 @@
  */
 
 #include <assert.h>
-#include <functional>
+#include <cmath>
 
 #include <libcamera/base/log.h>
 
@@ -167,26 +167,31 @@ int AwbConfig::read(const libcamera::YamlObject &params)
 	whitepointB = params["whitepoint_b"].get<double>(0.0);
 	if (bayes == false)
 		sensitivityR = sensitivityB = 1.0; /* nor do sensitivities make any sense */
+
+	incremental = params["incremental"].get<int>(0);
+	incrementalWindow = params["incremental_window"].get<double>(0.1);
+	incrementalLuxThreshold = params["incremental_lux_threshold"].get<double>(0.25);
+	incrementalDelta2Threshold = params["incremental_delta2_threshold"].get<double>(0.1);
+	incrementalMaxSearches = params["incremental_max_searches"].get<unsigned int>(30);
+	if (incremental && incrementalWindow <= 0) {
+		LOG(RPiAwb, Error) << "AwbConfig: incremental_window must be > 0";
+		return -EINVAL;
+	}
 	return 0;
 }
 
 Awb::Awb(Controller *controller)
-	: AwbAlgorithm(controller)
+	: AwbAlgorithm(controller), asyncTask_("rpi-awb", [this] { doAwb(); })
 {
-	asyncAbort_ = asyncStart_ = asyncStarted_ = asyncFinished_ = false;
+	asyncStarted_ = false;
 	mode_ = nullptr;
 	manualR_ = manualB_ = 0.0;
-	asyncThread_ = std::thread(std::bind(&Awb::asyncFunc, this));
 }
 
 Awb::~Awb()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		asyncAbort_ = true;
-	}
-	asyncSignal_.notify_one();
-	asyncThread_.join();
+	asyncTask_.cancel();
+	asyncTask_.wait();
 }
 
 char const *Awb::name() const
@@ -202,6 +207,7 @@ int Awb::read(const libcamera::YamlObject &params)
 void Awb::initialise()
 {
 	frameCount_ = framePhase_ = 0;
+	asyncTask_.setPriority(getTaskPriority());
 	/*
 	 * Put something sane into the status that we are filtering towards,
 	 * just in case the first few frames don't have anything meaningful in
@@ -219,6 +225,7 @@ void Awb::initialise()
 	}
 	prevSyncResults_ = syncResults_;
 	asyncResults_ = syncResults_;
+	warmStart_ = {};
 }
 
 void Awb::initialValues(double &gainR, double &gainB)
@@ -297,7 +304,6 @@ bool Awb::isAutoEnabled() const
 void Awb::fetchAsyncResults()
 {
 	LOG(RPiAwb, Debug) << "Fetch AWB results";
-	asyncFinished_ = false;
 	asyncStarted_ = false;
 	/*
 	 * It's possible manual gains could be set even while the async
@@ -307,7 +313,8 @@ void Awb::fetchAsyncResults()
 		syncResults_ = asyncResults_;
 }
 
-void Awb::restartAsync(StatisticsPtr &stats, double lux)
+void Awb::restartAsync(StatisticsPtr &stats, double lux,
+		       utils::Duration frameDuration)
 {
 	LOG(RPiAwb, Debug) << "Starting AWB calculation";
 	/* this makes a new reference which belongs to the asynchronous thread */
@@ -323,11 +330,8 @@ void Awb::restartAsync(StatisticsPtr &stats, double lux)
 	size_t len = modeName_.copy(asyncResults_.mode,
 				    sizeof(asyncResults_.mode) - 1);
 	asyncResults_.mode[len] = '\0';
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		asyncStart_ = true;
-	}
-	asyncSignal_.notify_one();
+	/* Aim to have the results by the time the algorithm runs again. */
+	asyncTask_.submit(config_.framePeriod * frameDuration);
 }
 
 void Awb::prepare(Metadata *imageMetadata)
@@ -339,11 +343,8 @@ void Awb::prepare(Metadata *imageMetadata)
 			       : config_.speed;
 	LOG(RPiAwb, Debug)
 		<< "frame_count " << frameCount_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (asyncStarted_ && asyncFinished_)
-			fetchAsyncResults();
-	}
+	if (asyncStarted_ && asyncTask_.done())
+		fetchAsyncResults();
 	/* Finally apply IIR filter to results and put into metadata. */
 	memcpy(prevSyncResults_.mode, syncResults_.mode,
 	       sizeof(prevSyncResults_.mode));
@@ -380,28 +381,8 @@ void Awb::process(StatisticsPtr &stats, Metadata *imageMetadata)
 		LOG(RPiAwb, Debug) << "Awb lux value is " << luxStatus.lux;
 
 		if (asyncStarted_ == false)
-			restartAsync(stats, luxStatus.lux);
-	}
-}
-
-void Awb::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			asyncSignal_.wait(lock, [&] {
-				return asyncStart_ || asyncAbort_;
-			});
-			asyncStart_ = false;
-			if (asyncAbort_)
-				break;
-		}
-		doAwb();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			asyncFinished_ = true;
-		}
-		syncSignal_.notify_one();
+			restartAsync(stats, luxStatus.lux,
+				     frameDuration(imageMetadata));
 	}
 }
 
@@ -514,11 +495,12 @@ static double interpolateQuadatric(ipa::Pwl::Point const &a, ipa::Pwl::Point con
 	return a.y() < c.y() - eps ? a.x() : (c.y() < a.y() - eps ? c.x() : b.x());
 }
 
-double Awb::coarseSearch(ipa::Pwl const &prior)
+double Awb::coarseSearch(ipa::Pwl const &prior, double ctLo, double ctHi,
+			 bool *atLimit)
 {
 	points_.clear(); /* assume doesn't deallocate memory */
 	size_t bestPoint = 0;
-	double t = mode_->ctLo;
+	double t = ctLo;
 	int spanR = 0, spanB = 0;
 	/* Step down the CT curve evaluating log likelihood. */
 	while (true) {
@@ -536,11 +518,19 @@ double Awb::coarseSearch(ipa::Pwl const &prior)
 		points_.push_back(ipa::Pwl::Point({ t, finalLogLikelihood }));
 		if (points_.back().y() < points_[bestPoint].y())
 			bestPoint = points_.size() - 1;
-		if (t == mode_->ctHi)
+		if (t == ctHi)
 			break;
 		/* for even steps along the r/b curve scale them by the current t */
-		t = std::min(t + t / 10 * config_.coarseStep, mode_->ctHi);
+		t = std::min(t + t / 10 * config_.coarseStep, ctHi);
 	}
+	/*
+	 * Report whether the best point is at an end of a search window that
+	 * doesn't extend to the limits of the mode, in which case the true
+	 * minimum may lie outside of the window.
+	 */
+	if (atLimit)
+		*atLimit = (bestPoint == 0 && ctLo > mode_->ctLo) ||
+			   (bestPoint == points_.size() - 1 && ctHi < mode_->ctHi);
 	t = points_[bestPoint].x();
 	LOG(RPiAwb, Debug) << "Coarse search found CT " << t;
 	/*
@@ -642,6 +632,32 @@ void Awb::fineSearch(double &t, double &r, double &b, ipa::Pwl const &prior)
 		<< "Fine search found t " << t << " r " << r << " b " << b;
 }
 
+bool Awb::canWarmStart()
+{
+	if (!config_.incremental || !warmStart_.valid)
+		return false;
+
+	if (warmStart_.mode != mode_ ||
+	    warmStart_.searches >= config_.incrementalMaxSearches)
+		return false;
+
+	if (std::abs(lux_ - warmStart_.lux) >
+	    config_.incrementalLuxThreshold * std::max(warmStart_.lux, 1.0))
+		return false;
+
+	/*
+	 * If the colour error at the previous result hasn't changed much, the
+	 * scene is considered stable and the minimum won't have moved far.
+	 */
+	double delta2 = computeDelta2Sum(1 / warmStart_.r, 1 / warmStart_.b) /
+			zones_.size();
+	LOG(RPiAwb, Debug)
+		<< "Colour error at previous result " << delta2
+		<< " (was " << warmStart_.delta2 << ")";
+	return std::abs(delta2 - warmStart_.delta2) <=
+	       config_.incrementalDelta2Threshold * std::max(warmStart_.delta2, 1e-3);
+}
+
 void Awb::awbBayes()
 {
 	/*
@@ -659,7 +675,25 @@ void Awb::awbBayes()
 	prior.map([](double x, double y) {
 		LOG(RPiAwb, Debug) << "(" << x << "," << y << ")";
 	});
-	double t = coarseSearch(prior);
+	double t;
+	bool atLimit = true;
+	if (canWarmStart()) {
+		/* Only search a window around the previous result. */
+		double ctLo = std::max(mode_->ctLo,
+				       warmStart_.t * (1 - config_.incrementalWindow));
+		double ctHi = std::min(mode_->ctHi,
+				       warmStart_.t * (1 + config_.incrementalWindow));
+		if (ctLo < ctHi) {
+			t = coarseSearch(prior, ctLo, ctHi, &atLimit);
+			warmStart_.searches++;
+		}
+		if (atLimit)
+			LOG(RPiAwb, Debug) << "Incremental search failed";
+	}
+	if (atLimit) {
+		t = coarseSearch(prior, mode_->ctLo, mode_->ctHi);
+		warmStart_.searches = 0;
+	}
 	double r = config_.ctR.eval(t);
 	double b = config_.ctB.eval(t);
 	LOG(RPiAwb, Debug)
@@ -682,6 +716,13 @@ void Awb::awbBayes()
 	 * the gains from the ones that the "canonical sensor" would require to
 	 * the ones needed by *this* sensor.
 	 */
+	warmStart_.valid = true;
+	warmStart_.mode = mode_;
+	warmStart_.lux = lux_;
+	warmStart_.t = t;
+	warmStart_.r = r;
+	warmStart_.b = b;
+	warmStart_.delta2 = computeDelta2Sum(1 / r, 1 / b) / zones_.size();
 	asyncResults_.temperatureK = t;
 	asyncResults_.gainR = 1.0 / r * config_.sensitivityR;
 	asyncResults_.gainG = 1.0;
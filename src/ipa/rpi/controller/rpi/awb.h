@@ -6,10 +6,6 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
-
 #include <libcamera/geometry.h>
 
 #include "../awb_algorithm.h"
@@ -17,6 +13,7 @@
 #include "../statistics.h"
 
 #include "libipa/pwl.h"
+#include "libipa/task_scheduler.h"
 
 namespace RPiController {
 
@@ -87,6 +84,19 @@ struct AwbConfig {
 	double whitepointR;
 	double whitepointB;
 	bool bayes; /* use Bayesian algorithm */
+	/*
+	 * Incremental mode: when the scene is stable, only search a window of
+	 * the CT curve around the previous result.
+	 */
+	bool incremental;
+	/* CT search window either side of the previous result, as a fraction */
+	double incrementalWindow;
+	/* relative lux change that forces a full search */
+	double incrementalLuxThreshold;
+	/* relative change of the colour error that forces a full search */
+	double incrementalDelta2Threshold;
+	/* maximum number of incremental searches between two full searches */
+	unsigned int incrementalMaxSearches;
 };
 
 class Awb : public AwbAlgorithm
@@ -123,19 +133,8 @@ private:
 	bool isAutoEnabled() const;
 	/* configuration is read-only, and available to both threads */
 	AwbConfig config_;
-	std::thread asyncThread_;
-	void asyncFunc(); /* asynchronous thread function */
-	std::mutex mutex_;
-	/* condvar for async thread to wait on */
-	std::condition_variable asyncSignal_;
-	/* condvar for synchronous thread to wait on */
-	std::condition_variable syncSignal_;
-	/* for sync thread to check  if async thread finished (requires mutex) */
-	bool asyncFinished_;
-	/* for async thread to check if it's been told to run (requires mutex) */
-	bool asyncStart_;
-	/* for async thread to check if it's been told to quit (requires mutex) */
-	bool asyncAbort_;
+	/* asynchronous job, run on the shared IPA worker pool */
+	libcamera::ipa::TaskScheduler::Task asyncTask_;
 
 	/*
 	 * The following are only for the synchronous thread to use:
@@ -152,7 +151,8 @@ private:
 	 * The following are for the asynchronous thread to use, though the main
 	 * thread can set/reset them if the async thread is known to be idle:
 	 */
-	void restartAsync(StatisticsPtr &stats, double lux);
+	void restartAsync(StatisticsPtr &stats, double lux,
+			  libcamera::utils::Duration frameDuration);
 	/* copy out the results from the async thread so that it can be restarted */
 	void fetchAsyncResults();
 	StatisticsPtr statistics_;
@@ -165,10 +165,22 @@ private:
 	void prepareStats();
 	double computeDelta2Sum(double gainR, double gainB);
 	libcamera::ipa::Pwl interpolatePrior();
-	double coarseSearch(libcamera::ipa::Pwl const &prior);
+	bool canWarmStart();
+	double coarseSearch(libcamera::ipa::Pwl const &prior, double ctLo,
+			    double ctHi, bool *atLimit = nullptr);
 	void fineSearch(double &t, double &r, double &b, libcamera::ipa::Pwl const &prior);
 	std::vector<RGB> zones_;
 	std::vector<libcamera::ipa::Pwl::Point> points_;
+	/* state of the previous Bayesian search, for the incremental mode */
+	struct {
+		bool valid;
+		AwbMode *mode;
+		double lux;
+		double t, r, b;
+		/* mean colour error of the zones at the previous result */
+		double delta2;
+		unsigned int searches;
+	} warmStart_;
 	/* manual r setting */
 	double manualR_;
 	/* manual b setting */
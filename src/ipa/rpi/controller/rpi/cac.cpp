@@ -27,6 +27,11 @@ char const *Cac::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Cac::dependencies() const
+{
+	return std::vector<std::string>{};
+}
+
 static bool arrayToSet(const libcamera::YamlObject &params, std::vector<double> &inputArray, const Size &size)
 {
 	int num = 0;
@@ -24,6 +24,7 @@ class Cac : public Algorithm
 public:
 	Cac(Controller *controller = NULL);
 	char const *name() const override;
+	std::optional<std::vector<std::string>> dependencies() const override;
 	int read(const libcamera::YamlObject &params) override;
 	void prepare(Metadata *imageMetadata) override;
 
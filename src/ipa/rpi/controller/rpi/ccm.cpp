@@ -114,7 +114,7 @@ void Ccm::initialise()
 }
 
 template<typename T>
-static bool getLocked(Metadata *metadata, std::string const &tag, T &value)
+static bool getLocked(Metadata *metadata, MetadataTag tag, T &value)
 {
 	T *ptr = metadata->getLocked<T>(tag);
 	if (ptr == nullptr)
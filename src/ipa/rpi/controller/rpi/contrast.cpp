@@ -38,6 +38,11 @@ char const *Contrast::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Contrast::dependencies() const
+{
+	return std::vector<std::string>{};
+}
+
 int Contrast::read(const libcamera::YamlObject &params)
 {
 	// enable adaptive enhancement by default
@@ -70,6 +70,11 @@ char const *Denoise::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Denoise::dependencies() const
+{
+	return std::vector<std::string>{ "noise" };
+}
+
 int Denoise::read(const libcamera::YamlObject &params)
 {
 	if (!params.contains("normal")) {
@@ -38,6 +38,7 @@ class Denoise : public DenoiseAlgorithm
 public:
 	Denoise(Controller *controller);
 	char const *name() const override;
+	std::optional<std::vector<std::string>> dependencies() const override;
 	int read(const libcamera::YamlObject &params) override;
 	void initialise() override;
 	void switchMode(CameraMode const &cameraMode, Metadata *metadata) override;
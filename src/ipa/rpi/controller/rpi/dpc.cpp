@@ -31,6 +31,11 @@ char const *Dpc::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Dpc::dependencies() const
+{
+	return std::vector<std::string>{};
+}
+
 int Dpc::read(const libcamera::YamlObject &params)
 {
 	config_.strength = params["strength"].get<int>(1);
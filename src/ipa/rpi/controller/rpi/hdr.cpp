@@ -50,6 +50,8 @@ void HdrConfig::read(const libcamera::YamlObject &params, const std::string &mod
 		spatialGainCurve.append(0.06, 1.0); /* maybe make this programmable? */
 		spatialGainCurve.append(1.0, 1.0);
 	}
+	/* The curve is evaluated for every region of every frame. */
+	spatialGainLut = spatialGainCurve.bake(1024);
 
 	diffusion = params["diffusion"].get<unsigned int>(3);
 	/* Clip to an arbitrary limit just to stop typos from killing the system! */
@@ -98,12 +100,20 @@ void HdrConfig::read(const libcamera::YamlObject &params, const std::string &mod
 }
 
 Hdr::Hdr(Controller *controller)
-	: HdrAlgorithm(controller)
+	: HdrAlgorithm(controller),
+	  asyncTask_("rpi-hdr", [this] { computeGains(); }),
+	  asyncConfig_(nullptr)
 {
 	regions_ = controller->getHardwareConfig().awbRegions;
 	numRegions_ = regions_.width * regions_.height;
-	gains_[0].resize(numRegions_, 1.0);
-	gains_[1].resize(numRegions_, 1.0);
+	gains_[0].resize(numRegions_, 1.0f);
+	gains_[1].resize(numRegions_, 1.0f);
+}
+
+Hdr::~Hdr()
+{
+	asyncTask_.cancel();
+	asyncTask_.wait();
 }
 
 char const *Hdr::name() const
@@ -129,6 +139,8 @@ int Hdr::read(const libcamera::YamlObject &params)
 	for (const auto &[key, value] : params.asDict())
 		config_[key].read(value, key);
 
+	asyncTask_.setPriority(getTaskPriority());
+
 	return 0;
 }
 
@@ -197,8 +209,11 @@ void Hdr::prepare(Metadata *imageMetadata)
 		return;
 	}
 
+	/* Wait for the gains computed from the last statistics. */
+	asyncTask_.wait();
+
 	/* The final gains ended up in the odd or even array, according to diffusion. */
-	std::vector<double> &gains = gains_[config.diffusion & 1];
+	const std::vector<float> &gains = gains_[config.diffusion & 1];
 	for (unsigned int i = 0; i < numRegions_; i++) {
 		alscStatus.r[i] *= gains[i];
 		alscStatus.g[i] *= gains[i];
@@ -292,48 +307,57 @@ bool Hdr::updateTonemap([[maybe_unused]] StatisticsPtr &stats, HdrConfig &config
 	return true;
 }
 
-static void averageGains(std::vector<double> &src, std::vector<double> &dst, const Size &size)
+/*
+ * Average each gain with its horizontal and vertical neighbours. The filter is
+ * separable, the horizontal sums are computed first, followed by the vertical
+ * neighbours and the normalisation by the number of terms. All inner loops run
+ * over contiguous rows without branches, allowing the compiler to vectorize
+ * them.
+ */
+static void averageGains(const std::vector<float> &src, std::vector<float> &dst,
+			 const Size &size)
 {
-#define IDX(y, x) ((y)*size.width + (x))
-	unsigned int lastCol = size.width - 1; /* index of last column */
-	unsigned int preLastCol = lastCol - 1; /* and the column before that */
-	unsigned int lastRow = size.height - 1; /* index of last row */
-	unsigned int preLastRow = lastRow - 1; /* and the row before that */
-
-	/* Corners first. */
-	dst[IDX(0, 0)] = (src[IDX(0, 0)] + src[IDX(0, 1)] + src[IDX(1, 0)]) / 3;
-	dst[IDX(0, lastCol)] = (src[IDX(0, lastCol)] + src[IDX(0, preLastCol)] + src[IDX(1, lastCol)]) / 3;
-	dst[IDX(lastRow, 0)] = (src[IDX(lastRow, 0)] + src[IDX(lastRow, 1)] + src[IDX(preLastRow, 0)]) / 3;
-	dst[IDX(lastRow, lastCol)] = (src[IDX(lastRow, lastCol)] + src[IDX(lastRow, preLastCol)] +
-				      src[IDX(preLastRow, lastCol)]) /
-				     3;
-
-	/* Now the edges. */
-	for (unsigned int i = 1; i < lastCol; i++) {
-		dst[IDX(0, i)] = (src[IDX(0, i - 1)] + src[IDX(0, i)] + src[IDX(0, i + 1)] + src[IDX(1, i)]) / 4;
-		dst[IDX(lastRow, i)] = (src[IDX(lastRow, i - 1)] + src[IDX(lastRow, i)] +
-					src[IDX(lastRow, i + 1)] + src[IDX(preLastRow, i)]) /
-				       4;
-	}
+	const unsigned int width = size.width;
+	const unsigned int height = size.height;
 
-	for (unsigned int i = 1; i < lastRow; i++) {
-		dst[IDX(i, 0)] = (src[IDX(i - 1, 0)] + src[IDX(i, 0)] + src[IDX(i + 1, 0)] + src[IDX(i, 1)]) / 4;
-		dst[IDX(i, 31)] = (src[IDX(i - 1, lastCol)] + src[IDX(i, lastCol)] +
-				   src[IDX(i + 1, lastCol)] + src[IDX(i, preLastCol)]) /
-				  4;
-	}
+	for (unsigned int y = 0; y < height; y++) {
+		const float *row = &src[y * width];
+		float *out = &dst[y * width];
 
-	/* Finally the interior. */
-	for (unsigned int j = 1; j < lastRow; j++) {
-		for (unsigned int i = 1; i < lastCol; i++) {
-			dst[IDX(j, i)] = (src[IDX(j - 1, i)] + src[IDX(j, i - 1)] + src[IDX(j, i)] +
-					  src[IDX(j, i + 1)] + src[IDX(j + 1, i)]) /
-					 5;
+		out[0] = row[0] + row[1];
+		for (unsigned int x = 1; x < width - 1; x++)
+			out[x] = row[x - 1] + row[x] + row[x + 1];
+		out[width - 1] = row[width - 2] + row[width - 1];
+
+		unsigned int terms = 3;
+
+		if (y > 0) {
+			const float *above = row - width;
+			for (unsigned int x = 0; x < width; x++)
+				out[x] += above[x];
+			terms++;
 		}
+
+		if (y < height - 1) {
+			const float *below = row + width;
+			for (unsigned int x = 0; x < width; x++)
+				out[x] += below[x];
+			terms++;
+		}
+
+		/* The first and last columns have one horizontal term less. */
+		const float inner = 1.0f / terms;
+		const float edge = 1.0f / (terms - 1);
+
+		out[0] *= edge;
+		for (unsigned int x = 1; x < width - 1; x++)
+			out[x] *= inner;
+		out[width - 1] *= edge;
 	}
 }
 
-void Hdr::updateGains(StatisticsPtr &stats, HdrConfig &config)
+void Hdr::updateGains(StatisticsPtr &stats, HdrConfig &config,
+		      utils::Duration deadline)
 {
 	if (config.spatialGainCurve.empty())
 		return;
@@ -342,17 +366,37 @@ void Hdr::updateGains(StatisticsPtr &stats, HdrConfig &config)
 	if (delayedStatus_.mode == "MultiExposure" && delayedStatus_.channel != "short")
 		return;
 
+	/*
+	 * Compute the gains on the worker pool, prepare() waits for the
+	 * results before using them. The previous computation has completed
+	 * by then, but wait for it anyway in case prepare() hasn't run.
+	 */
+	asyncTask_.wait();
+
+	asyncStats_ = stats;
+	asyncConfig_ = &config;
+	asyncTask_.submit(deadline);
+}
+
+void Hdr::computeGains()
+{
+	const HdrConfig &config = *asyncConfig_;
+	std::vector<float> &gains = gains_[0];
+
 	for (unsigned int i = 0; i < numRegions_; i++) {
-		auto &region = stats->awbRegions.get(i);
+		auto &region = asyncStats_->awbRegions.get(i);
 		unsigned int counted = region.counted;
 		counted += (counted == 0); /* avoid div by zero */
 		double r = region.val.rSum / counted;
 		double g = region.val.gSum / counted;
 		double b = region.val.bSum / counted;
 		double brightness = std::max({ r, g, b }) / 65535;
-		gains_[0][i] = config.spatialGainCurve.eval(brightness);
+		gains[i] = config.spatialGainLut.eval(brightness);
 	}
 
+	/* Release the statistics, they're not needed anymore. */
+	asyncStats_.reset();
+
 	/* Ping-pong between the two gains_ buffers. */
 	for (unsigned int i = 0; i < config.diffusion; i++)
 		averageGains(gains_[i & 1], gains_[(i & 1) ^ 1], regions_);
@@ -382,7 +426,7 @@ void Hdr::process(StatisticsPtr &stats, Metadata *imageMetadata)
 	HdrConfig &config = it->second;
 
 	/* Update the spatially varying gains. They get written in prepare(). */
-	updateGains(stats, config);
+	updateGains(stats, config, Algorithm::frameDuration(imageMetadata));
 
 	if (updateTonemap(stats, config)) {
 		/* Add tonemap.status metadata. */
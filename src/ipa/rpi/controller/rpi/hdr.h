@@ -13,6 +13,7 @@
 #include <libcamera/geometry.h>
 
 #include <libipa/pwl.h>
+#include <libipa/task_scheduler.h>
 
 #include "../hdr_algorithm.h"
 #include "../hdr_status.h"
@@ -28,6 +29,7 @@ struct HdrConfig {
 
 	/* Lens shading related parameters. */
 	libcamera::ipa::Pwl spatialGainCurve; /* Brightness to gain curve for different image regions. */
+	libcamera::ipa::Pwl::Lut spatialGainLut; /* The same curve, baked for per-region evaluation. */
 	unsigned int diffusion; /* How much to diffuse the gain spatially. */
 
 	/* Tonemap related parameters. */
@@ -59,6 +61,7 @@ class Hdr : public HdrAlgorithm
 {
 public:
 	Hdr(Controller *controller);
+	~Hdr();
 	char const *name() const override;
 	void switchMode(CameraMode const &cameraMode, Metadata *metadata) override;
 	int read(const libcamera::YamlObject &params) override;
@@ -69,7 +72,9 @@ public:
 
 private:
 	void updateAgcStatus(Metadata *metadata);
-	void updateGains(StatisticsPtr &stats, HdrConfig &config);
+	void updateGains(StatisticsPtr &stats, HdrConfig &config,
+			 libcamera::utils::Duration deadline);
+	void computeGains();
 	bool updateTonemap(StatisticsPtr &stats, HdrConfig &config);
 
 	std::map<std::string, HdrConfig> config_;
@@ -79,7 +84,11 @@ private:
 	libcamera::ipa::Pwl tonemap_;
 	libcamera::Size regions_; /* stats regions */
 	unsigned int numRegions_; /* total number of stats regions */
-	std::vector<double> gains_[2];
+	std::vector<float> gains_[2];
+	/* The spatial gains are computed on the IPA worker pool. */
+	libcamera::ipa::TaskScheduler::Task asyncTask_;
+	StatisticsPtr asyncStats_;
+	const HdrConfig *asyncConfig_;
 };
 
 } /* namespace RPiController */
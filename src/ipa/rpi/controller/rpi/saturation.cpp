@@ -27,6 +27,11 @@ char const *Saturation::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Saturation::dependencies() const
+{
+	return std::vector<std::string>{};
+}
+
 int Saturation::read(const libcamera::YamlObject &params)
 {
 	config_.shiftR = params["shift_r"].get<uint8_t>(0);
@@ -21,6 +21,7 @@ class Saturation : public Algorithm
 public:
 	Saturation(Controller *controller = NULL);
 	char const *name() const override;
+	std::optional<std::vector<std::string>> dependencies() const override;
 	int read(const libcamera::YamlObject &params) override;
 	void initialise() override;
 	void prepare(Metadata *imageMetadata) override;
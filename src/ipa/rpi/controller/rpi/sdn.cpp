@@ -35,6 +35,11 @@ char const *Sdn::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Sdn::dependencies() const
+{
+	return std::vector<std::string>{ "noise" };
+}
+
 int Sdn::read(const libcamera::YamlObject &params)
 {
 	LOG(RPiSdn, Warning)
@@ -30,6 +30,11 @@ char const *Sharpen::name() const
 	return NAME;
 }
 
+std::optional<std::vector<std::string>> Sharpen::dependencies() const
+{
+	return std::vector<std::string>{};
+}
+
 void Sharpen::switchMode(CameraMode const &cameraMode,
 			 [[maybe_unused]] Metadata *metadata)
 {
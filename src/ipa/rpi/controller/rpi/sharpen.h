@@ -18,6 +18,7 @@ class Sharpen : public SharpenAlgorithm
 public:
 	Sharpen(Controller *controller);
 	char const *name() const override;
+	std::optional<std::vector<std::string>> dependencies() const override;
 	void switchMode(CameraMode const &cameraMode, Metadata *metadata) override;
 	int read(const libcamera::YamlObject &params) override;
 	void setStrength(double strength) override;
@@ -78,6 +78,7 @@ int generateLut(const ipa::Pwl &pwl, uint32_t *lut, std::size_t lutSize,
 		return -EINVAL;
 
 	int lastY = 0;
+	int span = 0;
 	for (unsigned int i = 0; i < lutSize; i++) {
 		int x, y;
 		if (i < 32)
@@ -87,7 +88,8 @@ int generateLut(const ipa::Pwl &pwl, uint32_t *lut, std::size_t lutSize,
 		else
 			x = std::min(65535u, (i - 48) * 2048 + 32768);
 
-		y = pwl.eval(x);
+		/* x increases monotonically, carry the span over. */
+		y = pwl.eval(x, &span);
 		if (y < 0 || (i && y < lastY)) {
 			LOG(IPARPI, Error)
 				<< "Malformed PWL for Gamma, disabling!";
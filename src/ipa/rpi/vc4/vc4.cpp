@@ -370,13 +370,14 @@ void IpaVc4::applyGamma(const struct ContrastStatus *contrastStatus, ControlList
 {
 	const unsigned int numGammaPoints = controller_.getHardwareConfig().numGammaPoints;
 	struct bcm2835_isp_gamma gamma;
+	int span = 0;
 
 	for (unsigned int i = 0; i < numGammaPoints - 1; i++) {
 		int x = i < 16 ? i * 1024
 			       : (i < 24 ? (i - 16) * 2048 + 16384
 					 : (i - 24) * 4096 + 32768);
 		gamma.x[i] = x;
-		gamma.y[i] = std::min<uint16_t>(65535, contrastStatus->gammaCurve.eval(x));
+		gamma.y[i] = std::min<uint16_t>(65535, contrastStatus->gammaCurve.eval(x, &span));
 	}
 
 	gamma.x[numGammaPoints - 1] = 65535;
@@ -5,6 +5,7 @@
  * Simple Software Image Processing Algorithm module
  */
 
+#include <algorithm>
 #include <cmath>
 #include <numeric>
 #include <stdint.h>
@@ -12,7 +13,6 @@
 
 #include <linux/v4l2-controls.h>
 
-#include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/shared_fd.h>
 
@@ -28,6 +28,10 @@
 #include "libcamera/internal/yaml_parser.h"
 
 #include "libipa/camera_sensor_helper.h"
+#include "libipa/matrix.h"
+#include "libipa/matrix_interpolator.h"
+#include "libipa/persistent_state.h"
+#include "libipa/tuning_data.h"
 
 #include "black_level.h"
 
@@ -54,12 +58,25 @@ static constexpr float kExposureOptimal = kExposureBinsCount / 2.0;
  */
 static constexpr float kExposureSatisfactory = 0.2;
 
+/* The gamma curve applied to the output values */
+static constexpr float kGamma = 0.5;
+
+/*
+ * The lookup tables are only regenerated when a white balance gain changes by
+ * more than kLutGainThreshold percent, or the color temperature by more than
+ * kLutCtThreshold kelvins. Smaller changes are not noticeable.
+ */
+static constexpr unsigned int kLutGainThreshold = 1;
+static constexpr unsigned int kLutCtThreshold = 100;
+
 class IPASoftSimple : public ipa::soft::IPASoftInterface
 {
 public:
 	IPASoftSimple()
-		: params_(nullptr), stats_(nullptr), blackLevel_(BlackLevel()),
-		  ignoreUpdates_(0)
+		: params_(nullptr), paramsBufferId_(0), stats_(nullptr),
+		  blackLevel_(BlackLevel()), lutGains_{ 0, 0, 0 }, lutCt_(0),
+		  lutGeneration_(0), ccmEnabled_(false), exposure_(0),
+		  again_(0.0), ignoreUpdates_(0)
 	{
 	}
 
@@ -69,39 +86,69 @@ public:
 		 const SharedFD &fdStats,
 		 const SharedFD &fdParams,
 		 const ControlInfoMap &sensorInfoMap) override;
-	int configure(const ControlInfoMap &sensorInfoMap) override;
+	int configure(const ControlInfoMap &sensorInfoMap,
+		      StatsConfig *statsConfig) override;
 
 	int start() override;
 	void stop() override;
 
-	void processStats(const ControlList &sensorControls) override;
+	void processStats(const uint32_t frame, const uint32_t bufferId,
+			  const ControlList &sensorControls) override;
 
 private:
 	void updateExposure(double exposureMSV);
-
+	bool updateLutSettings(uint8_t blackLevel, const unsigned int gains[3],
+			       unsigned int ct);
+	void fillLuts(DebayerParams *params);
+	void updateCcm(DebayerParams *params, uint8_t blackLevel,
+		       const unsigned int gains[3], unsigned int ct);
+	static unsigned int estimateCCT(double red, double green, double blue);
+	void setControls();
+
+	/* Ring of DebayerParams::kBufferCount parameters buffers */
 	DebayerParams *params_;
-	SwIspStats *stats_;
+	unsigned int paramsBufferId_;
+	/* Ring of SwIspStats::kBufferCount statistics buffers */
+	const SwIspStats *stats_;
 	std::unique_ptr<CameraSensorHelper> camHelper_;
 	ControlInfoMap sensorInfoMap_;
 	BlackLevel blackLevel_;
+	StatsConfig statsConfig_;
 
 	static constexpr unsigned int kGammaLookupSize = 1024;
 	std::array<uint8_t, kGammaLookupSize> gammaTable_;
 	int lastBlackLevel_ = -1;
 
+	/* Settings of the current lookup tables, and their generation */
+	unsigned int lutGains_[3];
+	unsigned int lutCt_;
+	uint32_t lutGeneration_;
+
+	/* Color correction matrices, by color temperature */
+	bool ccmEnabled_;
+	MatrixInterpolator<float, 3, 3> ccm_;
+	DebayerParams::GammaLookupTable ccmGammaLut_;
+
 	int32_t exposureMin_, exposureMax_;
 	int32_t exposure_;
 	double againMin_, againMax_, againMinStep_;
 	double again_;
 	unsigned int ignoreUpdates_;
+
+	/* AGC results persisted across camera sessions */
+	PersistentState state_;
+
+	/* Tuning data, shared with the other cameras using the same file */
+	std::shared_ptr<const YamlObject> tuningData_;
 };
 
 IPASoftSimple::~IPASoftSimple()
 {
 	if (stats_)
-		munmap(stats_, sizeof(SwIspStats));
+		munmap(const_cast<SwIspStats *>(stats_),
+		       sizeof(SwIspStats) * SwIspStats::kBufferCount);
 	if (params_)
-		munmap(params_, sizeof(DebayerParams));
+		munmap(params_, sizeof(DebayerParams) * DebayerParams::kBufferCount);
 }
 
 int IPASoftSimple::init(const IPASettings &settings,
@@ -117,23 +164,47 @@ int IPASoftSimple::init(const IPASettings &settings,
 	}
 
 	/* Load the tuning data file */
-	File file(settings.configurationFile);
-	if (!file.open(File::OpenModeFlag::ReadOnly)) {
-		int ret = file.error();
-		LOG(IPASoft, Error)
-			<< "Failed to open configuration file "
-			<< settings.configurationFile << ": " << strerror(-ret);
+	int ret = TuningData::load(settings.configurationFile, &tuningData_);
+	if (ret)
 		return ret;
-	}
 
-	std::unique_ptr<libcamera::YamlObject> data = YamlParser::parse(file);
-	if (!data)
-		return -EINVAL;
+	const YamlObject *data = tuningData_.get();
 
 	/* \todo Use the IPA configuration file for real. */
 	unsigned int version = (*data)["version"].get<uint32_t>(0);
 	LOG(IPASoft, Debug) << "Tuning file version " << version;
 
+	/*
+	 * Statistics can be gathered on a subset of the frames and of the
+	 * columns only, to lower the CPU usage on slow platforms at the cost
+	 * of a slower convergence of the algorithms.
+	 */
+	const YamlObject &statsData = (*data)["statistics"];
+	statsConfig_.frameInterval =
+		std::max(statsData["frameInterval"].get<uint32_t>(1), 1U);
+	statsConfig_.xSubsampling =
+		std::max(statsData["xSubsampling"].get<uint32_t>(1), 1U);
+
+	/*
+	 * The color correction matrices are optional, colors are only white
+	 * balanced without them.
+	 */
+	if (data->contains("ccms")) {
+		ret = ccm_.readYaml((*data)["ccms"], "ct", "ccm");
+		if (ret < 0) {
+			LOG(IPASoft, Error)
+				<< "Failed to parse 'ccms' from the tuning file";
+			return ret;
+		}
+
+		ccmEnabled_ = true;
+
+		for (unsigned int i = 0; i < DebayerParams::kGammaLookupSize; i++)
+			ccmGammaLut_[i] = UINT8_MAX *
+					  std::pow(i / (DebayerParams::kGammaLookupSize - 1.0),
+						   kGamma);
+	}
+
 	params_ = nullptr;
 	stats_ = nullptr;
 
@@ -148,8 +219,8 @@ int IPASoftSimple::init(const IPASettings &settings,
 	}
 
 	{
-		void *mem = mmap(nullptr, sizeof(DebayerParams), PROT_WRITE,
-				 MAP_SHARED, fdParams.get(), 0);
+		void *mem = mmap(nullptr, sizeof(DebayerParams) * DebayerParams::kBufferCount,
+				 PROT_WRITE, MAP_SHARED, fdParams.get(), 0);
 		if (mem == MAP_FAILED) {
 			LOG(IPASoft, Error) << "Unable to map Parameters";
 			return -errno;
@@ -159,14 +230,14 @@ int IPASoftSimple::init(const IPASettings &settings,
 	}
 
 	{
-		void *mem = mmap(nullptr, sizeof(SwIspStats), PROT_READ,
-				 MAP_SHARED, fdStats.get(), 0);
+		void *mem = mmap(nullptr, sizeof(SwIspStats) * SwIspStats::kBufferCount,
+				 PROT_READ, MAP_SHARED, fdStats.get(), 0);
 		if (mem == MAP_FAILED) {
 			LOG(IPASoft, Error) << "Unable to map Statistics";
 			return -errno;
 		}
 
-		stats_ = static_cast<SwIspStats *>(mem);
+		stats_ = static_cast<const SwIspStats *>(mem);
 	}
 
 	/*
@@ -185,12 +256,16 @@ int IPASoftSimple::init(const IPASettings &settings,
 		return -EINVAL;
 	}
 
+	state_.init("simple-" + settings.sensorModel);
+
 	return 0;
 }
 
-int IPASoftSimple::configure(const ControlInfoMap &sensorInfoMap)
+int IPASoftSimple::configure(const ControlInfoMap &sensorInfoMap,
+			     StatsConfig *statsConfig)
 {
 	sensorInfoMap_ = sensorInfoMap;
+	*statsConfig = statsConfig_;
 
 	const ControlInfo &exposureInfo = sensorInfoMap_.find(V4L2_CID_EXPOSURE)->second;
 	const ControlInfo &gainInfo = sensorInfoMap_.find(V4L2_CID_ANALOGUE_GAIN)->second;
@@ -238,16 +313,50 @@ int IPASoftSimple::configure(const ControlInfoMap &sensorInfoMap)
 
 int IPASoftSimple::start()
 {
+	/*
+	 * Start from the exposure and gain of the previous session to shorten
+	 * the AGC convergence. The exposure is stored in lines, which is only
+	 * an approximation if the sensor mode has changed, and is clamped to
+	 * the current limits.
+	 */
+	if (state_.load())
+		return 0;
+
+	auto exposure = state_.get("agc.exposure");
+	auto gain = state_.get("agc.analogue_gain");
+	if (!exposure || !gain)
+		return 0;
+
+	exposure_ = std::clamp<double>(*exposure, exposureMin_, exposureMax_);
+	again_ = std::clamp(*gain, againMin_, againMax_);
+
+	setControls();
+
 	return 0;
 }
 
 void IPASoftSimple::stop()
 {
+	if (!state_.isEnabled() || !exposure_)
+		return;
+
+	state_.set("agc.exposure", exposure_);
+	state_.set("agc.analogue_gain", again_);
+	state_.store();
 }
 
-void IPASoftSimple::processStats(const ControlList &sensorControls)
+void IPASoftSimple::processStats(const uint32_t frame,
+				 const uint32_t bufferId,
+				 const ControlList &sensorControls)
 {
-	SwIspStats::Histogram histogram = stats_->yHistogram;
+	if (bufferId >= SwIspStats::kBufferCount) {
+		LOG(IPASoft, Error) << "Invalid statistics buffer " << bufferId;
+		return;
+	}
+
+	const SwIspStats *stats = &stats_[bufferId];
+
+	SwIspStats::Histogram histogram = stats->yHistogram;
 	if (ignoreUpdates_ > 0)
 		blackLevel_.update(histogram);
 	const uint8_t blackLevel = blackLevel_.get();
@@ -260,9 +369,9 @@ void IPASoftSimple::processStats(const ControlList &sensorControls)
 	const uint64_t nPixels = std::accumulate(
 		histogram.begin(), histogram.end(), 0);
 	const uint64_t offset = blackLevel * nPixels;
-	const uint64_t sumR = stats_->sumR_ - offset / 4;
-	const uint64_t sumG = stats_->sumG_ - offset / 2;
-	const uint64_t sumB = stats_->sumB_ - offset / 4;
+	const uint64_t sumR = stats->sumR_ - offset / 4;
+	const uint64_t sumG = stats->sumG_ - offset / 2;
+	const uint64_t sumB = stats->sumB_ - offset / 4;
 
 	/*
 	 * Calculate red and blue gains for AWB.
@@ -274,36 +383,37 @@ void IPASoftSimple::processStats(const ControlList &sensorControls)
 	/* Green gain and gamma values are fixed */
 	constexpr unsigned int gainG = 256;
 
-	/* Update the gamma table if needed */
-	if (blackLevel != lastBlackLevel_) {
-		constexpr float gamma = 0.5;
-		const unsigned int blackIndex = blackLevel * kGammaLookupSize / 256;
-		std::fill(gammaTable_.begin(), gammaTable_.begin() + blackIndex, 0);
-		const float divisor = kGammaLookupSize - blackIndex - 1.0;
-		for (unsigned int i = blackIndex; i < kGammaLookupSize; i++)
-			gammaTable_[i] = UINT8_MAX *
-					 std::pow((i - blackIndex) / divisor, gamma);
+	const unsigned int gains[3] = { gainR, gainG, gainB };
+	const unsigned int ct = ccmEnabled_ ? estimateCCT(sumR, sumG / 2.0, sumB) : 0;
+	const bool lutsChanged = updateLutSettings(blackLevel, gains, ct);
 
-		lastBlackLevel_ = blackLevel;
-	}
-
-	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
-		constexpr unsigned int div =
-			DebayerParams::kRGBLookupSize * 256 / kGammaLookupSize;
-		unsigned int idx;
+	/*
+	 * Write the parameters to the next buffer of the ring, the buffers
+	 * in use by the ISP for the current frames are left untouched. The
+	 * buffer only needs to be updated if it doesn't hold the current
+	 * lookup tables already. Copy them from the previous buffer when they
+	 * haven't changed, which is cheaper than computing them.
+	 */
+	const DebayerParams *prevParams = &params_[paramsBufferId_];
+	paramsBufferId_ = (paramsBufferId_ + 1) % DebayerParams::kBufferCount;
+	DebayerParams *params = &params_[paramsBufferId_];
 
-		/* Apply gamma after gain! */
-		idx = std::min({ i * gainR / div, (kGammaLookupSize - 1) });
-		params_->red[i] = gammaTable_[idx];
+	if (params->generation != lutGeneration_) {
+		if (!lutsChanged && prevParams->generation == lutGeneration_) {
+			*params = *prevParams;
+		} else {
+			fillLuts(params);
 
-		idx = std::min({ i * gainG / div, (kGammaLookupSize - 1) });
-		params_->green[i] = gammaTable_[idx];
+			params->ccmEnabled = ccmEnabled_;
+			if (ccmEnabled_)
+				updateCcm(params, blackLevel, lutGains_, lutCt_);
 
-		idx = std::min({ i * gainB / div, (kGammaLookupSize - 1) });
-		params_->blue[i] = gammaTable_[idx];
+			params->generation = lutGeneration_;
+		}
 	}
 
-	setIspParams.emit();
+	/* The new parameters apply from the next frame on */
+	setIspParams.emit(frame + 1, paramsBufferId_);
 
 	/* \todo Switch to the libipa/algorithm.h API someday. */
 
@@ -334,7 +444,7 @@ void IPASoftSimple::processStats(const ControlList &sensorControls)
 
 	for (unsigned int i = 0; i < histogramSize; i++) {
 		unsigned int idx = (i - (i / yHistValsPerBinMod)) / yHistValsPerBin;
-		exposureBins[idx] += stats_->yHistogram[blackLevelHistIdx + i];
+		exposureBins[idx] += stats->yHistogram[blackLevelHistIdx + i];
 	}
 
 	for (unsigned int i = 0; i < kExposureBinsCount; i++) {
@@ -358,6 +468,154 @@ void IPASoftSimple::processStats(const ControlList &sensorControls)
 
 	updateExposure(exposureMSV);
 
+	setControls();
+
+	LOG(IPASoft, Debug) << "exposureMSV " << exposureMSV
+			    << " exp " << exposure_ << " again " << again_
+			    << " gain R/B " << gainR << "/" << gainB
+			    << " black level " << static_cast<unsigned int>(blackLevel);
+}
+
+/*
+ * Update the settings of the lookup tables if they have changed noticeably,
+ * and return true if the lookup tables need to be regenerated.
+ */
+bool IPASoftSimple::updateLutSettings(uint8_t blackLevel,
+				      const unsigned int gains[3], unsigned int ct)
+{
+	auto changed = [](unsigned int value, unsigned int ref, unsigned int threshold) {
+		const unsigned int diff = value > ref ? value - ref : ref - value;
+		return diff * 100 > ref * threshold;
+	};
+
+	bool update = blackLevel != lastBlackLevel_;
+
+	for (unsigned int c = 0; c < 3; c++)
+		update |= changed(gains[c], lutGains_[c], kLutGainThreshold);
+
+	if (ccmEnabled_) {
+		const unsigned int diff = ct > lutCt_ ? ct - lutCt_ : lutCt_ - ct;
+		update |= diff > kLutCtThreshold;
+	}
+
+	if (!update)
+		return false;
+
+	/* Update the gamma table if needed */
+	if (blackLevel != lastBlackLevel_) {
+		const unsigned int blackIndex = blackLevel * kGammaLookupSize / 256;
+		std::fill(gammaTable_.begin(), gammaTable_.begin() + blackIndex, 0);
+		const float divisor = kGammaLookupSize - blackIndex - 1.0;
+		for (unsigned int i = blackIndex; i < kGammaLookupSize; i++)
+			gammaTable_[i] = UINT8_MAX *
+					 std::pow((i - blackIndex) / divisor, kGamma);
+
+		lastBlackLevel_ = blackLevel;
+	}
+
+	std::copy(gains, gains + 3, lutGains_);
+	lutCt_ = ct;
+
+	/* Skip the generation 0, reserved for tables that are always loaded. */
+	if (++lutGeneration_ == 0)
+		lutGeneration_ = 1;
+
+	return true;
+}
+
+/*
+ * Fill the red, green and blue lookup tables of \a params. The gains are
+ * applied in fixed point, gamma after gain.
+ */
+void IPASoftSimple::fillLuts(DebayerParams *params)
+{
+	constexpr unsigned int div =
+		DebayerParams::kRGBLookupSize * 256 / kGammaLookupSize;
+	DebayerParams::ColorLookupTable *tables[3] = {
+		&params->red, &params->green, &params->blue
+	};
+
+	for (unsigned int c = 0; c < 3; c++) {
+		DebayerParams::ColorLookupTable &table = *tables[c];
+		const unsigned int gain = lutGains_[c];
+
+		for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+			unsigned int idx = std::min(i * gain / div, kGammaLookupSize - 1);
+			table[i] = gammaTable_[idx];
+		}
+	}
+}
+
+/*
+ * Fill the color correction lookup tables of \a params. The black level, the
+ * white balance gains and the matrix coefficients are folded in the tables,
+ * which map each input value to its contributions to the three outputs.
+ */
+void IPASoftSimple::updateCcm(DebayerParams *params, uint8_t blackLevel,
+			      const unsigned int gains[3], unsigned int ct)
+{
+	constexpr unsigned int kScale =
+		DebayerParams::kGammaLookupSize / DebayerParams::kRGBLookupSize;
+	const Matrix<float, 3, 3> ccm = ccm_.get(ct);
+	DebayerParams::CcmLookupTable *tables[3] = {
+		&params->redCcm, &params->greenCcm, &params->blueCcm
+	};
+
+	/* The table entries are computed in Q16 fixed point. */
+	auto fixed = [](int64_t value) {
+		return static_cast<int16_t>(std::clamp<int64_t>((value + (1 << 15)) >> 16,
+								INT16_MIN, INT16_MAX));
+	};
+
+	for (unsigned int c = 0; c < 3; c++) {
+		DebayerParams::CcmLookupTable &table = *tables[c];
+		/* Stretch the range above the black level and apply the gain */
+		const float scale = kScale * gains[c] / 256.0 *
+				    DebayerParams::kRGBLookupSize /
+				    (DebayerParams::kRGBLookupSize - blackLevel);
+		int64_t coeffs[3];
+
+		for (unsigned int j = 0; j < 3; j++)
+			coeffs[j] = std::lround(ccm[j][c] * scale * 65536);
+
+		for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+			const int64_t value = i > blackLevel ? i - blackLevel : 0;
+
+			table[i] = { fixed(coeffs[0] * value),
+				     fixed(coeffs[1] * value),
+				     fixed(coeffs[2] * value) };
+		}
+	}
+
+	params->gammaLut = ccmGammaLut_;
+
+	LOG(IPASoft, Debug) << "Color temperature " << ct << "K, CCM " << ccm;
+}
+
+/*
+ * Estimate the correlated color temperature from the mean red, green and blue
+ * values, the same way as the rkisp1 IPA does.
+ */
+unsigned int IPASoftSimple::estimateCCT(double red, double green, double blue)
+{
+	/* Convert the RGB values to CIE tristimulus values (XYZ) */
+	double X = (-0.14282) * (red) + (1.54924) * (green) + (-0.95641) * (blue);
+	double Y = (-0.32466) * (red) + (1.57837) * (green) + (-0.73191) * (blue);
+	double Z = (-0.68202) * (red) + (0.77073) * (green) + (0.56332) * (blue);
+
+	/* Calculate the normalized chromaticity values */
+	double x = X / (X + Y + Z);
+	double y = Y / (X + Y + Z);
+
+	/* Calculate CCT */
+	double n = (x - 0.3320) / (0.1858 - y);
+	double cct = 449 * n * n * n + 3525 * n * n + 6823.3 * n + 5520.33;
+
+	return std::isfinite(cct) ? std::clamp(cct, 0.0, 100000.0) : 0;
+}
+
+void IPASoftSimple::setControls()
+{
 	ControlList ctrls(sensorInfoMap_);
 
 	ctrls.set(V4L2_CID_EXPOSURE, exposure_);
@@ -367,11 +625,6 @@ void IPASoftSimple::processStats(const ControlList &sensorControls)
 	ignoreUpdates_ = 2;
 
 	setSensorControls.emit(ctrls);
-
-	LOG(IPASoft, Debug) << "exposureMSV " << exposureMSV
-			    << " exp " << exposure_ << " again " << again_
-			    << " gain R/B " << gainR << "/" << gainB
-			    << " black level " << static_cast<unsigned int>(blackLevel);
 }
 
 void IPASoftSimple::updateExposure(double exposureMSV)
@@ -6,7 +6,12 @@
  */
 
 #include <libcamera/base/bound_method.h>
+
+#include <iterator>
+#include <new>
+
 #include <libcamera/base/message.h>
+#include <libcamera/base/mutex.h>
 #include <libcamera/base/object.h>
 #include <libcamera/base/semaphore.h>
 #include <libcamera/base/thread.h>
@@ -50,6 +55,208 @@ namespace libcamera {
  * blocks until the receiver signals the completion of the invocation.
  */
 
+namespace details {
+
+namespace {
+
+/*
+ * Memory pool for the small objects allocated on the message path, that is
+ * bound methods, packed arguments and messages.
+ *
+ * Free blocks are cached per thread in singly-linked lists, one per size class,
+ * making allocation and deallocation lock-free in the common case. As messages
+ * are usually allocated in one thread and freed in another, blocks are moved
+ * between threads in batches through a global depot protected by a mutex,
+ * which is thus only locked once every kPoolBatchSize operations.
+ *
+ * Blocks are never returned to the system, except when the depot is full. The
+ * memory footprint is thus bounded by the peak number of objects in flight.
+ */
+constexpr size_t kPoolSizes[] = { 32, 64, 128, 256 };
+constexpr unsigned int kPoolClasses = std::size(kPoolSizes);
+constexpr unsigned int kPoolBatchSize = 32;
+constexpr unsigned int kPoolMaxBatches = 64;
+
+struct PoolBlock {
+	PoolBlock *next;
+	PoolBlock *nextBatch;
+};
+
+static_assert(sizeof(PoolBlock) <= kPoolSizes[0]);
+
+int poolClass(size_t size)
+{
+	for (unsigned int i = 0; i < kPoolClasses; i++) {
+		if (size <= kPoolSizes[i])
+			return i;
+	}
+
+	return -1;
+}
+
+void poolFreeBatch(PoolBlock *batch)
+{
+	while (batch) {
+		PoolBlock *next = batch->next;
+		::operator delete(batch);
+		batch = next;
+	}
+}
+
+class PoolDepot
+{
+public:
+	PoolBlock *get(unsigned int cls)
+	{
+		MutexLocker locker(mutex_);
+
+		PoolBlock *batch = batches_[cls];
+		if (batch) {
+			batches_[cls] = batch->nextBatch;
+			count_[cls]--;
+		}
+
+		return batch;
+	}
+
+	bool put(unsigned int cls, PoolBlock *batch)
+	{
+		MutexLocker locker(mutex_);
+
+		if (count_[cls] >= kPoolMaxBatches)
+			return false;
+
+		batch->nextBatch = batches_[cls];
+		batches_[cls] = batch;
+		count_[cls]++;
+
+		return true;
+	}
+
+private:
+	Mutex mutex_;
+	PoolBlock *batches_[kPoolClasses] LIBCAMERA_TSA_GUARDED_BY(mutex_) = {};
+	unsigned int count_[kPoolClasses] LIBCAMERA_TSA_GUARDED_BY(mutex_) = {};
+};
+
+/*
+ * The depot is never destroyed, as threads may still free blocks while static
+ * objects get destroyed at exit time.
+ */
+PoolDepot &poolDepot()
+{
+	static PoolDepot *depot = new PoolDepot();
+	return *depot;
+}
+
+struct PoolCache {
+	~PoolCache();
+
+	/* Detach a batch of kPoolBatchSize blocks from the cache. */
+	PoolBlock *detach(unsigned int cls);
+
+	PoolBlock *blocks[kPoolClasses] = {};
+	unsigned int count[kPoolClasses] = {};
+};
+
+thread_local bool poolCacheDestroyed = false;
+thread_local PoolCache poolCache;
+
+PoolCache::~PoolCache()
+{
+	for (unsigned int cls = 0; cls < kPoolClasses; cls++) {
+		while (count[cls] >= kPoolBatchSize) {
+			PoolBlock *batch = detach(cls);
+			if (!poolDepot().put(cls, batch))
+				poolFreeBatch(batch);
+		}
+
+		poolFreeBatch(blocks[cls]);
+	}
+
+	poolCacheDestroyed = true;
+}
+
+PoolBlock *PoolCache::detach(unsigned int cls)
+{
+	PoolBlock *batch = blocks[cls];
+	PoolBlock *last = batch;
+
+	for (unsigned int i = 1; i < kPoolBatchSize; i++)
+		last = last->next;
+
+	blocks[cls] = last->next;
+	count[cls] -= kPoolBatchSize;
+	last->next = nullptr;
+
+	return batch;
+}
+
+} /* namespace */
+
+void *poolAllocate(size_t size)
+{
+	int cls = poolClass(size);
+	if (cls < 0)
+		return ::operator new(size);
+
+	/*
+	 * Always allocate blocks of the full class size, as they may be
+	 * released to any thread's cache.
+	 */
+	if (poolCacheDestroyed)
+		return ::operator new(kPoolSizes[cls]);
+
+	PoolCache &cache = poolCache;
+	PoolBlock *block = cache.blocks[cls];
+
+	if (!block) {
+		block = poolDepot().get(cls);
+		if (!block)
+			return ::operator new(kPoolSizes[cls]);
+
+		cache.count[cls] = kPoolBatchSize;
+	}
+
+	cache.blocks[cls] = block->next;
+	cache.count[cls]--;
+
+	return block;
+}
+
+void poolFree(void *ptr, size_t size) noexcept
+{
+	if (!ptr)
+		return;
+
+	int cls = poolClass(size);
+	if (cls < 0 || poolCacheDestroyed) {
+		::operator delete(ptr);
+		return;
+	}
+
+	PoolCache &cache = poolCache;
+	PoolBlock *block = static_cast<PoolBlock *>(ptr);
+
+	block->next = cache.blocks[cls];
+	cache.blocks[cls] = block;
+	cache.count[cls]++;
+
+	/*
+	 * Keep up to two batches in the cache to avoid moving blocks back and
+	 * forth when allocations and deallocations alternate around a batch
+	 * boundary.
+	 */
+	if (cache.count[cls] < 2 * kPoolBatchSize)
+		return;
+
+	PoolBlock *batch = cache.detach(cls);
+	if (!poolDepot().put(cls, batch))
+		poolFreeBatch(batch);
+}
+
+} /* namespace details */
+
 /**
  * \brief Invoke the bound method with packed arguments
  * \param[in] pack Packed arguments
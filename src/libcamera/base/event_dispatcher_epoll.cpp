@@ -0,0 +1,390 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Epoll-based event dispatcher
+ */
+
+#include <libcamera/base/event_dispatcher_epoll.h>
+
+#include <chrono>
+#include <errno.h>
+#include <iomanip>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_statistics.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file base/event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+static const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * Unlike the EventDispatcherPoll, which builds the array of file descriptors
+ * to poll on every iteration, the epoll-based event dispatcher keeps the set
+ * of monitored file descriptors in the kernel and updates it incrementally
+ * when event notifiers are registered and unregistered. Processing events then
+ * only costs time proportional to the number of file descriptors that are
+ * ready, regardless of the number of registered notifiers.
+ *
+ * Timers are backed by a timerfd monitored in the epoll set, so waiting for
+ * events doesn't require computing a timeout from the next timer deadline.
+ *
+ * The epoll interface doesn't support regular files, which are always ready
+ * for reading and writing, event notifiers for regular files are ignored.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: timers_(true), processingEvents_(false), pendingErase_(false)
+{
+	/*
+	 * Create the epoll and event fds. Failures are fatal as we can't
+	 * implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = UniqueFD(epoll_create1(EPOLL_CLOEXEC));
+	if (!epollfd_.isValid())
+		LOG(Event, Fatal) << "Unable to create epoll fd";
+
+	eventfd_ = UniqueFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+	if (!eventfd_.isValid())
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = eventfd_.get();
+
+	if (epoll_ctl(epollfd_.get(), EPOLL_CTL_ADD, eventfd_.get(), &event) < 0)
+		LOG(Event, Fatal) << "Unable to monitor eventfd";
+
+	/*
+	 * Monitor the timerfd if available, otherwise wait() falls back to
+	 * computing the timeout from the next timer deadline.
+	 */
+	if (timers_.fd() >= 0) {
+		event.data.fd = timers_.fd();
+		if (epoll_ctl(epollfd_.get(), EPOLL_CTL_ADD, timers_.fd(), &event) < 0)
+			LOG(Event, Fatal) << "Unable to monitor timerfd";
+	}
+
+	events_.resize(2);
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	EventNotifierSetEpoll &set = notifiers_[notifier->fd()];
+	EventNotifier::Type type = notifier->type();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierType(type)
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = notifier;
+
+	updateEvents(notifier->fd(), oldEvents, set.events());
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = nullptr;
+
+	updateEvents(notifier->fd(), oldEvents, set.events());
+
+	/*
+	 * Don't race with event processing if this function is called from an
+	 * event notifier. The notifiers_ entry will be erased by
+	 * processNotifiers().
+	 */
+	if (processingEvents_) {
+		pendingErase_ = true;
+		return;
+	}
+
+	if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+		notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/* One entry per monitored fd, plus the eventfd and timerfd. */
+	if (events_.size() < notifiers_.size() + 2)
+		events_.resize(notifiers_.size() + 2);
+
+	/* Wait for events and process notifiers and timers. */
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
+	utils::time_point start = statistics ? utils::clock::now() : utils::time_point{};
+
+	do {
+		ret = wait(&events_);
+	} while (ret == -1 && errno == EINTR);
+
+	if (statistics)
+		statistics->recordIdle(utils::clock::now() - start);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with " << strerror(-ret);
+	} else if (ret > 0) {
+		processNotifiers(ret);
+	}
+
+	timers_.expire(utils::clock::now());
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_.get(), &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	if (notifiers[EventNotifier::Read])
+		events |= EPOLLIN;
+	if (notifiers[EventNotifier::Write])
+		events |= EPOLLOUT;
+	if (notifiers[EventNotifier::Exception])
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+/* Update the events monitored for fd in the epoll set. */
+void EventDispatcherEpoll::updateEvents(int fd, uint32_t oldEvents, uint32_t newEvents)
+{
+	if (oldEvents == newEvents)
+		return;
+
+	struct epoll_event event = {};
+	event.events = newEvents;
+	event.data.fd = fd;
+
+	int op = !oldEvents ? EPOLL_CTL_ADD
+	       : !newEvents ? EPOLL_CTL_DEL
+	       : EPOLL_CTL_MOD;
+
+	if (epoll_ctl(epollfd_.get(), op, fd, &event) == 0)
+		return;
+
+	int ret = -errno;
+
+	/*
+	 * The fd is removed from the epoll set when it is closed, which may
+	 * happen before the notifier is unregistered.
+	 */
+	if (op == EPOLL_CTL_DEL && (ret == -EBADF || ret == -ENOENT))
+		return;
+
+	LOG(Event, Warning)
+		<< "Unable to update events for fd " << fd << ": "
+		<< strerror(-ret);
+}
+
+int EventDispatcherEpoll::wait(std::vector<struct epoll_event> *events)
+{
+	/*
+	 * Compute the timeout, unless timers are signalled through the
+	 * timerfd.
+	 */
+	Timer *nextTimer = timers_.fd() < 0 ? timers_.next() : nullptr;
+	struct timespec timeout;
+
+	if (nextTimer) {
+		utils::time_point now = utils::clock::now();
+
+		if (nextTimer->deadline() > now)
+			timeout = utils::duration_to_timespec(nextTimer->deadline() - now);
+		else
+			timeout = { 0, 0 };
+
+		LOG(Event, Debug)
+			<< "next timer " << nextTimer << " expires in "
+			<< timeout.tv_sec << "."
+			<< std::setfill('0') << std::setw(9)
+			<< timeout.tv_nsec;
+	}
+
+#if HAVE_EPOLL_PWAIT2
+	return epoll_pwait2(epollfd_.get(), events->data(), events->size(),
+			    nextTimer ? &timeout : nullptr, nullptr);
+#else
+	/*
+	 * Round the timeout up to the next millisecond, to avoid waking up
+	 * before the timer expires.
+	 */
+	int timeoutMs = -1;
+	if (nextTimer)
+		timeoutMs = timeout.tv_sec * 1000 + (timeout.tv_nsec + 999999) / 1000000;
+
+	return epoll_wait(epollfd_.get(), events->data(), events->size(),
+			  timeoutMs);
+#endif
+}
+
+void EventDispatcherEpoll::processInterrupt(const struct epoll_event &event)
+{
+	if (!(event.events & EPOLLIN))
+		return;
+
+	uint64_t value;
+	ssize_t ret = read(eventfd_.get(), &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(unsigned int count)
+{
+	static const struct {
+		EventNotifier::Type type;
+		uint32_t events;
+	} types[] = {
+		{ EventNotifier::Read, EPOLLIN },
+		{ EventNotifier::Write, EPOLLOUT },
+		{ EventNotifier::Exception, EPOLLPRI },
+	};
+
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
+
+	processingEvents_ = true;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const struct epoll_event &event = events_[i];
+
+		if (event.data.fd == eventfd_.get()) {
+			processInterrupt(event);
+			continue;
+		}
+
+		if (event.data.fd == timers_.fd()) {
+			timers_.acknowledge();
+			continue;
+		}
+
+		/*
+		 * The notifiers of the fd may have been unregistered by a
+		 * notifier processed earlier in the loop.
+		 */
+		auto iter = notifiers_.find(event.data.fd);
+		if (iter == notifiers_.end())
+			continue;
+
+		EventNotifierSetEpoll &set = iter->second;
+
+		for (const auto &type : types) {
+			EventNotifier *notifier = set.notifiers[type.type];
+
+			if (!notifier || !(event.events & type.events))
+				continue;
+
+			if (statistics) {
+				const std::type_info &handler =
+					ThreadStatisticsRecorder::handlerType(notifier);
+				int fd = notifier->fd();
+				utils::time_point start = utils::clock::now();
+				notifier->activated.emit();
+				statistics->recordNotifier(fd, handler, start,
+							   utils::clock::now());
+			} else {
+				notifier->activated.emit();
+			}
+		}
+	}
+
+	processingEvents_ = false;
+
+	/* Erase the notifiers_ entries that are now empty. */
+	if (!pendingErase_)
+		return;
+
+	for (auto iter = notifiers_.begin(); iter != notifiers_.end();) {
+		const EventNotifierSetEpoll &set = iter->second;
+
+		if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+			iter = notifiers_.erase(iter);
+		else
+			++iter;
+	}
+
+	pendingErase_ = false;
+}
+
+} /* namespace libcamera */
@@ -19,6 +19,7 @@
 #include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/thread.h>
+#include <libcamera/base/thread_statistics.h>
 #include <libcamera/base/timer.h>
 #include <libcamera/base/utils.h>
 
@@ -113,31 +114,12 @@ void EventDispatcherPoll::unregisterEventNotifier(EventNotifier *notifier)
 
 void EventDispatcherPoll::registerTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if ((*iter)->deadline() > timer->deadline()) {
-			timers_.insert(iter, timer);
-			return;
-		}
-	}
-
-	timers_.push_back(timer);
+	timers_.insert(timer);
 }
 
 void EventDispatcherPoll::unregisterTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if (*iter == timer) {
-			timers_.erase(iter);
-			return;
-		}
-
-		/*
-		 * As the timers list is ordered, we can stop as soon as we go
-		 * past the deadline.
-		 */
-		if ((*iter)->deadline() > timer->deadline())
-			break;
-	}
+	timers_.remove(timer);
 }
 
 void EventDispatcherPoll::processEvents()
@@ -146,8 +128,12 @@ void EventDispatcherPoll::processEvents()
 
 	Thread::current()->dispatchMessages();
 
-	/* Create the pollfd array. */
-	std::vector<struct pollfd> pollfds;
+	/*
+	 * Create the pollfd array. The vector is reused across iterations to
+	 * avoid reallocating it.
+	 */
+	std::vector<struct pollfd> &pollfds = pollfds_;
+	pollfds.clear();
 	pollfds.reserve(notifiers_.size() + 1);
 
 	for (auto notifier : notifiers_)
@@ -156,10 +142,16 @@ void EventDispatcherPoll::processEvents()
 	pollfds.push_back({ eventfd_.get(), POLLIN, 0 });
 
 	/* Wait for events and process notifiers and timers. */
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
+	utils::time_point start = statistics ? utils::clock::now() : utils::time_point{};
+
 	do {
 		ret = poll(&pollfds);
 	} while (ret == -1 && errno == EINTR);
 
+	if (statistics)
+		statistics->recordIdle(utils::clock::now() - start);
+
 	if (ret < 0) {
 		ret = -errno;
 		LOG(Event, Warning) << "poll() failed with " << strerror(-ret);
@@ -169,7 +161,7 @@ void EventDispatcherPoll::processEvents()
 		processNotifiers(pollfds);
 	}
 
-	processTimers();
+	timers_.expire(utils::clock::now());
 }
 
 void EventDispatcherPoll::interrupt()
@@ -202,7 +194,7 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
 {
 	/* Compute the timeout. */
-	Timer *nextTimer = !timers_.empty() ? timers_.front() : nullptr;
+	Timer *nextTimer = timers_.next();
 	struct timespec timeout;
 
 	if (nextTimer) {
@@ -250,6 +242,8 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 		{ EventNotifier::Exception, POLLPRI },
 	};
 
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
+
 	processingEvents_ = true;
 
 	for (const pollfd &pfd : pollfds) {
@@ -277,8 +271,20 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 				continue;
 			}
 
-			if (pfd.revents & event.events)
+			if (!(pfd.revents & event.events))
+				continue;
+
+			if (statistics) {
+				const std::type_info &handler =
+					ThreadStatisticsRecorder::handlerType(notifier);
+				int fd = notifier->fd();
+				utils::time_point start = utils::clock::now();
+				notifier->activated.emit();
+				statistics->recordNotifier(fd, handler, start,
+							   utils::clock::now());
+			} else {
 				notifier->activated.emit();
+			}
 		}
 
 		/* Erase the notifiers_ entry if it is now empty. */
@@ -289,19 +295,4 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 	processingEvents_ = false;
 }
 
-void EventDispatcherPoll::processTimers()
-{
-	utils::time_point now = utils::clock::now();
-
-	while (!timers_.empty()) {
-		Timer *timer = timers_.front();
-		if (timer->deadline() > now)
-			break;
-
-		timers_.pop_front();
-		timer->stop();
-		timer->timeout.emit();
-	}
-}
-
 } /* namespace libcamera */
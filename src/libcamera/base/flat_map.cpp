@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Sorted associative container with inline storage
+ */
+
+#include <libcamera/base/flat_map.h>
+
+/**
+ * \file base/flat_map.h
+ * \brief Sorted associative container with inline storage
+ */
+
+namespace libcamera {
+
+/**
+ * \class FlatMap
+ * \brief Sorted associative container optimized for a small number of entries
+ * \tparam Key The key type
+ * \tparam T The mapped type
+ * \tparam N The number of entries stored inline
+ * \tparam Compare The key comparison function
+ *
+ * The FlatMap class implements a subset of the std::map interface, storing its
+ * entries in a contiguous array sorted by key. The first \a N entries are
+ * stored inline in the FlatMap instance, and only larger maps allocate memory.
+ * Once allocated, the memory is retained by clear(), erase() and insert(), and
+ * only released when the FlatMap is destroyed.
+ *
+ * This makes FlatMap suitable for per-frame maps that hold a handful of
+ * entries, such as the buffers of a request, which would otherwise cause one
+ * heap allocation per entry with std::map.
+ *
+ * Unlike std::map, the key of the value_type is not const, but it shall not be
+ * modified through iterators. Insertion and erasure invalidate all iterators
+ * and references to the FlatMap entries. The \a Key and \a T types shall be
+ * default-constructible and copy-assignable.
+ */
+
+/**
+ * \typedef FlatMap::key_type
+ * \brief The key type
+ */
+
+/**
+ * \typedef FlatMap::mapped_type
+ * \brief The mapped type
+ */
+
+/**
+ * \typedef FlatMap::value_type
+ * \brief The type of the entries, a pair of key and mapped value
+ */
+
+/**
+ * \typedef FlatMap::size_type
+ * \brief The type used to express the number of entries
+ */
+
+/**
+ * \typedef FlatMap::iterator
+ * \brief Iterator over the entries, in key order
+ */
+
+/**
+ * \typedef FlatMap::const_iterator
+ * \brief Constant iterator over the entries, in key order
+ */
+
+/**
+ * \fn FlatMap::FlatMap()
+ * \brief Construct an empty FlatMap
+ */
+
+/**
+ * \fn FlatMap::FlatMap(std::initializer_list<value_type> init)
+ * \brief Construct a FlatMap from an initializer list
+ * \param[in] init The entries
+ *
+ * Entries with duplicated keys are ignored, as with std::map.
+ */
+
+/**
+ * \fn FlatMap::begin()
+ * \brief Retrieve an iterator to the first entry
+ * \return An iterator to the first entry
+ */
+
+/**
+ * \fn FlatMap::begin() const
+ * \copydoc FlatMap::begin()
+ */
+
+/**
+ * \fn FlatMap::cbegin()
+ * \copydoc FlatMap::begin()
+ */
+
+/**
+ * \fn FlatMap::end()
+ * \brief Retrieve an iterator pointing past the last entry
+ * \return An iterator pointing past the last entry
+ */
+
+/**
+ * \fn FlatMap::end() const
+ * \copydoc FlatMap::end()
+ */
+
+/**
+ * \fn FlatMap::cend()
+ * \copydoc FlatMap::end()
+ */
+
+/**
+ * \fn FlatMap::empty()
+ * \brief Check if the FlatMap is empty
+ * \return True if the FlatMap contains no entry, false otherwise
+ */
+
+/**
+ * \fn FlatMap::size()
+ * \brief Retrieve the number of entries
+ * \return The number of entries
+ */
+
+/**
+ * \fn FlatMap::clear()
+ * \brief Remove all entries, without releasing memory
+ */
+
+/**
+ * \fn FlatMap::find(const Key &key)
+ * \brief Find the entry for \a key
+ * \param[in] key The key to search for
+ * \return An iterator to the entry, or end() if no entry exists for \a key
+ */
+
+/**
+ * \fn FlatMap::find(const Key &key) const
+ * \copydoc FlatMap::find(const Key &key)
+ */
+
+/**
+ * \fn FlatMap::count()
+ * \brief Count the entries for \a key
+ * \param[in] key The key to search for
+ * \return 1 if an entry exists for \a key, 0 otherwise
+ */
+
+/**
+ * \fn FlatMap::at(const Key &key)
+ * \brief Retrieve the value mapped to \a key
+ * \param[in] key The key to search for
+ *
+ * \a key shall be present in the FlatMap, otherwise a std::out_of_range
+ * exception is thrown, as with std::map.
+ *
+ * \return A reference to the value mapped to \a key
+ */
+
+/**
+ * \fn FlatMap::at(const Key &key) const
+ * \copydoc FlatMap::at(const Key &key)
+ */
+
+/**
+ * \fn FlatMap::operator[]()
+ * \brief Retrieve the value mapped to \a key, inserting it if needed
+ * \param[in] key The key to search for
+ *
+ * If no entry exists for \a key, a new entry is inserted with a
+ * value-initialized mapped value.
+ *
+ * \return A reference to the value mapped to \a key
+ */
+
+/**
+ * \fn FlatMap::insert()
+ * \brief Insert an entry
+ * \param[in] value The entry to insert
+ *
+ * The entry is inserted only if no entry exists with the same key.
+ *
+ * \return A pair of an iterator to the entry with the key of \a value, and a
+ * boolean set to true if the entry has been inserted
+ */
+
+/**
+ * \fn FlatMap::emplace()
+ * \brief Construct and insert an entry
+ * \param[in] args The arguments to construct the value_type from
+ *
+ * \return A pair of an iterator to the entry with the key of the constructed
+ * value, and a boolean set to true if the entry has been inserted
+ */
+
+/**
+ * \fn FlatMap::erase(const_iterator pos)
+ * \brief Erase the entry at \a pos
+ * \param[in] pos The entry to erase
+ * \return An iterator to the entry following the erased entry
+ */
+
+/**
+ * \fn FlatMap::erase(const Key &key)
+ * \brief Erase the entry for \a key
+ * \param[in] key The key of the entry to erase
+ * \return The number of erased entries
+ */
+
+} /* namespace libcamera */
@@ -7,15 +7,22 @@
 
 #include <libcamera/base/log.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <syslog.h>
+#include <thread>
 #include <time.h>
+#include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <libcamera/logging.h>
@@ -52,6 +59,20 @@
  * of the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
  * to std::cerr.
+ *
+ * Log files are written in a text format by default. Setting the
+ * LIBCAMERA_LOG_FORMAT environment variable to "binary" selects a compact
+ * binary format instead, that avoids formatting timestamps and message headers
+ * at runtime. Binary log files can be converted to text with the
+ * utils/decode-log.py script.
+ *
+ * Log messages are written synchronously by the thread that logs them by
+ * default. Setting the LIBCAMERA_LOG_ASYNC environment variable to a number of
+ * messages enables asynchronous logging: messages are then queued to a ring
+ * buffer of that size and written to the log output by a dedicated thread. If
+ * the ring buffer overflows, messages are dropped and the number of dropped
+ * messages is reported in the log. Fatal messages are always written
+ * synchronously, after all queued messages.
  */
 
 /**
@@ -102,36 +123,108 @@ static const char *log_severity_name(LogSeverity severity)
  *
  * The LogOutput class models a log output destination
  */
+/**
+ * \brief Content of a log message captured for output
+ *
+ * A LogRecord stores all the information needed to write a log message,
+ * including the ID of the thread that logged it, so that the message can be
+ * written to the log output from a different thread.
+ */
+struct LogRecord {
+	utils::time_point timestamp;
+	LogSeverity severity = LogInvalid;
+	const LogCategory *category = nullptr;
+	pid_t threadId = 0;
+	std::string fileInfo;
+	std::string prefix;
+	std::string msg;
+};
+
 class LogOutput
 {
 public:
-	LogOutput(const char *path, bool color);
+	LogOutput(const char *path, bool color, bool binary = false);
 	LogOutput(std::ostream *stream, bool color);
 	LogOutput();
 	~LogOutput();
 
 	bool isValid() const;
-	void write(const LogMessage &msg);
+	void write(const LogRecord &msg);
 	void write(const std::string &msg);
 
 private:
 	void writeSyslog(LogSeverity severity, const std::string &msg);
 	void writeStream(const std::string &msg);
+	void writeBinary(const LogRecord &msg);
+	void writeBinary(const std::string &msg);
 
 	std::ostream *stream_;
 	LoggingTarget target_;
 	bool color_;
+	bool binary_;
+
+	Mutex mutex_;
+	std::unordered_map<const LogCategory *, uint16_t> categories_
+		LIBCAMERA_TSA_GUARDED_BY(mutex_);
 };
 
+namespace {
+
+/*
+ * Binary log format
+ *
+ * The binary log starts with an 8 bytes header made of the "LCBLOG" magic
+ * string followed by a 16-bit format version. Records follow, each starting
+ * with a one byte record type. All integers are stored in host byte order.
+ *
+ * - Category records (kBinaryRecordCategory) assign an ID to a category name,
+ *   and are written before the first message of the category:
+ *   u8 type, u16 id, u16 name length, name
+ *
+ * - Message records (kBinaryRecordMessage) store a log message:
+ *   u8 type, u8 severity, u16 category id, u32 thread id, u64 timestamp in
+ *   nanoseconds, u16 file info length, u16 prefix length, u32 message
+ *   length, file info, prefix, message
+ *
+ * - Text records (kBinaryRecordText) store raw text such as backtraces:
+ *   u8 type, u32 length, text
+ */
+constexpr char kBinaryMagic[] = { 'L', 'C', 'B', 'L', 'O', 'G' };
+constexpr uint16_t kBinaryVersion = 1;
+
+constexpr uint8_t kBinaryRecordMessage = 0;
+constexpr uint8_t kBinaryRecordCategory = 1;
+constexpr uint8_t kBinaryRecordText = 2;
+
+template<typename T>
+void appendBinary(std::string &buffer, T value)
+{
+	buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+} /* namespace */
+
 /**
  * \brief Construct a log output based on a file
  * \param[in] path Full path to log file
  * \param[in] color True to output colored messages
+ * \param[in] binary True to output messages in the binary log format
+ *
+ * Colors are ignored in the binary log format.
  */
-LogOutput::LogOutput(const char *path, bool color)
-	: target_(LoggingTargetFile), color_(color)
+LogOutput::LogOutput(const char *path, bool color, bool binary)
+	: target_(LoggingTargetFile), color_(color && !binary), binary_(binary)
 {
-	stream_ = new std::ofstream(path);
+	if (!binary_) {
+		stream_ = new std::ofstream(path);
+		return;
+	}
+
+	stream_ = new std::ofstream(path, std::ios::out | std::ios::binary);
+
+	std::string header(kBinaryMagic, sizeof(kBinaryMagic));
+	appendBinary(header, kBinaryVersion);
+	writeStream(header);
 }
 
 /**
@@ -140,7 +233,8 @@ LogOutput::LogOutput(const char *path, bool color)
  * \param[in] color True to output colored messages
  */
 LogOutput::LogOutput(std::ostream *stream, bool color)
-	: stream_(stream), target_(LoggingTargetStream), color_(color)
+	: stream_(stream), target_(LoggingTargetStream), color_(color),
+	  binary_(false)
 {
 }
 
@@ -148,7 +242,8 @@ LogOutput::LogOutput(std::ostream *stream, bool color)
  * \brief Construct a log output to syslog
  */
 LogOutput::LogOutput()
-	: stream_(nullptr), target_(LoggingTargetSyslog), color_(false)
+	: stream_(nullptr), target_(LoggingTargetSyslog), color_(false),
+	  binary_(false)
 {
 	openlog("libcamera", LOG_PID, 0);
 }
@@ -205,8 +300,13 @@ constexpr const char *kColorBrightWhite = "\033[1;37m";
  * \brief Write message to log output
  * \param[in] msg Message to write
  */
-void LogOutput::write(const LogMessage &msg)
+void LogOutput::write(const LogRecord &msg)
 {
+	if (binary_) {
+		writeBinary(msg);
+		return;
+	}
+
 	static const char *const severityColors[] = {
 		kColorBrightCyan,
 		kColorBrightGreen,
@@ -220,7 +320,7 @@ void LogOutput::write(const LogMessage &msg)
 	const char *prefixColor = color_ ? kColorGreen : "";
 	const char *resetColor = color_ ? kColorReset : "";
 	const char *severityColor = "";
-	LogSeverity severity = msg.severity();
+	LogSeverity severity = msg.severity;
 	std::string str;
 
 	if (color_) {
@@ -233,22 +333,22 @@ void LogOutput::write(const LogMessage &msg)
 	switch (target_) {
 	case LoggingTargetSyslog:
 		str = std::string(log_severity_name(severity)) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " ";
-		if (!msg.prefix().empty())
-			str += msg.prefix() + ": ";
-		str += msg.msg();
+		    + msg.category->name() + " " + msg.fileInfo + " ";
+		if (!msg.prefix.empty())
+			str += msg.prefix + ": ";
+		str += msg.msg;
 		writeSyslog(severity, str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		str = "[" + utils::time_point_to_string(msg.timestamp()) + "] ["
-		    + std::to_string(Thread::currentId()) + "] "
+		str = "[" + utils::time_point_to_string(msg.timestamp) + "] ["
+		    + std::to_string(msg.threadId) + "] "
 		    + severityColor + log_severity_name(severity) + " "
-		    + categoryColor + msg.category().name() + " "
-		    + fileColor + msg.fileInfo() + " ";
-		if (!msg.prefix().empty())
-			str += prefixColor + msg.prefix() + ": ";
-		str += resetColor + msg.msg();
+		    + categoryColor + msg.category->name() + " "
+		    + fileColor + msg.fileInfo + " ";
+		if (!msg.prefix.empty())
+			str += prefixColor + msg.prefix + ": ";
+		str += resetColor + msg.msg;
 		writeStream(str);
 		break;
 	default:
@@ -262,6 +362,11 @@ void LogOutput::write(const LogMessage &msg)
  */
 void LogOutput::write(const std::string &str)
 {
+	if (binary_) {
+		writeBinary(str);
+		return;
+	}
+
 	switch (target_) {
 	case LoggingTargetSyslog:
 		writeSyslog(LogDebug, str);
@@ -286,6 +391,122 @@ void LogOutput::writeStream(const std::string &str)
 	stream_->flush();
 }
 
+void LogOutput::writeBinary(const LogRecord &msg)
+{
+	std::string record;
+
+	/*
+	 * Serialize the whole record, including the category record if needed,
+	 * in a single buffer and write it with the lock held, to guarantee that
+	 * categories are defined before being used and that records from
+	 * different threads don't get interleaved.
+	 */
+	MutexLocker locker(mutex_);
+
+	auto iter = categories_.find(msg.category);
+	if (iter == categories_.end()) {
+		uint16_t id = categories_.size();
+		const std::string &name = msg.category->name();
+
+		appendBinary(record, kBinaryRecordCategory);
+		appendBinary(record, id);
+		appendBinary(record, static_cast<uint16_t>(name.size()));
+		record.append(name);
+
+		iter = categories_.emplace(msg.category, id).first;
+	}
+
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		msg.timestamp.time_since_epoch()).count();
+
+	appendBinary(record, kBinaryRecordMessage);
+	appendBinary(record, static_cast<uint8_t>(msg.severity));
+	appendBinary(record, iter->second);
+	appendBinary(record, static_cast<uint32_t>(msg.threadId));
+	appendBinary(record, timestamp);
+	appendBinary(record, static_cast<uint16_t>(msg.fileInfo.size()));
+	appendBinary(record, static_cast<uint16_t>(msg.prefix.size()));
+	appendBinary(record, static_cast<uint32_t>(msg.msg.size()));
+	record.append(msg.fileInfo);
+	record.append(msg.prefix);
+	record.append(msg.msg);
+
+	writeStream(record);
+}
+
+void LogOutput::writeBinary(const std::string &str)
+{
+	std::string record;
+
+	appendBinary(record, kBinaryRecordText);
+	appendBinary(record, static_cast<uint32_t>(str.size()));
+	record.append(str);
+
+	MutexLocker locker(mutex_);
+	writeStream(record);
+}
+
+class Logger;
+
+/**
+ * \brief Asynchronous log writer
+ *
+ * The LogWriter implements asynchronous logging. Log records are queued to a
+ * bounded lock-free multi-producer single-consumer ring buffer, and written to
+ * the log output by a dedicated thread. The ring buffer is an array of cells
+ * that each store a sequence number along with the record. The sequence
+ * number tells producers whether the cell is free, and the writer whether it
+ * holds a record ready to be written.
+ *
+ * Producers never block. When the ring buffer is full the record is dropped and
+ * a drop counter is incremented. The writer reports the number of dropped
+ * records in the log output.
+ *
+ * The writer thread sleeps on a condition variable when the ring buffer is
+ * empty. Producers only lock the associated mutex to wake it up when it
+ * sleeps.
+ */
+class LogWriter
+{
+public:
+	LogWriter(Logger *logger, unsigned int size);
+	~LogWriter();
+
+	bool isWriterProcess() const { return getpid() == pid_; }
+
+	void queue(LogRecord &&record);
+	void flush();
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	bool available() const;
+	void drain();
+	void run();
+
+	Logger *logger_;
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	std::atomic<size_t> enqueuePos_;
+	size_t dequeuePos_;
+	std::atomic<unsigned int> dropped_;
+	std::atomic<bool> sleeping_;
+
+	Mutex mutex_;
+	ConditionVariable cv_;
+	ConditionVariable flushCv_;
+	bool stop_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	uint64_t flushRequest_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	uint64_t flushDone_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+
+	pid_t pid_;
+	std::thread thread_;
+};
+
 /**
  * \brief Message logger
  *
@@ -298,10 +519,10 @@ public:
 
 	static Logger *instance();
 
-	void write(const LogMessage &msg);
+	void write(LogRecord &&msg);
 	void backtrace();
 
-	int logSetFile(const char *path, bool color);
+	int logSetFile(const char *path, bool color, bool binary = false);
 	int logSetStream(std::ostream *stream, bool color);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
@@ -309,6 +530,11 @@ public:
 private:
 	Logger();
 
+	friend LogWriter;
+	std::shared_ptr<LogOutput> output() const;
+	void output(const LogRecord &msg);
+
+	void parseLogAsync();
 	void parseLogFile();
 	void parseLogLevels();
 	static LogSeverity parseLogLevel(const std::string &level);
@@ -323,6 +549,7 @@ private:
 	std::list<std::pair<std::string, LogSeverity>> levels_;
 
 	std::shared_ptr<LogOutput> output_;
+	std::unique_ptr<LogWriter> writer_;
 };
 
 bool Logger::destroyed_ = false;
@@ -437,6 +664,9 @@ Logger::~Logger()
 {
 	destroyed_ = true;
 
+	/* Write all queued messages before destroying the categories. */
+	writer_.reset();
+
 	for (LogCategory *category : categories_)
 		delete category;
 }
@@ -461,17 +691,225 @@ Logger *Logger::instance()
 
 /**
  * \brief Write a message to the configured logger output
- * \param[in] msg The message object
+ * \param[in] msg The message record
+ *
+ * When asynchronous logging is enabled, the message is queued to the log
+ * writer, except for fatal messages that are written synchronously after all
+ * queued messages, as the process is about to abort.
  */
-void Logger::write(const LogMessage &msg)
+void Logger::write(LogRecord &&msg)
 {
-	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
+	/*
+	 * Write messages synchronously in child processes, which don't have a
+	 * writer thread.
+	 */
+	if (writer_ && writer_->isWriterProcess()) {
+		if (msg.severity != LogFatal) {
+			writer_->queue(std::move(msg));
+			return;
+		}
+
+		writer_->flush();
+	}
+
+	output(msg);
+}
+
+/**
+ * \brief Retrieve the current log output
+ * \return The log output, or a null pointer if logging is disabled
+ */
+std::shared_ptr<LogOutput> Logger::output() const
+{
+	return std::atomic_load(&output_);
+}
+
+/**
+ * \brief Write a message to the current log output
+ * \param[in] msg The message record
+ */
+void Logger::output(const LogRecord &msg)
+{
+	std::shared_ptr<LogOutput> output = Logger::output();
 	if (!output)
 		return;
 
 	output->write(msg);
 }
 
+/**
+ * \brief Construct a log writer and start its thread
+ * \param[in] logger The logger whose output the messages are written to
+ * \param[in] size The ring buffer size in messages
+ */
+LogWriter::LogWriter(Logger *logger, unsigned int size)
+	: logger_(logger), enqueuePos_(0), dequeuePos_(0), dropped_(0),
+	  sleeping_(false), stop_(false), flushRequest_(0), flushDone_(0),
+	  pid_(getpid())
+{
+	size_t cells = 1;
+	while (cells < size)
+		cells <<= 1;
+
+	cells_ = std::make_unique<Cell[]>(cells);
+	mask_ = cells - 1;
+
+	for (size_t i = 0; i < cells; ++i)
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+	thread_ = std::thread(&LogWriter::run, this);
+}
+
+/**
+ * \brief Write all queued messages and stop the writer thread
+ */
+LogWriter::~LogWriter()
+{
+	/*
+	 * The writer thread doesn't exist in child processes, don't try to
+	 * stop it.
+	 */
+	if (!isWriterProcess()) {
+		thread_.detach();
+		return;
+	}
+
+	{
+		MutexLocker locker(mutex_);
+		stop_ = true;
+	}
+
+	cv_.notify_one();
+	thread_.join();
+}
+
+/**
+ * \brief Queue a log record for writing
+ * \param[in] record The log record
+ *
+ * If the ring buffer is full, the \a record is dropped.
+ *
+ * \context This function is \threadsafe.
+ */
+void LogWriter::queue(LogRecord &&record)
+{
+	size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+	Cell *cell;
+
+	while (true) {
+		cell = &cells_[pos & mask_];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) -
+				static_cast<intptr_t>(pos);
+
+		if (diff == 0) {
+			if (enqueuePos_.compare_exchange_weak(pos, pos + 1,
+							      std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = enqueuePos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->record = std::move(record);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+
+	/*
+	 * Pairs with the fence in run(), to ensure that either the writer sees
+	 * the record, or we see that it sleeps.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!sleeping_.load(std::memory_order_relaxed))
+		return;
+
+	MutexLocker locker(mutex_);
+	cv_.notify_one();
+}
+
+/**
+ * \brief Wait until all messages queued so far have been written
+ *
+ * Messages queued by the calling thread before calling this function, as well
+ * as the report of messages dropped before this call, are guaranteed to have
+ * been written to the log output when the function returns.
+ *
+ * \context This function is \threadsafe.
+ */
+void LogWriter::flush()
+{
+	if (!isWriterProcess())
+		return;
+
+	MutexLocker locker(mutex_);
+	uint64_t request = ++flushRequest_;
+	cv_.notify_one();
+
+	flushCv_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+		return flushDone_ >= request;
+	});
+}
+
+bool LogWriter::available() const
+{
+	const Cell &cell = cells_[dequeuePos_ & mask_];
+	return cell.sequence.load(std::memory_order_acquire) == dequeuePos_ + 1;
+}
+
+void LogWriter::drain()
+{
+	while (available()) {
+		Cell &cell = cells_[dequeuePos_ & mask_];
+		LogRecord record = std::move(cell.record);
+
+		/* Release the cell to producers before writing the record. */
+		cell.sequence.store(dequeuePos_ + mask_ + 1,
+				    std::memory_order_release);
+		dequeuePos_++;
+
+		logger_->output(record);
+	}
+
+	unsigned int dropped = dropped_.exchange(0, std::memory_order_relaxed);
+	if (!dropped)
+		return;
+
+	std::shared_ptr<LogOutput> output = logger_->output();
+	if (output)
+		output->write(std::to_string(dropped) + " log messages dropped\n");
+}
+
+void LogWriter::run()
+{
+	MutexLocker locker(mutex_);
+
+	while (true) {
+		uint64_t request = flushRequest_;
+		bool stop = stop_;
+
+		locker.unlock();
+		drain();
+		locker.lock();
+
+		flushDone_ = request;
+		flushCv_.notify_all();
+
+		if (stop)
+			break;
+
+		sleeping_.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		cv_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+			return stop_ || flushRequest_ != flushDone_ || available();
+		});
+
+		sleeping_.store(false, std::memory_order_relaxed);
+	}
+}
+
 /**
  * \brief Write a backtrace to the log
  */
@@ -499,18 +937,22 @@ void Logger::backtrace()
  * \brief Set the log file
  * \param[in] path Full path to the log file
  * \param[in] color True to output colored messages
+ * \param[in] binary True to output messages in the binary log format
  *
  * \sa libcamera::logSetFile()
  *
  * \return Zero on success, or a negative error code otherwise.
  */
-int Logger::logSetFile(const char *path, bool color)
+int Logger::logSetFile(const char *path, bool color, bool binary)
 {
 	std::shared_ptr<LogOutput> output =
-		std::make_shared<LogOutput>(path, color);
+		std::make_shared<LogOutput>(path, color, binary);
 	if (!output->isValid())
 		return -EINVAL;
 
+	if (writer_)
+		writer_->flush();
+
 	std::atomic_store(&output_, output);
 	return 0;
 }
@@ -528,6 +970,10 @@ int Logger::logSetStream(std::ostream *stream, bool color)
 {
 	std::shared_ptr<LogOutput> output =
 		std::make_shared<LogOutput>(stream, color);
+
+	if (writer_)
+		writer_->flush();
+
 	std::atomic_store(&output_, output);
 	return 0;
 }
@@ -542,6 +988,9 @@ int Logger::logSetStream(std::ostream *stream, bool color)
  */
 int Logger::logSetTarget(enum LoggingTarget target)
 {
+	if (writer_)
+		writer_->flush();
+
 	switch (target) {
 	case LoggingTargetSyslog:
 		std::atomic_store(&output_, std::make_shared<LogOutput>());
@@ -591,6 +1040,28 @@ Logger::Logger()
 
 	parseLogFile();
 	parseLogLevels();
+	parseLogAsync();
+}
+
+/**
+ * \brief Parse the asynchronous logging configuration from the environment
+ *
+ * If the LIBCAMERA_LOG_ASYNC environment variable is set to a positive number,
+ * enable asynchronous logging with a ring buffer of that many messages, rounded
+ * up to a power of two.
+ */
+void Logger::parseLogAsync()
+{
+	const char *async = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (!async)
+		return;
+
+	char *endptr;
+	unsigned long size = strtoul(async, &endptr, 10);
+	if (*endptr != '\0' || !size || size > (1U << 20))
+		return;
+
+	writer_ = std::make_unique<LogWriter>(this, size);
 }
 
 /**
@@ -601,6 +1072,9 @@ Logger::Logger()
  * is set to "syslog", then the logger output will be directed to syslog. Errors
  * are silently ignored and don't affect the logger output (set to std::cerr by
  * default).
+ *
+ * If the LIBCAMERA_LOG_FORMAT environment variable is set to "binary", the log
+ * file is written in the binary log format.
  */
 void Logger::parseLogFile()
 {
@@ -613,7 +1087,10 @@ void Logger::parseLogFile()
 		return;
 	}
 
-	logSetFile(file, false);
+	const char *format = utils::secure_getenv("LIBCAMERA_LOG_FORMAT");
+	bool binary = format && !strcmp(format, "binary");
+
+	logSetFile(file, false, binary);
 }
 
 /**
@@ -834,6 +1311,17 @@ void LogCategory::setSeverity(LogSeverity severity)
 	severity_ = severity;
 }
 
+/**
+ * \fn LogCategory::isEnabled()
+ * \brief Check if messages of a given severity are enabled for the category
+ * \param[in] severity The message severity
+ *
+ * This function is used by the LOG() macro to discard messages before creating
+ * the LogMessage, it is cheap enough to be called for every message.
+ *
+ * \return True if messages of severity \a severity are printed, false otherwise
+ */
+
 /**
  * \brief Retrieve the default log category
  *
@@ -921,8 +1409,18 @@ LogMessage::~LogMessage()
 
 	msgStream_ << std::endl;
 
-	if (severity_ >= category_.severity())
-		logger->write(*this);
+	if (category_.isEnabled(severity_)) {
+		LogRecord record;
+		record.timestamp = timestamp_;
+		record.severity = severity_;
+		record.category = &category_;
+		record.threadId = Thread::currentId();
+		record.fileInfo = std::move(fileInfo_);
+		record.prefix = std::move(prefix_);
+		record.msg = msgStream_.str();
+
+		logger->write(std::move(record));
+	}
 
 	if (severity_ == LogSeverity::LogFatal) {
 		logger->backtrace();
@@ -1042,6 +1540,71 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
 			  severity);
 }
 
+/**
+ * \class LogRateLimiter
+ * \brief Limit the rate of messages logged from a call site
+ *
+ * Messages logged from hot paths, such as per-frame error handling, can be
+ * emitted for every frame when a problem persists. Formatting and writing the
+ * messages then adds load to an already overloaded system. The LogRateLimiter
+ * implements a token bucket that allows a burst of messages, and then limits
+ * the rate to the burst size per interval.
+ *
+ * The class is used by the LOG_RATELIMITED() and LOG_ONCE() macros, which
+ * create one instance per call site.
+ */
+
+/**
+ * \brief Construct a rate limiter
+ * \param[in] burst The maximum number of messages logged in a burst
+ * \param[in] interval The time needed to refill the bucket to \a burst tokens
+ *
+ * An \a interval of 0 never refills the bucket, only the first \a burst
+ * messages are then logged.
+ */
+LogRateLimiter::LogRateLimiter(unsigned int burst,
+			       std::chrono::milliseconds interval)
+	: burst_(burst), interval_(interval), tokens_(burst),
+	  last_(utils::clock::now()), suppressed_(0)
+{
+}
+
+/**
+ * \brief Check if a message can be logged
+ *
+ * This function consumes a token if one is available. It is thread-safe.
+ *
+ * \return The number of messages suppressed since the last message that was
+ * allowed, or -1 if the message shall be suppressed
+ */
+int LogRateLimiter::allow()
+{
+	/* Contention is low, as the function is only called for enabled messages. */
+	static Mutex mutex;
+	MutexLocker locker(mutex);
+
+	utils::time_point now = utils::clock::now();
+
+	if (interval_.count()) {
+		std::chrono::duration<double> elapsed = now - last_;
+		tokens_ = std::min(burst_, tokens_ + burst_ * elapsed / interval_);
+	}
+
+	last_ = now;
+
+	if (tokens_ < 1.0) {
+		suppressed_++;
+		return -1;
+	}
+
+	tokens_ -= 1.0;
+
+	int suppressed = suppressed_;
+	suppressed_ = 0;
+
+	return suppressed;
+}
+
 /**
  * \def LOG_DECLARE_CATEGORY(name)
  * \hideinitializer
@@ -1082,6 +1645,11 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * absent the default category is used. The  \a severity controls whether the
  * message is printed or discarded, depending on the log level for the category.
  *
+ * The log level is checked before the message is created. When the message is
+ * discarded, the stream operands are not evaluated, and logging has no cost
+ * beyond the check. Messages with a severity lower than the minimum severity
+ * selected at build time with the log_min_severity option are compiled out.
+ *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  *
@@ -1092,6 +1660,35 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * possible extent
  */
 
+/**
+ * \def LOG_RATELIMITED(category, severity)
+ * \hideinitializer
+ * \brief Log a message with a rate limit
+ * \param[in] category Category
+ * \param[in] severity Severity
+ *
+ * Log a message like the LOG() macro, limiting the rate of messages from the
+ * call site to a burst of 10 messages, and 10 messages every 5 seconds after
+ * the burst. When messages have been suppressed, the next message logged from
+ * the call site reports the number of suppressed messages.
+ *
+ * This macro is meant for warnings and errors that can occur for every frame.
+ * Unlike LOG(), it expands to a statement and can't be used in expressions.
+ *
+ * \sa LogRateLimiter
+ */
+
+/**
+ * \def LOG_ONCE(category, severity)
+ * \hideinitializer
+ * \brief Log a message once
+ * \param[in] category Category
+ * \param[in] severity Severity
+ *
+ * Log a message like the LOG() macro, the first time the call site is reached
+ * with the message enabled only.
+ */
+
 /**
  * \def ASSERT(condition)
  * \hideinitializer
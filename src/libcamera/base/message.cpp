@@ -59,7 +59,7 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), receiver_(nullptr), next_(nullptr)
 {
 }
 
@@ -67,6 +67,25 @@ Message::~Message()
 {
 }
 
+/**
+ * \fn Message::operator new(size_t size)
+ * \brief Allocate memory for a message
+ * \param[in] size The size of the message
+ *
+ * Messages are allocated and freed for every cross-thread method invocation
+ * and signal emission. They are allocated from a pool of memory blocks cached
+ * per thread, avoiding calls to the system memory allocator in steady state.
+ *
+ * \return A pointer to the allocated memory
+ */
+
+/**
+ * \fn Message::operator delete(void *ptr, size_t size)
+ * \brief Free memory allocated for a message
+ * \param[in] ptr The pointer to the memory
+ * \param[in] size The size of the message
+ */
+
 /**
  * \fn Message::type()
  * \brief Retrieve the message type
@@ -79,6 +98,17 @@ Message::~Message()
  * \return The message receiver
  */
 
+/**
+ * \fn Message::postTime()
+ * \brief Retrieve the time at which the message has been posted
+ *
+ * The post time is only recorded when the receiver thread has statistics
+ * enabled, see Thread::setStatisticsEnabled().
+ *
+ * \return The time at which the message has been posted, or a default
+ * constructed time point if the post time hasn't been recorded
+ */
+
 /**
  * \brief Reserve and register a custom user-defined message type
  *
@@ -269,6 +269,13 @@ bool Object::assertThreadBound(const char *message)
  * are passed untouched. The caller shall ensure that any pointer argument
  * remains valid until the method is invoked.
  *
+ * Rvalue arguments for parameters passed by value are moved instead of copied,
+ * both when storing them for asynchronous invocation and when calling \a func.
+ * Large arguments that can't be moved, such as data that the caller keeps
+ * using, can be shared without copies by declaring the method parameter as a
+ * std::shared_ptr to a const type. The data is then shared by the caller and
+ * the invoked method, and shall not be modified once passed.
+ *
  * Due to the asynchronous nature of threads, functions invoked asynchronously
  * with the ConnectionTypeQueued type are not guaranteed to be called before
  * the thread is stopped. See \ref thread-stop for additional information.
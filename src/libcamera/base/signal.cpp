@@ -7,6 +7,8 @@
 
 #include <libcamera/base/signal.h>
 
+#include <thread>
+
 #include <libcamera/base/mutex.h>
 #include <libcamera/base/object.h>
 
@@ -20,14 +22,42 @@ namespace libcamera {
 namespace {
 
 /*
- * Mutex to protect the SignalBase::slots_ and Object::signals_ lists. If lock
- * contention needs to be decreased, this could be replaced with locks in
- * Object and SignalBase, or with a mutex pool.
+ * Mutex to protect modifications of the SignalBase::slots_ array and the
+ * Object::signals_ lists. If lock contention needs to be decreased, this could
+ * be replaced with locks in Object and SignalBase, or with a mutex pool.
  */
 Mutex signalsLock;
 
 } /* namespace */
 
+/*
+ * The connected slots are stored in an immutable array, replaced with a
+ * modified copy when slots are connected or disconnected, and reference
+ * counted. Signal emission takes a reference to the current array without
+ * locking or copying, and can thus proceed concurrently with connection and
+ * disconnection, including from the slots being called.
+ *
+ * The only race to handle is between acquireSlots() loading the array pointer
+ * and taking a reference, and a concurrent modification releasing the last
+ * reference to the same array. The acquiring_ counter covers that short
+ * window, which doesn't call any slot: modifications wait for it to drop to
+ * zero before releasing the replaced array.
+ *
+ * Slots themselves are shared between arrays, and deleted when the last array
+ * referencing them is released. Slots are marked as disconnected when removed
+ * from the signal, to skip them in emissions that are in progress.
+ */
+
+SignalBase::SignalBase()
+	: slots_(nullptr), acquiring_(0)
+{
+}
+
+SignalBase::~SignalBase()
+{
+	releaseSlots(slots_.load(std::memory_order_relaxed));
+}
+
 void SignalBase::connect(BoundMethodBase *slot)
 {
 	MutexLocker locker(signalsLock);
@@ -35,38 +65,106 @@ void SignalBase::connect(BoundMethodBase *slot)
 	Object *object = slot->object();
 	if (object)
 		object->connect(this);
-	slots_.push_back(slot);
+
+	details::SignalSlotArray *current = slots_.load(std::memory_order_relaxed);
+	details::SignalSlotArray *slots = new details::SignalSlotArray();
+	slots->refs.store(1, std::memory_order_relaxed);
+	if (current) {
+		slots->slots.reserve(current->slots.size() + 1);
+		slots->slots.insert(slots->slots.end(), current->slots.begin(),
+				    current->slots.end());
+	}
+	slots->slots.push_back(std::make_shared<details::SignalSlot>(slot));
+
+	replaceSlots(slots);
 }
 
 void SignalBase::disconnect(Object *object)
 {
-	disconnect([object](SlotList::iterator &iter) {
-		return (*iter)->match(object);
+	disconnect([object](BoundMethodBase *slot) {
+		return slot->match(object);
 	});
 }
 
-void SignalBase::disconnect(std::function<bool(SlotList::iterator &)> match)
+void SignalBase::disconnect(std::function<bool(BoundMethodBase *)> match)
 {
 	MutexLocker locker(signalsLock);
 
-	for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-		if (match(iter)) {
-			Object *object = (*iter)->object();
-			if (object)
-				object->disconnect(this);
+	details::SignalSlotArray *current = slots_.load(std::memory_order_relaxed);
+	if (!current)
+		return;
 
-			delete *iter;
-			iter = slots_.erase(iter);
-		} else {
-			++iter;
+	std::vector<std::shared_ptr<details::SignalSlot>> remaining;
+
+	for (const std::shared_ptr<details::SignalSlot> &slot : current->slots) {
+		if (!match(slot->method.get())) {
+			remaining.push_back(slot);
+			continue;
 		}
+
+		Object *object = slot->method->object();
+		if (object)
+			object->disconnect(this);
+
+		slot->connected.store(false, std::memory_order_release);
+	}
+
+	if (remaining.size() == current->slots.size())
+		return;
+
+	details::SignalSlotArray *slots = nullptr;
+	if (!remaining.empty()) {
+		slots = new details::SignalSlotArray();
+		slots->refs.store(1, std::memory_order_relaxed);
+		slots->slots = std::move(remaining);
 	}
+
+	replaceSlots(slots);
 }
 
-SignalBase::SlotList SignalBase::slots()
+/*
+ * Replace the slots array with \a slots, taking ownership of its reference,
+ * and release the reference to the previous array. The caller shall hold the
+ * signalsLock.
+ */
+void SignalBase::replaceSlots(details::SignalSlotArray *slots)
 {
-	MutexLocker locker(signalsLock);
-	return slots_;
+	details::SignalSlotArray *old = slots_.exchange(slots);
+
+	/*
+	 * Wait for concurrent acquireSlots() calls that may have loaded the old
+	 * pointer to take their reference.
+	 */
+	while (acquiring_.load())
+		std::this_thread::yield();
+
+	releaseSlots(old);
+}
+
+/*
+ * Acquire a reference to the current slots array, or return nullptr if no slot
+ * is connected. The reference shall be released with releaseSlots().
+ */
+details::SignalSlotArray *SignalBase::acquireSlots()
+{
+	acquiring_.fetch_add(1);
+
+	details::SignalSlotArray *slots = slots_.load();
+	if (slots)
+		slots->refs.fetch_add(1, std::memory_order_relaxed);
+
+	acquiring_.fetch_sub(1, std::memory_order_release);
+
+	return slots;
+}
+
+void SignalBase::releaseSlots(details::SignalSlotArray *slots)
+{
+	if (!slots)
+		return;
+
+	if (slots->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete slots;
 }
 
 /**
@@ -105,6 +203,10 @@ SignalBase::SlotList SignalBase::slots()
  * arguments. The emitter shall thus ensure that any pointer or reference
  * passed through the signal will remain valid after the signal is emitted.
  *
+ * Copying large arguments, such as control lists, for every asynchronous
+ * call can be avoided by declaring the signal parameter as a std::shared_ptr
+ * to a const type. All slots then share the same immutable data.
+ *
  * Duplicate connections between a signal and a slot are not expected and use of
  * the Object class to manage signals will enforce this restriction.
  */
@@ -7,18 +7,25 @@
 
 #include <libcamera/base/thread.h>
 
+#include <algorithm>
 #include <atomic>
-#include <list>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/event_dispatcher_epoll.h>
 #include <libcamera/base/event_dispatcher_poll.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/message.h>
 #include <libcamera/base/mutex.h>
 #include <libcamera/base/object.h>
+#include <libcamera/base/utils.h>
 
 /**
  * \page thread Thread Support
@@ -115,18 +122,33 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * The queue is split in two parts. Messages are posted by any thread to a
+ * lock-free intrusive stack, linked through Message::next_, which costs a
+ * single atomic compare-and-swap and no memory allocation. The thread that owns
+ * the queue then moves the posted messages, in posting order, to the \ref list_
+ * of queued messages, from which they are dispatched.
+ *
+ * The \ref list_ is only accessed by the thread that owns the queue, or when
+ * that thread isn't running, as mandated by the threading rules of the Object
+ * class. It is thus not protected by any lock.
  */
 class MessageQueue
 {
 public:
+	~MessageQueue();
+
+	bool post(std::unique_ptr<Message> msg);
+	void receive();
+
 	/**
-	 * \brief List of queued Message instances
+	 * \brief List of queued Message instances, in posting order
 	 */
-	std::list<std::unique_ptr<Message>> list_;
+	std::vector<std::unique_ptr<Message>> list_;
 	/**
-	 * \brief Protects the \ref list_
+	 * \brief Stack of posted Message instances not yet moved to \ref list_
 	 */
-	Mutex mutex_;
+	std::atomic<Message *> posted_ = nullptr;
 	/**
 	 * \brief The recursion level for recursive Thread::dispatchMessages()
 	 * calls
@@ -134,6 +156,60 @@ public:
 	unsigned int recursion_ = 0;
 };
 
+MessageQueue::~MessageQueue()
+{
+	receive();
+}
+
+/**
+ * \brief Post a message to the queue
+ * \param[in] msg The message
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return True if the queue had no posted message pending reception, false
+ * otherwise
+ */
+bool MessageQueue::post(std::unique_ptr<Message> msg)
+{
+	Message *message = msg.release();
+	Message *head = posted_.load(std::memory_order_relaxed);
+
+	do {
+		message->next_ = head;
+	} while (!posted_.compare_exchange_weak(head, message,
+						std::memory_order_release,
+						std::memory_order_relaxed));
+
+	return !head;
+}
+
+/**
+ * \brief Move all posted messages to the list of queued messages
+ */
+void MessageQueue::receive()
+{
+	Message *message = posted_.exchange(nullptr, std::memory_order_acquire);
+	if (!message)
+		return;
+
+	/* The stack is in reverse posting order, reverse it. */
+	Message *first = nullptr;
+	while (message) {
+		Message *next = message->next_;
+		message->next_ = first;
+		first = message;
+		message = next;
+	}
+
+	while (first) {
+		Message *next = first->next_;
+		first->next_ = nullptr;
+		list_.emplace_back(first);
+		first = next;
+	}
+}
+
 /**
  * \brief Thread-local internal data
  */
@@ -141,7 +217,9 @@ class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), tid_(0), dispatcher_(nullptr),
+		  policy_(Thread::SchedulingPolicy::Other), priority_(0),
+		  hasPriority_(false), statistics_(nullptr), statisticsEnabled_(false)
 	{
 	}
 
@@ -150,6 +228,7 @@ public:
 private:
 	friend class Thread;
 	friend class ThreadMain;
+	friend class ThreadStatisticsRecorder;
 
 	Thread *thread_;
 	bool running_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
@@ -164,8 +243,122 @@ private:
 	int exitCode_;
 
 	MessageQueue messages_;
+
+	std::vector<unsigned int> cpus_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	Thread::SchedulingPolicy policy_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	int priority_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	bool hasPriority_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+
+	std::atomic<ThreadStatisticsRecorder *> statistics_;
+	std::atomic<bool> statisticsEnabled_;
 };
 
+namespace {
+
+/*
+ * Default thread attributes, set by thread name, typically from a
+ * configuration file. They take precedence over attributes set on Thread
+ * instances.
+ */
+struct ThreadAttributes {
+	std::vector<unsigned int> cpus;
+	Thread::SchedulingPolicy policy = Thread::SchedulingPolicy::Other;
+	int priority = 0;
+	bool hasPriority = false;
+};
+
+Mutex defaultAttributesLock;
+std::map<std::string, ThreadAttributes> defaultAttributes
+	LIBCAMERA_TSA_GUARDED_BY(defaultAttributesLock);
+
+int applyAffinity(pid_t tid, const std::vector<unsigned int> &cpus)
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	for (unsigned int cpu : cpus) {
+		if (cpu >= CPU_SETSIZE) {
+			LOG(Thread, Error) << "Invalid CPU index " << cpu;
+			return -EINVAL;
+		}
+
+		CPU_SET(cpu, &cpuset);
+	}
+
+	if (sched_setaffinity(tid, sizeof(cpuset), &cpuset) < 0) {
+		int ret = -errno;
+		LOG(Thread, Error)
+			<< "Failed to set thread " << tid << " affinity: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int applyPriority(pid_t tid, Thread::SchedulingPolicy policy, int priority)
+{
+	struct sched_param param = {};
+	int schedPolicy;
+
+	switch (policy) {
+	case Thread::SchedulingPolicy::Other:
+	default:
+		schedPolicy = SCHED_OTHER;
+		break;
+	case Thread::SchedulingPolicy::Fifo:
+		schedPolicy = SCHED_FIFO;
+		param.sched_priority = priority;
+		break;
+	case Thread::SchedulingPolicy::RoundRobin:
+		schedPolicy = SCHED_RR;
+		param.sched_priority = priority;
+		break;
+	}
+
+	if (sched_setscheduler(tid, schedPolicy, &param) < 0) {
+		int ret = -errno;
+		LOG(Thread, Error)
+			<< "Failed to set thread " << tid << " scheduling policy: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	/* Use the nice value for the priority of non real-time threads. */
+	if (policy == Thread::SchedulingPolicy::Other &&
+	    setpriority(PRIO_PROCESS, tid, priority) < 0) {
+		int ret = -errno;
+		LOG(Thread, Error)
+			<< "Failed to set thread " << tid << " nice value: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Apply the default attributes for thread \a name to the thread \a tid. */
+void applyDefaultAttributes(const std::string &name, pid_t tid)
+{
+	if (name.empty())
+		return;
+
+	MutexLocker locker(defaultAttributesLock);
+
+	auto iter = defaultAttributes.find(name);
+	if (iter == defaultAttributes.end())
+		return;
+
+	const ThreadAttributes &attrs = iter->second;
+
+	if (!attrs.cpus.empty())
+		applyAffinity(tid, attrs.cpus);
+	if (attrs.hasPriority)
+		applyPriority(tid, attrs.policy, attrs.priority);
+}
+
+} /* namespace */
+
 /**
  * \brief Thread wrapper for the main thread
  */
@@ -191,6 +384,19 @@ static ThreadMain mainThread;
  * \brief Retrieve thread-local internal data for the current thread
  * \return The thread-local internal data for the current thread
  */
+/*
+ * Implemented here as the thread-local data isn't accessible from
+ * thread_statistics.cpp.
+ */
+ThreadStatisticsRecorder *ThreadStatisticsRecorder::current()
+{
+	ThreadData *data = ThreadData::current();
+	if (!data->statisticsEnabled_.load(std::memory_order_acquire))
+		return nullptr;
+
+	return data->statistics_.load(std::memory_order_relaxed);
+}
+
 ThreadData *ThreadData::current()
 {
 	if (currentThreadData)
@@ -260,18 +466,41 @@ ThreadData *ThreadData::current()
  * deleted without being processed when the Thread instance is destroyed.
  */
 
+/**
+ * \enum Thread::SchedulingPolicy
+ * \brief Thread scheduling policy
+ * \var Thread::SchedulingPolicy::Other
+ * \brief The default time-sharing policy (SCHED_OTHER)
+ * \var Thread::SchedulingPolicy::Fifo
+ * \brief The first-in first-out real-time policy (SCHED_FIFO)
+ * \var Thread::SchedulingPolicy::RoundRobin
+ * \brief The round-robin real-time policy (SCHED_RR)
+ */
+
 /**
  * \brief Create a thread
+ * \param[in] name The thread name
+ *
+ * The \a name is set as the system thread name when the thread starts,
+ * truncated to 15 characters, and identifies the thread in the default
+ * attributes set with setDefaultAffinity() and setDefaultPriority().
  */
-Thread::Thread()
+Thread::Thread(const std::string &name)
+	: name_(name)
 {
 	data_ = new ThreadData;
 	data_->thread_ = this;
+
+	static const bool statisticsEnabled =
+		utils::secure_getenv("LIBCAMERA_THREAD_STATS") != nullptr;
+	if (statisticsEnabled)
+		setStatisticsEnabled(true);
 }
 
 Thread::~Thread()
 {
 	delete data_->dispatcher_.load(std::memory_order_relaxed);
+	delete data_->statistics_.load(std::memory_order_relaxed);
 	delete data_;
 }
 
@@ -286,6 +515,7 @@ void Thread::start()
 		return;
 
 	data_->running_ = true;
+	data_->tid_ = 0;
 	data_->exitCode_ = -1;
 	data_->exit_.store(false, std::memory_order_relaxed);
 
@@ -314,7 +544,22 @@ void Thread::startThread()
 	 */
 	thread_local ThreadCleaner cleaner(this, &Thread::finishThread);
 
-	data_->tid_ = syscall(SYS_gettid);
+	if (!name_.empty())
+		pthread_setname_np(pthread_self(), name_.substr(0, 15).c_str());
+
+	{
+		MutexLocker locker(data_->mutex_);
+
+		data_->tid_ = syscall(SYS_gettid);
+
+		if (!data_->cpus_.empty())
+			applyAffinity(data_->tid_, data_->cpus_);
+		if (data_->hasPriority_)
+			applyPriority(data_->tid_, data_->policy_, data_->priority_);
+	}
+
+	applyDefaultAttributes(name_, data_->tid_);
+
 	currentThreadData = data_;
 
 	run();
@@ -468,6 +713,192 @@ bool Thread::isRunning()
  * \brief Signal the end of thread execution
  */
 
+/**
+ * \fn Thread::name()
+ * \brief Retrieve the thread name
+ * \return The thread name
+ */
+
+/**
+ * \brief Set the CPU affinity of the thread
+ * \param[in] cpus The indices of the CPUs the thread is allowed to run on
+ *
+ * If the thread is running, the affinity is applied immediately, otherwise
+ * it is applied when the thread starts. An empty \a cpus list resets the
+ * affinity stored for the thread, but doesn't change the affinity of a
+ * running thread.
+ *
+ * Default attributes set for the thread name with setDefaultAffinity() take
+ * precedence over the affinity set with this function when the thread starts.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setAffinity(Span<const unsigned int> cpus)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->cpus_.assign(cpus.begin(), cpus.end());
+
+	if (!data_->running_ || !data_->tid_ || cpus.empty())
+		return 0;
+
+	return applyAffinity(data_->tid_, data_->cpus_);
+}
+
+/**
+ * \brief Set the scheduling policy and priority of the thread
+ * \param[in] policy The scheduling policy
+ * \param[in] priority The scheduling priority
+ *
+ * For the real-time SchedulingPolicy::Fifo and SchedulingPolicy::RoundRobin
+ * policies, \a priority is the real-time priority, between 1 (lowest) and 99
+ * (highest). For SchedulingPolicy::Other, \a priority is the nice value of
+ * the thread, between -20 (highest) and 19 (lowest). Real-time policies and
+ * negative nice values usually require the CAP_SYS_NICE capability.
+ *
+ * If the thread is running, the policy is applied immediately, otherwise it
+ * is applied when the thread starts.
+ *
+ * Default attributes set for the thread name with setDefaultPriority() take
+ * precedence over the policy set with this function when the thread starts.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setPriority(SchedulingPolicy policy, int priority)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->policy_ = policy;
+	data_->priority_ = priority;
+	data_->hasPriority_ = true;
+
+	if (!data_->running_ || !data_->tid_)
+		return 0;
+
+	return applyPriority(data_->tid_, policy, priority);
+}
+
+/**
+ * \brief Set the default CPU affinity for threads with a given name
+ * \param[in] name The thread name
+ * \param[in] cpus The indices of the CPUs the threads are allowed to run on
+ *
+ * The affinity is applied to all threads named \a name when they start,
+ * including threads configured with configureCurrent(). Threads already
+ * running are not affected. This is meant to be used by system integrators,
+ * through the threads configuration file, to pin threads to particular CPUs.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setDefaultAffinity(const std::string &name,
+				Span<const unsigned int> cpus)
+{
+	MutexLocker locker(defaultAttributesLock);
+	defaultAttributes[name].cpus.assign(cpus.begin(), cpus.end());
+}
+
+/**
+ * \brief Set the default scheduling policy for threads with a given name
+ * \param[in] name The thread name
+ * \param[in] policy The scheduling policy
+ * \param[in] priority The scheduling priority
+ *
+ * The scheduling \a policy and \a priority are applied to all threads named
+ * \a name when they start, including threads configured with
+ * configureCurrent(). Threads already running are not affected. See
+ * setPriority() for the meaning of \a priority.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setDefaultPriority(const std::string &name,
+				SchedulingPolicy policy, int priority)
+{
+	MutexLocker locker(defaultAttributesLock);
+
+	ThreadAttributes &attrs = defaultAttributes[name];
+	attrs.policy = policy;
+	attrs.priority = priority;
+	attrs.hasPriority = true;
+}
+
+/**
+ * \brief Name the calling thread and apply its default attributes
+ * \param[in] name The thread name
+ *
+ * This function is meant for threads that are not managed by the Thread class,
+ * such as std::thread instances, to make them configurable in the same way as
+ * Thread instances. It sets the system name of the calling thread to \a name,
+ * and applies the default attributes set for that name.
+ */
+void Thread::configureCurrent(const std::string &name)
+{
+	pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+	applyDefaultAttributes(name, syscall(SYS_gettid));
+}
+
+/**
+ * \brief Enable or disable event loop statistics
+ * \param[in] enable Whether to enable statistics
+ *
+ * When statistics are enabled, the thread records the depth of its message
+ * queue, the time messages wait in the queue before being dispatched, and the
+ * run time of message, event notifier and timer handlers. The statistics are
+ * retrieved with statistics(), and individual events are reported to the hook
+ * set with ThreadStatisticsRecorder::setTraceHook().
+ *
+ * Statistics are disabled by default, and are enabled for all threads when the
+ * LIBCAMERA_THREAD_STATS environment variable is set. Statistics recorded
+ * before disabling them are retained until resetStatistics() is called.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setStatisticsEnabled(bool enable)
+{
+	if (enable && !data_->statistics_.load(std::memory_order_acquire)) {
+		MutexLocker locker(data_->mutex_);
+
+		if (!data_->statistics_.load(std::memory_order_relaxed))
+			data_->statistics_.store(new ThreadStatisticsRecorder(this),
+						 std::memory_order_release);
+	}
+
+	data_->statisticsEnabled_.store(enable, std::memory_order_release);
+}
+
+/**
+ * \brief Retrieve the event loop statistics
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The statistics recorded since they have been enabled or last reset,
+ * or default-initialized statistics if they have never been enabled
+ */
+ThreadStatistics Thread::statistics() const
+{
+	ThreadStatisticsRecorder *recorder =
+		data_->statistics_.load(std::memory_order_acquire);
+	if (!recorder)
+		return {};
+
+	return recorder->statistics();
+}
+
+/**
+ * \brief Reset the event loop statistics
+ * \context This function is \threadsafe.
+ */
+void Thread::resetStatistics()
+{
+	ThreadStatisticsRecorder *recorder =
+		data_->statistics_.load(std::memory_order_acquire);
+	if (recorder)
+		recorder->reset();
+}
+
 /**
  * \brief Retrieve the Thread instance for the current thread
  * \context This function is \threadsafe.
@@ -495,12 +926,42 @@ pid_t Thread::currentId()
 	return data->tid_;
 }
 
+/*
+ * Create an event dispatcher of the type selected by the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable, or by the event_dispatcher
+ * build option by default.
+ */
+static EventDispatcher *createEventDispatcher()
+{
+	static const bool useEpoll = []() {
+		const char *type = utils::secure_getenv("LIBCAMERA_EVENT_DISPATCHER");
+		if (!type)
+			type = LIBCAMERA_DEFAULT_EVENT_DISPATCHER;
+
+		if (strcmp(type, "epoll") && strcmp(type, "poll"))
+			LOG(Thread, Warning)
+				<< "Unknown event dispatcher " << type
+				<< ", using poll";
+
+		return !strcmp(type, "epoll");
+	}();
+
+	if (useEpoll)
+		return new EventDispatcherEpoll();
+	else
+		return new EventDispatcherPoll();
+}
+
 /**
  * \brief Retrieve the event dispatcher
  *
  * This function retrieves the internal event dispatcher for the thread. The
  * returned event dispatcher is valid until the thread is destroyed.
  *
+ * The event dispatcher implementation defaults to poll() or epoll based on the
+ * event_dispatcher build option, and can be overridden by setting the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable to "poll" or "epoll".
+ *
  * \context This function is \threadsafe.
  *
  * \return Pointer to the event dispatcher
@@ -508,7 +969,7 @@ pid_t Thread::currentId()
 EventDispatcher *Thread::eventDispatcher()
 {
 	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
+		data_->dispatcher_.store(createEventDispatcher(),
 					 std::memory_order_release);
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
@@ -542,10 +1003,22 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
-	receiver->pendingMessages_++;
-	locker.unlock();
+	if (data_->statisticsEnabled_.load(std::memory_order_relaxed))
+		msg->postTime_ = utils::clock::now();
+
+	/*
+	 * Account for the message before posting it, to ensure the counter
+	 * can't be decremented by the receiving thread first.
+	 */
+	receiver->pendingMessages_.fetch_add(1, std::memory_order_relaxed);
+
+	/*
+	 * If messages were already pending reception, the thread that posted
+	 * the first of them interrupts the event dispatcher, and the messages
+	 * will all be received together.
+	 */
+	if (!data_->messages_.post(std::move(msg)))
+		return;
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -563,10 +1036,11 @@ void Thread::removeMessages(Object *receiver)
 {
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	if (!receiver->pendingMessages_)
+	if (!receiver->pendingMessages_.load(std::memory_order_relaxed))
 		return;
 
+	data_->messages_.receive();
+
 	std::vector<std::unique_ptr<Message>> toDelete;
 	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
 		if (!msg)
@@ -576,16 +1050,16 @@ void Thread::removeMessages(Object *receiver)
 
 		/*
 		 * Move the message to the pending deletion list to delete it
-		 * after releasing the lock. The messages list element will
-		 * contain a null pointer, and will be removed when dispatching
+		 * after iterating over the messages, as the message destructor
+		 * may post new messages. The messages list element will contain
+		 * a null pointer, and will be removed when dispatching
 		 * messages.
 		 */
 		toDelete.push_back(std::move(msg));
-		receiver->pendingMessages_--;
+		receiver->pendingMessages_.fetch_sub(1, std::memory_order_relaxed);
 	}
 
-	ASSERT(!receiver->pendingMessages_);
-	locker.unlock();
+	ASSERT(!receiver->pendingMessages_.load(std::memory_order_relaxed));
 
 	toDelete.clear();
 }
@@ -610,13 +1084,40 @@ void Thread::dispatchMessages(Message::Type type)
 {
 	ASSERT(data_ == ThreadData::current());
 
-	++data_->messages_.recursion_;
+	MessageQueue &queue = data_->messages_;
+	std::vector<std::unique_ptr<Message>> &messages = queue.list_;
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
 
-	MutexLocker locker(data_->messages_.mutex_);
+	++queue.recursion_;
 
-	std::list<std::unique_ptr<Message>> &messages = data_->messages_.list_;
+	/*
+	 * Iterate by index, as receiving posted messages may reallocate the
+	 * list. Messages posted while dispatching are received when reaching
+	 * the end of the list, and dispatched by the same call.
+	 */
+	for (size_t i = 0; ; i++) {
+		if (i == messages.size()) {
+			/*
+			 * Erase the dispatched messages before receiving new
+			 * ones, to avoid growing the list when messages are
+			 * posted continuously. This can only be done in the
+			 * outermost call.
+			 */
+			if (queue.recursion_ == 1) {
+				messages.erase(std::remove(messages.begin(), messages.end(), nullptr),
+					       messages.end());
+				i = messages.size();
+			}
+
+			queue.receive();
+			if (i == messages.size())
+				break;
+
+			if (statistics)
+				statistics->recordQueueDepth(messages.size() - i);
+		}
 
-	for (std::unique_ptr<Message> &msg : messages) {
+		std::unique_ptr<Message> &msg = messages[i];
 		if (!msg)
 			continue;
 
@@ -626,33 +1127,37 @@ void Thread::dispatchMessages(Message::Type type)
 		/*
 		 * Move the message, setting the entry in the list to null. It
 		 * will cause recursive calls to ignore the entry, and the erase
-		 * loop at the end of the function to delete it from the list.
+		 * operation at the end of the function to delete it from the
+		 * list.
 		 */
 		std::unique_ptr<Message> message = std::move(msg);
 
 		Object *receiver = message->receiver_;
 		ASSERT(data_ == receiver->thread()->data_);
-		receiver->pendingMessages_--;
+		receiver->pendingMessages_.fetch_sub(1, std::memory_order_relaxed);
+
+		if (statistics) {
+			/* The receiver may be deleted by the message handler. */
+			const std::type_info &handler = typeid(*receiver);
+			utils::time_point start = utils::clock::now();
+			receiver->message(message.get());
+			statistics->recordMessage(message.get(), handler, start,
+						  utils::clock::now());
+		} else {
+			receiver->message(message.get());
+		}
 
-		locker.unlock();
-		receiver->message(message.get());
 		message.reset();
-		locker.lock();
 	}
 
 	/*
 	 * If the recursion level is 0, erase all null messages in the list. We
-	 * can't do so during recursion, as it would invalidate the iterator of
+	 * can't do so during recursion, as it would invalidate the indices of
 	 * the outer calls.
 	 */
-	if (!--data_->messages_.recursion_) {
-		for (auto iter = messages.begin(); iter != messages.end(); ) {
-			if (!*iter)
-				iter = messages.erase(iter);
-			else
-				++iter;
-		}
-	}
+	if (!--queue.recursion_)
+		messages.erase(std::remove(messages.begin(), messages.end(), nullptr),
+			       messages.end());
 }
 
 /**
@@ -664,35 +1169,44 @@ void Thread::moveObject(Object *object)
 	ThreadData *currentData = object->thread_->data_;
 	ThreadData *targetData = data_;
 
-	MutexLocker lockerFrom(currentData->messages_.mutex_, std::defer_lock);
-	MutexLocker lockerTo(targetData->messages_.mutex_, std::defer_lock);
-	std::lock(lockerFrom, lockerTo);
+	/*
+	 * The object is bound to the current thread, which thus owns the
+	 * message queue of currentData. Receive the posted messages to move
+	 * them along with the already queued ones.
+	 */
+	currentData->messages_.receive();
+
+	std::vector<std::unique_ptr<Message>> messages;
+	moveObject(object, currentData, &messages);
 
-	moveObject(object, currentData, targetData);
+	/*
+	 * Post the pending messages to the new thread only after all objects
+	 * have been moved, as they may be dispatched immediately.
+	 */
+	bool interrupt = false;
+	for (std::unique_ptr<Message> &msg : messages)
+		interrupt |= targetData->messages_.post(std::move(msg));
+
+	if (interrupt) {
+		EventDispatcher *dispatcher =
+			targetData->dispatcher_.load(std::memory_order_acquire);
+		if (dispatcher)
+			dispatcher->interrupt();
+	}
 }
 
 void Thread::moveObject(Object *object, ThreadData *currentData,
-			ThreadData *targetData)
+			std::vector<std::unique_ptr<Message>> *messages)
 {
-	/* Move pending messages to the message queue of the new thread. */
-	if (object->pendingMessages_) {
-		unsigned int movedMessages = 0;
-
+	/* Collect the pending messages to move them to the new thread. */
+	if (object->pendingMessages_.load(std::memory_order_relaxed)) {
 		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
 			if (!msg)
 				continue;
 			if (msg->receiver_ != object)
 				continue;
 
-			targetData->messages_.list_.push_back(std::move(msg));
-			movedMessages++;
-		}
-
-		if (movedMessages) {
-			EventDispatcher *dispatcher =
-				targetData->dispatcher_.load(std::memory_order_acquire);
-			if (dispatcher)
-				dispatcher->interrupt();
+			messages->push_back(std::move(msg));
 		}
 	}
 
@@ -700,7 +1214,7 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 
 	/* Move all children. */
 	for (auto child : object->children_)
-		moveObject(child, currentData, targetData);
+		moveObject(child, currentData, messages);
 }
 
 } /* namespace libcamera */
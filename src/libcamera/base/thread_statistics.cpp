@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Thread event loop instrumentation
+ */
+
+#include <libcamera/base/thread_statistics.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cxxabi.h>
+#include <stdlib.h>
+
+#include <libcamera/base/message.h>
+#include <libcamera/base/object.h>
+
+/**
+ * \file base/thread_statistics.h
+ * \brief Thread event loop instrumentation
+ */
+
+namespace libcamera {
+
+namespace {
+
+std::atomic<ThreadTraceHook> traceHook{ nullptr };
+
+std::string demangle(const std::type_index &type)
+{
+	int status;
+	char *name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+	if (!name)
+		return type.name();
+
+	std::string result(name);
+	free(name);
+	return result;
+}
+
+} /* namespace */
+
+/**
+ * \struct ThreadStatistics
+ * \brief Event loop statistics of a thread
+ *
+ * The ThreadStatistics structure reports the activity of the event loop of a
+ * thread since statistics have been enabled or last reset, as returned by
+ * Thread::statistics().
+ *
+ * Durations are recorded in histograms of kHistogramBins bins, with
+ * logarithmic bin widths. Bin 0 counts durations shorter than 1µs, bin n
+ * counts durations in the [2^(n-1), 2^n[ µs range, and the last bin counts all
+ * longer durations.
+ */
+
+/**
+ * \var ThreadStatistics::kHistogramBins
+ * \brief The number of bins of the duration histograms
+ */
+
+/**
+ * \typedef ThreadStatistics::Histogram
+ * \brief A duration histogram
+ */
+
+/**
+ * \struct ThreadStatistics::Handler
+ * \brief Run time statistics for a handler type
+ *
+ * Handlers are identified by the type of the object that receives messages,
+ * or by the type of the parent of event notifiers and timers when they have
+ * one.
+ *
+ * \var ThreadStatistics::Handler::name
+ * \brief The demangled type name of the handler
+ * \var ThreadStatistics::Handler::count
+ * \brief The number of times the handler has been called
+ * \var ThreadStatistics::Handler::totalTime
+ * \brief The total run time of the handler
+ * \var ThreadStatistics::Handler::maxTime
+ * \brief The longest run time of the handler
+ */
+
+/**
+ * \brief Compute the histogram bin for a duration
+ * \param[in] duration The duration
+ * \return The index of the histogram bin that counts \a duration
+ */
+unsigned int ThreadStatistics::histogramBin(utils::Duration duration)
+{
+	uint64_t us = duration.get<std::micro>();
+	unsigned int bin = 0;
+
+	while (us && bin < kHistogramBins - 1) {
+		us >>= 1;
+		bin++;
+	}
+
+	return bin;
+}
+
+/**
+ * \var ThreadStatistics::elapsed
+ * \brief The time elapsed since statistics have been enabled or reset
+ *
+ * \var ThreadStatistics::idleTime
+ * \brief The time spent waiting for events
+ *
+ * The thread load is the ratio of the time not spent idle to the elapsed time.
+ *
+ * \var ThreadStatistics::messages
+ * \brief The number of messages dispatched
+ *
+ * \var ThreadStatistics::maxQueueDepth
+ * \brief The largest number of messages found waiting in the message queue
+ *
+ * \var ThreadStatistics::maxLatency
+ * \brief The longest time a message has waited in the queue before dispatch
+ *
+ * \var ThreadStatistics::latency
+ * \brief The histogram of the time messages wait in the queue
+ *
+ * \var ThreadStatistics::events
+ * \brief The number of messages, notifier events and timer expirations handled
+ *
+ * \var ThreadStatistics::runTime
+ * \brief The histogram of the handlers run time
+ *
+ * \var ThreadStatistics::handlers
+ * \brief The per-handler run time statistics, sorted by decreasing total time
+ */
+
+/**
+ * \struct ThreadTraceEvent
+ * \brief Description of an event handled by a thread event loop
+ *
+ * A ThreadTraceEvent is passed to the trace hook for every message, notifier
+ * event and timer expiration handled by an instrumented thread.
+ *
+ * \var ThreadTraceEvent::thread
+ * \brief The thread
+ * \var ThreadTraceEvent::type
+ * \brief The event type
+ * \var ThreadTraceEvent::handler
+ * \brief The mangled type name of the handler
+ * \var ThreadTraceEvent::fd
+ * \brief The file descriptor of event notifiers, or -1
+ * \var ThreadTraceEvent::queueDepth
+ * \brief The number of messages waiting in the queue
+ * \var ThreadTraceEvent::latency
+ * \brief The time the message has waited in the queue, or 0
+ * \var ThreadTraceEvent::runTime
+ * \brief The handler run time
+ */
+
+/**
+ * \enum ThreadTraceEvent::Type
+ * \brief The type of a thread event
+ * \var ThreadTraceEvent::Type::Message
+ * \brief A message dispatched to an object
+ * \var ThreadTraceEvent::Type::EventNotifier
+ * \brief An event notifier activation
+ * \var ThreadTraceEvent::Type::Timer
+ * \brief A timer expiration
+ */
+
+/**
+ * \typedef ThreadTraceHook
+ * \brief A function called for every event handled by instrumented threads
+ */
+
+/**
+ * \class ThreadStatisticsRecorder
+ * \brief Record event loop statistics for a thread
+ *
+ * The ThreadStatisticsRecorder is used by the Thread class and the event
+ * dispatchers to record how long messages wait in the queue and how long
+ * handlers run. It is created when statistics are enabled for a thread with
+ * Thread::setStatisticsEnabled().
+ *
+ * Recording takes a mutex to allow statistics to be retrieved concurrently
+ * from other threads. As the mutex is otherwise uncontended, and recording is
+ * disabled by default, the cost is acceptable.
+ */
+
+/**
+ * \brief Construct a statistics recorder for \a thread
+ * \param[in] thread The thread
+ */
+ThreadStatisticsRecorder::ThreadStatisticsRecorder(const Thread *thread)
+	: thread_(thread)
+{
+	reset();
+}
+
+/**
+ * \fn ThreadStatisticsRecorder::current()
+ * \brief Retrieve the recorder for the current thread
+ * \return The statistics recorder of the current thread, or nullptr if
+ * statistics are disabled for the thread
+ */
+
+/**
+ * \brief Set the trace hook
+ * \param[in] hook The hook function
+ *
+ * The \a hook is called for every event handled by instrumented threads. It is
+ * used to export events through tracepoints. Setting \a hook to nullptr
+ * disables the hook.
+ *
+ * \context This function is \threadsafe.
+ */
+void ThreadStatisticsRecorder::setTraceHook(ThreadTraceHook hook)
+{
+	traceHook.store(hook, std::memory_order_release);
+}
+
+/**
+ * \brief Identify the handler of an event notifier or timer
+ * \param[in] object The event notifier or timer
+ *
+ * Event notifiers and timers are identified by the type of their parent, if
+ * any, as their own type carries little information. The handler type must be
+ * retrieved before calling the handler, as the handler may delete \a object.
+ *
+ * \return The type of the object that handles events for \a object
+ */
+const std::type_info &ThreadStatisticsRecorder::handlerType(const Object *object)
+{
+	const Object *parent = object->parent();
+	return parent ? typeid(*parent) : typeid(*object);
+}
+
+/**
+ * \brief Record the depth of the message queue
+ * \param[in] depth The number of messages waiting in the queue
+ */
+void ThreadStatisticsRecorder::recordQueueDepth(unsigned int depth)
+{
+	MutexLocker locker(mutex_);
+
+	queueDepth_ = depth;
+	stats_.maxQueueDepth = std::max(stats_.maxQueueDepth, depth);
+}
+
+/**
+ * \brief Record the dispatch of a message
+ * \param[in] message The message
+ * \param[in] handler The type of the message receiver
+ * \param[in] start The time at which the dispatch started
+ * \param[in] end The time at which the dispatch ended
+ */
+void ThreadStatisticsRecorder::recordMessage(const Message *message,
+					     const std::type_info &handler,
+					     utils::time_point start,
+					     utils::time_point end)
+{
+	utils::Duration latency{};
+	if (message->postTime() != utils::time_point{})
+		latency = start - message->postTime();
+
+	MutexLocker locker(mutex_);
+
+	stats_.messages++;
+	stats_.latency[ThreadStatistics::histogramBin(latency)]++;
+	stats_.maxLatency = std::max(stats_.maxLatency, latency);
+
+	if (queueDepth_)
+		queueDepth_--;
+
+	record(ThreadTraceEvent::Type::Message, handler, -1, latency, end - start);
+}
+
+/**
+ * \brief Record the activation of an event notifier
+ * \param[in] fd The file descriptor of the event notifier
+ * \param[in] handler The handler type, as returned by handlerType()
+ * \param[in] start The time at which the activation started
+ * \param[in] end The time at which the activation ended
+ */
+void ThreadStatisticsRecorder::recordNotifier(int fd, const std::type_info &handler,
+					      utils::time_point start,
+					      utils::time_point end)
+{
+	MutexLocker locker(mutex_);
+
+	record(ThreadTraceEvent::Type::EventNotifier, handler, fd, {},
+	       end - start);
+}
+
+/**
+ * \brief Record the expiration of a timer
+ * \param[in] handler The handler type, as returned by handlerType()
+ * \param[in] start The time at which the timeout handling started
+ * \param[in] end The time at which the timeout handling ended
+ */
+void ThreadStatisticsRecorder::recordTimer(const std::type_info &handler,
+					   utils::time_point start,
+					   utils::time_point end)
+{
+	MutexLocker locker(mutex_);
+
+	record(ThreadTraceEvent::Type::Timer, handler, -1, {}, end - start);
+}
+
+/**
+ * \brief Record time spent waiting for events
+ * \param[in] duration The time spent waiting
+ */
+void ThreadStatisticsRecorder::recordIdle(utils::Duration duration)
+{
+	MutexLocker locker(mutex_);
+	stats_.idleTime += duration;
+}
+
+/**
+ * \brief Retrieve the statistics recorded so far
+ * \return The statistics
+ */
+ThreadStatistics ThreadStatisticsRecorder::statistics() const
+{
+	MutexLocker locker(mutex_);
+
+	ThreadStatistics stats = stats_;
+	stats.elapsed = utils::clock::now() - start_;
+
+	for (const auto &[type, data] : handlers_)
+		stats.handlers.push_back({ demangle(type), data.count,
+					   data.totalTime, data.maxTime });
+
+	std::sort(stats.handlers.begin(), stats.handlers.end(),
+		  [](const ThreadStatistics::Handler &a,
+		     const ThreadStatistics::Handler &b) {
+			  return a.totalTime > b.totalTime;
+		  });
+
+	return stats;
+}
+
+/**
+ * \brief Reset the statistics
+ */
+void ThreadStatisticsRecorder::reset()
+{
+	MutexLocker locker(mutex_);
+
+	start_ = utils::clock::now();
+	queueDepth_ = 0;
+	stats_ = {};
+	handlers_.clear();
+}
+
+void ThreadStatisticsRecorder::record(ThreadTraceEvent::Type type,
+				      const std::type_info &handler, int fd,
+				      utils::Duration latency,
+				      utils::Duration runTime)
+{
+	stats_.events++;
+	stats_.runTime[ThreadStatistics::histogramBin(runTime)]++;
+
+	HandlerData &data = handlers_[std::type_index(handler)];
+	data.count++;
+	data.totalTime += runTime;
+	data.maxTime = std::max(data.maxTime, runTime);
+
+	ThreadTraceHook hook = traceHook.load(std::memory_order_acquire);
+	if (!hook)
+		return;
+
+	ThreadTraceEvent event{
+		thread_, type, handler.name(), fd, queueDepth_, latency, runTime
+	};
+	hook(event);
+}
+
+} /* namespace libcamera */
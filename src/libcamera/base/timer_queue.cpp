@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Timer scheduling queue for event dispatchers
+ */
+
+#include <libcamera/base/timer_queue.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread_statistics.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file base/timer_queue.h
+ * \brief Timer scheduling queue for event dispatchers
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+/**
+ * \class TimerQueue
+ * \brief Queue of running timers ordered by deadline
+ *
+ * The TimerQueue stores the timers registered with an event dispatcher in a
+ * binary min-heap ordered by deadline. The heap position of each timer is
+ * tracked in a hash map, making insertion and removal O(log n) and retrieval
+ * of the next timer to expire O(1). This keeps the cost of timers that are
+ * restarted every frame independent of the number of timers running in the
+ * thread.
+ *
+ * The deadline of each timer is recorded when the timer is inserted, so the
+ * heap order doesn't depend on Timer::deadline() being stable until the timer
+ * is removed.
+ *
+ * When created with timerfd support, the queue additionally keeps a timerfd
+ * armed for the earliest deadline. Event dispatchers can then monitor the fd
+ * returned by fd() along with event notifiers and wait without a timeout,
+ * instead of computing one on every iteration. The timerfd is only rearmed
+ * when the earliest deadline changes, restarting a timer that isn't the next
+ * one to expire doesn't require any system call.
+ */
+
+/**
+ * \brief Construct a timer queue
+ * \param[in] useTimerfd Back the queue with a timerfd
+ *
+ * If \a useTimerfd is true and the timerfd can't be created, the queue falls
+ * back to operating without a timerfd, and fd() returns -1.
+ */
+TimerQueue::TimerQueue(bool useTimerfd)
+	: armed_(std::chrono::steady_clock::time_point::max())
+{
+	if (!useTimerfd)
+		return;
+
+	timerfd_ = UniqueFD(timerfd_create(CLOCK_MONOTONIC,
+					   TFD_CLOEXEC | TFD_NONBLOCK));
+	if (!timerfd_.isValid()) {
+		int ret = -errno;
+		LOG(Event, Warning)
+			<< "Unable to create timerfd: " << strerror(-ret);
+	}
+}
+
+TimerQueue::~TimerQueue()
+{
+}
+
+/**
+ * \fn TimerQueue::empty()
+ * \brief Check if the queue is empty
+ * \return True if no timer is queued, false otherwise
+ */
+
+/**
+ * \fn TimerQueue::fd()
+ * \brief Retrieve the timerfd backing the queue
+ *
+ * The timerfd becomes readable when the earliest deadline expires. The caller
+ * shall then call acknowledge() before expire().
+ *
+ * \return The timerfd, or -1 if the queue isn't backed by a timerfd
+ */
+
+/**
+ * \brief Insert a timer in the queue
+ * \param[in] timer The timer
+ *
+ * The timer is queued with its current deadline. If the timer is already
+ * queued, its position is updated to match its current deadline.
+ */
+void TimerQueue::insert(Timer *timer)
+{
+	auto iter = index_.find(timer);
+	if (iter != index_.end()) {
+		size_t index = iter->second;
+		heap_[index].deadline = timer->deadline();
+		siftUp(index);
+		siftDown(index_[timer]);
+	} else {
+		index_[timer] = heap_.size();
+		heap_.push_back({ timer->deadline(), timer });
+		siftUp(heap_.size() - 1);
+	}
+
+	arm();
+}
+
+/**
+ * \brief Remove a timer from the queue
+ * \param[in] timer The timer
+ *
+ * Removing a timer that isn't queued is a no-op.
+ */
+void TimerQueue::remove(Timer *timer)
+{
+	auto iter = index_.find(timer);
+	if (iter == index_.end())
+		return;
+
+	removeAt(iter->second);
+	arm();
+}
+
+/**
+ * \brief Retrieve the timer with the earliest deadline
+ * \return The next timer to expire, or nullptr if the queue is empty
+ */
+Timer *TimerQueue::next() const
+{
+	return !heap_.empty() ? heap_.front().timer : nullptr;
+}
+
+/**
+ * \brief Acknowledge expiration of the timerfd
+ *
+ * This function shall be called when the timerfd returned by fd() becomes
+ * readable, to clear its readable state.
+ */
+void TimerQueue::acknowledge()
+{
+	uint64_t expirations;
+	ssize_t ret = read(timerfd_.get(), &expirations, sizeof(expirations));
+	if (ret < 0 && errno != EAGAIN) {
+		ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to read timerfd (" << ret << ")";
+	}
+
+	/* The timerfd is a one-shot timer, it is now disarmed. */
+	armed_ = std::chrono::steady_clock::time_point::max();
+}
+
+/**
+ * \brief Expire all timers whose deadline has passed
+ * \param[in] now The current time
+ *
+ * Timers are removed from the queue and stopped before their timeout signal is
+ * emitted, in deadline order. Timer handlers may start and stop timers,
+ * including the one being expired.
+ */
+void TimerQueue::expire(std::chrono::steady_clock::time_point now)
+{
+	ThreadStatisticsRecorder *statistics = ThreadStatisticsRecorder::current();
+
+	while (!heap_.empty()) {
+		const Entry &entry = heap_.front();
+		if (entry.deadline > now)
+			break;
+
+		Timer *timer = entry.timer;
+		removeAt(0);
+
+		timer->stop();
+
+		if (statistics) {
+			const std::type_info &handler =
+				ThreadStatisticsRecorder::handlerType(timer);
+			utils::time_point start = utils::clock::now();
+			timer->timeout.emit();
+			statistics->recordTimer(handler, start, utils::clock::now());
+		} else {
+			timer->timeout.emit();
+		}
+	}
+
+	arm();
+}
+
+void TimerQueue::swap(size_t a, size_t b)
+{
+	std::swap(heap_[a], heap_[b]);
+	index_[heap_[a].timer] = a;
+	index_[heap_[b].timer] = b;
+}
+
+void TimerQueue::siftUp(size_t index)
+{
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (heap_[parent].deadline <= heap_[index].deadline)
+			break;
+
+		swap(index, parent);
+		index = parent;
+	}
+}
+
+void TimerQueue::siftDown(size_t index)
+{
+	size_t size = heap_.size();
+
+	while (true) {
+		size_t left = index * 2 + 1;
+		size_t right = left + 1;
+		size_t smallest = index;
+
+		if (left < size && heap_[left].deadline < heap_[smallest].deadline)
+			smallest = left;
+		if (right < size && heap_[right].deadline < heap_[smallest].deadline)
+			smallest = right;
+
+		if (smallest == index)
+			break;
+
+		swap(index, smallest);
+		index = smallest;
+	}
+}
+
+void TimerQueue::removeAt(size_t index)
+{
+	Timer *timer = heap_[index].timer;
+	size_t last = heap_.size() - 1;
+
+	if (index != last)
+		swap(index, last);
+
+	heap_.pop_back();
+	index_.erase(timer);
+
+	if (index == last)
+		return;
+
+	/* Restore the heap order around the entry moved from the end. */
+	Timer *moved = heap_[index].timer;
+	siftUp(index);
+	siftDown(index_[moved]);
+}
+
+/* Arm the timerfd for the earliest deadline, or disarm it if the queue is empty. */
+void TimerQueue::arm()
+{
+	if (!timerfd_.isValid())
+		return;
+
+	std::chrono::steady_clock::time_point deadline =
+		!heap_.empty() ? heap_.front().deadline
+			       : std::chrono::steady_clock::time_point::max();
+	if (deadline == armed_)
+		return;
+
+	/*
+	 * A zero it_value disarms the timer, make sure deadlines at the epoch
+	 * still fire.
+	 */
+	struct itimerspec spec = {};
+	if (!heap_.empty()) {
+		spec.it_value = utils::duration_to_timespec(deadline.time_since_epoch());
+		if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+			spec.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(timerfd_.get(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+		int ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to arm timerfd: " << strerror(-ret);
+		return;
+	}
+
+	armed_ = deadline;
+}
+
+} /* namespace libcamera */
@@ -7,16 +7,17 @@
 
 #include "libcamera/internal/bayer_format.h"
 
-#include <algorithm>
-#include <map>
 #include <sstream>
 #include <unordered_map>
+#include <utility>
 
 #include <linux/media-bus-format.h>
 
 #include <libcamera/formats.h>
 #include <libcamera/transform.h>
 
+#include "libcamera/internal/lookup_table.h"
+
 /**
  * \file bayer_format.h
  * \brief Class to represent Bayer formats and manipulate them
@@ -69,33 +70,14 @@ namespace libcamera {
 
 namespace {
 
-/* Define a slightly arbitrary ordering so that we can use a std::map. */
-struct BayerFormatComparator {
-	constexpr bool operator()(const BayerFormat &lhs, const BayerFormat &rhs) const
-	{
-		if (lhs.bitDepth < rhs.bitDepth)
-			return true;
-		else if (lhs.bitDepth > rhs.bitDepth)
-			return false;
-
-		if (lhs.order < rhs.order)
-			return true;
-		else if (lhs.order > rhs.order)
-			return false;
-
-		if (lhs.packing < rhs.packing)
-			return true;
-		else
-			return false;
-	}
-};
-
 struct Formats {
 	PixelFormat pixelFormat;
 	V4L2PixelFormat v4l2Format;
 };
 
-const std::map<BayerFormat, Formats, BayerFormatComparator> bayerToFormat{
+using BayerFormatEntry = std::pair<BayerFormat, Formats>;
+
+const BayerFormatEntry bayerToFormat[] = {
 	{ { BayerFormat::BGGR, 8, BayerFormat::Packing::None },
 		{ formats::SBGGR8, V4L2PixelFormat(V4L2_PIX_FMT_SBGGR8) } },
 	{ { BayerFormat::GBRG, 8, BayerFormat::Packing::None },
@@ -190,6 +172,40 @@ const std::map<BayerFormat, Formats, BayerFormatComparator> bayerToFormat{
 		{ formats::MONO_PISP_COMP1, V4L2PixelFormat(V4L2_PIX_FMT_PISP_COMP1_MONO) } },
 };
 
+struct BayerFormatHash {
+	size_t operator()(const BayerFormat &format) const
+	{
+		return (format.bitDepth << 24) | (format.order << 16) |
+		       static_cast<uint16_t>(format.packing);
+	}
+};
+
+struct PixelFormatHash {
+	size_t operator()(const PixelFormat &format) const
+	{
+		return format.fourcc() ^ format.modifier();
+	}
+};
+
+/*
+ * Index the table in all directions, the number of buckets is chosen to be at
+ * least twice the number of entries.
+ */
+const LookupTable<BayerFormat, BayerFormatEntry, 128, BayerFormatHash>
+bayerIndex{ bayerToFormat, [](const BayerFormatEntry &entry) {
+	return entry.first;
+} };
+
+const LookupTable<PixelFormat, BayerFormatEntry, 128, PixelFormatHash>
+pixelFormatIndex{ bayerToFormat, [](const BayerFormatEntry &entry) {
+	return entry.second.pixelFormat;
+} };
+
+const LookupTable<V4L2PixelFormat, BayerFormatEntry, 128, std::hash<uint32_t>>
+v4l2FormatIndex{ bayerToFormat, [](const BayerFormatEntry &entry) {
+	return entry.second.v4l2Format;
+} };
+
 const std::unordered_map<unsigned int, BayerFormat> mbusCodeToBayer{
 	{ MEDIA_BUS_FMT_SBGGR8_1X8, { BayerFormat::BGGR, 8, BayerFormat::Packing::None } },
 	{ MEDIA_BUS_FMT_SGBRG8_1X8, { BayerFormat::GBRG, 8, BayerFormat::Packing::None } },
@@ -338,9 +354,9 @@ std::ostream &operator<<(std::ostream &out, const BayerFormat &f)
  */
 V4L2PixelFormat BayerFormat::toV4L2PixelFormat() const
 {
-	const auto it = bayerToFormat.find(*this);
-	if (it != bayerToFormat.end())
-		return it->second.v4l2Format;
+	const BayerFormatEntry *entry = bayerIndex.find(*this);
+	if (entry)
+		return entry->second.v4l2Format;
 
 	return V4L2PixelFormat();
 }
@@ -352,12 +368,9 @@ V4L2PixelFormat BayerFormat::toV4L2PixelFormat() const
  */
 BayerFormat BayerFormat::fromV4L2PixelFormat(V4L2PixelFormat v4l2Format)
 {
-	auto it = std::find_if(bayerToFormat.begin(), bayerToFormat.end(),
-			       [v4l2Format](const auto &i) {
-				       return i.second.v4l2Format == v4l2Format;
-			       });
-	if (it != bayerToFormat.end())
-		return it->first;
+	const BayerFormatEntry *entry = v4l2FormatIndex.find(v4l2Format);
+	if (entry)
+		return entry->first;
 
 	return BayerFormat();
 }
@@ -368,9 +381,9 @@ BayerFormat BayerFormat::fromV4L2PixelFormat(V4L2PixelFormat v4l2Format)
  */
 PixelFormat BayerFormat::toPixelFormat() const
 {
-	const auto it = bayerToFormat.find(*this);
-	if (it != bayerToFormat.end())
-		return it->second.pixelFormat;
+	const BayerFormatEntry *entry = bayerIndex.find(*this);
+	if (entry)
+		return entry->second.pixelFormat;
 
 	return PixelFormat();
 }
@@ -381,12 +394,9 @@ PixelFormat BayerFormat::toPixelFormat() const
  */
 BayerFormat BayerFormat::fromPixelFormat(PixelFormat format)
 {
-	const auto it = std::find_if(bayerToFormat.begin(), bayerToFormat.end(),
-				     [format](const auto &i) {
-					     return i.second.pixelFormat == format;
-				     });
-	if (it != bayerToFormat.end())
-		return it->first;
+	const BayerFormatEntry *entry = pixelFormatIndex.find(format);
+	if (entry)
+		return entry->first;
 
 	return BayerFormat();
 }
@@ -291,7 +291,8 @@ bool SensorConfiguration::isValid() const
  * \brief Create an empty camera configuration
  */
 CameraConfiguration::CameraConfiguration()
-	: orientation(Orientation::Rotate0), config_({})
+	: orientation(Orientation::Rotate0), bufferHint(BufferHint::Balanced),
+	  config_({})
 {
 }
 
@@ -554,6 +555,65 @@ CameraConfiguration::Status CameraConfiguration::validateColorSpaces(ColorSpaceF
  * By default the orientation field is set to Orientation::Rotate0.
  */
 
+/**
+ * \enum CameraConfiguration::BufferHint
+ * \brief Trade-off between memory usage and throughput for buffer counts
+ *
+ * \var CameraConfiguration::BufferHint::Balanced
+ * \brief Use the buffer counts recommended by the pipeline handler
+ *
+ * \var CameraConfiguration::BufferHint::MinimalMemory
+ * \brief Use the smallest buffer counts the pipeline can operate with
+ *
+ * Minimal buffer counts save memory, especially for high resolution streams,
+ * but frames will be dropped if the application doesn't requeue buffers
+ * promptly.
+ *
+ * \var CameraConfiguration::BufferHint::MaxThroughput
+ * \brief Use extra buffers to absorb variations of the application latency
+ */
+
+/**
+ * \var CameraConfiguration::bufferHint
+ * \brief Hint to select the buffer count of the streams
+ *
+ * The bufferHint field lets applications trade memory for robustness to frame
+ * drops. Pipeline handlers take it into account in validate() when they set
+ * the StreamConfiguration::bufferCount of the streams. The buffer count
+ * required by a particular usage can be measured at runtime with the
+ * "streams.N.buffers.recommended" counter of Camera::counters().
+ *
+ * By default the bufferHint field is set to BufferHint::Balanced.
+ */
+
+/**
+ * \brief Compute the buffer count of a stream according to the buffer hint
+ * \param[in] minimum The minimum number of buffers the stream requires
+ * \param[in] preferred The number of buffers the pipeline handler recommends
+ *
+ * This helper function is meant to be used by pipeline handlers in their
+ * validate() implementation to set the StreamConfiguration::bufferCount of a
+ * stream.
+ *
+ * \return The buffer count for the stream
+ */
+unsigned int CameraConfiguration::bufferCount(unsigned int minimum,
+					      unsigned int preferred) const
+{
+	/* Extra buffers used to absorb application latency variations. */
+	static constexpr unsigned int kExtraBuffers = 2;
+
+	switch (bufferHint) {
+	case BufferHint::MinimalMemory:
+		return minimum;
+	case BufferHint::MaxThroughput:
+		return preferred + kExtraBuffers;
+	case BufferHint::Balanced:
+	default:
+		return preferred;
+	}
+}
+
 /**
  * \var CameraConfiguration::config_
  * \brief The vector of stream configurations
@@ -576,7 +636,8 @@ CameraConfiguration::Status CameraConfiguration::validateColorSpaces(ColorSpaceF
  * \param[in] pipe The pipeline handler responsible for the camera device
  */
 Camera::Private::Private(PipelineHandler *pipe)
-	: requestSequence_(0), pipe_(pipe->shared_from_this()),
+	: deliveryDepth_(0), requestSequence_(0), counters_({}),
+	  pipe_(pipe->shared_from_this()),
 	  disconnected_(false), state_(CameraAvailable)
 {
 }
@@ -642,6 +703,159 @@ Camera::Private::~Private()
  * over a single capture session.
  */
 
+/**
+ * \struct Camera::Private::Counters
+ * \brief Request and frame counters maintained by the PipelineHandler base class
+ *
+ * The counters are cumulative over the lifetime of the camera and are never
+ * reset. They are updated in the CameraManager thread and reported through
+ * Camera::counters().
+ *
+ * \var Camera::Private::Counters::requestsQueued
+ * \brief The number of requests queued to the pipeline handler
+ *
+ * \var Camera::Private::Counters::requestsCompleted
+ * \brief The number of requests that completed successfully
+ *
+ * \var Camera::Private::Counters::requestsCancelled
+ * \brief The number of requests that completed in the cancelled state
+ *
+ * \var Camera::Private::Counters::framesDropped
+ * \brief The number of frames missing from the buffer sequence of the streams
+ *
+ * \var Camera::Private::Counters::maxQueueDepth
+ * \brief The peak number of requests queued to the pipeline handler
+ */
+
+/**
+ * \var Camera::Private::counters_
+ * \brief The camera request and frame counters
+ */
+
+/**
+ * \var Camera::Private::lastSequence_
+ * \brief The sequence number of the last buffer completed for each stream
+ *
+ * The map is cleared when the camera is stopped, and is used to detect gaps in
+ * the buffer sequence numbers to account for dropped frames.
+ */
+
+/**
+ * \struct Camera::Private::BufferUsage
+ * \brief Buffer usage statistics of a stream
+ *
+ * The statistics are used to compute the number of buffers a stream needs to
+ * operate without starving the device, given the rate at which frames are
+ * captured, the time the pipeline takes to deliver a frame after it has been
+ * captured and the time the application holds buffers before requeuing them.
+ * All times are expressed in nanoseconds.
+ *
+ * \var Camera::Private::BufferUsage::index
+ * \brief The index of the stream in the camera configuration
+ *
+ * \var Camera::Private::BufferUsage::lastDelivery
+ * \brief The time at which the last buffer of the stream has been delivered
+ *
+ * \var Camera::Private::BufferUsage::intervalSum
+ * \brief The sum of the intervals between consecutive buffer deliveries
+ *
+ * \var Camera::Private::BufferUsage::intervals
+ * \brief The number of intervals accumulated in intervalSum
+ *
+ * \var Camera::Private::BufferUsage::latencySum
+ * \brief The sum of the latencies between capture and delivery of the buffers
+ *
+ * \var Camera::Private::BufferUsage::latencies
+ * \brief The number of latencies accumulated in latencySum
+ *
+ * \var Camera::Private::BufferUsage::holdTimeSum
+ * \brief The sum of the times buffers have been held by the application
+ *
+ * \var Camera::Private::BufferUsage::holdTimes
+ * \brief The number of hold times accumulated in holdTimeSum
+ */
+
+/**
+ * \var Camera::Private::bufferUsage_
+ * \brief The buffer usage statistics of each configured stream
+ *
+ * The map is reset when the camera is configured.
+ */
+
+/**
+ * \var Camera::Private::deliveredBuffers_
+ * \brief The delivery time of the buffers held by the application
+ *
+ * The map is cleared when the camera is stopped.
+ */
+
+/**
+ * \brief Account for a buffer being queued to the device
+ * \param[in] stream The stream the buffer belongs to
+ * \param[in] buffer The buffer
+ *
+ * If the \a buffer has previously been delivered to the application, the time
+ * it has been held is accounted for in the usage statistics of the \a stream.
+ */
+void Camera::Private::bufferQueued(const Stream *stream, const FrameBuffer *buffer)
+{
+	auto it = deliveredBuffers_.find(buffer);
+	if (it == deliveredBuffers_.end())
+		return;
+
+	utils::time_point delivered = it->second;
+	deliveredBuffers_.erase(it);
+
+	auto usage = bufferUsage_.find(stream);
+	if (usage == bufferUsage_.end())
+		return;
+
+	utils::duration holdTime = utils::clock::now() - delivered;
+	usage->second.holdTimeSum +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>(holdTime).count();
+	usage->second.holdTimes++;
+}
+
+/**
+ * \brief Account for a buffer being delivered to the application
+ * \param[in] stream The stream the buffer belongs to
+ * \param[in] buffer The buffer
+ *
+ * Record the delivery time of the \a buffer, and account for the interval since
+ * the previous delivery and the latency since capture in the usage statistics
+ * of the \a stream.
+ */
+void Camera::Private::bufferDelivered(const Stream *stream, const FrameBuffer *buffer)
+{
+	auto it = bufferUsage_.find(stream);
+	if (it == bufferUsage_.end())
+		return;
+
+	BufferUsage &usage = it->second;
+	utils::time_point now = utils::clock::now();
+
+	if (usage.lastDelivery != utils::time_point()) {
+		usage.intervalSum += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			now - usage.lastDelivery).count();
+		usage.intervals++;
+	}
+
+	usage.lastDelivery = now;
+
+	/*
+	 * The buffer timestamp is expressed in the CLOCK_MONOTONIC time base,
+	 * as is utils::clock.
+	 */
+	int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		now.time_since_epoch()).count() - buffer->metadata().timestamp;
+	if (buffer->metadata().timestamp && latency >= 0) {
+		usage.latencySum += latency;
+		usage.latencies++;
+	}
+
+	deliveredBuffers_[buffer] = now;
+}
+
 static const char *const camera_state_names[] = {
 	"Available",
 	"Acquired",
@@ -776,12 +990,12 @@ void Camera::Private::setState(State state)
  *   Acquired -> Configured [label = "configure()"];
  *
  *   Configured -> Available [label = "release()"];
- *   Configured -> Configured [label = "configure(), createRequest()"];
+ *   Configured -> Configured [label = "configure(), createRequest(), prepare()"];
  *   Configured -> Running [label = "start()"];
  *
  *   Running -> Stopping [label = "stop()"];
  *   Stopping -> Configured;
- *   Running -> Running [label = "createRequest(), queueRequest()"];
+ *   Running -> Running [label = "createRequest(), queueRequest(), flush()"];
  * }
  * \enddot
  *
@@ -798,7 +1012,8 @@ void Camera::Private::setState(State state)
  * \subsubsection Configured
  * The camera is configured and ready to be started. The application may
  * release() the camera and to get back to the Available state or start()
- * it to progress to the Running state.
+ * it to progress to the Running state. It may also prepare() the camera
+ * ahead of time to reduce the latency of start().
  *
  * \subsubsection Stopping
  * The camera has been asked to stop. Pending requests are being completed or
@@ -1184,10 +1399,18 @@ int Camera::configure(CameraConfiguration *config)
 
 	ret = d->pipe_->invokeMethod(&PipelineHandler::configure,
 				     ConnectionTypeBlocking, this, config);
+
+	/*
+	 * The pipeline handler may have updated the controls supported by the
+	 * camera, even if configuration failed.
+	 */
+	d->validator_->invalidate();
+
 	if (ret)
 		return ret;
 
 	d->activeStreams_.clear();
+	d->bufferUsage_.clear();
 	for (const StreamConfiguration &cfg : *config) {
 		Stream *stream = cfg.stream();
 		if (!stream) {
@@ -1199,6 +1422,10 @@ int Camera::configure(CameraConfiguration *config)
 
 		stream->configuration_ = cfg;
 		d->activeStreams_.insert(stream);
+
+		Private::BufferUsage usage = {};
+		usage.index = d->bufferUsage_.size();
+		d->bufferUsage_[stream] = usage;
 	}
 
 	d->setState(Private::CameraConfigured);
@@ -1257,6 +1484,12 @@ std::unique_ptr<Request> Camera::createRequest(uint64_t cookie)
  * Once the request has been queued, the camera will notify its completion
  * through the \ref requestCompleted signal.
  *
+ * When called from the thread the camera is bound to, outside of the
+ * requestCompleted and bufferCompleted signal handlers, the request is passed
+ * to the pipeline handler synchronously. Otherwise it is handed over to the
+ * camera thread, and requests queued in a burst are processed in a single
+ * batch.
+ *
  * \context This function is \threadsafe. It may only be called when the camera
  * is in the Running state as defined in \ref camera_operation.
  *
@@ -1306,12 +1539,79 @@ int Camera::queueRequest(Request *request)
 		}
 	}
 
-	d->pipe_->invokeMethod(&PipelineHandler::queueRequest,
-			       ConnectionTypeQueued, request);
+	/*
+	 * Queue the request synchronously when called from the pipeline
+	 * handler thread, unless called from a completion signal handler, as
+	 * the pipeline handler is then in the middle of processing an event.
+	 * Requests queued earlier and not submitted yet must be submitted
+	 * first to preserve ordering.
+	 */
+	bool direct = Thread::current() == d->pipe_->thread() &&
+		      !d->deliveryDepth_;
+
+	{
+		MutexLocker locker(d->pendingRequestsMutex_);
+
+		if (!direct || !d->pendingRequests_.empty()) {
+			/*
+			 * Batch requests queued before the pipeline handler
+			 * thread gets a chance to process them, and only
+			 * wake it up for the first one.
+			 */
+			bool wakeup = d->pendingRequests_.empty();
+			d->pendingRequests_.push_back(request);
+
+			if (wakeup)
+				d->pipe_->invokeMethod(&PipelineHandler::submitRequests,
+						       ConnectionTypeQueued, this);
+
+			return 0;
+		}
+	}
+
+	d->pipe_->queueRequest(request);
 
 	return 0;
 }
 
+/**
+ * \brief Prepare the camera to be started
+ *
+ * Starting a camera may require allocating internal buffers, mapping them to
+ * the IPA module or other costly operations that delay the first frame. This
+ * function performs those operations ahead of time, for the next start() to
+ * only apply the initial controls and start streaming. Applications that need
+ * a low start-to-first-frame latency, such as event-triggered captures, should
+ * call it after configuring the camera.
+ *
+ * Calling prepare() is optional, start() performs the operations that haven't
+ * been performed by prepare(). The prepared resources are released when the
+ * camera is reconfigured or released, and may be released when it is stopped.
+ * Applications should thus call prepare() before every start().
+ *
+ * \context This function may only be called when the camera is in the
+ * Configured state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be prepared
+ */
+int Camera::prepare()
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	LOG(Camera, Debug) << "Preparing capture";
+
+	return d->pipe_->invokeMethod(&PipelineHandler::prepare,
+				      ConnectionTypeBlocking, this);
+}
+
 /**
  * \brief Start capture from camera
  * \param[in] controls Controls to be applied before starting the Camera
@@ -1396,6 +1696,101 @@ int Camera::stop()
 	return 0;
 }
 
+/**
+ * \brief Cancel the requests that the camera hasn't started processing
+ *
+ * This function cancels the queued requests that haven't started being
+ * processed by the device, without stopping the camera. The cancelled requests
+ * complete in an error state, after all the requests that are being processed,
+ * which complete normally. The camera keeps running and new requests can be
+ * queued right away.
+ *
+ * Compared to stop() followed by start(), flushing avoids the latency of
+ * stopping and restarting the device, at the cost of waiting for the requests
+ * already in the hardware to complete. Which requests can be cancelled depends
+ * on the pipeline handler, at a minimum the requests still waiting for their
+ * fences are cancelled.
+ *
+ * The function returns once the requests have been cancelled, without waiting
+ * for their completion.
+ *
+ * \context This function is \threadsafe. It may only be called when the camera
+ * is in the Running state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running
+ */
+int Camera::flush()
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	LOG(Camera, Debug) << "Flushing requests";
+
+	d->pipe_->invokeMethod(&PipelineHandler::flush, ConnectionTypeBlocking,
+			       this);
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the performance counters of the camera
+ *
+ * This function returns a snapshot of the counters maintained by libcamera for
+ * the camera, indexed by name. The counters are cumulative over the lifetime
+ * of the camera and are cheap to maintain, they are always enabled and are
+ * meant for monitoring of production systems.
+ *
+ * The following counters are reported for all cameras:
+ *
+ * - requests.queued: Number of requests queued to the camera
+ * - requests.completed: Number of requests completed successfully
+ * - requests.cancelled: Number of requests completed in the cancelled state
+ * - requests.in_flight: Number of requests currently queued to the device
+ * - requests.in_flight_max: Peak number of requests queued to the device
+ * - frames.dropped: Number of frames missing from the sequence of buffers
+ *   completed for the streams
+ *
+ * The following counters are reported for each stream, where N is the index of
+ * the stream in the camera configuration:
+ *
+ * - streams.N.buffers.latency: Average time between capture of a frame and
+ *   delivery of its buffer to the application
+ * - streams.N.buffers.hold_time: Average time the application holds buffers
+ *   before queuing them back
+ * - streams.N.buffers.recommended: Number of buffers needed to cover the
+ *   latency and hold time at the measured frame rate, to be compared with the
+ *   StreamConfiguration::bufferCount
+ *
+ * Pipeline handlers may report additional counters specific to the platform,
+ * such as V4L2 buffer cache misses, IPA processing time or software ISP
+ * processing time. Time counters are expressed in microseconds. The set of
+ * counters is not part of the libcamera ABI, applications shall not rely on a
+ * particular counter being reported.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The counters of the camera, or an empty map if the camera has been
+ * disconnected
+ */
+std::map<std::string, uint64_t> Camera::counters() const
+{
+	const Private *const d = _d();
+	std::map<std::string, uint64_t> counters;
+
+	if (d->disconnected_)
+		return counters;
+
+	d->pipe_->invokeMethod(&PipelineHandler::counters,
+			       ConnectionTypeBlocking, this, &counters);
+
+	return counters;
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
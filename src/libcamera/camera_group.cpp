@@ -0,0 +1,401 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Synchronized capture from a group of cameras
+ */
+
+#include "libcamera/internal/camera_group.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+/**
+ * \file camera_group.h
+ * \brief Synchronized capture from a group of cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraGroup)
+
+namespace {
+
+/* Maximum skew used when the frame duration isn't reported by the cameras */
+constexpr int64_t kDefaultMaxSkew = 5000000;
+
+} /* namespace */
+
+/**
+ * \class CameraGroup::Private
+ * \brief Private data of the CameraGroup class
+ */
+
+/**
+ * \brief Construct the private data of a camera group
+ * \param[in] cameras The cameras of the group
+ */
+CameraGroup::Private::Private(const std::vector<std::shared_ptr<Camera>> &cameras)
+	: cameras_(cameras), maxSkew_(0), completed_(cameras.size())
+{
+}
+
+/**
+ * \var CameraGroup::Private::cameras_
+ * \brief The cameras of the group
+ */
+
+/**
+ * \var CameraGroup::Private::maxSkew_
+ * \brief The maximum timestamp skew in a matched set, in nanoseconds
+ *
+ * A value of 0 selects half the frame duration reported in the request
+ * metadata.
+ */
+
+/**
+ * \brief Handle completion of a request of one of the cameras of the group
+ * \param[in] index The index of the camera in the group
+ * \param[in] request The completed request
+ *
+ * Completed requests are held until a request has completed for every camera
+ * of the group, and then matched by timestamp. Cancelled requests are released
+ * immediately. Signals are emitted without holding the lock, as applications
+ * may queue requests from their handlers.
+ */
+void CameraGroup::Private::requestComplete(unsigned int index, Request *request)
+{
+	CameraGroup *const o = _o<CameraGroup>();
+	std::vector<RequestSet> sets;
+	std::vector<Request *> unmatched;
+
+	if (request->status() != Request::RequestComplete) {
+		unmatched.push_back(request);
+	} else {
+		MutexLocker locker(mutex_);
+		completed_[index].push_back(request);
+		match(&sets, &unmatched);
+	}
+
+	for (Request *req : unmatched)
+		o->requestUnmatched.emit(req);
+
+	for (const RequestSet &set : sets)
+		o->requestsCompleted.emit(set.requests, set.skew);
+}
+
+/**
+ * \brief Release the requests that haven't been matched
+ *
+ * This function is called when the cameras are stopped, and all requests
+ * queued to them have completed.
+ */
+void CameraGroup::Private::flush()
+{
+	CameraGroup *const o = _o<CameraGroup>();
+	std::vector<Request *> unmatched;
+
+	{
+		MutexLocker locker(mutex_);
+
+		for (std::deque<Request *> &queue : completed_) {
+			unmatched.insert(unmatched.end(), queue.begin(), queue.end());
+			queue.clear();
+		}
+	}
+
+	for (Request *request : unmatched)
+		o->requestUnmatched.emit(request);
+}
+
+int64_t CameraGroup::Private::timestamp(Request *request)
+{
+	std::optional<int64_t> timestamp =
+		request->metadata().get(controls::SensorTimestamp);
+	if (timestamp)
+		return *timestamp;
+
+	/* Fall back to the buffer timestamps if the sensor one isn't known. */
+	const Request::BufferMap &buffers = request->buffers();
+	if (buffers.empty())
+		return 0;
+
+	return buffers.begin()->second->metadata().timestamp;
+}
+
+int64_t CameraGroup::Private::frameDuration(Request *request)
+{
+	return request->metadata().get(controls::FrameDuration).value_or(0) * 1000;
+}
+
+/*
+ * Match the oldest completed request of each camera. When their timestamps are
+ * too far apart, the oldest request has no counterpart in the other cameras,
+ * typically because a frame was dropped, and is released unmatched.
+ */
+void CameraGroup::Private::match(std::vector<RequestSet> *sets,
+				 std::vector<Request *> *unmatched)
+{
+	while (std::all_of(completed_.begin(), completed_.end(),
+			   [](const auto &queue) { return !queue.empty(); })) {
+		unsigned int oldest = 0;
+		int64_t minTimestamp = timestamp(completed_[0].front());
+		int64_t maxTimestamp = minTimestamp;
+
+		for (unsigned int i = 1; i < completed_.size(); i++) {
+			int64_t ts = timestamp(completed_[i].front());
+
+			if (ts < minTimestamp) {
+				minTimestamp = ts;
+				oldest = i;
+			}
+
+			maxTimestamp = std::max(maxTimestamp, ts);
+		}
+
+		int64_t skew = maxTimestamp - minTimestamp;
+		int64_t maxSkew = maxSkew_;
+		if (!maxSkew) {
+			maxSkew = frameDuration(completed_[oldest].front()) / 2;
+			if (!maxSkew)
+				maxSkew = kDefaultMaxSkew;
+		}
+
+		if (skew > maxSkew) {
+			LOG(CameraGroup, Debug)
+				<< "Request of camera "
+				<< cameras_[oldest]->id() << " unmatched, skew "
+				<< skew << "ns";
+
+			unmatched->push_back(completed_[oldest].front());
+			completed_[oldest].pop_front();
+			continue;
+		}
+
+		RequestSet &set = sets->emplace_back();
+		set.skew = skew;
+
+		for (std::deque<Request *> &queue : completed_) {
+			set.requests.push_back(queue.front());
+			queue.pop_front();
+		}
+	}
+}
+
+/**
+ * \class CameraGroup
+ * \brief Capture synchronized frames from multiple cameras
+ *
+ * Stereo and multi-camera applications need frames captured at the same time
+ * by all their cameras. The CameraGroup class operates a set of cameras in
+ * lockstep: it starts them together, applies the same controls to the
+ * requests queued to all cameras at once, and matches the completed requests
+ * by their SensorTimestamp.
+ *
+ * Camera groups are created with CameraManager::createGroup(). The cameras of
+ * the group shall be acquired and configured by the application beforehand,
+ * and requests are created and buffers allocated for each camera as usual.
+ *
+ * Requests are queued with queueRequests(), one per camera, in the order of
+ * cameras(). Requests queued together carry the same controls, and as each
+ * pipeline handler applies the controls of its requests through the sensor's
+ * delayed controls, cameras started together take them into account for the
+ * same frame.
+ *
+ * When a request has completed for every camera, the group emits the
+ * requestsCompleted signal with one request per camera, in the order of
+ * cameras(), and the difference between their earliest and latest timestamps.
+ * Requests that can't be matched within the maximum skew, typically because
+ * one of the cameras dropped a frame, and requests that have been cancelled
+ * are reported individually through the requestUnmatched signal. Applications
+ * don't need to handle the requestCompleted signal of the cameras.
+ *
+ * Synchronization is performed in software. Cameras whose sensors run from a
+ * common trigger or clock will produce sets with a small and stable skew,
+ * while free-running sensors may drift by up to half a frame before frames
+ * get dropped and rematched.
+ */
+
+/**
+ * \brief Construct a group of cameras
+ * \param[in] cameras The cameras of the group
+ */
+CameraGroup::CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras)
+	: Extensible(std::make_unique<Private>(cameras))
+{
+	Private *const d = _d();
+
+	for (unsigned int i = 0; i < cameras.size(); i++) {
+		cameras[i]->requestCompleted.connect(this, [d, i](Request *request) {
+			d->requestComplete(i, request);
+		});
+	}
+}
+
+CameraGroup::~CameraGroup()
+{
+	for (const std::shared_ptr<Camera> &camera : _d()->cameras_)
+		camera->requestCompleted.disconnect(this);
+}
+
+/**
+ * \brief Retrieve the cameras of the group
+ * \return The cameras of the group, in the order of the requests passed to
+ * queueRequests() and reported by requestsCompleted
+ */
+const std::vector<std::shared_ptr<Camera>> &CameraGroup::cameras() const
+{
+	return _d()->cameras_;
+}
+
+/**
+ * \brief Set the maximum timestamp skew in a matched set of requests
+ * \param[in] maxSkew The maximum skew in nanoseconds
+ *
+ * Requests whose timestamps differ by more than \a maxSkew from the ones of
+ * other cameras are reported as unmatched. The default value of 0 selects half
+ * the frame duration reported by the cameras.
+ */
+void CameraGroup::setMaxSkew(int64_t maxSkew)
+{
+	_d()->maxSkew_ = maxSkew;
+}
+
+/**
+ * \brief Retrieve the maximum timestamp skew in a matched set of requests
+ * \return The maximum skew in nanoseconds, or 0 if it depends on the frame
+ * duration
+ */
+int64_t CameraGroup::maxSkew() const
+{
+	return _d()->maxSkew_;
+}
+
+/**
+ * \brief Start capture on all cameras of the group
+ * \param[in] controls Controls to be applied to all cameras before starting
+ *
+ * The cameras are started back to back, in the order of cameras(). If any
+ * camera fails to start, the cameras already started are stopped.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraGroup::start(const ControlList *controls)
+{
+	Private *const d = _d();
+
+	for (unsigned int i = 0; i < d->cameras_.size(); i++) {
+		int ret = d->cameras_[i]->start(controls);
+		if (ret < 0) {
+			LOG(CameraGroup, Error)
+				<< "Failed to start camera "
+				<< d->cameras_[i]->id();
+
+			while (i--)
+				d->cameras_[i]->stop();
+
+			d->flush();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Stop capture on all cameras of the group
+ *
+ * All cameras are stopped, and all requests that haven't been reported through
+ * the requestsCompleted signal are reported through requestUnmatched before
+ * this function returns.
+ *
+ * \return 0 on success or a negative error code if any camera failed to stop
+ */
+int CameraGroup::stop()
+{
+	Private *const d = _d();
+	int ret = 0;
+
+	for (const std::shared_ptr<Camera> &camera : d->cameras_) {
+		int err = camera->stop();
+		if (err < 0)
+			ret = err;
+	}
+
+	d->flush();
+
+	return ret;
+}
+
+/**
+ * \brief Queue one request to each camera of the group
+ * \param[in] requests The requests, one per camera in the order of cameras()
+ * \param[in] controls Controls to apply to all requests
+ *
+ * The \a controls supported by each camera are copied to its request,
+ * overriding any value already set in the request, and the requests are
+ * queued back to back. Typical controls are the exposure time, analogue gain
+ * and frame duration limits, to keep the cameras in lockstep.
+ *
+ * If queueing a request fails, the requests of the previous cameras remain
+ * queued, and will be reported as unmatched.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The number of requests doesn't match the number of cameras
+ */
+int CameraGroup::queueRequests(const std::vector<Request *> &requests,
+			       const ControlList *controls)
+{
+	Private *const d = _d();
+
+	if (requests.size() != d->cameras_.size())
+		return -EINVAL;
+
+	if (controls) {
+		for (unsigned int i = 0; i < requests.size(); i++) {
+			const ControlInfoMap &infoMap = d->cameras_[i]->controls();
+
+			for (const auto &[id, value] : *controls) {
+				if (infoMap.count(id))
+					requests[i]->controls().set(id, value);
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < requests.size(); i++) {
+		int ret = d->cameras_[i]->queueRequest(requests[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \var CameraGroup::requestsCompleted
+ * \brief Signal emitted when a matched set of requests has completed
+ *
+ * The signal carries one request per camera, in the order of cameras(), and
+ * the difference in nanoseconds between their earliest and latest timestamps.
+ * It is emitted from the thread in which the last request of the set
+ * completed, as for Camera::requestCompleted.
+ */
+
+/**
+ * \var CameraGroup::requestUnmatched
+ * \brief Signal emitted when a completed request can't be matched
+ *
+ * Requests that have been cancelled, or whose timestamp doesn't match the
+ * requests of the other cameras, are reported through this signal so that
+ * the application can reuse them.
+ */
+
+} /* namespace libcamera */
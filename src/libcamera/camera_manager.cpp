@@ -7,15 +7,24 @@
 
 #include "libcamera/internal/camera_manager.h"
 
+#include <algorithm>
+
+#include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread_statistics.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/camera_group.h>
 #include <libcamera/property_ids.h>
 
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/trace_recorder.h"
+#include "libcamera/internal/tracepoints.h"
+#include "libcamera/internal/yaml_parser.h"
 
 /**
  * \file libcamera/camera_manager.h
@@ -34,15 +43,106 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Camera)
 
+namespace {
+
+/*
+ * Thread running a pipeline handler instance. The pipeline handler is created
+ * and matched in the thread, in order for all the objects it creates,
+ * including the cameras, to be bound to the thread. The thread keeps a
+ * reference to the pipeline handler until it stops, and releases it from the
+ * thread.
+ */
+class PipelineThread : public Thread
+{
+public:
+	PipelineThread(CameraManager *manager,
+		       const PipelineHandlerFactoryBase *factory,
+		       DeviceEnumerator *enumerator)
+		: Thread(std::string("pipeline-") + factory->name()),
+		  manager_(manager), factory_(factory), enumerator_(enumerator),
+		  done_(false), matched_(false)
+	{
+	}
+
+	bool match()
+	{
+		start();
+
+		MutexLocker locker(mutex_);
+		cv_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+			return done_;
+		});
+
+		return matched_;
+	}
+
+protected:
+	void run() override
+	{
+		std::shared_ptr<PipelineHandler> pipe = factory_->create(manager_);
+		bool matched = pipe->match(enumerator_);
+		if (!matched)
+			pipe.reset();
+
+		{
+			MutexLocker locker(mutex_);
+			matched_ = matched;
+			done_ = true;
+		}
+		cv_.notify_one();
+
+		if (!matched)
+			return;
+
+		exec();
+	}
+
+private:
+	CameraManager *manager_;
+	const PipelineHandlerFactoryBase *factory_;
+	DeviceEnumerator *enumerator_;
+
+	Mutex mutex_;
+	ConditionVariable cv_;
+	bool done_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	bool matched_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+} /* namespace */
+
+namespace {
+
+void traceThreadEvent(const ThreadTraceEvent &event)
+{
+	LIBCAMERA_TRACEPOINT(thread_dispatch, event.thread->name().c_str(),
+			     static_cast<int>(event.type), event.handler,
+			     event.fd, event.queueDepth,
+			     static_cast<int64_t>(event.latency.get<std::nano>()),
+			     static_cast<int64_t>(event.runTime.get<std::nano>()));
+}
+
+} /* namespace */
+
 CameraManager::Private::Private()
-	: initialized_(false)
+	: Thread("camera-manager"), initialized_(false), pipelineThreads_(false)
 {
+	const char *pipelineThreads = utils::secure_getenv("LIBCAMERA_PIPELINE_THREADS");
+	if (pipelineThreads && *pipelineThreads != '\0')
+		pipelineThreads_ = true;
 }
 
 int CameraManager::Private::start()
 {
 	int status;
 
+	loadThreadConfiguration();
+
+	/* Export the events of threads with statistics enabled to tracepoints. */
+#if !HAVE_TRACING
+	if (TraceRecorder::instance()->isEnabled())
+#endif
+		ThreadStatisticsRecorder::setTraceHook(traceThreadEvent);
+
 	/* Start the thread and wait for initialization to complete. */
 	Thread::start();
 
@@ -97,7 +197,102 @@ int CameraManager::Private::init()
 	return 0;
 }
 
-void CameraManager::Private::createPipelineHandlers()
+/*
+ * Load the default thread attributes from the configuration file pointed to by
+ * the LIBCAMERA_THREAD_CONFIG_FILE environment variable, if set. The file
+ * contains a dictionary of thread names, each with optional "cpus" (a list of
+ * CPU indices), "policy" ("other", "fifo" or "rr") and "priority" entries:
+ *
+ * version: 1.0
+ * threads:
+ *   camera-manager:
+ *     cpus: [ 2, 3 ]
+ *   soft-isp:
+ *     cpus: [ 3 ]
+ *     policy: fifo
+ *     priority: 10
+ */
+void CameraManager::Private::loadThreadConfiguration()
+{
+	const char *configFromEnv = utils::secure_getenv("LIBCAMERA_THREAD_CONFIG_FILE");
+	if (!configFromEnv || *configFromEnv == '\0')
+		return;
+
+	std::string filename = configFromEnv;
+	File file(filename);
+
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		LOG(Camera, Warning)
+			<< "Failed to open thread configuration file '"
+			<< filename << "'";
+		return;
+	}
+
+	std::unique_ptr<YamlObject> root = YamlParser::parse(file);
+	if (!root) {
+		LOG(Camera, Warning) << "Failed to parse thread configuration file";
+		return;
+	}
+
+	std::optional<double> ver = (*root)["version"].get<double>();
+	if (!ver || *ver != 1.0) {
+		LOG(Camera, Warning)
+			<< "Unsupported thread configuration file version";
+		return;
+	}
+
+	const YamlObject &threads = (*root)["threads"];
+	if (!threads.isDictionary())
+		return;
+
+	for (const auto &[name, thread] : threads.asDict()) {
+		if (thread.contains("cpus")) {
+			std::optional<std::vector<unsigned int>> cpus =
+				thread["cpus"].getList<unsigned int>();
+			if (!cpus) {
+				LOG(Camera, Warning)
+					<< "Invalid CPU list for thread " << name;
+				continue;
+			}
+
+			Thread::setDefaultAffinity(name, *cpus);
+		}
+
+		if (!thread.contains("policy") && !thread.contains("priority"))
+			continue;
+
+		std::string policyName = thread["policy"].get<std::string>("other");
+		Thread::SchedulingPolicy policy;
+
+		if (policyName == "other") {
+			policy = Thread::SchedulingPolicy::Other;
+		} else if (policyName == "fifo") {
+			policy = Thread::SchedulingPolicy::Fifo;
+		} else if (policyName == "rr") {
+			policy = Thread::SchedulingPolicy::RoundRobin;
+		} else {
+			LOG(Camera, Warning)
+				<< "Invalid scheduling policy '" << policyName
+				<< "' for thread " << name;
+			continue;
+		}
+
+		int priority = thread["priority"].get<int32_t>(0);
+		Thread::setDefaultPriority(name, policy, priority);
+
+		LOG(Camera, Debug)
+			<< "Thread " << name << " scheduling policy "
+			<< policyName << ", priority " << priority;
+	}
+}
+
+/*
+ * Match the pipeline handlers against the enumerated media devices. When a
+ * media device has been \a added by hotplug, only the pipeline handlers whose
+ * previous match attempt searched for media devices of the same driver are
+ * tried again, as the outcome of the other ones can't have changed.
+ */
+void CameraManager::Private::createPipelineHandlers(MediaDevice *added)
 {
 	/*
 	 * \todo Try to read handlers and order from configuration
@@ -120,7 +315,7 @@ void CameraManager::Private::createPipelineHandlers()
 			LOG(Camera, Debug)
 				<< "Found listed pipeline handler '"
 				<< pipeName << "'";
-			pipelineFactoryMatch(factory);
+			pipelineFactoryMatch(factory, added);
 		}
 
 		return;
@@ -138,19 +333,47 @@ void CameraManager::Private::createPipelineHandlers()
 		 * Try each pipeline handler until it exhaust
 		 * all pipelines it can provide.
 		 */
-		pipelineFactoryMatch(factory);
+		pipelineFactoryMatch(factory, added);
 	}
 }
 
-void CameraManager::Private::pipelineFactoryMatch(const PipelineHandlerFactoryBase *factory)
+void CameraManager::Private::pipelineFactoryMatch(const PipelineHandlerFactoryBase *factory,
+						  MediaDevice *added)
 {
 	CameraManager *const o = LIBCAMERA_O_PTR();
 
+	if (added) {
+		auto it = unmatchedDrivers_.find(factory);
+		if (it != unmatchedDrivers_.end() && !it->second.count(added->driver()))
+			return;
+	}
+
 	/* Provide as many matching pipelines as possible. */
 	while (1) {
-		std::shared_ptr<PipelineHandler> pipe = factory->create(o);
-		if (!pipe->match(enumerator_.get()))
+		std::set<std::string> drivers;
+		bool matched;
+
+		enumerator_->recordSearches(&drivers);
+
+		if (pipelineThreads_) {
+			auto thread = std::make_unique<PipelineThread>(o, factory,
+								       enumerator_.get());
+			matched = thread->match();
+			if (matched)
+				threads_.push_back(std::move(thread));
+			else
+				thread->wait();
+		} else {
+			std::shared_ptr<PipelineHandler> pipe = factory->create(o);
+			matched = pipe->match(enumerator_.get());
+		}
+
+		enumerator_->recordSearches(nullptr);
+
+		if (!matched) {
+			unmatchedDrivers_[factory] = std::move(drivers);
 			break;
+		}
 
 		LOG(Camera, Debug)
 			<< "Pipeline handler \"" << factory->name()
@@ -176,6 +399,17 @@ void CameraManager::Private::cleanup()
 
 	dispatchMessages(Message::Type::DeferredDelete);
 
+	/*
+	 * Stop the pipeline handler threads. They delete the cameras scheduled
+	 * for deletion and release their pipeline handler before stopping.
+	 */
+	for (std::unique_ptr<Thread> &thread : threads_) {
+		thread->exit();
+		thread->wait();
+	}
+
+	threads_.clear();
+
 	enumerator_.reset(nullptr);
 }
 
@@ -190,11 +424,13 @@ void CameraManager::Private::cleanup()
  * Device numbers from the SystemDevices property are used by the V4L2
  * compatibility layer to map V4L2 device nodes to Camera instances.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the thread of the \a camera,
+ * which is the CameraManager thread or the thread of the pipeline handler when
+ * pipeline handler threads are enabled.
  */
 void CameraManager::Private::addCamera(std::shared_ptr<Camera> camera)
 {
-	ASSERT(Thread::current() == this);
+	ASSERT(Thread::current() == camera->thread());
 
 	MutexLocker locker(mutex_);
 
@@ -224,11 +460,13 @@ void CameraManager::Private::addCamera(std::shared_ptr<Camera> camera)
  * camera manager. Unregistered cameras won't be reported anymore by the
  * cameras() and get() calls, but references may still exist in applications.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the thread of the \a camera,
+ * which is the CameraManager thread or the thread of the pipeline handler when
+ * pipeline handler threads are enabled.
  */
 void CameraManager::Private::removeCamera(std::shared_ptr<Camera> camera)
 {
-	ASSERT(Thread::current() == this);
+	ASSERT(Thread::current() == camera->thread());
 
 	MutexLocker locker(mutex_);
 
@@ -329,12 +567,17 @@ int CameraManager::start()
  * After the manager has been stopped no resource provided by the camera
  * manager should be consider valid or functional even if they for one
  * reason or another have yet to be deleted.
+ *
+ * When the LIBCAMERA_TRACE_FILE environment variable is set, the events
+ * recorded by the built-in trace recorder are written to the trace file.
  */
 void CameraManager::stop()
 {
 	Private *const d = _d();
 	d->exit();
 	d->wait();
+
+	TraceRecorder::instance()->exportTrace();
 }
 
 /**
@@ -382,6 +625,47 @@ std::shared_ptr<Camera> CameraManager::get(const std::string &id)
 	return nullptr;
 }
 
+/**
+ * \brief Create a group of cameras for synchronized capture
+ * \param[in] cameras The cameras of the group
+ *
+ * The \a cameras shall be distinct cameras managed by this camera manager. The
+ * group doesn't acquire the cameras, this is the responsibility of the caller.
+ * The cameras shall outlive the group.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The camera group, or nullptr if \a cameras is empty, contains
+ * duplicates or unknown cameras
+ */
+std::unique_ptr<CameraGroup>
+CameraManager::createGroup(const std::vector<std::shared_ptr<Camera>> &cameras)
+{
+	Private *const d = _d();
+
+	if (cameras.empty())
+		return nullptr;
+
+	MutexLocker locker(d->mutex_);
+
+	for (auto iter = cameras.begin(); iter != cameras.end(); ++iter) {
+		if (std::find(d->cameras_.begin(), d->cameras_.end(), *iter) ==
+		    d->cameras_.end()) {
+			LOG(Camera, Error) << "Camera group with unknown camera";
+			return nullptr;
+		}
+
+		if (std::find(cameras.begin(), iter, *iter) != iter) {
+			LOG(Camera, Error)
+				<< "Camera " << (*iter)->id()
+				<< " listed twice in camera group";
+			return nullptr;
+		}
+	}
+
+	return std::unique_ptr<CameraGroup>(new CameraGroup(cameras));
+}
+
 /**
  * \var CameraManager::cameraAdded
  * \brief Notify of a new camera added to the system
@@ -392,7 +676,9 @@ std::shared_ptr<Camera> CameraManager::get(const std::string &id)
  * connected to the system. When the signal is emitted the new camera is already
  * available from the list of cameras().
  *
- * The signal is emitted from the CameraManager thread. Applications shall
+ * The signal is emitted from the CameraManager thread, or from the thread of
+ * the pipeline handler of the camera when the LIBCAMERA_PIPELINE_THREADS
+ * environment variable is set. Applications shall
  * minimize the time spent in the signal handler and shall in particular not
  * perform any blocking operation.
  */
@@ -405,7 +691,9 @@ std::shared_ptr<Camera> CameraManager::get(const std::string &id)
  * signal is emitted the camera is not available from the list of cameras()
  * anymore.
  *
- * The signal is emitted from the CameraManager thread. Applications shall
+ * The signal is emitted from the CameraManager thread, or from the thread of
+ * the pipeline handler of the camera when the LIBCAMERA_PIPELINE_THREADS
+ * environment variable is set. Applications shall
  * minimize the time spent in the signal handler and shall in particular not
  * perform any blocking operation.
  */
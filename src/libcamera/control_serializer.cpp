@@ -7,7 +7,6 @@
 
 #include "libcamera/internal/control_serializer.h"
 
-#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -51,6 +50,11 @@ LOG_DEFINE_CATEGORY(Serializer)
  * recreates those ControlId instances and stores them in an internal cache,
  * from which the ControlInfoMap is populated.
  *
+ * Once a ControlInfoMap has been serialized or deserialized, both sides of
+ * the IPC boundary know it by its handle. Serializing it again, in either
+ * direction, only transfers a reference to the handle, without the contents
+ * of the map.
+ *
  * ControlList instances need to be associated with a ControlInfoMap when
  * deserialized. To make this possible, the control lists are serialized with a
  * handle to their ControlInfoMap, and the map is looked up from the handle at
@@ -137,6 +141,7 @@ void ControlSerializer::reset()
 	serial_ = serialSeed_;
 
 	infoMapHandles_.clear();
+	handleInfoMaps_.clear();
 	infoMaps_.clear();
 	controlIds_.clear();
 	controlIdMaps_.clear();
@@ -157,12 +162,17 @@ size_t ControlSerializer::binarySize(const ControlInfo &info)
  * \param[in] infoMap The control info map
  *
  * Compute and return the size in bytes required to store the serialized
- * ControlInfoMap.
+ * ControlInfoMap. If the \a infoMap has already been serialized or
+ * deserialized, only a reference to it will be stored, and the size of the
+ * packet header is returned.
  *
  * \return The size in bytes required to store the serialized ControlInfoMap
  */
-size_t ControlSerializer::binarySize(const ControlInfoMap &infoMap)
+size_t ControlSerializer::binarySize(const ControlInfoMap &infoMap) const
 {
+	if (isCached(infoMap))
+		return sizeof(struct ipa_controls_header);
+
 	size_t size = sizeof(struct ipa_controls_header)
 		    + infoMap.size() * sizeof(struct ipa_control_info_entry);
 
@@ -187,7 +197,7 @@ size_t ControlSerializer::binarySize(const ControlList &list)
 		    + list.size() * sizeof(struct ipa_control_value_entry);
 
 	for (const auto &ctrl : list)
-		size += binarySize(ctrl.second);
+		size += ctrl.second.data().size_bytes();
 
 	return size;
 }
@@ -218,16 +228,40 @@ void ControlSerializer::store(const ControlInfo &info, ByteStreamBuffer &buffer)
  * The serializer stores a reference to the \a infoMap internally. The caller
  * shall ensure that \a infoMap stays valid until the serializer is reset().
  *
+ * If the \a infoMap has already been serialized or deserialized, only a
+ * reference to its handle is stored in the \a buffer.
+ *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOSPC Not enough space is available in the buffer
  */
 int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 				 ByteStreamBuffer &buffer)
 {
-	if (isCached(infoMap)) {
+	const ControlIdMap *idmap = &infoMap.idmap();
+	enum ipa_controls_id_map_type idMapType;
+	if (idmap == &controls::controls)
+		idMapType = IPA_CONTROL_ID_MAP_CONTROLS;
+	else if (idmap == &properties::properties)
+		idMapType = IPA_CONTROL_ID_MAP_PROPERTIES;
+	else
+		idMapType = IPA_CONTROL_ID_MAP_V4L2;
+
+	auto cached = infoMapHandles_.find(&infoMap);
+	if (cached != infoMapHandles_.end()) {
 		LOG(Serializer, Debug)
-			<< "Skipping already serialized ControlInfoMap";
-		return 0;
+			<< "Referencing already serialized ControlInfoMap";
+
+		struct ipa_controls_header hdr = {};
+		hdr.version = IPA_CONTROLS_FORMAT_VERSION;
+		hdr.handle = cached->second;
+		hdr.size = sizeof(hdr);
+		hdr.data_offset = sizeof(hdr);
+		hdr.id_map_type = idMapType;
+		hdr.flags = IPA_CONTROLS_FLAG_CACHED;
+
+		buffer.write(&hdr);
+
+		return buffer.overflow() ? -ENOSPC : 0;
 	}
 
 	/* Compute entries and data required sizes. */
@@ -237,17 +271,8 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	for (const auto &ctrl : infoMap)
 		valuesSize += binarySize(ctrl.second);
 
-	const ControlIdMap *idmap = &infoMap.idmap();
-	enum ipa_controls_id_map_type idMapType;
-	if (idmap == &controls::controls)
-		idMapType = IPA_CONTROL_ID_MAP_CONTROLS;
-	else if (idmap == &properties::properties)
-		idMapType = IPA_CONTROL_ID_MAP_PROPERTIES;
-	else
-		idMapType = IPA_CONTROL_ID_MAP_V4L2;
-
 	/* Prepare the packet header. */
-	struct ipa_controls_header hdr;
+	struct ipa_controls_header hdr = {};
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
 	hdr.handle = serial_;
 	hdr.entries = infoMap.size();
@@ -294,6 +319,7 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	 * deserialize control lists.
 	 */
 	infoMapHandles_[&infoMap] = hdr.handle;
+	handleInfoMaps_[hdr.handle] = &infoMap;
 
 	return 0;
 }
@@ -340,39 +366,31 @@ int ControlSerializer::serialize(const ControlList &list,
 	else
 		idMapType = IPA_CONTROL_ID_MAP_V4L2;
 
-	size_t entriesSize = list.size() * sizeof(struct ipa_control_value_entry);
-	size_t valuesSize = 0;
-	for (const auto &ctrl : list)
-		valuesSize += binarySize(ctrl.second);
-
 	/* Prepare the packet header. */
-	struct ipa_controls_header hdr;
+	struct ipa_controls_header hdr = {};
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
 	hdr.handle = infoMapHandle;
 	hdr.entries = list.size();
-	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
-	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.size = binarySize(list);
+	hdr.data_offset = sizeof(hdr);
 	hdr.id_map_type = idMapType;
 
 	buffer.write(&hdr);
 
-	ByteStreamBuffer entries = buffer.carveOut(entriesSize);
-	ByteStreamBuffer values = buffer.carveOut(valuesSize);
-
-	/* Serialize all entries. */
-	for (const auto &ctrl : list) {
-		unsigned int id = ctrl.first;
-		const ControlValue &value = ctrl.second;
-
+	/*
+	 * Serialize all entries, each of them immediately followed by its
+	 * value data. The list is stored in ID order, which the deserializer
+	 * relies on to rebuild it efficiently.
+	 */
+	for (const auto &[id, value] : list) {
 		struct ipa_control_value_entry entry;
 		entry.id = id;
 		entry.type = value.type();
 		entry.is_array = value.isArray();
 		entry.count = value.numElements();
-		entry.offset = values.offset();
-		entries.write(&entry);
 
-		store(value, values);
+		buffer.write(&entry);
+		buffer.write(value.data());
 	}
 
 	if (buffer.overflow())
@@ -381,16 +399,14 @@ int ControlSerializer::serialize(const ControlList &list,
 	return 0;
 }
 
-ControlValue ControlSerializer::loadControlValue(ByteStreamBuffer &buffer,
-						 bool isArray,
-						 unsigned int count)
+ControlValue ControlSerializer::loadControlValue(ByteStreamBuffer &buffer)
 {
 	ControlType type;
 	buffer.read(&type);
 
 	ControlValue value;
 
-	value.reserve(type, isArray, count);
+	value.reserve(type);
 	buffer.read(value.data());
 
 	return value;
@@ -432,12 +448,6 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		return {};
 	}
 
-	auto iter = infoMaps_.find(hdr->handle);
-	if (iter != infoMaps_.end()) {
-		LOG(Serializer, Debug) << "Use cached ControlInfoMap";
-		return iter->second;
-	}
-
 	if (hdr->version != IPA_CONTROLS_FORMAT_VERSION) {
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
@@ -445,6 +455,23 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		return {};
 	}
 
+	/*
+	 * Look the handle up in all known maps, as a reference may point to a
+	 * map deserialized from or serialized to the other side.
+	 */
+	auto iter = handleInfoMaps_.find(hdr->handle);
+	if (iter != handleInfoMaps_.end()) {
+		LOG(Serializer, Debug) << "Use cached ControlInfoMap";
+		return *iter->second;
+	}
+
+	if (hdr->flags & IPA_CONTROLS_FLAG_CACHED) {
+		LOG(Serializer, Error)
+			<< "Reference to unknown ControlInfoMap "
+			<< hdr->handle;
+		return {};
+	}
+
 	/*
 	 * Use the ControlIdMap corresponding to the id map type. If the type
 	 * references a globally defined id map (such as controls::controls
@@ -523,6 +550,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 	infoMaps_[hdr->handle] = ControlInfoMap(std::move(ctrls), *idMap);
 	ControlInfoMap &map = infoMaps_[hdr->handle];
 	infoMapHandles_[&map] = hdr->handle;
+	handleInfoMaps_[hdr->handle] = &map;
 
 	return map;
 }
@@ -552,8 +580,8 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		return {};
 	}
 
-	ByteStreamBuffer entries = buffer.carveOut(hdr->data_offset - sizeof(*hdr));
-	ByteStreamBuffer values = buffer.carveOut(hdr->size - hdr->data_offset);
+	buffer.skip(hdr->data_offset - sizeof(*hdr));
+	ByteStreamBuffer entries = buffer.carveOut(hdr->size - hdr->data_offset);
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Out of data";
@@ -571,17 +599,14 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	 */
 	const ControlIdMap *idMap;
 	if (hdr->handle) {
-		auto iter = std::find_if(infoMapHandles_.begin(), infoMapHandles_.end(),
-					 [&](decltype(infoMapHandles_)::value_type &entry) {
-						 return entry.second == hdr->handle;
-					 });
-		if (iter == infoMapHandles_.end()) {
+		auto iter = handleInfoMaps_.find(hdr->handle);
+		if (iter == handleInfoMaps_.end()) {
 			LOG(Serializer, Error)
 				<< "Can't deserialize ControlList: unknown ControlInfoMap";
 			return {};
 		}
 
-		const ControlInfoMap *infoMap = iter->first;
+		const ControlInfoMap *infoMap = iter->second;
 		idMap = &infoMap->idmap();
 	} else {
 		switch (hdr->id_map_type) {
@@ -609,23 +634,39 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	 */
 	ControlList ctrls(*idMap);
 
+	ControlValue value;
+
 	for (unsigned int i = 0; i < hdr->entries; ++i) {
-		const struct ipa_control_value_entry *entry =
-			entries.read<decltype(*entry)>();
-		if (!entry) {
+		/*
+		 * Entries are not aligned, copy them instead of accessing them
+		 * in place.
+		 */
+		struct ipa_control_value_entry entry;
+		if (entries.read(&entry) < 0) {
 			LOG(Serializer, Error) << "Out of data";
 			return {};
 		}
 
-		if (entry->offset != values.offset()) {
+		if (entry.type > ControlTypeSize) {
 			LOG(Serializer, Error)
-				<< "Bad data, entry offset mismatch (entry "
-				<< i << ")";
+				<< "Bad data, invalid type (entry " << i << ")";
+			return {};
+		}
+
+		/*
+		 * Read the value data straight into the value storage. As the
+		 * entries are sorted by ID, the values are appended to the
+		 * list.
+		 */
+		value.reserve(static_cast<ControlType>(entry.type),
+			      entry.is_array, entry.count);
+		if (entries.read(value.data()) < 0) {
+			LOG(Serializer, Error)
+				<< "Out of data (entry " << i << ")";
 			return {};
 		}
 
-		ctrls.set(entry->id,
-			  loadControlValue(values, entry->is_array, entry->count));
+		ctrls.set(entry.id, value);
 	}
 
 	return ctrls;
@@ -640,7 +681,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
  *
  * \return True if \a infoMap is in the cache or false otherwise
  */
-bool ControlSerializer::isCached(const ControlInfoMap &infoMap)
+bool ControlSerializer::isCached(const ControlInfoMap &infoMap) const
 {
 	return infoMapHandles_.count(&infoMap);
 }
@@ -24,6 +24,11 @@ namespace libcamera {
  * controls.
  */
 
+/**
+ * \fn ControlValidator::ControlValidator()
+ * \brief Construct a ControlValidator
+ */
+
 /**
  * \fn ControlValidator::name()
  * \brief Retrieve the name of the object associated with the validator
@@ -42,4 +47,24 @@ namespace libcamera {
  * \return True if the control is valid, false otherwise
  */
 
+/**
+ * \fn ControlValidator::generation()
+ * \brief Retrieve the generation of the validator
+ *
+ * The ControlList class caches the result of the validation of the controls it
+ * stores, and only validates them again when the generation of the validator
+ * changes.
+ *
+ * \return The generation of the validator
+ */
+
+/**
+ * \fn ControlValidator::invalidate()
+ * \brief Invalidate the results of previous validations
+ *
+ * This function shall be called when the set of controls accepted by the
+ * validator changes, to increment the generation of the validator and force
+ * control lists to validate their controls again.
+ */
+
 } /* namespace libcamera */
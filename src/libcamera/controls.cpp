@@ -87,10 +87,14 @@ static constexpr size_t ControlValueSize[] = {
 /**
  * \class ControlValue
  * \brief Abstract type representing the value of a control
+ *
+ * Values of up to 40 bytes, such as rectangles, small arrays and 3x3 matrices,
+ * are stored inline in the ControlValue instance. Larger values are stored in
+ * memory allocated from the heap.
  */
 
 /** \todo Revisit the ControlValue layout when stabilizing the ABI */
-static_assert(sizeof(ControlValue) == 16, "Invalid size of ControlValue class");
+static_assert(sizeof(ControlValue) == 48, "Invalid size of ControlValue class");
 
 /**
  * \brief Construct an empty ControlValue.
@@ -137,6 +141,24 @@ ControlValue::ControlValue(const ControlValue &other)
 	*this = other;
 }
 
+/**
+ * \brief Construct a ControlValue by moving the content of \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The content of \a other is moved to the new ControlValue without copying
+ * the stored data, and \a other is left with no value (ControlTypeNone).
+ */
+ControlValue::ControlValue(ControlValue &&other) noexcept
+	: type_(other.type_), isArray_(other.isArray_),
+	  numElements_(other.numElements_)
+{
+	memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+}
+
 /**
  * \brief Replace the content of the ControlValue with a copy of the content
  * of \a other
@@ -150,6 +172,35 @@ ControlValue &ControlValue::operator=(const ControlValue &other)
 	return *this;
 }
 
+/**
+ * \brief Replace the content of the ControlValue by moving the content of
+ * \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The content of \a other is moved without copying the stored data, and \a
+ * other is left with no value (ControlTypeNone).
+ *
+ * \return The ControlValue with its content replaced with the one of \a other
+ */
+ControlValue &ControlValue::operator=(ControlValue &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+	memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+
+	return *this;
+}
+
 /**
  * \fn ControlValue::type()
  * \brief Retrieve the data type of the value
@@ -188,7 +239,7 @@ Span<const uint8_t> ControlValue::data() const
 	std::size_t size = numElements_ * ControlValueSize[type_];
 	const uint8_t *data = size > sizeof(value_)
 			    ? reinterpret_cast<const uint8_t *>(storage_)
-			    : reinterpret_cast<const uint8_t *>(&value_);
+			    : reinterpret_cast<const uint8_t *>(value_);
 	return { data, size };
 }
 
@@ -815,6 +866,19 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * Controls are stored in a flat array sorted by numerical ID, and iterating
+ * over a ControlList visits the controls in increasing ID order. The storage
+ * is retained when the list is cleared, so a list that is cleared and
+ * repopulated with the same controls, such as the controls and metadata of a
+ * reused Request, doesn't allocate memory for its entries. This includes the
+ * storage of values too large to be stored inline in a ControlValue, such as
+ * rectangles and arrays, as long as their size doesn't change.
+ *
+ * Controls are validated when they are added to the list. Setting the value of
+ * a control already stored in the list, or of a control removed by the last
+ * call to clear(), doesn't validate the control again, unless the validator
+ * has been invalidated since the control was added.
  */
 
 /**
@@ -824,7 +888,7 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * be used directly by application.
  */
 ControlList::ControlList()
-	: validator_(nullptr), idmap_(nullptr), infoMap_(nullptr)
+	: validator_(nullptr), generation_(0), idmap_(nullptr), infoMap_(nullptr)
 {
 }
 
@@ -839,7 +903,8 @@ ControlList::ControlList()
  */
 ControlList::ControlList(const ControlIdMap &idmap,
 			 const ControlValidator *validator)
-	: validator_(validator), idmap_(&idmap), infoMap_(nullptr)
+	: validator_(validator), generation_(validator ? validator->generation() : 0),
+	  idmap_(&idmap), infoMap_(nullptr)
 {
 }
 
@@ -850,10 +915,69 @@ ControlList::ControlList(const ControlIdMap &idmap,
  */
 ControlList::ControlList(const ControlInfoMap &infoMap,
 			 const ControlValidator *validator)
-	: validator_(validator), idmap_(&infoMap.idmap()), infoMap_(&infoMap)
+	: validator_(validator), generation_(validator ? validator->generation() : 0),
+	  idmap_(&infoMap.idmap()), infoMap_(&infoMap)
+{
+	/*
+	 * The list can't contain more controls than the info map, size it
+	 * upfront to avoid reallocating the storage when populating it.
+	 */
+	controls_.reserve(infoMap.size());
+}
+
+/**
+ * \brief Copy constructor, construct a ControlList as a copy of \a other
+ * \param[in] other The ControlList to copy
+ *
+ * Only the controls stored in \a other are copied, the storage retained by
+ * \a other for reuse after being cleared isn't.
+ */
+ControlList::ControlList(const ControlList &other)
+	: validator_(other.validator_), generation_(other.generation_),
+	  idmap_(other.idmap_), infoMap_(other.infoMap_),
+	  controls_(other.controls_)
 {
 }
 
+/**
+ * \fn ControlList::ControlList(ControlList &&other)
+ * \brief Move constructor, construct a ControlList by moving \a other
+ * \param[in] other The ControlList to move
+ */
+
+/**
+ * \brief Copy assignment operator, replace the content of the list with a
+ * copy of \a other
+ * \param[in] other The ControlList to copy
+ *
+ * Only the controls stored in \a other are copied, the storage retained by
+ * \a other for reuse after being cleared isn't.
+ *
+ * \return A reference to this ControlList
+ */
+ControlList &ControlList::operator=(const ControlList &other)
+{
+	/* The spare values have only been validated by the previous validator. */
+	if (validator_ != other.validator_ || generation_ != other.generation_)
+		spares_.clear();
+
+	validator_ = other.validator_;
+	generation_ = other.generation_;
+	idmap_ = other.idmap_;
+	infoMap_ = other.infoMap_;
+	controls_ = other.controls_;
+
+	return *this;
+}
+
+/**
+ * \fn ControlList &ControlList::operator=(ControlList &&other)
+ * \brief Move assignment operator, replace the content of the list with the
+ * content of \a other
+ * \param[in] other The ControlList to move
+ * \return A reference to this ControlList
+ */
+
 /**
  * \typedef ControlList::iterator
  * \brief Iterator for the controls contained within the list
@@ -903,9 +1027,45 @@ ControlList::ControlList(const ControlInfoMap &infoMap,
  */
 
 /**
- * \fn ControlList::clear()
+ * \brief Reserve storage for a number of controls
+ * \param[in] size The number of controls to reserve storage for
+ *
+ * This function preallocates storage for \a size controls, to avoid
+ * allocating memory when populating the list, for instance when a pipeline
+ * handler stages metadata in a request.
+ */
+void ControlList::reserve(std::size_t size)
+{
+	controls_.reserve(size);
+	spares_.reserve(size);
+}
+
+/**
  * \brief Removes all controls from the list
+ *
+ * The memory used to store the controls is retained, to be reused when
+ * controls are added to the list again. The values of the removed controls
+ * are kept aside until the next call to clear(), and their storage is reused
+ * when the same controls are set again.
  */
+void ControlList::clear()
+{
+	/*
+	 * Keep the removed values as spares, and drop the spares that have
+	 * not been reused since the previous call.
+	 */
+	std::swap(controls_, spares_);
+	controls_.clear();
+
+	/*
+	 * The spare values can't be reused without validating them again if
+	 * the controls accepted by the validator have changed.
+	 */
+	if (!validated()) {
+		spares_.clear();
+		generation_ = validator_->generation();
+	}
+}
 
 /**
  * \enum ControlList::MergePolicy
@@ -931,9 +1091,6 @@ ControlList::ControlList(const ControlInfoMap &infoMap,
  *
  * Only control lists created from the same ControlIdMap or ControlInfoMap may
  * be merged. Attempting to do otherwise results in undefined behaviour.
- *
- * \todo Reimplement or implement an overloaded version which internally uses
- * std::unordered_map::merge() and accepts a non-const argument.
  */
 void ControlList::merge(const ControlList &source, MergePolicy policy)
 {
@@ -969,7 +1126,7 @@ void ControlList::merge(const ControlList &source, MergePolicy policy)
  */
 bool ControlList::contains(unsigned int id) const
 {
-	return controls_.find(id) != controls_.end();
+	return lookup(id) != controls_.end();
 }
 
 /**
@@ -1066,7 +1223,7 @@ void ControlList::set(unsigned int id, const ControlValue &value)
 
 const ControlValue *ControlList::find(unsigned int id) const
 {
-	const auto iter = controls_.find(id);
+	const auto iter = lookup(id);
 	if (iter == controls_.end()) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id) << " not found";
@@ -1079,14 +1236,56 @@ const ControlValue *ControlList::find(unsigned int id) const
 
 ControlValue *ControlList::find(unsigned int id)
 {
-	if (validator_ && !validator_->validate(id)) {
-		LOG(Controls, Error)
-			<< "Control " << utils::hex(id)
-			<< " is not valid for " << validator_->name();
+	/*
+	 * The controls stored in the list and the spare values have been
+	 * validated when first added. Skip the validation for them unless the
+	 * controls accepted by the validator have changed since then.
+	 */
+	bool trusted = validated();
+	if (!trusted && !validate(id))
 		return nullptr;
+
+	auto iter = std::lower_bound(controls_.begin(), controls_.end(), id,
+				     [](const auto &entry, unsigned int key) {
+					     return entry.first < key;
+				     });
+	if (iter != controls_.end() && iter->first == id)
+		return &iter->second;
+
+	/*
+	 * Reuse the value storage of the control if it has been removed by
+	 * the last call to clear().
+	 */
+	auto spare = std::lower_bound(spares_.begin(), spares_.end(), id,
+				      [](const auto &entry, unsigned int key) {
+					      return entry.first < key;
+				      });
+	if (spare != spares_.end() && spare->first == id) {
+		iter = controls_.emplace(iter, id, std::move(spare->second));
+	} else {
+		if (trusted && !validate(id))
+			return nullptr;
+
+		iter = controls_.emplace(iter, id, ControlValue{});
 	}
 
-	return &controls_[id];
+	return &iter->second;
+}
+
+bool ControlList::validate(unsigned int id) const
+{
+	if (!validator_ || validator_->validate(id))
+		return true;
+
+	LOG(Controls, Error)
+		<< "Control " << utils::hex(id)
+		<< " is not valid for " << validator_->name();
+	return false;
+}
+
+bool ControlList::validated() const
+{
+	return !validator_ || validator_->generation() == generation_;
 }
 
 } /* namespace libcamera */
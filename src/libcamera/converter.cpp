@@ -40,9 +40,14 @@ LOG_DEFINE_CATEGORY(Converter)
  *
  * This searches for the entity implementing the data streaming function in the
  * media graph entities and use its device node as the converter device node.
+ * Converters implemented in software are not backed by a media device, and
+ * pass a null \a media, in which case the device node is empty.
  */
 Converter::Converter(MediaDevice *media)
 {
+	if (!media)
+		return;
+
 	const std::vector<MediaEntity *> &entities = media->entities();
 	auto it = std::find_if(entities.begin(), entities.end(),
 			       [](MediaEntity *entity) {
@@ -122,6 +127,11 @@ Converter::~Converter()
  * otherwise
  */
 
+/**
+ * \typedef Converter::OutputBuffers
+ * \brief A map of output stream indexes to FrameBuffer pointers
+ */
+
 /**
  * \fn Converter::start()
  * \brief Start the converter streaming operation
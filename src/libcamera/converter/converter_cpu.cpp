@@ -0,0 +1,1144 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * CPU based format converter
+ */
+
+#include "libcamera/internal/converter/converter_cpu.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/color_space.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+/**
+ * \file internal/converter/converter_cpu.h
+ * \brief CPU based converter
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Converter)
+
+namespace {
+
+/* Indices in the YCbCr to RGB coefficients array */
+enum RgbCoefficient {
+	YOffset,
+	YGain,
+	CrR,
+	CbG,
+	CrG,
+	CbB,
+};
+
+/*
+ * Scalar kernels. They serve as the reference implementation, and process the
+ * pixels that don't fill a full vector in the SIMD kernels.
+ */
+
+void blendScalar(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+		 unsigned int weight, unsigned int count)
+{
+	for (unsigned int x = 0; x < count; x++)
+		dst[x] = (src0[x] * (256 - weight) + src1[x] * weight + 128) >> 8;
+}
+
+void splitScalar(uint8_t *even, uint8_t *odd, const uint8_t *src, unsigned int count)
+{
+	for (unsigned int x = 0; x < count; x++) {
+		even[x] = src[2 * x];
+		odd[x] = src[2 * x + 1];
+	}
+}
+
+void mergeScalar(uint8_t *dst, const uint8_t *even, const uint8_t *odd, unsigned int count)
+{
+	for (unsigned int x = 0; x < count; x++) {
+		dst[2 * x] = even[x];
+		dst[2 * x + 1] = odd[x];
+	}
+}
+
+/*
+ * Convert YUV 4:2:2 to planar RGB. The conversion uses 16-bit fixed-point
+ * arithmetic with 6 fractional bits, which the SIMD kernels replicate exactly.
+ */
+void yuvToRgbScalar(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *y,
+		    const uint8_t *u, const uint8_t *v, unsigned int count,
+		    const int16_t *coeffs)
+{
+	auto narrow = [](int value) {
+		return static_cast<uint8_t>(std::clamp((value + 32) >> 6, 0, 255));
+	};
+
+	for (unsigned int x = 0; x < count; x++) {
+		const int yv = (y[x] - coeffs[YOffset]) * coeffs[YGain];
+		const int cb = u[x / 2] - 128;
+		const int cr = v[x / 2] - 128;
+
+		r[x] = narrow(yv + cr * coeffs[CrR]);
+		g[x] = narrow(yv - cb * coeffs[CbG] - cr * coeffs[CrG]);
+		b[x] = narrow(yv + cb * coeffs[CbB]);
+	}
+}
+
+/* Interleave planar RGB to a packed RGB format with a constant alpha channel */
+template<unsigned int bpp, unsigned int rOffset, unsigned int bOffset>
+void packRgb(uint8_t *dst, const uint8_t *r, const uint8_t *g, const uint8_t *b,
+	     unsigned int count)
+{
+	for (unsigned int x = 0; x < count; x++) {
+		dst[rOffset] = r[x];
+		dst[1] = g[x];
+		dst[bOffset] = b[x];
+		if constexpr (bpp == 4)
+			dst[3] = 0xff;
+		dst += bpp;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define CONVERTER_TARGET_SSE2 __attribute__((target("sse2")))
+
+CONVERTER_TARGET_SSE2
+void blendSse2(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+	       unsigned int weight, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w0 = _mm_set1_epi16(256 - weight);
+	const __m128i w1 = _mm_set1_epi16(weight);
+	const __m128i round = _mm_set1_epi16(128);
+	unsigned int x = 0;
+
+	/* The sums fit in unsigned 16-bit integers */
+	for (; x + 16 <= count; x += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src0 + x));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src1 + x));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+					   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+					   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(lo, hi));
+	}
+
+	blendScalar(dst + x, src0 + x, src1 + x, weight, count - x);
+}
+
+CONVERTER_TARGET_SSE2
+void splitSse2(uint8_t *even, uint8_t *odd, const uint8_t *src, unsigned int count)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * x));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * x + 16));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(even + x),
+				 _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(odd + x),
+				 _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+
+	splitScalar(even + x, odd + x, src + 2 * x, count - x);
+}
+
+CONVERTER_TARGET_SSE2
+void mergeSse2(uint8_t *dst, const uint8_t *even, const uint8_t *odd, unsigned int count)
+{
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(even + x));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(odd + x));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * x),
+				 _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * x + 16),
+				 _mm_unpackhi_epi8(a, b));
+	}
+
+	mergeScalar(dst + 2 * x, even + x, odd + x, count - x);
+}
+
+/* Convert 8 pixels, with all values widened to 16 bits */
+CONVERTER_TARGET_SSE2
+inline void yuvToRgbSse2(__m128i y, __m128i cb, __m128i cr, const __m128i coeffs[6],
+			 __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i round = _mm_set1_epi16(32);
+	const __m128i yv = _mm_mullo_epi16(_mm_sub_epi16(y, coeffs[YOffset]), coeffs[YGain]);
+
+	*r = _mm_adds_epi16(yv, _mm_mullo_epi16(cr, coeffs[CrR]));
+	*g = _mm_subs_epi16(_mm_subs_epi16(yv, _mm_mullo_epi16(cb, coeffs[CbG])),
+			    _mm_mullo_epi16(cr, coeffs[CrG]));
+	*b = _mm_adds_epi16(yv, _mm_mullo_epi16(cb, coeffs[CbB]));
+
+	*r = _mm_srai_epi16(_mm_adds_epi16(*r, round), 6);
+	*g = _mm_srai_epi16(_mm_adds_epi16(*g, round), 6);
+	*b = _mm_srai_epi16(_mm_adds_epi16(*b, round), 6);
+}
+
+CONVERTER_TARGET_SSE2
+void yuvToRgbSse2(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *y,
+		  const uint8_t *u, const uint8_t *v, unsigned int count,
+		  const int16_t *coeffs)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i offset = _mm_set1_epi16(128);
+	const __m128i c[6] = {
+		_mm_set1_epi16(coeffs[YOffset]), _mm_set1_epi16(coeffs[YGain]),
+		_mm_set1_epi16(coeffs[CrR]), _mm_set1_epi16(coeffs[CbG]),
+		_mm_set1_epi16(coeffs[CrG]), _mm_set1_epi16(coeffs[CbB]),
+	};
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		const __m128i yy = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+		__m128i uu = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(u + x / 2));
+		__m128i vv = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v + x / 2));
+
+		/* Duplicate the chroma samples for the two pixels they cover */
+		uu = _mm_unpacklo_epi8(uu, uu);
+		vv = _mm_unpacklo_epi8(vv, vv);
+
+		__m128i rlo, glo, blo, rhi, ghi, bhi;
+
+		yuvToRgbSse2(_mm_unpacklo_epi8(yy, zero),
+			     _mm_sub_epi16(_mm_unpacklo_epi8(uu, zero), offset),
+			     _mm_sub_epi16(_mm_unpacklo_epi8(vv, zero), offset),
+			     c, &rlo, &glo, &blo);
+		yuvToRgbSse2(_mm_unpackhi_epi8(yy, zero),
+			     _mm_sub_epi16(_mm_unpackhi_epi8(uu, zero), offset),
+			     _mm_sub_epi16(_mm_unpackhi_epi8(vv, zero), offset),
+			     c, &rhi, &ghi, &bhi);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r + x), _mm_packus_epi16(rlo, rhi));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(g + x), _mm_packus_epi16(glo, ghi));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(b + x), _mm_packus_epi16(blo, bhi));
+	}
+
+	yuvToRgbScalar(r + x, g + x, b + x, y + x, u + x / 2, v + x / 2,
+		       count - x, coeffs);
+}
+
+#undef CONVERTER_TARGET_SSE2
+
+#elif defined(__ARM_NEON)
+
+void blendNeon(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+	       unsigned int weight, unsigned int count)
+{
+	/* The weights fit in 8 bits as the caller never blends with 0 or 256 */
+	const uint8x8_t w0 = vdup_n_u8(256 - weight);
+	const uint8x8_t w1 = vdup_n_u8(weight);
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		const uint8x16_t a = vld1q_u8(src0 + x);
+		const uint8x16_t b = vld1q_u8(src1 + x);
+
+		uint16x8_t lo = vmull_u8(vget_low_u8(a), w0);
+		uint16x8_t hi = vmull_u8(vget_high_u8(a), w0);
+		lo = vmlal_u8(lo, vget_low_u8(b), w1);
+		hi = vmlal_u8(hi, vget_high_u8(b), w1);
+
+		vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+	}
+
+	blendScalar(dst + x, src0 + x, src1 + x, weight, count - x);
+}
+
+void splitNeon(uint8_t *even, uint8_t *odd, const uint8_t *src, unsigned int count)
+{
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		const uint8x16x2_t v = vld2q_u8(src + 2 * x);
+
+		vst1q_u8(even + x, v.val[0]);
+		vst1q_u8(odd + x, v.val[1]);
+	}
+
+	splitScalar(even + x, odd + x, src + 2 * x, count - x);
+}
+
+void mergeNeon(uint8_t *dst, const uint8_t *even, const uint8_t *odd, unsigned int count)
+{
+	unsigned int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		uint8x16x2_t v;
+		v.val[0] = vld1q_u8(even + x);
+		v.val[1] = vld1q_u8(odd + x);
+
+		vst2q_u8(dst + 2 * x, v);
+	}
+
+	mergeScalar(dst + 2 * x, even + x, odd + x, count - x);
+}
+
+/* Convert 8 pixels, with all values widened to 16 bits */
+inline void yuvToRgbNeon(int16x8_t y, int16x8_t cb, int16x8_t cr, const int16_t *coeffs,
+			 uint8x8_t *r, uint8x8_t *g, uint8x8_t *b)
+{
+	const int16x8_t yv = vmulq_n_s16(vsubq_s16(y, vdupq_n_s16(coeffs[YOffset])),
+					 coeffs[YGain]);
+
+	const int16x8_t rv = vqaddq_s16(yv, vmulq_n_s16(cr, coeffs[CrR]));
+	const int16x8_t gv = vqsubq_s16(vqsubq_s16(yv, vmulq_n_s16(cb, coeffs[CbG])),
+					vmulq_n_s16(cr, coeffs[CrG]));
+	const int16x8_t bv = vqaddq_s16(yv, vmulq_n_s16(cb, coeffs[CbB]));
+
+	*r = vqrshrun_n_s16(rv, 6);
+	*g = vqrshrun_n_s16(gv, 6);
+	*b = vqrshrun_n_s16(bv, 6);
+}
+
+void yuvToRgbNeon(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *y,
+		  const uint8_t *u, const uint8_t *v, unsigned int count,
+		  const int16_t *coeffs)
+{
+	const int16x8_t offset = vdupq_n_s16(128);
+	unsigned int x = 0;
+
+	auto widen = [](uint8x8_t value) {
+		return vreinterpretq_s16_u16(vmovl_u8(value));
+	};
+
+	for (; x + 16 <= count; x += 16) {
+		const uint8x16_t yy = vld1q_u8(y + x);
+
+		/* Duplicate the chroma samples for the two pixels they cover */
+		const uint8x8x2_t uu = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+		const uint8x8x2_t vv = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+
+		uint8x8_t rlo, glo, blo, rhi, ghi, bhi;
+
+		yuvToRgbNeon(widen(vget_low_u8(yy)),
+			     vsubq_s16(widen(uu.val[0]), offset),
+			     vsubq_s16(widen(vv.val[0]), offset),
+			     coeffs, &rlo, &glo, &blo);
+		yuvToRgbNeon(widen(vget_high_u8(yy)),
+			     vsubq_s16(widen(uu.val[1]), offset),
+			     vsubq_s16(widen(vv.val[1]), offset),
+			     coeffs, &rhi, &ghi, &bhi);
+
+		vst1q_u8(r + x, vcombine_u8(rlo, rhi));
+		vst1q_u8(g + x, vcombine_u8(glo, ghi));
+		vst1q_u8(b + x, vcombine_u8(blo, bhi));
+	}
+
+	yuvToRgbScalar(r + x, g + x, b + x, y + x, u + x / 2, v + x / 2,
+		       count - x, coeffs);
+}
+
+#endif
+
+/*
+ * Retrieve the planes of a mapped frame buffer. Semi-planar formats may store
+ * their two planes in a single memory plane, in which case the chroma plane
+ * immediately follows the luma plane.
+ */
+template<typename T>
+bool framePlanes(MappedFrameBuffer &mapped, unsigned int numPlanes, unsigned int stride,
+		 unsigned int height, unsigned int frameSize, T *planes[2])
+{
+	const std::vector<Span<uint8_t>> &spans = mapped.planes();
+
+	planes[0] = spans[0].data();
+	planes[1] = nullptr;
+
+	if (numPlanes == 1)
+		return spans[0].size() >= frameSize;
+
+	if (spans.size() >= 2) {
+		planes[1] = spans[1].data();
+		return true;
+	}
+
+	if (spans[0].size() < frameSize)
+		return false;
+
+	planes[1] = spans[0].data() + stride * height;
+	return true;
+}
+
+} /* namespace */
+
+/**
+ * \class libcamera::CpuConverter
+ * \brief Converter implementation running on the CPU
+ *
+ * The CpuConverter implements the converter interface in software, for
+ * platforms that have no memory-to-memory hardware scaler. It scales YUV
+ * frames with bilinear interpolation and converts them to YUV or RGB output
+ * formats, for up to kMaxOutputs output streams.
+ *
+ * Conversion is performed line by line: each output line is interpolated
+ * vertically from the two nearest input lines, unpacked to YUV 4:2:2 planar
+ * form, then interpolated horizontally and packed to the output format. The
+ * vertical interpolation, the unpacking and packing, and the YUV to RGB
+ * conversion use SSE2 or NEON instructions when available. The horizontal
+ * interpolation uses precomputed steps and is scalar.
+ *
+ * Frames are processed in a dedicated thread, to avoid blocking the pipeline
+ * handler thread, and split in horizontal stripes that are converted
+ * concurrently by a pool of worker threads. Completion of the input and output
+ * buffers is signalled in the thread the converter is bound to.
+ */
+
+/**
+ * \var CpuConverter::kMaxOutputs
+ * \brief The maximum number of output streams
+ */
+
+/*
+ * Convert a complete frame in the converter thread, then signal completion to
+ * the converter in its own thread.
+ */
+class CpuConverter::Processor : public Object
+{
+public:
+	Processor(CpuConverter *converter)
+		: converter_(converter)
+	{
+	}
+
+	void process(FrameBuffer *input, OutputBuffers outputs)
+	{
+		converter_->processFrame(input, outputs);
+
+		{
+			MutexLocker locker(converter_->mutex_);
+			converter_->completed_.emplace_back(input, std::move(outputs));
+		}
+
+		converter_->invokeMethod(&CpuConverter::frameDone, ConnectionTypeQueued);
+	}
+
+	void sync()
+	{
+	}
+
+private:
+	CpuConverter *converter_;
+};
+
+/* Convert one stripe of a frame in a worker thread */
+class CpuConverter::StripeWorker : public Object
+{
+public:
+	StripeWorker(CpuConverter *converter)
+		: converter_(converter)
+	{
+	}
+
+	void process(Output *output, unsigned int index, Frame frame)
+	{
+		converter_->processStripe(*output, output->stripes[index], frame);
+		converter_->stripesDone_.release();
+	}
+
+private:
+	CpuConverter *converter_;
+};
+
+struct CpuConverter::Kernels {
+	const char *name;
+	void (*blend)(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+		      unsigned int weight, unsigned int count);
+	void (*split)(uint8_t *even, uint8_t *odd, const uint8_t *src, unsigned int count);
+	void (*merge)(uint8_t *dst, const uint8_t *even, const uint8_t *odd, unsigned int count);
+	void (*yuvToRgb)(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *y,
+			 const uint8_t *u, const uint8_t *v, unsigned int count,
+			 const int16_t *coeffs);
+};
+
+struct CpuConverter::YuvFormat {
+	PixelFormat format;
+	/* Packed 4:2:2 if true, semi-planar otherwise */
+	bool packed;
+	/* Packed formats: luma is stored in the even bytes */
+	bool lumaFirst;
+	/* Cr is stored before Cb */
+	bool swapUV;
+	/* Semi-planar formats: chroma is subsampled vertically */
+	bool chroma420;
+};
+
+struct CpuConverter::RgbFormat {
+	PixelFormat format;
+	void (*pack)(uint8_t *dst, const uint8_t *r, const uint8_t *g, const uint8_t *b,
+		     unsigned int count);
+};
+
+/**
+ * \brief Construct a CpuConverter instance
+ */
+CpuConverter::CpuConverter()
+	: Converter(nullptr),
+	  dmaBufAllocator_(DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
+			   DmaBufAllocator::DmaBufAllocatorFlag::SystemHeap |
+			   DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf),
+	  inputFormat_(nullptr), inputStride_(0), inputFrameSize_(0),
+	  rgbCoefficients_{},
+	  thread_("cpu-converter"), stopping_(false)
+{
+	kernels_ = selectKernels();
+
+	/* Account for the output buffers in the limit shared by all cameras. */
+	dmaBufAllocator_.useSharedPool();
+
+	processor_ = std::make_unique<Processor>(this);
+	processor_->moveToThread(&thread_);
+
+	/* The converter thread processes one stripe, workers the other ones. */
+	const unsigned int stripes = std::clamp(std::thread::hardware_concurrency(), 1U, 4U);
+
+	for (unsigned int i = 1; i < stripes; i++) {
+		std::unique_ptr<Thread> thread = std::make_unique<Thread>("cpu-converter");
+		std::unique_ptr<StripeWorker> worker = std::make_unique<StripeWorker>(this);
+
+		worker->moveToThread(thread.get());
+
+		workerThreads_.push_back(std::move(thread));
+		workers_.push_back(std::move(worker));
+	}
+
+	LOG(Converter, Debug)
+		<< "CPU converter using " << kernels_->name << " kernels and "
+		<< stripes << " stripes";
+}
+
+CpuConverter::~CpuConverter()
+{
+	stop();
+}
+
+const CpuConverter::Kernels *CpuConverter::selectKernels()
+{
+	static const Kernels scalarKernels = {
+		"scalar", blendScalar, splitScalar, mergeScalar, yuvToRgbScalar,
+	};
+
+#if defined(__x86_64__) || defined(__i386__)
+	static const Kernels sse2Kernels = {
+		"SSE2", blendSse2, splitSse2, mergeSse2, yuvToRgbSse2,
+	};
+
+	if (__builtin_cpu_supports("sse2"))
+		return &sse2Kernels;
+#elif defined(__ARM_NEON)
+	static const Kernels neonKernels = {
+		"NEON", blendNeon, splitNeon, mergeNeon, yuvToRgbNeon,
+	};
+
+	return &neonKernels;
+#endif
+
+	return &scalarKernels;
+}
+
+Span<const CpuConverter::YuvFormat> CpuConverter::yuvFormats()
+{
+	static const YuvFormat formats[] = {
+		{ formats::YUYV, true, true, false, false },
+		{ formats::YVYU, true, true, true, false },
+		{ formats::UYVY, true, false, false, false },
+		{ formats::VYUY, true, false, true, false },
+		{ formats::NV12, false, true, false, true },
+		{ formats::NV21, false, true, true, true },
+		{ formats::NV16, false, true, false, false },
+		{ formats::NV61, false, true, true, false },
+	};
+
+	return formats;
+}
+
+Span<const CpuConverter::RgbFormat> CpuConverter::rgbFormats()
+{
+	/* Byte order in memory is the reverse of the DRM format names. */
+	static const RgbFormat formats[] = {
+		{ formats::RGB888, packRgb<3, 2, 0> },
+		{ formats::BGR888, packRgb<3, 0, 2> },
+		{ formats::XRGB8888, packRgb<4, 2, 0> },
+		{ formats::XBGR8888, packRgb<4, 0, 2> },
+		{ formats::ARGB8888, packRgb<4, 2, 0> },
+		{ formats::ABGR8888, packRgb<4, 0, 2> },
+	};
+
+	return formats;
+}
+
+const CpuConverter::YuvFormat *CpuConverter::yuvFormat(const PixelFormat &format)
+{
+	for (const YuvFormat &yuv : yuvFormats()) {
+		if (yuv.format == format)
+			return &yuv;
+	}
+
+	return nullptr;
+}
+
+const CpuConverter::RgbFormat *CpuConverter::rgbFormat(const PixelFormat &format)
+{
+	for (const RgbFormat &rgb : rgbFormats()) {
+		if (rgb.format == format)
+			return &rgb;
+	}
+
+	return nullptr;
+}
+
+/*
+ * Compute the bilinear interpolation steps to scale \a input samples to
+ * \a output samples, aligning the centres of the first and last samples. The
+ * weight of the second sample is expressed in 1/256 units, and the index never
+ * points to the last input sample to avoid reading past the end of lines.
+ */
+std::vector<CpuConverter::ScaleStep>
+CpuConverter::scaleSteps(unsigned int input, unsigned int output)
+{
+	std::vector<ScaleStep> steps(output);
+
+	for (unsigned int i = 0; i < output; i++) {
+		int64_t pos = (static_cast<int64_t>(2 * i + 1) * input * 256) / (2 * output) - 128;
+		pos = std::clamp<int64_t>(pos, 0, (input - 1) * 256);
+
+		ScaleStep &step = steps[i];
+		step.index = pos >> 8;
+		step.weight = pos & 0xff;
+
+		if (step.index == input - 1) {
+			step.index = input - 2;
+			step.weight = 256;
+		}
+	}
+
+	return steps;
+}
+
+/**
+ * \copydoc libcamera::Converter::formats
+ */
+std::vector<PixelFormat> CpuConverter::formats(PixelFormat input)
+{
+	if (!yuvFormat(input))
+		return {};
+
+	std::vector<PixelFormat> pixelFormats;
+
+	for (const YuvFormat &yuv : yuvFormats())
+		pixelFormats.push_back(yuv.format);
+	for (const RgbFormat &rgb : rgbFormats())
+		pixelFormats.push_back(rgb.format);
+
+	return pixelFormats;
+}
+
+/**
+ * \copydoc libcamera::Converter::sizes
+ *
+ * The CpuConverter downscales by up to 16 times, and doesn't upscale. Output
+ * sizes are aligned to 2 pixels horizontally and vertically for chroma
+ * subsampling.
+ */
+SizeRange CpuConverter::sizes(const Size &input)
+{
+	const Size max = input.alignedDownTo(2, 2);
+	const Size min = Size(std::max(max.width / 16, 16U),
+			      std::max(max.height / 16, 16U)).alignedUpTo(2, 2);
+
+	if (max.width < min.width || max.height < min.height)
+		return {};
+
+	return SizeRange(min, max, 2, 2);
+}
+
+/**
+ * \copydoc libcamera::Converter::strideAndFrameSize
+ */
+std::tuple<unsigned int, unsigned int>
+CpuConverter::strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size)
+{
+	if (!yuvFormat(pixelFormat) && !rgbFormat(pixelFormat))
+		return std::make_tuple(0, 0);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+
+	return std::make_tuple(info.stride(size.width, 0, 1),
+			       info.frameSize(size, 1));
+}
+
+int CpuConverter::configureOutput(Output *output, const StreamConfiguration &cfg)
+{
+	output->yuv = yuvFormat(cfg.pixelFormat);
+	output->rgb = rgbFormat(cfg.pixelFormat);
+
+	if (!output->yuv && !output->rgb) {
+		LOG(Converter, Error)
+			<< "Unsupported output format " << cfg.pixelFormat;
+		return -EINVAL;
+	}
+
+	if (!sizes(inputSize_).contains(cfg.size)) {
+		LOG(Converter, Error)
+			<< "Unsupported output size " << cfg.size;
+		return -EINVAL;
+	}
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+
+	output->pixelFormat = cfg.pixelFormat;
+	output->size = cfg.size;
+	std::tie(output->stride, output->frameSize) =
+		strideAndFrameSize(cfg.pixelFormat, cfg.size);
+
+	output->planeSizes.clear();
+	for (unsigned int i = 0; i < info.numPlanes(); i++)
+		output->planeSizes.push_back(info.planeSize(cfg.size, i, 1));
+
+	output->lineSteps = scaleSteps(inputSize_.height, cfg.size.height);
+	output->lumaSteps = scaleSteps(inputSize_.width, cfg.size.width);
+	output->chromaSteps = scaleSteps(inputSize_.width / 2, cfg.size.width / 2);
+
+	/*
+	 * Split the frame in stripes of (nearly) equal height, aligned to 2
+	 * lines for vertical chroma subsampling.
+	 */
+	const unsigned int pairs = cfg.size.height / 2;
+	const unsigned int count = std::min<unsigned int>(workers_.size() + 1, pairs);
+	unsigned int y = 0;
+
+	output->stripes.resize(count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		Stripe &stripe = output->stripes[i];
+
+		stripe.begin = y;
+		stripe.end = y + (pairs / count + (i < pairs % count)) * 2;
+		y = stripe.end;
+
+		for (LineBuffer &line : stripe.lines) {
+			line.y.resize(inputSize_.width);
+			line.u.resize(inputSize_.width / 2);
+			line.v.resize(inputSize_.width / 2);
+			line.packed.resize(inputSize_.width);
+		}
+
+		stripe.blended[0].resize(inputSize_.width);
+		stripe.blended[1].resize(inputSize_.width / 2);
+		stripe.blended[2].resize(inputSize_.width / 2);
+
+		stripe.scaled[0].resize(cfg.size.width);
+		stripe.scaled[1].resize(cfg.size.width / 2);
+		stripe.scaled[2].resize(cfg.size.width / 2);
+
+		for (std::vector<uint8_t> &scratch : stripe.scratch)
+			scratch.resize(cfg.size.width);
+	}
+
+	return 0;
+}
+
+/**
+ * \copydoc libcamera::Converter::configure
+ */
+int CpuConverter::configure(const StreamConfiguration &inputCfg,
+			    const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	inputFormat_ = yuvFormat(inputCfg.pixelFormat);
+	if (!inputFormat_) {
+		LOG(Converter, Error)
+			<< "Unsupported input format " << inputCfg.pixelFormat;
+		return -EINVAL;
+	}
+
+	if (outputCfgs.empty() || outputCfgs.size() > kMaxOutputs)
+		return -EINVAL;
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(inputCfg.pixelFormat);
+
+	inputSize_ = inputCfg.size;
+	inputStride_ = inputCfg.stride;
+	inputFrameSize_ = info.frameSize(inputSize_, { inputStride_, inputStride_, 0 });
+
+	/*
+	 * Select the YCbCr to RGB coefficients, with 6 fractional bits,
+	 * defaulting to limited range BT.601 when the input colour space is
+	 * unknown.
+	 */
+	const bool fullRange = inputCfg.colorSpace &&
+			       inputCfg.colorSpace->range == ColorSpace::Range::Full;
+	const bool rec709 = inputCfg.colorSpace &&
+			    inputCfg.colorSpace->ycbcrEncoding == ColorSpace::YcbcrEncoding::Rec709;
+
+	if (fullRange)
+		rgbCoefficients_ = rec709 ? std::array<int16_t, 6>{ 0, 64, 101, 12, 30, 119 }
+					  : std::array<int16_t, 6>{ 0, 64, 90, 22, 46, 113 };
+	else
+		rgbCoefficients_ = rec709 ? std::array<int16_t, 6>{ 16, 75, 115, 14, 34, 135 }
+					  : std::array<int16_t, 6>{ 16, 75, 102, 25, 52, 129 };
+
+	outputs_.resize(outputCfgs.size());
+
+	for (unsigned int i = 0; i < outputCfgs.size(); i++) {
+		int ret = configureOutput(&outputs_[i], outputCfgs[i]);
+		if (ret < 0) {
+			outputs_.clear();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \copydoc libcamera::Converter::exportBuffers
+ */
+int CpuConverter::exportBuffers(unsigned int output, unsigned int count,
+				std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output >= outputs_.size())
+		return -EINVAL;
+
+	return dmaBufAllocator_.exportBuffers(count, outputs_[output].planeSizes,
+					      buffers);
+}
+
+/**
+ * \copydoc libcamera::Converter::start
+ */
+int CpuConverter::start()
+{
+	stopping_ = false;
+
+	thread_.start();
+	for (std::unique_ptr<Thread> &thread : workerThreads_)
+		thread->start();
+
+	return 0;
+}
+
+/**
+ * \copydoc libcamera::Converter::stop
+ *
+ * Frames that haven't been converted yet are completed with their output
+ * buffers marked as cancelled.
+ */
+void CpuConverter::stop()
+{
+	if (!thread_.isRunning())
+		return;
+
+	/* Wait for the queued frames to be processed, or skipped. */
+	stopping_ = true;
+	processor_->invokeMethod(&Processor::sync, ConnectionTypeBlocking);
+
+	thread_.exit();
+	thread_.wait();
+
+	for (std::unique_ptr<Thread> &thread : workerThreads_) {
+		thread->exit();
+		thread->wait();
+	}
+
+	/*
+	 * Complete the frames synchronously, the buffers may be freed as soon
+	 * as this function returns.
+	 */
+	frameDone();
+}
+
+/**
+ * \copydoc libcamera::Converter::queueBuffers
+ */
+int CpuConverter::queueBuffers(FrameBuffer *input, const OutputBuffers &outputs)
+{
+	unsigned int mask = 0;
+
+	/*
+	 * Validate the outputs as a sanity check: at least one output is
+	 * required, all outputs must reference a valid stream and no two
+	 * outputs can reference the same stream.
+	 */
+	if (outputs.empty())
+		return -EINVAL;
+
+	for (auto [index, buffer] : outputs) {
+		if (!buffer)
+			return -EINVAL;
+		if (index >= outputs_.size())
+			return -EINVAL;
+		if (mask & (1 << index))
+			return -EINVAL;
+
+		mask |= 1 << index;
+	}
+
+	processor_->invokeMethod(&Processor::process, ConnectionTypeQueued,
+				 input, outputs);
+
+	return 0;
+}
+
+/* Called in the converter thread */
+void CpuConverter::processFrame(FrameBuffer *input, const OutputBuffers &outputs)
+{
+	const FrameMetadata &inputMetadata = input->metadata();
+	const PixelFormatInfo &inputInfo = PixelFormatInfo::info(inputFormat_->format);
+	Frame frame;
+
+	MappedFrameBuffer in(input, MappedFrameBuffer::MapFlag::Read |
+				    MappedFrameBuffer::MapFlag::Persistent);
+	bool valid = in.isValid() &&
+		     framePlanes(in, inputInfo.numPlanes(), inputStride_, inputSize_.height,
+				 inputFrameSize_, frame.input);
+
+	for (auto [index, buffer] : outputs) {
+		const Output &output = outputs_[index];
+		const PixelFormatInfo &info = PixelFormatInfo::info(output.pixelFormat);
+
+		FrameMetadata &metadata = buffer->_d()->metadata();
+		metadata.status = inputMetadata.status;
+		metadata.sequence = inputMetadata.sequence;
+		metadata.timestamp = inputMetadata.timestamp;
+
+		if (stopping_) {
+			metadata.status = FrameMetadata::FrameCancelled;
+			continue;
+		}
+
+		MappedFrameBuffer out(buffer, MappedFrameBuffer::MapFlag::Write |
+					      MappedFrameBuffer::MapFlag::Persistent);
+		if (!valid || !out.isValid() ||
+		    !framePlanes(out, info.numPlanes(), output.stride, output.size.height,
+				 output.frameSize, frame.output)) {
+			LOG(Converter, Error) << "Failed to map frame buffers";
+			metadata.status = FrameMetadata::FrameError;
+			continue;
+		}
+
+		/* Hand all stripes but the first one to the workers. */
+		for (unsigned int i = 1; i < output.stripes.size(); i++)
+			workers_[i - 1]->invokeMethod(&StripeWorker::process,
+						      ConnectionTypeQueued,
+						      &outputs_[index], i, frame);
+
+		processStripe(output, outputs_[index].stripes[0], frame);
+
+		stripesDone_.acquire(output.stripes.size() - 1);
+
+		Span<FrameMetadata::Plane> planes = metadata.planes();
+		for (unsigned int i = 0; i < planes.size(); i++)
+			planes[i].bytesused = buffer->planes()[i].length;
+	}
+}
+
+void CpuConverter::processStripe(const Output &output, Stripe &stripe, const Frame &frame)
+{
+	const bool chroma420 = output.yuv && output.yuv->chroma420;
+
+	stripe.lines[0].index = -1;
+	stripe.lines[1].index = -1;
+
+	for (unsigned int y = stripe.begin; y < stripe.end; y++) {
+		const ScaleStep &step = output.lineSteps[y];
+		const bool chroma = !chroma420 || !(y & 1);
+		Line line;
+
+		if (step.weight == 0) {
+			line = unpackLine(stripe, frame, step.index, -1);
+		} else if (step.weight == 256) {
+			line = unpackLine(stripe, frame, step.index + 1, -1);
+		} else {
+			const Line &line0 = unpackLine(stripe, frame, step.index, -1);
+			const Line &line1 = unpackLine(stripe, frame, step.index + 1,
+						       step.index);
+			line = blendLines(stripe, line0, line1, step.weight, chroma);
+		}
+
+		line = scaleLine(output, stripe, line, chroma);
+		packLine(output, stripe, frame, y, line);
+	}
+}
+
+/*
+ * Unpack input line \a index to YUV 4:2:2 planar, caching it in the stripe
+ * line buffers. The buffer holding line \a keep, if any, is not overwritten.
+ */
+const CpuConverter::Line &
+CpuConverter::unpackLine(Stripe &stripe, const Frame &frame, int index, int keep)
+{
+	for (LineBuffer &buffer : stripe.lines) {
+		if (buffer.index == index)
+			return buffer.line;
+	}
+
+	LineBuffer &buffer = stripe.lines[0].index == keep && keep >= 0
+			   ? stripe.lines[1] : stripe.lines[0];
+	const unsigned int width = inputSize_.width;
+	uint8_t *u = buffer.u.data();
+	uint8_t *v = buffer.v.data();
+
+	if (inputFormat_->swapUV)
+		std::swap(u, v);
+
+	if (inputFormat_->packed) {
+		const uint8_t *src = frame.input[0] + index * inputStride_;
+		uint8_t *c = buffer.packed.data();
+
+		if (inputFormat_->lumaFirst)
+			kernels_->split(buffer.y.data(), c, src, width);
+		else
+			kernels_->split(c, buffer.y.data(), src, width);
+
+		kernels_->split(u, v, c, width / 2);
+
+		buffer.line.y = buffer.y.data();
+	} else {
+		const unsigned int chromaIndex = inputFormat_->chroma420 ? index / 2 : index;
+
+		kernels_->split(u, v, frame.input[1] + chromaIndex * inputStride_, width / 2);
+
+		buffer.line.y = frame.input[0] + index * inputStride_;
+	}
+
+	buffer.line.u = buffer.u.data();
+	buffer.line.v = buffer.v.data();
+	buffer.index = index;
+
+	return buffer.line;
+}
+
+CpuConverter::Line CpuConverter::blendLines(Stripe &stripe, const Line &line0,
+					    const Line &line1, unsigned int weight,
+					    bool chroma)
+{
+	const unsigned int width = inputSize_.width;
+
+	kernels_->blend(stripe.blended[0].data(), line0.y, line1.y, weight, width);
+
+	if (chroma) {
+		kernels_->blend(stripe.blended[1].data(), line0.u, line1.u, weight, width / 2);
+		kernels_->blend(stripe.blended[2].data(), line0.v, line1.v, weight, width / 2);
+	}
+
+	return { stripe.blended[0].data(), stripe.blended[1].data(),
+		 stripe.blended[2].data() };
+}
+
+CpuConverter::Line CpuConverter::scaleLine(const Output &output, Stripe &stripe,
+					   const Line &line, bool chroma)
+{
+	if (output.size.width == inputSize_.width)
+		return line;
+
+	auto scale = [](uint8_t *dst, const uint8_t *src,
+			const std::vector<ScaleStep> &steps) {
+		for (const ScaleStep &step : steps) {
+			const uint8_t *p = src + step.index;
+			*dst++ = (p[0] * (256 - step.weight) + p[1] * step.weight + 128) >> 8;
+		}
+	};
+
+	scale(stripe.scaled[0].data(), line.y, output.lumaSteps);
+
+	if (chroma) {
+		scale(stripe.scaled[1].data(), line.u, output.chromaSteps);
+		scale(stripe.scaled[2].data(), line.v, output.chromaSteps);
+	}
+
+	return { stripe.scaled[0].data(), stripe.scaled[1].data(),
+		 stripe.scaled[2].data() };
+}
+
+void CpuConverter::packLine(const Output &output, Stripe &stripe, const Frame &frame,
+			    unsigned int y, const Line &line)
+{
+	const unsigned int width = output.size.width;
+	uint8_t *dst = frame.output[0] + y * output.stride;
+
+	if (output.rgb) {
+		uint8_t *r = stripe.scratch[0].data();
+		uint8_t *g = stripe.scratch[1].data();
+		uint8_t *b = stripe.scratch[2].data();
+
+		kernels_->yuvToRgb(r, g, b, line.y, line.u, line.v, width,
+				   rgbCoefficients_.data());
+		output.rgb->pack(dst, r, g, b, width);
+		return;
+	}
+
+	const YuvFormat &format = *output.yuv;
+	const uint8_t *u = line.u;
+	const uint8_t *v = line.v;
+
+	if (format.swapUV)
+		std::swap(u, v);
+
+	if (format.packed) {
+		uint8_t *c = stripe.scratch[0].data();
+
+		kernels_->merge(c, u, v, width / 2);
+
+		if (format.lumaFirst)
+			kernels_->merge(dst, line.y, c, width);
+		else
+			kernels_->merge(dst, c, line.y, width);
+		return;
+	}
+
+	memcpy(dst, line.y, width);
+
+	if (format.chroma420 && (y & 1))
+		return;
+
+	const unsigned int chromaLine = format.chroma420 ? y / 2 : y;
+	kernels_->merge(frame.output[1] + chromaLine * output.stride, u, v, width / 2);
+}
+
+/* Signal completion of the converted frames, in the converter thread */
+void CpuConverter::frameDone()
+{
+	std::vector<std::pair<FrameBuffer *, OutputBuffers>> completed;
+
+	{
+		MutexLocker locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (auto &[input, outputs] : completed) {
+		for (auto [index, buffer] : outputs)
+			outputBufferReady.emit(buffer);
+
+		inputBufferReady.emit(input);
+	}
+}
+
+} /* namespace libcamera */
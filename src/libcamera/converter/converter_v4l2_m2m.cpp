@@ -142,17 +142,14 @@ void V4L2M2MConverter::Stream::stop()
 	m2m_->output()->releaseBuffers();
 }
 
-int V4L2M2MConverter::Stream::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+int V4L2M2MConverter::Stream::queueInput(FrameBuffer *input)
 {
-	int ret = m2m_->output()->queueBuffer(input);
-	if (ret < 0)
-		return ret;
-
-	ret = m2m_->capture()->queueBuffer(output);
-	if (ret < 0)
-		return ret;
+	return m2m_->output()->queueBuffer(input);
+}
 
-	return 0;
+int V4L2M2MConverter::Stream::queueOutput(FrameBuffer *output)
+{
+	return m2m_->capture()->queueBuffer(output);
 }
 
 std::string V4L2M2MConverter::Stream::logPrefix() const
@@ -401,7 +398,7 @@ void V4L2M2MConverter::stop()
  * \copydoc libcamera::Converter::queueBuffers
  */
 int V4L2M2MConverter::queueBuffers(FrameBuffer *input,
-				   const std::map<unsigned int, FrameBuffer *> &outputs)
+				   const OutputBuffers &outputs)
 {
 	unsigned int mask = 0;
 	int ret;
@@ -425,9 +422,22 @@ int V4L2M2MConverter::queueBuffers(FrameBuffer *input,
 		mask |= 1 << index;
 	}
 
-	/* Queue the input and output buffers to all the streams. */
+	/*
+	 * Each stream is a separate M2M context, as V4L2 M2M devices can't
+	 * produce multiple outputs in a single job. Queue the output buffers
+	 * to all the streams first, and the input buffer last, back to back.
+	 * All contexts then become ready at the same time, and the M2M core
+	 * schedules their jobs one after the other while the input frame is
+	 * still hot in the caches, without waiting for userspace in between.
+	 */
 	for (auto [index, buffer] : outputs) {
-		ret = streams_[index].queueBuffers(input, buffer);
+		ret = streams_[index].queueOutput(buffer);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (const auto &output : outputs) {
+		ret = streams_[output.first].queueInput(input);
 		if (ret < 0)
 			return ret;
 	}
@@ -445,7 +455,9 @@ int V4L2M2MConverter::queueBuffers(FrameBuffer *input,
 }
 
 static std::initializer_list<std::string> compatibles = {
+	"mtk-jpeg",
 	"mtk-mdp",
+	"mxc-jpeg",
 	"pxp",
 };
 
@@ -57,6 +57,40 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  * blanking bounds.
  */
 
+/**
+ * \struct DelayedControls::Statistics
+ * \brief Statistics about the timeliness of control updates
+ *
+ * The statistics are cumulative over the lifetime of the DelayedControls
+ * instance and are not affected by reset().
+ *
+ * \var Statistics::frames
+ * \brief The number of frames for which controls have been applied
+ *
+ * \var Statistics::underruns
+ * \brief The number of frames for which no controls had been pushed in time
+ *
+ * An underrun occurs when a frame starts before controls have been pushed for
+ * it, typically because the IPA is late. The previous control values are then
+ * carried over to the frame.
+ *
+ * \var Statistics::late
+ * \brief The number of control lists that have been pushed late
+ *
+ * A control list is late when it is pushed after the frame it was meant for
+ * has started. Its values are then applied to a later frame than intended.
+ *
+ * \var Statistics::maxLateness
+ * \brief The largest number of frames by which a control list has been late
+ *
+ * \var Statistics::totalLateness
+ * \brief The sum of the number of frames by which control lists have been
+ * late
+ *
+ * The average lateness of late control lists can be computed by dividing
+ * totalLateness by late.
+ */
+
 /**
  * \brief Construct a DelayedControls instance
  * \param[in] device The V4L2 device the controls have to be applied to
@@ -73,8 +107,32 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  */
 DelayedControls::DelayedControls(V4L2Device *device,
 				 const std::unordered_map<uint32_t, ControlParams> &controlParams)
-	: device_(device), maxDelay_(0)
+	: device_(device), maxDelay_(0), statistics_({})
+{
+	setDelays(controlParams);
+
+	reset();
+}
+
+/**
+ * \brief Update the control delays
+ * \param[in] controlParams Map of the numerical V4L2 control ids to their
+ * associated control parameters
+ *
+ * The delays at which sensors apply controls can depend on the sensor mode.
+ * This function replaces the control parameters passed to the constructor,
+ * and is meant to be called by pipeline handlers when configuring the camera
+ * for a new sensor mode. As with the constructor, only controls exposed by the
+ * device are handled.
+ *
+ * The control queue is not modified, the caller shall call reset() before
+ * calling applyControls() for the first time after updating the delays.
+ */
+void DelayedControls::setDelays(const std::unordered_map<uint32_t, ControlParams> &controlParams)
 {
+	controlParams_.clear();
+	maxDelay_ = 0;
+
 	const ControlInfoMap &controls = device_->controls();
 
 	/*
@@ -103,8 +161,6 @@ DelayedControls::DelayedControls(V4L2Device *device,
 
 		maxDelay_ = std::max(maxDelay_, controlParams_[id].delay);
 	}
-
-	reset();
 }
 
 /**
@@ -117,6 +173,7 @@ void DelayedControls::reset()
 {
 	queueCount_ = 1;
 	writeCount_ = 0;
+	lateness_ = 0;
 
 	/* Retrieve control as reported by the device. */
 	std::vector<uint32_t> ids;
@@ -160,7 +217,7 @@ bool DelayedControls::push(const ControlList &controls)
 	for (const auto &control : controls) {
 		const auto &it = idmap.find(control.first);
 		if (it == idmap.end()) {
-			LOG(DelayedControls, Warning)
+			LOG_RATELIMITED(DelayedControls, Warning)
 				<< "Unknown control " << control.first;
 			return false;
 		}
@@ -180,6 +237,17 @@ bool DelayedControls::push(const ControlList &controls)
 			<< " at index " << queueCount_;
 	}
 
+	if (lateness_) {
+		LOG(DelayedControls, Debug)
+			<< "Controls pushed " << lateness_ << " frame(s) late";
+
+		statistics_.late++;
+		statistics_.totalLateness += lateness_;
+		statistics_.maxLateness = std::max<uint64_t>(statistics_.maxLateness,
+							     lateness_);
+		lateness_ = 0;
+	}
+
 	queueCount_++;
 
 	return true;
@@ -272,14 +340,33 @@ void DelayedControls::applyControls(uint32_t sequence)
 	}
 
 	writeCount_ = sequence + 1;
+	statistics_.frames++;
+
+	/*
+	 * Track how many frames the next pushed control list will be late by.
+	 * The counter is cleared while queuing no-ops to avoid accounting for
+	 * them as late controls.
+	 */
+	unsigned int lateness = lateness_;
+	lateness_ = 0;
 
 	while (writeCount_ > queueCount_) {
 		LOG(DelayedControls, Debug)
 			<< "Queue is empty, auto queue no-op.";
+		statistics_.underruns++;
 		push({});
+		lateness++;
 	}
 
+	lateness_ = lateness;
+
 	device_->setControls(&out);
 }
 
+/**
+ * \fn DelayedControls::statistics()
+ * \brief Retrieve the control update statistics
+ * \return The control update statistics
+ */
+
 } /* namespace libcamera */
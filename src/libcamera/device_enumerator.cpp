@@ -97,28 +97,27 @@ bool DeviceMatch::match(const MediaDevice *device) const
 		return false;
 
 	for (const std::string &name : entities_) {
-		bool found = false;
-
-		for (const MediaEntity *entity : device->entities()) {
-			if (name == entity->name()) {
-				if (!entity->deviceNode().empty()) {
-					found = true;
-					break;
-				} else {
-					LOG(DeviceEnumerator, Debug)
-						<< "Skip " << entity->name()
-						<< ": no device node";
-				}
-			}
-		}
+		const MediaEntity *entity = device->getEntityByName(name);
+		if (!entity)
+			return false;
 
-		if (!found)
+		if (entity->deviceNode().empty()) {
+			LOG(DeviceEnumerator, Debug)
+				<< "Skip " << entity->name()
+				<< ": no device node";
 			return false;
+		}
 	}
 
 	return true;
 }
 
+/**
+ * \fn DeviceMatch::driver()
+ * \brief Retrieve the driver name of the search pattern
+ * \return The Linux device driver name
+ */
+
 /**
  * \class DeviceEnumerator
  * \brief Enumerate, store and search media devices
@@ -238,10 +237,10 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 * \var DeviceEnumerator::devicesAdded
 * \brief Notify of new media devices being found
 *
-* This signal is emitted when the device enumerator finds new media devices in
-* the system. It may be emitted for every newly detected device, or once for
-* multiple devices, at the discretion of the device enumerator. Not all device
-* enumerator types may support dynamic detection of new devices.
+* This signal is emitted when the device enumerator adds a new media device,
+* passed as the signal argument. It is emitted once for every newly detected
+* device. Not all device enumerator types may support dynamic detection of new
+* devices.
 */
 
 /**
@@ -258,10 +257,10 @@ void DeviceEnumerator::addDevice(std::unique_ptr<MediaDevice> media)
 	LOG(DeviceEnumerator, Debug)
 		<< "Added device " << media->deviceNode() << ": " << media->driver();
 
+	MediaDevice *added = media.get();
 	devices_.push_back(std::move(media));
 
-	/* \todo To batch multiple additions, emit with a small delay here. */
-	devicesAdded.emit();
+	devicesAdded.emit(added);
 }
 
 /**
@@ -310,6 +309,9 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
  */
 std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 {
+	if (searchedDrivers_)
+		searchedDrivers_->insert(dm.driver());
+
 	for (std::shared_ptr<MediaDevice> &media : devices_) {
 		if (media->busy())
 			continue;
@@ -325,4 +327,20 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 	return nullptr;
 }
 
+/**
+ * \brief Record the driver names of the search patterns
+ * \param[in] drivers The set to record driver names in, or nullptr to stop
+ * recording
+ *
+ * When \a drivers is not null, the driver name of every search pattern passed
+ * to search() is added to \a drivers. This allows the caller to find out which
+ * media devices the outcome of a pipeline handler match attempt depends on:
+ * a failed attempt can only succeed once a media device created by one of the
+ * recorded drivers is added.
+ */
+void DeviceEnumerator::recordSearches(std::set<std::string> *drivers)
+{
+	searchedDrivers_ = drivers;
+}
+
 } /* namespace libcamera */
@@ -15,9 +15,13 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 
 #include "libcamera/internal/media_device.h"
 
@@ -32,6 +36,7 @@ int DeviceEnumeratorSysfs::init()
 
 int DeviceEnumeratorSysfs::enumerate()
 {
+	std::vector<std::string> deviceNodes;
 	struct dirent *ent;
 	DIR *dir;
 
@@ -73,26 +78,72 @@ int DeviceEnumeratorSysfs::enumerate()
 			continue;
 		}
 
-		std::unique_ptr<MediaDevice> media = createDevice(devnode);
-		if (!media)
-			continue;
+		deviceNodes.push_back(std::move(devnode));
+	}
 
-		if (populateMediaDevice(media.get()) < 0) {
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to populate media device "
-				<< media->deviceNode()
-				<< " (" << media->driver() << "), skipping";
-			continue;
+	closedir(dir);
+
+	std::vector<std::unique_ptr<MediaDevice>> media(deviceNodes.size());
+
+	/*
+	 * Populating a media device requires multiple ioctl calls, and the
+	 * entity device nodes are looked up in sysfs. When parallel
+	 * enumeration is enabled, create all media devices concurrently, and
+	 * add them in the enumeration order once they're all ready.
+	 */
+	const char *parallel = utils::secure_getenv("LIBCAMERA_PARALLEL_ENUMERATION");
+	if (parallel && parallel[0] != '\0') {
+		std::vector<std::thread> threads;
+
+		for (unsigned int i = 0; i < deviceNodes.size(); ++i) {
+			threads.emplace_back([this, &deviceNodes, &media, i]() {
+				Thread::configureCurrent("device-enum");
+				media[i] = createMediaDevice(deviceNodes[i]);
+			});
 		}
 
-		addDevice(std::move(media));
+		for (std::thread &thread : threads)
+			thread.join();
+	} else {
+		for (unsigned int i = 0; i < deviceNodes.size(); ++i)
+			media[i] = createMediaDevice(deviceNodes[i]);
 	}
 
-	closedir(dir);
+	for (std::unique_ptr<MediaDevice> &device : media) {
+		if (device)
+			addDevice(std::move(device));
+	}
 
 	return 0;
 }
 
+/**
+ * \brief Create and populate the media device for a device node
+ * \param[in] devnode The media device node path
+ *
+ * This function is thread-safe, and is called concurrently for all media
+ * devices when parallel enumeration is enabled.
+ *
+ * \return The populated media device, or nullptr on error
+ */
+std::unique_ptr<MediaDevice>
+DeviceEnumeratorSysfs::createMediaDevice(const std::string &devnode)
+{
+	std::unique_ptr<MediaDevice> media = createDevice(devnode);
+	if (!media)
+		return nullptr;
+
+	if (populateMediaDevice(media.get()) < 0) {
+		LOG(DeviceEnumerator, Warning)
+			<< "Failed to populate media device "
+			<< media->deviceNode()
+			<< " (" << media->driver() << "), skipping";
+		return nullptr;
+	}
+
+	return media;
+}
+
 int DeviceEnumeratorSysfs::populateMediaDevice(MediaDevice *media)
 {
 	/* Associate entities to device node paths. */
@@ -16,10 +16,14 @@
 #include <string_view>
 #include <sys/ioctl.h>
 #include <sys/sysmacros.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 
 #include "libcamera/internal/media_device.h"
 
@@ -27,13 +31,50 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(DeviceEnumerator)
 
+/*
+ * Populating a media device requires multiple ioctl calls that may be slow,
+ * especially for USB devices. Media devices added by hotplug are created in a
+ * separate thread, to avoid stalling the cameras running in the camera manager
+ * thread.
+ */
+class DeviceEnumeratorUdev::HotplugWorker : public Object
+{
+public:
+	HotplugWorker(DeviceEnumeratorUdev *enumerator)
+		: enumerator_(enumerator)
+	{
+	}
+
+	void createDevice(const std::string &deviceNode)
+	{
+		std::unique_ptr<MediaDevice> media = enumerator_->createDevice(deviceNode);
+
+		{
+			MutexLocker locker(enumerator_->mutex_);
+			enumerator_->created_.emplace_back(deviceNode, std::move(media));
+		}
+
+		enumerator_->invokeMethod(&DeviceEnumeratorUdev::mediaDeviceCreated,
+					  ConnectionTypeQueued);
+	}
+
+private:
+	DeviceEnumeratorUdev *enumerator_;
+};
+
 DeviceEnumeratorUdev::DeviceEnumeratorUdev()
-	: udev_(nullptr), monitor_(nullptr), notifier_(nullptr)
+	: udev_(nullptr), monitor_(nullptr), notifier_(nullptr),
+	  hotplugThread_("device-hotplug")
 {
 }
 
 DeviceEnumeratorUdev::~DeviceEnumeratorUdev()
 {
+	if (hotplugWorker_) {
+		hotplugThread_.exit();
+		hotplugThread_.wait();
+	}
+
 	delete notifier_;
 
 	if (monitor_)
@@ -70,44 +111,67 @@ int DeviceEnumeratorUdev::init()
 	return 0;
 }
 
-int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
+/*
+ * Create and populate the media devices listed in \a ents concurrently, one
+ * thread per device, and return them indexed by device node. Populating a
+ * media device requires multiple ioctl calls that may be slow with some
+ * drivers, while the media devices are independent of each other.
+ */
+std::map<std::string, std::unique_ptr<MediaDevice>>
+DeviceEnumeratorUdev::createMediaDevices(struct udev_list_entry *ents)
+{
+	struct udev_list_entry *ent;
+	std::vector<std::string> deviceNodes;
+
+	udev_list_entry_foreach(ent, ents) {
+		struct udev_device *dev =
+			udev_device_new_from_syspath(udev_, udev_list_entry_get_name(ent));
+		if (!dev)
+			continue;
+
+		const char *subsystem = udev_device_get_subsystem(dev);
+		const char *devnode = udev_device_get_devnode(dev);
+		if (subsystem && devnode && !strcmp(subsystem, "media"))
+			deviceNodes.push_back(devnode);
+
+		udev_device_unref(dev);
+	}
+
+	std::vector<std::unique_ptr<MediaDevice>> media(deviceNodes.size());
+	std::vector<std::thread> threads;
+
+	for (unsigned int i = 0; i < deviceNodes.size(); ++i) {
+		threads.emplace_back([this, &deviceNodes, &media, i]() {
+			Thread::configureCurrent("device-enum");
+			media[i] = createDevice(deviceNodes[i]);
+		});
+	}
+
+	std::map<std::string, std::unique_ptr<MediaDevice>> devices;
+
+	for (unsigned int i = 0; i < deviceNodes.size(); ++i) {
+		threads[i].join();
+		if (media[i])
+			devices[deviceNodes[i]] = std::move(media[i]);
+	}
+
+	return devices;
+}
+
+int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev,
+					std::unique_ptr<MediaDevice> media)
 {
 	const char *subsystem = udev_device_get_subsystem(dev);
 	if (!subsystem)
 		return -ENODEV;
 
 	if (!strcmp(subsystem, "media")) {
-		std::unique_ptr<MediaDevice> media =
-			createDevice(udev_device_get_devnode(dev));
+		if (!media)
+			media = createDevice(udev_device_get_devnode(dev));
 		if (!media)
 			return -ENODEV;
 
-		DependencyMap deps;
-		int ret = populateMediaDevice(media.get(), &deps);
-		if (ret < 0) {
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to populate media device "
-				<< media->deviceNode()
-				<< " (" << media->driver() << "), skipping";
-			return ret;
-		}
-
-		if (!deps.empty()) {
-			LOG(DeviceEnumerator, Debug)
-				<< "Defer media device " << media->deviceNode()
-				<< " due to " << deps.size()
-				<< " missing dependencies";
-
-			pending_.emplace_back(std::move(media), std::move(deps));
-			MediaDeviceDeps *mediaDeps = &pending_.back();
-			for (const auto &dep : mediaDeps->deps_)
-				devMap_[dep.first] = mediaDeps;
-
-			return 0;
-		}
-
-		addDevice(std::move(media));
-		return 0;
+		return addMediaDevice(std::move(media));
 	}
 
 	if (!strcmp(subsystem, "video4linux")) {
@@ -118,10 +182,47 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 	return -ENODEV;
 }
 
+/*
+ * Associate the entities of a created media device with their device nodes,
+ * and add the media device to the enumerator, or defer it until all its device
+ * nodes are available.
+ */
+int DeviceEnumeratorUdev::addMediaDevice(std::unique_ptr<MediaDevice> media)
+{
+	DependencyMap deps;
+	int ret = populateMediaDevice(media.get(), &deps);
+	if (ret < 0) {
+		LOG(DeviceEnumerator, Warning)
+			<< "Failed to populate media device "
+			<< media->deviceNode()
+			<< " (" << media->driver() << "), skipping";
+		return ret;
+	}
+
+	if (!deps.empty()) {
+		LOG(DeviceEnumerator, Debug)
+			<< "Defer media device " << media->deviceNode()
+			<< " due to " << deps.size()
+			<< " missing dependencies";
+
+		pending_.emplace_back(std::move(media), std::move(deps));
+		MediaDeviceDeps *mediaDeps = &pending_.back();
+		for (const auto &dep : mediaDeps->deps_)
+			devMap_[dep.first] = mediaDeps;
+
+		return 0;
+	}
+
+	addDevice(std::move(media));
+	return 0;
+}
+
 int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::map<std::string, std::unique_ptr<MediaDevice>> populated;
+	const char *parallel;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -148,6 +249,10 @@ int DeviceEnumeratorUdev::enumerate()
 	if (!ents)
 		goto done;
 
+	parallel = utils::secure_getenv("LIBCAMERA_PARALLEL_ENUMERATION");
+	if (parallel && parallel[0] != '\0')
+		populated = createMediaDevices(ents);
+
 	udev_list_entry_foreach(ent, ents) {
 		struct udev_device *dev;
 		const char *devnode;
@@ -170,7 +275,12 @@ int DeviceEnumeratorUdev::enumerate()
 			continue;
 		}
 
-		if (addUdevDevice(dev) < 0)
+		std::unique_ptr<MediaDevice> media;
+		auto iter = populated.find(devnode);
+		if (iter != populated.end())
+			media = std::move(iter->second);
+
+		if (addUdevDevice(dev, std::move(media)) < 0)
 			LOG(DeviceEnumerator, Warning)
 				<< "Failed to add device for '"
 				<< syspath << "', skipping";
@@ -187,6 +297,10 @@ done:
 	if (ret < 0)
 		return ret;
 
+	hotplugWorker_ = std::make_unique<HotplugWorker>(this);
+	hotplugWorker_->moveToThread(&hotplugThread_);
+	hotplugThread_.start();
+
 	int fd = udev_monitor_get_fd(monitor_);
 	notifier_ = new EventNotifier(fd, EventNotifier::Read);
 	notifier_->activated.connect(this, &DeviceEnumeratorUdev::udevNotify);
@@ -338,15 +452,60 @@ void DeviceEnumeratorUdev::udevNotify()
 	LOG(DeviceEnumerator, Debug)
 		<< action << " device " << deviceNode;
 
+	const char *subsystem = udev_device_get_subsystem(dev);
+	bool isMedia = subsystem && !strcmp(subsystem, "media");
+
 	if (action == "add") {
-		addUdevDevice(dev);
+		if (isMedia) {
+			std::string node(deviceNode);
+			creating_.insert(node);
+			hotplugWorker_->invokeMethod(&HotplugWorker::createDevice,
+						     ConnectionTypeQueued, node);
+		} else {
+			addUdevDevice(dev);
+		}
 	} else if (action == "remove") {
-		const char *subsystem = udev_device_get_subsystem(dev);
-		if (subsystem && !strcmp(subsystem, "media"))
-			removeDevice(std::string(deviceNode));
+		if (isMedia) {
+			std::string node(deviceNode);
+
+			/* Drop media devices that are still being created. */
+			if (creating_.erase(node))
+				LOG(DeviceEnumerator, Debug)
+					<< "Media device " << node
+					<< " removed while being created";
+			else
+				removeDevice(node);
+		}
 	}
 
 	udev_device_unref(dev);
 }
 
+/*
+ * Add the media devices created by the hotplug worker, in the camera manager
+ * thread. Only the new media devices are populated, and pipeline handlers are
+ * then matched against them through the devicesAdded signal.
+ */
+void DeviceEnumeratorUdev::mediaDeviceCreated()
+{
+	std::list<std::pair<std::string, std::unique_ptr<MediaDevice>>> created;
+
+	{
+		MutexLocker locker(mutex_);
+		created = std::move(created_);
+		created_.clear();
+	}
+
+	for (auto &[deviceNode, media] : created) {
+		auto it = creating_.find(deviceNode);
+		if (it == creating_.end())
+			continue;
+
+		creating_.erase(it);
+
+		if (media)
+			addMediaDevice(std::move(media));
+	}
+}
+
 } /* namespace libcamera */
@@ -8,8 +8,14 @@
 
 #include "libcamera/internal/dma_buf_allocator.h"
 
+#include <algorithm>
 #include <array>
+#include <errno.h>
 #include <fcntl.h>
+#include <list>
+#include <map>
+#include <numeric>
+#include <stdlib.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -22,6 +28,13 @@
 #include <linux/udmabuf.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/mutex.h>
+#include <libcamera/base/shared_fd.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/framebuffer.h"
 
 /**
  * \file dma_buf_allocator.cpp
@@ -37,7 +50,12 @@ struct DmaBufAllocatorInfo {
 };
 #endif
 
-static constexpr std::array<DmaBufAllocatorInfo, 4> providerInfos = { {
+static constexpr std::array<DmaBufAllocatorInfo, 5> providerInfos = { {
+	/*
+	 * Huge pages are only used when explicitly requested, and are then
+	 * preferred over the other providers.
+	 */
+	{ DmaBufAllocator::DmaBufAllocatorFlag::UDmaBufHugePages, "/dev/udmabuf" },
 	/*
 	 * /dev/dma_heap/linux,cma is the CMA dma-heap. When the cma heap size is
 	 * specified on the kernel command line, this gets renamed to "reserved".
@@ -60,17 +78,243 @@ LOG_DEFINE_CATEGORY(DmaBufAllocator)
  * Different providers may provide dma-buffers with different properties for
  * the underlying memory. Which providers are acceptable is specified through
  * the type argument passed to the DmaBufAllocator() constructor.
+ *
+ * Allocating dma-buffers is expensive, as the kernel has to find and zero the
+ * memory. To speed up stream reconfiguration, the allocator can keep buffers
+ * that are not used anymore in a pool, and hand them out again for subsequent
+ * allocations of a similar size. Pooling is disabled by default, and is
+ * enabled by setting a pool capacity with setPoolCapacity(). Buffers return to
+ * the pool when the FrameBuffer instances created by exportBuffers() are
+ * destroyed. Memory reused from the pool is not cleared, and contains data
+ * from the previous use of the buffer.
+ *
+ * Each allocator has its own pool by default. Allocators that call
+ * useSharedPool() instead share a process-wide pool with all other allocators
+ * using the same provider, allowing buffers released by one camera or stream
+ * to be reused by another one. The memory used by the buffers created by
+ * exportBuffers() can additionally be capped with setMemoryLimit(). When the
+ * limit is reached, buffers held by the pool are freed first, and allocations
+ * fail if the buffers in use alone exceed the limit. Setting a limit on a
+ * shared pool bounds the memory used by all the cameras of the process, which
+ * would otherwise be the sum of the worst cases of all cameras.
  */
 
+#ifndef __DOXYGEN__
+static std::size_t pageAlign(std::size_t size)
+{
+	std::size_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+	return (size + pageMask) & ~pageMask;
+}
+
+class DmaBufAllocator::Pool
+{
+public:
+	Pool()
+		: capacity_(0), size_(0), limit_(0), allocated_(0)
+	{
+	}
+
+	/*
+	 * Retrieve the best fitting buffer for a page-aligned size. Larger
+	 * buffers are accepted within a 25% margin, to allow formats of
+	 * slightly different sizes to share buffers without wasting memory.
+	 */
+	UniqueFD get(std::size_t size, std::size_t *bufferSize)
+	{
+		MutexLocker locker(mutex_);
+
+		auto best = entries_.end();
+		for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+			if (it->size < size || it->size > size + size / 4)
+				continue;
+
+			if (best == entries_.end() || it->size < best->size)
+				best = it;
+		}
+
+		if (best == entries_.end())
+			return {};
+
+		UniqueFD fd = std::move(best->fd);
+		*bufferSize = best->size;
+		size_ -= best->size;
+		entries_.erase(best);
+
+		return fd;
+	}
+
+	void put(UniqueFD fd, std::size_t size)
+	{
+		MutexLocker locker(mutex_);
+
+		if (!fd.isValid() || size > capacity_) {
+			allocated_ -= std::min(size, allocated_);
+			return;
+		}
+
+		entries_.push_front({ std::move(fd), size });
+		size_ += size;
+
+		trim();
+	}
+
+	void setCapacity(std::size_t capacity)
+	{
+		MutexLocker locker(mutex_);
+
+		capacity_ = capacity;
+		trim();
+	}
+
+	std::size_t capacity() const
+	{
+		MutexLocker locker(mutex_);
+		return capacity_;
+	}
+
+	std::size_t size() const
+	{
+		MutexLocker locker(mutex_);
+		return size_;
+	}
+
+	void clear()
+	{
+		MutexLocker locker(mutex_);
+
+		entries_.clear();
+		allocated_ -= size_;
+		size_ = 0;
+	}
+
+	/*
+	 * Account for the allocation of a new buffer of the given size, freeing
+	 * pooled buffers as needed to stay within the memory limit. Return
+	 * false if the buffers in use don't leave enough room for the new one.
+	 */
+	bool reserve(std::size_t size)
+	{
+		MutexLocker locker(mutex_);
+
+		if (limit_) {
+			if (allocated_ - size_ + size > limit_)
+				return false;
+
+			while (allocated_ + size > limit_ && !entries_.empty())
+				evict();
+		}
+
+		allocated_ += size;
+		return true;
+	}
+
+	/*
+	 * Update the memory accounting for buffers that are not tracked by the
+	 * pool anymore, or for providers rounding the size of a buffer up.
+	 */
+	void release(std::size_t size)
+	{
+		MutexLocker locker(mutex_);
+		allocated_ -= std::min(size, allocated_);
+	}
+
+	void grow(std::size_t size)
+	{
+		MutexLocker locker(mutex_);
+		allocated_ += size;
+	}
+
+	void setLimit(std::size_t limit)
+	{
+		MutexLocker locker(mutex_);
+		limit_ = limit;
+	}
+
+	std::size_t limit() const
+	{
+		MutexLocker locker(mutex_);
+		return limit_;
+	}
+
+	std::size_t allocated() const
+	{
+		MutexLocker locker(mutex_);
+		return allocated_;
+	}
+
+private:
+	struct Entry {
+		UniqueFD fd;
+		std::size_t size;
+	};
+
+	/* Evict the least recently recycled buffers to fit the capacity. */
+	void trim() LIBCAMERA_TSA_REQUIRES(mutex_)
+	{
+		while (size_ > capacity_)
+			evict();
+	}
+
+	void evict() LIBCAMERA_TSA_REQUIRES(mutex_)
+	{
+		std::size_t size = entries_.back().size;
+
+		size_ -= size;
+		allocated_ -= std::min(size, allocated_);
+		entries_.pop_back();
+	}
+
+	mutable Mutex mutex_;
+	std::size_t capacity_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::size_t size_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::size_t limit_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::size_t allocated_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	std::list<Entry> entries_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
+class DmaBufAllocator::PooledFrameBufferData : public FrameBuffer::Private
+{
+public:
+	PooledFrameBufferData(const std::vector<FrameBuffer::Plane> &planes,
+			      const std::shared_ptr<Pool> &pool, std::size_t size)
+		: FrameBuffer::Private(planes), fd_(planes[0].fd), pool_(pool),
+		  size_(size)
+	{
+	}
+
+	~PooledFrameBufferData()
+	{
+		std::shared_ptr<Pool> pool = pool_.lock();
+		if (pool)
+			pool->put(fd_.dup(), size_);
+	}
+
+private:
+	SharedFD fd_;
+	std::weak_ptr<Pool> pool_;
+	std::size_t size_;
+};
+#endif /* __DOXYGEN__ */
+
 /**
  * \enum DmaBufAllocator::DmaBufAllocatorFlag
  * \brief Type of the dma-buf provider
  * \var DmaBufAllocator::CmaHeap
  * \brief Allocate from a CMA dma-heap, providing physically-contiguous memory
  * \var DmaBufAllocator::SystemHeap
- * \brief Allocate from the system dma-heap, using the page allocator
+ * \brief Allocate from the cached system dma-heap, using the page allocator
  * \var DmaBufAllocator::UDmaBuf
  * \brief Allocate using a memfd + /dev/udmabuf
+ * \var DmaBufAllocator::UDmaBufHugePages
+ * \brief Allocate using a hugetlb memfd + /dev/udmabuf, falling back to
+ * regular pages when no huge page is available
+ *
+ * All providers create buffers that are mapped cached by the CPU. The system
+ * heap variant with uncached mappings found on some kernels is never used.
+ * Huge pages reduce the TLB pressure when the CPU processes large frames. They
+ * must be reserved by the system administrator, and the UDmaBufHugePages
+ * provider is only selected if a huge page can be allocated at construction
+ * time.
  */
 
 /**
@@ -92,6 +336,7 @@ LOG_DEFINE_CATEGORY(DmaBufAllocator)
  * requested types can work on the system, which provider is used is undefined.
  */
 DmaBufAllocator::DmaBufAllocator(DmaBufAllocatorFlags type)
+	: hugePageSize_(0), pool_(std::make_shared<Pool>())
 {
 	for (const auto &info : providerInfos) {
 		if (!(type & info.type))
@@ -106,8 +351,17 @@ DmaBufAllocator::DmaBufAllocator(DmaBufAllocatorFlags type)
 			continue;
 		}
 
-		LOG(DmaBufAllocator, Debug) << "Using " << info.deviceNodeName;
 		providerHandle_ = UniqueFD(ret);
+
+		if (info.type == DmaBufAllocatorFlag::UDmaBufHugePages &&
+		    !probeHugePages()) {
+			LOG(DmaBufAllocator, Debug)
+				<< "Huge pages not available for udmabuf";
+			providerHandle_.reset();
+			continue;
+		}
+
+		LOG(DmaBufAllocator, Debug) << "Using " << info.deviceNodeName;
 		type_ = info.type;
 		break;
 	}
@@ -133,22 +387,24 @@ DmaBufAllocator::~DmaBufAllocator() = default;
 #define F_ADD_SEALS		1033
 #define F_SEAL_SHRINK		0x0002
 #endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB		0x0004U
+#endif
 #endif
 
-UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
+UniqueFD DmaBufAllocator::createUDmaBuf(const char *name, std::size_t size,
+				       unsigned int memfdFlags)
 {
-	/* Size must be a multiple of the page size. Round it up. */
-	std::size_t pageMask = sysconf(_SC_PAGESIZE) - 1;
-	size = (size + pageMask) & ~pageMask;
+	memfdFlags |= MFD_ALLOW_SEALING | MFD_CLOEXEC;
 
 #if HAVE_MEMFD_CREATE
-	int ret = memfd_create(name, MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	int ret = memfd_create(name, memfdFlags);
 #else
-	int ret = syscall(SYS_memfd_create, name, MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	int ret = syscall(SYS_memfd_create, name, memfdFlags);
 #endif
 	if (ret < 0) {
 		ret = errno;
-		LOG(DmaBufAllocator, Error)
+		LOG(DmaBufAllocator, Debug)
 			<< "Failed to allocate memfd storage for " << name
 			<< ": " << strerror(ret);
 		return {};
@@ -159,7 +415,7 @@ UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
 	ret = ftruncate(memfd.get(), size);
 	if (ret < 0) {
 		ret = errno;
-		LOG(DmaBufAllocator, Error)
+		LOG(DmaBufAllocator, Debug)
 			<< "Failed to set memfd size for " << name
 			<< ": " << strerror(ret);
 		return {};
@@ -169,7 +425,7 @@ UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
 	ret = fcntl(memfd.get(), F_ADD_SEALS, F_SEAL_SHRINK);
 	if (ret < 0) {
 		ret = errno;
-		LOG(DmaBufAllocator, Error)
+		LOG(DmaBufAllocator, Debug)
 			<< "Failed to seal the memfd for " << name
 			<< ": " << strerror(ret);
 		return {};
@@ -185,7 +441,7 @@ UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
 	ret = ::ioctl(providerHandle_.get(), UDMABUF_CREATE, &create);
 	if (ret < 0) {
 		ret = errno;
-		LOG(DmaBufAllocator, Error)
+		LOG(DmaBufAllocator, Debug)
 			<< "Failed to create dma buf for " << name
 			<< ": " << strerror(ret);
 		return {};
@@ -195,6 +451,56 @@ UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
 	return UniqueFD(ret);
 }
 
+UniqueFD DmaBufAllocator::allocFromUDmaBuf(const char *name, std::size_t size)
+{
+	/*
+	 * Huge pages are allocated from the hugetlb pool, which may be
+	 * exhausted. Fall back to regular pages in that case.
+	 */
+	if (type_ == DmaBufAllocator::DmaBufAllocatorFlag::UDmaBufHugePages) {
+		std::size_t hugeSize = (size + hugePageSize_ - 1) / hugePageSize_ * hugePageSize_;
+		UniqueFD fd = createUDmaBuf(name, hugeSize, MFD_HUGETLB);
+		if (fd.isValid())
+			return fd;
+
+		LOG(DmaBufAllocator, Debug)
+			<< "Falling back to regular pages for " << name;
+	}
+
+	/* Size must be a multiple of the page size. Round it up. */
+	UniqueFD fd = createUDmaBuf(name, pageAlign(size), 0);
+	if (!fd.isValid())
+		LOG(DmaBufAllocator, Error)
+			<< "Failed to allocate udmabuf storage for " << name;
+
+	return fd;
+}
+
+/*
+ * Check that huge pages can back udmabuf allocations, which requires both
+ * kernel support and huge pages to be reserved, and retrieve the huge page
+ * size.
+ */
+bool DmaBufAllocator::probeHugePages()
+{
+#if HAVE_MEMFD_CREATE
+	UniqueFD memfd(memfd_create("probe", MFD_HUGETLB | MFD_CLOEXEC));
+#else
+	UniqueFD memfd(syscall(SYS_memfd_create, "probe", MFD_HUGETLB | MFD_CLOEXEC));
+#endif
+	if (!memfd.isValid())
+		return false;
+
+	struct stat st;
+	if (fstat(memfd.get(), &st) < 0)
+		return false;
+
+	hugePageSize_ = st.st_blksize;
+	memfd.reset();
+
+	return createUDmaBuf("probe", hugePageSize_, MFD_HUGETLB).isValid();
+}
+
 UniqueFD DmaBufAllocator::allocFromHeap(const char *name, std::size_t size)
 {
 	struct dma_heap_allocation_data alloc = {};
@@ -221,12 +527,23 @@ UniqueFD DmaBufAllocator::allocFromHeap(const char *name, std::size_t size)
 	return allocFd;
 }
 
+UniqueFD DmaBufAllocator::allocFromProvider(const char *name, std::size_t size)
+{
+	if (type_ == DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf ||
+	    type_ == DmaBufAllocator::DmaBufAllocatorFlag::UDmaBufHugePages)
+		return allocFromUDmaBuf(name, size);
+	else
+		return allocFromHeap(name, size);
+}
+
 /**
  * \brief Allocate a dma-buf from the DmaBufAllocator
  * \param [in] name The name to set for the allocated buffer
  * \param [in] size The size of the buffer to allocate
  *
- * Allocates a dma-buf with read/write access.
+ * Allocates a dma-buf with read/write access. If the pool holds a buffer of a
+ * suitable size, that buffer is reused instead of allocating a new one. The
+ * returned buffer may then be larger than \a size.
  *
  * If the allocation fails, return an invalid UniqueFD.
  *
@@ -237,10 +554,427 @@ UniqueFD DmaBufAllocator::alloc(const char *name, std::size_t size)
 	if (!name)
 		return {};
 
-	if (type_ == DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf)
-		return allocFromUDmaBuf(name, size);
-	else
-		return allocFromHeap(name, size);
+	std::size_t bufferSize;
+	UniqueFD fd = pool_->get(pageAlign(size), &bufferSize);
+	if (!fd.isValid())
+		return allocFromProvider(name, size);
+
+	/* The caller owns the buffer, it isn't accounted for by the pool. */
+	pool_->release(bufferSize);
+
+	/* The udmabuf name comes from the memfd and can't be changed. */
+	if (type_ != DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf &&
+	    type_ != DmaBufAllocator::DmaBufAllocatorFlag::UDmaBufHugePages &&
+	    ::ioctl(fd.get(), DMA_BUF_SET_NAME, name) < 0)
+		LOG(DmaBufAllocator, Debug)
+			<< "Failed to rename pooled buffer to " << name;
+
+	return fd;
+}
+
+std::unique_ptr<FrameBuffer>
+DmaBufAllocator::createBuffer(const std::string &name,
+			      const std::vector<unsigned int> &planeSizes)
+{
+	std::size_t frameSize = std::accumulate(planeSizes.begin(),
+						planeSizes.end(), std::size_t(0));
+	std::size_t size = pageAlign(frameSize);
+	std::size_t bufferSize;
+
+	UniqueFD fd = pool_->get(size, &bufferSize);
+	if (fd.isValid()) {
+		LOG(DmaBufAllocator, Debug)
+			<< "Reusing pooled buffer of " << bufferSize
+			<< " bytes for " << name;
+	} else {
+		if (!pool_->reserve(size)) {
+			LOG(DmaBufAllocator, Warning)
+				<< "Memory limit of " << pool_->limit()
+				<< " bytes reached, can't allocate " << name;
+			return nullptr;
+		}
+
+		fd = allocFromProvider(name.c_str(), size);
+		if (!fd.isValid()) {
+			pool_->release(size);
+			return nullptr;
+		}
+
+		/* Providers may round the size up, e.g. to huge pages. */
+		off_t end = lseek(fd.get(), 0, SEEK_END);
+		bufferSize = end > 0 ? end : size;
+		if (bufferSize > size)
+			pool_->grow(bufferSize - size);
+	}
+
+	/* Multi-planar formats store all planes in a single dma_buf. */
+	SharedFD sharedFd(std::move(fd));
+	std::vector<FrameBuffer::Plane> planes;
+	unsigned int offset = 0;
+
+	for (unsigned int planeSize : planeSizes) {
+		FrameBuffer::Plane plane;
+		plane.fd = sharedFd;
+		plane.offset = offset;
+		plane.length = planeSize;
+		planes.push_back(std::move(plane));
+
+		offset += planeSize;
+	}
+
+	return std::make_unique<FrameBuffer>(
+		std::make_unique<PooledFrameBufferData>(planes, pool_, bufferSize));
+}
+
+/**
+ * \brief Allocate and export buffers from the DmaBufAllocator
+ * \param[in] count The number of requested FrameBuffers
+ * \param[in] planeSizes The sizes of planes in each FrameBuffer
+ * \param[out] buffers Array of buffers successfully allocated
+ *
+ * Planes of each FrameBuffer are stored contiguously in a single dma-buf.
+ * Buffers are taken from the pool when possible, and are returned to the pool
+ * when the FrameBuffer is destroyed, if the pool capacity allows it.
+ *
+ * If the memory limit set with setMemoryLimit() doesn't allow allocating all
+ * the buffers, the buffers allocated so far are released and -ENOMEM is
+ * returned.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ */
+int DmaBufAllocator::exportBuffers(unsigned int count,
+				   const std::vector<unsigned int> &planeSizes,
+				   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		std::unique_ptr<FrameBuffer> buffer =
+			createBuffer("frame-" + std::to_string(i), planeSizes);
+		if (!buffer) {
+			LOG(DmaBufAllocator, Error) << "Unable to create buffer";
+			buffers->clear();
+			return -ENOMEM;
+		}
+
+		buffers->push_back(std::move(buffer));
+	}
+
+	return count;
+}
+
+/**
+ * \brief Set the maximum amount of memory held by the buffer pool
+ * \param[in] capacity The pool capacity in bytes
+ *
+ * A capacity of 0, the default, disables pooling. When the capacity is
+ * reduced, the least recently released buffers are freed to fit it.
+ */
+void DmaBufAllocator::setPoolCapacity(std::size_t capacity)
+{
+	pool_->setCapacity(capacity);
+}
+
+/**
+ * \brief Retrieve the maximum amount of memory held by the buffer pool
+ * \return The pool capacity in bytes
+ */
+std::size_t DmaBufAllocator::poolCapacity() const
+{
+	return pool_->capacity();
+}
+
+/**
+ * \brief Retrieve the amount of memory currently held by the buffer pool
+ * \return The total size in bytes of the buffers in the pool
+ */
+std::size_t DmaBufAllocator::pooledSize() const
+{
+	return pool_->size();
+}
+
+/**
+ * \brief Allocate buffers ahead of time and store them in the pool
+ * \param[in] size The size of each buffer
+ * \param[in] count The number of buffers to allocate
+ *
+ * Pre-allocating buffers moves the allocation cost out of the stream
+ * configuration path, for instance to the time the camera is acquired.
+ *
+ * \return 0 on success, -ENOSPC if the buffers don't fit in the pool capacity or
+ * in the memory limit, or -ENOMEM if the allocation fails
+ */
+int DmaBufAllocator::preallocate(std::size_t size, unsigned int count)
+{
+	size = pageAlign(size);
+	if (pool_->size() + size * count > pool_->capacity())
+		return -ENOSPC;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		if (!pool_->reserve(size))
+			return -ENOSPC;
+
+		UniqueFD fd = allocFromProvider("pool", size);
+		if (!fd.isValid()) {
+			pool_->release(size);
+			return -ENOMEM;
+		}
+
+		pool_->put(std::move(fd), size);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Free all buffers held by the pool
+ *
+ * Buffers currently in use are not affected, and will return to the pool when
+ * released.
+ */
+void DmaBufAllocator::releasePool()
+{
+	pool_->clear();
+}
+
+/**
+ * \brief Use the buffer pool shared by all allocators of the same provider
+ *
+ * Replace the pool of this allocator with a pool shared with all the other
+ * allocators of the process that use the same dma-buf provider and have called
+ * this function. Buffers released by any of the allocators can then be reused
+ * by all of them, and the pool capacity and memory limit apply to all of them.
+ *
+ * When the shared pool is created, its memory limit is initialized from the
+ * LIBCAMERA_DMABUF_MEMORY_LIMIT environment variable, expressed in MiB.
+ *
+ * This function shall be called before allocating buffers. It has no effect if
+ * the allocator is not valid.
+ */
+void DmaBufAllocator::useSharedPool()
+{
+	static Mutex mutex;
+	static std::map<DmaBufAllocatorFlag, std::weak_ptr<Pool>> pools;
+
+	if (!isValid())
+		return;
+
+	MutexLocker locker(mutex);
+
+	std::shared_ptr<Pool> pool = pools[type_].lock();
+	if (!pool) {
+		pool = std::make_shared<Pool>();
+
+		const char *limit = utils::secure_getenv("LIBCAMERA_DMABUF_MEMORY_LIMIT");
+		if (limit) {
+			pool->setLimit(strtoul(limit, nullptr, 10) * 1024 * 1024);
+			LOG(DmaBufAllocator, Debug)
+				<< "Shared pool limited to " << limit << " MiB";
+		}
+
+		pools[type_] = pool;
+	}
+
+	pool_ = std::move(pool);
+}
+
+/**
+ * \brief Limit the memory used by the buffers created by the allocator
+ * \param[in] limit The memory limit in bytes
+ *
+ * The limit covers the buffers created by exportBuffers() that are in use and
+ * the buffers held by the pool. It applies to all the allocators sharing the
+ * pool, see useSharedPool(). A limit of 0, the default, disables the limit.
+ * Lowering the limit doesn't free buffers in use.
+ *
+ * The limit may be exceeded by the rounding of buffer sizes by the dma-buf
+ * provider, for instance to huge pages.
+ */
+void DmaBufAllocator::setMemoryLimit(std::size_t limit)
+{
+	pool_->setLimit(limit);
+}
+
+/**
+ * \brief Retrieve the limit of the memory used by the allocator
+ * \return The memory limit in bytes, or 0 if no limit is set
+ */
+std::size_t DmaBufAllocator::memoryLimit() const
+{
+	return pool_->limit();
+}
+
+/**
+ * \brief Retrieve the memory used by the buffers created by the allocator
+ *
+ * The memory includes the buffers created by exportBuffers() that are in use,
+ * and the buffers held by the pool, for all the allocators sharing the pool.
+ *
+ * \return The memory size in bytes
+ */
+std::size_t DmaBufAllocator::allocatedSize() const
+{
+	return pool_->allocated();
+}
+
+/**
+ * \class DmaSyncer
+ * \brief Helper class for dma-buf CPU access synchronization
+ *
+ * Memory shared with devices through dma-bufs may be cached on the CPU side.
+ * The kernel then requires CPU accesses to be bracketed with DMA_BUF_IOCTL_SYNC
+ * operations, to invalidate the CPU caches before reading data written by a
+ * device, and to clean them after writing data that will be read by a device.
+ *
+ * The DmaSyncer class starts the CPU access at construction time and ends it at
+ * destruction time, following the RAII pattern:
+ *
+ * \code{.cpp}
+ * {
+ *	DmaSyncer syncer(buffer, DmaSyncer::SyncType::Read);
+ *	... read the buffer contents ...
+ * }
+ * \endcode
+ *
+ * The cost of cache maintenance is proportional to the size of the
+ * synchronized memory. To keep it to what is actually accessed, the sync type
+ * shall match the CPU access direction, and users that access a subset of the
+ * planes of a frame buffer shall list them. As the DMA_BUF_IOCTL_SYNC ioctl
+ * doesn't support synchronizing a range of a dma-buf, planes that share a
+ * dma-buf are synchronized together, and each dma-buf is synchronized once.
+ *
+ * File descriptors that do not refer to a dma-buf, such as memfds, don't
+ * require synchronization and are ignored.
+ */
+
+/**
+ * \enum DmaSyncer::SyncType
+ * \brief The direction of the CPU access
+ * \var DmaSyncer::SyncType::Read
+ * \brief The CPU reads data written by devices
+ * \var DmaSyncer::SyncType::Write
+ * \brief The CPU writes data read by devices
+ * \var DmaSyncer::SyncType::ReadWrite
+ * \brief The CPU both reads and writes the data
+ */
+
+/**
+ * \brief Start CPU access to a dma-buf
+ * \param[in] fd The dma-buf file descriptor
+ * \param[in] type The direction of the CPU access
+ */
+DmaSyncer::DmaSyncer(const SharedFD &fd, SyncType type)
+	: DmaSyncer(nullptr, type)
+{
+	addFd(fd);
+	sync(DMA_BUF_SYNC_START);
+}
+
+/**
+ * \brief Start CPU access to planes of a frame buffer
+ * \param[in] buffer The frame buffer
+ * \param[in] type The direction of the CPU access
+ * \param[in] planes The indices of the planes to access, or an empty list to
+ * access all planes
+ */
+DmaSyncer::DmaSyncer(const FrameBuffer *buffer, SyncType type,
+		     std::initializer_list<unsigned int> planes)
+{
+	switch (type) {
+	case SyncType::Read:
+		flags_ = DMA_BUF_SYNC_READ;
+		break;
+	case SyncType::Write:
+		flags_ = DMA_BUF_SYNC_WRITE;
+		break;
+	case SyncType::ReadWrite:
+		flags_ = DMA_BUF_SYNC_RW;
+		break;
+	}
+
+	if (!buffer)
+		return;
+
+	const std::vector<FrameBuffer::Plane> &bufferPlanes = buffer->planes();
+
+	if (!planes.size()) {
+		for (const FrameBuffer::Plane &plane : bufferPlanes)
+			addFd(plane.fd);
+	} else {
+		for (unsigned int index : planes) {
+			ASSERT(index < bufferPlanes.size());
+			addFd(bufferPlanes[index].fd);
+		}
+	}
+
+	sync(DMA_BUF_SYNC_START);
+}
+
+/**
+ * \brief End the CPU access
+ */
+DmaSyncer::~DmaSyncer()
+{
+	sync(DMA_BUF_SYNC_END);
+}
+
+/**
+ * \brief Move constructor, transfer the CPU access of \a other
+ * \param[in] other The other DmaSyncer
+ */
+DmaSyncer::DmaSyncer(DmaSyncer &&other)
+	: fds_(std::move(other.fds_)), flags_(other.flags_)
+{
+	other.fds_.clear();
+}
+
+/**
+ * \brief Move assignment operator, transfer the CPU access of \a other
+ * \param[in] other The other DmaSyncer
+ *
+ * The CPU access started by this DmaSyncer, if any, is ended first.
+ *
+ * \return A reference to this DmaSyncer
+ */
+DmaSyncer &DmaSyncer::operator=(DmaSyncer &&other)
+{
+	sync(DMA_BUF_SYNC_END);
+
+	fds_ = std::move(other.fds_);
+	flags_ = other.flags_;
+	other.fds_.clear();
+
+	return *this;
+}
+
+void DmaSyncer::addFd(const SharedFD &fd)
+{
+	if (!fd.isValid())
+		return;
+
+	auto it = std::find_if(fds_.begin(), fds_.end(),
+			       [&](const SharedFD &other) {
+				       return other.get() == fd.get();
+			       });
+	if (it == fds_.end())
+		fds_.push_back(fd);
+}
+
+void DmaSyncer::sync(uint64_t step)
+{
+	for (const SharedFD &fd : fds_) {
+		struct dma_buf_sync sync = { step | flags_ };
+		int ret;
+
+		do {
+			ret = ioctl(fd.get(), DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+		/* Buffers that are not dma-bufs don't need synchronization. */
+		if (ret < 0 && errno != ENOTTY)
+			LOG(DmaBufAllocator, Error)
+				<< "Unable to sync dma fd " << fd.get()
+				<< ": " << strerror(errno);
+	}
 }
 
 } /* namespace libcamera */
@@ -9,12 +9,15 @@
 
 #include <algorithm>
 #include <errno.h>
+#include <utility>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/formats.h>
 
+#include "libcamera/internal/lookup_table.h"
+
 /**
  * \file internal/formats.h
  * \brief Types and helper functions to handle libcamera image formats
@@ -148,7 +151,9 @@ namespace {
 
 const PixelFormatInfo pixelFormatInfoInvalid{};
 
-const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
+using PixelFormatInfoEntry = std::pair<PixelFormat, PixelFormatInfo>;
+
+const PixelFormatInfoEntry pixelFormatInfo[] = {
 	/* RGB formats. */
 	{ formats::RGB565, {
 		.name = "RGB565",
@@ -976,6 +981,18 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 	} },
 };
 
+struct PixelFormatHash {
+	size_t operator()(const PixelFormat &format) const
+	{
+		return format.fourcc() ^ format.modifier();
+	}
+};
+
+const LookupTable<PixelFormat, PixelFormatInfoEntry, 256, PixelFormatHash>
+pixelFormatIndex{ pixelFormatInfo, [](const PixelFormatInfoEntry &entry) {
+	return entry.first;
+} };
+
 } /* namespace */
 
 /**
@@ -992,15 +1009,15 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
  */
 const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
 {
-	const auto iter = pixelFormatInfo.find(format);
-	if (iter == pixelFormatInfo.end()) {
+	const PixelFormatInfoEntry *entry = pixelFormatIndex.find(format);
+	if (!entry) {
 		LOG(Formats, Warning)
 			<< "Unsupported pixel format "
 			<< utils::hex(format.fourcc());
 		return pixelFormatInfoInvalid;
 	}
 
-	return iter->second;
+	return entry->second;
 }
 
 /**
@@ -1015,11 +1032,11 @@ const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
 	if (!pixelFormat.isValid())
 		return pixelFormatInfoInvalid;
 
-	const auto iter = pixelFormatInfo.find(pixelFormat);
-	if (iter == pixelFormatInfo.end())
+	const PixelFormatInfoEntry *entry = pixelFormatIndex.find(pixelFormat);
+	if (!entry)
 		return pixelFormatInfoInvalid;
 
-	return iter->second;
+	return entry->second;
 }
 
 /**
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Fixed-size storage of per-frame information for pipeline handlers
+ */
+
+#include "libcamera/internal/frame_info_ring.h"
+
+/**
+ * \file frame_info_ring.h
+ * \brief Fixed-size storage of per-frame information for pipeline handlers
+ */
+
+namespace libcamera {
+
+/**
+ * \class FrameInfoRing
+ * \brief Preallocated slots to track the frames processed by a pipeline handler
+ * \tparam Info The pipeline handler-specific per-frame information type
+ *
+ * Pipeline handlers for ISPs track information for every frame in flight,
+ * such as the request, the parameters and statistics buffers and the
+ * completion state. The FrameInfoRing stores that information in a fixed
+ * number of slots allocated upfront, avoiding dynamic allocations for every
+ * frame.
+ *
+ * Slots are looked up by frame number, starting at the slot indexed by the
+ * frame number modulo the ring size. As frames are normally completed in
+ * order, the lookup typically stops at the first slot. Frames whose slot is
+ * still in use by an older frame are stored in the next free slot, to support
+ * gaps in the frame numbers.
+ *
+ * Slots are reused without being reinitialised. This allows pipeline handlers
+ * to bind resources, such as parameters and statistics buffers, to a slot
+ * once when configuring the pipeline, through operator[](). The per-frame
+ * fields must be initialised by the caller when allocating a slot with
+ * alloc().
+ */
+
+/**
+ * \fn FrameInfoRing::FrameInfoRing()
+ * \brief Construct an empty FrameInfoRing
+ *
+ * The ring has no slot, resize() shall be called before any frame can be
+ * allocated.
+ */
+
+/**
+ * \fn FrameInfoRing::resize()
+ * \brief Set the number of slots in the ring
+ * \param[in] size The number of slots
+ *
+ * All existing slots are destroyed, and \a size default-constructed slots are
+ * allocated. This sets the maximum number of frames that can be tracked.
+ */
+
+/**
+ * \fn FrameInfoRing::clear()
+ * \brief Release all slots
+ *
+ * The contents of the slots is preserved.
+ */
+
+/**
+ * \fn FrameInfoRing::size()
+ * \brief Retrieve the number of slots in the ring
+ * \return The number of slots
+ */
+
+/**
+ * \fn FrameInfoRing::operator[](unsigned int index)
+ * \brief Access a slot by index
+ * \param[in] index The slot index, smaller than size()
+ * \return A reference to the slot information
+ */
+
+/**
+ * \fn FrameInfoRing::operator[](unsigned int index) const
+ * \copydoc FrameInfoRing::operator[](unsigned int index)
+ */
+
+/**
+ * \fn FrameInfoRing::alloc()
+ * \brief Allocate a slot for a frame
+ * \param[in] frame The frame number
+ * \return A pointer to the slot information, or nullptr if all slots are in
+ * use
+ */
+
+/**
+ * \fn FrameInfoRing::release()
+ * \brief Release a slot
+ * \param[in] info The slot information, as returned by alloc()
+ */
+
+/**
+ * \fn FrameInfoRing::find(unsigned int frame)
+ * \brief Find the slot allocated for a frame
+ * \param[in] frame The frame number
+ * \return A pointer to the slot information, or nullptr if no slot is
+ * allocated for \a frame
+ */
+
+/**
+ * \fn FrameInfoRing::findIf()
+ * \brief Find an allocated slot matching a predicate
+ * \tparam Predicate The predicate type
+ * \param[in] pred The predicate, called with a reference to the slot
+ * information and returning true when it matches
+ * \return A pointer to the first matching slot information, or nullptr if no
+ * allocated slot matches
+ */
+
+} /* namespace libcamera */
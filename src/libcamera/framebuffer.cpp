@@ -8,11 +8,19 @@
 #include <libcamera/framebuffer.h>
 #include "libcamera/internal/framebuffer.h"
 
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <utility>
+
+#include <linux/dma-buf.h>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/shared_fd.h>
 
+#include <libcamera/fence.h>
+
 /**
  * \file libcamera/framebuffer.h
  * \brief Frame buffer handling
@@ -207,6 +215,46 @@ FrameBuffer::Private::~Private()
  * \return Dynamic metadata for the frame contained in the buffer
  */
 
+/**
+ * \brief Retrieve a persistent memory mapping of the frame buffer
+ * \param[in] flags The mapping protection flags
+ *
+ * Mapping and unmapping large buffers for every CPU access is expensive, due to
+ * the page table updates and TLB shootdowns it requires. This function creates
+ * a mapping of all the buffer planes the first time it is called for a set of
+ * protection \a flags, and returns the same mapping in subsequent calls. A read
+ * and write mapping is reused for read-only or write-only accesses if it
+ * exists. The mappings are kept until the frame buffer is destroyed.
+ *
+ * This function is used by MappedFrameBuffer for the
+ * MappedFrameBuffer::MapFlag::Persistent flag and shall not be called directly.
+ *
+ * \return The mapping, or nullptr if the frame buffer can't be mapped
+ */
+const MappedFrameBuffer *
+FrameBuffer::Private::mapping(MappedFrameBuffer::MapFlags flags) const
+{
+	using MapFlag = MappedFrameBuffer::MapFlag;
+	using MapFlags = MappedFrameBuffer::MapFlags;
+
+	flags &= MapFlag::ReadWrite;
+
+	MutexLocker locker(mappingsLock_);
+
+	for (MapFlags key : { flags, MapFlags(MapFlag::ReadWrite) }) {
+		auto it = mappings_.find(static_cast<MapFlags::Type>(key));
+		if (it != mappings_.end())
+			return it->second.get();
+	}
+
+	auto map = std::make_unique<MappedFrameBuffer>(LIBCAMERA_O_PTR(), flags);
+	if (!map->isValid())
+		return nullptr;
+
+	auto it = mappings_.emplace(static_cast<MapFlags::Type>(flags), std::move(map)).first;
+	return it->second.get();
+}
+
 /**
  * \class FrameBuffer
  * \brief Frame buffer data and its associated dynamic metadata
@@ -248,6 +296,15 @@ FrameBuffer::Private::~Private()
  * and different offsets. No two planes may overlap, as specified by their
  * offset and length.
  *
+ * Planes stored in the same dmabuf may be given distinct file descriptors, for
+ * instance duplicated from the same file descriptor when importing a buffer.
+ * The FrameBuffer constructor detects this case and replaces the file
+ * descriptors of those planes with the file descriptor of the first plane
+ * stored in the same dmabuf, closing the duplicates if they are not referenced
+ * elsewhere. Planes of a FrameBuffer are thus stored in the same dmabuf if and
+ * only if their \a fd compare equal, which allows mapping or importing each
+ * dmabuf once for all its planes.
+ *
  * To support DMA access, planes are associated with dmabuf objects represented
  * by SharedFD handles. The Plane class doesn't handle mapping of the memory to
  * the CPU, but applications and IPAs may use the dmabuf file descriptors to map
@@ -279,10 +336,11 @@ FrameBuffer::Private::~Private()
 
 namespace {
 
-ino_t fileDescriptorInode(const SharedFD &fd)
+/* Identify the file referenced by a file descriptor, or return {} on error. */
+std::pair<dev_t, ino_t> fileDescriptorId(const SharedFD &fd)
 {
 	if (!fd.isValid())
-		return 0;
+		return {};
 
 	struct stat st;
 	int ret = fstat(fd.get(), &st);
@@ -290,10 +348,10 @@ ino_t fileDescriptorInode(const SharedFD &fd)
 		ret = -errno;
 		LOG(Buffer, Fatal)
 			<< "Failed to fstat() fd: " << strerror(-ret);
-		return 0;
+		return {};
 	}
 
-	return st.st_ino;
+	return { st.st_dev, st.st_ino };
 }
 
 } /* namespace */
@@ -315,31 +373,46 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
 FrameBuffer::FrameBuffer(std::unique_ptr<Private> d)
 	: Extensible(std::move(d))
 {
+	std::vector<Plane> &planes = _d()->planes_;
+
+	/*
+	 * Two different dmabuf file descriptors may still refer to the same
+	 * dmabuf instance. Check this using inodes, and make planes stored in
+	 * the same dmabuf share a single file descriptor, to map and import
+	 * the dmabuf once and release the duplicated file descriptors.
+	 */
+	std::vector<std::pair<dev_t, ino_t>> ids(planes.size());
+
+	for (unsigned int i = 1; i < planes.size(); i++) {
+		Plane &plane = planes[i];
+
+		for (unsigned int j = 0; j < i; j++) {
+			if (plane.fd == planes[j].fd)
+				break;
+
+			if (ids[i] == std::pair<dev_t, ino_t>{})
+				ids[i] = fileDescriptorId(plane.fd);
+			if (ids[j] == std::pair<dev_t, ino_t>{})
+				ids[j] = fileDescriptorId(planes[j].fd);
+
+			if (ids[i] != std::pair<dev_t, ino_t>{} && ids[i] == ids[j]) {
+				plane.fd = planes[j].fd;
+				break;
+			}
+		}
+	}
+
 	unsigned int offset = 0;
 	bool isContiguous = true;
-	ino_t inode = 0;
 
-	for (const auto &plane : _d()->planes_) {
+	for (const auto &plane : planes) {
 		ASSERT(plane.offset != Plane::kInvalidOffset);
 
-		if (plane.offset != offset) {
+		if (plane.offset != offset || plane.fd != planes[0].fd) {
 			isContiguous = false;
 			break;
 		}
 
-		/*
-		 * Two different dmabuf file descriptors may still refer to the
-		 * same dmabuf instance. Check this using inodes.
-		 */
-		if (plane.fd != _d()->planes_[0].fd) {
-			if (!inode)
-				inode = fileDescriptorInode(_d()->planes_[0].fd);
-			if (fileDescriptorInode(plane.fd) != inode) {
-				isContiguous = false;
-				break;
-			}
-		}
-
 		offset += plane.length;
 	}
 
@@ -433,4 +506,43 @@ std::unique_ptr<Fence> FrameBuffer::releaseFence()
 	return std::move(_d()->fence_);
 }
 
+/**
+ * \brief Export a Fence for the pending writes to the buffer
+ *
+ * This function exports a sync_file Fence that is signalled when all the
+ * pending device writes to the buffer memory have completed. It is meant to
+ * be called on completed buffers, to pass a fence to consumers such as GPUs
+ * or display controllers. They can then wait for the fence in hardware
+ * instead of relying on the CPU to wait for the buffer to be ready.
+ *
+ * The fence is exported from the dmabuf of the first plane using the
+ * DMA_BUF_IOCTL_EXPORT_SYNC_FILE ioctl, and thus requires kernel support for
+ * that ioctl. Devices that don't attach fences to the buffers they write
+ * produce a fence that is already signalled.
+ *
+ * \return A unique pointer to the Fence, or nullptr if the fence can't be
+ * exported
+ */
+std::unique_ptr<Fence> FrameBuffer::exportFence() const
+{
+	const std::vector<Plane> &planes = _d()->planes_;
+	if (planes.empty())
+		return nullptr;
+
+	struct dma_buf_export_sync_file exportSync = {};
+	exportSync.flags = DMA_BUF_SYNC_READ;
+	exportSync.fd = -1;
+
+	int ret = ::ioctl(planes[0].fd.get(), DMA_BUF_IOCTL_EXPORT_SYNC_FILE,
+			  &exportSync);
+	if (ret < 0) {
+		ret = errno;
+		LOG(Buffer, Debug)
+			<< "Failed to export fence: " << strerror(ret);
+		return nullptr;
+	}
+
+	return std::make_unique<Fence>(UniqueFD(exportSync.fd));
+}
+
 } /* namespace libcamera */
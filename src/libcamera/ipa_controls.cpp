@@ -19,57 +19,47 @@
  *
  * A control packet contains a list of entries, each of them describing a single
  * control info or control value. The packet starts with a fixed-size header
- * described by the ipa_controls_header structure, followed by an array of
- * fixed-size entries. Each entry is associated with data, stored either
- * directly in the entry, or in a data section after the entries array.
+ * described by the ipa_controls_header structure, followed by the entries.
  *
- * The following diagram describes the layout of the ControlList packet.
+ * ControlList packets are transferred for every request and are thus kept
+ * compact. Each entry is a fixed-size ipa_control_value_entry immediately
+ * followed by the value data, as described by the following diagram.
  *
  * ~~~~
  *           +-------------------------+    .                      .
  *  Header / | ipa_controls_header     |    |                      |
- *         | |                         |    |                      |
+ *         | |                         |    | hdr.data_offset      |
  *         \ |                         |    |                      |
- *           +-------------------------+    |                      |
- *         / | ipa_control_value_entry |    | hdr.data_offset      |
- *         | | #0                      |    |                      |
- * Control | +-------------------------+    |                      |
- *   value | | ...                     |    |                      |
- * entries | +-------------------------+    |                      |
- *         | | ipa_control_value_entry |    |             hdr.size |
- *         \ | #hdr.entries - 1        |    |                      |
- *           +-------------------------+    |                      |
- *           | empty space (optional)  |    |                      |
- *           +-------------------------+ <--´  .                   |
- *         / | ...                     |       | entry[n].offset   |
- *    Data | | ...                     |       |                   |
- * section | | value data for entry #n | <-----´                   |
- *         \ | ...                     |                           |
+ *           +-------------------------+ <--´                      |
+ *         / | ipa_control_value_entry |                           |
+ *         | | #0                      |                           |
+ *         | +-------------------------+                           |
+ *         | | value data for entry #0 |                           |
+ * Control | +-------------------------+                           |
+ *  values | | ...                     |                  hdr.size |
+ *         | +-------------------------+                           |
+ *         | | ipa_control_value_entry |                           |
+ *         | | #hdr.entries - 1        |                           |
+ *         | +-------------------------+                           |
+ *         \ | value data for entry #n |                           |
  *           +-------------------------+                           |
  *           | empty space (optional)  |                           |
  *           +-------------------------+ <-------------------------´
  * ~~~~
  *
  * The packet header contains the size of the packet, the number of entries, and
- * the offset from the beginning of the packet to the data section. The packet
- * entries array immediately follows the header. The data section starts at the
- * offset ipa_controls_header::data_offset from the beginning of the packet, and
- * shall be aligned to a multiple of 8 bytes.
+ * the offset from the beginning of the packet to the first entry.
  *
  * Entries are described by the ipa_control_value_entry structure. They contain
  * the numerical ID of the control, its type, and the number of control values.
+ * The control values are stored right after the entry in the platform's native
+ * format, without any padding, and their size is fully determined by the type
+ * and number of values. Entries and values are thus not aligned, and parsers
+ * shall not assume any alignment. Entries shall be stored in increasing
+ * numerical ID order.
  *
- * The control values are stored in the data section in the platform's native
- * format. The ipa_control_value_entry::offset field stores the offset from the
- * beginning of the data section to the values.
- *
- * All control values in the data section shall be stored in the same order as
- * the respective control entries, shall be aligned to a multiple of 8 bytes,
- * and shall be contiguous in memory.
- *
- * Empty spaces may be present between the end of the entries array and the
- * data section, and after the data section. They shall be ignored when parsing
- * the packet.
+ * Empty space may be present after the last entry. It shall be ignored when
+ * parsing the packet.
  *
  * The following diagram describes the layout of the ControlInfoMap packet.
  *
@@ -126,9 +116,15 @@
  * entries array, shall be aligned to a multiple of 8 bytes, and shall be
  * contiguous in memory.
  *
- * As for the ControlList packet, empty spaces may be present between the end of
- * the entries array and the data section, and after the data section. They
- * shall be ignored when parsing the packet.
+ * Empty spaces may be present between the end of the entries array and the
+ * data section, and after the data section. They shall be ignored when parsing
+ * the packet.
+ *
+ * As a ControlInfoMap is usually transferred multiple times over the lifetime
+ * of an IPA module, the serializer only transfers its contents the first time.
+ * Subsequent transfers use a header-only packet with the
+ * IPA_CONTROLS_FLAG_CACHED flag set, whose handle references the previously
+ * transferred ControlInfoMap.
  */
 
 namespace libcamera {
@@ -138,6 +134,16 @@ namespace libcamera {
  * \brief The current control serialization format version
  */
 
+/**
+ * \def IPA_CONTROLS_FLAG_CACHED
+ * \brief The ControlInfoMap packet references a previously transferred map
+ *
+ * When this flag is set in the ipa_controls_header::flags field of a
+ * ControlInfoMap packet, the packet contains no entry, and the handle
+ * identifies a ControlInfoMap that has been transferred before in either
+ * direction.
+ */
+
 /**
  * \var ipa_controls_id_map_type
  * \brief Enumerates the different control id map types
@@ -182,6 +188,8 @@ namespace libcamera {
  * Offset in bytes from the beginning of the packet of the data section start
  * \var ipa_controls_header::id_map_type
  * The id map type as defined by the ipa_controls_id_map_type enumeration
+ * \var ipa_controls_header::flags
+ * Packet flags (IPA_CONTROLS_FLAG_*)
  * \var ipa_controls_header::reserved
  * Reserved for future extensions
  */
@@ -200,14 +208,9 @@ static_assert(sizeof(ipa_controls_header) == 32,
  * True if the control value stores an array, false otherwise
  * \var ipa_control_value_entry::count
  * The number of control array entries for array controls (1 otherwise)
- * \var ipa_control_value_entry::offset
- * The offset in bytes from the beginning of the data section to the control
- * value data (shall be a multiple of 8 bytes).
- * \var ipa_control_value_entry::padding
- * Padding bytes (shall be set to 0)
  */
 
-static_assert(sizeof(ipa_control_value_entry) == 16,
+static_assert(sizeof(ipa_control_value_entry) == 8,
 	      "Invalid ABI size change for struct ipa_control_value_entry");
 
 /**
@@ -314,19 +314,29 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlList";
 
-	size_t size;
-	std::vector<uint8_t> infoData;
-	int ret;
-
 	/*
 	 * \todo Revisit this opportunistic serialization of the
 	 * ControlInfoMap, as it could be fragile
 	 */
-	if (data.infoMap() && !cs->isCached(*data.infoMap())) {
-		size = cs->binarySize(*data.infoMap());
-		infoData.resize(size);
-		ByteStreamBuffer buffer(infoData.data(), infoData.size());
-		ret = cs->serialize(*data.infoMap(), buffer);
+	const ControlInfoMap *infoMap = data.infoMap();
+	if (infoMap && cs->isCached(*infoMap))
+		infoMap = nullptr;
+
+	size_t infoSize = infoMap ? cs->binarySize(*infoMap) : 0;
+	size_t listSize = cs->binarySize(data);
+
+	/* Serialize the map and the list in place, avoiding copies. */
+	std::vector<uint8_t> dataVec;
+	dataVec.reserve(8 + infoSize + listSize);
+	appendPOD<uint32_t>(dataVec, infoSize);
+	appendPOD<uint32_t>(dataVec, listSize);
+	dataVec.resize(8 + infoSize + listSize);
+
+	int ret;
+
+	if (infoMap) {
+		ByteStreamBuffer buffer(dataVec.data() + 8, infoSize);
+		ret = cs->serialize(*infoMap, buffer);
 
 		if (ret < 0 || buffer.overflow()) {
 			LOG(IPADataSerializer, Error) << "Failed to serialize ControlList's ControlInfoMap";
@@ -334,9 +344,7 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		}
 	}
 
-	size = cs->binarySize(data);
-	std::vector<uint8_t> listData(size);
-	ByteStreamBuffer buffer(listData.data(), listData.size());
+	ByteStreamBuffer buffer(dataVec.data() + 8 + infoSize, listSize);
 	ret = cs->serialize(data, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -344,13 +352,6 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	dataVec.reserve(8 + infoData.size() + listData.size());
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	appendPOD<uint32_t>(dataVec, listData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-	dataVec.insert(dataVec.end(), listData.begin(), listData.end());
-
 	return { dataVec, {} };
 }
 
@@ -439,9 +440,17 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlInfoMap";
 
+	/*
+	 * Maps that have already been transferred are serialized as a
+	 * reference to their handle.
+	 */
 	size_t size = cs->binarySize(map);
-	std::vector<uint8_t> infoData(size);
-	ByteStreamBuffer buffer(infoData.data(), infoData.size());
+	std::vector<uint8_t> dataVec;
+	dataVec.reserve(4 + size);
+	appendPOD<uint32_t>(dataVec, size);
+	dataVec.resize(4 + size);
+
+	ByteStreamBuffer buffer(dataVec.data() + 4, size);
 	int ret = cs->serialize(map, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -449,10 +458,6 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-
 	return { dataVec, {} };
 }
 
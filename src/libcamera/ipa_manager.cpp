@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <libcamera/base/file.h>
@@ -18,6 +19,7 @@
 
 #include "libcamera/internal/ipa_module.h"
 #include "libcamera/internal/ipa_proxy.h"
+#include "libcamera/internal/ipc_pipe_unixsocket.h"
 #include "libcamera/internal/pipeline_handler.h"
 
 /**
@@ -85,6 +87,14 @@ LOG_DEFINE_CATEGORY(IPAManager)
  * +---------------+      over IPC     +---------------+
  * ~~~~
  *
+ * Spawning the proxy worker process and loading the IPA module in it is
+ * costly. Systems with multiple cameras handled by the same IPA module can set
+ * the LIBCAMERA_IPA_PROXY_PRESPAWN environment variable to have the manager
+ * spawn a spare worker in the background every time a worker is used. The
+ * next proxy for the same module then picks the spare worker up, which has
+ * already completed its startup. Spare workers are isolated exactly like any
+ * other worker.
+ *
  * The IPAInterface implemented by the IPAContextWrapper or IPAProxy is
  * returned to the pipeline handler, and all interactions with the IPA context
  * go the same interface regardless of process isolation.
@@ -104,6 +114,7 @@ IPAManager *IPAManager::self_ = nullptr;
  * CameraManager.
  */
 IPAManager::IPAManager()
+	: prespawn_(false)
 {
 	if (self_)
 		LOG(IPAManager, Fatal)
@@ -155,11 +166,16 @@ IPAManager::IPAManager()
 		LOG(IPAManager, Warning)
 			<< "No IPA found in '" IPA_MODULE_DIR "'";
 
+	const char *prespawn = utils::secure_getenv("LIBCAMERA_IPA_PROXY_PRESPAWN");
+	prespawn_ = prespawn && prespawn[0] != '\0';
+
 	self_ = this;
 }
 
 IPAManager::~IPAManager()
 {
+	spares_.clear();
+
 	for (IPAModule *module : modules_)
 		delete module;
 
@@ -280,6 +296,46 @@ IPAModule *IPAManager::module(PipelineHandler *pipe, uint32_t minVersion,
  * found or if the IPA proxy fails to initialize
  */
 
+/**
+ * \brief Create an IPC pipe to a proxy worker for an isolated IPA module
+ * \param[in] ipam The IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ *
+ * This function is used by IPA proxies to spawn their proxy worker. When
+ * worker prespawning is enabled, a spare worker previously spawned for the
+ * same \a ipam and \a workerPath is returned if available, and a new spare
+ * worker is spawned to replace it.
+ *
+ * \return The IPC pipe to the proxy worker, which may not be connected if the
+ * worker failed to start
+ */
+std::unique_ptr<IPCPipeUnixSocket>
+IPAManager::createPipe(const IPAModule *ipam, const std::string &workerPath)
+{
+	std::unique_ptr<IPCPipeUnixSocket> pipe;
+
+	if (!self_ || !self_->prespawn_)
+		return std::make_unique<IPCPipeUnixSocket>(ipam->path().c_str(),
+							   workerPath.c_str());
+
+	std::unique_ptr<IPCPipeUnixSocket> &spare =
+		self_->spares_[{ ipam->path(), workerPath }];
+
+	if (spare && spare->isConnected()) {
+		LOG(IPAManager, Debug)
+			<< "Using spare proxy worker for " << ipam->path();
+		pipe = std::move(spare);
+	} else {
+		pipe = std::make_unique<IPCPipeUnixSocket>(ipam->path().c_str(),
+							   workerPath.c_str());
+	}
+
+	spare = std::make_unique<IPCPipeUnixSocket>(ipam->path().c_str(),
+						    workerPath.c_str());
+
+	return pipe;
+}
+
 #if HAVE_IPA_PUBKEY
 /**
  * \fn IPAManager::pubKey()
@@ -304,15 +360,37 @@ bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
 		return false;
 	}
 
-	File file{ ipa->path() };
-	if (!file.open(File::OpenModeFlag::ReadOnly))
+	/*
+	 * Verifying the signature requires reading the whole module. Cache
+	 * the result, and only verify the module again if it has been
+	 * modified since the last verification.
+	 */
+	struct stat st;
+	if (stat(ipa->path().c_str(), &st))
 		return false;
 
-	Span<uint8_t> data = file.map();
-	if (data.empty())
-		return false;
+	const std::vector<uint8_t> signature = ipa->signature();
+	SignatureCacheEntry &entry = signatureCache_[ipa->path()];
+
+	if (!entry.verified || entry.mtime.tv_sec != st.st_mtim.tv_sec ||
+	    entry.mtime.tv_nsec != st.st_mtim.tv_nsec ||
+	    entry.size != st.st_size || entry.signature != signature) {
+		File file{ ipa->path() };
+		if (!file.open(File::OpenModeFlag::ReadOnly))
+			return false;
+
+		Span<uint8_t> data = file.map();
+		if (data.empty())
+			return false;
+
+		entry.verified = true;
+		entry.mtime = st.st_mtim;
+		entry.size = st.st_size;
+		entry.signature = signature;
+		entry.valid = pubKey_.verify(data, signature);
+	}
 
-	bool valid = pubKey_.verify(data, ipa->signature());
+	bool valid = entry.valid;
 
 	LOG(IPAManager, Debug)
 		<< "IPA module " << ipa->path() << " signature is "
@@ -256,8 +256,8 @@ Span<const uint8_t> elfLoadSymbol(Span<const uint8_t> elf, const char *symbol)
  * IPAModule instance to verify the validity of the IPAModule.
  */
 IPAModule::IPAModule(const std::string &libPath)
-	: libPath_(libPath), valid_(false), loaded_(false),
-	  dlHandle_(nullptr), ipaCreate_(nullptr)
+	: signatureLoaded_(false), libPath_(libPath), valid_(false),
+	  loaded_(false), dlHandle_(nullptr), ipaCreate_(nullptr)
 {
 	if (loadIPAModuleInfo() < 0)
 		return;
@@ -319,21 +319,26 @@ int IPAModule::loadIPAModuleInfo()
 		return -EINVAL;
 	}
 
-	/* Load the signature. Failures are not fatal. */
+	return 0;
+}
+
+void IPAModule::loadSignature() const
+{
+	signatureLoaded_ = true;
+
+	/* Failures are not fatal. */
 	File sign{ libPath_ + ".sign" };
 	if (!sign.open(File::OpenModeFlag::ReadOnly)) {
 		LOG(IPAModule, Debug)
 			<< "IPA module " << libPath_ << " is not signed";
-		return 0;
+		return;
 	}
 
-	data = sign.map(0, -1, File::MapFlag::Private);
+	Span<const uint8_t> data = sign.map(0, -1, File::MapFlag::Private);
 	signature_.resize(data.size());
 	memcpy(signature_.data(), data.data(), data.size());
 
 	LOG(IPAModule, Debug) << "IPA module " << libPath_ << " is signed";
-
-	return 0;
 }
 
 /**
@@ -368,14 +373,18 @@ const struct IPAModuleInfo &IPAModule::info() const
  * \brief Retrieve the IPA module signature
  *
  * The IPA module signature is stored alongside the IPA module in a file with a
- * '.sign' suffix, and is loaded when the IPAModule instance is created. This
- * function returns the signature without verifying it. If the signature is
- * missing, the returned vector will be empty.
+ * '.sign' suffix, and is loaded the first time this function is called, as
+ * only the modules used by pipeline handlers need to have their signature
+ * verified. This function returns the signature without verifying it. If the
+ * signature is missing, the returned vector will be empty.
  *
  * \return The IPA module signature
  */
 const std::vector<uint8_t> IPAModule::signature() const
 {
+	if (!signatureLoaded_)
+		loadSignature();
+
 	return signature_;
 }
 
@@ -51,7 +51,7 @@ LOG_DEFINE_CATEGORY(IPAProxy)
  * \param[in] ipam The IPA module
  */
 IPAProxy::IPAProxy(IPAModule *ipam)
-	: valid_(false), state_(ProxyStopped), ipam_(ipam)
+	: valid_(false), state_(ProxyStopped), directCalls_(false), ipam_(ipam)
 {
 }
 
@@ -69,6 +69,31 @@ IPAProxy::~IPAProxy()
  * \return True if the IPAProxy is valid, false otherwise
  */
 
+/**
+ * \brief Call the IPA functions directly from the pipeline handler thread
+ * \param[in] enable True to enable direct calls, false to disable them
+ *
+ * IPA modules that are not isolated run in a dedicated thread by default. All
+ * asynchronous functions are then queued to the IPA thread, and all signals
+ * emitted by the IPA are queued back to the pipeline handler thread, which
+ * costs context switches and copies of the arguments for every frame.
+ *
+ * When direct calls are enabled, the asynchronous functions are called
+ * synchronously in the thread of the caller, and the IPA signals are
+ * delivered synchronously to the pipeline handler. The pipeline handler must
+ * then handle signals emitted while it calls into the IPA, and the processing
+ * time of the IPA delays the events of the pipeline handler thread.
+ *
+ * Direct calls are opt-in for each pipeline handler. They are ignored for
+ * isolated IPA modules, and shall be selected while the proxy is stopped.
+ */
+void IPAProxy::setDirectCalls(bool enable)
+{
+	ASSERT(state_ == ProxyStopped);
+
+	directCalls_ = enable;
+}
+
 /**
  * \brief Retrieve the absolute path to an IPA configuration file
  * \param[in] name The configuration file name
@@ -229,6 +254,15 @@ std::string IPAProxy::resolvePath(const std::string &file) const
  * construction.
  */
 
+/**
+ * \var IPAProxy::directCalls_
+ * \brief Flag to indicate if asynchronous functions are called directly
+ *
+ * Implementations of the IPAProxy class that run the IPA in a thread should
+ * call the asynchronous functions synchronously when this flag is set, and
+ * skip starting the thread. \sa setDirectCalls()
+ */
+
 /**
  * \var IPAProxy::state_
  * \brief Current state of the IPAProxy
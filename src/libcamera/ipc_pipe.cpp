@@ -7,6 +7,8 @@
 
 #include "libcamera/internal/ipc_pipe.h"
 
+#include <string.h>
+
 #include <libcamera/base/log.h>
 
 /**
@@ -18,6 +20,17 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCPipe)
 
+namespace {
+
+/* Header of every message stored in a batch message. */
+struct BatchEntry {
+	IPCMessage::Header header;
+	uint32_t dataSize;
+	uint32_t numFds;
+};
+
+} /* namespace */
+
 /**
  * \struct IPCMessage::Header
  * \brief Container for an IPCMessage header
@@ -100,22 +113,134 @@ IPCMessage::IPCMessage(IPCUnixSocket::Payload &payload)
 IPCUnixSocket::Payload IPCMessage::payload() const
 {
 	IPCUnixSocket::Payload payload;
+	this->payload(&payload);
+	return payload;
+}
 
-	payload.data.resize(sizeof(Header) + data_.size());
-	payload.fds.reserve(fds_.size());
+/**
+ * \brief Convert the IPCMessage into an existing IPCUnixSocket payload
+ * \param[out] payload The IPCUnixSocket payload to fill
+ *
+ * The previous content of the \a payload is replaced. Its storage is reused,
+ * which avoids memory allocations when the same payload is used to send
+ * messages repeatedly.
+ */
+void IPCMessage::payload(IPCUnixSocket::Payload *payload) const
+{
+	payload->data.resize(sizeof(Header) + data_.size());
+	payload->fds.clear();
 
-	memcpy(payload.data.data(), &header_, sizeof(Header));
+	memcpy(payload->data.data(), &header_, sizeof(Header));
 
 	if (data_.size() > 0) {
 		/* \todo Make this work without copy */
-		memcpy(payload.data.data() + sizeof(Header),
+		memcpy(payload->data.data() + sizeof(Header),
 		       data_.data(), data_.size());
 	}
 
 	for (const SharedFD &fd : fds_)
-		payload.fds.push_back(fd.get());
+		payload->fds.push_back(fd.get());
+}
 
-	return payload;
+/**
+ * \brief Clear the data and file descriptors of the message
+ *
+ * The header command code is kept, and the number of messages of a batch
+ * message is reset to zero. The storage of the data is kept, to be reused for
+ * the next message.
+ */
+void IPCMessage::clear()
+{
+	data_.clear();
+	fds_.clear();
+
+	if (isBatch())
+		header_.cookie = 0;
+}
+
+/**
+ * \var IPCMessage::kBatchCmd
+ * \brief Command code of a message that batches multiple messages
+ *
+ * A batch message carries a sequence of messages, which the receiver shall
+ * handle in order as if they had been received individually. The header cookie
+ * of a batch message stores the number of messages it contains. Batch messages
+ * are created with append() and split with unbatch().
+ */
+
+/**
+ * \fn IPCMessage::isBatch()
+ * \brief Check if the message batches multiple messages
+ * \return True if the message is a batch message, false otherwise
+ */
+
+/**
+ * \brief Append \a message to a batch message
+ * \param[in] message The message to append
+ *
+ * The batch message must have been constructed with the kBatchCmd command
+ * code. The header, data and file descriptors of \a message are appended to
+ * the message.
+ */
+void IPCMessage::append(const IPCMessage &message)
+{
+	ASSERT(isBatch());
+
+	BatchEntry entry{
+		message.header_,
+		static_cast<uint32_t>(message.data_.size()),
+		static_cast<uint32_t>(message.fds_.size()),
+	};
+
+	const uint8_t *entryData = reinterpret_cast<const uint8_t *>(&entry);
+	data_.insert(data_.end(), entryData, entryData + sizeof(entry));
+	data_.insert(data_.end(), message.data_.begin(), message.data_.end());
+	fds_.insert(fds_.end(), message.fds_.begin(), message.fds_.end());
+
+	header_.cookie++;
+}
+
+/**
+ * \brief Split a batch message into the messages it contains
+ * \return The messages contained in the batch, in order, or an empty vector if
+ * the batch is malformed
+ */
+std::vector<IPCMessage> IPCMessage::unbatch() const
+{
+	std::vector<IPCMessage> messages;
+	messages.reserve(header_.cookie);
+
+	size_t offset = 0;
+	size_t fdOffset = 0;
+
+	for (uint32_t i = 0; i < header_.cookie; ++i) {
+		BatchEntry entry;
+
+		if (data_.size() - offset < sizeof(entry)) {
+			LOG(IPCPipe, Error) << "Truncated batch message";
+			return {};
+		}
+
+		memcpy(&entry, data_.data() + offset, sizeof(entry));
+		offset += sizeof(entry);
+
+		if (data_.size() - offset < entry.dataSize ||
+		    fds_.size() - fdOffset < entry.numFds) {
+			LOG(IPCPipe, Error) << "Truncated batch message";
+			return {};
+		}
+
+		IPCMessage &message = messages.emplace_back(entry.header);
+		message.data_.assign(data_.begin() + offset,
+				     data_.begin() + offset + entry.dataSize);
+		message.fds_.assign(fds_.begin() + fdOffset,
+				    fds_.begin() + fdOffset + entry.numFds);
+
+		offset += entry.dataSize;
+		fdOffset += entry.numFds;
+	}
+
+	return messages;
 }
 
 /**
@@ -199,7 +324,10 @@ IPCPipe::~IPCPipe()
  * \brief Send a message over IPC asynchronously
  * \param[in] data Data to send
  *
- * This function will return immediately after sending the message.
+ * This function will return immediately, without waiting for the message to
+ * be handled by the receiver. Implementations may defer sending the message
+ * to coalesce it with other asynchronous messages, but shall preserve the
+ * ordering of all messages sent through the pipe.
  *
  * \return Zero on success, negative error code otherwise
  */
@@ -7,12 +7,15 @@
 
 #include "libcamera/internal/ipc_pipe_unixsocket.h"
 
+#include <string.h>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/event_dispatcher.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/thread.h>
 #include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
 
 #include "libcamera/internal/ipc_pipe.h"
 #include "libcamera/internal/ipc_unixsocket.h"
@@ -26,14 +29,23 @@ LOG_DECLARE_CATEGORY(IPCPipe)
 
 IPCPipeUnixSocket::IPCPipeUnixSocket(const char *ipaModulePath,
 				     const char *ipaProxyWorkerPath)
-	: IPCPipe()
+	: IPCPipe(), pendingCount_(0), flushQueued_(false),
+	  batch_(IPCMessage::kBatchCmd)
 {
 	std::vector<int> fds;
 	std::vector<std::string> args;
 	args.push_back(ipaModulePath);
 
+	/*
+	 * Transporting payloads through shared memory avoids copying them
+	 * through the kernel. The proxy worker picks the shared memory up
+	 * automatically.
+	 */
+	const char *sharedMemory = utils::secure_getenv("LIBCAMERA_IPA_IPC_SHARED_MEMORY");
+	bool useSharedMemory = sharedMemory && sharedMemory[0] != '\0';
+
 	socket_ = std::make_unique<IPCUnixSocket>();
-	UniqueFD fd = socket_->create();
+	UniqueFD fd = socket_->create(useSharedMemory);
 	if (!fd.isValid()) {
 		LOG(IPCPipe, Error) << "Failed to create socket";
 		return;
@@ -55,12 +67,16 @@ IPCPipeUnixSocket::IPCPipeUnixSocket(const char *ipaModulePath,
 
 IPCPipeUnixSocket::~IPCPipeUnixSocket()
 {
+	flush();
 }
 
 int IPCPipeUnixSocket::sendSync(const IPCMessage &in, IPCMessage *out)
 {
 	IPCUnixSocket::Payload response;
 
+	/* Asynchronous messages sent before must be received first. */
+	flush();
+
 	int ret = call(in.payload(), &response, in.header().cookie);
 	if (ret) {
 		LOG(IPCPipe, Error) << "Failed to call sync";
@@ -73,37 +89,95 @@ int IPCPipeUnixSocket::sendSync(const IPCMessage &in, IPCMessage *out)
 	return 0;
 }
 
+/*
+ * Asynchronous messages are not sent immediately but queued, and a flush is
+ * scheduled through the event loop of the thread. All the messages sent during
+ * the current event loop iteration, typically by a pipeline handler queuing
+ * multiple asynchronous calls to the IPA for a frame, are then coalesced in a
+ * single batch message, saving system calls and context switches on both
+ * sides of the pipe.
+ */
 int IPCPipeUnixSocket::sendAsync(const IPCMessage &data)
 {
-	int ret = socket_->send(data.payload());
-	if (ret) {
-		LOG(IPCPipe, Error) << "Failed to call async";
-		return ret;
+	if (!connected_)
+		return -ENOTCONN;
+
+	/* Copy-assign to existing entries to reuse their storage. */
+	if (pendingCount_ < pending_.size())
+		pending_[pendingCount_] = data;
+	else
+		pending_.push_back(data);
+
+	pendingCount_++;
+
+	if (!flushQueued_) {
+		flushQueued_ = true;
+		invokeMethod(&IPCPipeUnixSocket::flush, ConnectionTypeQueued);
 	}
 
 	return 0;
 }
 
+void IPCPipeUnixSocket::flush()
+{
+	flushQueued_ = false;
+
+	if (!pendingCount_)
+		return;
+
+	/*
+	 * The batch message and the payload are reused for every flush, so
+	 * that no memory is allocated in steady state.
+	 */
+	if (pendingCount_ == 1) {
+		pending_.front().payload(&txPayload_);
+	} else {
+		batch_.clear();
+		for (size_t i = 0; i < pendingCount_; i++)
+			batch_.append(pending_[i]);
+
+		batch_.payload(&txPayload_);
+	}
+
+	int ret = socket_->send(txPayload_);
+	if (ret)
+		LOG(IPCPipe, Error)
+			<< "Failed to send " << pendingCount_
+			<< " async message(s): " << strerror(-ret);
+
+	/* Release the file descriptors, keeping the data storage. */
+	for (size_t i = 0; i < pendingCount_; i++)
+		pending_[i].fds().clear();
+	batch_.fds().clear();
+
+	pendingCount_ = 0;
+}
+
 void IPCPipeUnixSocket::readyRead()
 {
-	IPCUnixSocket::Payload payload;
-	int ret = socket_->receive(&payload);
+	int ret = socket_->receive(&rxPayload_);
 	if (ret) {
 		LOG(IPCPipe, Error) << "Receive message failed" << ret;
 		return;
 	}
 
 	/* \todo Use span to avoid the double copy when callData is found. */
-	if (payload.data.size() < sizeof(IPCMessage::Header)) {
+	if (rxPayload_.data.size() < sizeof(IPCMessage::Header)) {
 		LOG(IPCPipe, Error) << "Not enough data received";
 		return;
 	}
 
-	IPCMessage ipcMessage(payload);
+	IPCMessage ipcMessage(rxPayload_);
+
+	if (ipcMessage.isBatch()) {
+		for (const IPCMessage &message : ipcMessage.unbatch())
+			recv.emit(message);
+		return;
+	}
 
 	auto callData = callData_.find(ipcMessage.header().cookie);
 	if (callData != callData_.end()) {
-		*callData->second.response = std::move(payload);
+		std::swap(*callData->second.response, rxPayload_);
 		callData->second.done = true;
 		return;
 	}
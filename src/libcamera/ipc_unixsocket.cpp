@@ -7,14 +7,21 @@
 
 #include "libcamera/internal/ipc_unixsocket.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <new>
 #include <poll.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/shared_mem_object.h"
 
 /**
  * \file ipc_unixsocket.h
@@ -25,6 +32,143 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCUnixSocket)
 
+namespace {
+
+constexpr uint8_t kFlagSharedMemorySetup = 1 << 0;
+constexpr uint8_t kFlagSharedMemoryAck = 1 << 1;
+
+constexpr uint32_t kSharedRingSize = 128 * 1024;
+
+struct SharedRingHeader {
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+	      "Shared memory rings require lock-free atomics");
+
+constexpr std::size_t kSharedMemorySize =
+	2 * (sizeof(SharedRingHeader) + kSharedRingSize);
+
+struct SharedRecord {
+	uint32_t size;
+	uint32_t flags;
+};
+
+constexpr uint32_t kRecordOutOfBand = 1 << 0;
+
+/*
+ * Single producer, single consumer ring of records stored in shared memory.
+ * The head and tail are free-running counters, written by the producer and
+ * consumer respectively.
+ */
+class SharedRing
+{
+public:
+	SharedRing()
+		: header_(nullptr), data_(nullptr)
+	{
+	}
+
+	SharedRing(uint8_t *mem)
+		: header_(reinterpret_cast<SharedRingHeader *>(mem)),
+		  data_(mem + sizeof(SharedRingHeader))
+	{
+	}
+
+	bool hasSpace(std::size_t size) const
+	{
+		uint32_t head = header_->head.load(std::memory_order_relaxed);
+		uint32_t tail = header_->tail.load(std::memory_order_acquire);
+
+		return size <= kSharedRingSize &&
+		       recordSize(size) <= kSharedRingSize - (head - tail);
+	}
+
+	/* The caller shall check that the ring has enough space. */
+	void write(const SharedRecord &record, const uint8_t *data)
+	{
+		uint32_t head = header_->head.load(std::memory_order_relaxed);
+		uint32_t size = recordSize(record.size);
+
+		copyIn(head, &record, sizeof(record));
+		if (data)
+			copyIn(head + sizeof(record), data, record.size);
+
+		header_->head.store(head + size, std::memory_order_release);
+	}
+
+	int read(SharedRecord *record, std::vector<uint8_t> *data)
+	{
+		uint32_t tail = header_->tail.load(std::memory_order_relaxed);
+		uint32_t head = header_->head.load(std::memory_order_acquire);
+		uint32_t available = head - tail;
+
+		if (!available)
+			return -EAGAIN;
+
+		/* Don't trust the other side of the channel. */
+		if (available > kSharedRingSize || available < sizeof(*record))
+			return -EPROTO;
+
+		copyOut(tail, record, sizeof(*record));
+		if (record->size > available - sizeof(*record))
+			return -EPROTO;
+
+		data->resize(record->size);
+		copyOut(tail + sizeof(*record), data->data(), record->size);
+
+		header_->tail.store(tail + recordSize(record->size),
+				    std::memory_order_release);
+
+		return 0;
+	}
+
+private:
+	static uint32_t recordSize(uint32_t size)
+	{
+		return utils::alignUp(sizeof(SharedRecord) + size, 8);
+	}
+
+	void copyIn(uint32_t pos, const void *src, std::size_t size)
+	{
+		if (!size)
+			return;
+
+		uint32_t offset = pos % kSharedRingSize;
+		std::size_t first = std::min<std::size_t>(size, kSharedRingSize - offset);
+
+		memcpy(data_ + offset, src, first);
+		memcpy(data_, static_cast<const uint8_t *>(src) + first, size - first);
+	}
+
+	void copyOut(uint32_t pos, void *dst, std::size_t size) const
+	{
+		if (!size)
+			return;
+
+		uint32_t offset = pos % kSharedRingSize;
+		std::size_t first = std::min<std::size_t>(size, kSharedRingSize - offset);
+
+		memcpy(dst, data_ + offset, first);
+		memcpy(static_cast<uint8_t *>(dst) + first, data_, size - first);
+	}
+
+	SharedRingHeader *header_;
+	uint8_t *data_;
+};
+
+} /* namespace */
+
+struct IPCUnixSocket::SharedMemoryChannel {
+	SharedMem mem;
+	SharedRing tx;
+	SharedRing rx;
+	UniqueFD txEvent;
+	UniqueFD rxEvent;
+	std::unique_ptr<EventNotifier> notifier;
+};
+
 /**
  * \struct IPCUnixSocket::Payload
  * \brief Container for an IPC payload
@@ -65,6 +209,16 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  * it to the other side by passing the file descriptor to bind(). At that point
  * the channel is operation and communication is bidirectional and symmmetrical.
  *
+ * To avoid copying payloads through the kernel, the channel can optionally
+ * transport them through shared memory. In that mode, the side that creates
+ * the channel allocates a memfd-backed ring for each direction, and passes it
+ * along with two eventfds to the remote side as the first message on the
+ * socket. The remote side sets the rings up transparently when it receives
+ * that message. Payloads are then copied to the rings and the receiver is
+ * notified through the eventfds. The socket is only used for payloads that
+ * carry file descriptors or don't fit in the ring, and a marker is stored in
+ * the ring to preserve the order of messages.
+ *
  * \context This class is \threadbound.
  */
 
@@ -80,6 +234,7 @@ IPCUnixSocket::~IPCUnixSocket()
 
 /**
  * \brief Create an new IPC channel
+ * \param[in] sharedMemory Transport payloads through shared memory
  *
  * This function creates a new IPC channel. The socket instance is bound to the
  * local side of the channel, and the function returns a file descriptor bound
@@ -87,9 +242,13 @@ IPCUnixSocket::~IPCUnixSocket()
  * to the remote process, where it can be used with IPCUnixSocket::bind() to
  * bind the remote side socket.
  *
+ * When \a sharedMemory is true, payloads are transported through shared memory
+ * rings. If the shared memory can't be allocated, the channel falls back to
+ * transporting all payloads through the socket.
+ *
  * \return A file descriptor. It is valid on success or invalid otherwise.
  */
-UniqueFD IPCUnixSocket::create()
+UniqueFD IPCUnixSocket::create(bool sharedMemory)
 {
 	int sockets[2];
 	int ret;
@@ -110,6 +269,57 @@ UniqueFD IPCUnixSocket::create()
 	if (bind(std::move(socketFds[0])) < 0)
 		return {};
 
+	if (!sharedMemory)
+		return std::move(socketFds[1]);
+
+	auto shm = std::make_unique<SharedMemoryChannel>();
+	shm->mem = SharedMem("ipc-unixsocket", kSharedMemorySize);
+
+	std::array<UniqueFD, 2> events{
+		UniqueFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)),
+		UniqueFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)),
+	};
+
+	if (!shm->mem || !events[0].isValid() || !events[1].isValid()) {
+		LOG(IPCUnixSocket, Warning)
+			<< "Failed to allocate shared memory, using socket only";
+		return std::move(socketFds[1]);
+	}
+
+	uint8_t *mem = shm->mem.mem().data();
+	uint8_t *ring = mem + sizeof(SharedRingHeader) + kSharedRingSize;
+	new (mem) SharedRingHeader{};
+	new (ring) SharedRingHeader{};
+
+	shm->tx = SharedRing(mem);
+	shm->rx = SharedRing(ring);
+
+	/*
+	 * Pass the shared memory to the remote side. The local side transmits
+	 * through the shared memory right away, but only starts receiving
+	 * from it once the remote side acknowledges the setup, to preserve the
+	 * order of messages that the remote side may have sent through the
+	 * socket before.
+	 */
+	Payload setup;
+	setup.data.resize(sizeof(kSharedRingSize));
+	memcpy(setup.data.data(), &kSharedRingSize, sizeof(kSharedRingSize));
+	setup.fds = { shm->mem.fd().get(), events[0].get(), events[1].get() };
+
+	if (sendMessage(setup, kFlagSharedMemorySetup) < 0) {
+		close();
+		return {};
+	}
+
+	shm->txEvent = std::move(events[0]);
+	shm->rxEvent = std::move(events[1]);
+	shm->notifier = std::make_unique<EventNotifier>(shm->rxEvent.get(),
+							EventNotifier::Read);
+	shm->notifier->setEnabled(false);
+	shm->notifier->activated.connect(this, &IPCUnixSocket::sharedMemoryNotifier);
+
+	shm_ = std::move(shm);
+
 	return std::move(socketFds[1]);
 }
 
@@ -145,6 +355,8 @@ void IPCUnixSocket::close()
 	if (!isBound())
 		return;
 
+	shm_.reset();
+
 	delete notifier_;
 	notifier_ = nullptr;
 
@@ -173,27 +385,16 @@ bool IPCUnixSocket::isBound() const
  */
 int IPCUnixSocket::send(const Payload &payload)
 {
-	int ret;
-
 	if (!isBound())
 		return -ENOTCONN;
 
-	Header hdr = {};
-	hdr.data = payload.data.size();
-	hdr.fds = payload.fds.size();
-
-	if (!hdr.data && !hdr.fds)
+	if (payload.data.empty() && payload.fds.empty())
 		return -EINVAL;
 
-	ret = ::send(fd_.get(), &hdr, sizeof(hdr), 0);
-	if (ret < 0) {
-		ret = -errno;
-		LOG(IPCUnixSocket, Error)
-			<< "Failed to send: " << strerror(-ret);
-		return ret;
-	}
+	if (shm_)
+		return sendShared(payload);
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return sendMessage(payload);
 }
 
 /**
@@ -218,6 +419,9 @@ int IPCUnixSocket::receive(Payload *payload)
 	if (!isBound())
 		return -ENOTCONN;
 
+	if (shm_ && shm_->notifier->enabled())
+		return receiveShared(payload);
+
 	if (!headerReceived_)
 		return -EAGAIN;
 
@@ -240,6 +444,30 @@ int IPCUnixSocket::receive(Payload *payload)
  * \brief A Signal emitted when a message is ready to be read
  */
 
+int IPCUnixSocket::sendMessage(const Payload &payload, uint8_t flags)
+{
+	int ret;
+
+	Header hdr = {};
+	hdr.data = payload.data.size();
+	hdr.fds = payload.fds.size();
+	hdr.flags = flags;
+
+	ret = ::send(fd_.get(), &hdr, sizeof(hdr), 0);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to send: " << strerror(-ret);
+		return ret;
+	}
+
+	/* Acknowledgement messages consist of a header only. */
+	if (!hdr.data && !hdr.fds)
+		return 0;
+
+	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+}
+
 int IPCUnixSocket::sendData(const void *buffer, size_t length,
 			    const int32_t *fds, unsigned int num)
 {
@@ -314,6 +542,127 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 	return 0;
 }
 
+int IPCUnixSocket::sendShared(const Payload &payload)
+{
+	SharedRecord record = {};
+
+	if (payload.fds.empty() &&
+	    shm_->tx.hasSpace(payload.data.size())) {
+		record.size = payload.data.size();
+		shm_->tx.write(record, payload.data.data());
+	} else {
+		/*
+		 * Send the payload through the socket, and store a marker in
+		 * the ring to let the receiver retrieve it in order. The socket
+		 * is non-blocking, the payload is thus fully queued when the
+		 * marker becomes visible.
+		 */
+		if (!shm_->tx.hasSpace(0)) {
+			LOG(IPCUnixSocket, Error) << "Shared memory ring full";
+			return -ENOBUFS;
+		}
+
+		int ret = sendMessage(payload);
+		if (ret < 0)
+			return ret;
+
+		record.flags = kRecordOutOfBand;
+		shm_->tx.write(record, nullptr);
+	}
+
+	uint64_t value = 1;
+	if (::write(shm_->txEvent.get(), &value, sizeof(value)) < 0) {
+		int ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to notify: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCUnixSocket::receiveShared(Payload *payload)
+{
+	SharedRecord record;
+	int ret = shm_->rx.read(&record, &payload->data);
+	if (ret < 0) {
+		if (ret == -EPROTO)
+			LOG(IPCUnixSocket, Error) << "Corrupted shared memory ring";
+		return ret;
+	}
+
+	if (!(record.flags & kRecordOutOfBand)) {
+		payload->fds.clear();
+		return 0;
+	}
+
+	/* The payload has been queued on the socket before the marker. */
+	Header hdr;
+	ret = ::recv(fd_.get(), &hdr, sizeof(hdr), 0);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to receive header: " << strerror(-ret);
+		return ret;
+	}
+
+	payload->data.resize(hdr.data);
+	payload->fds.resize(hdr.fds);
+
+	return recvData(payload->data.data(), hdr.data,
+			payload->fds.data(), hdr.fds);
+}
+
+int IPCUnixSocket::bindSharedMemory()
+{
+	std::vector<uint8_t> data(header_.data);
+	std::vector<int32_t> fds(header_.fds);
+
+	int ret = recvData(data.data(), data.size(), fds.data(), fds.size());
+	headerReceived_ = false;
+	if (ret < 0)
+		return ret;
+
+	std::vector<UniqueFD> setupFds;
+	for (int32_t fd : fds)
+		setupFds.emplace_back(fd);
+
+	uint32_t ringSize;
+	if (setupFds.size() != 3 || data.size() != sizeof(ringSize))
+		return -EINVAL;
+
+	memcpy(&ringSize, data.data(), sizeof(ringSize));
+	if (ringSize != kSharedRingSize)
+		return -EINVAL;
+
+	auto shm = std::make_unique<SharedMemoryChannel>();
+	shm->mem = SharedMem(SharedFD(std::move(setupFds[0])), kSharedMemorySize);
+	if (!shm->mem)
+		return -ENOMEM;
+
+	/* The rings and events are swapped compared to the local side. */
+	uint8_t *mem = shm->mem.mem().data();
+	shm->rx = SharedRing(mem);
+	shm->tx = SharedRing(mem + sizeof(SharedRingHeader) + kSharedRingSize);
+	shm->rxEvent = std::move(setupFds[1]);
+	shm->txEvent = std::move(setupFds[2]);
+	shm->notifier = std::make_unique<EventNotifier>(shm->rxEvent.get(),
+							EventNotifier::Read);
+	shm->notifier->activated.connect(this, &IPCUnixSocket::sharedMemoryNotifier);
+
+	ret = sendMessage({}, kFlagSharedMemoryAck);
+	if (ret < 0)
+		return ret;
+
+	/* All further messages are received through the shared memory. */
+	notifier_->setEnabled(false);
+	shm_ = std::move(shm);
+
+	LOG(IPCUnixSocket, Debug) << "Shared memory transport enabled";
+
+	return 0;
+}
+
 void IPCUnixSocket::dataNotifier()
 {
 	int ret;
@@ -331,6 +680,19 @@ void IPCUnixSocket::dataNotifier()
 		headerReceived_ = true;
 	}
 
+	/*
+	 * The remote side has set up the shared memory, switch to receiving
+	 * from it.
+	 */
+	if (header_.flags & kFlagSharedMemoryAck) {
+		headerReceived_ = false;
+		if (shm_) {
+			notifier_->setEnabled(false);
+			shm_->notifier->setEnabled(true);
+		}
+		return;
+	}
+
 	/*
 	 * If the payload has arrived, disable the notifier and emit the
 	 * readyRead signal. The notifier will be reenabled by the receive()
@@ -344,8 +706,27 @@ void IPCUnixSocket::dataNotifier()
 	if (!(fds.revents & POLLIN))
 		return;
 
+	if (header_.flags & kFlagSharedMemorySetup) {
+		ret = bindSharedMemory();
+		if (ret < 0)
+			LOG(IPCUnixSocket, Error)
+				<< "Failed to set up shared memory: "
+				<< strerror(-ret);
+		return;
+	}
+
 	notifier_->setEnabled(false);
 	readyRead.emit();
 }
 
+void IPCUnixSocket::sharedMemoryNotifier()
+{
+	/* The eventfd is a semaphore, each read consumes one message. */
+	uint64_t value;
+	if (::read(shm_->rxEvent.get(), &value, sizeof(value)) < 0)
+		return;
+
+	readyRead.emit();
+}
+
 } /* namespace libcamera */
@@ -0,0 +1,282 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Parameters and statistics buffers pool for ISP pipeline handlers
+ */
+
+#include "libcamera/internal/isp_buffer_pool.h"
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/v4l2_videodevice.h"
+
+/**
+ * \file isp_buffer_pool.h
+ * \brief Parameters and statistics buffers pool for ISP pipeline handlers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IspBufferPool)
+
+/**
+ * \class IspBufferPool
+ * \brief Cycle ISP parameters and statistics buffers through the IPA
+ *
+ * ISP pipeline handlers allocate parameters and statistics buffers on the ISP
+ * video devices, map them to the IPA module, and for every frame use one
+ * buffer of each type to pass the ISP parameters computed by the IPA with
+ * fillParamsBuffer() and return the ISP statistics with processStatsBuffer().
+ * The IspBufferPool implements this pattern once for all pipeline handlers.
+ *
+ * The pool allocates buffers in pairs with allocate(), and exposes the
+ * IPABuffer list to map to the IPA module with ipaBuffers(). Pipeline handlers
+ * then acquire() a pair of buffers when queuing a request to the device and
+ * release() it when the frame completes. Pairs are identified by an index,
+ * which pipeline handlers usually store alongside the frame sequence number
+ * in their per-frame information.
+ *
+ * The number of buffers is fixed at allocation time. The pool records its
+ * occupancy and the number of times a pair couldn't be acquired, which can be
+ * retrieved with statistics() and is logged when the buffers are freed, to
+ * help tuning the number of buffers for a platform.
+ *
+ * The pool isn't thread-safe, it shall be used from the pipeline handler
+ * thread only.
+ */
+
+/**
+ * \struct IspBufferPool::Statistics
+ * \brief Usage statistics of an IspBufferPool
+ *
+ * \var IspBufferPool::Statistics::occupancy
+ * \brief The number of buffer pairs currently acquired
+ *
+ * \var IspBufferPool::Statistics::peakOccupancy
+ * \brief The largest number of buffer pairs acquired at the same time
+ *
+ * \var IspBufferPool::Statistics::underruns
+ * \brief The number of times acquire() failed as all pairs were in use
+ *
+ * \var IspBufferPool::Statistics::cycles
+ * \brief The number of buffer pairs successfully acquired
+ */
+
+/**
+ * \brief Construct an IspBufferPool
+ * \param[in] name The pool name, used in log messages
+ */
+IspBufferPool::IspBufferPool(const std::string &name)
+	: name_(name), statistics_{}
+{
+}
+
+IspBufferPool::~IspBufferPool()
+{
+	free();
+}
+
+/**
+ * \brief Allocate parameters and statistics buffers
+ * \param[in] params The ISP parameters video device
+ * \param[in] stats The ISP statistics video device
+ * \param[in] count The number of buffer pairs to allocate
+ * \param[in] firstCookie The cookie of the first parameters buffer
+ *
+ * Allocate \a count buffers on each of the \a params and \a stats video
+ * devices. The parameters buffers are assigned cookies starting at
+ * \a firstCookie, followed by the statistics buffers, and the cookies are used
+ * as IPABuffer identifiers. Pipeline handlers that map the buffers of multiple
+ * pools to the same IPA module shall use distinct cookie ranges.
+ *
+ * If the devices allocate a different number of buffers, the pool is sized to
+ * the smallest of the two.
+ *
+ * \return The number of buffer pairs allocated on success or a negative error
+ * code otherwise
+ */
+int IspBufferPool::allocate(V4L2VideoDevice *params, V4L2VideoDevice *stats,
+			    unsigned int count, unsigned int firstCookie)
+{
+	std::vector<std::unique_ptr<FrameBuffer>> paramsBuffers;
+	std::vector<std::unique_ptr<FrameBuffer>> statsBuffers;
+
+	free();
+
+	int ret = params->allocateBuffers(count, &paramsBuffers);
+	if (ret < 0) {
+		LOG(IspBufferPool, Error)
+			<< name_ << ": Failed to allocate parameters buffers";
+		return ret;
+	}
+
+	ret = stats->allocateBuffers(count, &statsBuffers);
+	if (ret < 0) {
+		LOG(IspBufferPool, Error)
+			<< name_ << ": Failed to allocate statistics buffers";
+		return ret;
+	}
+
+	unsigned int size = std::min(paramsBuffers.size(), statsBuffers.size());
+
+	entries_.resize(size);
+	free_.reserve(size);
+	ipaBuffers_.reserve(size * 2);
+
+	for (unsigned int i = 0; i < size; i++) {
+		std::unique_ptr<FrameBuffer> &buffer = paramsBuffers[i];
+
+		buffer->setCookie(firstCookie + i);
+		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		entries_[i].params = std::move(buffer);
+	}
+
+	for (unsigned int i = 0; i < size; i++) {
+		std::unique_ptr<FrameBuffer> &buffer = statsBuffers[i];
+
+		buffer->setCookie(firstCookie + size + i);
+		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		entries_[i].stats = std::move(buffer);
+	}
+
+	statistics_ = {};
+	reset();
+
+	LOG(IspBufferPool, Debug)
+		<< name_ << ": Allocated " << size << " buffer pairs";
+
+	return size;
+}
+
+/**
+ * \brief Free all buffers
+ *
+ * The buffers shall have been unmapped from the IPA module beforehand. The
+ * caller is responsible for releasing the buffers on the video devices.
+ */
+void IspBufferPool::free()
+{
+	if (entries_.empty())
+		return;
+
+	LOG(IspBufferPool, Debug)
+		<< name_ << ": " << entries_.size() << " buffer pairs, "
+		<< statistics_.cycles << " cycles, peak occupancy "
+		<< statistics_.peakOccupancy << ", "
+		<< statistics_.underruns << " underruns";
+
+	entries_.clear();
+	free_.clear();
+	ipaBuffers_.clear();
+}
+
+/**
+ * \fn IspBufferPool::size()
+ * \brief Retrieve the number of buffer pairs in the pool
+ * \return The number of buffer pairs
+ */
+
+/**
+ * \fn IspBufferPool::ipaBuffers()
+ * \brief Retrieve the buffers to map to the IPA module
+ * \return The IPABuffer list for all parameters and statistics buffers
+ */
+
+/**
+ * \brief Retrieve the identifiers of the buffers mapped to the IPA module
+ * \return The IPABuffer identifiers for all parameters and statistics buffers
+ */
+std::vector<unsigned int> IspBufferPool::ipaBufferIds() const
+{
+	std::vector<unsigned int> ids;
+
+	ids.reserve(ipaBuffers_.size());
+	for (const IPABuffer &buffer : ipaBuffers_)
+		ids.push_back(buffer.id);
+
+	return ids;
+}
+
+/**
+ * \brief Acquire a pair of parameters and statistics buffers
+ *
+ * The most recently released pair is returned first, to maximise the chances
+ * of its memory being still cached.
+ *
+ * \return The index of the buffer pair, or -ENOBUFS if all pairs are in use
+ */
+int IspBufferPool::acquire()
+{
+	if (free_.empty()) {
+		statistics_.underruns++;
+		LOG(IspBufferPool, Debug)
+			<< name_ << ": Buffer underrun, " << entries_.size()
+			<< " buffer pairs in use";
+		return -ENOBUFS;
+	}
+
+	unsigned int index = free_.back();
+	free_.pop_back();
+
+	statistics_.cycles++;
+	statistics_.occupancy++;
+	statistics_.peakOccupancy = std::max(statistics_.peakOccupancy,
+					     statistics_.occupancy);
+
+	return index;
+}
+
+/**
+ * \brief Release a pair of parameters and statistics buffers
+ * \param[in] index The buffer pair index, as returned by acquire()
+ */
+void IspBufferPool::release(unsigned int index)
+{
+	ASSERT(index < entries_.size());
+	ASSERT(free_.size() < entries_.size());
+
+	free_.push_back(index);
+	statistics_.occupancy--;
+}
+
+/**
+ * \brief Release all buffer pairs
+ *
+ * This function is typically called when stopping the camera, after all
+ * frames have been cancelled.
+ */
+void IspBufferPool::reset()
+{
+	free_.clear();
+	for (unsigned int i = entries_.size(); i > 0; i--)
+		free_.push_back(i - 1);
+
+	statistics_.occupancy = 0;
+}
+
+/**
+ * \fn IspBufferPool::params()
+ * \brief Retrieve the parameters buffer of a pair
+ * \param[in] index The buffer pair index
+ * \return The parameters buffer
+ */
+
+/**
+ * \fn IspBufferPool::stats()
+ * \brief Retrieve the statistics buffer of a pair
+ * \param[in] index The buffer pair index
+ * \return The statistics buffer
+ */
+
+/**
+ * \fn IspBufferPool::statistics()
+ * \brief Retrieve the pool usage statistics
+ * \return The pool usage statistics since the buffers were allocated
+ */
+
+} /* namespace libcamera */
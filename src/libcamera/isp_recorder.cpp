@@ -0,0 +1,518 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * ISP parameters, statistics and metadata recorder
+ */
+
+#include "libcamera/internal/isp_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/controls.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+/**
+ * \file isp_recorder.h
+ * \brief ISP parameters, statistics and metadata recorder
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IspRecorder)
+
+/**
+ * \namespace libcamera::isp_recording
+ * \brief Binary format of the ISP recordings
+ *
+ * An ISP recording starts with a FileHeader, followed by records made of a
+ * RecordHeader and RecordHeader::size bytes of data. All fields are stored in
+ * native endianness, as recordings are meant to be replayed on the machine
+ * architecture they have been captured on.
+ */
+
+/**
+ * \var isp_recording::kMagic
+ * \brief Magic value identifying ISP recording files
+ *
+ * \var isp_recording::kVersion
+ * \brief Version of the ISP recording format
+ */
+
+/**
+ * \enum isp_recording::RecordType
+ * \brief Type of the data stored in a record
+ * \var isp_recording::RecordType::Parameters
+ * \brief ISP parameters buffer, as queued to the device
+ * \var isp_recording::RecordType::Statistics
+ * \brief ISP statistics buffer, as dequeued from the device
+ * \var isp_recording::RecordType::Metadata
+ * \brief Request metadata, serialized with the ControlSerializer
+ */
+
+/**
+ * \struct isp_recording::FileHeader
+ * \brief Header of an ISP recording
+ * \var isp_recording::FileHeader::magic
+ * \brief Magic value, set to isp_recording::kMagic
+ * \var isp_recording::FileHeader::version
+ * \brief Version of the recording format, set to isp_recording::kVersion
+ * \var isp_recording::FileHeader::name
+ * \brief Nul-terminated name of the recorder, usually the pipeline handler
+ */
+
+/**
+ * \struct isp_recording::RecordHeader
+ * \brief Header of a record
+ * \var isp_recording::RecordHeader::type
+ * \brief Type of the record, as an isp_recording::RecordType
+ * \var isp_recording::RecordHeader::frame
+ * \brief Frame number the record relates to
+ * \var isp_recording::RecordHeader::timestamp
+ * \brief Monotonic time at which the record was captured, in nanoseconds
+ * \var isp_recording::RecordHeader::size
+ * \brief Size of the record data following the header, in bytes
+ * \var isp_recording::RecordHeader::reserved
+ * \brief Reserved for future use, set to 0
+ */
+
+/**
+ * \class IspRecorder
+ * \brief Record ISP parameters, statistics and metadata to a binary log
+ *
+ * The IspRecorder captures the stream of parameters and statistics buffers
+ * exchanged between a pipeline handler and its IPA module, along with the
+ * request metadata they produce, into a compact binary log. Recordings
+ * reproduce field issues offline, and can be replayed through the IPA
+ * algorithms without hardware with the IspRecordingReader.
+ *
+ * Recording is disabled by default. Setting the LIBCAMERA_ISP_RECORD
+ * environment variable to a directory enables it, a new file named after the
+ * recorder, the process ID and a capture session number being created in that
+ * directory every time the camera is started. The LIBCAMERA_ISP_RECORD_FRAMES
+ * environment variable optionally limits the number of frames recorded per
+ * session, to capture short windows in production.
+ *
+ * Pipeline handlers call start() and stop() when the camera starts and stops,
+ * and record() as buffers and metadata become available. Data is copied to a
+ * record and queued to a writer thread, so the pipeline handler thread never
+ * waits for storage. Buffers are mapped once and the mappings cached until
+ * stop(), and record storage is recycled. When the writer can't keep up and
+ * the pending data exceeds a fixed budget, records are dropped and the number
+ * of dropped records is logged when recording stops.
+ *
+ * The recorder isn't thread-safe, it shall be used from the pipeline handler
+ * thread only.
+ */
+
+/**
+ * \typedef IspRecorder::RecordType
+ * \brief Type of the data stored in a record
+ */
+
+/* Sessions are numbered process-wide to give each recording a unique name. */
+std::atomic<unsigned int> IspRecorder::sessions_ = 0;
+
+/**
+ * \brief Construct an IspRecorder
+ * \param[in] name The recorder name, stored in the recording and used to name
+ * the files
+ */
+IspRecorder::IspRecorder(const std::string &name)
+	: name_(name), maxFrames_(0), windowStarted_(false),
+	  firstFrame_(0), pendingBytes_(0), records_(0), dropped_(0),
+	  stop_(false)
+{
+	const char *directory = utils::secure_getenv("LIBCAMERA_ISP_RECORD");
+	if (!directory || !*directory)
+		return;
+
+	directory_ = directory;
+
+	const char *frames = utils::secure_getenv("LIBCAMERA_ISP_RECORD_FRAMES");
+	if (frames)
+		maxFrames_ = strtoul(frames, nullptr, 10);
+}
+
+IspRecorder::~IspRecorder()
+{
+	stop();
+}
+
+/**
+ * \fn IspRecorder::isEnabled()
+ * \brief Check if recording has been enabled in the environment
+ * \return True if recording is enabled, false otherwise
+ */
+
+/**
+ * \fn IspRecorder::isRecording()
+ * \brief Check if a recording is in progress
+ *
+ * Pipeline handlers can use this function to skip preparing data for record()
+ * when no recording is in progress.
+ *
+ * \return True if a recording is in progress, false otherwise
+ */
+
+/**
+ * \brief Start a recording
+ *
+ * Create a new recording file and start the writer thread. This function
+ * does nothing if recording isn't enabled. Failure to create the recording
+ * file is logged and doesn't prevent the camera from starting.
+ *
+ * \return 0 on success or if recording is disabled, or a negative error code
+ * otherwise
+ */
+int IspRecorder::start()
+{
+	if (!isEnabled() || isRecording())
+		return 0;
+
+	std::string path = directory_ + "/" + name_ + "-"
+			 + std::to_string(getpid()) + "-"
+			 + std::to_string(sessions_++) + ".rec";
+
+	file_.setFileName(path);
+	if (!file_.open(File::OpenModeFlag::WriteOnly)) {
+		LOG(IspRecorder, Error)
+			<< "Failed to create recording " << path << ": "
+			<< strerror(-file_.error());
+		return file_.error();
+	}
+
+	isp_recording::FileHeader header{};
+	header.magic = isp_recording::kMagic;
+	header.version = isp_recording::kVersion;
+	strncpy(header.name, name_.c_str(), sizeof(header.name) - 1);
+
+	file_.write({ reinterpret_cast<const uint8_t *>(&header), sizeof(header) });
+
+	windowStarted_ = false;
+
+	{
+		MutexLocker locker(mutex_);
+		records_ = 0;
+		dropped_ = 0;
+		stop_ = false;
+	}
+
+	thread_ = std::thread(&IspRecorder::run, this);
+
+	LOG(IspRecorder, Info) << "Recording to " << path;
+
+	return 0;
+}
+
+/**
+ * \brief Stop the recording
+ *
+ * Write all pending records, stop the writer thread, close the recording file
+ * and release the cached buffer mappings. This function shall be called
+ * before freeing the buffers passed to record().
+ */
+void IspRecorder::stop()
+{
+	maps_.clear();
+
+	if (!isRecording())
+		return;
+
+	unsigned int records;
+	unsigned int dropped;
+
+	{
+		MutexLocker locker(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+
+	thread_.join();
+
+	{
+		MutexLocker locker(mutex_);
+		records = records_;
+		dropped = dropped_;
+	}
+
+	LOG(IspRecorder, Info)
+		<< "Recorded " << records << " records to " << file_.fileName()
+		<< ", " << dropped << " dropped";
+
+	file_.close();
+}
+
+/**
+ * \brief Record the content of a buffer
+ * \param[in] type The record type
+ * \param[in] frame The frame number
+ * \param[in] buffer The buffer
+ *
+ * Record the bytes used in the first plane of \a buffer, or the whole plane if
+ * the bytes used are not set. The buffer is mapped the first time it is
+ * recorded, and stays mapped until stop().
+ */
+void IspRecorder::record(RecordType type, uint32_t frame,
+			 const FrameBuffer *buffer)
+{
+	if (!isRecording() || !accept(frame))
+		return;
+
+	auto it = maps_.find(buffer);
+	if (it == maps_.end()) {
+		auto mapped = std::make_unique<MappedFrameBuffer>(buffer,
+								  MappedFrameBuffer::MapFlag::Read);
+		if (!mapped->isValid()) {
+			LOG(IspRecorder, Error) << "Failed to map buffer";
+			return;
+		}
+
+		it = maps_.emplace(buffer, std::move(mapped)).first;
+	}
+
+	Span<uint8_t> plane = it->second->planes()[0];
+	size_t size = buffer->metadata().planes()[0].bytesused;
+	if (!size || size > plane.size())
+		size = plane.size();
+
+	record(type, frame, plane.first(size));
+}
+
+/**
+ * \brief Record data
+ * \param[in] type The record type
+ * \param[in] frame The frame number
+ * \param[in] data The data
+ *
+ * This function is used by pipeline handlers whose parameters or statistics
+ * are not stored in a FrameBuffer.
+ */
+void IspRecorder::record(RecordType type, uint32_t frame,
+			 Span<const uint8_t> data)
+{
+	if (!isRecording() || !accept(frame))
+		return;
+
+	std::vector<uint8_t> record = prepare(type, frame, data.size());
+	memcpy(record.data() + sizeof(isp_recording::RecordHeader), data.data(),
+	       data.size());
+
+	queue(std::move(record));
+}
+
+/**
+ * \brief Record request metadata
+ * \param[in] frame The frame number
+ * \param[in] metadata The request metadata
+ */
+void IspRecorder::record(uint32_t frame, const ControlList &metadata)
+{
+	if (!isRecording() || !accept(frame))
+		return;
+
+	size_t size = ControlSerializer::binarySize(metadata);
+	std::vector<uint8_t> record = prepare(RecordType::Metadata, frame, size);
+
+	ByteStreamBuffer buffer(record.data() + sizeof(isp_recording::RecordHeader),
+				size);
+	ControlSerializer serializer(ControlSerializer::Role::Proxy);
+
+	int ret = serializer.serialize(metadata, buffer);
+	if (ret < 0 || buffer.overflow())
+		return;
+
+	queue(std::move(record));
+}
+
+bool IspRecorder::accept(uint32_t frame)
+{
+	if (!maxFrames_)
+		return true;
+
+	if (!windowStarted_) {
+		firstFrame_ = frame;
+		windowStarted_ = true;
+	}
+
+	return frame - firstFrame_ < maxFrames_;
+}
+
+std::vector<uint8_t> IspRecorder::prepare(RecordType type, uint32_t frame,
+					  size_t size)
+{
+	std::vector<uint8_t> record;
+
+	{
+		MutexLocker locker(mutex_);
+		if (!spare_.empty()) {
+			record = std::move(spare_.back());
+			spare_.pop_back();
+		}
+	}
+
+	record.resize(sizeof(isp_recording::RecordHeader) + size);
+
+	isp_recording::RecordHeader header{};
+	header.type = static_cast<uint32_t>(type);
+	header.frame = frame;
+	header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	header.size = size;
+
+	memcpy(record.data(), &header, sizeof(header));
+
+	return record;
+}
+
+void IspRecorder::queue(std::vector<uint8_t> &&record)
+{
+	{
+		MutexLocker locker(mutex_);
+
+		if (pendingBytes_ + record.size() > kMaxPendingBytes) {
+			dropped_++;
+			spare_.push_back(std::move(record));
+			return;
+		}
+
+		pendingBytes_ += record.size();
+		pending_.push_back(std::move(record));
+	}
+
+	cv_.notify_one();
+}
+
+void IspRecorder::run()
+{
+	MutexLocker locker(mutex_);
+
+	while (true) {
+		cv_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+			return stop_ || !pending_.empty();
+		});
+
+		if (pending_.empty())
+			break;
+
+		std::vector<uint8_t> record = std::move(pending_.front());
+		pending_.pop_front();
+
+		locker.unlock();
+		ssize_t ret = file_.write(record);
+		locker.lock();
+
+		pendingBytes_ -= record.size();
+		if (ret == static_cast<ssize_t>(record.size()))
+			records_++;
+		else
+			dropped_++;
+
+		spare_.push_back(std::move(record));
+	}
+}
+
+/**
+ * \class IspRecordingReader
+ * \brief Read records from an ISP recording
+ *
+ * The IspRecordingReader reads recordings produced by the IspRecorder, to
+ * replay them offline, for instance through the IPA algorithms.
+ */
+
+/**
+ * \typedef IspRecordingReader::RecordType
+ * \brief Type of the data stored in a record
+ */
+
+/**
+ * \struct IspRecordingReader::Record
+ * \brief A record read from an ISP recording
+ * \var IspRecordingReader::Record::type
+ * \brief The record type
+ * \var IspRecordingReader::Record::frame
+ * \brief The frame number the record relates to
+ * \var IspRecordingReader::Record::timestamp
+ * \brief The monotonic time at which the record was captured, in nanoseconds
+ * \var IspRecordingReader::Record::data
+ * \brief The record data
+ */
+
+/**
+ * \brief Open an ISP recording
+ * \param[in] path The recording file path
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The file isn't an ISP recording in a supported version
+ */
+int IspRecordingReader::open(const std::string &path)
+{
+	file_.close();
+	file_.setFileName(path);
+
+	if (!file_.open(File::OpenModeFlag::ReadOnly))
+		return file_.error();
+
+	isp_recording::FileHeader header;
+	ssize_t ret = file_.read({ reinterpret_cast<uint8_t *>(&header), sizeof(header) });
+	if (ret != sizeof(header) || header.magic != isp_recording::kMagic ||
+	    header.version != isp_recording::kVersion) {
+		file_.close();
+		return -EINVAL;
+	}
+
+	header.name[sizeof(header.name) - 1] = '\0';
+	name_ = header.name;
+
+	return 0;
+}
+
+/**
+ * \fn IspRecordingReader::name()
+ * \brief Retrieve the name of the recorder that produced the recording
+ * \return The recorder name
+ */
+
+/**
+ * \brief Read the next record
+ * \param[out] record The record
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODATA The end of the recording has been reached
+ * \retval -EINVAL The recording is truncated or corrupted
+ */
+int IspRecordingReader::read(Record *record)
+{
+	if (!file_.isOpen())
+		return -EBADF;
+
+	isp_recording::RecordHeader header;
+	ssize_t ret = file_.read({ reinterpret_cast<uint8_t *>(&header), sizeof(header) });
+	if (ret == 0)
+		return -ENODATA;
+	if (ret != sizeof(header))
+		return -EINVAL;
+
+	record->type = static_cast<RecordType>(header.type);
+	record->frame = header.frame;
+	record->timestamp = header.timestamp;
+	record->data.resize(header.size);
+
+	ret = file_.read(record->data);
+	if (ret != static_cast<ssize_t>(header.size))
+		return -EINVAL;
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Fixed-size hash index for constant tables
+ */
+
+#include "libcamera/internal/lookup_table.h"
+
+/**
+ * \file lookup_table.h
+ * \brief Fixed-size hash index for constant tables
+ */
+
+namespace libcamera {
+
+/**
+ * \class LookupTable
+ * \brief Constant-time index of the entries of a constant table
+ * \tparam Key The type of the lookup key
+ * \tparam Entry The type of the table entries
+ * \tparam Size The number of buckets, shall be a power of two
+ * \tparam Hash The hash function object type for \a Key
+ *
+ * Static tables describing formats are looked up in hot paths, such as buffer
+ * plane size computation or per-frame validation. The LookupTable indexes the
+ * entries of such a table in an open addressing hash table with a fixed number
+ * of buckets, stored inline. Building the index doesn't allocate memory, and
+ * lookups run in constant time.
+ *
+ * The index stores pointers to the entries, the indexed table shall thus
+ * outlive the LookupTable and shall not be modified. The number of buckets
+ * should be at least twice the number of entries to keep probe sequences
+ * short.
+ */
+
+/**
+ * \fn LookupTable::LookupTable()
+ * \brief Index the entries of a table
+ * \param[in] entries The table entries
+ * \param[in] keyFunc Function returning the key of an entry
+ *
+ * Entries are indexed by the key returned by \a keyFunc. If multiple entries
+ * have the same key, the first one in \a entries is indexed. The number of
+ * entries shall not exceed the number of buckets.
+ */
+
+/**
+ * \fn LookupTable::find()
+ * \brief Find the entry corresponding to a key
+ * \param[in] key The key
+ * \return A pointer to the entry, or nullptr if no entry matches \a key
+ */
+
+} /* namespace libcamera */
@@ -10,11 +10,14 @@
 #include <algorithm>
 #include <errno.h>
 #include <map>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/framebuffer.h"
+
 /**
  * \file libcamera/internal/mapped_framebuffer.h
  * \brief Frame buffer memory mapping support
@@ -150,6 +153,19 @@ MappedBuffer::~MappedBuffer()
 /**
  * \class MappedFrameBuffer
  * \brief Map a FrameBuffer using the MappedBuffer interface
+ *
+ * By default, the frame buffer is mapped when the MappedFrameBuffer is
+ * constructed and unmapped when it is destroyed. Users that access the same
+ * buffers repeatedly, such as per-frame processing, should set the
+ * MapFlag::Persistent flag to reuse a mapping that lives as long as the frame
+ * buffer, and avoid the cost of mapping and unmapping large buffers for every
+ * frame.
+ *
+ * The MapFlag::Sync flag brackets the CPU access with a DmaSyncer, starting
+ * the access when the MappedFrameBuffer is constructed and ending it when the
+ * MappedFrameBuffer is destroyed. This keeps the CPU caches coherent with
+ * device accesses for dma-buf exporters that require it. The direction of the
+ * synchronization follows the MapFlag::Read and MapFlag::Write flags.
  */
 
 /**
@@ -161,6 +177,19 @@ MappedBuffer::~MappedBuffer()
  * \brief Create a write-only mapping
  * \var MappedFrameBuffer::ReadWrite
  * \brief Create a mapping that can be both read and written
+ * \var MappedFrameBuffer::Persistent
+ * \brief Reuse a mapping that is kept for the whole lifetime of the
+ * FrameBuffer
+ *
+ * The MappedFrameBuffer shall not outlive the FrameBuffer when this flag is
+ * set.
+ *
+ * \var MappedFrameBuffer::Sync
+ * \brief Synchronize the CPU access with DMA_BUF_IOCTL_SYNC for the lifetime
+ * of the MappedFrameBuffer
+ *
+ * The MappedFrameBuffer shall not outlive the FrameBuffer when this flag is
+ * set.
  */
 
 /**
@@ -182,6 +211,26 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 	ASSERT(!buffer->planes().empty());
 	planes_.reserve(buffer->planes().size());
 
+	DmaSyncer::SyncType syncType = DmaSyncer::SyncType::ReadWrite;
+	if (!(flags & MapFlag::Write))
+		syncType = DmaSyncer::SyncType::Read;
+	else if (!(flags & MapFlag::Read))
+		syncType = DmaSyncer::SyncType::Write;
+
+	if (flags & MapFlag::Persistent) {
+		const MappedFrameBuffer *mapping = buffer->_d()->mapping(flags);
+		if (!mapping) {
+			error_ = -ENOMEM;
+			return;
+		}
+
+		planes_ = mapping->planes();
+
+		if (flags & MapFlag::Sync)
+			syncer_.emplace(buffer, syncType);
+		return;
+	}
+
 	int mmapFlags = 0;
 
 	if (flags & MapFlag::Read)
@@ -238,6 +287,50 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 
 		planes_.emplace_back(info.address + plane.offset, plane.length);
 	}
+
+	if (flags & MapFlag::Sync)
+		syncer_.emplace(buffer, syncType);
+}
+
+MappedFrameBuffer::~MappedFrameBuffer()
+{
+	/* End the CPU access before the base class unmaps the memory. */
+	syncer_.reset();
+}
+
+/**
+ * \brief Move constructor, construct the MappedFrameBuffer with the contents
+ * of \a other using move semantics
+ * \param[in] other The other MappedFrameBuffer
+ *
+ * If the \a other MappedFrameBuffer synchronizes the CPU access, the access is
+ * transferred to the new MappedFrameBuffer.
+ */
+MappedFrameBuffer::MappedFrameBuffer(MappedFrameBuffer &&other)
+	: MappedBuffer(std::move(other)), syncer_(std::move(other.syncer_))
+{
+	other.syncer_.reset();
+}
+
+/**
+ * \brief Move assignment operator, replace the mappings with those of \a other
+ * \param[in] other The other MappedFrameBuffer
+ *
+ * Any CPU access synchronized by this MappedFrameBuffer is ended, and the
+ * access synchronized by the \a other MappedFrameBuffer, if any, is
+ * transferred.
+ *
+ * \return A reference to this MappedFrameBuffer
+ */
+MappedFrameBuffer &MappedFrameBuffer::operator=(MappedFrameBuffer &&other)
+{
+	syncer_.reset();
+
+	MappedBuffer::operator=(std::move(other));
+	syncer_ = std::move(other.syncer_);
+	other.syncer_.reset();
+
+	return *this;
 }
 
 } /* namespace libcamera */
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
@@ -63,7 +64,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * populate() before the media graph can be queried.
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
-	: deviceNode_(deviceNode), valid_(false), acquired_(false)
+	: deviceNode_(deviceNode), topologyVersion_(0), valid_(false),
+	  acquired_(false)
 {
 }
 
@@ -185,8 +187,12 @@ void MediaDevice::unlock()
  * Interfaces are not processed.
  *
  * Entities are stored in a separate list in the MediaDevice to ease lookup,
- * while pads are accessible from the entity they belong to and links from the
- * pads they connect.
+ * and indexed by name, while pads are accessible from the entity they belong
+ * to and links from the pads they connect.
+ *
+ * If the media graph is already populated and its topology version hasn't
+ * changed, the existing media objects are kept and this function only checks
+ * the topology version.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -200,12 +206,27 @@ int MediaDevice::populate()
 	__u64 version = -1;
 	int ret;
 
-	clear();
-
 	ret = open();
 	if (ret)
 		return ret;
 
+	/*
+	 * If the graph has already been populated and its topology hasn't
+	 * changed since, keep it. This avoids rebuilding all graph objects,
+	 * and keeps pointers to them and the cached formats valid.
+	 */
+	if (valid_) {
+		ret = ioctl(fd_.get(), MEDIA_IOC_G_TOPOLOGY, &topology);
+		if (!ret && topology.topology_version == topologyVersion_) {
+			close();
+			return 0;
+		}
+
+		topology = {};
+	}
+
+	clear();
+
 	struct media_device_info info = {};
 	ret = ioctl(fd_.get(), MEDIA_IOC_DEVICE_INFO, &info);
 	if (ret) {
@@ -258,8 +279,10 @@ int MediaDevice::populate()
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
-	    populateLinks(topology))
+	    populateLinks(topology)) {
+		topologyVersion_ = version;
 		valid_ = true;
+	}
 
 	ret = 0;
 done:
@@ -333,11 +356,8 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
-
-	return nullptr;
+	auto it = entitiesByName_.find(name);
+	return it != entitiesByName_.end() ? it->second : nullptr;
 }
 
 /**
@@ -453,6 +473,89 @@ int MediaDevice::disableLinks()
 	return 0;
 }
 
+/**
+ * \brief Allocate media controller requests
+ * \param[in] count Number of requests to allocate
+ * \param[out] requests Vector to store the allocated requests
+ *
+ * Allocate \a count requests from the media device and append them to
+ * \a requests. Requests allow binding V4L2 controls and buffers to a frame, see
+ * the MediaRequest class for more information. The media device shall be
+ * acquired before allocating requests, the requests stay valid after the media
+ * device is released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBADF The media device hasn't been acquired
+ * \retval -ENOTTY The media device doesn't support requests
+ */
+int MediaDevice::allocateRequests(unsigned int count,
+				  std::vector<std::unique_ptr<MediaRequest>> *requests)
+{
+	if (!fd_.isValid()) {
+		LOG(MediaDevice, Error)
+			<< "Media device must be acquired to allocate requests";
+		return -EBADF;
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		int fd;
+
+		if (ioctl(fd_.get(), MEDIA_IOC_REQUEST_ALLOC, &fd) < 0) {
+			int ret = -errno;
+			LOG(MediaDevice, Error)
+				<< "Failed to allocate request: " << strerror(-ret);
+			return ret;
+		}
+
+		requests->push_back(std::make_unique<MediaRequest>(UniqueFD(fd)));
+	}
+
+	return 0;
+}
+
+/**
+ * \typedef MediaDevice::CachedFormats
+ * \brief A map of format codes to the frame sizes they support
+ *
+ * The format codes are media bus codes for subdevices and V4L2 pixel format
+ * FourCCs for video devices.
+ */
+
+/**
+ * \brief Retrieve format enumeration results cached in the media device
+ * \param[in] key The cache key
+ *
+ * Enumerating the formats supported by video devices and subdevices requires a
+ * large number of ioctls, and is repeated every time a device is opened or a
+ * configuration generated. As the MediaDevice instance lives until the device
+ * is unplugged, it stores the results of enumerations that don't depend on the
+ * device state for the V4L2VideoDevice and V4L2Subdevice instances created for
+ * its entities. The \a key identifies the entity and the enumeration
+ * parameters, and is constructed by the caller.
+ *
+ * \return The cached formats, or nullptr if no formats are cached for \a key
+ */
+const MediaDevice::CachedFormats *MediaDevice::cachedFormats(const std::string &key) const
+{
+	auto it = formatsCache_.find(key);
+	if (it == formatsCache_.end())
+		return nullptr;
+
+	return &it->second;
+}
+
+/**
+ * \brief Store format enumeration results in the media device
+ * \param[in] key The cache key
+ * \param[in] formats The enumerated formats
+ *
+ * \sa cachedFormats()
+ */
+void MediaDevice::cacheFormats(const std::string &key, CachedFormats formats) const
+{
+	formatsCache_[key] = std::move(formats);
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -566,6 +669,8 @@ void MediaDevice::clear()
 
 	objects_.clear();
 	entities_.clear();
+	entitiesByName_.clear();
+	formatsCache_.clear();
 	valid_ = false;
 }
 
@@ -575,43 +680,9 @@ void MediaDevice::clear()
  */
 
 /**
- * \brief Find the interface associated with an entity
- * \param[in] topology The media topology as returned by MEDIA_IOC_G_TOPOLOGY
- * \param[in] entityId The entity id
- * \return A pointer to the interface if found, or nullptr otherwise
+ * \var MediaDevice::entitiesByName_
+ * \brief Media entities in the media graph, indexed by name
  */
-struct media_v2_interface *MediaDevice::findInterface(const struct media_v2_topology &topology,
-						      unsigned int entityId)
-{
-	struct media_v2_link *links = reinterpret_cast<struct media_v2_link *>
-						      (topology.ptr_links);
-	unsigned int ifaceId = 0;
-	unsigned int i;
-
-	for (i = 0; i < topology.num_links; ++i) {
-		/* Search for the interface to entity link. */
-		if (links[i].sink_id != entityId)
-			continue;
-
-		if ((links[i].flags & MEDIA_LNK_FL_LINK_TYPE) !=
-		    MEDIA_LNK_FL_INTERFACE_LINK)
-			continue;
-
-		ifaceId = links[i].source_id;
-		break;
-	}
-	if (i == topology.num_links)
-		return nullptr;
-
-	struct media_v2_interface *ifaces = reinterpret_cast<struct media_v2_interface *>
-					    (topology.ptr_interfaces);
-	for (i = 0; i < topology.num_interfaces; ++i) {
-		if (ifaces[i].id == ifaceId)
-			return &ifaces[i];
-	}
-
-	return nullptr;
-}
 
 /*
  * For each entity in the media graph create a MediaEntity and store a
@@ -621,6 +692,33 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 {
 	struct media_v2_entity *mediaEntities = reinterpret_cast<struct media_v2_entity *>
 						(topology.ptr_entities);
+	struct media_v2_interface *mediaInterfaces = reinterpret_cast<struct media_v2_interface *>
+						     (topology.ptr_interfaces);
+	struct media_v2_link *mediaLinks = reinterpret_cast<struct media_v2_link *>
+					   (topology.ptr_links);
+
+	/*
+	 * Index the interfaces by the id of the entity they're linked to, to
+	 * avoid scanning all links and interfaces for every entity.
+	 */
+	std::unordered_map<unsigned int, struct media_v2_interface *> interfaces;
+	for (unsigned int i = 0; i < topology.num_interfaces; ++i)
+		interfaces[mediaInterfaces[i].id] = &mediaInterfaces[i];
+
+	std::unordered_map<unsigned int, struct media_v2_interface *> entityInterfaces;
+	for (unsigned int i = 0; i < topology.num_links; ++i) {
+		if ((mediaLinks[i].flags & MEDIA_LNK_FL_LINK_TYPE) !=
+		    MEDIA_LNK_FL_INTERFACE_LINK)
+			continue;
+
+		auto iface = interfaces.find(mediaLinks[i].source_id);
+		if (iface != interfaces.end())
+			entityInterfaces.try_emplace(mediaLinks[i].sink_id,
+						     iface->second);
+	}
+
+	entities_.reserve(topology.num_entities);
+	entitiesByName_.reserve(topology.num_entities);
 
 	for (unsigned int i = 0; i < topology.num_entities; ++i) {
 		struct media_v2_entity *ent = &mediaEntities[i];
@@ -636,9 +734,10 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		 * Find the interface linked to this entity to get the device
 		 * node major and minor numbers.
 		 */
-		struct media_v2_interface *iface =
-			findInterface(topology, ent->id);
-		MediaEntity *entity = new MediaEntity(this, ent, iface);
+		auto iface = entityInterfaces.find(ent->id);
+		MediaEntity *entity =
+			new MediaEntity(this, ent, iface != entityInterfaces.end()
+						       ? iface->second : nullptr);
 
 		if (!addObject(entity)) {
 			delete entity;
@@ -646,6 +745,7 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		}
 
 		entities_.push_back(entity);
+		entitiesByName_.try_emplace(entity->name(), entity);
 	}
 
 	return true;
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Media controller request
+ */
+
+#include "libcamera/internal/media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/media.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+/**
+ * \file media_request.h
+ * \brief Media controller request
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A media controller request
+ *
+ * The MediaRequest class wraps a request allocated from a media device with
+ * MediaDevice::allocateRequests(). Requests bind V4L2 controls and buffers to
+ * a frame: controls set with V4L2Device::setControls() and buffers queued with
+ * V4L2VideoDevice::queueBuffer() on a request are not applied to the hardware
+ * immediately, but stored in the request. When the request is queued with
+ * queue(), the driver applies all the controls atomically at the time it
+ * processes the request buffers, removing the need to estimate the latency of
+ * controls.
+ *
+ * Completion of the request, once the driver has processed all the objects it
+ * contains, is reported through the completed signal. The buffers contained in
+ * the request are dequeued through the usual V4L2VideoDevice::bufferReady
+ * signal, and the request may complete before or after them.
+ *
+ * A completed request can be recycled with reinit(), which removes all the
+ * objects it contains and makes it available to be populated again.
+ *
+ * Support for requests is driver-specific, and is reported by
+ * V4L2VideoDevice::supportsRequests().
+ */
+
+/**
+ * \enum MediaRequest::Status
+ * \brief The request status
+ * \var MediaRequest::Status::Idle
+ * \brief The request is being populated and hasn't been queued
+ * \var MediaRequest::Status::Queued
+ * \brief The request has been queued and hasn't completed yet
+ * \var MediaRequest::Status::Complete
+ * \brief The request has completed
+ */
+
+/**
+ * \brief Construct a MediaRequest from a request file descriptor
+ * \param[in] fd The request file descriptor
+ *
+ * This constructor is meant to be called by MediaDevice::allocateRequests()
+ * only, pipeline handlers shall not create MediaRequest instances directly.
+ */
+MediaRequest::MediaRequest(UniqueFD fd)
+	: fd_(std::move(fd)), status_(Status::Idle)
+{
+	/* Request completion is signalled by a POLLPRI event. */
+	notifier_ = std::make_unique<EventNotifier>(fd_.get(),
+						    EventNotifier::Exception);
+	notifier_->activated.connect(this, &MediaRequest::notify);
+	notifier_->setEnabled(false);
+}
+
+MediaRequest::~MediaRequest() = default;
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ * \return The request file descriptor
+ */
+
+/**
+ * \fn MediaRequest::status()
+ * \brief Retrieve the request status
+ * \return The request status
+ */
+
+/**
+ * \brief Queue the request to the driver
+ *
+ * Queue the request and all the objects it contains to the driver. The request
+ * must contain at least one buffer. The completed signal is emitted when the
+ * driver has processed the request.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is already queued or has completed
+ * \retval -ENOENT The request doesn't contain any buffer
+ */
+int MediaRequest::queue()
+{
+	if (status_ != Status::Idle)
+		return -EBUSY;
+
+	if (::ioctl(fd_.get(), MEDIA_REQUEST_IOC_QUEUE) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Status::Queued;
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialize the request for reuse
+ *
+ * Remove all the objects contained in the request and reset its status to
+ * Status::Idle. The request shall not be queued when this function is called.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is queued and hasn't completed yet
+ */
+int MediaRequest::reinit()
+{
+	if (status_ == Status::Queued)
+		return -EBUSY;
+
+	if (::ioctl(fd_.get(), MEDIA_REQUEST_IOC_REINIT) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinitialize request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Status::Idle;
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief A Signal emitted when the request completes
+ */
+
+void MediaRequest::notify()
+{
+	notifier_->setEnabled(false);
+	status_ = Status::Complete;
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/mutex.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera_manager.h>
@@ -35,19 +36,57 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(ISI)
 
+class ISICameraData;
 class PipelineHandlerISI;
 
+/*
+ * Allocate the ISI pipes to the streams of all cameras, to stream from
+ * multiple cameras concurrently.
+ *
+ * Each ISI pipe has a line buffer for images up to kMaxLineWidth pixels wide.
+ * Wider images require chaining the pipe with the next one, which is then
+ * used for the same stream. Pipes are allocated when configuring a camera and
+ * stay allocated until the camera is reconfigured or released, so that
+ * validate() can report the pipes left available to a camera.
+ */
+class ISIPipeAllocator
+{
+public:
+	static constexpr unsigned int kMaxLineWidth = 2048;
+
+	void init(unsigned int numPipes);
+
+	unsigned int availableStreams(const ISICameraData *camera,
+				      bool chained) const;
+	int allocate(const ISICameraData *camera, unsigned int numStreams,
+		     bool chained, std::vector<unsigned int> *pipes);
+	void release(const ISICameraData *camera);
+
+	std::vector<std::pair<unsigned int, const ISICameraData *>> routes() const;
+
+private:
+	struct Slot {
+		const ISICameraData *owner;
+		bool chained;
+	};
+
+	std::vector<unsigned int> selectPipes(const ISICameraData *camera,
+					      bool chained) const
+		LIBCAMERA_TSA_REQUIRES(mutex_);
+
+	mutable Mutex mutex_;
+	std::vector<Slot> slots_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+};
+
 class ISICameraData : public Camera::Private
 {
 public:
-	ISICameraData(PipelineHandler *ph)
-		: Camera::Private(ph)
+	ISICameraData(PipelineHandler *ph, ISIPipeAllocator *allocator,
+		      unsigned int numPipes)
+		: Camera::Private(ph), allocator_(allocator)
 	{
-		/*
-		 * \todo Assume 2 channels only for now, as that's the number of
-		 * available channels on i.MX8MP.
-		 */
-		streams_.resize(2);
+		/* Streams can use any ISI pipe, expose one per pipe. */
+		streams_.resize(numPipes);
 	}
 
 	PipelineHandlerISI *pipe();
@@ -56,7 +95,7 @@ public:
 
 	unsigned int pipeIndex(const Stream *stream)
 	{
-		return stream - &*streams_.begin();
+		return streamPipes_[stream - &*streams_.begin()];
 	}
 
 	unsigned int getRawMediaBusFormat(PixelFormat *pixelFormat) const;
@@ -70,6 +109,10 @@ public:
 
 	std::vector<Stream *> enabledStreams_;
 
+	/* ISI pipe allocated to each stream, indexed by stream. */
+	std::vector<unsigned int> streamPipes_;
+	ISIPipeAllocator *allocator_;
+
 	unsigned int xbarSink_;
 };
 
@@ -113,6 +156,7 @@ public:
 	int start(Camera *camera, const ControlList *controls) override;
 
 protected:
+	void releaseDevice(Camera *camera) override;
 	void stopDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
@@ -143,8 +187,123 @@ private:
 
 	std::unique_ptr<V4L2Subdevice> crossbar_;
 	std::vector<Pipe> pipes_;
+	ISIPipeAllocator allocator_;
 };
 
+/* -----------------------------------------------------------------------------
+ * Pipe Allocator
+ */
+
+void ISIPipeAllocator::init(unsigned int numPipes)
+{
+	MutexLocker locker(mutex_);
+
+	slots_.assign(numPipes, { nullptr, false });
+}
+
+/*
+ * Select the pipes, free or already allocated to the camera, to use for its
+ * streams. Chained streams use pairs of consecutive pipes, the first pipe of
+ * each pair is returned.
+ */
+std::vector<unsigned int>
+ISIPipeAllocator::selectPipes(const ISICameraData *camera, bool chained) const
+{
+	auto available = [&](unsigned int index) {
+		return !slots_[index].owner || slots_[index].owner == camera;
+	};
+
+	std::vector<unsigned int> pipes;
+
+	for (unsigned int i = 0; i < slots_.size(); ++i) {
+		if (!available(i))
+			continue;
+
+		if (!chained) {
+			pipes.push_back(i);
+			continue;
+		}
+
+		if (i + 1 < slots_.size() && available(i + 1)) {
+			pipes.push_back(i);
+			++i;
+		}
+	}
+
+	return pipes;
+}
+
+/* Retrieve the number of streams the camera can use concurrently. */
+unsigned int ISIPipeAllocator::availableStreams(const ISICameraData *camera,
+						bool chained) const
+{
+	MutexLocker locker(mutex_);
+
+	return selectPipes(camera, chained).size();
+}
+
+/*
+ * Allocate pipes for \a numStreams streams of the camera, replacing the pipes
+ * previously allocated to it, and return the pipe of each stream in \a pipes.
+ */
+int ISIPipeAllocator::allocate(const ISICameraData *camera,
+			       unsigned int numStreams, bool chained,
+			       std::vector<unsigned int> *pipes)
+{
+	MutexLocker locker(mutex_);
+
+	std::vector<unsigned int> selected = selectPipes(camera, chained);
+	if (selected.size() < numStreams)
+		return -EBUSY;
+
+	selected.resize(numStreams);
+
+	for (Slot &slot : slots_) {
+		if (slot.owner == camera)
+			slot = { nullptr, false };
+	}
+
+	for (unsigned int pipe : selected) {
+		slots_[pipe] = { camera, false };
+		if (chained)
+			slots_[pipe + 1] = { camera, true };
+	}
+
+	*pipes = std::move(selected);
+
+	return 0;
+}
+
+void ISIPipeAllocator::release(const ISICameraData *camera)
+{
+	MutexLocker locker(mutex_);
+
+	for (Slot &slot : slots_) {
+		if (slot.owner == camera)
+			slot = { nullptr, false };
+	}
+}
+
+/*
+ * Retrieve the crossbar routes for all allocated pipes, as pairs of pipe index
+ * and camera. Chained pipes receive their input from the previous pipe and
+ * don't need a route.
+ */
+std::vector<std::pair<unsigned int, const ISICameraData *>>
+ISIPipeAllocator::routes() const
+{
+	MutexLocker locker(mutex_);
+
+	std::vector<std::pair<unsigned int, const ISICameraData *>> routes;
+
+	for (unsigned int i = 0; i < slots_.size(); ++i) {
+		if (slots_[i].owner && !slots_[i].chained)
+			routes.emplace_back(i, slots_[i].owner);
+	}
+
+	return routes;
+}
+
 /* -----------------------------------------------------------------------------
  * Camera Data
  */
@@ -500,26 +659,31 @@ CameraConfiguration::Status ISICameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of streams to the number of available ISI pipes. */
-	if (config_.size() > availableStreams.size()) {
-		config_.resize(availableStreams.size());
+	/*
+	 * Cap the number of streams to the number of ISI pipes not used by
+	 * other cameras. Fail early if no pipe is available.
+	 */
+	unsigned int maxStreams = data_->allocator_->availableStreams(data_, false);
+	if (!maxStreams) {
+		LOG(ISI, Error) << "No ISI pipe available";
+		return Invalid;
+	}
+
+	if (config_.size() > maxStreams) {
+		config_.resize(maxStreams);
 		status = Adjusted;
 	}
 
 	/*
-	 * If more than a single stream is requested, the maximum allowed input
-	 * image width is 2048. Cap the maximum image size accordingly.
-	 *
-	 * \todo The (size > 1) check only applies to i.MX8MP which has 2 ISI
-	 * channels. SoCs with more channels than the i.MX8MP are capable of
-	 * supporting more streams with input width > 2048 by chaining
-	 * successive channels together. Define a policy for channels allocation
-	 * to fully support other SoCs.
+	 * Input images wider than the ISI line buffer require chaining pipes.
+	 * If not enough pairs of pipes are available for all the streams, cap
+	 * the maximum image width to the line buffer size.
 	 */
 	CameraSensor *sensor = data_->sensor_.get();
 	Size maxResolution = sensor->resolution();
-	if (config_.size() > 1)
-		maxResolution.width = std::min(2048U, maxResolution.width);
+	if (maxResolution.width > ISIPipeAllocator::kMaxLineWidth &&
+	    data_->allocator_->availableStreams(data_, true) < config_.size())
+		maxResolution.width = ISIPipeAllocator::kMaxLineWidth;
 
 	/* Validate streams according to the format of the first one. */
 	const PixelFormatInfo info = PixelFormatInfo::info(config_[0].pixelFormat);
@@ -812,28 +976,45 @@ int PipelineHandlerISI::configure(Camera *camera, CameraConfiguration *c)
 	ISICameraConfiguration *camConfig = static_cast<ISICameraConfiguration *>(c);
 	ISICameraData *data = cameraData(camera);
 
+	/*
+	 * Allocate the ISI pipes for the streams, chaining pipes if the input
+	 * is wider than the line buffer.
+	 */
+	bool chained = camConfig->sensorFormat_.size.width > ISIPipeAllocator::kMaxLineWidth;
+	std::vector<unsigned int> pipes;
+
+	int ret = allocator_.allocate(data, c->size(), chained, &pipes);
+	if (ret) {
+		LOG(ISI, Error) << "ISI pipes are in use by other cameras";
+		return ret;
+	}
+
+	data->streamPipes_.assign(data->streams_.size(), 0);
+	for (const auto &[idx, config] : utils::enumerate(*c))
+		data->streamPipes_[config.stream() - &data->streams_[0]] = pipes[idx];
+
 	/* All links are immutable except the sensor -> csis link. */
 	const MediaPad *sensorSrc = data->sensor_->entity()->getPadByIndex(0);
 	sensorSrc->links()[0]->setEnabled(true);
 
 	/*
-	 * Reset the crossbar switch routing and enable one route for each
-	 * requested stream configuration.
+	 * Program the crossbar switch routing with one route for each pipe
+	 * allocated to any camera, to preserve the routes of other cameras.
 	 *
-	 * \todo Handle concurrent usage of multiple cameras by adjusting the
-	 * routing table instead of resetting it.
+	 * \todo The routing can't be changed while streaming, all cameras
+	 * need to be configured before starting any of them.
 	 */
 	V4L2Subdevice::Routing routing = {};
 	unsigned int xbarFirstSource = crossbar_->entity()->pads().size() / 2 + 1;
 
-	for (const auto &[idx, config] : utils::enumerate(*c)) {
-		uint32_t sourcePad = xbarFirstSource + idx;
-		routing.emplace_back(V4L2Subdevice::Stream{ data->xbarSink_, 0 },
+	for (const auto &[pipe, owner] : allocator_.routes()) {
+		uint32_t sourcePad = xbarFirstSource + pipe;
+		routing.emplace_back(V4L2Subdevice::Stream{ owner->xbarSink_, 0 },
 				     V4L2Subdevice::Stream{ sourcePad, 0 },
 				     V4L2_SUBDEV_ROUTE_FL_ACTIVE);
 	}
 
-	int ret = crossbar_->setRouting(&routing, V4L2Subdevice::ActiveFormat);
+	ret = crossbar_->setRouting(&routing, V4L2Subdevice::ActiveFormat);
 	if (ret)
 		return ret;
 
@@ -938,6 +1119,15 @@ int PipelineHandlerISI::start(Camera *camera,
 	return 0;
 }
 
+void PipelineHandlerISI::releaseDevice(Camera *camera)
+{
+	ISICameraData *data = cameraData(camera);
+
+	allocator_.release(data);
+	data->streamPipes_.clear();
+	data->enabledStreams_.clear();
+}
+
 void PipelineHandlerISI::stopDevice(Camera *camera)
 {
 	ISICameraData *data = cameraData(camera);
@@ -1017,6 +1207,8 @@ bool PipelineHandlerISI::match(DeviceEnumerator *enumerator)
 		return false;
 	}
 
+	allocator_.init(pipes_.size());
+
 	/*
 	 * Loop over all the crossbar switch sink pads to find connected CSI-2
 	 * receivers and camera sensors.
@@ -1055,7 +1247,8 @@ bool PipelineHandlerISI::match(DeviceEnumerator *enumerator)
 
 		/* Create the camera data. */
 		std::unique_ptr<ISICameraData> data =
-			std::make_unique<ISICameraData>(this);
+			std::make_unique<ISICameraData>(this, &allocator_,
+							 pipes_.size());
 
 		data->sensor_ = std::make_unique<CameraSensor>(sensor);
 		data->csis_ = std::make_unique<V4L2Subdevice>(csi);
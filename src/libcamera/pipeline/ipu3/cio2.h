@@ -59,6 +59,10 @@ public:
 	FrameBuffer *queueBuffer(Request *request, FrameBuffer *rawBuffer);
 	void tryReturnBuffer(FrameBuffer *buffer);
 	Signal<FrameBuffer *> &bufferReady() { return output_->bufferReady; }
+	V4L2BufferCache::Statistics bufferCacheStatistics() const
+	{
+		return output_->bufferCacheStatistics();
+	}
 	Signal<uint32_t> &frameStart() { return csi2_->frameStart; }
 
 	Signal<> bufferAvailable;
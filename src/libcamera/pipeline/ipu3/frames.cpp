@@ -11,6 +11,7 @@
 #include <libcamera/request.h>
 
 #include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/isp_buffer_pool.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -19,74 +20,88 @@ namespace libcamera {
 LOG_DECLARE_CATEGORY(IPU3)
 
 IPU3Frames::IPU3Frames()
+	: nextPipe_(0)
 {
 }
 
-void IPU3Frames::init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
-		      const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers)
+/*
+ * Frames are processed by one ImgU pipe, or alternately by two pipes when a
+ * camera uses both ImgU instances. Each pipe has its own pool of parameters
+ * and statistics buffers.
+ */
+void IPU3Frames::init(const std::vector<IspBufferPool *> &ispBuffers)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : paramBuffers)
-		availableParamBuffers_.push(buffer.get());
-
-	for (const std::unique_ptr<FrameBuffer> &buffer : statBuffers)
-		availableStatBuffers_.push(buffer.get());
-
-	frameInfo_.clear();
+	/* Track one frame per parameters and statistics buffers pair. */
+	unsigned int size = 0;
+	for (IspBufferPool *pool : ispBuffers)
+		size += pool->size();
+
+	ispBuffers_ = ispBuffers;
+	nextPipe_ = 0;
+	frameInfo_.resize(size);
 }
 
 void IPU3Frames::clear()
 {
-	availableParamBuffers_ = {};
-	availableStatBuffers_ = {};
+	frameInfo_.clear();
+
+	for (IspBufferPool *pool : ispBuffers_)
+		pool->reset();
 }
 
 IPU3Frames::Info *IPU3Frames::create(Request *request)
 {
 	unsigned int id = request->sequence();
 
-	if (availableParamBuffers_.empty()) {
-		LOG(IPU3, Debug) << "Parameters buffer underrun";
-		return nullptr;
+	/*
+	 * Dispatch frames to the pipes in a round-robin fashion, falling back
+	 * to the next pipe if the buffers of one are all in use.
+	 */
+	unsigned int pipe = nextPipe_;
+	int index = -1;
+
+	for (unsigned int i = 0; i < ispBuffers_.size(); i++) {
+		pipe = (nextPipe_ + i) % ispBuffers_.size();
+		index = ispBuffers_[pipe]->acquire();
+		if (index >= 0)
+			break;
 	}
 
-	if (availableStatBuffers_.empty()) {
-		LOG(IPU3, Debug) << "Statistics buffer underrun";
+	if (index < 0) {
+		LOG(IPU3, Debug) << "Parameters and statistics buffers underrun";
 		return nullptr;
 	}
 
-	FrameBuffer *paramBuffer = availableParamBuffers_.front();
-	FrameBuffer *statBuffer = availableStatBuffers_.front();
-
-	paramBuffer->_d()->setRequest(request);
-	statBuffer->_d()->setRequest(request);
-
-	availableParamBuffers_.pop();
-	availableStatBuffers_.pop();
+	nextPipe_ = (pipe + 1) % ispBuffers_.size();
 
-	/* \todo Remove the dynamic allocation of Info */
-	std::unique_ptr<Info> info = std::make_unique<Info>();
+	/* There are as many frame information slots as buffer pairs. */
+	Info *info = frameInfo_.alloc(id);
+	ASSERT(info);
 
 	info->id = id;
 	info->request = request;
+	info->pipe = pipe;
+	info->ispBuffers = index;
 	info->rawBuffer = nullptr;
-	info->paramBuffer = paramBuffer;
-	info->statBuffer = statBuffer;
+	info->paramBuffer = ispBuffers_[pipe]->params(index);
+	info->statBuffer = ispBuffers_[pipe]->stats(index);
+	info->effectiveSensorControls.clear();
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
+	info->statsQueued = {};
 
-	frameInfo_[id] = std::move(info);
+	info->paramBuffer->_d()->setRequest(request);
+	info->statBuffer->_d()->setRequest(request);
 
-	return frameInfo_[id].get();
+	return info;
 }
 
 void IPU3Frames::remove(IPU3Frames::Info *info)
 {
 	/* Return params and stat buffer for reuse. */
-	availableParamBuffers_.push(info->paramBuffer);
-	availableStatBuffers_.push(info->statBuffer);
+	ispBuffers_[info->pipe]->release(info->ispBuffers);
 
-	/* Delete the extended frame information. */
-	frameInfo_.erase(info->id);
+	frameInfo_.release(info);
 }
 
 bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
@@ -111,10 +126,9 @@ bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
 
 IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 {
-	const auto &itInfo = frameInfo_.find(id);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second.get();
+	Info *info = frameInfo_.find(id);
+	if (info)
+		return info;
 
 	LOG(IPU3, Fatal) << "Can't find tracking information for frame " << id;
 
@@ -123,17 +137,16 @@ IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 
 IPU3Frames::Info *IPU3Frames::find(FrameBuffer *buffer)
 {
-	for (auto const &itInfo : frameInfo_) {
-		Info *info = itInfo.second.get();
-
-		for (auto const itBuffers : info->request->buffers())
+	Info *info = frameInfo_.findIf([buffer](const Info &i) {
+		for (auto const itBuffers : i.request->buffers())
 			if (itBuffers.second == buffer)
-				return info;
+				return true;
 
-		if (info->rawBuffer == buffer || info->paramBuffer == buffer ||
-		    info->statBuffer == buffer)
-			return info;
-	}
+		return i.rawBuffer == buffer || i.paramBuffer == buffer ||
+		       i.statBuffer == buffer;
+	});
+	if (info)
+		return info;
 
 	LOG(IPU3, Fatal) << "Can't find tracking information from buffer";
 
@@ -7,19 +7,21 @@
 
 #pragma once
 
-#include <map>
 #include <memory>
-#include <queue>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/controls.h>
 
+#include "libcamera/internal/frame_info_ring.h"
+
 namespace libcamera {
 
 class FrameBuffer;
 class IPAProxy;
+class IspBufferPool;
 class PipelineHandler;
 class Request;
 class V4L2VideoDevice;
@@ -32,6 +34,8 @@ public:
 		unsigned int id;
 		Request *request;
 
+		unsigned int pipe;
+		unsigned int ispBuffers;
 		FrameBuffer *rawBuffer;
 		FrameBuffer *paramBuffer;
 		FrameBuffer *statBuffer;
@@ -40,12 +44,13 @@ public:
 
 		bool paramDequeued;
 		bool metadataProcessed;
+
+		utils::time_point statsQueued;
 	};
 
 	IPU3Frames();
 
-	void init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
-		  const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers);
+	void init(const std::vector<IspBufferPool *> &ispBuffers);
 	void clear();
 
 	Info *create(Request *request);
@@ -58,10 +63,9 @@ public:
 	Signal<> bufferAvailable;
 
 private:
-	std::queue<FrameBuffer *> availableParamBuffers_;
-	std::queue<FrameBuffer *> availableStatBuffers_;
-
-	std::map<unsigned int, std::unique_ptr<Info>> frameInfo_;
+	std::vector<IspBufferPool *> ispBuffers_;
+	unsigned int nextPipe_;
+	FrameInfoRing<Info> frameInfo_;
 };
 
 } /* namespace libcamera */
@@ -317,6 +317,11 @@ FOV calcFOV(const Size &in, const ImgUDevice::PipeConfig &pipe)
  * \brief The requested viewfinder output size
  */
 
+ImgUDevice::ImgUDevice()
+	: ispBuffers_("ImgU")
+{
+}
+
 /**
  * \brief Initialize components of the ImgU instance
  * \param[in] mediaDevice The ImgU instance media device
@@ -575,8 +580,10 @@ int ImgUDevice::configureVideoDevice(V4L2VideoDevice *dev, unsigned int pad,
 
 /**
  * \brief Allocate buffers for all the ImgU video devices
+ * \param[in] bufferCount The number of buffers to allocate
+ * \param[in] firstCookie The cookie of the first parameters buffer
  */
-int ImgUDevice::allocateBuffers(unsigned int bufferCount)
+int ImgUDevice::allocateBuffers(unsigned int bufferCount, unsigned int firstCookie)
 {
 	/* Share buffers between CIO2 output and ImgU input. */
 	int ret = input_->importBuffers(bufferCount);
@@ -585,15 +592,10 @@ int ImgUDevice::allocateBuffers(unsigned int bufferCount)
 		return ret;
 	}
 
-	ret = param_->allocateBuffers(bufferCount, &paramBuffers_);
-	if (ret < 0) {
-		LOG(IPU3, Error) << "Failed to allocate ImgU param buffers";
-		goto error;
-	}
-
-	ret = stat_->allocateBuffers(bufferCount, &statBuffers_);
+	ret = ispBuffers_.allocate(param_.get(), stat_.get(), bufferCount,
+				   firstCookie);
 	if (ret < 0) {
-		LOG(IPU3, Error) << "Failed to allocate ImgU stat buffers";
+		LOG(IPU3, Error) << "Failed to allocate ImgU param and stat buffers";
 		goto error;
 	}
 
@@ -629,8 +631,7 @@ void ImgUDevice::freeBuffers()
 {
 	int ret;
 
-	paramBuffers_.clear();
-	statBuffers_.clear();
+	ispBuffers_.free();
 
 	ret = output_->releaseBuffers();
 	if (ret)
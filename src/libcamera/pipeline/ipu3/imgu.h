@@ -10,6 +10,7 @@
 #include <memory>
 #include <string>
 
+#include "libcamera/internal/isp_buffer_pool.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -64,6 +65,8 @@ public:
 		Size viewfinder;
 	};
 
+	ImgUDevice();
+
 	int init(MediaDevice *media, unsigned int index);
 
 	PipeConfig calculatePipeConfig(Pipe *pipe);
@@ -84,7 +87,7 @@ public:
 					    outputFormat);
 	}
 
-	int allocateBuffers(unsigned int bufferCount);
+	int allocateBuffers(unsigned int bufferCount, unsigned int firstCookie = 1);
 	void freeBuffers();
 
 	int start();
@@ -99,8 +102,7 @@ public:
 	std::unique_ptr<V4L2VideoDevice> viewfinder_;
 	std::unique_ptr<V4L2VideoDevice> stat_;
 
-	std::vector<std::unique_ptr<FrameBuffer>> paramBuffers_;
-	std::vector<std::unique_ptr<FrameBuffer>> statBuffers_;
+	IspBufferPool ispBuffers_;
 
 private:
 	static constexpr unsigned int PAD_INPUT = 0;
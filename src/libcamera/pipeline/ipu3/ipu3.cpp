@@ -32,8 +32,10 @@
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/isp_recorder.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/tracepoints.h"
 
 #include "cio2.h"
 #include "frames.h"
@@ -51,11 +53,13 @@ class IPU3CameraData : public Camera::Private
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: Camera::Private(pipe)
+		: Camera::Private(pipe), imgu_(nullptr), secondaryImgu_(nullptr),
+		  buffersAllocated_(false), recorder_("ipu3"), ipaCounters_({})
 	{
 	}
 
 	int loadIPA();
+	void connectImgU(ImgUDevice *imgu);
 
 	void imguOutputBufferReady(FrameBuffer *buffer);
 	void cio2BufferReady(FrameBuffer *buffer);
@@ -67,6 +71,10 @@ public:
 
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	/* ImgU available to process alternate frames, if not used by a camera */
+	ImgUDevice *secondaryImgu_;
+	/* ImgU instances processing frames in the current configuration */
+	std::vector<ImgUDevice *> imgus_;
 
 	Stream outStream_;
 	Stream vfStream_;
@@ -86,6 +94,16 @@ public:
 
 	ControlInfoMap ipaControls_;
 
+	bool buffersAllocated_;
+	IspRecorder recorder_;
+
+	/* Time spent by the IPA between statistics and metadata */
+	struct {
+		uint64_t frames;
+		utils::Duration total;
+		utils::Duration max;
+	} ipaCounters_;
+
 private:
 	void metadataReady(unsigned int id, const ControlList &metadata);
 	void paramsBufferReady(unsigned int id);
@@ -97,6 +115,7 @@ class IPU3CameraConfiguration : public CameraConfiguration
 {
 public:
 	static constexpr unsigned int kBufferCount = 4;
+	static constexpr unsigned int kMinBufferCount = 2;
 	static constexpr unsigned int kMaxStreams = 3;
 
 	IPU3CameraConfiguration(IPU3CameraData *data);
@@ -141,19 +160,30 @@ public:
 	int exportFrameBuffers(Camera *camera, Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stopDevice(Camera *camera) override;
+	void flushDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+protected:
+	void releaseDevice(Camera *camera) override;
+	void countersDevice(const Camera *camera,
+			    std::map<std::string, uint64_t> *counters) override;
+
 private:
 	IPU3CameraData *cameraData(Camera *camera)
 	{
 		return static_cast<IPU3CameraData *>(camera->_d());
 	}
 
+	int configureImgU(ImgUDevice *imgu, IPU3CameraData *data,
+			  IPU3CameraConfiguration *config,
+			  V4L2DeviceFormat *inputFormat);
+
 	int initControls(IPU3CameraData *data);
 	int updateControls(IPU3CameraData *data);
 	int registerCameras();
@@ -165,8 +195,6 @@ private:
 	ImgUDevice imgu1_;
 	MediaDevice *cio2MediaDev_;
 	MediaDevice *imguMediaDev_;
-
-	std::vector<IPABuffer> ipaBuffers_;
 };
 
 IPU3CameraConfiguration::IPU3CameraConfiguration(IPU3CameraData *data)
@@ -333,7 +361,7 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 					      ImgUDevice::kOutputAlignHeight);
 
 			cfg->pixelFormat = formats::NV12;
-			cfg->bufferCount = kBufferCount;
+			cfg->bufferCount = bufferCount(kMinBufferCount, kBufferCount);
 			cfg->stride = info.stride(cfg->size.width, 0, 1);
 			cfg->frameSize = info.frameSize(cfg->size, 1);
 
@@ -477,18 +505,94 @@ PipelineHandlerIPU3::generateConfiguration(Camera *camera, Span<const StreamRole
 	return config;
 }
 
+int PipelineHandlerIPU3::configureImgU(ImgUDevice *imgu, IPU3CameraData *data,
+				       IPU3CameraConfiguration *config,
+				       V4L2DeviceFormat *inputFormat)
+{
+	Stream *outStream = &data->outStream_;
+	Stream *vfStream = &data->vfStream_;
+	V4L2DeviceFormat outputFormat;
+	int ret;
+
+	ret = imgu->configure(config->imguConfig(), inputFormat);
+	if (ret)
+		return ret;
+
+	/* Apply the format to the configured streams output devices. */
+	StreamConfiguration *mainCfg = nullptr;
+	StreamConfiguration *vfCfg = nullptr;
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = (*config)[i];
+		Stream *stream = cfg.stream();
+
+		if (stream == outStream) {
+			mainCfg = &cfg;
+			ret = imgu->configureOutput(cfg, &outputFormat);
+			if (ret)
+				return ret;
+		} else if (stream == vfStream) {
+			vfCfg = &cfg;
+			ret = imgu->configureViewfinder(cfg, &outputFormat);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/*
+	 * As we need to set format also on the non-active streams, use
+	 * the configuration of the active one for that purpose (there should
+	 * be at least one active stream in the configuration request).
+	 */
+	if (!vfCfg) {
+		ret = imgu->configureViewfinder(*mainCfg, &outputFormat);
+		if (ret)
+			return ret;
+	}
+
+	/* Apply the "pipe_mode" control to the ImgU subdevice. */
+	ControlList ctrls(imgu->imgu_->controls());
+	/*
+	 * Set the ImgU pipe mode to 'Video' unconditionally to have statistics
+	 * generated.
+	 *
+	 * \todo Figure out what the 'Still Capture' mode is meant for, and use
+	 * it accordingly.
+	 */
+	ctrls.set(V4L2_CID_IPU3_PIPE_MODE,
+		  static_cast<int32_t>(IPU3PipeModeVideo));
+	ret = imgu->imgu_->setControls(&ctrls);
+	if (ret) {
+		LOG(IPU3, Error) << "Unable to set pipe_mode control";
+		return ret;
+	}
+
+	return 0;
+}
+
 int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 {
 	IPU3CameraConfiguration *config =
 		static_cast<IPU3CameraConfiguration *>(c);
 	IPU3CameraData *data = cameraData(camera);
-	Stream *outStream = &data->outStream_;
-	Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
-	V4L2DeviceFormat outputFormat;
 	int ret;
 
+	/*
+	 * Buffers prepared for the previous configuration can't be used, free
+	 * them before the ImgU instances used by the camera change.
+	 */
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
+
+	/*
+	 * Use both ImgU instances when the second one is available, to process
+	 * alternate frames.
+	 */
+	data->imgus_ = { data->imgu_ };
+	if (data->secondaryImgu_)
+		data->imgus_.push_back(data->secondaryImgu_);
+
 	/*
 	 * FIXME: enabled links in one ImgU pipe interfere with capture
 	 * operations on the other one. This can be easily triggered by
@@ -527,9 +631,11 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * stream which is for raw capture, in which case no buffers will
 	 * ever be queued to the ImgU.
 	 */
-	ret = data->imgu_->enableLinks(true);
-	if (ret)
-		return ret;
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = imgu->enableLinks(true);
+		if (ret)
+			return ret;
+	}
 
 	/*
 	 * Pass the requested stream size to the CIO2 unit and get back the
@@ -559,59 +665,12 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (imguConfig.isNull())
 		return 0;
 
-	ret = imgu->configure(imguConfig, &cio2Format);
-	if (ret)
-		return ret;
-
-	/* Apply the format to the configured streams output devices. */
-	StreamConfiguration *mainCfg = nullptr;
-	StreamConfiguration *vfCfg = nullptr;
-
-	for (unsigned int i = 0; i < config->size(); ++i) {
-		StreamConfiguration &cfg = (*config)[i];
-		Stream *stream = cfg.stream();
-
-		if (stream == outStream) {
-			mainCfg = &cfg;
-			ret = imgu->configureOutput(cfg, &outputFormat);
-			if (ret)
-				return ret;
-		} else if (stream == vfStream) {
-			vfCfg = &cfg;
-			ret = imgu->configureViewfinder(cfg, &outputFormat);
-			if (ret)
-				return ret;
-		}
-	}
-
-	/*
-	 * As we need to set format also on the non-active streams, use
-	 * the configuration of the active one for that purpose (there should
-	 * be at least one active stream in the configuration request).
-	 */
-	if (!vfCfg) {
-		ret = imgu->configureViewfinder(*mainCfg, &outputFormat);
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = configureImgU(imgu, data, config, &cio2Format);
 		if (ret)
 			return ret;
 	}
 
-	/* Apply the "pipe_mode" control to the ImgU subdevice. */
-	ControlList ctrls(imgu->imgu_->controls());
-	/*
-	 * Set the ImgU pipe mode to 'Video' unconditionally to have statistics
-	 * generated.
-	 *
-	 * \todo Figure out what the 'Still Capture' mode is meant for, and use
-	 * it accordingly.
-	 */
-	ctrls.set(V4L2_CID_IPU3_PIPE_MODE,
-		  static_cast<int32_t>(IPU3PipeModeVideo));
-	ret = imgu->imgu_->setControls(&ctrls);
-	if (ret) {
-		LOG(IPU3, Error) << "Unable to set pipe_mode control";
-		return ret;
-	}
-
 	ipa::ipu3::IPAConfigInfo configInfo;
 	configInfo.sensorControls = data->cio2_.sensor()->controls();
 
@@ -660,8 +719,9 @@ int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
 int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
-	ImgUDevice *imgu = data->imgu_;
+	std::vector<IspBufferPool *> ispBuffers;
 	unsigned int bufferCount;
+	unsigned int firstCookie = 1;
 	int ret;
 
 	bufferCount = std::max({
@@ -670,29 +730,35 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 		data->rawStream_.configuration().bufferCount,
 	});
 
-	ret = imgu->allocateBuffers(bufferCount);
-	if (ret < 0)
-		return ret;
-
-	/* Map buffers to the IPA. */
-	unsigned int ipaBufferId = 1;
+	/*
+	 * Allocating and importing buffers on the ImgU video devices is slow,
+	 * do it in a worker to avoid stalling the other cameras.
+	 */
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = runInWorker([&]() {
+			return imgu->allocateBuffers(bufferCount, firstCookie);
+		});
+		if (ret < 0) {
+			freeBuffers(camera);
+			return ret;
+		}
 
-	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
-	}
+		/*
+		 * Map buffers to the IPA, with distinct cookies for the
+		 * buffers of each ImgU.
+		 */
+		data->ipa_->mapBuffers(imgu->ispBuffers_.ipaBuffers());
+		firstCookie += imgu->ispBuffers_.size() * 2;
 
-	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		ispBuffers.push_back(&imgu->ispBuffers_);
 	}
 
-	data->ipa_->mapBuffers(ipaBuffers_);
-
-	data->frameInfos_.init(imgu->paramBuffers_, imgu->statBuffers_);
+	data->frameInfos_.init(ispBuffers);
 	data->frameInfos_.bufferAvailable.connect(
 		data, &IPU3CameraData::queuePendingRequests);
 
+	data->buffersAllocated_ = true;
+
 	return 0;
 }
 
@@ -702,23 +768,35 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 
 	data->frameInfos_.clear();
 
-	std::vector<unsigned int> ids;
-	for (IPABuffer &ipabuf : ipaBuffers_)
-		ids.push_back(ipabuf.id);
-
-	data->ipa_->unmapBuffers(ids);
-	ipaBuffers_.clear();
+	for (ImgUDevice *imgu : data->imgus_) {
+		data->ipa_->unmapBuffers(imgu->ispBuffers_.ipaBufferIds());
+		imgu->freeBuffers();
+	}
 
-	data->imgu_->freeBuffers();
+	data->buffersAllocated_ = false;
 
 	return 0;
 }
 
+int PipelineHandlerIPU3::prepare(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	if (data->buffersAllocated_)
+		return 0;
+
+	/*
+	 * Allocate the ImgU buffers and map them to the IPA ahead of start().
+	 * The CIO2 buffers are still allocated by start(), as the CIO2 device
+	 * may be shared with the other camera of the pipeline handler.
+	 */
+	return allocateBuffers(camera);
+}
+
 int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
 	int ret;
 
 	/* Disable test pattern mode on the sensor, if any. */
@@ -727,10 +805,12 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 	if (ret)
 		return ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/* Allocate buffers for internal pipeline usage, unless prepared. */
+	if (!data->buffersAllocated_) {
+		ret = allocateBuffers(camera);
+		if (ret)
+			return ret;
+	}
 
 	ret = data->ipa_->start();
 	if (ret)
@@ -746,14 +826,19 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 	if (ret)
 		goto error;
 
-	ret = imgu->start();
-	if (ret)
-		goto error;
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = imgu->start();
+		if (ret)
+			goto error;
+	}
+
+	data->recorder_.start();
 
 	return 0;
 
 error:
-	imgu->stop();
+	for (ImgUDevice *imgu : data->imgus_)
+		imgu->stop();
 	cio2->stop();
 	data->ipa_->stop();
 	freeBuffers(camera);
@@ -767,22 +852,43 @@ void PipelineHandlerIPU3::stopDevice(Camera *camera)
 	IPU3CameraData *data = cameraData(camera);
 	int ret = 0;
 
+	data->processingRequests_ = {};
 	data->cancelPendingRequests();
 
 	data->ipa_->stop();
 
-	ret |= data->imgu_->stop();
+	for (ImgUDevice *imgu : data->imgus_)
+		ret |= imgu->stop();
 	ret |= data->cio2_.stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera " << camera->id();
 
+	data->recorder_.stop();
 	freeBuffers(camera);
 }
 
-void IPU3CameraData::cancelPendingRequests()
+void PipelineHandlerIPU3::releaseDevice(Camera *camera)
 {
-	processingRequests_ = {};
+	IPU3CameraData *data = cameraData(camera);
 
+	/* Free the buffers prepared for a camera that hasn't been started. */
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
+}
+
+void PipelineHandlerIPU3::flushDevice(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	/*
+	 * Requests waiting for a CIO2 buffer or a frame info slot haven't been
+	 * passed to the IPA or the hardware yet, cancel them.
+	 */
+	data->cancelPendingRequests();
+}
+
+void IPU3CameraData::cancelPendingRequests()
+{
 	while (!pendingRequests_.empty()) {
 		Request *request = pendingRequests_.front();
 
@@ -1052,6 +1158,7 @@ int PipelineHandlerIPU3::registerCameras()
 	 * in a compatible format.
 	 */
 	unsigned int numCameras = 0;
+	IPU3CameraData *firstCamera = nullptr;
 	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
 		std::unique_ptr<IPU3CameraData> data =
 			std::make_unique<IPU3CameraData>(this);
@@ -1120,16 +1227,10 @@ int PipelineHandlerIPU3::registerCameras()
 					&IPU3CameraData::cio2BufferReady);
 		data->cio2_.bufferAvailable.connect(
 			data.get(), &IPU3CameraData::queuePendingRequests);
-		data->imgu_->input_->bufferReady.connect(&data->cio2_,
-					&CIO2Device::tryReturnBuffer);
-		data->imgu_->output_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->viewfinder_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->param_->bufferReady.connect(data.get(),
-					&IPU3CameraData::paramBufferReady);
-		data->imgu_->stat_->bufferReady.connect(data.get(),
-					&IPU3CameraData::statBufferReady);
+		data->connectImgU(data->imgu_);
+
+		if (!numCameras)
+			firstCamera = data.get();
 
 		/* Create and register the Camera instance. */
 		const std::string &cameraId = cio2->sensor()->id();
@@ -1146,9 +1247,41 @@ int PipelineHandlerIPU3::registerCameras()
 		numCameras++;
 	}
 
+	/*
+	 * When a single camera is connected, the second ImgU is otherwise
+	 * unused. Optionally let the camera process alternate frames with it
+	 * to double the ISP throughput, for high frame rate capture.
+	 */
+	if (numCameras == 1 && utils::secure_getenv("LIBCAMERA_IPU3_DUAL_IMGU")) {
+		firstCamera->secondaryImgu_ = &imgu1_;
+		firstCamera->connectImgU(&imgu1_);
+
+		LOG(IPU3, Info) << "Using both ImgU instances for a single camera";
+	}
+
 	return numCameras ? 0 : -ENODEV;
 }
 
+/**
+ * \brief Connect the video devices of an ImgU to the camera
+ * \param[in] imgu The ImgU processing frames for the camera
+ *
+ * Connect the video devices' 'bufferReady' signals to their slot to implement
+ * the image processing pipeline. Frames produced by the CIO2 unit are passed
+ * to the ImgU input where they get processed and returned through the ImgU
+ * main and secondary outputs.
+ */
+void IPU3CameraData::connectImgU(ImgUDevice *imgu)
+{
+	imgu->input_->bufferReady.connect(&cio2_, &CIO2Device::tryReturnBuffer);
+	imgu->output_->bufferReady.connect(this,
+					   &IPU3CameraData::imguOutputBufferReady);
+	imgu->viewfinder_->bufferReady.connect(this,
+					       &IPU3CameraData::imguOutputBufferReady);
+	imgu->param_->bufferReady.connect(this, &IPU3CameraData::paramBufferReady);
+	imgu->stat_->bufferReady.connect(this, &IPU3CameraData::statBufferReady);
+}
+
 int IPU3CameraData::loadIPA()
 {
 	ipa_ = IPAManager::createIPA<ipa::ipu3::IPAProxyIPU3>(pipe(), 1, 1);
@@ -1224,22 +1357,30 @@ void IPU3CameraData::paramsBufferReady(unsigned int id)
 	if (!info)
 		return;
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "ipu3", "params_ready", info->request,
+			     id);
+
+	/* Process the frame with the ImgU that owns its parameters buffer. */
+	ImgUDevice *imgu = imgus_[info->pipe];
+
 	/* Queue all buffers from the request aimed for the ImgU. */
 	for (auto it : info->request->buffers()) {
 		const Stream *stream = it.first;
 		FrameBuffer *outbuffer = it.second;
 
 		if (stream == &outStream_)
-			imgu_->output_->queueBuffer(outbuffer);
+			imgu->output_->queueBuffer(outbuffer);
 		else if (stream == &vfStream_)
-			imgu_->viewfinder_->queueBuffer(outbuffer);
+			imgu->viewfinder_->queueBuffer(outbuffer);
 	}
 
 	info->paramBuffer->_d()->metadata().planes()[0].bytesused =
 		sizeof(struct ipu3_uapi_params);
-	imgu_->param_->queueBuffer(info->paramBuffer);
-	imgu_->stat_->queueBuffer(info->statBuffer);
-	imgu_->input_->queueBuffer(info->rawBuffer);
+	recorder_.record(IspRecorder::RecordType::Parameters, id, info->paramBuffer);
+
+	imgu->param_->queueBuffer(info->paramBuffer);
+	imgu->stat_->queueBuffer(info->statBuffer);
+	imgu->input_->queueBuffer(info->rawBuffer);
 }
 
 void IPU3CameraData::metadataReady(unsigned int id, const ControlList &metadata)
@@ -1248,6 +1389,18 @@ void IPU3CameraData::metadataReady(unsigned int id, const ControlList &metadata)
 	if (!info)
 		return;
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "ipu3", "metadata_ready",
+			     info->request, id);
+
+	recorder_.record(id, metadata);
+
+	if (info->statsQueued != utils::time_point{}) {
+		utils::Duration time = utils::clock::now() - info->statsQueued;
+		ipaCounters_.total += time;
+		ipaCounters_.max = std::max(ipaCounters_.max, time);
+		ipaCounters_.frames++;
+	}
+
 	Request *request = info->request;
 	request->metadata().merge(metadata);
 
@@ -1329,6 +1482,8 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 	if (request->findBuffer(&rawStream_))
 		pipe()->completeBuffer(request, buffer);
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "ipu3", "params_request", request,
+			     info->id);
 	ipa_->fillParamsBuffer(info->id, info->paramBuffer->cookie());
 }
 
@@ -1373,6 +1528,12 @@ void IPU3CameraData::statBufferReady(FrameBuffer *buffer)
 		return;
 	}
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "ipu3", "stats_ready", request,
+			     info->id);
+
+	recorder_.record(IspRecorder::RecordType::Statistics, info->id, buffer);
+
+	info->statsQueued = utils::clock::now();
 	ipa_->processStatsBuffer(info->id, request->metadata().get(controls::SensorTimestamp).value_or(0),
 				 info->statBuffer->cookie(), info->effectiveSensorControls);
 }
@@ -1420,6 +1581,49 @@ void IPU3CameraData::frameStart(uint32_t sequence)
 				*testPatternMode);
 }
 
+void PipelineHandlerIPU3::countersDevice(const Camera *camera,
+					 std::map<std::string, uint64_t> *counters)
+{
+	const IPU3CameraData *data =
+		static_cast<const IPU3CameraData *>(camera->_d());
+	unsigned int underruns = 0;
+	unsigned int peakOccupancy = 0;
+
+	V4L2BufferCache::Statistics cache = data->cio2_.bufferCacheStatistics();
+	for (const ImgUDevice *imgu : data->imgus_) {
+		cache += imgu->input_->bufferCacheStatistics();
+		cache += imgu->param_->bufferCacheStatistics();
+		cache += imgu->output_->bufferCacheStatistics();
+		cache += imgu->viewfinder_->bufferCacheStatistics();
+		cache += imgu->stat_->bufferCacheStatistics();
+
+		const IspBufferPool::Statistics &pool = imgu->ispBuffers_.statistics();
+		underruns += pool.underruns;
+		peakOccupancy += pool.peakOccupancy;
+	}
+
+	(*counters)["v4l2.buffer_cache.hits"] = cache.hits;
+	(*counters)["v4l2.buffer_cache.misses"] = cache.misses;
+	(*counters)["v4l2.buffer_cache.evictions"] = cache.evictions;
+
+	(*counters)["isp.buffer_pool.underruns"] = underruns;
+	(*counters)["isp.buffer_pool.peak_occupancy"] = peakOccupancy;
+
+	if (data->delayedCtrls_) {
+		const DelayedControls::Statistics &ctrls =
+			data->delayedCtrls_->statistics();
+		(*counters)["sensor.controls.frames"] = ctrls.frames;
+		(*counters)["sensor.controls.underruns"] = ctrls.underruns;
+		(*counters)["sensor.controls.late"] = ctrls.late;
+		(*counters)["sensor.controls.lateness_max"] = ctrls.maxLateness;
+		(*counters)["sensor.controls.lateness_total"] = ctrls.totalLateness;
+	}
+
+	(*counters)["ipa.frames"] = data->ipaCounters_.frames;
+	(*counters)["ipa.time_total_us"] = data->ipaCounters_.total.get<std::micro>();
+	(*counters)["ipa.time_max_us"] = data->ipaCounters_.max.get<std::micro>();
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerIPU3, "ipu3")
 
 } /* namespace libcamera */
@@ -9,8 +9,8 @@
 #include <array>
 #include <iomanip>
 #include <memory>
-#include <numeric>
-#include <queue>
+#include <optional>
+#include <vector>
 
 #include <linux/media-bus-format.h>
 #include <linux/rkisp1-config.h>
@@ -35,10 +35,14 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/frame_info_ring.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/isp_buffer_pool.h"
+#include "libcamera/internal/isp_recorder.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -55,6 +59,7 @@ struct RkISP1FrameInfo {
 	unsigned int frame;
 	Request *request;
 
+	int ispBuffers;
 	FrameBuffer *paramBuffer;
 	FrameBuffer *statBuffer;
 	FrameBuffer *mainPathBuffer;
@@ -62,6 +67,8 @@ struct RkISP1FrameInfo {
 
 	bool paramDequeued;
 	bool metadataProcessed;
+
+	utils::time_point statsQueued;
 };
 
 class RkISP1Frames
@@ -69,8 +76,9 @@ class RkISP1Frames
 public:
 	RkISP1Frames(PipelineHandler *pipe);
 
-	RkISP1FrameInfo *create(const RkISP1CameraData *data, Request *request,
-				bool isRaw);
+	void init(unsigned int count);
+
+	RkISP1FrameInfo *create(const RkISP1CameraData *data, Request *request);
 	int destroy(unsigned int frame);
 	void clear();
 
@@ -80,7 +88,7 @@ public:
 
 private:
 	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+	FrameInfoRing<RkISP1FrameInfo> frameInfo_;
 };
 
 class RkISP1CameraData : public Camera::Private
@@ -89,7 +97,7 @@ public:
 	RkISP1CameraData(PipelineHandler *pipe, RkISP1MainPath *mainPath,
 			 RkISP1SelfPath *selfPath)
 		: Camera::Private(pipe), frame_(0), frameInfo_(pipe),
-		  mainPath_(mainPath), selfPath_(selfPath)
+		  mainPath_(mainPath), selfPath_(selfPath), ipaCounters_({})
 	{
 	}
 
@@ -101,7 +109,6 @@ public:
 	std::unique_ptr<CameraSensor> sensor_;
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	unsigned int frame_;
-	std::vector<IPABuffer> ipaBuffers_;
 	RkISP1Frames frameInfo_;
 
 	RkISP1MainPath *mainPath_;
@@ -109,6 +116,13 @@ public:
 
 	std::unique_ptr<ipa::rkisp1::IPAProxyRkISP1> ipa_;
 
+	/* Time spent by the IPA between statistics and metadata */
+	struct {
+		uint64_t frames;
+		utils::Duration total;
+		utils::Duration max;
+	} ipaCounters_;
+
 private:
 	void paramFilled(unsigned int frame);
 	void setSensorControls(unsigned int frame,
@@ -128,7 +142,16 @@ public:
 	const Transform &combinedTransform() { return combinedTransform_; }
 
 private:
-	bool fitsAllPaths(const StreamConfiguration &cfg);
+	static constexpr unsigned int kMinBufferCount = 2;
+
+	/* A candidate assignment of the streams to the main and self paths */
+	struct PathPlan {
+		std::vector<StreamConfiguration> configs;
+		unsigned int adjusted;
+		uint64_t bandwidth;
+	};
+
+	std::optional<PathPlan> planPaths(Span<RkISP1Path *const> paths) const;
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -154,6 +177,7 @@ public:
 	int exportFrameBuffers(Camera *camera, Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stopDevice(Camera *camera) override;
 
@@ -161,6 +185,11 @@ public:
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+protected:
+	void releaseDevice(Camera *camera) override;
+	void countersDevice(const Camera *camera,
+			    std::map<std::string, uint64_t> *counters) override;
+
 private:
 	static constexpr Size kRkISP1PreviewSize = { 1920, 1080 };
 
@@ -196,10 +225,9 @@ private:
 	RkISP1MainPath mainPath_;
 	RkISP1SelfPath selfPath_;
 
-	std::vector<std::unique_ptr<FrameBuffer>> paramBuffers_;
-	std::vector<std::unique_ptr<FrameBuffer>> statBuffers_;
-	std::queue<FrameBuffer *> availableParamBuffers_;
-	std::queue<FrameBuffer *> availableStatBuffers_;
+	IspBufferPool ispBuffers_;
+	bool buffersAllocated_;
+	IspRecorder recorder_;
 
 	Camera *activeCamera_;
 
@@ -211,47 +239,45 @@ RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
 {
 }
 
-RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *request,
-				      bool isRaw)
+void RkISP1Frames::init(unsigned int count)
+{
+	frameInfo_.resize(count);
+}
+
+RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *request)
 {
 	unsigned int frame = data->frame_;
 
-	FrameBuffer *paramBuffer = nullptr;
-	FrameBuffer *statBuffer = nullptr;
+	RkISP1FrameInfo *info = frameInfo_.alloc(frame);
+	if (!info) {
+		LOG_RATELIMITED(RkISP1, Error) << "Frame information underrun";
+		return nullptr;
+	}
 
-	if (!isRaw) {
-		if (pipe_->availableParamBuffers_.empty()) {
-			LOG(RkISP1, Error) << "Parameters buffer underrun";
-			return nullptr;
-		}
+	/* Parameters and statistics buffers are not used in raw mode. */
+	IspBufferPool &ispBuffers = pipe_->ispBuffers_;
+	int index = -1;
 
-		if (pipe_->availableStatBuffers_.empty()) {
-			LOG(RkISP1, Error) << "Statistic buffer underrun";
+	if (ispBuffers.size()) {
+		index = ispBuffers.acquire();
+		if (index < 0) {
+			LOG_RATELIMITED(RkISP1, Error)
+				<< "Parameters and statistics buffers underrun";
+			frameInfo_.release(info);
 			return nullptr;
 		}
-
-		paramBuffer = pipe_->availableParamBuffers_.front();
-		pipe_->availableParamBuffers_.pop();
-
-		statBuffer = pipe_->availableStatBuffers_.front();
-		pipe_->availableStatBuffers_.pop();
 	}
 
-	FrameBuffer *mainPathBuffer = request->findBuffer(&data->mainPathStream_);
-	FrameBuffer *selfPathBuffer = request->findBuffer(&data->selfPathStream_);
-
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
-
 	info->frame = frame;
 	info->request = request;
-	info->paramBuffer = paramBuffer;
-	info->mainPathBuffer = mainPathBuffer;
-	info->selfPathBuffer = selfPathBuffer;
-	info->statBuffer = statBuffer;
+	info->ispBuffers = index;
+	info->paramBuffer = index >= 0 ? ispBuffers.params(index) : nullptr;
+	info->statBuffer = index >= 0 ? ispBuffers.stats(index) : nullptr;
+	info->mainPathBuffer = request->findBuffer(&data->mainPathStream_);
+	info->selfPathBuffer = request->findBuffer(&data->selfPathStream_);
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
-
-	frameInfo_[frame] = info;
+	info->statsQueued = {};
 
 	return info;
 }
@@ -262,36 +288,25 @@ int RkISP1Frames::destroy(unsigned int frame)
 	if (!info)
 		return -ENOENT;
 
-	pipe_->availableParamBuffers_.push(info->paramBuffer);
-	pipe_->availableStatBuffers_.push(info->statBuffer);
-
-	frameInfo_.erase(info->frame);
+	if (info->ispBuffers >= 0)
+		pipe_->ispBuffers_.release(info->ispBuffers);
 
-	delete info;
+	frameInfo_.release(info);
 
 	return 0;
 }
 
 void RkISP1Frames::clear()
 {
-	for (const auto &entry : frameInfo_) {
-		RkISP1FrameInfo *info = entry.second;
-
-		pipe_->availableParamBuffers_.push(info->paramBuffer);
-		pipe_->availableStatBuffers_.push(info->statBuffer);
-
-		delete info;
-	}
-
 	frameInfo_.clear();
+	pipe_->ispBuffers_.reset();
 }
 
 RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	RkISP1FrameInfo *info = frameInfo_.find(frame);
+	if (info)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from frame";
 
@@ -300,15 +315,14 @@ RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 
 RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->mainPathBuffer == buffer ||
-		    info->selfPathBuffer == buffer)
-			return info;
-	}
+	RkISP1FrameInfo *info = frameInfo_.findIf([buffer](const RkISP1FrameInfo &i) {
+		return i.paramBuffer == buffer ||
+		       i.statBuffer == buffer ||
+		       i.mainPathBuffer == buffer ||
+		       i.selfPathBuffer == buffer;
+	});
+	if (info)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from buffer";
 
@@ -317,12 +331,11 @@ RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 
 RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->request == request)
-			return info;
-	}
+	RkISP1FrameInfo *info = frameInfo_.findIf([request](const RkISP1FrameInfo &i) {
+		return i.request == request;
+	});
+	if (info)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from request";
 
@@ -340,6 +353,13 @@ int RkISP1CameraData::loadIPA(unsigned int hwRevision)
 	if (!ipa_)
 		return -ENOENT;
 
+	/*
+	 * The IPA per-frame processing is short, run it in the pipeline
+	 * handler thread to avoid two thread switches per frame. The signal
+	 * handlers don't depend on the state updated after calling the IPA.
+	 */
+	ipa_->setDirectCalls(true);
+
 	ipa_->setSensorControls.connect(this, &RkISP1CameraData::setSensorControls);
 	ipa_->paramsBufferReady.connect(this, &RkISP1CameraData::paramFilled);
 	ipa_->metadataReady.connect(this, &RkISP1CameraData::metadataReady);
@@ -386,8 +406,14 @@ void RkISP1CameraData::paramFilled(unsigned int frame)
 	if (!info)
 		return;
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "rkisp1", "params_ready",
+			     info->request, frame);
+
 	info->paramBuffer->_d()->metadata().planes()[0].bytesused =
 		sizeof(struct rkisp1_params_cfg);
+	pipe->recorder_.record(IspRecorder::RecordType::Parameters, frame,
+			       info->paramBuffer);
+
 	pipe->param_->queueBuffer(info->paramBuffer);
 	pipe->stat_->queueBuffer(info->statBuffer);
 
@@ -410,6 +436,18 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 	if (!info)
 		return;
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "rkisp1", "metadata_ready",
+			     info->request, frame);
+
+	pipe()->recorder_.record(frame, metadata);
+
+	if (info->statsQueued != utils::time_point{}) {
+		utils::Duration time = utils::clock::now() - info->statsQueued;
+		ipaCounters_.total += time;
+		ipaCounters_.max = std::max(ipaCounters_.max, time);
+		ipaCounters_.frames++;
+	}
+
 	info->request->metadata().merge(metadata);
 	info->metadataProcessed = true;
 
@@ -448,20 +486,39 @@ RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 	data_ = data;
 }
 
-bool RkISP1CameraConfiguration::fitsAllPaths(const StreamConfiguration &cfg)
+/*
+ * Validate the streams against the \a paths they would be assigned to, and
+ * compute the cost of the assignment: the number of streams that need to be
+ * adjusted, and the memory bandwidth consumed by writing the frames of all
+ * streams, as sized by the paths.
+ */
+std::optional<RkISP1CameraConfiguration::PathPlan>
+RkISP1CameraConfiguration::planPaths(Span<RkISP1Path *const> paths) const
 {
 	const CameraSensor *sensor = data_->sensor_.get();
-	StreamConfiguration config;
-
-	config = cfg;
-	if (data_->mainPath_->validate(sensor, &config) != Valid)
-		return false;
-
-	config = cfg;
-	if (data_->selfPath_ && data_->selfPath_->validate(sensor, &config) != Valid)
-		return false;
+	PathPlan plan{ {}, 0, 0 };
+
+	for (unsigned int i = 0; i < paths.size(); i++) {
+		StreamConfiguration cfg = config_[i];
+
+		Status status = paths[i]->validate(sensor, &cfg);
+		if (status == Invalid)
+			return std::nullopt;
+		if (status == Adjusted)
+			plan.adjusted++;
+
+		const Stream *stream = paths[i] == data_->mainPath_
+				     ? &data_->mainPathStream_
+				     : &data_->selfPathStream_;
+		cfg.setStream(const_cast<Stream *>(stream));
+
+		plan.bandwidth += cfg.frameSize
+				? cfg.frameSize
+				: PixelFormatInfo::info(cfg.pixelFormat).frameSize(cfg.size);
+		plan.configs.push_back(cfg);
+	}
 
-	return true;
+	return plan;
 }
 
 CameraConfiguration::Status RkISP1CameraConfiguration::validate()
@@ -502,72 +559,64 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 	}
 
 	/*
-	 * If there are more than one stream in the configuration figure out the
-	 * order to evaluate the streams. The first stream has the highest
-	 * priority but if both main path and self path can satisfy it evaluate
-	 * the second stream first as the first stream is guaranteed to work
-	 * with whichever path is not used by the second one.
+	 * Evaluate all assignments of the streams to the main and self paths,
+	 * and pick the one that requires the fewest adjustments, then the one
+	 * that consumes the least memory bandwidth. The first stream has the
+	 * highest priority and is assigned to the main path when all else is
+	 * equal, as the main path supports the largest resolutions.
 	 */
-	std::vector<unsigned int> order(config_.size());
-	std::iota(order.begin(), order.end(), 0);
-	if (config_.size() == 2 && fitsAllPaths(config_[0]))
-		std::reverse(order.begin(), order.end());
-
-	bool mainPathAvailable = true;
-	bool selfPathAvailable = data_->selfPath_;
-	for (unsigned int index : order) {
-		StreamConfiguration &cfg = config_[index];
-
-		/* Try to match stream without adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(sensor, &tryCfg) == Valid) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				continue;
-			}
-		}
-
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(sensor, &tryCfg) == Valid) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				continue;
-			}
-		}
+	RkISP1Path *mainPath = data_->mainPath_;
+	RkISP1Path *selfPath = data_->selfPath_;
+	std::vector<std::vector<RkISP1Path *>> candidates;
+
+	if (config_.size() == 1) {
+		candidates.push_back({ mainPath });
+		if (selfPath)
+			candidates.push_back({ selfPath });
+	} else {
+		candidates.push_back({ mainPath, selfPath });
+		candidates.push_back({ selfPath, mainPath });
+	}
 
-		/* Try to match stream allowing adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(sensor, &tryCfg) == Adjusted) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				status = Adjusted;
-				continue;
-			}
-		}
+	std::optional<PathPlan> best;
+	for (const std::vector<RkISP1Path *> &paths : candidates) {
+		std::optional<PathPlan> plan = planPaths(paths);
+		if (!plan)
+			continue;
 
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(sensor, &tryCfg) == Adjusted) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				status = Adjusted;
-				continue;
-			}
-		}
+		if (!best || plan->adjusted < best->adjusted ||
+		    (plan->adjusted == best->adjusted &&
+		     plan->bandwidth < best->bandwidth))
+			best = std::move(plan);
+	}
 
+	if (!best) {
 		/* All paths rejected configuration. */
-		LOG(RkISP1, Debug) << "Camera configuration not supported "
-				   << cfg.toString();
+		LOG(RkISP1, Debug) << "Camera configuration not supported";
 		return Invalid;
 	}
 
+	for (unsigned int i = 0; i < config_.size(); i++) {
+		StreamConfiguration &cfg = config_[i];
+		const StreamConfiguration &planned = best->configs[i];
+
+		LOG(RkISP1, Debug)
+			<< "Stream " << i << " " << planned.toString()
+			<< " assigned to "
+			<< (planned.stream() == &data_->mainPathStream_
+				    ? "main" : "self")
+			<< " path";
+
+		cfg = planned;
+		cfg.bufferCount = bufferCount(kMinBufferCount, planned.bufferCount);
+	}
+
+	if (best->adjusted)
+		status = Adjusted;
+
+	LOG(RkISP1, Debug)
+		<< "Streams output " << best->bandwidth << " bytes per frame";
+
 	/* Select the sensor format. */
 	PixelFormat rawFormat;
 	Size maxSize;
@@ -603,7 +652,8 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
  */
 
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
-	: PipelineHandler(manager), hasSelfPath_(true)
+	: PipelineHandler(manager), hasSelfPath_(true), ispBuffers_("rkisp1"),
+	  buffersAllocated_(false), recorder_("rkisp1")
 {
 }
 
@@ -719,6 +769,10 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	CameraSensor *sensor = data->sensor_.get();
 	int ret;
 
+	/* Buffers prepared for the previous configuration can't be used. */
+	if (buffersAllocated_)
+		freeBuffers(camera);
+
 	ret = initLinks(camera, sensor, *config);
 	if (ret)
 		return ret;
@@ -845,8 +899,6 @@ int PipelineHandlerRkISP1::exportFrameBuffers([[maybe_unused]] Camera *camera, S
 int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	unsigned int ipaBufferId = 1;
-	int ret;
 
 	unsigned int maxCount = std::max({
 		data->mainPathStream_.configuration().bufferCount,
@@ -854,59 +906,37 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 	});
 
 	if (!isRaw_) {
-		ret = param_->allocateBuffers(maxCount, &paramBuffers_);
-		if (ret < 0)
-			goto error;
-
-		ret = stat_->allocateBuffers(maxCount, &statBuffers_);
-		if (ret < 0)
-			goto error;
-	}
+		int ret = ispBuffers_.allocate(param_.get(), stat_.get(), maxCount);
+		if (ret < 0) {
+			param_->releaseBuffers();
+			stat_->releaseBuffers();
+			return ret;
+		}
 
-	for (std::unique_ptr<FrameBuffer> &buffer : paramBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		data->ipaBuffers_.emplace_back(buffer->cookie(),
-					       buffer->planes());
-		availableParamBuffers_.push(buffer.get());
+		data->ipa_->mapBuffers(ispBuffers_.ipaBuffers());
 	}
 
-	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		data->ipaBuffers_.emplace_back(buffer->cookie(),
-					       buffer->planes());
-		availableStatBuffers_.push(buffer.get());
-	}
+	/*
+	 * Track up to one frame per parameters and statistics buffers pair. In
+	 * raw mode, track as many frames as capture buffers.
+	 */
+	data->frameInfo_.init(isRaw_ ? maxCount : ispBuffers_.size());
 
-	data->ipa_->mapBuffers(data->ipaBuffers_);
+	buffersAllocated_ = true;
 
 	return 0;
-
-error:
-	paramBuffers_.clear();
-	statBuffers_.clear();
-
-	return ret;
 }
 
 int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 {
 	RkISP1CameraData *data = cameraData(camera);
 
-	while (!availableStatBuffers_.empty())
-		availableStatBuffers_.pop();
-
-	while (!availableParamBuffers_.empty())
-		availableParamBuffers_.pop();
-
-	paramBuffers_.clear();
-	statBuffers_.clear();
+	data->frameInfo_.init(0);
 
-	std::vector<unsigned int> ids;
-	for (IPABuffer &ipabuf : data->ipaBuffers_)
-		ids.push_back(ipabuf.id);
-
-	data->ipa_->unmapBuffers(ids);
-	data->ipaBuffers_.clear();
+	if (ispBuffers_.size()) {
+		data->ipa_->unmapBuffers(ispBuffers_.ipaBufferIds());
+		ispBuffers_.free();
+	}
 
 	if (param_->releaseBuffers())
 		LOG(RkISP1, Error) << "Failed to release parameters buffers";
@@ -914,20 +944,38 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	if (stat_->releaseBuffers())
 		LOG(RkISP1, Error) << "Failed to release stat buffers";
 
+	buffersAllocated_ = false;
+
 	return 0;
 }
 
-int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerRkISP1::prepare(Camera *camera)
+{
+	if (buffersAllocated_)
+		return 0;
+
+	/*
+	 * Allocate the internal buffers and map them to the IPA ahead of
+	 * start(), which then only starts the IPA and streams on.
+	 */
+	return allocateBuffers(camera);
+}
+
+int PipelineHandlerRkISP1::start(Camera *camera, const ControlList *controls)
 {
 	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/* Allocate buffers for internal pipeline usage, unless prepared. */
+	if (!buffersAllocated_) {
+		ret = allocateBuffers(camera);
+		if (ret)
+			return ret;
+	}
 
-	ret = data->ipa_->start();
+	ControlList sensorControls;
+	ret = data->ipa_->start(controls ? *controls : ControlList{ controls::controls },
+				&sensorControls);
 	if (ret) {
 		freeBuffers(camera);
 		LOG(RkISP1, Error)
@@ -935,6 +983,20 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 		return ret;
 	}
 
+	/*
+	 * Program the initial exposure and gain computed by the IPA before
+	 * streaming starts, and reset the delayed controls to the new sensor
+	 * state, for the first frames to be usable.
+	 */
+	if (!sensorControls.empty()) {
+		ret = data->sensor_->setControls(&sensorControls);
+		if (ret)
+			LOG(RkISP1, Warning)
+				<< "Failed to set initial sensor controls";
+	}
+
+	data->delayedCtrls_->reset();
+
 	data->frame_ = 0;
 
 	if (!isRaw_) {
@@ -981,6 +1043,9 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 		}
 	}
 
+	if (!isRaw_)
+		recorder_.start();
+
 	isp_->setFrameStartEnabled(true);
 
 	activeCamera_ = camera;
@@ -1015,16 +1080,24 @@ void PipelineHandlerRkISP1::stopDevice(Camera *camera)
 	ASSERT(data->queuedRequests_.empty());
 	data->frameInfo_.clear();
 
+	recorder_.stop();
 	freeBuffers(camera);
 
 	activeCamera_ = nullptr;
 }
 
+void PipelineHandlerRkISP1::releaseDevice(Camera *camera)
+{
+	/* Free the buffers prepared for a camera that hasn't been started. */
+	if (buffersAllocated_)
+		freeBuffers(camera);
+}
+
 int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera, Request *request)
 {
 	RkISP1CameraData *data = cameraData(camera);
 
-	RkISP1FrameInfo *info = data->frameInfo_.create(data, request, isRaw_);
+	RkISP1FrameInfo *info = data->frameInfo_.create(data, request);
 	if (!info)
 		return -ENOENT;
 
@@ -1036,6 +1109,8 @@ int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera, Request *request)
 		if (data->selfPath_ && info->selfPathBuffer)
 			data->selfPath_->queueBuffer(info->selfPathBuffer);
 	} else {
+		LIBCAMERA_TRACEPOINT(frame_stage, "rkisp1", "params_request",
+				     request, data->frame_);
 		data->ipa_->fillParamsBuffer(data->frame_,
 					     info->paramBuffer->cookie());
 	}
@@ -1276,6 +1351,7 @@ void PipelineHandlerRkISP1::bufferReady(FrameBuffer *buffer)
 		if (isRaw_) {
 			const ControlList &ctrls =
 				data->delayedCtrls_->get(metadata.sequence);
+			info->statsQueued = utils::clock::now();
 			data->ipa_->processStatsBuffer(info->frame, 0, ctrls);
 		}
 	} else {
@@ -1318,10 +1394,51 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 	if (data->frame_ <= buffer->metadata().sequence)
 		data->frame_ = buffer->metadata().sequence + 1;
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "rkisp1", "stats_ready",
+			     info->request, info->frame);
+
+	recorder_.record(IspRecorder::RecordType::Statistics, info->frame, buffer);
+
+	info->statsQueued = utils::clock::now();
 	data->ipa_->processStatsBuffer(info->frame, info->statBuffer->cookie(),
 				       data->delayedCtrls_->get(buffer->metadata().sequence));
 }
 
+void PipelineHandlerRkISP1::countersDevice(const Camera *camera,
+					   std::map<std::string, uint64_t> *counters)
+{
+	const RkISP1CameraData *data =
+		static_cast<const RkISP1CameraData *>(camera->_d());
+
+	V4L2BufferCache::Statistics cache = mainPath_.bufferCacheStatistics();
+	if (hasSelfPath_)
+		cache += selfPath_.bufferCacheStatistics();
+	cache += param_->bufferCacheStatistics();
+	cache += stat_->bufferCacheStatistics();
+
+	(*counters)["v4l2.buffer_cache.hits"] = cache.hits;
+	(*counters)["v4l2.buffer_cache.misses"] = cache.misses;
+	(*counters)["v4l2.buffer_cache.evictions"] = cache.evictions;
+
+	const IspBufferPool::Statistics &pool = ispBuffers_.statistics();
+	(*counters)["isp.buffer_pool.underruns"] = pool.underruns;
+	(*counters)["isp.buffer_pool.peak_occupancy"] = pool.peakOccupancy;
+
+	if (data->delayedCtrls_) {
+		const DelayedControls::Statistics &ctrls =
+			data->delayedCtrls_->statistics();
+		(*counters)["sensor.controls.frames"] = ctrls.frames;
+		(*counters)["sensor.controls.underruns"] = ctrls.underruns;
+		(*counters)["sensor.controls.late"] = ctrls.late;
+		(*counters)["sensor.controls.lateness_max"] = ctrls.maxLateness;
+		(*counters)["sensor.controls.lateness_total"] = ctrls.totalLateness;
+	}
+
+	(*counters)["ipa.frames"] = data->ipaCounters_.frames;
+	(*counters)["ipa.time_total_us"] = data->ipaCounters_.total.get<std::micro>();
+	(*counters)["ipa.time_max_us"] = data->ipaCounters_.max.get<std::micro>();
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRkISP1, "rkisp1")
 
 } /* namespace libcamera */
@@ -56,7 +56,8 @@ const std::map<PixelFormat, uint32_t> formatToMediaBus = {
 
 RkISP1Path::RkISP1Path(const char *name, const Span<const PixelFormat> &formats,
 		       const Size &minResolution, const Size &maxResolution)
-	: name_(name), running_(false), formats_(formats),
+	: name_(name), running_(false), bufferCount_(RKISP1_BUFFER_COUNT),
+	  formats_(formats),
 	  minResolution_(minResolution), maxResolution_(maxResolution),
 	  link_(nullptr)
 {
@@ -392,6 +393,8 @@ int RkISP1Path::configure(const StreamConfiguration &config,
 		return -EINVAL;
 	}
 
+	bufferCount_ = config.bufferCount;
+
 	return 0;
 }
 
@@ -402,8 +405,7 @@ int RkISP1Path::start()
 	if (running_)
 		return -EBUSY;
 
-	/* \todo Make buffer count user configurable. */
-	ret = video_->importBuffers(RKISP1_BUFFER_COUNT);
+	ret = video_->importBuffers(bufferCount_);
 	if (ret)
 		return ret;
 
@@ -61,6 +61,11 @@ public:
 	int queueBuffer(FrameBuffer *buffer) { return video_->queueBuffer(buffer); }
 	Signal<FrameBuffer *> &bufferReady() { return video_->bufferReady; }
 
+	V4L2BufferCache::Statistics bufferCacheStatistics() const
+	{
+		return video_->bufferCacheStatistics();
+	}
+
 private:
 	void populateFormats();
 
@@ -68,6 +73,7 @@ private:
 
 	const char *name_;
 	bool running_;
+	unsigned int bufferCount_;
 
 	const Span<const PixelFormat> formats_;
 	std::set<PixelFormat> streamFormats_;
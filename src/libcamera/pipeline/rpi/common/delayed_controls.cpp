@@ -79,6 +79,30 @@ DelayedControls::DelayedControls(V4L2Device *device,
 				 const std::unordered_map<uint32_t, ControlParams> &controlParams)
 	: device_(device), maxDelay_(0)
 {
+	setDelays(controlParams);
+
+	reset(0);
+}
+
+/**
+ * \brief Update the control delays
+ * \param[in] controlParams Map of the numerical V4L2 control ids to their
+ * associated control parameters
+ *
+ * The delays at which sensors apply controls can depend on the sensor mode.
+ * This function replaces the control parameters passed to the constructor,
+ * and is meant to be called by pipeline handlers when configuring the camera
+ * for a new sensor mode. As with the constructor, only controls exposed by the
+ * device are handled.
+ *
+ * The control queue is not modified, the caller shall call reset() before
+ * calling applyControls() for the first time after updating the delays.
+ */
+void DelayedControls::setDelays(const std::unordered_map<uint32_t, ControlParams> &controlParams)
+{
+	controlParams_.clear();
+	maxDelay_ = 0;
+
 	const ControlInfoMap &controls = device_->controls();
 
 	/*
@@ -107,8 +131,6 @@ DelayedControls::DelayedControls(V4L2Device *device,
 
 		maxDelay_ = std::max(maxDelay_, controlParams_[id].delay);
 	}
-
-	reset(0);
 }
 
 /**
@@ -165,7 +187,7 @@ bool DelayedControls::push(const ControlList &controls, const unsigned int cooki
 	for (const auto &control : controls) {
 		const auto &it = idmap.find(control.first);
 		if (it == idmap.end()) {
-			LOG(RPiDelayedControls, Warning)
+			LOG_RATELIMITED(RPiDelayedControls, Warning)
 				<< "Unknown control " << control.first;
 			return false;
 		}
@@ -32,6 +32,7 @@ public:
 	DelayedControls(V4L2Device *device,
 			const std::unordered_map<uint32_t, ControlParams> &controlParams);
 
+	void setDelays(const std::unordered_map<uint32_t, ControlParams> &controlParams);
 	void reset(unsigned int cookie);
 
 	bool push(const ControlList &controls, unsigned int cookie);
@@ -7,6 +7,7 @@
 
 #include "pipeline_base.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include <linux/media-bus-format.h>
@@ -21,6 +22,7 @@
 
 #include "libcamera/internal/camera_lens.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 
 using namespace std::chrono_literals;
@@ -85,6 +87,18 @@ std::optional<ColorSpace> findValidColorSpace(const ColorSpace &colourSpace)
 	return std::nullopt;
 }
 
+std::unordered_map<uint32_t, RPi::DelayedControls::ControlParams>
+delayedControlParams(const ipa::RPi::SensorConfig &sensorConfig)
+{
+	/* Mark VBLANK for priority write. */
+	return {
+		{ V4L2_CID_ANALOGUE_GAIN, { sensorConfig.gainDelay, false } },
+		{ V4L2_CID_EXPOSURE, { sensorConfig.exposureDelay, false } },
+		{ V4L2_CID_HBLANK, { sensorConfig.hblankDelay, false } },
+		{ V4L2_CID_VBLANK, { sensorConfig.vblankDelay, true } }
+	};
+}
+
 } /* namespace */
 
 /*
@@ -505,8 +519,12 @@ int PipelineHandlerBase::configure(Camera *camera, CameraConfiguration *config)
 	CameraData *data = cameraData(camera);
 	int ret;
 
-	/* Start by freeing all buffers and reset the stream states. */
-	data->freeBuffers();
+	/*
+	 * Start by freeing all buffers and reset the stream states. Internal
+	 * buffers may be retained to speed up sensor mode switches, they will
+	 * be reused by prepareBuffers() if they fit the new configuration.
+	 */
+	data->freeBuffers(data->config_.retainBuffers);
 	for (auto const stream : data->streams_)
 		stream->clearFlags(StreamFlag::External);
 
@@ -545,6 +563,9 @@ int PipelineHandlerBase::configure(Camera *camera, CameraConfiguration *config)
 		return ret;
 	}
 
+	/* Some sensors apply controls with different delays in some modes. */
+	data->delayedCtrls_->setDelays(delayedControlParams(result.sensorConfig));
+
 	/*
 	 * Set the scaler crop to the value we are using (scaled to native sensor
 	 * coordinates).
@@ -626,6 +647,30 @@ int PipelineHandlerBase::exportFrameBuffers([[maybe_unused]] Camera *camera, lib
 	return ret;
 }
 
+int PipelineHandlerBase::prepare(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	int ret;
+
+	if (data->buffersAllocated_)
+		return 0;
+
+	/*
+	 * Allocate the internal buffers and map them to the IPA ahead of
+	 * start(). They are kept until the next configure() or release().
+	 */
+	ret = prepareBuffers(camera);
+	if (ret) {
+		LOG(RPI, Error) << "Failed to allocate buffers";
+		data->freeBuffers();
+		return ret;
+	}
+
+	data->buffersAllocated_ = true;
+
+	return 0;
+}
+
 int PipelineHandlerBase::start(Camera *camera, const ControlList *controls)
 {
 	CameraData *data = cameraData(camera);
@@ -677,6 +722,7 @@ int PipelineHandlerBase::start(Camera *camera, const ControlList *controls)
 	 */
 	data->delayedCtrls_->reset(0);
 	data->state_ = CameraData::State::Idle;
+	data->requestsInFlight_ = 0;
 
 	/* Enable SOF event generation. */
 	data->frontendDevice()->setFrameStartEnabled(true);
@@ -692,6 +738,8 @@ int PipelineHandlerBase::start(Camera *camera, const ControlList *controls)
 		}
 	}
 
+	data->recorder_.start();
+
 	return 0;
 }
 
@@ -712,6 +760,8 @@ void PipelineHandlerBase::stopDevice(Camera *camera)
 
 	/* Stop the IPA. */
 	data->ipa_->stop();
+
+	data->recorder_.stop();
 }
 
 void PipelineHandlerBase::releaseDevice(Camera *camera)
@@ -762,7 +812,7 @@ int PipelineHandlerBase::queueRequestDevice(Camera *camera, Request *request)
 	}
 
 	/* Push the request to the back of the queue. */
-	data->requestQueue_.push(request);
+	data->requestQueue_.push_back(request);
 	data->handleState();
 
 	return 0;
@@ -802,15 +852,12 @@ int PipelineHandlerBase::registerCamera(std::unique_ptr<RPi::CameraData> &camera
 
 	/*
 	 * Setup our delayed control writer with the sensor default
-	 * gain and exposure delays. Mark VBLANK for priority write.
+	 * gain and exposure delays. They will be updated with the delays of
+	 * the sensor mode at configure time.
 	 */
-	std::unordered_map<uint32_t, RPi::DelayedControls::ControlParams> params = {
-		{ V4L2_CID_ANALOGUE_GAIN, { result.sensorConfig.gainDelay, false } },
-		{ V4L2_CID_EXPOSURE, { result.sensorConfig.exposureDelay, false } },
-		{ V4L2_CID_HBLANK, { result.sensorConfig.hblankDelay, false } },
-		{ V4L2_CID_VBLANK, { result.sensorConfig.vblankDelay, true } }
-	};
-	data->delayedCtrls_ = std::make_unique<RPi::DelayedControls>(data->sensor_->device(), params);
+	data->delayedCtrls_ =
+		std::make_unique<RPi::DelayedControls>(data->sensor_->device(),
+						       delayedControlParams(result.sensorConfig));
 	data->sensorMetadata_ = result.sensorConfig.sensorMetadata;
 
 	/* Register initial controls that the Raspberry Pi IPA can handle. */
@@ -965,7 +1012,7 @@ V4L2SubdeviceFormat CameraData::findBestFormat(const Size &req, unsigned int bit
 	return bestFormat;
 }
 
-void CameraData::freeBuffers()
+void CameraData::freeBuffers(bool retainInternal)
 {
 	if (ipa_) {
 		/*
@@ -979,7 +1026,7 @@ void CameraData::freeBuffers()
 	}
 
 	for (auto const stream : streams_)
-		stream->releaseBuffers();
+		stream->releaseBuffers(retainInternal);
 
 	platformFreeBuffers();
 
@@ -1084,6 +1131,8 @@ int CameraData::loadPipelineConfiguration()
 	config_ = {
 		.disableStartupFrameDrops = false,
 		.cameraTimeoutValue = 0,
+		.pipelineDepth = 1,
+		.retainBuffers = false,
 	};
 
 	/* Initial configuration of the platform, in case no config file is present */
@@ -1131,6 +1180,16 @@ int CameraData::loadPipelineConfiguration()
 		frontendDevice()->setDequeueTimeout(config_.cameraTimeoutValue * 1ms);
 	}
 
+	unsigned int pipelineDepth =
+		phConfig["pipeline_depth"].get<unsigned int>(config_.pipelineDepth);
+	config_.pipelineDepth = std::clamp(pipelineDepth, 1U, platformMaxPipelineDepth());
+	if (config_.pipelineDepth != pipelineDepth)
+		LOG(RPI, Warning) << "Pipeline depth " << pipelineDepth
+				  << " unsupported, using " << config_.pipelineDepth;
+
+	config_.retainBuffers =
+		phConfig["retain_buffers"].get<bool>(config_.retainBuffers);
+
 	return platformPipelineConfigure(root);
 }
 
@@ -1219,9 +1278,17 @@ void CameraData::metadataReady(const ControlList &metadata)
 	if (!isRunning())
 		return;
 
-	/* Add to the Request metadata buffer what the IPA has provided. */
-	/* Last thing to do is to fill up the request metadata. */
-	Request *request = requestQueue_.front();
+	if (!requestsInFlight_)
+		return;
+
+	/*
+	 * Add to the Request metadata buffer what the IPA has provided. The
+	 * metadata belongs to the last request handed to the IPA.
+	 */
+	Request *request = requestQueue_[requestsInFlight_ - 1];
+	LIBCAMERA_TRACEPOINT(frame_stage, "rpi", "metadata_ready", request,
+			     request->sequence());
+	recorder_.record(request->sequence(), metadata);
 	request->metadata().merge(metadata);
 
 	/*
@@ -1382,8 +1449,10 @@ void CameraData::clearIncompleteRequests()
 		}
 
 		pipe()->completeRequest(request);
-		requestQueue_.pop();
+		requestQueue_.pop_front();
 	}
+
+	requestsInFlight_ = 0;
 }
 
 void CameraData::handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream)
@@ -1393,8 +1462,8 @@ void CameraData::handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream)
 	 * that we actually have one to action, otherwise we just return
 	 * buffer back to the stream.
 	 */
-	Request *request = requestQueue_.empty() ? nullptr : requestQueue_.front();
-	if (!dropFrameCount_ && request && request->findBuffer(stream) == buffer) {
+	Request *request = dropFrameCount_ ? nullptr : findRequest(buffer, stream);
+	if (request) {
 		/*
 		 * Tag the buffer as completed, returning it to the
 		 * application.
@@ -1419,12 +1488,19 @@ void CameraData::handleState()
 {
 	switch (state_) {
 	case State::Stopped:
-	case State::Busy:
 	case State::Error:
 		break;
 
+	case State::Busy:
+		/*
+		 * Earlier requests in flight may complete while the IPA is
+		 * processing the last one.
+		 */
+		checkRequestCompleted();
+		break;
+
 	case State::IpaComplete:
-		/* If the request is completed, we will switch to Idle state. */
+		/* If the requests are completed, we will switch to Idle state. */
 		checkRequestCompleted();
 		/*
 		 * No break here, we want to try running the pipeline again.
@@ -1438,44 +1514,74 @@ void CameraData::handleState()
 	}
 }
 
+bool CameraData::canRunPipeline() const
+{
+	/* The IPA processes a single request at a time. */
+	if (state_ != State::Idle && state_ != State::IpaComplete)
+		return false;
+
+	/* Frames are dropped with a single request in flight. */
+	unsigned int depth = dropFrameCount_ ? 1 : config_.pipelineDepth;
+
+	return requestsInFlight_ < depth && requestsInFlight_ < requestQueue_.size();
+}
+
+Request *CameraData::findRequest(FrameBuffer *buffer, Stream *stream) const
+{
+	for (Request *request : requestQueue_) {
+		if (request->findBuffer(stream) == buffer)
+			return request;
+	}
+
+	return nullptr;
+}
+
 void CameraData::checkRequestCompleted()
 {
-	bool requestCompleted = false;
 	/*
 	 * If we are dropping this frame, do not touch the request, simply
-	 * change the state to IDLE when ready.
+	 * change the state to IDLE when ready. Make sure we have all outputs
+	 * completed in the case of a dropped frame.
 	 */
-	if (!dropFrameCount_) {
-		Request *request = requestQueue_.front();
-		if (request->hasPendingBuffers())
+	if (dropFrameCount_) {
+		if (state_ != State::IpaComplete || ispOutputCount_ != ispOutputTotal_)
 			return;
 
-		/* Must wait for metadata to be filled in before completing. */
-		if (state_ != State::IpaComplete)
-			return;
+		LOG(RPI, Debug) << "Going into Idle state";
+		state_ = State::Idle;
+
+		/* The request will be used again for the next frame. */
+		requestsInFlight_ = 0;
+
+		dropFrameCount_--;
+		LOG(RPI, Debug) << "Dropping frame at the request of the IPA ("
+				<< dropFrameCount_ << " left)";
+		return;
+	}
+
+	/*
+	 * Complete the requests in order. The last request in flight must
+	 * wait for the IPA to fill in its metadata before completing.
+	 */
+	while (requestsInFlight_) {
+		if (requestsInFlight_ == 1 && state_ != State::IpaComplete)
+			break;
+
+		Request *request = requestQueue_.front();
+		if (request->hasPendingBuffers())
+			break;
 
 		LOG(RPI, Debug) << "Completing request sequence: "
 				<< request->sequence();
 
 		pipe()->completeRequest(request);
-		requestQueue_.pop();
-		requestCompleted = true;
+		requestQueue_.pop_front();
+		requestsInFlight_--;
 	}
 
-	/*
-	 * Make sure we have three outputs completed in the case of a dropped
-	 * frame.
-	 */
-	if (state_ == State::IpaComplete &&
-	    ((ispOutputCount_ == ispOutputTotal_ && dropFrameCount_) ||
-	     requestCompleted)) {
+	if (state_ == State::IpaComplete && !requestsInFlight_) {
 		LOG(RPI, Debug) << "Going into Idle state";
 		state_ = State::Idle;
-		if (dropFrameCount_) {
-			dropFrameCount_--;
-			LOG(RPI, Debug) << "Dropping frame at the request of the IPA ("
-					<< dropFrameCount_ << " left)";
-		}
 	}
 }
 
@@ -5,6 +5,7 @@
  * Pipeline handler base class for Raspberry Pi devices
  */
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <optional>
@@ -21,6 +22,7 @@
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/isp_recorder.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
 #include "libcamera/internal/pipeline_handler.h"
@@ -48,8 +50,8 @@ class CameraData : public Camera::Private
 public:
 	CameraData(PipelineHandler *pipe)
 		: Camera::Private(pipe), state_(State::Stopped),
-		  dropFrameCount_(0), buffersAllocated_(false),
-		  ispOutputCount_(0), ispOutputTotal_(0)
+		  requestsInFlight_(0), dropFrameCount_(0), buffersAllocated_(false),
+		  recorder_("rpi"), ispOutputCount_(0), ispOutputTotal_(0)
 	{
 	}
 
@@ -65,7 +67,7 @@ public:
 	double scoreFormat(double desired, double actual) const;
 	V4L2SubdeviceFormat findBestFormat(const Size &req, unsigned int bitDepth) const;
 
-	void freeBuffers();
+	void freeBuffers(bool retainInternal = false);
 	virtual void platformFreeBuffers() = 0;
 
 	void enumerateVideoDevices(MediaLink *link, const std::string &frontend);
@@ -98,6 +100,20 @@ public:
 
 	virtual int platformPipelineConfigure(const std::unique_ptr<YamlObject> &root) = 0;
 
+	/*
+	 * Maximum number of requests the platform can process concurrently,
+	 * with the frontend, IPA and ISP stages overlapping across frames.
+	 */
+	virtual unsigned int platformMaxPipelineDepth() const
+	{
+		return 1;
+	}
+
+	unsigned int pipelineDepth() const
+	{
+		return config_.pipelineDepth;
+	}
+
 	std::unique_ptr<ipa::RPi::IPAProxyRPi> ipa_;
 
 	std::unique_ptr<CameraSensor> sensor_;
@@ -129,7 +145,12 @@ public:
 		return state_ != State::Stopped && state_ != State::Error;
 	}
 
-	std::queue<Request *> requestQueue_;
+	std::deque<Request *> requestQueue_;
+	/*
+	 * Number of requests, from the front of requestQueue_, that have been
+	 * handed to the IPA and not completed yet.
+	 */
+	unsigned int requestsInFlight_;
 
 	/* For handling digital zoom. */
 	IPACameraSensorInfo sensorInfo_;
@@ -159,15 +180,30 @@ public:
 		 * on frame durations.
 		 */
 		unsigned int cameraTimeoutValue;
+		/*
+		 * Maximum number of requests processed concurrently by the
+		 * pipeline, allowing the IPA to prepare a frame while the ISP
+		 * processes the previous ones.
+		 */
+		unsigned int pipelineDepth;
+		/*
+		 * Keep the internal buffers across camera reconfigurations and
+		 * reuse them when they are large enough for the new mode.
+		 */
+		bool retainBuffers;
 	};
 
 	Config config_;
 
+	IspRecorder recorder_;
+
 protected:
 	void fillRequestMetadata(const ControlList &bufferControls,
 				 Request *request);
 
 	virtual void tryRunPipeline() = 0;
+	bool canRunPipeline() const;
+	Request *findRequest(FrameBuffer *buffer, Stream *stream) const;
 
 	unsigned int ispOutputCount_;
 	unsigned int ispOutputTotal_;
@@ -207,6 +243,7 @@ public:
 	int exportFrameBuffers(Camera *camera, libcamera::Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stopDevice(Camera *camera) override;
 	void releaseDevice(Camera *camera) override;
@@ -111,10 +111,19 @@ int Stream::prepareBuffers(unsigned int count)
 	int ret;
 
 	if (!(flags_ & StreamFlag::ImportOnly)) {
-		/* Export some frame buffers for internal use. */
-		ret = dev_->exportBuffers(count, &internalBuffers_);
-		if (ret < 0)
-			return ret;
+		if (canReuseRetainedBuffers(count)) {
+			LOG(RPISTREAM, Debug) << "Reusing " << count
+					      << " buffers for " << name_;
+			internalBuffers_ = std::move(retainedBuffers_);
+		} else {
+			/* Export some frame buffers for internal use. */
+			retainedBuffers_.clear();
+			ret = dev_->exportBuffers(count, &internalBuffers_);
+			if (ret < 0)
+				return ret;
+		}
+
+		retainedBuffers_.clear();
 
 		/* Add these exported buffers to the internal/external buffer list. */
 		setExportedBuffers(&internalBuffers_);
@@ -241,9 +250,20 @@ int Stream::queueAllBuffers()
 	return 0;
 }
 
-void Stream::releaseBuffers()
+void Stream::releaseBuffers(bool retainInternal)
 {
 	dev_->releaseBuffers();
+
+	/*
+	 * The internal buffers are imported in the device as dmabufs, they stay
+	 * valid once released from the device and can be imported again after
+	 * a format change.
+	 */
+	if (!retainInternal)
+		retainedBuffers_.clear();
+	else if (!internalBuffers_.empty())
+		retainedBuffers_ = std::move(internalBuffers_);
+
 	clearBuffers();
 }
 
@@ -266,6 +286,28 @@ void Stream::clearBuffers()
 	id_ = 0;
 }
 
+bool Stream::canReuseRetainedBuffers(unsigned int count) const
+{
+	if (retainedBuffers_.size() != count)
+		return false;
+
+	/*
+	 * Only reuse single-plane buffers, which cover the Bayer, metadata and
+	 * statistics buffers that make up most of the internal memory. The
+	 * buffers must be large enough for the current device format.
+	 */
+	V4L2DeviceFormat format;
+	if (dev_->getFormat(&format) < 0 || format.planesCount != 1)
+		return false;
+
+	return std::all_of(retainedBuffers_.begin(), retainedBuffers_.end(),
+			   [&format](const std::unique_ptr<FrameBuffer> &buffer) {
+				   const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+				   return planes.size() == 1 && planes[0].offset == 0 &&
+					  planes[0].length >= format.planes[0].size;
+			   });
+}
+
 int Stream::queueToDevice(FrameBuffer *buffer)
 {
 	LOG(RPISTREAM, Debug) << "Queuing buffer " << getBufferId(buffer)
@@ -128,7 +128,7 @@ public:
 	const BufferObject &acquireBuffer();
 
 	int queueAllBuffers();
-	void releaseBuffers();
+	void releaseBuffers(bool retainInternal = false);
 
 	/* For error handling. */
 	static const BufferObject errorBufferObject;
@@ -136,6 +136,7 @@ public:
 private:
 	void bufferEmplace(unsigned int id, FrameBuffer *buffer);
 	void clearBuffers();
+	bool canReuseRetainedBuffers(unsigned int count) const;
 	int queueToDevice(FrameBuffer *buffer);
 
 	StreamFlags flags_;
@@ -177,6 +178,12 @@ private:
 	 * as the stream needs to maintain ownership of these buffers.
 	 */
 	std::vector<std::unique_ptr<FrameBuffer>> internalBuffers_;
+
+	/*
+	 * Internal buffers kept across a reconfiguration, to be reused by the
+	 * next prepareBuffers() call if they are large enough.
+	 */
+	std::vector<std::unique_ptr<FrameBuffer>> retainedBuffers_;
 };
 
 /*
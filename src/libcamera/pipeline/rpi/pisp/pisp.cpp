@@ -6,6 +6,7 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <fstream>
 #include <memory>
 #include <mutex>
@@ -14,19 +15,30 @@
 #include <set>
 #include <sstream>
 #include <string>
-#include <sys/ioctl.h>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include <linux/dma-buf.h>
 #include <linux/v4l2-controls.h>
 #include <linux/videodev2.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/semaphore.h>
 #include <libcamera/base/shared_fd.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 #include <libcamera/formats.h>
 
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_buf_allocator.h"
 #include "libcamera/internal/shared_mem_object.h"
+#include "libcamera/internal/tracepoints.h"
 
 #include "libpisp/backend/backend.hpp"
 #include "libpisp/common/logging.hpp"
@@ -293,341 +305,344 @@ void setupOutputClipping(const V4L2DeviceFormat &v4l2Format,
 	}
 }
 
-int dmabufSyncStart(const SharedFD &fd)
+void do32BitConversion(void *mem, unsigned int width, unsigned int height,
+		       unsigned int stride)
 {
-	struct dma_buf_sync dma_sync {};
-	dma_sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
-
-	int ret = ::ioctl(fd.get(), DMA_BUF_IOCTL_SYNC, &dma_sync);
-	if (ret)
-		LOG(RPI, Error) << "failed to lock-sync-write dma buf";
+	for (unsigned int j = 0; j < height; j++) {
+		uint8_t *ptr = static_cast<uint8_t *>(mem) + j * stride;
+		unsigned int i = width;
 
-	return ret;
-}
+		/*
+		 * Expand the line in place starting from its end, so that the
+		 * 32bpp pixels never overwrite 24bpp pixels still to be read.
+		 * The NEON implementation processes blocks of 16 pixels, the
+		 * generic code handles the remaining pixels at the end of the
+		 * line first.
+		 */
+#if defined(__ARM_NEON)
+		unsigned int tail = width % 16;
+#else
+		unsigned int tail = width;
+#endif
 
-int dmabufSyncEnd(const SharedFD &fd)
-{
-	struct dma_buf_sync dma_sync {};
-	dma_sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+		for (; i > width - tail; i--) {
+			const uint8_t *src = ptr + (i - 1) * 3;
+			uint8_t *dst = ptr + (i - 1) * 4;
+			uint8_t c0 = src[0], c1 = src[1], c2 = src[2];
 
-	int ret = ::ioctl(fd.get(), DMA_BUF_IOCTL_SYNC, &dma_sync);
+			dst[0] = c0;
+			dst[1] = c1;
+			dst[2] = c2;
+			dst[3] = 255;
+		}
 
-	if (ret)
-		LOG(RPI, Error) << "failed to unlock-sync-write dma buf";
+#if defined(__ARM_NEON)
+		const uint8x16_t alpha = vdupq_n_u8(255);
 
-	return ret;
+		for (; i > 0; i -= 16) {
+			uint8x16x3_t in = vld3q_u8(ptr + (i - 16) * 3);
+			uint8x16x4_t out = { { in.val[0], in.val[1], in.val[2], alpha } };
+			vst4q_u8(ptr + (i - 16) * 4, out);
+		}
+#endif
+	}
 }
 
-void do32BitConversion(void *mem, unsigned int width, unsigned int height,
+void do16BitEndianSwap(void *mem, unsigned int width, unsigned int height,
 		       unsigned int stride)
 {
-	/*
-	 * The arm64 version is actually not that much quicker because the
-	 * vast bulk of the time is spent waiting for memory.
-	 */
-#if __aarch64__
 	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-		uint64_t count = (width + 15) / 16;
-		uint8_t *dest = ptr + count * 64;
-		uint8_t *src = ptr + count * 48;
-
-		/* Pre-decrement would have been nice. */
-		asm volatile("movi v3.16b, #255 \n"
-				"1: \n"
-				"sub %[src], %[src], #48 \n"
-				"sub %[dest], %[dest], #64 \n"
-				"subs %[count], %[count], #1 \n"
-				"ld3 {v0.16b, v1.16b, v2.16b}, [%[src]] \n"
-				"st4 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[dest]] \n"
-				"b.gt 1b \n"
-				: [count]"+r" (count)
-				: [src]"r" (src), [dest]"r" (dest)
-				: "cc", "v1", "v2", "v3", "v4", "memory"
-				);
-	}
-#else
-	std::vector<uint8_t> incache(3 * width);
-	std::vector<uint8_t> outcache(4 * width);
+		uint8_t *ptr = static_cast<uint8_t *>(mem) + j * stride;
+		unsigned int i = 0;
 
-	memcpy(incache.data(), mem, 3 * width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-
-		uint8_t *ptr3 = incache.data();
-		uint8_t *ptr4 = outcache.data();
-		for (unsigned int i = 0; i < width; i++) {
-			*(ptr4++) = *(ptr3++);
-			*(ptr4++) = *(ptr3++);
-			*(ptr4++) = *(ptr3++);
-			*(ptr4++) = 255;
-		}
+#if defined(__ARM_NEON)
+		for (; i + 8 <= width; i += 8, ptr += 16)
+			vst1q_u8(ptr, vrev16q_u8(vld1q_u8(ptr)));
+#endif
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 3 * width);
-		memcpy(ptr, outcache.data(), 4 * width);
+		for (; i < width; i++, ptr += 2)
+			std::swap(ptr[0], ptr[1]);
 	}
-#endif
 }
 
-void do16BitEndianSwap([[maybe_unused]] void *mem, [[maybe_unused]] unsigned int width,
-		       [[maybe_unused]] unsigned int height, [[maybe_unused]] unsigned int stride)
+/*
+ * Software downscaling kernels. Each of them halves the width of a line,
+ * averaging pairs of horizontally adjacent pixels with rounding. The NEON
+ * implementations process the bulk of the line, and the generic code the
+ * remaining pixels.
+ */
+void downscaleLine1(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-#if __aarch64__
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-		uint64_t count = (width + 7) / 8;
-
-		asm volatile("1: \n"
-				"ld1 {v1.16b}, [%[ptr]] \n"
-				"rev16 v1.16b, v1.16b \n"
-				"st1 {v1.16b}, [%[ptr]], #16 \n"
-				"subs %[count], %[count], #1 \n"
-				"b.gt 1b \n"
-				: [count]"+r" (count), [ptr]"+r" (ptr)
-				:
-				: "cc", "v1", "memory"
-				);
+	unsigned int i = 0;
+
+#if defined(__ARM_NEON)
+	for (; i + 16 <= dst_width; i += 16, src += 32, dst += 16) {
+		uint8x16x2_t in = vld2q_u8(src);
+		vst1q_u8(dst, vrhaddq_u8(in.val[0], in.val[1]));
 	}
 #endif
+
+	for (; i < dst_width; i++, src += 2, dst++)
+		*dst = ((int)src[0] + (int)src[1] + 1) >> 1;
 }
 
-void downscaleInterleaved3(void *mem, unsigned int height, unsigned int src_width,
-			   unsigned int stride)
+void downscaleLine2(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-	std::vector<uint8_t> incache(3 * src_width);
-	unsigned int dst_width = src_width / 2;
-	std::vector<uint8_t> outcache(3 * dst_width);
+	unsigned int i = 0;
 
-	memcpy(incache.data(), mem, 3 * src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 6, dst += 3) {
-			dst[0] = ((int)src[0] + (int)src[3] + 1) >> 1;
-			dst[1] = ((int)src[1] + (int)src[4] + 1) >> 1;
-			dst[2] = ((int)src[2] + (int)src[5] + 1) >> 1;
-		}
+#if defined(__ARM_NEON)
+	for (; i + 8 <= dst_width; i += 8, src += 32, dst += 16) {
+		uint16x8x2_t in = vld2q_u16(reinterpret_cast<const uint16_t *>(src));
+		vst1q_u8(dst, vrhaddq_u8(vreinterpretq_u8_u16(in.val[0]),
+					 vreinterpretq_u8_u16(in.val[1])));
+	}
+#endif
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 3 * src_width);
-		memcpy(ptr, outcache.data(), 3 * dst_width);
+	for (; i < dst_width; i++, src += 4, dst += 2) {
+		dst[0] = ((int)src[0] + (int)src[2] + 1) >> 1;
+		dst[1] = ((int)src[1] + (int)src[3] + 1) >> 1;
 	}
 }
 
-void downscaleInterleaved4(void *mem, unsigned int height, unsigned int src_width,
-			   unsigned int stride)
+void downscaleLine3(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-	std::vector<uint8_t> incache(4 * src_width);
-	unsigned int dst_width = src_width / 2;
-	std::vector<uint8_t> outcache(4 * dst_width);
+	unsigned int i = 0;
 
-	memcpy(incache.data(), mem, 4 * src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 8, dst += 4) {
-			dst[0] = ((int)src[0] + (int)src[4] + 1) >> 1;
-			dst[1] = ((int)src[1] + (int)src[5] + 1) >> 1;
-			dst[2] = ((int)src[2] + (int)src[6] + 1) >> 1;
-			dst[3] = ((int)src[3] + (int)src[7] + 1) >> 1;
+#if defined(__ARM_NEON)
+	for (; i + 16 <= dst_width; i += 16, src += 96, dst += 48) {
+		uint8x16x3_t in0 = vld3q_u8(src);
+		uint8x16x3_t in1 = vld3q_u8(src + 48);
+		uint8x16x3_t out;
+
+		for (unsigned int c = 0; c < 3; c++) {
+			uint8x16x2_t pairs = vuzpq_u8(in0.val[c], in1.val[c]);
+			out.val[c] = vrhaddq_u8(pairs.val[0], pairs.val[1]);
 		}
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 4 * src_width);
-		memcpy(ptr, outcache.data(), 4 * dst_width);
+		vst3q_u8(dst, out);
+	}
+#endif
+
+	for (; i < dst_width; i++, src += 6, dst += 3) {
+		dst[0] = ((int)src[0] + (int)src[3] + 1) >> 1;
+		dst[1] = ((int)src[1] + (int)src[4] + 1) >> 1;
+		dst[2] = ((int)src[2] + (int)src[5] + 1) >> 1;
 	}
 }
 
-void downscalePlaneInternal(void *mem, unsigned int height, unsigned int src_width,
-			    unsigned int stride, std::vector<uint8_t> &incache,
-			    std::vector<uint8_t> &outcache)
+void downscaleLine4(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-	unsigned int dst_width = src_width / 2;
-	memcpy(incache.data(), mem, src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
+	unsigned int i = 0;
 
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 2, dst++)
-			*dst = ((int)src[0] + (int)src[1] + 1) >> 1;
+#if defined(__ARM_NEON)
+	for (; i + 4 <= dst_width; i += 4, src += 32, dst += 16) {
+		uint32x4x2_t in = vld2q_u32(reinterpret_cast<const uint32_t *>(src));
+		vst1q_u8(dst, vrhaddq_u8(vreinterpretq_u8_u32(in.val[0]),
+					 vreinterpretq_u8_u32(in.val[1])));
+	}
+#endif
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, src_width);
-		memcpy(ptr, outcache.data(), dst_width);
+	for (; i < dst_width; i++, src += 8, dst += 4) {
+		dst[0] = ((int)src[0] + (int)src[4] + 1) >> 1;
+		dst[1] = ((int)src[1] + (int)src[5] + 1) >> 1;
+		dst[2] = ((int)src[2] + (int)src[6] + 1) >> 1;
+		dst[3] = ((int)src[3] + (int)src[7] + 1) >> 1;
 	}
 }
 
-void downscalePlanar420(void *memY, void *memU, void *memV, unsigned int height,
-			unsigned int src_width, unsigned int stride)
+#if defined(__ARM_NEON)
+/*
+ * Average the two luma samples of each of 16 macropixels, and the chroma
+ * samples of each pair of macropixels, returning 8 output macropixels as Y, U,
+ * Y, V vectors.
+ */
+uint8x8x4_t downscaleMacropixels(uint8x16_t y0, uint8x16_t y1, uint8x16_t c0,
+				 uint8x16_t c1)
 {
-	std::vector<uint8_t> incache(src_width);
-	std::vector<uint8_t> outcache(src_width / 2);
+	uint8x16x2_t y = vuzpq_u8(vrhaddq_u8(y0, y1), y0);
+	uint8x16x2_t u = vuzpq_u8(c0, c0);
+	uint8x16x2_t v = vuzpq_u8(c1, c1);
 
-	downscalePlaneInternal(memY, height, src_width, stride, incache, outcache);
-	downscalePlaneInternal(memU, height / 2, src_width / 2, stride / 2, incache, outcache);
-	downscalePlaneInternal(memV, height / 2, src_width / 2, stride / 2, incache, outcache);
-}
-
-void downscalePlanar422(void *memY, void *memU, void *memV,
-			unsigned int height, unsigned int src_width, unsigned int stride)
-{
-	std::vector<uint8_t> incache(src_width);
-	std::vector<uint8_t> outcache(src_width / 2);
+	uint8x8x4_t out;
+	out.val[0] = vget_low_u8(y.val[0]);
+	out.val[1] = vget_low_u8(vrhaddq_u8(u.val[0], u.val[1]));
+	out.val[2] = vget_low_u8(y.val[1]);
+	out.val[3] = vget_low_u8(vrhaddq_u8(v.val[0], v.val[1]));
 
-	downscalePlaneInternal(memY, height, src_width, stride, incache, outcache);
-	downscalePlaneInternal(memU, height, src_width / 2, stride / 2, incache, outcache);
-	downscalePlaneInternal(memV, height, src_width / 2, stride / 2, incache, outcache);
+	return out;
 }
+#endif
 
-void downscaleInterleavedYuyv(void *mem, unsigned int height, unsigned int src_width,
-			      unsigned int stride)
+void downscaleLineYuyv(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-	std::vector<uint8_t> incache(2 * src_width);
-	unsigned int dst_width = src_width / 2;
-	std::vector<uint8_t> outcache(2 * dst_width);
+	unsigned int i = 0;
 
-	memcpy(incache.data(), mem, 2 * src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 8, dst += 4) {
-			dst[0] = ((int)src[0] + (int)src[2] + 1) >> 1;
-			dst[1] = ((int)src[1] + (int)src[5] + 1) >> 1;
-			dst[2] = ((int)src[4] + (int)src[6] + 1) >> 1;
-			dst[3] = ((int)src[3] + (int)src[7] + 1) >> 1;
-		}
+#if defined(__ARM_NEON)
+	for (; i + 16 <= dst_width; i += 16, src += 64, dst += 32) {
+		uint8x16x4_t in = vld4q_u8(src);
+		uint8x8x4_t out = downscaleMacropixels(in.val[0], in.val[2],
+						       in.val[1], in.val[3]);
+		vst4_u8(dst, out);
+	}
+#endif
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 4 * src_width);
-		memcpy(ptr, outcache.data(), 2 * dst_width);
+	for (; i + 2 <= dst_width; i += 2, src += 8, dst += 4) {
+		dst[0] = ((int)src[0] + (int)src[2] + 1) >> 1;
+		dst[1] = ((int)src[1] + (int)src[5] + 1) >> 1;
+		dst[2] = ((int)src[4] + (int)src[6] + 1) >> 1;
+		dst[3] = ((int)src[3] + (int)src[7] + 1) >> 1;
 	}
 }
 
-void downscaleInterleavedUyvy(void *mem, unsigned int height, unsigned int src_width,
-			      unsigned int stride)
+void downscaleLineUyvy(uint8_t *dst, const uint8_t *src, unsigned int dst_width)
 {
-	std::vector<uint8_t> incache(2 * src_width);
-	unsigned int dst_width = src_width / 2;
-	std::vector<uint8_t> outcache(2 * dst_width);
+	unsigned int i = 0;
 
-	memcpy(incache.data(), mem, 2 * src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
-
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 8, dst += 4) {
-			dst[0] = ((int)src[0] + (int)src[4] + 1) >> 1;
-			dst[1] = ((int)src[1] + (int)src[3] + 1) >> 1;
-			dst[2] = ((int)src[2] + (int)src[6] + 1) >> 1;
-			dst[3] = ((int)src[5] + (int)src[7] + 1) >> 1;
-		}
+#if defined(__ARM_NEON)
+	for (; i + 16 <= dst_width; i += 16, src += 64, dst += 32) {
+		uint8x16x4_t in = vld4q_u8(src);
+		uint8x8x4_t yuyv = downscaleMacropixels(in.val[1], in.val[3],
+							in.val[0], in.val[2]);
+		uint8x8x4_t out = { { yuyv.val[1], yuyv.val[0],
+				      yuyv.val[3], yuyv.val[2] } };
+		vst4_u8(dst, out);
+	}
+#endif
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 4 * src_width);
-		memcpy(ptr, outcache.data(), 2 * dst_width);
+	for (; i + 2 <= dst_width; i += 2, src += 8, dst += 4) {
+		dst[0] = ((int)src[0] + (int)src[4] + 1) >> 1;
+		dst[1] = ((int)src[1] + (int)src[3] + 1) >> 1;
+		dst[2] = ((int)src[2] + (int)src[6] + 1) >> 1;
+		dst[3] = ((int)src[5] + (int)src[7] + 1) >> 1;
 	}
 }
 
-void downscaleInterleaved2Internal(void *mem, unsigned int height, unsigned int src_width,
-				   unsigned int stride, std::vector<uint8_t> &incache,
-				   std::vector<uint8_t> &outcache)
+using DownscaleLineFunc = void (*)(uint8_t *dst, const uint8_t *src,
+				   unsigned int dst_width);
+
+/*
+ * Downscale a plane horizontally by 2, in place. Each line is copied to a
+ * cached buffer first, as reading from the dma-buf directly is slow.
+ */
+void downscalePlane(void *mem, unsigned int height, unsigned int src_width,
+		    unsigned int stride, unsigned int bpp,
+		    DownscaleLineFunc downscaleLine)
 {
 	unsigned int dst_width = src_width / 2;
-	memcpy(incache.data(), mem, 2 * src_width);
-	for (unsigned int j = 0; j < height; j++) {
-		uint8_t *ptr = (uint8_t *)mem + j * stride;
+	std::vector<uint8_t> incache(bpp * src_width);
+	std::vector<uint8_t> outcache(bpp * dst_width);
 
-		uint8_t *src = incache.data(), *dst = outcache.data();
-		for (unsigned int i = 0; i < dst_width; i++, src += 4, dst += 2) {
-			dst[0] = ((int)src[0] + (int)src[2] + 1) >> 1;
-			dst[1] = ((int)src[1] + (int)src[3] + 1) >> 1;
-		}
+	for (unsigned int j = 0; j < height; j++) {
+		uint8_t *ptr = static_cast<uint8_t *>(mem) + j * stride;
 
-		if (j < height - 1)
-			memcpy(incache.data(), ptr + stride, 2 * src_width);
-		memcpy(ptr, outcache.data(), 2 * dst_width);
+		memcpy(incache.data(), ptr, incache.size());
+		downscaleLine(outcache.data(), incache.data(), dst_width);
+		memcpy(ptr, outcache.data(), outcache.size());
 	}
 }
 
-void downscaleSemiPlanar420(void *memY, void *memUV, unsigned int height,
-			    unsigned int src_width, unsigned int stride)
+void *planeLine(void *mem, unsigned int line, unsigned int stride)
 {
-	std::vector<uint8_t> incache(src_width);
-	std::vector<uint8_t> outcache(src_width / 2);
+	return static_cast<uint8_t *>(mem) + line * stride;
+}
+
+/* Software post-processing to be applied to an ISP output buffer. */
+struct SwProcessingJob {
+	FrameBuffer *buffer;
+	RPi::Stream *stream;
+	PixelFormat pixelFormat;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int downscale;
+	bool needs32bitConv;
+	std::array<void *, 3> planes;
+	unsigned int numPlanes;
+	utils::time_point queued;
+};
 
-	downscalePlaneInternal(memY, height, src_width, stride, incache, outcache);
-	downscaleInterleaved2Internal(memUV, height / 2, src_width / 2, stride,
-				      incache, outcache);
+/*
+ * Retrieve the planes of a buffer, for formats that may look like either
+ * single or multi-planar buffers.
+ */
+void getPlanes(const SwProcessingJob &job, void **mem1, void **mem2,
+	       unsigned int chromaSize)
+{
+	if (job.numPlanes > 1) {
+		*mem1 = job.planes[1];
+		*mem2 = job.planes[2];
+	} else {
+		*mem1 = static_cast<uint8_t *>(job.planes[0]) + job.height * job.stride;
+		*mem2 = static_cast<uint8_t *>(*mem1) + chromaSize;
+	}
 }
 
-void downscaleStreamBuffer(RPi::Stream *stream, int index)
+/*
+ * Downscale the lines [y, y + height) of a buffer. The lines are processed
+ * independently, allowing the buffer to be split in bands downscaled
+ * concurrently. For formats with vertically subsampled chroma, y and height
+ * must be even, except for the height of the last band.
+ */
+void downscaleBuffer(const SwProcessingJob &job, unsigned int y, unsigned int height)
 {
-	unsigned int downscale = stream->swDownscale();
+	unsigned int downscale = job.downscale;
 	/* Must be a power of 2. */
 	ASSERT((downscale & (downscale - 1)) == 0);
 
-	unsigned int stride = stream->configuration().stride;
-	unsigned int dst_width = stream->configuration().size.width;
-	unsigned int height = stream->configuration().size.height;
-	const PixelFormat &pixFormat = stream->configuration().pixelFormat;
-	const RPi::BufferObject &b = stream->getBuffer(index);
-	void *mem = b.mapped->planes()[0].data();
-	ASSERT(b.mapped);
+	const PixelFormat &pixFormat = job.pixelFormat;
+	unsigned int stride = job.stride;
+	unsigned int dst_width = job.width;
+	void *mem = job.planes[0];
 
 	/* Do repeated downscale-by-2 in place until we're done. */
 	for (; downscale > 1; downscale >>= 1) {
 		unsigned int src_width = downscale * dst_width;
 
 		if (pixFormat == formats::RGB888 || pixFormat == formats::BGR888) {
-			downscaleInterleaved3(mem, height, src_width, stride);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 3, downscaleLine3);
 		} else if (pixFormat == formats::XRGB8888 || pixFormat == formats::XBGR8888) {
 			/* On some devices these may actually be 24bpp at this point. */
-			if (stream->getFlags() & StreamFlag::Needs32bitConv)
-				downscaleInterleaved3(mem, height, src_width, stride);
+			if (job.needs32bitConv)
+				downscalePlane(planeLine(mem, y, stride), height,
+					       src_width, stride, 3, downscaleLine3);
 			else
-				downscaleInterleaved4(mem, height, src_width, stride);
+				downscalePlane(planeLine(mem, y, stride), height,
+					       src_width, stride, 4, downscaleLine4);
 		} else if (pixFormat == formats::YUV420 || pixFormat == formats::YVU420) {
-			/* These may look like either single or multi-planar buffers. */
 			void *mem1;
 			void *mem2;
-			if (b.mapped->planes().size() == 3) {
-				mem1 = b.mapped->planes()[1].data();
-				mem2 = b.mapped->planes()[2].data();
-			} else {
-				unsigned int ySize = height * stride;
-				mem1 = static_cast<uint8_t *>(mem) + ySize;
-				mem2 = static_cast<uint8_t *>(mem1) + ySize / 4;
-			}
-			downscalePlanar420(mem, mem1, mem2, height, src_width, stride);
+			getPlanes(job, &mem1, &mem2, job.height * stride / 4);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 1, downscaleLine1);
+			downscalePlane(planeLine(mem1, y / 2, stride / 2), height / 2,
+				       src_width / 2, stride / 2, 1, downscaleLine1);
+			downscalePlane(planeLine(mem2, y / 2, stride / 2), height / 2,
+				       src_width / 2, stride / 2, 1, downscaleLine1);
 		} else if (pixFormat == formats::YUV422 || pixFormat == formats::YVU422) {
-			/* These may look like either single or multi-planar buffers. */
 			void *mem1;
 			void *mem2;
-			if (b.mapped->planes().size() == 3) {
-				mem1 = b.mapped->planes()[1].data();
-				mem2 = b.mapped->planes()[2].data();
-			} else {
-				unsigned int ySize = height * stride;
-				mem1 = static_cast<uint8_t *>(mem) + ySize;
-				mem2 = static_cast<uint8_t *>(mem1) + ySize / 2;
-			}
-			downscalePlanar422(mem, mem1, mem2, height, src_width, stride);
+			getPlanes(job, &mem1, &mem2, job.height * stride / 2);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 1, downscaleLine1);
+			downscalePlane(planeLine(mem1, y, stride / 2), height,
+				       src_width / 2, stride / 2, 1, downscaleLine1);
+			downscalePlane(planeLine(mem2, y, stride / 2), height,
+				       src_width / 2, stride / 2, 1, downscaleLine1);
 		} else if (pixFormat == formats::YUYV || pixFormat == formats::YVYU) {
-			downscaleInterleavedYuyv(mem, height, src_width, stride);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 2, downscaleLineYuyv);
 		} else if (pixFormat == formats::UYVY || pixFormat == formats::VYUY) {
-			downscaleInterleavedUyvy(mem, height, src_width, stride);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 2, downscaleLineUyvy);
 		} else if (pixFormat == formats::NV12 || pixFormat == formats::NV21) {
-			/* These may look like either single or multi-planar buffers. */
 			void *mem1;
-			if (b.mapped->planes().size() == 2)
-				mem1 = b.mapped->planes()[1].data();
-			else
-				mem1 = static_cast<uint8_t *>(mem) + height * stride;
-			downscaleSemiPlanar420(mem, mem1, height, src_width, stride);
+			void *mem2;
+			getPlanes(job, &mem1, &mem2, 0);
+			downscalePlane(planeLine(mem, y, stride), height,
+				       src_width, stride, 1, downscaleLine1);
+			downscalePlane(planeLine(mem1, y / 2, stride), height / 2,
+				       src_width / 2, stride, 2, downscaleLine2);
 		} else {
 			LOG(RPI, Error) << "Sw downscale unsupported for " << pixFormat;
 			ASSERT(0);
@@ -635,6 +650,142 @@ void downscaleStreamBuffer(RPi::Stream *stream, int index)
 	}
 }
 
+/*
+ * Software post-processing of ISP output buffers, to downscale beyond the
+ * hardware limits and convert 24bpp outputs to 32bpp. Buffers are processed
+ * in a dedicated thread not to stall the pipeline handler thread, and split in
+ * horizontal bands processed concurrently by helper threads.
+ */
+class SwPostProcessor : public Object
+{
+public:
+	SwPostProcessor();
+	~SwPostProcessor();
+
+	void queueBuffer(const SwProcessingJob &job);
+	void flush();
+
+	Signal<FrameBuffer *, RPi::Stream *, utils::Duration> bufferReady;
+
+private:
+	static constexpr unsigned int kMaxBands = 4;
+
+	class BandWorker : public Object
+	{
+	public:
+		BandWorker(SwPostProcessor *processor)
+			: processor_(processor)
+		{
+		}
+
+		void process(const SwProcessingJob &job, unsigned int y,
+			     unsigned int height)
+		{
+			processBand(job, y, height);
+			processor_->bandsDone_.release();
+		}
+
+	private:
+		SwPostProcessor *processor_;
+	};
+
+	static void processBand(const SwProcessingJob &job, unsigned int y,
+				unsigned int height);
+	void process(const SwProcessingJob &job);
+	void sync() {}
+
+	Thread thread_;
+	std::vector<std::unique_ptr<Thread>> bandThreads_;
+	std::vector<std::unique_ptr<BandWorker>> bandWorkers_;
+	Semaphore bandsDone_;
+};
+
+SwPostProcessor::SwPostProcessor()
+	: thread_("pisp-postproc")
+{
+	unsigned int bands = std::clamp(std::thread::hardware_concurrency(),
+					1U, kMaxBands);
+
+	for (unsigned int i = 1; i < bands; i++) {
+		std::unique_ptr<Thread> thread = std::make_unique<Thread>("pisp-postproc");
+		std::unique_ptr<BandWorker> worker = std::make_unique<BandWorker>(this);
+
+		worker->moveToThread(thread.get());
+		thread->start();
+
+		bandThreads_.push_back(std::move(thread));
+		bandWorkers_.push_back(std::move(worker));
+	}
+
+	moveToThread(&thread_);
+	thread_.start();
+}
+
+SwPostProcessor::~SwPostProcessor()
+{
+	thread_.exit();
+	thread_.wait();
+
+	for (std::unique_ptr<Thread> &thread : bandThreads_) {
+		thread->exit();
+		thread->wait();
+	}
+}
+
+/*
+ * Queue a buffer for processing. The bufferReady signal is emitted from the
+ * post-processing thread when done.
+ */
+void SwPostProcessor::queueBuffer(const SwProcessingJob &job)
+{
+	invokeMethod(&SwPostProcessor::process, ConnectionTypeQueued, job);
+}
+
+/* Wait for all queued buffers to be processed. */
+void SwPostProcessor::flush()
+{
+	invokeMethod(&SwPostProcessor::sync, ConnectionTypeBlocking);
+}
+
+void SwPostProcessor::processBand(const SwProcessingJob &job, unsigned int y,
+				  unsigned int height)
+{
+	if (job.downscale > 1)
+		downscaleBuffer(job, y, height);
+
+	/* Convert 24bpp outputs to 32bpp outputs where necessary. */
+	if (job.needs32bitConv)
+		do32BitConversion(planeLine(job.planes[0], y, job.stride),
+				  job.width, height, job.stride);
+}
+
+void SwPostProcessor::process(const SwProcessingJob &job)
+{
+	/* Split the buffer in bands of an even number of lines. */
+	unsigned int bands = std::clamp(job.height / 2, 1U,
+					static_cast<unsigned int>(bandWorkers_.size()) + 1);
+	std::vector<unsigned int> bandStart(bands + 1);
+
+	for (unsigned int i = 0; i < bands; i++)
+		bandStart[i] = job.height * i / bands & ~1U;
+	bandStart[bands] = job.height;
+
+	{
+		DmaSyncer syncer(job.buffer->planes()[0].fd);
+
+		for (unsigned int i = 1; i < bands; i++)
+			bandWorkers_[i - 1]->invokeMethod(&BandWorker::process,
+							  ConnectionTypeQueued, job,
+							  bandStart[i],
+							  bandStart[i + 1] - bandStart[i]);
+
+		processBand(job, 0, bandStart[1]);
+		bandsDone_.acquire(bands - 1);
+	}
+
+	bufferReady.emit(job.buffer, job.stream, utils::Duration(utils::clock::now() - job.queued));
+}
+
 /* Return largest width of any of these streams (or of the camera input). */
 unsigned int getLargestWidth(const V4L2SubdeviceFormat &sensorFormat,
 			     const std::vector<StreamParams> &outStreams)
@@ -720,6 +871,15 @@ public:
 
 	int platformPipelineConfigure(const std::unique_ptr<YamlObject> &root) override;
 
+	unsigned int platformMaxPipelineDepth() const override
+	{
+		/*
+		 * The Backend jobs are queued to the hardware, allowing the
+		 * IPA to prepare the next frames while they are processed.
+		 */
+		return 3;
+	}
+
 	void platformStart() override;
 	void platformStop() override;
 	void platformFreeBuffers() override;
@@ -727,6 +887,8 @@ public:
 	void cfeBufferDequeue(FrameBuffer *buffer);
 	void beInputDequeue(FrameBuffer *buffer);
 	void beOutputDequeue(FrameBuffer *buffer);
+	void beOutputProcessed(FrameBuffer *buffer, RPi::Stream *stream,
+			       utils::Duration duration);
 
 	void processStatsComplete(const ipa::RPi::BufferIds &buffers);
 	void prepareIspComplete(const ipa::RPi::BufferIds &buffers, bool stitchSwapBuffers);
@@ -751,6 +913,11 @@ public:
 	unsigned int tdnInputIndex_;
 	unsigned int stitchInputIndex_;
 
+	/* Has the BE job been queued before the IPA prepareIsp() call? */
+	bool beQueuedEarly_;
+	/* Stitch buffers swap to apply to the next BE job in low latency mode. */
+	bool stitchSwapPending_;
+
 	struct Config {
 		/*
 		 * Number of CFE config and stats buffers to allocate and use. A
@@ -767,6 +934,17 @@ public:
 		bool disableTdn;
 		/* Don't use BE HDR and free some memory resources. */
 		bool disableHdr;
+		/*
+		 * Queue the BE job before running the IPA, using the ISP
+		 * parameters computed for the previous frame.
+		 */
+		bool lowLatency;
+		/*
+		 * Adjust uncompressed application raw streams to the PiSP
+		 * compressed raw format, halving the memory bandwidth of the
+		 * Frontend to Backend buffers.
+		 */
+		bool compressRaw;
 	};
 
 	Config config_;
@@ -804,6 +982,9 @@ private:
 
 	std::queue<CfeJob> cfeJobQueue_;
 
+	/* Software post-processing of the ISP outputs, created on demand. */
+	std::unique_ptr<SwPostProcessor> swPostProcessor_;
+
 	bool cfeJobComplete() const
 	{
 		if (cfeJobQueue_.empty())
@@ -938,6 +1119,9 @@ int PipelineHandlerPiSP::prepareBuffers(Camera *camera)
 	unsigned int numRawBuffers = 0;
 	int ret;
 
+	/* Each additional request in flight holds a CFE buffer in the Backend. */
+	unsigned int extraBuffers = data->pipelineDepth() - 1;
+
 	for (Stream *s : camera->streams()) {
 		if (PipelineHandlerBase::isRaw(s->configuration().pixelFormat)) {
 			numRawBuffers = s->configuration().bufferCount;
@@ -960,7 +1144,8 @@ int PipelineHandlerPiSP::prepareBuffers(Camera *camera)
 			 * we have at least 2 sets of internal buffers to use to
 			 * minimise frame drops.
 			 */
-			numBuffers = std::max<int>(2, minBuffers - numRawBuffers);
+			numBuffers = std::max<int>(2, minBuffers - numRawBuffers) +
+				     extraBuffers;
 		} else if (stream == &data->isp_[Isp::Input]) {
 			/*
 			 * ISP input buffers are imported from the CFE, so follow
@@ -968,7 +1153,8 @@ int PipelineHandlerPiSP::prepareBuffers(Camera *camera)
 			 * available.
 			 */
 			numBuffers = numRawBuffers +
-					std::max<int>(2, minBuffers - numRawBuffers);
+					std::max<int>(2, minBuffers - numRawBuffers) +
+					extraBuffers;
 		} else if (stream == &data->cfe_[Cfe::Embedded]) {
 			/*
 			 * Embedded data buffers are (currently) for internal use,
@@ -987,6 +1173,9 @@ int PipelineHandlerPiSP::prepareBuffers(Camera *camera)
 		} else if (stream == &data->isp_[Isp::StitchOutput] && data->config_.disableHdr) {
 			/* Stitch/HDR is explicitly disabled. */
 			continue;
+		} else if (stream == &data->isp_[Isp::Config]) {
+			/* One Backend config buffer per queued job, plus a spare. */
+			numBuffers = 2 + extraBuffers;
 		} else {
 			/* Allocate 2 sets of all other Backend buffers */
 			numBuffers = 2;
@@ -995,7 +1184,7 @@ int PipelineHandlerPiSP::prepareBuffers(Camera *camera)
 		LOG(RPI, Debug) << "Preparing " << numBuffers
 				<< " buffers for stream " << stream->name();
 
-		ret = stream->prepareBuffers(numBuffers);
+		ret = runInWorker([&]() { return stream->prepareBuffers(numBuffers); });
 		if (ret < 0)
 			return ret;
 	}
@@ -1188,6 +1377,14 @@ PiSPCameraData::platformValidate(RPi::RPiCameraConfiguration *rpiConfig) const
 			bayer.bitDepth = 16;
 		}
 
+		/*
+		 * The raw stream buffers are also used as the Backend input.
+		 * Use the compressed format when requested by the configuration
+		 * file, applications can also select it explicitly.
+		 */
+		if (config_.compressRaw && bayer.packing == BayerFormat::Packing::None)
+			bayer.packing = BayerFormat::Packing::PISP1;
+
 		/* The RAW stream size cannot exceed the sensor frame output - for now. */
 		if (rawStream->size != rpiConfig->sensorFormat_.size ||
 		    rawStream->pixelFormat != bayer.toPixelFormat()) {
@@ -1313,6 +1510,8 @@ int PiSPCameraData::platformPipelineConfigure(const std::unique_ptr<YamlObject>
 		.numCfeConfigQueue = 2,
 		.disableTdn = false,
 		.disableHdr = false,
+		.lowLatency = false,
+		.compressRaw = false,
 	};
 
 	if (!root)
@@ -1338,6 +1537,8 @@ int PiSPCameraData::platformPipelineConfigure(const std::unique_ptr<YamlObject>
 		phConfig["num_cfe_config_queue"].get<unsigned int>(config_.numCfeConfigQueue);
 	config_.disableTdn = phConfig["disable_tdn"].get<bool>(config_.disableTdn);
 	config_.disableHdr = phConfig["disable_hdr"].get<bool>(config_.disableHdr);
+	config_.lowLatency = phConfig["low_latency"].get<bool>(config_.lowLatency);
+	config_.compressRaw = phConfig["compress_raw"].get<bool>(config_.compressRaw);
 
 	if (config_.disableTdn) {
 		LOG(RPI, Info) << "TDN disabled by user config";
@@ -1620,6 +1821,8 @@ void PiSPCameraData::platformStart()
 	 */
 	tdnInputIndex_ = 0;
 	stitchInputIndex_ = 0;
+	beQueuedEarly_ = false;
+	stitchSwapPending_ = false;
 
 	cfeJobQueue_ = {};
 
@@ -1632,6 +1835,13 @@ void PiSPCameraData::platformStart()
 
 void PiSPCameraData::platformStop()
 {
+	/*
+	 * Wait for the software post-processing to complete. The processed
+	 * buffers are ignored as the camera isn't running anymore.
+	 */
+	if (swPostProcessor_)
+		swPostProcessor_->flush();
+
 	cfeJobQueue_ = {};
 }
 
@@ -1683,9 +1893,8 @@ void PiSPCameraData::cfeBufferDequeue(FrameBuffer *buffer)
 			ASSERT(b.mapped);
 			void *mem = b.mapped->planes()[0].data();
 
-			dmabufSyncStart(buffer->planes()[0].fd);
+			DmaSyncer syncer(buffer->planes()[0].fd);
 			do16BitEndianSwap(mem, width, height, stride);
-			dmabufSyncEnd(buffer->planes()[0].fd);
 		}
 
 		/*
@@ -1749,30 +1958,60 @@ void PiSPCameraData::beOutputDequeue(FrameBuffer *buffer)
 	bool downscale = stream->swDownscale() > 1;
 	bool needs32bitConv = !!(stream->getFlags() & StreamFlag::Needs32bitConv);
 
-	if (downscale || needs32bitConv)
-		dmabufSyncStart(buffer->planes()[0].fd);
-
-	if (downscale) {
-		/* Further software downscaling must be applied. */
-		downscaleStreamBuffer(stream, index);
+	if (!downscale && !needs32bitConv) {
+		beOutputProcessed(buffer, stream, {});
+		return;
 	}
 
-	/* Convert 24bpp outputs to 32bpp outputs where necessary. */
-	if (needs32bitConv) {
-		unsigned int stride = stream->configuration().stride;
-		unsigned int width = stream->configuration().size.width;
-		unsigned int height = stream->configuration().size.height;
+	/*
+	 * Further software downscaling or 24bpp to 32bpp conversion must be
+	 * applied. Hand the buffer over to the post-processing thread, it will
+	 * be completed in beOutputProcessed().
+	 */
+	const RPi::BufferObject &b = stream->getBuffer(index);
+	ASSERT(b.mapped);
 
-		const RPi::BufferObject &b = stream->getBuffer(index);
+	SwProcessingJob job{};
+	job.buffer = buffer;
+	job.stream = stream;
+	job.pixelFormat = stream->configuration().pixelFormat;
+	job.width = stream->configuration().size.width;
+	job.height = stream->configuration().size.height;
+	job.stride = stream->configuration().stride;
+	job.downscale = stream->swDownscale();
+	job.needs32bitConv = needs32bitConv;
+	job.numPlanes = std::min<unsigned int>(b.mapped->planes().size(),
+					       job.planes.size());
+	for (unsigned int i = 0; i < job.numPlanes; i++)
+		job.planes[i] = b.mapped->planes()[i].data();
+	job.queued = utils::clock::now();
+
+	if (!swPostProcessor_) {
+		swPostProcessor_ = std::make_unique<SwPostProcessor>();
+		swPostProcessor_->bufferReady.connect(pipe(),
+			[this](FrameBuffer *buf, RPi::Stream *s, utils::Duration duration) {
+				if (isRunning())
+					beOutputProcessed(buf, s, duration);
+			});
+	}
+
+	swPostProcessor_->queueBuffer(job);
+}
 
-		ASSERT(b.mapped);
-		void *mem = b.mapped->planes()[0].data();
-		do32BitConversion(mem, width, height, stride);
+void PiSPCameraData::beOutputProcessed(FrameBuffer *buffer, RPi::Stream *stream,
+				       utils::Duration duration)
+{
+	/*
+	 * Report the time spent in software post-processing, accumulated over
+	 * all the streams of the request.
+	 */
+	Request *request = findRequest(buffer, stream);
+	if (duration && request) {
+		int64_t total = request->metadata().get(controls::rpi::SwProcessingDuration).value_or(0);
+		request->metadata().set(controls::rpi::SwProcessingDuration,
+					total + static_cast<int64_t>(duration.get<std::micro>()));
 	}
 
-	if (downscale || needs32bitConv)
-		dmabufSyncEnd(buffer->planes()[0].fd);
-
 	handleStreamBuffer(buffer, stream);
 
 	/*
@@ -1828,6 +2067,12 @@ void PiSPCameraData::prepareIspComplete(const ipa::RPi::BufferIds &buffers, bool
 		ispOutputCount_ = ispOutputTotal_;
 		buffer = cfe_[Cfe::Output0].getBuffers().at(bayerId).buffer;
 		handleStreamBuffer(buffer, &cfe_[Cfe::Output0]);
+	} else if (beQueuedEarly_) {
+		/*
+		 * The BE job has already been queued, apply the stitch buffers
+		 * swap to the next one.
+		 */
+		stitchSwapPending_ ^= stitchSwapBuffers;
 	} else
 		prepareBe(bayerId, stitchSwapBuffers);
 
@@ -2228,19 +2473,24 @@ void PiSPCameraData::prepareBe(uint32_t bufferId, bool stitchSwapBuffers)
 		}
 	}
 
+	if (recorder_.isRecording() && requestsInFlight_)
+		recorder_.record(IspRecorder::RecordType::Parameters,
+				 requestQueue_[requestsInFlight_ - 1]->sequence(),
+				 configBufferSpan.first(sizeof(*configBuffer)));
+
 	isp_[Isp::Config].queueBuffer(config.buffer);
 }
 
 void PiSPCameraData::tryRunPipeline()
 {
 	/* If any of our request or buffer queues are empty, we cannot proceed. */
-	if (state_ != State::Idle || requestQueue_.empty() || !cfeJobComplete())
+	if (!canRunPipeline() || !cfeJobComplete())
 		return;
 
 	CfeJob &job = cfeJobQueue_.front();
 
-	/* Take the first request from the queue and action the IPA. */
-	Request *request = requestQueue_.front();
+	/* Take the next request from the queue and action the IPA. */
+	Request *request = requestQueue_[requestsInFlight_];
 
 	/* See if a new ScalerCrop value needs to be applied. */
 	applyScalerCrop(request->controls());
@@ -2255,11 +2505,18 @@ void PiSPCameraData::tryRunPipeline()
 
 	/* Set our state to say the pipeline is active. */
 	state_ = State::Busy;
+	requestsInFlight_++;
 
 	unsigned int bayerId = cfe_[Cfe::Output0].getBufferId(job.buffers[&cfe_[Cfe::Output0]]);
 	unsigned int statsId = cfe_[Cfe::Stats].getBufferId(job.buffers[&cfe_[Cfe::Stats]]);
 	ASSERT(bayerId && statsId);
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "rpi/pisp", "stats_ready", request,
+			     request->sequence());
+
+	recorder_.record(IspRecorder::RecordType::Statistics, request->sequence(),
+			 job.buffers[&cfe_[Cfe::Stats]]);
+
 	std::stringstream ss;
 	ss << "Signalling IPA processStats and prepareIsp:"
 	   << " Bayer buffer id: " << bayerId
@@ -2269,7 +2526,7 @@ void PiSPCameraData::tryRunPipeline()
 	params.buffers.bayer = RPi::MaskBayerData | bayerId;
 	params.buffers.stats = RPi::MaskStats | statsId;
 	params.buffers.embedded = 0;
-	params.ipaContext = requestQueue_.front()->sequence();
+	params.ipaContext = request->sequence();
 	params.delayContext = job.delayContext;
 	params.sensorControls = std::move(job.sensorControls);
 	params.requestControls = request->controls();
@@ -2285,7 +2542,23 @@ void PiSPCameraData::tryRunPipeline()
 
 	LOG(RPI, Debug) << ss.str();
 
+	/*
+	 * In low latency mode, don't wait for the IPA to queue the BE job. The
+	 * BE processes the frame with the current configuration, and the ISP
+	 * parameters computed by the IPA for this frame apply to the next one.
+	 * This removes the IPA processing time from the image buffers
+	 * completion latency, the request still completes once the IPA has
+	 * filled its metadata.
+	 */
+	beQueuedEarly_ = config_.lowLatency && beEnabled_;
+	if (beQueuedEarly_) {
+		prepareBe(bayerId, stitchSwapPending_);
+		stitchSwapPending_ = false;
+	}
+
 	cfeJobQueue_.pop();
+	LIBCAMERA_TRACEPOINT(frame_stage, "rpi/pisp", "ipa_prepare", request,
+			     request->sequence());
 	ipa_->prepareIsp(params);
 }
 
@@ -13,6 +13,7 @@
 
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/dma_buf_allocator.h"
+#include "libcamera/internal/tracepoints.h"
 
 #include "../common/pipeline_base.h"
 #include "../common/rpi_stream.h"
@@ -331,7 +332,7 @@ int PipelineHandlerVc4::prepareBuffers(Camera *camera)
 		LOG(RPI, Debug) << "Preparing " << numBuffers
 				<< " buffers for stream " << stream->name();
 
-		ret = stream->prepareBuffers(numBuffers);
+		ret = runInWorker([&]() { return stream->prepareBuffers(numBuffers); });
 		if (ret < 0)
 			return ret;
 	}
@@ -882,6 +883,10 @@ void Vc4CameraData::ispOutputDequeue(FrameBuffer *buffer)
 		ipa::RPi::ProcessParams params;
 		params.buffers.stats = index | RPi::MaskStats;
 		params.ipaContext = requestQueue_.front()->sequence();
+		LIBCAMERA_TRACEPOINT(frame_stage, "rpi/vc4", "stats_ready",
+				     requestQueue_.front(), params.ipaContext);
+		recorder_.record(IspRecorder::RecordType::Statistics,
+				 params.ipaContext, buffer);
 		ipa_->processStats(params);
 	} else {
 		/* Any other ISP output can be handed back to the application now. */
@@ -972,15 +977,15 @@ void Vc4CameraData::tryRunPipeline()
 	BayerFrame bayerFrame;
 
 	/* If any of our request or buffer queues are empty, we cannot proceed. */
-	if (state_ != State::Idle || requestQueue_.empty() ||
+	if (!canRunPipeline() ||
 	    bayerQueue_.empty() || (embeddedQueue_.empty() && sensorMetadata_))
 		return;
 
 	if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
 		return;
 
-	/* Take the first request from the queue and action the IPA. */
-	Request *request = requestQueue_.front();
+	/* Take the next request from the queue and action the IPA. */
+	Request *request = requestQueue_[requestsInFlight_];
 
 	/* See if a new ScalerCrop value needs to be applied. */
 	applyScalerCrop(request->controls());
@@ -995,6 +1000,7 @@ void Vc4CameraData::tryRunPipeline()
 
 	/* Set our state to say the pipeline is active. */
 	state_ = State::Busy;
+	requestsInFlight_++;
 
 	unsigned int bayer = unicam_[Unicam::Image].getBufferId(bayerFrame.buffer);
 
@@ -1017,6 +1023,8 @@ void Vc4CameraData::tryRunPipeline()
 				<< " Embedded buffer id: " << embeddedId;
 	}
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "rpi/vc4", "ipa_prepare", request,
+			     request->sequence());
 	ipa_->prepareIsp(params);
 }
 
@@ -22,6 +22,7 @@
 #include <linux/media-bus-format.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
@@ -31,10 +32,12 @@
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/converter.h"
+#include "libcamera/internal/converter/converter_cpu.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/software_isp/software_isp.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -277,7 +280,8 @@ public:
 	std::map<PixelFormat, std::vector<const Configuration *>> formats_;
 
 	std::vector<std::unique_ptr<FrameBuffer>> conversionBuffers_;
-	std::queue<std::map<unsigned int, FrameBuffer *>> conversionQueue_;
+	unsigned int numConversionBuffers_;
+	std::queue<Converter::OutputBuffers> conversionQueue_;
 	bool useConversion_;
 
 	std::unique_ptr<Converter> converter_;
@@ -289,8 +293,10 @@ private:
 
 	void conversionInputDone(FrameBuffer *buffer);
 	void conversionOutputDone(FrameBuffer *buffer);
+	void conversionTimesReady(FrameBuffer *buffer,
+				  const SoftwareIsp::FrameTimes &times);
 
-	void ispStatsReady();
+	void ispStatsReady(uint32_t frame, uint32_t bufferId);
 	void setSensorControls(const ControlList &sensorControls);
 };
 
@@ -310,6 +316,8 @@ public:
 	const Transform &combinedTransform() const { return combinedTransform_; }
 
 private:
+	static constexpr unsigned int kMinBufferCount = 2;
+
 	/*
 	 * The SimpleCameraData instance is guaranteed to be valid as long as
 	 * the corresponding Camera instance is valid. In order to borrow a
@@ -344,12 +352,18 @@ public:
 	V4L2Subdevice *subdev(const MediaEntity *entity);
 	MediaDevice *converter() { return converter_; }
 	bool swIspEnabled() const { return swIspEnabled_; }
+	bool cpuConverterEnabled() const { return cpuConverterEnabled_; }
 
 protected:
 	int queueRequestDevice(Camera *camera, Request *request) override;
+	void countersDevice(const Camera *camera,
+			    std::map<std::string, uint64_t> *counters) override;
 
 private:
 	static constexpr unsigned int kNumInternalBuffers = 3;
+	static constexpr unsigned int kMinInternalBuffers = 2;
+
+	static unsigned int internalBufferCount(V4L2VideoDevice *video);
 
 	struct EntityData {
 		std::unique_ptr<V4L2VideoDevice> video;
@@ -373,6 +387,7 @@ private:
 
 	MediaDevice *converter_;
 	bool swIspEnabled_;
+	bool cpuConverterEnabled_;
 };
 
 /* -----------------------------------------------------------------------------
@@ -382,7 +397,7 @@ private:
 SimpleCameraData::SimpleCameraData(SimplePipelineHandler *pipe,
 				   unsigned int numStreams,
 				   MediaEntity *sensor)
-	: Camera::Private(pipe), streams_(numStreams)
+	: Camera::Private(pipe), streams_(numStreams), numConversionBuffers_(0)
 {
 	int ret;
 
@@ -522,6 +537,23 @@ int SimpleCameraData::init()
 		}
 	}
 
+	/*
+	 * Fall back to the CPU converter when requested and no hardware
+	 * converter is available. The converter emits its signals from the
+	 * pipeline handler thread, they can thus be connected directly.
+	 */
+	if (!converter_ && pipe->cpuConverterEnabled()) {
+		converter_ = std::make_unique<CpuConverter>();
+		if (!converter_->isValid()) {
+			LOG(SimplePipeline, Warning)
+				<< "Failed to create CPU converter, disabling format conversion";
+			converter_.reset();
+		} else {
+			converter_->inputBufferReady.connect(this, &SimpleCameraData::conversionInputDone);
+			converter_->outputBufferReady.connect(this, &SimpleCameraData::conversionOutputDone);
+		}
+	}
+
 	/*
 	 * Instantiate Soft ISP if this is enabled for the given driver and no converter is used.
 	 */
@@ -547,6 +579,7 @@ int SimpleCameraData::init()
 			swIsp_->inputBufferReady.connect(pipe, [this](FrameBuffer *buffer) {
 				this->conversionInputDone(buffer);
 			});
+			swIsp_->frameTimesReady.connect(this, &SimpleCameraData::conversionTimesReady);
 			swIsp_->outputBufferReady.connect(this, &SimpleCameraData::conversionOutputDone);
 			swIsp_->ispStatsReady.connect(this, &SimpleCameraData::ispStatsReady);
 			swIsp_->setSensorControls.connect(this, &SimpleCameraData::setSensorControls);
@@ -646,6 +679,11 @@ void SimpleCameraData::tryPipeline(unsigned int code, const Size &size)
 		if (converter_) {
 			config.outputFormats = converter_->formats(pixelFormat);
 			config.outputSizes = converter_->sizes(format.size);
+			if (config.outputFormats.empty()) {
+				/* Capture directly formats the converter can't process. */
+				config.outputFormats = { pixelFormat };
+				config.outputSizes = config.captureSize;
+			}
 		} else if (swIsp_) {
 			config.outputFormats = swIsp_->formats(pixelFormat);
 			config.outputSizes = swIsp_->sizes(pixelFormat, format.size);
@@ -836,8 +874,7 @@ void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 	Request *request = buffer->request();
 
 	if (useConversion_ && !conversionQueue_.empty()) {
-		const std::map<unsigned int, FrameBuffer *> &outputs =
-			conversionQueue_.front();
+		const Converter::OutputBuffers &outputs = conversionQueue_.front();
 		if (!outputs.empty()) {
 			FrameBuffer *outputBuffer = outputs.begin()->second;
 			if (outputBuffer)
@@ -849,6 +886,9 @@ void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 		request->metadata().set(controls::SensorTimestamp,
 					buffer->metadata().timestamp);
 
+	LIBCAMERA_TRACEPOINT(frame_stage, "simple", "capture_ready", request,
+			     buffer->metadata().sequence);
+
 	/*
 	 * Queue the captured and the request buffer to the converter or Software
 	 * ISP if format conversion is needed. If there's no queued request, just
@@ -890,10 +930,27 @@ void SimpleCameraData::conversionOutputDone(FrameBuffer *buffer)
 		pipe->completeRequest(request);
 }
 
-void SimpleCameraData::ispStatsReady()
+void SimpleCameraData::conversionTimesReady(FrameBuffer *buffer,
+					    const SoftwareIsp::FrameTimes &times)
+{
+	Request *request = buffer->request();
+	if (!request)
+		return;
+
+	ControlList &metadata = request->metadata();
+	metadata.set(controls::draft::IspProcessingDuration,
+		     times.processing.get<std::micro>());
+	metadata.set(controls::draft::IspStatisticsDuration,
+		     times.stats.get<std::micro>());
+	metadata.set(controls::draft::IspQueueDuration,
+		     times.queue.get<std::micro>());
+}
+
+void SimpleCameraData::ispStatsReady(uint32_t frame, uint32_t bufferId)
 {
 	/* \todo Use the DelayedControls class */
-	swIsp_->processStats(sensor_->getControls({ V4L2_CID_ANALOGUE_GAIN,
+	swIsp_->processStats(frame, bufferId,
+			     sensor_->getControls({ V4L2_CID_ANALOGUE_GAIN,
 						    V4L2_CID_EXPOSURE }));
 }
 
@@ -991,9 +1048,19 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 	if (orientation != requestedOrientation)
 		status = Adjusted;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > data_->streams_.size()) {
-		config_.resize(data_->streams_.size());
+	/*
+	 * Cap the number of entries to the available streams, and to the
+	 * number of outputs of the Software ISP. Without any converter or
+	 * Software ISP, a single stream can be captured.
+	 */
+	std::size_t maxStreams = data_->streams_.size();
+	if (data_->swIsp_)
+		maxStreams = std::min<std::size_t>(maxStreams, data_->swIsp_->maxOutputs());
+	else if (!data_->converter_)
+		maxStreams = 1;
+
+	if (config_.size() > maxStreams) {
+		config_.resize(maxStreams);
 		status = Adjusted;
 	}
 
@@ -1110,6 +1177,22 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 			status = Adjusted;
 		}
 
+		/*
+		 * The Software ISP produces the streams after the first one by
+		 * downscaling the first stream, which constrains their size.
+		 */
+		if (i > 0 && data_->swIsp_) {
+			Size adjustedSize = data_->swIsp_->outputSize(config_[0].size,
+								      cfg.size);
+			if (cfg.size != adjustedSize) {
+				LOG(SimplePipeline, Debug)
+					<< "Adjusting size from " << cfg.size
+					<< " to " << adjustedSize;
+				cfg.size = adjustedSize;
+				status = Adjusted;
+			}
+		}
+
 		/* \todo Create a libcamera core class to group format and size */
 		if (cfg.pixelFormat != pipeConfig_->captureFormat ||
 		    cfg.size != pipeConfig_->captureSize)
@@ -1138,7 +1221,7 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 			cfg.frameSize = format.planes[0].size;
 		}
 
-		cfg.bufferCount = 3;
+		cfg.bufferCount = bufferCount(kMinBufferCount, 3);
 	}
 
 	return status;
@@ -1283,7 +1366,8 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	inputCfg.pixelFormat = pipeConfig->captureFormat;
 	inputCfg.size = pipeConfig->captureSize;
 	inputCfg.stride = captureFormat.planes[0].bpl;
-	inputCfg.bufferCount = kNumInternalBuffers;
+	inputCfg.bufferCount = internalBufferCount(video);
+	data->numConversionBuffers_ = inputCfg.bufferCount;
 
 	return data->converter_
 		       ? data->converter_->configure(inputCfg, outputCfgs)
@@ -1291,6 +1375,31 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 						 data->sensor_->controls());
 }
 
+/*
+ * Internal buffers are either queued to the capture video node or being
+ * converted, the number of buffers is thus the minimum required by the video
+ * node to capture frames plus one. Fall back to a fixed number when the driver
+ * doesn't report its requirements.
+ */
+unsigned int SimplePipelineHandler::internalBufferCount(V4L2VideoDevice *video)
+{
+	const ControlInfoMap &controls = video->controls();
+	if (controls.find(V4L2_CID_MIN_BUFFERS_FOR_CAPTURE) == controls.end())
+		return kNumInternalBuffers;
+
+	ControlList ctrls = video->getControls({ V4L2_CID_MIN_BUFFERS_FOR_CAPTURE });
+	if (ctrls.empty())
+		return kNumInternalBuffers;
+
+	int32_t minBuffers = ctrls.get(V4L2_CID_MIN_BUFFERS_FOR_CAPTURE).get<int32_t>();
+	unsigned int count = std::max<int32_t>(minBuffers + 1, kMinInternalBuffers);
+
+	LOG(SimplePipeline, Debug)
+		<< "Using " << count << " internal buffers";
+
+	return count;
+}
+
 int SimplePipelineHandler::exportFrameBuffers(Camera *camera, Stream *stream,
 					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
@@ -1327,10 +1436,11 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 
 	if (data->useConversion_) {
 		/*
-		 * When using the converter allocate a fixed number of internal
-		 * buffers.
+		 * When using the converter allocate internal buffers. They are
+		 * exported as dmabufs and imported by the converter, without
+		 * any copy.
 		 */
-		ret = video->allocateBuffers(kNumInternalBuffers,
+		ret = video->allocateBuffers(data->numConversionBuffers_,
 					     &data->conversionBuffers_);
 	} else {
 		/* Otherwise, prepare for using buffers from the only stream. */
@@ -1398,7 +1508,7 @@ int SimplePipelineHandler::queueRequestDevice(Camera *camera, Request *request)
 	SimpleCameraData *data = cameraData(camera);
 	int ret;
 
-	std::map<unsigned int, FrameBuffer *> buffers;
+	Converter::OutputBuffers buffers;
 
 	for (auto &[stream, buffer] : request->buffers()) {
 		/*
@@ -1421,6 +1531,31 @@ int SimplePipelineHandler::queueRequestDevice(Camera *camera, Request *request)
 	return 0;
 }
 
+void SimplePipelineHandler::countersDevice(const Camera *camera,
+					   std::map<std::string, uint64_t> *counters)
+{
+	const SimpleCameraData *data =
+		static_cast<const SimpleCameraData *>(camera->_d());
+
+	V4L2BufferCache::Statistics cache = data->video_->bufferCacheStatistics();
+	(*counters)["v4l2.buffer_cache.hits"] = cache.hits;
+	(*counters)["v4l2.buffer_cache.misses"] = cache.misses;
+	(*counters)["v4l2.buffer_cache.evictions"] = cache.evictions;
+
+	if (!data->swIsp_)
+		return;
+
+	SoftwareIsp::Counters isp = data->swIsp_->counters();
+	(*counters)["isp.frames"] = isp.frames;
+	(*counters)["isp.dropped_frames"] = isp.dropped;
+	(*counters)["isp.processing_time_total_us"] = isp.total.processing.get<std::micro>();
+	(*counters)["isp.processing_time_max_us"] = isp.max.processing.get<std::micro>();
+	(*counters)["isp.stats_time_total_us"] = isp.total.stats.get<std::micro>();
+	(*counters)["isp.stats_time_max_us"] = isp.max.stats.get<std::micro>();
+	(*counters)["isp.queue_time_total_us"] = isp.total.queue.get<std::micro>();
+	(*counters)["isp.queue_time_max_us"] = isp.max.queue.get<std::micro>();
+}
+
 /* -----------------------------------------------------------------------------
  * Match and Setup
  */
@@ -1545,6 +1680,19 @@ bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 
 	swIspEnabled_ = info->swIspEnabled;
 
+	/* The Software ISP can produce multiple streams in a single pass. */
+	if (!converter_ && swIspEnabled_)
+		numStreams = SoftwareIsp::kMaxOutputs;
+
+	/*
+	 * The CPU converter is opt-in, as it changes the formats exposed by
+	 * platforms that currently capture YUV directly.
+	 */
+	cpuConverterEnabled_ = !converter_ && !swIspEnabled_ &&
+			       utils::secure_getenv("LIBCAMERA_SIMPLE_CPU_CONVERTER");
+	if (cpuConverterEnabled_)
+		numStreams = CpuConverter::kMaxOutputs;
+
 	/* Locate the sensors. */
 	std::vector<MediaEntity *> sensors = locateSensors();
 	if (sensors.empty()) {
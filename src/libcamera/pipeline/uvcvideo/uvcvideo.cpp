@@ -8,9 +8,13 @@
 #include <algorithm>
 #include <fstream>
 #include <iomanip>
+#include <functional>
 #include <math.h>
 #include <memory>
+#include <queue>
+#include <string.h>
 #include <tuple>
+#include <utility>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
@@ -18,12 +22,16 @@
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/camera.h"
+#include "libcamera/internal/converter.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/sysfs.h"
@@ -33,29 +41,80 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
+/*
+ * Header of the blocks stored in V4L2_META_FMT_UVC buffers, from struct
+ * uvc_meta_buf in linux/uvcvideo.h. The first block of a buffer stores the
+ * system timestamp and USB frame number sampled when the first packet of the
+ * frame was received.
+ */
+struct UVCMetadataHeader {
+	uint64_t ns;
+	uint16_t sof;
+	uint8_t length;
+	uint8_t flags;
+} __attribute__((packed));
+
 class UVCCameraData : public Camera::Private
 {
 public:
+	/* Number of internal MJPEG capture buffers when decoding. */
+	static constexpr unsigned int kNumDecodeBuffers = 4;
+	/* Number of metadata buffers, when the metadata node is available. */
+	static constexpr unsigned int kNumMetadataBuffers = 4;
+
 	UVCCameraData(PipelineHandler *pipe)
-		: Camera::Private(pipe)
+		: Camera::Private(pipe), useDecoder_(false), useMetadata_(false)
 	{
 	}
 
 	int init(MediaDevice *media);
+	void initDecoder(MediaDevice *media);
+	void initMetadata(MediaDevice *media);
 	void addControl(uint32_t cid, const ControlInfo &v4l2info,
 			ControlInfoMap::Map *ctrls);
 	void bufferReady(FrameBuffer *buffer);
 
+	int startMetadata();
+	void stopMetadata();
+
 	const std::string &id() const { return id_; }
 
+	std::map<PixelFormat, std::vector<SizeRange>> streamFormats() const;
+	bool needsDecoding(const PixelFormat &pixelFormat, const Size &size) const;
+
 	std::unique_ptr<V4L2VideoDevice> video_;
 	Stream stream_;
 	std::map<PixelFormat, std::vector<SizeRange>> formats_;
 
+	std::unique_ptr<Converter> decoder_;
+	std::map<PixelFormat, std::vector<SizeRange>> decodedFormats_;
+	bool useDecoder_;
+
+	std::vector<std::unique_ptr<FrameBuffer>> decodeBuffers_;
+	std::queue<FrameBuffer *> decodeQueue_;
+
+	std::unique_ptr<V4L2VideoDevice> metadata_;
+
 private:
 	bool generateId();
 
+	void metadataReady(FrameBuffer *buffer);
+	void frameReady(FrameBuffer *buffer, uint64_t timestamp);
+
+	void decodeBuffer(FrameBuffer *buffer, uint64_t timestamp);
+	void decodeInputDone(FrameBuffer *buffer);
+	void decodeOutputDone(FrameBuffer *buffer);
+
 	std::string id_;
+
+	std::vector<std::unique_ptr<FrameBuffer>> metadataBuffers_;
+	std::vector<MappedFrameBuffer> mappedMetadataBuffers_;
+	bool useMetadata_;
+
+	/* Video buffers waiting for their metadata buffer. */
+	std::queue<FrameBuffer *> pendingBuffers_;
+	/* Timestamps from metadata buffers received before their video buffer. */
+	std::queue<std::pair<uint32_t, uint64_t>> pendingTimestamps_;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
@@ -154,16 +213,34 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 
 	cfg.bufferCount = 4;
 
+	/*
+	 * Formats produced by the JPEG decoder are captured as MJPEG, with the
+	 * stride and frame size of the decoder output.
+	 */
+	bool decode = data_->needsDecoding(cfg.pixelFormat, cfg.size);
+
 	V4L2DeviceFormat format;
-	format.fourcc = data_->video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.fourcc = data_->video_->toV4L2PixelFormat(decode ? formats::MJPEG
+								: cfg.pixelFormat);
 	format.size = cfg.size;
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
 		return Invalid;
 
-	cfg.stride = format.planes[0].bpl;
-	cfg.frameSize = format.planes[0].size;
+	if (decode) {
+		if (format.size != cfg.size)
+			return Invalid;
+
+		std::tie(cfg.stride, cfg.frameSize) =
+			data_->decoder_->strideAndFrameSize(cfg.pixelFormat,
+							    cfg.size);
+		if (!cfg.stride)
+			return Invalid;
+	} else {
+		cfg.stride = format.planes[0].bpl;
+		cfg.frameSize = format.planes[0].size;
+	}
 
 	if (cfg.colorSpace != format.colorSpace) {
 		cfg.colorSpace = format.colorSpace;
@@ -189,7 +266,7 @@ PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	if (roles.empty())
 		return config;
 
-	StreamFormats formats(data->formats_);
+	StreamFormats formats(data->streamFormats());
 	StreamConfiguration cfg(formats);
 
 	cfg.pixelFormat = formats.pixelformats().front();
@@ -209,8 +286,11 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	bool decode = data->needsDecoding(cfg.pixelFormat, cfg.size);
+	PixelFormat captureFormat = decode ? formats::MJPEG : cfg.pixelFormat;
+
 	V4L2DeviceFormat format;
-	format.fourcc = data->video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.fourcc = data->video_->toV4L2PixelFormat(captureFormat);
 	format.size = cfg.size;
 
 	ret = data->video_->setFormat(&format);
@@ -218,9 +298,24 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 		return ret;
 
 	if (format.size != cfg.size ||
-	    format.fourcc != data->video_->toV4L2PixelFormat(cfg.pixelFormat))
+	    format.fourcc != data->video_->toV4L2PixelFormat(captureFormat))
 		return -EINVAL;
 
+	if (decode) {
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = captureFormat;
+		inputCfg.size = format.size;
+		inputCfg.stride = format.planes[0].bpl;
+		inputCfg.bufferCount = UVCCameraData::kNumDecodeBuffers;
+
+		std::vector<std::reference_wrapper<StreamConfiguration>> outputCfgs{ cfg };
+		ret = data->decoder_->configure(inputCfg, outputCfgs);
+		if (ret)
+			return ret;
+	}
+
+	data->useDecoder_ = decode;
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
@@ -232,6 +327,9 @@ int PipelineHandlerUVC::exportFrameBuffers(Camera *camera, Stream *stream,
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
+	if (data->useDecoder_)
+		return data->decoder_->exportBuffers(0, count, buffers);
+
 	return data->video_->exportBuffers(count, buffers);
 }
 
@@ -239,25 +337,71 @@ int PipelineHandlerUVC::start(Camera *camera, [[maybe_unused]] const ControlList
 {
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = data->stream_.configuration().bufferCount;
+	int ret;
 
-	int ret = data->video_->importBuffers(count);
+	/*
+	 * When decoding, capture to internal buffers that are imported by the
+	 * decoder as dmabufs, without any copy.
+	 */
+	if (data->useDecoder_)
+		ret = data->video_->allocateBuffers(UVCCameraData::kNumDecodeBuffers,
+						    &data->decodeBuffers_);
+	else
+		ret = data->video_->importBuffers(count);
 	if (ret < 0)
 		return ret;
 
 	ret = data->video_->streamOn();
 	if (ret < 0) {
 		data->video_->releaseBuffers();
+		data->decodeBuffers_.clear();
 		return ret;
 	}
 
+	if (data->useDecoder_) {
+		ret = data->decoder_->start();
+		if (ret < 0) {
+			data->video_->streamOff();
+			data->video_->releaseBuffers();
+			data->decodeBuffers_.clear();
+			return ret;
+		}
+
+		for (std::unique_ptr<FrameBuffer> &buffer : data->decodeBuffers_)
+			data->video_->queueBuffer(buffer.get());
+	}
+
+	/* Metadata is optional, don't fail if it can't be captured. */
+	if (data->metadata_)
+		data->startMetadata();
+
 	return 0;
 }
 
 void PipelineHandlerUVC::stopDevice(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	data->stopMetadata();
+
+	if (data->useDecoder_)
+		data->decoder_->stop();
+
 	data->video_->streamOff();
 	data->video_->releaseBuffers();
+	data->decodeBuffers_.clear();
+
+	/* Cancel the requests that haven't reached the decoder. */
+	while (!data->decodeQueue_.empty()) {
+		FrameBuffer *buffer = data->decodeQueue_.front();
+		Request *request = buffer->request();
+
+		data->decodeQueue_.pop();
+
+		buffer->_d()->cancel();
+		completeBuffer(request, buffer);
+		completeRequest(request);
+	}
 }
 
 int PipelineHandlerUVC::processControl(ControlList *controls, unsigned int id,
@@ -377,6 +521,15 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
+	/*
+	 * When decoding, the buffer will be handed to the decoder in the
+	 * capture completion handler.
+	 */
+	if (data->useDecoder_) {
+		data->decodeQueue_.push(buffer);
+		return 0;
+	}
+
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
@@ -398,6 +551,24 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	if (data->init(media))
 		return false;
 
+	/*
+	 * Cameras often support high resolutions in MJPEG only. Use a V4L2 M2M
+	 * JPEG decoder, if available, to expose uncompressed formats for them.
+	 * A decoder can only be acquired by one camera.
+	 */
+	if (data->formats_.count(formats::MJPEG)) {
+		for (const char *driver : { "mtk-jpeg", "mxc-jpeg" }) {
+			DeviceMatch decoderMatch(driver);
+			MediaDevice *decoder = acquireMediaDevice(enumerator, decoderMatch);
+			if (!decoder)
+				continue;
+
+			data->initDecoder(decoder);
+			if (data->decoder_)
+				break;
+		}
+	}
+
 	/* Create and register the camera. */
 	std::string id = data->id();
 	std::set<Stream *> streams{ &data->stream_ };
@@ -434,6 +605,8 @@ int UVCCameraData::init(MediaDevice *media)
 
 	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
 
+	initMetadata(media);
+
 	/* Generate the camera ID. */
 	if (!generateId()) {
 		LOG(UVC, Error) << "Failed to generate camera ID";
@@ -515,6 +688,189 @@ int UVCCameraData::init(MediaDevice *media)
 	return 0;
 }
 
+void UVCCameraData::initMetadata(MediaDevice *media)
+{
+	/* The metadata node is the video node without the default flag. */
+	const std::vector<MediaEntity *> &entities = media->entities();
+	auto entity = std::find_if(entities.begin(), entities.end(),
+				   [](MediaEntity *e) {
+					   return e->type() == MediaEntity::Type::V4L2VideoDevice &&
+						  !(e->flags() & MEDIA_ENT_FL_DEFAULT);
+				   });
+	if (entity == entities.end())
+		return;
+
+	std::unique_ptr<V4L2VideoDevice> metadata =
+		std::make_unique<V4L2VideoDevice>(*entity);
+	int ret = metadata->open();
+	if (ret)
+		return;
+
+	if (!metadata->caps().isMetaCapture())
+		return;
+
+	V4L2DeviceFormat format;
+	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_UVC);
+
+	ret = metadata->setFormat(&format);
+	if (ret || format.fourcc != V4L2PixelFormat(V4L2_META_FMT_UVC)) {
+		LOG(UVC, Debug) << "UVC metadata format not supported";
+		return;
+	}
+
+	metadata->bufferReady.connect(this, &UVCCameraData::metadataReady);
+	metadata_ = std::move(metadata);
+}
+
+int UVCCameraData::startMetadata()
+{
+	int ret = metadata_->allocateBuffers(kNumMetadataBuffers, &metadataBuffers_);
+	if (ret < 0) {
+		LOG(UVC, Warning) << "Failed to allocate metadata buffers";
+		return ret;
+	}
+
+	/*
+	 * Map the buffers once to parse them without any additional system
+	 * call when they are dequeued.
+	 */
+	mappedMetadataBuffers_.reserve(metadataBuffers_.size());
+
+	for (unsigned int i = 0; i < metadataBuffers_.size(); i++) {
+		FrameBuffer *buffer = metadataBuffers_[i].get();
+
+		MappedFrameBuffer &mapped =
+			mappedMetadataBuffers_.emplace_back(buffer,
+							    MappedFrameBuffer::MapFlag::Read);
+		if (!mapped.isValid()) {
+			LOG(UVC, Warning) << "Failed to map metadata buffer";
+			ret = -ENOMEM;
+			break;
+		}
+
+		buffer->setCookie(i);
+	}
+
+	if (!ret)
+		ret = metadata_->streamOn();
+
+	if (ret < 0) {
+		mappedMetadataBuffers_.clear();
+		metadataBuffers_.clear();
+		metadata_->releaseBuffers();
+		return ret;
+	}
+
+	for (std::unique_ptr<FrameBuffer> &buffer : metadataBuffers_)
+		metadata_->queueBuffer(buffer.get());
+
+	useMetadata_ = true;
+
+	return 0;
+}
+
+void UVCCameraData::stopMetadata()
+{
+	if (!useMetadata_)
+		return;
+
+	useMetadata_ = false;
+
+	metadata_->streamOff();
+	metadata_->releaseBuffers();
+	mappedMetadataBuffers_.clear();
+	metadataBuffers_.clear();
+
+	/* Complete the frames still waiting for metadata. */
+	while (!pendingBuffers_.empty()) {
+		FrameBuffer *buffer = pendingBuffers_.front();
+		pendingBuffers_.pop();
+
+		frameReady(buffer, buffer->metadata().timestamp);
+	}
+
+	pendingTimestamps_ = {};
+}
+
+void UVCCameraData::initDecoder(MediaDevice *media)
+{
+	std::unique_ptr<Converter> decoder = ConverterFactoryBase::create(media);
+	if (!decoder) {
+		LOG(UVC, Warning)
+			<< "Failed to create JPEG decoder " << media->driver();
+		return;
+	}
+
+	/*
+	 * Expose the NV12 and YUYV decoder outputs for all the sizes the
+	 * camera supports in MJPEG, unless it supports them natively.
+	 */
+	const std::vector<SizeRange> &mjpegSizes = formats_.at(formats::MJPEG);
+
+	for (const PixelFormat &pixelFormat : decoder->formats(formats::MJPEG)) {
+		if (pixelFormat != formats::NV12 && pixelFormat != formats::YUYV)
+			continue;
+
+		auto native = formats_.find(pixelFormat);
+		std::vector<SizeRange> sizes;
+
+		for (const SizeRange &range : mjpegSizes) {
+			if (native != formats_.end() &&
+			    std::any_of(native->second.begin(), native->second.end(),
+					[&](const SizeRange &r) {
+						return r.contains(range.max);
+					}))
+				continue;
+
+			sizes.push_back(range);
+		}
+
+		if (!sizes.empty())
+			decodedFormats_[pixelFormat] = std::move(sizes);
+	}
+
+	if (decodedFormats_.empty()) {
+		LOG(UVC, Debug)
+			<< "JPEG decoder " << media->driver()
+			<< " doesn't produce any additional format";
+		return;
+	}
+
+	LOG(UVC, Info)
+		<< "Using JPEG decoder " << decoder->deviceNode()
+		<< " for camera " << id_;
+
+	decoder->inputBufferReady.connect(this, &UVCCameraData::decodeInputDone);
+	decoder->outputBufferReady.connect(this, &UVCCameraData::decodeOutputDone);
+
+	decoder_ = std::move(decoder);
+}
+
+std::map<PixelFormat, std::vector<SizeRange>> UVCCameraData::streamFormats() const
+{
+	std::map<PixelFormat, std::vector<SizeRange>> streamFormats = formats_;
+
+	for (const auto &[pixelFormat, sizes] : decodedFormats_) {
+		std::vector<SizeRange> &ranges = streamFormats[pixelFormat];
+		ranges.insert(ranges.end(), sizes.begin(), sizes.end());
+	}
+
+	return streamFormats;
+}
+
+bool UVCCameraData::needsDecoding(const PixelFormat &pixelFormat,
+				  const Size &size) const
+{
+	auto it = decodedFormats_.find(pixelFormat);
+	if (it == decodedFormats_.end())
+		return false;
+
+	return std::any_of(it->second.begin(), it->second.end(),
+			   [&](const SizeRange &range) {
+				   return range.contains(size);
+			   });
+}
+
 bool UVCCameraData::generateId()
 {
 	const std::string path = video_->devicePath();
@@ -699,11 +1055,156 @@ void UVCCameraData::addControl(uint32_t cid, const ControlInfo &v4l2Info,
 
 void UVCCameraData::bufferReady(FrameBuffer *buffer)
 {
+	if (!useMetadata_ ||
+	    buffer->metadata().status != FrameMetadata::FrameSuccess) {
+		frameReady(buffer, buffer->metadata().timestamp);
+		return;
+	}
+
+	/*
+	 * The video and metadata buffers of a frame share the same sequence
+	 * number, but may be dequeued in any order. Use the timestamp from the
+	 * metadata buffer if it has been received already, drop the older
+	 * ones, and wait for it otherwise.
+	 */
+	uint32_t sequence = buffer->metadata().sequence;
+
+	while (!pendingTimestamps_.empty()) {
+		auto [metaSequence, timestamp] = pendingTimestamps_.front();
+		if (metaSequence > sequence) {
+			/* The metadata for this frame has been lost. */
+			frameReady(buffer, buffer->metadata().timestamp);
+			return;
+		}
+
+		pendingTimestamps_.pop();
+
+		if (metaSequence == sequence) {
+			frameReady(buffer, timestamp);
+			return;
+		}
+	}
+
+	pendingBuffers_.push(buffer);
+}
+
+void UVCCameraData::metadataReady(FrameBuffer *buffer)
+{
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+		return;
+
+	uint32_t sequence = buffer->metadata().sequence;
+	uint64_t timestamp = 0;
+
+	/*
+	 * Use the system timestamp sampled by the driver when the first packet
+	 * of the frame was received, which isn't affected by the USB transfer
+	 * duration. Copy it and requeue the buffer right away.
+	 */
+	Span<uint8_t> data = mappedMetadataBuffers_[buffer->cookie()].planes()[0];
+	unsigned int bytesused = buffer->metadata().planes()[0].bytesused;
+
+	if (buffer->metadata().status == FrameMetadata::FrameSuccess &&
+	    bytesused >= sizeof(UVCMetadataHeader) && data.size() >= bytesused) {
+		UVCMetadataHeader header;
+		memcpy(&header, data.data(), sizeof(header));
+		timestamp = header.ns;
+	}
+
+	metadata_->queueBuffer(buffer);
+
+	/*
+	 * Complete the video buffers waiting for metadata, up to the one
+	 * matching this metadata buffer. Older buffers whose metadata has been
+	 * lost use the V4L2 buffer timestamp.
+	 */
+	while (!pendingBuffers_.empty()) {
+		FrameBuffer *video = pendingBuffers_.front();
+		uint32_t videoSequence = video->metadata().sequence;
+		if (videoSequence > sequence)
+			return;
+
+		pendingBuffers_.pop();
+
+		if (videoSequence == sequence) {
+			frameReady(video, timestamp ? timestamp
+						    : video->metadata().timestamp);
+			return;
+		}
+
+		frameReady(video, video->metadata().timestamp);
+	}
+
+	if (!timestamp)
+		return;
+
+	/* Wait for the video buffer, keeping one entry per metadata buffer. */
+	if (pendingTimestamps_.size() == kNumMetadataBuffers)
+		pendingTimestamps_.pop();
+
+	pendingTimestamps_.emplace(sequence, timestamp);
+}
+
+void UVCCameraData::frameReady(FrameBuffer *buffer, uint64_t timestamp)
+{
+	if (useDecoder_) {
+		decodeBuffer(buffer, timestamp);
+		return;
+	}
+
 	Request *request = buffer->request();
 
-	/* \todo Use the UVC metadata to calculate a more precise timestamp */
-	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	pipe()->completeBuffer(request, buffer);
+	pipe()->completeRequest(request);
+}
+
+void UVCCameraData::decodeBuffer(FrameBuffer *buffer, uint64_t timestamp)
+{
+	/* Internal buffers are released when stopping. */
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+		return;
+
+	/*
+	 * Drop erroneous frames and frames captured while no request is
+	 * queued, and requeue the internal buffer for capture.
+	 */
+	if (buffer->metadata().status != FrameMetadata::FrameSuccess ||
+	    decodeQueue_.empty()) {
+		video_->queueBuffer(buffer);
+		return;
+	}
+
+	FrameBuffer *output = decodeQueue_.front();
+	Request *request = output->request();
+
+	decodeQueue_.pop();
+
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	int ret = decoder_->queueBuffers(buffer, { { 0, output } });
+	if (ret < 0) {
+		LOG(UVC, Error) << "Failed to queue buffers to the JPEG decoder";
+
+		video_->queueBuffer(buffer);
+
+		output->_d()->cancel();
+		pipe()->completeBuffer(request, output);
+		pipe()->completeRequest(request);
+	}
+}
+
+void UVCCameraData::decodeInputDone(FrameBuffer *buffer)
+{
+	/* Queue the MJPEG buffer back for capture. */
+	if (buffer->metadata().status != FrameMetadata::FrameCancelled)
+		video_->queueBuffer(buffer);
+}
+
+void UVCCameraData::decodeOutputDone(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
 
 	pipe()->completeBuffer(request, buffer);
 	pipe()->completeRequest(request);
@@ -94,6 +94,7 @@ public:
 	int start(Camera *camera, const ControlList *controls) override;
 	void stopDevice(Camera *camera) override;
 
+	bool handlesFences(const Camera *camera) const override;
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
@@ -435,6 +436,12 @@ int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 	return ret;
 }
 
+bool PipelineHandlerVimc::handlesFences([[maybe_unused]] const Camera *camera) const
+{
+	/* The only stream is captured directly from the video device. */
+	return true;
+}
+
 int PipelineHandlerVimc::queueRequestDevice(Camera *camera, Request *request)
 {
 	VimcCameraData *data = cameraData(camera);
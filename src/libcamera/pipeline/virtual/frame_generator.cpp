@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Frame generators for the virtual pipeline handler
+ */
+
+#include "frame_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <errno.h>
+#include <string.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
+
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Virtual)
+
+namespace {
+
+/*
+ * Retrieve the luma and chroma planes of an NV12 buffer of \a size. Buffers
+ * allocated by the pipeline handler store the planes separately, but imported
+ * buffers may store both planes in a single plane.
+ */
+bool nv12Planes(MappedBuffer *buffer, const Size &size,
+		Span<uint8_t> *y, Span<uint8_t> *uv)
+{
+	const std::vector<Span<uint8_t>> &planes = buffer->planes();
+	std::size_t ySize = size.width * size.height;
+	std::size_t uvSize = ySize / 2;
+
+	if (planes.size() == 1 && planes[0].size() >= ySize + uvSize) {
+		*y = planes[0].subspan(0, ySize);
+		*uv = planes[0].subspan(ySize, uvSize);
+	} else if (planes.size() == 2 && planes[0].size() >= ySize &&
+		   planes[1].size() >= uvSize) {
+		*y = planes[0].subspan(0, ySize);
+		*uv = planes[1].subspan(0, uvSize);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Copy a plane of \a width bytes per line, scrolled horizontally by \a shift
+ * bytes, to animate the image.
+ */
+void copyScrolled(uint8_t *dst, const uint8_t *src, unsigned int width,
+		  unsigned int lines, unsigned int shift)
+{
+	for (unsigned int i = 0; i < lines; i++) {
+		memcpy(dst, src + shift, width - shift);
+		memcpy(dst + width - shift, src, shift);
+
+		dst += width;
+		src += width;
+	}
+}
+
+} /* namespace */
+
+/**
+ * \class FrameGenerator
+ * \brief Produce the content of the frames captured by a virtual camera
+ *
+ * Frame generators write NV12 images to frame buffers. They are configured
+ * with the stream size before capture starts, and then fill one buffer per
+ * frame, which should be cheap as it runs in the pipeline handler thread.
+ */
+
+/**
+ * \fn FrameGenerator::configure()
+ * \brief Configure the generator for a frame size
+ * \param[in] size The frame size
+ * \return 0 on success or a negative error code otherwise
+ */
+
+/**
+ * \fn FrameGenerator::generate()
+ * \brief Fill a frame buffer
+ * \param[in] buffer The mapped frame buffer
+ * \param[in] frame The frame sequence number
+ */
+
+/**
+ * \class TestPatternGenerator
+ * \brief Generate animated test patterns
+ *
+ * The pattern is rendered once at configuration time, and copied to the frame
+ * buffers with a horizontal scroll that depends on the frame number.
+ */
+
+int TestPatternGenerator::configure(const Size &size)
+{
+	size_ = size;
+	y_.resize(size.width * size.height);
+	uv_.resize(size.width * size.height / 2);
+
+	switch (pattern_) {
+	case Pattern::ColorBars:
+		generateColorBars();
+		break;
+	case Pattern::DiagonalLines:
+		generateDiagonalLines();
+		break;
+	}
+
+	return 0;
+}
+
+void TestPatternGenerator::generate(MappedBuffer *buffer, unsigned int frame)
+{
+	Span<uint8_t> y;
+	Span<uint8_t> uv;
+
+	if (!nv12Planes(buffer, size_, &y, &uv))
+		return;
+
+	unsigned int shift = (frame * 4) % size_.width & ~1U;
+
+	copyScrolled(y.data(), y_.data(), size_.width, size_.height, shift);
+	copyScrolled(uv.data(), uv_.data(), size_.width, size_.height / 2, shift);
+}
+
+void TestPatternGenerator::generateColorBars()
+{
+	/* White, yellow, cyan, green, magenta, red, blue and black. */
+	static constexpr std::array<std::array<uint8_t, 3>, 8> bars = { {
+		{ 235, 128, 128 }, { 210, 16, 146 }, { 170, 166, 16 },
+		{ 145, 54, 34 }, { 106, 202, 222 }, { 81, 90, 240 },
+		{ 41, 240, 110 }, { 16, 128, 128 },
+	} };
+
+	for (unsigned int x = 0; x < size_.width; x++) {
+		const std::array<uint8_t, 3> &bar = bars[x * bars.size() / size_.width];
+
+		for (unsigned int line = 0; line < size_.height; line++)
+			y_[line * size_.width + x] = bar[0];
+
+		for (unsigned int line = 0; line < size_.height / 2; line++)
+			uv_[line * size_.width + x] = bar[1 + x % 2];
+	}
+}
+
+void TestPatternGenerator::generateDiagonalLines()
+{
+	for (unsigned int line = 0; line < size_.height; line++) {
+		for (unsigned int x = 0; x < size_.width; x++)
+			y_[line * size_.width + x] = (x + line) % 32 < 16 ? 235 : 16;
+	}
+
+	std::fill(uv_.begin(), uv_.end(), 128);
+}
+
+/**
+ * \class FileFrameGenerator
+ * \brief Generate frames from preloaded image files
+ *
+ * The image files contain raw NV12 images without padding, and are loaded in
+ * memory when the generator is created. Frames cycle through the images.
+ */
+
+std::unique_ptr<FileFrameGenerator>
+FileFrameGenerator::create(const Size &size, const std::vector<std::string> &files)
+{
+	std::unique_ptr<FileFrameGenerator> generator(new FileFrameGenerator(size));
+	std::size_t frameSize = size.width * size.height * 3 / 2;
+
+	for (const std::string &name : files) {
+		File file(name);
+		if (!file.open(File::OpenModeFlag::ReadOnly)) {
+			LOG(Virtual, Error)
+				<< "Failed to open " << name << ": "
+				<< strerror(-file.error());
+			return nullptr;
+		}
+
+		if (file.size() != static_cast<ssize_t>(frameSize)) {
+			LOG(Virtual, Error)
+				<< "Invalid size for " << name << ", expected "
+				<< frameSize << " bytes for " << size << " NV12";
+			return nullptr;
+		}
+
+		std::vector<uint8_t> &frame = generator->frames_.emplace_back(frameSize);
+		if (file.read(frame) != static_cast<ssize_t>(frameSize)) {
+			LOG(Virtual, Error) << "Failed to read " << name;
+			return nullptr;
+		}
+	}
+
+	if (generator->frames_.empty())
+		return nullptr;
+
+	return generator;
+}
+
+int FileFrameGenerator::configure(const Size &size)
+{
+	return size == size_ ? 0 : -EINVAL;
+}
+
+void FileFrameGenerator::generate(MappedBuffer *buffer, unsigned int frame)
+{
+	Span<uint8_t> y;
+	Span<uint8_t> uv;
+
+	if (!nv12Planes(buffer, size_, &y, &uv))
+		return;
+
+	const std::vector<uint8_t> &data = frames_[frame % frames_.size()];
+	memcpy(y.data(), data.data(), y.size());
+	memcpy(uv.data(), data.data() + y.size(), uv.size());
+}
+
+} /* namespace libcamera */
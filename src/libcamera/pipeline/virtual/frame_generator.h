@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Frame generators for the virtual pipeline handler
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class MappedBuffer;
+
+class FrameGenerator
+{
+public:
+	virtual ~FrameGenerator() = default;
+
+	virtual int configure(const Size &size) = 0;
+	virtual void generate(MappedBuffer *buffer, unsigned int frame) = 0;
+};
+
+class TestPatternGenerator : public FrameGenerator
+{
+public:
+	enum class Pattern {
+		ColorBars,
+		DiagonalLines,
+	};
+
+	TestPatternGenerator(Pattern pattern)
+		: pattern_(pattern)
+	{
+	}
+
+	int configure(const Size &size) override;
+	void generate(MappedBuffer *buffer, unsigned int frame) override;
+
+private:
+	void generateColorBars();
+	void generateDiagonalLines();
+
+	Pattern pattern_;
+	Size size_;
+	std::vector<uint8_t> y_;
+	std::vector<uint8_t> uv_;
+};
+
+class FileFrameGenerator : public FrameGenerator
+{
+public:
+	static std::unique_ptr<FileFrameGenerator>
+	create(const Size &size, const std::vector<std::string> &files);
+
+	int configure(const Size &size) override;
+	void generate(MappedBuffer *buffer, unsigned int frame) override;
+
+private:
+	FileFrameGenerator(const Size &size)
+		: size_(size)
+	{
+	}
+
+	Size size_;
+	std::vector<std::vector<uint8_t>> frames_;
+};
+
+} /* namespace libcamera */
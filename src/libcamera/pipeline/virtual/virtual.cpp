@@ -0,0 +1,691 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Pipeline handler for virtual cameras
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/formats.h>
+#include <libcamera/property_ids.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/camera.h"
+#include "libcamera/internal/dma_buf_allocator.h"
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/yaml_parser.h"
+
+#include "frame_generator.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Virtual)
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct VirtualCameraConfig {
+	std::string id;
+	std::string model;
+	int32_t location;
+	std::vector<Size> sizes;
+	utils::Duration minFrameDuration;
+	utils::Duration maxFrameDuration;
+	utils::Duration defaultFrameDuration;
+	std::chrono::microseconds ipaDelay;
+	std::unique_ptr<FrameGenerator> generator;
+};
+
+} /* namespace */
+
+/*
+ * Emulate an IPA module running in a separate thread. Each captured frame is
+ * sent to the IPA along with the request controls, and the IPA replies with
+ * the frame metadata. This exercises the same cross-thread messaging as the
+ * threaded IPA proxies.
+ */
+class VirtualIPA : public Object
+{
+public:
+	VirtualIPA(std::chrono::microseconds delay)
+		: delay_(delay)
+	{
+	}
+
+	void processFrame(unsigned int frame, const ControlList &controls,
+			  int64_t frameDuration);
+	void sync() {}
+
+	Signal<unsigned int, std::shared_ptr<const ControlList>> metadataReady;
+
+private:
+	std::chrono::microseconds delay_;
+};
+
+class VirtualCameraData : public Camera::Private
+{
+public:
+	VirtualCameraData(PipelineHandler *pipe, VirtualCameraConfig config);
+	~VirtualCameraData();
+
+	int init();
+	void start();
+	void stop();
+
+	void queueRequest(Request *request);
+
+	VirtualCameraConfig config_;
+	Stream stream_;
+
+	utils::Duration frameDuration_;
+
+private:
+	std::chrono::nanoseconds frameInterval() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(frameDuration_);
+	}
+
+	void frameTimeout();
+	void metadataReady(unsigned int frame,
+			   std::shared_ptr<const ControlList> metadata);
+	void cancelRequest(Request *request);
+
+	Thread ipaThread_;
+	VirtualIPA ipa_;
+
+	Timer frameTimer_;
+	std::chrono::steady_clock::time_point nextFrame_;
+	unsigned int sequence_;
+
+	std::deque<Request *> waitingRequests_;
+	std::deque<std::pair<unsigned int, Request *>> processingRequests_;
+};
+
+class VirtualCameraConfiguration : public CameraConfiguration
+{
+public:
+	VirtualCameraConfiguration(VirtualCameraData *data);
+
+	Status validate() override;
+
+private:
+	VirtualCameraData *data_;
+};
+
+class PipelineHandlerVirtual : public PipelineHandler
+{
+public:
+	PipelineHandlerVirtual(CameraManager *manager);
+
+	std::unique_ptr<CameraConfiguration> generateConfiguration(Camera *camera,
+								   Span<const StreamRole> roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start(Camera *camera, const ControlList *controls) override;
+	void stopDevice(Camera *camera) override;
+
+	int queueRequestDevice(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	static bool created_;
+
+	int parseConfigFile(const std::string &filename,
+			    std::vector<VirtualCameraConfig> *configs);
+	int parseCamera(const YamlObject &cameraConfig, unsigned int index,
+			VirtualCameraConfig *config);
+
+	VirtualCameraData *cameraData(Camera *camera)
+	{
+		return static_cast<VirtualCameraData *>(camera->_d());
+	}
+
+	DmaBufAllocator dmaBufAllocator_;
+};
+
+bool PipelineHandlerVirtual::created_ = false;
+
+void VirtualIPA::processFrame(unsigned int frame, const ControlList &controls,
+			      int64_t frameDuration)
+{
+	if (delay_.count())
+		std::this_thread::sleep_for(delay_);
+
+	auto metadata = std::make_shared<ControlList>(controls::controls);
+	metadata->set(controls::FrameDuration, frameDuration);
+	metadata->set(controls::ExposureTime, static_cast<int32_t>(frameDuration));
+	metadata->set(controls::AnalogueGain, 1.0f);
+
+	const auto brightness = controls.get(controls::Brightness);
+	if (brightness)
+		metadata->set(controls::Brightness, *brightness);
+
+	metadataReady.emit(frame, std::move(metadata));
+}
+
+VirtualCameraData::VirtualCameraData(PipelineHandler *pipe, VirtualCameraConfig config)
+	: Camera::Private(pipe), config_(std::move(config)),
+	  ipaThread_("virtual-ipa"), ipa_(config_.ipaDelay), sequence_(0)
+{
+	ipa_.moveToThread(&ipaThread_);
+	ipa_.metadataReady.connect(this, &VirtualCameraData::metadataReady);
+	ipaThread_.start();
+
+	frameTimer_.timeout.connect(this, &VirtualCameraData::frameTimeout);
+}
+
+VirtualCameraData::~VirtualCameraData()
+{
+	ipaThread_.exit();
+	ipaThread_.wait();
+}
+
+int VirtualCameraData::init()
+{
+	ControlInfoMap::Map controls;
+
+	int64_t minFrameDuration = config_.minFrameDuration.get<std::micro>();
+	int64_t maxFrameDuration = config_.maxFrameDuration.get<std::micro>();
+	int64_t defFrameDuration = config_.defaultFrameDuration.get<std::micro>();
+
+	controls[&controls::FrameDurationLimits] =
+		ControlInfo(minFrameDuration, maxFrameDuration,
+			    Span<const int64_t, 2>{ { defFrameDuration, defFrameDuration } });
+	controls[&controls::Brightness] = ControlInfo(-1.0f, 1.0f, 0.0f);
+
+	controlInfo_ = ControlInfoMap(std::move(controls), controls::controls);
+
+	Size maxSize = *std::max_element(config_.sizes.begin(), config_.sizes.end());
+
+	properties_.set(properties::Location, config_.location);
+	properties_.set(properties::Model, config_.model);
+	properties_.set(properties::PixelArraySize, maxSize);
+	properties_.set(properties::PixelArrayActiveAreas, { Rectangle(maxSize) });
+
+	frameDuration_ = config_.defaultFrameDuration;
+
+	return 0;
+}
+
+void VirtualCameraData::start()
+{
+	sequence_ = 0;
+	nextFrame_ = std::chrono::steady_clock::now() + frameInterval();
+	frameTimer_.start(nextFrame_);
+}
+
+void VirtualCameraData::stop()
+{
+	frameTimer_.stop();
+
+	/*
+	 * Wait for the IPA to process all frames sent to it. The metadata it
+	 * produces are delivered asynchronously and will be ignored, as the
+	 * corresponding requests are cancelled below.
+	 */
+	ipa_.invokeMethod(&VirtualIPA::sync, ConnectionTypeBlocking);
+
+	while (!processingRequests_.empty()) {
+		cancelRequest(processingRequests_.front().second);
+		processingRequests_.pop_front();
+	}
+
+	while (!waitingRequests_.empty()) {
+		cancelRequest(waitingRequests_.front());
+		waitingRequests_.pop_front();
+	}
+}
+
+void VirtualCameraData::queueRequest(Request *request)
+{
+	waitingRequests_.push_back(request);
+}
+
+void VirtualCameraData::cancelRequest(Request *request)
+{
+	FrameBuffer *buffer = request->findBuffer(&stream_);
+
+	buffer->_d()->cancel();
+	pipe()->completeBuffer(request, buffer);
+	pipe()->completeRequest(request);
+}
+
+void VirtualCameraData::frameTimeout()
+{
+	/*
+	 * Schedule the next frame relative to the previous deadline to keep a
+	 * steady frame rate, unless the pipeline handler thread fell behind.
+	 */
+	auto now = std::chrono::steady_clock::now();
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		now.time_since_epoch()).count();
+
+	nextFrame_ = std::max(nextFrame_ + frameInterval(), now);
+	frameTimer_.start(nextFrame_);
+
+	unsigned int frame = sequence_++;
+
+	/* The frame is dropped when no request is available to capture it. */
+	if (waitingRequests_.empty())
+		return;
+
+	Request *request = waitingRequests_.front();
+	waitingRequests_.pop_front();
+
+	const auto frameDurationLimits = request->controls().get(controls::FrameDurationLimits);
+	if (frameDurationLimits) {
+		utils::Duration duration = std::chrono::microseconds((*frameDurationLimits)[0]);
+		frameDuration_ = std::clamp(duration, config_.minFrameDuration,
+					    config_.maxFrameDuration);
+	}
+
+	FrameBuffer *buffer = request->findBuffer(&stream_);
+	MappedFrameBuffer mapped(buffer, MappedFrameBuffer::MapFlag::Write |
+					 MappedFrameBuffer::MapFlag::Persistent);
+	if (!mapped.isValid()) {
+		LOG(Virtual, Error) << "Failed to map buffer";
+		cancelRequest(request);
+		return;
+	}
+
+	config_.generator->generate(&mapped, frame);
+
+	FrameMetadata &metadata = buffer->_d()->metadata();
+	metadata.status = FrameMetadata::FrameSuccess;
+	metadata.sequence = frame;
+	metadata.timestamp = timestamp;
+	Span<FrameMetadata::Plane> planes = metadata.planes();
+	for (unsigned int i = 0; i < planes.size(); i++)
+		planes[i].bytesused = buffer->planes()[i].length;
+
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	processingRequests_.emplace_back(frame, request);
+
+	ipa_.invokeMethod(&VirtualIPA::processFrame, ConnectionTypeQueued,
+			  frame, request->controls(),
+			  static_cast<int64_t>(frameDuration_.get<std::micro>()));
+}
+
+void VirtualCameraData::metadataReady(unsigned int frame,
+				      std::shared_ptr<const ControlList> metadata)
+{
+	if (processingRequests_.empty() ||
+	    processingRequests_.front().first != frame)
+		return;
+
+	Request *request = processingRequests_.front().second;
+	processingRequests_.pop_front();
+
+	request->metadata().merge(*metadata);
+
+	FrameBuffer *buffer = request->findBuffer(&stream_);
+	pipe()->completeBuffer(request, buffer);
+	pipe()->completeRequest(request);
+}
+
+VirtualCameraConfiguration::VirtualCameraConfiguration(VirtualCameraData *data)
+	: CameraConfiguration(), data_(data)
+{
+}
+
+CameraConfiguration::Status VirtualCameraConfiguration::validate()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	if (orientation != Orientation::Rotate0) {
+		orientation = Orientation::Rotate0;
+		status = Adjusted;
+	}
+
+	/* Cap the number of entries to the available streams. */
+	if (config_.size() > 1) {
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	StreamConfiguration &cfg = config_[0];
+
+	if (cfg.pixelFormat != formats::NV12) {
+		LOG(Virtual, Debug) << "Adjusting format to NV12";
+		cfg.pixelFormat = formats::NV12;
+		status = Adjusted;
+	}
+
+	/* Pick the supported size closest to the requested size. */
+	const std::vector<Size> &sizes = data_->config_.sizes;
+	auto distance = [&cfg](const Size &size) {
+		return std::abs(static_cast<int64_t>(size.width) - cfg.size.width) +
+		       std::abs(static_cast<int64_t>(size.height) - cfg.size.height);
+	};
+	Size size = *std::min_element(sizes.begin(), sizes.end(),
+				      [&](const Size &a, const Size &b) {
+					      return distance(a) < distance(b);
+				      });
+
+	if (cfg.size != size) {
+		LOG(Virtual, Debug) << "Adjusting size to " << size;
+		cfg.size = size;
+		status = Adjusted;
+	}
+
+	if (!cfg.bufferCount) {
+		cfg.bufferCount = 4;
+		status = Adjusted;
+	}
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	cfg.stride = info.stride(cfg.size.width, 0, 1);
+	cfg.frameSize = info.frameSize(cfg.size, 1);
+
+	return status;
+}
+
+PipelineHandlerVirtual::PipelineHandlerVirtual(CameraManager *manager)
+	: PipelineHandler(manager),
+	  dmaBufAllocator_(DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
+			   DmaBufAllocator::DmaBufAllocatorFlag::SystemHeap |
+			   DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf)
+{
+}
+
+std::unique_ptr<CameraConfiguration>
+PipelineHandlerVirtual::generateConfiguration(Camera *camera,
+					      Span<const StreamRole> roles)
+{
+	VirtualCameraData *data = cameraData(camera);
+	std::unique_ptr<CameraConfiguration> config =
+		std::make_unique<VirtualCameraConfiguration>(data);
+
+	if (roles.empty())
+		return config;
+
+	std::vector<SizeRange> sizes;
+	for (const Size &size : data->config_.sizes)
+		sizes.emplace_back(size, size);
+
+	std::map<PixelFormat, std::vector<SizeRange>> formats;
+	formats[formats::NV12] = sizes;
+
+	StreamConfiguration cfg(formats);
+	cfg.pixelFormat = formats::NV12;
+	cfg.size = *std::max_element(data->config_.sizes.begin(),
+				     data->config_.sizes.end());
+	cfg.bufferCount = 4;
+
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerVirtual::configure(Camera *camera, CameraConfiguration *config)
+{
+	VirtualCameraData *data = cameraData(camera);
+	StreamConfiguration &cfg = config->at(0);
+
+	int ret = data->config_.generator->configure(cfg.size);
+	if (ret)
+		return ret;
+
+	cfg.setStream(&data->stream_);
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::exportFrameBuffers([[maybe_unused]] Camera *camera,
+					       Stream *stream,
+					       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!dmaBufAllocator_.isValid())
+		return -ENOBUFS;
+
+	const StreamConfiguration &config = stream->configuration();
+	const PixelFormatInfo &info = PixelFormatInfo::info(config.pixelFormat);
+
+	std::vector<unsigned int> planeSizes;
+	for (unsigned int i = 0; i < info.numPlanes(); i++)
+		planeSizes.push_back(info.planeSize(config.size, i, 1));
+
+	return dmaBufAllocator_.exportBuffers(config.bufferCount, planeSizes, buffers);
+}
+
+int PipelineHandlerVirtual::start(Camera *camera, const ControlList *controls)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	if (controls) {
+		const auto limits = controls->get(controls::FrameDurationLimits);
+		if (limits) {
+			utils::Duration duration = std::chrono::microseconds((*limits)[0]);
+			data->frameDuration_ = std::clamp(duration,
+							  data->config_.minFrameDuration,
+							  data->config_.maxFrameDuration);
+		}
+	}
+
+	data->start();
+
+	return 0;
+}
+
+void PipelineHandlerVirtual::stopDevice(Camera *camera)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	data->stop();
+}
+
+int PipelineHandlerVirtual::queueRequestDevice(Camera *camera, Request *request)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	if (!request->findBuffer(&data->stream_)) {
+		LOG(Virtual, Error)
+			<< "Attempt to queue request with invalid stream";
+		return -ENOENT;
+	}
+
+	data->queueRequest(request);
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::parseCamera(const YamlObject &cameraConfig,
+					unsigned int index,
+					VirtualCameraConfig *config)
+{
+	config->id = cameraConfig["id"].get<std::string>("Virtual" + std::to_string(index));
+	config->model = cameraConfig["model"].get<std::string>("Virtual camera");
+
+	std::string location = cameraConfig["location"].get<std::string>("external");
+	if (location == "front") {
+		config->location = properties::CameraLocationFront;
+	} else if (location == "back") {
+		config->location = properties::CameraLocationBack;
+	} else if (location == "external") {
+		config->location = properties::CameraLocationExternal;
+	} else {
+		LOG(Virtual, Error) << "Invalid location '" << location << "'";
+		return -EINVAL;
+	}
+
+	std::optional<std::vector<Size>> sizes =
+		cameraConfig["sizes"].getList<Size>();
+	if (!sizes || sizes->empty()) {
+		LOG(Virtual, Error) << "Missing or invalid sizes for camera " << index;
+		return -EINVAL;
+	}
+
+	for (const Size &size : *sizes) {
+		if (size.isNull() || size.width % 2 || size.height % 2) {
+			LOG(Virtual, Error) << "Invalid size " << size;
+			return -EINVAL;
+		}
+	}
+
+	config->sizes = std::move(*sizes);
+
+	double minRate = cameraConfig["min_frame_rate"].get<double>(1.0);
+	double maxRate = cameraConfig["max_frame_rate"].get<double>(1000.0);
+	double defRate = cameraConfig["frame_rate"].get<double>(30.0);
+	if (minRate <= 0 || maxRate < minRate || defRate < minRate || defRate > maxRate) {
+		LOG(Virtual, Error) << "Invalid frame rates for camera " << index;
+		return -EINVAL;
+	}
+
+	config->minFrameDuration = std::chrono::duration<double>(1.0 / maxRate);
+	config->maxFrameDuration = std::chrono::duration<double>(1.0 / minRate);
+	config->defaultFrameDuration = std::chrono::duration<double>(1.0 / defRate);
+
+	config->ipaDelay = std::chrono::microseconds(cameraConfig["ipa_delay_us"].get<uint32_t>(0));
+
+	if (cameraConfig.contains("files")) {
+		std::optional<std::vector<std::string>> files =
+			cameraConfig["files"].getList<std::string>();
+		if (!files || config->sizes.size() != 1) {
+			LOG(Virtual, Error)
+				<< "Cameras using files shall have a single size";
+			return -EINVAL;
+		}
+
+		config->generator = FileFrameGenerator::create(config->sizes[0], *files);
+		if (!config->generator)
+			return -EINVAL;
+
+		return 0;
+	}
+
+	std::string pattern = cameraConfig["pattern"].get<std::string>("bars");
+	if (pattern == "bars") {
+		config->generator = std::make_unique<TestPatternGenerator>(
+			TestPatternGenerator::Pattern::ColorBars);
+	} else if (pattern == "lines") {
+		config->generator = std::make_unique<TestPatternGenerator>(
+			TestPatternGenerator::Pattern::DiagonalLines);
+	} else {
+		LOG(Virtual, Error) << "Invalid pattern '" << pattern << "'";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::parseConfigFile(const std::string &filename,
+					    std::vector<VirtualCameraConfig> *configs)
+{
+	File file(filename);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		LOG(Virtual, Error) << "Failed to open configuration file '"
+				    << filename << "'";
+		return -ENOENT;
+	}
+
+	std::unique_ptr<YamlObject> root = YamlParser::parse(file);
+	if (!root) {
+		LOG(Virtual, Error) << "Failed to parse configuration file";
+		return -EINVAL;
+	}
+
+	std::optional<double> ver = (*root)["version"].get<double>();
+	if (!ver || *ver != 1.0) {
+		LOG(Virtual, Error) << "Unexpected configuration file version";
+		return -EINVAL;
+	}
+
+	const YamlObject &cameras = (*root)["cameras"];
+	if (!cameras.isList()) {
+		LOG(Virtual, Error) << "No cameras in configuration file";
+		return -EINVAL;
+	}
+
+	unsigned int index = 0;
+	for (const YamlObject &cameraConfig : cameras.asList()) {
+		VirtualCameraConfig config;
+
+		int ret = parseCamera(cameraConfig, index++, &config);
+		if (ret)
+			return ret;
+
+		configs->push_back(std::move(config));
+	}
+
+	return 0;
+}
+
+bool PipelineHandlerVirtual::match([[maybe_unused]] DeviceEnumerator *enumerator)
+{
+	/* Virtual cameras don't depend on devices, create them once only. */
+	if (created_)
+		return false;
+
+	created_ = true;
+
+	const char *configFile = utils::secure_getenv("LIBCAMERA_VIRTUAL_CONFIG_FILE");
+	if (!configFile || *configFile == '\0')
+		return false;
+
+	if (!dmaBufAllocator_.isValid()) {
+		LOG(Virtual, Error) << "No dma-buf provider available";
+		return false;
+	}
+
+	std::vector<VirtualCameraConfig> configs;
+	if (parseConfigFile(configFile, &configs))
+		return false;
+
+	for (VirtualCameraConfig &config : configs) {
+		std::string id = config.id;
+		std::unique_ptr<VirtualCameraData> data =
+			std::make_unique<VirtualCameraData>(this, std::move(config));
+
+		if (data->init())
+			continue;
+
+		std::set<Stream *> streams{ &data->stream_ };
+		std::shared_ptr<Camera> camera =
+			Camera::create(std::move(data), id, streams);
+		registerCamera(std::move(camera));
+	}
+
+	return true;
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerVirtual, "virtual")
+
+} /* namespace libcamera */
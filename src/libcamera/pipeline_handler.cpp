@@ -7,12 +7,16 @@
 
 #include "libcamera/internal/pipeline_handler.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 
+#include <libcamera/base/event_dispatcher.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/mutex.h>
+#include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
@@ -47,6 +51,28 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Pipeline)
 
+/*
+ * Worker running blocking operations on behalf of the pipeline handler in a
+ * dedicated thread, see PipelineHandler::runInWorker().
+ */
+class PipelineHandler::Worker : public Object
+{
+public:
+	struct Job {
+		std::function<int()> func;
+		EventDispatcher *dispatcher;
+		std::atomic<bool> done;
+		int result;
+	};
+
+	void run(Job *job)
+	{
+		job->result = job->func();
+		job->done.store(true, std::memory_order_release);
+		job->dispatcher->interrupt();
+	}
+};
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -58,6 +84,19 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * They implement std::enable_shared_from_this<> in order to create new
  * std::shared_ptr<> in code paths originating from member functions of the
  * PipelineHandler class where only the 'this' pointer is available.
+ *
+ * By default, all pipeline handlers run in the CameraManager thread. When the
+ * LIBCAMERA_PIPELINE_THREADS environment variable is set, each pipeline
+ * handler instance is instead created, matched and run in a dedicated thread
+ * with its own event dispatcher, so that the processing of one camera doesn't
+ * delay the other cameras. In that case, all references to the CameraManager
+ * thread in the documentation of the PipelineHandler class refer to the
+ * pipeline handler thread. The objects created by the pipeline handler,
+ * including its cameras, are bound to that thread, and the invariants of the
+ * CameraManager thread apply to it: all Camera operations are invoked on the
+ * pipeline handler thread, and the signals of the cameras and of the devices
+ * of the pipeline handler are emitted from it. Pipeline handlers shall thus
+ * not share state with other pipeline handler instances without locking.
  */
 
 /**
@@ -75,6 +114,11 @@ PipelineHandler::PipelineHandler(CameraManager *manager)
 
 PipelineHandler::~PipelineHandler()
 {
+	if (workerThread_) {
+		workerThread_->exit();
+		workerThread_->wait();
+	}
+
 	for (std::shared_ptr<MediaDevice> media : mediaDevices_)
 		media->release();
 }
@@ -223,6 +267,51 @@ void PipelineHandler::releaseDevice([[maybe_unused]] Camera *camera)
 {
 }
 
+/**
+ * \brief Run a blocking operation without stalling the CameraManager thread
+ * \param[in] func The operation to run
+ *
+ * Some operations performed by pipeline handlers when configuring or starting
+ * a camera, such as allocating or importing buffers on video devices, can
+ * block for tens of milliseconds. As all pipeline handlers run in the
+ * CameraManager thread, this would delay the processing of events for all
+ * other cameras, including buffer completion for cameras that are streaming.
+ *
+ * This function runs \a func in a worker thread owned by the pipeline
+ * handler, and processes events in the calling thread until \a func returns.
+ * From the point of view of the caller it is synchronous.
+ *
+ * As \a func runs in a different thread, it shall only perform operations
+ * that don't rely on the CameraManager thread, such as ioctls on devices that
+ * are not streaming. In particular, it shall not call the IPA module, or any
+ * function of an Object bound to the CameraManager thread. As events are
+ * processed while \a func runs, pipeline handlers shall also be prepared for
+ * other cameras to be operated on concurrently.
+ *
+ * \context This function shall be called from the CameraManager thread.
+ *
+ * \return The value returned by \a func
+ */
+int PipelineHandler::runInWorker(const std::function<int()> &func)
+{
+	if (!workerThread_) {
+		workerThread_ = std::make_unique<Thread>("pipeline-worker");
+		worker_ = std::make_unique<Worker>();
+		worker_->moveToThread(workerThread_.get());
+		workerThread_->start();
+	}
+
+	Thread *current = Thread::current();
+	Worker::Job job{ func, current->eventDispatcher(), false, 0 };
+
+	worker_->invokeMethod(&Worker::run, ConnectionTypeQueued, &job);
+
+	while (!job.done.load(std::memory_order_acquire))
+		current->eventDispatcher()->processEvents();
+
+	return job.result;
+}
+
 void PipelineHandler::unlockMediaDevices()
 {
 	for (std::shared_ptr<MediaDevice> &media : mediaDevices_)
@@ -301,6 +390,31 @@ void PipelineHandler::unlockMediaDevices()
  * otherwise
  */
 
+/**
+ * \brief Prepare a camera to be started
+ * \param[in] camera The camera to prepare
+ *
+ * Perform the costly operations of start() ahead of time, such as allocating
+ * internal buffers and mapping them to the IPA module, for start() to only
+ * apply the initial controls and start streaming. The intended caller of this
+ * function is the Camera class.
+ *
+ * Pipeline handlers shall keep track of the prepared resources and use them in
+ * the next call to start(), which shall also work without a prior call to
+ * this function. Resources prepared but not used by start() shall be released
+ * by configure() and releaseDevice().
+ *
+ * The default implementation does nothing.
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::prepare([[maybe_unused]] Camera *camera)
+{
+	return 0;
+}
+
 /**
  * \fn PipelineHandler::start()
  * \brief Start capturing from a group of streams
@@ -345,6 +459,49 @@ void PipelineHandler::stop(Camera *camera)
 	ASSERT(data->queuedRequests_.empty());
 
 	data->requestSequence_ = 0;
+	data->lastSequence_.clear();
+	data->deliveredBuffers_.clear();
+
+	for (auto &[stream, usage] : data->bufferUsage_)
+		usage.lastDelivery = {};
+}
+
+/**
+ * \brief Cancel the requests not yet started without stopping the camera
+ * \param[in] camera The camera to flush
+ *
+ * This function cancels the requests of \a camera still waiting to be queued to
+ * the device, and calls flushDevice() to let the pipeline handler cancel the
+ * requests it has received but not started processing yet. The requests being
+ * processed complete normally, and the cancelled requests complete in an error
+ * state after them, in submission order.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::flush(Camera *camera)
+{
+	std::queue<Request *> waitingRequests;
+
+	/*
+	 * Queue the cancelled requests to the camera to complete them in
+	 * order with the requests already queued to the device.
+	 */
+	while (!waitingRequests_.empty()) {
+		Request *request = waitingRequests_.front();
+		waitingRequests_.pop();
+
+		if (request->_d()->camera() != camera) {
+			waitingRequests.push(request);
+			continue;
+		}
+
+		request->_d()->cancel();
+		doQueueRequest(request);
+	}
+
+	waitingRequests_ = std::move(waitingRequests);
+
+	flushDevice(camera);
 }
 
 /**
@@ -356,6 +513,25 @@ void PipelineHandler::stop(Camera *camera)
  * pending requests are cancelled and complete immediately in an error state.
  */
 
+/**
+ * \brief Cancel the requests queued to the device but not started yet
+ * \param[in] camera The camera to flush
+ *
+ * This function is called by flush() and may be overridden by pipeline
+ * handlers that keep requests internally before processing them, for instance
+ * while waiting for internal buffers. The pipeline handler shall cancel those
+ * requests and their buffers and complete them with completeRequest(), without
+ * stopping the device. Requests whose buffers have been queued to the hardware
+ * shall complete normally.
+ *
+ * The default implementation does nothing.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::flushDevice([[maybe_unused]] Camera *camera)
+{
+}
+
 /**
  * \brief Determine if the camera has any requests pending
  * \param[in] camera The camera to check
@@ -416,7 +592,41 @@ void PipelineHandler::queueRequest(Request *request)
 
 	waitingRequests_.push(request);
 
-	request->_d()->prepare(300ms);
+	/*
+	 * Pipeline handlers that handle fences get the request right away,
+	 * with the fences still attached to the buffers.
+	 */
+	if (handlesFences(request->_d()->camera()))
+		request->_d()->emitPrepareCompleted();
+	else
+		request->_d()->prepare(300ms);
+}
+
+/**
+ * \brief Queue the requests submitted by the application from another thread
+ * \param[in] camera The camera the requests have been submitted to
+ *
+ * Camera::queueRequest() calls queueRequest() synchronously when invoked from
+ * the pipeline handler thread. Otherwise, it accumulates requests in a list of
+ * pending requests and wakes up the pipeline handler thread once per batch by
+ * invoking this function, which queues all pending requests in submission
+ * order.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::submitRequests(Camera *camera)
+{
+	Camera::Private *data = camera->_d();
+
+	{
+		MutexLocker locker(data->pendingRequestsMutex_);
+		std::swap(data->submittingRequests_, data->pendingRequests_);
+	}
+
+	for (Request *request : data->submittingRequests_)
+		queueRequest(request);
+
+	data->submittingRequests_.clear();
 }
 
 /**
@@ -432,6 +642,14 @@ void PipelineHandler::doQueueRequest(Request *request)
 
 	request->_d()->sequence_ = data->requestSequence_++;
 
+	for (const auto &[stream, buffer] : request->buffers())
+		data->bufferQueued(stream, buffer);
+
+	data->counters_.requestsQueued++;
+	data->counters_.maxQueueDepth =
+		std::max<unsigned int>(data->counters_.maxQueueDepth,
+				       data->queuedRequests_.size());
+
 	if (request->_d()->cancelled_) {
 		completeRequest(request);
 		return;
@@ -462,6 +680,32 @@ void PipelineHandler::doQueueRequests()
 	}
 }
 
+/**
+ * \brief Check if the pipeline handler handles buffer fences for a camera
+ * \param[in] camera The camera
+ *
+ * By default, requests are passed to the pipeline handler only once the
+ * fences of all their buffers have been signalled, and requests whose fences
+ * expire are cancelled without being passed to the pipeline handler. A request
+ * waiting on a fence thus delays the processing of the request, including the
+ * buffers that don't carry a fence.
+ *
+ * Pipeline handlers that queue every buffer of a request to a V4L2VideoDevice
+ * can override this function to return true. Requests are then passed to the
+ * pipeline handler without waiting, and each buffer is queued to its device
+ * as soon as its own fence is signalled, as implemented by
+ * V4L2VideoDevice::queueBuffer(). Buffers whose fence expires complete with
+ * the FrameMetadata::FrameCancelled status, and the pipeline handler shall
+ * cancel the corresponding request.
+ *
+ * \return True if the pipeline handler handles fences for \a camera, false
+ * otherwise
+ */
+bool PipelineHandler::handlesFences([[maybe_unused]] const Camera *camera) const
+{
+	return false;
+}
+
 /**
  * \fn PipelineHandler::queueRequestDevice()
  * \brief Queue a request to the device
@@ -499,7 +743,32 @@ void PipelineHandler::doQueueRequests()
 bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
 {
 	Camera *camera = request->_d()->camera();
+	Camera::Private *data = camera->_d();
+	const FrameMetadata &metadata = buffer->metadata();
+
+	if (metadata.status == FrameMetadata::FrameSuccess) {
+		for (const auto &[stream, buf] : request->buffers()) {
+			if (buf != buffer)
+				continue;
+
+			auto it = data->lastSequence_.find(stream);
+			if (it == data->lastSequence_.end()) {
+				data->lastSequence_[stream] = metadata.sequence;
+				break;
+			}
+
+			if (metadata.sequence > it->second + 1)
+				data->counters_.framesDropped +=
+					metadata.sequence - it->second - 1;
+			it->second = metadata.sequence;
+			break;
+		}
+	}
+
+	data->deliveryDepth_++;
 	camera->bufferCompleted.emit(request, buffer);
+	data->deliveryDepth_--;
+
 	return request->_d()->completeBuffer(buffer);
 }
 
@@ -521,6 +790,9 @@ void PipelineHandler::completeRequest(Request *request)
 {
 	Camera *camera = request->_d()->camera();
 
+	LIBCAMERA_TRACEPOINT(frame_stage, name(), "complete", request,
+			     request->sequence());
+
 	request->_d()->complete();
 
 	Camera::Private *data = camera->_d();
@@ -532,8 +804,92 @@ void PipelineHandler::completeRequest(Request *request)
 
 		ASSERT(!req->hasPendingBuffers());
 		data->queuedRequests_.pop_front();
+
+		if (req->status() == Request::RequestCancelled)
+			data->counters_.requestsCancelled++;
+		else
+			data->counters_.requestsCompleted++;
+
+		for (const auto &[stream, buffer] : req->buffers()) {
+			if (buffer->metadata().status == FrameMetadata::FrameSuccess)
+				data->bufferDelivered(stream, buffer);
+		}
+
+		LIBCAMERA_TRACEPOINT(frame_stage, name(), "deliver", req,
+				     req->sequence());
+		data->deliveryDepth_++;
 		camera->requestComplete(req);
+		data->deliveryDepth_--;
+	}
+}
+
+/**
+ * \brief Retrieve the performance counters of a camera
+ * \param[in] camera The camera
+ * \param[out] counters The counters, indexed by name
+ *
+ * This function fills \a counters with the request and frame counters
+ * maintained by the PipelineHandler base class for the \a camera, and then
+ * calls countersDevice() to let the pipeline handler report its own counters.
+ *
+ * The only intended caller is Camera::counters().
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::counters(const Camera *camera,
+			       std::map<std::string, uint64_t> *counters)
+{
+	const Camera::Private *data = camera->_d();
+
+	(*counters)["requests.queued"] = data->counters_.requestsQueued;
+	(*counters)["requests.completed"] = data->counters_.requestsCompleted;
+	(*counters)["requests.cancelled"] = data->counters_.requestsCancelled;
+	(*counters)["requests.in_flight"] = data->queuedRequests_.size();
+	(*counters)["requests.in_flight_max"] = data->counters_.maxQueueDepth;
+	(*counters)["frames.dropped"] = data->counters_.framesDropped;
+
+	for (const auto &[stream, usage] : data->bufferUsage_) {
+		const std::string prefix = "streams." + std::to_string(usage.index) +
+					   ".buffers.";
+		uint64_t latency = usage.latencies ? usage.latencySum / usage.latencies : 0;
+		uint64_t holdTime = usage.holdTimes ? usage.holdTimeSum / usage.holdTimes : 0;
+
+		(*counters)[prefix + "latency"] = latency / 1000;
+		(*counters)[prefix + "hold_time"] = holdTime / 1000;
+
+		if (!usage.intervals)
+			continue;
+
+		/*
+		 * Buffers are busy for the capture of the frame, the pipeline
+		 * latency and the application hold time, and one buffer must
+		 * be queued to the device at all times to avoid frame drops.
+		 */
+		uint64_t interval = std::max<uint64_t>(usage.intervalSum / usage.intervals, 1);
+		(*counters)[prefix + "recommended"] =
+			(latency + holdTime + interval - 1) / interval + 1;
 	}
+
+	countersDevice(camera, counters);
+}
+
+/**
+ * \brief Report pipeline handler specific performance counters
+ * \param[in] camera The camera
+ * \param[inout] counters The counters, indexed by name
+ *
+ * This function is called by counters() to let pipeline handlers add their own
+ * counters to \a counters. Counter names shall be prefixed by the name of the
+ * component they relate to (e.g. "ipa." or the name of a video device), and
+ * time counters shall be expressed in microseconds.
+ *
+ * The default implementation doesn't report any counter.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::countersDevice([[maybe_unused]] const Camera *camera,
+				     [[maybe_unused]] std::map<std::string, uint64_t> *counters)
+{
 }
 
 /**
@@ -8,13 +8,15 @@
 #include "libcamera/internal/process.h"
 
 #include <algorithm>
-#include <dirent.h>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -64,6 +66,87 @@ void sigact(int signal, siginfo_t *info, void *ucontext)
 	}
 }
 
+/*
+ * Parameters of the child process, prepared by the parent as the child can't
+ * allocate memory. The child reports failures through the error and stage
+ * fields, which the parent reads once the child has exited.
+ */
+struct SpawnContext {
+	const char *path;
+	char *const *argv;
+	char *const *envp;
+	const int *fds;
+	unsigned int numFds;
+	int maxFd;
+	sigset_t sigmask;
+
+	int error;
+	const char *stage;
+};
+
+/* Stack size of the child process until it calls execve() */
+constexpr size_t kSpawnStackSize = 64 * 1024;
+
+void closeRange(unsigned int first, unsigned int last, int maxFd)
+{
+#ifdef SYS_close_range
+	if (!syscall(SYS_close_range, first, last, 0))
+		return;
+#endif
+
+	for (int fd = first; fd <= maxFd && static_cast<unsigned int>(fd) <= last; fd++)
+		close(fd);
+}
+
+/*
+ * The child process shares the address space of the parent until it calls
+ * execve(), and shall thus only use async-signal-safe functions and not modify
+ * any memory other than the SpawnContext.
+ */
+int spawnChild(void *arg)
+{
+	SpawnContext *ctx = static_cast<SpawnContext *>(arg);
+
+	/*
+	 * Signal handlers would run in the address space of the parent, reset
+	 * them to the default before unblocking signals.
+	 */
+	for (int sig = 1; sig < NSIG; sig++) {
+		struct sigaction sa;
+		if (sigaction(sig, nullptr, &sa) || sa.sa_handler == SIG_IGN ||
+		    sa.sa_handler == SIG_DFL)
+			continue;
+
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		sigaction(sig, &sa, nullptr);
+	}
+
+	sigprocmask(SIG_SETMASK, &ctx->sigmask, nullptr);
+
+	if (unshare(/*CLONE_NEWUSER */ CLONE_NEWNET)) {
+		ctx->error = errno;
+		ctx->stage = "unshare execution context";
+		_exit(EXIT_FAILURE);
+	}
+
+	/* Close all file descriptors except the sorted ctx->fds. */
+	unsigned int first = 0;
+	for (unsigned int i = 0; i < ctx->numFds; i++) {
+		unsigned int fd = ctx->fds[i];
+		if (fd > first)
+			closeRange(first, fd - 1, ctx->maxFd);
+		first = fd + 1;
+	}
+	closeRange(first, ~0U, ctx->maxFd);
+
+	execve(ctx->path, ctx->argv, ctx->envp);
+
+	ctx->error = errno;
+	ctx->stage = "execute";
+	_exit(EXIT_FAILURE);
+}
+
 } /* namespace */
 
 void ProcessManager::sighandler()
@@ -104,6 +187,19 @@ void ProcessManager::registerProcess(Process *proc)
 	processes_.push_back(proc);
 }
 
+/**
+ * \brief Unregister process from process manager
+ * \param[in] proc Process to unregister
+ *
+ * This function unregisters the \a proc from the process manager. It shall be
+ * called when a running process is destroyed, as its termination can't be
+ * signalled anymore.
+ */
+void ProcessManager::unregisterProcess(Process *proc)
+{
+	processes_.remove(proc);
+}
+
 ProcessManager *ProcessManager::self_ = nullptr;
 
 /**
@@ -216,24 +312,42 @@ Process::Process()
 
 Process::~Process()
 {
+	if (!running_)
+		return;
+
+	/*
+	 * Reap the child process synchronously, the process manager can't
+	 * notify a destroyed Process instance of its termination.
+	 */
 	kill();
-	/* \todo wait for child process to exit */
+
+	ProcessManager *manager = ProcessManager::instance();
+	if (manager)
+		manager->unregisterProcess(this);
+
+	waitpid(pid_, nullptr, 0);
 }
 
 /**
- * \brief Fork and exec a process, and close fds
+ * \brief Spawn a process, and close fds
  * \param[in] path Path to executable
  * \param[in] args Arguments to pass to executable (optional)
  * \param[in] fds Vector of file descriptors to keep open (optional)
  *
- * Fork a process, and exec the executable specified by path. Prior to
- * exec'ing, but after forking, all file descriptors except for those
- * specified in fds will be closed.
+ * Spawn a process, and exec the executable specified by path. Prior to
+ * exec'ing, all file descriptors except for those specified in fds will be
+ * closed.
+ *
+ * The child process is created with clone(CLONE_VM | CLONE_VFORK). It shares
+ * the address space of the caller until it execs, which avoids copying the
+ * page tables of the caller as fork() does. The cost of spawning a process is
+ * thus independent of the amount of memory mapped by the caller, and the
+ * calling thread is only blocked until the child process has exec'ed.
  *
  * All indexes of args will be incremented by 1 before being fed to exec(),
  * so args[0] should not need to be equal to path.
  *
- * \return Zero on successful fork, exec, and closing the file descriptors,
+ * \return Zero on successful spawn, exec, and closing the file descriptors,
  * or a negative error code otherwise
  */
 int Process::start(const std::string &path,
@@ -245,76 +359,80 @@ int Process::start(const std::string &path,
 	if (running_)
 		return 0;
 
-	int childPid = fork();
-	if (childPid == -1) {
-		ret = -errno;
-		LOG(Process, Error) << "Failed to fork: " << strerror(-ret);
-		return ret;
-	} else if (childPid) {
-		pid_ = childPid;
-		ProcessManager::instance()->registerProcess(this);
+	/* Prepare everything the child needs, it can't allocate memory. */
+	std::vector<char *> argv;
+	argv.reserve(args.size() + 2);
+	argv.push_back(const_cast<char *>(path.c_str()));
+	for (const std::string &arg : args)
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	argv.push_back(nullptr);
 
-		running_ = true;
+	const char *file = utils::secure_getenv("LIBCAMERA_LOG_FILE");
+	bool dropLogFile = file && strcmp(file, "syslog");
 
-		return 0;
-	} else {
-		if (isolate())
-			_exit(EXIT_FAILURE);
+	std::vector<char *> envp;
+	for (char **env = environ; *env; env++) {
+		if (dropLogFile && !strncmp(*env, "LIBCAMERA_LOG_FILE=", 19))
+			continue;
+		envp.push_back(*env);
+	}
+	envp.push_back(nullptr);
 
-		closeAllFdsExcept(fds);
+	std::vector<int> keepFds;
+	for (int fd : fds) {
+		if (fd >= 0)
+			keepFds.push_back(fd);
+	}
+	std::sort(keepFds.begin(), keepFds.end());
 
-		const char *file = utils::secure_getenv("LIBCAMERA_LOG_FILE");
-		if (file && strcmp(file, "syslog"))
-			unsetenv("LIBCAMERA_LOG_FILE");
+	struct rlimit rlim;
+	int maxFd = 1024;
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur != RLIM_INFINITY)
+		maxFd = rlim.rlim_cur;
 
-		const char **argv = new const char *[args.size() + 2];
-		unsigned int len = args.size();
-		argv[0] = path.c_str();
-		for (unsigned int i = 0; i < len; i++)
-			argv[i+1] = args[i].c_str();
-		argv[len+1] = nullptr;
+	SpawnContext ctx = {};
+	ctx.path = path.c_str();
+	ctx.argv = argv.data();
+	ctx.envp = envp.data();
+	ctx.fds = keepFds.data();
+	ctx.numFds = keepFds.size();
+	ctx.maxFd = maxFd;
 
-		execv(path.c_str(), (char **)argv);
+	std::vector<uint8_t> stack(kSpawnStackSize);
 
-		exit(EXIT_FAILURE);
-	}
-}
+	/*
+	 * Block all signals to prevent signal handlers from running in the
+	 * child before it resets them.
+	 */
+	sigset_t allSignals;
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &ctx.sigmask);
 
-void Process::closeAllFdsExcept(const std::vector<int> &fds)
-{
-	std::vector<int> v(fds);
-	sort(v.begin(), v.end());
+	int childPid = clone(spawnChild, stack.data() + stack.size(),
+			     CLONE_VM | CLONE_VFORK | SIGCHLD, &ctx);
+	ret = childPid == -1 ? -errno : 0;
 
-	DIR *dir = opendir("/proc/self/fd");
-	if (!dir)
-		return;
+	pthread_sigmask(SIG_SETMASK, &ctx.sigmask, nullptr);
 
-	int dfd = dirfd(dir);
+	if (childPid == -1) {
+		LOG(Process, Error) << "Failed to spawn: " << strerror(-ret);
+		return ret;
+	}
 
-	struct dirent *ent;
-	while ((ent = readdir(dir)) != nullptr) {
-		char *endp;
-		int fd = strtoul(ent->d_name, &endp, 10);
-		if (*endp)
-			continue;
+	/* The child has exec'ed or exited, reap it if it failed. */
+	if (ctx.error) {
+		waitpid(childPid, nullptr, 0);
 
-		if (fd >= 0 && fd != dfd &&
-		    !std::binary_search(v.begin(), v.end(), fd))
-			close(fd);
+		LOG(Process, Error)
+			<< "Failed to " << ctx.stage << ": "
+			<< strerror(ctx.error);
+		return -ctx.error;
 	}
 
-	closedir(dir);
-}
+	pid_ = childPid;
+	ProcessManager::instance()->registerProcess(this);
 
-int Process::isolate()
-{
-	int ret = unshare(/*CLONE_NEWUSER */ CLONE_NEWNET);
-	if (ret) {
-		ret = -errno;
-		LOG(Process, Error) << "Failed to unshare execution context: "
-				    << strerror(-ret);
-		return ret;
-	}
+	running_ = true;
 
 	return 0;
 }
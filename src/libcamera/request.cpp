@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/request.h"
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 
@@ -79,8 +80,8 @@ bool Request::Private::hasPendingBuffers() const
  * \brief Complete a buffer for the request
  * \param[in] buffer The buffer that has completed
  *
- * A request tracks the status of all buffers it contains through a set of
- * pending buffers. This function removes the \a buffer from the set to mark it
+ * A request tracks the status of all buffers it contains through a list of
+ * pending buffers. This function removes the \a buffer from the list to mark it
  * as complete. All buffers associate with the request shall be marked as
  * complete by calling this function once and once only before reporting the
  * request as complete with the complete() function.
@@ -92,8 +93,9 @@ bool Request::Private::completeBuffer(FrameBuffer *buffer)
 {
 	LIBCAMERA_TRACEPOINT(request_complete_buffer, this, buffer);
 
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	auto it = std::find(pending_.begin(), pending_.end(), buffer);
+	ASSERT(it != pending_.end());
+	pending_.erase(it);
 
 	buffer->_d()->setRequest(nullptr);
 
@@ -128,11 +130,16 @@ void Request::Private::doCancelRequest()
 {
 	Request *request = _o<Request>();
 
+	Camera::Private *data = camera_->_d();
+	data->deliveryDepth_++;
+
 	for (FrameBuffer *buffer : pending_) {
 		buffer->_d()->cancel();
 		camera_->bufferCompleted.emit(request, buffer);
 	}
 
+	data->deliveryDepth_--;
+
 	cancelled_ = true;
 	pending_.clear();
 	notifiers_.clear();
@@ -324,6 +331,9 @@ void Request::Private::timeout()
 /**
  * \typedef Request::BufferMap
  * \brief A map of Stream to FrameBuffer pointers
+ *
+ * The map stores a small number of buffers inline, so that adding buffers to
+ * a request doesn't allocate memory in the common case.
  */
 
 /**
@@ -332,6 +342,13 @@ void Request::Private::timeout()
  *
  * A Request allows an application to associate buffers and controls on a
  * per-frame basis to be queued to the camera device for processing.
+ *
+ * Requests are meant to be allocated once, typically one per buffer, and
+ * recycled with reuse() once they complete. Recycled requests retain the
+ * memory of their controls and metadata lists and of their buffers, so that
+ * an application that queues the same pool of requests with the same
+ * controls doesn't cause libcamera to allocate memory for the requests in a
+ * steady state.
  */
 
 /**
@@ -378,6 +395,11 @@ Request::~Request()
  * prior to queueing the request to the camera, in lieu of constructing a new
  * request. The application can reuse the buffers that were previously added
  * to the request via addBuffer() by setting \a flags to ReuseBuffers.
+ *
+ * The memory used to store the controls and metadata is retained, including
+ * the storage of values that don't fit inline in a ControlValue. Setting the
+ * same controls, or pipeline handlers reporting the same metadata, for the
+ * reused request thus doesn't allocate memory.
  */
 void Request::reuse(ReuseFlag flags)
 {
@@ -389,7 +411,7 @@ void Request::reuse(ReuseFlag flags)
 		for (auto pair : bufferMap_) {
 			FrameBuffer *buffer = pair.second;
 			buffer->_d()->setRequest(this);
-			_d()->pending_.insert(buffer);
+			_d()->pending_.push_back(buffer);
 		}
 	} else {
 		bufferMap_.clear();
@@ -474,7 +496,7 @@ int Request::addBuffer(const Stream *stream, FrameBuffer *buffer,
 	}
 
 	buffer->_d()->setRequest(this);
-	_d()->pending_.insert(buffer);
+	_d()->pending_.push_back(buffer);
 	bufferMap_[stream] = buffer;
 
 	/*
@@ -143,6 +143,20 @@ int CameraSensor::init()
 	auto last = std::unique(sizes_.begin(), sizes_.end());
 	sizes_.erase(last, sizes_.end());
 
+	/* Index the output sizes with the criteria used by getFormat(). */
+	for (const auto &[code, ranges] : formats_) {
+		std::vector<Mode> &modes = modes_[code];
+
+		for (const SizeRange &range : ranges) {
+			const Size &sz = range.max;
+			modes.push_back({ sz, static_cast<float>(sz.width) / sz.height,
+					  sz.width * sz.height });
+		}
+
+		std::stable_sort(modes.begin(), modes.end(),
+				 [](const Mode &a, const Mode &b) { return a.area < b.area; });
+	}
+
 	/*
 	 * VIMC is a bit special, as it does not yet support all the mandatory
 	 * requirements regular sensors have to respect.
@@ -696,11 +710,45 @@ Size CameraSensor::resolution() const
  * The returned sensor output format is guaranteed to be acceptable by the
  * setFormat() function without any modification.
  *
+ * Pipeline handlers call this function repeatedly with the same arguments when
+ * generating and validating configurations. The results are memoized, which
+ * makes the repeated calls cheap. This function is thread-safe.
+ *
  * \return The best sensor output format matching the desired media bus codes
  * and size on success, or an empty format otherwise.
  */
 V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbusCodes,
 					    const Size &size) const
+{
+	auto key = std::make_pair(mbusCodes, size);
+
+	{
+		MutexLocker locker(formatCacheMutex_);
+
+		auto it = formatCache_.find(key);
+		if (it != formatCache_.end())
+			return it->second;
+	}
+
+	V4L2SubdeviceFormat format = selectFormat(mbusCodes, size);
+
+	MutexLocker locker(formatCacheMutex_);
+
+	/* The desired sizes are unbounded, start over when the cache is full. */
+	if (formatCache_.size() >= kFormatCacheSize)
+		formatCache_.clear();
+
+	formatCache_.emplace(std::move(key), format);
+
+	return format;
+}
+
+/*
+ * Score the output sizes of the sensor for the desired media bus codes and
+ * size, see getFormat().
+ */
+V4L2SubdeviceFormat CameraSensor::selectFormat(const std::vector<unsigned int> &mbusCodes,
+					       const Size &size) const
 {
 	unsigned int desiredArea = size.width * size.height;
 	unsigned int bestArea = UINT_MAX;
@@ -710,20 +758,18 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 	uint32_t bestCode = 0;
 
 	for (unsigned int code : mbusCodes) {
-		const auto formats = formats_.find(code);
-		if (formats == formats_.end())
+		const auto modes = modes_.find(code);
+		if (modes == modes_.end())
 			continue;
 
-		for (const SizeRange &range : formats->second) {
-			const Size &sz = range.max;
+		for (const Mode &mode : modes->second) {
+			const Size &sz = mode.size;
 
 			if (sz.width < size.width || sz.height < size.height)
 				continue;
 
-			float ratio = static_cast<float>(sz.width) / sz.height;
-			float ratioDiff = fabsf(ratio - desiredRatio);
-			unsigned int area = sz.width * sz.height;
-			unsigned int areaDiff = area - desiredArea;
+			float ratioDiff = fabsf(mode.ratio - desiredRatio);
+			unsigned int areaDiff = mode.area - desiredArea;
 
 			if (ratioDiff > bestRatio)
 				continue;
@@ -13,6 +13,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -85,6 +86,39 @@ SharedMem::SharedMem(const std::string &name, std::size_t size)
 	mem_ = { static_cast<uint8_t *>(mem), size };
 }
 
+/**
+ * \brief Construct a SharedMem mapping existing shared memory
+ * \param[in] fd File descriptor of the shared memory
+ * \param[in] size Size of the shared memory to map
+ *
+ * This constructor maps the memory backed by \a fd, typically received from
+ * another process that has allocated it with a SharedMem. The \a size shall
+ * not exceed the size of the shared memory.
+ */
+SharedMem::SharedMem(const SharedFD &fd, std::size_t size)
+	: fd_(fd)
+{
+	if (!fd_.isValid())
+		return;
+
+	/* Accessing pages beyond the end of the file would raise SIGBUS. */
+	struct stat st;
+	if (fstat(fd_.get(), &st) < 0 ||
+	    static_cast<std::size_t>(st.st_size) < size) {
+		fd_ = SharedFD();
+		return;
+	}
+
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd_.get(), 0);
+	if (mem == MAP_FAILED) {
+		fd_ = SharedFD();
+		return;
+	}
+
+	mem_ = { static_cast<uint8_t *>(mem), size };
+}
+
 /**
  * \brief Move constructor for SharedMem
  * \param[in] rhs The object to move
@@ -11,6 +11,8 @@
 
 #include "debayer.h"
 
+#include "libcamera/internal/framebuffer.h"
+
 namespace libcamera {
 
 /**
@@ -23,11 +25,33 @@ namespace libcamera {
  * \brief Size of a color lookup table
  */
 
+/**
+ * \var DebayerParams::kGammaLookupSize
+ * \brief Size of the gamma lookup table
+ */
+
+/**
+ * \var DebayerParams::kBufferCount
+ * \brief Number of parameters buffers shared between the ISP and the IPA
+ */
+
 /**
  * \typedef DebayerParams::ColorLookupTable
  * \brief Type of the lookup tables for red, green, blue values
  */
 
+/**
+ * \var DebayerParams::generation
+ * \brief Generation of the lookup tables
+ *
+ * The IPA increments the generation every time it changes the content of the
+ * lookup tables, and the parameters buffers holding the same lookup tables
+ * have the same generation. Debayering implementations can thus skip loading
+ * the lookup tables when their generation is identical to the generation of
+ * the tables used for the previous frame. The generation 0 is reserved for
+ * tables that must always be loaded.
+ */
+
 /**
  * \var DebayerParams::red
  * \brief Lookup table for red color, mapping input values to output values
@@ -43,6 +67,69 @@ namespace libcamera {
  * \brief Lookup table for blue color, mapping input values to output values
  */
 
+/**
+ * \struct DebayerParams::CcmColumn
+ * \brief Contribution of an input color value to the red, green and blue
+ * output values
+ *
+ * The contributions are expressed in units of DebayerParams::kGammaLookupSize
+ * / 256 of an 8-bit value, the sum of the contributions of the three input
+ * colors is the index in the gamma lookup table.
+ *
+ * \var DebayerParams::CcmColumn::r
+ * \brief Contribution to the red output value
+ *
+ * \var DebayerParams::CcmColumn::g
+ * \brief Contribution to the green output value
+ *
+ * \var DebayerParams::CcmColumn::b
+ * \brief Contribution to the blue output value
+ */
+
+/**
+ * \typedef DebayerParams::CcmLookupTable
+ * \brief Type of the lookup tables for the color correction of red, green,
+ * blue values
+ */
+
+/**
+ * \typedef DebayerParams::GammaLookupTable
+ * \brief Type of the gamma lookup table
+ */
+
+/**
+ * \var DebayerParams::ccmEnabled
+ * \brief Apply the color correction lookup tables and the gamma lookup table
+ * instead of the red, green and blue lookup tables
+ *
+ * A 3x3 color correction matrix is applied with three lookups and additions
+ * per output value, by folding the white balance gains, the black level and
+ * the matrix coefficients in per-color lookup tables. The red, green and blue
+ * lookup tables must still be filled for the debayering implementations that
+ * don't support color correction.
+ */
+
+/**
+ * \var DebayerParams::redCcm
+ * \brief Color correction lookup table for red input values
+ */
+
+/**
+ * \var DebayerParams::greenCcm
+ * \brief Color correction lookup table for green input values
+ */
+
+/**
+ * \var DebayerParams::blueCcm
+ * \brief Color correction lookup table for blue input values
+ */
+
+/**
+ * \var DebayerParams::gammaLut
+ * \brief Gamma lookup table, mapping the sums of the color corrected
+ * contributions to output values
+ */
+
 /**
  * \class Debayer
  * \brief Base debayering class
@@ -94,25 +181,161 @@ Debayer::~Debayer()
  */
 
 /**
- * \fn void Debayer::process(FrameBuffer *input, FrameBuffer *output, DebayerParams params)
+ * \fn void Debayer::process(FrameBuffer *input, const FlatMap<unsigned int, FrameBuffer *> &outputs, const DebayerParams *params)
  * \brief Process the bayer data into the requested format.
  * \param[in] input The input buffer.
- * \param[in] output The output buffer.
+ * \param[in] outputs The output buffers, by output index.
  * \param[in] params The parameters to be used in debayering.
  *
- * \note DebayerParams is passed by value deliberately so that a copy is passed
- * when this is run in another thread by invokeMethod().
+ * All configured outputs are produced from a single pass over the input. The
+ * \a outputs may contain a subset of the configured outputs only, in which
+ * case the other ones are not written.
+ *
+ * The \a params point to one of the parameters buffers shared with the IPA.
+ * They are read when processing starts, the IPA must not modify the buffer
+ * until the frame has been processed.
  */
 
+/**
+ * \brief Complete a frame without processing it.
+ * \param[in] input The input buffer.
+ * \param[in] outputs The output buffers, by output index.
+ *
+ * The output buffers are completed with the FrameCancelled status, and the
+ * input buffer is released, in the same order as process() would. This is used
+ * to drop frames when processing can't keep up with the frame rate, and must be
+ * called in the thread process() is called from to preserve the frame order.
+ */
+void Debayer::cancel(FrameBuffer *input,
+		     const FlatMap<unsigned int, FrameBuffer *> &outputs)
+{
+	for (auto [index, output] : outputs) {
+		FrameMetadata &metadata = output->_d()->metadata();
+		metadata.status = FrameMetadata::FrameCancelled;
+		metadata.sequence = input->metadata().sequence;
+		metadata.timestamp = input->metadata().timestamp;
+
+		outputBufferReady.emit(output);
+	}
+
+	inputBufferReady.emit(input);
+}
+
 /**
  * \fn virtual SizeRange Debayer::sizes(PixelFormat inputFormat, const Size &inputSize)
  * \brief Get the supported output sizes for the given input format and size.
  * \param[in] inputFormat The input format.
  * \param[in] inputSize The input size.
  *
+ * Output sizes smaller than the input may be produced by cropping the center of
+ * the input, or by downscaling it when the implementation supports it.
+ *
  * \return The valid size ranges or an empty range if there are none.
  */
 
+/**
+ * \fn const SharedFD &Debayer::getStatsFD()
+ * \brief Get the file descriptor for the statistics.
+ *
+ * \return The file descriptor pointing to the statistics.
+ */
+
+/**
+ * \fn void Debayer::setStatsSampling(unsigned int frameInterval, unsigned int xSubsampling)
+ * \brief Set the statistics sampling rates
+ * \param[in] frameInterval Gather statistics on one frame out of frameInterval
+ * \param[in] xSubsampling Subsampling factor of the statistics on each line
+ *
+ * \sa SwStatsCpu::setSampling()
+ */
+
+/**
+ * \fn unsigned int Debayer::frameSize(unsigned int output)
+ * \brief Get the output frame size.
+ * \param[in] output The output index.
+ *
+ * \return The output frame size.
+ */
+
+/**
+ * \fn const std::vector<unsigned int> &Debayer::planeSizes(unsigned int output)
+ * \brief Get the sizes of the planes of the output frame.
+ * \param[in] output The output index.
+ *
+ * \return The output plane sizes, stored contiguously in the frame.
+ */
+
+/**
+ * \brief Get the maximum number of outputs produced concurrently.
+ *
+ * The default implementation supports a single output.
+ *
+ * \return The maximum number of outputs.
+ */
+unsigned int Debayer::maxOutputs() const
+{
+	return 1;
+}
+
+/**
+ * \brief Get the size closest to \a size an additional output can be produced at.
+ * \param[in] firstSize The size of the first output.
+ * \param[in] size The requested size of the additional output.
+ *
+ * Additional outputs are produced from the data debayered for the first output,
+ * their sizes are thus constrained by the size of the first output. This
+ * function is only meaningful for implementations supporting multiple outputs,
+ * the default implementation returns \a firstSize.
+ *
+ * \return The closest supported size not larger than \a size when possible.
+ */
+Size Debayer::outputSize(const Size &firstSize, [[maybe_unused]] const Size &size)
+{
+	return firstSize;
+}
+
+/**
+ * \brief Set the number of stripes to split frames in.
+ * \param[in] stripes The number of stripes.
+ *
+ * Splitting frames in stripes processed concurrently is an optimization
+ * specific to some implementations. The default implementation ignores the
+ * \a stripes.
+ */
+void Debayer::setStripes([[maybe_unused]] unsigned int stripes)
+{
+}
+
+/**
+ * \fn utils::Duration Debayer::processingTime() const
+ * \brief Get the time taken to process the last frame.
+ *
+ * The value is updated before emitting the outputBufferReady signal, it can be
+ * retrieved from the signal handlers.
+ *
+ * \return The processing time of the last frame.
+ */
+
+/**
+ * \fn utils::Duration Debayer::statsTime() const
+ * \brief Get the time spent gathering statistics for the last frame.
+ *
+ * The statistics time is included in the processing time. Like the processing
+ * time, it can be retrieved from the outputBufferReady signal handlers.
+ *
+ * \return The statistics time of the last frame.
+ */
+
+/**
+ * \var Debayer::processingTime_
+ * \brief The processing time of the last frame, set by the implementations.
+ */
+
+/**
+ * \var Debayer::statsTime_
+ * \brief The statistics time of the last frame, set by the implementations.
+ */
+
 /**
  * \var Signal<FrameBuffer *> Debayer::inputBufferReady
  * \brief Signals when the input buffer is ready.
@@ -12,9 +12,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <vector>
 
+#include <libcamera/base/flat_map.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/shared_fd.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/geometry.h>
 #include <libcamera/stream.h>
@@ -27,7 +32,7 @@ class FrameBuffer;
 
 LOG_DECLARE_CATEGORY(Debayer)
 
-class Debayer
+class Debayer : public Object
 {
 public:
 	virtual ~Debayer() = 0;
@@ -40,13 +45,35 @@ public:
 	virtual std::tuple<unsigned int, unsigned int>
 	strideAndFrameSize(const PixelFormat &outputFormat, const Size &size) = 0;
 
-	virtual void process(FrameBuffer *input, FrameBuffer *output, DebayerParams params) = 0;
+	virtual void process(FrameBuffer *input,
+			     const FlatMap<unsigned int, FrameBuffer *> &outputs,
+			     const DebayerParams *params) = 0;
+	void cancel(FrameBuffer *input,
+		    const FlatMap<unsigned int, FrameBuffer *> &outputs);
 
 	virtual SizeRange sizes(PixelFormat inputFormat, const Size &inputSize) = 0;
 
+	virtual const SharedFD &getStatsFD() = 0;
+	virtual void setStatsSampling(unsigned int frameInterval,
+				      unsigned int xSubsampling) = 0;
+	virtual unsigned int frameSize(unsigned int output) = 0;
+	virtual const std::vector<unsigned int> &planeSizes(unsigned int output) = 0;
+
+	virtual unsigned int maxOutputs() const;
+	virtual Size outputSize(const Size &firstSize, const Size &size);
+
+	virtual void setStripes(unsigned int stripes);
+
+	utils::Duration processingTime() const { return processingTime_; }
+	utils::Duration statsTime() const { return statsTime_; }
+
 	Signal<FrameBuffer *> inputBufferReady;
 	Signal<FrameBuffer *> outputBufferReady;
 
+protected:
+	utils::Duration processingTime_;
+	utils::Duration statsTime_;
+
 private:
 	virtual Size patternSize(PixelFormat inputFormat) = 0;
 };
@@ -11,14 +11,33 @@
 
 #include "debayer_cpu.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <errno.h>
+#include <limits>
+#include <map>
+#include <optional>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/base/utils.h>
+
+#include <libcamera/color_space.h>
 #include <libcamera/formats.h>
 
 #include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/dma_buf_allocator.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/tracepoints.h"
 
 namespace libcamera {
 
@@ -40,24 +59,93 @@ DebayerCpu::DebayerCpu(std::unique_ptr<SwStatsCpu> stats)
 	 * Reading from uncached buffers may be very slow.
 	 * In such a case, it's better to copy input buffer data to normal memory.
 	 * But in case of cached buffers, copying the data is unnecessary overhead.
-	 * enable_input_memcpy_ makes this behavior configurable.  At the moment, we
-	 * always set it to true as the safer choice but this should be changed in
-	 * future.
+	 * The fastest input strategy is selected automatically by timing them
+	 * on the first frames, unless the LIBCAMERA_SOFTISP_INPUT_STRATEGY
+	 * environment variable selects one explicitly.
+	 */
+	inputStrategy_ = InputStrategy::Memcpy;
+	autoInputStrategy_ = true;
+
+	const char *strategy = utils::secure_getenv("LIBCAMERA_SOFTISP_INPUT_STRATEGY");
+	if (strategy) {
+		static const std::map<std::string, InputStrategy> strategies = {
+			{ "direct", InputStrategy::Direct },
+			{ "memcpy", InputStrategy::Memcpy },
+			{ "stream", InputStrategy::Stream },
+			{ "sync", InputStrategy::Sync },
+		};
+
+		auto it = strategies.find(strategy);
+		if (it != strategies.end()) {
+			inputStrategy_ = it->second;
+			autoInputStrategy_ = false;
+		} else if (strcmp(strategy, "auto")) {
+			LOG(Debayer, Warning)
+				<< "Unknown input strategy " << strategy;
+		}
+	}
+
+	inputTrialFrame_ = 0;
+
+	/*
+	 * The SIMD debayer functions are used by default when supported by the
+	 * CPU. They can be disabled to compare with the scalar reference
+	 * implementation.
 	 */
-	enableInputMemcpy_ = true;
+	enableSimd_ = !utils::secure_getenv("LIBCAMERA_SOFTISP_DISABLE_SIMD");
 
 	/* Initialize color lookup tables */
 	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++)
 		red_[i] = green_[i] = blue_[i] = i;
+	ccmEnabled_ = false;
+	tablesGeneration_ = 0;
 
-	for (unsigned int i = 0; i < kMaxLineBuffers; i++)
-		lineBuffers_[i] = nullptr;
+	binning_ = 1;
+	maxScale_ = 1;
+	stripeCount_ = 1;
 }
 
 DebayerCpu::~DebayerCpu()
 {
-	for (unsigned int i = 0; i < kMaxLineBuffers; i++)
-		free(lineBuffers_[i]);
+	stopWorkers();
+}
+
+/*
+ * Worker debayering one stripe of the frame in its own thread, concurrently
+ * with the other stripes.
+ */
+class DebayerCpu::StripeWorker : public Object
+{
+public:
+	StripeWorker(DebayerCpu *debayer)
+		: debayer_(debayer)
+	{
+	}
+
+	void process(const uint8_t *src, unsigned int index)
+	{
+		debayer_->processStripe(src, debayer_->stripes_[index]);
+		debayer_->stripesDone_.release();
+	}
+
+private:
+	DebayerCpu *debayer_;
+};
+
+/**
+ * \brief Set the number of stripes to split frames in
+ * \param[in] stripes The number of stripes
+ *
+ * Frames are split in horizontal stripes which are debayered concurrently,
+ * the first stripe in the thread process() is called from and the other ones
+ * in dedicated worker threads. The number of stripes is reduced if the frame
+ * is too small to be split in the requested number of stripes.
+ *
+ * The new number of stripes takes effect at the next configure() call.
+ */
+void DebayerCpu::setStripes(unsigned int stripes)
+{
+	stripeCount_ = std::max(stripes, 1U);
 }
 
 #define DECLARE_SRC_POINTERS(pixel_t)                            \
@@ -65,15 +153,48 @@ DebayerCpu::~DebayerCpu()
 	const pixel_t *curr = (const pixel_t *)src[1] + xShift_; \
 	const pixel_t *next = (const pixel_t *)src[2] + xShift_;
 
+/*
+ * Store a debayered pixel. Without color correction, the red, green and blue
+ * values go through the per-color lookup tables, which hold the white balance
+ * gains, the black level and the gamma curve. With color correction, the
+ * lookup tables give the contributions of each input color to the three output
+ * colors, with the gains and black level folded in, and the sums of the
+ * contributions go through the gamma lookup table. This applies the 3x3 matrix
+ * with 9 lookups and 6 additions per pixel, without any multiplication.
+ */
+template<bool ccmEnabled>
+inline uint8_t *DebayerCpu::storeBGR888(uint8_t *dst, unsigned int b,
+					unsigned int g, unsigned int r)
+{
+	if constexpr (ccmEnabled) {
+		constexpr int maxIndex = DebayerParams::kGammaLookupSize - 1;
+		const DebayerParams::CcmColumn &blue = blueCcm_[b];
+		const DebayerParams::CcmColumn &green = greenCcm_[g];
+		const DebayerParams::CcmColumn &red = redCcm_[r];
+
+		*dst++ = gammaLut_[std::clamp(blue.b + green.b + red.b, 0, maxIndex)];
+		*dst++ = gammaLut_[std::clamp(blue.g + green.g + red.g, 0, maxIndex)];
+		*dst++ = gammaLut_[std::clamp(blue.r + green.r + red.r, 0, maxIndex)];
+	} else {
+		*dst++ = blue_[b];
+		*dst++ = green_[g];
+		*dst++ = red_[r];
+	}
+
+	return dst;
+}
+
 /*
  * RGR
  * GBG
  * RGR
  */
-#define BGGR_BGR888(p, n, div)                                                                \
-	*dst++ = blue_[curr[x] / (div)];                                                      \
-	*dst++ = green_[(prev[x] + curr[x - p] + curr[x + n] + next[x]) / (4 * (div))];       \
-	*dst++ = red_[(prev[x - p] + prev[x + n] + next[x - p] + next[x + n]) / (4 * (div))]; \
+#define BGGR_BGR888(p, n, div)                                                              \
+	dst = storeBGR888<ccmEnabled>(dst, curr[x] / (div),                                 \
+				      (prev[x] + curr[x - p] + curr[x + n] + next[x]) /     \
+					      (4 * (div)),                                  \
+				      (prev[x - p] + prev[x + n] + next[x - p] + next[x + n]) / \
+					      (4 * (div)));                                 \
 	x++;
 
 /*
@@ -81,10 +202,10 @@ DebayerCpu::~DebayerCpu()
  * RGR
  * GBG
  */
-#define GRBG_BGR888(p, n, div)                                    \
-	*dst++ = blue_[(prev[x] + next[x]) / (2 * (div))];        \
-	*dst++ = green_[curr[x] / (div)];                         \
-	*dst++ = red_[(curr[x - p] + curr[x + n]) / (2 * (div))]; \
+#define GRBG_BGR888(p, n, div)                                                   \
+	dst = storeBGR888<ccmEnabled>(dst, (prev[x] + next[x]) / (2 * (div)),    \
+				      curr[x] / (div),                           \
+				      (curr[x - p] + curr[x + n]) / (2 * (div))); \
 	x++;
 
 /*
@@ -92,10 +213,10 @@ DebayerCpu::~DebayerCpu()
  * BGB
  * GRG
  */
-#define GBRG_BGR888(p, n, div)                                     \
-	*dst++ = blue_[(curr[x - p] + curr[x + n]) / (2 * (div))]; \
-	*dst++ = green_[curr[x] / (div)];                          \
-	*dst++ = red_[(prev[x] + next[x]) / (2 * (div))];          \
+#define GBRG_BGR888(p, n, div)                                                        \
+	dst = storeBGR888<ccmEnabled>(dst, (curr[x - p] + curr[x + n]) / (2 * (div)), \
+				      curr[x] / (div),                                \
+				      (prev[x] + next[x]) / (2 * (div)));             \
 	x++;
 
 /*
@@ -103,12 +224,16 @@ DebayerCpu::~DebayerCpu()
  * GRG
  * BGB
  */
-#define RGGB_BGR888(p, n, div)                                                                 \
-	*dst++ = blue_[(prev[x - p] + prev[x + n] + next[x - p] + next[x + n]) / (4 * (div))]; \
-	*dst++ = green_[(prev[x] + curr[x - p] + curr[x + n] + next[x]) / (4 * (div))];        \
-	*dst++ = red_[curr[x] / (div)];                                                        \
+#define RGGB_BGR888(p, n, div)                                                              \
+	dst = storeBGR888<ccmEnabled>(dst,                                                  \
+				      (prev[x - p] + prev[x + n] + next[x - p] + next[x + n]) / \
+					      (4 * (div)),                                  \
+				      (prev[x] + curr[x - p] + curr[x + n] + next[x]) /     \
+					      (4 * (div)),                                  \
+				      curr[x] / (div));                                     \
 	x++;
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer8_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint8_t)
@@ -119,6 +244,7 @@ void DebayerCpu::debayer8_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer8_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint8_t)
@@ -129,6 +255,7 @@ void DebayerCpu::debayer8_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint16_t)
@@ -140,6 +267,7 @@ void DebayerCpu::debayer10_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint16_t)
@@ -151,6 +279,7 @@ void DebayerCpu::debayer10_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer12_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint16_t)
@@ -162,6 +291,7 @@ void DebayerCpu::debayer12_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer12_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	DECLARE_SRC_POINTERS(uint16_t)
@@ -173,6 +303,7 @@ void DebayerCpu::debayer12_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10P_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	const int widthInBytes = window_.width * 5 / 4;
@@ -198,6 +329,7 @@ void DebayerCpu::debayer10P_BGBG_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10P_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	const int widthInBytes = window_.width * 5 / 4;
@@ -218,6 +350,7 @@ void DebayerCpu::debayer10P_GRGR_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10P_GBGB_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	const int widthInBytes = window_.width * 5 / 4;
@@ -238,6 +371,7 @@ void DebayerCpu::debayer10P_GBGB_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+template<bool ccmEnabled>
 void DebayerCpu::debayer10P_RGRG_BGR888(uint8_t *dst, const uint8_t *src[])
 {
 	const int widthInBytes = window_.width * 5 / 4;
@@ -258,12 +392,484 @@ void DebayerCpu::debayer10P_RGRG_BGR888(uint8_t *dst, const uint8_t *src[])
 	}
 }
 
+/*
+ * Vectorized debayering
+ *
+ * The SIMD line functions compute the same bilinear interpolation as the
+ * scalar functions above, 8 (SSE4.1, NEON) or 16 (AVX2) pixels at a time, in
+ * 16-bit lanes. For every pixel of the line, the following sums are computed:
+ *
+ * - c: the pixel itself
+ * - h: the left and right neighbours
+ * - v: the top and bottom neighbours
+ * - x: the left, right, top and bottom neighbours (h + v)
+ * - d: the four diagonal neighbours
+ *
+ * For a BGBG line, even pixels are blue and odd pixels green. For a GRGR line,
+ * even pixels are green and odd pixels red. The blue, green and red values are
+ * then selected from the sums based on the pixel parity, narrowed to 8 bits and
+ * fed through the color lookup tables. The lookup tables can't be vectorized
+ * efficiently, they are applied in a scalar loop which the compiler unrolls.
+ *
+ * Swapping the blue and red values turns a BGBG line into a RGRG line and a
+ * GRGR line into a GBGB line. The remaining pixels of a line that don't fill a
+ * full vector are processed with the scalar code.
+ *
+ * The x86 implementations use function target attributes to avoid requiring
+ * specific compiler flags, and are selected at runtime based on the CPU
+ * features. NEON is mandatory on arm64 and is enabled at compile time.
+ */
+
+template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+	 bool ccmEnabled>
+void DebayerCpu::debayerTail_BGR888(uint8_t *dst, const pixel_t *prev,
+				    const pixel_t *curr, const pixel_t *next,
+				    int x)
+{
+	constexpr unsigned int div = 1 << shift;
+
+	while (x < (int)window_.width) {
+		if constexpr (bgLine && !swapRB) {
+			BGGR_BGR888(1, 1, div)
+			GBRG_BGR888(1, 1, div)
+		} else if constexpr (!bgLine && !swapRB) {
+			GRBG_BGR888(1, 1, div)
+			RGGB_BGR888(1, 1, div)
+		} else if constexpr (bgLine && swapRB) {
+			RGGB_BGR888(1, 1, div)
+			GRBG_BGR888(1, 1, div)
+		} else {
+			GBRG_BGR888(1, 1, div)
+			BGGR_BGR888(1, 1, div)
+		}
+	}
+}
+
+template<bool ccmEnabled>
+uint8_t *DebayerCpu::lookupBGR888(uint8_t *dst, const uint8_t *b, const uint8_t *g,
+				  const uint8_t *r, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+		dst = storeBGR888<ccmEnabled>(dst, b[i], g[i], r[i]);
+
+	return dst;
+}
+
+/*
+ * The color channels of each output pixel are the averages of the input pixels
+ * of the same color in a factor x factor block, without any interpolation.
+ * This fuses binning with debayering: the input is read once, and the cost
+ * scales with the output size instead of the input size.
+ */
+template<typename pixel_t, unsigned int shift, unsigned int factor,
+	 bool ccmEnabled>
+void DebayerCpu::bin_BGR888(uint8_t *dst, const uint8_t *src[])
+{
+	/* Each block holds (factor / 2)^2 2x2 patterns */
+	constexpr unsigned int sumShift = shift + (factor == 4 ? 2 : 0);
+	const unsigned int bx = binBlueX_;
+	const unsigned int by = binBlueY_;
+
+	for (unsigned int x = 0; x < outputs_[0].size.width; x++) {
+		unsigned int sumB = 0;
+		unsigned int sumG = 0;
+		unsigned int sumR = 0;
+
+		for (unsigned int j = 0; j < factor; j += 2) {
+			/* Lines holding the blue and the red pixels */
+			const pixel_t *bLine = (const pixel_t *)src[j + by] + x * factor;
+			const pixel_t *rLine = (const pixel_t *)src[j + 1 - by] + x * factor;
+
+			for (unsigned int i = 0; i < factor; i += 2) {
+				sumB += bLine[i + bx];
+				sumG += bLine[i + 1 - bx] + rLine[i + bx];
+				sumR += rLine[i + 1 - bx];
+			}
+		}
+
+		dst = storeBGR888<ccmEnabled>(dst, sumB >> sumShift,
+					      sumG >> (sumShift + 1), sumR >> sumShift);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define DEBAYER_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define DEBAYER_TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace {
+
+/*
+ * Copy with non-temporal loads, which read write-combining memory a cache line
+ * at a time without polluting the caches.
+ */
+DEBAYER_TARGET_SSE41 void streamCopy(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	/* Streaming loads require 16 bytes aligned addresses */
+	const size_t head = std::min<size_t>(-reinterpret_cast<uintptr_t>(src) & 15, size);
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 16; size -= 16, src += 16, dst += 16) {
+		__m128i *p = reinterpret_cast<__m128i *>(const_cast<uint8_t *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_stream_load_si128(p));
+	}
+
+	memcpy(dst, src, size);
+}
+
+/* Load 8 pixels widened to 16 bits */
+DEBAYER_TARGET_SSE41 inline __m128i loadSse41(const uint8_t *p)
+{
+	return _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+}
+
+DEBAYER_TARGET_SSE41 inline __m128i loadSse41(const uint16_t *p)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+template<typename pixel_t, unsigned int shift, bool bgLine>
+DEBAYER_TARGET_SSE41 inline void
+interpolateSse41(const pixel_t *prev, const pixel_t *curr, const pixel_t *next,
+		 uint8_t *b, uint8_t *g, uint8_t *r)
+{
+	const __m128i hsum = _mm_add_epi16(loadSse41(curr - 1), loadSse41(curr + 1));
+	const __m128i vsum = _mm_add_epi16(loadSse41(prev), loadSse41(next));
+	const __m128i dsum = _mm_add_epi16(_mm_add_epi16(loadSse41(prev - 1), loadSse41(prev + 1)),
+					   _mm_add_epi16(loadSse41(next - 1), loadSse41(next + 1)));
+
+	const __m128i c = _mm_srli_epi16(loadSse41(curr), shift);
+	const __m128i h = _mm_srli_epi16(hsum, shift + 1);
+	const __m128i v = _mm_srli_epi16(vsum, shift + 1);
+	const __m128i x = _mm_srli_epi16(_mm_add_epi16(hsum, vsum), shift + 2);
+	const __m128i d = _mm_srli_epi16(dsum, shift + 2);
+
+	/* Take the even pixels from the first and odd pixels from the second operand */
+	__m128i bv, gv, rv;
+	if constexpr (bgLine) {
+		bv = _mm_blend_epi16(c, h, 0xaa);
+		gv = _mm_blend_epi16(x, c, 0xaa);
+		rv = _mm_blend_epi16(d, v, 0xaa);
+	} else {
+		bv = _mm_blend_epi16(v, d, 0xaa);
+		gv = _mm_blend_epi16(c, x, 0xaa);
+		rv = _mm_blend_epi16(h, c, 0xaa);
+	}
+
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(b), _mm_packus_epi16(bv, bv));
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(g), _mm_packus_epi16(gv, gv));
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(r), _mm_packus_epi16(rv, rv));
+}
+
+/* Load 16 pixels widened to 16 bits */
+DEBAYER_TARGET_AVX2 inline __m256i loadAvx2(const uint8_t *p)
+{
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+DEBAYER_TARGET_AVX2 inline __m256i loadAvx2(const uint16_t *p)
+{
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+/* Narrow 16 pixels to 8 bits and store them */
+DEBAYER_TARGET_AVX2 inline void storeAvx2(uint8_t *p, __m256i v)
+{
+	/* packus operates on 128-bit lanes, gather the two results together */
+	v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(v));
+}
+
+template<typename pixel_t, unsigned int shift, bool bgLine>
+DEBAYER_TARGET_AVX2 inline void
+interpolateAvx2(const pixel_t *prev, const pixel_t *curr, const pixel_t *next,
+		uint8_t *b, uint8_t *g, uint8_t *r)
+{
+	const __m256i hsum = _mm256_add_epi16(loadAvx2(curr - 1), loadAvx2(curr + 1));
+	const __m256i vsum = _mm256_add_epi16(loadAvx2(prev), loadAvx2(next));
+	const __m256i dsum = _mm256_add_epi16(_mm256_add_epi16(loadAvx2(prev - 1), loadAvx2(prev + 1)),
+					      _mm256_add_epi16(loadAvx2(next - 1), loadAvx2(next + 1)));
+
+	const __m256i c = _mm256_srli_epi16(loadAvx2(curr), shift);
+	const __m256i h = _mm256_srli_epi16(hsum, shift + 1);
+	const __m256i v = _mm256_srli_epi16(vsum, shift + 1);
+	const __m256i x = _mm256_srli_epi16(_mm256_add_epi16(hsum, vsum), shift + 2);
+	const __m256i d = _mm256_srli_epi16(dsum, shift + 2);
+
+	/* Take the even pixels from the first and odd pixels from the second operand */
+	if constexpr (bgLine) {
+		storeAvx2(b, _mm256_blend_epi16(c, h, 0xaa));
+		storeAvx2(g, _mm256_blend_epi16(x, c, 0xaa));
+		storeAvx2(r, _mm256_blend_epi16(d, v, 0xaa));
+	} else {
+		storeAvx2(b, _mm256_blend_epi16(v, d, 0xaa));
+		storeAvx2(g, _mm256_blend_epi16(c, x, 0xaa));
+		storeAvx2(r, _mm256_blend_epi16(h, c, 0xaa));
+	}
+}
+
+} /* namespace */
+
+template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+	 bool ccmEnabled>
+DEBAYER_TARGET_SSE41 void DebayerCpu::debayerSse41_BGR888(uint8_t *dst, const uint8_t *src[])
+{
+	DECLARE_SRC_POINTERS(pixel_t)
+
+	int x = 0;
+	for (; x + 8 <= (int)window_.width; x += 8) {
+		uint8_t b[8], g[8], r[8];
+
+		interpolateSse41<pixel_t, shift, bgLine>(prev + x, curr + x, next + x,
+							 swapRB ? r : b, g, swapRB ? b : r);
+		dst = lookupBGR888<ccmEnabled>(dst, b, g, r, 8);
+	}
+
+	debayerTail_BGR888<pixel_t, shift, bgLine, swapRB, ccmEnabled>(dst, prev, curr,
+								       next, x);
+}
+
+template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+	 bool ccmEnabled>
+DEBAYER_TARGET_AVX2 void DebayerCpu::debayerAvx2_BGR888(uint8_t *dst, const uint8_t *src[])
+{
+	DECLARE_SRC_POINTERS(pixel_t)
+
+	int x = 0;
+	for (; x + 16 <= (int)window_.width; x += 16) {
+		uint8_t b[16], g[16], r[16];
+
+		interpolateAvx2<pixel_t, shift, bgLine>(prev + x, curr + x, next + x,
+							 swapRB ? r : b, g, swapRB ? b : r);
+		dst = lookupBGR888<ccmEnabled>(dst, b, g, r, 16);
+	}
+
+	debayerTail_BGR888<pixel_t, shift, bgLine, swapRB, ccmEnabled>(dst, prev, curr,
+								       next, x);
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+#if defined(__ARM_NEON)
+
+namespace {
+
+/* Load 8 pixels widened to 16 bits */
+inline uint16x8_t loadNeon(const uint8_t *p)
+{
+	return vmovl_u8(vld1_u8(p));
+}
+
+inline uint16x8_t loadNeon(const uint16_t *p)
+{
+	return vld1q_u16(p);
+}
+
+template<typename pixel_t, unsigned int shift, bool bgLine>
+inline void interpolateNeon(const pixel_t *prev, const pixel_t *curr, const pixel_t *next,
+			    uint8_t *b, uint8_t *g, uint8_t *r)
+{
+	static const uint16_t oddPixels[8] = { 0, 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff };
+	const uint16x8_t odd = vld1q_u16(oddPixels);
+
+	const uint16x8_t hsum = vaddq_u16(loadNeon(curr - 1), loadNeon(curr + 1));
+	const uint16x8_t vsum = vaddq_u16(loadNeon(prev), loadNeon(next));
+	const uint16x8_t dsum = vaddq_u16(vaddq_u16(loadNeon(prev - 1), loadNeon(prev + 1)),
+					  vaddq_u16(loadNeon(next - 1), loadNeon(next + 1)));
+
+	/* A left shift by a negative amount shifts right */
+	const uint16x8_t c = vshlq_u16(loadNeon(curr), vdupq_n_s16(-(int)shift));
+	const uint16x8_t h = vshlq_u16(hsum, vdupq_n_s16(-(int)(shift + 1)));
+	const uint16x8_t v = vshlq_u16(vsum, vdupq_n_s16(-(int)(shift + 1)));
+	const uint16x8_t x = vshlq_u16(vaddq_u16(hsum, vsum), vdupq_n_s16(-(int)(shift + 2)));
+	const uint16x8_t d = vshlq_u16(dsum, vdupq_n_s16(-(int)(shift + 2)));
+
+	/* Take the odd pixels from the first and even pixels from the second operand */
+	if constexpr (bgLine) {
+		vst1_u8(b, vqmovn_u16(vbslq_u16(odd, h, c)));
+		vst1_u8(g, vqmovn_u16(vbslq_u16(odd, c, x)));
+		vst1_u8(r, vqmovn_u16(vbslq_u16(odd, v, d)));
+	} else {
+		vst1_u8(b, vqmovn_u16(vbslq_u16(odd, d, v)));
+		vst1_u8(g, vqmovn_u16(vbslq_u16(odd, x, c)));
+		vst1_u8(r, vqmovn_u16(vbslq_u16(odd, c, h)));
+	}
+}
+
+} /* namespace */
+
+template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+	 bool ccmEnabled>
+void DebayerCpu::debayerNeon_BGR888(uint8_t *dst, const uint8_t *src[])
+{
+	DECLARE_SRC_POINTERS(pixel_t)
+
+	int x = 0;
+	for (; x + 8 <= (int)window_.width; x += 8) {
+		uint8_t b[8], g[8], r[8];
+
+		interpolateNeon<pixel_t, shift, bgLine>(prev + x, curr + x, next + x,
+							 swapRB ? r : b, g, swapRB ? b : r);
+		dst = lookupBGR888<ccmEnabled>(dst, b, g, r, 8);
+	}
+
+	debayerTail_BGR888<pixel_t, shift, bgLine, swapRB, ccmEnabled>(dst, prev, curr,
+								       next, x);
+}
+
+#endif /* __ARM_NEON */
+
+/*
+ * Replace the scalar debayer functions with their vectorized counterparts if
+ * the CPU supports them. Return true if SIMD functions are used, false
+ * otherwise.
+ */
+template<bool ccmEnabled>
+bool DebayerCpu::setSimdDebayerFunctions(const BayerFormat &bayerFormat)
+{
+	struct SimdFunctions {
+		/* BGBG and GRGR functions, indexed by (bitDepth - 8) / 2 */
+		debayerFn unpacked[3][2];
+		/* 8-bit functions for BGBG, GRGR, GBGB and RGRG lines */
+		debayerFn narrow[4];
+	};
+
+#define DEBAYER_SIMD_FUNCTIONS(isa)                                                         \
+	{ { { &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, true, false, ccmEnabled>,      \
+	      &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, false, false, ccmEnabled> },   \
+	    { &DebayerCpu::debayer##isa##_BGR888<uint16_t, 2, true, false, ccmEnabled>,     \
+	      &DebayerCpu::debayer##isa##_BGR888<uint16_t, 2, false, false, ccmEnabled> },  \
+	    { &DebayerCpu::debayer##isa##_BGR888<uint16_t, 4, true, false, ccmEnabled>,     \
+	      &DebayerCpu::debayer##isa##_BGR888<uint16_t, 4, false, false, ccmEnabled> } }, \
+	  { &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, true, false, ccmEnabled>,        \
+	    &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, false, false, ccmEnabled>,       \
+	    &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, false, true, ccmEnabled>,        \
+	    &DebayerCpu::debayer##isa##_BGR888<uint8_t, 0, true, true, ccmEnabled> } }
+
+	const SimdFunctions *functions = nullptr;
+	const char *isa = nullptr;
+
+	if (!enableSimd_)
+		return false;
+
+#if defined(__x86_64__) || defined(__i386__)
+	static const SimdFunctions avx2Functions = DEBAYER_SIMD_FUNCTIONS(Avx2);
+	static const SimdFunctions sse41Functions = DEBAYER_SIMD_FUNCTIONS(Sse41);
+
+	if (__builtin_cpu_supports("avx2")) {
+		functions = &avx2Functions;
+		isa = "AVX2";
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		functions = &sse41Functions;
+		isa = "SSE4.1";
+	}
+#elif defined(__ARM_NEON)
+	static const SimdFunctions neonFunctions = DEBAYER_SIMD_FUNCTIONS(Neon);
+
+	functions = &neonFunctions;
+	isa = "NEON";
+#endif
+
+#undef DEBAYER_SIMD_FUNCTIONS
+
+	if (!functions)
+		return false;
+
+	if (bayerFormat.packing == BayerFormat::Packing::None) {
+		const unsigned int index = (bayerFormat.bitDepth - 8) / 2;
+
+		debayer0_ = functions->unpacked[index][0];
+		debayer1_ = functions->unpacked[index][1];
+	} else {
+		const debayerFn *narrow = functions->narrow;
+
+		/*
+		 * CSI-2 packed 10-bit, narrowed to 8-bit unpacked when copied
+		 * to the line buffers.
+		 */
+		switch (bayerFormat.order) {
+		case BayerFormat::BGGR:
+			debayer0_ = narrow[0];
+			debayer1_ = narrow[1];
+			break;
+		case BayerFormat::GBRG:
+			debayer0_ = narrow[2];
+			debayer1_ = narrow[3];
+			break;
+		case BayerFormat::GRBG:
+			debayer0_ = narrow[1];
+			debayer1_ = narrow[0];
+			break;
+		case BayerFormat::RGGB:
+			debayer0_ = narrow[3];
+			debayer1_ = narrow[2];
+			break;
+		default:
+			return false;
+		}
+
+		narrowInput_ = true;
+	}
+
+	LOG(Debayer, Debug) << "Using " << isa << " debayer functions";
+
+	return true;
+}
+
 static bool isStandardBayerOrder(BayerFormat::Order order)
 {
 	return order == BayerFormat::BGGR || order == BayerFormat::GBRG ||
 	       order == BayerFormat::GRBG || order == BayerFormat::RGGB;
 }
 
+/*
+ * Select the binning function and locate the blue pixel in the Bayer pattern.
+ * CSI-2 packed input is narrowed to 8 bpp when copied to the line buffers.
+ */
+template<bool ccmEnabled>
+int DebayerCpu::setBinningFunctions(const BayerFormat &bayerFormat)
+{
+	if (!isStandardBayerOrder(bayerFormat.order))
+		return -EINVAL;
+
+	binBlueX_ = bayerFormat.order == BayerFormat::GBRG ||
+		    bayerFormat.order == BayerFormat::RGGB;
+	binBlueY_ = bayerFormat.order == BayerFormat::GRBG ||
+		    bayerFormat.order == BayerFormat::RGGB;
+
+	if (bayerFormat.packing == BayerFormat::Packing::CSI2) {
+		if (bayerFormat.bitDepth != 10)
+			return -EINVAL;
+
+		narrowInput_ = true;
+	} else if (bayerFormat.packing != BayerFormat::Packing::None) {
+		return -EINVAL;
+	}
+
+	const unsigned int bitDepth = narrowInput_ ? 8 : bayerFormat.bitDepth;
+
+	switch (bitDepth) {
+	case 8:
+		debayer0_ = binning_ == 4 ? &DebayerCpu::bin_BGR888<uint8_t, 0, 4, ccmEnabled>
+					  : &DebayerCpu::bin_BGR888<uint8_t, 0, 2, ccmEnabled>;
+		return 0;
+	case 10:
+		debayer0_ = binning_ == 4 ? &DebayerCpu::bin_BGR888<uint16_t, 2, 4, ccmEnabled>
+					  : &DebayerCpu::bin_BGR888<uint16_t, 2, 2, ccmEnabled>;
+		return 0;
+	case 12:
+		debayer0_ = binning_ == 4 ? &DebayerCpu::bin_BGR888<uint16_t, 4, 4, ccmEnabled>
+					  : &DebayerCpu::bin_BGR888<uint16_t, 4, 2, ccmEnabled>;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 /*
  * Setup the Debayer object according to the passed in parameters.
  * Return 0 on success, a negative errno value on failure
@@ -280,7 +886,8 @@ int DebayerCpu::getInputConfig(PixelFormat inputFormat, DebayerInputConfig &conf
 		config.bpp = (bayerFormat.bitDepth + 7) & ~7;
 		config.patternSize.width = 2;
 		config.patternSize.height = 2;
-		config.outputFormats = std::vector<PixelFormat>({ formats::RGB888, formats::BGR888 });
+		config.outputFormats = std::vector<PixelFormat>({ formats::RGB888, formats::BGR888,
+								  formats::NV12, formats::YUYV });
 		return 0;
 	}
 
@@ -290,7 +897,8 @@ int DebayerCpu::getInputConfig(PixelFormat inputFormat, DebayerInputConfig &conf
 		config.bpp = 10;
 		config.patternSize.width = 4; /* 5 bytes per *4* pixels */
 		config.patternSize.height = 2;
-		config.outputFormats = std::vector<PixelFormat>({ formats::RGB888, formats::BGR888 });
+		config.outputFormats = std::vector<PixelFormat>({ formats::RGB888, formats::BGR888,
+								  formats::NV12, formats::YUYV });
 		return 0;
 	}
 
@@ -306,6 +914,17 @@ int DebayerCpu::getOutputConfig(PixelFormat outputFormat, DebayerOutputConfig &c
 		return 0;
 	}
 
+	/* bpp of the first plane for multi-planar formats */
+	if (outputFormat == formats::NV12) {
+		config.bpp = 8;
+		return 0;
+	}
+
+	if (outputFormat == formats::YUYV) {
+		config.bpp = 16;
+		return 0;
+	}
+
 	LOG(Debayer, Info)
 		<< "Unsupported output format " << outputFormat.toString();
 	return -EINVAL;
@@ -337,6 +956,7 @@ int DebayerCpu::setupStandardBayerOrder(BayerFormat::Order order)
 	return 0;
 }
 
+template<bool ccmEnabled>
 int DebayerCpu::setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputFormat)
 {
 	BayerFormat bayerFormat =
@@ -344,6 +964,7 @@ int DebayerCpu::setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputF
 
 	xShift_ = 0;
 	swapRedBlueGains_ = false;
+	narrowInput_ = false;
 
 	auto invalidFmt = []() -> int {
 		LOG(Debayer, Error) << "Unsupported input output format combination";
@@ -353,6 +974,10 @@ int DebayerCpu::setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputF
 	switch (outputFormat) {
 	case formats::RGB888:
 		break;
+	case formats::NV12:
+	case formats::YUYV:
+		/* Debayer to RGB888 lines and convert them to YUV */
+		break;
 	case formats::BGR888:
 		/* Swap R and B in bayer order to generate BGR888 instead of RGB888 */
 		swapRedBlueGains_ = true;
@@ -378,45 +1003,53 @@ int DebayerCpu::setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputF
 		return invalidFmt();
 	}
 
+	if (binning_ > 1)
+		return setBinningFunctions<ccmEnabled>(bayerFormat) ? invalidFmt() : 0;
+
 	if ((bayerFormat.bitDepth == 8 || bayerFormat.bitDepth == 10 || bayerFormat.bitDepth == 12) &&
 	    bayerFormat.packing == BayerFormat::Packing::None &&
 	    isStandardBayerOrder(bayerFormat.order)) {
 		switch (bayerFormat.bitDepth) {
 		case 8:
-			debayer0_ = &DebayerCpu::debayer8_BGBG_BGR888;
-			debayer1_ = &DebayerCpu::debayer8_GRGR_BGR888;
+			debayer0_ = &DebayerCpu::debayer8_BGBG_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer8_GRGR_BGR888<ccmEnabled>;
 			break;
 		case 10:
-			debayer0_ = &DebayerCpu::debayer10_BGBG_BGR888;
-			debayer1_ = &DebayerCpu::debayer10_GRGR_BGR888;
+			debayer0_ = &DebayerCpu::debayer10_BGBG_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer10_GRGR_BGR888<ccmEnabled>;
 			break;
 		case 12:
-			debayer0_ = &DebayerCpu::debayer12_BGBG_BGR888;
-			debayer1_ = &DebayerCpu::debayer12_GRGR_BGR888;
+			debayer0_ = &DebayerCpu::debayer12_BGBG_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer12_GRGR_BGR888<ccmEnabled>;
 			break;
 		}
+		setSimdDebayerFunctions<ccmEnabled>(bayerFormat);
 		setupStandardBayerOrder(bayerFormat.order);
 		return 0;
 	}
 
 	if (bayerFormat.bitDepth == 10 &&
 	    bayerFormat.packing == BayerFormat::Packing::CSI2) {
+		if (isStandardBayerOrder(bayerFormat.order) &&
+		    setSimdDebayerFunctions<ccmEnabled>(bayerFormat))
+			return 0;
+
 		switch (bayerFormat.order) {
 		case BayerFormat::BGGR:
-			debayer0_ = &DebayerCpu::debayer10P_BGBG_BGR888;
-			debayer1_ = &DebayerCpu::debayer10P_GRGR_BGR888;
+			debayer0_ = &DebayerCpu::debayer10P_BGBG_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer10P_GRGR_BGR888<ccmEnabled>;
 			return 0;
 		case BayerFormat::GBRG:
-			debayer0_ = &DebayerCpu::debayer10P_GBGB_BGR888;
-			debayer1_ = &DebayerCpu::debayer10P_RGRG_BGR888;
+			debayer0_ = &DebayerCpu::debayer10P_GBGB_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer10P_RGRG_BGR888<ccmEnabled>;
 			return 0;
 		case BayerFormat::GRBG:
-			debayer0_ = &DebayerCpu::debayer10P_GRGR_BGR888;
-			debayer1_ = &DebayerCpu::debayer10P_BGBG_BGR888;
+			debayer0_ = &DebayerCpu::debayer10P_GRGR_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer10P_BGBG_BGR888<ccmEnabled>;
 			return 0;
 		case BayerFormat::RGGB:
-			debayer0_ = &DebayerCpu::debayer10P_RGRG_BGR888;
-			debayer1_ = &DebayerCpu::debayer10P_GBGB_BGR888;
+			debayer0_ = &DebayerCpu::debayer10P_RGRG_BGR888<ccmEnabled>;
+			debayer1_ = &DebayerCpu::debayer10P_GBGB_BGR888<ccmEnabled>;
 			return 0;
 		default:
 			break;
@@ -426,27 +1059,62 @@ int DebayerCpu::setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputF
 	return invalidFmt();
 }
 
-int DebayerCpu::configure(const StreamConfiguration &inputCfg,
-			  const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+/*
+ * Select the debayer functions for the configured formats, with or without
+ * color correction.
+ */
+int DebayerCpu::selectDebayerFunctions()
 {
-	if (getInputConfig(inputCfg.pixelFormat, inputConfig_) != 0)
-		return -EINVAL;
+	if (ccmEnabled_)
+		return setDebayerFunctions<true>(inputFormat_, outputFormat_);
+	else
+		return setDebayerFunctions<false>(inputFormat_, outputFormat_);
+}
+
+/*
+ * Compute the stride and plane sizes of an output, and check them against the
+ * output configuration.
+ */
+int DebayerCpu::configureOutput(Output &output, const StreamConfiguration &outputCfg)
+{
+	DebayerOutputConfig &config = output.config;
 
-	if (stats_->configure(inputCfg) != 0)
+	if (getOutputConfig(outputCfg.pixelFormat, config) != 0)
 		return -EINVAL;
 
-	const Size &statsPatternSize = stats_->patternSize();
-	if (inputConfig_.patternSize.width != statsPatternSize.width ||
-	    inputConfig_.patternSize.height != statsPatternSize.height) {
+	std::tie(config.stride, config.frameSize) =
+		strideAndFrameSize(outputCfg.pixelFormat, outputCfg.size);
+
+	if (config.stride != outputCfg.stride) {
 		LOG(Debayer, Error)
-			<< "mismatching stats and debayer pattern sizes for "
-			<< inputCfg.pixelFormat.toString();
+			<< "Invalid output stride " << outputCfg.stride
+			<< " for " << outputCfg.toString()
+			<< ", expected " << config.stride;
 		return -EINVAL;
 	}
 
+	output.size = outputCfg.size;
+	output.dst = nullptr;
+
+	config.planeSizes = { config.stride * output.size.height };
+	if (outputCfg.pixelFormat == formats::NV12)
+		config.planeSizes.push_back(config.stride * output.size.height / 2);
+
+	return 0;
+}
+
+int DebayerCpu::configure(const StreamConfiguration &inputCfg,
+			  const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	if (getInputConfig(inputCfg.pixelFormat, inputConfig_) != 0)
+		return -EINVAL;
+
 	inputConfig_.stride = inputCfg.stride;
 
-	if (outputCfgs.size() != 1) {
+	/* The color tables depend on the output format, reload them. */
+	tablesGeneration_ = 0;
+
+	if (outputCfgs.empty() || outputCfgs.size() > kMaxOutputs) {
 		LOG(Debayer, Error)
 			<< "Unsupported number of output streams: "
 			<< outputCfgs.size();
@@ -455,69 +1123,130 @@ int DebayerCpu::configure(const StreamConfiguration &inputCfg,
 
 	const StreamConfiguration &outputCfg = outputCfgs[0];
 	SizeRange outSizeRange = sizes(inputCfg.pixelFormat, inputCfg.size);
-	std::tie(outputConfig_.stride, outputConfig_.frameSize) =
-		strideAndFrameSize(outputCfg.pixelFormat, outputCfg.size);
 
-	if (!outSizeRange.contains(outputCfg.size) || outputConfig_.stride != outputCfg.stride) {
+	if (!outSizeRange.contains(outputCfg.size)) {
 		LOG(Debayer, Error)
-			<< "Invalid output size/stride: "
-			<< "\n  " << outputCfg.size << " (" << outSizeRange << ")"
-			<< "\n  " << outputCfg.stride << " (" << outputConfig_.stride << ")";
+			<< "Invalid output size " << outputCfg.size
+			<< " (" << outSizeRange << ")";
 		return -EINVAL;
 	}
 
-	if (setDebayerFunctions(inputCfg.pixelFormat, outputCfg.pixelFormat) != 0)
-		return -EINVAL;
-
-	window_.x = ((inputCfg.size.width - outputCfg.size.width) / 2) &
-		    ~(inputConfig_.patternSize.width - 1);
-	window_.y = ((inputCfg.size.height - outputCfg.size.height) / 2) &
-		    ~(inputConfig_.patternSize.height - 1);
-	window_.width = outputCfg.size.width;
-	window_.height = outputCfg.size.height;
-
-	/* Don't pass x,y since process() already adjusts src before passing it */
-	stats_->setWindow(Rectangle(window_.size()));
+	outputs_.resize(outputCfgs.size());
 
-	/* pad with patternSize.Width on both left and right side */
-	lineBufferPadding_ = inputConfig_.patternSize.width * inputConfig_.bpp / 8;
-	lineBufferLength_ = window_.width * inputConfig_.bpp / 8 +
-			    2 * lineBufferPadding_;
-	for (unsigned int i = 0;
-	     i < (inputConfig_.patternSize.height + 1) && enableInputMemcpy_;
-	     i++) {
-		free(lineBuffers_[i]);
-		lineBuffers_[i] = (uint8_t *)malloc(lineBufferLength_);
-		if (!lineBuffers_[i])
-			return -ENOMEM;
+	for (unsigned int i = 0; i < outputCfgs.size(); i++) {
+		if (configureOutput(outputs_[i], outputCfgs[i]) != 0)
+			return -EINVAL;
 	}
 
-	measuredFrames_ = 0;
-	frameProcessTime_ = 0;
-
-	return 0;
-}
+	/*
+	 * The additional outputs are downscaled from the first one, by a factor
+	 * that must leave an even number of pairs of lines in the first output
+	 * for each pair of lines of the additional output.
+	 */
+	const Size &firstSize = outputs_[0].size;
+	maxScale_ = 1;
 
-/*
- * Get width and height at which the bayer-pattern repeats.
- * Return pattern-size or an empty Size for an unsupported inputFormat.
- */
-Size DebayerCpu::patternSize(PixelFormat inputFormat)
-{
-	DebayerCpu::DebayerInputConfig config;
+	for (unsigned int i = 1; i < outputs_.size(); i++) {
+		Output &output = outputs_[i];
 
-	if (getInputConfig(inputFormat, config) != 0)
-		return {};
+		if (outputSize(firstSize, output.size) != output.size) {
+			LOG(Debayer, Error)
+				<< "Output size " << output.size
+				<< " can't be produced from " << firstSize;
+			return -EINVAL;
+		}
 
-	return config.patternSize;
-}
+		output.scale = firstSize.width / output.size.width;
 
-std::vector<PixelFormat> DebayerCpu::formats(PixelFormat inputFormat)
-{
-	DebayerCpu::DebayerInputConfig config;
+		maxScale_ = std::max(maxScale_, output.scale);
+	}
 
-	if (getInputConfig(inputFormat, config) != 0)
-		return std::vector<PixelFormat>();
+	outputs_[0].scale = 1;
+
+	/*
+	 * Downscale by the largest supported factor for which the output
+	 * still fits in the input, debayering a smaller output by cropping the
+	 * center of the input only when it doesn't fit at half the resolution.
+	 */
+	binning_ = 1;
+	for (unsigned int factor : { 4U, 2U }) {
+		if (outputCfg.size.width * factor <= inputCfg.size.width &&
+		    outputCfg.size.height * factor <= inputCfg.size.height) {
+			binning_ = factor;
+			break;
+		}
+	}
+
+	inputFormat_ = inputCfg.pixelFormat;
+	outputFormat_ = outputCfg.pixelFormat;
+
+	if (selectDebayerFunctions() != 0)
+		return -EINVAL;
+
+	if (stats_->configure(inputCfg, narrowInput_) != 0)
+		return -EINVAL;
+
+	const Size &statsPatternSize = stats_->patternSize();
+	if (inputConfig_.patternSize.width != statsPatternSize.width ||
+	    inputConfig_.patternSize.height != statsPatternSize.height) {
+		LOG(Debayer, Error)
+			<< "mismatching stats and debayer pattern sizes for "
+			<< inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	window_.width = firstSize.width * binning_;
+	window_.height = firstSize.height * binning_;
+	window_.x = ((inputCfg.size.width - window_.width) / 2) &
+		    ~(inputConfig_.patternSize.width - 1);
+	window_.y = ((inputCfg.size.height - window_.height) / 2) &
+		    ~(inputConfig_.patternSize.height - 1);
+
+	for (unsigned int i = 0; i < outputs_.size(); i++)
+		setupConversion(outputs_[i], outputCfgs[i], i == 0);
+
+	/* Don't pass x,y since process() already adjusts src before passing it */
+	stats_->setWindow(Rectangle(window_.size()));
+
+	/*
+	 * pad with patternSize.Width on both left and right side, narrowed
+	 * lines hold 8 bpp. Binning doesn't interpolate and needs no padding.
+	 */
+	const unsigned int lineBufferBpp = narrowInput_ ? 8 : inputConfig_.bpp;
+	lineBufferPadding_ = binning_ > 1 ? 0
+			   : inputConfig_.patternSize.width * lineBufferBpp / 8;
+	lineBufferLength_ = window_.width * lineBufferBpp / 8 +
+			    2 * lineBufferPadding_;
+
+	setupStripes();
+	setupInputStrategy();
+
+	measuredFrames_ = 0;
+	frameProcessTime_ = 0;
+
+	return 0;
+}
+
+/*
+ * Get width and height at which the bayer-pattern repeats.
+ * Return pattern-size or an empty Size for an unsupported inputFormat.
+ */
+Size DebayerCpu::patternSize(PixelFormat inputFormat)
+{
+	DebayerCpu::DebayerInputConfig config;
+
+	if (getInputConfig(inputFormat, config) != 0)
+		return {};
+
+	return config.patternSize;
+}
+
+std::vector<PixelFormat> DebayerCpu::formats(PixelFormat inputFormat)
+{
+	DebayerCpu::DebayerInputConfig config;
+
+	if (getInputConfig(inputFormat, config) != 0)
+		return std::vector<PixelFormat>();
 
 	return config.outputFormats;
 }
@@ -533,24 +1262,508 @@ DebayerCpu::strideAndFrameSize(const PixelFormat &outputFormat, const Size &size
 	/* round up to multiple of 8 for 64 bits alignment */
 	unsigned int stride = (size.width * config.bpp / 8 + 7) & ~7;
 
+	/* NV12 has a half height CbCr plane after the luma plane */
+	if (outputFormat == formats::NV12)
+		return std::make_tuple(stride, stride * size.height * 3 / 2);
+
 	return std::make_tuple(stride, stride * size.height);
 }
 
-void DebayerCpu::setupInputMemcpy(const uint8_t *linePointers[])
+/*
+ * Fixed point RGB to YCbCr conversion coefficients, with kYuvShift fractional
+ * bits.
+ */
+static constexpr unsigned int kYuvShift = 14;
+
+/*
+ * Select the function storing the debayered lines to the output, null when the
+ * output is debayered to directly. The debayered lines hold the blue component
+ * of each pixel first, or the red component when swapRedBlueGains_ is set.
+ */
+void DebayerCpu::setupConversion(Output &output, const StreamConfiguration &outputCfg,
+				 bool direct)
+{
+	output.convert = nullptr;
+	output.swapRedBlue = false;
+
+	switch (outputCfg.pixelFormat) {
+	case formats::RGB888:
+	case formats::BGR888:
+		if (direct)
+			return;
+
+		output.swapRedBlue = (outputCfg.pixelFormat == formats::BGR888) !=
+				     swapRedBlueGains_;
+		output.convert = &DebayerCpu::convertRGB;
+		return;
+	case formats::NV12:
+		output.convert = &DebayerCpu::convertNV12;
+		break;
+	case formats::YUYV:
+		output.convert = &DebayerCpu::convertYUYV;
+		break;
+	default:
+		return;
+	}
+
+	YuvCoefficients &yuvCoeffs = output.yuvCoeffs;
+
+	/* Default to the JPEG colour space when none is specified */
+	ColorSpace colorSpace = outputCfg.colorSpace.value_or(ColorSpace::Sycc);
+	double kr, kb;
+
+	switch (colorSpace.ycbcrEncoding) {
+	case ColorSpace::YcbcrEncoding::Rec709:
+		kr = 0.2126;
+		kb = 0.0722;
+		break;
+	case ColorSpace::YcbcrEncoding::Rec2020:
+		kr = 0.2627;
+		kb = 0.0593;
+		break;
+	case ColorSpace::YcbcrEncoding::None:
+	case ColorSpace::YcbcrEncoding::Rec601:
+	default:
+		kr = 0.299;
+		kb = 0.114;
+		break;
+	}
+
+	const bool limited = colorSpace.range == ColorSpace::Range::Limited;
+	const double yScale = (limited ? 219.0 : 255.0) / 255.0;
+	const double cScale = (limited ? 224.0 : 255.0) / 255.0;
+	const double kg = 1.0 - kr - kb;
+	const double one = 1 << kYuvShift;
+
+	/* The coefficients are ordered as the BGR888 bytes in memory */
+	const double y[3] = { kb, kg, kr };
+	const double cb[3] = { 0.5, -0.5 * kg / (1.0 - kb), -0.5 * kr / (1.0 - kb) };
+	const double cr[3] = { -0.5 * kb / (1.0 - kr), -0.5 * kg / (1.0 - kr), 0.5 };
+
+	for (unsigned int i = 0; i < 3; i++) {
+		yuvCoeffs.y[i] = std::lround(y[i] * yScale * one);
+		yuvCoeffs.cb[i] = std::lround(cb[i] * cScale * one);
+		yuvCoeffs.cr[i] = std::lround(cr[i] * cScale * one);
+	}
+
+	/*
+	 * Make sure rounding doesn't break the sums of the coefficients, to
+	 * map white to the maximum luma and greys to a neutral chroma.
+	 */
+	yuvCoeffs.y[1] = std::lround(yScale * one) - yuvCoeffs.y[0] - yuvCoeffs.y[2];
+	yuvCoeffs.cb[1] = -yuvCoeffs.cb[0] - yuvCoeffs.cb[2];
+	yuvCoeffs.cr[1] = -yuvCoeffs.cr[0] - yuvCoeffs.cr[2];
+
+	/* Include the rounding in the offsets */
+	yuvCoeffs.yOffset = ((limited ? 16 : 0) << kYuvShift) + (1 << (kYuvShift - 1));
+	yuvCoeffs.cOffset = (128 << kYuvShift) + (1 << (kYuvShift - 1));
+
+	if (swapRedBlueGains_) {
+		std::swap(yuvCoeffs.y[0], yuvCoeffs.y[2]);
+		std::swap(yuvCoeffs.cb[0], yuvCoeffs.cb[2]);
+		std::swap(yuvCoeffs.cr[0], yuvCoeffs.cr[2]);
+	}
+
+	LOG(Debayer, Debug)
+		<< "Converting to " << outputCfg.pixelFormat
+		<< " in the " << colorSpace.toString() << " colour space";
+}
+
+/*
+ * Copy the debayered pixels in lines[0] and lines[1] to the output rows row
+ * and row + 1, swapping red and blue if needed.
+ */
+void DebayerCpu::convertRGB(const Output &output, unsigned int row, uint8_t *lines[2])
+{
+	const unsigned int length = output.size.width * 3;
+
+	for (unsigned int l = 0; l < 2; l++) {
+		uint8_t *dst = output.dst + (row + l) * output.config.stride;
+		const uint8_t *src = lines[l];
+
+		if (!output.swapRedBlue) {
+			memcpy(dst, src, length);
+			continue;
+		}
+
+		for (unsigned int x = 0; x < length; x += 3) {
+			dst[x] = src[x + 2];
+			dst[x + 1] = src[x + 1];
+			dst[x + 2] = src[x];
+		}
+	}
+}
+
+/*
+ * Convert the BGR888 pixels in lines[0] and lines[1], corresponding to the
+ * output rows row and row + 1.
+ */
+void DebayerCpu::convertNV12(const Output &output, unsigned int row, uint8_t *lines[2])
+{
+	const YuvCoefficients &c = output.yuvCoeffs;
+	const unsigned int stride = output.config.stride;
+	uint8_t *y0 = output.dst + row * stride;
+	uint8_t *y1 = y0 + stride;
+	uint8_t *uv = output.dst + (output.size.height + row / 2) * stride;
+	const uint8_t *rgb0 = lines[0];
+	const uint8_t *rgb1 = lines[1];
+
+	auto luma = [&c](const uint8_t *p) -> uint8_t {
+		return (c.y[0] * p[0] + c.y[1] * p[1] + c.y[2] * p[2] + c.yOffset) >> kYuvShift;
+	};
+
+	/* Average the 2x2 blocks by dividing the chroma of the sums by 4 */
+	auto chroma = [&c](const int coeffs[3], const int sum[3]) -> uint8_t {
+		int v = (coeffs[0] * sum[0] + coeffs[1] * sum[1] + coeffs[2] * sum[2] +
+			 (c.cOffset << 2)) >> (kYuvShift + 2);
+		return std::min(v, 255);
+	};
+
+	for (unsigned int x = 0; x < output.size.width; x += 2) {
+		int sum[3];
+
+		for (unsigned int i = 0; i < 3; i++)
+			sum[i] = rgb0[i] + rgb0[i + 3] + rgb1[i] + rgb1[i + 3];
+
+		y0[x] = luma(rgb0);
+		y0[x + 1] = luma(rgb0 + 3);
+		y1[x] = luma(rgb1);
+		y1[x + 1] = luma(rgb1 + 3);
+		uv[x] = chroma(c.cb, sum);
+		uv[x + 1] = chroma(c.cr, sum);
+
+		rgb0 += 6;
+		rgb1 += 6;
+	}
+}
+
+void DebayerCpu::convertYUYV(const Output &output, unsigned int row, uint8_t *lines[2])
+{
+	const YuvCoefficients &c = output.yuvCoeffs;
+
+	auto luma = [&c](const uint8_t *p) -> uint8_t {
+		return (c.y[0] * p[0] + c.y[1] * p[1] + c.y[2] * p[2] + c.yOffset) >> kYuvShift;
+	};
+
+	/* Average the 2x1 blocks by dividing the chroma of the sums by 2 */
+	auto chroma = [&c](const int coeffs[3], const int sum[3]) -> uint8_t {
+		int v = (coeffs[0] * sum[0] + coeffs[1] * sum[1] + coeffs[2] * sum[2] +
+			 (c.cOffset << 1)) >> (kYuvShift + 1);
+		return std::min(v, 255);
+	};
+
+	for (unsigned int l = 0; l < 2; l++) {
+		uint8_t *yuyv = output.dst + (row + l) * output.config.stride;
+		const uint8_t *rgb = lines[l];
+
+		for (unsigned int x = 0; x < output.size.width; x += 2) {
+			int sum[3];
+
+			for (unsigned int i = 0; i < 3; i++)
+				sum[i] = rgb[i] + rgb[i + 3];
+
+			yuyv[0] = luma(rgb);
+			yuyv[1] = chroma(c.cb, sum);
+			yuyv[2] = luma(rgb + 3);
+			yuyv[3] = chroma(c.cr, sum);
+
+			yuyv += 4;
+			rgb += 6;
+		}
+	}
+}
+
+/*
+ * Downscale the lines debayered for the rows row and row + 1 of the first
+ * output to an additional output, averaging blocks of scale x scale pixels.
+ * The lines are stored to the output every time two of them are complete.
+ */
+void DebayerCpu::scaleOutputLines(const Output &output, ScaledLines &scaled,
+				  unsigned int row, uint8_t *lines[2])
+{
+	if (!output.dst)
+		return;
+
+	if (output.scale == 1) {
+		(this->*output.convert)(output, row, lines);
+		return;
+	}
+
+	const unsigned int scale = output.scale;
+	const unsigned int length = output.size.width * 3;
+	/* The scale is 2 or 4, divide the sums of scale^2 pixels by shifting */
+	const unsigned int shift = scale == 4 ? 4 : 2;
+	uint16_t *sums = scaled.sums.data();
+
+	for (unsigned int l = 0; l < 2; l++) {
+		const unsigned int y = row + l;
+		const uint8_t *src = lines[l];
+
+		if (y % scale == 0)
+			std::fill(scaled.sums.begin(), scaled.sums.end(), 0);
+
+		for (unsigned int x = 0; x < length; x += 3) {
+			for (unsigned int i = 0; i < scale * 3; i += 3) {
+				sums[x] += src[i];
+				sums[x + 1] += src[i + 1];
+				sums[x + 2] += src[i + 2];
+			}
+
+			src += scale * 3;
+		}
+
+		if ((y + 1) % scale)
+			continue;
+
+		const unsigned int outputRow = y / scale;
+		uint8_t *dst = scaled.lines[outputRow % 2].data();
+
+		for (unsigned int x = 0; x < length; x++)
+			dst[x] = (sums[x] + (1 << shift >> 1)) >> shift;
+
+		if (outputRow % 2) {
+			uint8_t *outputLines[2] = {
+				scaled.lines[0].data(), scaled.lines[1].data()
+			};
+			(this->*output.convert)(output, outputRow - 1, outputLines);
+		}
+	}
+}
+
+/*
+ * Get the locations to debayer the first 2 lines of a stripe to, either the
+ * first output buffer or the RGB lines of the stripe when converting the lines
+ * or when the frame has no buffer for the first output.
+ */
+void DebayerCpu::setupOutputLines(Stripe &stripe, uint8_t *lines[2])
+{
+	const Output &output = outputs_[0];
+
+	if (output.convert || !output.dst) {
+		lines[0] = stripe.rgbLines[0].data();
+		lines[1] = stripe.rgbLines[1].data();
+		return;
+	}
+
+	lines[0] = output.dst + stripe.y / binning_ * output.config.stride;
+	lines[1] = lines[0] + output.config.stride;
+}
+
+/*
+ * Store the 2 lines debayered to lines[] at output row row to all outputs, and
+ * get the locations to debayer the next 2 lines to.
+ */
+void DebayerCpu::storeOutputLines(Stripe &stripe, unsigned int row, uint8_t *lines[2])
+{
+	for (unsigned int i = 1; i < outputs_.size(); i++)
+		scaleOutputLines(outputs_[i], stripe.scaledLines[i - 1], row, lines);
+
+	const Output &output = outputs_[0];
+	if (!output.dst)
+		return;
+
+	if (output.convert) {
+		(this->*output.convert)(output, row, lines);
+		return;
+	}
+
+	lines[0] += 2 * output.config.stride;
+	lines[1] += 2 * output.config.stride;
+}
+
+void DebayerCpu::stopWorkers()
+{
+	for (std::unique_ptr<Thread> &thread : workerThreads_) {
+		thread->exit();
+		thread->wait();
+	}
+
+	workers_.clear();
+	workerThreads_.clear();
+}
+
+/*
+ * Split the window in stripeCount_ stripes of (nearly) equal height, aligned
+ * to the bayer pattern height times the binning factor and the downscaling
+ * factor of the additional outputs, and start a worker for each stripe but the
+ * first one.
+ */
+void DebayerCpu::setupStripes()
+{
+	const unsigned int patternHeight = inputConfig_.patternSize.height * binning_ *
+					   maxScale_;
+	const unsigned int patterns = window_.height / patternHeight;
+	const unsigned int count = std::clamp(stripeCount_, 1U, std::max(patterns, 1U));
+	/* Binning reads binning_ lines at a time, without neighbouring lines */
+	const unsigned int lineBuffers = binning_ > 1 ? binning_
+				       : inputConfig_.patternSize.height + 1;
+	unsigned int y = 0;
+
+	stripes_.resize(count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		Stripe &stripe = stripes_[i];
+
+		stripe.index = i;
+		stripe.y = y;
+		stripe.height = i == count - 1 ? window_.height - y
+			      : (patterns / count + (i < patterns % count)) * patternHeight;
+		y += stripe.height;
+
+		for (unsigned int j = 0; j < kMaxLineBuffers; j++) {
+			if (j < lineBuffers)
+				stripe.lineBuffers[j].resize(lineBufferLength_);
+			else
+				stripe.lineBuffers[j].clear();
+		}
+
+		/* Also used when a frame has no buffer for the first output */
+		for (std::vector<uint8_t> &line : stripe.rgbLines)
+			line.resize(outputs_[0].size.width * 3);
+
+		stripe.scaledLines.resize(outputs_.size() - 1);
+		for (unsigned int j = 0; j < stripe.scaledLines.size(); j++) {
+			ScaledLines &scaled = stripe.scaledLines[j];
+			const unsigned int length = outputs_[j + 1].size.width * 3;
+
+			scaled.sums.resize(length);
+			scaled.lines[0].resize(length);
+			scaled.lines[1].resize(length);
+		}
+	}
+
+	stats_->setStripes(count);
+
+	if (workers_.size() == count - 1)
+		return;
+
+	stopWorkers();
+
+	for (unsigned int i = 1; i < count; i++) {
+		std::unique_ptr<Thread> thread = std::make_unique<Thread>("soft-isp-stripe");
+		std::unique_ptr<StripeWorker> worker = std::make_unique<StripeWorker>(this);
+
+		worker->moveToThread(thread.get());
+		thread->start();
+
+		workerThreads_.push_back(std::move(thread));
+		workers_.push_back(std::move(worker));
+	}
+
+	LOG(Debayer, Debug) << "Debayering in " << count << " stripes";
+}
+
+/*
+ * Select the input strategies to time on the following frames. Strategies
+ * reading the input directly avoid copies, which is faster for cached buffers,
+ * copying the lines to the line buffers is faster for uncached ones. The
+ * strategies are timed on live frames as the buffers are not known before
+ * processing starts, they all produce the same output.
+ */
+void DebayerCpu::setupInputStrategy()
+{
+	inputTrials_.clear();
+	inputTrialFrame_ = 0;
+
+	if (!autoInputStrategy_)
+		return;
+
+	std::vector<InputStrategy> strategies = { InputStrategy::Memcpy };
+
+	/* Packed input is always copied to be narrowed */
+	if (!narrowInput_)
+		strategies.push_back(InputStrategy::Direct);
+
+	strategies.push_back(InputStrategy::Sync);
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (!narrowInput_ && __builtin_cpu_supports("sse4.1"))
+		strategies.push_back(InputStrategy::Stream);
+#endif
+
+	for (InputStrategy strategy : strategies)
+		inputTrials_.emplace_back(strategy, std::numeric_limits<int64_t>::max());
+
+	inputStrategy_ = inputTrials_[0].first;
+}
+
+/*
+ * Record the time taken to process a frame with the current input strategy,
+ * and move to the next strategy to time, or to the fastest one once they all
+ * have been timed.
+ */
+void DebayerCpu::updateInputStrategy(int64_t frameTime)
+{
+	auto trial = std::find_if(inputTrials_.begin(), inputTrials_.end(),
+				  [&](const auto &t) { return t.first == inputStrategy_; });
+	trial->second = std::min(trial->second, frameTime);
+
+	if (++inputTrialFrame_ < kInputTrialFrames)
+		return;
+
+	inputTrialFrame_ = 0;
+
+	if (++trial != inputTrials_.end()) {
+		inputStrategy_ = trial->first;
+		return;
+	}
+
+	auto best = std::min_element(inputTrials_.begin(), inputTrials_.end(),
+				     [](const auto &a, const auto &b) { return a.second < b.second; });
+	inputStrategy_ = best->first;
+	inputTrials_.clear();
+
+	static const char *names[] = { "direct", "memcpy", "stream", "sync" };
+	LOG(Debayer, Debug)
+		<< "Using " << names[static_cast<unsigned int>(inputStrategy_)]
+		<< " input strategy, " << best->second / 1000 << " us/frame";
+}
+
+bool DebayerCpu::copyInput() const
+{
+	return inputStrategy_ == InputStrategy::Memcpy ||
+	       inputStrategy_ == InputStrategy::Stream || narrowInput_;
+}
+
+/*
+ * Copy a line to a line buffer, including the padding on both sides. When
+ * narrowInput_ is set, drop the 5th byte of every CSI-2 packed 10-bit 5 bytes
+ * group, keeping the 8 most significant bits of each pixel only.
+ */
+void DebayerCpu::copyLine(uint8_t *dst, const uint8_t *src)
+{
+	if (!narrowInput_) {
+#if defined(__x86_64__) || defined(__i386__)
+		if (inputStrategy_ == InputStrategy::Stream) {
+			streamCopy(dst, src - lineBufferPadding_, lineBufferLength_);
+			return;
+		}
+#endif
+		memcpy(dst, src - lineBufferPadding_, lineBufferLength_);
+		return;
+	}
+
+	src -= lineBufferPadding_ * 5 / 4;
+	for (unsigned int i = 0; i < lineBufferLength_; i += 4) {
+		memcpy(dst + i, src, 4);
+		src += 5;
+	}
+}
+
+void DebayerCpu::setupInputMemcpy(Stripe &stripe, const uint8_t *linePointers[])
 {
 	const unsigned int patternHeight = inputConfig_.patternSize.height;
 
-	if (!enableInputMemcpy_)
+	if (!copyInput())
 		return;
 
 	for (unsigned int i = 0; i < patternHeight; i++) {
-		memcpy(lineBuffers_[i], linePointers[i + 1] - lineBufferPadding_,
-		       lineBufferLength_);
-		linePointers[i + 1] = lineBuffers_[i] + lineBufferPadding_;
+		copyLine(stripe.lineBuffers[i].data(), linePointers[i + 1]);
+		linePointers[i + 1] = stripe.lineBuffers[i].data() + lineBufferPadding_;
 	}
 
-	/* Point lineBufferIndex_ to first unused lineBuffer */
-	lineBufferIndex_ = patternHeight;
+	/* Point lineBufferIndex to first unused lineBuffer */
+	stripe.lineBufferIndex = patternHeight;
 }
 
 void DebayerCpu::shiftLinePointers(const uint8_t *linePointers[], const uint8_t *src)
@@ -564,86 +1777,123 @@ void DebayerCpu::shiftLinePointers(const uint8_t *linePointers[], const uint8_t
 				      (patternHeight / 2) * (int)inputConfig_.stride;
 }
 
-void DebayerCpu::memcpyNextLine(const uint8_t *linePointers[])
+void DebayerCpu::memcpyNextLine(Stripe &stripe, const uint8_t *linePointers[])
 {
 	const unsigned int patternHeight = inputConfig_.patternSize.height;
 
-	if (!enableInputMemcpy_)
+	if (!copyInput())
 		return;
 
-	memcpy(lineBuffers_[lineBufferIndex_], linePointers[patternHeight] - lineBufferPadding_,
-	       lineBufferLength_);
-	linePointers[patternHeight] = lineBuffers_[lineBufferIndex_] + lineBufferPadding_;
+	uint8_t *lineBuffer = stripe.lineBuffers[stripe.lineBufferIndex].data();
+
+	copyLine(lineBuffer, linePointers[patternHeight]);
+	linePointers[patternHeight] = lineBuffer + lineBufferPadding_;
+
+	stripe.lineBufferIndex = (stripe.lineBufferIndex + 1) % (patternHeight + 1);
+}
+
+static inline int64_t timeDiff(timespec &after, timespec &before)
+{
+	return (after.tv_sec - before.tv_sec) * 1000000000LL +
+	       (int64_t)after.tv_nsec - (int64_t)before.tv_nsec;
+}
+
+/* Gather the statistics of line 0 or 2 of the pattern, timing it for the stripe */
+void DebayerCpu::processStatsLine(Stripe &stripe, unsigned int line, unsigned int y,
+				  const uint8_t *src[])
+{
+	timespec startTime = {};
+	timespec endTime = {};
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &startTime);
+
+	if (line == 0)
+		stats_->processLine0(y, src, stripe.index);
+	else
+		stats_->processLine2(y, src, stripe.index);
 
-	lineBufferIndex_ = (lineBufferIndex_ + 1) % (patternHeight + 1);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &endTime);
+	stripe.statsTime += timeDiff(endTime, startTime);
 }
 
-void DebayerCpu::process2(const uint8_t *src, uint8_t *dst)
+void DebayerCpu::process2(const uint8_t *src, Stripe &stripe)
 {
-	unsigned int yEnd = window_.y + window_.height;
+	const unsigned int yStart = window_.y + stripe.y;
+	unsigned int yEnd = yStart + stripe.height;
 	/* Holds [0] previous- [1] current- [2] next-line */
 	const uint8_t *linePointers[3];
+	/* Holds the destinations of the 2 lines being debayered */
+	uint8_t *lines[2];
+	/* Without a border below the window the last 2 lines need special handling */
+	const bool bottomEdge = window_.y == 0 &&
+				stripe.y + stripe.height == window_.height;
 
-	/* Adjust src to top left corner of the window */
-	src += window_.y * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	/* Adjust src to top left corner of the stripe */
+	src += yStart * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	setupOutputLines(stripe, lines);
 
 	/* [x] becomes [x - 1] after initial shiftLinePointers() call */
-	if (window_.y) {
+	if (yStart) {
 		linePointers[1] = src - inputConfig_.stride; /* previous-line */
 		linePointers[2] = src;
 	} else {
-		/* window_.y == 0, use the next line as prev line */
+		/* yStart == 0, use the next line as prev line */
 		linePointers[1] = src + inputConfig_.stride;
 		linePointers[2] = src;
-		/* Last 2 lines also need special handling */
-		yEnd -= 2;
 	}
 
-	setupInputMemcpy(linePointers);
+	if (bottomEdge)
+		yEnd -= 2;
+
+	setupInputMemcpy(stripe, linePointers);
 
-	for (unsigned int y = window_.y; y < yEnd; y += 2) {
+	for (unsigned int y = yStart; y < yEnd; y += 2) {
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		stats_->processLine0(y, linePointers);
-		(this->*debayer0_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		processStatsLine(stripe, 0, y, linePointers);
+		(this->*debayer0_)(lines[0], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
 
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		(this->*debayer1_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer1_)(lines[1], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
+
+		storeOutputLines(stripe, y - window_.y, lines);
 	}
 
-	if (window_.y == 0) {
+	if (bottomEdge) {
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		stats_->processLine0(yEnd, linePointers);
-		(this->*debayer0_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		processStatsLine(stripe, 0, yEnd, linePointers);
+		(this->*debayer0_)(lines[0], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
 
 		shiftLinePointers(linePointers, src);
 		/* next line may point outside of src, use prev. */
 		linePointers[2] = linePointers[0];
-		(this->*debayer1_)(dst, linePointers);
+		(this->*debayer1_)(lines[1], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
+
+		storeOutputLines(stripe, yEnd - window_.y, lines);
 	}
 }
 
-void DebayerCpu::process4(const uint8_t *src, uint8_t *dst)
+void DebayerCpu::process4(const uint8_t *src, Stripe &stripe)
 {
-	const unsigned int yEnd = window_.y + window_.height;
+	const unsigned int yStart = window_.y + stripe.y;
+	const unsigned int yEnd = yStart + stripe.height;
 	/*
 	 * This holds pointers to [0] 2-lines-up [1] 1-line-up [2] current-line
 	 * [3] 1-line-down [4] 2-lines-down.
 	 */
 	const uint8_t *linePointers[5];
+	/* Holds the destinations of the 2 lines being debayered */
+	uint8_t *lines[2];
 
-	/* Adjust src to top left corner of the window */
-	src += window_.y * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	/* Adjust src to top left corner of the stripe */
+	src += yStart * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	setupOutputLines(stripe, lines);
 
 	/* [x] becomes [x - 1] after initial shiftLinePointers() call */
 	linePointers[1] = src - 2 * inputConfig_.stride;
@@ -651,85 +1901,260 @@ void DebayerCpu::process4(const uint8_t *src, uint8_t *dst)
 	linePointers[3] = src;
 	linePointers[4] = src + inputConfig_.stride;
 
-	setupInputMemcpy(linePointers);
+	setupInputMemcpy(stripe, linePointers);
 
-	for (unsigned int y = window_.y; y < yEnd; y += 4) {
+	for (unsigned int y = yStart; y < yEnd; y += 4) {
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		stats_->processLine0(y, linePointers);
-		(this->*debayer0_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		processStatsLine(stripe, 0, y, linePointers);
+		(this->*debayer0_)(lines[0], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
 
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		(this->*debayer1_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer1_)(lines[1], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
+
+		storeOutputLines(stripe, y - window_.y, lines);
 
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		stats_->processLine2(y, linePointers);
-		(this->*debayer2_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		processStatsLine(stripe, 2, y, linePointers);
+		(this->*debayer2_)(lines[0], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
 
 		shiftLinePointers(linePointers, src);
-		memcpyNextLine(linePointers);
-		(this->*debayer3_)(dst, linePointers);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer3_)(lines[1], linePointers);
 		src += inputConfig_.stride;
-		dst += outputConfig_.stride;
+
+		storeOutputLines(stripe, y + 2 - window_.y, lines);
 	}
 }
 
-static inline int64_t timeDiff(timespec &after, timespec &before)
+/* Get pointers to the binning_ lines starting at src, copying them if needed */
+void DebayerCpu::readBinnedLines(Stripe &stripe, const uint8_t *src,
+				 const uint8_t *linePointers[])
 {
-	return (after.tv_sec - before.tv_sec) * 1000000000LL +
-	       (int64_t)after.tv_nsec - (int64_t)before.tv_nsec;
+	for (unsigned int i = 0; i < binning_; i++) {
+		linePointers[i] = src + i * inputConfig_.stride;
+		if (!copyInput())
+			continue;
+
+		copyLine(stripe.lineBuffers[i].data(), linePointers[i]);
+		linePointers[i] = stripe.lineBuffers[i].data();
+	}
 }
 
-void DebayerCpu::process(FrameBuffer *input, FrameBuffer *output, DebayerParams params)
+void DebayerCpu::processBinned(const uint8_t *src, Stripe &stripe)
 {
-	timespec frameStartTime;
+	const unsigned int yStart = window_.y + stripe.y;
+	const unsigned int yEnd = yStart + stripe.height;
+	/* Holds binning_ lines */
+	const uint8_t *linePointers[kMaxLineBuffers];
+	/* Holds the destinations of the 2 lines being debayered */
+	uint8_t *lines[2];
+
+	/* Adjust src to top left corner of the stripe */
+	src += yStart * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	setupOutputLines(stripe, lines);
+
+	for (unsigned int y = yStart; y < yEnd; y += 2 * binning_) {
+		for (unsigned int i = 0; i < 2; i++) {
+			const unsigned int blockY = y + i * binning_;
+
+			readBinnedLines(stripe, src, linePointers);
+
+			/* The statistics functions use src[1] and src[2] */
+			for (unsigned int j = 0; j < binning_; j += 2) {
+				const uint8_t *statsLines[3] = {
+					nullptr, linePointers[j], linePointers[j + 1]
+				};
+				processStatsLine(stripe, 0, blockY + j, statsLines);
+			}
+
+			(this->*debayer0_)(lines[i], linePointers);
+			src += binning_ * inputConfig_.stride;
+		}
 
-	if (measuredFrames_ < DebayerCpu::kLastFrameToMeasure) {
-		frameStartTime = {};
-		clock_gettime(CLOCK_MONOTONIC_RAW, &frameStartTime);
+		storeOutputLines(stripe, (y - window_.y) / binning_, lines);
 	}
+}
 
-	green_ = params.green;
-	red_ = swapRedBlueGains_ ? params.blue : params.red;
-	blue_ = swapRedBlueGains_ ? params.red : params.blue;
+void DebayerCpu::processStripe(const uint8_t *src, Stripe &stripe)
+{
+	if (binning_ > 1)
+		processBinned(src, stripe);
+	else if (inputConfig_.patternSize.height == 2)
+		process2(src, stripe);
+	else
+		process4(src, stripe);
+}
+
+/*
+ * Copy the color tables of the frame parameters. The color correction tables
+ * are stored in the order of the debayered colors and of their output bytes,
+ * swapping red and blue for BGR888 output like the lookup tables. The debayer
+ * functions are switched when the color correction gets enabled or disabled.
+ * Tables of the same generation as the previous ones are not copied again.
+ */
+void DebayerCpu::setColorTables(const DebayerParams *params)
+{
+	if (params->generation && params->generation == tablesGeneration_)
+		return;
+
+	tablesGeneration_ = params->generation;
+
+	green_ = params->green;
+	red_ = swapRedBlueGains_ ? params->blue : params->red;
+	blue_ = swapRedBlueGains_ ? params->red : params->blue;
+
+	if (params->ccmEnabled) {
+		auto swapped = [](const DebayerParams::CcmLookupTable &table) {
+			DebayerParams::CcmLookupTable result;
+			for (unsigned int i = 0; i < table.size(); i++)
+				result[i] = { table[i].b, table[i].g, table[i].r };
+			return result;
+		};
+
+		if (swapRedBlueGains_) {
+			redCcm_ = swapped(params->blueCcm);
+			greenCcm_ = swapped(params->greenCcm);
+			blueCcm_ = swapped(params->redCcm);
+		} else {
+			redCcm_ = params->redCcm;
+			greenCcm_ = params->greenCcm;
+			blueCcm_ = params->blueCcm;
+		}
+
+		gammaLut_ = params->gammaLut;
+	}
+
+	if (params->ccmEnabled != ccmEnabled_) {
+		ccmEnabled_ = params->ccmEnabled;
+		selectDebayerFunctions();
+	}
+}
+
+void DebayerCpu::processFrame(const uint8_t *src)
+{
+	for (Stripe &stripe : stripes_)
+		stripe.statsTime = 0;
+
+	/* Hand all stripes but the first one to the workers */
+	for (unsigned int i = 1; i < stripes_.size(); i++)
+		workers_[i - 1]->invokeMethod(&StripeWorker::process,
+					      ConnectionTypeQueued, src, i);
+
+	processStripe(src, stripes_[0]);
+
+	/* Wait for the workers to complete their stripes */
+	stripesDone_.acquire(stripes_.size() - 1);
+}
+
+void DebayerCpu::process(FrameBuffer *input,
+			 const FlatMap<unsigned int, FrameBuffer *> &outputs,
+			 const DebayerParams *params)
+{
+	const uint32_t sequence = input->metadata().sequence;
+	timespec frameStartTime = {};
+
+	LIBCAMERA_TRACEPOINT(frame_process_begin, "simple", "debayer", sequence);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &frameStartTime);
+
+	setColorTables(params);
 
 	/* Copy metadata from the input buffer */
-	FrameMetadata &metadata = output->_d()->metadata();
-	metadata.status = input->metadata().status;
-	metadata.sequence = input->metadata().sequence;
-	metadata.timestamp = input->metadata().timestamp;
-
-	MappedFrameBuffer in(input, MappedFrameBuffer::MapFlag::Read);
-	MappedFrameBuffer out(output, MappedFrameBuffer::MapFlag::Write);
-	if (!in.isValid() || !out.isValid()) {
+	for (auto [index, output] : outputs) {
+		FrameMetadata &metadata = output->_d()->metadata();
+		metadata.status = input->metadata().status;
+		metadata.sequence = input->metadata().sequence;
+		metadata.timestamp = input->metadata().timestamp;
+	}
+
+	/*
+	 * The input and output buffers are reused for every frame, keep their
+	 * mappings to avoid mapping and unmapping them for every frame. The
+	 * output buffers are consumed by devices, synchronize the CPU writes.
+	 */
+	MappedFrameBuffer in(input, MappedFrameBuffer::MapFlag::Read |
+				    MappedFrameBuffer::MapFlag::Persistent);
+	std::array<std::optional<MappedFrameBuffer>, kMaxOutputs> out;
+	bool valid = in.isValid();
+
+	for (Output &output : outputs_)
+		output.dst = nullptr;
+
+	for (auto [index, output] : outputs) {
+		out[index].emplace(output, MappedFrameBuffer::MapFlag::Write |
+					   MappedFrameBuffer::MapFlag::Persistent |
+					   MappedFrameBuffer::MapFlag::Sync);
+		if (!out[index]->isValid()) {
+			valid = false;
+			break;
+		}
+
+		outputs_[index].dst = out[index]->planes()[0].data();
+	}
+
+	if (!valid) {
 		LOG(Debayer, Error) << "mmap-ing buffer(s) failed";
-		metadata.status = FrameMetadata::FrameError;
+		for (auto [index, output] : outputs)
+			output->_d()->metadata().status = FrameMetadata::FrameError;
+		LIBCAMERA_TRACEPOINT(frame_process_end, "simple", "debayer", sequence);
 		return;
 	}
 
 	stats_->startFrame();
 
-	if (inputConfig_.patternSize.height == 2)
-		process2(in.planes()[0].data(), out.planes()[0].data());
-	else
-		process4(in.planes()[0].data(), out.planes()[0].data());
+	timespec trialStartTime;
+	if (!inputTrials_.empty()) {
+		trialStartTime = {};
+		clock_gettime(CLOCK_MONOTONIC_RAW, &trialStartTime);
+	}
+
+	{
+		/*
+		 * Bracket CPU reads of the input with a DmaSyncer, for the
+		 * cache to be kept coherent with the device writes.
+		 */
+		std::optional<DmaSyncer> syncer;
+		if (inputStrategy_ == InputStrategy::Sync)
+			syncer.emplace(input, DmaSyncer::SyncType::Read);
+
+		processFrame(in.planes()[0].data());
+	}
+
+	if (!inputTrials_.empty()) {
+		timespec trialEndTime = {};
+		clock_gettime(CLOCK_MONOTONIC_RAW, &trialEndTime);
+		updateInputStrategy(timeDiff(trialEndTime, trialStartTime));
+	}
+
+	for (auto [index, output] : outputs) {
+		FrameMetadata &metadata = output->_d()->metadata();
+		const std::vector<Span<uint8_t>> &planes = out[index]->planes();
 
-	metadata.planes()[0].bytesused = out.planes()[0].size();
+		for (unsigned int i = 0; i < planes.size(); i++)
+			metadata.planes()[i].bytesused = planes[i].size();
+	}
 
 	/* Measure before emitting signals */
+	timespec frameEndTime = {};
+	clock_gettime(CLOCK_MONOTONIC_RAW, &frameEndTime);
+	const int64_t frameTime = timeDiff(frameEndTime, frameStartTime);
+
+	int64_t statsTime = 0;
+	for (const Stripe &stripe : stripes_)
+		statsTime += stripe.statsTime;
+
+	processingTime_ = std::chrono::nanoseconds(frameTime);
+	statsTime_ = std::chrono::nanoseconds(statsTime);
+
 	if (measuredFrames_ < DebayerCpu::kLastFrameToMeasure &&
 	    ++measuredFrames_ > DebayerCpu::kFramesToSkip) {
-		timespec frameEndTime = {};
-		clock_gettime(CLOCK_MONOTONIC_RAW, &frameEndTime);
-		frameProcessTime_ += timeDiff(frameEndTime, frameStartTime);
+		frameProcessTime_ += frameTime;
 		if (measuredFrames_ == DebayerCpu::kLastFrameToMeasure) {
 			const unsigned int measuredFrames = DebayerCpu::kLastFrameToMeasure -
 							    DebayerCpu::kFramesToSkip;
@@ -741,8 +2166,11 @@ void DebayerCpu::process(FrameBuffer *input, FrameBuffer *output, DebayerParams
 		}
 	}
 
-	stats_->finishFrame();
-	outputBufferReady.emit(output);
+	LIBCAMERA_TRACEPOINT(frame_process_end, "simple", "debayer", sequence);
+
+	stats_->finishFrame(sequence);
+	for (auto [index, output] : outputs)
+		outputBufferReady.emit(output);
 	inputBufferReady.emit(input);
 }
 
@@ -769,10 +2197,38 @@ SizeRange DebayerCpu::sizes(PixelFormat inputFormat, const Size &inputSize)
 		return {};
 	}
 
+	/*
+	 * Sizes fitting in half or a quarter of the input are downscaled by
+	 * binning, which needs no border, the other ones are cropped from the
+	 * center of the input. The binned sizes are all included in the cropped
+	 * range.
+	 */
 	return SizeRange(Size(patternSize.width, patternSize.height),
 			 Size((inputSize.width - 2 * patternSize.width) & ~(patternSize.width - 1),
 			      (inputSize.height - 2 * borderHeight) & ~(patternSize.height - 1)),
 			 patternSize.width, patternSize.height);
 }
 
+/*
+ * Additional outputs are downscaled from the first output by a factor of 1, 2
+ * or 4, which must divide the size of the first output in pairs of lines and
+ * columns. Pick the smallest factor producing a size not larger than the
+ * requested one, or the largest factor if none fits.
+ */
+Size DebayerCpu::outputSize(const Size &firstSize, const Size &size)
+{
+	Size scaled = firstSize;
+
+	for (unsigned int scale : { 1U, 2U, 4U }) {
+		if (firstSize.width % (2 * scale) || firstSize.height % (2 * scale))
+			break;
+
+		scaled = Size(firstSize.width / scale, firstSize.height / scale);
+		if (scaled.width <= size.width && scaled.height <= size.height)
+			break;
+	}
+
+	return scaled;
+}
+
 } /* namespace libcamera */
@@ -13,9 +13,11 @@
 
 #include <memory>
 #include <stdint.h>
+#include <utility>
 #include <vector>
 
-#include <libcamera/base/object.h>
+#include <libcamera/base/semaphore.h>
+#include <libcamera/base/thread.h>
 
 #include "libcamera/internal/bayer_format.h"
 
@@ -24,9 +26,11 @@
 
 namespace libcamera {
 
-class DebayerCpu : public Debayer, public Object
+class DebayerCpu : public Debayer
 {
 public:
+	static constexpr unsigned int kMaxOutputs = 2;
+
 	DebayerCpu(std::unique_ptr<SwStatsCpu> stats);
 	~DebayerCpu();
 
@@ -36,22 +40,26 @@ public:
 	std::vector<PixelFormat> formats(PixelFormat input);
 	std::tuple<unsigned int, unsigned int>
 	strideAndFrameSize(const PixelFormat &outputFormat, const Size &size);
-	void process(FrameBuffer *input, FrameBuffer *output, DebayerParams params);
+	void process(FrameBuffer *input, const FlatMap<unsigned int, FrameBuffer *> &outputs,
+		     const DebayerParams *params);
 	SizeRange sizes(PixelFormat inputFormat, const Size &inputSize);
+	unsigned int maxOutputs() const { return kMaxOutputs; }
+	Size outputSize(const Size &firstSize, const Size &size);
+	void setStripes(unsigned int stripes);
 
-	/**
-	 * \brief Get the file descriptor for the statistics
-	 *
-	 * \return the file descriptor pointing to the statistics
-	 */
 	const SharedFD &getStatsFD() { return stats_->getStatsFD(); }
-
-	/**
-	 * \brief Get the output frame size
-	 *
-	 * \return The output frame size
-	 */
-	unsigned int frameSize() { return outputConfig_.frameSize; }
+	void setStatsSampling(unsigned int frameInterval, unsigned int xSubsampling)
+	{
+		stats_->setSampling(frameInterval, xSubsampling);
+	}
+	unsigned int frameSize(unsigned int output)
+	{
+		return outputs_[output].config.frameSize;
+	}
+	const std::vector<unsigned int> &planeSizes(unsigned int output)
+	{
+		return outputs_[output].config.planeSizes;
+	}
 
 private:
 	/**
@@ -85,20 +93,71 @@ private:
 	using debayerFn = void (DebayerCpu::*)(uint8_t *dst, const uint8_t *src[]);
 
 	/* 8-bit raw bayer format */
+	template<bool ccmEnabled>
 	void debayer8_BGBG_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer8_GRGR_BGR888(uint8_t *dst, const uint8_t *src[]);
 	/* unpacked 10-bit raw bayer format */
+	template<bool ccmEnabled>
 	void debayer10_BGBG_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer10_GRGR_BGR888(uint8_t *dst, const uint8_t *src[]);
 	/* unpacked 12-bit raw bayer format */
+	template<bool ccmEnabled>
 	void debayer12_BGBG_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer12_GRGR_BGR888(uint8_t *dst, const uint8_t *src[]);
 	/* CSI-2 packed 10-bit raw bayer format (all the 4 orders) */
+	template<bool ccmEnabled>
 	void debayer10P_BGBG_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer10P_GRGR_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer10P_GBGB_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<bool ccmEnabled>
 	void debayer10P_RGRG_BGR888(uint8_t *dst, const uint8_t *src[]);
 
+	/*
+	 * Vectorized implementations of the above. The unpacked variants are
+	 * templated on the pixel type, the number of bits to shift the values
+	 * right by to get 8 bpp values, the line type (BGBG or GRGR) and
+	 * whether to swap red and blue (turning BGBG into RGRG and GRGR into
+	 * GBGB). CSI-2 packed input is narrowed to 8 bpp when copied to the line
+	 * buffers and processed with the 8-bit unpacked variants.
+	 *
+	 * All debayer functions are also templated on whether to apply the
+	 * color correction matrix, see storeBGR888().
+	 */
+	template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+		 bool ccmEnabled>
+	void debayerSse41_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+		 bool ccmEnabled>
+	void debayerAvx2_BGR888(uint8_t *dst, const uint8_t *src[]);
+	template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+		 bool ccmEnabled>
+	void debayerNeon_BGR888(uint8_t *dst, const uint8_t *src[]);
+
+	template<typename pixel_t, unsigned int shift, bool bgLine, bool swapRB,
+		 bool ccmEnabled>
+	void debayerTail_BGR888(uint8_t *dst, const pixel_t *prev, const pixel_t *curr,
+				const pixel_t *next, int x);
+	template<bool ccmEnabled>
+	uint8_t *lookupBGR888(uint8_t *dst, const uint8_t *b, const uint8_t *g,
+			      const uint8_t *r, unsigned int count);
+	template<bool ccmEnabled>
+	uint8_t *storeBGR888(uint8_t *dst, unsigned int b, unsigned int g,
+			     unsigned int r);
+
+	/*
+	 * Downscale by averaging the pixels of each color in factor x factor
+	 * blocks of any of the 4 standard Bayer orders. The src array holds
+	 * pointers to the factor lines of a row of blocks.
+	 */
+	template<typename pixel_t, unsigned int shift, unsigned int factor,
+		 bool ccmEnabled>
+	void bin_BGR888(uint8_t *dst, const uint8_t *src[]);
+
 	struct DebayerInputConfig {
 		Size patternSize;
 		unsigned int bpp; /* Memory used per pixel, not precision */
@@ -110,39 +169,150 @@ private:
 		unsigned int bpp; /* Memory used per pixel, not precision */
 		unsigned int stride;
 		unsigned int frameSize;
+		std::vector<unsigned int> planeSizes;
+	};
+
+	struct Output;
+
+	/* Store 2 lines of debayered data to an output in its format */
+	using convertFn = void (DebayerCpu::*)(const Output &output, unsigned int row,
+					       uint8_t *lines[2]);
+
+	struct YuvCoefficients {
+		int y[3];
+		int cb[3];
+		int cr[3];
+		int yOffset;
+		int cOffset;
 	};
 
+	/*
+	 * An output stream. The first output is debayered directly, the other
+	 * ones are downscaled from the lines debayered for the first output.
+	 */
+	struct Output {
+		Size size;
+		DebayerOutputConfig config;
+		unsigned int scale; /* Downscaling factor from the first output */
+		bool swapRedBlue; /* Swap red and blue from the debayered lines */
+		convertFn convert; /* Null when debayering to the output directly */
+		YuvCoefficients yuvCoeffs;
+		uint8_t *dst; /* Buffer of the frame being processed, if any */
+	};
+
+	/* Lines of an additional output being downscaled by a stripe */
+	struct ScaledLines {
+		std::vector<uint16_t> sums;
+		std::vector<uint8_t> lines[2];
+	};
+
+	/* Strategies to read the input frame, see setupInputStrategy() */
+	enum class InputStrategy {
+		Direct, /* Read the input buffer directly */
+		Memcpy, /* Copy the input lines to the line buffers */
+		Stream, /* Copy the input lines with non-temporal streaming loads */
+		Sync, /* Read the input buffer directly between dma-buf syncs */
+	};
+
+	/* Number of frames each input strategy is timed for */
+	static constexpr unsigned int kInputTrialFrames = 2;
+
+	/* Max. supported Bayer pattern height is 4, debayering this requires 5 lines */
+	static constexpr unsigned int kMaxLineBuffers = 5;
+
+	/* A horizontal stripe of the window, debayered by a single thread */
+	struct Stripe {
+		unsigned int index;
+		unsigned int y; /* Offset of the first line from window_.y */
+		unsigned int height;
+		std::vector<uint8_t> lineBuffers[kMaxLineBuffers];
+		unsigned int lineBufferIndex;
+		std::vector<uint8_t> rgbLines[2]; /* Debayered lines to convert to YUV */
+		std::vector<ScaledLines> scaledLines; /* For the outputs after the first */
+		int64_t statsTime; /* Time spent gathering statistics, in ns */
+	};
+
+	class StripeWorker;
+
 	int getInputConfig(PixelFormat inputFormat, DebayerInputConfig &config);
 	int getOutputConfig(PixelFormat outputFormat, DebayerOutputConfig &config);
 	int setupStandardBayerOrder(BayerFormat::Order order);
+	template<bool ccmEnabled>
 	int setDebayerFunctions(PixelFormat inputFormat, PixelFormat outputFormat);
-	void setupInputMemcpy(const uint8_t *linePointers[]);
+	template<bool ccmEnabled>
+	bool setSimdDebayerFunctions(const BayerFormat &bayerFormat);
+	template<bool ccmEnabled>
+	int setBinningFunctions(const BayerFormat &bayerFormat);
+	int selectDebayerFunctions();
+	void setColorTables(const DebayerParams *params);
+	int configureOutput(Output &output, const StreamConfiguration &outputCfg);
+	void setupConversion(Output &output, const StreamConfiguration &outputCfg,
+			     bool direct);
+	void convertRGB(const Output &output, unsigned int row, uint8_t *lines[2]);
+	void convertNV12(const Output &output, unsigned int row, uint8_t *lines[2]);
+	void convertYUYV(const Output &output, unsigned int row, uint8_t *lines[2]);
+	void scaleOutputLines(const Output &output, ScaledLines &scaled,
+			      unsigned int row, uint8_t *lines[2]);
+	void setupOutputLines(Stripe &stripe, uint8_t *lines[2]);
+	void storeOutputLines(Stripe &stripe, unsigned int row, uint8_t *lines[2]);
+	void setupStripes();
+	void stopWorkers();
+	void setupInputStrategy();
+	void updateInputStrategy(int64_t frameTime);
+	bool copyInput() const;
+	void copyLine(uint8_t *dst, const uint8_t *src);
+	void setupInputMemcpy(Stripe &stripe, const uint8_t *linePointers[]);
 	void shiftLinePointers(const uint8_t *linePointers[], const uint8_t *src);
-	void memcpyNextLine(const uint8_t *linePointers[]);
-	void process2(const uint8_t *src, uint8_t *dst);
-	void process4(const uint8_t *src, uint8_t *dst);
-
-	/* Max. supported Bayer pattern height is 4, debayering this requires 5 lines */
-	static constexpr unsigned int kMaxLineBuffers = 5;
+	void memcpyNextLine(Stripe &stripe, const uint8_t *linePointers[]);
+	void processStatsLine(Stripe &stripe, unsigned int line, unsigned int y,
+			      const uint8_t *src[]);
+	void process2(const uint8_t *src, Stripe &stripe);
+	void process4(const uint8_t *src, Stripe &stripe);
+	void readBinnedLines(Stripe &stripe, const uint8_t *src, const uint8_t *linePointers[]);
+	void processBinned(const uint8_t *src, Stripe &stripe);
+	void processStripe(const uint8_t *src, Stripe &stripe);
+	void processFrame(const uint8_t *src);
 
 	DebayerParams::ColorLookupTable red_;
 	DebayerParams::ColorLookupTable green_;
 	DebayerParams::ColorLookupTable blue_;
+	/* Color correction tables, indexed and ordered as the debayered lines */
+	DebayerParams::CcmLookupTable redCcm_;
+	DebayerParams::CcmLookupTable greenCcm_;
+	DebayerParams::CcmLookupTable blueCcm_;
+	DebayerParams::GammaLookupTable gammaLut_;
+	bool ccmEnabled_;
+	uint32_t tablesGeneration_;
+	PixelFormat inputFormat_;
+	PixelFormat outputFormat_; /* Format of the first output */
 	debayerFn debayer0_;
 	debayerFn debayer1_;
 	debayerFn debayer2_;
 	debayerFn debayer3_;
-	Rectangle window_;
+	Rectangle window_; /* Input area, binning_ times the first output size */
+	unsigned int binning_; /* Downscaling factor, 1, 2 or 4 */
+	unsigned int binBlueX_; /* Position of the blue pixel in the 2x2 pattern */
+	unsigned int binBlueY_;
 	DebayerInputConfig inputConfig_;
-	DebayerOutputConfig outputConfig_;
+	std::vector<Output> outputs_;
+	unsigned int maxScale_; /* Largest downscaling factor of the outputs */
 	std::unique_ptr<SwStatsCpu> stats_;
-	uint8_t *lineBuffers_[kMaxLineBuffers];
 	unsigned int lineBufferLength_;
 	unsigned int lineBufferPadding_;
-	unsigned int lineBufferIndex_;
 	unsigned int xShift_; /* Offset of 0/1 applied to window_.x */
-	bool enableInputMemcpy_;
+	InputStrategy inputStrategy_;
+	bool autoInputStrategy_;
+	/* Input strategies to time and their best frame processing times */
+	std::vector<std::pair<InputStrategy, int64_t>> inputTrials_;
+	unsigned int inputTrialFrame_;
+	bool enableSimd_;
+	bool narrowInput_; /* CSI-2 packed input is narrowed to 8 bpp */
 	bool swapRedBlueGains_;
+	unsigned int stripeCount_;
+	std::vector<Stripe> stripes_;
+	std::vector<std::unique_ptr<Thread>> workerThreads_;
+	std::vector<std::unique_ptr<StripeWorker>> workers_;
+	Semaphore stripesDone_;
 	unsigned int measuredFrames_;
 	int64_t frameProcessTime_;
 	/* Skip 30 frames for things to stabilize then measure 30 frames */
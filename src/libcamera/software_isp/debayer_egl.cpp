@@ -0,0 +1,892 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Linaro Ltd
+ *
+ * GPU based debayering class
+ */
+
+#include "debayer_egl.h"
+
+#include <sstream>
+#include <string.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+/**
+ * \class DebayerEGL
+ * \brief Class for debayering on the GPU
+ *
+ * Implementation of debayering with OpenGL ES 3.0 fragment shaders, in an EGL
+ * surfaceless context. The input frame is imported in a texture through
+ * EGL_EXT_image_dma_buf_import and the output frame rendered to directly when
+ * supported by the driver, otherwise the frames are uploaded to and read back
+ * from the GPU through the CPU mappings of the buffers.
+ *
+ * The interpolation and the color lookup tables are applied by the GPU with
+ * results identical to DebayerCpu. The statistics are computed by SwStatsCpu
+ * on the CPU while the GPU renders the frame.
+ *
+ * The EGL context is made current in the calling thread for the duration of
+ * the configure() and process() calls only, allowing them to be called from
+ * different threads.
+ */
+
+namespace {
+
+const char *vertexShaderSource = R"(#version 300 es
+void main()
+{
+	/* Full screen triangle */
+	vec2 pos = vec2(float((gl_VertexID & 1) << 2) - 1.0,
+			float((gl_VertexID & 2) << 1) - 1.0);
+	gl_Position = vec4(pos, 0.0, 1.0);
+}
+)";
+
+/*
+ * The fragment shader is configured through the following defines:
+ * - INPUT_8, INPUT_16 or INPUT_10P: 8 bpp, unpacked 16 bpp or CSI-2 packed
+ *   10 bpp input
+ * - SHIFT: number of bits to shift the values right by to get 8 bpp values
+ * - RED_X, RED_Y: position of the red pixel in the 2x2 Bayer pattern
+ * - WINDOW_X, WINDOW_Y: position of the output window in the input frame
+ * - INPUT_WIDTH, INPUT_HEIGHT: size of the input frame in pixels
+ */
+const char *fragmentShaderSource = R"(
+precision highp float;
+precision highp int;
+
+uniform highp sampler2D inputTexture;
+uniform highp sampler2D lut;
+uniform bool swapRedBlue;
+
+out vec4 fragColor;
+
+/* Mirror coordinates at the frame edges, keeping the Bayer pattern */
+int mirror(int v, int size)
+{
+	v = abs(v);
+	return size - 1 - abs(size - 1 - v);
+}
+
+int fetch(int x, int y)
+{
+	x = mirror(x, INPUT_WIDTH);
+	y = mirror(y, INPUT_HEIGHT);
+
+#if defined(INPUT_10P)
+	/* 5 bytes per 4 pixels, use the 8 most significant bits only */
+	vec4 t = texelFetch(inputTexture, ivec2((x >> 2) * 5 + (x & 3), y), 0);
+	return int(t.r * 255.0 + 0.5);
+#elif defined(INPUT_16)
+	vec4 t = texelFetch(inputTexture, ivec2(x, y), 0);
+	return int(t.r * 255.0 + 0.5) | (int(t.g * 255.0 + 0.5) << 8);
+#else
+	vec4 t = texelFetch(inputTexture, ivec2(x, y), 0);
+	return int(t.r * 255.0 + 0.5);
+#endif
+}
+
+void main()
+{
+	int x = int(gl_FragCoord.x) + WINDOW_X;
+	int y = int(gl_FragCoord.y) + WINDOW_Y;
+	bool redColumn = ((x ^ RED_X) & 1) == 0;
+	bool redLine = ((y ^ RED_Y) & 1) == 0;
+
+	int c = fetch(x, y);
+	int h = fetch(x - 1, y) + fetch(x + 1, y);
+	int v = fetch(x, y - 1) + fetch(x, y + 1);
+	ivec3 rgb;
+
+	if (redColumn == redLine) {
+		int d = fetch(x - 1, y - 1) + fetch(x + 1, y - 1) +
+			fetch(x - 1, y + 1) + fetch(x + 1, y + 1);
+		int g = (h + v) >> (SHIFT + 2);
+
+		if (redLine)
+			rgb = ivec3(c >> SHIFT, g, d >> (SHIFT + 2));
+		else
+			rgb = ivec3(d >> (SHIFT + 2), g, c >> SHIFT);
+	} else if (redLine) {
+		rgb = ivec3(h >> (SHIFT + 1), c >> SHIFT, v >> (SHIFT + 1));
+	} else {
+		rgb = ivec3(v >> (SHIFT + 1), c >> SHIFT, h >> (SHIFT + 1));
+	}
+
+	float r = texelFetch(lut, ivec2(rgb.r, 0), 0).r;
+	float g = texelFetch(lut, ivec2(rgb.g, 0), 0).g;
+	float b = texelFetch(lut, ivec2(rgb.b, 0), 0).b;
+
+	fragColor = swapRedBlue ? vec4(b, g, r, 1.0) : vec4(r, g, b, 1.0);
+}
+)";
+
+/* DRM_FORMAT_GR88, 2 channels 16 bpp format without a PixelFormat equivalent */
+constexpr uint32_t kDrmFormatGR88 = 'G' | ('R' << 8) | ('8' << 16) | ('8' << 24);
+
+bool hasExtension(const char *extensions, const char *name)
+{
+	if (!extensions)
+		return false;
+
+	std::istringstream stream(extensions);
+	std::string extension;
+	while (stream >> extension) {
+		if (extension == name)
+			return true;
+	}
+
+	return false;
+}
+
+bool isStandardBayerOrder(BayerFormat::Order order)
+{
+	return order == BayerFormat::BGGR || order == BayerFormat::GBRG ||
+	       order == BayerFormat::GRBG || order == BayerFormat::RGGB;
+}
+
+} /* namespace */
+
+/**
+ * \brief Constructs a DebayerEGL object
+ * \param[in] stats Pointer to the stats object to use
+ *
+ * The object is invalid if no EGL display supporting OpenGL ES 3.0 is
+ * available, see isValid().
+ */
+DebayerEGL::DebayerEGL(std::unique_ptr<SwStatsCpu> stats)
+	: display_(EGL_NO_DISPLAY), context_(EGL_NO_CONTEXT),
+	  hardwareAccelerated_(false), dmaBufImport_(false),
+	  dmaBufInput_(false), dmaBufOutput_(false), eglCreateImageKHR_(nullptr),
+	  eglDestroyImageKHR_(nullptr), glEGLImageTargetTexture2DOES_(nullptr),
+	  program_(0), inputTexture_(0), outputTexture_(0), lutGeneration_(0),
+	  stats_(std::move(stats))
+{
+	if (initEGL() < 0) {
+		if (context_ != EGL_NO_CONTEXT)
+			eglDestroyContext(display_, context_);
+		context_ = EGL_NO_CONTEXT;
+	}
+}
+
+DebayerEGL::~DebayerEGL()
+{
+	if (context_ == EGL_NO_CONTEXT)
+		return;
+
+	if (makeCurrent()) {
+		destroyGLObjects();
+		glDeleteTextures(1, &inputImageTexture_);
+		glDeleteTextures(1, &outputImageTexture_);
+		glDeleteTextures(1, &lutTexture_);
+		glDeleteFramebuffers(1, &framebuffer_);
+		glDeleteVertexArrays(1, &vertexArray_);
+		releaseCurrent();
+	}
+
+	/*
+	 * The display is shared with the other users of EGL in the process,
+	 * don't terminate it.
+	 */
+	eglDestroyContext(display_, context_);
+}
+
+/**
+ * \fn bool DebayerEGL::isValid() const
+ * \brief Check if the GPU debayering is available
+ * \return True if an OpenGL ES 3.0 context has been created, false otherwise
+ */
+
+/**
+ * \fn bool DebayerEGL::isHardwareAccelerated() const
+ * \brief Check if the OpenGL ES implementation runs on a GPU
+ *
+ * Debayering with a software rasterizer is usually slower than with
+ * DebayerCpu.
+ *
+ * \return True if rendering is hardware accelerated, false otherwise
+ */
+
+int DebayerEGL::initEGL()
+{
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+			eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (getPlatformDisplay)
+			display_ = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+						      EGL_DEFAULT_DISPLAY, nullptr);
+	}
+
+	if (display_ == EGL_NO_DISPLAY)
+		display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, nullptr, nullptr)) {
+		LOG(Debayer, Debug) << "No EGL display available";
+		return -ENODEV;
+	}
+
+	const char *extensions = eglQueryString(display_, EGL_EXTENSIONS);
+	if (!hasExtension(extensions, "EGL_KHR_surfaceless_context")) {
+		LOG(Debayer, Debug) << "EGL surfaceless contexts not supported";
+		return -ENOTSUP;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API))
+		return -ENOTSUP;
+
+	/* Rendering is offscreen only, the context doesn't need a config */
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!hasExtension(extensions, "EGL_KHR_no_config_context")) {
+		const EGLint configAttribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+			EGL_NONE
+		};
+		EGLint numConfigs;
+		if (!eglChooseConfig(display_, configAttribs, &config, 1, &numConfigs) ||
+		    numConfigs < 1) {
+			LOG(Debayer, Debug) << "No OpenGL ES 3.0 EGL configuration";
+			return -ENOTSUP;
+		}
+	}
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_NONE
+	};
+	context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context_ == EGL_NO_CONTEXT) {
+		LOG(Debayer, Debug) << "Failed to create OpenGL ES 3.0 context";
+		return -ENOTSUP;
+	}
+
+	if (!makeCurrent())
+		return -EIO;
+
+	const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+	const std::string rendererName = renderer ? renderer : "";
+	hardwareAccelerated_ = rendererName.find("llvmpipe") == std::string::npos &&
+			       rendererName.find("softpipe") == std::string::npos &&
+			       rendererName.find("SwiftShader") == std::string::npos;
+
+	const char *glExtensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+	if (hasExtension(extensions, "EGL_EXT_image_dma_buf_import") &&
+	    hasExtension(glExtensions, "GL_OES_EGL_image")) {
+		eglCreateImageKHR_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+			eglGetProcAddress("eglCreateImageKHR"));
+		eglDestroyImageKHR_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+			eglGetProcAddress("eglDestroyImageKHR"));
+		glEGLImageTargetTexture2DOES_ = reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+			eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+		dmaBufImport_ = eglCreateImageKHR_ && eglDestroyImageKHR_ &&
+				glEGLImageTargetTexture2DOES_;
+	}
+
+	glGenVertexArrays(1, &vertexArray_);
+	glGenFramebuffers(1, &framebuffer_);
+
+	glGenTextures(1, &lutTexture_);
+	glBindTexture(GL_TEXTURE_2D, lutTexture_);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, DebayerParams::kRGBLookupSize, 1);
+	setTextureParameters();
+
+	glGenTextures(1, &inputImageTexture_);
+	glBindTexture(GL_TEXTURE_2D, inputImageTexture_);
+	setTextureParameters();
+
+	glGenTextures(1, &outputImageTexture_);
+	glBindTexture(GL_TEXTURE_2D, outputImageTexture_);
+	setTextureParameters();
+
+	GLenum error = glGetError();
+	releaseCurrent();
+
+	if (error != GL_NO_ERROR) {
+		LOG(Debayer, Error) << "Failed to initialize OpenGL ES: " << error;
+		return -EIO;
+	}
+
+	LOG(Debayer, Debug)
+		<< "Using OpenGL ES renderer " << rendererName
+		<< (dmaBufImport_ ? " with" : " without") << " dmabuf import";
+
+	return 0;
+}
+
+bool DebayerEGL::makeCurrent()
+{
+	if (!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+		LOG(Debayer, Error)
+			<< "Failed to make EGL context current: " << eglGetError();
+		return false;
+	}
+
+	return true;
+}
+
+void DebayerEGL::releaseCurrent()
+{
+	eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void DebayerEGL::setTextureParameters()
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/* Destroy the objects created by configure() */
+void DebayerEGL::destroyGLObjects()
+{
+	if (program_)
+		glDeleteProgram(program_);
+	if (inputTexture_)
+		glDeleteTextures(1, &inputTexture_);
+	if (outputTexture_)
+		glDeleteTextures(1, &outputTexture_);
+
+	program_ = 0;
+	inputTexture_ = 0;
+	outputTexture_ = 0;
+}
+
+GLuint DebayerEGL::compileShader(GLenum type, const std::string &source)
+{
+	GLuint shader = glCreateShader(type);
+	const char *sources[] = { source.c_str() };
+
+	glShaderSource(shader, 1, sources, nullptr);
+	glCompileShader(shader);
+
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		LOG(Debayer, Error) << "Failed to compile shader: " << log;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+int DebayerEGL::setupProgram(const BayerFormat &bayerFormat, const Size &inputSize)
+{
+	std::ostringstream defines;
+
+	defines << "#version 300 es\n";
+
+	if (bayerFormat.packing == BayerFormat::Packing::CSI2)
+		defines << "#define INPUT_10P\n"
+			<< "#define SHIFT 0\n";
+	else if (bayerFormat.bitDepth > 8)
+		defines << "#define INPUT_16\n"
+			<< "#define SHIFT " << bayerFormat.bitDepth - 8 << "\n";
+	else
+		defines << "#define INPUT_8\n"
+			<< "#define SHIFT 0\n";
+
+	const Point red = bayerFormat.order == BayerFormat::RGGB ? Point(0, 0)
+			: bayerFormat.order == BayerFormat::GRBG ? Point(1, 0)
+			: bayerFormat.order == BayerFormat::GBRG ? Point(0, 1)
+								 : Point(1, 1);
+
+	/*
+	 * Like DebayerCpu, start the window of unpacked formats on a column of
+	 * blue pixels, shifting it one pixel right for the GBRG and RGGB orders.
+	 */
+	const int xShift = red.x == 0 &&
+			   bayerFormat.packing == BayerFormat::Packing::None ? 1 : 0;
+
+	defines << "#define RED_X " << red.x << "\n"
+		<< "#define RED_Y " << red.y << "\n"
+		<< "#define WINDOW_X " << window_.x + xShift << "\n"
+		<< "#define WINDOW_Y " << window_.y << "\n"
+		<< "#define INPUT_WIDTH " << inputSize.width << "\n"
+		<< "#define INPUT_HEIGHT " << inputSize.height << "\n";
+
+	GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER,
+					      defines.str() + fragmentShaderSource);
+	if (!vertexShader || !fragmentShader) {
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+		return -EINVAL;
+	}
+
+	program_ = glCreateProgram();
+	glAttachShader(program_, vertexShader);
+	glAttachShader(program_, fragmentShader);
+	glLinkProgram(program_);
+
+	/* The shaders are freed with the program */
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	GLint status;
+	glGetProgramiv(program_, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1024];
+		glGetProgramInfoLog(program_, sizeof(log), nullptr, log);
+		LOG(Debayer, Error) << "Failed to link program: " << log;
+		return -EINVAL;
+	}
+
+	glUseProgram(program_);
+	glUniform1i(glGetUniformLocation(program_, "inputTexture"), 0);
+	glUniform1i(glGetUniformLocation(program_, "lut"), 1);
+	swapRedBlueUniform_ = glGetUniformLocation(program_, "swapRedBlue");
+
+	return 0;
+}
+
+int DebayerEGL::setupTextures()
+{
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (inputTextureSize_.width > static_cast<unsigned int>(maxSize) ||
+	    inputTextureSize_.height > static_cast<unsigned int>(maxSize)) {
+		LOG(Debayer, Error)
+			<< "Input texture size " << inputTextureSize_
+			<< " exceeds the maximum of " << maxSize;
+		return -EINVAL;
+	}
+
+	glGenTextures(1, &inputTexture_);
+	glBindTexture(GL_TEXTURE_2D, inputTexture_);
+	glTexStorage2D(GL_TEXTURE_2D, 1, inputInternalFormat_,
+		       inputTextureSize_.width, inputTextureSize_.height);
+	setTextureParameters();
+
+	glGenTextures(1, &outputTexture_);
+	glBindTexture(GL_TEXTURE_2D, outputTexture_);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, window_.width, window_.height);
+	setTextureParameters();
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR) {
+		LOG(Debayer, Error) << "Failed to create textures: " << error;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+int DebayerEGL::getInputConfig(PixelFormat inputFormat, DebayerInputConfig &config)
+{
+	BayerFormat bayerFormat =
+		BayerFormat::fromPixelFormat(inputFormat);
+
+	if (!isStandardBayerOrder(bayerFormat.order))
+		return -EINVAL;
+
+	config.outputFormats = std::vector<PixelFormat>({ formats::XRGB8888, formats::ARGB8888,
+							  formats::XBGR8888, formats::ABGR8888 });
+
+	if ((bayerFormat.bitDepth == 8 || bayerFormat.bitDepth == 10 || bayerFormat.bitDepth == 12) &&
+	    bayerFormat.packing == BayerFormat::Packing::None) {
+		config.bpp = (bayerFormat.bitDepth + 7) & ~7;
+		config.patternSize.width = 2;
+		config.patternSize.height = 2;
+		return 0;
+	}
+
+	if (bayerFormat.bitDepth == 10 &&
+	    bayerFormat.packing == BayerFormat::Packing::CSI2) {
+		config.bpp = 10;
+		config.patternSize.width = 4; /* 5 bytes per *4* pixels */
+		config.patternSize.height = 2;
+		return 0;
+	}
+
+	LOG(Debayer, Info)
+		<< "Unsupported input format " << inputFormat.toString();
+	return -EINVAL;
+}
+
+int DebayerEGL::getOutputConfig(PixelFormat outputFormat, DebayerOutputConfig &config)
+{
+	if (outputFormat == formats::XRGB8888 || outputFormat == formats::ARGB8888 ||
+	    outputFormat == formats::XBGR8888 || outputFormat == formats::ABGR8888) {
+		config.bpp = 32;
+		return 0;
+	}
+
+	LOG(Debayer, Info)
+		<< "Unsupported output format " << outputFormat.toString();
+	return -EINVAL;
+}
+
+int DebayerEGL::configure(const StreamConfiguration &inputCfg,
+			  const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	if (getInputConfig(inputCfg.pixelFormat, inputConfig_) != 0)
+		return -EINVAL;
+
+	inputConfig_.stride = inputCfg.stride;
+
+	if (outputCfgs.size() != 1) {
+		LOG(Debayer, Error)
+			<< "Unsupported number of output streams: "
+			<< outputCfgs.size();
+		return -EINVAL;
+	}
+
+	const StreamConfiguration &outputCfg = outputCfgs[0];
+	SizeRange outSizeRange = sizes(inputCfg.pixelFormat, inputCfg.size);
+	std::tie(outputConfig_.stride, outputConfig_.frameSize) =
+		strideAndFrameSize(outputCfg.pixelFormat, outputCfg.size);
+
+	if (!outSizeRange.contains(outputCfg.size) || outputConfig_.stride != outputCfg.stride) {
+		LOG(Debayer, Error)
+			<< "Invalid output size/stride: "
+			<< "\n  " << outputCfg.size << " (" << outSizeRange << ")"
+			<< "\n  " << outputCfg.stride << " (" << outputConfig_.stride << ")";
+		return -EINVAL;
+	}
+
+	if (getOutputConfig(outputCfg.pixelFormat, outputConfig_) != 0)
+		return -EINVAL;
+
+	if (stats_->configure(inputCfg) != 0)
+		return -EINVAL;
+
+	const Size &statsPatternSize = stats_->patternSize();
+	if (inputConfig_.patternSize.width != statsPatternSize.width ||
+	    inputConfig_.patternSize.height != statsPatternSize.height) {
+		LOG(Debayer, Error)
+			<< "mismatching stats and debayer pattern sizes for "
+			<< inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	window_.x = ((inputCfg.size.width - outputCfg.size.width) / 2) &
+		    ~(inputConfig_.patternSize.width - 1);
+	window_.y = ((inputCfg.size.height - outputCfg.size.height) / 2) &
+		    ~(inputConfig_.patternSize.height - 1);
+	window_.width = outputCfg.size.width;
+	window_.height = outputCfg.size.height;
+
+	outputConfig_.planeSizes = { outputConfig_.stride * window_.height };
+
+	/* Don't pass x,y since processStats() already adjusts src */
+	stats_->setWindow(Rectangle(window_.size()));
+	stats_->setStripes(1);
+
+	/* Unpacked 10 and 12 bpp pixels are stored in 2 channels textures */
+	const BayerFormat bayerFormat = BayerFormat::fromPixelFormat(inputCfg.pixelFormat);
+	if (inputConfig_.bpp == 16) {
+		inputInternalFormat_ = GL_RG8;
+		inputFormat_ = GL_RG;
+		inputFourcc_ = kDrmFormatGR88;
+		inputTextureSize_ = Size(inputConfig_.stride / 2, inputCfg.size.height);
+	} else {
+		inputInternalFormat_ = GL_R8;
+		inputFormat_ = GL_RED;
+		inputFourcc_ = formats::R8.fourcc();
+		inputTextureSize_ = Size(inputConfig_.stride, inputCfg.size.height);
+	}
+
+	/*
+	 * The output is read back with the RGBA byte order, swap red and blue
+	 * for the formats stored in BGRA order. Imported dmabufs are rendered
+	 * in the byte order of their format by the GPU.
+	 */
+	outputFourcc_ = outputCfg.pixelFormat.fourcc();
+	swapRedBlue_ = outputCfg.pixelFormat == formats::XRGB8888 ||
+		       outputCfg.pixelFormat == formats::ARGB8888;
+
+	dmaBufInput_ = dmaBufImport_;
+	dmaBufOutput_ = dmaBufImport_;
+
+	if (!makeCurrent())
+		return -EIO;
+
+	destroyGLObjects();
+
+	int ret = setupProgram(bayerFormat, inputCfg.size);
+	if (!ret)
+		ret = setupTextures();
+
+	releaseCurrent();
+
+	return ret;
+}
+
+/*
+ * Get width and height at which the bayer-pattern repeats.
+ * Return pattern-size or an empty Size for an unsupported inputFormat.
+ */
+Size DebayerEGL::patternSize(PixelFormat inputFormat)
+{
+	DebayerEGL::DebayerInputConfig config;
+
+	if (getInputConfig(inputFormat, config) != 0)
+		return {};
+
+	return config.patternSize;
+}
+
+std::vector<PixelFormat> DebayerEGL::formats(PixelFormat inputFormat)
+{
+	DebayerEGL::DebayerInputConfig config;
+
+	if (getInputConfig(inputFormat, config) != 0)
+		return std::vector<PixelFormat>();
+
+	return config.outputFormats;
+}
+
+std::tuple<unsigned int, unsigned int>
+DebayerEGL::strideAndFrameSize(const PixelFormat &outputFormat, const Size &size)
+{
+	DebayerEGL::DebayerOutputConfig config;
+
+	if (getOutputConfig(outputFormat, config) != 0)
+		return std::make_tuple(0, 0);
+
+	/* round up to multiple of 8 for 64 bits alignment */
+	unsigned int stride = (size.width * config.bpp / 8 + 7) & ~7;
+
+	return std::make_tuple(stride, stride * size.height);
+}
+
+EGLImageKHR DebayerEGL::importDmaBuf(const FrameBuffer::Plane &plane, uint32_t fourcc,
+				     const Size &size, unsigned int stride)
+{
+	const EGLint attribs[] = {
+		EGL_WIDTH, static_cast<EGLint>(size.width),
+		EGL_HEIGHT, static_cast<EGLint>(size.height),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(fourcc),
+		EGL_DMA_BUF_PLANE0_FD_EXT, plane.fd.get(),
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(plane.offset),
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(stride),
+		EGL_NONE
+	};
+
+	return eglCreateImageKHR_(display_, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+				  nullptr, attribs);
+}
+
+/*
+ * Bind the input frame to texture unit 0, importing its dmabuf when possible
+ * and uploading the data otherwise.
+ */
+void DebayerEGL::bindInput(FrameBuffer *input, const uint8_t *data, EGLImageKHR *image)
+{
+	glActiveTexture(GL_TEXTURE0);
+
+	if (dmaBufInput_) {
+		*image = importDmaBuf(input->planes()[0], inputFourcc_,
+				      inputTextureSize_, inputConfig_.stride);
+		if (*image != EGL_NO_IMAGE_KHR) {
+			glBindTexture(GL_TEXTURE_2D, inputImageTexture_);
+			glEGLImageTargetTexture2DOES_(GL_TEXTURE_2D, *image);
+			return;
+		}
+
+		LOG(Debayer, Warning)
+			<< "Failed to import input dmabuf, uploading frames instead";
+		dmaBufInput_ = false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, inputTexture_);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+			inputTextureSize_.width, inputTextureSize_.height,
+			inputFormat_, GL_UNSIGNED_BYTE, data);
+}
+
+/*
+ * Attach the output frame to the framebuffer, rendering to its dmabuf when
+ * possible and to a texture read back by the CPU otherwise.
+ */
+void DebayerEGL::bindOutput(FrameBuffer *output, EGLImageKHR *image)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+
+	if (dmaBufOutput_) {
+		*image = importDmaBuf(output->planes()[0], outputFourcc_,
+				      window_.size(), outputConfig_.stride);
+		if (*image != EGL_NO_IMAGE_KHR) {
+			glBindTexture(GL_TEXTURE_2D, outputImageTexture_);
+			glEGLImageTargetTexture2DOES_(GL_TEXTURE_2D, *image);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+					       GL_TEXTURE_2D, outputImageTexture_, 0);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+				return;
+
+			eglDestroyImageKHR_(display_, *image);
+			*image = EGL_NO_IMAGE_KHR;
+		}
+
+		LOG(Debayer, Warning)
+			<< "Failed to render to output dmabuf, reading frames back instead";
+		dmaBufOutput_ = false;
+	}
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, outputTexture_, 0);
+}
+
+void DebayerEGL::processStats(const uint8_t *src)
+{
+	const unsigned int stride = inputConfig_.stride;
+	/* Holds [0] previous- [1] current- [2] next-line */
+	const uint8_t *linePointers[3];
+
+	/* Adjust src to top left corner of the window */
+	src += window_.y * stride + window_.x * inputConfig_.bpp / 8;
+
+	for (unsigned int y = window_.y; y < window_.y + window_.height; y += 2) {
+		linePointers[0] = src;
+		linePointers[1] = src;
+		linePointers[2] = src + stride;
+		stats_->processLine0(y, linePointers);
+		src += 2 * stride;
+	}
+}
+
+void DebayerEGL::process(FrameBuffer *input,
+			 const FlatMap<unsigned int, FrameBuffer *> &outputs,
+			 const DebayerParams *params)
+{
+	const utils::time_point frameStartTime = utils::clock::now();
+
+	/* A single output is supported */
+	FrameBuffer *output = outputs.at(0);
+
+	/* Copy metadata from the input buffer */
+	FrameMetadata &metadata = output->_d()->metadata();
+	metadata.status = input->metadata().status;
+	metadata.sequence = input->metadata().sequence;
+	metadata.timestamp = input->metadata().timestamp;
+
+	MappedFrameBuffer in(input, MappedFrameBuffer::MapFlag::Read |
+				    MappedFrameBuffer::MapFlag::Persistent);
+	if (!in.isValid()) {
+		LOG(Debayer, Error) << "mmap-ing buffer(s) failed";
+		metadata.status = FrameMetadata::FrameError;
+		return;
+	}
+
+	if (!makeCurrent()) {
+		metadata.status = FrameMetadata::FrameError;
+		return;
+	}
+
+	/* Upload the lookup table only when it has changed. */
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, lutTexture_);
+
+	if (!params->generation || params->generation != lutGeneration_) {
+		for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+			lut_[i * 4 + 0] = params->red[i];
+			lut_[i * 4 + 1] = params->green[i];
+			lut_[i * 4 + 2] = params->blue[i];
+			lut_[i * 4 + 3] = UINT8_MAX;
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DebayerParams::kRGBLookupSize, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, lut_.data());
+
+		lutGeneration_ = params->generation;
+	}
+
+	EGLImageKHR inputImage = EGL_NO_IMAGE_KHR;
+	EGLImageKHR outputImage = EGL_NO_IMAGE_KHR;
+
+	bindInput(input, in.planes()[0].data(), &inputImage);
+	bindOutput(output, &outputImage);
+
+	glUseProgram(program_);
+	glUniform1i(swapRedBlueUniform_, outputImage == EGL_NO_IMAGE_KHR && swapRedBlue_);
+	glViewport(0, 0, window_.width, window_.height);
+	glBindVertexArray(vertexArray_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glFlush();
+
+	/* Gather the statistics while the GPU renders the frame */
+	const utils::time_point statsStartTime = utils::clock::now();
+	stats_->startFrame();
+	processStats(in.planes()[0].data());
+	statsTime_ = utils::clock::now() - statsStartTime;
+
+	if (outputImage == EGL_NO_IMAGE_KHR) {
+		MappedFrameBuffer out(output, MappedFrameBuffer::MapFlag::Write |
+					      MappedFrameBuffer::MapFlag::Persistent);
+		if (out.isValid()) {
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glPixelStorei(GL_PACK_ROW_LENGTH, outputConfig_.stride / 4);
+			glReadPixels(0, 0, window_.width, window_.height, GL_RGBA,
+				     GL_UNSIGNED_BYTE, out.planes()[0].data());
+		} else {
+			LOG(Debayer, Error) << "mmap-ing buffer(s) failed";
+			metadata.status = FrameMetadata::FrameError;
+		}
+	} else {
+		glFinish();
+	}
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR) {
+		LOG(Debayer, Error) << "Failed to process frame: " << error;
+		metadata.status = FrameMetadata::FrameError;
+	}
+
+	if (inputImage != EGL_NO_IMAGE_KHR)
+		eglDestroyImageKHR_(display_, inputImage);
+	if (outputImage != EGL_NO_IMAGE_KHR)
+		eglDestroyImageKHR_(display_, outputImage);
+
+	releaseCurrent();
+
+	metadata.planes()[0].bytesused = outputConfig_.planeSizes[0];
+
+	processingTime_ = utils::clock::now() - frameStartTime;
+
+	stats_->finishFrame(metadata.sequence);
+	outputBufferReady.emit(output);
+	inputBufferReady.emit(input);
+}
+
+SizeRange DebayerEGL::sizes(PixelFormat inputFormat, const Size &inputSize)
+{
+	Size patternSize = this->patternSize(inputFormat);
+	unsigned int borderHeight = patternSize.height;
+
+	if (patternSize.isNull())
+		return {};
+
+	/* No need for top/bottom border with a pattern height of 2 */
+	if (patternSize.height == 2)
+		borderHeight = 0;
+
+	/*
+	 * For debayer interpolation a border is kept around the entire image
+	 * and the minimum output size is pattern-height x pattern-width.
+	 */
+	if (inputSize.width < (3 * patternSize.width) ||
+	    inputSize.height < (2 * borderHeight + patternSize.height)) {
+		LOG(Debayer, Warning)
+			<< "Input format size too small: " << inputSize.toString();
+		return {};
+	}
+
+	return SizeRange(Size(patternSize.width, patternSize.height),
+			 Size((inputSize.width - 2 * patternSize.width) & ~(patternSize.width - 1),
+			      (inputSize.height - 2 * borderHeight) & ~(patternSize.height - 1)),
+			 patternSize.width, patternSize.height);
+}
+
+} /* namespace libcamera */
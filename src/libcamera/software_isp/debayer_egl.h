@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Linaro Ltd
+ *
+ * GPU based debayering header
+ */
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+/* gl2ext.h depends on the definitions of gl3.h */
+#include <GLES2/gl2ext.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/bayer_format.h"
+
+#include "debayer.h"
+#include "swstats_cpu.h"
+
+namespace libcamera {
+
+class DebayerEGL : public Debayer
+{
+public:
+	DebayerEGL(std::unique_ptr<SwStatsCpu> stats);
+	~DebayerEGL();
+
+	bool isValid() const { return context_ != EGL_NO_CONTEXT; }
+	bool isHardwareAccelerated() const { return hardwareAccelerated_; }
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs);
+	Size patternSize(PixelFormat inputFormat);
+	std::vector<PixelFormat> formats(PixelFormat input);
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &outputFormat, const Size &size);
+	void process(FrameBuffer *input, const FlatMap<unsigned int, FrameBuffer *> &outputs,
+		     const DebayerParams *params);
+	SizeRange sizes(PixelFormat inputFormat, const Size &inputSize);
+
+	const SharedFD &getStatsFD() { return stats_->getStatsFD(); }
+	void setStatsSampling(unsigned int frameInterval, unsigned int xSubsampling)
+	{
+		stats_->setSampling(frameInterval, xSubsampling);
+	}
+	unsigned int frameSize([[maybe_unused]] unsigned int output)
+	{
+		return outputConfig_.frameSize;
+	}
+	const std::vector<unsigned int> &planeSizes([[maybe_unused]] unsigned int output)
+	{
+		return outputConfig_.planeSizes;
+	}
+
+private:
+	struct DebayerInputConfig {
+		Size patternSize;
+		unsigned int bpp; /* Memory used per pixel, not precision */
+		unsigned int stride;
+		std::vector<PixelFormat> outputFormats;
+	};
+
+	struct DebayerOutputConfig {
+		unsigned int bpp; /* Memory used per pixel, not precision */
+		unsigned int stride;
+		unsigned int frameSize;
+		std::vector<unsigned int> planeSizes;
+	};
+
+	int getInputConfig(PixelFormat inputFormat, DebayerInputConfig &config);
+	int getOutputConfig(PixelFormat outputFormat, DebayerOutputConfig &config);
+	int initEGL();
+	bool makeCurrent();
+	void releaseCurrent();
+	void setTextureParameters();
+	void destroyGLObjects();
+	GLuint compileShader(GLenum type, const std::string &source);
+	int setupProgram(const BayerFormat &bayerFormat, const Size &inputSize);
+	int setupTextures();
+	EGLImageKHR importDmaBuf(const FrameBuffer::Plane &plane, uint32_t fourcc,
+				 const Size &size, unsigned int stride);
+	void bindInput(FrameBuffer *input, const uint8_t *data, EGLImageKHR *image);
+	void bindOutput(FrameBuffer *output, EGLImageKHR *image);
+	void processStats(const uint8_t *src);
+
+	EGLDisplay display_;
+	EGLContext context_;
+	bool hardwareAccelerated_;
+	bool dmaBufImport_;
+	bool dmaBufInput_;
+	bool dmaBufOutput_;
+
+	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_;
+	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES_;
+
+	GLuint program_;
+	GLuint vertexArray_;
+	GLuint inputTexture_; /* Input uploaded from the CPU */
+	GLuint inputImageTexture_; /* Input imported from a dmabuf */
+	GLuint lutTexture_;
+	GLuint outputTexture_; /* Output read back by the CPU */
+	GLuint outputImageTexture_; /* Output rendered to a dmabuf */
+	GLuint framebuffer_;
+	GLint swapRedBlueUniform_;
+
+	/* Input texture format and size in texels */
+	GLenum inputInternalFormat_;
+	GLenum inputFormat_;
+	uint32_t inputFourcc_;
+	Size inputTextureSize_;
+	uint32_t outputFourcc_;
+	bool swapRedBlue_;
+
+	uint32_t lutGeneration_;
+	std::array<uint8_t, 4 * DebayerParams::kRGBLookupSize> lut_;
+	Rectangle window_;
+	DebayerInputConfig inputConfig_;
+	DebayerOutputConfig outputConfig_;
+	std::unique_ptr<SwStatsCpu> stats_;
+};
+
+} /* namespace libcamera */
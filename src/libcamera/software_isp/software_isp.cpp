@@ -7,12 +7,18 @@
 
 #include "libcamera/internal/software_isp/software_isp.h"
 
+#include <algorithm>
 #include <cmath>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <libcamera/base/file.h>
+#include <libcamera/base/utils.h>
+
 #include <libcamera/formats.h>
 #include <libcamera/stream.h>
 
@@ -21,8 +27,14 @@
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/mapped_framebuffer.h"
 #include "libcamera/internal/software_isp/debayer_params.h"
+#include "libcamera/internal/software_isp/swisp_stats.h"
+#include "libcamera/internal/tracepoints.h"
+#include "libcamera/internal/yaml_parser.h"
 
 #include "debayer_cpu.h"
+#if HAVE_DEBAYER_EGL
+#include "debayer_egl.h"
+#endif
 
 /**
  * \file software_isp.cpp
@@ -48,9 +60,64 @@ LOG_DEFINE_CATEGORY(SoftwareIsp)
  * \brief A signal emitted when the output frame buffer completes
  */
 
+/**
+ * \struct SoftwareIsp::FrameTimes
+ * \brief Times spent by the Software ISP on a frame
+ *
+ * \var SoftwareIsp::FrameTimes::processing
+ * \brief The time taken to process the frame
+ *
+ * \var SoftwareIsp::FrameTimes::stats
+ * \brief The time spent gathering statistics, included in the processing
+ * time
+ *
+ * \var SoftwareIsp::FrameTimes::queue
+ * \brief The time the frame waited in the queue before being processed
+ */
+
+/**
+ * \struct SoftwareIsp::Counters
+ * \brief Software ISP performance counters, accumulated since construction
+ *
+ * \var SoftwareIsp::Counters::frames
+ * \brief The number of processed frames
+ *
+ * \var SoftwareIsp::Counters::dropped
+ * \brief The number of frames dropped without processing, as too many frames
+ * were already queued
+ *
+ * \var SoftwareIsp::Counters::last
+ * \brief The times of the last processed frame
+ *
+ * \var SoftwareIsp::Counters::total
+ * \brief The sums of the times of all processed frames
+ *
+ * \var SoftwareIsp::Counters::max
+ * \brief The maximum times of all processed frames
+ */
+
+/**
+ * \var SoftwareIsp::kMaxOutputs
+ * \brief The maximum number of outputs supported by any debayering
+ * implementation
+ *
+ * The number of outputs supported by the implementation in use is returned by
+ * maxOutputs().
+ */
+
+/**
+ * \var SoftwareIsp::frameTimesReady
+ * \brief A signal emitted with the frame times when an output frame buffer
+ * completes, before outputBufferReady
+ */
+
 /**
  * \var SoftwareIsp::ispStatsReady
  * \brief A signal emitted when the statistics for IPA are ready
+ *
+ * The signal carries the frame sequence number and the index of the shared
+ * statistics buffer holding the statistics of the frame, to be passed to
+ * processStats().
  */
 
 /**
@@ -66,46 +133,65 @@ LOG_DEFINE_CATEGORY(SoftwareIsp)
  * handler
  */
 SoftwareIsp::SoftwareIsp(PipelineHandler *pipe, const CameraSensor *sensor)
-	: dmaHeap_(DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
+	: ispWorkerThread_("soft-isp"), paramsBufferId_(0), numOutputs_(0),
+	  maxQueuedFrames_(kDefaultMaxQueuedFrames), statsFrameInterval_(1),
+	  statsXSubsampling_(1), statsDecimation_(0), framesSinceDrop_(0),
+	  dmaHeap_(DmaBufAllocator::DmaBufAllocatorFlag::UDmaBufHugePages |
+		   DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
 		   DmaBufAllocator::DmaBufAllocatorFlag::SystemHeap |
-		   DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf)
+		   DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf),
+	  counters_({}), recorder_("simple")
 {
 	/*
-	 * debayerParams_ must be initialized because the initial value is used for
-	 * the first two frames, i.e. until stats processing starts providing its
-	 * own parameters.
-	 *
-	 * \todo This should be handled in the same place as the related
-	 * operations, in the IPA module.
+	 * Output buffers are written by the CPU, prefer huge pages when the
+	 * system reserves them to lower the TLB pressure on large frames.
 	 */
-	std::array<uint8_t, 256> gammaTable;
-	for (unsigned int i = 0; i < 256; i++)
-		gammaTable[i] = UINT8_MAX * std::pow(i / 256.0, 0.5);
-	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
-		debayerParams_.red[i] = gammaTable[i];
-		debayerParams_.green[i] = gammaTable[i];
-		debayerParams_.blue[i] = gammaTable[i];
-	}
-
 	if (!dmaHeap_.isValid()) {
 		LOG(SoftwareIsp, Error) << "Failed to create DmaBufAllocator object";
 		return;
 	}
 
-	sharedParams_ = SharedMemObject<DebayerParams>("softIsp_params");
+	/*
+	 * Keep output buffers released by the application to reuse them when
+	 * the camera is reconfigured, e.g. when switching between still and
+	 * video capture. The pool is shared by all cameras, buffers released
+	 * by one camera can then be used by another one.
+	 */
+	dmaHeap_.useSharedPool();
+	dmaHeap_.setPoolCapacity(kBufferPoolCapacity);
+
+	sharedParams_ = SharedMemObject<std::array<DebayerParams, DebayerParams::kBufferCount>>(
+		"softIsp_params");
 	if (!sharedParams_) {
 		LOG(SoftwareIsp, Error) << "Failed to create shared memory for parameters";
 		return;
 	}
 
-	auto stats = std::make_unique<SwStatsCpu>();
-	if (!stats->isValid()) {
-		LOG(SoftwareIsp, Error) << "Failed to create SwStatsCpu object";
-		return;
+	/*
+	 * The parameters buffers must be initialized because the initial value
+	 * is used for the first two frames, i.e. until stats processing starts
+	 * providing its own parameters.
+	 *
+	 * \todo This should be handled in the same place as the related
+	 * operations, in the IPA module.
+	 */
+	std::array<uint8_t, 256> gammaTable;
+	for (unsigned int i = 0; i < 256; i++)
+		gammaTable[i] = UINT8_MAX * std::pow(i / 256.0, 0.5);
+	for (DebayerParams &params : *sharedParams_) {
+		for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+			params.red[i] = gammaTable[i];
+			params.green[i] = gammaTable[i];
+			params.blue[i] = gammaTable[i];
+		}
+		params.ccmEnabled = false;
+		params.generation = 0;
 	}
-	stats->statsReady.connect(this, &SoftwareIsp::statsReady);
 
-	debayer_ = std::make_unique<DebayerCpu>(std::move(stats));
+	debayer_ = createDebayer();
+	if (!debayer_)
+		return;
+
 	debayer_->inputBufferReady.connect(this, &SoftwareIsp::inputReady);
 	debayer_->outputBufferReady.connect(this, &SoftwareIsp::outputReady);
 
@@ -125,6 +211,8 @@ SoftwareIsp::SoftwareIsp(PipelineHandler *pipe, const CameraSensor *sensor)
 	if (ipaTuningFile.empty())
 		ipaTuningFile = ipa_->configurationFile("uncalibrated.yaml");
 
+	loadConfiguration(ipaTuningFile);
+
 	int ret = ipa_->init(IPASettings{ ipaTuningFile, sensor->model() },
 			     debayer_->getStatsFD(),
 			     sharedParams_.fd(),
@@ -135,6 +223,10 @@ SoftwareIsp::SoftwareIsp(PipelineHandler *pipe, const CameraSensor *sensor)
 		return;
 	}
 
+	if (recorder_.isEnabled())
+		recordedStats_ = SharedMem(debayer_->getStatsFD(),
+					   sizeof(std::array<SwIspStats, SwIspStats::kBufferCount>));
+
 	ipa_->setIspParams.connect(this, &SoftwareIsp::saveIspParams);
 	ipa_->setSensorControls.connect(this, &SoftwareIsp::setSensorCtrls);
 
@@ -143,31 +235,130 @@ SoftwareIsp::SoftwareIsp(PipelineHandler *pipe, const CameraSensor *sensor)
 
 SoftwareIsp::~SoftwareIsp()
 {
-	/* make sure to destroy the DebayerCpu before the ispWorkerThread_ is gone */
+	/* make sure to destroy the Debayer before the ispWorkerThread_ is gone */
 	debayer_.reset();
 }
 
+std::unique_ptr<SwStatsCpu> SoftwareIsp::createStats()
+{
+	auto stats = std::make_unique<SwStatsCpu>();
+	if (!stats->isValid()) {
+		LOG(SoftwareIsp, Error) << "Failed to create SwStatsCpu object";
+		return nullptr;
+	}
+	stats->statsReady.connect(this, &SoftwareIsp::statsReady);
+
+	return stats;
+}
+
+/*
+ * Debayer on the GPU when a hardware accelerated OpenGL ES implementation is
+ * available, on the CPU otherwise. The LIBCAMERA_SOFTISP_DEBAYER environment
+ * variable selects the implementation explicitly.
+ */
+std::unique_ptr<Debayer> SoftwareIsp::createDebayer()
+{
+	const char *debayerEnv = utils::secure_getenv("LIBCAMERA_SOFTISP_DEBAYER");
+	const std::string implementation = debayerEnv ? debayerEnv : "";
+
+	if (!implementation.empty() && implementation != "cpu" &&
+	    implementation != "egl")
+		LOG(SoftwareIsp, Warning)
+			<< "Unknown debayering implementation " << implementation;
+
+#if HAVE_DEBAYER_EGL
+	if (implementation != "cpu") {
+		std::unique_ptr<SwStatsCpu> stats = createStats();
+		if (!stats)
+			return nullptr;
+
+		auto debayer = std::make_unique<DebayerEGL>(std::move(stats));
+		if (debayer->isValid() &&
+		    (debayer->isHardwareAccelerated() || implementation == "egl")) {
+			LOG(SoftwareIsp, Info) << "Debayering on the GPU";
+			return debayer;
+		}
+
+		if (implementation == "egl")
+			LOG(SoftwareIsp, Warning)
+				<< "GPU debayering not available, using the CPU";
+	}
+#else
+	if (implementation == "egl")
+		LOG(SoftwareIsp, Warning)
+			<< "GPU debayering not supported, using the CPU";
+#endif
+
+	std::unique_ptr<SwStatsCpu> stats = createStats();
+	if (!stats)
+		return nullptr;
+
+	return std::make_unique<DebayerCpu>(std::move(stats));
+}
+
 /**
- * \fn int SoftwareIsp::loadConfiguration([[maybe_unused]] const std::string &filename)
  * \brief Load a configuration from a file
  * \param[in] filename The file to load the configuration data from
  *
- * Currently is a stub doing nothing and always returning "success".
+ * The configuration is read from the optional 'debayer' section of the tuning
+ * file. The supported parameters are
+ *
+ * - 'stripes', the number of horizontal stripes frames are split in to be
+ *   debayered concurrently in multiple threads. It defaults to 1 and can be
+ *   overridden by the LIBCAMERA_SOFTISP_STRIPES environment variable.
+ * - 'maxQueuedFrames', the maximum number of frames waiting to be processed
+ *   before new frames get dropped, see process(). It defaults to 2, and 0
+ *   never drops frames.
  *
- * \return 0 on success
+ * \return 0 on success, a negative errno value otherwise
  */
+int SoftwareIsp::loadConfiguration(const std::string &filename)
+{
+	unsigned int stripes = 1;
+	int ret = 0;
+
+	File file(filename);
+	if (file.open(File::OpenModeFlag::ReadOnly)) {
+		std::unique_ptr<YamlObject> root = YamlParser::parse(file);
+		if (root) {
+			const YamlObject &config = (*root)["debayer"];
+			stripes = config["stripes"].get<unsigned int>(stripes);
+			maxQueuedFrames_ = config["maxQueuedFrames"].get<unsigned int>(maxQueuedFrames_);
+		} else {
+			LOG(SoftwareIsp, Warning)
+				<< "Failed to parse configuration file " << filename;
+			ret = -EINVAL;
+		}
+	} else {
+		ret = file.error();
+		LOG(SoftwareIsp, Warning)
+			<< "Failed to open configuration file " << filename
+			<< ": " << strerror(-ret);
+	}
+
+	const char *stripesEnv = utils::secure_getenv("LIBCAMERA_SOFTISP_STRIPES");
+	if (stripesEnv)
+		stripes = strtoul(stripesEnv, nullptr, 10);
+
+	debayer_->setStripes(stripes);
+
+	return ret;
+}
 
 /**
  * \brief Process the statistics gathered
+ * \param[in] frame The frame sequence number
+ * \param[in] bufferId The index of the shared statistics buffer
  * \param[in] sensorControls The sensor controls
  *
  * Requests the IPA to calculate new parameters for ISP and new control
  * values for the sensor.
  */
-void SoftwareIsp::processStats(const ControlList &sensorControls)
+void SoftwareIsp::processStats(const uint32_t frame, const uint32_t bufferId,
+			       const ControlList &sensorControls)
 {
 	ASSERT(ipa_);
-	ipa_->processStats(sensorControls);
+	ipa_->processStats(frame, bufferId, sensorControls);
 }
 
 /**
@@ -204,6 +395,38 @@ SizeRange SoftwareIsp::sizes(PixelFormat inputFormat, const Size &inputSize)
 	return debayer_->sizes(inputFormat, inputSize);
 }
 
+/**
+ * \brief Get the maximum number of outputs produced concurrently
+ *
+ * All outputs are produced from a single pass over the input frame, sharing
+ * the debayering and the statistics.
+ *
+ * \return The maximum number of outputs
+ */
+unsigned int SoftwareIsp::maxOutputs() const
+{
+	ASSERT(debayer_);
+
+	return debayer_->maxOutputs();
+}
+
+/**
+ * \brief Get the closest size an additional output can be produced at
+ * \param[in] firstSize The size of the first output
+ * \param[in] size The requested size of the additional output
+ *
+ * Outputs other than the first one are downscaled from the first output, which
+ * constrains their size.
+ *
+ * \return The closest supported size for the additional output
+ */
+Size SoftwareIsp::outputSize(const Size &firstSize, const Size &size)
+{
+	ASSERT(debayer_);
+
+	return debayer_->outputSize(firstSize, size);
+}
+
 /**
  * Get the output stride and the frame size in bytes for the given output format and size
  * \param[in] outputFormat The output format
@@ -232,11 +455,28 @@ int SoftwareIsp::configure(const StreamConfiguration &inputCfg,
 {
 	ASSERT(ipa_ && debayer_);
 
-	int ret = ipa_->configure(sensorControls);
+	ipa::soft::StatsConfig statsConfig;
+	int ret = ipa_->configure(sensorControls, &statsConfig);
+	if (ret < 0)
+		return ret;
+
+	debayer_->setStatsSampling(statsConfig.frameInterval,
+				   statsConfig.xSubsampling);
+
+	statsFrameInterval_ = statsConfig.frameInterval;
+	statsXSubsampling_ = statsConfig.xSubsampling;
+	statsDecimation_ = 0;
+	framesSinceDrop_ = 0;
+
+	numOutputs_ = 0;
+
+	ret = debayer_->configure(inputCfg, outputCfgs);
 	if (ret < 0)
 		return ret;
 
-	return debayer_->configure(inputCfg, outputCfgs);
+	numOutputs_ = outputCfgs.size();
+
+	return 0;
 }
 
 /**
@@ -252,29 +492,10 @@ int SoftwareIsp::exportBuffers(unsigned int output, unsigned int count,
 {
 	ASSERT(debayer_ != nullptr);
 
-	/* single output for now */
-	if (output >= 1)
+	if (output >= numOutputs_)
 		return -EINVAL;
 
-	for (unsigned int i = 0; i < count; i++) {
-		const std::string name = "frame-" + std::to_string(i);
-		const size_t frameSize = debayer_->frameSize();
-
-		FrameBuffer::Plane outPlane;
-		outPlane.fd = SharedFD(dmaHeap_.alloc(name.c_str(), frameSize));
-		if (!outPlane.fd.isValid()) {
-			LOG(SoftwareIsp, Error)
-				<< "failed to allocate a dma_buf";
-			return -ENOMEM;
-		}
-		outPlane.offset = 0;
-		outPlane.length = frameSize;
-
-		std::vector<FrameBuffer::Plane> planes{ outPlane };
-		buffers->emplace_back(std::make_unique<FrameBuffer>(std::move(planes)));
-	}
-
-	return count;
+	return dmaHeap_.exportBuffers(count, debayer_->planeSizes(output), buffers);
 }
 
 /**
@@ -285,7 +506,7 @@ int SoftwareIsp::exportBuffers(unsigned int output, unsigned int count,
  * \return 0 on success, a negative errno on failure
  */
 int SoftwareIsp::queueBuffers(FrameBuffer *input,
-			      const std::map<unsigned int, FrameBuffer *> &outputs)
+			      const FlatMap<unsigned int, FrameBuffer *> &outputs)
 {
 	unsigned int mask = 0;
 
@@ -300,7 +521,7 @@ int SoftwareIsp::queueBuffers(FrameBuffer *input,
 	for (auto [index, buffer] : outputs) {
 		if (!buffer)
 			return -EINVAL;
-		if (index >= 1) /* only single stream atm */
+		if (index >= numOutputs_)
 			return -EINVAL;
 		if (mask & (1 << index))
 			return -EINVAL;
@@ -308,7 +529,7 @@ int SoftwareIsp::queueBuffers(FrameBuffer *input,
 		mask |= 1 << index;
 	}
 
-	process(input, outputs.at(0));
+	process(input, outputs);
 
 	return 0;
 }
@@ -324,6 +545,7 @@ int SoftwareIsp::start()
 		return ret;
 
 	ispWorkerThread_.start();
+	recorder_.start();
 	return 0;
 }
 
@@ -336,22 +558,142 @@ void SoftwareIsp::stop()
 	ispWorkerThread_.wait();
 
 	ipa_->stop();
+	recorder_.stop();
+
+	/* Frame sequence numbers restart from 0 at the next start */
+	pendingParams_.clear();
+
+	/* Restore the configured statistics sampling for the next start */
+	if (statsDecimation_) {
+		statsDecimation_ = 0;
+		debayer_->setStatsSampling(statsFrameInterval_, statsXSubsampling_);
+	}
+	framesSinceDrop_ = 0;
+
+	MutexLocker locker(countersMutex_);
+	queueTimes_.clear();
+}
+
+/**
+ * \brief Get the performance counters
+ *
+ * The counters are updated when the frames complete, they can be retrieved
+ * from any thread.
+ *
+ * \return The Software ISP performance counters
+ */
+SoftwareIsp::Counters SoftwareIsp::counters() const
+{
+	MutexLocker locker(countersMutex_);
+	return counters_;
 }
 
 /**
  * \brief Passes the input framebuffer to the ISP worker to process
  * \param[in] input The input framebuffer
- * \param[out] output The framebuffer to write the processed frame to
+ * \param[out] outputs The framebuffers to write the processed frame to, by
+ * output stream index
+ *
+ * When the ISP worker can't keep up with the frame rate and maxQueuedFrames
+ * frames are already waiting to be processed, the frame is dropped: its output
+ * buffers complete with the FrameCancelled status, in order with the frames
+ * being processed, without any CPU time spent on them. Statistics are then
+ * gathered on fewer frames until processing catches up.
+ */
+void SoftwareIsp::process(FrameBuffer *input,
+			  const FlatMap<unsigned int, FrameBuffer *> &outputs)
+{
+	const uint32_t frame = input->metadata().sequence;
+
+	/* Use the most recent parameters applicable to the frame */
+	while (!pendingParams_.empty() && pendingParams_.front().first <= frame) {
+		paramsBufferId_ = pendingParams_.front().second;
+		pendingParams_.pop_front();
+	}
+
+	bool drop;
+
+	{
+		MutexLocker locker(countersMutex_);
+
+		drop = maxQueuedFrames_ && queueTimes_.size() >= maxQueuedFrames_;
+		if (drop)
+			counters_.dropped++;
+		else
+			queueTimes_[input] = utils::clock::now();
+	}
+
+	updateBackpressure(drop);
+
+	if (drop) {
+		LOG(SoftwareIsp, Debug)
+			<< "Dropping frame " << frame << ", processing is too slow";
+
+		LIBCAMERA_TRACEPOINT(frame_stage, "simple", "isp_drop", nullptr, frame);
+
+		debayer_->invokeMethod(&Debayer::cancel,
+				       ConnectionTypeQueued, input, outputs);
+		return;
+	}
+
+	LIBCAMERA_TRACEPOINT(frame_stage, "simple", "isp_queue", nullptr, frame);
+
+	debayer_->invokeMethod(&Debayer::process,
+			       ConnectionTypeQueued, input, outputs,
+			       &(*sharedParams_)[paramsBufferId_]);
+}
+
+/*
+ * Adapt the statistics sampling to the processing load. Every dropped frame
+ * halves the rate of the frames statistics are gathered on, up to
+ * kMaxStatsDecimation times, and the rate is doubled back after
+ * kStatsRecoveryFrames frames have been processed without any drop.
  */
-void SoftwareIsp::process(FrameBuffer *input, FrameBuffer *output)
+void SoftwareIsp::updateBackpressure(bool dropped)
 {
-	debayer_->invokeMethod(&DebayerCpu::process,
-			       ConnectionTypeQueued, input, output, debayerParams_);
+	unsigned int decimation = statsDecimation_;
+
+	if (dropped) {
+		framesSinceDrop_ = 0;
+		if (decimation < kMaxStatsDecimation)
+			decimation++;
+	} else if (decimation && ++framesSinceDrop_ >= kStatsRecoveryFrames) {
+		framesSinceDrop_ = 0;
+		decimation--;
+	}
+
+	if (decimation == statsDecimation_)
+		return;
+
+	statsDecimation_ = decimation;
+
+	LOG(SoftwareIsp, Debug)
+		<< "Gathering statistics every "
+		<< (statsFrameInterval_ << decimation) << " frames";
+
+	debayer_->invokeMethod(&Debayer::setStatsSampling, ConnectionTypeQueued,
+			       statsFrameInterval_ << decimation,
+			       statsXSubsampling_);
 }
 
-void SoftwareIsp::saveIspParams()
+void SoftwareIsp::saveIspParams(uint32_t frame, uint32_t bufferId)
 {
-	debayerParams_ = *sharedParams_;
+	if (bufferId >= DebayerParams::kBufferCount) {
+		LOG(SoftwareIsp, Error) << "Invalid parameters buffer " << bufferId;
+		return;
+	}
+
+	LIBCAMERA_TRACEPOINT(frame_stage, "simple", "params_ready", nullptr, frame);
+
+	const DebayerParams &params = (*sharedParams_)[bufferId];
+	recorder_.record(IspRecorder::RecordType::Parameters, frame,
+			 { reinterpret_cast<const uint8_t *>(&params), sizeof(params) });
+
+	/* Parameters are expected in frame order, drop the superseded ones */
+	while (!pendingParams_.empty() && pendingParams_.back().first >= frame)
+		pendingParams_.pop_back();
+
+	pendingParams_.emplace_back(frame, bufferId);
 }
 
 void SoftwareIsp::setSensorCtrls(const ControlList &sensorControls)
@@ -359,18 +701,95 @@ void SoftwareIsp::setSensorCtrls(const ControlList &sensorControls)
 	setSensorControls.emit(sensorControls);
 }
 
-void SoftwareIsp::statsReady()
+void SoftwareIsp::statsReady(uint32_t frame, uint32_t bufferId)
+{
+	LIBCAMERA_TRACEPOINT(frame_stage, "simple", "stats_ready", nullptr, frame);
+
+	if (recordedStats_)
+		recorder_.record(IspRecorder::RecordType::Statistics, frame,
+				 recordedStats_.mem().subspan(bufferId * sizeof(SwIspStats),
+							      sizeof(SwIspStats)));
+
+	ispStatsReady.emit(frame, bufferId);
+}
+
+/*
+ * Compute the times of the frame being completed. Frames are processed in
+ * order, the oldest queued frame is thus the one being completed.
+ */
+SoftwareIsp::FrameTimes SoftwareIsp::frameTimes()
 {
-	ispStatsReady.emit();
+	FrameTimes times;
+
+	times.processing = debayer_->processingTime();
+	times.stats = debayer_->statsTime();
+	times.queue = utils::Duration(0);
+
+	auto it = std::min_element(queueTimes_.begin(), queueTimes_.end(),
+				   [](const auto &a, const auto &b) {
+					   return a.second < b.second;
+				   });
+	if (it != queueTimes_.end()) {
+		const utils::Duration elapsed = utils::clock::now() - it->second;
+		if (elapsed > times.processing)
+			times.queue = elapsed - times.processing;
+	}
+
+	return times;
 }
 
+/*
+ * Called in the ISP worker thread, after the outputReady() calls for all the
+ * outputs of the frame.
+ */
 void SoftwareIsp::inputReady(FrameBuffer *input)
 {
+	MutexLocker locker(countersMutex_);
+
+	/* Dropped frames have not been queued for processing */
+	auto it = queueTimes_.find(input);
+	if (it != queueTimes_.end()) {
+		const FrameTimes times = frameTimes();
+		queueTimes_.erase(it);
+
+		counters_.frames++;
+		counters_.last = times;
+		counters_.total.processing += times.processing;
+		counters_.total.stats += times.stats;
+		counters_.total.queue += times.queue;
+		counters_.max.processing = std::max(counters_.max.processing, times.processing);
+		counters_.max.stats = std::max(counters_.max.stats, times.stats);
+		counters_.max.queue = std::max(counters_.max.queue, times.queue);
+	}
+
+	locker.unlock();
+
 	inputBufferReady.emit(input);
 }
 
+/*
+ * Called in the ISP worker thread for each output of a frame, with the input
+ * buffer that was processed still queued until the inputReady() call that
+ * follows.
+ */
 void SoftwareIsp::outputReady(FrameBuffer *output)
 {
+	if (output->metadata().status == FrameMetadata::FrameCancelled) {
+		outputBufferReady.emit(output);
+		return;
+	}
+
+	FrameTimes times;
+
+	{
+		MutexLocker locker(countersMutex_);
+		times = frameTimes();
+	}
+
+	LIBCAMERA_TRACEPOINT(frame_stage, "simple", "isp_done", output->request(),
+			     output->metadata().sequence);
+
+	frameTimesReady.emit(output, times);
 	outputBufferReady.emit(output);
 }
 
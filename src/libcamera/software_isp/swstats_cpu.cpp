@@ -32,6 +32,12 @@ namespace libcamera {
  *
  * It is also possible to specify a window over which to gather statistics
  * instead of processing the whole frame.
+ *
+ * The statistics are gathered directly in a ring of SwIspStats::kBufferCount
+ * buffers shared with the IPA, the index of the buffer holding the statistics
+ * of a frame is passed to the statsReady signal. The IPA must be done with a
+ * buffer before the statistics of SwIspStats::kBufferCount - 1 more frames are
+ * gathered.
  */
 
 /**
@@ -62,37 +68,49 @@ namespace libcamera {
  */
 
 /**
- * \fn void SwStatsCpu::processLine0(unsigned int y, const uint8_t *src[])
+ * \fn void SwStatsCpu::processLine0(unsigned int y, const uint8_t *src[], unsigned int stripe)
  * \brief Process line 0
  * \param[in] y The y coordinate.
  * \param[in] src The input data.
+ * \param[in] stripe The index of the stripe the line belongs to
  *
  * This function processes line 0 for input formats with
  * patternSize height == 1.
  * It'll process line 0 and 1 for input formats with patternSize height >= 2.
  * This function may only be called after a successful setWindow() call.
+ *
+ * Lines of different stripes may be processed concurrently from different
+ * threads, lines of the same stripe must be processed from a single thread.
  */
 
 /**
- * \fn void SwStatsCpu::processLine2(unsigned int y, const uint8_t *src[])
+ * \fn void SwStatsCpu::processLine2(unsigned int y, const uint8_t *src[], unsigned int stripe)
  * \brief Process line 2 and 3
  * \param[in] y The y coordinate.
  * \param[in] src The input data.
+ * \param[in] stripe The index of the stripe the line belongs to
  *
  * This function processes line 2 and 3 for input formats with
  * patternSize height == 4.
  * This function may only be called after a successful setWindow() call.
+ *
+ * Lines of different stripes may be processed concurrently from different
+ * threads, lines of the same stripe must be processed from a single thread.
  */
 
 /**
- * \var Signal<> SwStatsCpu::statsReady
+ * \var Signal<uint32_t, uint32_t> SwStatsCpu::statsReady
  * \brief Signals that the statistics are ready
+ *
+ * The signal carries the frame sequence number and the index of the shared
+ * statistics buffer holding the statistics of the frame.
  */
 
 /**
  * \typedef SwStatsCpu::statsProcessFn
  * \brief Called when there is data to get statistics from
  * \param[in] src The input data
+ * \param[out] stats The statistics to accumulate the line statistics to
  *
  * These functions take an array of (patternSize_.height + 1) src
  * pointers each pointing to a line in the source image. The middle
@@ -108,6 +126,27 @@ namespace libcamera {
  * \brief Skip lines where this bitmask is set in y
  */
 
+/**
+ * \var unsigned int SwStatsCpu::frameInterval_
+ * \brief Gather statistics on one frame out of frameInterval_
+ */
+
+/**
+ * \var unsigned int SwStatsCpu::xSubsampling_
+ * \brief Sample one 2x2 block out of xSubsampling_ of the blocks sampled by
+ * default
+ */
+
+/**
+ * \var unsigned int SwStatsCpu::frameCount_
+ * \brief Number of frames started since the last setSampling() call
+ */
+
+/**
+ * \var bool SwStatsCpu::skipFrame_
+ * \brief Whether statistics are not gathered for the current frame
+ */
+
 /**
  * \var Rectangle SwStatsCpu::window_
  * \brief Statistics window, set by setWindow(), used every line
@@ -130,7 +169,8 @@ namespace libcamera {
 LOG_DEFINE_CATEGORY(SwStatsCpu)
 
 SwStatsCpu::SwStatsCpu()
-	: sharedStats_("softIsp_stats")
+	: frameInterval_(1), xSubsampling_(1), frameCount_(0), skipFrame_(false),
+	  sharedStats_("softIsp_stats"), bufferId_(0), stripeStats_(1)
 {
 	if (!sharedStats_)
 		LOG(SwStatsCpu, Error)
@@ -157,14 +197,14 @@ static constexpr unsigned int kBlueYMul = 29; /* 0.114 * 256 */
 	yVal = r * kRedYMul;               \
 	yVal += g * kGreenYMul;            \
 	yVal += b * kBlueYMul;             \
-	stats_.yHistogram[yVal * SwIspStats::kYHistogramSize / (256 * 256 * (div))]++;
+	stats.yHistogram[yVal * SwIspStats::kYHistogramSize / (256 * 256 * (div))]++;
 
 #define SWSTATS_FINISH_LINE_STATS() \
-	stats_.sumR_ += sumR;       \
-	stats_.sumG_ += sumG;       \
-	stats_.sumB_ += sumB;
+	stats.sumR_ += sumR;        \
+	stats.sumG_ += sumG;        \
+	stats.sumB_ += sumB;
 
-void SwStatsCpu::statsBGGR8Line0(const uint8_t *src[])
+void SwStatsCpu::statsBGGR8Line0(const uint8_t *src[], SwIspStats &stats)
 {
 	const uint8_t *src0 = src[1] + window_.x;
 	const uint8_t *src1 = src[2] + window_.x;
@@ -174,8 +214,9 @@ void SwStatsCpu::statsBGGR8Line0(const uint8_t *src[])
 	if (swapLines_)
 		std::swap(src0, src1);
 
-	/* x += 4 sample every other 2x2 block */
-	for (int x = 0; x < (int)window_.width; x += 4) {
+	/* x += 4 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 4 * xSubsampling_;
+	for (int x = 0; x < (int)window_.width; x += step) {
 		b = src0[x];
 		g = src0[x + 1];
 		g2 = src1[x];
@@ -189,7 +230,37 @@ void SwStatsCpu::statsBGGR8Line0(const uint8_t *src[])
 	SWSTATS_FINISH_LINE_STATS()
 }
 
-void SwStatsCpu::statsBGGR10Line0(const uint8_t *src[])
+/*
+ * CSI-2 packed 10-bit data narrowed to 8-bit unpacked data by DebayerCpu.
+ * Sample the same pixels as statsGBRG10PLine0().
+ */
+void SwStatsCpu::statsGBRG8Line0(const uint8_t *src[], SwIspStats &stats)
+{
+	const uint8_t *src0 = src[1] + window_.x;
+	const uint8_t *src1 = src[2] + window_.x;
+
+	SWSTATS_START_LINE_STATS(uint8_t)
+
+	if (swapLines_)
+		std::swap(src0, src1);
+
+	/* x += 4 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 4 * xSubsampling_;
+	for (int x = 0; x < (int)window_.width; x += step) {
+		g = src0[x];
+		b = src0[x + 1];
+		r = src1[x];
+		g2 = src1[x + 1];
+
+		g = (g + g2) / 2;
+
+		SWSTATS_ACCUMULATE_LINE_STATS(1)
+	}
+
+	SWSTATS_FINISH_LINE_STATS()
+}
+
+void SwStatsCpu::statsBGGR10Line0(const uint8_t *src[], SwIspStats &stats)
 {
 	const uint16_t *src0 = (const uint16_t *)src[1] + window_.x;
 	const uint16_t *src1 = (const uint16_t *)src[2] + window_.x;
@@ -199,8 +270,9 @@ void SwStatsCpu::statsBGGR10Line0(const uint8_t *src[])
 	if (swapLines_)
 		std::swap(src0, src1);
 
-	/* x += 4 sample every other 2x2 block */
-	for (int x = 0; x < (int)window_.width; x += 4) {
+	/* x += 4 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 4 * xSubsampling_;
+	for (int x = 0; x < (int)window_.width; x += step) {
 		b = src0[x];
 		g = src0[x + 1];
 		g2 = src1[x];
@@ -215,7 +287,7 @@ void SwStatsCpu::statsBGGR10Line0(const uint8_t *src[])
 	SWSTATS_FINISH_LINE_STATS()
 }
 
-void SwStatsCpu::statsBGGR12Line0(const uint8_t *src[])
+void SwStatsCpu::statsBGGR12Line0(const uint8_t *src[], SwIspStats &stats)
 {
 	const uint16_t *src0 = (const uint16_t *)src[1] + window_.x;
 	const uint16_t *src1 = (const uint16_t *)src[2] + window_.x;
@@ -225,8 +297,9 @@ void SwStatsCpu::statsBGGR12Line0(const uint8_t *src[])
 	if (swapLines_)
 		std::swap(src0, src1);
 
-	/* x += 4 sample every other 2x2 block */
-	for (int x = 0; x < (int)window_.width; x += 4) {
+	/* x += 4 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 4 * xSubsampling_;
+	for (int x = 0; x < (int)window_.width; x += step) {
 		b = src0[x];
 		g = src0[x + 1];
 		g2 = src1[x];
@@ -241,7 +314,7 @@ void SwStatsCpu::statsBGGR12Line0(const uint8_t *src[])
 	SWSTATS_FINISH_LINE_STATS()
 }
 
-void SwStatsCpu::statsBGGR10PLine0(const uint8_t *src[])
+void SwStatsCpu::statsBGGR10PLine0(const uint8_t *src[], SwIspStats &stats)
 {
 	const uint8_t *src0 = src[1] + window_.x * 5 / 4;
 	const uint8_t *src1 = src[2] + window_.x * 5 / 4;
@@ -252,8 +325,9 @@ void SwStatsCpu::statsBGGR10PLine0(const uint8_t *src[])
 
 	SWSTATS_START_LINE_STATS(uint8_t)
 
-	/* x += 5 sample every other 2x2 block */
-	for (int x = 0; x < widthInBytes; x += 5) {
+	/* x += 5 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 5 * xSubsampling_;
+	for (int x = 0; x < widthInBytes; x += step) {
 		/* BGGR */
 		b = src0[x];
 		g = src0[x + 1];
@@ -267,7 +341,7 @@ void SwStatsCpu::statsBGGR10PLine0(const uint8_t *src[])
 	SWSTATS_FINISH_LINE_STATS()
 }
 
-void SwStatsCpu::statsGBRG10PLine0(const uint8_t *src[])
+void SwStatsCpu::statsGBRG10PLine0(const uint8_t *src[], SwIspStats &stats)
 {
 	const uint8_t *src0 = src[1] + window_.x * 5 / 4;
 	const uint8_t *src1 = src[2] + window_.x * 5 / 4;
@@ -278,8 +352,9 @@ void SwStatsCpu::statsGBRG10PLine0(const uint8_t *src[])
 
 	SWSTATS_START_LINE_STATS(uint8_t)
 
-	/* x += 5 sample every other 2x2 block */
-	for (int x = 0; x < widthInBytes; x += 5) {
+	/* x += 5 sample every other 2x2 block, times xSubsampling_ */
+	const int step = 5 * xSubsampling_;
+	for (int x = 0; x < widthInBytes; x += step) {
 		/* GBRG */
 		g = src0[x];
 		b = src0[x + 1];
@@ -303,21 +378,53 @@ void SwStatsCpu::startFrame(void)
 	if (window_.width == 0)
 		LOG(SwStatsCpu, Error) << "Calling startFrame() without setWindow()";
 
-	stats_.sumR_ = 0;
-	stats_.sumB_ = 0;
-	stats_.sumG_ = 0;
-	stats_.yHistogram.fill(0);
+	skipFrame_ = frameCount_++ % frameInterval_ != 0;
+	if (skipFrame_)
+		return;
+
+	bufferId_ = (bufferId_ + 1) % SwIspStats::kBufferCount;
+
+	stripeStats_[0] = &(*sharedStats_)[bufferId_];
+	for (unsigned int i = 1; i < stripeStats_.size(); i++)
+		stripeStats_[i] = &partialStats_[i - 1];
+
+	for (SwIspStats *stats : stripeStats_) {
+		stats->sumR_ = 0;
+		stats->sumB_ = 0;
+		stats->sumG_ = 0;
+		stats->yHistogram.fill(0);
+	}
 }
 
 /**
  * \brief Finish statistics calculation for the current frame
+ * \param[in] frame The frame sequence number
  *
- * This may only be called after a successful setWindow() call.
+ * Merge the statistics of all stripes in the shared statistics buffer and
+ * signal that they are available to the IPA.
+ *
+ * This may only be called after a successful setWindow() call, once all the
+ * lines of all stripes have been processed.
+ *
+ * Nothing is signalled for frames skipped due to temporal decimation, the
+ * statistics of the last sampled frame remain valid.
  */
-void SwStatsCpu::finishFrame(void)
+void SwStatsCpu::finishFrame(uint32_t frame)
 {
-	*sharedStats_ = stats_;
-	statsReady.emit();
+	if (skipFrame_)
+		return;
+
+	SwIspStats &stats = *stripeStats_[0];
+
+	for (const SwIspStats &stripe : partialStats_) {
+		stats.sumR_ += stripe.sumR_;
+		stats.sumG_ += stripe.sumG_;
+		stats.sumB_ += stripe.sumB_;
+		for (unsigned int i = 0; i < SwIspStats::kYHistogramSize; i++)
+			stats.yHistogram[i] += stripe.yHistogram[i];
+	}
+
+	statsReady.emit(frame, bufferId_);
 }
 
 /**
@@ -359,10 +466,12 @@ int SwStatsCpu::setupStandardBayerOrder(BayerFormat::Order order)
 /**
  * \brief Configure the statistics object for the passed in input format
  * \param[in] inputCfg The input format
+ * \param[in] narrowPacked Whether CSI-2 packed 10-bit lines are narrowed to
+ * 8-bit unpacked lines before being passed to processLine0()
  *
  * \return 0 on success, a negative errno value on failure
  */
-int SwStatsCpu::configure(const StreamConfiguration &inputCfg)
+int SwStatsCpu::configure(const StreamConfiguration &inputCfg, bool narrowPacked)
 {
 	BayerFormat bayerFormat =
 		BayerFormat::fromPixelFormat(inputCfg.pixelFormat);
@@ -393,12 +502,14 @@ int SwStatsCpu::configure(const StreamConfiguration &inputCfg)
 		switch (bayerFormat.order) {
 		case BayerFormat::BGGR:
 		case BayerFormat::GRBG:
-			stats0_ = &SwStatsCpu::statsBGGR10PLine0;
+			stats0_ = narrowPacked ? &SwStatsCpu::statsBGGR8Line0
+					       : &SwStatsCpu::statsBGGR10PLine0;
 			swapLines_ = bayerFormat.order == BayerFormat::GRBG;
 			return 0;
 		case BayerFormat::GBRG:
 		case BayerFormat::RGGB:
-			stats0_ = &SwStatsCpu::statsGBRG10PLine0;
+			stats0_ = narrowPacked ? &SwStatsCpu::statsGBRG8Line0
+					       : &SwStatsCpu::statsGBRG10PLine0;
 			swapLines_ = bayerFormat.order == BayerFormat::RGGB;
 			return 0;
 		default:
@@ -429,4 +540,36 @@ void SwStatsCpu::setWindow(const Rectangle &window)
 	window_.height &= ~(patternSize_.height - 1);
 }
 
+/**
+ * \brief Set the number of stripes the frame is processed in
+ * \param[in] stripes The number of stripes
+ *
+ * Statistics are accumulated separately for each stripe, allowing the stripes
+ * to be processed concurrently, and merged by finishFrame().
+ */
+void SwStatsCpu::setStripes(unsigned int stripes)
+{
+	stripeStats_.resize(std::max(stripes, 1U));
+	partialStats_.resize(stripeStats_.size() - 1);
+}
+
+/**
+ * \brief Set the statistics sampling rates
+ * \param[in] frameInterval Gather statistics on one frame out of frameInterval
+ * \param[in] xSubsampling Sample one out of xSubsampling of the 2x2 blocks
+ * sampled by default on each line
+ *
+ * Decimating statistics temporally and horizontally reduces the CPU usage,
+ * at the expense of a slower convergence of the algorithms and of less
+ * accurate statistics. The values default to 1, values of 0 are treated as 1.
+ *
+ * This must not be called while a frame is being processed.
+ */
+void SwStatsCpu::setSampling(unsigned int frameInterval, unsigned int xSubsampling)
+{
+	frameInterval_ = std::max(frameInterval, 1U);
+	xSubsampling_ = std::max(xSubsampling, 1U);
+	frameCount_ = 0;
+}
+
 } /* namespace libcamera */
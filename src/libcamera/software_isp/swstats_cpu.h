@@ -11,7 +11,9 @@
 
 #pragma once
 
+#include <array>
 #include <stdint.h>
+#include <vector>
 
 #include <libcamera/base/signal.h>
 
@@ -38,44 +40,49 @@ public:
 
 	const Size &patternSize() { return patternSize_; }
 
-	int configure(const StreamConfiguration &inputCfg);
+	int configure(const StreamConfiguration &inputCfg, bool narrowPacked = false);
 	void setWindow(const Rectangle &window);
+	void setStripes(unsigned int stripes);
+	void setSampling(unsigned int frameInterval, unsigned int xSubsampling);
 	void startFrame();
-	void finishFrame();
+	void finishFrame(uint32_t frame);
 
-	void processLine0(unsigned int y, const uint8_t *src[])
+	void processLine0(unsigned int y, const uint8_t *src[], unsigned int stripe = 0)
 	{
-		if ((y & ySkipMask_) || y < static_cast<unsigned int>(window_.y) ||
+		if (skipFrame_ || (y & ySkipMask_) ||
+		    y < static_cast<unsigned int>(window_.y) ||
 		    y >= (window_.y + window_.height))
 			return;
 
-		(this->*stats0_)(src);
+		(this->*stats0_)(src, *stripeStats_[stripe]);
 	}
 
-	void processLine2(unsigned int y, const uint8_t *src[])
+	void processLine2(unsigned int y, const uint8_t *src[], unsigned int stripe = 0)
 	{
-		if ((y & ySkipMask_) || y < static_cast<unsigned int>(window_.y) ||
+		if (skipFrame_ || (y & ySkipMask_) ||
+		    y < static_cast<unsigned int>(window_.y) ||
 		    y >= (window_.y + window_.height))
 			return;
 
-		(this->*stats2_)(src);
+		(this->*stats2_)(src, *stripeStats_[stripe]);
 	}
 
-	Signal<> statsReady;
+	Signal<uint32_t, uint32_t> statsReady;
 
 private:
-	using statsProcessFn = void (SwStatsCpu::*)(const uint8_t *src[]);
+	using statsProcessFn = void (SwStatsCpu::*)(const uint8_t *src[], SwIspStats &stats);
 
 	int setupStandardBayerOrder(BayerFormat::Order order);
 	/* Bayer 8 bpp unpacked */
-	void statsBGGR8Line0(const uint8_t *src[]);
+	void statsBGGR8Line0(const uint8_t *src[], SwIspStats &stats);
+	void statsGBRG8Line0(const uint8_t *src[], SwIspStats &stats);
 	/* Bayer 10 bpp unpacked */
-	void statsBGGR10Line0(const uint8_t *src[]);
+	void statsBGGR10Line0(const uint8_t *src[], SwIspStats &stats);
 	/* Bayer 12 bpp unpacked */
-	void statsBGGR12Line0(const uint8_t *src[]);
+	void statsBGGR12Line0(const uint8_t *src[], SwIspStats &stats);
 	/* Bayer 10 bpp packed */
-	void statsBGGR10PLine0(const uint8_t *src[]);
-	void statsGBRG10PLine0(const uint8_t *src[]);
+	void statsBGGR10PLine0(const uint8_t *src[], SwIspStats &stats);
+	void statsGBRG10PLine0(const uint8_t *src[], SwIspStats &stats);
 
 	/* Variables set by configure(), used every line */
 	statsProcessFn stats0_;
@@ -90,8 +97,19 @@ private:
 
 	unsigned int xShift_;
 
-	SharedMemObject<SwIspStats> sharedStats_;
-	SwIspStats stats_;
+	/* Temporal and horizontal decimation, set by setSampling() */
+	unsigned int frameInterval_;
+	unsigned int xSubsampling_;
+	unsigned int frameCount_;
+	bool skipFrame_;
+
+	SharedMemObject<std::array<SwIspStats, SwIspStats::kBufferCount>> sharedStats_;
+	/* Index of the shared statistics buffer used for the current frame */
+	unsigned int bufferId_;
+	/* Statistics of the stripes of the frame, the first one is shared */
+	std::vector<SwIspStats *> stripeStats_;
+	/* Partial statistics of all stripes but the first one */
+	std::vector<SwIspStats> partialStats_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,656 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Built-in in-memory trace recorder
+ */
+
+#include "libcamera/internal/trace_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/request.h"
+
+/**
+ * \file trace_recorder.h
+ * \brief Built-in in-memory trace recorder
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Trace)
+
+namespace {
+
+constexpr unsigned int kDefaultTraceEvents = 16384;
+
+int64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+}
+
+void writeString(std::ostream &stream, const char *str)
+{
+	stream << '"';
+
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		switch (c) {
+		case '"':
+			stream << "\\\"";
+			break;
+		case '\\':
+			stream << "\\\\";
+			break;
+		default:
+			if (c < 0x20)
+				stream << "\\u" << std::hex << std::setw(4)
+				       << std::setfill('0') << static_cast<unsigned int>(c)
+				       << std::dec << std::setfill(' ');
+			else
+				stream << c;
+			break;
+		}
+	}
+
+	stream << '"';
+}
+
+void writeTimestamp(std::ostream &stream, int64_t ns)
+{
+	/* Chrome traces use microseconds. */
+	stream << ns / 1000 << '.' << std::setw(3) << std::setfill('0')
+	       << ns % 1000 << std::setfill(' ');
+}
+
+} /* namespace */
+
+/**
+ * \class TraceArg
+ * \brief An argument of a trace event
+ *
+ * Trace arguments are stored by value in the trace recorder ring, strings are
+ * copied and truncated to 31 characters. Argument names must be string
+ * literals.
+ */
+
+/**
+ * \enum TraceArg::Type
+ * \brief The type of a trace argument
+ * \var TraceArg::Type::Integer
+ * \brief A signed integer
+ * \var TraceArg::Type::Hex
+ * \brief An integer displayed in hexadecimal, typically a pointer
+ * \var TraceArg::Type::String
+ * \brief A string
+ */
+
+/**
+ * \fn TraceArg::TraceArg()
+ * \brief Construct an uninitialized trace argument
+ */
+
+/**
+ * \brief Construct an integer trace argument
+ * \param[in] name The argument name
+ * \param[in] value The argument value
+ */
+TraceArg::TraceArg(const char *name, int64_t value)
+	: name_(name), type_(Type::Integer), integer_(value)
+{
+}
+
+/**
+ * \brief Construct a string trace argument
+ * \param[in] name The argument name
+ * \param[in] value The argument value, may be nullptr
+ */
+TraceArg::TraceArg(const char *name, const char *value)
+	: name_(name), type_(Type::String)
+{
+	if (!value)
+		value = "";
+
+	strncpy(string_, value, kMaxStringLength);
+	string_[kMaxStringLength] = '\0';
+}
+
+/**
+ * \brief Construct a hexadecimal integer trace argument
+ * \param[in] name The argument name
+ * \param[in] value The argument value
+ * \return The trace argument
+ */
+TraceArg TraceArg::hex(const char *name, uint64_t value)
+{
+	TraceArg arg(name, static_cast<int64_t>(value));
+	arg.type_ = Type::Hex;
+	return arg;
+}
+
+/**
+ * \fn TraceArg::name()
+ * \brief Retrieve the argument name
+ * \return The argument name
+ */
+
+/**
+ * \fn TraceArg::type()
+ * \brief Retrieve the argument type
+ * \return The argument type
+ */
+
+/**
+ * \fn TraceArg::integer()
+ * \brief Retrieve the value of an integer argument
+ * \return The argument value
+ */
+
+/**
+ * \fn TraceArg::string()
+ * \brief Retrieve the value of a string argument
+ * \return The argument value
+ */
+
+/**
+ * \class TraceRecorder
+ * \brief Record tracepoint events in memory and export them as Chrome traces
+ *
+ * The TraceRecorder is a lightweight tracing backend that doesn't depend on
+ * lttng, for systems where lttng isn't available, such as Android. When
+ * enabled, every LIBCAMERA_TRACEPOINT() is recorded, along with the ID of the
+ * calling thread and a timestamp, in a fixed-size ring of events that keeps
+ * the most recent ones.
+ *
+ * The events are exported in the Chrome JSON trace event format, which can be
+ * loaded in the Perfetto UI (https://ui.perfetto.dev) or in chrome://tracing
+ * to display the activity of the pipeline handler, IPA and software ISP
+ * threads on a timeline.
+ *
+ * The recorder is enabled by setting the LIBCAMERA_TRACE_FILE environment
+ * variable to the path of the trace file, which is written when the camera
+ * manager is stopped or when exportTrace() is called. The size of the ring is
+ * set by the LIBCAMERA_TRACE_EVENTS environment variable.
+ */
+
+/**
+ * \enum TraceRecorder::Phase
+ * \brief The type of a trace event, as defined by the Chrome trace format
+ * \var TraceRecorder::Phase::Begin
+ * \brief Beginning of a duration on the current thread
+ * \var TraceRecorder::Phase::End
+ * \brief End of a duration on the current thread
+ * \var TraceRecorder::Phase::Instant
+ * \brief Instant event
+ * \var TraceRecorder::Phase::Complete
+ * \brief Duration on the current thread that ended when recorded
+ * \var TraceRecorder::Phase::AsyncBegin
+ * \brief Beginning of a duration that may span multiple threads
+ * \var TraceRecorder::Phase::AsyncEnd
+ * \brief End of a duration that may span multiple threads
+ */
+
+TraceRecorder::TraceRecorder()
+	: enabled_(false), head_(0)
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_TRACE_FILE");
+	if (!path || *path == '\0')
+		return;
+
+	unsigned int size = kDefaultTraceEvents;
+	const char *events = utils::secure_getenv("LIBCAMERA_TRACE_EVENTS");
+	if (events && *events != '\0')
+		size = std::max(strtoul(events, nullptr, 10), 1ul);
+
+	path_ = path;
+	enable(size);
+}
+
+/**
+ * \brief Retrieve the trace recorder instance
+ *
+ * The instance is never destroyed, to allow tracepoints to be recorded from
+ * the destructors of static objects.
+ *
+ * \return The trace recorder instance
+ */
+TraceRecorder *TraceRecorder::instance()
+{
+	static TraceRecorder *recorder = new TraceRecorder();
+	return recorder;
+}
+
+/**
+ * \fn TraceRecorder::isEnabled()
+ * \brief Check if events are recorded
+ * \return True if the recorder is enabled, false otherwise
+ */
+
+/**
+ * \brief Enable the recorder
+ * \param[in] size The maximum number of events stored in the ring
+ *
+ * Recorded events are discarded.
+ */
+void TraceRecorder::enable(unsigned int size)
+{
+	MutexLocker locker(mutex_);
+
+	events_.clear();
+	events_.resize(size);
+	events_.shrink_to_fit();
+	head_ = 0;
+
+	enabled_.store(true, std::memory_order_relaxed);
+}
+
+void TraceRecorder::append(const char *name, Phase phase, int64_t timestamp,
+			   int64_t duration, uint64_t id,
+			   std::initializer_list<TraceArg> args)
+{
+	static thread_local pid_t tid = 0;
+	bool newThread = false;
+
+	if (!tid) {
+		tid = syscall(SYS_gettid);
+		newThread = true;
+	}
+
+	MutexLocker locker(mutex_);
+
+	if (newThread) {
+		char threadName[16] = {};
+		pthread_getname_np(pthread_self(), threadName, sizeof(threadName));
+		threads_[tid] = threadName;
+	}
+
+	if (events_.empty())
+		return;
+
+	Event &event = events_[head_++ % events_.size()];
+	event.timestamp = timestamp;
+	event.duration = duration;
+	event.id = id;
+	event.name = name;
+	event.tid = tid;
+	event.phase = phase;
+	event.numArgs = std::min<size_t>(args.size(), kMaxArgs);
+	std::copy_n(args.begin(), event.numArgs, event.args);
+}
+
+/**
+ * \brief Record an event
+ * \param[in] name The event name, must be a string literal
+ * \param[in] phase The event type
+ * \param[in] args The event arguments
+ */
+void TraceRecorder::record(const char *name, Phase phase,
+			   std::initializer_list<TraceArg> args)
+{
+	append(name, phase, now(), 0, 0, args);
+}
+
+/**
+ * \brief Record an event that may span multiple threads
+ * \param[in] name The event name, must be a string literal
+ * \param[in] phase The event type, AsyncBegin or AsyncEnd
+ * \param[in] id Identifier matching the beginning and the end of the event
+ * \param[in] args The event arguments
+ */
+void TraceRecorder::recordAsync(const char *name, Phase phase, uint64_t id,
+				std::initializer_list<TraceArg> args)
+{
+	append(name, phase, now(), 0, id, args);
+}
+
+/**
+ * \brief Record a duration that has just ended on the current thread
+ * \param[in] name The event name, must be a string literal
+ * \param[in] duration The duration in nanoseconds
+ * \param[in] args The event arguments
+ */
+void TraceRecorder::recordComplete(const char *name, int64_t duration,
+				   std::initializer_list<TraceArg> args)
+{
+	append(name, Phase::Complete, now() - duration, duration, 0, args);
+}
+
+/**
+ * \brief Export the recorded events in the Chrome JSON trace format
+ * \param[in] stream The output stream
+ *
+ * The recorded events are kept, and recording continues during the export.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int TraceRecorder::exportTrace(std::ostream &stream)
+{
+	pid_t pid = getpid();
+	std::vector<Event> events;
+	std::map<pid_t, std::string> threads;
+
+	/* Copy the events to avoid stalling the traced threads. */
+	{
+		MutexLocker locker(mutex_);
+
+		size_t size = events_.size();
+		size_t count = std::min<uint64_t>(head_, size);
+		events.reserve(count);
+
+		for (uint64_t i = head_ - count; i < head_; i++)
+			events.push_back(events_[i % size]);
+
+		threads = threads_;
+	}
+
+	stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	const char *separator = "\n";
+
+	stream << separator << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":"
+	       << pid << ",\"args\":{\"name\":\"libcamera\"}}";
+	separator = ",\n";
+
+	for (const auto &[tid, name] : threads) {
+		stream << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"
+		       << pid << ",\"tid\":" << tid << ",\"args\":{\"name\":";
+		writeString(stream, name.c_str());
+		stream << "}}";
+	}
+
+	for (const Event &event : events) {
+		stream << separator << "{\"name\":";
+		writeString(stream, event.name);
+		stream << ",\"cat\":\"libcamera\",\"ph\":\""
+		       << static_cast<char>(event.phase) << "\",\"ts\":";
+		writeTimestamp(stream, event.timestamp);
+		stream << ",\"pid\":" << pid << ",\"tid\":" << event.tid;
+
+		switch (event.phase) {
+		case Phase::Complete:
+			stream << ",\"dur\":";
+			writeTimestamp(stream, event.duration);
+			break;
+		case Phase::Instant:
+			stream << ",\"s\":\"t\"";
+			break;
+		case Phase::AsyncBegin:
+		case Phase::AsyncEnd:
+			stream << ",\"id\":\"0x" << std::hex << event.id << std::dec
+			       << "\"";
+			break;
+		default:
+			break;
+		}
+
+		stream << ",\"args\":{";
+
+		for (unsigned int i = 0; i < event.numArgs; i++) {
+			const TraceArg &arg = event.args[i];
+
+			if (i)
+				stream << ",";
+
+			writeString(stream, arg.name());
+			stream << ":";
+
+			switch (arg.type()) {
+			case TraceArg::Type::Integer:
+				stream << arg.integer();
+				break;
+			case TraceArg::Type::Hex:
+				stream << "\"0x" << std::hex
+				       << static_cast<uint64_t>(arg.integer())
+				       << std::dec << "\"";
+				break;
+			case TraceArg::Type::String:
+				writeString(stream, arg.string());
+				break;
+			}
+		}
+
+		stream << "}}";
+	}
+
+	stream << "\n]}\n";
+
+	return stream.good() ? 0 : -EIO;
+}
+
+/**
+ * \brief Export the recorded events to a file
+ * \param[in] path The path to the trace file
+ *
+ * \sa exportTrace(std::ostream &stream)
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int TraceRecorder::exportTrace(const std::string &path)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) {
+		LOG(Trace, Error) << "Failed to open trace file " << path;
+		return -EACCES;
+	}
+
+	int ret = exportTrace(file);
+	file.close();
+	if (ret < 0 || file.fail()) {
+		LOG(Trace, Error) << "Failed to write trace file " << path;
+		return -EIO;
+	}
+
+	LOG(Trace, Info) << "Trace written to " << path;
+
+	return 0;
+}
+
+/**
+ * \brief Export the recorded events to the file set in the environment
+ *
+ * Write the recorded events to the file set by the LIBCAMERA_TRACE_FILE
+ * environment variable. This function does nothing if the variable isn't set.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int TraceRecorder::exportTrace()
+{
+	if (path_.empty() || !isEnabled())
+		return 0;
+
+	return exportTrace(path_);
+}
+
+/**
+ * \namespace libcamera::trace
+ * \brief Trace recorder handlers for the libcamera tracepoints
+ */
+
+namespace trace {
+
+#ifndef __DOXYGEN__
+
+void ipa_call_begin(const char *pipe, const char *func)
+{
+	TraceRecorder::instance()->record("ipa_call", TraceRecorder::Phase::Begin,
+					  { { "pipeline_name", pipe },
+					    { "function_name", func } });
+}
+
+void ipa_call_end(const char *pipe, const char *func)
+{
+	TraceRecorder::instance()->record("ipa_call", TraceRecorder::Phase::End,
+					  { { "pipeline_name", pipe },
+					    { "function_name", func } });
+}
+
+void ipa_call_async(const char *pipe, const char *func)
+{
+	TraceRecorder::instance()->record("ipa_call_async", TraceRecorder::Phase::Instant,
+					  { { "pipeline_name", pipe },
+					    { "function_name", func } });
+}
+
+void ipa_signal(const char *pipe, const char *func)
+{
+	TraceRecorder::instance()->record("ipa_signal", TraceRecorder::Phase::Instant,
+					  { { "pipeline_name", pipe },
+					    { "function_name", func } });
+}
+
+namespace {
+
+void request_event(const char *name, Request *req)
+{
+	TraceRecorder::instance()->record(name, TraceRecorder::Phase::Instant,
+					  { TraceArg::hex("request", reinterpret_cast<uintptr_t>(req)),
+					    { "cookie", static_cast<int64_t>(req->cookie()) } });
+}
+
+} /* namespace */
+
+void request_construct(Request *req)
+{
+	request_event("request_construct", req);
+}
+
+void request_destroy(Request *req)
+{
+	request_event("request_destroy", req);
+}
+
+void request_reuse(Request *req)
+{
+	request_event("request_reuse", req);
+}
+
+void request_queue(Request *req)
+{
+	/* Track requests from queueing to completion across threads. */
+	TraceRecorder::instance()->recordAsync("request", TraceRecorder::Phase::AsyncBegin,
+					       reinterpret_cast<uintptr_t>(req),
+					       { { "cookie", static_cast<int64_t>(req->cookie()) } });
+}
+
+void request_device_queue(Request *req)
+{
+	request_event("request_device_queue", req);
+}
+
+void request_complete(Request::Private *req)
+{
+	Request *request = req->_o<Request>();
+
+	TraceRecorder::instance()->recordAsync("request", TraceRecorder::Phase::AsyncEnd,
+					       reinterpret_cast<uintptr_t>(request),
+					       { { "cookie", static_cast<int64_t>(request->cookie()) },
+						 { "sequence", static_cast<int64_t>(request->sequence()) },
+						 { "status", static_cast<int64_t>(request->status()) } });
+}
+
+void request_cancel(Request::Private *req)
+{
+	request_event("request_cancel", req->_o<Request>());
+}
+
+void request_complete_buffer(Request::Private *req, FrameBuffer *buf)
+{
+	Request *request = req->_o<Request>();
+
+	TraceRecorder::instance()->record("request_complete_buffer", TraceRecorder::Phase::Instant,
+					  { TraceArg::hex("request", reinterpret_cast<uintptr_t>(request)),
+					    { "cookie", static_cast<int64_t>(request->cookie()) },
+					    TraceArg::hex("buffer", reinterpret_cast<uintptr_t>(buf)),
+					    { "buf_status", static_cast<int64_t>(buf->metadata().status) } });
+}
+
+void v4l2_buffer_queue(const char *dev, unsigned int idx, FrameBuffer *buf)
+{
+	TraceRecorder::instance()->record("v4l2_buffer_queue", TraceRecorder::Phase::Instant,
+					  { { "device", dev },
+					    { "index", static_cast<int64_t>(idx) },
+					    TraceArg::hex("buffer", reinterpret_cast<uintptr_t>(buf)) });
+}
+
+void v4l2_buffer_dequeue(const char *dev, FrameBuffer *buf)
+{
+	const FrameMetadata &metadata = buf->metadata();
+
+	TraceRecorder::instance()->record("v4l2_buffer_dequeue", TraceRecorder::Phase::Instant,
+					  { { "device", dev },
+					    TraceArg::hex("buffer", reinterpret_cast<uintptr_t>(buf)),
+					    { "sequence", static_cast<int64_t>(metadata.sequence) },
+					    { "timestamp", static_cast<int64_t>(metadata.timestamp) },
+					    { "buf_status", static_cast<int64_t>(metadata.status) } });
+}
+
+void frame_stage(const char *pipe, const char *stage, Request *req,
+		 uint32_t seq)
+{
+	TraceRecorder::instance()->record("frame_stage", TraceRecorder::Phase::Instant,
+					  { { "pipeline_name", pipe },
+					    { "stage", stage },
+					    TraceArg::hex("request", reinterpret_cast<uintptr_t>(req)),
+					    { "cookie", static_cast<int64_t>(req ? req->cookie() : 0) },
+					    { "sequence", static_cast<int64_t>(seq) } });
+}
+
+void frame_process_begin(const char *pipe, const char *stage, uint32_t seq)
+{
+	TraceRecorder::instance()->record("frame_process", TraceRecorder::Phase::Begin,
+					  { { "pipeline_name", pipe },
+					    { "stage", stage },
+					    { "sequence", static_cast<int64_t>(seq) } });
+}
+
+void frame_process_end(const char *pipe, const char *stage, uint32_t seq)
+{
+	TraceRecorder::instance()->record("frame_process", TraceRecorder::Phase::End,
+					  { { "pipeline_name", pipe },
+					    { "stage", stage },
+					    { "sequence", static_cast<int64_t>(seq) } });
+}
+
+void thread_dispatch([[maybe_unused]] const char *thread, int type,
+		     const char *handler, int fd, unsigned int queue_depth,
+		     int64_t latency, int64_t run_time)
+{
+	static const char *const names[] = {
+		"thread_message",
+		"thread_notifier",
+		"thread_timer",
+	};
+
+	const char *name = type >= 0 && type < static_cast<int>(std::size(names))
+			 ? names[type] : "thread_dispatch";
+
+	/* The thread name is recorded with the thread ID. */
+	TraceRecorder::instance()->recordComplete(name, run_time,
+						  { { "handler", handler },
+						    { "fd", static_cast<int64_t>(fd) },
+						    { "queue_depth", static_cast<int64_t>(queue_depth) },
+						    { "latency_ns", latency } });
+}
+
+#endif /* __DOXYGEN__ */
+
+} /* namespace trace */
+
+} /* namespace libcamera */
@@ -25,6 +25,7 @@
 #include <libcamera/base/utils.h>
 
 #include "libcamera/internal/formats.h"
+#include "libcamera/internal/media_request.h"
 #include "libcamera/internal/sysfs.h"
 
 /**
@@ -163,10 +164,15 @@ void V4L2Device::close()
 /**
  * \brief Read controls from the device
  * \param[in] ids The list of controls to read, specified by their ID
+ * \param[in] request The media request to read the controls from (optional)
  *
  * This function reads the value of all controls contained in \a ids, and
  * returns their values as a ControlList.
  *
+ * If a \a request is specified, the values are read from the request instead
+ * of the device. For a completed request, this retrieves the values that were
+ * applied by the driver when processing the request.
+ *
  * If any control in \a ids is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
  * during validation of the requested controls, no control is read and this
@@ -175,7 +181,8 @@ void V4L2Device::close()
  * \return The control values in a ControlList on success, or an empty list on
  * error
  */
-ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
+ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids,
+				    const MediaRequest *request)
 {
 	if (ids.empty())
 		return {};
@@ -229,7 +236,12 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
 	v4l2ExtCtrls.count = v4l2Ctrls.size();
 
@@ -260,11 +272,17 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in (optional)
  *
  * This function writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If a \a request is specified, the controls are stored in the request instead
+ * of being applied immediately. The driver applies them atomically with the
+ * other objects of the request when it processes the request, and the values
+ * stored in \a ctrls are the values validated for the request.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, if any other error
  * occurs during validation of the requested controls, no control is written and
@@ -279,7 +297,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, const MediaRequest *request)
 {
 	if (ctrls->empty())
 		return 0;
@@ -340,7 +358,12 @@ int V4L2Device::setControls(ControlList *ctrls)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
 	v4l2ExtCtrls.count = v4l2Ctrls.size();
 
@@ -904,6 +927,22 @@ template std::optional<ColorSpace> V4L2Device::toColorSpace(const struct v4l2_pi
 template std::optional<ColorSpace> V4L2Device::toColorSpace(const struct v4l2_mbus_framefmt &,
 							    PixelFormatInfo::ColourEncoding);
 
+namespace {
+
+/*
+ * The LOG() macro can't be used in static member functions of Loggable
+ * classes, log the fromColorSpace() warnings from a free function instead.
+ */
+void logUnrecognisedColorSpace(const char *field,
+			       const std::optional<ColorSpace> &colorSpace)
+{
+	LOG(V4L2, Warning)
+		<< "Unrecognised " << field << " in "
+		<< ColorSpace::toString(colorSpace);
+}
+
+} /* namespace */
+
 /**
  * \brief Fill in the color space fields of a V4L2 format from a ColorSpace
  * \param[in] colorSpace The ColorSpace to be converted
@@ -954,9 +993,7 @@ int V4L2Device::fromColorSpace(const std::optional<ColorSpace> &colorSpace, T &v
 	if (itPrimaries != primariesToV4l2.end()) {
 		v4l2Format.colorspace = itPrimaries->second;
 	} else {
-		libcamera::LOG(V4L2, Warning)
-			<< "Unrecognised primaries in "
-			<< ColorSpace::toString(colorSpace);
+		logUnrecognisedColorSpace("primaries", colorSpace);
 		ret = -EINVAL;
 	}
 
@@ -964,9 +1001,7 @@ int V4L2Device::fromColorSpace(const std::optional<ColorSpace> &colorSpace, T &v
 	if (itTransfer != transferFunctionToV4l2.end()) {
 		v4l2Format.xfer_func = itTransfer->second;
 	} else {
-		libcamera::LOG(V4L2, Warning)
-			<< "Unrecognised transfer function in "
-			<< ColorSpace::toString(colorSpace);
+		logUnrecognisedColorSpace("transfer function", colorSpace);
 		ret = -EINVAL;
 	}
 
@@ -974,9 +1009,7 @@ int V4L2Device::fromColorSpace(const std::optional<ColorSpace> &colorSpace, T &v
 	if (itYcbcrEncoding != ycbcrEncodingToV4l2.end()) {
 		v4l2Format.ycbcr_enc = itYcbcrEncoding->second;
 	} else {
-		libcamera::LOG(V4L2, Warning)
-			<< "Unrecognised YCbCr encoding in "
-			<< ColorSpace::toString(colorSpace);
+		logUnrecognisedColorSpace("YCbCr encoding", colorSpace);
 		ret = -EINVAL;
 	}
 
@@ -984,9 +1017,7 @@ int V4L2Device::fromColorSpace(const std::optional<ColorSpace> &colorSpace, T &v
 	if (itRange != rangeToV4l2.end()) {
 		v4l2Format.quantization = itRange->second;
 	} else {
-		libcamera::LOG(V4L2, Warning)
-			<< "Unrecognised quantization in "
-			<< ColorSpace::toString(colorSpace);
+		logUnrecognisedColorSpace("quantization", colorSpace);
 		ret = -EINVAL;
 	}
 
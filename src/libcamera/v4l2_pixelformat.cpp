@@ -9,8 +9,8 @@
 #include "libcamera/internal/v4l2_pixelformat.h"
 
 #include <ctype.h>
-#include <map>
 #include <string.h>
+#include <utility>
 
 #include <libcamera/base/log.h>
 
@@ -18,6 +18,7 @@
 #include <libcamera/pixel_format.h>
 
 #include "libcamera/internal/formats.h"
+#include "libcamera/internal/lookup_table.h"
 
 /**
  * \file v4l2_pixelformat.h
@@ -45,7 +46,9 @@ LOG_DECLARE_CATEGORY(V4L2)
 
 namespace {
 
-const std::map<V4L2PixelFormat, V4L2PixelFormat::Info> vpf2pf{
+using V4L2PixelFormatEntry = std::pair<V4L2PixelFormat, V4L2PixelFormat::Info>;
+
+const V4L2PixelFormatEntry vpf2pf[] = {
 	/* RGB formats. */
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565),
 		{ formats::RGB565, "16-bit RGB 5-6-5" } },
@@ -225,6 +228,11 @@ const std::map<V4L2PixelFormat, V4L2PixelFormat::Info> vpf2pf{
 		{ formats::MJPEG, "JPEG JFIF" } },
 };
 
+const LookupTable<V4L2PixelFormat, V4L2PixelFormatEntry, 256, std::hash<uint32_t>>
+vpf2pfIndex{ vpf2pf, [](const V4L2PixelFormatEntry &entry) {
+	return entry.first;
+} };
+
 } /* namespace */
 
 /**
@@ -313,15 +321,15 @@ std::string V4L2PixelFormat::toString() const
  */
 const char *V4L2PixelFormat::description() const
 {
-	const auto iter = vpf2pf.find(*this);
-	if (iter == vpf2pf.end()) {
+	const V4L2PixelFormatEntry *entry = vpf2pfIndex.find(*this);
+	if (!entry) {
 		LOG(V4L2, Warning)
 			<< "Unsupported V4L2 pixel format "
 			<< toString();
 		return "Unsupported format";
 	}
 
-	return iter->second.description;
+	return entry->second.description;
 }
 
 /**
@@ -338,15 +346,15 @@ const char *V4L2PixelFormat::description() const
  */
 PixelFormat V4L2PixelFormat::toPixelFormat(bool warn) const
 {
-	const auto iter = vpf2pf.find(*this);
-	if (iter == vpf2pf.end()) {
+	const V4L2PixelFormatEntry *entry = vpf2pfIndex.find(*this);
+	if (!entry) {
 		if (warn)
 			LOG(V4L2, Warning) << "Unsupported V4L2 pixel format "
 					   << toString();
 		return PixelFormat();
 	}
 
-	return iter->second.format;
+	return entry->second.format;
 }
 
 /**
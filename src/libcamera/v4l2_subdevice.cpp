@@ -1170,6 +1170,10 @@ int V4L2Subdevice::setSelection(const Stream &stream, unsigned int target,
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
  * a \a stream.
  *
+ * The formats of camera sensors don't depend on the device state, except for
+ * the flips that may affect the Bayer pattern order. They are cached in the
+ * media device and only enumerated once per flips configuration.
+ *
  * \return A list of the supported device formats
  */
 V4L2Subdevice::Formats V4L2Subdevice::formats(const Stream &stream)
@@ -1181,6 +1185,34 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(const Stream &stream)
 		return {};
 	}
 
+	/*
+	 * The formats supported by camera sensors don't depend on the format
+	 * configured on other pads, cache them in the media device to avoid
+	 * enumerating them again. The media bus codes of some sensors depend
+	 * on the flips, include them in the cache key.
+	 */
+	const MediaDevice *media = entity_->device();
+	std::string cacheKey;
+	if (entity_->function() == MEDIA_ENT_F_CAM_SENSOR) {
+		cacheKey = "subdev:" + entity_->name() + ":" +
+			   std::to_string(stream.pad) + "/" +
+			   std::to_string(stream.stream);
+
+		std::vector<uint32_t> flips;
+		for (uint32_t id : { V4L2_CID_HFLIP, V4L2_CID_VFLIP }) {
+			if (controls().find(id) != controls().end())
+				flips.push_back(id);
+		}
+
+		ControlList ctrls = getControls(flips);
+		for (const auto &[id, value] : ctrls)
+			cacheKey += ":" + std::to_string(id) + "=" + value.toString();
+
+		const MediaDevice::CachedFormats *cached = media->cachedFormats(cacheKey);
+		if (cached)
+			return *cached;
+	}
+
 	for (unsigned int code : enumPadCodes(stream)) {
 		std::vector<SizeRange> sizes = enumPadSizes(stream, code);
 		if (sizes.empty())
@@ -1195,6 +1227,9 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(const Stream &stream)
 		}
 	}
 
+	if (!cacheKey.empty() && !formats.empty())
+		media->cacheFormats(cacheKey, formats);
+
 	return formats;
 }
 
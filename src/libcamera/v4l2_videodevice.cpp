@@ -14,6 +14,7 @@
 #include <sstream>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -27,10 +28,14 @@
 #include <libcamera/base/unique_fd.h>
 #include <libcamera/base/utils.h>
 
+#include <libcamera/fence.h>
+
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/tracepoints.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -162,7 +167,50 @@ LOG_DECLARE_CATEGORY(V4L2)
  * index associations to help selecting V4L2 buffers. It tracks, for every
  * entry, if the V4L2 buffer is in use, and offers lookup of the best free V4L2
  * buffer for a set of dmabufs.
+ *
+ * Dmabufs are identified by their inode, not by their file descriptor number,
+ * as the same dmabuf may be imported multiple times with different file
+ * descriptors, which is common with buffers allocated by external allocators.
+ * Cache lookups use a hash table indexed by the dmabuf inode, offset and
+ * length of all planes. When no free V4L2 buffer is associated with the
+ * dmabufs, the least recently used free V4L2 buffer is evicted and associated
+ * with the new dmabufs.
+ */
+
+/**
+ * \struct V4L2BufferCache::Statistics
+ * \brief Buffer cache usage statistics
+ *
+ * \var V4L2BufferCache::Statistics::hits
+ * \brief The number of lookups that found a V4L2 buffer associated with the
+ * dmabufs
+ *
+ * \var V4L2BufferCache::Statistics::misses
+ * \brief The number of lookups that didn't find a free V4L2 buffer associated
+ * with the dmabufs
+ *
+ * \var V4L2BufferCache::Statistics::evictions
+ * \brief The number of associations between V4L2 buffers and dmabufs that were
+ * replaced following a miss
+ *
+ * Every eviction causes the kernel to unmap the previous dmabufs and map the
+ * new ones when the V4L2 buffer is queued.
+ */
+
+/**
+ * \brief Accumulate statistics
+ * \param[in] other The statistics to add
+ * \return A reference to this instance
  */
+V4L2BufferCache::Statistics &
+V4L2BufferCache::Statistics::operator+=(const Statistics &other)
+{
+	hits += other.hits;
+	misses += other.misses;
+	evictions += other.evictions;
+
+	return *this;
+}
 
 /**
  * \brief Create an empty cache with \a numEntries entries
@@ -173,7 +221,7 @@ LOG_DECLARE_CATEGORY(V4L2)
  * buffer import, with buffers added to the cache as they are queued.
  */
 V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
-	: lastUsedCounter_(1), missCounter_(0)
+	: lastUsedCounter_(1)
 {
 	cache_.resize(numEntries);
 }
@@ -187,18 +235,25 @@ V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
  * allocated.
  */
 V4L2BufferCache::V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
-	: lastUsedCounter_(1), missCounter_(0)
+	: lastUsedCounter_(1)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		Key key(*buffer.get());
+		if (key.valid)
+			index_[key] = cache_.size();
+
 		cache_.emplace_back(true,
 				    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-				    *buffer.get());
+				    key);
+	}
 }
 
 V4L2BufferCache::~V4L2BufferCache()
 {
-	if (missCounter_ > cache_.size())
-		LOG(V4L2, Debug) << "Cache misses: " << missCounter_;
+	if (stats_.evictions)
+		LOG(V4L2, Debug)
+			<< "Cache hits: " << stats_.hits << ", misses: "
+			<< stats_.misses << ", evictions: " << stats_.evictions;
 }
 
 /**
@@ -221,46 +276,64 @@ bool V4L2BufferCache::isEmpty() const
  * Find the best V4L2 buffer index to be used for the FrameBuffer \a buffer
  * based on previous mappings of frame buffers to V4L2 buffers. If a free V4L2
  * buffer previously used with the same dmabufs as \a buffer is found in the
- * cache, return its index. Otherwise return the index of the first free V4L2
- * buffer and record its association with the dmabufs of \a buffer.
+ * cache, return its index. Otherwise return the index of the least recently
+ * used free V4L2 buffer and record its association with the dmabufs of
+ * \a buffer.
+ *
+ * Cache hits are found in constant time, while misses require a scan of the
+ * cache entries.
  *
  * \return The index of the best V4L2 buffer, or -ENOENT if no free V4L2 buffer
  * is available
  */
 int V4L2BufferCache::get(const FrameBuffer &buffer)
 {
-	bool hit = false;
+	Key key(buffer);
+
+	if (key.valid) {
+		auto iter = index_.find(key);
+		if (iter != index_.end() && cache_[iter->second].free_) {
+			Entry &entry = cache_[iter->second];
+			entry.free_ = false;
+			entry.lastUsed_ = lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel);
+
+			stats_.hits++;
+			return iter->second;
+		}
+	}
+
+	stats_.misses++;
+
 	int use = -1;
 	uint64_t oldest = UINT64_MAX;
 
 	for (unsigned int index = 0; index < cache_.size(); index++) {
 		const Entry &entry = cache_[index];
 
-		if (!entry.free_)
-			continue;
-
-		/* Try to find a cache hit by comparing the planes. */
-		if (entry == buffer) {
-			hit = true;
-			use = index;
-			break;
-		}
-
-		if (entry.lastUsed_ < oldest) {
+		if (entry.free_ && entry.lastUsed_ < oldest) {
 			use = index;
 			oldest = entry.lastUsed_;
 		}
 	}
 
-	if (!hit)
-		missCounter_++;
-
 	if (use < 0)
 		return -ENOENT;
 
-	cache_[use] = Entry(false,
-			    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-			    buffer);
+	Entry &entry = cache_[use];
+
+	if (entry.key_.valid) {
+		auto iter = index_.find(entry.key_);
+		if (iter != index_.end() && iter->second == static_cast<unsigned int>(use))
+			index_.erase(iter);
+
+		stats_.evictions++;
+	}
+
+	entry = Entry(false, lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
+		      key);
+
+	if (key.valid)
+		index_[key] = use;
 
 	return use;
 }
@@ -275,32 +348,90 @@ void V4L2BufferCache::put(unsigned int index)
 	cache_[index].free_ = true;
 }
 
-V4L2BufferCache::Entry::Entry()
-	: free_(true), lastUsed_(0)
+/**
+ * \fn V4L2BufferCache::statistics()
+ * \brief Retrieve the cache usage statistics
+ * \return The cache usage statistics since the cache was created
+ */
+
+V4L2BufferCache::Key::Key()
+	: valid(false), numPlanes(0), planes{}
 {
 }
 
-V4L2BufferCache::Entry::Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer)
-	: free_(free), lastUsed_(lastUsed)
+V4L2BufferCache::Key::Key(const FrameBuffer &buffer)
+	: Key()
 {
-	for (const FrameBuffer::Plane &plane : buffer.planes())
-		planes_.emplace_back(plane);
+	const std::vector<FrameBuffer::Plane> &bufferPlanes = buffer.planes();
+	if (bufferPlanes.size() > planes.size())
+		return;
+
+	/* Planes usually share a single dmabuf, avoid repeated fstat() calls. */
+	int lastFd = -1;
+	ino_t lastInode = 0;
+
+	for (const FrameBuffer::Plane &plane : bufferPlanes) {
+		int fd = plane.fd.get();
+
+		if (fd != lastFd) {
+			struct stat st;
+			if (fstat(fd, &st) < 0)
+				return;
+
+			lastFd = fd;
+			lastInode = st.st_ino;
+		}
+
+		planes[numPlanes++] = { lastInode, plane.offset, plane.length };
+	}
+
+	valid = true;
 }
 
-bool V4L2BufferCache::Entry::operator==(const FrameBuffer &buffer) const
+bool V4L2BufferCache::Key::operator==(const Key &other) const
 {
-	const std::vector<FrameBuffer::Plane> &planes = buffer.planes();
-
-	if (planes_.size() != planes.size())
+	if (valid != other.valid || numPlanes != other.numPlanes)
 		return false;
 
-	for (unsigned int i = 0; i < planes.size(); i++)
-		if (planes_[i].fd != planes[i].fd.get() ||
-		    planes_[i].length != planes[i].length)
+	for (unsigned int i = 0; i < numPlanes; i++) {
+		const Plane &a = planes[i];
+		const Plane &b = other.planes[i];
+
+		if (a.inode != b.inode || a.offset != b.offset ||
+		    a.length != b.length)
 			return false;
+	}
+
 	return true;
 }
 
+std::size_t V4L2BufferCache::KeyHash::operator()(const Key &key) const
+{
+	std::size_t hash = key.numPlanes;
+
+	for (unsigned int i = 0; i < key.numPlanes; i++) {
+		const Key::Plane &plane = key.planes[i];
+
+		for (uint64_t value : { static_cast<uint64_t>(plane.inode),
+					static_cast<uint64_t>(plane.offset),
+					static_cast<uint64_t>(plane.length) })
+			hash ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ULL +
+				(hash << 6) + (hash >> 2);
+	}
+
+	return hash;
+}
+
+V4L2BufferCache::Entry::Entry()
+	: free_(true), lastUsed_(0)
+{
+}
+
+V4L2BufferCache::Entry::Entry(bool free, uint64_t lastUsed, const Key &key)
+	: free_(free), lastUsed_(lastUsed), key_(key)
+{
+}
+
 /**
  * \class V4L2DeviceFormat
  * \brief The V4L2 video device image format and sizes
@@ -533,10 +664,12 @@ std::ostream &operator<<(std::ostream &out, const V4L2DeviceFormat &f)
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), formatInfo_(nullptr), cache_(nullptr),
-	  fdBufferNotifier_(nullptr), state_(State::Stopped),
+	: V4L2Device(deviceNode), entity_(nullptr), formatInfo_(nullptr), cache_(nullptr),
+	  fdBufferNotifier_(nullptr), nonBlocking_(false), state_(State::Stopped),
 	  watchdogDuration_(0.0)
 {
+	fenceTimer_.timeout.connect(this, &V4L2VideoDevice::fenceExpired);
+
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
 	 * be updated based upon the device capabilities.
@@ -554,6 +687,7 @@ V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 V4L2VideoDevice::V4L2VideoDevice(const MediaEntity *entity)
 	: V4L2VideoDevice(entity->deviceNode())
 {
+	entity_ = entity;
 	watchdog_.timeout.connect(this, &V4L2VideoDevice::watchdogExpired);
 }
 
@@ -575,6 +709,8 @@ int V4L2VideoDevice::open()
 	if (ret < 0)
 		return ret;
 
+	nonBlocking_ = true;
+
 	ret = ioctl(VIDIOC_QUERYCAP, &caps_);
 	if (ret < 0) {
 		LOG(V4L2, Error)
@@ -669,6 +805,12 @@ int V4L2VideoDevice::open(SharedFD handle, enum v4l2_buf_type type)
 		return ret;
 	}
 
+	/*
+	 * Buffers can only be drained from the device without blocking the
+	 * event loop if the file handle is non-blocking.
+	 */
+	nonBlocking_ = fcntl(newFd.get(), F_GETFL) & O_NONBLOCK;
+
 	ret = V4L2Device::setFd(std::move(newFd));
 	if (ret < 0) {
 		LOG(V4L2, Error) << "Failed to set file handle: "
@@ -790,6 +932,36 @@ void V4L2VideoDevice::close()
  * \return The device V4L2 capabilities
  */
 
+/**
+ * \brief Check if the device supports media controller requests
+ *
+ * Devices that support requests can have buffers queued in a MediaRequest with
+ * queueBuffer(), to bind them with controls set on other devices of the same
+ * media device.
+ *
+ * \return True if the device supports requests, false otherwise
+ */
+bool V4L2VideoDevice::supportsRequests()
+{
+	/*
+	 * Creating zero buffers reports the queue capabilities without
+	 * affecting the buffers currently allocated.
+	 */
+	struct v4l2_create_buffers create = {};
+	create.memory = memoryType_;
+	create.format.type = bufferType_;
+
+	int ret = ioctl(VIDIOC_CREATE_BUFS, &create);
+	if (ret < 0) {
+		LOG(V4L2, Debug)
+			<< "Unable to query buffer capabilities: "
+			<< strerror(-ret);
+		return false;
+	}
+
+	return create.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+}
+
 std::string V4L2VideoDevice::logPrefix() const
 {
 	return deviceNode() + "[" + std::to_string(fd()) +
@@ -1073,12 +1245,31 @@ int V4L2VideoDevice::trySetFormatSingleplane(V4L2DeviceFormat *format, bool set)
  * If the \a code argument is not zero, only formats compatible with that media
  * bus code will be enumerated.
  *
+ * For video devices created from a MediaEntity, the formats are enumerated once
+ * and cached in the media device, except for memory-to-memory devices whose
+ * capture formats depend on the output format.
+ *
  * \return A list of the supported video device formats
  */
 V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 {
 	Formats formats;
 
+	const MediaDevice *media = entity_ ? entity_->device() : nullptr;
+	std::string cacheKey;
+	if (media && !caps_.isM2M()) {
+		cacheKey = "video:" + entity_->name() + ":" +
+			   std::to_string(bufferType_) + ":" + std::to_string(code);
+
+		const MediaDevice::CachedFormats *cached = media->cachedFormats(cacheKey);
+		if (cached) {
+			for (const auto &[fourcc, sizes] : *cached)
+				formats.emplace(V4L2PixelFormat(fourcc), sizes);
+
+			return formats;
+		}
+	}
+
 	for (V4L2PixelFormat pixelFormat : enumPixelformats(code)) {
 		std::vector<SizeRange> sizes = enumSizes(pixelFormat);
 		if (sizes.empty())
@@ -1094,6 +1285,14 @@ V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 		formats.emplace(pixelFormat, sizes);
 	}
 
+	if (!cacheKey.empty() && !formats.empty()) {
+		MediaDevice::CachedFormats cache;
+		for (const auto &[pixelFormat, sizes] : formats)
+			cache.emplace(pixelFormat.fourcc(), sizes);
+
+		media->cacheFormats(cacheKey, std::move(cache));
+	}
+
 	return formats;
 }
 
@@ -1538,6 +1737,7 @@ int V4L2VideoDevice::releaseBuffers()
 
 	LOG(V4L2, Debug) << "Releasing buffers";
 
+	cacheStats_ += cache_->statistics();
 	delete cache_;
 	cache_ = nullptr;
 
@@ -1556,17 +1756,28 @@ int V4L2VideoDevice::releaseBuffers()
  * The best available V4L2 buffer is picked for \a buffer using the V4L2 buffer
  * cache.
  *
+ * If a \a request is specified, the buffer is added to the request instead of
+ * being queued to the device directly, and is only made available to the device
+ * when the request is queued with MediaRequest::queue(). The buffer completes
+ * through the bufferReady signal as usual. The device shall support requests,
+ * as reported by supportsRequests().
+ *
+ * If the \a buffer carries a Fence, queuing the buffer to the device is
+ * deferred until the fence is signalled, without blocking the caller. Buffers
+ * are queued to the device in the order of the calls to this function, any
+ * buffer queued after a buffer waiting on its fence is thus deferred as well.
+ * If the fence isn't signalled within 300ms, the buffer is completed with the
+ * FrameMetadata::FrameCancelled status through the bufferReady signal, and
+ * the fence is left in the buffer. Fences are not supported for buffers
+ * queued in a \a request.
+ *
  * Note that queueBuffer() will fail if the device is in the process of being
  * stopped from a streaming state through streamOff().
  *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
+int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer, const MediaRequest *request)
 {
-	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
-	struct v4l2_buffer buf = {};
-	int ret;
-
 	if (state_ == State::Stopping) {
 		LOG(V4L2, Error) << "Device is in a stopping state.";
 		return -ESHUTDOWN;
@@ -1582,6 +1793,91 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 		return -ENOENT;
 	}
 
+	if (buffer->_d()->fence() || !fencedBuffers_.empty()) {
+		if (request) {
+			LOG(V4L2, Error) << "Fences are not supported with requests";
+			return -EINVAL;
+		}
+
+		fencedBuffers_.push(buffer);
+		if (fencedBuffers_.size() == 1)
+			processFencedBuffers();
+
+		return 0;
+	}
+
+	return queueBufferDevice(buffer, request);
+}
+
+/**
+ * \brief Queue fenced buffers to the device until a fence needs to be waited on
+ *
+ * Buffers are queued to the device in order, starting from the head of the
+ * fenced buffers queue, until a buffer with a Fence is encountered. A notifier
+ * is then set up to resume processing when the fence is signalled, along with
+ * a timer to cancel the buffer if the fence expires.
+ */
+void V4L2VideoDevice::processFencedBuffers()
+{
+	while (!fencedBuffers_.empty()) {
+		FrameBuffer *buffer = fencedBuffers_.front();
+		const Fence *fence = buffer->_d()->fence();
+
+		if (fence) {
+			fenceNotifier_ = std::make_unique<EventNotifier>(fence->fd().get(),
+									 EventNotifier::Read);
+			fenceNotifier_->activated.connect(this, &V4L2VideoDevice::fenceSignalled);
+			fenceTimer_.start(std::chrono::milliseconds(300));
+			return;
+		}
+
+		fencedBuffers_.pop();
+
+		int ret = queueBufferDevice(buffer, nullptr);
+		if (ret < 0) {
+			buffer->_d()->metadata().status = FrameMetadata::FrameError;
+			bufferReady.emit(buffer);
+		}
+	}
+}
+
+void V4L2VideoDevice::fenceSignalled()
+{
+	FrameBuffer *buffer = fencedBuffers_.front();
+
+	LOG(V4L2, Debug) << "Fence signalled for buffer " << buffer;
+
+	fenceTimer_.stop();
+	fenceNotifier_.reset();
+
+	/* Close the fence now that it has been signalled. */
+	buffer->releaseFence();
+
+	processFencedBuffers();
+}
+
+void V4L2VideoDevice::fenceExpired()
+{
+	FrameBuffer *buffer = fencedBuffers_.front();
+
+	LOG(V4L2, Debug) << "Fence expired for buffer " << buffer;
+
+	fenceNotifier_.reset();
+	fencedBuffers_.pop();
+
+	/* Keep the fence in the buffer for the application to handle it. */
+	buffer->_d()->metadata().status = FrameMetadata::FrameCancelled;
+	bufferReady.emit(buffer);
+
+	processFencedBuffers();
+}
+
+int V4L2VideoDevice::queueBufferDevice(FrameBuffer *buffer, const MediaRequest *request)
+{
+	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_buffer buf = {};
+	int ret;
+
 	ret = cache_->get(*buffer);
 	if (ret < 0)
 		return ret;
@@ -1628,7 +1924,7 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 
 		for (const auto &plane : metadata.planes()) {
 			if (!plane.bytesused)
-				LOG(V4L2, Warning) << "byteused == 0 is deprecated";
+				LOG_ONCE(V4L2, Warning) << "byteused == 0 is deprecated";
 		}
 
 		if (numV4l2Planes != planes.size()) {
@@ -1690,16 +1986,26 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 		buf.timestamp.tv_usec = (metadata.timestamp / 1000) % 1000000;
 	}
 
-	LOG(V4L2, Debug) << "Queueing buffer " << buf.index;
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
+	LOG(V4L2, Debug)
+		<< "Queueing buffer " << buf.index
+		<< (request ? " in request" : "");
 
 	ret = ioctl(VIDIOC_QBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Failed to queue buffer " << buf.index << ": "
 			<< strerror(-ret);
 		return ret;
 	}
 
+	LIBCAMERA_TRACEPOINT(v4l2_buffer_queue, deviceNode().c_str(), buf.index,
+			     buffer);
+
 	if (queuedBuffers_.empty()) {
 		fdBufferNotifier_->setEnabled(true);
 		if (watchdogDuration_)
@@ -1714,8 +2020,14 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 /**
  * \brief Slot to handle completed buffer events from the V4L2 video device
  *
- * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * When this slot is called, one or more Buffers have become available from the
+ * device, and will be emitted through the bufferReady Signal in the order they
+ * are dequeued.
+ *
+ * To avoid going through the event loop for every buffer at high frame rates,
+ * all the buffers completed by the device are dequeued in one go when the
+ * device is opened in non-blocking mode. Dequeuing stops as soon as no buffer
+ * is left in the device, or when a bufferReady handler stops streaming.
  *
  * For Capture video devices the FrameBuffer will contain valid data.
  * For Output video devices the FrameBuffer can be considered empty.
@@ -1723,22 +2035,33 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 void V4L2VideoDevice::bufferAvailable()
 {
 	FrameBuffer *buffer = dequeueBuffer();
-	if (!buffer)
-		return;
 
-	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+	while (buffer) {
+		LIBCAMERA_TRACEPOINT(v4l2_buffer_dequeue, deviceNode().c_str(), buffer);
+
+		/* Notify anyone listening to the device. */
+		bufferReady.emit(buffer);
+
+		if (!nonBlocking_ || state_ != State::Streaming ||
+		    queuedBuffers_.empty())
+			break;
+
+		buffer = dequeueBuffer(true);
+	}
 }
 
 /**
  * \brief Dequeue the next available buffer from the video device
+ * \param[in] drain True if the call is part of a loop dequeuing all buffers
  *
  * This function dequeues the next available buffer from the device. If no
- * buffer is available to be dequeued it will return nullptr immediately.
+ * buffer is available to be dequeued it will return nullptr immediately. As
+ * running out of buffers is the expected way to terminate a \a drain loop, no
+ * error is logged in that case.
  *
  * \return A pointer to the dequeued buffer on success, or nullptr otherwise
  */
-FrameBuffer *V4L2VideoDevice::dequeueBuffer()
+FrameBuffer *V4L2VideoDevice::dequeueBuffer(bool drain)
 {
 	struct v4l2_buffer buf = {};
 	struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
@@ -1756,7 +2079,10 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
+		if (drain && ret == -EAGAIN)
+			return nullptr;
+
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
@@ -1777,7 +2103,7 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	 */
 	auto it = queuedBuffers_.find(buf.index);
 	if (it == queuedBuffers_.end()) {
-		LOG(V4L2, Error)
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Dequeued unexpected buffer index " << buf.index;
 
 		return nullptr;
@@ -1834,7 +2160,7 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 		 * bytes used than its length.
 		 */
 		if (numV4l2Planes != 1) {
-			LOG(V4L2, Error)
+			LOG_RATELIMITED(V4L2, Error)
 				<< "Invalid number of planes (" << numV4l2Planes
 				<< " != " << buffer->planes().size() << ")";
 
@@ -1855,7 +2181,7 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 		for (auto [i, plane] : utils::enumerate(buffer->planes())) {
 			if (!remaining) {
-				LOG(V4L2, Error)
+				LOG_RATELIMITED(V4L2, Error)
 					<< "Dequeued buffer (" << bytesused
 					<< " bytes) too small for plane lengths "
 					<< utils::join(buffer->planes(), "/",
@@ -1891,6 +2217,26 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
  * \brief A Signal emitted when a framebuffer completes
  */
 
+/**
+ * \brief Retrieve the buffer cache usage statistics
+ *
+ * The statistics are accumulated over all the buffer caches created by
+ * allocateBuffers() and importBuffers() since the device was created. A high
+ * number of evictions compared to hits indicates that the buffers queued to the
+ * device use more dmabufs than V4L2 buffers are available, which forces the
+ * kernel to map and unmap dmabufs repeatedly.
+ *
+ * \return The buffer cache usage statistics
+ */
+V4L2BufferCache::Statistics V4L2VideoDevice::bufferCacheStatistics() const
+{
+	V4L2BufferCache::Statistics stats = cacheStats_;
+	if (cache_)
+		stats += cache_->statistics();
+
+	return stats;
+}
+
 /**
  * \brief Start the video stream
  * \return 0 on success or a negative error code otherwise
@@ -1932,12 +2278,25 @@ int V4L2VideoDevice::streamOff()
 {
 	int ret;
 
-	if (state_ != State::Streaming && queuedBuffers_.empty())
+	if (state_ != State::Streaming && queuedBuffers_.empty() &&
+	    fencedBuffers_.empty())
 		return 0;
 
 	if (watchdogDuration_.count())
 		watchdog_.stop();
 
+	/* Send back the buffers still waiting on fences. */
+	fenceTimer_.stop();
+	fenceNotifier_.reset();
+
+	while (!fencedBuffers_.empty()) {
+		FrameBuffer *buffer = fencedBuffers_.front();
+		fencedBuffers_.pop();
+
+		buffer->_d()->metadata().status = FrameMetadata::FrameCancelled;
+		bufferReady.emit(buffer);
+	}
+
 	ret = ioctl(VIDIOC_STREAMOFF, &bufferType_);
 	if (ret < 0) {
 		LOG(V4L2, Error)
@@ -10,10 +10,19 @@
 #include <cstdlib>
 #include <errno.h>
 #include <functional>
+#include <iomanip>
 #include <limits>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
 
 #include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/utils.h>
 
 #include <yaml.h>
 
@@ -43,7 +52,7 @@ static const YamlObject empty;
  */
 
 YamlObject::YamlObject()
-	: type_(Type::Value)
+	: type_(Type::Value), numberFlags_(0), real_(0.0), integer_(0)
 {
 }
 
@@ -132,171 +141,95 @@ YamlObject::Getter<bool>::get(const YamlObject &obj) const
 	return std::nullopt;
 }
 
-namespace {
-
-bool parseSignedInteger(const std::string &str, long min, long max,
-			long *result)
-{
-	if (str == "")
-		return false;
-
-	char *end;
-
-	errno = 0;
-	long value = std::strtol(str.c_str(), &end, 10);
-
-	if ('\0' != *end || errno == ERANGE || value < min || value > max)
-		return false;
-
-	*result = value;
-	return true;
-}
-
-bool parseUnsignedInteger(const std::string &str, unsigned long max,
-			  unsigned long *result)
-{
-	if (str == "")
-		return false;
-
-	/*
-	 * strtoul() accepts strings representing a negative number, in which
-	 * case it negates the converted value. We don't want to silently accept
-	 * negative values and return a large positive number, so check for a
-	 * minus sign (after optional whitespace) and return an error.
-	 */
-	std::size_t found = str.find_first_not_of(" \t");
-	if (found != std::string::npos && str[found] == '-')
-		return false;
-
-	char *end;
-
-	errno = 0;
-	unsigned long value = std::strtoul(str.c_str(), &end, 10);
-
-	if ('\0' != *end || errno == ERANGE || value > max)
-		return false;
-
-	*result = value;
-	return true;
-}
-
-} /* namespace */
-
 template<>
 std::optional<int8_t>
 YamlObject::Getter<int8_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberInteger))
 		return std::nullopt;
 
-	long value;
-
-	if (!parseSignedInteger(obj.value_, std::numeric_limits<int8_t>::min(),
-				std::numeric_limits<int8_t>::max(), &value))
+	if (obj.integer_ < std::numeric_limits<int8_t>::min() ||
+	    obj.integer_ > std::numeric_limits<int8_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<uint8_t>
 YamlObject::Getter<uint8_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberUnsigned))
 		return std::nullopt;
 
-	unsigned long value;
-
-	if (!parseUnsignedInteger(obj.value_, std::numeric_limits<uint8_t>::max(),
-				  &value))
+	if (obj.integer_ > std::numeric_limits<uint8_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<int16_t>
 YamlObject::Getter<int16_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberInteger))
 		return std::nullopt;
 
-	long value;
-
-	if (!parseSignedInteger(obj.value_, std::numeric_limits<int16_t>::min(),
-				std::numeric_limits<int16_t>::max(), &value))
+	if (obj.integer_ < std::numeric_limits<int16_t>::min() ||
+	    obj.integer_ > std::numeric_limits<int16_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<uint16_t>
 YamlObject::Getter<uint16_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberUnsigned))
 		return std::nullopt;
 
-	unsigned long value;
-
-	if (!parseUnsignedInteger(obj.value_, std::numeric_limits<uint16_t>::max(),
-				  &value))
+	if (obj.integer_ > std::numeric_limits<uint16_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<int32_t>
 YamlObject::Getter<int32_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberInteger))
 		return std::nullopt;
 
-	long value;
-
-	if (!parseSignedInteger(obj.value_, std::numeric_limits<int32_t>::min(),
-				std::numeric_limits<int32_t>::max(), &value))
+	if (obj.integer_ < std::numeric_limits<int32_t>::min() ||
+	    obj.integer_ > std::numeric_limits<int32_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<uint32_t>
 YamlObject::Getter<uint32_t>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberUnsigned))
 		return std::nullopt;
 
-	unsigned long value;
-
-	if (!parseUnsignedInteger(obj.value_, std::numeric_limits<uint32_t>::max(),
-				  &value))
+	if (obj.integer_ > std::numeric_limits<uint32_t>::max())
 		return std::nullopt;
 
-	return value;
+	return obj.integer_;
 }
 
 template<>
 std::optional<double>
 YamlObject::Getter<double>::get(const YamlObject &obj) const
 {
-	if (obj.type_ != Type::Value)
-		return std::nullopt;
-
-	if (obj.value_ == "")
-		return std::nullopt;
-
-	char *end;
-
-	errno = 0;
-	double value = utils::strtod(obj.value_.c_str(), &end);
-
-	if ('\0' != *end || errno == ERANGE)
+	if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberReal))
 		return std::nullopt;
 
-	return value;
+	return obj.real_;
 }
 
 template<>
@@ -363,6 +296,13 @@ std::optional<std::vector<T>> YamlObject::getList() const
 	if (type_ != Type::List)
 		return std::nullopt;
 
+	if constexpr (std::is_same_v<double, T>) {
+		if (!(numberFlags_ & NumberReal))
+			return std::nullopt;
+
+		return reals_;
+	}
+
 	std::vector<T> values;
 	values.reserve(list_.size());
 
@@ -389,6 +329,39 @@ template std::optional<std::vector<Size>> YamlObject::getList<Size>() const;
 
 #endif /* __DOXYGEN__ */
 
+/**
+ * \fn template<typename T> YamlObject::getSpan<T>() const
+ * \brief Retrieve the YamlObject as a span of \a T values
+ *
+ * This function returns a view of the values of a list YamlObject whose
+ * elements are all \a T values, without parsing or copying them. Numerical
+ * values are parsed when the YAML content is loaded, making this function the
+ * fastest way to access large tables of numbers. If the YamlObject isn't a
+ * list of \a T values, std::nullopt is returned.
+ *
+ * Only the double type is currently supported. The returned span is valid for
+ * the lifetime of the YamlObject.
+ *
+ * \return The YamlObject value as a Span<const T>, or std::nullopt if the
+ * YamlObject isn't a list of \a T values
+ */
+
+#ifndef __DOXYGEN__
+
+template<typename T,
+	 std::enable_if_t<std::is_same_v<double, T>> *>
+std::optional<Span<const T>> YamlObject::getSpan() const
+{
+	if (type_ != Type::List || !(numberFlags_ & NumberReal))
+		return std::nullopt;
+
+	return Span<const T>{ reals_ };
+}
+
+template std::optional<Span<const double>> YamlObject::getSpan<double>() const;
+
+#endif /* __DOXYGEN__ */
+
 /**
  * \fn YamlObject::asDict() const
  * \brief Wrap a dictionary YamlObject in an adapter that exposes iterators
@@ -488,6 +461,72 @@ const YamlObject &YamlObject::operator[](const std::string &key) const
 	return *iter->second;
 }
 
+/**
+ * \brief Parse the numerical value of a value or list YamlObject
+ *
+ * Parsing numbers from strings is expensive, and tuning files contain large
+ * tables of numbers. This function parses the value of a value YamlObject as
+ * an integer and as a real number once, when the YAML content is loaded, to
+ * speed up the getters. For a list YamlObject whose elements are all real
+ * numbers, the numbers are additionally stored in a contiguous array to be
+ * accessed through getSpan().
+ *
+ * The elements of a list shall be parsed before the list itself.
+ */
+void YamlObject::parseNumbers()
+{
+	numberFlags_ = 0;
+	reals_.clear();
+
+	if (type_ == Type::List) {
+		for (const Value &elem : list_) {
+			const YamlObject &obj = *elem.value;
+			if (obj.type_ != Type::Value || !(obj.numberFlags_ & NumberReal))
+				return;
+		}
+
+		reals_.reserve(list_.size());
+		for (const Value &elem : list_)
+			reals_.push_back(elem.value->real_);
+
+		numberFlags_ = NumberReal;
+		return;
+	}
+
+	if (type_ != Type::Value || value_.empty())
+		return;
+
+	const char *str = value_.c_str();
+	char *end;
+
+	errno = 0;
+	double real = utils::strtod(str, &end);
+	if ('\0' != *end || errno == ERANGE)
+		return;
+
+	numberFlags_ = NumberReal;
+	real_ = real;
+
+	/* All integers are valid real numbers, skip them early otherwise. */
+	errno = 0;
+	long long integer = std::strtoll(str, &end, 10);
+	if ('\0' != *end || errno == ERANGE)
+		return;
+
+	numberFlags_ |= NumberInteger;
+	integer_ = integer;
+
+	/*
+	 * strtoul() accepts strings representing a negative number, in which
+	 * case it negates the converted value. We don't want to silently accept
+	 * negative values as unsigned integers, so check for a minus sign
+	 * (after optional whitespace).
+	 */
+	std::size_t found = value_.find_first_not_of(" \t");
+	if (found == std::string::npos || value_[found] != '-')
+		numberFlags_ |= NumberUnsigned;
+}
+
 #ifndef __DOXYGEN__
 
 class YamlParserContext
@@ -496,7 +535,7 @@ public:
 	YamlParserContext();
 	~YamlParserContext();
 
-	int init(File &file);
+	int init(Span<const uint8_t> contents);
 	int parseContent(YamlObject &yamlObject);
 
 private:
@@ -509,9 +548,6 @@ private:
 	};
 	using EventPtr = std::unique_ptr<yaml_event_t, EventDeleter>;
 
-	static int yamlRead(void *data, unsigned char *buffer, size_t size,
-			    size_t *sizeRead);
-
 	EventPtr nextEvent();
 
 	void readValue(std::string &value, EventPtr event);
@@ -549,17 +585,17 @@ YamlParserContext::~YamlParserContext()
 
 /**
  * \fn YamlParserContext::init()
- * \brief Initialize a parser with an opened file for parsing
- * \param[in] fh The YAML file to parse
+ * \brief Initialize a parser with the contents of a file for parsing
+ * \param[in] contents The YAML content to parse
  *
  * Prior to parsing the YAML content, the YamlParserContext must be initialized
- * with a file to create an internal parser. The file needs to stay valid until
- * parsing completes.
+ * with the content to create an internal parser. The content needs to stay
+ * valid until parsing completes.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EINVAL The parser has failed to initialize
  */
-int YamlParserContext::init(File &file)
+int YamlParserContext::init(Span<const uint8_t> contents)
 {
 	/* yaml_parser_initialize returns 1 when it succeededs */
 	if (!yaml_parser_initialize(&parser_)) {
@@ -567,25 +603,11 @@ int YamlParserContext::init(File &file)
 		return -EINVAL;
 	}
 	parserValid_ = true;
-	yaml_parser_set_input(&parser_, &YamlParserContext::yamlRead, &file);
+	yaml_parser_set_input_string(&parser_, contents.data(), contents.size());
 
 	return 0;
 }
 
-int YamlParserContext::yamlRead(void *data, unsigned char *buffer, size_t size,
-				size_t *sizeRead)
-{
-	File *file = static_cast<File *>(data);
-
-	Span<unsigned char> buf{ buffer, size };
-	ssize_t ret = file->read(buf);
-	if (ret < 0)
-		return 0;
-
-	*sizeRead = ret;
-	return 1;
-}
-
 /**
  * \fn YamlParserContext::nextEvent()
  * \brief Get the next event
@@ -728,6 +750,7 @@ int YamlParserContext::parseNextYamlObject(YamlObject &yamlObject, EventPtr even
 	case YAML_SCALAR_EVENT:
 		yamlObject.type_ = YamlObject::Type::Value;
 		readValue(yamlObject.value_, std::move(event));
+		yamlObject.parseNumbers();
 		return 0;
 
 	case YAML_SEQUENCE_START_EVENT: {
@@ -737,7 +760,12 @@ int YamlParserContext::parseNextYamlObject(YamlObject &yamlObject, EventPtr even
 			list.emplace_back(std::string{}, std::make_unique<YamlObject>());
 			return parseNextYamlObject(*list.back().value, std::move(evt));
 		};
-		return parseDictionaryOrList(YamlObject::Type::List, handler);
+		int ret = parseDictionaryOrList(YamlObject::Type::List, handler);
+		if (ret)
+			return ret;
+
+		yamlObject.parseNumbers();
+		return 0;
 	}
 
 	case YAML_MAPPING_START_EVENT: {
@@ -782,6 +810,428 @@ int YamlParserContext::parseNextYamlObject(YamlObject &yamlObject, EventPtr even
 	}
 }
 
+/*
+ * The binary cache stores the tree of YamlObject instances in a flat array of
+ * nodes, in depth-first order. Container nodes are followed by their children,
+ * and all keys and values are interned in a string table. The parsed numerical
+ * values are stored in a separate array, in node order. Caches are only
+ * meant to be used on the system that created them, and are thus stored in
+ * native byte order.
+ */
+namespace {
+
+constexpr uint32_t kCacheMagic = 0x4259434c; /* "LCYB" */
+constexpr uint32_t kCacheVersion = 2;
+constexpr uint32_t kCacheNoKey = std::numeric_limits<uint32_t>::max();
+constexpr unsigned int kCacheMaxDepth = 256;
+
+enum CacheNodeType : uint32_t {
+	CacheNodeValue = 0,
+	CacheNodeList = 1,
+	CacheNodeDictionary = 2,
+};
+
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint32_t nodeCount;
+	uint32_t numberCount;
+	uint32_t stringCount;
+	uint32_t dataSize;
+};
+
+struct CacheNode {
+	uint32_t type;
+	/* Key string index for dictionary members, kCacheNoKey otherwise */
+	uint32_t key;
+	/* Value string index for values, number of children otherwise */
+	uint32_t value;
+	/* YamlObject::NumberFlag, a number is stored for values when non-zero */
+	uint32_t flags;
+};
+
+struct CacheNumber {
+	double real;
+	int64_t integer;
+};
+
+struct CacheString {
+	uint32_t offset;
+	uint32_t length;
+};
+
+uint64_t hashContents(Span<const uint8_t> data)
+{
+	/* 64-bit FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (uint8_t byte : data) {
+		hash ^= byte;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+std::string cacheDirectory()
+{
+	const char *dir = utils::secure_getenv("LIBCAMERA_YAML_CACHE_DIR");
+	if (dir)
+		return dir;
+
+	dir = utils::secure_getenv("XDG_CACHE_HOME");
+	if (dir && *dir)
+		return std::string(dir) + "/libcamera";
+
+	dir = utils::secure_getenv("HOME");
+	if (dir && *dir)
+		return std::string(dir) + "/.cache/libcamera";
+
+	return {};
+}
+
+int createDirectory(const std::string &path)
+{
+	for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+		std::string dir = path.substr(0, pos);
+		if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+			return -errno;
+
+		if (pos == std::string::npos)
+			return 0;
+	}
+}
+
+} /* namespace */
+
+class YamlParserCache
+{
+public:
+	YamlParserCache(Span<const uint8_t> contents);
+
+	std::unique_ptr<YamlObject> load();
+	void store(const YamlObject &root);
+
+private:
+	int loadObject(YamlObject &yamlObject, unsigned int depth);
+	bool loadString(uint32_t index, std::string *str) const;
+
+	void storeObject(const YamlObject &yamlObject, uint32_t key);
+	uint32_t intern(const std::string &str);
+
+	std::string directory_;
+	std::string path_;
+	uint64_t hash_;
+	uint64_t size_;
+
+	Span<const CacheNode> nodes_;
+	Span<const CacheNumber> numbers_;
+	Span<const CacheString> strings_;
+	Span<const char> data_;
+	unsigned int index_;
+	unsigned int numberIndex_;
+
+	std::vector<CacheNode> storeNodes_;
+	std::vector<CacheNumber> storeNumbers_;
+	std::vector<CacheString> storeStrings_;
+	std::string storeData_;
+	std::unordered_map<std::string, uint32_t> interned_;
+};
+
+/**
+ * \class YamlParserCache
+ * \brief Binary cache of parsed YAML files
+ * \param[in] contents The contents of the YAML file
+ *
+ * Parsing large YAML files, such as tuning files, with libyaml is slow. The
+ * YamlParserCache stores the tree of YamlObject instances parsed from a YAML
+ * file in a binary file in the cache directory, named after a hash of the YAML
+ * contents. The binary file is memory-mapped and turned into a tree of
+ * YamlObject instances without tokenizing the YAML content the next time the
+ * same contents are parsed.
+ *
+ * The cache directory is set by the LIBCAMERA_YAML_CACHE_DIR environment
+ * variable, and defaults to $XDG_CACHE_HOME/libcamera or
+ * $HOME/.cache/libcamera. Setting LIBCAMERA_YAML_CACHE_DIR to an empty string
+ * disables the cache.
+ */
+YamlParserCache::YamlParserCache(Span<const uint8_t> contents)
+	: hash_(hashContents(contents)), size_(contents.size()), index_(0),
+	  numberIndex_(0)
+{
+	directory_ = cacheDirectory();
+	if (directory_.empty())
+		return;
+
+	std::stringstream name;
+	name << "yaml-" << std::hex << std::setw(16) << std::setfill('0')
+	     << hash_ << ".bin";
+	path_ = directory_ + "/" + name.str();
+}
+
+/**
+ * \brief Load the cached tree for the YAML contents
+ *
+ * The cache is validated against the hash and size of the YAML contents, and
+ * all indices and sizes it contains are checked before being used. An invalid
+ * cache is ignored.
+ *
+ * \return The root YamlObject if a valid cache exists, nullptr otherwise
+ */
+std::unique_ptr<YamlObject> YamlParserCache::load()
+{
+	if (path_.empty())
+		return nullptr;
+
+	File file(path_);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return nullptr;
+
+	Span<const uint8_t> map = file.map();
+	if (map.size() < sizeof(CacheHeader))
+		return nullptr;
+
+	const CacheHeader *header = reinterpret_cast<const CacheHeader *>(map.data());
+	if (header->magic != kCacheMagic || header->version != kCacheVersion ||
+	    header->sourceHash != hash_ || header->sourceSize != size_)
+		return nullptr;
+
+	uint64_t size = sizeof(*header)
+		      + static_cast<uint64_t>(header->nodeCount) * sizeof(CacheNode)
+		      + static_cast<uint64_t>(header->numberCount) * sizeof(CacheNumber)
+		      + static_cast<uint64_t>(header->stringCount) * sizeof(CacheString)
+		      + header->dataSize;
+	if (map.size() != size) {
+		LOG(YamlParser, Warning) << "Invalid cache " << path_;
+		return nullptr;
+	}
+
+	const uint8_t *data = map.data() + sizeof(*header);
+	nodes_ = { reinterpret_cast<const CacheNode *>(data), header->nodeCount };
+	data += nodes_.size_bytes();
+	numbers_ = { reinterpret_cast<const CacheNumber *>(data), header->numberCount };
+	data += numbers_.size_bytes();
+	strings_ = { reinterpret_cast<const CacheString *>(data), header->stringCount };
+	data += strings_.size_bytes();
+	data_ = { reinterpret_cast<const char *>(data), header->dataSize };
+	index_ = 0;
+	numberIndex_ = 0;
+
+	std::unique_ptr<YamlObject> root(new YamlObject());
+
+	if (loadObject(*root, 0) || index_ != nodes_.size() ||
+	    numberIndex_ != numbers_.size()) {
+		LOG(YamlParser, Warning) << "Invalid cache " << path_;
+		return nullptr;
+	}
+
+	LOG(YamlParser, Debug) << "Loaded YAML content from cache " << path_;
+
+	return root;
+}
+
+int YamlParserCache::loadObject(YamlObject &yamlObject, unsigned int depth)
+{
+	if (depth > kCacheMaxDepth || index_ >= nodes_.size())
+		return -EINVAL;
+
+	const CacheNode &node = nodes_[index_++];
+
+	switch (node.type) {
+	case CacheNodeValue:
+		yamlObject.type_ = YamlObject::Type::Value;
+		if (!loadString(node.value, &yamlObject.value_))
+			return -EINVAL;
+
+		if (node.flags) {
+			if (numberIndex_ >= numbers_.size())
+				return -EINVAL;
+
+			const CacheNumber &number = numbers_[numberIndex_++];
+			yamlObject.numberFlags_ = node.flags;
+			yamlObject.real_ = number.real;
+			yamlObject.integer_ = number.integer;
+		}
+
+		return 0;
+
+	case CacheNodeList:
+	case CacheNodeDictionary: {
+		bool isDictionary = node.type == CacheNodeDictionary;
+
+		if (node.value > nodes_.size() - index_)
+			return -EINVAL;
+
+		yamlObject.type_ = isDictionary ? YamlObject::Type::Dictionary
+						: YamlObject::Type::List;
+
+		auto &list = yamlObject.list_;
+		list.reserve(node.value);
+
+		for (uint32_t i = 0; i < node.value; i++) {
+			std::string key;
+			if (isDictionary &&
+			    (index_ >= nodes_.size() ||
+			     !loadString(nodes_[index_].key, &key)))
+				return -EINVAL;
+
+			auto &elem = list.emplace_back(std::move(key),
+						       std::make_unique<YamlObject>());
+			int ret = loadObject(*elem.value, depth + 1);
+			if (ret)
+				return ret;
+		}
+
+		if (isDictionary) {
+			auto &dictionary = yamlObject.dictionary_;
+			for (const auto &elem : list)
+				dictionary.emplace(elem.key, elem.value.get());
+		} else {
+			yamlObject.parseNumbers();
+		}
+
+		return 0;
+	}
+
+	default:
+		return -EINVAL;
+	}
+}
+
+bool YamlParserCache::loadString(uint32_t index, std::string *str) const
+{
+	if (index >= strings_.size())
+		return false;
+
+	const CacheString &string = strings_[index];
+	if (string.offset > data_.size() ||
+	    string.length > data_.size() - string.offset)
+		return false;
+
+	str->assign(data_.data() + string.offset, string.length);
+	return true;
+}
+
+/**
+ * \brief Store the tree parsed from the YAML contents in the cache
+ * \param[in] root The root YamlObject
+ *
+ * The cache is written to a temporary file that is then atomically renamed, to
+ * avoid corrupting caches accessed concurrently. Failures to write the cache
+ * are not fatal.
+ */
+void YamlParserCache::store(const YamlObject &root)
+{
+	if (path_.empty())
+		return;
+
+	storeObject(root, kCacheNoKey);
+
+	CacheHeader header{};
+	header.magic = kCacheMagic;
+	header.version = kCacheVersion;
+	header.sourceHash = hash_;
+	header.sourceSize = size_;
+	header.nodeCount = storeNodes_.size();
+	header.numberCount = storeNumbers_.size();
+	header.stringCount = storeStrings_.size();
+	header.dataSize = storeData_.size();
+
+	int ret = createDirectory(directory_);
+	if (ret < 0) {
+		LOG(YamlParser, Debug)
+			<< "Failed to create cache directory " << directory_
+			<< ": " << strerror(-ret);
+		return;
+	}
+
+	std::string tmpPath = path_ + "." + std::to_string(getpid()) + ".tmp";
+	unlink(tmpPath.c_str());
+
+	File file(tmpPath);
+	if (!file.open(File::OpenModeFlag::WriteOnly)) {
+		LOG(YamlParser, Debug)
+			<< "Failed to create cache " << tmpPath << ": "
+			<< strerror(-file.error());
+		return;
+	}
+
+	Span<const uint8_t> chunks[] = {
+		{ reinterpret_cast<const uint8_t *>(&header), sizeof(header) },
+		{ reinterpret_cast<const uint8_t *>(storeNodes_.data()),
+		  storeNodes_.size() * sizeof(CacheNode) },
+		{ reinterpret_cast<const uint8_t *>(storeNumbers_.data()),
+		  storeNumbers_.size() * sizeof(CacheNumber) },
+		{ reinterpret_cast<const uint8_t *>(storeStrings_.data()),
+		  storeStrings_.size() * sizeof(CacheString) },
+		{ reinterpret_cast<const uint8_t *>(storeData_.data()),
+		  storeData_.size() },
+	};
+
+	for (const Span<const uint8_t> &chunk : chunks) {
+		if (file.write(chunk) != static_cast<ssize_t>(chunk.size())) {
+			LOG(YamlParser, Debug) << "Failed to write cache " << tmpPath;
+			file.close();
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	file.close();
+
+	if (rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	LOG(YamlParser, Debug) << "Stored YAML content in cache " << path_;
+}
+
+void YamlParserCache::storeObject(const YamlObject &yamlObject, uint32_t key)
+{
+	CacheNode node{};
+	node.key = key;
+
+	switch (yamlObject.type_) {
+	case YamlObject::Type::Value:
+		node.type = CacheNodeValue;
+		node.value = intern(yamlObject.value_);
+		node.flags = yamlObject.numberFlags_;
+		storeNodes_.push_back(node);
+
+		if (node.flags)
+			storeNumbers_.push_back({ yamlObject.real_, yamlObject.integer_ });
+		return;
+
+	case YamlObject::Type::List:
+	case YamlObject::Type::Dictionary: {
+		bool isDictionary = yamlObject.type_ == YamlObject::Type::Dictionary;
+
+		node.type = isDictionary ? CacheNodeDictionary : CacheNodeList;
+		node.value = yamlObject.list_.size();
+		storeNodes_.push_back(node);
+
+		for (const auto &elem : yamlObject.list_)
+			storeObject(*elem.value,
+				    isDictionary ? intern(elem.key) : kCacheNoKey);
+		return;
+	}
+	}
+}
+
+uint32_t YamlParserCache::intern(const std::string &str)
+{
+	auto [it, inserted] = interned_.try_emplace(str, storeStrings_.size());
+	if (inserted) {
+		storeStrings_.push_back({ static_cast<uint32_t>(storeData_.size()),
+					  static_cast<uint32_t>(str.size()) });
+		storeData_ += str;
+	}
+
+	return it->second;
+}
+
 #endif /* __DOXYGEN__ */
 
 /**
@@ -842,16 +1292,48 @@ int YamlParserContext::parseNextYamlObject(YamlObject &yamlObject, EventPtr even
  * returns a pointer to a YamlObject corresponding to the root node of the YAML
  * document.
  *
+ * The parsed tree is stored in a binary cache, and loaded from the cache the
+ * next time a file with the same contents is parsed. The cache is validated by
+ * a hash of the file contents, and is located in the directory set by the
+ * LIBCAMERA_YAML_CACHE_DIR environment variable, or in the libcamera
+ * subdirectory of the user cache directory ($XDG_CACHE_HOME, or $HOME/.cache)
+ * by default. Setting LIBCAMERA_YAML_CACHE_DIR to an empty string disables the
+ * cache.
+ *
  * \return Pointer to result YamlObject on success or nullptr otherwise
  */
 std::unique_ptr<YamlObject> YamlParser::parse(File &file)
 {
+	std::vector<uint8_t> contents;
+	uint8_t buffer[4096];
+
+	while (true) {
+		ssize_t ret = file.read(buffer);
+		if (ret < 0) {
+			LOG(YamlParser, Error)
+				<< "Failed to read " << file.fileName() << ": "
+				<< strerror(-ret);
+			return nullptr;
+		}
+
+		if (!ret)
+			break;
+
+		contents.insert(contents.end(), buffer, buffer + ret);
+	}
+
+	YamlParserCache cache(contents);
+
+	std::unique_ptr<YamlObject> root = cache.load();
+	if (root)
+		return root;
+
 	YamlParserContext context;
 
-	if (context.init(file))
+	if (context.init(contents))
 		return nullptr;
 
-	std::unique_ptr<YamlObject> root(new YamlObject());
+	root = std::make_unique<YamlObject>();
 
 	if (context.parseContent(*root)) {
 		LOG(YamlParser, Error)
@@ -860,6 +1342,8 @@ std::unique_ptr<YamlObject> YamlParser::parse(File &file)
 		return nullptr;
 	}
 
+	cache.store(*root);
+
 	return root;
 }
 
@@ -0,0 +1,122 @@
+# SPDX-License-Identifier: LGPL-2.1-or-later
+# Copyright (C) 2024, Google Inc.
+
+"""asyncio integration for libcamera
+
+The CameraManager signals completed requests through its event_fd. The
+RequestCompletions class registers that file descriptor with an asyncio event
+loop, and dispatches the completed requests from the event loop thread, either
+to the future returned by queue_request(), or to the async iterator:
+
+    with RequestCompletions(cm) as completions:
+        cam.start()
+
+        req = await completions.queue_request(cam, req)
+
+        for req in reqs:
+            cam.queue_request(req)
+
+        async for req in completions:
+            ...
+
+Requests completing at the same time are dispatched in a single batch, with a
+single wakeup of the event loop, and a single RequestCompletions handles the
+requests of all cameras of the manager.
+"""
+
+from __future__ import annotations
+
+import asyncio
+import typing
+
+from ._libcamera import Camera, CameraManager, Request
+
+__all__ = ['RequestCompletions']
+
+
+class RequestCompletions:
+    """Dispatch the requests completed by a CameraManager to an event loop
+
+    The event loop defaults to the running loop, the instance shall then be
+    created from a coroutine.
+    """
+
+    def __init__(self, cm: CameraManager,
+                 loop: typing.Optional[asyncio.AbstractEventLoop] = None):
+        self._cm: typing.Optional[CameraManager] = cm
+        self._loop = loop if loop is not None else asyncio.get_running_loop()
+        self._fd = cm.event_fd
+
+        # Futures of the requests queued with queue_request(), indexed by the
+        # id of the request. Queued requests are kept alive by the bindings,
+        # so their id can't be reused before they complete.
+        self._futures: dict[int, asyncio.Future[Request]] = {}
+        self._queue: asyncio.Queue[typing.Optional[Request]] = asyncio.Queue()
+
+        self._loop.add_reader(self._fd, self._dispatch)
+
+    def close(self) -> None:
+        """Stop dispatching completed requests and release the manager"""
+        if self._cm is None:
+            return
+
+        self._loop.remove_reader(self._fd)
+        self._cm = None
+
+        for future in self._futures.values():
+            future.cancel()
+        self._futures.clear()
+
+        # Wake up the async iterator.
+        self._queue.put_nowait(None)
+
+    def __enter__(self) -> RequestCompletions:
+        return self
+
+    def __exit__(self, *args) -> None:
+        self.close()
+
+    def queue_request(self, cam: Camera, req: Request) -> asyncio.Future[Request]:
+        """Queue a request to a camera
+
+        Return a future that completes with the request when it completes.
+        The request is not returned by the async iterator.
+        """
+        if self._cm is None:
+            raise RuntimeError('RequestCompletions is closed')
+
+        future = self._loop.create_future()
+        self._futures[id(req)] = future
+
+        try:
+            cam.queue_request(req)
+        except Exception:
+            del self._futures[id(req)]
+            raise
+
+        return future
+
+    def __aiter__(self) -> RequestCompletions:
+        return self
+
+    async def __anext__(self) -> Request:
+        """Wait for the next completed request not queued with queue_request()"""
+        if self._cm is None and self._queue.empty():
+            raise StopAsyncIteration
+
+        req = await self._queue.get()
+        if req is None:
+            raise StopAsyncIteration
+
+        return req
+
+    def _dispatch(self) -> None:
+        if self._cm is None:
+            return
+
+        for req in self._cm.get_ready_requests():
+            future = self._futures.pop(id(req), None)
+            if future is None:
+                self._queue.put_nowait(req)
+            elif not future.cancelled():
+                future.set_result(req)
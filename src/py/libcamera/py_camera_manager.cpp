@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <vector>
 
+#include "py_helpers.h"
 #include "py_main.h"
 
 namespace py = pybind11;
@@ -31,7 +32,12 @@ PyCameraManager::PyCameraManager()
 
 	eventFd_ = UniqueFD(fd);
 
-	int ret = cameraManager_->start();
+	int ret;
+	{
+		/* Enumerating the cameras may take a while, release the GIL. */
+		py::gil_scoped_release release;
+		ret = cameraManager_->start();
+	}
 	if (ret)
 		throw std::system_error(-ret, std::generic_category(),
 					"Failed to start CameraManager");
@@ -62,31 +68,58 @@ py::list PyCameraManager::cameras()
 
 std::vector<py::object> PyCameraManager::getReadyRequests()
 {
-	int ret = readFd();
+	std::vector<py::object> py_reqs;
 
-	if (ret == -EAGAIN)
-		return std::vector<py::object>();
+	for (Request *request : readCompletedRequests()) {
+		py::object o = py::cast(request);
+		/* Decrease the ref increased in Camera.queue_request() */
+		o.dec_ref();
+		py_reqs.push_back(o);
+	}
 
-	if (ret != 0)
-		throw std::system_error(-ret, std::generic_category());
+	return py_reqs;
+}
 
-	std::vector<py::object> py_reqs;
+/*
+ * Retrieve all completed requests along with their metadata in a single call,
+ * as a list of (request, metadata) tuples. Array metadata are returned as
+ * memoryviews, avoiding the creation of one Python object per element.
+ */
+py::list PyCameraManager::getReadyRequestsWithMetadata()
+{
+	py::list py_reqs;
 
-	for (Request *request : getCompletedRequests()) {
+	for (Request *request : readCompletedRequests()) {
 		py::object o = py::cast(request);
 		/* Decrease the ref increased in Camera.queue_request() */
 		o.dec_ref();
-		py_reqs.push_back(o);
+
+		py::dict metadata;
+
+		for (const auto &[key, cv] : request->metadata()) {
+			const ControlId *id = controls::controls.at(key);
+			metadata[py::cast(id, py::return_value_policy::reference)] =
+				controlValueToPyView(cv);
+		}
+
+		py_reqs.append(py::make_tuple(o, metadata));
 	}
 
 	return py_reqs;
 }
 
-/* Note: Called from another thread */
+/*
+ * Note: Called from another thread
+ *
+ * The eventfd is only signalled when the first request is added to an empty
+ * list. Requests completing before the application reads the list are
+ * delivered with it, with a single wakeup of the application for the whole
+ * batch and without a write() system call per request.
+ */
 void PyCameraManager::handleRequestCompleted(Request *req)
 {
-	pushRequest(req);
-	writeFd();
+	if (pushRequest(req))
+		writeFd();
 }
 
 void PyCameraManager::writeFd()
@@ -116,10 +149,11 @@ int PyCameraManager::readFd()
 		return -EIO;
 }
 
-void PyCameraManager::pushRequest(Request *req)
+bool PyCameraManager::pushRequest(Request *req)
 {
 	MutexLocker guard(completedRequestsMutex_);
 	completedRequests_.push_back(req);
+	return completedRequests_.size() == 1;
 }
 
 std::vector<Request *> PyCameraManager::getCompletedRequests()
@@ -129,3 +163,21 @@ std::vector<Request *> PyCameraManager::getCompletedRequests()
 	swap(v, completedRequests_);
 	return v;
 }
+
+std::vector<Request *> PyCameraManager::readCompletedRequests()
+{
+	/*
+	 * Read the eventfd before retrieving the requests, to ensure that a
+	 * request pushed to the list after it has been swapped signals the
+	 * eventfd again.
+	 */
+	int ret = readFd();
+
+	if (ret == -EAGAIN)
+		return std::vector<Request *>();
+
+	if (ret != 0)
+		throw std::system_error(-ret, std::generic_category());
+
+	return getCompletedRequests();
+}
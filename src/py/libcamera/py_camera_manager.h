@@ -27,6 +27,7 @@ public:
 	int eventFd() const { return eventFd_.get(); }
 
 	std::vector<pybind11::object> getReadyRequests();
+	pybind11::list getReadyRequestsWithMetadata();
 
 	void handleRequestCompleted(Request *req);
 
@@ -40,6 +41,7 @@ private:
 
 	void writeFd();
 	int readFd();
-	void pushRequest(Request *req);
+	bool pushRequest(Request *req);
 	std::vector<Request *> getCompletedRequests();
+	std::vector<Request *> readCompletedRequests();
 };
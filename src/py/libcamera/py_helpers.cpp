@@ -59,6 +59,41 @@ py::object controlValueToPy(const ControlValue &cv)
 	}
 }
 
+template<typename T>
+static py::object arrayView(const ControlValue &cv)
+{
+	Span<const uint8_t> data = cv.data();
+	py::bytes bytes(reinterpret_cast<const char *>(data.data()), data.size());
+
+	return py::memoryview(bytes).attr("cast")(py::format_descriptor<T>::format());
+}
+
+/*
+ * Convert arrays of numerical values to a memoryview on a copy of the data,
+ * instead of creating a Python object for each element. Other values are
+ * converted with controlValueToPy().
+ */
+py::object controlValueToPyView(const ControlValue &cv)
+{
+	if (!cv.isArray())
+		return controlValueToPy(cv);
+
+	switch (cv.type()) {
+	case ControlTypeBool:
+		return arrayView<bool>(cv);
+	case ControlTypeByte:
+		return arrayView<uint8_t>(cv);
+	case ControlTypeInteger32:
+		return arrayView<int32_t>(cv);
+	case ControlTypeInteger64:
+		return arrayView<int64_t>(cv);
+	case ControlTypeFloat:
+		return arrayView<float>(cv);
+	default:
+		return controlValueToPy(cv);
+	}
+}
+
 template<typename T>
 static ControlValue controlValueMaybeArray(const py::object &ob)
 {
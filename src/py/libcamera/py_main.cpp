@@ -7,6 +7,7 @@
 
 #include "py_main.h"
 
+#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -90,6 +91,7 @@ void init_py_controls_generated(py::module &m);
 void init_py_enums(py::module &m);
 void init_py_formats_generated(py::module &m);
 void init_py_geometry(py::module &m);
+void init_py_mapped_frame_buffer(py::module &m);
 void init_py_properties_generated(py::module &m);
 void init_py_transform(py::module &m);
 
@@ -115,6 +117,7 @@ PYBIND11_MODULE(_libcamera, m)
 	auto pySensorConfiguration = py::class_<SensorConfiguration>(m, "SensorConfiguration");
 	auto pyCameraConfiguration = py::class_<CameraConfiguration>(m, "CameraConfiguration");
 	auto pyCameraConfigurationStatus = py::enum_<CameraConfiguration::Status>(pyCameraConfiguration, "Status");
+	auto pyCameraConfigurationBufferHint = py::enum_<CameraConfiguration::BufferHint>(pyCameraConfiguration, "BufferHint");
 	auto pyStreamConfiguration = py::class_<StreamConfiguration>(m, "StreamConfiguration");
 	auto pyStreamFormats = py::class_<StreamFormats>(m, "StreamFormats");
 	auto pyFrameBufferAllocator = py::class_<FrameBufferAllocator>(m, "FrameBufferAllocator");
@@ -132,6 +135,7 @@ PYBIND11_MODULE(_libcamera, m)
 	auto pyPixelFormat = py::class_<PixelFormat>(m, "PixelFormat");
 
 	init_py_formats_generated(m);
+	init_py_mapped_frame_buffer(m);
 
 	/* Global functions */
 	m.def("log_set_level", &logSetLevel);
@@ -154,18 +158,27 @@ PYBIND11_MODULE(_libcamera, m)
 		.def_property_readonly("cameras", &PyCameraManager::cameras)
 
 		.def_property_readonly("event_fd", &PyCameraManager::eventFd)
-		.def("get_ready_requests", &PyCameraManager::getReadyRequests);
+		.def("get_ready_requests", &PyCameraManager::getReadyRequests)
+		.def("get_ready_requests_with_metadata", &PyCameraManager::getReadyRequestsWithMetadata);
 
 	pyCamera
 		.def_property_readonly("id", &Camera::id)
 		.def("acquire", [](Camera &self) {
-			int ret = self.acquire();
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.acquire();
+			}
 			if (ret)
 				throw std::system_error(-ret, std::generic_category(),
 							"Failed to acquire camera");
 		})
 		.def("release", [](Camera &self) {
-			int ret = self.release();
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.release();
+			}
 			if (ret)
 				throw std::system_error(-ret, std::generic_category(),
 							"Failed to release camera");
@@ -186,7 +199,11 @@ PYBIND11_MODULE(_libcamera, m)
 				controlList.set(id->id(), val);
 			}
 
-			int ret = self.start(&controlList);
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.start(&controlList);
+			}
 			if (ret) {
 				self.requestCompleted.disconnect();
 				throw std::system_error(-ret, std::generic_category(),
@@ -195,7 +212,11 @@ PYBIND11_MODULE(_libcamera, m)
 		}, py::arg("controls") = std::unordered_map<const ControlId *, py::object>())
 
 		.def("stop", [](Camera &self) {
-			int ret = self.stop();
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.stop();
+			}
 
 			self.requestCompleted.disconnect();
 
@@ -214,7 +235,11 @@ PYBIND11_MODULE(_libcamera, m)
 		}, py::keep_alive<0, 1>())
 
 		.def("configure", [](Camera &self, CameraConfiguration *config) {
-			int ret = self.configure(config);
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.configure(config);
+			}
 			if (ret)
 				throw std::system_error(-ret, std::generic_category(),
 							"Failed to configure camera");
@@ -238,7 +263,11 @@ PYBIND11_MODULE(_libcamera, m)
 
 			py_req.inc_ref();
 
-			int ret = self.queueRequest(req);
+			int ret;
+			{
+				py::gil_scoped_release release;
+				ret = self.queueRequest(req);
+			}
 			if (ret) {
 				py_req.dec_ref();
 				throw std::system_error(-ret, std::generic_category(),
@@ -329,13 +358,19 @@ PYBIND11_MODULE(_libcamera, m)
 		.def_property_readonly("size", &CameraConfiguration::size)
 		.def_property_readonly("empty", &CameraConfiguration::empty)
 		.def_readwrite("sensor_config", &CameraConfiguration::sensorConfig)
-		.def_readwrite("orientation", &CameraConfiguration::orientation);
+		.def_readwrite("orientation", &CameraConfiguration::orientation)
+		.def_readwrite("buffer_hint", &CameraConfiguration::bufferHint);
 
 	pyCameraConfigurationStatus
 		.value("Valid", CameraConfiguration::Valid)
 		.value("Adjusted", CameraConfiguration::Adjusted)
 		.value("Invalid", CameraConfiguration::Invalid);
 
+	pyCameraConfigurationBufferHint
+		.value("Balanced", CameraConfiguration::BufferHint::Balanced)
+		.value("MinimalMemory", CameraConfiguration::BufferHint::MinimalMemory)
+		.value("MaxThroughput", CameraConfiguration::BufferHint::MaxThroughput);
+
 	pyStreamConfiguration
 		.def("__str__", &StreamConfiguration::toString)
 		.def_property_readonly("stream", &StreamConfiguration::stream,
@@ -445,7 +480,12 @@ PYBIND11_MODULE(_libcamera, m)
 							"Failed to add buffer");
 		}, py::keep_alive<1, 3>()) /* Request keeps Framebuffer alive */
 		.def_property_readonly("status", &Request::status)
-		.def_property_readonly("buffers", &Request::buffers)
+		.def_property_readonly("buffers", [](Request &self) {
+			/* Convert to a std::map for pybind11 to return a dict. */
+			const Request::BufferMap &buffers = self.buffers();
+			return std::map<const Stream *, FrameBuffer *>(buffers.begin(),
+								       buffers.end());
+		})
 		.def_property_readonly("cookie", &Request::cookie)
 		.def_property_readonly("sequence", &Request::sequence)
 		.def_property_readonly("has_pending_buffers", &Request::hasPendingBuffers)
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Python bindings - MappedFrameBuffer class
+ */
+
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+using namespace libcamera;
+
+namespace {
+
+struct CachedMapping {
+	std::shared_ptr<MappedFrameBuffer> mapping;
+	py::weakref ref;
+};
+
+/*
+ * Mapping a FrameBuffer is expensive, and applications usually map the same
+ * buffers for every frame. Keep the mappings cached until the Python
+ * FrameBuffer object they belong to is destroyed.
+ *
+ * The cache is intentionally leaked, as global C++ destructors can be run
+ * after the Python interpreter has been finalized.
+ */
+std::unordered_map<const FrameBuffer *, CachedMapping> *gMappings =
+	new std::unordered_map<const FrameBuffer *, CachedMapping>();
+
+std::shared_ptr<MappedFrameBuffer> mapFrameBuffer(py::object pyFb)
+{
+	const FrameBuffer *fb = pyFb.cast<const FrameBuffer *>();
+
+	auto it = gMappings->find(fb);
+	if (it != gMappings->end())
+		return it->second.mapping;
+
+	auto mapping = std::make_shared<MappedFrameBuffer>(fb,
+							   MappedFrameBuffer::MapFlag::ReadWrite);
+	if (!mapping->isValid())
+		throw std::system_error(-mapping->error(), std::generic_category(),
+					"Failed to map FrameBuffer");
+
+	py::cpp_function release([fb](py::handle) { gMappings->erase(fb); });
+
+	gMappings->emplace(fb, CachedMapping{ mapping, py::weakref(pyFb, release) });
+
+	return mapping;
+}
+
+class PyMappedPlane
+{
+public:
+	PyMappedPlane(std::shared_ptr<MappedFrameBuffer> mapping, unsigned int index,
+		      std::vector<py::ssize_t> shape, std::vector<py::ssize_t> strides)
+		: mapping_(std::move(mapping)), index_(index),
+		  shape_(std::move(shape)), strides_(std::move(strides))
+	{
+	}
+
+	py::buffer_info bufferInfo() const
+	{
+		Span<uint8_t> plane = mapping_->planes()[index_];
+
+		return py::buffer_info(plane.data(), sizeof(uint8_t),
+				       py::format_descriptor<uint8_t>::format(),
+				       shape_.size(), shape_, strides_, false);
+	}
+
+	size_t length() const { return mapping_->planes()[index_].size(); }
+
+private:
+	std::shared_ptr<MappedFrameBuffer> mapping_;
+	unsigned int index_;
+	std::vector<py::ssize_t> shape_;
+	std::vector<py::ssize_t> strides_;
+};
+
+class PyMappedFrameBuffer
+{
+public:
+	PyMappedFrameBuffer(py::object fb, const std::optional<StreamConfiguration> &config)
+		: fb_(fb), mapping_(mapFrameBuffer(fb))
+	{
+		const std::vector<Span<uint8_t>> &planes = mapping_->planes();
+
+		for (unsigned int i = 0; i < planes.size(); i++) {
+			std::vector<py::ssize_t> shape{ static_cast<py::ssize_t>(planes[i].size()) };
+			std::vector<py::ssize_t> strides{ 1 };
+
+			if (config)
+				planeLayout(*config, i, planes.size(), &shape, &strides);
+
+			planes_.emplace_back(mapping_, i, std::move(shape), std::move(strides));
+		}
+	}
+
+	py::object fb() const { return fb_; }
+	const std::vector<PyMappedPlane> &planes() const { return planes_; }
+
+private:
+	void planeLayout(const StreamConfiguration &config, unsigned int index,
+			 unsigned int numPlanes, std::vector<py::ssize_t> *shape,
+			 std::vector<py::ssize_t> *strides) const;
+
+	py::object fb_;
+	std::shared_ptr<MappedFrameBuffer> mapping_;
+	std::vector<PyMappedPlane> planes_;
+};
+
+/*
+ * Describe the plane as a 2D array of lines for planar and semi-planar
+ * formats, or as a 3D array of pixels for formats with whole-byte pixels such
+ * as RGB888, using the stride of the stream configuration. Fall back to a 1D
+ * array if the configuration doesn't match the buffer.
+ */
+void PyMappedFrameBuffer::planeLayout(const StreamConfiguration &config,
+				      unsigned int index, unsigned int numPlanes,
+				      std::vector<py::ssize_t> *shape,
+				      std::vector<py::ssize_t> *strides) const
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(config.pixelFormat);
+	if (!info.isValid() || info.numPlanes() != numPlanes)
+		return;
+
+	const PixelFormatInfo::Plane &plane = info.planes[index];
+	unsigned int width = config.size.width;
+	unsigned int lines = (config.size.height + plane.verticalSubSampling - 1)
+			   / plane.verticalSubSampling;
+	unsigned int lineLength = info.stride(width, index, 1);
+	unsigned int stride = config.stride
+			    ? config.stride * plane.bytesPerGroup / info.planes[0].bytesPerGroup
+			    : lineLength;
+
+	if (!lines || !lineLength || stride < lineLength)
+		return;
+
+	size_t size = static_cast<size_t>(lines - 1) * stride + lineLength;
+	if (size > mapping_->planes()[index].size())
+		return;
+
+	if (numPlanes == 1 && info.pixelsPerGroup == 1 &&
+	    info.colourEncoding == PixelFormatInfo::ColourEncodingRGB) {
+		py::ssize_t bpp = plane.bytesPerGroup;
+
+		*shape = { lines, width, bpp };
+		*strides = { stride, bpp, 1 };
+	} else {
+		*shape = { lines, lineLength };
+		*strides = { stride, 1 };
+	}
+}
+
+} /* namespace */
+
+void init_py_mapped_frame_buffer(py::module &m)
+{
+	auto pyMappedFrameBuffer = py::class_<PyMappedFrameBuffer>(m, "MappedFrameBuffer");
+	auto pyMappedPlane = py::class_<PyMappedPlane>(pyMappedFrameBuffer, "Plane",
+						       py::buffer_protocol());
+
+	pyMappedFrameBuffer
+		.def(py::init<py::object, const std::optional<StreamConfiguration> &>(),
+		     py::arg("fb"), py::arg("config") = std::nullopt)
+		.def_property_readonly("fb", &PyMappedFrameBuffer::fb)
+		.def_property_readonly("planes", [](const PyMappedFrameBuffer &self) {
+			py::tuple planes(self.planes().size());
+			for (size_t i = 0; i < self.planes().size(); i++)
+				planes[i] = py::cast(self.planes()[i]);
+			return planes;
+		});
+
+	pyMappedPlane
+		.def_buffer(&PyMappedPlane::bufferInfo)
+		.def("__len__", &PyMappedPlane::length);
+}
@@ -11,7 +11,7 @@ class MappedFrameBuffer:
     def __init__(self, fb: libcamera.FrameBuffer):
         self.__fb = fb
         self.__planes = ()
-        self.__maps = ()
+        self.__mapping = None
 
     def __enter__(self):
         return self.mmap()
@@ -23,59 +23,11 @@ class MappedFrameBuffer:
         if self.__planes:
             raise RuntimeError('MappedFrameBuffer already mmapped')
 
-        import os
-        import mmap
+        # The native mapping is cached for the lifetime of the FrameBuffer,
+        # and exposes the planes through the buffer protocol without copies.
+        self.__mapping = libcamera.MappedFrameBuffer(self.__fb)
 
-        fb = self.__fb
-
-        # Collect information about the buffers
-
-        bufinfos = {}
-
-        for plane in fb.planes:
-            fd = plane.fd
-
-            if fd not in bufinfos:
-                buflen = os.lseek(fd, 0, os.SEEK_END)
-                bufinfos[fd] = {'maplen': 0, 'buflen': buflen}
-            else:
-                buflen = bufinfos[fd]['buflen']
-
-            if plane.offset > buflen or plane.offset + plane.length > buflen:
-                raise RuntimeError(f'plane is out of buffer: buffer length={buflen}, ' +
-                                   f'plane offset={plane.offset}, plane length={plane.length}')
-
-            bufinfos[fd]['maplen'] = max(bufinfos[fd]['maplen'], plane.offset + plane.length)
-
-        # mmap the buffers
-
-        maps = []
-
-        for fd, info in bufinfos.items():
-            map = mmap.mmap(fd, info['maplen'], mmap.MAP_SHARED, mmap.PROT_READ | mmap.PROT_WRITE)
-            info['map'] = map
-            maps.append(map)
-
-        self.__maps = tuple(maps)
-
-        # Create memoryviews for the planes
-
-        planes = []
-
-        for plane in fb.planes:
-            fd = plane.fd
-            info = bufinfos[fd]
-
-            mv = memoryview(info['map'])
-
-            start = plane.offset
-            end = plane.offset + plane.length
-
-            mv = mv[start:end]
-
-            planes.append(mv)
-
-        self.__planes = tuple(planes)
+        self.__planes = tuple(memoryview(p) for p in self.__mapping.planes)
 
         return self
 
@@ -86,11 +38,8 @@ class MappedFrameBuffer:
         for p in self.__planes:
             p.release()
 
-        for mm in self.__maps:
-            mm.close()
-
         self.__planes = ()
-        self.__maps = ()
+        self.__mapping = None
 
     @property
     def planes(self) -> Tuple[memoryview, ...]:
@@ -7,15 +7,47 @@
 
 #include "v4l2_camera.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <unistd.h>
 
+#include <linux/videodev2.h>
+
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/dma_buf_allocator.h"
+
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat)
 
+namespace {
+
+/*
+ * Maximum number of completed frames waiting to be dequeued by a reader. The
+ * oldest frame is dropped when a new frame completes, so that readers slower
+ * than the camera don't starve the owner of buffers.
+ */
+constexpr unsigned int kMaxReaderQueuedFrames = 2;
+
+void signalEventfd(int efd)
+{
+	uint64_t data = 1;
+	int ret = ::write(efd, &data, sizeof(data));
+	if (ret != sizeof(data))
+		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+}
+
+void clearEventfd(int efd)
+{
+	uint64_t data;
+	int ret = ::read(efd, &data, sizeof(data));
+	if (ret != sizeof(data))
+		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+}
+
+} /* namespace */
+
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
 	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr),
 	  efd_(-1), bufferAvailableCount_(0)
@@ -89,20 +121,87 @@ void V4L2Camera::requestComplete(Request *request)
 	FrameBuffer *buffer = request->buffers().begin()->second;
 	std::unique_ptr<Buffer> metadata =
 		std::make_unique<Buffer>(request->cookie(), buffer->metadata());
+	Buffer frame = *metadata;
 	completedBuffers_.push_back(std::move(metadata));
 	bufferLock_.unlock();
 
-	uint64_t data = 1;
-	int ret = ::write(efd_, &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+	signalEventfd(efd_);
 
 	request->reuse();
+
+	std::vector<unsigned int> requeue;
 	{
 		MutexLocker locker(bufferMutex_);
 		bufferAvailableCount_++;
+		distributeBuffer(frame, &requeue);
 	}
 	bufferCV_.notify_all();
+
+	for (unsigned int index : requeue)
+		qbuf(index);
+}
+
+/*
+ * Share a completed buffer with the streaming readers. The buffer is queued
+ * back to the camera once the owner and all the readers have released it.
+ */
+void V4L2Camera::distributeBuffer(const Buffer &buffer,
+				  std::vector<unsigned int> *requeue)
+{
+	unsigned int count = std::count_if(readers_.begin(), readers_.end(),
+					   [](const auto &reader) {
+						   return reader.second.streaming;
+					   });
+	if (!count)
+		return;
+
+	bufferRefs_[buffer.index_] = count + 1;
+
+	for (auto &[efd, reader] : readers_) {
+		if (!reader.streaming)
+			continue;
+
+		reader.queue.push_back(buffer);
+		signalEventfd(efd);
+
+		if (reader.queue.size() <= kMaxReaderQueuedFrames)
+			continue;
+
+		unsigned int index = reader.queue.front().index_;
+		reader.queue.pop_front();
+		clearEventfd(efd);
+
+		if (releaseBuffer(index))
+			requeue->push_back(index);
+	}
+}
+
+/*
+ * Release all the buffers queued to or held by a reader, and clear the
+ * eventfd events of the queued buffers.
+ */
+void V4L2Camera::dropReaderBuffers(int efd, Reader *reader,
+				   std::vector<unsigned int> *requeue)
+{
+	for (const Buffer &buffer : reader->queue) {
+		clearEventfd(efd);
+		if (releaseBuffer(buffer.index_))
+			requeue->push_back(buffer.index_);
+	}
+
+	for (unsigned int index : reader->held) {
+		if (releaseBuffer(index))
+			requeue->push_back(index);
+	}
+
+	reader->queue.clear();
+	reader->held.clear();
+}
+
+/* Release a reference to a shared buffer, return true if it is now unused. */
+bool V4L2Camera::releaseBuffer(unsigned int index)
+{
+	return !--bufferRefs_[index];
 }
 
 int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
@@ -164,7 +263,20 @@ int V4L2Camera::allocBuffers(unsigned int count)
 	if (ret < 0)
 		return ret;
 
-	for (unsigned int i = 0; i < count; i++) {
+	for (const std::unique_ptr<FrameBuffer> &buffer : bufferAllocator_->buffers(stream))
+		buffers_.push_back(buffer.get());
+
+	/*
+	 * Pipeline handlers allocate the number of buffers they need, which
+	 * may be lower than what the application requested. Allocate the
+	 * additional buffers from a dma-buf allocator with the same layout,
+	 * so that applications can keep more buffers queued.
+	 */
+	count = std::min<unsigned int>(count, VIDEO_MAX_FRAME);
+	if (count > buffers_.size())
+		allocExtraBuffers(count - buffers_.size());
+
+	for (unsigned int i = 0; i < buffers_.size(); i++) {
 		std::unique_ptr<Request> request = camera_->createRequest(i);
 		if (!request) {
 			requestPool_.clear();
@@ -173,7 +285,47 @@ int V4L2Camera::allocBuffers(unsigned int count)
 		requestPool_.push_back(std::move(request));
 	}
 
-	return ret;
+	{
+		MutexLocker locker(bufferMutex_);
+		bufferRefs_.assign(buffers_.size(), 0);
+	}
+
+	return buffers_.size();
+}
+
+void V4L2Camera::allocExtraBuffers(unsigned int count)
+{
+	if (!dmaBufAllocator_)
+		dmaBufAllocator_ = std::make_unique<DmaBufAllocator>(
+			DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
+			DmaBufAllocator::DmaBufAllocatorFlag::SystemHeap |
+			DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf);
+
+	if (!dmaBufAllocator_->isValid()) {
+		LOG(V4L2Compat, Warning)
+			<< "No dma-buf provider, using " << buffers_.size()
+			<< " buffers";
+		return;
+	}
+
+	std::vector<unsigned int> planeSizes;
+	for (const FrameBuffer::Plane &plane : buffers_[0]->planes())
+		planeSizes.push_back(plane.length);
+
+	int ret = dmaBufAllocator_->exportBuffers(count, planeSizes, &extraBuffers_);
+	if (ret < 0) {
+		LOG(V4L2Compat, Warning)
+			<< "Failed to allocate additional buffers, using "
+			<< buffers_.size() << " buffers";
+		extraBuffers_.clear();
+		return;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : extraBuffers_)
+		buffers_.push_back(buffer.get());
+
+	LOG(V4L2Compat, Debug)
+		<< "Allocated " << extraBuffers_.size() << " additional buffers";
 }
 
 void V4L2Camera::freeBuffers()
@@ -181,20 +333,24 @@ void V4L2Camera::freeBuffers()
 	pendingRequests_.clear();
 	requestPool_.clear();
 
+	buffers_.clear();
+	extraBuffers_.clear();
+
+	{
+		MutexLocker locker(bufferMutex_);
+		bufferRefs_.clear();
+	}
+
 	Stream *stream = config_->at(0).stream();
 	bufferAllocator_->free(stream);
 }
 
 int V4L2Camera::getBufferFd(unsigned int index)
 {
-	Stream *stream = config_->at(0).stream();
-	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
-		bufferAllocator_->buffers(stream);
-
-	if (buffers.size() <= index)
+	if (buffers_.size() <= index)
 		return -1;
 
-	return buffers[index]->planes()[0].fd.get();
+	return buffers_[index]->planes()[0].fd.get();
 }
 
 int V4L2Camera::streamOn()
@@ -238,6 +394,17 @@ int V4L2Camera::streamOff()
 	{
 		MutexLocker locker(bufferMutex_);
 		isRunning_ = false;
+
+		/* All buffers return to the owner, drop the readers' frames. */
+		for (auto &[efd, reader] : readers_) {
+			for (size_t i = 0; i < reader.queue.size(); i++)
+				clearEventfd(efd);
+
+			reader.queue.clear();
+			reader.held.clear();
+		}
+
+		std::fill(bufferRefs_.begin(), bufferRefs_.end(), 0);
 	}
 	bufferCV_.notify_all();
 
@@ -250,10 +417,18 @@ int V4L2Camera::qbuf(unsigned int index)
 		LOG(V4L2Compat, Error) << "Invalid index";
 		return -EINVAL;
 	}
+	/* Buffers shared with readers are queued once all users release them. */
+	{
+		MutexLocker locker(bufferMutex_);
+		if (index < bufferRefs_.size() && bufferRefs_[index] &&
+		    !releaseBuffer(index))
+			return 0;
+	}
+
 	Request *request = requestPool_[index].get();
 
 	Stream *stream = config_->at(0).stream();
-	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
+	FrameBuffer *buffer = buffers_[index];
 	int ret = request->addBuffer(stream, buffer);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't set buffer for request";
@@ -274,6 +449,103 @@ int V4L2Camera::qbuf(unsigned int index)
 	return 0;
 }
 
+/*
+ * Readers are identified by the eventfd signalled when a frame is available
+ * to them.
+ */
+void V4L2Camera::addReader(int efd)
+{
+	MutexLocker locker(bufferMutex_);
+	readers_[efd];
+}
+
+void V4L2Camera::removeReader(int efd)
+{
+	setReaderStreaming(efd, false);
+
+	MutexLocker locker(bufferMutex_);
+	readers_.erase(efd);
+}
+
+void V4L2Camera::setReaderStreaming(int efd, bool streaming)
+{
+	std::vector<unsigned int> requeue;
+
+	{
+		MutexLocker locker(bufferMutex_);
+
+		auto it = readers_.find(efd);
+		if (it == readers_.end())
+			return;
+
+		Reader &reader = it->second;
+		reader.streaming = streaming;
+		if (!streaming)
+			dropReaderBuffers(efd, &reader, &requeue);
+	}
+	bufferCV_.notify_all();
+
+	for (unsigned int index : requeue)
+		qbuf(index);
+}
+
+int V4L2Camera::readerQbuf(int efd, unsigned int index)
+{
+	bool requeue;
+
+	{
+		MutexLocker locker(bufferMutex_);
+
+		auto it = readers_.find(efd);
+		if (it == readers_.end())
+			return -EINVAL;
+
+		/* Buffers queued before streaming have nothing to release. */
+		if (!it->second.held.erase(index))
+			return 0;
+
+		requeue = releaseBuffer(index);
+	}
+
+	if (requeue)
+		return qbuf(index);
+
+	return 0;
+}
+
+int V4L2Camera::readerDqbuf(int efd, bool nonBlocking, unsigned int *index,
+			    FrameMetadata *metadata)
+{
+	MutexLocker locker(bufferMutex_);
+
+	auto ready = [&]() LIBCAMERA_TSA_REQUIRES(bufferMutex_) {
+		auto it = readers_.find(efd);
+		return it == readers_.end() || !it->second.streaming ||
+		       !it->second.queue.empty() || !isRunning_;
+	};
+
+	if (!nonBlocking)
+		bufferCV_.wait(locker, ready);
+
+	auto it = readers_.find(efd);
+	if (it == readers_.end() || !it->second.streaming || !isRunning_)
+		return -EINVAL;
+
+	Reader &reader = it->second;
+	if (reader.queue.empty())
+		return -EAGAIN;
+
+	const Buffer &buffer = reader.queue.front();
+	*index = buffer.index_;
+	*metadata = buffer.data_;
+
+	reader.held.insert(buffer.index_);
+	reader.queue.pop_front();
+	clearEventfd(efd);
+
+	return 0;
+}
+
 void V4L2Camera::waitForBufferAvailable()
 {
 	MutexLocker locker(bufferMutex_);
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <deque>
+#include <map>
+#include <set>
 #include <utility>
 
 #include <libcamera/base/mutex.h>
@@ -18,6 +20,12 @@
 #include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
 
+namespace libcamera {
+
+class DmaBufAllocator;
+
+} /* namespace libcamera */
+
 class V4L2Camera
 {
 public:
@@ -56,7 +64,17 @@ public:
 	int streamOn();
 	int streamOff();
 
-	int qbuf(unsigned int index);
+	int qbuf(unsigned int index) LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
+
+	void addReader(int efd) LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
+	void removeReader(int efd) LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
+	void setReaderStreaming(int efd, bool streaming)
+		LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
+	int readerQbuf(int efd, unsigned int index)
+		LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
+	int readerDqbuf(int efd, bool nonBlocking, unsigned int *index,
+			libcamera::FrameMetadata *metadata)
+		LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
 
 	void waitForBufferAvailable() LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
 	bool isBufferAvailable() LIBCAMERA_TSA_EXCLUDES(bufferMutex_);
@@ -64,8 +82,28 @@ public:
 	bool isRunning();
 
 private:
+	/*
+	 * A reader shares the frames captured for the owner of the camera.
+	 * Completed frames wait in the queue until the reader dequeues them,
+	 * and are then held until the reader queues them back.
+	 */
+	struct Reader {
+		bool streaming = false;
+		std::deque<Buffer> queue;
+		std::set<unsigned int> held;
+	};
+
 	void requestComplete(libcamera::Request *request)
-		LIBCAMERA_TSA_EXCLUDES(bufferLock_);
+		LIBCAMERA_TSA_EXCLUDES(bufferLock_, bufferMutex_);
+	void allocExtraBuffers(unsigned int count);
+
+	void distributeBuffer(const Buffer &buffer,
+			      std::vector<unsigned int> *requeue)
+		LIBCAMERA_TSA_REQUIRES(bufferMutex_);
+	void dropReaderBuffers(int efd, Reader *reader,
+			       std::vector<unsigned int> *requeue)
+		LIBCAMERA_TSA_REQUIRES(bufferMutex_);
+	bool releaseBuffer(unsigned int index) LIBCAMERA_TSA_REQUIRES(bufferMutex_);
 
 	std::shared_ptr<libcamera::Camera> camera_;
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
@@ -74,6 +112,9 @@ private:
 
 	libcamera::Mutex bufferLock_;
 	libcamera::FrameBufferAllocator *bufferAllocator_;
+	std::unique_ptr<libcamera::DmaBufAllocator> dmaBufAllocator_;
+	std::vector<std::unique_ptr<libcamera::FrameBuffer>> extraBuffers_;
+	std::vector<libcamera::FrameBuffer *> buffers_;
 
 	std::vector<std::unique_ptr<libcamera::Request>> requestPool_;
 
@@ -86,4 +127,8 @@ private:
 	libcamera::Mutex bufferMutex_;
 	libcamera::ConditionVariable bufferCV_;
 	unsigned int bufferAvailableCount_ LIBCAMERA_TSA_GUARDED_BY(bufferMutex_);
+
+	/* Readers indexed by eventfd, and number of users of each buffer. */
+	std::map<int, Reader> readers_ LIBCAMERA_TSA_GUARDED_BY(bufferMutex_);
+	std::vector<unsigned int> bufferRefs_ LIBCAMERA_TSA_GUARDED_BY(bufferMutex_);
 };
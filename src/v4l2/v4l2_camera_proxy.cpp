@@ -37,11 +37,42 @@ using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat)
 
+namespace {
+
+void fillBufferFromMetadata(struct v4l2_buffer *buf, const FrameMetadata &fmd)
+{
+	switch (fmd.status) {
+	case FrameMetadata::FrameSuccess:
+		buf->bytesused = std::accumulate(fmd.planes().begin(),
+						 fmd.planes().end(), 0,
+						 [](unsigned int total, const auto &plane) {
+							 return total + plane.bytesused;
+						 });
+		buf->field = V4L2_FIELD_NONE;
+		buf->timestamp.tv_sec = fmd.timestamp / 1000000000;
+		buf->timestamp.tv_usec = (fmd.timestamp / 1000) % 1000000;
+		buf->sequence = fmd.sequence;
+
+		buf->flags |= V4L2_BUF_FLAG_DONE;
+		break;
+	case FrameMetadata::FrameError:
+		buf->flags |= V4L2_BUF_FLAG_ERROR;
+		break;
+	default:
+		break;
+	}
+}
+
+} /* namespace */
+
 V4L2CameraProxy::V4L2CameraProxy(unsigned int index,
 				 std::shared_ptr<Camera> camera)
-	: refcount_(0), index_(index), bufferCount_(0), currentBuf_(0),
-	  vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
+	: refcount_(0), index_(index), bufferCount_(0),
+	  memory_(V4L2_MEMORY_MMAP), vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
 {
+	fanout_ = utils::secure_getenv("LIBCAMERA_V4L2_FANOUT") != nullptr;
+
+
 	querycap(camera);
 }
 
@@ -89,6 +120,11 @@ void V4L2CameraProxy::close(V4L2CameraFile *file)
 
 	files_.erase(file);
 
+	if (isReader(file)) {
+		vcam_->removeReader(file->efd());
+		readers_.erase(file);
+	}
+
 	release(file);
 
 	if (--refcount_ > 0)
@@ -105,6 +141,11 @@ void *V4L2CameraProxy::mmap(V4L2CameraFile *file, void *addr, size_t length,
 
 	MutexLocker locker(proxyMutex_);
 
+	if (memory_ != V4L2_MEMORY_MMAP) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
 	/*
 	 * Mimic the videobuf2 behaviour, which requires PROT_READ and
 	 * MAP_SHARED.
@@ -173,7 +214,7 @@ bool V4L2CameraProxy::validateBufferType(uint32_t type)
 
 bool V4L2CameraProxy::validateMemoryType(uint32_t memory)
 {
-	return memory == V4L2_MEMORY_MMAP;
+	return memory == V4L2_MEMORY_MMAP || memory == V4L2_MEMORY_USERPTR;
 }
 
 void V4L2CameraProxy::setFmtFromConfig(const StreamConfiguration &streamConfig)
@@ -220,29 +261,8 @@ void V4L2CameraProxy::updateBuffers()
 {
 	std::vector<V4L2Camera::Buffer> completedBuffers = vcam_->completedBuffers();
 	for (const V4L2Camera::Buffer &buffer : completedBuffers) {
-		const FrameMetadata &fmd = buffer.data_;
-		struct v4l2_buffer &buf = buffers_[buffer.index_];
-
-		switch (fmd.status) {
-		case FrameMetadata::FrameSuccess:
-			buf.bytesused = std::accumulate(fmd.planes().begin(),
-							fmd.planes().end(), 0,
-							[](unsigned int total, const auto &plane) {
-								return total + plane.bytesused;
-							});
-			buf.field = V4L2_FIELD_NONE;
-			buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
-			buf.timestamp.tv_usec = (fmd.timestamp / 1000) % 1000000;
-			buf.sequence = fmd.sequence;
-
-			buf.flags |= V4L2_BUF_FLAG_DONE;
-			break;
-		case FrameMetadata::FrameError:
-			buf.flags |= V4L2_BUF_FLAG_ERROR;
-			break;
-		default:
-			break;
-		}
+		fillBufferFromMetadata(&buffers_[buffer.index_], buffer.data_);
+		completedBuffers_.push_back(buffer.index_);
 	}
 }
 
@@ -466,10 +486,45 @@ int V4L2CameraProxy::vidioc_s_input(V4L2CameraFile *file, int *arg)
 	return 0;
 }
 
+/*
+ * libcamera can only capture to dmabufs, USERPTR buffers are thus emulated by
+ * capturing to internal buffers and copying the frames to the application
+ * memory when they are dequeued. The internal buffers are mapped once when
+ * they are allocated, not for every frame.
+ */
+int V4L2CameraProxy::mapUserptrBuffers()
+{
+	for (unsigned int i = 0; i < bufferCount_; i++) {
+		int fd = vcam_->getBufferFd(i);
+		if (fd < 0)
+			return -EINVAL;
+
+		void *map = V4L2CompatManager::instance()->fops().mmap(nullptr, sizeimage_,
+								       PROT_READ, MAP_SHARED,
+								       fd, 0);
+		if (map == MAP_FAILED) {
+			int ret = -errno;
+			LOG(V4L2Compat, Error)
+				<< "Failed to map buffer " << i << ": "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		userptrMaps_.emplace_back(static_cast<uint8_t *>(map), sizeimage_);
+	}
+
+	return 0;
+}
+
 void V4L2CameraProxy::freeBuffers()
 {
+	for (const Span<uint8_t> &map : userptrMaps_)
+		V4L2CompatManager::instance()->fops().munmap(map.data(), map.size());
+	userptrMaps_.clear();
+
 	vcam_->freeBuffers();
 	buffers_.clear();
+	completedBuffers_.clear();
 	bufferCount_ = 0;
 }
 
@@ -487,10 +542,14 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
+	if (fanout_ && owner_ && !hasOwnership(file))
+		return readerReqbufs(file, arg);
+
 	if (!hasOwnership(file) && owner_)
 		return -EBUSY;
 
-	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP
+			  | V4L2_BUF_CAP_SUPPORTS_USERPTR;
 	arg->flags = 0;
 	memset(arg->reserved, 0, sizeof(arg->reserved));
 
@@ -502,14 +561,17 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		if (vcam_->isRunning())
 			return -EBUSY;
 
+		removeReaders();
 		freeBuffers();
 		release(file);
 
 		return 0;
 	}
 
-	if (bufferCount_ > 0)
+	if (bufferCount_ > 0) {
+		removeReaders();
 		freeBuffers();
+	}
 
 	Size size(v4l2PixFormat_.width, v4l2PixFormat_.height);
 	V4L2PixelFormat v4l2Format = V4L2PixelFormat(v4l2PixFormat_.pixelformat);
@@ -520,22 +582,38 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 
 	setFmtFromConfig(streamConfig_);
 
-	arg->count = streamConfig_.bufferCount;
-	bufferCount_ = arg->count;
-
-	ret = vcam_->allocBuffers(arg->count);
+	/*
+	 * Honour requests for more buffers than the pipeline handler needs,
+	 * V4L2Camera allocates the additional buffers.
+	 */
+	ret = vcam_->allocBuffers(std::max(arg->count, streamConfig_.bufferCount));
 	if (ret < 0) {
 		arg->count = 0;
 		return ret;
 	}
 
+	arg->count = ret;
+	bufferCount_ = arg->count;
+
+	memory_ = arg->memory;
+
+	if (memory_ == V4L2_MEMORY_USERPTR) {
+		ret = mapUserptrBuffers();
+		if (ret < 0) {
+			freeBuffers();
+			arg->count = 0;
+			return ret;
+		}
+	}
+
 	buffers_.resize(arg->count);
 	for (unsigned int i = 0; i < arg->count; i++) {
 		struct v4l2_buffer buf = {};
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.length = v4l2PixFormat_.sizeimage;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.offset = i * v4l2PixFormat_.sizeimage;
+		buf.memory = memory_;
+		if (memory_ == V4L2_MEMORY_MMAP)
+			buf.m.offset = i * v4l2PixFormat_.sizeimage;
 		buf.index = i;
 		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
 
@@ -584,7 +662,7 @@ int V4L2CameraProxy::vidioc_prepare_buf(V4L2CameraFile *file, struct v4l2_buffer
 		return -EINVAL;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
 	struct v4l2_buffer &buffer = buffers_[arg->index];
@@ -609,6 +687,14 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
+	if (isReader(file)) {
+		if (!validateBufferType(arg->type) ||
+		    arg->memory != V4L2_MEMORY_MMAP)
+			return -EINVAL;
+
+		return vcam_->readerQbuf(file->efd(), arg->index);
+	}
+
 	if (buffers_[arg->index].flags & V4L2_BUF_FLAG_QUEUED)
 		return -EINVAL;
 
@@ -616,17 +702,27 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 		return -EBUSY;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory) ||
+	    arg->memory != memory_ ||
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
+	struct v4l2_buffer &buffer = buffers_[arg->index];
+
+	if (memory_ == V4L2_MEMORY_USERPTR) {
+		if (!arg->m.userptr || arg->length < sizeimage_)
+			return -EINVAL;
+
+		buffer.m.userptr = arg->m.userptr;
+		buffer.length = arg->length;
+	}
+
 	int ret = vcam_->qbuf(arg->index);
 	if (ret < 0)
 		return ret;
 
-	buffers_[arg->index].flags |= V4L2_BUF_FLAG_QUEUED;
+	buffer.flags |= V4L2_BUF_FLAG_QUEUED;
 
-	arg->flags = buffers_[arg->index].flags;
+	arg->flags = buffer.flags;
 
 	return ret;
 }
@@ -640,6 +736,9 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
+	if (isReader(file))
+		return readerDqbuf(file, arg, lock);
+
 	if (!hasOwnership(file))
 		return -EBUSY;
 
@@ -647,7 +746,7 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 		return -EINVAL;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
 	if (!file->nonBlocking()) {
@@ -666,14 +765,31 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 
 	updateBuffers();
 
-	struct v4l2_buffer &buf = buffers_[currentBuf_];
+	/*
+	 * Buffers are dequeued in completion order, which may differ from the
+	 * order in which they have been queued.
+	 */
+	if (completedBuffers_.empty())
+		return -EINVAL;
+
+	unsigned int index = completedBuffers_.front();
+	completedBuffers_.pop_front();
+
+	struct v4l2_buffer &buf = buffers_[index];
+
+	if (memory_ == V4L2_MEMORY_USERPTR) {
+		if (buf.flags & V4L2_BUF_FLAG_DONE)
+			memcpy(reinterpret_cast<void *>(buf.m.userptr),
+			       userptrMaps_[index].data(),
+			       std::min<size_t>(buf.bytesused,
+						userptrMaps_[index].size()));
+	} else {
+		buf.length = sizeimage_;
+	}
 
 	buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_PREPARED);
-	buf.length = sizeimage_;
 	*arg = buf;
 
-	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
-
 	uint64_t data;
 	int ret = ::read(file->efd(), &data, sizeof(data));
 	if (ret != sizeof(data))
@@ -687,11 +803,10 @@ int V4L2CameraProxy::vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffe
 	LOG(V4L2Compat, Debug)
 		<< "[" << file->description() << "] " << __func__ << "()";
 
-	if (!hasOwnership(file))
+	if (!hasOwnership(file) && !isReader(file))
 		return -EBUSY;
 
-	/* \todo Verify that the memory type is MMAP when adding DMABUF support */
-	if (!validateBufferType(arg->type))
+	if (!validateBufferType(arg->type) || memory_ != V4L2_MEMORY_MMAP)
 		return -EINVAL;
 
 	if (arg->index >= bufferCount_)
@@ -723,13 +838,19 @@ int V4L2CameraProxy::vidioc_streamon(V4L2CameraFile *file, int *arg)
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
+	/* Readers only receive the frames while the owner is streaming. */
+	if (isReader(file)) {
+		vcam_->setReaderStreaming(file->efd(), true);
+		return 0;
+	}
+
 	if (!hasOwnership(file))
 		return -EBUSY;
 
 	if (vcam_->isRunning())
 		return 0;
 
-	currentBuf_ = 0;
+	completedBuffers_.clear();
 
 	return vcam_->streamOn();
 }
@@ -745,6 +866,11 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
+	if (isReader(file)) {
+		vcam_->setReaderStreaming(file->efd(), false);
+		return 0;
+	}
+
 	if (!hasOwnership(file) && owner_)
 		return -EBUSY;
 
@@ -753,9 +879,93 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	for (struct v4l2_buffer &buf : buffers_)
 		buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
 
+	completedBuffers_.clear();
+
 	return ret;
 }
 
+bool V4L2CameraProxy::isReader(V4L2CameraFile *file)
+{
+	return readers_.find(file) != readers_.end();
+}
+
+/*
+ * Readers share the MMAP buffers allocated by the owner, the number of buffers
+ * is thus dictated by the owner.
+ */
+int V4L2CameraProxy::readerReqbufs(V4L2CameraFile *file,
+				   struct v4l2_requestbuffers *arg)
+{
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->flags = 0;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+
+	if (arg->count == 0) {
+		if (isReader(file)) {
+			vcam_->removeReader(file->efd());
+			readers_.erase(file);
+		}
+
+		return 0;
+	}
+
+	if (arg->memory != V4L2_MEMORY_MMAP || memory_ != V4L2_MEMORY_MMAP ||
+	    bufferCount_ == 0)
+		return -EBUSY;
+
+	if (!isReader(file)) {
+		vcam_->addReader(file->efd());
+		readers_.insert(file);
+	}
+
+	arg->count = bufferCount_;
+
+	LOG(V4L2Compat, Debug) << "Sharing " << arg->count << " buffers";
+
+	return 0;
+}
+
+int V4L2CameraProxy::readerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+				 Mutex *lock)
+{
+	if (!validateBufferType(arg->type) ||
+	    arg->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
+	unsigned int index;
+	FrameMetadata metadata;
+
+	lock->unlock();
+	int ret = vcam_->readerDqbuf(file->efd(), file->nonBlocking(),
+				     &index, &metadata);
+	lock->lock();
+
+	if (ret < 0)
+		return ret;
+
+	/* Check the buffers haven't been freed while we were blocked. */
+	if (index >= bufferCount_)
+		return -EINVAL;
+
+	struct v4l2_buffer buf = buffers_[index];
+	buf.flags &= V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	buf.length = sizeimage_;
+	fillBufferFromMetadata(&buf, metadata);
+	buf.flags &= ~V4L2_BUF_FLAG_DONE;
+
+	*arg = buf;
+
+	return 0;
+}
+
+void V4L2CameraProxy::removeReaders()
+{
+	for (V4L2CameraFile *reader : readers_)
+		vcam_->removeReader(reader->efd());
+
+	readers_.clear();
+}
+
 const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_QUERYCAP,
 	VIDIOC_ENUM_FRAMESIZES,
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <deque>
 #include <linux/videodev2.h>
 #include <map>
 #include <memory>
@@ -15,6 +16,7 @@
 #include <vector>
 
 #include <libcamera/base/mutex.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/camera.h>
 
@@ -45,6 +47,7 @@ private:
 	int tryFormat(struct v4l2_format *arg);
 	enum v4l2_priority maxPriority();
 	void updateBuffers();
+	int mapUserptrBuffers();
 	void freeBuffers();
 
 	int vidioc_querycap(V4L2CameraFile *file, struct v4l2_capability *arg);
@@ -68,6 +71,12 @@ private:
 	int vidioc_streamon(V4L2CameraFile *file, int *arg);
 	int vidioc_streamoff(V4L2CameraFile *file, int *arg);
 
+	bool isReader(V4L2CameraFile *file);
+	int readerReqbufs(V4L2CameraFile *file, struct v4l2_requestbuffers *arg);
+	int readerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+			libcamera::Mutex *lock) LIBCAMERA_TSA_REQUIRES(*lock);
+	void removeReaders();
+
 	bool hasOwnership(V4L2CameraFile *file);
 	int acquire(V4L2CameraFile *file);
 	void release(V4L2CameraFile *file);
@@ -79,14 +88,16 @@ private:
 
 	libcamera::StreamConfiguration streamConfig_;
 	unsigned int bufferCount_;
-	unsigned int currentBuf_;
 	unsigned int sizeimage_;
+	uint32_t memory_;
 
 	struct v4l2_capability capabilities_;
 	struct v4l2_pix_format v4l2PixFormat_;
 
 	std::vector<struct v4l2_buffer> buffers_;
+	std::deque<unsigned int> completedBuffers_;
 	std::map<void *, unsigned int> mmaps_;
+	std::vector<libcamera::Span<uint8_t>> userptrMaps_;
 
 	std::set<V4L2CameraFile *> files_;
 
@@ -103,6 +114,14 @@ private:
 	 */
 	V4L2CameraFile *owner_;
 
+	/*
+	 * When fanout is enabled, files other than the owner can request
+	 * buffers to become readers. Readers dequeue the frames captured for
+	 * the owner, without being able to configure or control the stream.
+	 */
+	bool fanout_;
+	std::set<V4L2CameraFile *> readers_;
+
 	/* This mutex is to serialize access to the proxy. */
 	libcamera::Mutex proxyMutex_;
 };
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * ControlList and ControlSerializer microbenchmarks
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/geometry.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Populate the list with the metadata typically reported per frame. */
+void setMetadata(ControlList &list, int64_t frame)
+{
+	const float gains[] = { 1.5f, 2.0f };
+	const float ccm[] = { 1.6f, -0.4f, -0.2f, -0.3f, 1.5f, -0.2f,
+			      -0.1f, -0.5f, 1.6f };
+
+	list.set(controls::SensorTimestamp, frame * 33333333);
+	list.set(controls::FrameDuration, 33333);
+	list.set(controls::ExposureTime, 10000);
+	list.set(controls::AnalogueGain, 2.0f);
+	list.set(controls::DigitalGain, 1.0f);
+	list.set(controls::ColourGains, gains);
+	list.set(controls::ColourTemperature, 5000);
+	list.set(controls::ColourCorrectionMatrix, ccm);
+	list.set(controls::ScalerCrop, Rectangle(0, 0, 1920, 1080));
+	list.set(controls::Lux, 400.0f);
+}
+
+ControlInfoMap controlInfoMap()
+{
+	return ControlInfoMap({
+		{ &controls::AeEnable, ControlInfo(false, true) },
+		{ &controls::ExposureTime, ControlInfo(100, 66666) },
+		{ &controls::AnalogueGain, ControlInfo(1.0f, 16.0f) },
+		{ &controls::Brightness, ControlInfo(-1.0f, 1.0f, 0.0f) },
+		{ &controls::Contrast, ControlInfo(0.0f, 2.0f, 1.0f) },
+		{ &controls::Saturation, ControlInfo(0.0f, 2.0f, 1.0f) },
+		{ &controls::FrameDurationLimits, ControlInfo(int64_t(33333), int64_t(1000000)) },
+		{ &controls::ScalerCrop, ControlInfo(Rectangle{}, Rectangle(0, 0, 1920, 1080)) },
+	}, controls::controls);
+}
+
+void ControlListSet(benchmark::State &state)
+{
+	ControlList list(controls::controls);
+	int64_t frame = 0;
+
+	for (auto _ : state) {
+		setMetadata(list, frame++);
+		benchmark::DoNotOptimize(list);
+	}
+
+	state.SetItemsProcessed(state.iterations() * list.size());
+}
+BENCHMARK(ControlListSet);
+
+void ControlListGet(benchmark::State &state)
+{
+	ControlList list(controls::controls);
+	setMetadata(list, 0);
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(list.get(controls::SensorTimestamp));
+		benchmark::DoNotOptimize(list.get(controls::AnalogueGain));
+		benchmark::DoNotOptimize(list.get(controls::ColourGains));
+		benchmark::DoNotOptimize(list.get(controls::ScalerCrop));
+		/* A control that isn't in the list. */
+		benchmark::DoNotOptimize(list.get(controls::AfState));
+	}
+
+	state.SetItemsProcessed(state.iterations() * 5);
+}
+BENCHMARK(ControlListGet);
+
+void ControlListMerge(benchmark::State &state)
+{
+	const ControlList::MergePolicy policy =
+		static_cast<ControlList::MergePolicy>(state.range(0));
+	ControlList source(controls::controls);
+	setMetadata(source, 0);
+
+	for (auto _ : state) {
+		ControlList list(controls::controls);
+		list.set(controls::AfState, controls::AfStateFocused);
+		list.set(controls::ExposureTime, 20000);
+		list.merge(source, policy);
+		benchmark::DoNotOptimize(list);
+	}
+}
+BENCHMARK(ControlListMerge)
+	->Arg(static_cast<int64_t>(ControlList::MergePolicy::KeepExisting))
+	->Arg(static_cast<int64_t>(ControlList::MergePolicy::OverwriteExisting));
+
+/*
+ * Serialize a control list on the proxy side and deserialize it on the worker
+ * side, as done for every IPA call with isolated IPA modules.
+ */
+void ControlSerializerRoundTrip(benchmark::State &state)
+{
+	ControlSerializer serializer(ControlSerializer::Role::Proxy);
+	ControlSerializer deserializer(ControlSerializer::Role::Worker);
+	ControlInfoMap infoMap = controlInfoMap();
+
+	std::vector<uint8_t> infoData(serializer.binarySize(infoMap));
+	ByteStreamBuffer infoBuffer(infoData.data(), infoData.size());
+	if (serializer.serialize(infoMap, infoBuffer) < 0) {
+		state.SkipWithError("Failed to serialize the ControlInfoMap");
+		return;
+	}
+
+	ByteStreamBuffer infoInput(const_cast<const uint8_t *>(infoData.data()),
+				   infoData.size());
+	deserializer.deserialize<ControlInfoMap>(infoInput);
+
+	ControlList list(infoMap);
+	list.set(controls::AeEnable, false);
+	list.set(controls::ExposureTime, 10000);
+	list.set(controls::AnalogueGain, 2.0f);
+	list.set(controls::Brightness, 0.5f);
+	list.set(controls::ScalerCrop, Rectangle(0, 0, 1280, 720));
+
+	std::vector<uint8_t> data;
+
+	for (auto _ : state) {
+		data.resize(ControlSerializer::binarySize(list));
+		ByteStreamBuffer output(data.data(), data.size());
+		serializer.serialize(list, output);
+
+		ByteStreamBuffer input(const_cast<const uint8_t *>(data.data()),
+				       data.size());
+		ControlList result = deserializer.deserialize<ControlList>(input);
+		benchmark::DoNotOptimize(result);
+	}
+
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(ControlSerializerRoundTrip);
+
+} /* namespace */
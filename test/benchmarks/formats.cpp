@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * PixelFormatInfo lookup microbenchmarks
+ */
+
+#include <array>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+using namespace libcamera;
+
+namespace {
+
+const std::array<PixelFormat, 6> kFormats = {
+	formats::NV12,
+	formats::YUYV,
+	formats::RGB888,
+	formats::XRGB8888,
+	formats::SRGGB10_CSI2P,
+	formats::SBGGR12,
+};
+
+void PixelFormatInfoLookup(benchmark::State &state)
+{
+	for (auto _ : state) {
+		for (const PixelFormat &format : kFormats)
+			benchmark::DoNotOptimize(&PixelFormatInfo::info(format));
+	}
+
+	state.SetItemsProcessed(state.iterations() * kFormats.size());
+}
+BENCHMARK(PixelFormatInfoLookup);
+
+void PixelFormatInfoLookupV4L2(benchmark::State &state)
+{
+	std::array<V4L2PixelFormat, kFormats.size()> v4l2Formats;
+
+	for (unsigned int i = 0; i < kFormats.size(); i++)
+		v4l2Formats[i] = PixelFormatInfo::info(kFormats[i]).v4l2Formats[0];
+
+	for (auto _ : state) {
+		for (const V4L2PixelFormat &format : v4l2Formats)
+			benchmark::DoNotOptimize(&PixelFormatInfo::info(format));
+	}
+
+	state.SetItemsProcessed(state.iterations() * v4l2Formats.size());
+}
+BENCHMARK(PixelFormatInfoLookupV4L2);
+
+void PixelFormatInfoLookupName(benchmark::State &state)
+{
+	std::array<std::string, kFormats.size()> names;
+
+	for (unsigned int i = 0; i < kFormats.size(); i++)
+		names[i] = kFormats[i].toString();
+
+	for (auto _ : state) {
+		for (const std::string &name : names)
+			benchmark::DoNotOptimize(&PixelFormatInfo::info(name));
+	}
+
+	state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(PixelFormatInfoLookupName);
+
+} /* namespace */
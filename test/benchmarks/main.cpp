@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * libcamera microbenchmarks
+ */
+
+#include <benchmark/benchmark.h>
+
+BENCHMARK_MAIN();
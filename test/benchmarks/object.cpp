@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Signal, Object and Timer microbenchmarks
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+namespace {
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: count_(0)
+	{
+	}
+
+	void slot(unsigned int value)
+	{
+		count_.fetch_add(value, std::memory_order_release);
+	}
+
+	unsigned int value(unsigned int value)
+	{
+		return value + 1;
+	}
+
+	uint64_t count() const { return count_.load(std::memory_order_acquire); }
+
+private:
+	std::atomic<uint64_t> count_;
+};
+
+void SignalEmitDirect(benchmark::State &state)
+{
+	Signal<unsigned int> signal;
+	Receiver receiver;
+
+	signal.connect(&receiver, &Receiver::slot);
+
+	for (auto _ : state)
+		signal.emit(1);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(SignalEmitDirect);
+
+/*
+ * Emit signals to a receiver running in a different thread, and wait for all
+ * of them to be delivered. This measures the throughput of the message queue.
+ */
+void SignalEmitQueued(benchmark::State &state)
+{
+	Thread thread("benchmark");
+	Signal<unsigned int> signal;
+	Receiver receiver;
+
+	receiver.moveToThread(&thread);
+	signal.connect(&receiver, &Receiver::slot);
+	thread.start();
+
+	uint64_t emitted = 0;
+
+	for (auto _ : state) {
+		signal.emit(1);
+		emitted++;
+	}
+
+	while (receiver.count() < emitted)
+		std::this_thread::yield();
+
+	state.SetItemsProcessed(state.iterations());
+
+	thread.exit();
+	thread.wait();
+}
+BENCHMARK(SignalEmitQueued)->UseRealTime();
+
+/* Measure the round-trip latency of a blocking call to another thread. */
+void InvokeMethodBlocking(benchmark::State &state)
+{
+	Thread thread("benchmark");
+	Receiver receiver;
+
+	receiver.moveToThread(&thread);
+	thread.start();
+
+	for (auto _ : state) {
+		unsigned int value = receiver.invokeMethod(&Receiver::value,
+							   ConnectionTypeBlocking, 1);
+		benchmark::DoNotOptimize(value);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+
+	thread.exit();
+	thread.wait();
+}
+BENCHMARK(InvokeMethodBlocking)->UseRealTime();
+
+/* Measure the cost of a call queued to the current thread. */
+void InvokeMethodQueued(benchmark::State &state)
+{
+	Receiver receiver;
+	uint64_t queued = 0;
+
+	for (auto _ : state) {
+		receiver.invokeMethod(&Receiver::slot, ConnectionTypeQueued, 1);
+		queued++;
+
+		if (queued % 1024 == 0)
+			Thread::current()->dispatchMessages();
+	}
+
+	Thread::current()->dispatchMessages();
+
+	if (receiver.count() != queued)
+		state.SkipWithError("Queued calls not delivered");
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(InvokeMethodQueued);
+
+/*
+ * Start and stop timers, as done by pipeline handlers and IPA modules to
+ * implement per-frame timeouts.
+ */
+void TimerChurn(benchmark::State &state)
+{
+	Timer timer;
+
+	for (auto _ : state) {
+		timer.start(100ms);
+		timer.stop();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(TimerChurn);
+
+} /* namespace */
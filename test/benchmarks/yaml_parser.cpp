@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * YamlParser microbenchmarks
+ */
+
+#include <memory>
+#include <stdlib.h>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/yaml_parser.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Parse a tuning file from the source tree. */
+void YamlParserParse(benchmark::State &state, const char *name)
+{
+	std::string root = utils::libcameraSourcePath();
+	if (root.empty()) {
+		state.SkipWithError("Tuning files are only available in the source tree");
+		return;
+	}
+
+	/* Measure parsing, not the binary cache. */
+	setenv("LIBCAMERA_YAML_CACHE_DIR", "", 1);
+
+	File file(root + name);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		state.SkipWithError("Failed to open tuning file");
+		return;
+	}
+
+	for (auto _ : state) {
+		file.seek(0);
+		std::unique_ptr<YamlObject> object = YamlParser::parse(file);
+		if (!object) {
+			state.SkipWithError("Failed to parse tuning file");
+			return;
+		}
+
+		benchmark::DoNotOptimize(object);
+	}
+
+	state.SetBytesProcessed(state.iterations() * file.size());
+}
+BENCHMARK_CAPTURE(YamlParserParse, rkisp1_imx219, "src/ipa/rkisp1/data/imx219.yaml");
+BENCHMARK_CAPTURE(YamlParserParse, rkisp1_ov5640, "src/ipa/rkisp1/data/ov5640.yaml");
+BENCHMARK_CAPTURE(YamlParserParse, rpi_vc4_imx477, "src/ipa/rpi/vc4/data/imx477.json");
+BENCHMARK_CAPTURE(YamlParserParse, rpi_pisp_imx477, "src/ipa/rpi/pisp/data/imx477.json");
+
+} /* namespace */
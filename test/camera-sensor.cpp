@@ -108,6 +108,20 @@ protected:
 			return TestFail;
 		}
 
+		/* Repeated calls must select the same format. */
+		for (unsigned int i = 0; i < 2; i++) {
+			V4L2SubdeviceFormat again =
+				sensor_->getFormat({ 0xdeadbeef,
+						     MEDIA_BUS_FMT_SBGGR10_1X10,
+						     MEDIA_BUS_FMT_BGR888_1X24 },
+						   Size(1024, 768));
+			if (again.code != format.code || again.size != format.size) {
+				cerr << "Inconsistent format on repeated call, got "
+				     << again << endl;
+				return TestFail;
+			}
+		}
+
 		if (lens_ && lens_->setFocusPosition(10)) {
 			cerr << "Failed to set lens focus position" << endl;
 			return TestFail;
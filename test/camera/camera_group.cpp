@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * libcamera CameraGroup API tests
+ */
+
+#include <iostream>
+
+#include <libcamera/camera_group.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class CameraGroupTest : public CameraTest, public Test
+{
+public:
+	CameraGroupTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestsComplete(const std::vector<Request *> &requests, int64_t skew)
+	{
+		if (requests.size() != 1 || skew != 0) {
+			invalidSets_++;
+			return;
+		}
+
+		Request *request = requests[0];
+		const Stream *stream = request->buffers().begin()->first;
+		FrameBuffer *buffer = request->buffers().begin()->second;
+
+		completeSetsCount_++;
+
+		request->reuse();
+		request->addBuffer(stream, buffer);
+		group_->queueRequests({ request }, &controls_);
+	}
+
+	void requestUnmatched([[maybe_unused]] Request *request)
+	{
+		unmatchedCount_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+		dispatcher_ = Thread::current()->eventDispatcher();
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (cm_->createGroup({}) || cm_->createGroup({ camera_, camera_ })) {
+			cout << "Invalid camera group created" << endl;
+			return TestFail;
+		}
+
+		group_ = cm_->createGroup({ camera_ });
+		if (!group_ || group_->cameras().size() != 1) {
+			cout << "Failed to create camera group" << endl;
+			return TestFail;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		completeSetsCount_ = 0;
+		unmatchedCount_ = 0;
+		invalidSets_ = 0;
+
+		group_->requestsCompleted.connect(this, &CameraGroupTest::requestsComplete);
+		group_->requestUnmatched.connect(this, &CameraGroupTest::requestUnmatched);
+
+		if (group_->start()) {
+			cout << "Failed to start camera group" << endl;
+			return TestFail;
+		}
+
+		controls_ = ControlList(controls::controls);
+		controls_.set(controls::Brightness, 0.5f);
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (group_->queueRequests({ request.get() }, &controls_)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+
+			if (request->controls().get(controls::Brightness) != 0.5f) {
+				cout << "Group controls not applied to request" << endl;
+				return TestFail;
+			}
+		}
+
+		if (group_->queueRequests({})) {
+			cout << "Invalid request set queued" << endl;
+			return TestFail;
+		}
+
+		unsigned int nFrames = requests_.size() * 2;
+
+		Timer timer;
+		timer.start(500ms * nFrames);
+		while (timer.isRunning()) {
+			dispatcher_->processEvents();
+			if (completeSetsCount_ > nFrames)
+				break;
+		}
+
+		if (group_->stop()) {
+			cout << "Failed to stop camera group" << endl;
+			return TestFail;
+		}
+
+		if (completeSetsCount_ < nFrames || invalidSets_) {
+			cout << "Failed to capture enough request sets" << endl;
+			return TestFail;
+		}
+
+		/* All requests queued at stop time are reported as unmatched. */
+		if (unmatchedCount_ != requests_.size()) {
+			cout << "Invalid number of unmatched requests" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	EventDispatcher *dispatcher_;
+
+	std::unique_ptr<CameraGroup> group_;
+	std::vector<std::unique_ptr<Request>> requests_;
+	ControlList controls_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+
+	unsigned int completeSetsCount_;
+	unsigned int unmatchedCount_;
+	unsigned int invalidSets_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraGroupTest)
@@ -165,6 +165,15 @@ protected:
 			return TestFail;
 		}
 
+		std::map<std::string, uint64_t> counters = camera_->counters();
+		if (counters["requests.completed"] != completeRequestsCount_ ||
+		    counters["requests.queued"] != counters["requests.completed"] +
+						   counters["requests.cancelled"] ||
+		    counters["requests.in_flight"] != 0) {
+			cout << "Invalid request counters" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
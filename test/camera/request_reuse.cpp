@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Request reuse memory allocation test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+static atomic<bool> countAllocations = false;
+static atomic<unsigned int> allocations = 0;
+
+void *operator new(size_t size)
+{
+	if (countAllocations.load(memory_order_relaxed))
+		allocations.fetch_add(1, memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] size_t size) noexcept
+{
+	free(ptr);
+}
+
+namespace {
+
+class RequestReuseTest : public CameraTest, public Test
+{
+public:
+	RequestReuseTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = make_unique<FrameBufferAllocator>(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		allocator_.reset();
+	}
+
+	/*
+	 * Populate the request the way an application and a pipeline handler
+	 * would for every frame, with controls and metadata of different
+	 * sizes, including values that don't fit inline in a ControlValue.
+	 */
+	void populate(Request *request, unsigned int frame)
+	{
+		const float ccm[9] = { 1.0f, 0.0f, 0.0f,
+				       0.0f, 1.0f, 0.0f,
+				       0.0f, 0.0f, 1.0f };
+
+		request->controls().set(controls::Brightness, 0.1f * (frame % 10));
+		request->controls().set(controls::Contrast, 1.0f);
+
+		ControlList &metadata = request->metadata();
+		metadata.set(controls::SensorTimestamp, static_cast<int64_t>(frame));
+		metadata.set(controls::ScalerCrop, Rectangle(0, 0, 640 + frame % 2, 480));
+		metadata.set(controls::ColourCorrectionMatrix, Span<const float, 9>(ccm));
+		metadata.set(controls::ColourGains, { 1.5f, 2.0f });
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<Request> request = camera_->createRequest();
+		if (!request) {
+			cout << "Failed to create request" << endl;
+			return TestFail;
+		}
+
+		FrameBuffer *buffer = allocator_->buffers(stream)[0].get();
+		if (request->addBuffer(stream, buffer)) {
+			cout << "Failed to associate buffer with request" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The first two iterations size the control lists, they are
+		 * allowed to allocate memory.
+		 */
+		for (unsigned int i = 0; i < 2; i++) {
+			request->reuse(Request::ReuseBuffers);
+			populate(request.get(), i);
+		}
+
+		countAllocations = true;
+
+		for (unsigned int i = 2; i < 100; i++) {
+			request->reuse(Request::ReuseBuffers);
+			populate(request.get(), i);
+		}
+
+		countAllocations = false;
+
+		if (allocations) {
+			cout << "Request reuse performed " << allocations
+			     << " allocations" << endl;
+			return TestFail;
+		}
+
+		if (request->buffers().size() != 1 ||
+		    request->metadata().size() != 4) {
+			cout << "Invalid request content after reuse" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestReuseTest)
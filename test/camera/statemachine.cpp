@@ -99,6 +99,9 @@ protected:
 		if (camera_->queueRequest(&request1) != -EACCES)
 			return TestFail;
 
+		if (camera_->flush() != -EACCES)
+			return TestFail;
+
 		/* Test operations which should pass. */
 		std::unique_ptr<Request> request2 = camera_->createRequest();
 		if (!request2)
@@ -156,6 +159,9 @@ protected:
 		if (camera_->queueRequest(request.get()))
 			return TestFail;
 
+		if (camera_->flush())
+			return TestFail;
+
 		/* Test valid state transitions, end in Available state. */
 		if (camera_->stop())
 			return TestFail;
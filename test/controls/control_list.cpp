@@ -20,6 +20,29 @@
 using namespace std;
 using namespace libcamera;
 
+class CountingValidator : public ControlValidator
+{
+public:
+	CountingValidator(const ControlValidator *validator)
+		: validator_(validator), count_(0)
+	{
+	}
+
+	const std::string &name() const override { return validator_->name(); }
+
+	bool validate(unsigned int id) const override
+	{
+		count_++;
+		return validator_->validate(id);
+	}
+
+	unsigned int count() const { return count_; }
+
+private:
+	const ControlValidator *validator_;
+	mutable unsigned int count_;
+};
+
 class ControlListTest : public CameraTest, public Test
 {
 public:
@@ -246,6 +269,55 @@ protected:
 			return TestFail;
 		}
 
+		/* Test that iteration visits the controls in ID order. */
+		unsigned int previousId = 0;
+		for (const auto &[id, value] : mergeList) {
+			if (id <= previousId) {
+				cout << "Controls not iterated in ID order" << endl;
+				return TestFail;
+			}
+
+			previousId = id;
+		}
+
+		/*
+		 * Test that controls are validated when added to the list
+		 * only, including when reusing the list after clearing it, until
+		 * the validator is invalidated.
+		 */
+		CountingValidator counter(&validator);
+		ControlList reuseList(controls::controls, &counter);
+
+		reuseList.set(controls::Brightness, 0.5f);
+		reuseList.set(controls::Brightness, 0.6f);
+		reuseList.clear();
+		reuseList.set(controls::Brightness, 0.7f);
+
+		if (counter.count() != 1) {
+			cout << "Control validated " << counter.count()
+			     << " times, expected 1" << endl;
+			return TestFail;
+		}
+
+		counter.invalidate();
+		reuseList.set(controls::Brightness, 0.8f);
+		reuseList.clear();
+		reuseList.set(controls::Brightness, 0.9f);
+		reuseList.set(controls::Brightness, 1.0f);
+
+		if (counter.count() != 3) {
+			cout << "Control validated " << counter.count()
+			     << " times after invalidation, expected 3" << endl;
+			return TestFail;
+		}
+
+		/* Unsupported controls must still be rejected. */
+		reuseList.set(controls::AeEnable, true);
+		if (reuseList.contains(controls::AeEnable.id())) {
+			cout << "List should not contain AeEnable control" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * ControlList per-frame operations benchmark
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static atomic<bool> countAllocations = false;
+static atomic<unsigned int> allocations = 0;
+
+void *operator new(size_t size)
+{
+	if (countAllocations.load(memory_order_relaxed))
+		allocations.fetch_add(1, memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] size_t size) noexcept
+{
+	free(ptr);
+}
+
+class ControlListBenchmark : public Test
+{
+protected:
+	/* Populate the list with the metadata typically reported per frame. */
+	static void setMetadata(ControlList &list, unsigned int frame)
+	{
+		const float gains[] = { 1.5f, 2.0f };
+		const float ccm[] = { 1.6f, -0.4f, -0.2f, -0.3f, 1.5f, -0.2f,
+				      -0.1f, -0.5f, 1.6f };
+		const int32_t blackLevels[] = { 4096, 4096, 4096, 4096 };
+
+		list.set(controls::SensorTimestamp, frame * 33333333LL);
+		list.set(controls::FrameDuration, 33333);
+		list.set(controls::ExposureTime, 10000);
+		list.set(controls::AnalogueGain, 2.0f);
+		list.set(controls::DigitalGain, 1.0f);
+		list.set(controls::ColourGains, gains);
+		list.set(controls::ColourTemperature, 5000);
+		list.set(controls::ColourCorrectionMatrix, ccm);
+		list.set(controls::SensorBlackLevels, blackLevels);
+		list.set(controls::ScalerCrop, Rectangle(0, 0, 1920, 1080));
+		list.set(controls::Lux, 400.0f);
+		list.set(controls::FocusFoM, 1000);
+	}
+
+	int run()
+	{
+		static constexpr unsigned int kFrames = 100000;
+
+		ControlList metadata(controls::controls);
+		ControlList pipelineMetadata(controls::controls);
+		ControlList copy(controls::controls);
+
+		/* Warm up the lists to reach steady state. */
+		setMetadata(pipelineMetadata, 0);
+		setMetadata(metadata, 0);
+		metadata.merge(pipelineMetadata, ControlList::MergePolicy::OverwriteExisting);
+		copy = metadata;
+
+		countAllocations = true;
+		auto start = chrono::steady_clock::now();
+
+		for (unsigned int frame = 1; frame < kFrames; frame++) {
+			/* Mimic a reused request going through a pipeline. */
+			metadata.clear();
+			setMetadata(pipelineMetadata, frame);
+			metadata.merge(pipelineMetadata,
+				       ControlList::MergePolicy::OverwriteExisting);
+			copy = metadata;
+		}
+
+		auto end = chrono::steady_clock::now();
+		countAllocations = false;
+
+		if (copy.size() != metadata.size() ||
+		    copy.get(controls::SensorTimestamp) !=
+		    (kFrames - 1) * 33333333LL) {
+			cout << "Invalid metadata after copy" << endl;
+			return TestFail;
+		}
+
+		const auto ccm = copy.get(controls::ColourCorrectionMatrix);
+		if (!ccm || (*ccm)[4] != 1.5f) {
+			cout << "Invalid colour correction matrix" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Clearing and repopulating lists, merging them and copying
+		 * them with the same controls shall reuse the existing storage.
+		 */
+		if (allocations) {
+			cout << allocations << " allocations for " << kFrames
+			     << " frames" << endl;
+			return TestFail;
+		}
+
+		double seconds = chrono::duration<double>(end - start).count();
+		cout << static_cast<unsigned int>(kFrames / seconds)
+		     << " frames/s (set, merge and copy of "
+		     << metadata.size() << " controls)" << endl;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlListBenchmark)
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * CpuConverter tests
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/converter/converter_cpu.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/shared_mem_object.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+class CpuConverterTest : public Test
+{
+protected:
+	/* A frame buffer backed by anonymous shared memory */
+	struct Buffer {
+		Buffer(const vector<unsigned int> &planeSizes)
+		{
+			unsigned int size = 0;
+			for (unsigned int planeSize : planeSizes)
+				size += planeSize;
+
+			mem = SharedMem("converter-test", size);
+
+			vector<FrameBuffer::Plane> planes;
+			unsigned int offset = 0;
+			for (unsigned int planeSize : planeSizes) {
+				planes.push_back({ mem.fd(), offset, planeSize });
+				offset += planeSize;
+			}
+
+			buffer = make_unique<FrameBuffer>(planes);
+		}
+
+		SharedMem mem;
+		unique_ptr<FrameBuffer> buffer;
+	};
+
+	int convert(CpuConverter &converter, FrameBuffer *input,
+		    const Converter::OutputBuffers &outputs)
+	{
+		completed_ = 0;
+		inputDone_ = false;
+
+		if (converter.start() < 0) {
+			cerr << "Failed to start converter" << endl;
+			return TestFail;
+		}
+
+		if (converter.queueBuffers(input, outputs) < 0) {
+			cerr << "Failed to queue buffers" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		timeout.start(1000ms);
+
+		while (timeout.isRunning() && !inputDone_)
+			dispatcher->processEvents();
+
+		converter.stop();
+
+		if (!inputDone_ || completed_ != outputs.size()) {
+			cerr << "Conversion didn't complete" << endl;
+			return TestFail;
+		}
+
+		for (auto [index, buffer] : outputs) {
+			if (buffer->metadata().status != FrameMetadata::FrameSuccess ||
+			    buffer->metadata().sequence != 42) {
+				cerr << "Invalid metadata for output " << index << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* Convert a uniform red YUYV frame to scaled NV12 and full size XRGB8888. */
+	int testUniform(CpuConverter &converter)
+	{
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = formats::YUYV;
+		inputCfg.size = { 64, 32 };
+		inputCfg.stride = 128;
+
+		StreamConfiguration nv12Cfg;
+		nv12Cfg.pixelFormat = formats::NV12;
+		nv12Cfg.size = { 32, 16 };
+
+		StreamConfiguration rgbCfg;
+		rgbCfg.pixelFormat = formats::XRGB8888;
+		rgbCfg.size = { 64, 32 };
+
+		if (converter.configure(inputCfg, { nv12Cfg, rgbCfg }) < 0) {
+			cerr << "Failed to configure converter" << endl;
+			return TestFail;
+		}
+
+		Buffer input({ 128 * 32 });
+		Buffer nv12({ 32 * 16, 32 * 8 });
+		Buffer rgb({ 256 * 32 });
+
+		/* BT.601 limited range red. */
+		Span<uint8_t> src = input.mem.mem();
+		for (unsigned int i = 0; i < src.size(); i += 4) {
+			src[i] = 81;
+			src[i + 1] = 90;
+			src[i + 2] = 81;
+			src[i + 3] = 240;
+		}
+
+		input.buffer->_d()->metadata().status = FrameMetadata::FrameSuccess;
+		input.buffer->_d()->metadata().sequence = 42;
+
+		int ret = convert(converter, input.buffer.get(),
+				  { { 0, nv12.buffer.get() }, { 1, rgb.buffer.get() } });
+		if (ret != TestPass)
+			return ret;
+
+		Span<uint8_t> dst = nv12.mem.mem();
+		for (unsigned int i = 0; i < dst.size(); i++) {
+			uint8_t expected = i < 32 * 16 ? 81 : i % 2 ? 240 : 90;
+			if (dst[i] != expected) {
+				cerr << "Invalid NV12 value " << static_cast<unsigned int>(dst[i])
+				     << " at offset " << i << endl;
+				return TestFail;
+			}
+		}
+
+		dst = rgb.mem.mem();
+		for (unsigned int i = 0; i < dst.size(); i += 4) {
+			if (dst[i] != 0 || dst[i + 1] != 0 || dst[i + 2] != 255 ||
+			    dst[i + 3] != 255) {
+				cerr << "Invalid XRGB8888 value at offset " << i << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* Downscale a NV12 horizontal luma gradient to UYVY. */
+	int testScaling(CpuConverter &converter)
+	{
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = formats::NV12;
+		inputCfg.size = { 128, 64 };
+		inputCfg.stride = 128;
+
+		StreamConfiguration outputCfg;
+		outputCfg.pixelFormat = formats::UYVY;
+		outputCfg.size = { 64, 32 };
+
+		if (converter.configure(inputCfg, { outputCfg }) < 0) {
+			cerr << "Failed to configure converter" << endl;
+			return TestFail;
+		}
+
+		Buffer input({ 128 * 64, 128 * 32 });
+		Buffer output({ 128 * 32 });
+
+		Span<uint8_t> src = input.mem.mem();
+		for (unsigned int y = 0; y < 64; y++) {
+			for (unsigned int x = 0; x < 128; x++)
+				src[y * 128 + x] = x * 2;
+		}
+		for (unsigned int i = 128 * 64; i < src.size(); i++)
+			src[i] = 128;
+
+		input.buffer->_d()->metadata().status = FrameMetadata::FrameSuccess;
+		input.buffer->_d()->metadata().sequence = 42;
+
+		int ret = convert(converter, input.buffer.get(),
+				  { { 0, output.buffer.get() } });
+		if (ret != TestPass)
+			return ret;
+
+		/* Each output pixel averages two input pixels. */
+		Span<uint8_t> dst = output.mem.mem();
+		for (unsigned int y = 0; y < 32; y++) {
+			for (unsigned int x = 0; x < 64; x++) {
+				const uint8_t *pixel = &dst[y * 128 + x * 2];
+				if (pixel[0] != 128 || pixel[1] != x * 4 + 1) {
+					cerr << "Invalid UYVY value at " << x << "," << y
+					     << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		CpuConverter converter;
+
+		converter.outputBufferReady.connect(this, [&](FrameBuffer *) { completed_++; });
+		converter.inputBufferReady.connect(this, [&](FrameBuffer *) { inputDone_ = true; });
+
+		if (converter.formats(formats::SBGGR8).size() ||
+		    converter.formats(formats::YUYV).empty()) {
+			cerr << "Invalid output formats" << endl;
+			return TestFail;
+		}
+
+		int ret = testUniform(converter);
+		if (ret != TestPass)
+			return ret;
+
+		return testScaling(converter);
+	}
+
+private:
+	unsigned int completed_;
+	bool inputDone_;
+};
+
+TEST_REGISTER(CpuConverterTest)
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * FlatMap tests
+ */
+
+#include <iostream>
+#include <map>
+
+#include <libcamera/base/flat_map.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class FlatMapTest : public Test
+{
+protected:
+	using Map = FlatMap<unsigned int, int, 3>;
+
+	/* Compare the FlatMap with a std::map reference. */
+	bool equal(const Map &map, const std::map<unsigned int, int> &ref)
+	{
+		if (map.size() != ref.size() || map.empty() != ref.empty())
+			return false;
+
+		auto it = ref.begin();
+		for (const auto &[key, value] : map) {
+			if (key != it->first || value != it->second)
+				return false;
+			++it;
+		}
+
+		return true;
+	}
+
+	int run() override
+	{
+		Map map;
+		std::map<unsigned int, int> ref;
+
+		if (!map.empty() || map.begin() != map.end()) {
+			cerr << "Default-constructed map isn't empty" << endl;
+			return TestFail;
+		}
+
+		/* Insert in reverse order to test sorting and grow past N. */
+		for (unsigned int i = 6; i > 0; i--) {
+			auto [it, inserted] = map.emplace(i, i * 10);
+			ref.emplace(i, i * 10);
+
+			if (!inserted || it->first != i || !equal(map, ref)) {
+				cerr << "Failed to insert key " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (map.insert({ 3, 0 }).second || map.at(3) != 30) {
+			cerr << "Duplicated key has been inserted" << endl;
+			return TestFail;
+		}
+
+		if (map.count(4) != 1 || map.count(7) != 0 ||
+		    map.find(7) != map.end() || map.find(5)->second != 50) {
+			cerr << "Lookup failed" << endl;
+			return TestFail;
+		}
+
+		map[7] = 70;
+		ref[7] = 70;
+		map[1] = 11;
+		ref[1] = 11;
+
+		if (!equal(map, ref)) {
+			cerr << "operator[] failed" << endl;
+			return TestFail;
+		}
+
+		if (map.erase(2) != 1 || map.erase(2) != 0) {
+			cerr << "Failed to erase key" << endl;
+			return TestFail;
+		}
+		ref.erase(2);
+
+		auto next = map.erase(map.find(5));
+		ref.erase(5);
+
+		if (next->first != 6 || !equal(map, ref)) {
+			cerr << "Failed to erase iterator" << endl;
+			return TestFail;
+		}
+
+		map.clear();
+		ref.clear();
+
+		if (!equal(map, ref)) {
+			cerr << "Failed to clear map" << endl;
+			return TestFail;
+		}
+
+		/* Test the inline storage path after clearing. */
+		Map small = { { 2, 20 }, { 1, 10 }, { 2, 30 } };
+		ref = { { 2, 20 }, { 1, 10 } };
+
+		if (!equal(small, ref)) {
+			cerr << "Initializer list construction failed" << endl;
+			return TestFail;
+		}
+
+		small.erase(small.begin());
+		ref.erase(ref.begin());
+
+		const Map copy = small;
+		if (!equal(copy, ref) || copy.at(2) != 20) {
+			cerr << "Copy failed" << endl;
+			return TestFail;
+		}
+
+		try {
+			copy.at(1);
+			cerr << "Lookup of missing key didn't throw" << endl;
+			return TestFail;
+		} catch (const std::out_of_range &) {
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(FlatMapTest)
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * FrameInfoRing tests
+ */
+
+#include <iostream>
+
+#include "libcamera/internal/frame_info_ring.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class FrameInfoRingTest : public Test
+{
+protected:
+	struct Info {
+		unsigned int frame;
+		unsigned int resource;
+	};
+
+	int run()
+	{
+		static constexpr unsigned int kSize = 4;
+
+		FrameInfoRing<Info> ring;
+		ring.resize(kSize);
+
+		if (ring.size() != kSize) {
+			cout << "Invalid ring size " << ring.size() << endl;
+			return TestFail;
+		}
+
+		/* Bind a resource to each slot. */
+		for (unsigned int i = 0; i < kSize; i++)
+			ring[i].resource = 100 + i;
+
+		/* Allocate frames in sequence, they shall use their own slot. */
+		for (unsigned int frame = 0; frame < kSize; frame++) {
+			Info *info = ring.alloc(frame);
+			if (!info || info->resource != 100 + frame) {
+				cout << "Failed to allocate frame " << frame << endl;
+				return TestFail;
+			}
+
+			info->frame = frame;
+		}
+
+		if (ring.alloc(kSize)) {
+			cout << "Allocation succeeded with all slots in use" << endl;
+			return TestFail;
+		}
+
+		/* Release frame 1 and allocate a frame from a gap in the sequence. */
+		Info *info = ring.find(1);
+		if (!info || info->frame != 1) {
+			cout << "Failed to find frame 1" << endl;
+			return TestFail;
+		}
+
+		ring.release(info);
+
+		if (ring.find(1)) {
+			cout << "Released frame still found" << endl;
+			return TestFail;
+		}
+
+		info = ring.alloc(10);
+		if (!info || info->resource != 101) {
+			cout << "Failed to allocate frame 10 in a free slot" << endl;
+			return TestFail;
+		}
+
+		info->frame = 10;
+
+		if (ring.find(10) != info) {
+			cout << "Failed to find frame 10" << endl;
+			return TestFail;
+		}
+
+		info = ring.findIf([](const Info &i) { return i.resource == 103; });
+		if (!info || info->frame != 3) {
+			cout << "Failed to find frame by predicate" << endl;
+			return TestFail;
+		}
+
+		/* Release all slots, the bound resources shall be preserved. */
+		ring.clear();
+
+		if (ring.find(0) || ring.find(10)) {
+			cout << "Frames found after clear" << endl;
+			return TestFail;
+		}
+
+		info = ring.alloc(6);
+		if (!info || info->resource != 102) {
+			cout << "Failed to allocate frame after clear" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(FrameInfoRingTest)
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Exposure mode helper test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "libipa/exposure_mode_helper.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace std::literals::chrono_literals;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class ExposureModeHelperTest : public Test
+{
+protected:
+	struct Split {
+		utils::Duration exposure;
+		utils::Duration shutter;
+		double gain;
+		double digitalGain;
+	};
+
+	int check(const ExposureModeHelper &helper, const vector<Split> &splits)
+	{
+		for (const Split &split : splits) {
+			auto [shutter, gain, digitalGain] =
+				helper.splitExposure(split.exposure);
+
+			double delta = shutter.get<std::micro>() -
+				       split.shutter.get<std::micro>();
+
+			if (std::abs(delta) > 0.01 ||
+			    std::abs(gain - split.gain) > 1e-6 ||
+			    std::abs(digitalGain - split.digitalGain) > 1e-6) {
+				cerr << "Invalid split of " << split.exposure
+				     << ": " << shutter << ", " << gain << ", "
+				     << digitalGain << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		vector<pair<utils::Duration, double>> stages = {
+			{ 10ms, 2.0 },
+			{ 30ms, 4.0 },
+		};
+
+		ExposureModeHelper helper(stages);
+		helper.setLimits(100us, 33ms, 1.0, 8.0);
+
+		/*
+		 * Ramp up the shutter time and gain of each stage in turn, and
+		 * max out the shutter time, analogue gain and digital gain when
+		 * the stages are exhausted.
+		 */
+		vector<Split> splits = {
+			{ 5ms, 5ms, 1.0, 1.0 },
+			{ 15ms, 7.5ms, 2.0, 1.0 },
+			{ 30ms, 15ms, 2.0, 1.0 },
+			{ 100ms, 25ms, 4.0, 1.0 },
+			{ 400ms, 33ms, 8.0, 400.0 / (33.0 * 8.0) },
+		};
+
+		if (check(helper, splits) != TestPass)
+			return TestFail;
+
+		/* Lower the maximum gain, the last stage must be skipped. */
+		helper.setLimits(100us, 33ms, 1.0, 2.0);
+
+		splits = {
+			{ 15ms, 7.5ms, 2.0, 1.0 },
+			{ 100ms, 33ms, 2.0, 100.0 / (33.0 * 2.0) },
+		};
+
+		if (check(helper, splits) != TestPass)
+			return TestFail;
+
+		/* Without stages, the shutter time is maxed out first. */
+		ExposureModeHelper linear({});
+		linear.setLimits(100us, 33ms, 1.0, 8.0);
+
+		splits = {
+			{ 20ms, 20ms, 1.0, 1.0 },
+			{ 66ms, 33ms, 2.0, 1.0 },
+		};
+
+		if (check(linear, splits) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ExposureModeHelperTest)
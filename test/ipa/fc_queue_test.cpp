@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Frame context queue test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <thread>
+
+#include "libipa/fc_queue.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+namespace {
+
+struct TestFrameContext : public FrameContext {
+	uint32_t value;
+	unsigned int state;
+};
+
+} /* namespace */
+
+class FCQueueTest : public Test
+{
+protected:
+	int testExclusiveAccess()
+	{
+		FCQueue<TestFrameContext> queue(4);
+
+		/* Contexts can't be acquired before being allocated. */
+		if (queue.acquire(1)) {
+			cerr << "Acquired an unallocated context" << endl;
+			return TestFail;
+		}
+
+		TestFrameContext &context = queue.alloc(1);
+		context.value = 1;
+
+		TestFrameContext *acquired = queue.acquire(1);
+		if (acquired != &context) {
+			cerr << "Failed to acquire an allocated context" << endl;
+			return TestFail;
+		}
+
+		/* A context can only be acquired by one stage at a time. */
+		if (queue.acquire(1)) {
+			cerr << "Context acquired twice" << endl;
+			return TestFail;
+		}
+
+		/* The slot of an acquired context can't be reallocated. */
+		if (queue.isAvailable(5)) {
+			cerr << "Acquired slot reported as available" << endl;
+			return TestFail;
+		}
+
+		if (!queue.isAvailable(2)) {
+			cerr << "Free slot reported as unavailable" << endl;
+			return TestFail;
+		}
+
+		queue.release(1);
+
+		if (!queue.isAvailable(5)) {
+			cerr << "Released slot reported as unavailable" << endl;
+			return TestFail;
+		}
+
+		acquired = queue.acquire(1);
+		if (!acquired || acquired->value != 1) {
+			cerr << "Failed to acquire a released context" << endl;
+			return TestFail;
+		}
+
+		queue.release(1);
+
+		/* Overwritten contexts can't be acquired anymore. */
+		queue.alloc(5);
+		if (queue.acquire(1)) {
+			cerr << "Acquired an overwritten context" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testHandOff()
+	{
+		static constexpr uint32_t kFrames = 10000;
+		static constexpr unsigned int kQueueSize = 4;
+
+		FCQueue<TestFrameContext> queue(kQueueSize);
+		unsigned int errors = 0;
+
+		/*
+		 * Wait until the context for the frame can be acquired in the
+		 * expected state. The context is released if it's in a
+		 * different state, to let the other stages progress.
+		 */
+		auto acquire = [&](uint32_t frame, unsigned int state) {
+			while (true) {
+				TestFrameContext *context = queue.acquire(frame);
+				if (context && context->state == state)
+					return context;
+
+				if (context)
+					queue.release(frame);
+
+				this_thread::yield();
+			}
+		};
+
+		/*
+		 * Allocate the contexts in this thread, fill them in a first
+		 * stage thread and check them in a second stage thread. The
+		 * contexts are handed over between the stages through the
+		 * queue only, without any other synchronization.
+		 */
+		thread producer([&]() {
+			for (uint32_t frame = 1; frame <= kFrames; ++frame) {
+				TestFrameContext *context = acquire(frame, 0);
+				context->value = frame * 3;
+				context->state = 1;
+				queue.release(frame);
+			}
+		});
+
+		thread consumer([&]() {
+			for (uint32_t frame = 1; frame <= kFrames; ++frame) {
+				TestFrameContext *context = acquire(frame, 1);
+				if (context->value != frame * 3)
+					errors++;
+				context->state = 2;
+				queue.release(frame);
+			}
+		});
+
+		for (uint32_t frame = 1; frame <= kFrames; ++frame) {
+			/* Wait for the previous frame using the slot to complete. */
+			if (frame > kQueueSize) {
+				acquire(frame - kQueueSize, 2);
+				queue.release(frame - kQueueSize);
+			}
+
+			queue.alloc(frame);
+		}
+
+		producer.join();
+		consumer.join();
+
+		if (errors) {
+			cerr << "Frame contexts corrupted during hand-off" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (testExclusiveAccess() != TestPass)
+			return TestFail;
+
+		if (testHandOff() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(FCQueueTest)
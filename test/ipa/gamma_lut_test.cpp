@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Gamma lookup table generation test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "libipa/gamma_lut.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class GammaLutTest : public Test
+{
+protected:
+	int run()
+	{
+		std::vector<double> samples(256);
+		for (unsigned int i = 0; i < samples.size(); i++)
+			samples[i] = i / 255.0;
+
+		GammaLut gamma(samples, 8191);
+
+		/* Check the table contents. */
+		Span<const uint16_t> lut = gamma.get(2.2);
+		if (lut.size() != samples.size()) {
+			cerr << "Invalid table size " << lut.size() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < samples.size(); i++) {
+			uint16_t expected = std::pow(samples[i], 1.0 / 2.2) * 8191;
+			if (lut[i] != expected) {
+				cerr << "Invalid entry " << i << ": " << lut[i]
+				     << ", expected " << expected << endl;
+				return TestFail;
+			}
+		}
+
+		if (lut[0] != 0 || lut[255] != 8191) {
+			cerr << "Invalid table bounds" << endl;
+			return TestFail;
+		}
+
+		/* Tables are cached per gamma value. */
+		const uint16_t *data = lut.data();
+		if (gamma.get(1.0).data() == data || gamma.get(2.2).data() != data) {
+			cerr << "Table not cached" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The least recently used table is replaced when the cache is
+		 * full, 2.2 has been used more recently than 1.0.
+		 */
+		gamma.get(1.5);
+		gamma.get(1.8);
+		gamma.get(2.0);
+		if (gamma.get(2.2).data() != data) {
+			cerr << "Recently used table evicted" << endl;
+			return TestFail;
+		}
+
+		if (gamma.get(1.0)[128] != static_cast<uint16_t>(128 / 255.0 * 8191)) {
+			cerr << "Evicted table not regenerated" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(GammaLutTest)
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Histogram test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "libipa/histogram.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class HistogramTest : public Test
+{
+protected:
+	int run()
+	{
+		/* Bins in 28.4 fixed-point format, as reported by the RkISP1. */
+		vector<uint32_t> bins(32);
+		for (unsigned int i = 0; i < bins.size(); i++)
+			bins[i] = ((i * 7) % 13 + 1) << 4 | (i & 0xf);
+
+		Histogram reference(bins, [](uint32_t x) { return x >> 4; });
+
+		Histogram hist;
+		hist.setData(bins, 4);
+
+		if (hist.bins() != reference.bins() ||
+		    hist.total() != reference.total()) {
+			cerr << "Fixed-point histogram mismatch" << endl;
+			return TestFail;
+		}
+
+		for (double q : { 0.0, 0.1, 0.5, 0.9, 1.0 }) {
+			if (hist.quantile(q) != reference.quantile(q)) {
+				cerr << "Quantile " << q << " mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Cached queries must return the same results. */
+		double mean = hist.interQuantileMean(0.2, 0.8);
+		double median = hist.quantile(0.5);
+		if (hist.interQuantileMean(0.2, 0.8) != mean ||
+		    hist.quantile(0.5) != median ||
+		    mean != reference.interQuantileMean(0.2, 0.8)) {
+			cerr << "Cached query mismatch" << endl;
+			return TestFail;
+		}
+
+		/* Replacing the data must invalidate the cached queries. */
+		vector<uint32_t> flat(16, 10);
+		hist.setData(flat);
+
+		if (hist.bins() != 16 || hist.total() != 160) {
+			cerr << "Histogram data not replaced" << endl;
+			return TestFail;
+		}
+
+		Histogram fresh(flat);
+		if (hist.quantile(0.5) != fresh.quantile(0.5) ||
+		    hist.interQuantileMean(0.2, 0.8) != fresh.interQuantileMean(0.2, 0.8)) {
+			cerr << "Stale cached query after replacing data" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(HistogramTest)
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * ISP parameter blocks tracking test
+ */
+
+#include <iostream>
+#include <stdint.h>
+
+#include "libipa/params_tracker.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+struct Block {
+	uint16_t coeffs[9];
+	uint16_t offsets[3];
+};
+
+class ParamsTrackerTest : public Test
+{
+protected:
+	int run()
+	{
+		ParamsTracker tracker;
+		Block a = { { 1, 2, 3, 4, 5, 6, 7, 8, 9 }, { 0, 0, 0 } };
+		Block b = a;
+
+		/* Blocks are always updated the first time. */
+		tracker.startFrame();
+		if (!tracker.update(0, a) || !tracker.update(1, b) ||
+		    tracker.frameUpdates() != 2) {
+			cerr << "New blocks not updated" << endl;
+			return TestFail;
+		}
+
+		/* Unchanged blocks are skipped, blocks are tracked by ID. */
+		tracker.startFrame();
+		b.offsets[1] = 16;
+		if (tracker.update(0, a) || !tracker.update(1, b) ||
+		    tracker.frameUpdates() != 1) {
+			cerr << "Block changes not tracked" << endl;
+			return TestFail;
+		}
+
+		tracker.startFrame();
+		if (tracker.update(0, a) || tracker.update(1, b) ||
+		    tracker.frameUpdates() != 0) {
+			cerr << "Unchanged blocks updated" << endl;
+			return TestFail;
+		}
+
+		/* Resetting the tracker forces all blocks to be updated. */
+		tracker.reset();
+		tracker.startFrame();
+		if (!tracker.update(0, a) || !tracker.update(1, b)) {
+			cerr << "Blocks not updated after reset" << endl;
+			return TestFail;
+		}
+
+		const ParamsTracker::Statistics &stats = tracker.statistics();
+		if (stats.frames != 4 || stats.updated != 5 || stats.skipped != 3) {
+			cerr << "Invalid statistics: " << stats.frames << " frames, "
+			     << stats.updated << " updated, " << stats.skipped
+			     << " skipped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ParamsTrackerTest)
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Persistent algorithm state test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include <libcamera/base/file.h>
+
+#include "libipa/persistent_state.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class PersistentStateTest : public Test
+{
+protected:
+	int init()
+	{
+		char dir[] = "/tmp/libcamera.test.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+		path_ = dir_ + "/test-sensor_name.state";
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		PersistentState state;
+
+		/* Persistence is disabled when the variable isn't set. */
+		unsetenv("LIBCAMERA_IPA_STATE_DIR");
+		if (state.init("test-sensor name") != -ENOENT || state.isEnabled()) {
+			cerr << "Persistence enabled without a state directory" << endl;
+			return TestFail;
+		}
+
+		setenv("LIBCAMERA_IPA_STATE_DIR", dir_.c_str(), 1);
+		if (state.init("test-sensor name") || !state.isEnabled()) {
+			cerr << "Failed to enable persistence" << endl;
+			return TestFail;
+		}
+
+		/* Loading a missing state fails and leaves the state empty. */
+		if (!state.load() || state.get("agc.gain")) {
+			cerr << "Missing state loaded" << endl;
+			return TestFail;
+		}
+
+		state.set("agc.exposure_time", 33333.3333333);
+		state.set("agc.gain", 2.5);
+		state.set("awb.colour_temperature", 5000);
+
+		if (state.store()) {
+			cerr << "Failed to store state" << endl;
+			return TestFail;
+		}
+
+		if (!File::exists(path_)) {
+			cerr << "State file not created" << endl;
+			return TestFail;
+		}
+
+		/* Values shall be restored exactly. */
+		PersistentState loaded;
+		if (loaded.init("test-sensor name") || loaded.load()) {
+			cerr << "Failed to load state" << endl;
+			return TestFail;
+		}
+
+		if (loaded.get("agc.exposure_time") != 33333.3333333 ||
+		    loaded.get("agc.gain") != 2.5 ||
+		    loaded.get("awb.colour_temperature") != 5000 ||
+		    loaded.get("awb.red_gain")) {
+			cerr << "Invalid state values" << endl;
+			return TestFail;
+		}
+
+		/* Malformed lines shall be ignored. */
+		File file(path_);
+		if (!file.open(File::OpenModeFlag::WriteOnly)) {
+			cerr << "Failed to open state file" << endl;
+			return TestFail;
+		}
+
+		const string contents = "agc.gain 1.5\ninvalid\nawb.red_gain abc\n"
+					" 2.0\nagc.exposure_time 1000\n";
+		file.write({ reinterpret_cast<const uint8_t *>(contents.data()),
+			     contents.size() });
+		file.close();
+
+		if (loaded.load() || loaded.get("agc.gain") != 1.5 ||
+		    loaded.get("agc.exposure_time") != 1000 ||
+		    loaded.get("awb.red_gain") ||
+		    loaded.get("awb.colour_temperature")) {
+			cerr << "Malformed state file not handled correctly" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink(path_.c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string dir_;
+	string path_;
+};
+
+TEST_REGISTER(PersistentStateTest)
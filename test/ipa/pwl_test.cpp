@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Piecewise linear function evaluation test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "libipa/pwl.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class PwlTest : public Test
+{
+protected:
+	int run()
+	{
+		/* A gamma curve with 17 knots, as used for ISP gamma LUTs. */
+		Pwl gamma;
+		for (unsigned int i = 0; i <= 16; i++) {
+			double x = i * 4096.0;
+			gamma.append(x, pow(x / 65536.0, 1 / 2.2) * 65535.0);
+		}
+
+		vector<double> x(1024);
+		for (unsigned int i = 0; i < x.size(); i++)
+			x[i] = i * 64.0;
+
+		/* The batch evaluation must match the scalar evaluation. */
+		vector<double> y(x.size());
+		gamma.eval(x, y);
+
+		for (unsigned int i = 0; i < x.size(); i++) {
+			if (y[i] != gamma.eval(x[i])) {
+				cerr << "Batch evaluation mismatch at " << x[i]
+				     << ": " << y[i] << " != " << gamma.eval(x[i])
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * The baked function is an approximation, check that it stays
+		 * close to the function, and exact on the knots that fall on
+		 * its samples.
+		 */
+		Pwl::Lut lut = gamma.bake(1025);
+		if (lut.size() != 1025) {
+			cerr << "Invalid Lut size " << lut.size() << endl;
+			return TestFail;
+		}
+
+		vector<double> baked(x.size());
+		lut.eval(x, baked);
+
+		for (unsigned int i = 0; i < x.size(); i++) {
+			if (fabs(baked[i] - y[i]) > 0.5) {
+				cerr << "Baked evaluation error at " << x[i]
+				     << ": " << baked[i] << " != " << y[i] << endl;
+				return TestFail;
+			}
+		}
+
+		if (fabs(lut.eval(4096.0) - gamma.eval(4096.0)) > 1e-6) {
+			cerr << "Baked evaluation not exact on a knot" << endl;
+			return TestFail;
+		}
+
+		/* The baked function is clamped outside of the domain. */
+		if (lut.eval(-100.0) != lut.eval(0.0) ||
+		    fabs(lut.eval(1e6) - gamma.eval(65536.0)) > 1e-6) {
+			cerr << "Baked evaluation not clamped" << endl;
+			return TestFail;
+		}
+
+		/* Functions with a single point bake to a constant. */
+		Pwl constant({ Pwl::Point({ 1.0, 3.0 }) });
+		lut = constant.bake(16);
+		if (lut.eval(0.0) != 3.0 || lut.eval(2.0) != 3.0) {
+			cerr << "Single point function not constant" << endl;
+			return TestFail;
+		}
+
+		if (!Pwl().bake(16).empty()) {
+			cerr << "Empty function baked to a non-empty Lut" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(PwlTest)
@@ -0,0 +1,385 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * RkISP1 IPA algorithms benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <linux/rkisp1-config.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/isp_recorder.h"
+#include "libcamera/internal/yaml_parser.h"
+
+#include "algorithms/algorithm.h"
+#include "ipa_context.h"
+#include "module.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace std::literals::chrono_literals;
+using namespace libcamera;
+using namespace ipa::rkisp1;
+
+namespace {
+
+class BenchmarkModule : public Module
+{
+protected:
+	std::string logPrefix() const override
+	{
+		return "rkisp1";
+	}
+};
+
+const IPAHwSettings kHwSettings{
+	RKISP1_CIF_ISP_AE_MEAN_MAX_V12,
+	RKISP1_CIF_ISP_HIST_BIN_N_MAX_V12,
+	RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V12,
+	RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V12,
+};
+
+} /* namespace */
+
+/*
+ * Run the RkISP1 algorithms instantiated from a tuning file over a sequence of
+ * statistics buffers, and report the time spent by each algorithm per frame.
+ * This allows comparing algorithm changes without hardware.
+ *
+ * The tuning file defaults to the IMX219 one from the source tree, and can be
+ * overridden with the RKISP1_BENCHMARK_TUNING_FILE environment variable. The
+ * statistics are synthesized to cover several scene brightness and colour
+ * changes, unless RKISP1_BENCHMARK_STATS_FILE points to a recording produced
+ * by the pipeline handler with LIBCAMERA_ISP_RECORD, or to a file containing
+ * rkisp1_stat_buffer structures back to back, as captured from the statistics
+ * video node, for instance with v4l2-ctl --stream-to. The recorded statistics
+ * are replayed in a loop.
+ */
+class RkISP1AlgorithmsBenchmark : public Test
+{
+protected:
+	static constexpr unsigned int kFrames = 1000;
+	static constexpr uint32_t kMaxFrameContexts = 16;
+
+	RkISP1AlgorithmsBenchmark()
+		: context_({ &kHwSettings, {}, {}, { kMaxFrameContexts }, {} })
+	{
+	}
+
+	int init()
+	{
+		string tuningFile;
+
+		const char *path = utils::secure_getenv("RKISP1_BENCHMARK_TUNING_FILE");
+		if (path) {
+			tuningFile = path;
+		} else {
+			string root = utils::libcameraSourcePath();
+			if (root.empty()) {
+				cout << "Tuning files are only available in the source tree" << endl;
+				return TestSkip;
+			}
+
+			tuningFile = root + "src/ipa/rkisp1/data/imx219.yaml";
+		}
+
+		File file(tuningFile);
+		if (!file.open(File::OpenModeFlag::ReadOnly)) {
+			cerr << "Failed to open tuning file " << tuningFile << endl;
+			return TestFail;
+		}
+
+		unique_ptr<YamlObject> tuning = YamlParser::parse(file);
+		if (!tuning || !tuning->contains("algorithms")) {
+			cerr << "Failed to parse tuning file" << endl;
+			return TestFail;
+		}
+
+		const YamlObject &algorithms = (*tuning)["algorithms"];
+		if (module_.createAlgorithms(context_, algorithms)) {
+			cerr << "Failed to create algorithms" << endl;
+			return TestFail;
+		}
+
+		/* The algorithms are instantiated in the tuning file order. */
+		for (const YamlObject &algo : algorithms.asList())
+			names_.push_back(algo.asDict().begin()->first);
+
+		if (configure())
+			return TestFail;
+
+		path = utils::secure_getenv("RKISP1_BENCHMARK_STATS_FILE");
+		if (path)
+			return loadStatistics(path);
+
+		synthesizeStatistics();
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const auto &algorithms = module_.algorithms();
+
+		struct Timing {
+			chrono::duration<double, micro> queueRequest{};
+			chrono::duration<double, micro> prepare{};
+			chrono::duration<double, micro> process{};
+		};
+
+		vector<Timing> timings(algorithms.size());
+		const ControlList controls(controls::controls);
+		rkisp1_params_cfg params;
+
+		for (unsigned int frame = 0; frame < kFrames; frame++) {
+			IPAFrameContext &frameContext = context_.frameContexts.alloc(frame);
+			const rkisp1_stat_buffer *stats = &stats_[frame % stats_.size()];
+			ControlList metadata(controls::controls);
+			unsigned int index;
+
+			index = 0;
+			for (auto const &algo : algorithms) {
+				auto start = chrono::steady_clock::now();
+				algo->queueRequest(context_, frame, frameContext, controls);
+				timings[index++].queueRequest += chrono::steady_clock::now() - start;
+			}
+
+			memset(&params, 0, sizeof(params));
+
+			index = 0;
+			for (auto const &algo : algorithms) {
+				auto start = chrono::steady_clock::now();
+				algo->prepare(context_, frame, frameContext, &params);
+				timings[index++].prepare += chrono::steady_clock::now() - start;
+			}
+
+			/* Assume the sensor applies the AGC output immediately. */
+			frameContext.sensor.exposure = frameContext.agc.exposure;
+			frameContext.sensor.gain = frameContext.agc.gain;
+
+			index = 0;
+			for (auto const &algo : algorithms) {
+				auto start = chrono::steady_clock::now();
+				algo->process(context_, frame, frameContext, stats, metadata);
+				timings[index++].process += chrono::steady_clock::now() - start;
+			}
+		}
+
+		cout << kFrames << " frames, " << stats_.size()
+		     << " statistics buffers, time per frame in us" << endl;
+
+		cout << "  " << left << setw(24) << "algorithm" << right
+		     << setw(14) << "queueRequest" << setw(10) << "prepare"
+		     << setw(10) << "process" << setw(10) << "total" << endl;
+
+		Timing total;
+
+		for (unsigned int i = 0; i < timings.size(); i++) {
+			const Timing &timing = timings[i];
+
+			printTiming(names_[i], timing.queueRequest, timing.prepare,
+				    timing.process);
+
+			total.queueRequest += timing.queueRequest;
+			total.prepare += timing.prepare;
+			total.process += timing.process;
+		}
+
+		printTiming("total", total.queueRequest, total.prepare, total.process);
+
+		return TestPass;
+	}
+
+private:
+	int configure()
+	{
+		/* Mimic an IMX219 in its 1080p mode. */
+		IPACameraSensorInfo sensorInfo{};
+		sensorInfo.model = "imx219";
+		sensorInfo.bitsPerPixel = 10;
+		sensorInfo.activeAreaSize = { 3280, 2464 };
+		sensorInfo.analogCrop = { 680, 692, 1920, 1080 };
+		sensorInfo.outputSize = { 1920, 1080 };
+		sensorInfo.pixelRate = 182400000;
+		sensorInfo.minLineLength = 3448;
+		sensorInfo.maxLineLength = 32767;
+		sensorInfo.minFrameLength = 1763;
+		sensorInfo.maxFrameLength = 65535;
+
+		IPASessionConfiguration &config = context_.configuration;
+
+		config.sensor.lineDuration = sensorInfo.minLineLength * 1.0s
+					   / sensorInfo.pixelRate;
+		config.sensor.defVBlank = sensorInfo.minFrameLength
+					- sensorInfo.outputSize.height;
+		config.sensor.size = sensorInfo.outputSize;
+		config.sensor.minShutterSpeed = 4 * config.sensor.lineDuration;
+		config.sensor.maxShutterSpeed = (sensorInfo.minFrameLength - 4)
+					      * config.sensor.lineDuration;
+		config.sensor.minAnalogueGain = 1.0;
+		config.sensor.maxAnalogueGain = 10.66;
+
+		for (auto const &a : module_.algorithms()) {
+			Algorithm *algo = static_cast<Algorithm *>(a.get());
+
+			int ret = algo->configure(context_, sensorInfo);
+			if (ret) {
+				cerr << "Failed to configure algorithms" << endl;
+				return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	int loadStatistics(const char *path)
+	{
+		IspRecordingReader reader;
+		if (!reader.open(path))
+			return loadRecording(reader, path);
+
+		ifstream file(path, ios::binary);
+		if (!file) {
+			cerr << "Failed to open statistics file " << path << endl;
+			return TestFail;
+		}
+
+		rkisp1_stat_buffer stats;
+		while (file.read(reinterpret_cast<char *>(&stats), sizeof(stats)))
+			stats_.push_back(stats);
+
+		if (stats_.empty() || file.gcount()) {
+			cerr << "Invalid statistics file " << path << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int loadRecording(IspRecordingReader &reader, const char *path)
+	{
+		IspRecordingReader::Record record;
+		int ret;
+
+		while (!(ret = reader.read(&record))) {
+			if (record.type != IspRecordingReader::RecordType::Statistics)
+				continue;
+
+			if (record.data.size() != sizeof(rkisp1_stat_buffer)) {
+				cerr << "Invalid statistics record size "
+				     << record.data.size() << endl;
+				return TestFail;
+			}
+
+			rkisp1_stat_buffer &stats = stats_.emplace_back();
+			memcpy(&stats, record.data.data(), sizeof(stats));
+		}
+
+		if (ret != -ENODATA || stats_.empty()) {
+			cerr << "Invalid recording " << path << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	/*
+	 * Generate statistics for a sequence of scenes of different brightness
+	 * and colour temperatures, each lasting for a few frames, to keep the
+	 * AGC and AWB busy. The luminance falls off towards the edges of the
+	 * image to mimic lens shading.
+	 */
+	void synthesizeStatistics()
+	{
+		struct Scene {
+			unsigned int luminance;
+			int cb;
+			int cr;
+		};
+
+		static const Scene scenes[] = {
+			{ 40, 12, -10 },
+			{ 90, -6, 8 },
+			{ 160, 0, 0 },
+			{ 220, -14, 16 },
+			{ 120, 8, -4 },
+		};
+
+		static constexpr unsigned int kFramesPerScene = 30;
+		static constexpr unsigned int kAeGrid = 5;
+
+		for (const Scene &scene : scenes) {
+			rkisp1_stat_buffer stats{};
+
+			stats.meas_type = RKISP1_CIF_ISP_STAT_AWB |
+					  RKISP1_CIF_ISP_STAT_AUTOEXP |
+					  RKISP1_CIF_ISP_STAT_HIST;
+
+			rkisp1_cif_isp_awb_meas &awb = stats.params.awb.awb_mean[0];
+			awb.cnt = 1920 * 1080 / 2;
+			awb.mean_y_or_g = scene.luminance;
+			awb.mean_cb_or_b = 128 + scene.cb;
+			awb.mean_cr_or_r = 128 + scene.cr;
+
+			unsigned int cells = kHwSettings.numAeCells;
+			for (unsigned int i = 0; i < cells; i++) {
+				int x = static_cast<int>(i % kAeGrid) - kAeGrid / 2;
+				int y = static_cast<int>(i / kAeGrid) - kAeGrid / 2;
+				unsigned int falloff = 100 - 4 * (x * x + y * y);
+
+				stats.params.ae.exp_mean[i] = scene.luminance * falloff / 100;
+			}
+
+			unsigned int bins = kHwSettings.numHistogramBins;
+			unsigned int peak = scene.luminance * bins / 256;
+			for (unsigned int i = 0; i < bins; i++) {
+				unsigned int distance = i > peak ? i - peak : peak - i;
+				stats.params.hist.hist_bins[i] = (1000 >> std::min(distance, 10U)) << 4;
+			}
+
+			for (unsigned int i = 0; i < kFramesPerScene; i++) {
+				stats.frame_id = stats_.size();
+				stats_.push_back(stats);
+			}
+		}
+	}
+
+	static void printTiming(const string &name,
+				chrono::duration<double, micro> queueRequest,
+				chrono::duration<double, micro> prepare,
+				chrono::duration<double, micro> process)
+	{
+		cout << "  " << left << setw(24) << name << right
+		     << fixed << setprecision(2)
+		     << setw(14) << queueRequest.count() / kFrames
+		     << setw(10) << prepare.count() / kFrames
+		     << setw(10) << process.count() / kFrames
+		     << setw(10) << (queueRequest + prepare + process).count() / kFrames
+		     << defaultfloat << endl;
+	}
+
+	BenchmarkModule module_;
+	IPAContext context_;
+	vector<string> names_;
+	vector<rkisp1_stat_buffer> stats_;
+};
+
+TEST_REGISTER(RkISP1AlgorithmsBenchmark)
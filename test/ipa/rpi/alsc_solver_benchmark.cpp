@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Raspberry Pi ALSC solver benchmark
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/yaml_parser.h"
+
+#include "controller/rpi/alsc_solver.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace RPiController;
+
+/*
+ * The colour statistics are derived from the lens shading calibration tables
+ * recorded for the IMX219 on PiSP, at the lowest and highest colour
+ * temperatures, with deterministic noise and a few regions without enough
+ * data. Each solve starts from unity lambdas, as after a mode switch, which is
+ * the slowest case.
+ */
+class AlscSolverBenchmark : public Test
+{
+protected:
+	static constexpr unsigned int kRuns = 50;
+
+	int init()
+	{
+		string root = utils::libcameraSourcePath();
+		if (root.empty()) {
+			cout << "Tuning files are only available in the source tree" << endl;
+			return TestSkip;
+		}
+
+		File file(root + "src/ipa/rpi/pisp/data/imx219.json");
+		if (!file.open(File::OpenModeFlag::ReadOnly)) {
+			cerr << "Failed to open tuning file" << endl;
+			return TestFail;
+		}
+
+		unique_ptr<YamlObject> tuning = YamlParser::parse(file);
+		if (!tuning) {
+			cerr << "Failed to parse tuning file" << endl;
+			return TestFail;
+		}
+
+		const YamlObject *alsc = nullptr;
+		for (const YamlObject &algo : (*tuning)["algorithms"].asList()) {
+			if (algo.contains("rpi.alsc"))
+				alsc = &algo["rpi.alsc"];
+		}
+
+		if (!alsc) {
+			cerr << "No ALSC parameters in tuning file" << endl;
+			return TestFail;
+		}
+
+		omega_ = (*alsc)["omega"].get<double>(1.3);
+		nIter_ = (*alsc)["n_iter"].get<uint32_t>(64);
+		sigma_ = (*alsc)["sigma"].get<double>(0.01);
+
+		for (const char *key : { "calibrations_Cr", "calibrations_Cb" }) {
+			const YamlObject &calibrations = (*alsc)[key];
+
+			for (std::size_t i : { std::size_t(0), calibrations.size() - 1 }) {
+				auto table = calibrations[i]["table"].getList<double>();
+				if (!table || table->size() != kSize.width * kSize.height) {
+					cerr << "Invalid " << key << " table" << endl;
+					return TestFail;
+				}
+
+				stats_.push_back(createStatistics(*table));
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		struct Configuration {
+			const char *name;
+			AlscSolver::Precision precision;
+			unsigned int coarseIterations;
+		};
+
+		const Configuration configurations[] = {
+			{ "double", AlscSolver::Precision::Double, 0 },
+			{ "double, coarse", AlscSolver::Precision::Double, 8 },
+			{ "float", AlscSolver::Precision::Float, 0 },
+			{ "float, coarse", AlscSolver::Precision::Float, 8 },
+		};
+
+		/*
+		 * Compute reference lambdas with the double precision solver
+		 * run to full convergence.
+		 */
+		vector<Array2D<double>> reference;
+		AlscSolver referenceSolver;
+		referenceSolver.configure(kSize);
+
+		for (const Array2D<double> &C : stats_) {
+			const AlscSolver::Params params = {
+				AlscSolver::Precision::Double, omega_, 10000,
+				1e-9, 0.05, 0,
+			};
+			Array2D<double> lambda;
+			lambda.resize(kSize, 1.0);
+
+			referenceSolver.solve(C, sigma_, lambda, params);
+			reference.push_back(std::move(lambda));
+		}
+
+		double baselineError = 0.0;
+
+		for (const Configuration &config : configurations) {
+			AlscSolver::Params params = {
+				config.precision, omega_, nIter_, 1e-3, 0.05,
+				config.coarseIterations,
+			};
+			vector<Array2D<double>> results;
+			double maxError = 0.0;
+			unsigned int iterations = 0;
+
+			AlscSolver solver;
+			solver.configure(kSize);
+
+			auto start = chrono::steady_clock::now();
+
+			for (unsigned int run = 0; run < kRuns; run++) {
+				for (const Array2D<double> &C : stats_) {
+					Array2D<double> lambda;
+					lambda.resize(kSize, 1.0);
+
+					iterations += solver.solve(C, sigma_, lambda, params);
+
+					if (run == 0)
+						results.push_back(std::move(lambda));
+				}
+			}
+
+			chrono::duration<double, micro> elapsed =
+				chrono::steady_clock::now() - start;
+
+			for (unsigned int i = 0; i < results.size(); i++) {
+				const Array2D<double> &ref = reference[i];
+				const Array2D<double> &res = results[i];
+
+				for (unsigned int j = 0; j < res.size(); j++)
+					maxError = std::max(maxError, fabs(res[j] - ref[j]));
+			}
+
+			unsigned int solves = kRuns * stats_.size();
+
+			cout << setw(16) << left << config.name
+			     << fixed << setprecision(1)
+			     << elapsed.count() / solves << " us/solve, "
+			     << static_cast<double>(iterations) / solves << " iterations, "
+			     << setprecision(4) << "max difference " << maxError
+			     << endl;
+
+			/*
+			 * The solvers stop before full convergence. Check that
+			 * they all stop about as close to the converged lambdas
+			 * as the double precision solver.
+			 */
+			if (config.precision == AlscSolver::Precision::Double &&
+			    !config.coarseIterations)
+				baselineError = maxError;
+
+			if (maxError > baselineError + 0.01) {
+				cerr << config.name << " diverges from the reference"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	static constexpr Size kSize{ 32, 32 };
+
+	static Array2D<double> createStatistics(const vector<double> &table)
+	{
+		Array2D<double> C;
+		uint32_t seed = 1;
+
+		C.resize(kSize);
+
+		for (unsigned int i = 0; i < C.size(); i++) {
+			seed = seed * 1664525 + 1013904223;
+			double noise = static_cast<double>(seed >> 8) / (1 << 24) - 0.5;
+
+			C[i] = 0.5 / table[i] * (1.0 + 0.01 * noise);
+		}
+
+		/* Simulate regions too dark to be used. */
+		for (unsigned int i = 0; i < 8; i++)
+			C[(i * 131) % C.size()] = InsufficientData;
+
+		return C;
+	}
+
+	vector<Array2D<double>> stats_;
+	double omega_;
+	double sigma_;
+	unsigned int nIter_;
+};
+
+TEST_REGISTER(AlscSolverBenchmark)
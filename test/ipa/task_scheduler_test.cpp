@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * IPA task scheduler test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "libipa/task_scheduler.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class TaskSchedulerTest : public Test
+{
+protected:
+	int init()
+	{
+		/* Use a single worker to make the execution order predictable. */
+		setenv("LIBCAMERA_IPA_WORKERS", "1", 1);
+
+		if (TaskScheduler::instance()->maxWorkers() != 1) {
+			cerr << "Failed to limit the number of workers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		mutex lock;
+		condition_variable cv;
+		bool started = false;
+		bool release = false;
+		vector<int> order;
+
+		/* Block the worker until all other tasks are queued. */
+		TaskScheduler::Task blocker("blocker", [&] {
+			unique_lock<mutex> locker(lock);
+			started = true;
+			cv.notify_one();
+			cv.wait(locker, [&] { return release; });
+		});
+
+		TaskScheduler::Task low("low", [&] { order.push_back(0); }, 0);
+		TaskScheduler::Task late("late", [&] { order.push_back(1); }, 1);
+		TaskScheduler::Task early("early", [&] { order.push_back(2); }, 1);
+		TaskScheduler::Task cancelled("cancelled", [&] { order.push_back(3); }, 2);
+
+		if (!blocker.submit(1s)) {
+			cerr << "Failed to submit task" << endl;
+			return TestFail;
+		}
+
+		{
+			unique_lock<mutex> locker(lock);
+			cv.wait(locker, [&] { return started; });
+		}
+
+		low.submit(1s);
+		late.submit(1s);
+		early.submit(500ms);
+		cancelled.submit(1s);
+
+		if (low.submit(1s) || low.done()) {
+			cerr << "Queued task submitted twice" << endl;
+			return TestFail;
+		}
+
+		cancelled.cancel();
+		if (!cancelled.done()) {
+			cerr << "Cancelled task still queued" << endl;
+			return TestFail;
+		}
+
+		{
+			lock_guard<mutex> locker(lock);
+			release = true;
+		}
+		cv.notify_one();
+
+		low.wait();
+		late.wait();
+		early.wait();
+
+		/*
+		 * The tasks with the highest priority run first, the earliest
+		 * deadline first for tasks with the same priority.
+		 */
+		if (order != vector<int>{ 2, 1, 0 }) {
+			cerr << "Tasks run in the wrong order" << endl;
+			return TestFail;
+		}
+
+		/* A zero deadline is always missed. */
+		TaskScheduler::Task missed("missed", [] {});
+		missed.submit(0s);
+		missed.wait();
+
+		TaskScheduler::Statistics stats = missed.statistics();
+		if (stats.submitted != 1 || stats.completed != 1 ||
+		    stats.missedDeadlines != 1) {
+			cerr << "Missed deadline not recorded" << endl;
+			return TestFail;
+		}
+
+		stats = low.statistics();
+		if (stats.completed != 1 || stats.missedDeadlines != 0) {
+			cerr << "Invalid task statistics" << endl;
+			return TestFail;
+		}
+
+		/* Destroying a task waits for its job to complete. */
+		atomic<bool> running = false;
+		atomic<bool> completed = false;
+		{
+			TaskScheduler::Task slow("slow", [&] {
+				running = true;
+				this_thread::sleep_for(50ms);
+				completed = true;
+			});
+			slow.submit(1s);
+
+			while (!running)
+				this_thread::yield();
+		}
+
+		if (!completed) {
+			cerr << "Task destroyed while running" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TaskSchedulerTest)
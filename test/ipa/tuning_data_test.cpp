@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Shared tuning data test
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/file.h>
+
+#include "libipa/tuning_data.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class TuningDataTest : public Test
+{
+protected:
+	int writeFile(const string &contents)
+	{
+		/* Replace the file, to change its size and inode. */
+		unlink(path_.c_str());
+
+		File file(path_);
+		if (!file.open(File::OpenModeFlag::WriteOnly)) {
+			cerr << "Failed to open tuning file" << endl;
+			return TestFail;
+		}
+
+		file.write({ reinterpret_cast<const uint8_t *>(contents.data()),
+			     contents.size() });
+		return TestPass;
+	}
+
+	shared_ptr<const vector<double>> table(const YamlObject &root)
+	{
+		return TuningData::share<vector<double>>(root["table"], [&]() {
+			created_++;
+			return make_shared<vector<double>>(
+				root["table"].getList<double>().value_or(vector<double>{}));
+		});
+	}
+
+	int init()
+	{
+		/* Don't pollute the user's YAML cache. */
+		setenv("LIBCAMERA_YAML_CACHE_DIR", "", 1);
+
+		char path[] = "/tmp/libcamera.test.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cerr << "Failed to create temporary file" << endl;
+			return TestFail;
+		}
+
+		close(fd);
+		path_ = path;
+
+		return writeFile("version: 1\ntable: [ 1.0, 2.0, 3.0 ]\n");
+	}
+
+	int run()
+	{
+		shared_ptr<const YamlObject> first;
+		shared_ptr<const YamlObject> second;
+
+		if (TuningData::load(path_, &first) || !first) {
+			cerr << "Failed to load tuning file" << endl;
+			return TestFail;
+		}
+
+		/* The tree shall be shared while it is referenced. */
+		if (TuningData::load(path_, &second) || second != first) {
+			cerr << "Tuning file not shared" << endl;
+			return TestFail;
+		}
+
+		/* Derived data shall be created once and shared. */
+		created_ = 0;
+		shared_ptr<const vector<double>> table1 = table(*first);
+		shared_ptr<const vector<double>> table2 = table(*second);
+		if (created_ != 1 || table1 != table2 || table1->size() != 3) {
+			cerr << "Derived data not shared" << endl;
+			return TestFail;
+		}
+
+		/* Data derived from a tree not loaded by TuningData isn't shared. */
+		unique_ptr<YamlObject> other;
+		{
+			File file(path_);
+			if (!file.open(File::OpenModeFlag::ReadOnly))
+				return TestFail;
+			other = YamlParser::parse(file);
+		}
+
+		if (!other) {
+			cerr << "Failed to parse tuning file" << endl;
+			return TestFail;
+		}
+
+		created_ = 0;
+		shared_ptr<const vector<double>> table3 = table(*other);
+		shared_ptr<const vector<double>> table4 = table(*other);
+		if (created_ != 2 || table3 == table4) {
+			cerr << "Unrelated data shared" << endl;
+			return TestFail;
+		}
+
+		/* The derived data keeps the tree alive, and is still shared. */
+		const YamlObject *tree = first.get();
+		first.reset();
+		second.reset();
+		table2.reset();
+
+		created_ = 0;
+		if (TuningData::load(path_, &first) || first.get() != tree ||
+		    table(*first) != table1 || created_ != 0) {
+			cerr << "Tuning data released while in use" << endl;
+			return TestFail;
+		}
+
+		/* A modified file shall be parsed again. */
+		if (writeFile("version: 1\ntable: [ 4.0, 5.0 ]\n") != TestPass)
+			return TestFail;
+
+		if (TuningData::load(path_, &second) || second == first) {
+			cerr << "Modified tuning file not reloaded" << endl;
+			return TestFail;
+		}
+
+		created_ = 0;
+		if (table(*second)->size() != 2 || created_ != 1) {
+			cerr << "Invalid data derived from modified file" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink(path_.c_str());
+	}
+
+private:
+	string path_;
+	unsigned int created_;
+};
+
+TEST_REGISTER(TuningDataTest)
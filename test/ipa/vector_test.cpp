@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Matrix and vector batch operations test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "libipa/matrix.h"
+#include "libipa/vector.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class VectorTest : public Test
+{
+protected:
+	int run()
+	{
+		const Matrix<float, 3, 3> ccm({ 1.6f, -0.4f, -0.2f,
+						-0.3f, 1.5f, -0.2f,
+						0.0f, -0.6f, 1.6f });
+
+		vector<Vector<float, 3>> zones;
+		for (unsigned int i = 0; i < 64; i++)
+			zones.push_back(Vector<float, 3>({ i * 4.0f, i * 3.0f + 10.0f, 255.0f - i * 2.0f }));
+
+		/* The batch API must match the per-vector multiplications. */
+		vector<Vector<float, 3>> out(zones.size());
+		transform(ccm, Span<const Vector<float, 3>>(zones),
+			  Span<Vector<float, 3>>(out));
+
+		for (unsigned int i = 0; i < zones.size(); i++) {
+			if (out[i] != ccm * zones[i]) {
+				cerr << "Batch multiplication mismatch for zone "
+				     << i << ": " << out[i] << " != "
+				     << ccm * zones[i] << endl;
+				return TestFail;
+			}
+		}
+
+		/* In-place multiplication must be supported. */
+		vector<Vector<float, 3>> inPlace = zones;
+		transform(ccm, Span<const Vector<float, 3>>(inPlace),
+			  Span<Vector<float, 3>>(inPlace));
+
+		for (unsigned int i = 0; i < zones.size(); i++) {
+			if (inPlace[i] != out[i]) {
+				cerr << "In-place multiplication mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Fixed-point multiplication, with 7 fractional bits. */
+		Matrix<int16_t, 3, 3> fixedCcm;
+		Matrix<float, 3, 3> roundedCcm;
+		for (unsigned int i = 0; i < 3; i++) {
+			for (unsigned int j = 0; j < 3; j++) {
+				fixedCcm[i][j] = lround(ccm[i][j] * 128);
+				roundedCcm[i][j] = fixedCcm[i][j] / 128.0f;
+			}
+		}
+
+		vector<Vector<uint16_t, 3>> fixedZones;
+		for (const Vector<float, 3> &zone : zones)
+			fixedZones.push_back(Vector<uint16_t, 3>({
+				static_cast<uint16_t>(zone[0]),
+				static_cast<uint16_t>(zone[1]),
+				static_cast<uint16_t>(zone[2]) }));
+
+		vector<Vector<uint16_t, 3>> fixedOut(fixedZones.size());
+		transformFixedPoint<7>(fixedCcm,
+				       Span<const Vector<uint16_t, 3>>(fixedZones),
+				       Span<Vector<uint16_t, 3>>(fixedOut));
+
+		for (unsigned int i = 0; i < zones.size(); i++) {
+			Vector<float, 3> expected = roundedCcm * zones[i];
+
+			for (unsigned int j = 0; j < 3; j++) {
+				/* Negative values are clamped to 0. */
+				if (fabs(fixedOut[i][j] - std::max(expected[j], 0.0f)) > 0.5f) {
+					cerr << "Fixed-point multiplication mismatch for zone "
+					     << i << ": " << fixedOut[i] << " != "
+					     << expected << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(VectorTest)
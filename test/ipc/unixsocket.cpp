@@ -253,6 +253,33 @@ protected:
 		return 0;
 	}
 
+	int testLargeReverse()
+	{
+		IPCUnixSocket::Payload message, response;
+		int ret;
+
+		/*
+		 * Send messages large enough to wrap around the shared memory
+		 * ring several times.
+		 */
+		for (unsigned int i = 0; i < 8; i++) {
+			message.data.resize(40000 + i);
+			message.data[0] = CMD_REVERSE;
+			for (unsigned int j = 1; j < message.data.size(); j++)
+				message.data[j] = j * (i + 1);
+
+			ret = call(message, &response);
+			if (ret)
+				return ret;
+
+			std::reverse(response.data.begin() + 1, response.data.end());
+			if (message.data != response.data)
+				return TestFail;
+		}
+
+		return 0;
+	}
+
 	int testEmptyFail()
 	{
 		IPCUnixSocket::Payload message;
@@ -360,7 +387,17 @@ protected:
 
 	int run()
 	{
-		UniqueFD slavefd = ipc_.create();
+		if (runChannel(false) != TestPass)
+			return TestFail;
+
+		/* Run the same tests with the shared memory transport. */
+		return runChannel(true);
+	}
+
+private:
+	int runChannel(bool sharedMemory)
+	{
+		UniqueFD slavefd = ipc_.create(sharedMemory);
 		if (!slavefd.isValid())
 			return TestFail;
 
@@ -377,6 +414,12 @@ protected:
 			return TestFail;
 		}
 
+		/* Test sending large messages. */
+		if (testLargeReverse()) {
+			cerr << "Large reverse array test failed" << endl;
+			return TestFail;
+		}
+
 		/* Test that an empty message fails. */
 		if (testEmptyFail()) {
 			cerr << "Empty message test failed" << endl;
@@ -415,10 +458,11 @@ protected:
 			return TestFail;
 		}
 
+		ipc_.readyRead.disconnect(this);
+
 		return TestPass;
 	}
 
-private:
 	int call(const IPCUnixSocket::Payload &message, IPCUnixSocket::Payload *response)
 	{
 		Timer timeout;
@@ -0,0 +1,414 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Unix socket IPC latency and throughput benchmark
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/unique_fd.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/ipc_pipe.h"
+#include "libcamera/internal/ipc_pipe_unixsocket.h"
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/process.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+enum {
+	CmdExit = 0,
+	CmdEcho = 1,
+	CmdSink = 2,
+};
+
+/*
+ * The benchmark runs with 'meson test --benchmark'. Setting the
+ * LIBCAMERA_IPA_IPC_SHARED_MEMORY environment variable measures the
+ * IPCPipeUnixSocket shared memory transport.
+ */
+
+/* Reply to every CmdEcho message with the same data and file descriptors. */
+class UnixSocketBenchmarkWorker
+{
+public:
+	UnixSocketBenchmarkWorker()
+		: exit_(false)
+	{
+		ipc_.readyRead.connect(this, &UnixSocketBenchmarkWorker::readyRead);
+	}
+
+	int run(UniqueFD fd)
+	{
+		if (ipc_.bind(std::move(fd))) {
+			cerr << "Failed to connect to IPC channel" << endl;
+			return EXIT_FAILURE;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		while (!exit_)
+			dispatcher->processEvents();
+
+		ipc_.close();
+
+		return EXIT_SUCCESS;
+	}
+
+private:
+	void readyRead()
+	{
+		IPCUnixSocket::Payload payload;
+		if (ipc_.receive(&payload)) {
+			exit_ = true;
+			return;
+		}
+
+		IPCMessage message(payload);
+		if (!message.isBatch()) {
+			handle(message);
+			return;
+		}
+
+		for (const IPCMessage &batched : message.unbatch())
+			handle(batched);
+	}
+
+	void handle(const IPCMessage &message)
+	{
+		switch (message.header().cmd) {
+		case CmdExit:
+			exit_ = true;
+			break;
+
+		case CmdEcho:
+			if (ipc_.send(message.payload()))
+				exit_ = true;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	IPCUnixSocket ipc_;
+	bool exit_;
+};
+
+class UnixSocketBenchmark : public Test
+{
+protected:
+	static constexpr unsigned int kIterations = 2000;
+
+	struct Result {
+		vector<chrono::nanoseconds> latencies;
+		chrono::nanoseconds elapsed;
+		chrono::microseconds cpuTime;
+	};
+
+	static chrono::microseconds cpuTime()
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+
+		return chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+		       chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+	}
+
+	/*
+	 * Create a message carrying a serialized ControlList with a mix of
+	 * scalar and array controls, representative of per-frame metadata.
+	 */
+	static IPCMessage createMessage(unsigned int entries, unsigned int numFds)
+	{
+		ControlList list(controls::controls);
+		const array<float, 9> matrix{ 1.6f, -0.4f, -0.2f, -0.3f, 1.5f,
+					      -0.2f, -0.1f, -0.5f, 1.6f };
+
+		for (unsigned int id = 1; id <= entries; ++id) {
+			if (id % 10 == 0)
+				list.set(id, ControlValue(Span<const float>(matrix)));
+			else if (id % 2)
+				list.set(id, ControlValue(static_cast<int32_t>(id)));
+			else
+				list.set(id, ControlValue(id * 0.5f));
+		}
+
+		ControlSerializer serializer(ControlSerializer::Role::Proxy);
+		IPCMessage message(CmdEcho);
+
+		message.data().resize(serializer.binarySize(list));
+		ByteStreamBuffer buffer(message.data().data(), message.data().size());
+		serializer.serialize(list, buffer);
+
+		for (unsigned int i = 0; i < numFds; ++i)
+			message.fds().push_back(SharedFD(UniqueFD(open("/dev/null", O_RDONLY))));
+
+		return message;
+	}
+
+	static void report(const string &name, const IPCMessage &message,
+			   Result &result)
+	{
+		vector<chrono::nanoseconds> &lat = result.latencies;
+		sort(lat.begin(), lat.end());
+
+		auto percentile = [&](unsigned int p) {
+			return chrono::duration<double, micro>(lat[(lat.size() - 1) * p / 100]).count();
+		};
+
+		double seconds = chrono::duration<double>(result.elapsed).count();
+
+		cout << fixed << setprecision(1)
+		     << name << ", " << message.data().size() << " bytes, "
+		     << message.fds().size() << " fds: p50 " << percentile(50)
+		     << "us p90 " << percentile(90) << "us p99 " << percentile(99)
+		     << "us max " << percentile(100) << "us, "
+		     << static_cast<unsigned int>(lat.size() / seconds) << " msg/s, "
+		     << static_cast<double>(result.cpuTime.count()) / lat.size()
+		     << "us CPU/msg" << endl;
+	}
+
+	int waitReply()
+	{
+		Timer timeout;
+		timeout.start(2000ms);
+
+		while (!replied_) {
+			if (!timeout.isRunning()) {
+				cerr << "Reply timeout" << endl;
+				return -ETIMEDOUT;
+			}
+
+			dispatcher_->processEvents();
+		}
+
+		return 0;
+	}
+
+	void readyRead()
+	{
+		IPCUnixSocket::Payload payload;
+		if (socket_.receive(&payload))
+			return;
+
+		/* Take ownership of the file descriptors to close them. */
+		IPCMessage message(payload);
+		replied_ = true;
+	}
+
+	/* Measure round trips through a bare IPCUnixSocket. */
+	int benchmarkSocket(const IPCMessage &message, Result *result)
+	{
+		UniqueFD fd = socket_.create();
+		if (!fd.isValid())
+			return -ENODEV;
+
+		socket_.readyRead.connect(this, &UnixSocketBenchmark::readyRead);
+
+		vector<string> args{ "", to_string(fd.get()) };
+		vector<int> fds{ fd.get() };
+
+		Process worker;
+		int ret = worker.start(self(), args, fds);
+		if (ret)
+			return ret;
+
+		fd.reset();
+
+		auto start = chrono::steady_clock::now();
+		chrono::microseconds cpuStart = cpuTime();
+
+		for (unsigned int i = 0; i < kIterations; ++i) {
+			auto begin = chrono::steady_clock::now();
+
+			replied_ = false;
+			ret = socket_.send(message.payload());
+			if (ret)
+				break;
+
+			ret = waitReply();
+			if (ret)
+				break;
+
+			result->latencies.push_back(chrono::steady_clock::now() - begin);
+		}
+
+		result->cpuTime = cpuTime() - cpuStart;
+		result->elapsed = chrono::steady_clock::now() - start;
+
+		socket_.send(IPCMessage(CmdExit).payload());
+		socket_.readyRead.disconnect(this);
+		socket_.close();
+
+		return ret;
+	}
+
+	/* Measure synchronous calls through an IPCPipeUnixSocket. */
+	int benchmarkPipeSync(const IPCMessage &message, Result *result)
+	{
+		IPCPipeUnixSocket pipe("", self().c_str());
+		if (!pipe.isConnected())
+			return -ENODEV;
+
+		IPCMessage in = message;
+		int ret = 0;
+
+		auto start = chrono::steady_clock::now();
+		chrono::microseconds cpuStart = cpuTime();
+
+		for (unsigned int i = 0; i < kIterations; ++i) {
+			auto begin = chrono::steady_clock::now();
+
+			in.header().cookie = i;
+			IPCMessage out;
+			ret = pipe.sendSync(in, &out);
+			if (ret)
+				break;
+
+			result->latencies.push_back(chrono::steady_clock::now() - begin);
+		}
+
+		result->cpuTime = cpuTime() - cpuStart;
+		result->elapsed = chrono::steady_clock::now() - start;
+
+		pipe.sendAsync(IPCMessage(CmdExit));
+
+		return ret;
+	}
+
+	/*
+	 * Measure asynchronous calls through an IPCPipeUnixSocket, in bursts
+	 * of messages sent within one event loop iteration, each burst being
+	 * terminated by a synchronous call to wait for the worker to catch up.
+	 * The latencies are reported per message.
+	 */
+	int benchmarkPipeAsync(const IPCMessage &message, Result *result)
+	{
+		static constexpr unsigned int kBurst = 4;
+
+		IPCPipeUnixSocket pipe("", self().c_str());
+		if (!pipe.isConnected())
+			return -ENODEV;
+
+		IPCMessage in = message;
+		in.header().cmd = CmdSink;
+
+		IPCMessage sync(CmdEcho);
+		int ret = 0;
+
+		auto start = chrono::steady_clock::now();
+		chrono::microseconds cpuStart = cpuTime();
+
+		for (unsigned int i = 0; i < kIterations; i += kBurst) {
+			auto begin = chrono::steady_clock::now();
+
+			for (unsigned int j = 0; j < kBurst; ++j) {
+				ret = pipe.sendAsync(in);
+				if (ret)
+					break;
+			}
+
+			sync.header().cookie = i;
+			if (!ret)
+				ret = pipe.sendSync(sync);
+			if (ret)
+				break;
+
+			auto latency = (chrono::steady_clock::now() - begin) / kBurst;
+			for (unsigned int j = 0; j < kBurst; ++j)
+				result->latencies.push_back(latency);
+		}
+
+		result->cpuTime = cpuTime() - cpuStart;
+		result->elapsed = chrono::steady_clock::now() - start;
+
+		pipe.sendAsync(IPCMessage(CmdExit));
+
+		return ret;
+	}
+
+	int run()
+	{
+		dispatcher_ = Thread::current()->eventDispatcher();
+
+		struct Benchmark {
+			const char *name;
+			int (UnixSocketBenchmark::*func)(const IPCMessage &, Result *);
+		};
+
+		const array<Benchmark, 3> benchmarks{ {
+			{ "IPCUnixSocket round trip", &UnixSocketBenchmark::benchmarkSocket },
+			{ "IPCPipeUnixSocket sync", &UnixSocketBenchmark::benchmarkPipeSync },
+			{ "IPCPipeUnixSocket async", &UnixSocketBenchmark::benchmarkPipeAsync },
+		} };
+
+		for (const Benchmark &benchmark : benchmarks) {
+			for (unsigned int entries : { 10, 50, 100 }) {
+				for (unsigned int numFds : { 0, 2 }) {
+					IPCMessage message = createMessage(entries, numFds);
+					Result result;
+
+					int ret = (this->*benchmark.func)(message, &result);
+					if (ret) {
+						cerr << benchmark.name << " failed: "
+						     << strerror(-ret) << endl;
+						return TestFail;
+					}
+
+					report(string(benchmark.name) + ", " +
+					       to_string(entries) + " controls",
+					       message, result);
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	ProcessManager processManager_;
+
+	EventDispatcher *dispatcher_;
+	IPCUnixSocket socket_;
+	bool replied_;
+};
+
+/*
+ * Can't use TEST_REGISTER() as single binary needs to act as both client and
+ * server
+ */
+int main(int argc, char **argv)
+{
+	/* IPCPipeUnixSocket passes IPA module path in argv[1] */
+	if (argc == 3) {
+		UniqueFD ipcfd = UniqueFD(std::stoi(argv[2]));
+		UnixSocketBenchmarkWorker worker;
+		return worker.run(std::move(ipcfd));
+	}
+
+	UnixSocketBenchmark test;
+	test.setArgs(argc, argv);
+	return test.execute();
+}
@@ -34,6 +34,7 @@ enum {
 	CmdExit = 0,
 	CmdGetSync = 1,
 	CmdSetAsync = 2,
+	CmdGetBatchesSync = 3,
 };
 
 const int32_t kInitialValue = 1337;
@@ -43,7 +44,8 @@ class UnixSocketTestIPCSlave
 {
 public:
 	UnixSocketTestIPCSlave()
-		: value_(kInitialValue), exitCode_(EXIT_FAILURE), exit_(false)
+		: value_(kInitialValue), batches_(0), exitCode_(EXIT_FAILURE),
+		  exit_(false)
 	{
 		dispatcher_ = Thread::current()->eventDispatcher();
 		ipc_.readyRead.connect(this, &UnixSocketTestIPCSlave::readyRead);
@@ -77,7 +79,22 @@ private:
 		}
 
 		IPCMessage ipcMessage(message);
+
+		if (!ipcMessage.isBatch()) {
+			dispatch(ipcMessage);
+			return;
+		}
+
+		batches_++;
+
+		for (IPCMessage &batched : ipcMessage.unbatch())
+			dispatch(batched);
+	}
+
+	void dispatch(IPCMessage &ipcMessage)
+	{
 		uint32_t cmd = ipcMessage.header().cmd;
+		int ret;
 
 		switch (cmd) {
 		case CmdExit: {
@@ -85,12 +102,14 @@ private:
 			break;
 		}
 
-		case CmdGetSync: {
+		case CmdGetSync:
+		case CmdGetBatchesSync: {
 			IPCMessage::Header header = { cmd, ipcMessage.header().cookie };
 			IPCMessage response(header);
 
+			int32_t value = cmd == CmdGetSync ? value_ : batches_;
 			vector<uint8_t> buf;
-			tie(buf, ignore) = IPADataSerializer<int32_t>::serialize(value_);
+			tie(buf, ignore) = IPADataSerializer<int32_t>::serialize(value);
 			response.data().insert(response.data().end(), buf.begin(), buf.end());
 
 			ret = ipc_.send(response.payload());
@@ -115,6 +134,7 @@ private:
 	}
 
 	int32_t value_;
+	int32_t batches_;
 
 	IPCUnixSocket ipc_;
 	EventDispatcher *dispatcher_;
@@ -144,9 +164,9 @@ protected:
 		return 0;
 	}
 
-	int getValue()
+	int getValue(uint32_t cmd = CmdGetSync)
 	{
-		IPCMessage msg(CmdGetSync);
+		IPCMessage msg(cmd);
 		IPCMessage buf;
 
 		int ret = ipc_->sendSync(msg, &buf);
@@ -199,6 +219,58 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Asynchronous messages sent in a row shall be coalesced in a
+		 * single batch, and handled in order.
+		 */
+		for (int32_t value : { kInitialValue, kChangedValue + 1, kChangedValue }) {
+			ret = setValue(value);
+			if (ret < 0) {
+				cerr << "Failed to set value: " << strerror(-ret) << endl;
+				return TestFail;
+			}
+		}
+
+		ret = getValue();
+		if (ret != kChangedValue) {
+			cerr << "Wrong batched value, expected " << kChangedValue
+			     << ", got " << ret << endl;
+			return TestFail;
+		}
+
+		ret = getValue(CmdGetBatchesSync);
+		if (ret != 1) {
+			cerr << "Wrong number of batches, expected 1, got "
+			     << ret << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The batch message is reused for the next batch, which shall
+		 * only contain the new messages.
+		 */
+		for (int32_t value : { kChangedValue, kInitialValue }) {
+			ret = setValue(value);
+			if (ret < 0) {
+				cerr << "Failed to set value: " << strerror(-ret) << endl;
+				return TestFail;
+			}
+		}
+
+		ret = getValue();
+		if (ret != kInitialValue) {
+			cerr << "Wrong batched value, expected " << kInitialValue
+			     << ", got " << ret << endl;
+			return TestFail;
+		}
+
+		ret = getValue(CmdGetBatchesSync);
+		if (ret != 2) {
+			cerr << "Wrong number of batches, expected 2, got "
+			     << ret << endl;
+			return TestFail;
+		}
+
 		ret = exit();
 		if (ret < 0) {
 			cerr << "Failed to exit: " << strerror(-ret) << endl;
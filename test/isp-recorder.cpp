@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * IspRecorder tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/isp_recorder.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class IspRecorderTest : public Test
+{
+protected:
+	static constexpr unsigned int kFrames = 8;
+	static constexpr unsigned int kMaxFrames = 5;
+
+	int init()
+	{
+		char dir[] = "/tmp/libcamera.test.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+
+		setenv("LIBCAMERA_ISP_RECORD", dir_.c_str(), 1);
+		setenv("LIBCAMERA_ISP_RECORD_FRAMES", to_string(kMaxFrames).c_str(), 1);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		string path = dir_ + "/test-" + to_string(getpid()) + "-0.rec";
+
+		{
+			IspRecorder recorder("test");
+
+			if (!recorder.isEnabled()) {
+				cerr << "Recorder not enabled" << endl;
+				return TestFail;
+			}
+
+			if (recorder.start() < 0 || !recorder.isRecording()) {
+				cerr << "Failed to start recording" << endl;
+				return TestFail;
+			}
+
+			for (unsigned int frame = 10; frame < 10 + kFrames; frame++) {
+				vector<uint8_t> params(16 + frame, frame);
+				vector<uint8_t> stats(64, ~frame);
+
+				recorder.record(IspRecorder::RecordType::Parameters,
+						frame, params);
+				recorder.record(IspRecorder::RecordType::Statistics,
+						frame, stats);
+
+				ControlList metadata(controls::controls);
+				metadata.set(controls::FrameDuration, frame * 1000);
+				recorder.record(frame, metadata);
+			}
+
+			recorder.stop();
+		}
+
+		IspRecordingReader reader;
+		int ret = reader.open(path);
+		if (ret < 0) {
+			cerr << "Failed to open recording " << path << endl;
+			return TestFail;
+		}
+
+		if (reader.name() != "test") {
+			cerr << "Invalid recorder name " << reader.name() << endl;
+			return TestFail;
+		}
+
+		/* Only the first kMaxFrames frames shall have been recorded. */
+		for (unsigned int frame = 10; frame < 10 + kMaxFrames; frame++) {
+			IspRecordingReader::Record record;
+
+			if (reader.read(&record) < 0 ||
+			    record.type != IspRecordingReader::RecordType::Parameters ||
+			    record.frame != frame ||
+			    record.data != vector<uint8_t>(16 + frame, frame)) {
+				cerr << "Invalid parameters record for frame " << frame << endl;
+				return TestFail;
+			}
+
+			if (reader.read(&record) < 0 ||
+			    record.type != IspRecordingReader::RecordType::Statistics ||
+			    record.frame != frame ||
+			    record.data != vector<uint8_t>(64, ~frame)) {
+				cerr << "Invalid statistics record for frame " << frame << endl;
+				return TestFail;
+			}
+
+			if (reader.read(&record) < 0 ||
+			    record.type != IspRecordingReader::RecordType::Metadata ||
+			    record.frame != frame) {
+				cerr << "Invalid metadata record for frame " << frame << endl;
+				return TestFail;
+			}
+
+			ByteStreamBuffer buffer(const_cast<const uint8_t *>(record.data.data()),
+						record.data.size());
+			ControlSerializer serializer(ControlSerializer::Role::Worker);
+			ControlList metadata = serializer.deserialize<ControlList>(buffer);
+
+			auto duration = metadata.get(controls::FrameDuration);
+			if (!duration || *duration != frame * 1000) {
+				cerr << "Invalid metadata for frame " << frame << endl;
+				return TestFail;
+			}
+		}
+
+		IspRecordingReader::Record record;
+		if (reader.read(&record) != -ENODATA) {
+			cerr << "Unexpected record past the recording window" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink((dir_ + "/test-" + to_string(getpid()) + "-0.rec").c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string dir_;
+};
+
+TEST_REGISTER(IspRecorderTest)
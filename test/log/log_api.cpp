@@ -6,6 +6,7 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
@@ -14,6 +15,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 
 #include <libcamera/base/log.h>
@@ -23,6 +25,7 @@
 #include "test.h"
 
 using namespace std;
+using namespace std::chrono_literals;
 using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(LogAPITest)
@@ -133,6 +136,94 @@ protected:
 		return TestPass;
 	}
 
+	int testDisabled()
+	{
+		unsigned int evaluated = 0;
+		auto operand = [&evaluated]() {
+			evaluated++;
+			return "operand";
+		};
+
+		logSetTarget(LoggingTargetNone);
+
+		/* Operands of disabled messages shall not be evaluated. */
+		logSetLevel("LogAPITest", "WARN");
+		LOG(LogAPITest, Info) << operand();
+		if (evaluated) {
+			cout << "Disabled log message evaluated" << endl;
+			return TestFail;
+		}
+
+		LOG(LogAPITest, Warning) << operand();
+		if (evaluated != 1) {
+			cout << "Enabled log message not evaluated" << endl;
+			return TestFail;
+		}
+
+		/* The LOG() macro shall behave as a single statement. */
+		if (evaluated)
+			LOG(LogAPITest, Info) << operand();
+		else
+			LOG(LogAPITest, Warning) << operand();
+
+		if (evaluated != 1) {
+			cout << "Incorrect LOG() statement nesting" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testRateLimit()
+	{
+		stringstream log;
+		logSetStream(&log);
+
+		/* Disabled messages shall not consume tokens. */
+		logSetLevel("LogAPITest", "ERROR");
+		for (unsigned int i = 0; i < 20; ++i)
+			LOG_RATELIMITED(LogAPITest, Warning) << "limited";
+
+		logSetLevel("LogAPITest", "WARN");
+		for (unsigned int i = 0; i < 20; ++i) {
+			LOG_RATELIMITED(LogAPITest, Warning) << "limited";
+			LOG_ONCE(LogAPITest, Warning) << "once";
+		}
+
+		unsigned int limited = 0;
+		unsigned int once = 0;
+		string line;
+		while (getline(log, line)) {
+			if (line.find("limited") != string::npos)
+				limited++;
+			else if (line.find("once") != string::npos)
+				once++;
+		}
+
+		if (limited != 10 || once != 1) {
+			cout << "Incorrect number of rate-limited messages ("
+			     << limited << ", " << once << ")" << endl;
+			return TestFail;
+		}
+
+		/* The number of suppressed messages is reported after a refill. */
+		LogRateLimiter limiter(1, 1ms);
+		if (limiter.allow() != 0 || limiter.allow() != -1 ||
+		    limiter.allow() != -1) {
+			cout << "Rate limiter burst exceeded" << endl;
+			return TestFail;
+		}
+
+		this_thread::sleep_for(5ms);
+
+		if (limiter.allow() != 2) {
+			cout << "Incorrect suppressed messages count" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		int ret = testFile();
@@ -147,6 +238,14 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testDisabled();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testRateLimit();
+		if (ret != TestPass)
+			return TestFail;
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Asynchronous logging test
+ */
+
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/logging.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(LogAsyncTest)
+
+class LogAsyncTest : public Test
+{
+protected:
+	int init() override
+	{
+		/* The test is run with LIBCAMERA_LOG_ASYNC=16. */
+		const char *async = getenv("LIBCAMERA_LOG_ASYNC");
+		if (!async || string(async) != "16") {
+			cout << "Asynchronous logging not enabled" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	/*
+	 * Parse the log lines, checking that messages from each producer are
+	 * in order, and count the received and dropped messages.
+	 */
+	int parse(istream &is, unsigned int producers, unsigned int *received,
+		  unsigned int *dropped)
+	{
+		vector<int> last(producers, -1);
+		string line;
+
+		*received = 0;
+		*dropped = 0;
+
+		while (getline(is, line)) {
+			size_t pos = line.find(" log messages dropped");
+			if (pos != string::npos) {
+				*dropped += stoul(line.substr(0, pos));
+				continue;
+			}
+
+			unsigned int producer, index;
+			pos = line.find("producer ");
+			if (pos == string::npos ||
+			    sscanf(line.c_str() + pos, "producer %u message %u",
+				   &producer, &index) != 2 ||
+			    producer >= producers) {
+				cout << "Invalid log line '" << line << "'" << endl;
+				return TestFail;
+			}
+
+			if (static_cast<int>(index) <= last[producer]) {
+				cout << "Log messages out of order" << endl;
+				return TestFail;
+			}
+
+			last[producer] = index;
+			(*received)++;
+		}
+
+		return TestPass;
+	}
+
+	int testFlush()
+	{
+		stringstream log;
+		logSetStream(&log);
+
+		/* Less messages than the ring size, none shall be dropped. */
+		for (unsigned int i = 0; i < 8; i++)
+			LOG(LogAsyncTest, Info) << "producer 0 message " << i;
+
+		/* Changing the log target writes all queued messages. */
+		logSetTarget(LoggingTargetNone);
+
+		unsigned int received, dropped;
+		if (parse(log, 1, &received, &dropped) != TestPass)
+			return TestFail;
+
+		if (received != 8 || dropped) {
+			cout << "Flush test failed: " << received << " received, "
+			     << dropped << " dropped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testOverflow()
+	{
+		static constexpr unsigned int kProducers = 4;
+		static constexpr unsigned int kMessages = 1000;
+
+		stringstream log;
+		logSetStream(&log);
+
+		vector<thread> threads;
+		for (unsigned int p = 0; p < kProducers; p++) {
+			threads.emplace_back([p]() {
+				for (unsigned int i = 0; i < kMessages; i++)
+					LOG(LogAsyncTest, Info)
+						<< "producer " << p << " message " << i;
+			});
+		}
+
+		for (thread &t : threads)
+			t.join();
+
+		logSetTarget(LoggingTargetNone);
+
+		unsigned int received, dropped;
+		if (parse(log, kProducers, &received, &dropped) != TestPass)
+			return TestFail;
+
+		if (received + dropped != kProducers * kMessages) {
+			cout << "Overflow test failed: " << received
+			     << " received, " << dropped << " dropped" << endl;
+			return TestFail;
+		}
+
+		cout << received << " messages received, " << dropped
+		     << " dropped" << endl;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testFlush() != TestPass)
+			return TestFail;
+
+		if (testOverflow() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(LogAsyncTest)
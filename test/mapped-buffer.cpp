@@ -9,7 +9,9 @@
 
 #include <libcamera/framebuffer_allocator.h>
 
+#include "libcamera/internal/dma_buf_allocator.h"
 #include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/shared_mem_object.h"
 
 #include "camera_test.h"
 #include "test.h"
@@ -103,6 +105,72 @@ protected:
 			return TestFail;
 		}
 
+		/* Persistent mappings shall be reused for the same buffer. */
+		const uint8_t *address;
+		{
+			MappedFrameBuffer persistent(buffer.get(),
+						     MappedFrameBuffer::MapFlag::Read |
+						     MappedFrameBuffer::MapFlag::Persistent);
+			if (!persistent.isValid()) {
+				cout << "Failed to map persistent buffer" << endl;
+				return TestFail;
+			}
+
+			address = persistent.planes()[0].data();
+		}
+
+		MappedFrameBuffer persistent(buffer.get(),
+					     MappedFrameBuffer::MapFlag::Read |
+					     MappedFrameBuffer::MapFlag::Persistent |
+					     MappedFrameBuffer::MapFlag::Sync);
+		if (!persistent.isValid() ||
+		    persistent.planes()[0].data() != address) {
+			cout << "Persistent mapping not reused" << endl;
+			return TestFail;
+		}
+
+		/* The mapping shall still be accessible. */
+		volatile uint8_t value = persistent.planes()[0][0];
+		(void)value;
+
+		/* Synchronize the first plane and transfer the CPU access. */
+		DmaSyncer syncer(buffer.get(), DmaSyncer::SyncType::Read, { 0 });
+		DmaSyncer moved(std::move(syncer));
+		value = rw_map.planes()[0][0];
+
+		/*
+		 * Planes given duplicated fds of the same buffer shall share a
+		 * single fd and be mapped once.
+		 */
+		SharedMem mem("mapped-buffer", 8192);
+		if (!mem) {
+			cout << "Failed to allocate shared memory" << endl;
+			return TestFail;
+		}
+
+		std::vector<FrameBuffer::Plane> planes(2);
+		planes[0].fd = SharedFD(mem.fd().get());
+		planes[0].offset = 0;
+		planes[0].length = 4096;
+		planes[1].fd = SharedFD(mem.fd().get());
+		planes[1].offset = 4096;
+		planes[1].length = 4096;
+
+		FrameBuffer semiPlanar(planes);
+		if (semiPlanar.planes()[0].fd != semiPlanar.planes()[1].fd) {
+			cout << "Planes of the same buffer don't share the fd" << endl;
+			return TestFail;
+		}
+
+		MappedFrameBuffer semiPlanarMap(&semiPlanar,
+						MappedFrameBuffer::MapFlag::Read);
+		if (!semiPlanarMap.isValid() ||
+		    semiPlanarMap.planes()[1].data() !=
+		    semiPlanarMap.planes()[0].data() + 4096) {
+			cout << "Planes of the same buffer not mapped once" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Test repopulating a MediaDevice with an unchanged topology
+ */
+
+#include <iostream>
+
+#include "media_device_test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MediaDevicePopulate : public MediaDeviceTest
+{
+	int run()
+	{
+		MediaEntity *sensor = media_->getEntityByName("Sensor A");
+		if (!sensor) {
+			cerr << "Failed to look up entity by name" << endl;
+			return TestFail;
+		}
+
+		if (media_->getEntityByName("Unknown entity")) {
+			cerr << "Lookup of unknown entity succeeded" << endl;
+			return TestFail;
+		}
+
+		size_t numEntities = media_->entities().size();
+
+		/*
+		 * The vimc topology is static, populating the device again
+		 * shall keep the existing media objects.
+		 */
+		if (media_->populate()) {
+			cerr << "Failed to populate media device" << endl;
+			return TestFail;
+		}
+
+		if (media_->entities().size() != numEntities ||
+		    media_->getEntityByName("Sensor A") != sensor) {
+			cerr << "Media graph rebuilt with unchanged topology" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MediaDevicePopulate)
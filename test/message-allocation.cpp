@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Message path memory allocation test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static atomic<bool> countAllocations = false;
+static atomic<unsigned int> allocations = 0;
+
+void *operator new(size_t size)
+{
+	if (countAllocations.load(memory_order_relaxed))
+		allocations.fetch_add(1, memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] size_t size) noexcept
+{
+	free(ptr);
+}
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: value_(0)
+	{
+	}
+
+	void set(int value) { value_ = value; }
+	int get() { return value_; }
+	void add(int value) { value_ += value; }
+
+private:
+	int value_;
+};
+
+class MessageAllocationTest : public Test
+{
+protected:
+	int init()
+	{
+		thread_.start();
+		receiver_.moveToThread(&thread_);
+
+		signal_.connect(&local_, &Receiver::add);
+		signal_.connect(this, [this](int value) { local_.add(value); });
+
+		return TestPass;
+	}
+
+	int iterate(unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++) {
+			/* Direct signal emission to the local receiver. */
+			local_.set(0);
+			signal_.emit(1);
+			if (local_.get() != 2) {
+				cout << "Invalid signal value " << local_.get() << endl;
+				return TestFail;
+			}
+
+			receiver_.invokeMethod(&Receiver::set,
+					       ConnectionTypeBlocking, i);
+
+			receiver_.invokeMethod(&Receiver::set,
+					       ConnectionTypeQueued, i + 1);
+			int value = receiver_.invokeMethod(&Receiver::get,
+							   ConnectionTypeBlocking);
+			if (value != static_cast<int>(i + 1)) {
+				cout << "Invalid value " << value << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* Warm up the memory pools. */
+		if (iterate(1000) != TestPass)
+			return TestFail;
+
+		countAllocations = true;
+		int ret = iterate(10000);
+		countAllocations = false;
+
+		if (ret != TestPass)
+			return TestFail;
+
+		if (allocations) {
+			cout << allocations << " allocations in steady state"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Thread thread_;
+	Receiver receiver_;
+	Receiver local_;
+	Signal<int> signal_;
+};
+
+TEST_REGISTER(MessageAllocationTest)
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Cross-thread message throughput test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/message.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SequenceMessage : public Message
+{
+public:
+	SequenceMessage(Message::Type type, unsigned int producer,
+			unsigned int sequence)
+		: Message(type), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	unsigned int producer() const { return producer_; }
+	unsigned int sequence() const { return sequence_; }
+
+private:
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class SequenceReceiver : public Object
+{
+public:
+	SequenceReceiver(Message::Type type, unsigned int producers)
+		: type_(type), sequences_(producers, 0), received_(0),
+		  outOfOrder_(false)
+	{
+	}
+
+	unsigned int received() const { return received_.load(); }
+	bool outOfOrder() const { return outOfOrder_.load(); }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != type_) {
+			Object::message(msg);
+			return;
+		}
+
+		SequenceMessage *seq = static_cast<SequenceMessage *>(msg);
+		unsigned int &expected = sequences_[seq->producer()];
+
+		if (seq->sequence() != expected)
+			outOfOrder_.store(true);
+
+		expected = seq->sequence() + 1;
+		received_.fetch_add(1);
+	}
+
+private:
+	Message::Type type_;
+	vector<unsigned int> sequences_;
+	atomic<unsigned int> received_;
+	atomic<bool> outOfOrder_;
+};
+
+class MessageThroughputTest : public Test
+{
+protected:
+	int init()
+	{
+		type_ = Message::registerMessageType();
+		thread_.start();
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		static constexpr unsigned int kMessages = 100000;
+
+		for (unsigned int producers : { 1, 2, 4 }) {
+			SequenceReceiver *receiver = new SequenceReceiver(type_, producers);
+			receiver->moveToThread(&thread_);
+
+			auto start = chrono::steady_clock::now();
+
+			vector<std::thread> threads;
+			for (unsigned int p = 0; p < producers; p++) {
+				threads.emplace_back([&, p]() {
+					for (unsigned int i = 0; i < kMessages; i++)
+						receiver->postMessage(std::make_unique<SequenceMessage>(type_, p, i));
+				});
+			}
+
+			for (std::thread &thread : threads)
+				thread.join();
+
+			const unsigned int total = producers * kMessages;
+			auto timeout = start + chrono::seconds(30);
+
+			while (receiver->received() != total &&
+			       chrono::steady_clock::now() < timeout)
+				this_thread::sleep_for(chrono::milliseconds(1));
+
+			auto end = chrono::steady_clock::now();
+			unsigned int received = receiver->received();
+			bool outOfOrder = receiver->outOfOrder();
+			receiver->deleteLater();
+
+			if (received != total) {
+				cout << "Received " << received << " messages out of "
+				     << total << endl;
+				return TestFail;
+			}
+
+			if (outOfOrder) {
+				cout << "Messages received out of order" << endl;
+				return TestFail;
+			}
+
+			double seconds = chrono::duration<double>(end - start).count();
+			cout << producers << " producer(s): "
+			     << static_cast<unsigned int>(total / seconds)
+			     << " messages/s" << endl;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Message::Type type_;
+	Thread thread_;
+};
+
+TEST_REGISTER(MessageThroughputTest)
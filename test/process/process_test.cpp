@@ -55,6 +55,13 @@ protected:
 		/* Test that kill() on an unstarted process is safe. */
 		proc_.kill();
 
+		/* Test that exec failures are reported to the caller. */
+		Process invalid;
+		if (!invalid.start("/nonexistent/libcamera/process")) {
+			cerr << "starting a nonexistent executable succeeded" << endl;
+			return TestFail;
+		}
+
 		/* Test starting the process and retrieving the exit code. */
 		int ret = proc_.start(self(), args);
 		if (ret) {
@@ -3,9 +3,11 @@
 # SPDX-License-Identifier: GPL-2.0-or-later
 # Copyright (C) 2022, Tomi Valkeinen <tomi.valkeinen@ideasonboard.com>
 
+import asyncio
 from collections import defaultdict
 import gc
 import libcamera as libcam
+from libcamera.aio import RequestCompletions
 import selectors
 import typing
 import unittest
@@ -162,6 +164,45 @@ class AllocatorTestMethods(CameraTesterBase):
         self.assertIsDead(wr_streamconfig)
 
 
+    def test_mapped_frame_buffer(self):
+        cam = self.cam
+
+        camconfig = cam.generate_configuration([libcam.StreamRole.StillCapture])
+        streamconfig = camconfig.at(0)
+
+        cam.configure(camconfig)
+
+        stream = streamconfig.stream
+
+        allocator = libcam.FrameBufferAllocator(cam)
+        allocator.allocate(stream)
+
+        buffer = allocator.buffers(stream)[0]
+
+        # Without a configuration, planes are exposed as 1D byte arrays
+        mfb = libcam.MappedFrameBuffer(buffer)
+        self.assertEqual(len(mfb.planes), len(buffer.planes))
+
+        mv = memoryview(mfb.planes[0])
+        self.assertEqual(mv.ndim, 1)
+        self.assertEqual(mv.nbytes, buffer.planes[0].length)
+
+        # With a configuration, planes are exposed as arrays of lines
+        mfb = libcam.MappedFrameBuffer(buffer, streamconfig)
+
+        mv = memoryview(mfb.planes[0])
+        self.assertIn(mv.ndim, (2, 3))
+        self.assertEqual(mv.shape[0], streamconfig.size.height)
+        self.assertEqual(mv.strides[0], streamconfig.stride)
+
+        # The data is shared between mappings of the same buffer
+        flat = memoryview(libcam.MappedFrameBuffer(buffer).planes[0])
+        flat[0] = 0x5a
+        self.assertEqual(mv[(0,) * mv.ndim], 0x5a)
+
+        mv.release()
+        flat.release()
+
 class SimpleCaptureMethods(CameraTesterBase):
     def test_blocking(self):
         cm = self.cm
@@ -299,6 +340,111 @@ class SimpleCaptureMethods(CameraTesterBase):
         cam.stop()
 
 
+    def test_ready_requests_with_metadata(self):
+        cm = self.cm
+        cam = self.cam
+
+        camconfig = cam.generate_configuration([libcam.StreamRole.StillCapture])
+        streamconfig = camconfig.at(0)
+
+        cam.configure(camconfig)
+
+        stream = streamconfig.stream
+
+        allocator = libcam.FrameBufferAllocator(cam)
+        num_bufs = allocator.allocate(stream)
+        self.assertTrue(num_bufs > 0)
+
+        reqs = []
+        for i, buffer in enumerate(allocator.buffers(stream)):
+            req = cam.create_request(i)
+            req.add_buffer(stream, buffer)
+            reqs.append(req)
+
+        buffer = None
+
+        cam.start()
+
+        for req in reqs:
+            cam.queue_request(req)
+
+        reqs = None
+        gc.collect()
+
+        sel = selectors.DefaultSelector()
+        sel.register(cm.event_fd, selectors.EVENT_READ)
+
+        ready = []
+
+        while len(ready) < num_bufs:
+            sel.select()
+            ready += cm.get_ready_requests_with_metadata()
+
+        for i, (req, metadata) in enumerate(ready):
+            self.assertTrue(i == req.cookie)
+            self.assertIsInstance(metadata, dict)
+            self.assertEqual(metadata.keys(), req.metadata.keys())
+
+        ready = None
+        gc.collect()
+
+        cam.stop()
+
+    def test_asyncio(self):
+        cm = self.cm
+        cam = self.cam
+
+        camconfig = cam.generate_configuration([libcam.StreamRole.StillCapture])
+        streamconfig = camconfig.at(0)
+
+        cam.configure(camconfig)
+
+        stream = streamconfig.stream
+
+        allocator = libcam.FrameBufferAllocator(cam)
+        num_bufs = allocator.allocate(stream)
+        self.assertTrue(num_bufs > 0)
+
+        reqs = []
+        for i, buffer in enumerate(allocator.buffers(stream)):
+            req = cam.create_request(i)
+            req.add_buffer(stream, buffer)
+            reqs.append(req)
+
+        buffer = None
+
+        async def capture():
+            with RequestCompletions(cm) as completions:
+                cam.start()
+
+                # Wait for the first request through its future.
+                req = await completions.queue_request(cam, reqs[0])
+                self.assertEqual(req.cookie, 0)
+                self.assertEqual(req.status, libcam.Request.Status.Complete)
+
+                # And for the other ones through the async iterator.
+                for req in reqs[1:]:
+                    cam.queue_request(req)
+
+                ready = []
+                async for req in completions:
+                    ready.append(req)
+                    if len(ready) == num_bufs - 1:
+                        break
+
+                return ready
+
+        ready = asyncio.run(asyncio.wait_for(capture(), 10))
+
+        for i, req in enumerate(ready):
+            self.assertEqual(i + 1, req.cookie)
+
+        reqs = None
+        ready = None
+        gc.collect()
+
+        cam.stop()
+
 # Recursively expand slist's objects into olist, using seen to track already
 # processed objects.
 def _getr(slist, olist, seen):
@@ -11,6 +11,8 @@
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 
+#include <libcamera/ipa/ipa_controls.h>
+
 #include "libcamera/internal/byte_stream_buffer.h"
 #include "libcamera/internal/control_serializer.h"
 
@@ -169,6 +171,35 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Serialize the control info map again, only a reference to
+		 * the cached map should be transferred.
+		 */
+		size = serializer.binarySize(infoMap);
+		if (size != sizeof(struct ipa_controls_header)) {
+			cerr << "Cached ControlInfoMap should be serialized as a reference"
+			     << endl;
+			return TestFail;
+		}
+
+		infoData.resize(size);
+		buffer = ByteStreamBuffer(infoData.data(), infoData.size());
+
+		ret = serializer.serialize(infoMap, buffer);
+		if (ret < 0 || buffer.overflow()) {
+			cerr << "Failed to serialize cached ControlInfoMap" << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+					  infoData.size());
+
+		newInfoMap = deserializer.deserialize<ControlInfoMap>(buffer);
+		if (!equals(infoMap, newInfoMap)) {
+			cerr << "Cached ControlInfoMap doesn't match original" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
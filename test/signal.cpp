@@ -74,6 +74,11 @@ protected:
 		signalVoid_.disconnect(this, &SignalTest::slotDisconnect);
 	}
 
+	void slotDisconnectOther()
+	{
+		signalVoid_.disconnect(this, &SignalTest::slotVoid);
+	}
+
 	void slotInteger1(int value)
 	{
 		values_[0] = value;
@@ -184,6 +189,23 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test disconnection of a slot from a previous slot during the
+		 * same emission.
+		 */
+		signalVoid_.connect(this, &SignalTest::slotDisconnectOther);
+		signalVoid_.connect(this, &SignalTest::slotVoid);
+
+		called_ = false;
+		signalVoid_.emit();
+
+		if (called_) {
+			cout << "Signal disconnection during emission test failed" << endl;
+			return TestFail;
+		}
+
+		signalVoid_.disconnect();
+
 		/*
 		 * Test connecting to slots that return a value. This targets
 		 * compilation, there's no need to check runtime results.
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Thread event loop statistics test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <libcamera/base/message.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_statistics.h>
+#include <libcamera/base/timer.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+class SlowReceiver : public Object
+{
+public:
+	SlowReceiver()
+		: timer_(this), messages_(0), timeouts_(0)
+	{
+		timer_.timeout.connect(this, &SlowReceiver::timeout);
+	}
+
+	void startTimer()
+	{
+		timer_.start(10ms);
+	}
+
+	unsigned int messages() const { return messages_; }
+	unsigned int timeouts() const { return timeouts_; }
+
+protected:
+	void message(Message *msg) override
+	{
+		if (msg->type() != Message::UserMessage) {
+			Object::message(msg);
+			return;
+		}
+
+		this_thread::sleep_for(1ms);
+		messages_++;
+	}
+
+private:
+	void timeout()
+	{
+		timeouts_++;
+	}
+
+	Timer timer_;
+	unsigned int messages_;
+	unsigned int timeouts_;
+};
+
+namespace {
+
+std::atomic<unsigned int> traceEvents{ 0 };
+
+void traceHook([[maybe_unused]] const ThreadTraceEvent &event)
+{
+	traceEvents++;
+}
+
+} /* namespace */
+
+class ThreadStatisticsTest : public Test
+{
+protected:
+	int init()
+	{
+		thread_.setStatisticsEnabled(true);
+		thread_.start();
+
+		receiver_ = new SlowReceiver();
+		receiver_->moveToThread(&thread_);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		static constexpr unsigned int kNumMessages = 10;
+
+		ThreadStatisticsRecorder::setTraceHook(traceHook);
+
+		/* Post messages in a burst to fill the queue. */
+		for (unsigned int i = 0; i < kNumMessages; ++i)
+			receiver_->postMessage(std::make_unique<Message>(Message::UserMessage));
+
+		receiver_->invokeMethod(&SlowReceiver::startTimer,
+				       ConnectionTypeQueued);
+
+		this_thread::sleep_for(100ms);
+
+		ThreadStatisticsRecorder::setTraceHook(nullptr);
+
+		ThreadStatistics stats = thread_.statistics();
+
+		if (receiver_->messages() != kNumMessages || !receiver_->timeouts()) {
+			cout << "Messages or timeouts not received" << endl;
+			return TestFail;
+		}
+
+		if (stats.messages != kNumMessages + 1) {
+			cout << "Invalid message count " << stats.messages << endl;
+			return TestFail;
+		}
+
+		if (stats.events != stats.messages + receiver_->timeouts()) {
+			cout << "Invalid event count " << stats.events << endl;
+			return TestFail;
+		}
+
+		if (stats.maxQueueDepth < 2) {
+			cout << "Invalid maximum queue depth " << stats.maxQueueDepth
+			     << endl;
+			return TestFail;
+		}
+
+		/* The last message waited for all previous messages. */
+		if (stats.maxLatency < 5ms) {
+			cout << "Invalid maximum latency " << stats.maxLatency << endl;
+			return TestFail;
+		}
+
+		if (!stats.idleTime || stats.idleTime > stats.elapsed) {
+			cout << "Invalid idle time " << stats.idleTime << endl;
+			return TestFail;
+		}
+
+		if (traceEvents != stats.events) {
+			cout << "Invalid trace event count " << traceEvents << endl;
+			return TestFail;
+		}
+
+		if (stats.handlers.empty() ||
+		    stats.handlers[0].name != "SlowReceiver" ||
+		    stats.handlers[0].count != stats.events ||
+		    stats.handlers[0].totalTime < kNumMessages * 1ms) {
+			cout << "Invalid handler statistics" << endl;
+			return TestFail;
+		}
+
+		/* Reset the statistics and make sure they restart from scratch. */
+		thread_.resetStatistics();
+		stats = thread_.statistics();
+
+		if (stats.messages || stats.events || !stats.handlers.empty()) {
+			cout << "Statistics not reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		receiver_->deleteLater();
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	SlowReceiver *receiver_;
+	Thread thread_;
+};
+
+TEST_REGISTER(ThreadStatisticsTest)
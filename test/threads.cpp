@@ -9,6 +9,8 @@
 #include <iostream>
 #include <memory>
 #include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <thread>
 #include <time.h>
 
@@ -66,6 +68,38 @@ private:
 	bool &cancelled_;
 };
 
+class AttributesThread : public Thread
+{
+public:
+	AttributesThread(const std::string &name)
+		: Thread(name), cpus_(0)
+	{
+	}
+
+	const std::string &systemName() const { return systemName_; }
+	unsigned int cpus() const { return cpus_; }
+	bool cpu0() const { return cpu0_; }
+
+protected:
+	void run()
+	{
+		char name[16] = {};
+		pthread_getname_np(pthread_self(), name, sizeof(name));
+		systemName_ = name;
+
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		sched_getaffinity(0, sizeof(cpuset), &cpuset);
+		cpus_ = CPU_COUNT(&cpuset);
+		cpu0_ = CPU_ISSET(0, &cpuset);
+	}
+
+private:
+	std::string systemName_;
+	unsigned int cpus_;
+	bool cpu0_;
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -165,6 +199,41 @@ protected:
 			return TestFail;
 		}
 
+		/* Test the thread name and CPU affinity. */
+		const unsigned int cpu = 0;
+		AttributesThread attrThread("test-thread-attributes");
+
+		if (attrThread.setAffinity({ &cpu, 1 }) < 0) {
+			cout << "Failed to set thread affinity" << endl;
+			return TestFail;
+		}
+
+		attrThread.start();
+		attrThread.wait();
+
+		if (attrThread.systemName() != "test-thread-att") {
+			cout << "Invalid thread name " << attrThread.systemName()
+			     << endl;
+			return TestFail;
+		}
+
+		if (attrThread.cpus() != 1 || !attrThread.cpu0()) {
+			cout << "Thread affinity not applied" << endl;
+			return TestFail;
+		}
+
+		/* Test that default attributes apply to named threads. */
+		AttributesThread defaultThread("test-default");
+		Thread::setDefaultAffinity("test-default", { &cpu, 1 });
+
+		defaultThread.start();
+		defaultThread.wait();
+
+		if (defaultThread.cpus() != 1 || !defaultThread.cpu0()) {
+			cout << "Default thread affinity not applied" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -7,6 +7,8 @@
 
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <libcamera/base/event_dispatcher.h>
 #include <libcamera/base/thread.h>
@@ -190,6 +192,37 @@ protected:
 			return TestFail;
 		}
 
+		/* Multiple timers restarted out of order. */
+		std::vector<std::unique_ptr<ManagedTimer>> timers;
+		for (unsigned int i = 0; i < 16; i++)
+			timers.push_back(std::make_unique<ManagedTimer>());
+
+		for (unsigned int round = 0; round < 3; round++) {
+			for (unsigned int i = 0; i < timers.size(); i++) {
+				unsigned int index = (i * 7 + round) % timers.size();
+				timers[index]->start(std::chrono::milliseconds(100 + 20 * i));
+			}
+		}
+
+		timers[3]->stop();
+
+		for (unsigned int i = 0; i < 100; i++) {
+			bool running = false;
+			for (const auto &t : timers)
+				running |= t->isRunning();
+			if (!running)
+				break;
+
+			dispatcher->processEvents();
+		}
+
+		for (unsigned int i = 0; i < timers.size(); i++) {
+			if (i == 3 ? timers[i]->isRunning() : timers[i]->hasFailed()) {
+				cout << "Multiple timers test failed" << endl;
+				return TestFail;
+			}
+		}
+
 		/*
 		 * Test that dynamically allocated timers are stopped when
 		 * deleted. This will result in a crash on failure.
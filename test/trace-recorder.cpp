@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * TraceRecorder tests
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "libcamera/internal/trace_recorder.h"
+#include "libcamera/internal/tracepoints.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class TraceRecorderTest : public Test
+{
+protected:
+	static unsigned int count(const string &str, const string &pattern)
+	{
+		unsigned int n = 0;
+
+		for (size_t pos = str.find(pattern); pos != string::npos;
+		     pos = str.find(pattern, pos + 1))
+			n++;
+
+		return n;
+	}
+
+	int run()
+	{
+		TraceRecorder *recorder = TraceRecorder::instance();
+
+		recorder->enable(4);
+		if (!recorder->isEnabled()) {
+			cout << "Failed to enable the trace recorder" << endl;
+			return TestFail;
+		}
+
+		LIBCAMERA_TRACEPOINT_IPA_BEGIN(test, process);
+		LIBCAMERA_TRACEPOINT_IPA_END(test, process);
+
+		thread worker([]() {
+			LIBCAMERA_TRACEPOINT(frame_process_begin, "test", "stage \"1\"", 42);
+			LIBCAMERA_TRACEPOINT(frame_process_end, "test", "stage \"1\"", 42);
+		});
+		worker.join();
+
+		stringstream stream;
+		if (recorder->exportTrace(stream)) {
+			cout << "Failed to export trace" << endl;
+			return TestFail;
+		}
+
+		string trace = stream.str();
+
+		if (trace.find("{\"displayTimeUnit\"") != 0 ||
+		    trace.find("\n]}\n") != trace.size() - 4) {
+			cout << "Invalid trace format" << endl;
+			return TestFail;
+		}
+
+		if (count(trace, "\"name\":\"ipa_call\"") != 2 ||
+		    count(trace, "\"ph\":\"B\"") != 2 ||
+		    count(trace, "\"ph\":\"E\"") != 2 ||
+		    count(trace, "\"function_name\":\"process\"") != 2) {
+			cout << "IPA call events not recorded" << endl;
+			return TestFail;
+		}
+
+		/* Strings shall be escaped, and events tagged with their thread. */
+		if (count(trace, "\"stage\":\"stage \\\"1\\\"\"") != 2 ||
+		    count(trace, "\"sequence\":42") != 2 ||
+		    count(trace, "\"name\":\"thread_name\"") != 2) {
+			cout << "Frame processing events not recorded" << endl;
+			return TestFail;
+		}
+
+		/* The ring shall keep the most recent events only. */
+		LIBCAMERA_TRACEPOINT(ipa_signal, "test", "signal");
+
+		stream.str("");
+		recorder->exportTrace(stream);
+		trace = stream.str();
+
+		if (count(trace, "\"name\":\"ipa_call\"") != 1 ||
+		    count(trace, "\"name\":\"ipa_signal\"") != 1) {
+			cout << "Invalid ring overflow behaviour" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TraceRecorderTest)
@@ -12,6 +12,7 @@
 
 #include <libcamera/base/utils.h>
 
+#include "libcamera/internal/media_device.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 
 #include "v4l2_subdevice_test.h"
@@ -126,6 +126,50 @@ public:
 		return TestPass;
 	}
 
+	/*
+	 * Test that a buffer wrapping the same dmabufs through different file
+	 * descriptors is matched to the same V4L2 buffer, as happens when
+	 * buffers are imported multiple times by an external allocator.
+	 */
+	int testDuplicatedFds(V4L2BufferCache *cache,
+			      const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+	{
+		V4L2BufferCache::Statistics before = cache->statistics();
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+			int index = cache->get(*buffer.get());
+			if (index < 0)
+				return TestFail;
+
+			cache->put(index);
+
+			std::vector<FrameBuffer::Plane> planes = buffer->planes();
+			for (FrameBuffer::Plane &plane : planes)
+				plane.fd = SharedFD(plane.fd.get());
+
+			FrameBuffer duplicate(planes);
+
+			int duplicateIndex = cache->get(duplicate);
+			if (duplicateIndex != index) {
+				std::cout << "Expected index " << index
+					  << " for duplicated buffer, got "
+					  << duplicateIndex << std::endl;
+				return TestFail;
+			}
+
+			cache->put(duplicateIndex);
+		}
+
+		const V4L2BufferCache::Statistics &after = cache->statistics();
+		if (after.evictions != before.evictions) {
+			std::cout << "Duplicated buffers caused evictions"
+				  << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testIsEmpty(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
 	{
 		V4L2BufferCache cache(buffers.size());
@@ -200,6 +244,18 @@ public:
 		if (testSequential(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
+		/* All lookups in a pre-populated cache shall hit. */
+		const V4L2BufferCache::Statistics &stats = cacheFromBuffers.statistics();
+		if (stats.hits != numBuffers * 100 || stats.misses || stats.evictions) {
+			std::cout << "Unexpected cache statistics: " << stats.hits
+				  << " hits, " << stats.misses << " misses, "
+				  << stats.evictions << " evictions" << std::endl;
+			return TestFail;
+		}
+
+		if (testDuplicatedFds(&cacheFromBuffers, buffers) != TestPass)
+			return TestFail;
+
 		if (testRandom(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * Media controller request API test
+ */
+
+#include <iostream>
+
+#include <libcamera/framebuffer.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "libcamera/internal/media_request.h"
+
+#include "v4l2_videodevice_test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+class MediaRequestTest : public V4L2VideoDeviceTest
+{
+public:
+	MediaRequestTest()
+		: V4L2VideoDeviceTest("vivid", "vivid-000-vid-cap"),
+		  buffersCompleted_(0), requestsCompleted_(0)
+	{
+	}
+
+protected:
+	void bufferComplete([[maybe_unused]] FrameBuffer *buffer)
+	{
+		buffersCompleted_++;
+	}
+
+	void requestComplete([[maybe_unused]] MediaRequest *request)
+	{
+		requestsCompleted_++;
+	}
+
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+
+		if (!capture_->supportsRequests()) {
+			cout << "Device doesn't support requests" << endl;
+			return TestSkip;
+		}
+
+		if (!media_->acquire())
+			return TestFail;
+
+		std::vector<std::unique_ptr<MediaRequest>> requests;
+		int ret = media_->allocateRequests(bufferCount, &requests);
+		media_->release();
+		if (ret == -ENOTTY)
+			return TestSkip;
+		if (ret || requests.size() != bufferCount) {
+			cerr << "Failed to allocate requests" << endl;
+			return TestFail;
+		}
+
+		ret = capture_->allocateBuffers(bufferCount, &buffers_);
+		if (ret < 0) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		capture_->bufferReady.connect(this, &MediaRequestTest::bufferComplete);
+
+		const ControlInfo &brightness =
+			capture_->controls().find(V4L2_CID_BRIGHTNESS)->second;
+		int32_t minBrightness = brightness.min().get<int32_t>();
+
+		/* Bind a different brightness value to each buffer. */
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			MediaRequest *request = requests[i].get();
+			request->completed.connect(this, &MediaRequestTest::requestComplete);
+
+			ControlList ctrls(capture_->controls());
+			ctrls.set(V4L2_CID_BRIGHTNESS, minBrightness + static_cast<int32_t>(i));
+
+			if (capture_->setControls(&ctrls, request)) {
+				cerr << "Failed to set controls in request" << endl;
+				return TestFail;
+			}
+
+			if (capture_->queueBuffer(buffers_[i].get(), request)) {
+				cerr << "Failed to queue buffer in request" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Buffers in requests shall not complete before the requests are queued. */
+		for (const std::unique_ptr<MediaRequest> &request : requests) {
+			if (request->queue()) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		timeout.start(1000ms);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (requestsCompleted_ == bufferCount &&
+			    buffersCompleted_ == bufferCount)
+				break;
+		}
+
+		if (requestsCompleted_ != bufferCount ||
+		    buffersCompleted_ != bufferCount) {
+			cerr << "Completed " << requestsCompleted_ << " requests and "
+			     << buffersCompleted_ << " buffers, expected "
+			     << bufferCount << endl;
+			return TestFail;
+		}
+
+		/* Each request shall report the control value it applied. */
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			MediaRequest *request = requests[i].get();
+
+			if (request->status() != MediaRequest::Status::Complete) {
+				cerr << "Invalid request status" << endl;
+				return TestFail;
+			}
+
+			ControlList ctrls = capture_->getControls({ V4L2_CID_BRIGHTNESS },
+								  request);
+			if (ctrls.get(V4L2_CID_BRIGHTNESS).get<int32_t>() !=
+			    minBrightness + static_cast<int32_t>(i)) {
+				cerr << "Invalid control value in request " << i << endl;
+				return TestFail;
+			}
+		}
+
+		ControlList ctrls = capture_->getControls({ V4L2_CID_BRIGHTNESS });
+		if (ctrls.get(V4L2_CID_BRIGHTNESS).get<int32_t>() !=
+		    minBrightness + static_cast<int32_t>(bufferCount - 1)) {
+			cerr << "Control values from requests not applied" << endl;
+			return TestFail;
+		}
+
+		/* Completed requests can be recycled. */
+		if (requests[0]->reinit() ||
+		    requests[0]->status() != MediaRequest::Status::Idle) {
+			cerr << "Failed to reinitialize request" << endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	unsigned int buffersCompleted_;
+	unsigned int requestsCompleted_;
+};
+
+TEST_REGISTER(MediaRequestTest)
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2024, Google Inc.
+ *
+ * YAML parser binary cache tests
+ */
+
+#include <dirent.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/file.h>
+
+#include "libcamera/internal/yaml_parser.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+static const string testYaml =
+	"string: libcamera\n"
+	"double: 3.14159\n"
+	"size: [1920, 1080]\n"
+	"empty: []\n"
+	"list:\n"
+	"  - James\n"
+	"  - Mary\n"
+	"  - James\n"
+	"dictionary:\n"
+	"  a: 1\n"
+	"  c: 3\n"
+	"  b: 2\n"
+	"level1:\n"
+	"  level2:\n"
+	"    - [1, 2]\n"
+	"    - {one: 1, two: 2}\n";
+
+class YamlParserCacheTest : public Test
+{
+protected:
+	bool writeFile(const string &filename, const string &content)
+	{
+		File file(filename);
+		if (!file.open(File::OpenModeFlag::WriteOnly))
+			return false;
+
+		Span<const uint8_t> data{ reinterpret_cast<const uint8_t *>(content.data()),
+					  content.size() };
+		return file.write(data) == static_cast<ssize_t>(content.size());
+	}
+
+	vector<string> cacheFiles()
+	{
+		vector<string> files;
+
+		DIR *dir = opendir(dir_.c_str());
+		if (!dir)
+			return files;
+
+		while (struct dirent *ent = readdir(dir)) {
+			string name = ent->d_name;
+			if (name != "." && name != "..")
+				files.push_back(dir_ + "/" + name);
+		}
+
+		closedir(dir);
+		return files;
+	}
+
+	unique_ptr<YamlObject> parse()
+	{
+		File file(yamlFile_);
+		if (!file.open(File::OpenModeFlag::ReadOnly))
+			return nullptr;
+
+		return YamlParser::parse(file);
+	}
+
+	bool equal(const YamlObject &a, const YamlObject &b)
+	{
+		if (a.isValue() != b.isValue() || a.isList() != b.isList() ||
+		    a.isDictionary() != b.isDictionary())
+			return false;
+
+		if (a.isValue())
+			return a.get<string>() == b.get<string>();
+
+		if (a.size() != b.size())
+			return false;
+
+		if (a.isList()) {
+			for (size_t i = 0; i < a.size(); i++) {
+				if (!equal(a[i], b[i]))
+					return false;
+			}
+
+			return true;
+		}
+
+		auto itB = b.asDict().begin();
+		for (const auto &[key, value] : a.asDict()) {
+			const auto &[keyB, valueB] = *itB;
+			if (key != keyB || !equal(value, valueB))
+				return false;
+			++itB;
+		}
+
+		return true;
+	}
+
+	int init()
+	{
+		char dir[] = "/tmp/libcamera.test.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+		yamlFile_ = dir_ + ".yaml";
+
+		setenv("LIBCAMERA_YAML_CACHE_DIR", dir_.c_str(), 1);
+
+		if (!writeFile(yamlFile_, testYaml)) {
+			cerr << "Failed to create test YAML file" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* Parse the YAML file and populate the cache. */
+		unique_ptr<YamlObject> reference = parse();
+		if (!reference) {
+			cerr << "Failed to parse test YAML file" << endl;
+			return TestFail;
+		}
+
+		vector<string> files = cacheFiles();
+		if (files.size() != 1) {
+			cerr << "Cache not created" << endl;
+			return TestFail;
+		}
+
+		/* Load the YAML file from the cache. */
+		unique_ptr<YamlObject> root = parse();
+		if (!root || !equal(*reference, *root)) {
+			cerr << "Cached YAML content differs" << endl;
+			return TestFail;
+		}
+
+		if ((*root)["dictionary"]["c"].get<int32_t>(0) != 3 ||
+		    (*root)["level1"]["level2"][1]["two"].get<int32_t>(0) != 2) {
+			cerr << "Cached dictionary lookup failed" << endl;
+			return TestFail;
+		}
+
+		/* A corrupted cache shall be ignored. */
+		if (!writeFile(files[0], "Invalid cache content")) {
+			cerr << "Failed to corrupt cache" << endl;
+			return TestFail;
+		}
+
+		root = parse();
+		if (!root || !equal(*reference, *root)) {
+			cerr << "Failed to parse YAML file with corrupted cache" << endl;
+			return TestFail;
+		}
+
+		/* A modified YAML file shall not use the stale cache. */
+		if (!writeFile(yamlFile_, testYaml + "extra: 42\n")) {
+			cerr << "Failed to modify test YAML file" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < 2; i++) {
+			root = parse();
+			if (!root || (*root)["extra"].get<int32_t>(0) != 42) {
+				cerr << "Stale cache used for modified YAML file" << endl;
+				return TestFail;
+			}
+		}
+
+		/* An empty cache directory disables the cache. */
+		for (const string &file : cacheFiles())
+			unlink(file.c_str());
+
+		setenv("LIBCAMERA_YAML_CACHE_DIR", "", 1);
+
+		root = parse();
+		if (!root || !cacheFiles().empty()) {
+			cerr << "Cache created while disabled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		for (const string &file : cacheFiles())
+			unlink(file.c_str());
+
+		rmdir(dir_.c_str());
+		unlink(yamlFile_.c_str());
+	}
+
+private:
+	string dir_;
+	string yamlFile_;
+};
+
+TEST_REGISTER(YamlParserCacheTest)
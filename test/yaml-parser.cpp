@@ -547,6 +547,18 @@ protected:
 			return TestFail;
 		}
 
+		const auto &span = firstElement.getSpan<double>();
+		if (!span || span->size() != 2 || (*span)[0] != 1.0 || (*span)[1] != 2.0) {
+			cerr << "getSpan() failed to return correct span" << std::endl;
+			return TestFail;
+		}
+
+		if (listObj.getSpan<double>() || level2Obj.getSpan<double>() ||
+		    sizeObj.getSpan<double>()->size() != 2) {
+			cerr << "getSpan() returned invalid span" << std::endl;
+			return TestFail;
+		}
+
 		auto &secondElement = level2Obj[1];
 		if (!secondElement.isDictionary() ||
 		    !secondElement.contains("one") ||
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2024, Google Inc.
+#
+# Convert a libcamera binary log file to text
+#
+# Binary log files are produced by setting the LIBCAMERA_LOG_FORMAT environment
+# variable to "binary" along with LIBCAMERA_LOG_FILE. The output matches the
+# format of text log files.
+
+import argparse
+import struct
+import sys
+
+magic = b'LCBLOG'
+version = 1
+
+record_message = 0
+record_category = 1
+record_text = 2
+
+severities = ['DEBUG', 'INFO', 'WARN', 'ERROR', 'FATAL']
+
+header_fmt = struct.Struct('=6sH')
+category_fmt = struct.Struct('=HH')
+message_fmt = struct.Struct('=BHIQHHI')
+text_fmt = struct.Struct('=I')
+
+
+class DecodeError(Exception):
+    pass
+
+
+def read(f, size):
+    data = f.read(size)
+    if len(data) != size:
+        raise DecodeError('Truncated record')
+    return data
+
+
+def format_timestamp(nsecs):
+    secs = nsecs // 1000000000
+    return '%u:%02u:%02u.%09u' % (secs // 3600, (secs // 60) % 60, secs % 60,
+                                  nsecs % 1000000000)
+
+
+def format_severity(severity):
+    if severity < len(severities):
+        return severities[severity]
+    return 'UNKN'
+
+
+def decode(f, out):
+    header = f.read(header_fmt.size)
+    if len(header) != header_fmt.size:
+        raise DecodeError('File too short')
+
+    file_magic, file_version = header_fmt.unpack(header)
+    if file_magic != magic:
+        raise DecodeError('Not a libcamera binary log file')
+    if file_version != version:
+        raise DecodeError(f'Unsupported version {file_version}')
+
+    categories = {}
+
+    while True:
+        record_type = f.read(1)
+        if not record_type:
+            break
+
+        record_type = record_type[0]
+
+        if record_type == record_category:
+            id, length = category_fmt.unpack(read(f, category_fmt.size))
+            categories[id] = read(f, length).decode('utf-8', 'replace')
+
+        elif record_type == record_message:
+            severity, category, thread, timestamp, file_length, \
+                prefix_length, msg_length = message_fmt.unpack(read(f, message_fmt.size))
+
+            file_info = read(f, file_length).decode('utf-8', 'replace')
+            prefix = read(f, prefix_length).decode('utf-8', 'replace')
+            msg = read(f, msg_length).decode('utf-8', 'replace')
+
+            line = f'[{format_timestamp(timestamp)}] [{thread}] ' \
+                   f'{format_severity(severity)} ' \
+                   f'{categories.get(category, "unknown")} {file_info} '
+            if prefix:
+                line += f'{prefix}: '
+            line += msg
+
+            out.write(line)
+
+        elif record_type == record_text:
+            length, = text_fmt.unpack(read(f, text_fmt.size))
+            out.write(read(f, length).decode('utf-8', 'replace'))
+
+        else:
+            raise DecodeError(f'Invalid record type {record_type}')
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Convert a libcamera binary log file to text')
+    parser.add_argument('-o', '--output', type=str, default='-',
+                        help='Output file name, defaults to standard output')
+    parser.add_argument('input', type=str,
+                        help='Binary log file name')
+    args = parser.parse_args(argv[1:])
+
+    if args.output == '-':
+        out = sys.stdout
+    else:
+        out = open(args.output, 'w')
+
+    try:
+        with open(args.input, 'rb') as f:
+            decode(f, out)
+    except DecodeError as e:
+        print(f'{args.input}: {e}', file=sys.stderr)
+        return 1
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -238,6 +238,7 @@ ${vendor_controls_str}
         'controls_doc': '\n\n'.join(ctrls_doc['libcamera']),
         'controls_def': '\n'.join(ctrls_def['libcamera']),
         'controls_map': '\n'.join(ctrls_map),
+        'controls_count': len(ctrls_map),
         'vendor_controls_doc': '\n'.join(vendor_ctrl_doc_sub),
         'vendor_controls_def': '\n'.join(vendor_ctrl_def_sub),
     }
@@ -17,61 +17,165 @@ timestamps = {}
 # pipeline:function -> samples[]
 samples = {}
 
+# request -> {'start': timestamp, 'stages': [(stage, timestamp)]}
+requests = {}
+
+# sequence -> request, for events that are not bound to a request
+sequences = {}
+
+# stage -> latency samples[]
+stage_samples = {}
+
+
+def process_ipa_call(event, payload, timestamp_ns):
+    pipeline = payload['pipeline_name']
+    func = payload['function_name']
+
+    if event == 'libcamera:ipa_call_begin':
+        if pipeline not in timestamps:
+            timestamps[pipeline] = {}
+        if func not in timestamps[pipeline]:
+            timestamps[pipeline][func] = []
+        timestamps[pipeline][func].append(timestamp_ns)
+
+    if event == 'libcamera:ipa_call_end':
+        if not timestamps.get(pipeline, {}).get(func):
+            return
+        ts = timestamps[pipeline][func].pop()
+        key = f'{pipeline}:{func}'
+        if key not in samples:
+            samples[key] = []
+        samples[key].append(timestamp_ns - ts)
+
+
+def add_stage(request, stage, timestamp_ns):
+    if request in requests:
+        requests[request]['stages'].append((stage, timestamp_ns))
+
+
+def process_frame(event, payload, timestamp_ns, pipeline):
+    if event == 'libcamera:request_device_queue':
+        requests[int(payload['request'])] = {'start': timestamp_ns, 'stages': []}
+        return
+
+    if event == 'libcamera:v4l2_buffer_dequeue':
+        device = str(payload['device'])
+        request = int(payload['request'])
+
+        if not request:
+            request = sequences.get(int(payload['sequence']), 0)
+        add_stage(request, f'dqbuf:{device}', timestamp_ns)
+        return
+
+    if event != 'libcamera:frame_stage':
+        return
+
+    name = str(payload['pipeline_name'])
+    if pipeline is not None and not name.startswith(pipeline):
+        return
+
+    stage = f'{name}:{payload["stage"]}'
+    request = int(payload['request'])
+    sequence = int(payload['sequence'])
+
+    if request:
+        sequences[sequence] = request
+    else:
+        request = sequences.get(sequence, 0)
+
+    if request not in requests:
+        return
+
+    if payload['stage'] != 'deliver':
+        add_stage(request, stage, timestamp_ns)
+        return
+
+    info = requests.pop(request)
+    for key, ts in info['stages'] + [(stage, timestamp_ns)]:
+        if key not in stage_samples:
+            stage_samples[key] = []
+        stage_samples[key].append(ts - info['start'])
+
+
+def print_table(rows):
+    # Get maximum string width for every column
+    widths = []
+    for i in range(len(rows[0])):
+        widths.append(max([len(row[i]) for row in rows]))
+
+    # Print stats table
+    for row in rows:
+        fmt = [row[i].rjust(widths[i]) for i in range(1, len(row))]
+        print(' '.join([row[0].ljust(widths[0])] + fmt))
+
+
+def print_ipa_stats():
+    rows = []
+    rows.append(['pipeline:function', 'min', 'max', 'mean', 'stddev'])
+    for k, v in samples.items():
+        mean = int(stats.mean(v))
+        stddev = int(stats.stdev(v)) if len(v) > 1 else 0
+        minv = min(v)
+        maxv = max(v)
+        rows.append([k, str(minv), str(maxv), str(mean), str(stddev)])
+
+    print_table(rows)
+
+
+def print_frame_stats():
+    # Sort the stages by their mean latency to follow the frame processing
+    # order.
+    values = sorted(stage_samples.items(), key=lambda kv: stats.mean(kv[1]))
+
+    rows = []
+    rows.append(['stage', 'frames', 'min', 'max', 'mean', 'stddev'])
+    for k, v in values:
+        v = [s / 1000 for s in v]
+        mean = stats.mean(v)
+        stddev = stats.stdev(v) if len(v) > 1 else 0
+        rows.append([k, str(len(v)), f'{min(v):.1f}', f'{max(v):.1f}',
+                     f'{mean:.1f}', f'{stddev:.1f}'])
+
+    print('Latency from request device queue, in microseconds')
+    print_table(rows)
+
+
 def main(argv):
     parser = argparse.ArgumentParser(
             description='A simple analysis script to get statistics on time taken for IPA calls')
     parser.add_argument('-p', '--pipeline', type=str,
                         help='Name of pipeline to filter for')
+    parser.add_argument('-f', '--frames', action='store_true',
+                        help='Report the per-stage latency breakdown of frames instead of IPA calls')
     parser.add_argument('trace_path', type=str,
                         help='Path to lttng trace (eg. ~/lttng-traces/demo-20201029-184003)')
     args = parser.parse_args(argv[1:])
 
     traces = bt2.TraceCollectionMessageIterator(args.trace_path)
     for msg in traces:
-        if type(msg) is not bt2._EventMessageConst or \
-           'pipeline_name' not in msg.event.payload_field or \
-           (args.pipeline is not None and \
-            msg.event.payload_field['pipeline_name'] != args.pipeline):
+        if type(msg) is not bt2._EventMessageConst:
             continue
 
-        pipeline = msg.event.payload_field['pipeline_name']
         event = msg.event.name
-        func = msg.event.payload_field['function_name']
+        payload = msg.event.payload_field
         timestamp_ns = msg.default_clock_snapshot.ns_from_origin
 
-        if event == 'libcamera:ipa_call_begin':
-            if pipeline not in timestamps:
-                timestamps[pipeline] = {}
-            if func not in timestamps[pipeline]:
-                timestamps[pipeline][func] = []
-            timestamps[pipeline][func].append(timestamp_ns)
-
-        if event == 'libcamera:ipa_call_end':
-            ts = timestamps[pipeline][func].pop()
-            key = f'{pipeline}:{func}'
-            if key not in samples:
-                samples[key] = []
-            samples[key].append(timestamp_ns - ts)
-
-    # Compute stats
-    rows = []
-    rows.append(['pipeline:function', 'min', 'max', 'mean', 'stddev'])
-    for k, v in samples.items():
-        mean = int(stats.mean(v))
-        stddev = int(stats.stdev(v))
-        minv = min(v)
-        maxv = max(v)
-        rows.append([k, str(minv), str(maxv), str(mean), str(stddev)])
+        if args.frames:
+            process_frame(event, payload, timestamp_ns, args.pipeline)
+            continue
 
-    # Get maximum string width for every column
-    widths = []
-    for i in range(len(rows[0])):
-        widths.append(max([len(row[i]) for row in rows]))
+        if event not in ['libcamera:ipa_call_begin', 'libcamera:ipa_call_end'] or \
+           (args.pipeline is not None and \
+            payload['pipeline_name'] != args.pipeline):
+            continue
+
+        process_ipa_call(event, payload, timestamp_ns)
+
+    if args.frames:
+        print_frame_stats()
+    else:
+        print_ipa_stats()
 
-    # Print stats table
-    for row in rows:
-        fmt = [row[i].rjust(widths[i]) for i in range(1, 5)]
-        print('{} {} {} {} {}'.format(row[0].ljust(widths[0]), *fmt))
 
 if __name__ == '__main__':
     sys.exit(main(sys.argv))